@@ -18,11 +18,7 @@
 #include <maxscale/log_manager.h>
 #include <errno.h>
 
-/** Maximum byte size of an integer value */
-#define MAX_INTEGER_SIZE 10
-
 #define avro_decode(n) ((n >> 1) ^ -(n & 1))
-#define encode_long(n) ((n << 1) ^ (n >> 63))
 #define more_bytes(b) (b & 0x80)
 
 /**
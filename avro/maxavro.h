@@ -24,6 +24,12 @@
 #define AVRO_MAGIC_SIZE 4
 #define SYNC_MARKER_SIZE 16
 
+/** Maximum byte size of an integer value */
+#define MAX_INTEGER_SIZE 10
+
+/** Zigzag encoding of a signed integer value */
+#define encode_long(n) (((n) << 1) ^ (uint64_t)((int64_t)(n) >> 63))
+
 /** The file magic */
 static const char avro_magic[] = {0x4f, 0x62, 0x6a, 0x01};
 
@@ -85,6 +91,7 @@ typedef struct
                          * is made later when new data is available. We need
                          * to know when to read it and when not to.  */
     enum maxavro_error last_error; /*< Last error */
+    struct maxavro_reader *reader; /*< Reader of all fields, used for JSON */
     uint8_t sync[SYNC_MARKER_SIZE];
 } MAXAVRO_FILE;
 
@@ -106,6 +113,28 @@ typedef struct
     size_t size;
 } MAXAVRO_RECORD;
 
+/** A field value read from a record */
+typedef struct
+{
+    MAXAVRO_SCHEMA_FIELD *field; /*< The field of the value */
+    MAXAVRO_RECORD_VALUE value;  /*< The value, strings and bytes are null-terminated */
+    size_t size;                 /*< Length of a string or bytes value */
+} MAXAVRO_VALUE;
+
+/**
+ * A reader compiled from the schema of a file. It decodes the requested fields
+ * of the records and skips the rest without decoding them.
+ */
+typedef struct maxavro_reader
+{
+    MAXAVRO_SCHEMA *schema; /*< The schema of the file */
+    int *targets;           /*< Value index of each schema field, -1 if skipped */
+    MAXAVRO_VALUE *values;  /*< The values of the last read record */
+    size_t num_values;      /*< Number of values */
+    char *buffer;           /*< Storage for the string values */
+    size_t buffersize;      /*< Size of the string storage */
+} MAXAVRO_READER;
+
 typedef struct
 {
     uint8_t *buffer; /*< Buffer memory */
@@ -150,10 +179,16 @@ void maxavro_map_free(MAXAVRO_MAP *value);
 
 /** Reading and seeking records */
 json_t* maxavro_record_read_json(MAXAVRO_FILE *file);
+MAXAVRO_VALUE* maxavro_record_read_values(MAXAVRO_FILE *file, MAXAVRO_READER *reader);
 GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file);
 bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset);
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos);
 bool maxavro_next_block(MAXAVRO_FILE *file);
+bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
+
+/** Compiled readers, NULL fields reads all fields of the schema */
+MAXAVRO_READER* maxavro_reader_alloc(MAXAVRO_SCHEMA *schema, const char **fields, size_t num_fields);
+void maxavro_reader_free(MAXAVRO_READER *reader);
 
 /** File operations */
 MAXAVRO_FILE* maxavro_file_open(const char* filename);
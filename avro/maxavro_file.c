@@ -205,6 +205,7 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
             avrofile->schema = maxavro_schema_alloc(schema);
 
             if (avrofile->schema &&
+                (avrofile->reader = maxavro_reader_alloc(avrofile->schema, NULL, 0)) &&
                 maxavro_read_sync(file, avrofile->sync) &&
                 maxavro_read_datablock_start(avrofile))
             {
@@ -213,6 +214,7 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
             else
             {
                 MXS_ERROR("Failed to initialize avrofile.");
+                maxavro_reader_free(avrofile->reader);
                 maxavro_schema_free(avrofile->schema);
                 error = true;
             }
@@ -285,6 +287,7 @@ void maxavro_file_close(MAXAVRO_FILE *file)
     {
         fclose(file->file);
         free(file->filename);
+        maxavro_reader_free(file->reader);
         maxavro_schema_free(file->schema);
         free(file);
     }
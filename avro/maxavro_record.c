@@ -18,183 +18,391 @@
 #include <maxscale/log_manager.h>
 #include <errno.h>
 
-bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
 bool maxavro_verify_block(MAXAVRO_FILE *file);
 const char* type_to_string(enum maxavro_value_type type);
 
 /**
- * @brief Read a single value from a file
+ * @brief Skip an integer value
+ *
  * @param file File to read from
- * @param name Name of the field
- * @param type Type of the field
- * @param field_num Field index in the schema
- * @return JSON object or NULL if an error occurred
+ * @return True if the value was skipped
  */
-static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *field)
+static bool skip_integer(MAXAVRO_FILE *file)
 {
-    json_t* value = NULL;
-    switch (field->type)
+    int c;
+    int nread = 0;
+
+    while ((c = getc(file->file)) != EOF && (c & 0x80))
     {
-    case MAXAVRO_TYPE_BOOL:
+        if (++nread >= MAX_INTEGER_SIZE)
         {
-            int i = 0;
-            if (fread(&i, 1, 1, file->file) == 1)
-            {
-                value = json_pack("b", i);
-            }
+            file->last_error = MAXAVRO_ERR_VALUE_OVERFLOW;
+            return false;
         }
-        break;
+    }
 
+    return c != EOF;
+}
+
+/**
+ * @brief Skip a single value
+ *
+ * @param file File to read from
+ * @param type Type of the value
+ * @return True if the value was skipped
+ */
+static bool skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
+{
+    switch (type)
+    {
     case MAXAVRO_TYPE_INT:
     case MAXAVRO_TYPE_LONG:
+    case MAXAVRO_TYPE_ENUM:
+        return skip_integer(file);
+
+    case MAXAVRO_TYPE_BOOL:
+        return getc(file->file) != EOF;
+
+    case MAXAVRO_TYPE_FLOAT:
+        return fseek(file->file, sizeof(float), SEEK_CUR) == 0;
+
+    case MAXAVRO_TYPE_DOUBLE:
+        return fseek(file->file, sizeof(double), SEEK_CUR) == 0;
+
+    case MAXAVRO_TYPE_BYTES:
+    case MAXAVRO_TYPE_STRING:
+        return maxavro_skip_string(file);
+
+    case MAXAVRO_TYPE_NULL:
+        return true;
+
+    default:
+        MXS_ERROR("Unimplemented type: %d - %s", type, type_to_string(type));
+        return false;
+    }
+}
+
+/**
+ * @brief Read a string value into the string storage of a reader
+ *
+ * The offset of the string in the storage is stored in the value, the
+ * pointer is set after the whole record is read.
+ *
+ * @param file File to read from
+ * @param reader Reader whose storage is used
+ * @param used Number of bytes used in the storage
+ * @param value Value to read
+ * @return True if the value was read
+ */
+static bool read_string_value(MAXAVRO_FILE *file, MAXAVRO_READER *reader,
+                              size_t *used, MAXAVRO_VALUE *value)
+{
+    uint64_t len;
+
+    if (!maxavro_read_integer(file, &len))
+    {
+        return false;
+    }
+
+    if (*used + len + 1 > reader->buffersize)
+    {
+        size_t size = reader->buffersize * 2 + len + 1;
+        char *tmp = realloc(reader->buffer, size);
+
+        if (tmp == NULL)
         {
-            uint64_t val = 0;
-            if (maxavro_read_integer(file, &val))
-            {
-                json_int_t jsonint = val;
-                value = json_pack("I", jsonint);
-            }
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            return false;
         }
-        break;
 
-    case MAXAVRO_TYPE_ENUM:
+        reader->buffer = tmp;
+        reader->buffersize = size;
+    }
+
+    size_t nread = fread(reader->buffer + *used, 1, len, file->file);
+
+    if (nread != len)
+    {
+        if (nread != 0)
         {
-            uint64_t val = 0;
-            maxavro_read_integer(file, &val);
+            file->last_error = MAXAVRO_ERR_IO;
+        }
+        return false;
+    }
 
-            json_t *arr = field->extra;
-            ss_dassert(arr);
-            ss_dassert(json_is_array(arr));
+    reader->buffer[*used + len] = '\0';
+    value->value.integer = *used;
+    value->size = len;
+    *used += len + 1;
+    return true;
+}
 
-            if (json_array_size(arr) >= val)
-            {
-                json_t * symbol = json_array_get(arr, val);
-                ss_dassert(json_is_string(symbol));
-                value = json_pack("s", json_string_value(symbol));
-            }
+/**
+ * @brief Read a single value
+ *
+ * @param file File to read from
+ * @param reader Reader whose storage is used for strings
+ * @param used Number of bytes used in the string storage
+ * @param value Value to read
+ * @return True if the value was read
+ */
+static bool read_value(MAXAVRO_FILE *file, MAXAVRO_READER *reader,
+                       size_t *used, MAXAVRO_VALUE *value)
+{
+    switch (value->field->type)
+    {
+    case MAXAVRO_TYPE_BOOL:
+        {
+            int c = getc(file->file);
+            value->value.boolean = c > 0;
+            return c != EOF;
         }
-        break;
+
+    case MAXAVRO_TYPE_INT:
+    case MAXAVRO_TYPE_LONG:
+    case MAXAVRO_TYPE_ENUM:
+        return maxavro_read_integer(file, &value->value.integer);
 
     case MAXAVRO_TYPE_FLOAT:
         {
             float f = 0;
-            if (maxavro_read_float(file, &f))
-            {
-                double d = f;
-                value = json_pack("f", d);
-            }
+            bool rval = maxavro_read_float(file, &f);
+            value->value.floating = f;
+            return rval;
         }
 
-        break;
     case MAXAVRO_TYPE_DOUBLE:
-        {
-            double d = 0;
-            if (maxavro_read_double(file, &d))
-            {
-                value = json_pack("f", d);
-            }
-        }
-        break;
+        return maxavro_read_double(file, &value->value.floating);
 
     case MAXAVRO_TYPE_BYTES:
     case MAXAVRO_TYPE_STRING:
-        {
-            size_t len;
-            char *str = maxavro_read_string(file, &len);
-            if (str)
-            {
-                value = json_stringn(str, len);
-                free(str);
-            }
-        }
-        break;
+        return read_string_value(file, reader, used, value);
+
+    case MAXAVRO_TYPE_NULL:
+        return true;
 
     default:
-        MXS_ERROR("Unimplemented type: %d", field->type);
-        break;
+        MXS_ERROR("Unimplemented type: %d", value->field->type);
+        return false;
     }
-    return value;
 }
 
-static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
+/**
+ * @brief Convert a value into JSON
+ *
+ * @param value Value to convert
+ * @return JSON value or NULL if an error occurred
+ */
+static json_t* pack_value(MAXAVRO_VALUE *value)
 {
-    switch (type)
+    json_t* rval = NULL;
+
+    switch (value->field->type)
     {
+    case MAXAVRO_TYPE_BOOL:
+        rval = json_boolean(value->value.boolean);
+        break;
+
     case MAXAVRO_TYPE_INT:
     case MAXAVRO_TYPE_LONG:
+        rval = json_integer(value->value.integer);
+        break;
+
     case MAXAVRO_TYPE_ENUM:
         {
-            uint64_t val = 0;
-            maxavro_read_integer(file, &val);
+            json_t *arr = value->field->extra;
+            ss_dassert(arr);
+            ss_dassert(json_is_array(arr));
+
+            if (json_array_size(arr) > value->value.integer)
+            {
+                json_t * symbol = json_array_get(arr, value->value.integer);
+                ss_dassert(json_is_string(symbol));
+                rval = json_string(json_string_value(symbol));
+            }
         }
         break;
 
     case MAXAVRO_TYPE_FLOAT:
     case MAXAVRO_TYPE_DOUBLE:
-        {
-            double d = 0;
-            maxavro_read_double(file, &d);
-        }
+        rval = json_real(value->value.floating);
         break;
 
     case MAXAVRO_TYPE_BYTES:
     case MAXAVRO_TYPE_STRING:
-        {
-            maxavro_skip_string(file);
-        }
+        rval = json_stringn(value->value.string, value->size);
+        break;
+
+    case MAXAVRO_TYPE_NULL:
+        rval = json_null();
         break;
 
     default:
-        MXS_ERROR("Unimplemented type: %d - %s", type, type_to_string(type));
+        MXS_ERROR("Unimplemented type: %d", value->field->type);
         break;
     }
+
+    return rval;
 }
 
 /**
- * @brief Read a record and convert in into JSON
+ * @brief Compile a reader for a schema
+ *
+ * @param schema Schema of the file that is read
+ * @param fields Names of the fields to read or NULL to read all fields
+ * @param num_fields Number of names in @c fields
+ * @return The reader or NULL if a field is not in the schema or memory
+ * allocation failed. The values are returned in the order of @c fields.
+ */
+MAXAVRO_READER* maxavro_reader_alloc(MAXAVRO_SCHEMA *schema, const char **fields, size_t num_fields)
+{
+    if (fields == NULL)
+    {
+        num_fields = schema->num_fields;
+    }
+
+    MAXAVRO_READER *reader = calloc(1, sizeof(MAXAVRO_READER));
+
+    if (reader == NULL ||
+        (reader->targets = malloc(sizeof(int) * (schema->num_fields + 1))) == NULL ||
+        (reader->values = calloc(num_fields + 1, sizeof(MAXAVRO_VALUE))) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        maxavro_reader_free(reader);
+        return NULL;
+    }
+
+    reader->schema = schema;
+    reader->num_values = num_fields;
+
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        reader->targets[i] = fields ? -1 : (int)i;
+
+        if (fields == NULL)
+        {
+            reader->values[i].field = &schema->fields[i];
+        }
+    }
+
+    for (size_t j = 0; fields && j < num_fields; j++)
+    {
+        size_t i = 0;
+
+        while (i < schema->num_fields && strcmp(schema->fields[i].name, fields[j]) != 0)
+        {
+            i++;
+        }
+
+        if (i == schema->num_fields)
+        {
+            MXS_ERROR("Field '%s' is not in the schema.", fields[j]);
+            maxavro_reader_free(reader);
+            return NULL;
+        }
+
+        reader->targets[i] = j;
+        reader->values[j].field = &schema->fields[i];
+    }
+
+    return reader;
+}
+
+void maxavro_reader_free(MAXAVRO_READER *reader)
+{
+    if (reader)
+    {
+        free(reader->targets);
+        free(reader->values);
+        free(reader->buffer);
+        free(reader);
+    }
+}
+
+/**
+ * @brief Read the values of a record
+ *
+ * Only the fields of the reader are decoded, the other fields are skipped.
  *
  * @param file File to read from
- * @return JSON value or NULL if an error occurred. The caller must call
- * json_decref() on the returned value to free the allocated memory.
+ * @param reader Reader compiled for the schema of the file
+ * @return The values of the record or NULL if no record was read. The values
+ * are valid until the reader is used again.
  */
-json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
+MAXAVRO_VALUE* maxavro_record_read_values(MAXAVRO_FILE *file, MAXAVRO_READER *reader)
 {
     if (!file->metadata_read && !maxavro_read_datablock_start(file))
     {
         return NULL;
     }
 
-    json_t* object = NULL;
+    if (file->records_read_from_block >= file->records_in_block)
+    {
+        return NULL;
+    }
 
-    if (file->records_read_from_block < file->records_in_block)
+    size_t used = 0;
+
+    for (size_t i = 0; i < file->schema->num_fields; i++)
+    {
+        int target = reader->targets[i];
+        bool ok = target < 0 ? skip_value(file, file->schema->fields[i].type) :
+                  read_value(file, reader, &used, &reader->values[target]);
+
+        if (!ok)
+        {
+            long pos = ftell(file->file);
+            MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                      "file offset %ld, record number %lu.",
+                      file->schema->fields[i].name,
+                      type_to_string(file->schema->fields[i].type),
+                      pos, file->records_read);
+            return NULL;
+        }
+    }
+
+    /** The storage is not moved after the strings are read */
+    for (size_t i = 0; i < reader->num_values; i++)
     {
-        object = json_object();
+        MAXAVRO_VALUE *value = &reader->values[i];
 
-        if (object)
+        if (value->field->type == MAXAVRO_TYPE_STRING || value->field->type == MAXAVRO_TYPE_BYTES)
         {
-            for (size_t i = 0; i < file->schema->num_fields; i++)
+            value->value.string = reader->buffer + value->value.integer;
+        }
+    }
+
+    file->records_read_from_block++;
+    file->records_read++;
+    return reader->values;
+}
+
+/**
+ * @brief Read a record and convert in into JSON
+ *
+ * @param file File to read from
+ * @return JSON value or NULL if an error occurred. The caller must call
+ * json_decref() on the returned value to free the allocated memory.
+ */
+json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
+{
+    MAXAVRO_VALUE *values = maxavro_record_read_values(file, file->reader);
+    json_t* object = NULL;
+
+    if (values && (object = json_object()))
+    {
+        for (size_t i = 0; i < file->reader->num_values; i++)
+        {
+            json_t* value = pack_value(&values[i]);
+
+            if (value == NULL)
             {
-                json_t* value = read_and_pack_value(file, &file->schema->fields[i]);
-                if (value)
-                {
-                    json_object_set_new(object, file->schema->fields[i].name, value);
-                }
-                else
-                {
-                    long pos = ftell(file->file);
-                    MXS_ERROR("Failed to read field value '%s', type '%s' at "
-                              "file offset %ld, record number %lu.",
-                              file->schema->fields[i].name,
-                              type_to_string(file->schema->fields[i].type),
-                              pos, file->records_read);
-                    json_decref(object);
-                    return NULL;
-                }
+                json_decref(object);
+                return NULL;
             }
-        }
 
-        file->records_read_from_block++;
-        file->records_read++;
+            json_object_set_new(object, values[i].field->name, value);
+        }
     }
 
     return object;
@@ -35,7 +35,7 @@ uint64_t maxavro_encode_integer(uint8_t* buffer, uint64_t val)
     uint64_t encval = encode_long(val);
     uint8_t nbytes = 0;
 
-    while (more_bytes(encval))
+    while (encval > 0x7f)
     {
         buffer[nbytes++] = 0x80 | (0x7f & encval);
         encval >>= 7;
@@ -64,7 +64,7 @@ uint64_t maxavro_encode_string(uint8_t* dest, const char* str)
 {
     uint64_t slen = strlen(str);
     uint64_t ilen = maxavro_encode_integer(dest, slen);
-    memcpy(dest, str, slen);
+    memcpy(dest + ilen, str, slen);
     return slen + ilen;
 }
 
@@ -119,12 +119,12 @@ uint64_t avro_map_encode(uint8_t *dest, MAXAVRO_MAP* map)
 
     while (map)
     {
-        len += maxavro_encode_string(dest, map->key);
-        len += maxavro_encode_string(dest, map->value);
+        len += maxavro_encode_string(dest + len, map->key);
+        len += maxavro_encode_string(dest + len, map->value);
         map = map->next;
     }
 
     /** Maps end with an empty block i.e. a zero integer value */
-    len += maxavro_encode_integer(dest, 0);
+    len += maxavro_encode_integer(dest + len, 0);
     return len;
 }
@@ -54,6 +54,9 @@ set(WITH_TCMALLOC FALSE CACHE BOOL "Use tcmalloc as the memory allocator")
 # Use jemalloc as the memory allocator
 set(WITH_JEMALLOC FALSE CACHE BOOL "Use jemalloc as the memory allocator")
 
+# Add the static tracing probes if sys/sdt.h is available
+set(WITH_USDT FALSE CACHE BOOL "Add USDT probes for perf and bpftrace if sys/sdt.h is available")
+
 # Install experimental modules
 set(INSTALL_EXPERIMENTAL TRUE CACHE BOOL "Install experimental modules")
 
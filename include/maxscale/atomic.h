@@ -36,6 +36,127 @@ int      atomic_add(int *variable, int value);
 int64_t  atomic_add_int64(int64_t *variable, int64_t value);
 uint64_t atomic_add_uint64(uint64_t *variable, int64_t value);
 
+/**
+ * Load a value
+ *
+ * The load has acquire semantics, i.e. anything stored before the value was
+ * last modified with an atomic operation is visible after the load.
+ *
+ * @param variable      Pointer the the variable to load
+ * @return              The value of variable
+ */
+static inline int atomic_load_int(const int *variable)
+{
+#ifdef __GNUC__
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+static inline uint64_t atomic_load_uint64(const uint64_t *variable)
+{
+#ifdef __GNUC__
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Store a value
+ *
+ * The store has release semantics, i.e. anything stored before it is visible
+ * to a thread that loads the value with atomic_load_uint64.
+ *
+ * @param variable      Pointer the the variable to store to
+ * @param value         The value to store
+ */
+static inline void atomic_store_uint64(uint64_t *variable, uint64_t value)
+{
+#ifdef __GNUC__
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Store a value
+ *
+ * The store has release semantics, i.e. anything stored before it is visible
+ * to a thread that loads the value with atomic_load_int.
+ *
+ * @param variable      Pointer the the variable to store to
+ * @param value         The value to store
+ */
+static inline void atomic_store_int(int *variable, int value)
+{
+#ifdef __GNUC__
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Load a pointer
+ *
+ * The load has acquire semantics, i.e. the contents of the object that was
+ * stored with atomic_store_ptr are visible after the load.
+ *
+ * @param variable      Pointer to the pointer to load
+ * @return              The value of variable
+ */
+static inline void* atomic_load_ptr(void * const *variable)
+{
+#ifdef __GNUC__
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Store a pointer
+ *
+ * The store has release semantics, i.e. anything stored before it is visible
+ * to a thread that loads the pointer with atomic_load_ptr.
+ *
+ * @param variable      Pointer to the pointer to store to
+ * @param value         The value to store
+ */
+static inline void atomic_store_ptr(void **variable, void *value)
+{
+#ifdef __GNUC__
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Compare and swap a pointer
+ *
+ * Stores @c new_value in the location pointed to by @c variable if the
+ * location contains @c old_value. The operation implies a full memory barrier.
+ *
+ * @param variable      Pointer to the pointer to modify
+ * @param old_value     The expected current value
+ * @param new_value     The value to store
+ * @return              True if the value was stored
+ */
+bool atomic_cas_ptr(void **variable, void *old_value, void *new_value);
+
+/**
+ * Swap a pointer with a new value
+ *
+ * @param variable      Pointer to the pointer to modify
+ * @param new_value     The value to store
+ * @return              The value of variable before the swap occurred
+ */
+void* atomic_exchange_ptr(void **variable, void *new_value);
+
 /**
  * @brief Impose a full memory barrier
  *
@@ -75,28 +75,43 @@ typedef enum
     GWBUF_INFO_PARSED       = 0x1
 } gwbuf_info_t;
 
-#define GWBUF_IS_PARSED(b)      (b->sbuf->info & GWBUF_INFO_PARSED)
+#define GWBUF_IS_PARSED(b)      ((b->sbuf->info & GWBUF_INFO_PARSED) && \
+                                 gwbuf_get_buffer_object_data(b, GWBUF_PARSING_INFO))
 
 /**
  * A structure for cleaning up memory allocations of structures which are
  * referred to by GWBUF and deallocated in gwbuf_free but GWBUF doesn't
  * know what they are.
  * All functions on the list are executed before freeing memory of GWBUF struct.
+ *
+ * The objects are stored in the shared buffer, so all clones of a GWBUF share
+ * them. An object describes the data starting where the GWBUF it was added to
+ * started, so a clone of a different portion of the data, e.g. the second
+ * packet split from the same network read, does not see it.
+ *
+ * The first objects are kept in a fixed number of slots in the shared buffer,
+ * so adding one does not allocate memory and finding one only compares the
+ * identifiers of a few slots. When the slots are in use, e.g. when many
+ * statements are split from the same network read, further objects are
+ * added to a list that is allocated from the heap.
  */
 typedef enum
 {
-    GWBUF_PARSING_INFO
+    GWBUF_PARSING_INFO,
+    GWBUF_REPLY_INFO
 } bufobj_id_t;
 
-typedef struct buffer_object_st buffer_object_t;
+/** The number of objects a shared buffer can have without allocating memory */
+#define GWBUF_MAX_OBJECTS 4
 
-struct buffer_object_st
+typedef struct buffer_object_st
 {
     bufobj_id_t      bo_id;
+    const void*      bo_start; /*< Start of the data the object describes */
     void*            bo_data;
     void            (*bo_donefun_fp)(void *);
-    buffer_object_t* bo_next;
-};
+    struct buffer_object_st *bo_next; /*< Next object in the overflow list */
+} buffer_object_t;
 
 /**
  * A structure to encapsulate the data in a form that the data itself can be
@@ -107,7 +122,10 @@ typedef struct
 {
     unsigned char   *data;     /*< Physical memory that was allocated */
     int              refcount; /*< Reference count on the buffer */
-    buffer_object_t *bufobj;   /*< List of objects referred to by GWBUF */
+    buffer_object_t  bufobj[GWBUF_MAX_OBJECTS]; /*< Objects referred to by GWBUF */
+    int              n_bufobj; /*< Number of used object slots */
+    buffer_object_t *bufobj_overflow; /*< Objects that did not fit in the slots */
+    SPINLOCK         bufobj_lock; /*< Serializes the adding of objects */
     gwbuf_info_t     info;     /*< Info bits */
 } SHARED_BUF;
 
@@ -364,6 +382,22 @@ extern char *gwbuf_get_property(GWBUF *buf, char *name);
  */
 extern GWBUF *gwbuf_make_contiguous(GWBUF *buf);
 
+/**
+ * Copy the data of a chain into a single buffer of the right size if the
+ * chain holds on to more memory than that. Used to release the memory of
+ * partially consumed large reads that are kept for a long time.
+ *
+ * Chains whose data is shared with other buffers or that carry hints,
+ * properties or buffer objects are not copied.
+ *
+ * @param head     The chain to shrink
+ * @param released Set to the number of bytes released
+ *
+ * @return The chain or the buffer that replaced it. If a memory allocation
+ *         fails, the chain is returned as it was.
+ */
+extern GWBUF *gwbuf_shrink(GWBUF *head, size_t *released);
+
 /**
  * Add hint to a buffer.
  *
@@ -380,18 +414,26 @@ extern void gwbuf_add_hint(GWBUF *buf, HINT *hint);
  * @param id          Type identifier for object
  * @param data        Object data
  * @param donefun_fp  Clean-up function to be executed before buffer is freed.
+ *
+ * @return True, if the object was added. False, if memory could not be
+ *         allocated for it, in which case the ownership of @c data remains
+ *         with the caller.
  */
-void gwbuf_add_buffer_object(GWBUF* buf,
+bool gwbuf_add_buffer_object(GWBUF* buf,
                              bufobj_id_t id,
                              void*  data,
                              void (*donefun_fp)(void *));
 
 /**
- * Search buffer object which matches with the id.
+ * Search buffer object which matches with the id and which describes the
+ * data of @c buf.
  *
  * @param buf  GWBUF to be searched
  * @param id   Identifier for the object
  *
+ * @note The objects can be searched without locking, as they are removed
+ *       only when the last reference to the shared buffer is released.
+ *
  * @return Searched buffer object or NULL if not found
  */
 void *gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id);
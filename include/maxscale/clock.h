@@ -0,0 +1,63 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file clock.h - Clocks of the polling threads
+ *
+ * A polling thread reads the clocks once per cycle of its event loop, before
+ * it processes the events of the cycle. The coarse clocks return the time the
+ * current cycle started, so everything done for the events of a cycle sees the
+ * same time without reading the clocks again. A cycle seldom takes more than
+ * a few milliseconds, which makes the coarse clocks suitable for timeouts,
+ * expiration checks and time stamps with a resolution of a second. Threads
+ * that do not poll, such as the housekeeper and the monitors, read the clocks
+ * on every call.
+ *
+ * Durations that must be measured accurately use mxs_clock_precise_ns().
+ */
+
+#include <maxscale/cdefs.h>
+#include <time.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Get the wall clock time
+ *
+ * @return The time in seconds since the epoch when the current cycle started
+ */
+time_t mxs_clock_time(void);
+
+/**
+ * @brief Get the monotonic time
+ *
+ * @return The CLOCK_MONOTONIC time in milliseconds when the current cycle started
+ */
+uint64_t mxs_clock_ms(void);
+
+/**
+ * @brief Get the monotonic time
+ *
+ * @return The CLOCK_MONOTONIC time in nanoseconds when the current cycle started
+ */
+uint64_t mxs_clock_ns(void);
+
+/**
+ * @brief Get the precise monotonic time
+ *
+ * @return The current CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t mxs_clock_precise_ns(void);
+
+MXS_END_DECLS
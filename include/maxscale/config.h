@@ -23,6 +23,7 @@
 #include <sys/utsname.h>
 #include <time.h>
 
+#include <maxscale/limits.h>
 #include <maxscale/modinfo.h>
 
 MXS_BEGIN_DECLS
@@ -59,6 +60,8 @@ typedef struct
 {
     bool          config_check;                        /**< Only check config */
     int           n_threads;                           /**< Number of polling threads */
+    int           max_threads;                         /**< Number of polling threads started, 0 for n_threads */
+    int           n_active_threads;                    /**< Number of threads that handle sessions at startup */
     char          *version_string;                     /**< The version string of embedded db library */
     char          release_string[_RELEASE_STR_LENGTH]; /**< The release name string of the system */
     char          sysname[_UTSNAME_SYSNAME_LENGTH];    /**< The OS name of the system */
@@ -75,8 +78,31 @@ typedef struct
     bool          skip_permission_checks;              /**< Skip service and monitor permission checks */
     char          qc_name[PATH_MAX];                   /**< The name of the query classifier to load */
     char*         qc_args;                             /**< Arguments for the query classifier */
+    int64_t       qc_cache_size;                       /**< Size of the per-thread classification cache */
     int           query_retries;                       /**< Number of times a interrupted query is retried */
     time_t        query_retry_timeout;                 /**< Timeout for query retries */
+    bool          adaptive_reads;                      /**< Read without FIONREAD into adaptively sized buffers */
+    bool          adaptive_polls;                      /**< Tune non-blocking polls from the event arrival rate */
+    int           busy_poll;                           /**< SO_BUSY_POLL value in microseconds, 0 for none */
+    int           trace_records;                       /**< Number of trace records per thread, 0 for none */
+    int           stall_threshold;                     /**< Event loop stall threshold in milliseconds, 0 for none */
+    int           read_budget;                         /**< Bytes read from a socket per event, 0 for no limit */
+    bool          write_coalescing;                    /**< Defer writes to the end of the poll cycle */
+    int           writeq_high_water;                   /**< Client write queue size that pauses the servers, 0 for none */
+    int           writeq_low_water;                    /**< Client write queue size that resumes the servers */
+    int           writeq_spill_threshold;              /**< Client write queue size in memory above which
+                                                        *   the rest is written to a file, 0 for none */
+    char*         writeq_spill_directory;              /**< Directory of the spill files, NULL for the data directory */
+    int           idle_memory_timeout;                 /**< Seconds after which idle connections release memory, 0 for never */
+    bool          session_arena;                       /**< Allocate session memory from per-session chunks */
+    int           thread_cpus[MXS_MAX_THREADS];        /**< CPUs the polling threads are bound to in order */
+    int           n_thread_cpus;                       /**< Number of CPUs in thread_cpus, 0 for no binding */
+    bool          incoming_cpu_steering;               /**< Accept connections in the thread of the receiving CPU */
+    int           thread_rebalance;                    /**< Load difference in percent that moves sessions, 0 for none */
+    char*         statistics_segment;                  /**< Path of the statistics segment, NULL for none */
+    int           statistics_segment_interval;         /**< Seconds between the updates of the segment */
+    char*         handoff_socket;                      /**< Path of the listener handoff socket, NULL for none */
+    int           handoff_drain_timeout;               /**< Seconds the sessions are kept after a handoff, 0 for no limit */
 } MXS_CONFIG;
 
 /**
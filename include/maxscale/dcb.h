@@ -22,8 +22,10 @@
 #include <maxscale/protocol.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/ssl.h>
+#include <maxscale/timer.h>
 #include <maxscale/modinfo.h>
 #include <netinet/in.h>
+#include <sys/types.h>
 
 MXS_BEGIN_DECLS
 
@@ -36,33 +38,6 @@ struct servlistener;
 
 struct dcb;
 
-/**
- * The event queue structure used in the polling loop to maintain a queue
- * of events that need to be processed for the DCB.
- *
- *      next                    The next DCB in the event queue
- *      prev                    The previous DCB in the event queue
- *      pending_events          The events that are pending processing
- *      processing_events       The evets currently being processed
- *      processing              Flag to indicate the processing status of the DCB
- *      eventqlock              Spinlock to protect this structure
- *      inserted                Insertion time for logging purposes
- *      started                 Time that the processign started
- */
-typedef struct
-{
-    struct  dcb     *next;
-    struct  dcb     *prev;
-    uint32_t        pending_events;
-    uint32_t        processing_events;
-    int             processing;
-    SPINLOCK        eventqlock;
-    unsigned long   inserted;
-    unsigned long   started;
-} DCBEVENTQ;
-
-#define DCBEVENTQ_INIT {NULL, NULL, 0, 0, 0, SPINLOCK_INIT, 0, 0}
-
 #define DCBFD_CLOSED -1
 
 /**
@@ -76,6 +51,7 @@ typedef struct dcbstats
     int     n_buffered;     /*< Number of buffered writes */
     int     n_high_water;   /*< Number of crosses of high water mark */
     int     n_low_water;    /*< Number of crosses of low water mark */
+    int     n_spills;       /*< Number of times the write queue started to go to a file */
 } DCBSTATS;
 
 #define DCBSTATS_INIT {0}
@@ -168,6 +144,21 @@ typedef enum
     SSL_HANDSHAKE_FAILED            /*< The SSL handshake failed */
 } SSL_STATE;
 
+/**
+ * The parts of a DCB that only client DCBs use
+ *
+ * They are allocated when first needed, so that the far more numerous
+ * backend DCBs do not carry them.
+ */
+typedef struct dcb_cold
+{
+    struct sockaddr_storage ip;     /**< remote IPv4/IPv6 address */
+    MXS_TIMER       idle_timer;     /**< Timer of the idle timeout */
+    int             spill_fd;       /**< File of the spilled write queue, -1 if not yet created */
+    off_t           spill_start;    /**< Offset of the spilled data not yet moved to the write queue */
+    off_t           spill_end;      /**< Offset where the next spilled data is written */
+} DCB_COLD;
+
 /**
  * Descriptor Control Block
  *
@@ -179,56 +170,28 @@ typedef enum
  * It is important to hold the state information here such that any thread within the
  * gateway may be selected to execute the required actions when a network event occurs.
  *
- * Note that the first few fields (up to and including "entry_is_ready") must
- * precisely match the LIST_ENTRY structure defined in the list manager.
+ * The fields used for every event come first, so that processing an event
+ * touches as few cache lines as possible. The fields used when connections
+ * are created, authenticated or closed follow them, and the parts only client
+ * DCBs need are in a separately allocated DCB_COLD.
  */
 typedef struct dcb
 {
     skygw_chk_t     dcb_chk_top;
+    dcb_role_t      dcb_role;
+    dcb_state_t     state;          /**< Current descriptor state */
+    int             fd;             /**< The descriptor */
+    int             flags;          /**< DCB flags */
+    SSL_STATE       ssl_state;      /**< Current state of SSL if in use */
     bool            dcb_errhandle_called; /*< this can be called only once */
     bool            dcb_is_zombie;  /**< Whether the DCB is in the zombie list */
     bool            draining_flag;  /**< Set while write queue is drained */
     bool            drain_called_while_busy; /**< Set as described */
-    dcb_role_t      dcb_role;
-    DCBEVENTQ       evq;            /**< The event queue for this DCB */
-    int             fd;             /**< The descriptor */
-    dcb_state_t     state;          /**< Current descriptor state */
-    SSL_STATE       ssl_state;      /**< Current state of SSL if in use */
-    int             flags;          /**< DCB flags */
-    char            *remote;        /**< Address of remote end */
-    char            *user;          /**< User name for connection */
-    struct sockaddr_storage ip;     /**< remote IPv4/IPv6 address */
-    char            *protoname;     /**< Name of the protocol */
-    void            *protocol;      /**< The protocol specific state */
-    size_t           protocol_packet_length; /**< How long the protocol specific packet is */
-    size_t           protocol_bytes_processed; /**< How many bytes of a packet have been read */
-    struct session  *session;       /**< The owning session */
-    struct servlistener *listener;  /**< For a client DCB, the listener data */
-    MXS_PROTOCOL    func;           /**< The protocol functions for this descriptor */
-    MXS_AUTHENTICATOR authfunc;     /**< The authenticator functions for this descriptor */
-    int             writeqlen;      /**< Current number of byes in the write queue */
-    GWBUF           *writeq;        /**< Write Data Queue */
-    GWBUF           *delayq;        /**< Delay Backend Write Data Queue */
-    GWBUF           *dcb_readqueue; /**< read queue for storing incomplete reads */
-    GWBUF           *dcb_fakequeue; /**< Fake event queue for generated events */
-
-    DCBSTATS        stats;          /**< DCB related statistics */
-    struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
-    time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
-    struct service  *service;       /**< The related service */
-    void            *data;          /**< Specific client data, shared between DCBs of this session */
-    void            *authenticator_data; /**< The authenticator data for this DCB */
-    DCBMM           memdata;        /**< The data related to DCB memory management */
-    DCB_CALLBACK    *callbacks;     /**< The list of callbacks for the DCB */
-    long            last_read;      /*< Last time the DCB received data */
-    int             high_water;     /**< High water mark */
-    int             low_water;      /**< Low water mark */
-    struct server   *server;        /**< The associated backend server */
-    SSL*            ssl;            /*< SSL struct for connection */
     bool            ssl_read_want_read;    /*< Flag */
     bool            ssl_read_want_write;    /*< Flag */
     bool            ssl_write_want_read;    /*< Flag */
     bool            ssl_write_want_write;    /*< Flag */
+    bool            ssl_ktls_send;   /**< The kernel encrypts what is written to the socket */
     bool            was_persistent;  /**< Whether this DCB was in the persistent pool */
     struct
     {
@@ -236,15 +199,48 @@ typedef struct dcb
         struct dcb *next; /**< Next DCB in owning thread's list */
         struct dcb *tail; /**< Last DCB in owning thread's list */
     } thread;
+    struct session  *session;       /**< The owning session */
+    void            *protocol;      /**< The protocol specific state */
+    SSL*            ssl;            /*< SSL struct for connection */
+    GWBUF           *writeq;        /**< Write Data Queue */
+    GWBUF           *dcb_readqueue; /**< read queue for storing incomplete reads */
+    GWBUF           *dcb_fakequeue; /**< Fake event queue for generated events */
+    int             writeqlen;      /**< Current number of byes in the write queue */
+    int             high_water;     /**< High water mark */
+    int             low_water;      /**< Low water mark */
+    int             spill_threshold; /**< Write queue size above which data goes to a file, 0 for none */
+    int             read_size;       /**< Size of the next read when adaptive reads are used */
+    long            last_read;      /*< Last time the DCB received data */
+    DCB_CALLBACK    *callbacks;     /**< The list of callbacks for the DCB */
+    DCBSTATS        stats;          /**< DCB related statistics */
+    MXS_PROTOCOL    func;           /**< The protocol functions for this descriptor */
+
+    GWBUF           *delayq;        /**< Delay Backend Write Data Queue */
+    size_t           protocol_packet_length; /**< How long the protocol specific packet is */
+    size_t           protocol_bytes_processed; /**< How many bytes of a packet have been read */
+    char            *remote;        /**< Address of remote end */
+    char            *user;          /**< User name for connection */
+    char            *protoname;     /**< Name of the protocol */
+    struct servlistener *listener;  /**< For a client DCB, the listener data */
+    struct service  *service;       /**< The related service */
+    struct server   *server;        /**< The associated backend server */
+    void            *data;          /**< Specific client data, shared between DCBs of this session */
+    void            *authenticator_data; /**< The authenticator data for this DCB */
+    MXS_AUTHENTICATOR authfunc;     /**< The authenticator functions for this descriptor */
+    struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
+    time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
+    DCBMM           memdata;        /**< The data related to DCB memory management */
+    int             *shard_fds;      /**< Per-thread SO_REUSEPORT listener sockets or NULL */
+    DCB_COLD        *cold;          /**< The parts only client DCBs use, see dcb_get_ip() */
     skygw_chk_t     dcb_chk_tail;
 } DCB;
 
 #define DCB_INIT {.dcb_chk_top = CHK_NUM_DCB, \
-    .evq = DCBEVENTQ_INIT, .ip = {0}, .func = {0}, .authfunc = {0}, \
+    .func = {0}, .authfunc = {0}, \
     .stats = {0}, .memdata = DCBMM_INIT, \
     .fd = DCBFD_CLOSED, .stats = DCBSTATS_INIT, .ssl_state = SSL_HANDSHAKE_UNKNOWN, \
     .state = DCB_STATE_ALLOC, .dcb_chk_tail = CHK_NUM_DCB, \
-    .authenticator_data = NULL, .thread = {0}}
+    .authenticator_data = NULL, .thread = {0}, .cold = NULL}
 
 /**
  * The DCB usage filer used for returning DCB's in use for a certain reason
@@ -265,12 +261,10 @@ typedef enum
 #define DCB_ISZOMBIE(x)                 ((x)->state == DCB_STATE_ZOMBIE)
 #define DCB_WRITEQLEN(x)                (x)->writeqlen
 #define DCB_SET_LOW_WATER(x, lo)        (x)->low_water = (lo);
-#define DCB_SET_HIGH_WATER(x, hi)       (x)->low_water = (hi);
+#define DCB_SET_HIGH_WATER(x, hi)       (x)->high_water = (hi);
 #define DCB_BELOW_LOW_WATER(x)          ((x)->low_water && (x)->writeqlen < (x)->low_water)
 #define DCB_ABOVE_HIGH_WATER(x)         ((x)->high_water && (x)->writeqlen > (x)->high_water)
 
-#define DCB_POLL_BUSY(x)                ((x)->evq.next != NULL)
-
 /**
  * @brief DCB system initialization function
  *
@@ -299,6 +293,21 @@ void dcb_close(DCB *);
  */
 void dcb_process_zombies(int threadid);
 
+/**
+ * Free the DCBs cached by the calling polling thread
+ *
+ * Must be called by each polling thread before it exits.
+ */
+void dcb_cache_thread_finish();
+
+/**
+ * Start checking the connections of the calling polling thread for idle ones
+ *
+ * Does nothing unless idle_memory_timeout is set. The memory of connections
+ * that have been idle for that long is released, see dShowDCBMemory().
+ */
+void dcb_idle_memory_thread_init();
+
 /**
  * Add a DCB to the owner's list
  *
@@ -306,6 +315,30 @@ void dcb_process_zombies(int threadid);
  */
 void dcb_add_to_list(DCB *dcb);
 
+/**
+ * Move DCBs from the list of the calling thread to the list of another thread
+ *
+ * Only the lists are changed, the DCBs are handed over by poll_migrate_dcbs().
+ *
+ * @param dcbs      DCBs owned by the calling thread
+ * @param n         Number of DCBs
+ * @param thread_id The new owner
+ */
+void dcb_move_to_list(DCB **dcbs, int n, int thread_id);
+
+/**
+ * Move idle sessions of the calling thread to another thread
+ *
+ * A session is idle when it is not waiting for a reply and none of its DCBs
+ * has buffered data or pending events. All DCBs of a session are moved
+ * together. Must be called by a polling thread between events.
+ *
+ * @param thread_id The thread the sessions are moved to
+ * @param max       Maximum number of sessions to move
+ * @return Number of sessions moved
+ */
+int dcb_migrate_idle_sessions(int thread_id, int max);
+
 void printAllDCBs();                         /* Debug to print all DCB in the system */
 void printDCB(DCB *);                        /* Debug print routine */
 void dprintDCBList(DCB *);                 /* Debug print DCB list statistics */
@@ -317,6 +350,7 @@ void dListClients(DCB *);                    /* List al the client DCBs */
 const char *gw_dcb_state2string(dcb_state_t);              /* DCB state to string */
 void dcb_printf(DCB *, const char *, ...) __attribute__((format(printf, 2, 3))); /* DCB version of printf */
 void dcb_hashtable_stats(DCB *, void *);     /**< Print statisitics */
+void dShowDCBReadStats(DCB *);               /**< Print read statistics per DCB role */
 int dcb_add_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *), void *);
 int dcb_remove_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *), void *);
 int dcb_isvalid(DCB *);                     /* Check the DCB is in the linked list */
@@ -328,9 +362,21 @@ char *dcb_role_name(DCB *);                  /* Return the name of a role */
 int dcb_accept_SSL(DCB* dcb);
 int dcb_connect_SSL(DCB* dcb);
 int dcb_listen(DCB *listener, const char *config, const char *protocol_name);
+void dcb_listen_close(DCB *listener);        /* Close the sockets of a stopped listener */
 void dcb_append_readqueue(DCB *dcb, GWBUF *buffer);
 void dcb_enable_session_timeouts();
-void dcb_process_idle_sessions(int thr);
+void dcb_start_idle_timer(DCB *dcb);
+
+/**
+ * @brief Enable the flow control of a session
+ *
+ * If @c writeq_high_water is configured, the reading of the backend DCBs of
+ * the session is paused whenever the write queue of the client DCB grows
+ * above it, and resumed once the queue drains below @c writeq_low_water.
+ *
+ * @param dcb The client DCB of the session
+ */
+void dcb_enable_flow_control(DCB *dcb);
 
 /**
  * @brief Call a function for each connected DCB
@@ -343,6 +389,21 @@ void dcb_process_idle_sessions(int thr);
  */
 bool dcb_foreach(bool (*func)(DCB *, void *), void *data);
 
+/**
+ * @brief Return the address of the remote end of a client DCB
+ *
+ * @param dcb DCB to inspect
+ * @return The address, with the family AF_UNSPEC if the DCB has none
+ */
+const struct sockaddr_storage* dcb_get_ip(const DCB *dcb);
+
+/**
+ * @brief Print the memory used by the DCBs
+ *
+ * @param pdcb DCB to print to
+ */
+void dShowDCBMemory(DCB *pdcb);
+
 /**
  * @brief Return the port number this DCB is connected to
  *
@@ -365,6 +426,9 @@ DCB* dcb_get_current();
 #define DCBF_CLONE              0x0001  /*< DCB is a clone */
 #define DCBF_HUNG               0x0002  /*< Hangup has been dispatched */
 #define DCBF_REPLIED    0x0004  /*< DCB was written to */
+#define DCBF_READ_PENDING 0x0008 /*< DCB used up its read budget and is read again */
+#define DCBF_WRITE_PENDING 0x0010 /*< DCB has writes deferred to the end of the poll cycle */
+#define DCBF_READ_PAUSED 0x0020 /*< DCB is not read until the client catches up */
 
 #define DCB_IS_CLONE(d) ((d)->flags & DCBF_CLONE)
 #define DCB_REPLIED(d) ((d)->flags & DCBF_REPLIED)
@@ -49,6 +49,20 @@ typedef struct mxs_filter_session
 {
 } MXS_FILTER_SESSION;
 
+/**
+ * A value that a filter instance reports with the metrics of MaxScale
+ */
+typedef struct mxs_filter_metric
+{
+    const char *name;    /**< Name of the metric, shown with the prefix maxscale_<module>_ */
+    const char *help;    /**< Description of the metric */
+    bool        counter; /**< True if the value only grows, false if it can also decrease */
+    int64_t     value;   /**< The current value */
+} MXS_FILTER_METRIC;
+
+/** The maximum number of metrics that a filter instance can report */
+#define MXS_FILTER_MAX_METRICS 16
+
 /**
  * @verbatim
  * The "module object" structure for a filter module
@@ -65,6 +79,7 @@ typedef struct mxs_filter_session
  *      diagnostics      Called for diagnostic output
  *      getCapabilities  Called to obtain the capabilities of the filter
  *      destroyInstance  Called for destroying a filter instance
+ *      getMetrics       Called to obtain the metrics of the filter, optional
  *
  * @endverbatim
  *
@@ -192,6 +207,19 @@ typedef struct mxs_filter_object
      */
     void     (*destroyInstance)(MXS_FILTER *instance);
 
+    /**
+     * @brief Called to obtain the metrics of a filter instance
+     *
+     * The entry point is optional and may be NULL. All instances of a filter
+     * module must report the same metrics in the same order.
+     *
+     * @param instance Filter instance
+     * @param metrics  Array of MXS_FILTER_MAX_METRICS metrics to fill
+     *
+     * @return The number of metrics that were filled
+     */
+    int      (*getMetrics)(MXS_FILTER *instance, MXS_FILTER_METRIC *metrics);
+
 } MXS_FILTER_OBJECT;
 
 /**
@@ -199,7 +227,7 @@ typedef struct mxs_filter_object
  * is changed these values must be updated in line with the rules in the
  * file modinfo.h.
  */
-#define MXS_FILTER_VERSION  {2, 2, 0}
+#define MXS_FILTER_VERSION  {2, 3, 0}
 
 /**
  * MXS_FILTER_DEF represents a filter definition from the configuration file.
@@ -27,6 +27,11 @@ namespace maxscale
  * Note that even though this class is intended to be derived from, no functions
  * are virtual. That is by design, as the class will be used in a context where
  * the concrete class is known. That is, there is no need for the virtual mechanism.
+ *
+ * The functions are defined in this header so that the ones a concrete class
+ * does not override are inlined into the entry points generated by the Filter
+ * template. A filter that merely passes a packet on thus costs one indirect call
+ * per packet, the one made to the next component in the chain.
  */
 class FilterSession : public MXS_FILTER_SESSION
 {
@@ -105,26 +110,36 @@ public:
      * The FilterSession instance will be deleted when a client session
      * has terminated. Will be called only after @c close() has been called.
      */
-    ~FilterSession();
+    ~FilterSession()
+    {
+    }
 
     /**
      * Called when a client session has been closed.
      */
-    void close();
+    void close()
+    {
+    }
 
     /**
      * Called for setting the component following this filter session.
      *
      * @param down The component following this filter.
      */
-    void setDownstream(const Downstream& down);
+    void setDownstream(const Downstream& down)
+    {
+        m_down = down;
+    }
 
     /**
      * Called for setting the component preceeding this filter session.
      *
      * @param up The component preceeding this filter.
      */
-    void setUpstream(const Upstream& up);
+    void setUpstream(const Upstream& up)
+    {
+        m_up = up;
+    }
 
     /**
      * Called when a packet being is routed to the backend. The filter should
@@ -132,7 +147,10 @@ public:
      *
      * @param pPacket A client packet.
      */
-    int routeQuery(GWBUF* pPacket);
+    int routeQuery(GWBUF* pPacket)
+    {
+        return m_down.routeQuery(pPacket);
+    }
 
     /**
      * Called when a packet is routed to the client. The filter should
@@ -140,17 +158,25 @@ public:
      *
      * @param pPacket A client packet.
      */
-    int clientReply(GWBUF* pPacket);
+    int clientReply(GWBUF* pPacket)
+    {
+        return m_up.clientReply(pPacket);
+    }
 
     /**
      * Called for obtaining diagnostics about the filter session.
      *
      * @param pDcb  The dcb where the diagnostics should be written.
      */
-    void diagnostics(DCB *pDcb);
+    void diagnostics(DCB *pDcb)
+    {
+    }
 
 protected:
-    FilterSession(MXS_SESSION* pSession);
+    FilterSession(MXS_SESSION* pSession)
+        : m_pSession(pSession)
+    {
+    }
 
 protected:
     MXS_SESSION*   m_pSession; /*< The MXS_SESSION this filter session is associated with. */
@@ -189,6 +215,8 @@ protected:
  *
  * The concrete filter class must implement the methods @c create, @c newSession,
  * @c diagnostics and @c getCapabilities, with the prototypes as shown above.
+ * It may also implement @c int getMetrics(MXS_FILTER_METRIC* pMetrics) if it
+ * has metrics to report.
  *
  * The plugin function @c GetModuleObject is then implemented as follows:
  *
@@ -308,6 +336,26 @@ public:
         MXS_EXCEPTION_GUARD(delete pFilter);
     }
 
+    static int getMetrics(MXS_FILTER* pInstance, MXS_FILTER_METRIC* pMetrics)
+    {
+        int rv = 0;
+
+        FilterType* pFilter = static_cast<FilterType*>(pInstance);
+
+        MXS_EXCEPTION_GUARD(rv = pFilter->getMetrics(pMetrics));
+
+        return rv;
+    }
+
+    /**
+     * The default for filters that have no metrics. A filter that has metrics
+     * declares a method with the same prototype.
+     */
+    int getMetrics(MXS_FILTER_METRIC* pMetrics)
+    {
+        return 0;
+    }
+
     static MXS_FILTER_OBJECT s_object;
 };
 
@@ -326,6 +374,7 @@ MXS_FILTER_OBJECT Filter<FilterType, FilterSessionType>::s_object =
     &Filter<FilterType, FilterSessionType>::diagnostics,
     &Filter<FilterType, FilterSessionType>::getCapabilities,
     &Filter<FilterType, FilterSessionType>::destroyInstance,
+    &Filter<FilterType, FilterSessionType>::getMetrics,
 };
 
 
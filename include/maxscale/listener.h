@@ -20,6 +20,7 @@
 #include <maxscale/protocol.h>
 #include <maxscale/ssl.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/utils.h>
 
 MXS_BEGIN_DECLS
 
@@ -42,6 +43,8 @@ typedef struct servlistener
     char *auth_options;         /**< Authenticator options */
     void *auth_instance;        /**< Authenticator instance created in MXS_AUTHENTICATOR::initialize() */
     SSL_LISTENER *ssl;          /**< Structure of SSL data or NULL */
+    bool reuseport;             /**< Open one SO_REUSEPORT socket per thread */
+    MXS_SOCKET_OPTS sockopts;   /**< Options of the listening and the client sockets */
     struct dcb *listener;       /**< The DCB for the listener */
     struct users *users;        /**< The user data for this listener */
     struct service* service;    /**< The service which used by this listener */
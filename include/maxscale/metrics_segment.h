@@ -0,0 +1,96 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics_segment.h - The layout of the statistics segment
+ *
+ * When @c statistics_segment is configured, MaxScale periodically writes the
+ * same metrics that maxinfo returns from /metrics into a file that external
+ * tools can map into memory and read without contacting MaxScale. The file
+ * starts with a METRICS_SEGMENT_HEADER, followed by @c capacity records of
+ * @c record_size bytes, of which the first @c n_records are in use.
+ *
+ * The segment is updated in place. The generation is odd while the records
+ * are being written and is incremented to the next even value when they are
+ * complete, so a reader copies the records as follows:
+ *
+ * @code
+ * do
+ * {
+ *     gen = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+ *     n = header->n_records;
+ *     memcpy(copy, records, n * header->record_size);
+ *     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ * }
+ * while ((gen & 1) || gen != __atomic_load_n(&header->generation, __ATOMIC_RELAXED));
+ * @endcode
+ *
+ * If the records no longer fit, MaxScale replaces the file with a larger one
+ * and sets @c replaced in the old one, after which a reader must map the file
+ * again. The file is removed when MaxScale shuts down.
+ *
+ * The header contains only fixed size types so that the layout is the same
+ * for any reader. The version is incremented whenever the layout changes.
+ */
+
+#include <stdint.h>
+
+/** The magic bytes at the start of the segment, without a terminating null */
+#define METRICS_SEGMENT_MAGIC   "MXSSTATS"
+
+/** The version of the layout described here */
+#define METRICS_SEGMENT_VERSION 1
+
+/** The types of the metric families */
+enum metrics_segment_type
+{
+    METRICS_SEGMENT_COUNTER = 1, /**< A counter, only ever increases */
+    METRICS_SEGMENT_GAUGE   = 2, /**< A value that can go up and down */
+    METRICS_SEGMENT_SUMMARY = 3, /**< A latency quantile or the count of a latency summary */
+};
+
+typedef struct metrics_segment_header
+{
+    char     magic[8];    /**< METRICS_SEGMENT_MAGIC */
+    uint32_t version;     /**< METRICS_SEGMENT_VERSION */
+    uint32_t header_size; /**< Size of the header, the offset of the first record */
+    uint32_t record_size; /**< Size of one record */
+    uint32_t capacity;    /**< Number of records the segment has room for */
+    uint64_t generation;  /**< Odd while the records are being updated */
+    uint32_t n_records;   /**< Number of records in use */
+    uint32_t replaced;    /**< Non-zero if the file has been replaced with a larger one */
+    int64_t  pid;         /**< Process id of MaxScale */
+    int64_t  started;     /**< When MaxScale was started, seconds since the epoch */
+    int64_t  updated;     /**< When the records were last updated, seconds since the epoch */
+    uint32_t interval;    /**< Seconds between the updates */
+    uint32_t reserved;
+} METRICS_SEGMENT_HEADER;
+
+/**
+ * One sample of a metric
+ *
+ * The names are the same as in the OpenMetrics output of maxinfo and the
+ * strings are always null terminated. Unlike in that output, the quantiles
+ * of the latency summaries are in microseconds.
+ */
+typedef struct metrics_segment_record
+{
+    char     name[128];        /**< Name of the sample, e.g. maxscale_server_connections_total */
+    char     label[32];        /**< Name of the label, empty if the sample has no label */
+    char     label_value[128]; /**< Value of the label, e.g. the name of the server */
+    uint32_t type;             /**< The enum metrics_segment_type of the family */
+    uint32_t reserved;
+    double   quantile;         /**< Quantile of a latency sample, otherwise 0 */
+    int64_t  value;            /**< The value of the sample */
+} METRICS_SEGMENT_RECORD;
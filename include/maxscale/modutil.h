@@ -55,6 +55,100 @@ GWBUF*          modutil_create_mysql_err_msg(int             packet_number,
                                              const char      *msg);
 
 int modutil_count_signal_packets(GWBUF*, int, int, int*);
+
+/**
+ * The progress of the replies of a backend connection, kept between reads
+ */
+typedef struct mxs_reply_state
+{
+    bool in_rset;   /*< A result set is being read */
+    int  n_eof;     /*< EOF packets found in the result set */
+    bool continued; /*< The next packet continues a large packet */
+} MXS_REPLY_STATE;
+
+/** Markers of the packets of a reply */
+#define MXS_REPLY_OK           0x01 /*< OK packet that is a result of its own */
+#define MXS_REPLY_ERR          0x02 /*< ERR packet */
+#define MXS_REPLY_LOCAL_INFILE 0x04 /*< Request for the file of LOAD DATA LOCAL INFILE */
+#define MXS_REPLY_RSET_START   0x08 /*< Column count that starts a result set */
+#define MXS_REPLY_EOF          0x10 /*< EOF packet of a result set */
+#define MXS_REPLY_RESULT_END   0x20 /*< Last packet of a result */
+#define MXS_REPLY_END          0x40 /*< Last packet of the whole reply */
+
+typedef struct mxs_reply_packet
+{
+    uint32_t offset; /*< Offset of the packet from the start of the buffer */
+    uint32_t length; /*< Length of the packet, including the header */
+    uint16_t flags;  /*< MXS_REPLY_* markers */
+    uint16_t status; /*< Server status flags of a packet that ends a result */
+} MXS_REPLY_PACKET;
+
+/**
+ * The packets of the replies in a buffer
+ */
+typedef struct mxs_reply_info
+{
+    int               n_packets; /*< Number of packets in the buffer */
+    int               n_replies; /*< Number of replies that end in the buffer */
+    MXS_REPLY_PACKET *packets;   /*< The packets in the order they are in */
+} MXS_REPLY_INFO;
+
+/**
+ * @brief Start following the replies to a new command
+ *
+ * The state must be reset whenever a command is written to the connection,
+ * so that a reply that ended in an unexpected way does not affect the
+ * replies to the following commands.
+ *
+ * @param state The progress of the replies of the connection
+ */
+void modutil_reset_reply_state(MXS_REPLY_STATE *state);
+
+/**
+ * @brief Find the packets of replies and where the results and replies end
+ *
+ * A result is either an OK packet or a result set that ends in its second EOF
+ * packet, or in its first one if it has SERVER_STATUS_CURSOR_EXISTS set. Another
+ * result follows if the status flags of a result have SERVER_MORE_RESULTS_EXIST
+ * set. An ERR packet always ends the reply. Each
+ * packet is inspected only once, so this should be done by the protocol
+ * module for every read of a connection and the result passed on with
+ * modutil_add_reply_info().
+ *
+ * @param state   The progress of the replies of the connection
+ * @param command The command the replies are for
+ * @param buffer  Buffer containing only complete packets
+ *
+ * @return The packets of the buffer or NULL if the replies to @c command are
+ *         not made of results, or if memory allocation failed
+ */
+MXS_REPLY_INFO* modutil_parse_reply(MXS_REPLY_STATE *state, uint8_t command, GWBUF *buffer);
+
+/** Free the information returned by modutil_parse_reply() */
+void modutil_free_reply_info(MXS_REPLY_INFO *info);
+
+/**
+ * @brief Attach the packets of the replies to the buffer that they describe
+ *
+ * @param buffer Buffer whose packets @c info describes
+ * @param info   Information returned by modutil_parse_reply(), freed with the buffer,
+ *               or immediately if the buffer cannot hold more objects
+ */
+void modutil_add_reply_info(GWBUF *buffer, MXS_REPLY_INFO *info);
+
+/**
+ * @brief Get the packets of the replies in a buffer
+ *
+ * The information is available in the buffers that routers and filters
+ * declaring RCAP_TYPE_REPLY_INFO receive from the backend protocol, unless
+ * the replies are not made of results. A buffer created or modified by a
+ * filter has no information.
+ *
+ * @param buffer A reply buffer
+ *
+ * @return The packets of the buffer or NULL if there is no information
+ */
+const MXS_REPLY_INFO* modutil_get_reply_info(GWBUF *buffer);
 mxs_pcre2_result_t modutil_mysql_wildcard_match(const char* pattern, const char* string);
 
 /**
@@ -82,6 +176,7 @@ char* strnchr_esc_mysql(char* ptr, char c, int len);
 bool is_mysql_statement_end(const char* start, int len);
 bool is_mysql_sp_end(const char* start, int len);
 char* modutil_get_canonical(GWBUF* querybuf);
+size_t modutil_canonicalize(const char* sql, size_t len, char* dest, uint64_t* hash);
 
 // TODO: Move modutil out of the core
 const char* STRPACKETTYPE(int p);
@@ -138,6 +138,7 @@ typedef struct monitor_servers
     int mon_err_count;
     unsigned int mon_prev_status;
     unsigned int pending_status;  /**< Pending Status flag bitmap */
+    uint64_t probe_time;          /**< Duration of the last probe in milliseconds */
     struct monitor_servers *next; /**< The next server in the list */
 } MXS_MONITOR_SERVERS;
 
@@ -170,6 +171,8 @@ struct mxs_monitor
     volatile bool server_pending_changes;
     /**< Are there any pending changes to a server?
        * If yes, the next monitor loop starts early.  */
+    uint64_t tick_start;          /**< Start of the current monitoring cycle */
+    uint64_t tick_time;           /**< Duration of the last monitoring cycle in milliseconds */
     struct mxs_monitor *next;     /**< Next monitor in the linked list */
 };
 
@@ -220,6 +223,22 @@ mxs_connect_result_t mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *da
 void mon_log_connect_error(MXS_MONITOR_SERVERS* database, mxs_connect_result_t rval);
 
 void lock_monitor_servers(MXS_MONITOR *monitor);
+
+/** Function that probes one server of a monitor */
+typedef void (*mxs_monitor_probe_t)(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database);
+
+/**
+ * @brief Probe all servers of a monitor in parallel
+ *
+ * Each server is probed in a separate thread so that a slow server does not
+ * delay the probing of the others. The function returns when all servers have
+ * been probed and stores the duration of each probe in the @c probe_time of the
+ * server. The probe function must only modify the server it is given.
+ *
+ * @param monitor Monitor object
+ * @param probe   Function that probes one server
+ */
+void mon_probe_servers(MXS_MONITOR *monitor, mxs_monitor_probe_t probe);
 void release_monitor_servers(MXS_MONITOR *monitor);
 
 /**
@@ -250,4 +269,16 @@ void mon_hangup_failed_servers(MXS_MONITOR *monitor);
  */
 void mon_report_query_error(MXS_MONITOR_SERVERS* db);
 
+/**
+ * @brief Request an early check of a server
+ *
+ * Called when a connection to a server fails or is hung up. If the server is
+ * monitored, the monitor runs its next cycle without waiting for the rest of
+ * the monitor interval so that a failed server is detected sooner. The request
+ * is ignored if the server is already down.
+ *
+ * @param server The server whose connection failed
+ */
+void monitor_request_check(const SERVER *server);
+
 MXS_END_DECLS
@@ -41,5 +41,8 @@ mxs_pcre2_result_t mxs_pcre2_substitute(pcre2_code *re, const char *subject,
                                         const char *replace, char** dest, size_t* size);
 mxs_pcre2_result_t mxs_pcre2_simple_match(const char* pattern, const char* subject,
                                           int options, int* error);
+size_t mxs_pcre2_get_literal(const char *pattern, bool caseless, char *dest, size_t size);
+bool mxs_pcre2_has_literal(const char *subject, size_t subject_len,
+                           const char *literal, size_t literal_len, bool caseless);
 
 MXS_END_DECLS
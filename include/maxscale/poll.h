@@ -91,4 +91,39 @@ int poll_remove_dcb(DCB *);
  */
 void poll_add_epollin_event_to_dcb(DCB* dcb, GWBUF* buf);
 
+/**
+ * A task executed by a polling thread
+ *
+ * @param thread_id The ID of the thread executing the task
+ * @param data      The data given when the task was posted
+ */
+typedef void (*POLL_TASK_FN)(int thread_id, void *data);
+
+/**
+ * Post a task to a polling thread
+ *
+ * The task is added to the thread's task queue without taking any locks and
+ * the thread is woken up if it is waiting for events. The tasks posted to a
+ * thread are executed in the order they were posted. This function can be
+ * called from any thread.
+ *
+ * @param thread_id The ID of the thread that executes the task
+ * @param func      The task to execute
+ * @param data      Data passed to the task
+ * @return          True if the task was posted, false on memory allocation failure
+ */
+bool poll_post_task(int thread_id, POLL_TASK_FN func, void *data);
+
+/**
+ * Execute a task in all polling threads and wait for it to complete
+ *
+ * If called from a polling thread, the task is executed directly in that
+ * thread and the tasks posted to it are processed while waiting for the
+ * other threads. The polling threads must be running.
+ *
+ * @param func The task to execute
+ * @param data Data passed to the task
+ */
+void poll_execute_on_all(POLL_TASK_FN func, void *data);
+
 MXS_END_DECLS
@@ -0,0 +1,48 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file probe.h - Static tracing probes
+ *
+ * When MaxScale is built with sys/sdt.h available, the MXS_PROBE macros add
+ * USDT probes in the @c maxscale provider that perf, bpftrace and SystemTap
+ * can attach to in a running process. A probe that nothing is attached to is
+ * a single nop instruction, but its arguments are still evaluated, so they
+ * must be cheap to compute. Without sys/sdt.h the macros expand to nothing.
+ *
+ * The probes are listed in Documentation/Reference/Probes.md, which must be
+ * updated when probes are added or their arguments change.
+ */
+
+#include <maxscale/cdefs.h>
+
+#if defined(MXS_USDT)
+
+#include <sys/sdt.h>
+
+#define MXS_PROBE0(name)                 DTRACE_PROBE(maxscale, name)
+#define MXS_PROBE1(name, a1)             DTRACE_PROBE1(maxscale, name, a1)
+#define MXS_PROBE2(name, a1, a2)         DTRACE_PROBE2(maxscale, name, a1, a2)
+#define MXS_PROBE3(name, a1, a2, a3)     DTRACE_PROBE3(maxscale, name, a1, a2, a3)
+#define MXS_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(maxscale, name, a1, a2, a3, a4)
+
+#else
+
+#define MXS_PROBE0(name)                 do {} while (false)
+#define MXS_PROBE1(name, a1)             do {} while (false)
+#define MXS_PROBE2(name, a1, a2)         do {} while (false)
+#define MXS_PROBE3(name, a1, a2, a3)     do {} while (false)
+#define MXS_PROBE4(name, a1, a2, a3, a4) do {} while (false)
+
+#endif
@@ -60,6 +60,7 @@
 #include <maxscale/users.h>
 #include <maxscale/version.h>
 #include <maxscale/housekeeper.h>
+#include <maxscale/modutil.h>
 #include <maxscale/utils.h>
 #include <mysql.h>
 
@@ -73,6 +74,9 @@ MXS_BEGIN_DECLS
 #define MYSQL_HEADER_LEN 4
 #define MYSQL_CHECKSUM_LEN 4
 #define MYSQL_EOF_PACKET_LEN 9
+#define MYSQL_COMPRESSED_HEADER_LEN 7
+/** Data shorter than this is not worth compressing */
+#define MYSQL_COMPRESS_MIN_LEN 50
 #define MYSQL_OK_PACKET_MIN_LEN 11
 #define MYSQL_ERR_PACKET_MIN_LEN 9
 
@@ -119,6 +123,7 @@ MXS_BEGIN_DECLS
 #define MAX_CHUNK SMALL_CHUNK * 8 * 4
 #define ToHex(Y) (Y>='0'&&Y<='9'?Y-'0':Y-'A'+10)
 #define COM_QUIT_PACKET_SIZE (4+1)
+#define GW_MYSQL_COM_RESET_CONNECTION 0x1f // Not known to all connector versions
 struct dcb;
 
 
@@ -265,6 +270,21 @@ typedef enum
 #define MXS_MARIA_CAP_COM_MULTI            (1 << 1)
 #define MXS_MARIA_CAP_STMT_BULK_OPERATIONS (1 << 2)
 
+/** Server status flags that are not defined by all client library versions */
+#define MXS_SERVER_STATUS_IN_TRANS_READONLY 0x2000
+#define MXS_SERVER_SESSION_STATE_CHANGED    0x4000
+
+/** Types of the session state information in OK packets */
+typedef enum
+{
+    MXS_SESSION_TRACK_SYSTEM_VARIABLES      = 0,
+    MXS_SESSION_TRACK_SCHEMA                = 1,
+    MXS_SESSION_TRACK_STATE_CHANGE          = 2,
+    MXS_SESSION_TRACK_GTIDS                 = 3,
+    MXS_SESSION_TRACK_TRX_CHARACTERISTICS   = 4,
+    MXS_SESSION_TRACK_TRX_STATE             = 5
+} mxs_session_track_t;
+
 typedef enum enum_server_command mysql_server_cmd_t;
 
 static const mysql_server_cmd_t MYSQL_COM_UNDEFINED = (mysql_server_cmd_t) - 1;
@@ -308,6 +328,19 @@ typedef struct
     unsigned int           charset;                      /*< MySQL character set at connect time */
     bool                   ignore_reply;                 /*< If the reply should be discarded */
     GWBUF*                 stored_query;                 /*< Temporarily stored queries */
+    int                    reset_replies;                /*< Replies of a connection reset left to discard */
+    bool                   large_query;                  /*< The next packet continues a large query */
+    size_t                 rset_scanned;                 /*< Bytes of a pending result set already inspected */
+    int                    rset_eofs;                    /*< EOF packets found in the pending result set */
+    bool                   compress;                     /*< Whether the compressed protocol is used */
+    uint8_t                compressed_seq;               /*< Next sequence of a compressed packet */
+    GWBUF*                 compressed_queue;             /*< Partial compressed packet */
+    bool                   session_track;                /*< Whether the server reports session state changes */
+    MXS_REPLY_STATE        reply_state;                  /*< Progress of the replies being read */
+    bool                   result_start;                 /*< The next reply packet starts a result */
+    bool                   have_status;                  /*< Whether server_status has been received */
+    uint16_t               server_status;                /*< Status flags of the latest OK or EOF packet */
+    char                   tracked_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Default database reported by the server */
 #if defined(SS_DEBUG)
     skygw_chk_t            protocol_chk_tail;
 #endif
@@ -442,4 +475,31 @@ bool mxs_mysql_is_ok_packet(GWBUF *buffer);
 /** Check for result set */
 bool mxs_mysql_is_result_set(GWBUF *buffer);
 
+/**
+ * @brief Wrap data in compressed packets
+ *
+ * Data shorter than MYSQL_COMPRESS_MIN_LEN, or data that does not get any
+ * shorter, is sent in compressed packets with an uncompressed payload.
+ *
+ * @param proto  Protocol that uses the compressed protocol
+ * @param buffer Any number of MySQL packets or parts of them, freed by this call
+ *
+ * @return The compressed packets or NULL on memory allocation failure
+ */
+GWBUF* mxs_mysql_compress(MySQLProtocol *proto, GWBUF *buffer);
+
+/**
+ * @brief Extract the data in complete compressed packets
+ *
+ * @param proto  Protocol that uses the compressed protocol
+ * @param buffer Received data, on return the data of a partial compressed packet
+ * @param error  Set to true if a packet could not be decompressed
+ *
+ * @return The data of the complete compressed packets or NULL if there are none
+ */
+GWBUF* mxs_mysql_decompress(MySQLProtocol *proto, GWBUF **buffer, bool *error);
+
+/** Free the compression state of the calling thread */
+void mxs_mysql_compress_thread_finish(void);
+
 MXS_END_DECLS
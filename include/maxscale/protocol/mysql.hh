@@ -12,11 +12,23 @@
  * Public License.
  */
 
+/**
+ * @file protocol/mysql.hh - Views of MySQL packets
+ *
+ * The classes in this file parse MySQL packets in place. They do not copy
+ * the data and do not allocate memory, so they are cheap enough to be used
+ * on every packet that passes through a filter. The classes derived from
+ * @c ComPacket require the packet to be contiguous, while @c ComChainReader
+ * walks the packets of a response that is spread over a chain of buffers.
+ */
+
 #include <maxscale/cppdefs.hh>
+#include <algorithm>
 #include <ostream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <string.h>
 #include <maxscale/buffer.h>
 #include <maxscale/mysql_utils.h>
 #include <maxscale/protocol/mysql.h>
@@ -438,7 +450,7 @@ inline LEncString::iterator operator + (const LEncString::iterator& it, ptrdiff_
 {
     LEncString::iterator rv(it);
     rv += n;
-    return it;
+    return rv;
 }
 
 /**
@@ -470,7 +482,7 @@ inline LEncString::iterator operator - (const LEncString::iterator& it, ptrdiff_
 {
     LEncString::iterator rv(it);
     rv -= n;
-    return it;
+    return rv;
 }
 
 /**
@@ -642,6 +654,141 @@ private:
     uint16_t m_status;
 };
 
+/**
+ * @class ComOK
+ *
+ * An OK packet.
+ */
+class ComOK : public ComResponse
+{
+public:
+    ComOK(GWBUF* pPacket)
+        : ComResponse(pPacket)
+    {
+        ss_dassert(m_type == OK_PACKET);
+
+        extract_payload();
+    }
+
+    ComOK(const ComResponse& response)
+        : ComResponse(response)
+    {
+        ss_dassert(m_type == OK_PACKET);
+
+        extract_payload();
+    }
+
+    uint64_t affected_rows() const
+    {
+        return m_affected_rows;
+    }
+
+    uint64_t last_insert_id() const
+    {
+        return m_last_insert_id;
+    }
+
+    uint16_t status() const
+    {
+        return m_status;
+    }
+
+    uint16_t warnings() const
+    {
+        return m_warnings;
+    }
+
+private:
+    void extract_payload()
+    {
+        m_affected_rows = LEncInt(&m_pData).value();
+        m_last_insert_id = LEncInt(&m_pData).value();
+
+        m_status = *m_pData++;
+        m_status += (*m_pData++ << 8);
+
+        m_warnings = *m_pData++;
+        m_warnings += (*m_pData++ << 8);
+    }
+
+private:
+    uint64_t m_affected_rows;
+    uint64_t m_last_insert_id;
+    uint16_t m_status;
+    uint16_t m_warnings;
+};
+
+/**
+ * @class ComERR
+ *
+ * An ERR packet. The message refers to the packet and is not
+ * zero-terminated.
+ */
+class ComERR : public ComResponse
+{
+public:
+    ComERR(GWBUF* pPacket)
+        : ComResponse(pPacket)
+    {
+        ss_dassert(m_type == ERR_PACKET);
+
+        extract_payload();
+    }
+
+    ComERR(const ComResponse& response)
+        : ComResponse(response)
+    {
+        ss_dassert(m_type == ERR_PACKET);
+
+        extract_payload();
+    }
+
+    uint16_t code() const
+    {
+        return m_code;
+    }
+
+    /**
+     * @return The SQL state, 5 characters that are not zero-terminated.
+     */
+    const char* state() const
+    {
+        return m_pState;
+    }
+
+    const char* message() const
+    {
+        return m_pMessage;
+    }
+
+    size_t message_len() const
+    {
+        return m_message_len;
+    }
+
+private:
+    void extract_payload()
+    {
+        const uint8_t* pEnd = m_pData - 1 + payload_len();
+
+        m_code = *m_pData++;
+        m_code += (*m_pData++ << 8);
+
+        // The SQL state marker '#' and the 5 character state.
+        m_pState = reinterpret_cast<const char*>(m_pData + 1);
+        m_pData += 6;
+
+        m_pMessage = reinterpret_cast<const char*>(m_pData);
+        m_message_len = pEnd - m_pData;
+    }
+
+private:
+    uint16_t    m_code;
+    const char* m_pState;
+    const char* m_pMessage;
+    size_t      m_message_len;
+};
+
 /**
  * @class ComRequest
  *
@@ -1227,3 +1374,240 @@ public:
 private:
     LEncInt m_nFields;
 };
+
+/**
+ * @class ComChainReader
+ *
+ * @c ComChainReader walks the packets of a chain of buffers, such as a
+ * response that is collected until it is complete. The header and the
+ * leading payload bytes of the current packet are copied into the reader,
+ * so its type, the length encoded integer it starts with and the fixed
+ * size fields that follow can be read even if the packet spans several
+ * buffers. The reader never moves backwards in the chain, so walking all
+ * packets of a chain is linear in the number of buffers.
+ *
+ * The chain must not be modified while the reader is used.
+ */
+class ComChainReader
+{
+public:
+    enum
+    {
+        PREFIX_LEN = 9 // The type byte and fixed size fields, or the largest length encoded integer.
+    };
+
+    /**
+     * Constructor
+     *
+     * @param pBuffer  The chain.
+     * @param offset   The offset of the first packet to read.
+     */
+    ComChainReader(const GWBUF* pBuffer, size_t offset = 0)
+        : m_pBuffer(pBuffer)
+        , m_pos(0)
+        , m_offset(0)
+        , m_left(0)
+        , m_prefix_len(0)
+    {
+        for (const GWBUF* p = pBuffer; p; p = p->next)
+        {
+            m_left += GWBUF_LENGTH(p);
+        }
+
+        skip(offset);
+        load();
+    }
+
+    /**
+     * @return The offset of the current packet from the start of the chain.
+     */
+    size_t offset() const
+    {
+        return m_offset;
+    }
+
+    /**
+     * @return True, if the header of the current packet is available.
+     */
+    bool at_packet() const
+    {
+        return m_prefix_len >= MYSQL_HEADER_LEN;
+    }
+
+    /**
+     * @return True, if the whole current packet is available.
+     */
+    bool is_complete() const
+    {
+        return at_packet() && m_left >= packet_len();
+    }
+
+    uint32_t payload_len() const
+    {
+        ss_dassert(at_packet());
+        return MYSQL_GET_PAYLOAD_LEN(m_prefix);
+    }
+
+    uint32_t packet_len() const
+    {
+        return MYSQL_HEADER_LEN + payload_len();
+    }
+
+    uint8_t packet_no() const
+    {
+        ss_dassert(at_packet());
+        return MYSQL_GET_PACKET_NO(m_prefix);
+    }
+
+    /**
+     * @return True, if the first byte of the payload is available.
+     */
+    bool has_type() const
+    {
+        return m_prefix_len > MYSQL_HEADER_LEN;
+    }
+
+    /**
+     * @return The first byte of the payload, that is, the command of a request
+     *         or the type of a response.
+     */
+    uint8_t type() const
+    {
+        ss_dassert(has_type());
+        return m_prefix[MYSQL_HEADER_LEN];
+    }
+
+    bool is_ok() const
+    {
+        return has_type() && type() == ComResponse::OK_PACKET;
+    }
+
+    bool is_err() const
+    {
+        return has_type() && type() == ComResponse::ERR_PACKET;
+    }
+
+    /**
+     * @return True, if the packet is an EOF packet. A packet that starts with
+     *         0xfe but is longer than an EOF packet is a row or a length
+     *         encoded integer.
+     */
+    bool is_eof() const
+    {
+        return packet_len() == ComEOF::PACKET_LEN && type() == ComResponse::EOF_PACKET;
+    }
+
+    bool is_local_infile() const
+    {
+        return has_type() && type() == ComResponse::LOCAL_INFILE_PACKET;
+    }
+
+    /**
+     * @return True, if the length encoded integer the payload starts with is available.
+     */
+    bool has_leint() const
+    {
+        return has_type() &&
+            m_prefix_len >= MYSQL_HEADER_LEN + mxs_leint_bytes(m_prefix + MYSQL_HEADER_LEN);
+    }
+
+    /**
+     * @return The value of the length encoded integer the payload starts with.
+     */
+    uint64_t leint() const
+    {
+        ss_dassert(has_leint());
+        return mxs_leint_value(m_prefix + MYSQL_HEADER_LEN);
+    }
+
+    /**
+     * @return The size of the length encoded integer the payload starts with.
+     */
+    size_t leint_bytes() const
+    {
+        ss_dassert(has_leint());
+        return mxs_leint_bytes(m_prefix + MYSQL_HEADER_LEN);
+    }
+
+    /**
+     * @param pos  A position within the first @c PREFIX_LEN bytes of the payload.
+     *
+     * @return The 2 byte integer at the position.
+     */
+    uint16_t get_byte2(size_t pos) const
+    {
+        ss_dassert(MYSQL_HEADER_LEN + pos + 2 <= m_prefix_len);
+        return gw_mysql_get_byte2(m_prefix + MYSQL_HEADER_LEN + pos);
+    }
+
+    /**
+     * @param pos  A position within the first @c PREFIX_LEN bytes of the payload.
+     *
+     * @return The 4 byte integer at the position.
+     */
+    uint32_t get_byte4(size_t pos) const
+    {
+        ss_dassert(MYSQL_HEADER_LEN + pos + 4 <= m_prefix_len);
+        return gw_mysql_get_byte4(m_prefix + MYSQL_HEADER_LEN + pos);
+    }
+
+    /**
+     * Move to the next packet. The current packet must be complete.
+     */
+    void next()
+    {
+        ss_dassert(is_complete());
+        skip(packet_len());
+        load();
+    }
+
+private:
+    void skip(size_t n)
+    {
+        ss_dassert(n <= m_left);
+        m_offset += n;
+        m_left -= n;
+        n += m_pos;
+
+        while (m_pBuffer && n >= (size_t)GWBUF_LENGTH(m_pBuffer))
+        {
+            n -= GWBUF_LENGTH(m_pBuffer);
+            m_pBuffer = m_pBuffer->next;
+        }
+
+        m_pos = n;
+    }
+
+    void load()
+    {
+        const GWBUF* pBuffer = m_pBuffer;
+        size_t pos = m_pos;
+
+        m_prefix_len = 0;
+
+        while (pBuffer && m_prefix_len < sizeof(m_prefix))
+        {
+            size_t n = std::min(GWBUF_LENGTH(pBuffer) - pos, sizeof(m_prefix) - m_prefix_len);
+
+            memcpy(m_prefix + m_prefix_len, GWBUF_DATA(pBuffer) + pos, n);
+            m_prefix_len += n;
+
+            pBuffer = pBuffer->next;
+            pos = 0;
+        }
+
+        if (m_prefix_len >= MYSQL_HEADER_LEN && m_prefix_len > packet_len())
+        {
+            // Only the bytes of the current packet belong to the prefix.
+            m_prefix_len = packet_len();
+        }
+    }
+
+private:
+    const GWBUF* m_pBuffer;                               /*<! The buffer of the current packet. */
+    size_t       m_pos;                                   /*<! The position of the packet in the buffer. */
+    size_t       m_offset;                                /*<! The offset of the packet in the chain. */
+    size_t       m_left;                                  /*<! Bytes from the packet to the end of the chain. */
+    uint8_t      m_prefix[MYSQL_HEADER_LEN + PREFIX_LEN]; /*<! The leading bytes of the packet. */
+    size_t       m_prefix_len;                            /*<! The number of bytes in the prefix. */
+};
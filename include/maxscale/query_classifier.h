@@ -17,7 +17,7 @@
 
 MXS_BEGIN_DECLS
 
-#define QUERY_CLASSIFIER_VERSION {1, 1, 0}
+#define QUERY_CLASSIFIER_VERSION {1, 2, 0}
 
 /**
  * qc_init_kind_t specifies what kind of initialization should be performed.
@@ -374,6 +374,41 @@ typedef struct query_classifier
      *         exhaustion or equivalent.
      */
     int32_t (*qc_get_preparable_stmt)(GWBUF* stmt, GWBUF** preparable_stmt);
+
+    /**
+     * Returns all table names, without copying them.
+     *
+     * @param stmt       A COM_QUERY or COM_STMT_PREPARE packet.
+     * @param fullnames  If non-zero, the full (i.e. qualified) names are returned.
+     * @param names      On return, the names of the statement, if @c QC_RESULT_OK
+     *                   is returned.
+     * @param n_names    On return, how many names were returned, if @c QC_RESULT_OK
+     *                   is returned.
+     *
+     * @attention The returned array and names are the property of @c stmt and
+     *            will be deleted when @c stmt is.
+     *
+     * @return QC_RESULT_OK, if the parsing was not aborted due to resource
+     *         exhaustion or equivalent.
+     */
+    int32_t (*qc_get_table_names_ref)(GWBUF* stmt, int32_t fullnames,
+                                      const char* const** names, uint32_t* n_names);
+
+    /**
+     * Reports the database names, without copying them.
+     *
+     * @param stmt     A COM_QUERY or COM_STMT_PREPARE packet.
+     * @param names    On return, the database names, if @c QC_RESULT_OK is returned.
+     * @param n_names  On return, the number of names in @c names, if @c QC_RESULT_OK
+     *                 is returned.
+     *
+     * @attention The returned array and names are the property of @c stmt and
+     *            will be deleted when @c stmt is.
+     *
+     * @return QC_RESULT_OK, if the parsing was not aborted due to resource
+     *         exhaustion or equivalent.
+     */
+    int32_t (*qc_get_database_names_ref)(GWBUF* stmt, const char* const** names, uint32_t* n_names);
 } QUERY_CLASSIFIER;
 
 /**
@@ -590,6 +625,22 @@ char* qc_get_created_table_name(GWBUF* stmt);
  */
 char** qc_get_database_names(GWBUF* stmt, int* size);
 
+/**
+ * Returns the databases accessed by the statement, without copying them.
+ * Note that a possible default database is not returned.
+ *
+ * @param stmt     A buffer containing a COM_QUERY or COM_STMT_PREPARE packet.
+ * @param names    Pointer to pointer that after the call will point to an
+ *                 array of database names.
+ * @param n_names  Pointer to size_t variable where the number of names
+ *                 in @c names will be returned.
+ *
+ * @note The returned array belongs to the GWBUF and remains valid for as
+ *       long as the GWBUF is valid. If the data is needed for longer than
+ *       that, it must be copied.
+ */
+void qc_get_database_names_ref(GWBUF* stmt, const char* const** names, size_t* n_names);
+
 /**
  * Returns the operation of the statement.
  *
@@ -654,6 +705,23 @@ GWBUF* qc_get_preparable_stmt(GWBUF* stmt);
  */
 char** qc_get_table_names(GWBUF* stmt, int* size, bool fullnames);
 
+/**
+ * Returns the tables accessed by the statement, without copying them.
+ *
+ * @param stmt       A buffer containing a COM_QUERY or COM_STMT_PREPARE packet.
+ * @param fullnames  If true, a table names will include the database name
+ *                   as well (if explicitly referred to in the statement).
+ * @param names      Pointer to pointer that after the call will point to an
+ *                   array of table names.
+ * @param n_names    Pointer to size_t variable where the number of names
+ *                   in @c names will be returned.
+ *
+ * @note The returned array belongs to the GWBUF and remains valid for as
+ *       long as the GWBUF is valid. If the data is needed for longer than
+ *       that, it must be copied.
+ */
+void qc_get_table_names_ref(GWBUF* stmt, bool fullnames, const char* const** names, size_t* n_names);
+
 
 /**
  * Returns a bitmask specifying the type(s) of the statement. The result
@@ -668,6 +736,25 @@ char** qc_get_table_names(GWBUF* stmt, int* size, bool fullnames);
  */
 uint32_t qc_get_type_mask(GWBUF* stmt);
 
+/**
+ * Returns the type bitmask of each statement of a multi-statement query.
+ *
+ * The statements are split at the semicolons that are not inside quotes or
+ * comments and each statement is classified separately. Comments and empty
+ * statements between the semicolons are ignored. If the query contains a
+ * single statement, the result is that of @c qc_get_type_mask.
+ *
+ * @param stmt     A buffer containing a COM_QUERY packet.
+ * @param n_masks  On return, the number of statements.
+ *
+ * @return Array of type bitmasks, one for each statement in the order they
+ *         appear in the query, or NULL if the query contains no statements
+ *         or a memory allocation fails.
+ *
+ * @note The returned array @b must be freed by the caller.
+ */
+uint32_t* qc_get_type_masks(GWBUF* stmt, int* n_masks);
+
 /**
  * Returns the type bitmask of transaction related statements.
  *
@@ -692,6 +779,21 @@ uint32_t qc_get_type_mask(GWBUF* stmt);
  */
 uint32_t qc_get_trx_type_mask(GWBUF* stmt);
 
+/**
+ * Returns the type bitmask of a statement that only affects the transaction
+ * state, the autocommit mode or the state of the session. That is, BEGIN,
+ * START TRANSACTION, COMMIT, ROLLBACK, SET autocommit, SET TRANSACTION, USE
+ * and XA statements. The statement is recognized by a light-weight parser,
+ * without the query classifier being used.
+ *
+ * @param stmt A COM_QUERY packet.
+ *
+ * @return The type bitmask of the statement, or 0 if the statement is not
+ *         one of those recognized, in which case @c qc_get_type_mask must
+ *         be used.
+ */
+uint32_t qc_get_session_type_mask(GWBUF* stmt);
+
 /**
  * Returns whether the statement is a DROP TABLE statement.
  *
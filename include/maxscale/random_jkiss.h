@@ -17,9 +17,10 @@
 MXS_BEGIN_DECLS
 
 /**
- * @brief Initialize the random number generator
+ * @brief Initialize the random number generator of the calling thread
  *
- * Uses /dev/urandom if available, and warms the generator up with 1000 iterations.
+ * Uses /dev/urandom if available. Each thread has its own generator which
+ * random_jkiss() seeds on first use, so calling this is optional.
  */
 void random_jkiss_init(void);
 
@@ -27,6 +28,7 @@ void random_jkiss_init(void);
  * @brief Return a pseudo-random number
  *
  * Return a pseudo-random number that satisfies major tests for random sequences.
+ * The generator is per thread and needs no locking.
  *
  * @return A random number
  */
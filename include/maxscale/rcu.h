@@ -0,0 +1,46 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file rcu.h - Deferred freeing of data read without locks
+ *
+ * Data that the polling threads read without locks, such as the server
+ * snapshots of the services, is never modified in place. A writer builds a
+ * new copy, publishes it with atomic_store_ptr and retires the old copy with
+ * mxs_rcu_retire. The old copy is freed once every polling thread has passed
+ * a quiescent point, that is, has returned to the poll loop, after which no
+ * thread can hold a pointer to it.
+ *
+ * A polling thread must therefore not keep a pointer to published data
+ * across the handling of an event. Other threads do not take part in the
+ * quiescent points and must hold the lock of the writers while they use the
+ * published data.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Free data once no polling thread can be using it
+ *
+ * The data must already have been replaced with a new version so that it
+ * can no longer be found by the readers. Can be called from any thread.
+ *
+ * @param data    The data to free
+ * @param free_fn The function that frees the data
+ */
+void mxs_rcu_retire(void *data, void (*free_fn)(void *data));
+
+MXS_END_DECLS
@@ -42,6 +42,11 @@ typedef enum routing_capability
     RCAP_TYPE_CONTIGUOUS_OUTPUT     = 0x0030, /* 0b0000000000110000 */
     /** Result sets are delivered in one buffer; implies RCAP_TYPE_STMT_OUTPUT. */
     RCAP_TYPE_RESULTSET_OUTPUT      = 0x0050, /* 0b0000000001110000 */
+    /** The session state that the servers report in the replies is tracked. */
+    RCAP_TYPE_SESSION_STATE_TRACKING = 0x0080, /* 0b0000000010000000 */
+    /** Replies are delivered in complete packets, with the packets described by
+        an MXS_REPLY_INFO; see modutil_get_reply_info(). */
+    RCAP_TYPE_REPLY_INFO             = 0x0100, /* 0b0000000100000000 */
 
 } mxs_routing_capability_t;
 
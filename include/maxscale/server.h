@@ -21,6 +21,8 @@
 #include <maxscale/cdefs.h>
 #include <maxscale/dcb.h>
 #include <maxscale/resultset.h>
+#include <maxscale/statistics.h>
+#include <maxscale/utils.h>
 
 MXS_BEGIN_DECLS
 
@@ -51,8 +53,30 @@ typedef struct
     int n_persistent;     /**< Current persistent pool */
     uint64_t n_new_conn;  /**< Times the current pool was empty */
     uint64_t n_from_pool; /**< Times when a connection was available from the pool */
+    int64_t response_time; /**< Average time to the first reply packet in microseconds */
+    ts_hist_t latency;     /**< Times to the complete replies, allocated on first use */
 } SERVER_STATS;
 
+/**
+ * The state of a server that routers use for routing decisions. Monitors
+ * publish a copy of the state of all of their servers at the end of each
+ * monitoring cycle and routers read a consistent copy of it with
+ * server_get_states() instead of reading the fields that the monitor is
+ * updating.
+ */
+typedef struct server_state
+{
+    unsigned int status;    /**< Status flag bitmap for the server */
+    int          rlag;      /**< Replication Lag for Master / Slave replication */
+    int          rlag_ms;   /**< Replication lag in milliseconds */
+    unsigned long node_ts;  /**< Last timestamp set from M/S monitor module */
+    long         node_id;   /**< Node id, server_id for M/S or local_index for Galera */
+    long         master_id; /**< Master server id of this node */
+    int          depth;     /**< Replication level in the tree */
+    int          load;      /**< Load reported by the monitor, see SERVER_LOAD_MAX */
+    uint64_t     synced_ms; /**< See SERVER::synced_ms */
+} SERVER_STATE;
+
 /**
  * The SERVER structure defines a backend server. Each server has a name
  * or IP address for the server, a port that the server listens on and
@@ -68,6 +92,8 @@ typedef struct server
     char           *unique_name;   /**< Unique name for the server */
     char           name[MAX_SERVER_NAME_LEN]; /**< Server name/IP address*/
     unsigned short port;           /**< Port to listen on */
+    char           *socket;        /**< Unix domain socket to connect to instead of the port, or NULL */
+    MXS_SOCKET_OPTS sockopts;      /**< Options of the sockets connected to the server */
     char           *protocol;      /**< Protocol module to use */
     char           *authenticator; /**< Authenticator module name */
     void           *auth_instance; /**< Authenticator instance */
@@ -83,10 +109,15 @@ typedef struct server
     char           *server_string; /**< Server version string, i.e. MySQL server version */
     long           node_id;        /**< Node id, server_id for M/S or local_index for Galera */
     int            rlag;           /**< Replication Lag for Master / Slave replication */
+    int            rlag_ms;        /**< Replication lag in milliseconds measured from GTID positions */
+    uint64_t       synced_ms;      /**< Time, in milliseconds of CLOCK_MONOTONIC, before which all
+                                    *   transactions committed on the master are known to be on
+                                    *   this server, 0 if not known */
     unsigned long  node_ts;        /**< Last timestamp set from M/S monitor module */
     SERVER_PARAM   *parameters;    /**< Parameters of a server that may be used to weight routing decisions */
     long           master_id;      /**< Master server id of this node */
     int            depth;          /**< Replication level in the tree */
+    int            load;           /**< Load reported by the monitor, see SERVER_LOAD_MAX */
     long           slaves[MAX_NUM_SLAVES]; /**< Slaves of this node */
     bool           master_err_is_logged; /*< If node failed, this indicates whether it is logged */
     DCB            **persistent;    /**< List of unused persistent connections to the server */
@@ -96,6 +127,7 @@ typedef struct server
     uint8_t        charset;        /**< Default server character set */
     bool           is_active;      /**< Server is active and has not been "destroyed" */
     bool           created_online; /**< Whether this server was created after startup */
+    SERVER_STATE   published;      /**< The state last published for the routers */
 #if defined(SS_DEBUG)
     skygw_chk_t    server_chk_tail;
 #endif
@@ -107,6 +139,13 @@ enum
     MAX_RLAG_UNDEFINED = -2
 };
 
+/**
+ * The load of a server is reported by the monitor as a value from 0, a server
+ * that can take more work, to SERVER_LOAD_MAX, a server that should be avoided.
+ * Monitors that do not measure the load leave it at 0.
+ */
+#define SERVER_LOAD_MAX 1000
+
 /**
  * Status bits in the server->status member.
  *
@@ -264,6 +303,29 @@ bool server_remove_parameter(SERVER *server, const char *name);
  */
 bool server_is_mxs_service(const SERVER *server);
 
+/**
+ * @brief Add a response time sample to the average response time of a server
+ *
+ * Routers call this when they receive the first reply packet of a query. The
+ * average is an exponentially weighted moving average where concurrent
+ * updates may lose samples.
+ *
+ * @param server Server that replied
+ * @param usecs  Time from sending the query to the first reply in microseconds
+ */
+void server_add_response_time(SERVER *server, int64_t usecs);
+
+/**
+ * @brief Add the time it took a server to reply to a query
+ *
+ * Routers call this when the last packet of the reply has arrived. The
+ * percentiles of the times are shown with the server statistics.
+ *
+ * @param server Server that replied
+ * @param usecs  Time from sending the query to the complete reply in microseconds
+ */
+void server_add_latency(SERVER *server, int64_t usecs);
+
 extern int server_free(SERVER *server);
 extern SERVER *server_find_by_unique_name(const char *name);
 extern SERVER *server_find(const char *servname, unsigned short port);
@@ -273,6 +335,7 @@ extern void server_set_status_nolock(SERVER *server, int bit);
 extern void server_clear_status_nolock(SERVER *server, int bit);
 extern void server_transfer_status(SERVER *dest_server, const SERVER *source_server);
 extern void server_add_mon_user(SERVER *server, const char *user, const char *passwd);
+extern bool server_set_socket(SERVER *server, const char *path);
 extern const char *server_get_parameter(const SERVER *server, char *name);
 extern void server_update_credentials(SERVER *server, const char *user, const char *passwd);
 extern DCB  *server_get_persistent(SERVER *server, const char *user, const char *protocol, int id);
@@ -283,6 +346,41 @@ extern bool server_set_version_string(SERVER* server, const char* string);
 extern void server_set_status(SERVER *server, int bit);
 extern void server_clear_status(SERVER *server, int bit);
 
+/**
+ * @brief Publish the current state of servers
+ *
+ * Copies the status, replication lag and replication topology of each server
+ * into its published state. All servers are published at once so that readers
+ * never see the new state of some servers and the old state of others.
+ *
+ * @param servers   Servers to publish
+ * @param n_servers Number of servers
+ */
+extern void server_publish_states(SERVER **servers, int n_servers);
+
+/**
+ * @brief Get the published state of servers
+ *
+ * The function never blocks: if the states are published while they are
+ * being read, they are read again.
+ *
+ * @param servers   Servers whose state is read
+ * @param n_servers Number of servers
+ * @param states    Array of @c n_servers where the states are stored
+ */
+extern void server_get_states(SERVER **servers, int n_servers, SERVER_STATE *states);
+
+/**
+ * @brief Get the version of the published server states
+ *
+ * The version changes every time the states of any servers are published.
+ * Routers can use it to tell whether something they derived from the states
+ * needs to be recomputed.
+ *
+ * @return The current version
+ */
+extern uint64_t server_states_version(void);
+
 extern void printServer(const SERVER *);
 extern void printAllServers();
 extern void dprintAllServers(DCB *);
@@ -20,6 +20,7 @@
 
 #include <maxscale/cdefs.h>
 #include <time.h>
+#include <maxscale/atomic.h>
 #include <maxscale/protocol.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/dcb.h>
@@ -30,6 +31,7 @@
 #include <maxscale/resultset.h>
 #include <maxscale/config.h>
 #include <maxscale/queuemanager.h>
+#include <maxscale/statistics.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -51,6 +53,10 @@ typedef struct
     int    n_failed_starts; /**< Number of times this service has failed to start */
     int    n_sessions;      /**< Number of sessions created on service since start */
     int    n_current;       /**< Current number of sessions */
+    ts_hist_t latency;      /**< Query times seen by the clients, allocated on first use */
+    ts_stats_t query_time;  /**< Nanoseconds spent routing queries, allocated on first use */
+    ts_stats_t reply_time;  /**< Nanoseconds spent routing replies, allocated on first use */
+    ts_stats_t wait_time;   /**< Nanoseconds spent waiting for the servers, allocated on first use */
 } SERVICE_STATS;
 
 /**
@@ -75,6 +81,24 @@ typedef struct
     time_t last;
 } SERVICE_REFRESH_RATE;
 
+/**
+ * The admission control of new client connections. New sessions are paced
+ * with a token bucket that is refilled at @c rate tokens per second, with
+ * tokens counted in tenths so that the housekeeper heartbeat can be used.
+ * Connections that find the bucket empty wait in @c queue for a token.
+ */
+typedef struct
+{
+    int           rate;       /**< New sessions per second, 0 for no limit */
+    int           burst;      /**< The maximum number of sessions at once */
+    int           tokens;     /**< Available tokens, in tenths */
+    long          last;       /**< The heartbeat of the previous refill */
+    SPINLOCK      lock;       /**< Protects the token bucket */
+    QUEUE_CONFIG *queue;      /**< Connections waiting for a token, if set */
+    uint64_t      n_delayed;  /**< Connections that had to wait for a token */
+    uint64_t      n_rejected; /**< Connections rejected by the admission control */
+} SERVICE_ADMISSION;
+
 typedef struct server_ref_t
 {
     struct server_ref_t *next; /**< Next server reference */
@@ -84,6 +108,30 @@ typedef struct server_ref_t
     bool active;               /**< Whether this reference is valid and in use*/
 } SERVER_REF;
 
+/**
+ * A server in a snapshot of the servers of a service
+ */
+typedef struct service_server
+{
+    SERVER_REF *ref;    /**< The server reference, its counters are shared by all snapshots */
+    int         weight; /**< Weight of the server */
+} SERVICE_SERVER;
+
+/**
+ * An immutable snapshot of the servers of a service and their weights
+ *
+ * A new snapshot is published whenever servers are added to or removed from
+ * the service or the weights are calculated again. The snapshot only contains
+ * the servers that are in use by the service, the states of the servers must
+ * still be checked.
+ */
+typedef struct service_servers
+{
+    uint64_t        version;   /**< Version of the snapshot, the first one is 1 */
+    int             n_servers; /**< Number of servers */
+    SERVICE_SERVER *servers;   /**< The servers in the order they were added in */
+} SERVICE_SERVERS;
+
 /** Macro to check whether a SERVER_REF is active */
 #define SERVER_REF_IS_ACTIVE(ref) (ref->active && SERVER_IS_ACTIVE(ref->server))
 
@@ -121,6 +169,7 @@ typedef struct service
     int client_count;                  /**< Number of connected clients */
     int max_connections;               /**< Maximum client connections */
     QUEUE_CONFIG *queued_connections;  /**< Queued connections, if set */
+    SERVICE_ADMISSION admission;       /**< Pacing of new client connections */
     SERV_LISTENER *ports;              /**< Linked list of ports and protocols
                                         * that this service will listen on */
     char *routerModule;                /**< Name of router module to use */
@@ -130,6 +179,7 @@ typedef struct service
     char *version_string;              /**< version string for this service listeners */
     SERVER_REF *dbref;                 /**< server references */
     int         n_dbref;               /**< Number of server references */
+    SERVICE_SERVERS *servers;          /**< The current snapshot of the servers */
     SERVICE_USER credentials;          /**< The cedentials of the service user */
     SPINLOCK spin;                     /**< The service spinlock */
     SERVICE_STATS stats;               /**< The service statistics */
@@ -249,12 +299,25 @@ bool serviceHasListener(SERVICE *service, const char *protocol,
  */
 bool service_port_is_used(unsigned short port);
 
+/**
+ * @brief Add the time it took the service to answer a query
+ *
+ * Routers call this when the last packet of the reply has been routed to
+ * the client. The time starts when the query arrived from the client.
+ *
+ * @param service Service that answered the query
+ * @param usecs   Time from receiving the query to the complete reply in microseconds
+ */
+void service_add_latency(SERVICE *service, int64_t usecs);
+
 int   serviceGetUser(SERVICE *service, char **user, char **auth);
 int   serviceSetUser(SERVICE *service, char *user, char *auth);
 bool  serviceSetFilters(SERVICE *service, char *filters);
 int   serviceEnableRootUser(SERVICE *service, int action);
 int   serviceSetTimeout(SERVICE *service, int val);
 int   serviceSetConnectionLimits(SERVICE *service, int max, int queued, int timeout);
+int   serviceSetConnectionRate(SERVICE *service, int rate, int burst, int queued, int timeout);
+bool  serviceAdmitConnection(SERVICE *service, DCB *dcb);
 void  serviceSetRetryOnFailure(SERVICE *service, char* value);
 void  serviceWeightBy(SERVICE *service, char *weightby);
 char* serviceGetWeightingParameter(SERVICE *service);
@@ -296,4 +359,56 @@ static inline uint64_t service_get_capabilities(const SERVICE *service)
     return service->capabilities;
 }
 
+/**
+ * Get the current snapshot of the servers of a service
+ *
+ * A polling thread can use the snapshot without locking until it returns to
+ * the poll loop, see rcu.h. Other threads must hold the service spinlock.
+ *
+ * @param service The service
+ *
+ * @return The snapshot.
+ */
+static inline const SERVICE_SERVERS* service_get_servers(const SERVICE *service)
+{
+    return (const SERVICE_SERVERS*)atomic_load_ptr((void * const *)&service->servers);
+}
+
+/**
+ * Adjust the weight of a server by the load of the server.
+ *
+ * The weight is reduced in proportion to the load that the monitor reports for
+ * the server. A server with a non-zero weight keeps a weight of at least one so
+ * that it is still preferred over servers that have a zero weight.
+ *
+ * @param weight The weight of the server
+ * @param load   The load of the server, from 0 to SERVER_LOAD_MAX
+ *
+ * @return The adjusted weight.
+ */
+static inline int server_weight_by_load(int weight, int load)
+{
+    if (weight > 0 && load > 0)
+    {
+        weight = MXS_MAX(weight * (SERVER_LOAD_MAX - MXS_MIN(load, SERVER_LOAD_MAX)) / SERVER_LOAD_MAX, 1);
+    }
+
+    return weight;
+}
+
+/**
+ * Get the weight of a server reference adjusted by the load of the server.
+ *
+ * @see server_weight_by_load
+ *
+ * @param ref  The server reference
+ * @param load The load of the server, from 0 to SERVER_LOAD_MAX
+ *
+ * @return The adjusted weight.
+ */
+static inline int server_ref_weight(const SERVER_REF *ref, int load)
+{
+    return server_weight_by_load(ref->weight, load);
+}
+
 MXS_END_DECLS
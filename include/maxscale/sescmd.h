@@ -0,0 +1,75 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file sescmd.h - Interned session commands
+ *
+ * Routers that replay the session commands of a session on new backend
+ * connections keep a history of the commands. Most sessions of an
+ * application execute the very same commands, so instead of each session
+ * storing its own copy, the commands are interned into a table shared by all
+ * sessions. A session holds a reference to each command in its history and
+ * keeps only its own state of the command, such as whether the command has
+ * been replied to, separately.
+ *
+ * The buffer of an interned command is shared by all threads and must not be
+ * modified. It is written to backends by cloning it with gwbuf_clone(), and it
+ * has GWBUF_TYPE_SESCMD set so that the clones are handled as session commands.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+typedef struct mxs_sescmd MXS_SESCMD;
+
+/**
+ * @brief Intern a session command
+ *
+ * If an identical command has been interned, a new reference to it is
+ * returned. Otherwise the contents of the buffer are copied into a new entry.
+ *
+ * @param buffer The session command, freed by this function
+ *
+ * @return The interned command, or NULL on memory allocation failure
+ */
+MXS_SESCMD* mxs_sescmd_intern(GWBUF *buffer);
+
+/**
+ * @brief Release a reference to an interned session command
+ *
+ * The command is freed when the last reference is released.
+ *
+ * @param cmd The command, may be NULL
+ */
+void mxs_sescmd_release(MXS_SESCMD *cmd);
+
+/**
+ * @brief Get the buffer of an interned session command
+ *
+ * @param cmd The command
+ *
+ * @return The contiguous buffer of the command, which must not be modified
+ */
+GWBUF* mxs_sescmd_buffer(const MXS_SESCMD *cmd);
+
+/**
+ * @brief Get the number of interned session commands
+ *
+ * @return The number of distinct commands that are referred to
+ */
+int mxs_sescmd_count(void);
+
+MXS_END_DECLS
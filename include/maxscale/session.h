@@ -77,6 +77,11 @@ typedef enum
 typedef struct
 {
     time_t          connect;        /**< Time when the session was started */
+    uint64_t        query_time;     /**< Nanoseconds spent routing queries */
+    uint64_t        reply_time;     /**< Nanoseconds spent routing replies */
+    uint64_t        wait_time;      /**< Nanoseconds spent waiting for the servers */
+    uint64_t        wait_start;     /**< When the last query was routed, 0 if a reply has arrived */
+    uint64_t        n_reads_paused; /**< Times the servers were paused for the client to catch up */
 } MXS_SESSION_STATS;
 
 /**
@@ -113,6 +118,18 @@ typedef struct mxs_upstream
     int32_t (*error)(void *instance, void *session, void *);
 } MXS_UPSTREAM;
 
+struct session_arena_chunk;
+struct session_probe;
+
+/**
+ * Memory that lives as long as the session, see session_alloc_mem()
+ */
+typedef struct
+{
+    struct session_arena_chunk *chunks; /**< The chunks, the one being filled first */
+    bool                        enabled; /**< Whether the memory is taken from the chunks */
+} MXS_SESSION_ARENA;
+
 /**
  * The session status block
  *
@@ -146,6 +163,9 @@ typedef struct session
         const struct server *target; /**< Where the statement was sent */
     } stmt;  /**< Current statement being executed */
     bool qualifies_for_pooling; /**< Whether this session qualifies for the connection pool */
+    bool reads_paused;          /**< Whether the servers are read, see dcb_enable_flow_control() */
+    MXS_SESSION_ARENA arena;    /**< Memory freed with the session */
+    struct session_probe *probes; /**< The routeQuery probes of the components, see probe.h */
     skygw_chk_t     ses_chk_tail;
 } MXS_SESSION;
 
@@ -169,6 +189,31 @@ typedef struct session
 MXS_SESSION *session_alloc(struct service *, struct dcb *);
 MXS_SESSION *session_set_dummy(struct dcb *);
 
+/**
+ * Allocate zeroed memory that is needed until the session is freed.
+ *
+ * With the @c session_arena parameter, the memory is taken from chunks owned
+ * by the session, which are freed all at once after the router and filter
+ * sessions have been freed. Otherwise it is allocated with MXS_CALLOC().
+ *
+ * @param session The session
+ * @param size    Number of bytes to allocate
+ * @return The memory or NULL if it could not be allocated
+ */
+void *session_alloc_mem(MXS_SESSION *session, size_t size);
+
+/**
+ * Free memory allocated with session_alloc_mem().
+ *
+ * Memory taken from the chunks of the session is not released before the
+ * session is freed, so this should only be used for memory that is needed
+ * for the whole session.
+ *
+ * @param session The session the memory was allocated for
+ * @param ptr     The memory, can be NULL
+ */
+void session_free_mem(MXS_SESSION *session, void *ptr);
+
 const char *session_get_remote(const MXS_SESSION *);
 const char *session_get_user(const MXS_SESSION *);
 
@@ -325,6 +370,21 @@ static inline bool session_set_autocommit(MXS_SESSION* ses, bool autocommit)
  */
 MXS_SESSION* session_get_by_id(int id);
 
+/**
+ * @brief Get a session reference
+ *
+ * This creates an additional reference to a session which allows it to live
+ * as long as it is needed.
+ *
+ * This function is public only because the cache filter uses it.
+ *
+ * @param session Session reference to get
+ * @return Reference to a MXS_SESSION
+ *
+ * @note The caller must free the session reference by calling session_put_ref
+ */
+MXS_SESSION* session_get_ref(MXS_SESSION *session);
+
 /**
  * @brief Release a session reference
  *
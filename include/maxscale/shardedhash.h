@@ -0,0 +1,169 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file shardedhash.h A hashtable for data that is accessed concurrently
+ * by all worker threads
+ *
+ * The table is divided into shards, each of which has its own lock and
+ * chains. Threads that access keys in different shards never contend with
+ * each other, whereas a HASHTABLE serializes all writers and makes every
+ * reader and writer update the same counters.
+ *
+ * As with HASHTABLE, a pointer returned by @c shardedhash_fetch remains
+ * valid only as long as the entry is not deleted. Tables where entries
+ * are only added, or deleted only when no other thread can access them,
+ * need no further synchronization.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/spinlock.h>
+
+MXS_BEGIN_DECLS
+
+/** The default number of shards */
+#define SHARDEDHASH_DEFAULT_SHARDS 16
+
+/**
+ * A shard of a SHARDEDHASH
+ */
+typedef struct shardedhash_shard
+{
+    SPINLOCK      lock;       /**< Protects the chains and the count */
+    HASHENTRIES **entries;    /**< The chains of the shard */
+    int           n_elements; /**< Number of elements in the shard */
+    char          pad[64];    /**< Keeps the locks on separate cache lines */
+} SHARDEDHASH_SHARD;
+
+/**
+ * A hashtable divided into independently locked shards.
+ */
+typedef struct shardedhash
+{
+    int                nshards;  /**< The number of shards */
+    int                size;     /**< The number of chains in each shard */
+    SHARDEDHASH_SHARD *shards;   /**< The shards */
+    HASHHASHFN         hashfn;   /**< The hash function */
+    HASHCMPFN          cmpfn;    /**< The key comparison function */
+    HASHCOPYFN         kcopyfn;  /**< Key copy function */
+    HASHCOPYFN         vcopyfn;  /**< Value copy function */
+    HASHFREEFN         kfreefn;  /**< Key free function */
+    HASHFREEFN         vfreefn;  /**< Value free function */
+} SHARDEDHASH;
+
+/**
+ * Allocate a sharded hashtable
+ *
+ * @param nshards The number of shards, 0 for SHARDEDHASH_DEFAULT_SHARDS
+ * @param size    The total number of chains, divided evenly between the shards
+ * @param hashfn  The hash function
+ * @param cmpfn   The key comparison function
+ *
+ * @return The new table or NULL on memory allocation failure
+ */
+SHARDEDHASH *shardedhash_alloc(int nshards, int size, HASHHASHFN hashfn, HASHCMPFN cmpfn);
+
+/**
+ * Allocate a sharded hashtable with case-sensitive string keys
+ *
+ * The keys are copied when they are added and freed when they are deleted.
+ *
+ * @param nshards The number of shards, 0 for SHARDEDHASH_DEFAULT_SHARDS
+ * @param size    The total number of chains
+ *
+ * @return The new table or NULL on memory allocation failure
+ */
+SHARDEDHASH *shardedhash_alloc_str(int nshards, int size);
+
+/**
+ * Set the functions used for copying and freeing the keys and values
+ *
+ * A NULL function means that the pointer is stored as such or not freed.
+ * Must be called before the table is taken into use.
+ *
+ * @param table   The table
+ * @param kcopyfn Key copy function
+ * @param vcopyfn Value copy function
+ * @param kfreefn Key free function
+ * @param vfreefn Value free function
+ */
+void shardedhash_memory_fns(SHARDEDHASH *table,
+                            HASHCOPYFN kcopyfn,
+                            HASHCOPYFN vcopyfn,
+                            HASHFREEFN kfreefn,
+                            HASHFREEFN vfreefn);
+
+/**
+ * Free a sharded hashtable and all its entries
+ *
+ * @param table The table, may be NULL
+ */
+void shardedhash_free(SHARDEDHASH *table);
+
+/**
+ * Add an entry
+ *
+ * @param table The table
+ * @param key   The key
+ * @param value The value
+ *
+ * @return 1 if the entry was added, 0 if the key exists or memory ran out
+ */
+int shardedhash_add(SHARDEDHASH *table, void *key, void *value);
+
+/**
+ * Fetch the value of a key, adding the entry if it does not exist
+ *
+ * The lookup and the addition are done while holding the lock of the shard,
+ * so concurrent callers with the same key all get the same value.
+ *
+ * @param table The table
+ * @param key   The key
+ * @param value The value to add if the key does not exist
+ *
+ * @return The stored value or NULL on memory allocation failure
+ */
+void *shardedhash_fetch_or_add(SHARDEDHASH *table, void *key, void *value);
+
+/**
+ * Delete an entry
+ *
+ * @param table The table
+ * @param key   The key
+ *
+ * @return 1 if the entry was deleted, 0 if it was not found
+ */
+int shardedhash_delete(SHARDEDHASH *table, void *key);
+
+/**
+ * Fetch the value of a key
+ *
+ * @param table The table
+ * @param key   The key
+ *
+ * @return The value or NULL if the key was not found
+ */
+void *shardedhash_fetch(SHARDEDHASH *table, void *key);
+
+/**
+ * Return the number of entries in the table
+ *
+ * @param table The table
+ *
+ * @return The number of entries
+ */
+int shardedhash_size(SHARDEDHASH *table);
+
+MXS_END_DECLS
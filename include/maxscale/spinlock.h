@@ -17,10 +17,16 @@
  *
  * Spinlock implementation for MaxScale.
  *
- * Spinlocks are cheap locks that can be used to protect short code blocks, they are
- * generally wasteful as any blocked threads will spin, consuming CPU cycles, waiting
- * for the lock to be released. However they are useful in that they do not involve
- * system calls and are light weight when the expected wait time for a lock is low.
+ * Spinlocks are cheap locks that can be used to protect short code blocks. They
+ * do not involve system calls and are light weight when the expected wait time
+ * for a lock is low. A thread that finds the lock held spins for a while with an
+ * exponentially growing delay between the attempts, which keeps the cache line
+ * of the lock from bouncing between the waiting cores. If the lock still is not
+ * released, the thread sleeps until the holder of the lock wakes it up.
+ *
+ * A lock can be given a name, after which the number of times it was acquired,
+ * how often it had to be waited for and how long are counted. The counters are
+ * shown with "show spinlocks" in maxadmin and can be used to find hot locks.
  */
 
 #include <maxscale/cdefs.h>
@@ -29,37 +35,22 @@
 
 MXS_BEGIN_DECLS
 
-#define SPINLOCK_PROFILE 0
-
 /**
  * The spinlock structure.
  *
- * In normal builds the structure merely contains a lock value which
- * is 0 if the spinlock is not taken and greater than zero if it is held.
- *
- * In builds with the SPINLOCK_PROFILE option set this structure also holds
- * a number of profile related fields that count the number of spins, number
- * of waiting threads and the number of times the lock has been acquired.
+ * The lock value is 0 if the spinlock is not taken, 1 if it is held and 2 if
+ * it is held and there may be threads sleeping on it.
  */
 typedef struct spinlock
 {
     int lock;              /*< Is the lock held? */
-#if SPINLOCK_PROFILE
-    uint64_t spins;        /*< Number of spins on this lock */
-    uint64_t maxspins;     /*< Max no of spins to acquire lock */
-    uint64_t acquired;     /*< No. of times lock was acquired */
-    uint64_t waiting;      /*< No. of threads acquiring this lock */
-    uint64_t max_waiting;  /*< Max no of threads waiting for lock */
-    uint64_t contended;    /*< No. of times acquire was contended */
-    THREAD owner;          /*< Last owner of this lock */
-#endif
+    int stats;             /*< Index of the counters of a named lock, 0 if unnamed */
 } SPINLOCK;
 
-#if SPINLOCK_PROFILE
-#define SPINLOCK_INIT { 0, 0, 0, 0, 0, 0, 0, 0 }
-#else
-#define SPINLOCK_INIT { 0 }
-#endif
+#define SPINLOCK_INIT { 0, 0 }
+
+/** The maximum length of the name of a spinlock */
+#define SPINLOCK_NAME_LEN 64
 
 /**
  * Debugging macro for testing the state of a spinlock.
@@ -75,6 +66,19 @@ typedef struct spinlock
  */
 extern void spinlock_init(SPINLOCK *lock);
 
+/**
+ * Name a spinlock and start counting its contention.
+ *
+ * Locks with the same name share the counters, so an object that is destroyed
+ * and created again continues from where the old one left. Naming a lock that
+ * already has a name does nothing. If too many locks have been named, the lock
+ * is left unnamed.
+ *
+ * @param lock The spinlock to name
+ * @param name The name of the lock, truncated to SPINLOCK_NAME_LEN - 1 characters
+ */
+extern void spinlock_set_name(SPINLOCK *lock, const char *name);
+
 /**
  * Acquire a spinlock.
  *
@@ -98,8 +102,7 @@ extern bool spinlock_acquire_nowait(const SPINLOCK *lock);
 extern void spinlock_release(const SPINLOCK *lock);
 
 /**
- * Report statistics on a spinlock. This only has an effect if the
- * spinlock code has been compiled with the SPINLOCK_PROFILE option set.
+ * Report statistics on a spinlock. Only named locks have statistics.
  *
  * NB A callback function is used to return the data rather than
  * merely printing to a DCB in order to avoid a dependency on the DCB
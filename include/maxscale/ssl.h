@@ -20,6 +20,7 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/protocol.h>
+#include <maxscale/spinlock.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -66,6 +67,10 @@ typedef struct ssl_listener
     char *ssl_ca_cert;                  /*< SSL CA certificate */
     bool ssl_init_done;                 /*< If SSL has already been initialized for this service */
     bool ssl_verify_peer_certificate;   /*< Enable peer certificate verification */
+    uint64_t n_full_handshakes;         /*< Handshakes that created a new session */
+    uint64_t n_resumed_handshakes;      /*< Handshakes that resumed an earlier session */
+    SSL_SESSION *session;               /*< For backend connections, the session to resume */
+    SPINLOCK session_lock;              /*< Protects session */
     struct ssl_listener
         *next;          /*< Next SSL configuration, currently used to store obsolete configurations */
 } SSL_LISTENER;
@@ -22,6 +22,7 @@
 MXS_BEGIN_DECLS
 
 typedef void* ts_stats_t;
+typedef void* ts_hist_t;
 
 /** Enum values for ts_stats_get */
 enum ts_stats_type
@@ -98,4 +99,84 @@ void ts_stats_set_max(ts_stats_t stats, int value, int thread_id);
  */
 void ts_stats_set_min(ts_stats_t stats, int value, int thread_id);
 
+/**
+ * @brief Add a value to thread statistics
+ *
+ * @param stats     Statistics to add to
+ * @param value     Value to add
+ * @param thread_id ID of thread
+ */
+void ts_stats_add(ts_stats_t stats, int64_t value, int thread_id);
+
+/**
+ * @brief Add a value to statistics that are allocated by the first value
+ *
+ * For statistics of objects that are created before the statistics are
+ * initialized. The value is dropped if the allocation fails.
+ *
+ * @param stats     Pointer to the statistics, NULL until the first value is added
+ * @param value     Value to add
+ * @param thread_id ID of thread
+ */
+void ts_stats_add_lazy(ts_stats_t *stats, int64_t value, int thread_id);
+
+/**
+ * @brief Allocate a new histogram
+ *
+ * Each thread adds values to a histogram of its own. The histograms are
+ * combined when they are read. The relative error of a reported value is
+ * at most about 3%.
+ *
+ * @return New histogram or NULL if memory allocation failed
+ */
+ts_hist_t ts_hist_alloc();
+
+/**
+ * @brief Free a histogram
+ *
+ * @param hist Histogram to free
+ */
+void ts_hist_free(ts_hist_t hist);
+
+/**
+ * @brief Add a value to the histogram of a thread
+ *
+ * @param hist      Histogram to add to
+ * @param value     Value to add, negative values are counted as zero
+ * @param thread_id ID of thread
+ */
+void ts_hist_add(ts_hist_t hist, int64_t value, int thread_id);
+
+/**
+ * @brief Add a value to a histogram that is allocated by the first value
+ *
+ * For histograms of objects that are created before the statistics are
+ * initialized. The value is dropped if the allocation fails.
+ *
+ * @param hist      Pointer to the histogram, NULL until the first value is added
+ * @param value     Value to add
+ * @param thread_id ID of thread
+ */
+void ts_hist_add_lazy(ts_hist_t *hist, int64_t value, int thread_id);
+
+/**
+ * @brief Get the number of values in a histogram
+ *
+ * @param hist Histogram to read
+ * @return Number of values added by all threads
+ */
+int64_t ts_hist_count(ts_hist_t hist);
+
+/**
+ * @brief Get a percentile of the values in a histogram
+ *
+ * The histogram is read without locking while the threads add values to it.
+ *
+ * @param hist       Histogram to read
+ * @param percentile Percentile to get, from 0 to 100
+ * @return The value below which the given percentage of the values are,
+ *         or 0 if the histogram is empty
+ */
+int64_t ts_hist_percentile(ts_hist_t hist, double percentile);
+
 MXS_END_DECLS
@@ -0,0 +1,74 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file tablechange.h A feed of the tables modified by committed transactions
+ *
+ * A module that follows the replication stream of a server, e.g. the avrorouter,
+ * publishes the tables modified by each committed transaction and a module that
+ * depends on the content of tables, e.g. the cache filter, subscribes to them.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The function called when tables have been modified.
+ *
+ * The function is called by the thread that publishes the changes and must
+ * not subscribe or unsubscribe.
+ *
+ * @param tables    The fully qualified names of the tables, i.e. "db.tbl".
+ * @param n_tables  The number of tables.
+ * @param data      The data given when subscribing.
+ */
+typedef void (*TABLECHANGE_CB)(const char* const* tables, int n_tables, void* data);
+
+/**
+ * Subscribe to table modifications.
+ *
+ * @param cb    The function to call when tables have been modified.
+ * @param data  Data passed to the function.
+ *
+ * @return True if the subscription was added, false if memory allocation failed.
+ */
+bool tablechange_subscribe(TABLECHANGE_CB cb, void* data);
+
+/**
+ * Unsubscribe from table modifications. When the function returns, @c cb
+ * is not being called and will not be called again with @c data.
+ *
+ * @param cb    The function given when subscribing.
+ * @param data  The data given when subscribing.
+ */
+void tablechange_unsubscribe(TABLECHANGE_CB cb, void* data);
+
+/**
+ * Whether anyone has subscribed to table modifications. Can be used for
+ * avoiding the collection of modified tables if nobody is interested.
+ *
+ * @return True if there is at least one subscription.
+ */
+bool tablechange_has_subscribers();
+
+/**
+ * Publish table modifications to all subscribers.
+ *
+ * @param tables    The fully qualified names of the tables, i.e. "db.tbl".
+ * @param n_tables  The number of tables.
+ */
+void tablechange_publish(const char* const* tables, int n_tables);
+
+MXS_END_DECLS
@@ -35,5 +35,6 @@ MXS_BEGIN_DECLS
 extern THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg);
 extern void thread_wait(THREAD thd);
 extern void thread_millisleep(int ms);
+extern void thread_save_affinity(void);
 
 MXS_END_DECLS
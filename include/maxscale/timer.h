@@ -0,0 +1,92 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file timer.h - Timers of the polling threads
+ *
+ * Each polling thread has a hierarchical timer wheel that is advanced once
+ * every heartbeat, that is, every 100 milliseconds. Setting, cancelling and
+ * expiring a timer take constant time regardless of how many timers there are,
+ * which makes the timers suitable for per-session and per-DCB timeouts.
+ * Global and periodic jobs belong in the housekeeper.
+ *
+ * A timer belongs to the polling thread that set it and must only be set and
+ * cancelled in that thread. The function of the timer is also called in it.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+struct mxs_timer;
+
+/**
+ * The function called when a timer expires
+ *
+ * The timer is no longer set when the function is called, so the function
+ * can set it again.
+ *
+ * @param timer The expired timer
+ * @param data  The data given when the timer was set
+ */
+typedef void (*MXS_TIMER_FN)(struct mxs_timer *timer, void *data);
+
+/**
+ * A timer. A zero-initialized timer is not set.
+ */
+typedef struct mxs_timer
+{
+    struct mxs_timer  *next;    /*< Next timer in the same slot */
+    struct mxs_timer **pprev;   /*< The pointer to this timer, NULL if not set */
+    long               expires; /*< The heartbeat when the timer expires */
+    MXS_TIMER_FN       func;    /*< The function to call */
+    void              *data;    /*< Data passed to the function */
+    int                thread;  /*< The thread that set the timer */
+} MXS_TIMER;
+
+/**
+ * @brief Set a timer
+ *
+ * If the timer is already set, it is first cancelled. Must be called from
+ * a polling thread.
+ *
+ * @param timer The timer to set
+ * @param ticks Number of heartbeats until the timer expires, at least one
+ * @param func  Function to call when the timer expires
+ * @param data  Data passed to the function
+ */
+void mxs_timer_set(MXS_TIMER *timer, long ticks, MXS_TIMER_FN func, void *data);
+
+/**
+ * @brief Cancel a timer
+ *
+ * Cancelling a timer that is not set does nothing. Must be called from the
+ * thread that set the timer.
+ *
+ * @param timer The timer to cancel
+ */
+void mxs_timer_cancel(MXS_TIMER *timer);
+
+/**
+ * @brief Check whether a timer is set
+ *
+ * @param timer The timer to check
+ * @return True if the timer is set and has not yet expired
+ */
+static inline bool mxs_timer_is_set(const MXS_TIMER *timer)
+{
+    return timer->pprev != NULL;
+}
+
+MXS_END_DECLS
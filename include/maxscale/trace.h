@@ -0,0 +1,74 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file trace.h Binary tracepoints
+ *
+ * A tracepoint stores a fixed-size record in a ring buffer of the calling
+ * polling thread. The record contains the tracepoint, the time, the current
+ * session and up to MXS_TRACE_MAX_ARGS arguments. The arguments are formatted
+ * with the format string of the tracepoint only when the records are shown,
+ * so a tracepoint costs little more than a few stores.
+ *
+ * The arguments are stored as intptr_t values, so the format may only use
+ * conversions of long values, e.g. %ld and %lx, and %s for strings that
+ * outlive the record, e.g. the names of servers.
+ *
+ * @code
+ * static MXS_TRACEPOINT tp_route = {"route", "target=%s type=0x%lx"};
+ *
+ * MXS_TRACE(tp_route, server->unique_name, qtype, 0, 0);
+ * @endcode
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+#define MXS_TRACE_MAX_ARGS 4
+
+typedef struct mxs_tracepoint
+{
+    const char *name;   /**< The name of the tracepoint */
+    const char *format; /**< The printf format of the arguments */
+} MXS_TRACEPOINT;
+
+/** True if the polling threads have trace buffers */
+extern bool mxs_trace_enabled;
+
+/**
+ * Store a trace record in the buffer of the calling thread. Does nothing if
+ * the thread has no trace buffer. Use the MXS_TRACE macro instead.
+ *
+ * @param tp   The tracepoint
+ * @param arg1 The first argument
+ * @param arg2 The second argument
+ * @param arg3 The third argument
+ * @param arg4 The fourth argument
+ */
+void mxs_trace_record(const MXS_TRACEPOINT *tp, intptr_t arg1, intptr_t arg2,
+                      intptr_t arg3, intptr_t arg4);
+
+#define MXS_TRACE(tp, arg1, arg2, arg3, arg4)                           \
+    do                                                                  \
+    {                                                                   \
+        if (mxs_trace_enabled)                                          \
+        {                                                               \
+            mxs_trace_record(&(tp), (intptr_t)(arg1), (intptr_t)(arg2), \
+                             (intptr_t)(arg3), (intptr_t)(arg4));       \
+        }                                                               \
+    }                                                                   \
+    while (false)
+
+MXS_END_DECLS
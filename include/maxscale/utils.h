@@ -21,6 +21,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 
 MXS_BEGIN_DECLS
 
@@ -40,8 +41,28 @@ enum mxs_socket_type
 {
     MXS_SOCKET_LISTENER, /**< */
     MXS_SOCKET_NETWORK,
+    MXS_SOCKET_ACCEPTED, /**< A connection accepted by a listener */
 };
 
+/**
+ * The socket options of a listener or a server. The options that are not
+ * set leave the defaults of MaxScale and the kernel in place.
+ */
+typedef struct mxs_socket_opts
+{
+    int sndbuf;       /**< SO_SNDBUF in bytes, 0 for the default */
+    int rcvbuf;       /**< SO_RCVBUF in bytes, 0 for the default */
+    int nodelay;      /**< TCP_NODELAY, -1 for the default */
+    int quickack;     /**< TCP_QUICKACK, -1 for the default */
+    int defer_accept; /**< TCP_DEFER_ACCEPT in seconds for listeners, 0 for none */
+    int fastopen;     /**< TCP_FASTOPEN queue length of listeners, or for servers
+                       *   TCP_FASTOPEN_CONNECT if non-zero, 0 for none */
+    int keepalive;    /**< Idle seconds before TCP keepalive probes are sent, 0 for none */
+    int priority;     /**< SO_PRIORITY, -1 for the default */
+} MXS_SOCKET_OPTS;
+
+#define MXS_SOCKET_OPTS_INIT {0, 0, -1, -1, 0, 0, 0, -1}
+
 bool utils_init(); /*< Call this first before using any other function */
 void utils_end();
 
@@ -69,6 +90,53 @@ void utils_end();
 int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr,
                         const char *host, uint16_t port);
 
+/**
+ * @brief Create a Unix domain socket for a connection to a local server
+ *
+ * The counterpart of open_network_socket() for servers that are connected
+ * through a Unix domain socket. The socket is non-blocking and @c addr can
+ * be given to connect() as it is.
+ *
+ * @param addr Pointer to a struct sockaddr_un where the address is stored
+ * @param path The path of the socket of the server
+ *
+ * @return The opened socket or -1 on failure
+ */
+int open_unix_socket(struct sockaddr_un *addr, const char *path);
+
+/**
+ * @brief Apply the configured socket options to a socket
+ *
+ * For a listener socket, the options of the listening socket are set. For
+ * other sockets, the options of the connection are set, which must be done
+ * before connect() for MXS_SOCKET_NETWORK sockets. TCP options are skipped
+ * for Unix domain sockets. A failure is logged but is not fatal.
+ *
+ * @param so   The socket
+ * @param opts The options of the listener or the server
+ * @param type What the socket is used for
+ */
+void socket_opts_apply(int so, const MXS_SOCKET_OPTS *opts, enum mxs_socket_type type);
+
+/**
+ * @brief Write the socket options that are set in INI format
+ *
+ * @param fd   File to write to
+ * @param opts The options to write
+ */
+void write_socket_opts_config(int fd, const MXS_SOCKET_OPTS *opts);
+
+/**
+ * @brief Enable busy polling on a connection socket
+ *
+ * Sets SO_BUSY_POLL to the value of the `busy_poll` parameter. Nothing is
+ * done if the parameter is not set. A failure is not fatal and is only
+ * logged once.
+ *
+ * @param so The socket to configure
+ */
+void set_busy_poll(int so);
+
 int setnonblocking(int fd);
 char  *gw_strend(register const char *s);
 static char gw_randomchar();
@@ -136,4 +204,7 @@ bool mxs_mkdir_all(const char *path, int mask);
 
 long get_processor_count();
 
+int mxs_parse_cpu_list(const char *str, int *cpus, int max_cpus);
+int mxs_numa_cpu_list(int *cpus, int max_cpus);
+
 MXS_END_DECLS
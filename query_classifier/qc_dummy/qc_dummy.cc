@@ -35,6 +35,14 @@ int32_t qc_dummy_get_table_names(GWBUF* querybuf, int32_t fullnames, char*** ppz
     return QC_RESULT_OK;
 }
 
+int32_t qc_dummy_get_table_names_ref(GWBUF* querybuf, int32_t fullnames,
+                                     const char* const** ppzNames, uint32_t* pnNames)
+{
+    *ppzNames = NULL;
+    *pnNames = 0;
+    return QC_RESULT_OK;
+}
+
 int32_t qc_dummy_get_created_table_name(GWBUF* querybuf, char** pzName)
 {
     *pzName = NULL;
@@ -60,6 +68,13 @@ int32_t qc_dummy_get_database_names(GWBUF* querybuf, char*** ppzNames, int32_t*
     return QC_RESULT_OK;
 }
 
+int32_t qc_dummy_get_database_names_ref(GWBUF* querybuf, const char* const** ppzNames, uint32_t* pnNames)
+{
+    *ppzNames = NULL;
+    *pnNames = 0;
+    return QC_RESULT_OK;
+}
+
 int32_t qc_dummy_get_operation(GWBUF* querybuf, int32_t* pOp)
 {
     *pOp = QUERY_OP_UNDEFINED;
@@ -139,6 +154,8 @@ extern "C"
             qc_dummy_get_field_info,
             qc_dummy_get_function_info,
             qc_dummy_get_preparable_stmt,
+            qc_dummy_get_table_names_ref,
+            qc_dummy_get_database_names_ref,
         };
 
         static MXS_MODULE info =
@@ -89,6 +89,15 @@ typedef struct parsing_info_st
     size_t function_infos_len;
     size_t function_infos_capacity;
     GWBUF* preparable_stmt;
+    bool table_names_fetched;
+    char** table_names;
+    int32_t n_table_names;
+    bool table_fullnames_fetched;
+    char** table_fullnames;
+    int32_t n_table_fullnames;
+    bool database_names_fetched;
+    char** database_names;
+    int32_t n_database_names;
 #if defined(SS_DEBUG)
     skygw_chk_t pi_chk_tail;
 #endif
@@ -272,10 +281,16 @@ static bool parse_query(GWBUF* querybuf)
      */
     create_parse_tree(thd);
     /** Add complete parsing info struct to the query buffer */
-    gwbuf_add_buffer_object(querybuf,
-                            GWBUF_PARSING_INFO,
-                            (void *) pi,
-                            parsing_info_done);
+    if (!gwbuf_add_buffer_object(querybuf,
+                                 GWBUF_PARSING_INFO,
+                                 (void *) pi,
+                                 parsing_info_done))
+    {
+        MXS_ERROR("Parsing info could not be added to the query buffer.");
+        parsing_info_done(pi);
+        succp = false;
+        goto retblock;
+    }
 
     succp = true;
 retblock:
@@ -1504,6 +1519,16 @@ retblock:
  * @return void
  *
  */
+static void free_names(char** names, int32_t n_names)
+{
+    for (int32_t i = 0; i < n_names; ++i)
+    {
+        free(names[i]);
+    }
+
+    free(names);
+}
+
 static void parsing_info_done(void* ptr)
 {
     parsing_info_t* pi;
@@ -1550,6 +1575,10 @@ static void parsing_info_done(void* ptr)
 
         gwbuf_free(pi->preparable_stmt);
 
+        free_names(pi->table_names, pi->n_table_names);
+        free_names(pi->table_fullnames, pi->n_table_fullnames);
+        free_names(pi->database_names, pi->n_database_names);
+
         free(pi);
     }
 }
@@ -1845,6 +1874,82 @@ int32_t qc_mysql_get_preparable_stmt(GWBUF* stmt, GWBUF** preparable_stmt)
     return QC_RESULT_OK;
 }
 
+int32_t qc_mysql_get_table_names_ref(GWBUF* querybuf, int32_t fullnames,
+                                     const char* const** namesp, uint32_t* n_names)
+{
+    *namesp = NULL;
+    *n_names = 0;
+
+    if (!querybuf)
+    {
+        return QC_RESULT_OK;
+    }
+
+    if (!ensure_query_is_parsed(querybuf))
+    {
+        return QC_RESULT_ERROR;
+    }
+
+    parsing_info_t* pi = get_pinfo(querybuf);
+    ss_dassert(pi);
+
+    // The names are collected once and then kept with the parsing info.
+    if (fullnames)
+    {
+        if (!pi->table_fullnames_fetched)
+        {
+            qc_mysql_get_table_names(querybuf, fullnames, &pi->table_fullnames, &pi->n_table_fullnames);
+            pi->table_fullnames_fetched = true;
+        }
+
+        *namesp = pi->table_fullnames;
+        *n_names = pi->n_table_fullnames;
+    }
+    else
+    {
+        if (!pi->table_names_fetched)
+        {
+            qc_mysql_get_table_names(querybuf, fullnames, &pi->table_names, &pi->n_table_names);
+            pi->table_names_fetched = true;
+        }
+
+        *namesp = pi->table_names;
+        *n_names = pi->n_table_names;
+    }
+
+    return QC_RESULT_OK;
+}
+
+int32_t qc_mysql_get_database_names_ref(GWBUF* querybuf, const char* const** namesp, uint32_t* n_names)
+{
+    *namesp = NULL;
+    *n_names = 0;
+
+    if (!querybuf)
+    {
+        return QC_RESULT_OK;
+    }
+
+    if (!ensure_query_is_parsed(querybuf))
+    {
+        return QC_RESULT_ERROR;
+    }
+
+    parsing_info_t* pi = get_pinfo(querybuf);
+    ss_dassert(pi);
+
+    if (!pi->database_names_fetched)
+    {
+        qc_mysql_get_database_names(querybuf, &pi->database_names, &pi->n_database_names);
+        pi->database_names_fetched = true;
+    }
+
+    *namesp = pi->database_names;
+    *n_names = pi->n_database_names;
+
+    return QC_RESULT_OK;
+}
+
 static bool should_exclude(const char* name, List<Item>* excludep)
 {
     bool exclude = false;
@@ -2747,6 +2852,8 @@ extern "C"
             qc_mysql_get_field_info,
             qc_mysql_get_function_info,
             qc_mysql_get_preparable_stmt,
+            qc_mysql_get_table_names_ref,
+            qc_mysql_get_database_names_ref,
         };
 
         static MXS_MODULE info =
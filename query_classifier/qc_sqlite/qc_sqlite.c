@@ -14,6 +14,7 @@
 #define MXS_MODULE_NAME "qc_sqlite"
 #include <sqliteInt.h>
 
+#include <ctype.h>
 #include <signal.h>
 #include <string.h>
 #include <maxscale/alloc.h>
@@ -49,6 +50,33 @@ static inline bool qc_info_was_parsed(qc_parse_result_t status)
     return status == QC_QUERY_PARSED;
 }
 
+/**
+ * The lookaside memory of the per-thread sqlite connection. The parse tree
+ * of a statement is allocated from it and released when the statement has
+ * been classified, so the memory is reused for every statement.
+ */
+#define QC_SQLITE_LOOKASIDE_SLOT_SIZE  512
+#define QC_SQLITE_LOOKASIDE_SLOT_COUNT 1024
+
+/**
+ * The size of the chunks from which the strings of a QC_SQLITE_INFO are
+ * allocated. Larger strings get a chunk of their own.
+ */
+#define QC_SQLITE_CHUNK_SIZE 1024
+
+/**
+ * A chunk of memory from which the strings of a QC_SQLITE_INFO are allocated.
+ * The strings are not freed individually; all chunks are freed together with
+ * the info.
+ */
+typedef struct qc_sqlite_chunk
+{
+    struct qc_sqlite_chunk* next; // The previously allocated chunk.
+    size_t size;                  // The size of data.
+    size_t used;                  // The used bytes of data.
+    char data[];
+} QC_SQLITE_CHUNK;
+
 /**
  * Contains information about a particular query.
  */
@@ -85,6 +113,9 @@ typedef struct qc_sqlite_info
     size_t function_infos_len;       // The used entries in function_infos.
     size_t function_infos_capacity;  // The capacity of the function_infos array.
     bool initializing;               // Whether we are initializing sqlite3.
+    bool tokenized_only;             // Classified by the tokenizer, sqlite3 has not seen it.
+    QC_SQLITE_CHUNK* chunks;         // The chunks the strings are allocated from, latest first.
+    bool truncated;                  // Only a prefix of the statement was parsed.
 } QC_SQLITE_INFO;
 
 typedef enum qc_log_level
@@ -104,6 +135,7 @@ static struct
     bool initialized;
     bool setup;
     qc_log_level_t log_level;
+    size_t max_parse_length; // Longer statements are classified by a prefix, 0 means no limit.
 } this_unit;
 
 /**
@@ -131,14 +163,17 @@ static void buffer_object_free(void* data);
 static char** copy_string_array(char** strings, int* pn);
 static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity);
 static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect);
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos);
-static void free_string_array(char** sa);
+static void free_chunks(QC_SQLITE_CHUNK* chunk);
 static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect);
+static QC_SQLITE_INFO* get_query_type_info(GWBUF* query);
 static QC_SQLITE_INFO* info_alloc(uint32_t collect);
 static void info_finish(QC_SQLITE_INFO* info);
 static void info_free(QC_SQLITE_INFO* info);
 static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info, uint32_t collect);
+static char* info_alloc_string(QC_SQLITE_INFO* info, size_t len);
+static char* info_strdup(QC_SQLITE_INFO* info, const char* s);
 static void log_invalid_data(GWBUF* query, const char* message);
+static size_t get_prefix_len(const char* s, size_t len, size_t limit);
 static bool parse_query(GWBUF* query, uint32_t collect);
 static void parse_query_string(const char* query, size_t len);
 static bool query_is_parsed(GWBUF* query, uint32_t collect);
@@ -281,47 +316,13 @@ static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect)
     return parsed;
 }
 
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos)
+static void free_chunks(QC_SQLITE_CHUNK* chunk)
 {
-    if (infos)
+    while (chunk)
     {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].database);
-            MXS_FREE(infos[i].table);
-            MXS_FREE(infos[i].column);
-        }
-
-        MXS_FREE(infos);
-    }
-}
-
-static void free_function_infos(QC_FUNCTION_INFO* infos, size_t n_infos)
-{
-    if (infos)
-    {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].name);
-        }
-
-        MXS_FREE(infos);
-    }
-}
-
-static void free_string_array(char** sa)
-{
-    if (sa)
-    {
-        char** s = sa;
-
-        while (*s)
-        {
-            free(*s);
-            ++s;
-        }
-
-        free(sa);
+        QC_SQLITE_CHUNK* next = chunk->next;
+        MXS_FREE(chunk);
+        chunk = next;
     }
 }
 
@@ -350,14 +351,14 @@ static QC_SQLITE_INFO* info_alloc(uint32_t collect)
 
 static void info_finish(QC_SQLITE_INFO* info)
 {
-    free_string_array(info->table_names);
-    free_string_array(info->table_fullnames);
-    free(info->created_table_name);
-    free_string_array(info->database_names);
-    free(info->prepare_name);
+    // The strings referred to from the arrays are in the chunks.
+    MXS_FREE(info->table_names);
+    MXS_FREE(info->table_fullnames);
+    MXS_FREE(info->database_names);
     gwbuf_free(info->preparable_stmt);
-    free_field_infos(info->field_infos, info->field_infos_len);
-    free_function_infos(info->function_infos, info->function_infos_len);
+    MXS_FREE(info->field_infos);
+    MXS_FREE(info->function_infos);
+    free_chunks(info->chunks);
 }
 
 static void info_free(QC_SQLITE_INFO* info)
@@ -402,10 +403,71 @@ static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info, uint32_t collect)
     info->function_infos_len = 0;
     info->function_infos_capacity = 0;
     info->initializing = false;
+    info->tokenized_only = false;
+    info->chunks = NULL;
+    info->truncated = false;
 
     return info;
 }
 
+/**
+ * Allocates memory for a string that lives as long as the info.
+ *
+ * @param info  The info the string belongs to.
+ * @param len   The number of bytes needed, including the terminating NULL.
+ *
+ * @return The memory or NULL if it could not be allocated.
+ */
+static char* info_alloc_string(QC_SQLITE_INFO* info, size_t len)
+{
+    QC_SQLITE_CHUNK* chunk = info->chunks;
+
+    if (!chunk || (chunk->size - chunk->used < len))
+    {
+        size_t size = len > QC_SQLITE_CHUNK_SIZE ? len : QC_SQLITE_CHUNK_SIZE;
+
+        chunk = MXS_MALLOC(sizeof(QC_SQLITE_CHUNK) + size);
+
+        if (!chunk)
+        {
+            return NULL;
+        }
+
+        chunk->size = size;
+        chunk->used = 0;
+
+        if (info->chunks && (size == len))
+        {
+            // A string of its own; keep allocating from the current chunk.
+            chunk->next = info->chunks->next;
+            info->chunks->next = chunk;
+        }
+        else
+        {
+            chunk->next = info->chunks;
+            info->chunks = chunk;
+        }
+    }
+
+    char* s = chunk->data + chunk->used;
+    chunk->used += len;
+
+    return s;
+}
+
+static char* info_strdup(QC_SQLITE_INFO* info, const char* s)
+{
+    size_t len = strlen(s) + 1;
+    char* copy = info_alloc_string(info, len);
+
+    if (copy)
+    {
+        memcpy(copy, s, len);
+    }
+
+    return copy;
+}
+
 static void parse_query_string(const char* query, size_t len)
 {
     sqlite3_stmt* stmt = NULL;
@@ -447,7 +509,8 @@ static void parse_query_string(const char* query, size_t len)
             }
         }
 
-        if (this_unit.log_level > QC_LOG_NOTHING)
+        // If only a prefix was parsed, an error is expected.
+        if ((this_unit.log_level > QC_LOG_NOTHING) && !this_thread.info->truncated)
         {
             bool log_warning = false;
 
@@ -526,7 +589,14 @@ static bool parse_query(GWBUF* query, uint32_t collect)
                 QC_SQLITE_INFO* info =
                     (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
 
-                if (info)
+                if (info && info->tokenized_only)
+                {
+                    // The statement has only been classified by the tokenizer,
+                    // so it must now be parsed from scratch.
+                    info_finish(info);
+                    info_init(info, collect);
+                }
+                else if (info)
                 {
                     ss_dassert((~info->collect & collect) != 0);
                     ss_dassert((~info->collected & collect) != 0);
@@ -540,10 +610,11 @@ static bool parse_query(GWBUF* query, uint32_t collect)
                 {
                     info = info_alloc(collect);
 
-                    if (info)
+                    if (info && !gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO,
+                                                         info, buffer_object_free))
                     {
-                        // TODO: Add return value to gwbuf_add_buffer_object.
-                        gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO, info, buffer_object_free);
+                        info_free(info);
+                        info = NULL;
                     }
                 }
 
@@ -555,12 +626,26 @@ static bool parse_query(GWBUF* query, uint32_t collect)
 
                     const char* s = (const char*) &data[MYSQL_HEADER_LEN + 1];
 
+                    if ((this_unit.max_parse_length != 0) && (len > this_unit.max_parse_length))
+                    {
+                        // Only a prefix of a very long statement is parsed, so that the
+                        // time it takes to classify it does not depend upon its length.
+                        len = get_prefix_len(s, len, this_unit.max_parse_length);
+                        info->truncated = true;
+                    }
+
                     this_thread.info->query = s;
                     this_thread.info->query_len = len;
                     parse_query_string(s, len);
                     this_thread.info->query = NULL;
                     this_thread.info->query_len = 0;
 
+                    if (info->truncated && qc_info_was_parsed(info->status))
+                    {
+                        // The rest of the statement was not parsed.
+                        info->status = QC_QUERY_PARTIALLY_PARSED;
+                    }
+
                     if (command == MYSQL_COM_STMT_PREPARE)
                     {
                         info->type_mask |= QUERY_TYPE_PREPARE_STMT;
@@ -607,10 +692,10 @@ static bool query_is_parsed(GWBUF* query, uint32_t collect)
         QC_SQLITE_INFO* info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
         ss_dassert(info);
 
-        if ((~info->collected & collect) != 0)
+        if (info->tokenized_only || ((~info->collected & collect) != 0))
         {
-            // The statement has been parsed once, but the needed information
-            // was not collected at that time.
+            // The statement has been parsed (or tokenized) once, but the needed
+            // information was not collected at that time.
             rc = false;
         }
     }
@@ -618,6 +703,563 @@ static bool query_is_parsed(GWBUF* query, uint32_t collect)
     return rc;
 }
 
+/**
+ * TOKENIZER
+ *
+ * The type mask and operation of the most common statements, plain SELECTs
+ * and transaction boundaries, can be deduced from their keywords alone. The
+ * tokenizer below recognizes such statements without invoking sqlite3 and
+ * without allocating anything but the QC_SQLITE_INFO. If a statement contains
+ * anything that could affect the classification, e.g. variables, functions,
+ * subqueries or executable comments, it is left for the parser.
+ */
+
+typedef enum qc_tok
+{
+    QC_TOK_END,       // End of the statement.
+    QC_TOK_WORD,      // A keyword, an identifier or a number.
+    QC_TOK_QUOTED,    // A quoted string or identifier.
+    QC_TOK_EQ,        // "="
+    QC_TOK_COMMA,     // ","
+    QC_TOK_OTHER,     // Some other character that does not affect the classification.
+    QC_TOK_AMBIGUOUS, // Something only the parser can classify.
+} qc_tok_t;
+
+typedef struct qc_tokenizer
+{
+    const char* pos;  // The current position.
+    const char* end;  // One past the end of the statement.
+    const char* word; // The start of the latest QC_TOK_WORD.
+    size_t word_len;  // The length of the latest QC_TOK_WORD.
+} QC_TOKENIZER;
+
+static inline bool is_word_char(char c)
+{
+    return isalnum((unsigned char)c) || (c == '_') || (c == '$') || ((unsigned char)c >= 0x80);
+}
+
+/**
+ * Skips whitespace and comments.
+ *
+ * @param t  The tokenizer.
+ *
+ * @return False, if an executable or an unterminated comment was encountered.
+ */
+static bool tokenizer_skip(QC_TOKENIZER* t)
+{
+    while (t->pos < t->end)
+    {
+        const char* p = t->pos;
+
+        if (isspace((unsigned char)*p))
+        {
+            ++t->pos;
+        }
+        else if ((*p == '#') ||
+                 ((*p == '-') && (p + 1 < t->end) && (p[1] == '-') &&
+                  ((p + 2 == t->end) || isspace((unsigned char)p[2]))))
+        {
+            while ((t->pos < t->end) && (*t->pos != '\n'))
+            {
+                ++t->pos;
+            }
+        }
+        else if ((*p == '/') && (p + 1 < t->end) && (p[1] == '*'))
+        {
+            // "/*!" and "/*M!" are executed by the server.
+            if ((p + 2 < t->end) && ((p[2] == '!') || (p[2] == 'M')))
+            {
+                return false;
+            }
+
+            p += 2;
+
+            while ((p + 1 < t->end) && !((p[0] == '*') && (p[1] == '/')))
+            {
+                ++p;
+            }
+
+            if (p + 1 >= t->end)
+            {
+                return false;
+            }
+
+            t->pos = p + 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+static qc_tok_t tokenizer_next(QC_TOKENIZER* t)
+{
+    if (!tokenizer_skip(t))
+    {
+        return QC_TOK_AMBIGUOUS;
+    }
+
+    if (t->pos == t->end)
+    {
+        return QC_TOK_END;
+    }
+
+    qc_tok_t token = QC_TOK_OTHER;
+    char c = *t->pos;
+
+    if (is_word_char(c))
+    {
+        t->word = t->pos;
+
+        while ((t->pos < t->end) && is_word_char(*t->pos))
+        {
+            ++t->pos;
+        }
+
+        t->word_len = t->pos - t->word;
+        token = QC_TOK_WORD;
+    }
+    else
+    {
+        ++t->pos;
+
+        switch (c)
+        {
+        case '\'':
+        case '"':
+        case '`':
+            token = QC_TOK_AMBIGUOUS; // Unless the closing quote is found.
+
+            while (t->pos < t->end)
+            {
+                char q = *t->pos++;
+
+                if ((q == '\\') && (c != '`'))
+                {
+                    ++t->pos;
+                }
+                else if (q == c)
+                {
+                    if ((t->pos < t->end) && (*t->pos == c))
+                    {
+                        ++t->pos; // A doubled quote.
+                    }
+                    else
+                    {
+                        token = QC_TOK_QUOTED;
+                        break;
+                    }
+                }
+            }
+            break;
+
+        case '=':
+            token = QC_TOK_EQ;
+            break;
+
+        case ',':
+            token = QC_TOK_COMMA;
+            break;
+
+        case ';':
+            // Only a trailing semicolon is accepted.
+            token = (tokenizer_skip(t) && (t->pos == t->end)) ? QC_TOK_END : QC_TOK_AMBIGUOUS;
+            break;
+
+        case '(':
+        case '@':
+        case '{':
+        case ':':
+            // Function calls, subqueries, variables, ODBC escapes and labels.
+            token = QC_TOK_AMBIGUOUS;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return token;
+}
+
+static bool tokenizer_is(const QC_TOKENIZER* t, const char* keyword)
+{
+    return (strlen(keyword) == t->word_len) && (strncasecmp(t->word, keyword, t->word_len) == 0);
+}
+
+static bool tokenizer_next_is(QC_TOKENIZER* t, const char* keyword)
+{
+    return (tokenizer_next(t) == QC_TOK_WORD) && tokenizer_is(t, keyword);
+}
+
+/**
+ * Checks whether the rest of the statement is "[WORK]".
+ */
+static bool tokenize_work_opt(QC_TOKENIZER* t)
+{
+    qc_tok_t token = tokenizer_next(t);
+
+    if ((token == QC_TOK_WORD) && tokenizer_is(t, "work"))
+    {
+        token = tokenizer_next(t);
+    }
+
+    return token == QC_TOK_END;
+}
+
+static bool tokenize_select(QC_TOKENIZER* t, QC_SQLITE_INFO* info)
+{
+    bool has_clause = false;
+    qc_tok_t token;
+
+    while (((token = tokenizer_next(t)) != QC_TOK_END) && (token != QC_TOK_AMBIGUOUS))
+    {
+        if (token == QC_TOK_WORD)
+        {
+            if (tokenizer_is(t, "into") ||     // SELECT ... INTO ...
+                tokenizer_is(t, "for") ||      // SELECT ... FOR UPDATE
+                tokenizer_is(t, "lock") ||     // SELECT ... LOCK IN SHARE MODE
+                tokenizer_is(t, "procedure"))  // SELECT ... PROCEDURE ANALYSE
+            {
+                token = QC_TOK_AMBIGUOUS;
+                break;
+            }
+            else if (tokenizer_is(t, "where") || tokenizer_is(t, "having"))
+            {
+                has_clause = true;
+            }
+        }
+    }
+
+    if (token == QC_TOK_END)
+    {
+        info->type_mask = QUERY_TYPE_READ;
+        info->operation = QUERY_OP_SELECT;
+        info->has_clause = has_clause;
+    }
+
+    return token == QC_TOK_END;
+}
+
+static bool tokenize_start_transaction(QC_TOKENIZER* t, QC_SQLITE_INFO* info)
+{
+    if (!tokenizer_next_is(t, "transaction"))
+    {
+        return false;
+    }
+
+    uint32_t type_mask = QUERY_TYPE_BEGIN_TRX;
+    qc_tok_t token = tokenizer_next(t);
+
+    while (token == QC_TOK_WORD)
+    {
+        if (tokenizer_is(t, "read"))
+        {
+            if (tokenizer_next_is(t, "only"))
+            {
+                type_mask |= QUERY_TYPE_READ;
+            }
+            else if (tokenizer_is(t, "write"))
+            {
+                type_mask |= QUERY_TYPE_WRITE;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (!tokenizer_is(t, "with") ||
+                 !tokenizer_next_is(t, "consistent") ||
+                 !tokenizer_next_is(t, "snapshot"))
+        {
+            return false;
+        }
+
+        token = tokenizer_next(t);
+
+        if (token == QC_TOK_COMMA)
+        {
+            token = tokenizer_next(t);
+
+            if (token != QC_TOK_WORD)
+            {
+                return false;
+            }
+        }
+    }
+
+    if (token == QC_TOK_END)
+    {
+        info->type_mask = type_mask;
+    }
+
+    return token == QC_TOK_END;
+}
+
+static bool tokenize_set_autocommit(QC_TOKENIZER* t, QC_SQLITE_INFO* info)
+{
+    qc_tok_t token = tokenizer_next(t);
+
+    if ((token == QC_TOK_WORD) && tokenizer_is(t, "session"))
+    {
+        token = tokenizer_next(t);
+    }
+
+    if ((token != QC_TOK_WORD) || !tokenizer_is(t, "autocommit") ||
+        (tokenizer_next(t) != QC_TOK_EQ) || (tokenizer_next(t) != QC_TOK_WORD))
+    {
+        return false;
+    }
+
+    int enable = -1;
+
+    if (tokenizer_is(t, "1") || tokenizer_is(t, "true") || tokenizer_is(t, "on"))
+    {
+        enable = 1;
+    }
+    else if (tokenizer_is(t, "0") || tokenizer_is(t, "false") || tokenizer_is(t, "off"))
+    {
+        enable = 0;
+    }
+
+    if ((enable == -1) || (tokenizer_next(t) != QC_TOK_END))
+    {
+        return false;
+    }
+
+    if (enable)
+    {
+        info->type_mask = (QUERY_TYPE_GSYSVAR_WRITE |
+                           QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_COMMIT);
+    }
+    else
+    {
+        info->type_mask = (QUERY_TYPE_GSYSVAR_WRITE |
+                           QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT);
+    }
+
+    return true;
+}
+
+/**
+ * Classifies a statement using the tokenizer.
+ *
+ * @param info   The info to store the classification in.
+ * @param query  The statement.
+ * @param len    The length of the statement.
+ *
+ * @return True, if the statement could be classified. If false is returned,
+ *         the statement must be parsed and @c info may contain garbage.
+ */
+static bool tokenize_query(QC_SQLITE_INFO* info, const char* query, size_t len)
+{
+    QC_TOKENIZER t = { query, query + len, NULL, 0 };
+    bool classified = false;
+
+    if (tokenizer_next(&t) == QC_TOK_WORD)
+    {
+        if (tokenizer_is(&t, "select"))
+        {
+            classified = tokenize_select(&t, info);
+        }
+        else if (tokenizer_is(&t, "begin"))
+        {
+            info->type_mask = QUERY_TYPE_BEGIN_TRX;
+            classified = tokenize_work_opt(&t);
+        }
+        else if (tokenizer_is(&t, "start"))
+        {
+            classified = tokenize_start_transaction(&t, info);
+        }
+        else if (tokenizer_is(&t, "commit"))
+        {
+            info->type_mask = QUERY_TYPE_COMMIT;
+            classified = tokenize_work_opt(&t);
+        }
+        else if (tokenizer_is(&t, "rollback"))
+        {
+            info->type_mask = QUERY_TYPE_ROLLBACK;
+            classified = tokenize_work_opt(&t);
+        }
+        else if (tokenizer_is(&t, "set"))
+        {
+            classified = tokenize_set_autocommit(&t, info);
+        }
+    }
+
+    return classified;
+}
+
+/**
+ * Returns the length of the prefix that is parsed in place of a statement
+ * that is longer than the limit. If the statement is an INSERT or REPLACE
+ * with a VALUES list, the prefix ends after the last row that fits within
+ * the limit, so that the prefix is a complete statement that is classified
+ * like the whole one. Otherwise the statement is simply cut at the limit,
+ * after which it can typically only be classified by keywords.
+ *
+ * @param s      The statement.
+ * @param len    The length of the statement.
+ * @param limit  The maximum length of the prefix.
+ *
+ * @return The length of the prefix.
+ */
+static size_t get_prefix_len(const char* s, size_t len, size_t limit)
+{
+    const char* end = s + (len < limit ? len : limit);
+    QC_TOKENIZER t = { s, end, NULL, 0 };
+
+    if ((tokenizer_next(&t) != QC_TOK_WORD) ||
+        !(tokenizer_is(&t, "insert") || tokenizer_is(&t, "replace")))
+    {
+        return end - s;
+    }
+
+    const char* prefix_end = NULL;
+    const char* p = t.pos;
+    bool values_seen = false;
+    int depth = 0;
+
+    while (p < end)
+    {
+        char c = *p;
+
+        if ((c == '\'') || (c == '"') || (c == '`'))
+        {
+            // A doubled quote is treated as two adjacent strings.
+            ++p;
+
+            while ((p < end) && (*p != c))
+            {
+                if ((*p == '\\') && (c != '`'))
+                {
+                    ++p;
+                }
+
+                ++p;
+            }
+
+            ++p;
+        }
+        else if ((c == '#') ||
+                 ((c == '-') && (p + 2 < end) && (p[1] == '-') && isspace((unsigned char)p[2])))
+        {
+            while ((p < end) && (*p != '\n'))
+            {
+                ++p;
+            }
+        }
+        else if ((c == '/') && (p + 1 < end) && (p[1] == '*'))
+        {
+            p += 2;
+
+            while ((p + 1 < end) && !((p[0] == '*') && (p[1] == '/')))
+            {
+                ++p;
+            }
+
+            p += 2;
+        }
+        else if (is_word_char(c))
+        {
+            const char* word = p;
+
+            while ((p < end) && is_word_char(*p))
+            {
+                ++p;
+            }
+
+            size_t n = p - word;
+
+            if ((depth == 0) &&
+                (((n == 6) && (strncasecmp(word, "values", n) == 0)) ||
+                 ((n == 5) && (strncasecmp(word, "value", n) == 0))))
+            {
+                values_seen = true;
+            }
+        }
+        else
+        {
+            if (c == '(')
+            {
+                ++depth;
+            }
+            else if (c == ')')
+            {
+                --depth;
+
+                if ((depth == 0) && values_seen)
+                {
+                    prefix_end = p + 1;
+                }
+            }
+
+            ++p;
+        }
+    }
+
+    return (prefix_end ? prefix_end : end) - s;
+}
+
+/**
+ * Returns the info needed for reporting the type mask and operation of a
+ * statement. If the statement has not been parsed, an attempt is first made
+ * to classify it using the tokenizer. If that fails, it is parsed.
+ *
+ * @param query  The statement.
+ *
+ * @return The info, or NULL if the statement could not be parsed.
+ */
+static QC_SQLITE_INFO* get_query_type_info(GWBUF* query)
+{
+    QC_SQLITE_INFO* info = NULL;
+
+    if (GWBUF_IS_PARSED(query))
+    {
+        info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
+        ss_dassert(info);
+    }
+    else if (GWBUF_IS_CONTIGUOUS(query) && (GWBUF_LENGTH(query) >= MYSQL_HEADER_LEN + 1))
+    {
+        uint8_t* data = (uint8_t*) GWBUF_DATA(query);
+
+        if ((GWBUF_LENGTH(query) == MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(data)) &&
+            (MYSQL_GET_COMMAND(data) == MYSQL_COM_QUERY))
+        {
+            QC_SQLITE_INFO tokenized;
+            info_init(&tokenized, QC_COLLECT_ESSENTIALS);
+
+            const char* s = (const char*) &data[MYSQL_HEADER_LEN + 1];
+            size_t len = MYSQL_GET_PAYLOAD_LEN(data) - 1; // Subtract 1 for packet type byte.
+
+            if (tokenize_query(&tokenized, s, len))
+            {
+                tokenized.status = QC_QUERY_TOKENIZED;
+                tokenized.tokenized_only = true;
+
+                info = info_alloc(QC_COLLECT_ESSENTIALS);
+                *info = tokenized;
+
+                if (!gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO, info, buffer_object_free))
+                {
+                    info_free(info);
+                    info = NULL;
+                }
+            }
+        }
+    }
+
+    if (!info)
+    {
+        info = get_query_info(query, QC_COLLECT_ESSENTIALS);
+    }
+
+    return info;
+}
+
 /**
  * Logs information about invalid data.
  *
@@ -771,10 +1413,10 @@ static void update_field_info(QC_SQLITE_INFO* info,
     // If field_infos is NULL, then the field was found and has already been noted.
     if (field_infos)
     {
-        item.database = item.database ? MXS_STRDUP(item.database) : NULL;
-        item.table = item.table ? MXS_STRDUP(item.table) : NULL;
+        item.database = item.database ? info_strdup(info, item.database) : NULL;
+        item.table = item.table ? info_strdup(info, item.table) : NULL;
         ss_dassert(item.column);
-        item.column = MXS_STRDUP(item.column);
+        item.column = info_strdup(info, item.column);
 
         // We are happy if we at least could dup the column.
 
@@ -840,7 +1482,7 @@ static void update_function_info(QC_SQLITE_INFO* info,
     if (function_infos)
     {
         ss_dassert(item.name);
-        item.name = MXS_STRDUP(item.name);
+        item.name = info_strdup(info, item.name);
 
         if (item.name)
         {
@@ -1285,7 +1927,7 @@ static void update_field_infos_from_select_compound(QC_SQLITE_INFO* info,
 
 static void update_database_names(QC_SQLITE_INFO* info, const char* zDatabase)
 {
-    char* zCopy = MXS_STRDUP(zDatabase);
+    char* zCopy = info_strdup(info, zDatabase);
     MXS_ABORT_IF_NULL(zCopy);
     exposed_sqlite3Dequote(zCopy);
 
@@ -1299,7 +1941,7 @@ static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char
 {
     if ((info->collect & QC_COLLECT_TABLES) && !(info->collected & QC_COLLECT_TABLES))
     {
-        char* zCopy = MXS_STRDUP(zTable);
+        char* zCopy = info_strdup(info, zTable);
         MXS_ABORT_IF_NULL(zCopy);
         // TODO: Is this call really needed. Check also sqlite3Dequote.
         exposed_sqlite3Dequote(zCopy);
@@ -1310,7 +1952,7 @@ static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char
 
         if (zDatabase)
         {
-            zCopy = MXS_MALLOC(strlen(zDatabase) + 1 + strlen(zTable) + 1);
+            zCopy = info_alloc_string(info, strlen(zDatabase) + 1 + strlen(zTable) + 1);
             MXS_ABORT_IF_NULL(zCopy);
 
             strcpy(zCopy, zDatabase);
@@ -1320,7 +1962,7 @@ static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char
         }
         else
         {
-            zCopy = MXS_STRDUP(zCopy);
+            zCopy = info_strdup(info, zCopy);
             MXS_ABORT_IF_NULL(zCopy);
         }
 
@@ -1828,7 +2470,7 @@ void mxs_sqlite3StartTable(Parse *pParse,   /* Parser context */
             // this information already.
             if (!info->created_table_name)
             {
-                info->created_table_name = MXS_STRDUP(info->table_names[0]);
+                info->created_table_name = info_strdup(info, info->table_names[0]);
                 MXS_ABORT_IF_NULL(info->created_table_name);
             }
             else
@@ -2009,7 +2651,7 @@ void maxscaleDeallocate(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
+        info->prepare_name = info_alloc_string(info, pName->n + 1);
         if (info->prepare_name)
         {
             memcpy(info->prepare_name, pName->z, pName->n);
@@ -2062,7 +2704,7 @@ void maxscaleExecute(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
+        info->prepare_name = info_alloc_string(info, pName->n + 1);
         if (info->prepare_name)
         {
             memcpy(info->prepare_name, pName->z, pName->n);
@@ -2442,7 +3084,7 @@ void maxscalePrepare(Parse* pParse, Token* pName, Token* pStmt)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
+        info->prepare_name = info_alloc_string(info, pName->n + 1);
         if (info->prepare_name)
         {
             memcpy(info->prepare_name, pName->z, pName->n);
@@ -2937,6 +3579,9 @@ static int32_t qc_sqlite_get_table_names(GWBUF* query, int32_t fullnames, char**
 static int32_t qc_sqlite_get_canonical(GWBUF* query, char** canonical);
 static int32_t qc_sqlite_query_has_clause(GWBUF* query, int32_t* has_clause);
 static int32_t qc_sqlite_get_database_names(GWBUF* query, char*** names, int* sizep);
+static int32_t qc_sqlite_get_table_names_ref(GWBUF* query, int32_t fullnames,
+                                             const char* const** names, uint32_t* n_names);
+static int32_t qc_sqlite_get_database_names_ref(GWBUF* query, const char* const** names, uint32_t* n_names);
 static int32_t qc_sqlite_get_preparable_stmt(GWBUF* stmt, GWBUF** preparable_stmt);
 
 static bool get_key_and_value(char* arg, const char** pkey, const char** pvalue)
@@ -2955,6 +3600,7 @@ static bool get_key_and_value(char* arg, const char** pkey, const char** pvalue)
 }
 
 static char ARG_LOG_UNRECOGNIZED_STATEMENTS[] = "log_unrecognized_statements";
+static char ARG_MAX_PARSE_LENGTH[] = "max_parse_length";
 
 static int32_t qc_sqlite_setup(const char* args)
 {
@@ -2962,46 +3608,69 @@ static int32_t qc_sqlite_setup(const char* args)
     assert(!this_unit.setup);
 
     qc_log_level_t log_level = QC_LOG_NOTHING;
+    size_t max_parse_length = 0;
 
     if (args)
     {
-        char arg[strlen(args) + 1];
-        strcpy(arg, args);
+        char copy[strlen(args) + 1];
+        strcpy(copy, args);
 
-        const char* key;
-        const char* value;
+        char* saveptr;
+        char* arg = strtok_r(copy, ",", &saveptr);
 
-        if (get_key_and_value(arg, &key, &value))
+        while (arg)
         {
-            if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+            const char* key;
+            const char* value;
+
+            if (get_key_and_value(arg, &key, &value))
             {
                 char *end;
 
-                long l = strtol(value, &end, 0);
+                if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+                {
+                    long l = strtol(value, &end, 0);
 
-                if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                    if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                    {
+                        log_level = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("'%s' is not a number between %d and %d.",
+                                    value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    }
+                }
+                else if (strcmp(key, ARG_MAX_PARSE_LENGTH) == 0)
                 {
-                    log_level = l;
+                    long l = strtol(value, &end, 0);
+
+                    if ((*end == 0) && (l >= 0))
+                    {
+                        max_parse_length = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("'%s' is not a non-negative number.", value);
+                    }
                 }
                 else
                 {
-                    MXS_WARNING("'%s' is not a number between %d and %d.",
-                                value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    MXS_WARNING("'%s' is not a recognized argument.", key);
                 }
             }
             else
             {
-                MXS_WARNING("'%s' is not a recognized argument.", key);
+                MXS_WARNING("'%s' is not a recognized argument string.", arg);
             }
-        }
-        else
-        {
-            MXS_WARNING("'%s' is not a recognized argument string.", args);
+
+            arg = strtok_r(NULL, ",", &saveptr);
         }
     }
 
     this_unit.setup = true;
     this_unit.log_level = log_level;
+    this_unit.max_parse_length = max_parse_length;
 
     return this_unit.setup ? QC_RESULT_OK : QC_RESULT_ERROR;
 }
@@ -3083,6 +3752,17 @@ static int32_t qc_sqlite_thread_init(void)
     int rc = sqlite3_open(":memory:", &this_thread.db);
     if (rc == SQLITE_OK)
     {
+        // A larger lookaside than the default means that the parse tree of a
+        // typical statement is allocated without calling malloc.
+        rc = sqlite3_db_config(this_thread.db, SQLITE_DBCONFIG_LOOKASIDE, NULL,
+                               QC_SQLITE_LOOKASIDE_SLOT_SIZE, QC_SQLITE_LOOKASIDE_SLOT_COUNT);
+
+        if (rc != SQLITE_OK)
+        {
+            MXS_WARNING("Could not configure the lookaside memory of the in-memory "
+                        "sqlite database: %s", sqlite3_errstr(rc));
+        }
+
         this_thread.initialized = true;
 
         MXS_INFO("In-memory sqlite database successfully opened for thread %lu.",
@@ -3174,7 +3854,7 @@ static int32_t qc_sqlite_get_type_mask(GWBUF* query, uint32_t* type_mask)
     ss_dassert(this_thread.initialized);
 
     *type_mask = QUERY_TYPE_UNKNOWN;
-    QC_SQLITE_INFO* info = get_query_info(query, QC_COLLECT_ESSENTIALS);
+    QC_SQLITE_INFO* info = get_query_type_info(query);
 
     if (info)
     {
@@ -3204,7 +3884,7 @@ static int32_t qc_sqlite_get_operation(GWBUF* query, int32_t* op)
     ss_dassert(this_thread.initialized);
 
     *op = QUERY_OP_UNDEFINED;
-    QC_SQLITE_INFO* info = get_query_info(query, QC_COLLECT_ESSENTIALS);
+    QC_SQLITE_INFO* info = get_query_type_info(query);
 
     if (info)
     {
@@ -3341,6 +4021,50 @@ static int32_t qc_sqlite_get_table_names(GWBUF* query,
     return rv;
 }
 
+static int32_t qc_sqlite_get_table_names_ref(GWBUF* query,
+                                             int32_t fullnames,
+                                             const char* const** table_names,
+                                             uint32_t* n_table_names)
+{
+    QC_TRACE();
+    int32_t rv = QC_RESULT_ERROR;
+    ss_dassert(this_unit.initialized);
+    ss_dassert(this_thread.initialized);
+
+    *table_names = NULL;
+    *n_table_names = 0;
+    QC_SQLITE_INFO* info = get_query_info(query, QC_COLLECT_TABLES);
+
+    if (info)
+    {
+        if (qc_info_is_valid(info->status))
+        {
+            if (fullnames)
+            {
+                *table_names = (const char* const*)info->table_fullnames;
+                *n_table_names = info->table_fullnames_len;
+            }
+            else
+            {
+                *table_names = (const char* const*)info->table_names;
+                *n_table_names = info->table_names_len;
+            }
+
+            rv = QC_RESULT_OK;
+        }
+        else if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
+        {
+            log_invalid_data(query, "cannot report what tables are accessed");
+        }
+    }
+    else
+    {
+        MXS_ERROR("The query could not be parsed. Response not valid.");
+    }
+
+    return rv;
+}
+
 static int32_t qc_sqlite_get_canonical(GWBUF* query, char** canonical)
 {
     QC_TRACE();
@@ -3420,6 +4144,41 @@ static int32_t qc_sqlite_get_database_names(GWBUF* query, char*** database_names
     return rv;
 }
 
+static int32_t qc_sqlite_get_database_names_ref(GWBUF* query,
+                                                const char* const** database_names,
+                                                uint32_t* n_database_names)
+{
+    QC_TRACE();
+    int32_t rv = QC_RESULT_ERROR;
+    ss_dassert(this_unit.initialized);
+    ss_dassert(this_thread.initialized);
+
+    *database_names = NULL;
+    *n_database_names = 0;
+    QC_SQLITE_INFO* info = get_query_info(query, QC_COLLECT_DATABASES);
+
+    if (info)
+    {
+        if (qc_info_is_valid(info->status))
+        {
+            *database_names = (const char* const*)info->database_names;
+            *n_database_names = info->database_names_len;
+
+            rv = QC_RESULT_OK;
+        }
+        else if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
+        {
+            log_invalid_data(query, "cannot report what databases are accessed");
+        }
+    }
+    else
+    {
+        MXS_ERROR("The query could not be parsed. Response not valid.");
+    }
+
+    return rv;
+}
+
 static int32_t qc_sqlite_get_prepare_name(GWBUF* query, char** prepare_name)
 {
     QC_TRACE();
@@ -3579,6 +4338,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         qc_sqlite_get_field_info,
         qc_sqlite_get_function_info,
         qc_sqlite_get_preparable_stmt,
+        qc_sqlite_get_table_names_ref,
+        qc_sqlite_get_database_names_ref,
     };
 
     static MXS_MODULE info =
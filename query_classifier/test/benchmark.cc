@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#define MYSQL_COM_QUIT        COM_QUIT
+#define MYSQL_COM_INIT_DB     COM_INIT_DB
+#define MYSQL_COM_CHANGE_USER COM_CHANGE_USER
+#include <maxscale/config.h>
+#include <maxscale/paths.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "../../server/core/maxscale/query_classifier.h"
+#include "testreader.hh"
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::map;
+using std::string;
+using std::vector;
+
+/**
+ * The allocations made by the classifier are counted by interposing the
+ * allocation functions of libc. The counter is thread specific so that
+ * counting does not affect the scalability that is being measured.
+ */
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+}
+
+static thread_local uint64_t n_allocations;
+
+extern "C" void* malloc(size_t size)
+{
+    ++n_allocations;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    ++n_allocations;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    ++n_allocations;
+    return __libc_realloc(ptr, size);
+}
+
+namespace
+{
+
+char USAGE[] =
+    "usage: qc_benchmark [-c classifier] [-A args] [-t threads] [-r rounds] "
+        "[-C cache size] [-p] file...\n\n"
+    "-c    the classifier, default qc_sqlite\n"
+    "-A    arguments for the classifier\n"
+    "-t    the number of threads, default 1\n"
+    "-r    how many times each thread classifies the statements, default 1\n"
+    "-C    the size of the classification cache of each thread, default 0 (disabled)\n"
+    "-p    parse the statements completely, instead of only getting the type and operation\n\n"
+    "The files contain the statements, either one per line or in the format of a\n"
+    "MySQL/MariaDB test file. Each statement is classified the way a router does it,\n"
+    "with a new buffer, so that the result of an earlier round is not reused.\n";
+
+struct Kind
+{
+    Kind()
+        : n_statements(0)
+        , ns(0)
+        , n_allocations(0)
+    {
+    }
+
+    uint64_t n_statements;
+    uint64_t ns;
+    uint64_t n_allocations;
+};
+
+typedef map<string, Kind> Kinds;
+
+struct Thread
+{
+    Thread()
+        : tid(0)
+        , ok(false)
+        , cache_hits(0)
+        , cache_misses(0)
+    {
+    }
+
+    pthread_t tid;
+    bool      ok;
+    Kinds     kinds;
+    int64_t   cache_hits;
+    int64_t   cache_misses;
+};
+
+struct
+{
+    vector<string> statements;
+    size_t         rounds;
+    bool           parse;
+} global;
+
+GWBUF* create_gwbuf(const string& s)
+{
+    size_t len = s.length();
+    size_t payload_len = len + 1;
+    size_t gwbuf_len = MYSQL_HEADER_LEN + payload_len;
+
+    GWBUF* gwbuf = gwbuf_alloc(gwbuf_len);
+
+    if (gwbuf)
+    {
+        uint8_t* data = GWBUF_DATA(gwbuf);
+
+        data[0] = payload_len;
+        data[1] = (payload_len >> 8);
+        data[2] = (payload_len >> 16);
+        data[3] = 0x00;
+        data[4] = 0x03;
+        memcpy(data + 5, s.c_str(), len);
+    }
+
+    return gwbuf;
+}
+
+inline uint64_t time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool read_statements(const char* zFile)
+{
+    ifstream in(zFile);
+
+    if (!in)
+    {
+        cerr << "error: Could not open " << zFile << "." << endl;
+        return false;
+    }
+
+    maxscale::TestReader reader(in);
+    string stmt;
+
+    while (reader.get_statement(stmt) == maxscale::TestReader::RESULT_STMT)
+    {
+        global.statements.push_back(stmt);
+        stmt.clear();
+    }
+
+    return true;
+}
+
+void* run(void* pData)
+{
+    Thread* pThread = static_cast<Thread*>(pData);
+
+    if (!qc_thread_init(QC_INIT_BOTH))
+    {
+        cerr << "error: Could not initialize the classifier for a thread." << endl;
+        return NULL;
+    }
+
+    for (size_t round = 0; round < global.rounds; ++round)
+    {
+        for (vector<string>::const_iterator i = global.statements.begin();
+             i != global.statements.end();
+             ++i)
+        {
+            GWBUF* pStmt = create_gwbuf(*i);
+
+            if (pStmt)
+            {
+                uint64_t allocations = n_allocations;
+                uint64_t start = time_ns();
+
+                if (global.parse)
+                {
+                    qc_parse(pStmt, QC_COLLECT_ALL);
+                }
+
+                qc_get_type_mask(pStmt);
+                qc_query_op_t op = qc_get_operation(pStmt);
+
+                uint64_t ns = time_ns() - start;
+
+                Kind& kind = pThread->kinds[qc_op_to_string(op)];
+                ++kind.n_statements;
+                kind.ns += ns;
+                kind.n_allocations += n_allocations - allocations;
+
+                gwbuf_free(pStmt);
+            }
+        }
+    }
+
+    qc_get_cache_stats(&pThread->cache_hits, &pThread->cache_misses);
+    qc_thread_end(QC_INIT_BOTH);
+    pThread->ok = true;
+
+    return NULL;
+}
+
+void report(const vector<Thread>& threads, uint64_t ns)
+{
+    Kinds kinds;
+    Kind total;
+    int64_t cache_hits = 0;
+    int64_t cache_misses = 0;
+
+    for (vector<Thread>::const_iterator i = threads.begin(); i != threads.end(); ++i)
+    {
+        for (Kinds::const_iterator j = i->kinds.begin(); j != i->kinds.end(); ++j)
+        {
+            Kind& kind = kinds[j->first];
+            kind.n_statements += j->second.n_statements;
+            kind.ns += j->second.ns;
+            kind.n_allocations += j->second.n_allocations;
+
+            total.n_statements += j->second.n_statements;
+            total.ns += j->second.ns;
+            total.n_allocations += j->second.n_allocations;
+        }
+
+        cache_hits += i->cache_hits;
+        cache_misses += i->cache_misses;
+    }
+
+    printf("%-24s | %-12s | %-12s | %s\n", "Operation", "Statements", "ns/stmt", "allocs/stmt");
+    printf("-------------------------+--------------+--------------+------------\n");
+
+    for (Kinds::const_iterator i = kinds.begin(); i != kinds.end(); ++i)
+    {
+        const Kind& kind = i->second;
+
+        printf("%-24s | %-12lu | %-12lu | %.1f\n",
+               i->first.c_str(), kind.n_statements,
+               kind.ns / kind.n_statements,
+               (double)kind.n_allocations / kind.n_statements);
+    }
+
+    printf("-------------------------+--------------+--------------+------------\n");
+
+    if (total.n_statements)
+    {
+        printf("%-24s | %-12lu | %-12lu | %.1f\n",
+               "Total", total.n_statements,
+               total.ns / total.n_statements,
+               (double)total.n_allocations / total.n_statements);
+    }
+
+    printf("\nThreads       : %lu\n", threads.size());
+    printf("Elapsed       : %.3f s\n", ns / 1e9);
+    printf("Statements/sec: %.0f\n", ns ? total.n_statements / (ns / 1e9) : 0.0);
+
+    if (cache_hits + cache_misses)
+    {
+        printf("Cache hit rate: %.1f %%\n", 100.0 * cache_hits / (cache_hits + cache_misses));
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    const char* zClassifier = "qc_sqlite";
+    const char* zClassifierArgs = NULL;
+    size_t n_threads = 1;
+    int64_t cache_size = 0;
+
+    global.rounds = 1;
+    global.parse = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:A:t:r:C:p")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            zClassifier = optarg;
+            break;
+
+        case 'A':
+            zClassifierArgs = optarg;
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'r':
+            global.rounds = atoi(optarg);
+            break;
+
+        case 'C':
+            cache_size = strtoll(optarg, NULL, 10);
+            break;
+
+        case 'p':
+            global.parse = true;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+            break;
+        };
+    }
+
+    if ((rc != EXIT_SUCCESS) || (optind == argc) || (n_threads == 0))
+    {
+        cout << USAGE << endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; ++i)
+    {
+        if (!read_statements(argv[i]))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    rc = EXIT_FAILURE;
+
+    set_datadir(strdup("/tmp"));
+    set_langdir(strdup("."));
+    set_process_datadir(strdup("/tmp"));
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        size_t len = strlen(zClassifier);
+        char libdir[len + 4];
+        sprintf(libdir, "../%s", zClassifier);
+        set_libdir(strdup(libdir));
+
+        config_get_global_options()->qc_cache_size = cache_size;
+
+        if (qc_setup(zClassifier, zClassifierArgs) && qc_process_init(QC_INIT_BOTH))
+        {
+            vector<Thread> threads(n_threads);
+            uint64_t start = time_ns();
+            rc = EXIT_SUCCESS;
+
+            for (size_t i = 0; i < n_threads; ++i)
+            {
+                if (pthread_create(&threads[i].tid, NULL, run, &threads[i]) != 0)
+                {
+                    cerr << "error: Could not create thread." << endl;
+                    threads.resize(i);
+                    rc = EXIT_FAILURE;
+                    break;
+                }
+            }
+
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                pthread_join(threads[i].tid, NULL);
+
+                if (!threads[i].ok)
+                {
+                    rc = EXIT_FAILURE;
+                }
+            }
+
+            if (rc == EXIT_SUCCESS)
+            {
+                cout << global.statements.size() << " statements, "
+                     << global.rounds << " rounds, classifier " << zClassifier << "\n\n";
+                report(threads, time_ns() - start);
+            }
+
+            qc_process_end(QC_INIT_BOTH);
+        }
+        else
+        {
+            cerr << "error: Could not setup or init classifier " << zClassifier << "." << endl;
+        }
+
+        mxs_log_finish();
+    }
+    else
+    {
+        cerr << "error: Could not initialize log." << endl;
+    }
+
+    return rc;
+}
@@ -37,7 +37,7 @@ typedef struct consumer_t
 {
     char *hostname, *vhost, *user, *passwd, *queue, *dbserver, *dbname, *dbuser, *dbpasswd;
     DELIVERY* query_stack;
-    int port, dbport;
+    int port, dbport, batch_size;
 } CONSUMER;
 
 static int all_ok;
@@ -46,10 +46,11 @@ static CONSUMER* c_inst;
 static char* DB_DATABASE = "CREATE DATABASE IF NOT EXISTS %s;";
 static char* DB_TABLE =
     "CREATE TABLE IF NOT EXISTS pairs (tag VARCHAR(64) PRIMARY KEY NOT NULL, query VARCHAR(2048), reply VARCHAR(2048), date_in DATETIME NOT NULL, date_out DATETIME DEFAULT NULL, counter INT DEFAULT 1)";
-static char* DB_INSERT = "INSERT INTO pairs(tag, query, date_in) VALUES ('%s','%s',FROM_UNIXTIME(%s))";
-static char* DB_UPDATE = "UPDATE pairs SET reply='%s', date_out=FROM_UNIXTIME(%s) WHERE tag='%s'";
+static char* DB_INSERT = "INSERT INTO pairs(tag, query, date_in) SELECT '%s','%s',FROM_UNIXTIME(%s) "
+    "FROM DUAL WHERE NOT EXISTS (SELECT 1 FROM pairs WHERE query='%s');";
+static char* DB_UPDATE = "UPDATE pairs SET reply='%s', date_out=FROM_UNIXTIME(%s) WHERE tag='%s';";
 static char* DB_INCREMENT =
-    "UPDATE pairs SET counter = counter+1, date_out=FROM_UNIXTIME(%s) WHERE query='%s'";
+    "UPDATE pairs SET counter = counter+1, date_out=FROM_UNIXTIME(%s) WHERE query='%s';";
 
 void sighndl(int signum)
 {
@@ -110,6 +111,10 @@ int handler(void* user, const char* section, const char* name,
         {
             c_inst->dbpasswd = strdup(value);
         }
+        else if (strcmp(name, "batch_size") == 0)
+        {
+            c_inst->batch_size = atoi(value);
+        }
         else if (strcmp(name, "logfile") == 0)
         {
             out_fd = fopen(value, "ab");
@@ -151,7 +156,7 @@ int connectToServer(MYSQL* server)
                                         NULL,
                                         c_inst->dbport,
                                         NULL,
-                                        0);
+                                        CLIENT_MULTI_STATEMENTS);
 
 
     if (result == NULL)
@@ -197,12 +202,17 @@ int connectToServer(MYSQL* server)
     return 1;
 }
 
-int sendMessage(MYSQL* server, amqp_message_t* msg)
+/**
+ * Format the statements that store a message into the database.
+ * @param server The database connection, used for escaping
+ * @param msg The message
+ * @return The statements separated by semicolons or NULL if the message is malformed
+ */
+char* formatMessage(MYSQL* server, amqp_message_t* msg)
 {
-    int buffsz = (int)((msg->body.len + 1) * 2 + 1) +
+    int buffsz = (int)((msg->body.len + 1) * 2 + 1) * 5 +
                  (int)((msg->properties.correlation_id.len + 1) * 2 + 1) +
-                 strlen(DB_INSERT),
-                 rval = 0;
+                 strlen(DB_INCREMENT) + strlen(DB_INSERT);
     char* saved;
     char *qstr = calloc(buffsz, sizeof(char)),
           *rawmsg = calloc((msg->body.len + 1), sizeof(char)),
@@ -222,8 +232,7 @@ int sendMessage(MYSQL* server, amqp_message_t* msg)
     if (ptr == NULL)
     {
         fprintf(out_fd, "Message content not valid.\n");
-        rval = 1;
-        goto cleanup;
+        goto error;
     }
     sprintf(rawmsg, "%s", ptr);
     sprintf(rawtag, "%.*s", (int)msg->properties.correlation_id.len,
@@ -238,15 +247,9 @@ int sendMessage(MYSQL* server, amqp_message_t* msg)
                 "query", msg->properties.message_id.len) == 0)
     {
 
-        sprintf(qstr, DB_INCREMENT, clndate, clnmsg);
-        rval = mysql_query(server, qstr);
-
-        if (mysql_affected_rows(server) == 0)
-        {
-            memset(qstr, 0, buffsz);
-            sprintf(qstr, DB_INSERT, clntag, clnmsg, clndate);
-            rval = mysql_query(server, qstr);
-        }
+        /** The insert only adds a row if the update found none */
+        int len = sprintf(qstr, DB_INCREMENT, clndate, clnmsg);
+        sprintf(qstr + len, DB_INSERT, clntag, clnmsg, clndate, clnmsg);
 
     }
     else if (strncmp(msg->properties.message_id.bytes,
@@ -254,23 +257,23 @@ int sendMessage(MYSQL* server, amqp_message_t* msg)
     {
 
         sprintf(qstr, DB_UPDATE, clnmsg, clndate, clntag);
-        rval = mysql_query(server, qstr);
 
     }
     else
     {
-        rval = 1;
-        goto cleanup;
+        goto error;
     }
 
+    free(rawmsg);
+    free(clnmsg);
+    free(rawdate);
+    free(clndate);
+    free(rawtag);
+    free(clntag);
 
-    if (rval)
-    {
-        fprintf(stderr, "Could not send query to SQL server:%s\n", mysql_error(server));
-        goto cleanup;
-    }
+    return qstr;
 
-cleanup:
+error:
     free(qstr);
     free(rawmsg);
     free(clnmsg);
@@ -279,9 +282,134 @@ cleanup:
     free(rawtag);
     free(clntag);
 
+    return NULL;
+}
+
+/**
+ * Execute one or more statements and read all of their results.
+ * @param server The database connection
+ * @param qstr The statements separated by semicolons
+ * @return 0 on success, non-zero if a statement failed
+ */
+int runStatements(MYSQL* server, const char* qstr)
+{
+    int rval = mysql_real_query(server, qstr, strlen(qstr));
+
+    while (rval == 0)
+    {
+        MYSQL_RES* res = mysql_store_result(server);
+
+        if (res)
+        {
+            mysql_free_result(res);
+        }
+
+        /** Returns -1 when there are no more results and a positive value on error */
+        int next = mysql_next_result(server);
+
+        if (next != 0)
+        {
+            rval = next > 0 ? next : 0;
+            break;
+        }
+    }
+
     return rval;
 }
 
+/**
+ * Store a batch of messages in one transaction and acknowledge them with one
+ * acknowledgement. Malformed messages are rejected. If the transaction fails,
+ * the messages are stored one at a time so that only the failing ones are
+ * rejected.
+ * @param server The database connection
+ * @param conn The RabbitMQ connection
+ * @param channel The RabbitMQ channel
+ * @param msgs The messages, destroyed by this function
+ * @param tags The delivery tags of the messages
+ * @param n The number of messages
+ */
+void sendBatch(MYSQL* server, amqp_connection_state_t conn, int channel,
+               amqp_message_t* msgs, uint64_t* tags, int n)
+{
+    static const char trx_start[] = "START TRANSACTION;";
+    static const char trx_end[] = "COMMIT;";
+    char* stmts[n];
+    size_t len = sizeof(trx_start) + sizeof(trx_end);
+    int last = -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((stmts[i] = formatMessage(server, &msgs[i])))
+        {
+            len += strlen(stmts[i]);
+            last = i;
+        }
+        else
+        {
+            fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Received malformed message.\n");
+            amqp_basic_reject(conn, channel, tags[i], 0);
+        }
+        amqp_destroy_message(&msgs[i]);
+    }
+
+    if (last == -1)
+    {
+        return;
+    }
+
+    char* qstr = malloc(len);
+
+    if (qstr)
+    {
+        strcpy(qstr, trx_start);
+
+        for (int i = 0; i < n; i++)
+        {
+            if (stmts[i])
+            {
+                strcat(qstr, stmts[i]);
+            }
+        }
+
+        strcat(qstr, trx_end);
+    }
+
+    if (qstr && runStatements(server, qstr) == 0)
+    {
+        /** Acknowledge all messages up to the last stored one */
+        amqp_basic_ack(conn, channel, tags[last], 1);
+    }
+    else
+    {
+        fprintf(stderr, "Could not send batch to SQL server:%s\n", mysql_error(server));
+        runStatements(server, "ROLLBACK");
+
+        for (int i = 0; i < n; i++)
+        {
+            if (stmts[i])
+            {
+                if (runStatements(server, stmts[i]))
+                {
+                    fprintf(stderr, "Could not send query to SQL server:%s\n", mysql_error(server));
+                    amqp_basic_reject(conn, channel, tags[i], 0);
+                }
+                else
+                {
+                    amqp_basic_ack(conn, channel, tags[i], 0);
+                }
+            }
+        }
+    }
+
+    free(qstr);
+
+    for (int i = 0; i < n; i++)
+    {
+        free(stmts[i]);
+    }
+}
+
 int sendToServer(MYSQL* server, amqp_message_t* a, amqp_message_t* b)
 {
 
@@ -398,9 +526,10 @@ int main(int argc, char** argv)
     amqp_socket_t *socket = NULL;
     amqp_connection_state_t conn;
     amqp_rpc_reply_t ret;
-    amqp_message_t *reply = NULL;
+    amqp_message_t *batch = NULL;
+    uint64_t *tags = NULL;
     amqp_frame_t frame;
-    struct timeval timeout;
+    struct timeval timeout, batch_timeout;
     MYSQL db_inst;
     char ch, *cnfname = NULL, *cnfpath = NULL;
     static const char* fname = "consumer.cnf";
@@ -455,6 +584,10 @@ int main(int argc, char** argv)
 
     timeout.tv_sec = 1;
     timeout.tv_usec = 0;
+    /** How long to wait for the next message of a batch */
+    batch_timeout.tv_sec = 0;
+    batch_timeout.tv_usec = 10000;
+    c_inst->batch_size = 100;
     all_ok = 1;
     out_fd = NULL;
 
@@ -489,6 +622,11 @@ int main(int argc, char** argv)
         goto fatal_error;
     }
 
+    if (c_inst->batch_size < 1)
+    {
+        c_inst->batch_size = 1;
+    }
+
     connectToServer(&db_inst);
 
     if ((conn = amqp_new_connection()) == NULL ||
@@ -521,12 +659,16 @@ int main(int argc, char** argv)
         goto error;
     }
 
-    reply = malloc(sizeof(amqp_message_t));
-    if (!reply)
+    batch = calloc(c_inst->batch_size, sizeof(amqp_message_t));
+    tags = calloc(c_inst->batch_size, sizeof(uint64_t));
+    if (!batch || !tags)
     {
         fprintf(stderr, "Error: Cannot allocate enough memory.\n");
         goto error;
     }
+
+    /** Let the broker send a full batch without waiting for acknowledgements */
+    amqp_basic_qos(conn, channel, 0, c_inst->batch_size, 0);
     amqp_basic_consume(conn, channel, amqp_cstring_bytes(c_inst->queue), amqp_empty_bytes, 0, 0, 0,
                        amqp_empty_table);
 
@@ -542,31 +684,37 @@ int main(int argc, char** argv)
             continue;
         }
 
-        if (frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD)
-        {
+        int n = 0;
 
+        /** Collect the messages that are already available into one batch */
+        while (status == AMQP_STATUS_OK &&
+               frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD)
+        {
             amqp_basic_deliver_t* decoded = (amqp_basic_deliver_t*)frame.payload.method.decoded;
+            tags[n] = decoded->delivery_tag;
+            amqp_read_message(conn, channel, &batch[n], 0);
 
-            amqp_read_message(conn, channel, reply, 0);
-
-            if (sendMessage(&db_inst, reply))
+            if (++n == c_inst->batch_size)
             {
-
-                fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Received malformed message.\n");
-                amqp_basic_reject(conn, channel, decoded->delivery_tag, 0);
-                amqp_destroy_message(reply);
-
+                break;
             }
-            else
-            {
 
-                amqp_basic_ack(conn, channel, decoded->delivery_tag, 0);
-                amqp_destroy_message(reply);
+            status = amqp_simple_wait_frame_noblock(conn, &frame, &batch_timeout);
+        }
 
-            }
+        if (n > 0)
+        {
+            sendBatch(&db_inst, conn, channel, batch, tags, n);
+        }
 
+        if (status != AMQP_STATUS_OK && status != AMQP_STATUS_TIMEOUT)
+        {
+            fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Failed to read frame from server: %s\n",
+                    amqp_error_string2(status));
+            all_ok = 0;
+            goto error;
         }
-        else
+        else if (status == AMQP_STATUS_OK && n < c_inst->batch_size)
         {
             fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Received method from server: %s\n",
                     amqp_method_name(frame.payload.method.id));
@@ -579,6 +727,8 @@ int main(int argc, char** argv)
     fprintf(out_fd, "Shutting down...\n");
 error:
 
+    free(batch);
+    free(tags);
     mysql_close(&db_inst);
     mysql_library_end();
     if (c_inst && c_inst->query_stack)
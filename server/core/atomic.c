@@ -31,3 +31,21 @@ uint64_t atomic_add_uint64(uint64_t *variable, int64_t value)
 {
     return __sync_fetch_and_add(variable, value);
 }
+
+bool atomic_cas_ptr(void **variable, void *old_value, void *new_value)
+{
+    return __sync_bool_compare_and_swap(variable, old_value, new_value);
+}
+
+void* atomic_exchange_ptr(void **variable, void *new_value)
+{
+    void *old_value;
+
+    do
+    {
+        old_value = *(void * volatile *)variable;
+    }
+    while (!__sync_bool_compare_and_swap(variable, old_value, new_value));
+
+    return old_value;
+}
@@ -13,13 +13,19 @@
 
 #include <maxscale/buffer.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
+#include <maxscale/dcb.h>
 #include <maxscale/debug.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/hint.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+
+#include "maxscale/buffer.h"
 
 #if defined(BUFFER_TRACE)
 #include <maxscale/hashtable.h>
@@ -29,8 +35,6 @@ static HASHTABLE *buffer_hashtable = NULL;
 #endif
 
 static void gwbuf_free_one(GWBUF *buf);
-static buffer_object_t* gwbuf_remove_buffer_object(GWBUF*           buf,
-                                                   buffer_object_t* bufobj);
 
 #if defined(BUFFER_TRACE)
 static void gwbuf_add_to_hashtable(GWBUF *buf);
@@ -39,60 +43,399 @@ static int bcmpfn (void *key1, void *key2);
 static void gwbuf_remove_from_hashtable(GWBUF *buf);
 #endif
 
+/** Alignment of the pooled buffer blocks */
+#define GWBUF_POOL_ALIGN 64
+
+/** Maximum number of bytes of data each thread caches per size class */
+#define GWBUF_POOL_CLASS_BYTES (256 * 1024)
+
+/** Minimum number of blocks each thread caches per size class */
+#define GWBUF_POOL_CLASS_MIN 16
+
+/** The data area sizes of the pooled size classes */
+static const unsigned int pool_class_sizes[] =
+{
+    64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384
+};
+
+#define GWBUF_POOL_N_SIZES (sizeof(pool_class_sizes) / sizeof(pool_class_sizes[0]))
+
 /**
- * Allocate a new gateway buffer structure of size bytes.
+ * The size class of blocks whose data area is allocated separately for
+ * each use. Used for buffers that are larger than the largest size class.
+ */
+#define GWBUF_POOL_HEADER_CLASS GWBUF_POOL_N_SIZES
+
+#define GWBUF_POOL_N_CLASSES (GWBUF_POOL_N_SIZES + 1)
+
+/**
+ * Buffers with a data area of at most this many bytes store the data inline
+ * in the buffer block. This makes the allocation of a small packet a single
+ * allocation and keeps the header and the payload on adjacent cache lines.
+ */
+#define GWBUF_INLINE_MAX 256
+
+/**
+ * A buffer block holds the GWBUF and the SHARED_BUF that are allocated by
+ * gwbuf_alloc. Buffers created by cloning only allocate a GWBUF and refer to
+ * the SHARED_BUF of the block. The block is released when the last reference
+ * to its SHARED_BUF is released, even if the embedded GWBUF was freed earlier.
+ *
+ * Blocks of the pooled size classes keep their data area when they are
+ * cached so that a reused block does not need to touch the heap at all.
+ * For size classes of at most GWBUF_INLINE_MAX bytes the data area follows
+ * the block in the same allocation.
+ */
+typedef struct gwbuf_block
+{
+    GWBUF               buf;        /*< The buffer header, must be the first member */
+    SHARED_BUF          sbuf;       /*< The shared data buffer */
+    struct gwbuf_block *next_free;  /*< Next cached block of the same size class */
+    int                 size_class; /*< Size class of the data area */
+    unsigned int        data_size;  /*< Size of the data area */
+    unsigned char       inline_data[]; /*< Data area of small size classes */
+} GWBUF_BLOCK;
+
+#define GWBUF_BLOCK_OF(s) ((GWBUF_BLOCK *)((char *)(s) - offsetof(GWBUF_BLOCK, sbuf)))
+
+/**
+ * The buffer pool of one polling thread. Only the owning thread modifies the
+ * pool so no locking is needed.
+ */
+typedef struct gwbuf_pool
+{
+    GWBUF_BLOCK *free[GWBUF_POOL_N_CLASSES];   /*< Cached blocks */
+    int          n_free[GWBUF_POOL_N_CLASSES]; /*< Number of cached blocks */
+    int          max_free[GWBUF_POOL_N_CLASSES]; /*< Maximum number of cached blocks */
+    int64_t      n_hits;      /*< Allocations served from the pool */
+    int64_t      n_misses;    /*< Allocations that used the heap */
+    int64_t      n_returned;  /*< Blocks returned to the pool */
+    int64_t      n_overflows; /*< Blocks freed because the pool was full */
+} GWBUF_POOL;
+
+static GWBUF_POOL *gwbuf_pools = NULL;
+static int gwbuf_n_pools = 0;
+static thread_local GWBUF_POOL *this_pool = NULL; /*< The pool of this thread */
+
+bool gwbuf_pool_init(int n_threads)
+{
+    ss_dassert(gwbuf_pools == NULL);
+    void *pools = NULL;
+
+    if (posix_memalign(&pools, GWBUF_POOL_ALIGN, n_threads * sizeof(GWBUF_POOL)) != 0)
+    {
+        MXS_OOM();
+        return false;
+    }
+
+    memset(pools, 0, n_threads * sizeof(GWBUF_POOL));
+    gwbuf_pools = (GWBUF_POOL *)pools;
+    gwbuf_n_pools = n_threads;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        for (int j = 0; j < GWBUF_POOL_N_SIZES; j++)
+        {
+            gwbuf_pools[i].max_free[j] = MXS_MAX(GWBUF_POOL_CLASS_MIN,
+                                                 GWBUF_POOL_CLASS_BYTES / pool_class_sizes[j]);
+        }
+
+        gwbuf_pools[i].max_free[GWBUF_POOL_HEADER_CLASS] = GWBUF_POOL_CLASS_BYTES /
+                                                           sizeof(GWBUF_BLOCK);
+    }
+
+    return true;
+}
+
+void gwbuf_pool_thread_init(int thread_id)
+{
+    if (gwbuf_pools && thread_id >= 0 && thread_id < gwbuf_n_pools)
+    {
+        this_pool = &gwbuf_pools[thread_id];
+    }
+}
+
+/**
+ * Free a block and its data area back to the heap
+ *
+ * @param block Block to free
+ */
+static void gwbuf_block_destroy(GWBUF_BLOCK *block)
+{
+    if (block->sbuf.data != block->inline_data)
+    {
+        MXS_FREE(block->sbuf.data);
+    }
+
+    MXS_FREE(block);
+}
+
+/**
+ * Check whether a size class stores its data inline
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more efficient mechanism.
+ * @param size_class Size class to check
  *
- * @param       size The size in bytes of the data area required
- * @return      Pointer to the buffer structure or NULL if memory could not
- *              be allocated.
+ * @return True if data of this size class is stored in the block itself
  */
-GWBUF *
-gwbuf_alloc(unsigned int size)
+static inline bool gwbuf_size_class_is_inline(int size_class)
 {
-    GWBUF      *rval;
-    SHARED_BUF *sbuf;
+    return size_class < GWBUF_POOL_N_SIZES && pool_class_sizes[size_class] <= GWBUF_INLINE_MAX;
+}
+
+void gwbuf_pool_thread_finish()
+{
+    GWBUF_POOL *pool = this_pool;
+
+    if (pool)
+    {
+        for (int i = 0; i < GWBUF_POOL_N_CLASSES; i++)
+        {
+            while (pool->free[i])
+            {
+                GWBUF_BLOCK *block = pool->free[i];
+                pool->free[i] = block->next_free;
+                gwbuf_block_destroy(block);
+            }
+
+            pool->n_free[i] = 0;
+        }
+
+        this_pool = NULL;
+    }
+}
+
+/**
+ * Find the size class for a data area
+ *
+ * @param size Size of the data area
+ *
+ * @return The smallest size class that can hold @c size bytes
+ */
+static inline int gwbuf_size_class(unsigned int size)
+{
+    int i = 0;
 
-    /* Allocate the buffer header */
-    if ((rval = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    while (i < GWBUF_POOL_N_SIZES && pool_class_sizes[i] < size)
     {
-        goto retblock;
+        i++;
     }
 
-    /* Allocate the shared data buffer */
-    if ((sbuf = (SHARED_BUF *)MXS_MALLOC(sizeof(SHARED_BUF))) == NULL)
+    return i;
+}
+
+/**
+ * Allocate a new block from the heap
+ *
+ * @param size_class Size class of the block
+ *
+ * @return New block or NULL if memory allocation failed
+ */
+static GWBUF_BLOCK* gwbuf_block_create(int size_class)
+{
+    bool is_inline = gwbuf_size_class_is_inline(size_class);
+    size_t block_size = sizeof(GWBUF_BLOCK) + (is_inline ? pool_class_sizes[size_class] : 0);
+    void *ptr = NULL;
+
+    if (posix_memalign(&ptr, GWBUF_POOL_ALIGN, block_size) != 0)
     {
-        MXS_FREE(rval);
-        rval = NULL;
-        goto retblock;
+        return NULL;
     }
 
-    /* Allocate the space for the actual data */
-    if ((sbuf->data = (unsigned char *)MXS_MALLOC(size)) == NULL)
+    GWBUF_BLOCK *block = (GWBUF_BLOCK *)ptr;
+    block->size_class = size_class;
+    block->next_free = NULL;
+    block->sbuf.data = is_inline ? block->inline_data : NULL;
+
+    if (!is_inline && size_class != GWBUF_POOL_HEADER_CLASS &&
+        (block->sbuf.data = (unsigned char *)MXS_MALLOC(pool_class_sizes[size_class])) == NULL)
     {
-        MXS_FREE(rval);
-        MXS_FREE(sbuf);
-        rval = NULL;
-        goto retblock;
+        MXS_FREE(block);
+        block = NULL;
+    }
+
+    return block;
+}
+
+/**
+ * Get a block with a data area of at least @c size bytes
+ *
+ * The block is taken from the pool of the calling thread if one is available.
+ *
+ * @param size Size of the data area
+ *
+ * @return A block or NULL if memory allocation failed
+ */
+static GWBUF_BLOCK* gwbuf_block_get(unsigned int size)
+{
+    int size_class = gwbuf_size_class(size);
+    GWBUF_POOL *pool = this_pool;
+    GWBUF_BLOCK *block;
+
+    if (pool && pool->free[size_class])
+    {
+        block = pool->free[size_class];
+        pool->free[size_class] = block->next_free;
+        pool->n_free[size_class]--;
+        pool->n_hits++;
+    }
+    else
+    {
+        if (pool)
+        {
+            pool->n_misses++;
+        }
+
+        block = gwbuf_block_create(size_class);
+    }
+
+    if (block && size_class == GWBUF_POOL_HEADER_CLASS &&
+        (block->sbuf.data = (unsigned char *)MXS_MALLOC(size)) == NULL)
+    {
+        MXS_FREE(block);
+        block = NULL;
+    }
+
+    if (block)
+    {
+        block->data_size = size_class == GWBUF_POOL_HEADER_CLASS ? size : pool_class_sizes[size_class];
+    }
+
+    return block;
+}
+
+/**
+ * Release a block whose SHARED_BUF is no longer referenced
+ *
+ * The block is cached by the calling thread if it has a pool with space
+ * left in it. Otherwise it is freed to the heap.
+ *
+ * @param block Block to release
+ */
+static void gwbuf_block_release(GWBUF_BLOCK *block)
+{
+    GWBUF_POOL *pool = this_pool;
+    int size_class = block->size_class;
+
+    if (block->size_class == GWBUF_POOL_HEADER_CLASS)
+    {
+        MXS_FREE(block->sbuf.data);
+        block->sbuf.data = NULL;
+    }
+
+    if (pool && pool->n_free[size_class] < pool->max_free[size_class])
+    {
+        block->next_free = pool->free[size_class];
+        pool->free[size_class] = block;
+        pool->n_free[size_class]++;
+        pool->n_returned++;
+    }
+    else
+    {
+        if (pool)
+        {
+            pool->n_overflows++;
+        }
+
+        gwbuf_block_destroy(block);
+    }
+}
+
+/**
+ * Print the statistics of all buffer pools
+ *
+ * @param dcb DCB to print to
+ */
+static void dprintBufferPools(DCB *dcb)
+{
+    dcb_printf(dcb, " ID | Hits         | Misses       | Returned     | Overflows    | Cached\n");
+    dcb_printf(dcb, "----+--------------+--------------+--------------+--------------+----------\n");
+
+    int64_t cached[GWBUF_POOL_N_CLASSES] = {0};
+
+    for (int i = 0; i < gwbuf_n_pools; i++)
+    {
+        GWBUF_POOL *pool = &gwbuf_pools[i];
+        int n_cached = 0;
+
+        for (int j = 0; j < GWBUF_POOL_N_CLASSES; j++)
+        {
+            n_cached += pool->n_free[j];
+            cached[j] += pool->n_free[j];
+        }
+
+        dcb_printf(dcb, " %2d | %-12" PRId64 " | %-12" PRId64 " | %-12" PRId64 " | %-12" PRId64 " | %d\n",
+                   i, pool->n_hits, pool->n_misses, pool->n_returned, pool->n_overflows, n_cached);
+    }
+
+    dcb_printf(dcb, "\nCached blocks per size class:\n");
+
+    for (int j = 0; j < GWBUF_POOL_N_SIZES; j++)
+    {
+        dcb_printf(dcb, "\t%-8u bytes\t%" PRId64 "\n", pool_class_sizes[j], cached[j]);
+    }
+
+    dcb_printf(dcb, "\t%-8s\t%" PRId64 "\n", "Large", cached[GWBUF_POOL_HEADER_CLASS]);
+}
+
+void dprintBufferStats(DCB *dcb)
+{
+    dcb_printf(dcb, "Buffer Pools.\n\n");
+
+    if (gwbuf_pools)
+    {
+        dprintBufferPools(dcb);
+    }
+    else
+    {
+        dcb_printf(dcb, "Buffer pools are not enabled.\n");
+    }
+
+#if defined(BUFFER_TRACE)
+    dcb_printf(dcb, "\n");
+    dprintAllBuffers(dcb);
+#endif
+}
+
+/**
+ * Allocate a new gateway buffer structure of size bytes.
+ *
+ * The buffer header and the shared buffer are allocated as one block. If the
+ * calling thread has a buffer pool, the block and its data area are taken
+ * from the pool.
+ *
+ * @param       size The size in bytes of the data area required
+ * @return      Pointer to the buffer structure or NULL if memory could not
+ *              be allocated.
+ */
+GWBUF *
+gwbuf_alloc(unsigned int size)
+{
+    GWBUF       *rval = NULL;
+    GWBUF_BLOCK *block = gwbuf_block_get(size);
+
+    if (block)
+    {
+        SHARED_BUF *sbuf = &block->sbuf;
+        sbuf->refcount = 1;
+        sbuf->info = GWBUF_INFO_NONE;
+        sbuf->n_bufobj = 0;
+        sbuf->bufobj_overflow = NULL;
+        spinlock_init(&sbuf->bufobj_lock);
+
+        rval = &block->buf;
+        spinlock_init(&rval->gwbuf_lock);
+        rval->start = sbuf->data;
+        rval->end = (void *)((char *)rval->start + size);
+        rval->sbuf = sbuf;
+        rval->next = NULL;
+        rval->tail = rval;
+        rval->hint = NULL;
+        rval->properties = NULL;
+        rval->server = NULL;
+        rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
+        CHK_GWBUF(rval);
     }
-    sbuf->refcount = 1;
-    sbuf->info = GWBUF_INFO_NONE;
-    sbuf->bufobj = NULL;
 
-    spinlock_init(&rval->gwbuf_lock);
-    rval->start = sbuf->data;
-    rval->end = (void *)((char *)rval->start + size);
-    rval->sbuf = sbuf;
-    rval->next = NULL;
-    rval->tail = rval;
-    rval->hint = NULL;
-    rval->properties = NULL;
-    rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
-    CHK_GWBUF(rval);
-retblock:
     if (rval == NULL)
     {
         char errbuf[MXS_STRERROR_BUFLEN];
@@ -232,8 +575,6 @@ void
 gwbuf_free(GWBUF *buf)
 {
     GWBUF *nextbuf;
-    BUF_PROPERTY    *prop;
-    buffer_object_t *bo;
 
     while (buf)
     {
@@ -253,20 +594,8 @@ static void
 gwbuf_free_one(GWBUF *buf)
 {
     BUF_PROPERTY    *prop;
-    buffer_object_t *bo;
-
-    if (atomic_add(&buf->sbuf->refcount, -1) == 1)
-    {
-        bo = buf->sbuf->bufobj;
-
-        while (bo != NULL)
-        {
-            bo = gwbuf_remove_buffer_object(buf, bo);
-        }
-
-        MXS_FREE(buf->sbuf->data);
-        MXS_FREE(buf->sbuf);
-    }
+    GWBUF_BLOCK     *block = GWBUF_BLOCK_OF(buf->sbuf);
+    bool             embedded = (buf == &block->buf);
 
     while (buf->properties)
     {
@@ -286,7 +615,32 @@ gwbuf_free_one(GWBUF *buf)
 #if defined(BUFFER_TRACE)
     gwbuf_remove_from_hashtable(buf);
 #endif
-    MXS_FREE(buf);
+
+    if (atomic_add(&block->sbuf.refcount, -1) == 1)
+    {
+        for (int i = 0; i < block->sbuf.n_bufobj; i++)
+        {
+            buffer_object_t *bo = &block->sbuf.bufobj[i];
+            /** Call corresponding clean-up function to clean buffer object's data */
+            bo->bo_donefun_fp(bo->bo_data);
+        }
+
+        while (block->sbuf.bufobj_overflow)
+        {
+            buffer_object_t *bo = block->sbuf.bufobj_overflow;
+            block->sbuf.bufobj_overflow = bo->bo_next;
+            bo->bo_donefun_fp(bo->bo_data);
+            MXS_FREE(bo);
+        }
+
+        /** This also releases the embedded buffer header */
+        gwbuf_block_release(block);
+    }
+
+    if (!embedded)
+    {
+        MXS_FREE(buf);
+    }
 }
 
 /**
@@ -654,71 +1008,88 @@ void gwbuf_set_type(GWBUF* buf, gwbuf_type_t type)
     }
 }
 
-void gwbuf_add_buffer_object(GWBUF* buf,
+bool gwbuf_add_buffer_object(GWBUF* buf,
                              bufobj_id_t id,
                              void*  data,
                              void (*donefun_fp)(void *))
 {
-    buffer_object_t** p_b;
-    buffer_object_t*  newb;
+    SHARED_BUF *sbuf = buf->sbuf;
+    bool added = false;
 
     CHK_GWBUF(buf);
-    newb = (buffer_object_t *)MXS_MALLOC(sizeof(buffer_object_t));
-    MXS_ABORT_IF_NULL(newb);
-
-    newb->bo_id = id;
-    newb->bo_data = data;
-    newb->bo_donefun_fp = donefun_fp;
-    newb->bo_next = NULL;
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
-    p_b = &buf->sbuf->bufobj;
-    /** Search the end of the list and add there */
-    while (*p_b != NULL)
+    spinlock_acquire(&sbuf->bufobj_lock);
+
+    int n = sbuf->n_bufobj;
+
+    if (n < GWBUF_MAX_OBJECTS)
     {
-        p_b = &(*p_b)->bo_next;
+        buffer_object_t *bo = &sbuf->bufobj[n];
+        bo->bo_id = id;
+        bo->bo_start = buf->start;
+        bo->bo_data = data;
+        bo->bo_donefun_fp = donefun_fp;
+        bo->bo_next = NULL;
+        sbuf->info |= GWBUF_INFO_PARSED;
+        /** Publish the slot only after it has been filled */
+        atomic_store_int(&sbuf->n_bufobj, n + 1);
+        added = true;
     }
-    *p_b = newb;
-    /** Set flag */
-    buf->sbuf->info |= GWBUF_INFO_PARSED;
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
+    else
+    {
+        buffer_object_t *bo = (buffer_object_t*)MXS_MALLOC(sizeof(buffer_object_t));
+
+        if (bo)
+        {
+            bo->bo_id = id;
+            bo->bo_start = buf->start;
+            bo->bo_data = data;
+            bo->bo_donefun_fp = donefun_fp;
+            bo->bo_next = sbuf->bufobj_overflow;
+            sbuf->info |= GWBUF_INFO_PARSED;
+            /** Publish the object only after it has been filled */
+            atomic_store_ptr((void**)&sbuf->bufobj_overflow, bo);
+            added = true;
+        }
+    }
+
+    spinlock_release(&sbuf->bufobj_lock);
+
+    return added;
 }
 
 void* gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id)
 {
-    buffer_object_t* bo;
+    SHARED_BUF *sbuf = buf->sbuf;
 
     CHK_GWBUF(buf);
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
-    bo = buf->sbuf->bufobj;
+    int n = atomic_load_int(&sbuf->n_bufobj);
 
-    while (bo != NULL && bo->bo_id != id)
+    for (int i = 0; i < n; i++)
     {
-        bo = bo->bo_next;
+        buffer_object_t *bo = &sbuf->bufobj[i];
+
+        if (bo->bo_id == id && bo->bo_start == buf->start)
+        {
+            return bo->bo_data;
+        }
     }
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
-    if (bo)
+
+    if (n == GWBUF_MAX_OBJECTS)
     {
-        return bo->bo_data;
-    }
-    return NULL;
-}
+        buffer_object_t *bo = (buffer_object_t*)atomic_load_ptr((void* const*)&sbuf->bufobj_overflow);
 
-/**
- * @return pointer to next buffer object or NULL
- */
-static buffer_object_t* gwbuf_remove_buffer_object(GWBUF* buf, buffer_object_t* bufobj)
-{
-    buffer_object_t* next;
+        while (bo)
+        {
+            if (bo->bo_id == id && bo->bo_start == buf->start)
+            {
+                return bo->bo_data;
+            }
+
+            bo = bo->bo_next;
+        }
+    }
 
-    next = bufobj->bo_next;
-    /** Call corresponding clean-up function to clean buffer object's data */
-    bufobj->bo_donefun_fp(bufobj->bo_data);
-    MXS_FREE(bufobj);
-    return next;
+    return NULL;
 }
 
 bool
@@ -798,6 +1169,50 @@ gwbuf_make_contiguous(GWBUF *orig)
     return newbuf;
 }
 
+GWBUF *
+gwbuf_shrink(GWBUF *head, size_t *released)
+{
+    size_t capacity = 0;
+    unsigned int length = 0;
+
+    *released = 0;
+
+    for (GWBUF *buf = head; buf; buf = buf->next)
+    {
+        /** Shared data is not freed by copying it */
+        if (buf->sbuf->refcount > 1 || buf->sbuf->n_bufobj || buf->hint || buf->properties)
+        {
+            return head;
+        }
+
+        capacity += GWBUF_BLOCK_OF(buf->sbuf)->data_size + sizeof(GWBUF_BLOCK);
+        length += GWBUF_LENGTH(buf);
+    }
+
+    int size_class = gwbuf_size_class(length);
+    size_t new_capacity = (size_class == GWBUF_POOL_HEADER_CLASS ? length : pool_class_sizes[size_class]) +
+                          sizeof(GWBUF_BLOCK);
+
+    if (head == NULL || new_capacity >= capacity)
+    {
+        return head;
+    }
+
+    GWBUF *newbuf = gwbuf_alloc(length);
+
+    if (newbuf)
+    {
+        gwbuf_copy_data(head, 0, length, GWBUF_DATA(newbuf));
+        newbuf->gwbuf_type = head->gwbuf_type;
+        newbuf->server = head->server;
+        gwbuf_free(head);
+        *released = capacity - new_capacity;
+        head = newbuf;
+    }
+
+    return head;
+}
+
 void
 gwbuf_add_hint(GWBUF *buf, HINT *hint)
 {
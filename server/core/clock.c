@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file clock.c - Clocks of the polling threads
+ */
+
+#include "maxscale/clock.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <maxscale/platform.h>
+
+typedef struct thread_clock
+{
+    bool     coarse;  /*< True if the thread updates the clocks every cycle */
+    time_t   time;    /*< Wall clock time in seconds */
+    uint64_t mono_ns; /*< CLOCK_MONOTONIC time in nanoseconds */
+} THREAD_CLOCK;
+
+static thread_local THREAD_CLOCK this_clock;
+
+uint64_t mxs_clock_precise_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void mxs_clock_update()
+{
+    this_clock.mono_ns = mxs_clock_precise_ns();
+    this_clock.time = time(NULL);
+    this_clock.coarse = true;
+}
+
+time_t mxs_clock_time()
+{
+    return this_clock.coarse ? this_clock.time : time(NULL);
+}
+
+uint64_t mxs_clock_ns()
+{
+    return this_clock.coarse ? this_clock.mono_ns : mxs_clock_precise_ns();
+}
+
+uint64_t mxs_clock_ms()
+{
+    return mxs_clock_ns() / 1000000;
+}
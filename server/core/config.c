@@ -126,6 +126,8 @@ static const char *service_params[] =
     "max_connections",
     "max_queued_connections",
     "queued_connection_timeout",
+    "connection_rate",
+    "connection_burst",
     "connection_timeout",
     "auth_all_servers",
     "strip_db_esc",
@@ -155,6 +157,15 @@ static const char *listener_params[] =
     "ssl_version",
     "ssl_cert_verify_depth",
     "ssl_verify_peer_certificate",
+    "reuseport",
+    "send_buffer_size",
+    "receive_buffer_size",
+    "tcp_nodelay",
+    "tcp_quickack",
+    "tcp_defer_accept",
+    "tcp_fastopen",
+    "tcp_keepalive",
+    "socket_priority",
     NULL
 };
 
@@ -188,6 +199,7 @@ static const char *server_params[] =
     "protocol",
     "port",
     "address",
+    "socket",
     "authenticator",
     "authenticator_options",
     "monitoruser",
@@ -201,6 +213,13 @@ static const char *server_params[] =
     "ssl_version",
     "ssl_cert_verify_depth",
     "ssl_verify_peer_certificate",
+    "send_buffer_size",
+    "receive_buffer_size",
+    "tcp_nodelay",
+    "tcp_quickack",
+    "tcp_fastopen",
+    "tcp_keepalive",
+    "socket_priority",
     NULL
 };
 
@@ -679,6 +698,36 @@ config_load_and_process(const char* filename, bool (*process_config)(CONFIG_CONT
                 is_persisted_config = false;
             }
 
+            if (rval && gateway.writeq_high_water &&
+                gateway.writeq_low_water >= gateway.writeq_high_water)
+            {
+                MXS_ERROR("The value of 'writeq_low_water' (%d) must be lower than "
+                          "the value of 'writeq_high_water' (%d).",
+                          gateway.writeq_low_water, gateway.writeq_high_water);
+                rval = false;
+            }
+
+            if (rval && gateway.writeq_high_water &&
+                gateway.writeq_spill_threshold >= gateway.writeq_high_water)
+            {
+                MXS_ERROR("The value of 'writeq_spill_threshold' (%d) must be lower than "
+                          "the value of 'writeq_high_water' (%d).",
+                          gateway.writeq_spill_threshold, gateway.writeq_high_water);
+                rval = false;
+            }
+
+            if (rval)
+            {
+                /** The extra threads are started but handle no sessions until
+                 * they are activated at runtime */
+                gateway.n_active_threads = gateway.n_threads;
+
+                if (gateway.max_threads > gateway.n_threads)
+                {
+                    gateway.n_threads = gateway.max_threads;
+                }
+            }
+
             if (rval)
             {
                 if (!check_config_objects(ccontext.next) || !process_config(ccontext.next))
@@ -1121,9 +1170,12 @@ void config_context_free(CONFIG_CONTEXT *context)
 }
 
 /**
- * Return the number of configured threads
+ * Return the number of polling threads
  *
- * @return The number of threads configured in the config file
+ * This includes the threads started for max_threads that are not active,
+ * so it is also the size of all per-thread data.
+ *
+ * @return The number of polling threads
  */
 int
 config_threadcount()
@@ -1232,6 +1284,20 @@ handle_global_item(const char *name, const char *value)
             gateway.n_threads = MXS_MAX_THREADS;
         }
     }
+    else if (strcmp(name, "max_threads") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0 && intval <= MXS_MAX_THREADS)
+        {
+            gateway.max_threads = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'max_threads': %s", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "non_blocking_polls") == 0)
     {
         gateway.n_nbpoll = atoi(value);
@@ -1248,6 +1314,154 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.skip_permission_checks = config_truth_value((char*)value);
     }
+    else if (strcmp(name, "adaptive_reads") == 0)
+    {
+        gateway.adaptive_reads = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "adaptive_polls") == 0)
+    {
+        gateway.adaptive_polls = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "trace_records") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.trace_records = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'trace_records': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "thread_affinity") == 0)
+    {
+        if (strcmp(value, "none") == 0)
+        {
+            gateway.n_thread_cpus = 0;
+        }
+        else if (strcmp(value, "auto") == 0)
+        {
+            gateway.n_thread_cpus = mxs_numa_cpu_list(gateway.thread_cpus, MXS_MAX_THREADS);
+        }
+        else if ((gateway.n_thread_cpus = mxs_parse_cpu_list(value, gateway.thread_cpus,
+                                                             MXS_MAX_THREADS)) <= 0)
+        {
+            gateway.n_thread_cpus = 0;
+            MXS_ERROR("Invalid value for 'thread_affinity': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "incoming_cpu_steering") == 0)
+    {
+        gateway.incoming_cpu_steering = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "thread_rebalance") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0 && intval <= 100)
+        {
+            gateway.thread_rebalance = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'thread_rebalance': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "write_coalescing") == 0)
+    {
+        gateway.write_coalescing = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "idle_memory_timeout") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0 && intval <= INT_MAX / 10)
+        {
+            gateway.idle_memory_timeout = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "session_arena") == 0)
+    {
+        gateway.session_arena = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "writeq_high_water") == 0 || strcmp(name, "writeq_low_water") == 0 ||
+             strcmp(name, "writeq_spill_threshold") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0 && intval <= INT_MAX)
+        {
+            if (strcmp(name, "writeq_high_water") == 0)
+            {
+                gateway.writeq_high_water = intval;
+            }
+            else if (strcmp(name, "writeq_low_water") == 0)
+            {
+                gateway.writeq_low_water = intval;
+            }
+            else
+            {
+                gateway.writeq_spill_threshold = intval;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "read_budget") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.read_budget = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'read_budget': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "stall_threshold") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.stall_threshold = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'stall_threshold': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "busy_poll") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.busy_poll = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'busy_poll': %s", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "auth_connect_timeout") == 0)
     {
         char* endptr;
@@ -1303,10 +1517,67 @@ handle_global_item(const char *name, const char *value)
             return 0;
         }
     }
+    else if (strcmp(name, "writeq_spill_directory") == 0)
+    {
+        MXS_FREE(gateway.writeq_spill_directory);
+        gateway.writeq_spill_directory = *value ? MXS_STRDUP_A(value) : NULL;
+    }
+    else if (strcmp(name, "statistics_segment") == 0)
+    {
+        MXS_FREE(gateway.statistics_segment);
+        gateway.statistics_segment = *value ? MXS_STRDUP_A(value) : NULL;
+    }
+    else if (strcmp(name, "statistics_segment_interval") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval > 0)
+        {
+            gateway.statistics_segment_interval = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'statistics_segment_interval': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "handoff_socket") == 0)
+    {
+        MXS_FREE(gateway.handoff_socket);
+        gateway.handoff_socket = *value ? MXS_STRDUP_A(value) : NULL;
+    }
+    else if (strcmp(name, "handoff_drain_timeout") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.handoff_drain_timeout = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'handoff_drain_timeout': %s", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "query_classifier_args") == 0)
     {
         gateway.qc_args = MXS_STRDUP_A(value);
     }
+    else if (strcmp(name, "query_classifier_cache_size") == 0)
+    {
+        char* endptr;
+        long long intval = strtoll(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.qc_cache_size = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'query_classifier_cache_size': %s", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "query_retries") == 0)
     {
         char* endptr;
@@ -1432,6 +1703,10 @@ free_ssl_structure(SSL_LISTENER *ssl)
     if (ssl)
     {
         SSL_CTX_free(ssl->ctx);
+        if (ssl->session)
+        {
+            SSL_SESSION_free(ssl->session);
+        }
         MXS_FREE(ssl->ssl_key);
         MXS_FREE(ssl->ssl_cert);
         MXS_FREE(ssl->ssl_ca_cert);
@@ -1473,6 +1748,7 @@ SSL_LISTENER* make_ssl_structure (CONFIG_CONTEXT *obj, bool require_cert, int *e
             new_ssl->ssl_init_done = false;
             new_ssl->ssl_cert_verify_depth = 9; // Default of 9 as per Linux man page
             new_ssl->ssl_verify_peer_certificate = true;
+            spinlock_init(&new_ssl->session_lock);
 
             if (ssl_version)
             {
@@ -1626,12 +1902,35 @@ global_defaults()
     struct utsname uname_data;
     gateway.config_check = false;
     gateway.n_threads = DEFAULT_NTHREADS;
+    gateway.max_threads = 0;
+    gateway.n_active_threads = DEFAULT_NTHREADS;
     gateway.n_nbpoll = DEFAULT_NBPOLLS;
     gateway.pollsleep = DEFAULT_POLLSLEEP;
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
     gateway.auth_read_timeout = DEFAULT_AUTH_READ_TIMEOUT;
     gateway.auth_write_timeout = DEFAULT_AUTH_WRITE_TIMEOUT;
     gateway.skip_permission_checks = false;
+    gateway.adaptive_reads = false;
+    gateway.adaptive_polls = false;
+    gateway.busy_poll = 0;
+    gateway.trace_records = 0;
+    gateway.stall_threshold = 0;
+    gateway.read_budget = 0;
+    gateway.write_coalescing = false;
+    gateway.writeq_high_water = 0;
+    gateway.writeq_low_water = DEFAULT_WRITEQ_LOW_WATER;
+    gateway.writeq_spill_threshold = 0;
+    gateway.writeq_spill_directory = NULL;
+    gateway.session_arena = false;
+    gateway.idle_memory_timeout = 0;
+    gateway.n_thread_cpus = 0;
+    gateway.incoming_cpu_steering = false;
+    gateway.thread_rebalance = 0;
+    gateway.statistics_segment = NULL;
+    gateway.statistics_segment_interval = DEFAULT_STATISTICS_SEGMENT_INTERVAL;
+    gateway.handoff_socket = NULL;
+    gateway.handoff_drain_timeout = 0;
+    gateway.qc_cache_size = 0;
     gateway.query_retries = DEFAULT_QUERY_RETRIES;
     gateway.query_retry_timeout = DEFAULT_QUERY_RETRY_TIMEOUT;
 
@@ -1794,6 +2093,17 @@ process_config_update(CONFIG_CONTEXT *context)
                                                        atoi(queued_connection_timeout));
                         }
 
+                        char *connection_rate = config_get_value(obj->parameters, "connection_rate");
+                        if (connection_rate)
+                        {
+                            char *connection_burst = config_get_value(obj->parameters, "connection_burst");
+                            serviceSetConnectionRate(service,
+                                                     atoi(connection_rate),
+                                                     connection_burst ? atoi(connection_burst) : 0,
+                                                     atoi(max_queued_connections),
+                                                     atoi(queued_connection_timeout));
+                        }
+
                         if (auth_all_servers)
                         {
                             serviceAuthAllServers(service, config_truth_value(auth_all_servers));
@@ -2615,6 +2925,15 @@ int create_new_service(CONFIG_CONTEXT *obj)
                                    atoi(max_queued_connections), atoi(queued_connection_timeout));
     }
 
+    char *connection_rate = config_get_value(obj->parameters, "connection_rate");
+    if (connection_rate)
+    {
+        char *connection_burst = config_get_value(obj->parameters, "connection_burst");
+        serviceSetConnectionRate(obj->element, atoi(connection_rate),
+                                 connection_burst ? atoi(connection_burst) : 0,
+                                 atoi(max_queued_connections), atoi(queued_connection_timeout));
+    }
+
     char *auth_all_servers = config_get_value(obj->parameters, "auth_all_servers");
     if (auth_all_servers)
     {
@@ -2731,6 +3050,82 @@ bool is_normal_server_parameter(const char *param)
     return false;
 }
 
+/**
+ * Read a non-negative integer socket option of a listener or a server
+ *
+ * @param obj         Configuration context
+ * @param name        Name of the parameter
+ * @param dest        Where the value is stored, unchanged if it is not set
+ * @param error_count Incremented if the value is invalid
+ */
+static void get_socket_opt_int(CONFIG_CONTEXT *obj, const char *name, int *dest, int *error_count)
+{
+    const char *value = config_get_value_string(obj->parameters, name);
+
+    if (*value)
+    {
+        char *endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr == '\0' && intval >= 0 && intval <= INT_MAX)
+        {
+            *dest = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for '%s' in '%s': %s", name, obj->object, value);
+            (*error_count)++;
+        }
+    }
+}
+
+/**
+ * Read a boolean socket option of a listener or a server
+ *
+ * @param obj         Configuration context
+ * @param name        Name of the parameter
+ * @param dest        Where the value is stored, unchanged if it is not set
+ * @param error_count Incremented if the value is invalid
+ */
+static void get_socket_opt_bool(CONFIG_CONTEXT *obj, const char *name, int *dest, int *error_count)
+{
+    const char *value = config_get_value_string(obj->parameters, name);
+
+    if (*value)
+    {
+        int truth = config_truth_value(value);
+
+        if (truth != -1)
+        {
+            *dest = truth;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for '%s' in '%s': %s", name, obj->object, value);
+            (*error_count)++;
+        }
+    }
+}
+
+/**
+ * Read the socket options of a listener or a server
+ *
+ * @param obj         Configuration context
+ * @param opts        Where the options are stored
+ * @param error_count Incremented for each invalid value
+ */
+static void make_socket_opts(CONFIG_CONTEXT *obj, MXS_SOCKET_OPTS *opts, int *error_count)
+{
+    get_socket_opt_int(obj, "send_buffer_size", &opts->sndbuf, error_count);
+    get_socket_opt_int(obj, "receive_buffer_size", &opts->rcvbuf, error_count);
+    get_socket_opt_bool(obj, "tcp_nodelay", &opts->nodelay, error_count);
+    get_socket_opt_bool(obj, "tcp_quickack", &opts->quickack, error_count);
+    get_socket_opt_int(obj, "tcp_defer_accept", &opts->defer_accept, error_count);
+    get_socket_opt_int(obj, "tcp_fastopen", &opts->fastopen, error_count);
+    get_socket_opt_int(obj, "tcp_keepalive", &opts->keepalive, error_count);
+    get_socket_opt_int(obj, "socket_priority", &opts->priority, error_count);
+}
+
 /**
  * Create a new server
  * @param obj Server configuration context
@@ -2746,6 +3141,14 @@ int create_new_server(CONFIG_CONTEXT *obj)
     char *monpw = config_get_value(obj->parameters, "monitorpw");
     char *auth = config_get_value(obj->parameters, "authenticator");
     char *auth_opts = config_get_value(obj->parameters, "authenticator_options");
+    char *socket = config_get_value(obj->parameters, "socket");
+
+    if (socket)
+    {
+        /** The address and the port only identify a server that is connected through a socket */
+        address = address ? address : "localhost";
+        port = port ? port : "0";
+    }
 
     if (address && port && protocol)
     {
@@ -2754,12 +3157,17 @@ int create_new_server(CONFIG_CONTEXT *obj)
             MXS_ERROR("Failed to create a new server, memory allocation failed.");
             error_count++;
         }
+        else if (socket && !server_set_socket(obj->element, socket))
+        {
+            error_count++;
+        }
     }
     else
     {
         obj->element = NULL;
         MXS_ERROR("Server '%s' is missing a required configuration parameter. A "
-                  "server must have address, port and protocol defined.", obj->object);
+                  "server must have protocol and either socket or address and "
+                  "port defined.", obj->object);
         error_count++;
     }
 
@@ -2811,6 +3219,8 @@ int create_new_server(CONFIG_CONTEXT *obj)
             }
         }
 
+        make_socket_opts(obj, &server->sockopts, &error_count);
+
         MXS_CONFIG_PARAMETER *params = obj->parameters;
 
         server->server_ssl = make_ssl_structure(obj, false, &error_count);
@@ -3121,8 +3531,13 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, socket, 0,
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol,
+                                                                    socket, 0, authenticator,
+                                                                    authenticator_options, ssl_info);
+                    if (listener)
+                    {
+                        make_socket_opts(obj, &listener->sockopts, &error_count);
+                    }
                 }
             }
 
@@ -3138,8 +3553,20 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, address, atoi(port),
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol,
+                                                                    address, atoi(port), authenticator,
+                                                                    authenticator_options, ssl_info);
+                    char *reuseport = config_get_value(obj->parameters, "reuseport");
+
+                    if (listener && reuseport)
+                    {
+                        listener->reuseport = config_truth_value(reuseport);
+                    }
+
+                    if (listener)
+                    {
+                        make_socket_opts(obj, &listener->sockopts, &error_count);
+                    }
                 }
             }
 
@@ -21,6 +21,7 @@
 #include "maxscale/config.h"
 #include "maxscale/monitor.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/service.h"
 
 static SPINLOCK crt_lock = SPINLOCK_INIT;
@@ -490,6 +491,29 @@ bool runtime_alter_monitor(MXS_MONITOR *monitor, char *key, char *value)
     return valid;
 }
 
+bool runtime_alter_maxscale(char *key, char *value)
+{
+    spinlock_acquire(&crt_lock);
+    bool valid = false;
+
+    if (strcmp(key, "threads") == 0)
+    {
+        long ival = get_positive_int(value);
+        if (ival && poll_set_active_threads(ival))
+        {
+            valid = true;
+        }
+    }
+
+    if (valid)
+    {
+        MXS_NOTICE("Updated MaxScale: %s=%s", key, value);
+    }
+
+    spinlock_release(&crt_lock);
+    return valid;
+}
+
 bool runtime_create_listener(SERVICE *service, const char *name, const char *addr,
                              const char *port, const char *proto, const char *auth,
                              const char *auth_opt, const char *ssl_key,
@@ -66,12 +66,15 @@
 #include <maxscale/dcb.h>
 
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <maxscale/spinlock.h>
 #include <maxscale/server.h>
@@ -86,31 +89,94 @@
 #include <maxscale/hk_heartbeat.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <maxscale/alloc.h>
 #include <maxscale/utils.h>
 #include <maxscale/platform.h>
+#include <maxscale/paths.h>
 
 #include "maxscale/session.h"
+#include "maxscale/handoff.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/queuemanager.h"
+#include "maxscale/service.h"
 
 /* A DCB with null values, used for initialization */
 static DCB dcb_initialized = DCB_INIT;
 
 static  DCB           **all_dcbs;
+static  int            n_cold_dcbs; /*< Number of DCBs with a DCB_COLD */
 static  SPINLOCK       *all_dcbs_lock;
 static  DCB           **zombies;
 static  int            *nzombies;
 static  int             maxzombies = 0;
 static  SPINLOCK        zombiespin = SPINLOCK_INIT;
 
-/** Variables for session timeout checks */
+/** Whether any service has an idle timeout */
 bool check_timeouts = false;
-thread_local long next_timeout_check = 0;
+
+/** The smallest and the initial size of a read when adaptive reads are used */
+#define DCB_READ_SIZE_MIN     1024
+#define DCB_READ_SIZE_INITIAL 4096
+
+/**
+ * Reads that fill less than 1/DCB_READ_SHRINK_RATIO of the read buffer shrink
+ * the size of the next read. The data of such reads is also copied into a
+ * buffer of the correct size so that the large buffer can be reused right away.
+ */
+#define DCB_READ_SHRINK_RATIO 4
+
+/** The smallest amount of spilled data moved back to the write queue at a time */
+#define DCB_SPILL_READ_SIZE (64 * 1024)
+
+#define DCB_N_ROLES (DCB_ROLE_INTERNAL + 1)
+
+/** Read statistics of one thread */
+typedef struct
+{
+    int64_t n_reads[DCB_N_ROLES];  /*< Number of reads that returned data */
+    int64_t n_bytes[DCB_N_ROLES];  /*< Number of bytes read */
+    int64_t n_grows[DCB_N_ROLES];  /*< Number of times the read size was increased */
+    int64_t n_shrinks[DCB_N_ROLES]; /*< Number of times the read size was decreased */
+} DCB_READ_STATS;
+
+static DCB_READ_STATS *read_stats = NULL;
+static int n_read_stats = 0;
+
+/** Memory of the idle connections of one thread, see dcb_idle_memory_thread_init() */
+typedef struct
+{
+    int64_t n_shrinks;  /*< Number of read queues copied into smaller buffers */
+    int64_t n_released; /*< Bytes released by shrinking the read queues */
+    int     n_idle;     /*< Idle connections found by the latest check */
+    int64_t idle_bytes; /*< Bytes buffered by the idle connections at the latest check */
+} DCB_IDLE_STATS;
+
+static DCB_IDLE_STATS *idle_stats = NULL;
+
+/** The timer that checks the connections of a polling thread for idle ones */
+static thread_local MXS_TIMER idle_memory_timer;
+
+/** Maximum number of freed DCBs a polling thread keeps for reuse */
+#define DCB_CACHE_MAX 1024
+
+/**
+ * Freed DCBs of a polling thread. The DCBs are linked through memdata.next
+ * and are only accessed by the owning thread.
+ */
+typedef struct
+{
+    DCB *head;  /*< The most recently freed DCB */
+    int  count; /*< Number of DCBs in the cache */
+} DCB_CACHE;
+
+static thread_local DCB_CACHE dcb_cache;
 
 void dcb_global_init()
 {
@@ -119,6 +185,8 @@ void dcb_global_init()
     if ((zombies = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
         (all_dcbs = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
         (all_dcbs_lock = MXS_CALLOC(nthreads, sizeof(SPINLOCK))) == NULL ||
+        (read_stats = MXS_CALLOC(nthreads, sizeof(DCB_READ_STATS))) == NULL ||
+        (idle_stats = MXS_CALLOC(nthreads, sizeof(DCB_IDLE_STATS))) == NULL ||
         (nzombies = MXS_CALLOC(nthreads, sizeof(int))) == NULL)
     {
         MXS_OOM();
@@ -129,6 +197,8 @@ void dcb_global_init()
     {
         spinlock_init(&all_dcbs_lock[i]);
     }
+
+    n_read_stats = nthreads;
 }
 
 static void dcb_initialize(void *dcb);
@@ -141,7 +211,9 @@ static inline void dcb_process_victim_queue(int threadid);
 static void dcb_stop_polling_and_shutdown (DCB *dcb);
 static bool dcb_maybe_add_persistent(DCB *);
 static inline bool dcb_write_parameter_check(DCB *dcb, GWBUF *queue);
+static inline bool dcb_write_deferred(DCB *dcb);
 static int dcb_bytes_readable(DCB *dcb);
+static int dcb_read_adaptive(DCB *dcb, GWBUF **head, int maxbytes, int nreadtotal);
 static int dcb_read_no_bytes_available(DCB *dcb, int nreadtotal);
 static int dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl);
 static int dcb_read_SSL(DCB *dcb, GWBUF **head);
@@ -153,13 +225,19 @@ static int gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret);
 static int dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn);
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port);
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport);
+static bool dcb_listen_create_shards(DCB *listener, const char *config, const char *host,
+                                     uint16_t port, const char *protocol_name);
+static void dcb_listen_steer_shards(DCB *listener);
 static int dcb_listen_create_socket_unix(const char *path);
 static int dcb_set_socket_option(int sockfd, int level, int optname, void *optval, socklen_t optlen);
 static void dcb_add_to_all_list(DCB *dcb);
-static DCB *dcb_find_free();
 static GWBUF *dcb_grab_writeq(DCB *dcb, bool first_time);
 static void dcb_remove_from_list(DCB *dcb);
+static void dcb_pause_if_throttled(DCB *dcb);
+static int dcb_spill(DCB *dcb, GWBUF *queue, int len);
+static void dcb_spill_read(DCB *dcb);
+static DCB_COLD *dcb_get_cold(DCB *dcb);
 
 size_t dcb_get_session_id(
     DCB *dcb)
@@ -204,9 +282,14 @@ dcb_initialize(void *dcb)
 DCB *
 dcb_alloc(dcb_role_t role, SERV_LISTENER *listener)
 {
-    DCB *newdcb;
+    DCB *newdcb = dcb_cache.head;
 
-    if ((newdcb = (DCB *)MXS_MALLOC(sizeof(*newdcb))) == NULL)
+    if (newdcb)
+    {
+        dcb_cache.head = newdcb->memdata.next;
+        dcb_cache.count--;
+    }
+    else if ((newdcb = (DCB *)MXS_MALLOC(sizeof(*newdcb))) == NULL)
     {
         return NULL;
     }
@@ -309,10 +392,9 @@ dcb_final_free(DCB *dcb)
                     dcb->state == DCB_STATE_ALLOC,
                     "dcb not in DCB_STATE_DISCONNECTED not in DCB_STATE_ALLOC state.");
 
-    if (DCB_POLL_BUSY(dcb))
+    if (dcb->cold)
     {
-        /* Check if DCB has outstanding poll events */
-        MXS_ERROR("dcb_final_free: DCB %p has outstanding events.", dcb);
+        mxs_timer_cancel(&dcb->cold->idle_timer);
     }
 
     if (dcb->session)
@@ -416,9 +498,43 @@ dcb_free_all_memory(DCB *dcb)
         SSL_free(dcb->ssl);
     }
 
-    /* We never free the actual DCB, it is available for reuse*/
-    MXS_FREE(dcb);
+    if (dcb->cold)
+    {
+        if (dcb->cold->spill_fd >= 0)
+        {
+            close(dcb->cold->spill_fd);
+        }
+
+        MXS_FREE(dcb->cold);
+        atomic_add(&n_cold_dcbs, -1);
+    }
+
+    /** Polling threads keep the memory for DCBs they allocate later. The DCB
+     * can be one that was allocated by another thread. */
+    if (current_thread_id != -1 && dcb_cache.count < DCB_CACHE_MAX)
+    {
+        dcb->memdata.next = dcb_cache.head;
+        dcb_cache.head = dcb;
+        dcb_cache.count++;
+    }
+    else
+    {
+        MXS_FREE(dcb);
+    }
+}
+
+void dcb_cache_thread_finish()
+{
+    mxs_timer_cancel(&idle_memory_timer);
+
+    while (dcb_cache.head)
+    {
+        DCB *dcb = dcb_cache.head;
+        dcb_cache.head = dcb->memdata.next;
+        MXS_FREE(dcb);
+    }
 
+    dcb_cache.count = 0;
 }
 
 /**
@@ -508,17 +624,7 @@ dcb_process_victim_queue(int threadid)
             {
                 if (dcb->protocol)
                 {
-                    QUEUE_ENTRY conn_waiting;
-                    if (mxs_dequeue(dcb->service->queued_connections, &conn_waiting))
-                    {
-                        DCB *waiting_dcb = (DCB *)conn_waiting.queued_object;
-                        waiting_dcb->state = DCB_STATE_WAITING;
-                        poll_fake_read_event(waiting_dcb);
-                    }
-                    else
-                    {
-                        atomic_add(&dcb->service->client_count, -1);
-                    }
+                    service_release_connection(dcb->service);
                 }
             }
             else
@@ -553,6 +659,18 @@ dcb_process_victim_queue(int threadid)
             {
                 dcb->fd = DCBFD_CLOSED;
 
+                if (dcb->shard_fds)
+                {
+                    /** The first shard is the socket that was closed above */
+                    for (int i = 1; i < config_threadcount(); i++)
+                    {
+                        close(dcb->shard_fds[i]);
+                    }
+
+                    MXS_FREE(dcb->shard_fds);
+                    dcb->shard_fds = NULL;
+                }
+
                 MXS_DEBUG("%lu [dcb_process_victim_queue] Closed socket "
                           "%d on dcb %p.",
                           pthread_self(),
@@ -637,12 +755,18 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
             dcb->was_persistent = true;
             dcb->last_read = hkheartbeat;
             atomic_add_uint64(&server->stats.n_from_pool, 1);
+            dcb_pause_if_throttled(dcb);
             return dcb;
         }
         else
         {
             MXS_DEBUG("%lu [dcb_connect] Failed to find a reusable persistent connection.\n",
                       pthread_self());
+
+            if (server->persistpoolmax)
+            {
+                atomic_add_uint64(&server->stats.n_new_conn, 1);
+            }
         }
     }
 
@@ -763,6 +887,7 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
      */
     atomic_add(&server->stats.n_connections, 1);
     atomic_add(&server->stats.n_current, 1);
+    dcb_pause_if_throttled(dcb);
 
     return dcb;
 }
@@ -816,6 +941,28 @@ int dcb_read(DCB   *dcb,
         return 0;
     }
 
+    /** A read without a limit of its own reads at most the read budget. The
+     * data left in the socket is read after the other events of the thread. */
+    int budget = config_get_global_options()->read_budget;
+    bool budgeted = budget > 0 && maxbytes == 0 && dcb->thread.id == current_thread_id;
+
+    if (budgeted)
+    {
+        maxbytes = nreadtotal + budget;
+    }
+
+    if (config_get_global_options()->adaptive_reads)
+    {
+        int rval = dcb_read_adaptive(dcb, head, maxbytes, nreadtotal);
+
+        if (budgeted && rval >= maxbytes)
+        {
+            poll_add_read_pending(dcb);
+        }
+
+        return rval;
+    }
+
     while (0 == maxbytes || nreadtotal < maxbytes)
     {
         int bytes_available;
@@ -857,9 +1004,166 @@ int dcb_read(DCB   *dcb,
         }
     } /*< while (0 == maxbytes || nreadtotal < maxbytes) */
 
+    if (budgeted && nreadtotal >= maxbytes)
+    {
+        poll_add_read_pending(dcb);
+    }
+
+    return nreadtotal;
+}
+
+/**
+ * Read data from the DCB's socket without checking how much data is available
+ *
+ * The data is read directly into buffers whose size adapts to the traffic of
+ * the DCB: a read that fills the whole buffer doubles the size of the next
+ * read and a read that fills only a small part of it halves it. A short read
+ * means that the socket has been drained, so no extra read is done to get
+ * EAGAIN.
+ *
+ * @param dcb        The DCB to read from
+ * @param head       Pointer to linked list to append data to
+ * @param maxbytes   Maximum bytes to read (0 = no limit)
+ * @param nreadtotal Number of bytes already in @c head
+ *
+ * @return -1 on error, otherwise the total number of bytes read
+ */
+static int
+dcb_read_adaptive(DCB *dcb, GWBUF **head, int maxbytes, int nreadtotal)
+{
+    DCB_READ_STATS *stats = dcb->thread.id < n_read_stats ? &read_stats[dcb->thread.id] : NULL;
+
+    if (dcb->read_size == 0)
+    {
+        dcb->read_size = DCB_READ_SIZE_INITIAL;
+    }
+
+    while (0 == maxbytes || nreadtotal < maxbytes)
+    {
+        int bufsize = dcb->read_size;
+
+        if (maxbytes)
+        {
+            bufsize = MXS_MIN(bufsize, maxbytes - nreadtotal);
+        }
+
+        GWBUF *buffer = gwbuf_alloc(bufsize);
+
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+
+        errno = 0;
+        int nread = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
+        int eno = errno;
+        dcb->stats.n_reads++;
+
+        if (nread <= 0)
+        {
+            gwbuf_free(buffer);
+
+            if (nread < 0 && eno != EAGAIN && eno != EWOULDBLOCK)
+            {
+                char errbuf[MXS_STRERROR_BUFLEN];
+                MXS_ERROR("Read failed, dcb %p in state %s fd %d, due %d, %s.",
+                          dcb, STRDCBSTATE(dcb->state), dcb->fd, eno,
+                          strerror_r(eno, errbuf, sizeof(errbuf)));
+                return nreadtotal > 0 ? nreadtotal : -1;
+            }
+
+            break;
+        }
+
+        dcb->last_read = hkheartbeat;
+
+        if (nread < bufsize / DCB_READ_SHRINK_RATIO)
+        {
+            GWBUF *exact = gwbuf_alloc_and_load(nread, GWBUF_DATA(buffer));
+            gwbuf_free(buffer);
+
+            if ((buffer = exact) == NULL)
+            {
+                return -1;
+            }
+        }
+        else if (nread < bufsize)
+        {
+            GWBUF_RTRIM(buffer, bufsize - nread);
+        }
+
+        buffer->server = dcb->server;
+        *head = gwbuf_append(*head, buffer);
+        nreadtotal += nread;
+
+        if (stats)
+        {
+            stats->n_reads[dcb->dcb_role]++;
+            stats->n_bytes[dcb->dcb_role] += nread;
+        }
+
+        if (nread == dcb->read_size && dcb->read_size < MXS_MAX_NW_READ_BUFFER_SIZE)
+        {
+            dcb->read_size = MXS_MIN(dcb->read_size * 2, MXS_MAX_NW_READ_BUFFER_SIZE);
+
+            if (stats)
+            {
+                stats->n_grows[dcb->dcb_role]++;
+            }
+        }
+        else if (nread < dcb->read_size / DCB_READ_SHRINK_RATIO && dcb->read_size > DCB_READ_SIZE_MIN)
+        {
+            dcb->read_size = MXS_MAX(dcb->read_size / 2, DCB_READ_SIZE_MIN);
+
+            if (stats)
+            {
+                stats->n_shrinks[dcb->dcb_role]++;
+            }
+        }
+
+        if (nread < bufsize)
+        {
+            /** The socket has been drained */
+            break;
+        }
+    }
+
     return nreadtotal;
 }
 
+void dShowDCBReadStats(DCB *pdcb)
+{
+    static const char *role_names[DCB_N_ROLES] =
+    {
+        "Listener", "Client", "Backend", "Internal"
+    };
+
+    dcb_printf(pdcb, "\nRead statistics (adaptive reads %s).\n\n",
+               config_get_global_options()->adaptive_reads ? "enabled" : "disabled");
+    dcb_printf(pdcb, "Role       | Reads        | Bytes          | Average size | Grows      | Shrinks\n");
+    dcb_printf(pdcb, "-----------+--------------+----------------+--------------+------------+-----------\n");
+
+    for (int role = DCB_ROLE_CLIENT_HANDLER; role <= DCB_ROLE_BACKEND_HANDLER; role++)
+    {
+        int64_t n_reads = 0;
+        int64_t n_bytes = 0;
+        int64_t n_grows = 0;
+        int64_t n_shrinks = 0;
+
+        for (int i = 0; i < n_read_stats; i++)
+        {
+            n_reads += read_stats[i].n_reads[role];
+            n_bytes += read_stats[i].n_bytes[role];
+            n_grows += read_stats[i].n_grows[role];
+            n_shrinks += read_stats[i].n_shrinks[role];
+        }
+
+        dcb_printf(pdcb, "%-10s | %-12" PRId64 " | %-14" PRId64 " | %-12" PRId64 " | %-10" PRId64 " | %" PRId64 "\n",
+                   role_names[role], n_reads, n_bytes, n_reads ? n_bytes / n_reads : 0,
+                   n_grows, n_shrinks);
+    }
+}
+
 /**
  * Find the number of bytes available for the DCB's socket
  *
@@ -1216,6 +1520,27 @@ dcb_write(DCB *dcb, GWBUF *queue)
         return 0;
     }
 
+    if (dcb->spill_threshold)
+    {
+        int len = gwbuf_length(queue);
+        int spilled = dcb_spill(dcb, queue, len);
+
+        if (spilled != 0)
+        {
+            if (spilled < 0)
+            {
+                /** The data can't be sent in order any more */
+                gwbuf_free(queue);
+                poll_fake_hangup_event(dcb);
+                return 0;
+            }
+
+            dcb->writeqlen += len;
+            dcb_write_tidy_up(dcb, below_water);
+            return 1;
+        }
+    }
+
     empty_queue = (dcb->writeq == NULL);
     /*
      * Add our data to the write queue.  If the queue already had data,
@@ -1234,7 +1559,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
               dcb,
               STRDCBSTATE(dcb->state),
               dcb->fd);
-    if (empty_queue)
+    if (empty_queue && !dcb_write_deferred(dcb))
     {
         dcb_drain_writeq(dcb);
     }
@@ -1243,6 +1568,26 @@ dcb_write(DCB *dcb, GWBUF *queue)
     return 1;
 }
 
+/**
+ * Defer the writing of a DCB to the end of the poll cycle
+ *
+ * The data written to the DCB during the cycle is then sent with one system
+ * call. Only the connections of the current thread that are being polled are
+ * deferred; the rest are written immediately.
+ *
+ * @param dcb The DCB that was written to
+ * @return True if the write was deferred
+ */
+static inline bool
+dcb_write_deferred(DCB *dcb)
+{
+    return config_get_global_options()->write_coalescing &&
+           dcb->thread.id == current_thread_id &&
+           dcb->state == DCB_STATE_POLLING && !dcb->dcb_is_zombie &&
+           (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER || dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER) &&
+           poll_add_write_pending(dcb);
+}
+
 /**
  * Check the parameters for dcb_write
  *
@@ -1425,7 +1770,7 @@ dcb_drain_writeq(DCB *dcb)
         dcb_call_callback(dcb, DCB_REASON_DRAINED);
         return 0;
     }
-    above_water = (dcb->low_water && gwbuf_length(local_writeq) > dcb->low_water);
+    above_water = (dcb->low_water && dcb->writeqlen > dcb->low_water);
     do
     {
         /*
@@ -1436,7 +1781,7 @@ dcb_drain_writeq(DCB *dcb)
             bool stop_writing = false;
             int written;
             /* The value put into written will be >= 0 */
-            if (dcb->ssl)
+            if (dcb->ssl && !dcb->ssl_ktls_send)
             {
                 written = gw_write_SSL(dcb, local_writeq, &stop_writing);
             }
@@ -1537,6 +1882,11 @@ dcb_grab_writeq(DCB *dcb, bool first_time)
     }
     else
     {
+        if (dcb->writeq == NULL && dcb->cold && dcb->cold->spill_end > dcb->cold->spill_start)
+        {
+            dcb_spill_read(dcb);
+        }
+
         local_writeq = dcb->writeq;
         dcb->draining_flag = local_writeq ? true : false;
         dcb->writeq = NULL;
@@ -1631,6 +1981,15 @@ dcb_close(DCB *dcb)
         /*<
          * Add closing dcb to the top of the list, setting zombie marker
          */
+        poll_cancel_read_pending(dcb);
+
+        if (dcb->flags & DCBF_WRITE_PENDING)
+        {
+            /** Send the deferred data before the connection is closed */
+            poll_cancel_write_pending(dcb);
+            dcb_drain_writeq(dcb);
+        }
+
         int owner = dcb->thread.id;
         dcb->dcb_is_zombie = true;
         dcb->memdata.next = zombies[owner];
@@ -1698,6 +2057,13 @@ dcb_maybe_add_persistent(DCB *dcb)
             MXS_FREE(loopcallback);
         }
 
+        if (dcb->flags & DCBF_READ_PAUSED)
+        {
+            /** A pooled connection is read only to detect that it was closed */
+            poll_resume_reading(dcb);
+            poll_cancel_read_pending(dcb);
+        }
+
         /** Free all buffered data */
         gwbuf_free(dcb->dcb_fakequeue);
         gwbuf_free(dcb->dcb_readqueue);
@@ -1881,6 +2247,7 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
     dcb_printf(pdcb, "\t\tNo. of Accepts:           %d\n", dcb->stats.n_accepts);
     dcb_printf(pdcb, "\t\tNo. of High Water Events: %d\n", dcb->stats.n_high_water);
     dcb_printf(pdcb, "\t\tNo. of Low Water Events:  %d\n", dcb->stats.n_low_water);
+    dcb_printf(pdcb, "\t\tNo. of Write Queue Spills: %d\n", dcb->stats.n_spills);
     if (dcb->flags & DCBF_CLONE)
     {
         dcb_printf(pdcb, "\t\tDCB is a clone.\n");
@@ -2041,11 +2408,8 @@ dprintDCB(DCB *pdcb, DCB *dcb)
                dcb->stats.n_high_water);
     dcb_printf(pdcb, "\t\tNo. of Low Water Events:  %d\n",
                dcb->stats.n_low_water);
-    if (DCB_POLL_BUSY(dcb))
-    {
-        dcb_printf(pdcb, "\t\tPending events in the queue:      %x %s\n",
-                   dcb->evq.pending_events, dcb->evq.processing ? "(processing)" : "");
-    }
+    dcb_printf(pdcb, "\t\tNo. of Write Queue Spills: %d\n",
+               dcb->stats.n_spills);
     if (dcb->flags & DCBF_CLONE)
     {
         dcb_printf(pdcb, "\t\tDCB is a clone.\n");
@@ -2216,9 +2580,25 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
     return written > 0 ? written : 0;
 }
 
+/**
+ * The maximum number of buffers written with one writev call. The vector is
+ * allocated on the stack so it is kept below IOV_MAX even if the platform
+ * allows more.
+ */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define DCB_WRITEV_MAX IOV_MAX
+#else
+#define DCB_WRITEV_MAX 1024
+#endif
+
 /**
  * Write data to a DCB. The data is taken from the DCB's write queue.
  *
+ * If the write queue is a chain of buffers, as many of them as possible are
+ * written with a single writev call. The caller is expected to consume
+ * exactly the returned number of bytes from the write queue, which takes
+ * care of partially written chains.
+ *
  * @param dcb           The DCB to write buffer
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2227,17 +2607,37 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 static int
 gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
-    int written = 0;
+    ssize_t written = 0;
     int fd = dcb->fd;
-    size_t nbytes = GWBUF_LENGTH(writeq);
-    void *buf = GWBUF_DATA(writeq);
     int saved_errno;
 
     errno = 0;
 
     if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        if (writeq->next == NULL)
+        {
+            written = write(fd, GWBUF_DATA(writeq), GWBUF_LENGTH(writeq));
+        }
+        else
+        {
+            struct iovec iov[DCB_WRITEV_MAX];
+            int iovcnt = 0;
+
+            for (GWBUF *buf = writeq; buf && iovcnt < DCB_WRITEV_MAX; buf = buf->next)
+            {
+                if (GWBUF_LENGTH(buf) > 0)
+                {
+                    iov[iovcnt].iov_base = GWBUF_DATA(buf);
+                    iov[iovcnt].iov_len = GWBUF_LENGTH(buf);
+                    iovcnt++;
+                }
+            }
+
+            written = writev(fd, iov, iovcnt);
+        }
+
+        dcb->stats.n_writes++;
     }
 
     saved_errno = errno;
@@ -2647,6 +3047,12 @@ dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl)
         return -1;
     }
 
+    if (config_get_global_options()->idle_memory_timeout > 0)
+    {
+        /** The record buffers are freed whenever they are empty */
+        SSL_set_mode(dcb->ssl, SSL_MODE_RELEASE_BUFFERS);
+    }
+
     if (SSL_set_fd(dcb->ssl, dcb->fd) == 0)
     {
         MXS_ERROR("Failed to set file descriptor for SSL connection.");
@@ -2656,6 +3062,89 @@ dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl)
     return 0;
 }
 
+/**
+ * Count a completed handshake as either a full or a resumed one.
+ *
+ * @param dcb DCB whose handshake completed
+ * @param ssl The SSL configuration the connection was created with
+ */
+static void
+dcb_count_handshake_SSL(DCB *dcb, SSL_LISTENER *ssl)
+{
+    if (SSL_session_reused(dcb->ssl))
+    {
+        atomic_add_uint64(&ssl->n_resumed_handshakes, 1);
+    }
+    else
+    {
+        atomic_add_uint64(&ssl->n_full_handshakes, 1);
+    }
+}
+
+/**
+ * Check whether the kernel took over the encryption of the connection. If it
+ * did, the data is written to the socket as it is, without copying it through
+ * OpenSSL. Reads still use SSL_read() as it handles the non-data records.
+ *
+ * @param dcb DCB whose handshake completed
+ */
+static void
+dcb_check_ktls_SSL(DCB *dcb)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    dcb->ssl_ktls_send = BIO_get_ktls_send(SSL_get_wbio(dcb->ssl));
+#endif
+}
+
+/**
+ * Set the session of the latest backend connection to be resumed by a new
+ * connection to the same server.
+ *
+ * @param dcb Backend DCB that has not yet started the handshake
+ * @param ssl The SSL configuration of the server
+ */
+static void
+dcb_resume_session_SSL(DCB *dcb, SSL_LISTENER *ssl)
+{
+    spinlock_acquire(&ssl->session_lock);
+
+    if (ssl->session && SSL_set_session(dcb->ssl, ssl->session) == 0)
+    {
+        MXS_INFO("Failed to set the TLS session to resume for '%s'.", dcb->remote);
+    }
+
+    spinlock_release(&ssl->session_lock);
+}
+
+/**
+ * Store the session of a new backend connection so that later connections to
+ * the same server can resume it instead of doing a full handshake.
+ *
+ * @param dcb Backend DCB whose handshake completed
+ * @param ssl The SSL configuration of the server
+ */
+static void
+dcb_store_session_SSL(DCB *dcb, SSL_LISTENER *ssl)
+{
+    if (!SSL_session_reused(dcb->ssl))
+    {
+        SSL_SESSION *session = SSL_get1_session(dcb->ssl);
+
+        if (session)
+        {
+            spinlock_acquire(&ssl->session_lock);
+            SSL_SESSION *old_session = ssl->session;
+            ssl->session = session;
+            spinlock_release(&ssl->session_lock);
+
+            if (old_session)
+            {
+                SSL_SESSION_free(old_session);
+            }
+        }
+    }
+}
+
 /**
  * Accept a SSL connection and do the SSL authentication handshake.
  * This function accepts a client connection to a DCB. It assumes that the SSL
@@ -2684,6 +3173,8 @@ int dcb_accept_SSL(DCB* dcb)
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_accept done for %s@%s", user, remote);
+        dcb_count_handshake_SSL(dcb, dcb->listener->ssl);
+        dcb_check_ktls_SSL(dcb);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return 1;
@@ -2746,18 +3237,33 @@ int dcb_connect_SSL(DCB* dcb)
     int ssl_rval;
     int return_code;
 
-    if ((NULL == dcb->server || NULL == dcb->server->server_ssl) ||
-        (NULL == dcb->ssl && dcb_create_SSL(dcb, dcb->server->server_ssl) != 0))
+    if (NULL == dcb->server || NULL == dcb->server->server_ssl)
     {
         ss_dassert((NULL != dcb->server) && (NULL != dcb->server->server_ssl));
         return -1;
     }
+
+    SSL_LISTENER *ssl = dcb->server->server_ssl;
+
+    if (NULL == dcb->ssl)
+    {
+        if (dcb_create_SSL(dcb, ssl) != 0)
+        {
+            return -1;
+        }
+
+        dcb_resume_session_SSL(dcb, ssl);
+    }
+
     dcb->ssl_state = SSL_HANDSHAKE_REQUIRED;
     ssl_rval = SSL_connect(dcb->ssl);
     switch (SSL_get_error(dcb->ssl, ssl_rval))
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_connect done for %s", dcb->remote);
+        dcb_count_handshake_SSL(dcb, ssl);
+        dcb_store_session_SSL(dcb, ssl);
+        dcb_check_ktls_SSL(dcb);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return_code = 1;
@@ -2837,7 +3343,13 @@ dcb_accept(DCB *listener)
     socklen_t optlen = sizeof(sendbuf);
     char errbuf[MXS_STRERROR_BUFLEN];
 
-    if ((c_sock = dcb_accept_one_connection(listener, (struct sockaddr *)&client_conn)) >= 0)
+    /**
+     * The listener is edge-triggered, so the connections that are queued or
+     * refused must not end the accepting while the backlog still has
+     * connections in it.
+     */
+    while (client_dcb == NULL &&
+           (c_sock = dcb_accept_one_connection(listener, (struct sockaddr *)&client_conn)) >= 0)
     {
         listener->stats.n_accepts++;
         MXS_DEBUG("%lu [gw_MySQLAccept] Accepted fd %d.",
@@ -2860,6 +3372,12 @@ dcb_accept(DCB *listener)
                       errno, strerror_r(errno, errbuf, sizeof(errbuf)));
         }
         setnonblocking(c_sock);
+        set_busy_poll(c_sock);
+
+        if (listener->listener)
+        {
+            socket_opts_apply(c_sock, &listener->listener->sockopts, MXS_SOCKET_ACCEPTED);
+        }
 
         client_dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, listener->listener);
 
@@ -2885,24 +3403,30 @@ dcb_accept(DCB *listener)
             }
             else
             {
-                /* client IP in raw data*/
-                memcpy(&client_dcb->ip, &client_conn, sizeof(client_conn));
+                DCB_COLD *cold = dcb_get_cold(client_dcb);
+
+                if (cold)
+                {
+                    /* client IP in raw data*/
+                    memcpy(&cold->ip, &client_conn, sizeof(client_conn));
+                }
+
                 /* client IP in string representation */
                 client_dcb->remote = (char *)MXS_CALLOC(INET6_ADDRSTRLEN + 1, sizeof(char));
 
                 if (client_dcb->remote)
                 {
                     void *ptr;
-                    if (client_dcb->ip.ss_family == AF_INET)
+                    if (client_conn.ss_family == AF_INET)
                     {
-                        ptr = &((struct sockaddr_in*)&client_dcb->ip)->sin_addr;
+                        ptr = &((struct sockaddr_in*)&client_conn)->sin_addr;
                     }
                     else
                     {
-                        ptr = &((struct sockaddr_in6*)&client_dcb->ip)->sin6_addr;
+                        ptr = &((struct sockaddr_in6*)&client_conn)->sin6_addr;
                     }
 
-                    inet_ntop(client_dcb->ip.ss_family, ptr,
+                    inet_ntop(client_conn.ss_family, ptr,
                               client_dcb->remote, INET6_ADDRSTRLEN);
                 }
             }
@@ -2943,7 +3467,7 @@ dcb_accept(DCB *listener)
             if (client_dcb->service->max_connections &&
                 client_dcb->service->client_count >= client_dcb->service->max_connections)
             {
-                if (!mxs_enqueue(client_dcb->service->queued_connections, client_dcb))
+                if (!service_queue_connection(client_dcb->service, client_dcb))
                 {
                     if (client_dcb->func.connlimit)
                     {
@@ -2953,6 +3477,10 @@ dcb_accept(DCB *listener)
                 }
                 client_dcb = NULL;
             }
+            else if (!serviceAdmitConnection(client_dcb->service, client_dcb))
+            {
+                client_dcb = NULL;
+            }
         }
     }
     return client_dcb;
@@ -2980,7 +3508,7 @@ dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
         int eno = 0;
 
         /* new connection from client */
-        c_sock = accept(listener->fd,
+        c_sock = accept(listener->shard_fds ? listener->shard_fds[current_thread_id] : listener->fd,
                         client_conn,
                         &client_len);
         eno = errno;
@@ -3054,6 +3582,9 @@ dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
  * list.  The protocol name does not affect the logic, but is used in
  * log messages.
  *
+ * If the socket was received from the previous MaxScale process, it is
+ * taken into use instead of creating a new one.
+ *
  * @param listener Listener DCB that is being created
  * @param config Configuration for port to listen on
  * @param protocol_name Name of protocol that is listening
@@ -3072,15 +3603,32 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
         port = atoi(port_str);
     }
 
-    int listener_socket = -1;
+    char key[HANDOFF_KEY_MAX];
+    handoff_key(key, config, 0);
+
+    int listener_socket = handoff_take_fd(key);
+    bool reuseport = listener->listener && listener->listener->reuseport;
 
     if (strchr(host, '/'))
     {
-        listener_socket = dcb_listen_create_socket_unix(host);
+        if (reuseport)
+        {
+            MXS_WARNING("The 'reuseport' parameter is ignored for UNIX domain socket '%s'.", host);
+            reuseport = false;
+        }
+
+        if (listener_socket == -1)
+        {
+            listener_socket = dcb_listen_create_socket_unix(host);
+        }
+    }
+    else if (listener_socket != -1)
+    {
+        MXS_NOTICE("Took over the listening socket of [%s]:%u from the previous process.", host, port);
     }
     else if (port > 0)
     {
-        listener_socket = dcb_listen_create_socket_inet(host, port);
+        listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
 
         if (listener_socket == -1 && strcmp(host, "::") == 0)
         {
@@ -3088,7 +3636,7 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
             MXS_WARNING("Failed to bind on default IPv6 host '::', attempting "
                         "to bind on IPv4 version '0.0.0.0'");
             strcpy(host, "0.0.0.0");
-            listener_socket = dcb_listen_create_socket_inet(host, port);
+            listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
         }
     }
     else
@@ -3103,6 +3651,11 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
         return -1;
     }
 
+    if (listener->listener)
+    {
+        socket_opts_apply(listener_socket, &listener->listener->sockopts, MXS_SOCKET_LISTENER);
+    }
+
     /**
      * The use of INT_MAX for backlog length in listen() allows the end-user to
      * control the backlog length with the net.ipv4.tcp_max_syn_backlog kernel
@@ -3123,6 +3676,11 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     // assign listener_socket to dcb
     listener->fd = listener_socket;
 
+    if (reuseport && !dcb_listen_create_shards(listener, config, host, port, protocol_name))
+    {
+        return -1;
+    }
+
     // add listening socket to poll structure
     if (poll_add_dcb(listener) != 0)
     {
@@ -3133,6 +3691,34 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     return 0;
 }
 
+/**
+ * @brief Close the sockets of a listener that is no longer polled
+ *
+ * @param listener Listener DCB that has been removed from polling
+ */
+void dcb_listen_close(DCB *listener)
+{
+    ss_dassert(listener->state != DCB_STATE_LISTENING);
+
+    if (listener->shard_fds)
+    {
+        /** The first shard is the listener socket itself */
+        for (int i = 1; i < config_threadcount(); i++)
+        {
+            close(listener->shard_fds[i]);
+        }
+
+        MXS_FREE(listener->shard_fds);
+        listener->shard_fds = NULL;
+    }
+
+    if (listener->fd > 0)
+    {
+        close(listener->fd);
+        listener->fd = DCBFD_CLOSED;
+    }
+}
+
 /**
  * @brief Create a network listener socket
  *
@@ -3140,14 +3726,21 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
  * @param port The port to listen on
  * @return     The opened socket or -1 on error
  */
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port)
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport)
 {
     struct sockaddr_storage server_address = {};
     int listener_socket = open_network_socket(MXS_SOCKET_LISTENER, &server_address, host, port);
+    int one = 1;
 
     if (listener_socket != -1)
     {
-        if (bind(listener_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
+        if (reuseport &&
+            dcb_set_socket_option(listener_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&one, sizeof(one)) != 0)
+        {
+            close(listener_socket);
+            listener_socket = -1;
+        }
+        else if (bind(listener_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
         {
             MXS_ERROR("Failed to bind on '%s:%u': %d, %s",
                       host, port, errno, mxs_strerror(errno));
@@ -3159,6 +3752,129 @@ static int dcb_listen_create_socket_inet(const char *host, uint16_t port)
     return listener_socket;
 }
 
+/**
+ * @brief Create the per-thread sockets of a SO_REUSEPORT listener
+ *
+ * The socket already assigned to the listener is used by the first thread and
+ * a new socket bound to the same address is opened for every other thread,
+ * unless the previous MaxScale process handed one over.
+ * Each socket is later registered only in the epoll instance of its own
+ * thread which lets the kernel balance new connections between the threads.
+ *
+ * @param listener      Listener DCB with an open, listening socket
+ * @param config        The configuration given to dcb_listen()
+ * @param host          The network address to listen on
+ * @param port          The port to listen on
+ * @param protocol_name Name of protocol that is listening
+ * @return True if all sockets were created
+ */
+static bool dcb_listen_create_shards(DCB *listener, const char *config, const char *host,
+                                     uint16_t port, const char *protocol_name)
+{
+    int n_threads = config_threadcount();
+    int *fds = (int*)MXS_MALLOC(n_threads * sizeof(int));
+
+    if (fds == NULL)
+    {
+        return false;
+    }
+
+    fds[0] = listener->fd;
+
+    for (int i = 1; i < n_threads; i++)
+    {
+        char key[HANDOFF_KEY_MAX];
+        handoff_key(key, config, i);
+
+        if ((fds[i] = handoff_take_fd(key)) == -1)
+        {
+            fds[i] = dcb_listen_create_socket_inet(host, port, true);
+        }
+
+        if (fds[i] != -1)
+        {
+            socket_opts_apply(fds[i], &listener->listener->sockopts, MXS_SOCKET_LISTENER);
+        }
+
+        if (fds[i] == -1 || listen(fds[i], INT_MAX) != 0)
+        {
+            if (fds[i] != -1)
+            {
+                MXS_ERROR("Failed to start listening on '[%s]:%u' with protocol '%s': %d, %s",
+                          host, port, protocol_name, errno, mxs_strerror(errno));
+                close(fds[i]);
+            }
+
+            for (int j = 1; j < i; j++)
+            {
+                close(fds[j]);
+            }
+
+            MXS_FREE(fds);
+            return false;
+        }
+    }
+
+    listener->shard_fds = fds;
+
+    if (config_get_global_options()->incoming_cpu_steering && poll_thread_cpu(0) >= 0)
+    {
+        dcb_listen_steer_shards(listener);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Accept the connections of a listener in the thread of the receiving CPU
+ *
+ * A classic BPF program attached to the SO_REUSEPORT group selects the socket
+ * of the thread that is bound to the CPU that processed the incoming
+ * connection. When the NIC interrupts are bound to the same CPUs, a
+ * connection is then handled on the CPU, and NUMA node, where its packets
+ * arrive. Connections that arrive on other CPUs are balanced by the kernel.
+ * The sockets of the group are indexed in the order they were bound, which
+ * is the order of the threads.
+ *
+ * @param listener Listener DCB with the sockets of all threads
+ */
+static void dcb_listen_steer_shards(DCB *listener)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    int n_threads = config_threadcount();
+    struct sock_filter *code = MXS_MALLOC((2 * n_threads + 2) * sizeof(struct sock_filter));
+
+    if (code == NULL)
+    {
+        return;
+    }
+
+    int n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, poll_thread_cpu(i), 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+
+    /** An index outside the group makes the kernel select the socket */
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+    struct sock_fprog prog = {.len = n, .filter = code};
+
+    if (setsockopt(listener->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0)
+    {
+        MXS_WARNING("Failed to steer the connections of listener '%s' by CPU: %d, %s",
+                    listener->listener ? listener->listener->name : "", errno, mxs_strerror(errno));
+    }
+
+    MXS_FREE(code);
+#else
+    MXS_WARNING("Connections cannot be steered by CPU on this system.");
+#endif
+}
+
 /**
  * @brief Create a Unix domain socket
  *
@@ -3384,6 +4100,192 @@ static void dcb_remove_from_list(DCB *dcb)
     spinlock_release(&all_dcbs_lock[dcb->thread.id]);
 }
 
+/** Minimum time in 100ms ticks nothing has been read from a session that is moved */
+#define DCB_MIGRATE_MIN_IDLE 10
+
+/** Maximum number of DCBs of a session that is moved to another thread */
+#define DCB_MIGRATE_MAX_DCBS 32
+
+/** Maximum number of sessions moved at a time */
+#define DCB_MIGRATE_MAX_SESSIONS 8
+
+/**
+ * A session selected to be moved to another thread
+ */
+typedef struct
+{
+    MXS_SESSION *session;
+    DCB         *dcbs[DCB_MIGRATE_MAX_DCBS]; /*< The client DCB is the first one */
+    int          n_dcbs;
+    bool         idle;                       /*< False if a DCB of the session is busy */
+} DCB_MIGRATION;
+
+/**
+ * Check whether a DCB has nothing in progress that ties it to its thread
+ *
+ * @param dcb The DCB
+ * @return True if the DCB can be moved to another thread
+ */
+static bool dcb_is_idle(DCB *dcb)
+{
+    return dcb->state == DCB_STATE_POLLING && !dcb->dcb_is_zombie && dcb->fd > 0 &&
+           !(dcb->flags & (DCBF_CLONE | DCBF_HUNG | DCBF_READ_PENDING | DCBF_WRITE_PENDING | DCBF_READ_PAUSED)) &&
+           dcb->writeq == NULL && dcb->delayq == NULL && dcb->dcb_readqueue == NULL &&
+           dcb->dcb_fakequeue == NULL && hkheartbeat - dcb->last_read >= DCB_MIGRATE_MIN_IDLE;
+}
+
+/**
+ * Check whether a session could be moved to another thread
+ *
+ * The filters can keep state of the thread the session was created in, so
+ * only sessions of services without filters are moved.
+ *
+ * @param session The session of a client DCB
+ * @return True if the session can be moved
+ */
+static bool dcb_session_is_idle(MXS_SESSION *session)
+{
+    return session && session->state == SESSION_STATE_ROUTER_READY &&
+           session->service->n_filters == 0 && !session->reads_paused &&
+           session->stats.wait_start == 0;
+}
+
+void dcb_move_to_list(DCB **dcbs, int n, int thread_id)
+{
+    int from = current_thread_id;
+    ss_dassert(from != thread_id);
+
+    /** Locking in the order of the threads prevents deadlocks with a move
+     * in the other direction */
+    SPINLOCK *first = &all_dcbs_lock[MXS_MIN(from, thread_id)];
+    SPINLOCK *second = &all_dcbs_lock[MXS_MAX(from, thread_id)];
+    spinlock_acquire(first);
+    spinlock_acquire(second);
+
+    for (int i = 0; i < n; i++)
+    {
+        DCB *dcb = dcbs[i];
+        DCB *prev = NULL;
+        DCB *current = all_dcbs[from];
+
+        while (current && current != dcb)
+        {
+            prev = current;
+            current = current->thread.next;
+        }
+
+        ss_dassert(current);
+
+        if (current)
+        {
+            DCB *tail = all_dcbs[from]->thread.tail;
+
+            if (prev)
+            {
+                prev->thread.next = dcb->thread.next;
+            }
+            else
+            {
+                all_dcbs[from] = dcb->thread.next;
+            }
+
+            if (all_dcbs[from])
+            {
+                all_dcbs[from]->thread.tail = tail == dcb ? prev : tail;
+            }
+
+            dcb->thread.next = NULL;
+            dcb->thread.tail = NULL;
+
+            if (all_dcbs[thread_id])
+            {
+                all_dcbs[thread_id]->thread.tail->thread.next = dcb;
+                all_dcbs[thread_id]->thread.tail = dcb;
+            }
+            else
+            {
+                all_dcbs[thread_id] = dcb;
+                dcb->thread.tail = dcb;
+            }
+        }
+    }
+
+    spinlock_release(second);
+    spinlock_release(first);
+}
+
+int dcb_migrate_idle_sessions(int thread_id, int max)
+{
+    int id = current_thread_id;
+    DCB_MIGRATION migrations[DCB_MIGRATE_MAX_SESSIONS];
+    int n = 0;
+
+    if (max > DCB_MIGRATE_MAX_SESSIONS)
+    {
+        max = DCB_MIGRATE_MAX_SESSIONS;
+    }
+
+    spinlock_acquire(&all_dcbs_lock[id]);
+
+    /** Select idle client DCBs, then collect the other DCBs of their sessions */
+    for (DCB *dcb = all_dcbs[id]; dcb && n < max; dcb = dcb->thread.next)
+    {
+        if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb_is_idle(dcb) &&
+            dcb_session_is_idle(dcb->session) && dcb->session->client_dcb == dcb)
+        {
+            migrations[n].session = dcb->session;
+            migrations[n].dcbs[0] = dcb;
+            migrations[n].n_dcbs = 1;
+            migrations[n].idle = true;
+            n++;
+        }
+    }
+
+    for (DCB *dcb = all_dcbs[id]; dcb && n > 0; dcb = dcb->thread.next)
+    {
+        if (dcb->dcb_role != DCB_ROLE_BACKEND_HANDLER || dcb->session == NULL)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            DCB_MIGRATION *m = &migrations[i];
+
+            if (dcb->session == m->session && m->idle)
+            {
+                if (dcb_is_idle(dcb) && m->n_dcbs < DCB_MIGRATE_MAX_DCBS)
+                {
+                    m->dcbs[m->n_dcbs++] = dcb;
+                }
+                else
+                {
+                    m->idle = false;
+                }
+                break;
+            }
+        }
+    }
+
+    spinlock_release(&all_dcbs_lock[id]);
+
+    /** Only the owning thread removes DCBs from its list so the selected
+     * ones are still there */
+    int moved = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (migrations[i].idle && poll_migrate_dcbs(migrations[i].dcbs, migrations[i].n_dcbs, thread_id))
+        {
+            MXS_DEBUG("Moved session %lu from thread %d to thread %d.",
+                      migrations[i].session->ses_id, id, thread_id);
+            moved++;
+        }
+    }
+
+    return moved;
+}
+
 /**
  * Enable the timing out of idle connections.
  */
@@ -3393,42 +4295,330 @@ void dcb_enable_session_timeouts()
 }
 
 /**
- * Close sessions that have been idle for too long.
+ * Close a client DCB that has been idle for too long.
  *
- * If the time since a session last sent data is greater than the set value in the
- * service, it is disconnected. The connection timeout is disabled by default.
+ * The timer is not moved every time the client sends data. Instead, when it
+ * expires, it is set again for the remaining time if the client has sent
+ * data in the meantime.
  */
-void dcb_process_idle_sessions(int thr)
+static void dcb_idle_timeout(MXS_TIMER *timer, void *data)
 {
-    if (check_timeouts && hkheartbeat >= next_timeout_check)
+    DCB *dcb = (DCB*)data;
+    ss_dassert(dcb->listener);
+    SERVICE *service = dcb->listener->service;
+
+    if (service->conn_idle_timeout && dcb->state == DCB_STATE_POLLING)
     {
-        /** Because the resolution of the timeout is one second, we only need to
-         * check for it once per second. One heartbeat is 100 milliseconds. */
-        next_timeout_check = hkheartbeat + 10;
+        long idle = hkheartbeat - dcb->last_read;
+        long timeout = service->conn_idle_timeout * 10;
 
-        for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+        if (idle > timeout)
         {
-            if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+            MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
+                        dcb->user ? dcb->user : "<unknown>",
+                        dcb->remote ? dcb->remote : "<unknown>",
+                        (float)idle / 10.f);
+            poll_fake_hangup_event(dcb);
+        }
+        else
+        {
+            mxs_timer_set(timer, timeout - idle + 1, dcb_idle_timeout, dcb);
+        }
+    }
+}
+
+/**
+ * Start the idle timer of a client DCB if its service has an idle timeout.
+ *
+ * Called by the owning thread whenever it processes an event of the DCB, so
+ * the timer is also started for sessions that existed before the timeout
+ * was enabled. The connection timeout is disabled by default.
+ */
+void dcb_start_idle_timer(DCB *dcb)
+{
+    if (check_timeouts && (dcb->cold == NULL || !mxs_timer_is_set(&dcb->cold->idle_timer)) &&
+        dcb->state == DCB_STATE_POLLING)
+    {
+        ss_dassert(dcb->listener);
+        SERVICE *service = dcb->listener->service;
+        DCB_COLD *cold;
+
+        if (service->conn_idle_timeout && (cold = dcb_get_cold(dcb)))
+        {
+            mxs_timer_set(&cold->idle_timer, service->conn_idle_timeout * 10,
+                          dcb_idle_timeout, dcb);
+        }
+    }
+}
+
+/**
+ * Pause or resume the reading of the backend DCBs of a session
+ *
+ * The backend DCBs are owned by the thread of the client DCB, so only its
+ * list of DCBs is searched.
+ *
+ * @param session The session
+ * @param pause   True to pause the reading, false to resume it
+ */
+static void dcb_set_session_reading(MXS_SESSION *session, bool pause)
+{
+    int id = session->client_dcb->thread.id;
+
+    spinlock_acquire(&all_dcbs_lock[id]);
+
+    for (DCB *dcb = all_dcbs[id]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->session == session && dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER &&
+            !dcb->dcb_is_zombie)
+        {
+            if (pause)
             {
-                ss_dassert(dcb->listener);
-                SERVICE *service = dcb->listener->service;
+                poll_pause_reading(dcb);
+            }
+            else
+            {
+                poll_resume_reading(dcb);
+            }
+        }
+    }
 
-                if (service->conn_idle_timeout && dcb->state == DCB_STATE_POLLING)
-                {
-                    int64_t idle = hkheartbeat - dcb->last_read;
-                    int64_t timeout = service->conn_idle_timeout * 10;
+    spinlock_release(&all_dcbs_lock[id]);
+}
 
-                    if (idle > timeout)
-                    {
-                        MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
-                                    dcb->user ? dcb->user : "<unknown>",
-                                    dcb->remote ? dcb->remote : "<unknown>",
-                                    (float)idle / 10.f);
-                        poll_fake_hangup_event(dcb);
-                    }
+/**
+ * Called when the write queue of a client DCB crosses its water marks
+ *
+ * When the client does not read its replies as fast as the servers send
+ * them, the replies would pile up in the write queue. Instead, the servers
+ * are not read until the client has caught up and the data waits in the
+ * socket buffers, where TCP flow control slows the servers down.
+ */
+static int dcb_flow_control_cb(DCB *dcb, DCB_REASON reason, void *userdata)
+{
+    MXS_SESSION *session = dcb->session;
+
+    if (session && session->state != SESSION_STATE_DUMMY &&
+        dcb->thread.id == current_thread_id)
+    {
+        if (reason == DCB_REASON_HIGH_WATER && !session->reads_paused)
+        {
+            MXS_DEBUG("Write queue of session %lu is %d bytes, pausing the servers.",
+                      session->ses_id, dcb->writeqlen);
+            session->reads_paused = true;
+            session->stats.n_reads_paused++;
+            dcb_set_session_reading(session, true);
+        }
+        else if (reason == DCB_REASON_LOW_WATER && session->reads_paused)
+        {
+            MXS_DEBUG("Write queue of session %lu is %d bytes, resuming the servers.",
+                      session->ses_id, dcb->writeqlen);
+            session->reads_paused = false;
+            dcb_set_session_reading(session, false);
+        }
+    }
+
+    return 1;
+}
+
+void dcb_enable_flow_control(DCB *dcb)
+{
+    MXS_CONFIG *cnf = config_get_global_options();
+
+    if (cnf->writeq_high_water && dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        dcb->high_water = cnf->writeq_high_water;
+        dcb->low_water = cnf->writeq_low_water;
+        dcb_add_callback(dcb, DCB_REASON_HIGH_WATER, dcb_flow_control_cb, NULL);
+        dcb_add_callback(dcb, DCB_REASON_LOW_WATER, dcb_flow_control_cb, NULL);
+    }
+
+    if (cnf->writeq_spill_threshold && dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        dcb->spill_threshold = cnf->writeq_spill_threshold;
+    }
+}
+
+/**
+ * Create the spill file of a client write queue
+ *
+ * The file is removed immediately, so it disappears when it is closed.
+ *
+ * @return The file descriptor or -1 on error
+ */
+static int dcb_spill_open()
+{
+    const char *dir = config_get_global_options()->writeq_spill_directory;
+    char path[PATH_MAX + 1];
+
+    snprintf(path, sizeof(path), "%s/maxscale-writeq-XXXXXX", dir ? dir : get_datadir());
+
+    int fd = mkstemp(path);
+
+    if (fd == -1)
+    {
+        MXS_ERROR("Failed to create write queue spill file '%s': %d, %s",
+                  path, errno, mxs_strerror(errno));
+    }
+    else
+    {
+        unlink(path);
+    }
+
+    return fd;
+}
+
+/**
+ * Write data to the spill file of a client DCB
+ *
+ * When the client is not reading and more than @c spill_threshold bytes
+ * are waiting, the rest is written to a file instead of the write queue, so
+ * that the replies of the servers can be read in full without keeping them
+ * in memory. Once data has been spilled, everything written to the DCB goes
+ * to the file until all of it has been moved back to the write queue, so
+ * that the data stays in order.
+ *
+ * @param dcb   Client DCB
+ * @param queue The data to write, freed if it was spilled
+ * @param len   Length of the data
+ *
+ * @return 1 if the data was spilled, 0 if it goes to the write queue and -1
+ *         if it could not be spilled after earlier data was
+ */
+static int dcb_spill(DCB *dcb, GWBUF *queue, int len)
+{
+    DCB_COLD *cold = dcb->cold;
+    bool pending = cold && cold->spill_end > cold->spill_start;
+
+    if (!pending && (dcb->writeq == NULL || dcb->writeqlen + len <= dcb->spill_threshold))
+    {
+        return 0;
+    }
+
+    if (cold == NULL && (cold = dcb_get_cold(dcb)) == NULL)
+    {
+        return 0;
+    }
+
+    if (cold->spill_fd < 0 && (cold->spill_fd = dcb_spill_open()) < 0)
+    {
+        /** Don't try again for this client */
+        dcb->spill_threshold = 0;
+        return 0;
+    }
+
+    off_t offset = cold->spill_end;
+
+    for (GWBUF *buf = queue; buf; buf = buf->next)
+    {
+        const uint8_t *data = GWBUF_DATA(buf);
+        size_t left = GWBUF_LENGTH(buf);
+
+        while (left > 0)
+        {
+            ssize_t written = pwrite(cold->spill_fd, data, left, offset);
+
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
                 }
+
+                MXS_ERROR("Failed to write to the write queue spill file of '%s': %d, %s",
+                          dcb->remote ? dcb->remote : "", errno, mxs_strerror(errno));
+                return pending ? -1 : 0;
             }
+
+            data += written;
+            left -= written;
+            offset += written;
+        }
+    }
+
+    if (!pending)
+    {
+        dcb->stats.n_spills++;
+    }
+
+    cold->spill_end = offset;
+    gwbuf_free(queue);
+
+    return 1;
+}
+
+/**
+ * Move the next part of the spilled data to the empty write queue
+ *
+ * @param dcb Client DCB with spilled data
+ */
+static void dcb_spill_read(DCB *dcb)
+{
+    DCB_COLD *cold = dcb->cold;
+    off_t pending = cold->spill_end - cold->spill_start;
+    off_t len = MXS_MAX(dcb->spill_threshold, DCB_SPILL_READ_SIZE);
+
+    if (len > pending)
+    {
+        len = pending;
+    }
+
+    GWBUF *buf = gwbuf_alloc(len);
+    off_t done = 0;
+
+    while (buf && done < len)
+    {
+        ssize_t n = pread(cold->spill_fd, GWBUF_DATA(buf) + done, len - done,
+                          cold->spill_start + done);
+
+        if (n > 0)
+        {
+            done += n;
         }
+        else if (n == 0 || errno != EINTR)
+        {
+            MXS_ERROR("Failed to read the write queue spill file of '%s': %d, %s",
+                      dcb->remote ? dcb->remote : "", errno, mxs_strerror(errno));
+            gwbuf_free(buf);
+            buf = NULL;
+        }
+    }
+
+    if (buf)
+    {
+        cold->spill_start += len;
+        dcb->writeq = buf;
+    }
+    else
+    {
+        /** The rest of the data is lost, the client can't continue */
+        cold->spill_start = cold->spill_end;
+        poll_fake_hangup_event(dcb);
+    }
+
+    if (cold->spill_start == cold->spill_end)
+    {
+        /** Everything has been read, release the disk space */
+        cold->spill_start = 0;
+        cold->spill_end = 0;
+
+        if (ftruncate(cold->spill_fd, 0) == -1)
+        {
+            MXS_ERROR("Failed to truncate the write queue spill file: %d, %s",
+                      errno, mxs_strerror(errno));
+        }
+    }
+}
+
+/**
+ * Pause a new backend DCB of a session whose client is not keeping up
+ *
+ * @param dcb The backend DCB
+ */
+static void dcb_pause_if_throttled(DCB *dcb)
+{
+    if (dcb->session->reads_paused)
+    {
+        poll_pause_reading(dcb);
     }
 }
 
@@ -3456,24 +4646,146 @@ bool dcb_foreach(bool(*func)(DCB *, void *), void *data)
     return more;
 }
 
+/**
+ * Get the cold part of a DCB, allocating it if the DCB has none
+ *
+ * @param dcb The DCB
+ * @return The cold part or NULL if memory allocation failed
+ */
+static DCB_COLD *dcb_get_cold(DCB *dcb)
+{
+    if (dcb->cold == NULL && (dcb->cold = (DCB_COLD*)MXS_CALLOC(1, sizeof(DCB_COLD))))
+    {
+        dcb->cold->spill_fd = -1;
+        atomic_add(&n_cold_dcbs, 1);
+    }
+
+    return dcb->cold;
+}
+
+const struct sockaddr_storage* dcb_get_ip(const DCB *dcb)
+{
+    static const struct sockaddr_storage no_address;
+
+    return dcb->cold ? &dcb->cold->ip : &no_address;
+}
+
 int dcb_get_port(const DCB *dcb)
 {
     int rval = -1;
+    const struct sockaddr_storage *ip = dcb_get_ip(dcb);
 
-    if (dcb->ip.ss_family == AF_INET)
+    if (ip->ss_family == AF_INET)
     {
-        struct sockaddr_in* ip = (struct sockaddr_in*)&dcb->ip;
-        rval = ntohs(ip->sin_port);
+        rval = ntohs(((const struct sockaddr_in*)ip)->sin_port);
     }
-    else if (dcb->ip.ss_family == AF_INET6)
+    else if (ip->ss_family == AF_INET6)
     {
-        struct sockaddr_in6* ip = (struct sockaddr_in6*)&dcb->ip;
-        rval = ntohs(ip->sin6_port);
+        rval = ntohs(((const struct sockaddr_in6*)ip)->sin6_port);
     }
     else
     {
-        ss_dassert(dcb->ip.ss_family == AF_UNIX);
+        ss_dassert(ip->ss_family == AF_UNIX);
     }
 
     return rval;
 }
+
+/**
+ * Release the memory that the idle connections of the calling thread do not need
+ *
+ * A connection is idle when nothing has been read from it for
+ * idle_memory_timeout seconds and it has nothing to write. The read queue of
+ * an idle connection usually holds the start of a packet that was split from
+ * a large read, so it is copied into a buffer of its own size. Adaptive reads
+ * start again from the initial size when the connection becomes active.
+ */
+static void dcb_idle_memory_check(MXS_TIMER *timer, void *data)
+{
+    int id = current_thread_id;
+    long timeout = config_get_global_options()->idle_memory_timeout * 10;
+    DCB_IDLE_STATS *stats = &idle_stats[id];
+    int n_idle = 0;
+    int64_t idle_bytes = 0;
+
+    spinlock_acquire(&all_dcbs_lock[id]);
+
+    for (DCB *dcb = all_dcbs[id]; dcb; dcb = dcb->thread.next)
+    {
+        if ((dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER || dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER) &&
+            dcb->state == DCB_STATE_POLLING && !dcb->dcb_is_zombie && dcb->writeq == NULL &&
+            hkheartbeat - dcb->last_read >= timeout)
+        {
+            if (dcb->dcb_readqueue)
+            {
+                size_t released;
+                dcb->dcb_readqueue = gwbuf_shrink(dcb->dcb_readqueue, &released);
+
+                if (released)
+                {
+                    stats->n_shrinks++;
+                    stats->n_released += released;
+                }
+
+                idle_bytes += gwbuf_length(dcb->dcb_readqueue);
+            }
+
+            dcb->read_size = 0;
+            n_idle++;
+        }
+    }
+
+    spinlock_release(&all_dcbs_lock[id]);
+
+    stats->n_idle = n_idle;
+    stats->idle_bytes = idle_bytes;
+
+    mxs_timer_set(timer, timeout, dcb_idle_memory_check, NULL);
+}
+
+void dcb_idle_memory_thread_init()
+{
+    int seconds = config_get_global_options()->idle_memory_timeout;
+
+    if (seconds > 0 && idle_stats && current_thread_id >= 0 && current_thread_id < n_read_stats)
+    {
+        mxs_timer_set(&idle_memory_timer, seconds * 10, dcb_idle_memory_check, NULL);
+    }
+}
+
+void dShowDCBMemory(DCB *pdcb)
+{
+    int n_all = dcb_count_by_usage(DCB_USAGE_ALL);
+    int n_cold = n_cold_dcbs;
+    int64_t total = (int64_t)n_all * sizeof(DCB) + (int64_t)n_cold * sizeof(DCB_COLD);
+
+    dcb_printf(pdcb, "\nDCB memory.\n\n");
+    dcb_printf(pdcb, "Size of a DCB:                    %lu bytes\n", sizeof(DCB));
+    dcb_printf(pdcb, "Size of the part of client DCBs:  %lu bytes\n", sizeof(DCB_COLD));
+    dcb_printf(pdcb, "DCBs:                             %d\n", n_all);
+    dcb_printf(pdcb, "DCBs with a client part:          %d\n", n_cold);
+    dcb_printf(pdcb, "Total:                            %" PRId64 " bytes\n", total);
+    dcb_printf(pdcb, "Average per DCB:                  %" PRId64 " bytes\n",
+               n_all ? total / n_all : 0);
+
+    if (config_get_global_options()->idle_memory_timeout > 0)
+    {
+        int n_idle = 0;
+        int64_t idle_bytes = 0;
+        int64_t n_shrinks = 0;
+        int64_t n_released = 0;
+
+        for (int i = 0; i < n_read_stats; i++)
+        {
+            n_idle += idle_stats[i].n_idle;
+            idle_bytes += idle_stats[i].idle_bytes;
+            n_shrinks += idle_stats[i].n_shrinks;
+            n_released += idle_stats[i].n_released;
+        }
+
+        dcb_printf(pdcb, "Idle connections:                 %d\n", n_idle);
+        dcb_printf(pdcb, "Buffered by idle connections:     %" PRId64 " bytes\n", idle_bytes);
+        dcb_printf(pdcb, "Read queues shrunk:               %" PRId64 "\n", n_shrinks);
+        dcb_printf(pdcb, "Released from read queues:        %" PRId64 " bytes\n", n_released);
+    }
+}
@@ -23,6 +23,7 @@
  * @endverbatim
  */
 #include <maxscale/filter.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,7 @@
 #include "maxscale/filter.h"
 
 #include "maxscale/config.h"
+#include "maxscale/metrics.h"
 #include "maxscale/modules.h"
 
 static SPINLOCK filter_spin = SPINLOCK_INIT;    /**< Protects the list of all filters */
@@ -224,6 +226,103 @@ dprintAllFilters(DCB *dcb)
     spinlock_release(&filter_spin);
 }
 
+/**
+ * Print the name of the metric family of a filter metric. Characters that
+ * are not valid in a metric name are replaced with underscores.
+ */
+static void filter_metric_family(char *dest, size_t size, const char *module, const char *name)
+{
+    snprintf(dest, size, "maxscale_%s_%s", module, name);
+
+    for (char *p = dest; *p; p++)
+    {
+        if (!isalnum((unsigned char)*p) && *p != '_')
+        {
+            *p = '_';
+        }
+    }
+}
+
+/**
+ * Print the metrics of all filters
+ *
+ * The metrics of all instances of a module are collected first so that each
+ * metric family can be printed for all of the instances at once.
+ *
+ * @param dcb The DCB to print to
+ */
+void
+dprintAllFiltersMetrics(DCB *dcb)
+{
+    MXS_FILTER_DEF *ptr;
+    int n_filters = 0;
+
+    spinlock_acquire(&filter_spin);
+
+    for (ptr = allFilters; ptr; ptr = ptr->next)
+    {
+        n_filters++;
+    }
+
+    MXS_FILTER_DEF **defs = MXS_CALLOC(n_filters, sizeof(*defs));
+    MXS_FILTER_METRIC *metrics = MXS_CALLOC(n_filters * MXS_FILTER_MAX_METRICS, sizeof(*metrics));
+    int *n_metrics = MXS_CALLOC(n_filters, sizeof(*n_metrics));
+
+    if (defs && metrics && n_metrics)
+    {
+        int i = 0;
+
+        for (ptr = allFilters; ptr; ptr = ptr->next)
+        {
+            if (ptr->obj && ptr->filter && ptr->obj->getMetrics)
+            {
+                defs[i] = ptr;
+                n_metrics[i] = ptr->obj->getMetrics(ptr->filter, &metrics[i * MXS_FILTER_MAX_METRICS]);
+                ss_dassert(n_metrics[i] <= MXS_FILTER_MAX_METRICS);
+                i++;
+            }
+        }
+
+        n_filters = i;
+
+        for (i = 0; i < n_filters; i++)
+        {
+            bool printed = false;
+
+            for (int j = 0; j < i && !printed; j++)
+            {
+                printed = strcasecmp(defs[j]->module, defs[i]->module) == 0;
+            }
+
+            for (int m = 0; !printed && m < n_metrics[i]; m++)
+            {
+                MXS_FILTER_METRIC *metric = &metrics[i * MXS_FILTER_MAX_METRICS + m];
+                char family[200];
+                char sample[sizeof(family) + 6];
+
+                filter_metric_family(family, sizeof(family), defs[i]->module, metric->name);
+                snprintf(sample, sizeof(sample), "%s%s", family, metric->counter ? "_total" : "");
+                metrics_family(dcb, family, metric->counter ? "counter" : "gauge", NULL, metric->help);
+
+                for (int j = i; j < n_filters; j++)
+                {
+                    if (m < n_metrics[j] && strcasecmp(defs[j]->module, defs[i]->module) == 0)
+                    {
+                        metrics_sample(dcb, sample, "filter", defs[j]->name,
+                                       metrics[j * MXS_FILTER_MAX_METRICS + m].value);
+                    }
+                }
+            }
+        }
+    }
+
+    spinlock_release(&filter_spin);
+
+    MXS_FREE(defs);
+    MXS_FREE(metrics);
+    MXS_FREE(n_metrics);
+}
+
 /**
  * Print filter details to a DCB
  *
@@ -401,35 +500,33 @@ bool filter_load(MXS_FILTER_DEF* filter)
 /**
  * Connect the downstream filter chain for a filter.
  *
- * This will create the filter instance, loading the filter module, and
- * conenct the fitler into the downstream chain.
+ * This will create the filter session and connect the filter into the
+ * downstream chain. The chain is updated in place: the filter takes a copy of
+ * the component that follows it and then becomes the head of the chain, so no
+ * memory is allocated for the links of the chain.
  *
  * @param filter        The filter to add into the chain
  * @param session       The client session
- * @param downstream    The filter downstream of this filter
- * @return              The downstream component for the next filter or NULL
- *                      if the filter could not be created
+ * @param chain         The head of the chain, i.e. the component downstream of
+ *                      this filter, which is replaced with the filter
+ * @return              True if the filter session could be created
  */
-MXS_DOWNSTREAM *
-filter_apply(MXS_FILTER_DEF *filter, MXS_SESSION *session, MXS_DOWNSTREAM *downstream)
+bool
+filter_apply(MXS_FILTER_DEF *filter, MXS_SESSION *session, MXS_DOWNSTREAM *chain)
 {
-    MXS_DOWNSTREAM *me;
+    MXS_DOWNSTREAM me;
 
-    if ((me = (MXS_DOWNSTREAM *)MXS_CALLOC(1, sizeof(MXS_DOWNSTREAM))) == NULL)
-    {
-        return NULL;
-    }
-    me->instance = filter->filter;
-    me->routeQuery = (void *)(filter->obj->routeQuery);
+    me.instance = filter->filter;
+    me.routeQuery = (void *)(filter->obj->routeQuery);
 
-    if ((me->session = filter->obj->newSession(me->instance, session)) == NULL)
+    if ((me.session = filter->obj->newSession(me.instance, session)) == NULL)
     {
-        MXS_FREE(me);
-        return NULL;
+        return false;
     }
-    filter->obj->setDownstream(me->instance, me->session, downstream);
+    filter->obj->setDownstream(me.instance, me.session, chain);
+    *chain = me;
 
-    return me;
+    return true;
 }
 
 /**
@@ -442,33 +539,35 @@ filter_apply(MXS_FILTER_DEF *filter, MXS_SESSION *session, MXS_DOWNSTREAM *downs
  *
  * @param filter        The fitler to add to the chain
  * @param fsession      The filter session
- * @param upstream      The filter that should be upstream of this filter
- * @return              The upstream component for the next filter
+ * @param chain         The tail of the chain, i.e. the component upstream of
+ *                      this filter, which is replaced with the filter
+ * @return              False if the filter has an upstream but no clientReply
  */
-MXS_UPSTREAM *
-filter_upstream(MXS_FILTER_DEF *filter, void *fsession, MXS_UPSTREAM *upstream)
+bool
+filter_upstream(MXS_FILTER_DEF *filter, void *fsession, MXS_UPSTREAM *chain)
 {
-    MXS_UPSTREAM *me = NULL;
-
     /*
      * The the filter has no setUpstream entry point then is does
      * not require to see results and can be left out of the chain.
      */
     if (filter->obj->setUpstream == NULL)
     {
-        return upstream;
+        return true;
     }
 
-    if (filter->obj->clientReply != NULL)
+    if (filter->obj->clientReply == NULL)
     {
-        if ((me = (MXS_UPSTREAM *)MXS_CALLOC(1, sizeof(MXS_UPSTREAM))) == NULL)
-        {
-            return NULL;
-        }
-        me->instance = filter->filter;
-        me->session = fsession;
-        me->clientReply = (void *)(filter->obj->clientReply);
-        filter->obj->setUpstream(me->instance, me->session, upstream);
+        return false;
     }
-    return me;
+
+    MXS_UPSTREAM me;
+
+    me.instance = filter->filter;
+    me.session = fsession;
+    me.clientReply = (void *)(filter->obj->clientReply);
+    me.error = NULL;
+    filter->obj->setUpstream(me.instance, me.session, chain);
+    *chain = me;
+
+    return true;
 }
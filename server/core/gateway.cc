@@ -40,6 +40,7 @@
 #include <execinfo.h>
 #include <ftw.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -70,12 +71,15 @@
 #include <maxscale/random_jkiss.h>
 
 #include "maxscale/config.h"
+#include "maxscale/handoff.h"
 #include "maxscale/maxscale.h"
+#include "maxscale/metrics.h"
 #include "maxscale/modules.h"
 #include "maxscale/monitor.h"
 #include "maxscale/poll.h"
 #include "maxscale/service.h"
 #include "maxscale/statistics.h"
+#include "maxscale/trace.h"
 
 #define STRING_BUFFER_SIZE 1024
 #define PIDFD_CLOSED -1
@@ -146,6 +150,17 @@ static bool maxlog_configured = false;
 static bool log_to_shm_configured = false;
 static volatile sig_atomic_t  last_signal = 0;
 
+#define MAX_STARTUP_PHASES 10
+
+/** How long each phase of the startup took */
+static struct
+{
+    const char* name;
+    uint64_t    ms;
+} startup_phases[MAX_STARTUP_PHASES];
+static int startup_nphases = 0;
+static uint64_t startup_phase_start = 0;
+
 static int cnf_preparser(void* data, const char* section, const char* name, const char* value);
 static void log_flush_shutdown(void);
 static void log_flush_cb(void* arg);
@@ -188,6 +203,9 @@ static bool modules_process_init();
 static void modules_process_finish();
 static bool modules_thread_init();
 static void modules_thread_finish();
+static uint64_t startup_clock_ms();
+static void startup_phase_end(const char* name);
+static void startup_phases_log();
 
 #ifndef OPENSSL_1_1
 /** SSL multi-threading functions and structures */
@@ -425,6 +443,7 @@ sigfatal_handler(int i)
         MXS_FREE(symbols);
     }
 
+    mxs_trace_log_thread();
     mxs_log_flush_sync();
 
     /* re-raise signal to enforce core dump */
@@ -1324,6 +1343,7 @@ int main(int argc, char **argv)
     MXS_CONFIG* cnf = NULL;
     int numlocks = 0;
     bool pid_file_created = false;
+    bool handed_off = false;
 
     *syslog_enabled = 1;
     *maxlog_enabled = 1;
@@ -1884,6 +1904,8 @@ int main(int argc, char **argv)
     MXS_NOTICE("Module directory: %s", get_libdir());
     MXS_NOTICE("Service cache: %s", get_cachedir());
 
+    startup_phase_start = startup_clock_ms();
+
     if (!config_load(cnf_file_path))
     {
         const char* fprerr =
@@ -1899,6 +1921,7 @@ int main(int argc, char **argv)
 
     cnf = config_get_global_options();
     ss_dassert(cnf);
+    startup_phase_end("configuration");
 
     if (!qc_setup(cnf->qc_name, cnf->qc_args))
     {
@@ -1910,7 +1933,10 @@ int main(int argc, char **argv)
 
     cnf->config_check = config_check;
 
-    if (!config_check)
+    /** A running MaxScale hands its listening sockets and PID file over */
+    handed_off = !config_check && cnf->handoff_socket && handoff_receive(cnf->handoff_socket);
+
+    if (!config_check && !handed_off)
     {
         /** Check if a MaxScale process is already running */
         if (pid_file_exists())
@@ -1939,6 +1965,7 @@ int main(int argc, char **argv)
     poll_init();
 
     dcb_global_init();
+    startup_phase_end("initialization");
 
     /* Initialize the internal query classifier. The plugin will be initialized
      * via the module initialization below.
@@ -1958,11 +1985,15 @@ int main(int argc, char **argv)
         goto return_main;
     }
 
+    startup_phase_end("modules");
+
     /** Start all monitors */
     monitorStartAll();
+    startup_phase_end("monitors");
 
     /** Start the services that were created above */
     n_services = service_launch_all();
+    startup_phase_end("services");
 
     if (n_services == 0)
     {
@@ -2003,6 +2034,36 @@ int main(int argc, char **argv)
         goto return_main;
     }
 
+    if (cnf->statistics_segment &&
+        !metrics_segment_start(cnf->statistics_segment, cnf->statistics_segment_interval))
+    {
+        const char* logerr = "Failed to create the statistics segment.";
+        print_log_n_stderr(true, true, logerr, logerr, 0);
+        rc = MAXSCALE_INTERNALERROR;
+        goto return_main;
+    }
+
+    if (handed_off)
+    {
+        /** The previous process no longer accepts, so the PID file can be taken over */
+        if (handoff_complete() && write_pid_file() == 0)
+        {
+            pid_file_created = true;
+        }
+        else
+        {
+            MXS_WARNING("The PID file was not written, as the previous process still holds it.");
+        }
+    }
+
+    if (cnf->handoff_socket && !handoff_start(cnf->handoff_socket, cnf->handoff_drain_timeout))
+    {
+        const char* logerr = "Failed to create the handoff socket.";
+        print_log_n_stderr(true, true, logerr, logerr, 0);
+        rc = MAXSCALE_INTERNALERROR;
+        goto return_main;
+    }
+
     /*<
      * Start the polling threads, note this is one less than is
      * configured as the main thread will also poll.
@@ -2024,7 +2085,9 @@ int main(int argc, char **argv)
         }
     }
 
+    startup_phase_end("threads");
     MXS_NOTICE("MaxScale started with %d server threads.", config_threadcount());
+    startup_phases_log();
     /**
      * Successful start, notify the parent process that it can exit.
      */
@@ -2043,6 +2106,8 @@ int main(int argc, char **argv)
      * Wait for the housekeeper to finish.
      */
     hkfinish();
+    metrics_segment_stop();
+    handoff_finish();
 
     /*<
      * Wait server threads' completion.
@@ -2178,9 +2243,17 @@ static void unlock_pidfile()
             print_log_n_stderr(true, true, logbuf, logbuf, errno);
         }
         close(pidfd);
+        pidfd = PIDFD_CLOSED;
     }
 }
 
+void maxscale_release_pidfile()
+{
+    unlock_pidfile();
+    /** The file now belongs to the new process */
+    pidfile[0] = '\0';
+}
+
 /**
  * Unlink pid file, called at program exit
  */
@@ -2991,3 +3064,53 @@ static void modules_thread_finish()
         }
     }
 }
+
+/**
+ * @brief Get a monotonic timestamp in milliseconds
+ *
+ * @return The current time in milliseconds
+ */
+static uint64_t startup_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * End the current phase of the startup and begin the next one
+ *
+ * @param name Name of the phase that ended
+ */
+static void startup_phase_end(const char* name)
+{
+    uint64_t now = startup_clock_ms();
+
+    if (startup_nphases < MAX_STARTUP_PHASES)
+    {
+        startup_phases[startup_nphases].name = name;
+        startup_phases[startup_nphases].ms = now - startup_phase_start;
+        startup_nphases++;
+    }
+
+    startup_phase_start = now;
+}
+
+/**
+ * Log how long the startup took in total and in each phase
+ */
+static void startup_phases_log()
+{
+    char buf[STRING_BUFFER_SIZE] = "";
+    size_t len = 0;
+    uint64_t total = 0;
+
+    for (int i = 0; i < startup_nphases && len < sizeof(buf); i++)
+    {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%s %" PRIu64 "ms", i ? ", " : "",
+                        startup_phases[i].name, startup_phases[i].ms);
+        total += startup_phases[i].ms;
+    }
+
+    MXS_NOTICE("Startup took %" PRIu64 " milliseconds: %s", total, buf);
+}
@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file handoff.c Handing the listening sockets over to a new process
+ *
+ * The messages are exchanged over a SOCK_SEQPACKET socket, so that each
+ * message, and the socket passed with it, is received as a unit.
+ */
+
+#include "maxscale/handoff.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/thread.h>
+
+#include "maxscale/maxscale.h"
+#include "maxscale/service.h"
+
+/** The maximum length of a message */
+#define HANDOFF_MSG_MAX (sizeof(HANDOFF_MSG_FD) + HANDOFF_KEY_MAX)
+
+/** Seconds the new process waits for a reply from the previous process */
+#define HANDOFF_TIMEOUT 30
+
+/** The name of the housekeeper task that waits for the sessions to end */
+#define HANDOFF_DRAIN_TASK "handoff_drain"
+
+/** A listening socket received from the previous process */
+typedef struct handoff_fd
+{
+    char key[HANDOFF_KEY_MAX];
+    int  fd;
+} HANDOFF_FD;
+
+/** The sockets received by this process, used only by the main thread at startup */
+static struct
+{
+    int         conn;  /**< Connection to the previous process */
+    HANDOFF_FD *fds;   /**< The received sockets */
+    int         n_fds; /**< Number of received sockets */
+} received = {.conn = -1};
+
+/** The state of the handoff socket of this process */
+static struct
+{
+    int    fd;            /**< The handoff socket */
+    int    drain_timeout; /**< Seconds after which the remaining sessions are closed */
+    time_t drain_start;   /**< When the listeners were handed over */
+    bool   closed;        /**< Whether the listener sockets have been closed */
+    THREAD thread;        /**< The thread waiting for a new process */
+} control = {.fd = -1};
+
+void handoff_key(char *dest, const char *config, int shard)
+{
+    snprintf(dest, HANDOFF_KEY_MAX, "%s#%d", config, shard);
+}
+
+/**
+ * Send a message
+ *
+ * @param conn The connection
+ * @param msg  The message
+ * @param fd   Socket to pass with the message or -1
+ *
+ * @return True if the message was sent
+ */
+static bool send_msg(int conn, const char *msg, int fd)
+{
+    struct iovec iov = {.iov_base = (void*)msg, .iov_len = strlen(msg)};
+    struct msghdr hdr = {.msg_iov = &iov, .msg_iovlen = 1};
+    char cbuf[CMSG_SPACE(sizeof(int))];
+
+    if (fd != -1)
+    {
+        memset(cbuf, 0, sizeof(cbuf));
+        hdr.msg_control = cbuf;
+        hdr.msg_controllen = sizeof(cbuf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t rc;
+
+    while ((rc = sendmsg(conn, &hdr, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    {
+    }
+
+    if (rc == -1)
+    {
+        MXS_ERROR("Failed to send a handoff message: %d, %s", errno, mxs_strerror(errno));
+    }
+
+    return rc != -1;
+}
+
+/**
+ * Receive a message
+ *
+ * @param conn The connection
+ * @param msg  Buffer of HANDOFF_MSG_MAX bytes for the null terminated message
+ * @param fd   The socket passed with the message is stored here, -1 if there was none
+ *
+ * @return True if a message was received
+ */
+static bool recv_msg(int conn, char *msg, int *fd)
+{
+    struct iovec iov = {.iov_base = msg, .iov_len = HANDOFF_MSG_MAX - 1};
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr hdr = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = cbuf, .msg_controllen = sizeof(cbuf)};
+    ssize_t rc;
+
+    *fd = -1;
+
+    while ((rc = recvmsg(conn, &hdr, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+    {
+    }
+
+    if (rc <= 0)
+    {
+        if (rc == -1)
+        {
+            MXS_ERROR("Failed to receive a handoff message: %d, %s", errno, mxs_strerror(errno));
+        }
+        return false;
+    }
+
+    msg[rc] = '\0';
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+        {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Set the address of the handoff socket
+ *
+ * @return True if the path fits in the address
+ */
+static bool handoff_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        MXS_ERROR("The path '%s' of the handoff socket is too long. The maximum length is %lu.",
+                  path, sizeof(addr->sun_path) - 1);
+        return false;
+    }
+
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static void close_received_fds()
+{
+    for (int i = 0; i < received.n_fds; i++)
+    {
+        if (received.fds[i].fd != -1)
+        {
+            close(received.fds[i].fd);
+        }
+    }
+
+    MXS_FREE(received.fds);
+    received.fds = NULL;
+    received.n_fds = 0;
+}
+
+bool handoff_receive(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (!handoff_address(&addr, path))
+    {
+        return false;
+    }
+
+    int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (conn == -1 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        /** No MaxScale is running, which is the normal case */
+        MXS_INFO("No process to take the listeners over from at '%s': %d, %s",
+                 path, errno, mxs_strerror(errno));
+
+        if (conn != -1)
+        {
+            close(conn);
+        }
+        return false;
+    }
+
+    struct timeval tv = {.tv_sec = HANDOFF_TIMEOUT};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    bool ok = send_msg(conn, HANDOFF_MSG_REQUEST, -1);
+    bool done = false;
+    char msg[HANDOFF_MSG_MAX];
+    int fd;
+
+    while (ok && !done && (ok = recv_msg(conn, msg, &fd)))
+    {
+        if (strcmp(msg, HANDOFF_MSG_END) == 0)
+        {
+            done = true;
+        }
+        else if (strncmp(msg, HANDOFF_MSG_FD, sizeof(HANDOFF_MSG_FD) - 1) == 0 && fd != -1)
+        {
+            HANDOFF_FD *fds = MXS_REALLOC(received.fds, (received.n_fds + 1) * sizeof(HANDOFF_FD));
+
+            if (fds)
+            {
+                received.fds = fds;
+                snprintf(fds[received.n_fds].key, HANDOFF_KEY_MAX, "%s", msg + sizeof(HANDOFF_MSG_FD) - 1);
+                fds[received.n_fds++].fd = fd;
+            }
+            else
+            {
+                close(fd);
+                ok = false;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Unexpected handoff message: %s", msg);
+
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            ok = false;
+        }
+    }
+
+    if (!ok || !done)
+    {
+        MXS_ERROR("Failed to take the listeners over from the process at '%s'.", path);
+        close_received_fds();
+        close(conn);
+        return false;
+    }
+
+    MXS_NOTICE("Received %d listening sockets from the process at '%s'.", received.n_fds, path);
+    received.conn = conn;
+
+    return true;
+}
+
+int handoff_take_fd(const char *key)
+{
+    for (int i = 0; i < received.n_fds; i++)
+    {
+        if (received.fds[i].fd != -1 && strcmp(received.fds[i].key, key) == 0)
+        {
+            int fd = received.fds[i].fd;
+            received.fds[i].fd = -1;
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+bool handoff_complete()
+{
+    ss_dassert(received.conn != -1);
+
+    /** The sockets of removed listeners and of threads this process does not have */
+    close_received_fds();
+
+    char msg[HANDOFF_MSG_MAX];
+    int fd;
+    bool ok = send_msg(received.conn, HANDOFF_MSG_READY, -1) &&
+              recv_msg(received.conn, msg, &fd) && strcmp(msg, HANDOFF_MSG_DONE) == 0;
+
+    close(received.conn);
+    received.conn = -1;
+
+    if (ok)
+    {
+        MXS_NOTICE("The previous process has stopped accepting connections.");
+    }
+    else
+    {
+        MXS_ERROR("The previous process did not confirm that it stopped accepting connections.");
+    }
+
+    return ok;
+}
+
+/**
+ * Housekeeper task that shuts the process down once the sessions have ended
+ */
+static void handoff_drain(void *data)
+{
+    if (!control.closed)
+    {
+        /** Events of the listeners were processed when they were stopped a moment ago */
+        service_close_all_listeners();
+        control.closed = true;
+    }
+
+    int n = service_client_count();
+
+    if (n == 0)
+    {
+        MXS_NOTICE("All sessions have ended, shutting down.");
+        hktask_remove(HANDOFF_DRAIN_TASK);
+        maxscale_shutdown();
+    }
+    else if (control.drain_timeout && time(NULL) - control.drain_start >= control.drain_timeout)
+    {
+        MXS_NOTICE("Closing %d sessions that did not end within %d seconds, shutting down.",
+                   n, control.drain_timeout);
+        hktask_remove(HANDOFF_DRAIN_TASK);
+        maxscale_shutdown();
+    }
+}
+
+static bool send_listener(const char *key, int fd, void *data)
+{
+    char msg[HANDOFF_MSG_MAX];
+    snprintf(msg, sizeof(msg), "%s%s", HANDOFF_MSG_FD, key);
+    return send_msg(*(int*)data, msg, fd);
+}
+
+/**
+ * Hand the listeners over to the process at the other end of a connection
+ *
+ * @param conn The connection
+ *
+ * @return True if the new process took the listeners over
+ */
+static bool handoff_send(int conn)
+{
+    char msg[HANDOFF_MSG_MAX];
+    int fd;
+
+    if (!recv_msg(conn, msg, &fd) || strcmp(msg, HANDOFF_MSG_REQUEST) != 0)
+    {
+        MXS_WARNING("Ignoring an invalid handoff request.");
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    MXS_NOTICE("A new process is taking the listeners over.");
+
+    if (!service_for_each_listener_socket(send_listener, &conn) ||
+        !send_msg(conn, HANDOFF_MSG_END, -1))
+    {
+        return false;
+    }
+
+    /** The new process replies once it has started its services */
+    if (!recv_msg(conn, msg, &fd) || strcmp(msg, HANDOFF_MSG_READY) != 0)
+    {
+        MXS_WARNING("The new process did not take the listeners over, continuing normally.");
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    service_stop_all_listeners();
+    maxscale_release_pidfile();
+    send_msg(conn, HANDOFF_MSG_DONE, -1);
+
+    control.drain_start = time(NULL);
+    hktask_add(HANDOFF_DRAIN_TASK, handoff_drain, NULL, 1);
+    MXS_NOTICE("Handed the listeners over to the new process, waiting for %d sessions to end.",
+               service_client_count());
+
+    return true;
+}
+
+static void handoff_main(void *data)
+{
+    bool handed_off = false;
+
+    while (!handed_off)
+    {
+        int conn = accept4(control.fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (conn == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            /** The socket was shut down by handoff_finish() */
+            break;
+        }
+
+        handed_off = handoff_send(conn);
+        close(conn);
+    }
+}
+
+bool handoff_start(const char *path, int drain_timeout)
+{
+    struct sockaddr_un addr;
+
+    if (!handoff_address(&addr, path))
+    {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    /** The socket of a previous process is replaced, it no longer needs it */
+    if (fd == -1 || (unlink(path) == -1 && errno != ENOENT) ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        chmod(path, S_IRUSR | S_IWUSR) == -1 || listen(fd, 1) == -1)
+    {
+        MXS_ERROR("Failed to create the handoff socket '%s': %d, %s",
+                  path, errno, mxs_strerror(errno));
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    control.fd = fd;
+    control.drain_timeout = drain_timeout;
+
+    if (thread_start(&control.thread, handoff_main, NULL) == NULL)
+    {
+        MXS_ERROR("Failed to start the handoff thread.");
+        close(fd);
+        control.fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void handoff_finish()
+{
+    if (control.fd != -1)
+    {
+        /** Wakes up the thread waiting in accept() */
+        shutdown(control.fd, SHUT_RDWR);
+        thread_wait(control.thread);
+        close(control.fd);
+        control.fd = -1;
+    }
+}
@@ -31,6 +31,10 @@
  * The housekeeper also maintains a global variable, hkheartbeat, that
  * is incremented every 100ms.
  *
+ * The tasks are kept in a list that is scanned every second, so the
+ * housekeeper is meant for global jobs. Timeouts of individual sessions
+ * and DCBs use the timer wheels of the polling threads, see timer.h.
+ *
  * @verbatim
  * Revision History
  *
@@ -40,6 +40,9 @@
 #include <maxscale/users.h>
 #include <maxscale/service.h>
 
+/** The session ID context, sessions are only resumed within the same context */
+static const unsigned char ssl_session_id_context[] = "MaxScale";
+
 static RSA *rsa_512 = NULL;
 static RSA *rsa_1024 = NULL;
 
@@ -128,6 +131,8 @@ listener_alloc(struct service* service, const char* name, const char *protocol,
     proto->authenticator = my_authenticator;
     proto->auth_options = my_auth_options;
     proto->ssl = ssl;
+    proto->reuseport = false;
+    proto->sockopts = (MXS_SOCKET_OPTS)MXS_SOCKET_OPTS_INIT;
     proto->users = NULL;
     proto->next = NULL;
     proto->auth_instance = auth_instance;
@@ -290,6 +295,17 @@ listener_init_SSL(SSL_LISTENER *ssl_listener)
         /** Disable SSLv3 */
         SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_NO_SSLv3);
 
+#ifdef SSL_OP_ENABLE_KTLS
+        /** Let the kernel encrypt and decrypt the records if it supports the cipher */
+        SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+        /** Let clients resume their sessions with session IDs or tickets. The
+         * context must be set for sessions with verified peers to be resumed. */
+        SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(ssl_listener->ctx, ssl_session_id_context,
+                                       sizeof(ssl_session_id_context) - 1);
+
         /** Generate the 512-bit and 1024-bit RSA keys */
         if (rsa_512 == NULL && (rsa_512 = create_rsa(512)) == NULL)
         {
@@ -428,6 +444,13 @@ static bool create_listener_config(const SERV_LISTENER *listener, const char *fi
         dprintf(file, "authenticator_options=%s\n", listener->auth_options);
     }
 
+    if (listener->reuseport)
+    {
+        dprintf(file, "reuseport=true\n");
+    }
+
+    write_socket_opts_config(file, &listener->sockopts);
+
     if (listener->ssl)
     {
         write_ssl_config(file, listener->ssl);
@@ -36,6 +36,7 @@
 #include <dlfcn.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/probe.h>
 #include <maxscale/version.h>
 #include <maxscale/notification.h>
 #include <curl/curl.h>
@@ -212,6 +213,7 @@ void *load_module(const char *module, const char *type)
         }
 
         MXS_NOTICE("Loaded module %s: %s from %s", module, mod_info->version, fname);
+        MXS_PROBE2(module_load, module, fname);
     }
 
     return mod->modobj;
@@ -31,6 +31,7 @@
 #include <maxscale/config.h>
 #include <maxscale/debug.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/shardedhash.h>
 #include <maxscale/platform.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
@@ -158,7 +159,22 @@ static logmanager_t* lm;
 static bool flushall_flag;
 static bool flushall_started_flag;
 static bool flushall_done_flag;
-static HASHTABLE* message_stats;
+static SHARDEDHASH* message_stats;
+
+/**
+ * The block buffers of the current thread. The buffers belong to the log
+ * manager they were created for and are freed when it is shut down, so they
+ * are valid only while the generation matches lm_generation. The file
+ * writer uses the shared buffers, as it would otherwise wait for itself
+ * if it filled its own.
+ */
+static int lm_generation;
+static thread_local struct
+{
+    struct thread_blockbufs* tb;
+    int                      generation;
+    bool                     filewriter;
+} this_thread;
 
 /** This is used to detect if the initialization of the log manager has failed
  * and that it isn't initialized again after a failure has occurred. */
@@ -338,12 +354,29 @@ typedef struct blockbuf
     size_t         bb_buf_size;
     size_t         bb_buf_left;
     size_t         bb_buf_used;
+    uint64_t       bb_seq;      /**< When the owning thread filled the buffer */
     char           bb_buf[MAX_LOGSTRLEN];
 #if defined(SS_DEBUG)
     skygw_chk_t    bb_chk_tail;
 #endif
 } blockbuf_t;
 
+#define NTHREADBLOCKBUFS 2
+
+/**
+ * The block buffers of a single thread. Only the owning thread writes to the
+ * buffers, so it needs no lock; a buffer is handed to the file writer by
+ * marking it full and taken back when the file writer has cleared it. While
+ * the file writer writes one buffer the thread continues with the other.
+ */
+typedef struct thread_blockbufs
+{
+    blockbuf_t*              tb_bufs[NTHREADBLOCKBUFS];
+    int                      tb_current; /**< The buffer written to, only used by the owner */
+    uint64_t                 tb_nfull;   /**< How many times the owner has filled a buffer */
+    struct thread_blockbufs* tb_next;
+} thread_blockbufs_t;
+
 /**
  * logfile object corresponds to physical file(s) where
  * certain log is written.
@@ -366,6 +399,8 @@ struct logfile
     char*            lf_full_link_name; /**< complete symlink name */
     /** list of block-sized log buffers */
     mlist_t          lf_blockbuf_list;
+    /** per-thread block buffers, only ever added to while logging */
+    thread_blockbufs_t* lf_thread_blockbufs;
     size_t           lf_buf_size;
     bool             lf_flushflag;
     bool             lf_rotateflag;
@@ -462,8 +497,12 @@ static char* blockbuf_get_writepos(blockbuf_t** p_bb,
                                    size_t       str_len,
                                    bool         flush);
 
+static char* thread_blockbuf_get_writepos(blockbuf_t** p_bb,
+                                          size_t       str_len,
+                                          bool         flush);
 static void blockbuf_register(blockbuf_t* bb);
 static void blockbuf_unregister(blockbuf_t* bb);
+static void blockbuf_free(blockbuf_t* bb);
 static char* add_slash(char* str);
 
 static bool check_file_and_path(const char* filename, bool* writable);
@@ -491,6 +530,7 @@ static bool logmanager_init_nomutex(const char* ident,
     }
 
     lm->lm_target = (target == MXS_LOG_TARGET_DEFAULT ? MXS_LOG_TARGET_FS : target);
+    lm_generation++;
 #if defined(SS_DEBUG)
     lm->lm_chk_top   = CHK_NUM_LOGMANAGER;
     lm->lm_chk_tail  = CHK_NUM_LOGMANAGER;
@@ -604,24 +644,26 @@ bool mxs_log_init(const char* ident, const char* logdir, mxs_log_target_t target
     {
         ss_dassert(!message_stats);
 
-        message_stats = hashtable_alloc(LM_MESSAGE_HASH_SIZE,
-                                        lm_message_key_hash,
-                                        lm_message_key_cmp);
+        // Every thread that logs looks up the table, so it is sharded to
+        // keep the threads from contending on a single lock.
+        message_stats = shardedhash_alloc(0, LM_MESSAGE_HASH_SIZE,
+                                          lm_message_key_hash,
+                                          lm_message_key_cmp);
         if (message_stats)
         {
             // As entries are added to the hashtable they will be cloned,
             // so stack allocated keys and values are ok.
-            hashtable_memory_fns(message_stats,
-                                 lm_message_key_clone,
-                                 lm_message_stats_clone,
-                                 hashtable_item_free,
-                                 hashtable_item_free);
+            shardedhash_memory_fns(message_stats,
+                                   lm_message_key_clone,
+                                   lm_message_stats_clone,
+                                   hashtable_item_free,
+                                   hashtable_item_free);
 
             succ = logmanager_init_nomutex(ident, logdir, target, log_config.do_maxlog);
 
             if (!succ)
             {
-                hashtable_free(message_stats);
+                shardedhash_free(message_stats);
                 message_stats = NULL;
             }
         }
@@ -680,7 +722,7 @@ static void logmanager_done_nomutex(void)
     MXS_FREE(lm);
     lm = NULL;
 
-    hashtable_free(message_stats);
+    shardedhash_free(message_stats);
     message_stats = NULL;
 }
 
@@ -833,8 +875,14 @@ static int logmanager_write_log(int            priority,
     /** Book space for log string from buffer */
     if (do_maxlog)
     {
-        // All messages are now logged to the error log file.
-        wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        // All messages are now logged to the error log file. The shared
+        // buffers are used only if the thread has no buffers of its own.
+        wp = thread_blockbuf_get_writepos(&bb, safe_str_len, flush);
+
+        if (wp == NULL)
+        {
+            wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        }
     }
     else
     {
@@ -871,10 +919,15 @@ static int logmanager_write_log(int            priority,
      * Write next string to overwrite terminating null character
      * of the timestamp string.
      */
-    snprintf(wp + timestamp_len,
-             safe_str_len - timestamp_len,
-             "%s",
-             str);
+    size_t copy_len = safe_str_len - timestamp_len - 1;
+
+    if (copy_len >= str_len)
+    {
+        copy_len = str_len - 1; // The trailing NULL of str is not copied.
+    }
+
+    memcpy(wp + timestamp_len, str, copy_len);
+    wp[timestamp_len + copy_len] = '\0';
 
     /** Add an ellipsis to an overflowing message to signal truncation. */
     if (overflow && safe_str_len > 4)
@@ -1240,6 +1293,147 @@ static void blockbuf_node_done(void* bb_data)
     simple_mutex_done(&bb->bb_mutex);
 }
 
+static void blockbuf_free(blockbuf_t* bb)
+{
+    if (bb)
+    {
+        blockbuf_node_done(bb);
+        MXS_FREE(bb);
+    }
+}
+
+/**
+ * Get the block buffers of the current thread, creating them if the thread
+ * has not logged since the log manager was initialized.
+ *
+ * @param lf  The logfile
+ *
+ * @return The buffers of the thread or NULL if they could not be allocated
+ */
+static thread_blockbufs_t* thread_blockbufs_get(logfile_t* lf)
+{
+    if (this_thread.generation != lm_generation)
+    {
+        this_thread.generation = lm_generation;
+        this_thread.tb = NULL;
+
+        thread_blockbufs_t* tb = (thread_blockbufs_t*)MXS_CALLOC(1, sizeof(thread_blockbufs_t));
+
+        if (tb == NULL)
+        {
+            return NULL;
+        }
+
+        for (int i = 0; i < NTHREADBLOCKBUFS; i++)
+        {
+            if ((tb->tb_bufs[i] = blockbuf_init()) == NULL)
+            {
+                for (int j = 0; j < i; j++)
+                {
+                    blockbuf_free(tb->tb_bufs[j]);
+                }
+
+                MXS_FREE(tb);
+                return NULL;
+            }
+        }
+
+        /** The file writer only follows the list, so a push needs no lock */
+        do
+        {
+            tb->tb_next = lf->lf_thread_blockbufs;
+        }
+        while (!atomic_cas_ptr((void**)&lf->lf_thread_blockbufs, tb->tb_next, tb));
+
+        this_thread.tb = tb;
+    }
+
+    return this_thread.tb;
+}
+
+/**
+ * Hand a buffer of the current thread over to the file writer. The thread
+ * must be registered to the buffer.
+ */
+static void thread_blockbuf_set_full(thread_blockbufs_t* tb, blockbuf_t* bb)
+{
+    bb->bb_seq = ++tb->tb_nfull;
+    atomic_synchronize();
+    bb->bb_state = BB_FULL;
+}
+
+/**
+ * Reserve space for a log string from the block buffers of the current
+ * thread. Only the thread itself and the file writer access the buffers, and
+ * they synchronize with the reference count of the buffer: the thread
+ * registers before checking that the buffer is ready and the file writer
+ * marks the buffer full before waiting for the registrations to end.
+ *
+ * @param p_bb     On return, the buffer the thread is registered to
+ * @param str_len  The length of the log string
+ * @param flush    Whether the buffer should be written after this string
+ *
+ * @return The write position or NULL if the thread has no buffers
+ */
+static char* thread_blockbuf_get_writepos(blockbuf_t** p_bb,
+                                          size_t       str_len,
+                                          bool         flush)
+{
+    logfile_t* lf = &lm->lm_logfile;
+    thread_blockbufs_t* tb = this_thread.filewriter ? NULL : thread_blockbufs_get(lf);
+
+    if (tb == NULL)
+    {
+        return NULL;
+    }
+
+    blockbuf_t* bb = tb->tb_bufs[tb->tb_current];
+    blockbuf_register(bb);
+
+    if (bb->bb_state != BB_READY || bb->bb_buf_left < str_len)
+    {
+        if (bb->bb_state == BB_READY)
+        {
+            thread_blockbuf_set_full(tb, bb);
+        }
+
+        /** Wakes up the file writer if the buffer is full */
+        blockbuf_unregister(bb);
+
+        tb->tb_current = (tb->tb_current + 1) % NTHREADBLOCKBUFS;
+        bb = tb->tb_bufs[tb->tb_current];
+        blockbuf_register(bb);
+
+        while (bb->bb_state != BB_READY)
+        {
+            /** All buffers of the thread wait for the file writer */
+            blockbuf_unregister(bb);
+
+            while (bb->bb_state != BB_READY)
+            {
+                pthread_yield();
+            }
+
+            blockbuf_register(bb);
+        }
+
+        /** A buffer becomes ready again only after it has been cleared */
+        ss_dassert(bb->bb_buf_left >= str_len);
+    }
+
+    char* pos = &bb->bb_buf[bb->bb_buf_used];
+    bb->bb_buf_used += str_len;
+    bb->bb_buf_left -= str_len;
+
+    if (flush)
+    {
+        thread_blockbuf_set_full(tb, bb);
+    }
+
+    *p_bb = bb;
+    return pos;
+}
+
 
 static blockbuf_t* blockbuf_init()
 {
@@ -1872,6 +2066,7 @@ static bool logfile_init(logfile_t*    logfile,
     logfile->lf_spinlock = 0;
     logfile->lf_store_shmem = store_shmem;
     logfile->lf_buf_size = MAX_LOGSTRLEN;
+    logfile->lf_thread_blockbufs = NULL;
     /**
      * If file is stored in shared memory in /dev/shm, a link
      * pointing to shm file is created and located to the file
@@ -1974,6 +2169,19 @@ static void logfile_done(logfile_t* lf)
         {
             mlist_done(&lf->lf_blockbuf_list);
         }
+
+        while (lf->lf_thread_blockbufs)
+        {
+            thread_blockbufs_t* tb = lf->lf_thread_blockbufs;
+            lf->lf_thread_blockbufs = tb->tb_next;
+
+            for (int i = 0; i < NTHREADBLOCKBUFS; i++)
+            {
+                blockbuf_free(tb->tb_bufs[i]);
+            }
+
+            MXS_FREE(tb);
+        }
         logfile_free_memory(lf);
         lf->lf_state = DONE;
     /** fallthrough */
@@ -2119,6 +2327,106 @@ static void filewriter_done(filewriter_t* fw, bool write_footer)
     }
 }
 
+/**
+ * Write the contents of a block buffer to the log file and clear the buffer.
+ * No client may be registered to the buffer.
+ *
+ * @param lf     The logfile
+ * @param file   The file to write to
+ * @param bb     The block buffer
+ * @param flush  Whether the file should be flushed
+ * @param state  The state of the buffer once it has been cleared
+ */
+static void blockbuf_write(logfile_t* lf, skygw_file_t* file, blockbuf_t* bb,
+                           bool flush, blockbuf_state_t state)
+{
+    int err = skygw_file_write(file, (void *)bb->bb_buf, bb->bb_buf_used, flush);
+
+    if (err)
+    {
+        // TODO: Log this to syslog.
+        char errbuf[MXS_STRERROR_BUFLEN];
+        LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
+                  "Disabling writing to the log.\n",
+                  lf->lf_full_file_name, err, strerror_r(err, errbuf, sizeof(errbuf)));
+
+        mxs_log_set_maxlog_enabled(false);
+    }
+    /**
+     * Reset buffer's counters and mark
+     * not full.
+     */
+    bb->bb_buf_left = bb->bb_buf_size;
+    bb->bb_buf_used = 0;
+    memset(bb->bb_buf, 0, bb->bb_buf_size);
+#if defined(SS_LOG_DEBUG)
+    sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
+    bb->bb_buf_used += strlen(bb->bb_buf);
+    bb->bb_buf_left -= strlen(bb->bb_buf);
+#endif
+    atomic_synchronize();
+    bb->bb_state = state;
+}
+
+/**
+ * Write the full block buffers of the threads to the log file. The buffers
+ * of each thread are written in the order the thread filled them. When the
+ * file is flushed, the buffer a thread is currently writing to is taken
+ * over and written as well.
+ *
+ * @param lf     The logfile
+ * @param file   The file to write to
+ * @param flush  Whether all buffered data should be written and flushed
+ */
+static void thr_flush_thread_blockbufs(logfile_t* lf, skygw_file_t* file, bool flush)
+{
+    for (thread_blockbufs_t* tb = lf->lf_thread_blockbufs; tb; tb = tb->tb_next)
+    {
+        for (int n = 0; n < NTHREADBLOCKBUFS; n++)
+        {
+            blockbuf_t* bb = NULL;
+
+            for (int i = 0; i < NTHREADBLOCKBUFS; i++)
+            {
+                blockbuf_t* candidate = tb->tb_bufs[i];
+
+                if (candidate->bb_state == BB_FULL &&
+                    (bb == NULL || candidate->bb_seq < bb->bb_seq))
+                {
+                    bb = candidate;
+                }
+            }
+
+            if (bb == NULL && flush)
+            {
+                for (int i = 0; i < NTHREADBLOCKBUFS && bb == NULL; i++)
+                {
+                    if (tb->tb_bufs[i]->bb_buf_used != 0)
+                    {
+                        /** Stops the thread from writing to the buffer */
+                        bb = tb->tb_bufs[i];
+                        bb->bb_state = BB_FULL;
+                    }
+                }
+            }
+
+            if (bb == NULL)
+            {
+                break;
+            }
+
+            atomic_synchronize();
+
+            while (atomic_load_int(&bb->bb_refcount) > 0)
+            {
+                pthread_yield();
+            }
+
+            blockbuf_write(lf, file, bb, flush, BB_READY);
+        }
+    }
+}
+
 static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
 {
     /**
@@ -2164,6 +2472,9 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
     }
 
     skygw_file_t *file = fwr->fwr_file;
+
+    thr_flush_thread_blockbufs(lf, file, flush_logfile || do_flushall);
+
     /**
      * get logfile's block buffer list
      */
@@ -2177,8 +2488,6 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
 
     while (node != NULL)
     {
-        int err = 0;
-
         CHK_MLIST_NODE(node);
         blockbuf_t *bb = (blockbuf_t *)node->mlnode_data;
         CHK_BLOCKBUF(bb);
@@ -2200,34 +2509,7 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
                 simple_mutex_unlock(&bb->bb_mutex);
                 simple_mutex_lock(&bb->bb_mutex, true);
             }
-            err = skygw_file_write(file,
-                                   (void *)bb->bb_buf,
-                                   bb->bb_buf_used,
-                                   (flush_logfile || do_flushall));
-            if (err)
-            {
-                // TODO: Log this to syslog.
-                char errbuf[MXS_STRERROR_BUFLEN];
-                LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
-                          "Disabling writing to the log.\n",
-                          lf->lf_full_file_name, err, strerror_r(err, errbuf, sizeof(errbuf)));
-
-                mxs_log_set_maxlog_enabled(false);
-            }
-            /**
-             * Reset buffer's counters and mark
-             * not full.
-             */
-            bb->bb_buf_left = bb->bb_buf_size;
-            bb->bb_buf_used = 0;
-            memset(bb->bb_buf, 0, bb->bb_buf_size);
-            bb->bb_state = BB_CLEARED;
-#if defined(SS_LOG_DEBUG)
-            sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-            bb->bb_buf_used += strlen(bb->bb_buf);
-            bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-
+            blockbuf_write(lf, file, bb, flush_logfile || do_flushall, BB_CLEARED);
         }
         /** Release lock to block buffer */
         simple_mutex_unlock(&bb->bb_mutex);
@@ -2308,12 +2590,17 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
  * completion, it is increased again to even. List can be read only when
  * version is even and read is consistent only if version hasn't changed
  * during the read.
+ *
+ * In addition, each logging thread has block buffers of its own, which are
+ * written before the shared list. Log clients use the shared list only if
+ * their own buffers could not be allocated.
  */
 static void* thr_filewriter_fun(void* data)
 {
     skygw_thread_t* thr = (skygw_thread_t *)data;
     filewriter_t*   fwr = (filewriter_t *)skygw_thread_get_data(thr);
 
+    this_thread.filewriter = true;
     flushall_logfiles(false);
 
     CHK_FILEWRITER(fwr);
@@ -2771,30 +3058,16 @@ static message_suppression_t message_status(const char* file, int line)
         LM_MESSAGE_KEY key = { file, line };
         LM_MESSAGE_STATS *value;
 
-        errno = 0;
+        LM_MESSAGE_STATS stats;
+        spinlock_init(&stats.lock);
+        stats.first_ms = time_monotonic_ms();
+        stats.last_ms = 0;
+        stats.count = 0;
 
-        // Since the hashtable can not be externally locked, the lookup/creation
-        // must be done in a loop to ensure that everything works even if two
-        // threads logs the same message at the very same time.
-        do
-        {
-            value = (LM_MESSAGE_STATS*) hashtable_fetch(message_stats, &key);
-
-            if (!value)
-            {
-                LM_MESSAGE_STATS stats;
-                spinlock_init(&stats.lock);
-                stats.first_ms = time_monotonic_ms();
-                stats.last_ms = 0;
-                stats.count = 0;
-
-                // hashtable_add may fail for two reasons; the key exists
-                // already or it runs out of memory. In the latter case
-                // errno is set.
-                hashtable_add(message_stats, &key, &stats);
-            }
-        }
-        while (!value && (errno == 0));
+        // The lookup and the creation are done under the lock of the shard,
+        // so two threads logging the same message get the same entry. NULL
+        // is returned only if memory runs out.
+        value = (LM_MESSAGE_STATS*) shardedhash_fetch_or_add(message_stats, &key, &stats);
 
         if (value)
         {
@@ -2928,105 +3201,108 @@ int mxs_log_message(int priority,
                 suppression_len += UINTLEN(suppress_ms);
             }
 
-            /**
-             * Find out the length of log string (to be formatted str).
-             */
-            va_start(valist, format);
-            int message_len = vsnprintf(NULL, 0, format, valist);
-            va_end(valist);
+            log_prefix_t prefix = priority_to_prefix(priority);
 
-            if (message_len >= 0)
-            {
-                log_prefix_t prefix = priority_to_prefix(priority);
+            static const char FORMAT_FUNCTION[] = "(%s): ";
 
-                static const char FORMAT_FUNCTION[] = "(%s): ";
+            // Other thread might change log_config.augmentation.
+            int augmentation = log_config.augmentation;
+            int augmentation_len = 0;
 
-                // Other thread might change log_config.augmentation.
-                int augmentation = log_config.augmentation;
-                int augmentation_len = 0;
+            switch (augmentation)
+            {
+            case MXS_LOG_AUGMENT_WITH_FUNCTION:
+                augmentation_len = sizeof(FORMAT_FUNCTION) - 1; // Remove trailing 0
+                augmentation_len -= 2; // Remove the %s
+                augmentation_len += strlen(function);
+                break;
 
-                switch (augmentation)
-                {
-                case MXS_LOG_AUGMENT_WITH_FUNCTION:
-                    augmentation_len = sizeof(FORMAT_FUNCTION) - 1; // Remove trailing 0
-                    augmentation_len -= 2; // Remove the %s
-                    augmentation_len += strlen(function);
-                    break;
+            default:
+                break;
+            }
 
-                default:
-                    break;
-                }
+            // The message is formatted only once, directly after the fixed
+            // parts. Measuring it first with a separate vsnprintf would double
+            // the cost of every message, which shows on hot paths when info
+            // messages are enabled.
+            char buffer[MAX_LOGSTRLEN];
 
-                int buffer_len = 0;
-                buffer_len += prefix.len;
-                buffer_len += session_len;
-                buffer_len += modname_len;
-                buffer_len += augmentation_len;
-                buffer_len += message_len;
-                buffer_len += suppression_len;
-                buffer_len += 1; // Trailing NULL
+            int fixed_len = prefix.len + session_len + modname_len + augmentation_len;
 
-                if (buffer_len > MAX_LOGSTRLEN)
-                {
-                    message_len -= (buffer_len - MAX_LOGSTRLEN);
-                    buffer_len = MAX_LOGSTRLEN;
+            if (fixed_len + suppression_len + 1 > MAX_LOGSTRLEN)
+            {
+                // Only an absurdly long function or module name could cause this.
+                augmentation_len = 0;
+                modname_len = 0;
+                fixed_len = prefix.len + session_len;
+            }
 
-                    ss_dassert(prefix.len + session_len + modname_len +
-                               augmentation_len + message_len + suppression_len + 1 == buffer_len);
-                }
+            char *prefix_text = buffer;
+            char *session_text = prefix_text + prefix.len;
+            char *modname_text = session_text + session_len;
+            char *augmentation_text = modname_text + modname_len;
+            char *message_text = augmentation_text + augmentation_len;
 
-                char buffer[buffer_len];
+            strcpy(prefix_text, prefix.text);
 
-                char *prefix_text = buffer;
-                char *session_text = prefix_text + prefix.len;
-                char *modname_text = session_text + session_len;
-                char *augmentation_text = modname_text + modname_len;
-                char *message_text = augmentation_text + augmentation_len;
-                char *suppression_text = message_text + message_len;
+            if (session_len)
+            {
+                strcpy(session_text, "(");
+                strcat(session_text, session);
+                strcat(session_text, ") ");
+            }
 
-                strcpy(prefix_text, prefix.text);
+            if (modname_len)
+            {
+                strcpy(modname_text, "[");
+                strcat(modname_text, modname);
+                strcat(modname_text, "] ");
+            }
 
-                if (session_len)
-                {
-                    strcpy(session_text, "(");
-                    strcat(session_text, session);
-                    strcat(session_text, ") ");
-                }
+            if (augmentation_len)
+            {
+                int len = 0;
 
-                if (modname_len)
+                switch (augmentation)
                 {
-                    strcpy(modname_text, "[");
-                    strcat(modname_text, modname);
-                    strcat(modname_text, "] ");
+                case MXS_LOG_AUGMENT_WITH_FUNCTION:
+                    len = sprintf(augmentation_text, FORMAT_FUNCTION, function);
+                    break;
+
+                default:
+                    assert(!true);
                 }
 
-                if (augmentation_len)
-                {
-                    int len = 0;
+                (void)len;
+                ss_dassert(len == augmentation_len);
+            }
 
-                    switch (augmentation)
-                    {
-                    case MXS_LOG_AUGMENT_WITH_FUNCTION:
-                        len = sprintf(augmentation_text, FORMAT_FUNCTION, function);
-                        break;
+            // Room for the message, leaving space for the suppression
+            // text and the trailing NULL.
+            int message_space = MAX_LOGSTRLEN - fixed_len - suppression_len;
 
-                    default:
-                        assert(!true);
-                    }
+            va_start(valist, format);
+            int message_len = vsnprintf(message_text, message_space, format, valist);
+            va_end(valist);
 
-                    (void)len;
-                    ss_dassert(len == augmentation_len);
+            if (message_len >= 0)
+            {
+                if (message_len >= message_space)
+                {
+                    // Truncated, vsnprintf returned the length it would have needed.
+                    message_len = message_space - 1;
                 }
 
-                va_start(valist, format);
-                vsnprintf(message_text, message_len + 1, format, valist);
-                va_end(valist);
+                char *suppression_text = message_text + message_len;
 
                 if (suppression_len)
                 {
                     sprintf(suppression_text, SUPPRESSION, suppress_ms);
                 }
 
+                int buffer_len = fixed_len + message_len + suppression_len + 1; // Trailing NULL
+                ss_dassert(buffer[buffer_len - 1] == 0);
+
                 enum log_flush flush = priority_to_flush(priority);
 
                 err = log_write(priority, file, line, function, prefix.len, buffer_len, buffer, flush);
@@ -0,0 +1,58 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/buffer.h - The private buffer interface
+ */
+
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+struct dcb;
+
+/**
+ * Initialize the per-thread buffer pools
+ *
+ * Must be called once before the polling threads are started.
+ *
+ * @param n_threads Number of polling threads
+ *
+ * @return True if the pools were allocated
+ */
+bool gwbuf_pool_init(int n_threads);
+
+/**
+ * Attach the calling thread to its buffer pool
+ *
+ * Buffers allocated and freed by a thread that is not attached to a pool
+ * are served directly from the heap.
+ *
+ * @param thread_id The ID of the polling thread
+ */
+void gwbuf_pool_thread_init(int thread_id);
+
+/**
+ * Detach the calling thread from its buffer pool and release all cached blocks
+ */
+void gwbuf_pool_thread_finish();
+
+/**
+ * Print the buffer pool statistics
+ *
+ * @param dcb DCB to print to
+ */
+void dprintBufferStats(struct dcb *dcb);
+
+MXS_END_DECLS
@@ -0,0 +1,32 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/clock.h - The private clock interface
+ */
+
+#include <maxscale/clock.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * Read the clocks of the calling thread
+ *
+ * Called by a polling thread at the start of every cycle. After the first
+ * call, the coarse clocks of the thread return the times read by the
+ * latest call.
+ */
+void mxs_clock_update(void);
+
+MXS_END_DECLS
@@ -22,11 +22,13 @@
 
 MXS_BEGIN_DECLS
 
-#define DEFAULT_NBPOLLS             3    /**< Default number of non block polls before we block */
-#define DEFAULT_POLLSLEEP           1000 /**< Default poll wait time (milliseconds) */
-#define DEFAULT_NTHREADS            1    /**< Default number of polling threads */
-#define DEFAULT_QUERY_RETRIES       0    /**< Number of retries for interrupted queries */
-#define DEFAULT_QUERY_RETRY_TIMEOUT 5    /**< Timeout for query retries */
+#define DEFAULT_NBPOLLS                     3    /**< Default number of non block polls before we block */
+#define DEFAULT_POLLSLEEP                   1000 /**< Default poll wait time (milliseconds) */
+#define DEFAULT_NTHREADS                    1    /**< Default number of polling threads */
+#define DEFAULT_QUERY_RETRIES               0    /**< Number of retries for interrupted queries */
+#define DEFAULT_QUERY_RETRY_TIMEOUT         5    /**< Timeout for query retries */
+#define DEFAULT_WRITEQ_LOW_WATER            8192 /**< Client write queue size that resumes the servers */
+#define DEFAULT_STATISTICS_SEGMENT_INTERVAL 1    /**< Seconds between the updates of the statistics segment */
 
 /**
  * @brief Generate default module parameters
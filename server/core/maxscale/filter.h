@@ -40,10 +40,10 @@ struct mxs_filter_def
 void filter_add_option(MXS_FILTER_DEF *filter_def, const char *option);
 void filter_add_parameter(MXS_FILTER_DEF *filter_def, const char *name, const char *value);
 MXS_FILTER_DEF *filter_alloc(const char *name, const char *module_name);
-MXS_DOWNSTREAM *filter_apply(MXS_FILTER_DEF *filter_def, MXS_SESSION *session, MXS_DOWNSTREAM *downstream);
+bool filter_apply(MXS_FILTER_DEF *filter_def, MXS_SESSION *session, MXS_DOWNSTREAM *chain);
 void filter_free(MXS_FILTER_DEF *filter_def);
 bool filter_load(MXS_FILTER_DEF *filter_def);
 int filter_standard_parameter(const char *name);
-MXS_UPSTREAM *filter_upstream(MXS_FILTER_DEF *filter_def, void *fsession, MXS_UPSTREAM *upstream);
+bool filter_upstream(MXS_FILTER_DEF *filter_def, void *fsession, MXS_UPSTREAM *chain);
 
 MXS_END_DECLS
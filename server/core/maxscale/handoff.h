@@ -0,0 +1,106 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/handoff.h - Handing the listening sockets over to a new process
+ *
+ * When @c handoff_socket is configured, a running MaxScale waits for
+ * connections on that Unix domain socket. A new MaxScale process started with
+ * the same configuration connects to it before it starts its services and
+ * receives the listening sockets of the running process, so that the new
+ * process can start accepting without the ports ever being closed:
+ *
+ * 1. The new process sends HANDOFF_MSG_REQUEST.
+ * 2. The running process sends each listening socket in a HANDOFF_MSG_FD
+ *    message with the key of the socket, followed by HANDOFF_MSG_END.
+ * 3. The new process starts its services, taking the received sockets into
+ *    use, and sends HANDOFF_MSG_READY.
+ * 4. The running process stops accepting, releases its PID file and replies
+ *    with HANDOFF_MSG_DONE. It then shuts down once its sessions have ended.
+ *
+ * If the connection closes before step 4, the running process continues as
+ * if nothing had happened.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stddef.h>
+
+MXS_BEGIN_DECLS
+
+#define HANDOFF_MSG_REQUEST "HANDOFF 1"
+#define HANDOFF_MSG_FD      "FD "
+#define HANDOFF_MSG_END     "END"
+#define HANDOFF_MSG_READY   "READY"
+#define HANDOFF_MSG_DONE    "DONE"
+
+/** The maximum length of a key, including the terminating null */
+#define HANDOFF_KEY_MAX 512
+
+/**
+ * @brief Create the key of a listening socket
+ *
+ * @param dest   Buffer of HANDOFF_KEY_MAX bytes
+ * @param config The address and port the socket is bound to, as given to dcb_listen()
+ * @param shard  The index of the SO_REUSEPORT socket of the listener, 0 if there is one socket
+ */
+void handoff_key(char *dest, const char *config, int shard);
+
+/**
+ * @brief Receive the listening sockets of a running process
+ *
+ * @param path Path of the handoff socket
+ *
+ * @return True if a running process handed its sockets over. If it did, this
+ *         process must call handoff_complete() once its services have started.
+ */
+bool handoff_receive(const char *path);
+
+/**
+ * @brief Take a received listening socket into use
+ *
+ * @param key The key of the socket
+ *
+ * @return The socket, or -1 if no socket with the key was received
+ */
+int handoff_take_fd(const char *key);
+
+/**
+ * @brief Tell the previous process that this process is accepting
+ *
+ * Closes the received sockets that were not taken into use and waits until
+ * the previous process has stopped accepting.
+ *
+ * @return True if the previous process confirmed that it has stopped
+ */
+bool handoff_complete();
+
+/**
+ * @brief Start waiting for a new process to take over
+ *
+ * @param path          Path of the handoff socket
+ * @param drain_timeout Seconds after which the remaining sessions are closed
+ *                      when a new process has taken over, 0 for no limit
+ *
+ * @return True if the handoff socket was created
+ */
+bool handoff_start(const char *path, int drain_timeout);
+
+/**
+ * @brief Stop waiting for a new process
+ *
+ * Must be called only at shutdown, after the housekeeper has stopped.
+ */
+void handoff_finish();
+
+MXS_END_DECLS
@@ -30,6 +30,12 @@ MXS_BEGIN_DECLS
  */
 int maxscale_shutdown(void);
 
+/**
+ * Release the PID file so that another process can take it over. The file
+ * is not removed when this process exits.
+ */
+void maxscale_release_pidfile(void);
+
 /**
  * Reset the start time from which the uptime is calculated.
  */
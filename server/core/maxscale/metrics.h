@@ -0,0 +1,107 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/metrics.h - Metrics in the OpenMetrics text format
+ *
+ * The metrics are printed straight to a DCB as they are read. All samples of
+ * a metric family must be printed right after the lines that start the family.
+ *
+ * When the DCB is NULL, the metrics are collected into the statistics segment
+ * instead. This is done only by the housekeeper task of the segment.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/dcb.h>
+#include <maxscale/statistics.h>
+
+MXS_BEGIN_DECLS
+
+/** The content type of the metrics */
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/**
+ * @brief Start writing the metrics to the statistics segment
+ *
+ * The segment is created and then updated by a housekeeper task. Its layout
+ * is described in maxscale/metrics_segment.h.
+ *
+ * @param path     Path of the segment file
+ * @param interval Seconds between the updates
+ *
+ * @return True if the segment was created
+ */
+bool metrics_segment_start(const char *path, int interval);
+
+/**
+ * @brief Stop writing the statistics segment and remove it
+ */
+void metrics_segment_stop();
+
+/**
+ * @brief Print all metrics of MaxScale
+ *
+ * @param dcb DCB to print to
+ */
+void metrics_write(DCB *dcb);
+
+/**
+ * @brief Start a metric family
+ *
+ * @param dcb    DCB to print to
+ * @param family Name of the family, the samples of a counter have the suffix _total
+ * @param type   "counter", "gauge" or "summary"
+ * @param unit   Unit of the values, must be the suffix of @c family, or NULL
+ * @param help   Description of the family
+ */
+void metrics_family(DCB *dcb, const char *family, const char *type, const char *unit,
+                    const char *help);
+
+/**
+ * @brief Print a sample
+ *
+ * @param dcb         DCB to print to
+ * @param name        Name of the sample
+ * @param label       Name of the label or NULL if the sample has no label
+ * @param label_value Value of the label
+ * @param value       Value of the sample
+ */
+void metrics_sample(DCB *dcb, const char *name, const char *label, const char *label_value,
+                    int64_t value);
+
+/**
+ * @brief Print the samples of a latency histogram as a summary
+ *
+ * The histogram values are in microseconds and are printed in seconds.
+ *
+ * @param dcb         DCB to print to
+ * @param family      Name of the family
+ * @param label       Name of the label
+ * @param label_value Value of the label
+ * @param hist        The histogram, NULL if no values have been added
+ */
+void metrics_latency(DCB *dcb, const char *family, const char *label, const char *label_value,
+                     ts_hist_t hist);
+
+/**
+ * The metric families of the subsystems
+ *
+ * @param dcb DCB to print to
+ */
+void dprintPollMetrics(DCB *dcb);
+void dprintAllServicesMetrics(DCB *dcb);
+void dprintAllServersMetrics(DCB *dcb);
+void dprintAllFiltersMetrics(DCB *dcb);
+
+MXS_END_DECLS
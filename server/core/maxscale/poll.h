@@ -18,12 +18,16 @@
 
 #include <maxscale/poll.h>
 
+#include <maxscale/platform.h>
 #include <maxscale/resultset.h>
 
 MXS_BEGIN_DECLS
 
 #define MAX_EVENTS 1000
 
+/** The ID of the polling thread running the caller, -1 for other threads */
+extern thread_local int current_thread_id;
+
 /**
  * A statistic identifier that can be returned by poll_get_stat
  */
@@ -40,11 +44,6 @@ typedef enum
     POLL_STAT_MAX_EXECTIME
 } POLL_STAT;
 
-enum poll_message
-{
-    POLL_MSG_CLEAN_PERSISTENT = 0x01
-};
-
 void            poll_init();
 void            poll_shutdown();
 
@@ -57,9 +56,103 @@ void            dShowThreads(DCB *dcb);
 void            dShowEventQ(DCB *dcb);
 void            dShowEventStats(DCB *dcb);
 
+/**
+ * Read the rest of the data of a DCB after the other events of the thread
+ *
+ * Called by a read that used up the read budget of the DCB. The DCB is read
+ * again by its thread after the events of the current poll cycle.
+ *
+ * @param dcb DCB whose socket may have more data
+ */
+void            poll_add_read_pending(DCB *dcb);
+
+/**
+ * Cancel the pending read of a DCB that is closed
+ *
+ * @param dcb The DCB, must be owned by the calling thread
+ */
+void            poll_cancel_read_pending(DCB *dcb);
+
+/**
+ * Defer the writing of the write queue of a DCB to the end of the poll cycle
+ *
+ * The writes of the cycle are then done with one system call per DCB.
+ *
+ * @param dcb DCB with data in its write queue, must be owned by the calling thread
+ * @return True if the write was deferred, false if the queue must be written now
+ */
+bool            poll_add_write_pending(DCB *dcb);
+
+/**
+ * Cancel the deferred write of a DCB
+ *
+ * @param dcb The DCB, must be owned by the calling thread
+ */
+void            poll_cancel_write_pending(DCB *dcb);
+
+/**
+ * Stop reading a DCB
+ *
+ * The DCB stays in the poll set so that hangups and errors are still
+ * handled, but its EPOLLIN events are ignored until it is resumed.
+ *
+ * @param dcb Polled DCB, must be owned by the calling thread
+ */
+void            poll_pause_reading(DCB *dcb);
+
+/**
+ * Start reading a paused DCB again
+ *
+ * The data that arrived while the DCB was paused is read after the events
+ * of the current poll cycle.
+ *
+ * @param dcb The DCB, must be owned by the calling thread
+ */
+void            poll_resume_reading(DCB *dcb);
+
+/**
+ * Hand DCBs of the calling thread over to another thread
+ *
+ * The DCBs are removed from the poll set of the calling thread and added to
+ * the poll set of the new thread. The DCBs must not be in the read or write
+ * pending lists of the calling thread.
+ *
+ * @param dcbs      The DCBs of a session, the client DCB first
+ * @param n         Number of DCBs
+ * @param thread_id The new owner
+ * @return True if the DCBs were moved
+ */
+bool            poll_migrate_dcbs(DCB **dcbs, int n, int thread_id);
+
+/**
+ * Get the number of threads new sessions are assigned to
+ *
+ * @return The number of active threads
+ */
+int             poll_get_active_threads();
+
+/**
+ * Change the number of threads new sessions are assigned to
+ *
+ * The threads above the new count stop receiving sessions and their idle
+ * sessions are moved to the active threads. The other sessions are moved
+ * once they become idle. The number can be raised up to the number of
+ * threads started, see max_threads.
+ *
+ * @param n The new number of active threads
+ * @return True if the number was changed
+ */
+bool            poll_set_active_threads(int n);
+
+/**
+ * Get the CPU a polling thread is bound to
+ *
+ * @param thread_id The thread
+ * @return The CPU or -1 if the threads are not bound to CPUs
+ */
+int             poll_thread_cpu(int thread_id);
+
 int64_t         poll_get_stat(POLL_STAT stat);
 RESULTSET       *eventTimesGetList();
 
-void            poll_send_message(enum poll_message msg, void *data);
-
 MXS_END_DECLS
@@ -17,6 +17,8 @@
 
 MXS_BEGIN_DECLS
 
+struct dcb;
+
 typedef enum qc_trx_parse_using
 {
     QC_TRX_PARSE_USING_QC,     /**< Use the query classifier. */
@@ -36,4 +38,21 @@ typedef enum qc_trx_parse_using
  */
 uint32_t qc_get_trx_type_mask_using(GWBUF* stmt, qc_trx_parse_using_t use);
 
+/**
+ * Print the statistics of the classification caches of all threads
+ *
+ * @param dcb DCB to print to
+ */
+void qc_print_cache_stats(struct dcb* dcb);
+
+/**
+ * Get the statistics of the classification cache of the calling thread
+ *
+ * @param hits   Set to the number of cache hits
+ * @param misses Set to the number of cache misses
+ *
+ * @return True if the calling thread has a cache
+ */
+bool qc_get_cache_stats(int64_t* hits, int64_t* misses);
+
 MXS_END_DECLS
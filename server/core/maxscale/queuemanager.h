@@ -50,5 +50,6 @@ void mxs_queue_free(QUEUE_CONFIG *queue_config);
 bool mxs_enqueue(QUEUE_CONFIG *queue_config, void *new_entry);
 bool mxs_dequeue(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result);
 bool mxs_dequeue_if_expired(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result);
+int mxs_queue_length(QUEUE_CONFIG *queue_config);
 
 MXS_END_DECLS
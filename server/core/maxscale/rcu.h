@@ -0,0 +1,70 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/rcu.h - The private deferred freeing interface
+ */
+
+#include <maxscale/rcu.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * Allocate the epochs of the polling threads
+ *
+ * Must be called once before the polling threads are started. Also adds the
+ * housekeeper task that frees the retired data.
+ *
+ * @param n_threads Number of polling threads
+ * @return True if the epochs were allocated
+ */
+bool mxs_rcu_init(int n_threads);
+
+/**
+ * Mark a quiescent point of a polling thread
+ *
+ * The thread holds no pointers to published data when it calls this. It also
+ * brings a thread that was offline back online.
+ *
+ * @param thread_id The ID of the calling thread
+ */
+void mxs_rcu_quiescent(int thread_id);
+
+/**
+ * Mark a polling thread offline
+ *
+ * An offline thread holds no pointers to published data and does not hold
+ * back the freeing of retired data, e.g. while it is blocked in epoll_wait.
+ *
+ * @param thread_id The ID of the calling thread
+ */
+void mxs_rcu_offline(int thread_id);
+
+/**
+ * Free the retired data that no polling thread can be using
+ *
+ * Called periodically by the housekeeper.
+ *
+ * @return Number of retired items that were freed
+ */
+int mxs_rcu_reclaim();
+
+/**
+ * Get the number of retired items that have not yet been freed
+ *
+ * @return Number of items
+ */
+int mxs_rcu_pending();
+
+MXS_END_DECLS
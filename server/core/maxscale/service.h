@@ -59,6 +59,62 @@ void service_shutdown(void);
  */
 void service_destroy_instances(void);
 
+/**
+ * @brief Call a function for each listening socket of the started listeners
+ *
+ * The key of a socket, created with handoff_key(), is the same in every
+ * process that uses the same configuration.
+ *
+ * @param func Function to call, the iteration stops if it returns false
+ * @param data Passed to @c func
+ *
+ * @return True if @c func returned true for all sockets
+ */
+bool service_for_each_listener_socket(bool (*func)(const char *key, int fd, void *data), void *data);
+
+/**
+ * @brief Stop accepting connections on all listeners
+ */
+void service_stop_all_listeners(void);
+
+/**
+ * @brief Close the sockets of the stopped listeners
+ *
+ * The listeners cannot be started again afterwards.
+ */
+void service_close_all_listeners(void);
+
+/**
+ * @brief Queue a client connection that found max_connections reached
+ *
+ * The connection is started as soon as one of the connections of the service
+ * is closed, or refused by the housekeeper once it has waited for longer than
+ * queued_connection_timeout.
+ *
+ * @param service The service of the connection
+ * @param dcb     The client DCB, not yet added to a polling thread
+ *
+ * @return False if the queue is full or the service has none
+ */
+bool service_queue_connection(SERVICE *service, DCB *dcb);
+
+/**
+ * @brief Release the slot of a closed client connection
+ *
+ * If connections are queued, the oldest one takes the slot and is started by
+ * the calling thread as soon as it has processed its current events.
+ *
+ * @param service The service of the closed connection
+ */
+void service_release_connection(SERVICE *service);
+
+/**
+ * @brief Get the number of client connections of all services
+ *
+ * @return The number of client connections
+ */
+int service_client_count(void);
+
 /**
  * @brief Launch all services
  *
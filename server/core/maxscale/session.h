@@ -40,11 +40,33 @@ typedef enum
     SESSION_LIST_CONNECTION
 } SESSIONLISTFILTER;
 
+/**
+ * Free the sessions cached by the calling polling thread
+ *
+ * Must be called by each polling thread before it exits.
+ */
+void session_cache_thread_finish();
+
 int session_isvalid(MXS_SESSION *);
 int session_reply(void *inst, void *session, GWBUF *data);
 char *session_state(mxs_session_state_t);
 bool session_link_dcb(MXS_SESSION *, struct dcb *);
 
+/**
+ * Account the time a polling thread spent on a read event of a session
+ *
+ * Events of the client connection route queries and events of the backend
+ * connections route replies. The time from the end of a query event to the
+ * start of the next reply event is counted as waiting for the servers. The
+ * times are added to the session and to its service.
+ *
+ * @param session The session
+ * @param client  True for an event of the client connection
+ * @param start   Start of the event in nanoseconds of the monotonic clock
+ * @param end     End of the event in nanoseconds of the monotonic clock
+ */
+void session_add_event_time(MXS_SESSION *session, bool client, uint64_t start, uint64_t end);
+
 RESULTSET *sessionGetList(SESSIONLISTFILTER);
 
 void printAllSessions();
@@ -55,17 +77,4 @@ void dprintAllSessions(struct dcb *);
 void dprintSession(struct dcb *, MXS_SESSION *);
 void dListSessions(struct dcb *);
 
-/**
- * @brief Get a session reference
- *
- * This creates an additional reference to a session which allows it to live
- * as long as it is needed.
- *
- * @param session Session reference to get
- * @return Reference to a MXS_SESSION
- *
- * @note The caller must free the session reference by calling session_put_ref
- */
-MXS_SESSION* session_get_ref(MXS_SESSION *sessoin);
-
 MXS_END_DECLS
@@ -0,0 +1,46 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/spinlock.h - The private spinlock interface
+ */
+
+#include <maxscale/spinlock.h>
+#include <stdint.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The contention counters of a named spinlock. The counters are updated by
+ * the thread that holds the lock, so reading them without the lock gives
+ * approximate values.
+ */
+typedef struct spinlock_counters
+{
+    char     name[SPINLOCK_NAME_LEN];
+    uint64_t acquired;   /*< No. of times the lock was acquired */
+    uint64_t contended;  /*< No. of times the lock had to be waited for */
+    uint64_t spins;      /*< No. of rounds spun while waiting */
+    uint64_t parked;     /*< No. of times a waiting thread went to sleep */
+} SPINLOCK_COUNTERS;
+
+/**
+ * Call a function for the counters of each named spinlock
+ *
+ * @param func Function to call, iteration stops when it returns false
+ * @param data Data passed to the function
+ */
+void spinlock_foreach_named(bool (*func)(const SPINLOCK_COUNTERS *counters, void *data), void *data);
+
+MXS_END_DECLS
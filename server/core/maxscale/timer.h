@@ -0,0 +1,48 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/timer.h - The private timer interface
+ */
+
+#include <maxscale/timer.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * Allocate the timer wheels of the polling threads
+ *
+ * Must be called once before the polling threads are started.
+ *
+ * @param n_threads Number of polling threads
+ * @return True if the wheels were allocated
+ */
+bool mxs_timer_init(int n_threads);
+
+/**
+ * Call the functions of the timers of a thread that have expired
+ *
+ * @param thread_id The ID of the calling thread
+ */
+void mxs_timer_process(int thread_id);
+
+/**
+ * Get the number of timers set in a thread
+ *
+ * @param thread_id The ID of the thread
+ * @return Number of timers
+ */
+int mxs_timer_count(int thread_id);
+
+MXS_END_DECLS
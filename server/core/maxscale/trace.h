@@ -0,0 +1,60 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/trace.h - The private tracing interface
+ */
+
+#include <maxscale/trace.h>
+
+MXS_BEGIN_DECLS
+
+struct dcb;
+
+/**
+ * Allocate the trace buffers of the polling threads
+ *
+ * Must be called once before the polling threads are started.
+ *
+ * @param n_threads Number of polling threads
+ * @param n_records Number of records in each buffer, rounded up to a power
+ *                  of two. If 0, tracing is disabled.
+ *
+ * @return True if the buffers were allocated or tracing is disabled
+ */
+bool mxs_trace_init(int n_threads, int n_records);
+
+/**
+ * Attach the calling thread to its trace buffer
+ *
+ * @param thread_id The ID of the polling thread
+ */
+void mxs_trace_thread_init(int thread_id);
+
+/**
+ * Print the trace records of all polling threads, oldest first
+ *
+ * @param dcb DCB to print to
+ */
+void dprintTrace(struct dcb *dcb);
+
+/**
+ * Log the trace records of the calling thread
+ *
+ * Used when MaxScale crashes, so the records are formatted into a buffer
+ * on the stack and logged at the alert level.
+ */
+void mxs_trace_log_thread();
+
+MXS_END_DECLS
@@ -31,7 +31,13 @@ namespace maxscale
  *
  * @ TrxBoundaryParser is a class capable of parsing and returning the
  * correct type mask of statements affecting the transaction state and
- * autocommit mode.
+ * autocommit mode. It also recognizes USE, SET TRANSACTION and XA statements,
+ * so that all statements that only affect the state of the session can be
+ * classified without the query classifier.
+ *
+ * The keywords are recognized by switching on their characters, with the
+ * keywords and their lengths being compile-time constants, so no keyword
+ * table is searched at runtime.
  *
  * The class is intended to be used in context where the performance is
  * of utmost importance; consequently it is defined in its entirety
@@ -48,13 +54,16 @@ public:
         TK_COMMIT,
         TK_CONSISTENT,
         TK_DOT,
+        TK_END,
         TK_EQ,
         TK_FALSE,
         TK_GLOBAL,
         TK_GLOBAL_VAR,
         TK_ONE,
         TK_ONLY,
+        TK_PREPARE,
         TK_READ,
+        TK_RECOVER,
         TK_ROLLBACK,
         TK_SESSION,
         TK_SESSION_VAR,
@@ -63,9 +72,11 @@ public:
         TK_START,
         TK_TRANSACTION,
         TK_TRUE,
+        TK_USE,
         TK_WITH,
         TK_WORK,
         TK_WRITE,
+        TK_XA,
         TK_ZERO,
 
         PARSER_UNKNOWN_TOKEN,
@@ -107,8 +118,36 @@ public:
      */
     uint32_t type_mask_of(const char* pSql, size_t len)
     {
-        uint32_t type_mask = 0;
+        return trx_type_mask(session_type_mask_of(pSql, len));
+    }
+
+    /**
+     * Return the type mask of a statement, provided the statement affects
+     * transaction state or autocommit mode.
+     *
+     * @param pBuf A COM_QUERY
+     *
+     * @return The corresponding type mask or 0, if the statement does not
+     *         affect transaction state or autocommit mode.
+     */
+    uint32_t type_mask_of(GWBUF* pBuf)
+    {
+        return trx_type_mask(session_type_mask_of(pBuf));
+    }
 
+    /**
+     * Return the type mask of a statement, provided the statement affects
+     * only transaction state, autocommit mode or session state. The type
+     * mask is the one the query classifier would return.
+     *
+     * @param pSql  SQL statament.
+     * @param len   Length of pSql.
+     *
+     * @return The corresponding type mask or 0, if the statement is not
+     *         one recognized by the parser.
+     */
+    uint32_t session_type_mask_of(const char* pSql, size_t len)
+    {
         m_pSql = pSql;
         m_len = len;
 
@@ -120,14 +159,15 @@ public:
 
     /**
      * Return the type mask of a statement, provided the statement affects
-     * transaction state or autocommit mode.
+     * only transaction state, autocommit mode or session state. The type
+     * mask is the one the query classifier would return.
      *
      * @param pBuf A COM_QUERY
      *
-     * @return The corresponding type mask or 0, if the statement does not
-     *         affect transaction state or autocommit mode.
+     * @return The corresponding type mask or 0, if the statement is not
+     *         one recognized by the parser.
      */
-    uint32_t type_mask_of(GWBUF* pBuf)
+    uint32_t session_type_mask_of(GWBUF* pBuf)
     {
         uint32_t type_mask = 0;
 
@@ -151,6 +191,26 @@ private:
         TOKEN_NOT_REQUIRED,
     };
 
+    /**
+     * Leave only the bits related to transaction state and autocommit mode.
+     */
+    static uint32_t trx_type_mask(uint32_t type_mask)
+    {
+        // Only START TRANSACTION can be explicitly READ or WRITE.
+        if (!(type_mask & QUERY_TYPE_BEGIN_TRX))
+        {
+            type_mask &= ~(QUERY_TYPE_WRITE | QUERY_TYPE_READ);
+        }
+
+        return type_mask & (QUERY_TYPE_BEGIN_TRX |
+                            QUERY_TYPE_WRITE |
+                            QUERY_TYPE_READ |
+                            QUERY_TYPE_COMMIT |
+                            QUERY_TYPE_ROLLBACK |
+                            QUERY_TYPE_ENABLE_AUTOCOMMIT |
+                            QUERY_TYPE_DISABLE_AUTOCOMMIT);
+    }
+
     void log_unexpected()
     {
 #ifdef TBP_LOG_UNEXPECTED_AND_EXHAUSTED
@@ -194,6 +254,14 @@ private:
             type_mask = parse_set(0);
             break;
 
+        case TK_USE:
+            type_mask = parse_use(type_mask);
+            break;
+
+        case TK_XA:
+            type_mask = parse_xa(type_mask);
+            break;
+
         default:
             ;
         }
@@ -329,11 +397,11 @@ private:
             token = next_token(TOKEN_REQUIRED);
             if (token == TK_ONE || token == TK_TRUE)
             {
-                type_mask |= (QUERY_TYPE_COMMIT | QUERY_TYPE_ENABLE_AUTOCOMMIT);
+                type_mask |= (QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_COMMIT | QUERY_TYPE_ENABLE_AUTOCOMMIT);
             }
             else if (token == TK_ZERO || token == TK_FALSE)
             {
-                type_mask = (QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT);
+                type_mask = (QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT);
             }
             else
             {
@@ -368,6 +436,12 @@ private:
             type_mask = parse_set_autocommit(type_mask);
             break;
 
+        case TK_TRANSACTION:
+            // Affects only the next transaction. The characteristics
+            // themselves do not matter.
+            type_mask = QUERY_TYPE_WRITE;
+            break;
+
         case TK_GLOBAL:
         case TK_SESSION:
             token = next_token(TOKEN_REQUIRED);
@@ -375,6 +449,10 @@ private:
             {
                 type_mask = parse_set_autocommit(type_mask);
             }
+            else if (token == TK_TRANSACTION)
+            {
+                type_mask = QUERY_TYPE_GSYSVAR_WRITE;
+            }
             else
             {
                 type_mask = 0;
@@ -475,6 +553,19 @@ private:
         return type_mask;
     }
 
+    uint32_t parse_use(uint32_t type_mask)
+    {
+        // The database name itself does not matter.
+        token_t token = next_token(TOKEN_REQUIRED);
+
+        if (token != PARSER_EXHAUSTED)
+        {
+            type_mask = QUERY_TYPE_SESSION_WRITE;
+        }
+
+        return type_mask;
+    }
+
     uint32_t parse_with_consistent_snapshot(uint32_t type_mask)
     {
         token_t token = next_token(TOKEN_REQUIRED);
@@ -546,6 +637,44 @@ private:
         return type_mask;
     }
 
+    uint32_t parse_xa(uint32_t type_mask)
+    {
+        // What follows the second keyword, e.g. the xid, does not matter.
+        token_t token = next_token(TOKEN_REQUIRED);
+
+        switch (token)
+        {
+        case TK_BEGIN:
+        case TK_START:
+            type_mask = QUERY_TYPE_BEGIN_TRX;
+            break;
+
+        case TK_COMMIT:
+            type_mask = QUERY_TYPE_COMMIT;
+            break;
+
+        case TK_ROLLBACK:
+            type_mask = QUERY_TYPE_ROLLBACK;
+            break;
+
+        case TK_END:
+        case TK_PREPARE:
+        case TK_RECOVER:
+            type_mask = QUERY_TYPE_WRITE;
+            break;
+
+        case PARSER_EXHAUSTED:
+            type_mask = 0;
+            break;
+
+        default:
+            type_mask = 0;
+            log_unexpected();
+        }
+
+        return type_mask;
+    }
+
     inline bool is_next_alpha(char uc, int offset = 1) const
     {
         ss_dassert(uc >= 'A' && uc <= 'Z');
@@ -691,6 +820,11 @@ private:
                 token = TK_DOT;
                 break;
 
+            case 'e':
+            case 'E':
+                token = expect_token(TBP_EXPECT_TOKEN("END"), TK_END);
+                break;
+
             case '=':
                 ++m_pI;
                 token = TK_EQ;
@@ -736,11 +870,23 @@ private:
                 }
                 break;
 
+            case 'p':
+            case 'P':
+                token = expect_token(TBP_EXPECT_TOKEN("PREPARE"), TK_PREPARE);
+                break;
+
             case 'r':
             case 'R':
                 if (is_next_alpha('E'))
                 {
-                    token = expect_token(TBP_EXPECT_TOKEN("READ"), TK_READ);
+                    if (is_next_alpha('A', 2))
+                    {
+                        token = expect_token(TBP_EXPECT_TOKEN("READ"), TK_READ);
+                    }
+                    else if (is_next_alpha('C', 2))
+                    {
+                        token = expect_token(TBP_EXPECT_TOKEN("RECOVER"), TK_RECOVER);
+                    }
                 }
                 else if (is_next_alpha('O'))
                 {
@@ -786,6 +932,11 @@ private:
                 }
                 break;
 
+            case 'u':
+            case 'U':
+                token = expect_token(TBP_EXPECT_TOKEN("USE"), TK_USE);
+                break;
+
             case 'w':
             case 'W':
                 if (is_next_alpha('I'))
@@ -802,6 +953,11 @@ private:
                 }
                 break;
 
+            case 'x':
+            case 'X':
+                token = expect_token(TBP_EXPECT_TOKEN("XA"), TK_XA);
+                break;
+
             case '0':
                 {
                     char c;
@@ -25,6 +25,8 @@
  */
 
 #include <maxscale/pcre2.h>
+#include <ctype.h>
+#include <string.h>
 #include <maxscale/alloc.h>
 
 /**
@@ -135,3 +137,239 @@ mxs_pcre2_result_t mxs_pcre2_simple_match(const char* pattern, const char* subje
     }
     return rval;
 }
+
+/** Characters that are literals when escaped, in PCRE2 and in POSIX regular expressions */
+static const char escaped_literals[] = "\\.*[]^$/-,;:=!@#%&~\" ";
+
+/**
+ * Skip a bracket expression
+ *
+ * @param ptr Pointer to the opening bracket
+ *
+ * @return Pointer to the closing bracket or NULL if there is none
+ */
+static const char* skip_bracket(const char *ptr)
+{
+    ptr++;
+
+    if (*ptr == '^')
+    {
+        ptr++;
+    }
+
+    if (*ptr == ']')
+    {
+        /** A leading bracket is a part of the set */
+        ptr++;
+    }
+
+    while (*ptr && *ptr != ']')
+    {
+        if (*ptr == '[' && (ptr[1] == ':' || ptr[1] == '.' || ptr[1] == '='))
+        {
+            /** A character class such as [:alpha:] */
+            const char *end = strchr(ptr + 2, ']');
+
+            if (end == NULL)
+            {
+                return NULL;
+            }
+
+            ptr = end;
+        }
+        else if (*ptr == '\\' && ptr[1])
+        {
+            ptr++;
+        }
+
+        ptr++;
+    }
+
+    return *ptr ? ptr : NULL;
+}
+
+/**
+ * Find a literal string that every match of a regular expression contains.
+ *
+ * The pattern is scanned conservatively: only characters outside of groups
+ * and not made optional by a quantifier are used and patterns with
+ * alternatives or inline options have no literal. The rules hold for both
+ * PCRE2 and POSIX patterns. If no string is found, the pattern must be
+ * matched against every subject.
+ *
+ * @param pattern  The regular expression
+ * @param caseless Whether the pattern is matched without regard to case
+ * @param dest     Where the longest literal string is stored
+ * @param size     Size of @c dest, a longer literal is truncated
+ *
+ * @return Length of the literal or 0 if none was found
+ */
+size_t mxs_pcre2_get_literal(const char *pattern, bool caseless, char *dest, size_t size)
+{
+    char run[size];
+    size_t run_len = 0;
+    size_t best_len = 0;
+    int depth = 0;
+    /** Alternatives, inline options and verbs are not analyzed */
+    bool analyzable = !strchr(pattern, '|') && !strstr(pattern, "(?") && !strstr(pattern, "(*");
+
+    for (const char *ptr = pattern; analyzable; ptr++)
+    {
+        bool end_run = true;
+        bool drop_last = false;
+        char c = *ptr;
+
+        if (c == '\\')
+        {
+            c = *++ptr;
+
+            if (c == '\0' || c == '(' || c == ')')
+            {
+                analyzable = false;
+                break;
+            }
+            else if (depth == 0 && strchr(escaped_literals, c))
+            {
+                end_run = false;
+            }
+            else if (c == '{')
+            {
+                /** Skip the interval, it can make the previous character optional */
+                const char *end = strstr(ptr, "\\}");
+                drop_last = true;
+
+                if (end == NULL)
+                {
+                    break;
+                }
+
+                ptr = end + 1;
+            }
+            else
+            {
+                /** Skip the arguments of escapes such as \x41 or \k<name> */
+                drop_last = true;
+
+                while (ptr[1] && (isalnum((unsigned char)ptr[1]) || strchr("<>'_-", ptr[1])))
+                {
+                    ptr++;
+                }
+            }
+        }
+        else if (c == '[')
+        {
+            if ((ptr = skip_bracket(ptr)) == NULL)
+            {
+                analyzable = false;
+                break;
+            }
+        }
+        else if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')')
+        {
+            if (--depth < 0)
+            {
+                analyzable = false;
+                break;
+            }
+        }
+        else if (c == '*' || c == '?' || (c == '+' && ptr[1] && strchr("*?{+", ptr[1])))
+        {
+            /** Stacked quantifiers can make the character optional */
+            drop_last = true;
+        }
+        else if (c == '{')
+        {
+            drop_last = true;
+
+            /** Skip the interval */
+            if ((ptr = strchr(ptr, '}')) == NULL)
+            {
+                break;
+            }
+        }
+        else if (c != '\0' && c != '+' && c != '.' && c != '^' && c != '$' && depth == 0 &&
+                 (!caseless || (unsigned char)c < 0x80))
+        {
+            end_run = false;
+        }
+
+        if (!end_run && run_len < size - 1)
+        {
+            run[run_len++] = c;
+        }
+        else if (end_run)
+        {
+            if (drop_last && run_len > 0)
+            {
+                run_len--;
+            }
+
+            if (run_len > best_len)
+            {
+                best_len = run_len;
+                memcpy(dest, run, run_len);
+            }
+
+            run_len = 0;
+        }
+
+        if (*ptr == '\0')
+        {
+            break;
+        }
+    }
+
+    if (!analyzable)
+    {
+        best_len = 0;
+    }
+
+    dest[best_len] = '\0';
+    return best_len;
+}
+
+/**
+ * Check whether a subject contains a literal string. This is used to skip
+ * the matching of a regular expression when the subject lacks the literal
+ * found with mxs_pcre2_get_literal().
+ *
+ * @param subject     The subject
+ * @param subject_len Length of the subject
+ * @param literal     The literal string
+ * @param literal_len Length of the literal
+ * @param caseless    Whether the case of ASCII characters is ignored
+ *
+ * @return True if the subject contains the literal
+ */
+bool mxs_pcre2_has_literal(const char *subject, size_t subject_len,
+                           const char *literal, size_t literal_len, bool caseless)
+{
+    if (!caseless)
+    {
+        return memmem(subject, subject_len, literal, literal_len) != NULL;
+    }
+
+    if (literal_len > subject_len)
+    {
+        return false;
+    }
+
+    char lower = tolower((unsigned char)literal[0]);
+    char upper = toupper((unsigned char)literal[0]);
+    const char *end = subject + subject_len - literal_len + 1;
+
+    for (const char *ptr = subject; ptr < end; ptr++)
+    {
+        if ((*ptr == lower || *ptr == upper) &&
+            strncasecmp(ptr + 1, literal + 1, literal_len - 1) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.c Metrics in the OpenMetrics text format
+ *
+ * Each subsystem prints its own metric families. Nothing is collected before
+ * it is printed, the values are read from the statistics as they are.
+ *
+ * The same functions fill the statistics segment, in which case they are
+ * called without a DCB.
+ */
+
+#include "maxscale/metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/maxscale.h>
+#include <maxscale/metrics_segment.h>
+
+/** The percentiles shown for the latencies */
+static const char *latency_quantiles[] = {"0.5", "0.99", "0.999"};
+static const double latency_percentiles[] = {50, 99, 99.9};
+
+/** The initial number of records in the statistics segment */
+#define SEGMENT_INITIAL_CAPACITY 256
+
+/** The name of the housekeeper task that updates the statistics segment */
+#define SEGMENT_TASK_NAME "metrics_segment"
+
+/**
+ * The statistics segment. It is only accessed by the thread that starts and
+ * stops it and by the housekeeper thread, which does not run concurrently
+ * with the former.
+ */
+static struct
+{
+    char                   *path;        /**< Path of the segment file */
+    int                     interval;    /**< Seconds between the updates */
+    METRICS_SEGMENT_HEADER *header;      /**< The mapped segment */
+    size_t                  size;        /**< Size of the mapping */
+    METRICS_SEGMENT_RECORD *records;     /**< The records being collected */
+    uint32_t                n_records;   /**< Number of collected records */
+    uint32_t                max_records; /**< Number of allocated records */
+    uint32_t                type;        /**< Type of the family being collected */
+    bool                    failed;      /**< Memory allocation failed during collection */
+} segment;
+
+static uint32_t segment_type(const char *type)
+{
+    if (strcmp(type, "counter") == 0)
+    {
+        return METRICS_SEGMENT_COUNTER;
+    }
+    else if (strcmp(type, "gauge") == 0)
+    {
+        return METRICS_SEGMENT_GAUGE;
+    }
+    else
+    {
+        return METRICS_SEGMENT_SUMMARY;
+    }
+}
+
+/**
+ * Collect a record of the statistics segment
+ *
+ * @param name        Name of the sample
+ * @param suffix      Suffix of the name
+ * @param label       Name of the label or NULL
+ * @param label_value Value of the label
+ * @param quantile    The quantile of a latency or 0
+ * @param value       Value of the sample
+ */
+static void segment_add(const char *name, const char *suffix, const char *label,
+                        const char *label_value, double quantile, int64_t value)
+{
+    if (segment.n_records == segment.max_records)
+    {
+        uint32_t max_records = segment.max_records ? 2 * segment.max_records : SEGMENT_INITIAL_CAPACITY;
+        METRICS_SEGMENT_RECORD *records = MXS_REALLOC(segment.records, max_records * sizeof(*records));
+
+        if (!records)
+        {
+            segment.failed = true;
+            return;
+        }
+
+        segment.records = records;
+        segment.max_records = max_records;
+    }
+
+    METRICS_SEGMENT_RECORD *record = &segment.records[segment.n_records++];
+    memset(record, 0, sizeof(*record));
+    snprintf(record->name, sizeof(record->name), "%s%s", name, suffix);
+    snprintf(record->label, sizeof(record->label), "%s", label ? label : "");
+    snprintf(record->label_value, sizeof(record->label_value), "%s", label ? label_value : "");
+    record->type = segment.type;
+    record->quantile = quantile;
+    record->value = value;
+}
+
+/**
+ * Create and map a new segment file. The file is written under a temporary
+ * name and then renamed, so that a reader never sees an incomplete header.
+ *
+ * @param capacity Number of records the segment has room for
+ * @param size     The size of the mapping is stored here
+ *
+ * @return The mapped segment or NULL on error
+ */
+static METRICS_SEGMENT_HEADER* segment_create(uint32_t capacity, size_t *size)
+{
+    char tmp[strlen(segment.path) + sizeof(".tmp")];
+    sprintf(tmp, "%s.tmp", segment.path);
+
+    *size = sizeof(METRICS_SEGMENT_HEADER) + (size_t)capacity * sizeof(METRICS_SEGMENT_RECORD);
+
+    METRICS_SEGMENT_HEADER *header = NULL;
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1 || ftruncate(fd, *size) == -1 ||
+        (header = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to create the statistics segment '%s': %d, %s", tmp,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        header = NULL;
+    }
+    else
+    {
+        memcpy(header->magic, METRICS_SEGMENT_MAGIC, sizeof(header->magic));
+        header->version = METRICS_SEGMENT_VERSION;
+        header->header_size = sizeof(METRICS_SEGMENT_HEADER);
+        header->record_size = sizeof(METRICS_SEGMENT_RECORD);
+        header->capacity = capacity;
+        header->pid = getpid();
+        header->started = maxscale_started();
+        header->interval = segment.interval;
+
+        if (rename(tmp, segment.path) == -1)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to rename '%s' to '%s': %d, %s", tmp, segment.path,
+                      errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+            munmap(header, *size);
+            header = NULL;
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+
+        if (!header)
+        {
+            unlink(tmp);
+        }
+    }
+
+    return header;
+}
+
+/**
+ * Collect the metrics and copy them to the statistics segment
+ */
+static void segment_update(void *data)
+{
+    segment.n_records = 0;
+    segment.failed = false;
+    metrics_write(NULL);
+
+    if (segment.failed)
+    {
+        return;
+    }
+
+    if (segment.n_records > segment.header->capacity)
+    {
+        size_t size;
+        METRICS_SEGMENT_HEADER *header = segment_create(2 * segment.n_records, &size);
+
+        if (!header)
+        {
+            return;
+        }
+
+        segment.header->replaced = 1;
+        munmap(segment.header, segment.size);
+        segment.header = header;
+        segment.size = size;
+    }
+
+    METRICS_SEGMENT_HEADER *header = segment.header;
+    uint64_t generation = header->generation;
+
+    atomic_store_uint64(&header->generation, generation + 1);
+    atomic_synchronize();
+
+    memcpy(header + 1, segment.records, segment.n_records * sizeof(METRICS_SEGMENT_RECORD));
+    header->n_records = segment.n_records;
+    header->updated = time(NULL);
+
+    atomic_store_uint64(&header->generation, generation + 2);
+}
+
+bool metrics_segment_start(const char *path, int interval)
+{
+    ss_dassert(!segment.header);
+    segment.path = MXS_STRDUP_A(path);
+    segment.interval = interval;
+    segment.header = segment_create(SEGMENT_INITIAL_CAPACITY, &segment.size);
+
+    if (!segment.header)
+    {
+        MXS_FREE(segment.path);
+        segment.path = NULL;
+        return false;
+    }
+
+    segment_update(NULL);
+    hktask_add(SEGMENT_TASK_NAME, segment_update, NULL, interval);
+    MXS_NOTICE("Writing statistics to '%s' every %d seconds.", path, interval);
+
+    return true;
+}
+
+void metrics_segment_stop()
+{
+    if (segment.header)
+    {
+        hktask_remove(SEGMENT_TASK_NAME);
+        munmap(segment.header, segment.size);
+        unlink(segment.path);
+        MXS_FREE(segment.path);
+        MXS_FREE(segment.records);
+        memset(&segment, 0, sizeof(segment));
+    }
+}
+
+/**
+ * Print a label value. Backslashes, double quotes and line feeds are escaped.
+ */
+static void print_label_value(DCB *dcb, const char *value)
+{
+    const char *start = value;
+    const char *p;
+
+    for (p = value; *p; p++)
+    {
+        if (*p == '\\' || *p == '"' || *p == '\n')
+        {
+            dcb_printf(dcb, "%.*s\\%c", (int)(p - start), start, *p == '\n' ? 'n' : *p);
+            start = p + 1;
+        }
+    }
+
+    dcb_printf(dcb, "%s", start);
+}
+
+void metrics_family(DCB *dcb, const char *family, const char *type, const char *unit,
+                    const char *help)
+{
+    if (!dcb)
+    {
+        segment.type = segment_type(type);
+        return;
+    }
+
+    dcb_printf(dcb, "# TYPE %s %s\n", family, type);
+
+    if (unit)
+    {
+        dcb_printf(dcb, "# UNIT %s %s\n", family, unit);
+    }
+
+    dcb_printf(dcb, "# HELP %s %s\n", family, help);
+}
+
+void metrics_sample(DCB *dcb, const char *name, const char *label, const char *label_value,
+                    int64_t value)
+{
+    if (!dcb)
+    {
+        segment_add(name, "", label, label_value, 0, value);
+    }
+    else if (label)
+    {
+        dcb_printf(dcb, "%s{%s=\"", name, label);
+        print_label_value(dcb, label_value);
+        dcb_printf(dcb, "\"} %" PRId64 "\n", value);
+    }
+    else
+    {
+        dcb_printf(dcb, "%s %" PRId64 "\n", name, value);
+    }
+}
+
+void metrics_latency(DCB *dcb, const char *family, const char *label, const char *label_value,
+                     ts_hist_t hist)
+{
+    if (!dcb)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            segment_add(family, "", label, label_value, latency_percentiles[i] / 100,
+                        hist ? ts_hist_percentile(hist, latency_percentiles[i]) : 0);
+        }
+
+        segment_add(family, "_count", label, label_value, 0, hist ? ts_hist_count(hist) : 0);
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        dcb_printf(dcb, "%s{%s=\"", family, label);
+        print_label_value(dcb, label_value);
+        dcb_printf(dcb, "\",quantile=\"%s\"} %.6f\n", latency_quantiles[i],
+                   hist ? ts_hist_percentile(hist, latency_percentiles[i]) / 1000000.0 : 0.0);
+    }
+
+    dcb_printf(dcb, "%s_count{%s=\"", family, label);
+    print_label_value(dcb, label_value);
+    dcb_printf(dcb, "\"} %" PRId64 "\n", hist ? ts_hist_count(hist) : 0);
+}
+
+void metrics_write(DCB *dcb)
+{
+    metrics_family(dcb, "maxscale_uptime_seconds", "gauge", "seconds",
+                   "Time since MaxScale was started");
+    metrics_sample(dcb, "maxscale_uptime_seconds", NULL, NULL, maxscale_uptime());
+    metrics_family(dcb, "maxscale_threads", "gauge", NULL, "Number of polling threads");
+    metrics_sample(dcb, "maxscale_threads", NULL, NULL, config_threadcount());
+
+    dprintPollMetrics(dcb);
+    dprintAllServicesMetrics(dcb);
+    dprintAllServersMetrics(dcb);
+    dprintAllFiltersMetrics(dcb);
+
+    if (dcb)
+    {
+        dcb_printf(dcb, "# EOF\n");
+    }
+}
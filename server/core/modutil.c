@@ -30,6 +30,7 @@
 #include <maxscale/alloc.h>
 #include <maxscale/poll.h>
 #include <maxscale/modutil.h>
+#include <maxscale/mysql_utils.h>
 #include <maxscale/platform.h>
 #include <strings.h>
 
@@ -713,6 +714,213 @@ modutil_count_signal_packets(GWBUF *reply, int use_ok,  int n_found, int* more)
     return (eof + err);
 }
 
+/**
+ * @brief Follow one packet of a reply
+ *
+ * @param state   The progress of the replies
+ * @param results Whether the reply is made of results or of single OK packets
+ * @param data    The start of the packet
+ * @param len     Length of @c data, at most the length of the packet
+ * @param pktlen  Length of the packet
+ * @param status  The server status flags of a packet that ends a result
+ *
+ * @return The MXS_REPLY_* markers of the packet
+ */
+static uint16_t reply_packet_flags(MXS_REPLY_STATE *state, bool results, const uint8_t *data,
+                                   size_t len, uint32_t pktlen, uint16_t *status)
+{
+    uint8_t cmd = data[MYSQL_HEADER_LEN];
+    uint16_t flags = 0;
+    bool continued = state->continued;
+    *status = 0;
+    state->continued = pktlen - MYSQL_HEADER_LEN == GW_MYSQL_MAX_PACKET_LEN;
+
+    if (continued)
+    {
+        /** The rest of a large packet, only its first part tells what it is */
+    }
+    else if (state->in_rset)
+    {
+        if (cmd == MYSQL_REPLY_ERR)
+        {
+            flags = MXS_REPLY_ERR | MXS_REPLY_RESULT_END;
+            state->in_rset = false;
+        }
+        else if (pktlen == MYSQL_EOF_PACKET_LEN && cmd == MYSQL_REPLY_EOF)
+        {
+            uint16_t eof_status = gw_mysql_get_byte2(data + MYSQL_HEADER_LEN + 3);
+            flags = MXS_REPLY_EOF;
+
+            /** A COM_STMT_EXECUTE that opens a cursor only sends the column
+             * definitions, the rows are read with COM_STMT_FETCH */
+            if (++state->n_eof == 2 || (eof_status & SERVER_STATUS_CURSOR_EXISTS))
+            {
+                *status = eof_status;
+                flags |= MXS_REPLY_RESULT_END;
+                state->in_rset = false;
+            }
+        }
+    }
+    else if (cmd == MYSQL_REPLY_OK)
+    {
+        size_t pos = MYSQL_HEADER_LEN + 1;
+
+        if (pos < len)
+        {
+            pos += mxs_leint_bytes(data + pos); // Affected rows
+        }
+
+        if (pos < len)
+        {
+            pos += mxs_leint_bytes(data + pos); // Last insert ID
+        }
+
+        if (pos + 2 <= len)
+        {
+            *status = gw_mysql_get_byte2(data + pos);
+        }
+
+        flags = MXS_REPLY_OK | MXS_REPLY_RESULT_END;
+    }
+    else if (cmd == MYSQL_REPLY_ERR)
+    {
+        flags = MXS_REPLY_ERR | MXS_REPLY_RESULT_END;
+    }
+    else if (cmd == MYSQL_REPLY_LOCAL_INFILE)
+    {
+        /** The client sends the file next and the server replies with an OK */
+        flags = MXS_REPLY_LOCAL_INFILE;
+    }
+    else if (results)
+    {
+        flags = MXS_REPLY_RSET_START;
+        state->in_rset = true;
+        state->n_eof = 0;
+    }
+
+    if ((flags & MXS_REPLY_RESULT_END) && !(*status & SERVER_MORE_RESULTS_EXIST))
+    {
+        flags |= MXS_REPLY_END;
+    }
+
+    return flags;
+}
+
+void modutil_reset_reply_state(MXS_REPLY_STATE *state)
+{
+    state->in_rset = false;
+    state->n_eof = 0;
+    state->continued = false;
+}
+
+/** The longest possible start of an OK packet up to and including the status */
+#define MXS_REPLY_PEEK_LEN (MYSQL_HEADER_LEN + 1 + 9 + 9 + 2)
+
+MXS_REPLY_INFO* modutil_parse_reply(MXS_REPLY_STATE *state, uint8_t command, GWBUF *buffer)
+{
+    bool results;
+
+    switch (command)
+    {
+    case MYSQL_COM_QUERY:
+    case MYSQL_COM_STMT_EXECUTE:
+        results = true;
+        break;
+
+    case MYSQL_COM_STMT_PREPARE:
+    case MYSQL_COM_STMT_FETCH:
+    case MYSQL_COM_FIELD_LIST:
+    case MYSQL_COM_STATISTICS:
+    case MYSQL_COM_PROCESS_INFO:
+    case MYSQL_COM_BINLOG_DUMP:
+        /** These replies have packets that only look like OK packets */
+        return NULL;
+
+    default:
+        /** The other commands are answered with a single OK or ERR packet */
+        results = false;
+        break;
+    }
+
+    MXS_REPLY_INFO *info = (MXS_REPLY_INFO*)MXS_CALLOC(1, sizeof(MXS_REPLY_INFO));
+    int size = 0;
+    GWBUF *buf = buffer;
+    size_t offset = 0;
+    size_t pos = 0;
+
+    while (info && buf)
+    {
+        uint8_t data[MXS_REPLY_PEEK_LEN];
+        size_t n = gwbuf_copy_data(buf, offset, sizeof(data), data);
+        ss_dassert(n > MYSQL_HEADER_LEN);
+        uint32_t pktlen = MYSQL_GET_PAYLOAD_LEN(data) + MYSQL_HEADER_LEN;
+
+        if (info->n_packets == size)
+        {
+            size = size ? size * 2 : 8;
+            MXS_REPLY_PACKET *packets = (MXS_REPLY_PACKET*)MXS_REALLOC(info->packets,
+                                                                       size * sizeof(MXS_REPLY_PACKET));
+            if (packets == NULL)
+            {
+                modutil_free_reply_info(info);
+                info = NULL;
+                break;
+            }
+
+            info->packets = packets;
+        }
+
+        MXS_REPLY_PACKET *packet = &info->packets[info->n_packets++];
+        packet->offset = pos;
+        packet->length = pktlen;
+        packet->flags = reply_packet_flags(state, results, data, MXS_MIN(n, pktlen),
+                                           pktlen, &packet->status);
+
+        if (packet->flags & MXS_REPLY_END)
+        {
+            info->n_replies++;
+        }
+
+        pos += pktlen;
+        offset += pktlen;
+
+        while (buf && offset >= GWBUF_LENGTH(buf))
+        {
+            offset -= GWBUF_LENGTH(buf);
+            buf = buf->next;
+        }
+    }
+
+    return info;
+}
+
+void modutil_free_reply_info(MXS_REPLY_INFO *info)
+{
+    if (info)
+    {
+        MXS_FREE(info->packets);
+        MXS_FREE(info);
+    }
+}
+
+static void free_reply_info(void *data)
+{
+    modutil_free_reply_info((MXS_REPLY_INFO*)data);
+}
+
+void modutil_add_reply_info(GWBUF *buffer, MXS_REPLY_INFO *info)
+{
+    if (!gwbuf_add_buffer_object(buffer, GWBUF_REPLY_INFO, info, free_reply_info))
+    {
+        modutil_free_reply_info(info);
+    }
+}
+
+const MXS_REPLY_INFO* modutil_get_reply_info(GWBUF *buffer)
+{
+    return (const MXS_REPLY_INFO*)gwbuf_get_buffer_object_data(buffer, GWBUF_REPLY_INFO);
+}
+
 /**
  * Create parse error and EPOLLIN event to event queue of the backend DCB.
  * When event is notified the error message is processed as error reply and routed
@@ -1221,6 +1429,214 @@ char* modutil_get_canonical(GWBUF* querybuf)
 }
 
 
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+static inline bool is_canonical_word_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+/**
+ * @brief Create the canonical form of a statement into a caller supplied buffer
+ *
+ * The statement is processed in a single pass without allocating memory.
+ * String and numeric literals are replaced with a bare question mark, comments
+ * are replaced with whitespace and all whitespace is squeezed into single
+ * spaces. Quoted identifiers, variables and executable comments, including
+ * their version numbers, are copied as such.
+ *
+ * @param sql  The statement
+ * @param len  Length of the statement
+ * @param dest Buffer with room for at least @c len + 1 bytes, the canonical
+ *             form is never longer than the statement
+ * @param hash If not NULL, the 64-bit FNV-1a hash of the canonical form is
+ *             stored here
+ *
+ * @return The length of the canonical form, which is null terminated
+ */
+size_t modutil_canonicalize(const char* sql, size_t len, char* dest, uint64_t* hash)
+{
+    const char* ptr = sql;
+    const char* end = sql + len;
+    char* out = dest;
+    bool space = false;
+
+    while (ptr < end)
+    {
+        char c = *ptr;
+
+        if (isspace((unsigned char)c))
+        {
+            space = true;
+            ptr++;
+            continue;
+        }
+
+        if (c == '#' || (c == '-' && ptr + 2 < end && ptr[1] == '-' && isspace((unsigned char)ptr[2])))
+        {
+            while (ptr < end && *ptr != '\n')
+            {
+                ptr++;
+            }
+            space = true;
+            continue;
+        }
+
+        if (c == '/' && ptr + 1 < end && ptr[1] == '*')
+        {
+            if (ptr + 2 < end && (ptr[2] == '!' || (ptr[2] == 'M' && ptr + 3 < end && ptr[3] == '!')))
+            {
+                /** Executable comment, the contents are processed normally */
+                const char* start = ptr;
+                ptr += ptr[2] == '!' ? 3 : 4;
+
+                while (ptr < end && isdigit((unsigned char)*ptr))
+                {
+                    ptr++;
+                }
+
+                if (space && out > dest)
+                {
+                    *out++ = ' ';
+                }
+
+                memcpy(out, start, ptr - start);
+                out += ptr - start;
+                space = false;
+                continue;
+            }
+
+            ptr += 2;
+
+            while (ptr + 1 < end && !(ptr[0] == '*' && ptr[1] == '/'))
+            {
+                ptr++;
+            }
+
+            ptr = ptr + 1 < end ? ptr + 2 : end;
+            space = true;
+            continue;
+        }
+
+        if (space && out > dest)
+        {
+            *out++ = ' ';
+        }
+
+        space = false;
+
+        if (c == '\'' || c == '"')
+        {
+            /** String literal */
+            ptr++;
+
+            while (ptr < end)
+            {
+                if (*ptr == '\\')
+                {
+                    ptr = ptr + 1 < end ? ptr + 2 : end;
+                }
+                else if (*ptr == c)
+                {
+                    ptr++;
+
+                    if (ptr < end && *ptr == c)
+                    {
+                        ptr++;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    ptr++;
+                }
+            }
+
+            *out++ = '?';
+        }
+        else if (c == '`')
+        {
+            /** Quoted identifier */
+            const char* start = ptr++;
+
+            while (ptr < end)
+            {
+                if (*ptr++ == '`')
+                {
+                    if (ptr < end && *ptr == '`')
+                    {
+                        ptr++;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            }
+
+            memcpy(out, start, ptr - start);
+            out += ptr - start;
+        }
+        else if (isdigit((unsigned char)c) ||
+                 (c == '.' && ptr + 1 < end && isdigit((unsigned char)ptr[1]) &&
+                  (ptr == sql || !is_canonical_word_char(ptr[-1]))))
+        {
+            /** Numeric literal, e.g. 1, 1.5, .5, 1e-5 or 0xff */
+            while (ptr < end)
+            {
+                if (is_canonical_word_char(*ptr) || *ptr == '.')
+                {
+                    ptr++;
+                }
+                else if ((*ptr == '-' || *ptr == '+') && (ptr[-1] == 'e' || ptr[-1] == 'E') &&
+                         ptr + 1 < end && isdigit((unsigned char)ptr[1]))
+                {
+                    ptr++;
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            *out++ = '?';
+        }
+        else if (is_canonical_word_char(c))
+        {
+            /** Keyword, identifier or variable name */
+            while (ptr < end && is_canonical_word_char(*ptr))
+            {
+                *out++ = *ptr++;
+            }
+        }
+        else
+        {
+            *out++ = *ptr++;
+        }
+    }
+
+    *out = '\0';
+
+    if (hash)
+    {
+        uint64_t h = FNV_OFFSET_BASIS;
+
+        for (const char* p = dest; p < out; p++)
+        {
+            h ^= (uint8_t)*p;
+            h *= FNV_PRIME;
+        }
+
+        *hash = h;
+    }
+
+    return out - dest;
+}
+
 char* modutil_MySQL_bypass_whitespace(char* sql, size_t len)
 {
     char *i = sql;
@@ -33,8 +33,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <maxscale/alloc.h>
+#include <errmsg.h>
 #include <mysqld_error.h>
 #include <maxscale/paths.h>
 #include <maxscale/log_manager.h>
@@ -42,6 +44,7 @@
 #include <maxscale/pcre2.h>
 #include <maxscale/secrets.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 
 #include "maxscale/config.h"
 #include "maxscale/externcmd.h"
@@ -52,6 +55,26 @@ static MXS_MONITOR  *allMonitors = NULL;
 static SPINLOCK monLock = SPINLOCK_INIT;
 
 static void monitor_server_free_all(MXS_MONITOR_SERVERS *servers);
+static uint64_t mon_clock_ms();
+
+/**
+ * A server address that a monitor failed to connect to. The other monitors
+ * that monitor a server with the same address and port use the result
+ * instead of connecting to it until their monitor interval has passed.
+ */
+typedef struct mon_unreachable
+{
+    char                   *address;
+    unsigned short          port;
+    const MXS_MONITOR      *monitor; /**< The monitor that failed to connect */
+    uint64_t                when;    /**< When the connection failed */
+    mxs_connect_result_t    result;
+    char                    error[MYSQL_ERRMSG_SIZE];
+    struct mon_unreachable *next;
+} MON_UNREACHABLE;
+
+static MON_UNREACHABLE *unreachable = NULL;
+static SPINLOCK unreachable_lock = SPINLOCK_INIT;
 
 /** Server type specific bits */
 static unsigned int server_type_bits = SERVER_MASTER | SERVER_SLAVE |
@@ -107,6 +130,8 @@ monitor_alloc(char *name, char *module)
     mon->parameters = NULL;
     mon->created_online = false;
     mon->server_pending_changes = false;
+    mon->tick_start = 0;
+    mon->tick_time = 0;
     spinlock_init(&mon->lock);
     spinlock_acquire(&monLock);
     mon->next = allMonitors;
@@ -272,6 +297,7 @@ bool monitorAddServer(MXS_MONITOR *mon, SERVER *server)
         db->mon_prev_status = -1;
         /* pending status is updated by get_replication_tree */
         db->pending_status = 0;
+        db->probe_time = 0;
 
         monitor_state_t old_state = mon->state;
 
@@ -471,6 +497,18 @@ monitorShow(DCB *dcb, MXS_MONITOR *monitor)
         sep = ", ";
     }
 
+    dcb_printf(dcb, "\n");
+    dcb_printf(dcb, "Monitor cycle:     %lu milliseconds\n", monitor->tick_time);
+    dcb_printf(dcb, "Probe times:       ");
+
+    sep = "";
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        dcb_printf(dcb, "%s[%s]:%d %lu ms", sep, db->server->name, db->server->port, db->probe_time);
+        sep = ", ";
+    }
+
     dcb_printf(dcb, "\n");
 
     if (monitor->handle)
@@ -1144,6 +1182,106 @@ monitor_launch_script(MXS_MONITOR* mon, MXS_MONITOR_SERVERS* ptr, const char* sc
     externcmd_free(cmd);
 }
 
+/**
+ * Find the unreachable entry of a server address, the caller must hold
+ * unreachable_lock.
+ */
+static MON_UNREACHABLE** mon_find_unreachable(const SERVER *server)
+{
+    MON_UNREACHABLE **ptr = &unreachable;
+
+    while (*ptr && ((*ptr)->port != server->port || strcmp((*ptr)->address, server->name) != 0))
+    {
+        ptr = &(*ptr)->next;
+    }
+
+    return ptr;
+}
+
+/**
+ * Check whether another monitor failed to connect to the address of a server
+ * during the last monitor interval.
+ *
+ * @param mon The monitor that is about to connect
+ * @param server The server
+ * @param result Where the result of the failed attempt is stored
+ * @return True if the connection attempt can be skipped
+ */
+static bool mon_is_unreachable(const MXS_MONITOR *mon, const SERVER *server,
+                               mxs_connect_result_t *result)
+{
+    bool rval = false;
+    spinlock_acquire(&unreachable_lock);
+    MON_UNREACHABLE *entry = *mon_find_unreachable(server);
+
+    if (entry && entry->monitor != mon && mon_clock_ms() - entry->when < mon->interval)
+    {
+        *result = entry->result;
+        rval = true;
+    }
+
+    spinlock_release(&unreachable_lock);
+    return rval;
+}
+
+/**
+ * Store or clear the result of a connection attempt to the address of a server
+ *
+ * @param mon The monitor that connected
+ * @param server The server
+ * @param con The connection, NULL if the connection succeeded
+ * @param result The result of the connection attempt
+ */
+static void mon_set_unreachable(const MXS_MONITOR *mon, const SERVER *server,
+                                MYSQL *con, mxs_connect_result_t result)
+{
+    spinlock_acquire(&unreachable_lock);
+    MON_UNREACHABLE **ptr = mon_find_unreachable(server);
+    MON_UNREACHABLE *entry = *ptr;
+
+    if (con == NULL)
+    {
+        if (entry)
+        {
+            *ptr = entry->next;
+            MXS_FREE(entry->address);
+            MXS_FREE(entry);
+        }
+    }
+    else if (entry || ((entry = MXS_CALLOC(1, sizeof(MON_UNREACHABLE))) &&
+                       (entry->address = MXS_STRDUP(server->name))))
+    {
+        if (*ptr == NULL)
+        {
+            entry->port = server->port;
+            *ptr = entry;
+        }
+
+        entry->monitor = mon;
+        entry->when = mon_clock_ms();
+        entry->result = result;
+        snprintf(entry->error, sizeof(entry->error), "%s", mysql_error(con));
+    }
+    else
+    {
+        MXS_FREE(entry);
+    }
+
+    spinlock_release(&unreachable_lock);
+}
+
+/**
+ * Whether a failed connection attempt means that the address can't be reached.
+ * Errors such as authentication failures are specific to the monitor.
+ */
+static bool mon_is_network_error(MYSQL *con, mxs_connect_result_t result)
+{
+    unsigned int err = mysql_errno(con);
+
+    return result == MONITOR_CONN_TIMEOUT || err == CR_CONNECTION_ERROR ||
+           err == CR_CONN_HOST_ERROR || err == CR_UNKNOWN_HOST || err == CR_SERVER_LOST;
+}
+
 /**
  * Connect to a database. This will always leave a valid database handle in the
  * database->con pointer. This allows the user to call MySQL C API functions to
@@ -1170,6 +1308,12 @@ mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
 
     if ((database->con = mysql_init(NULL)))
     {
+        /** Another monitor already found the server unreachable */
+        if (mon_is_unreachable(mon, database->server, &rval))
+        {
+            return rval;
+        }
+
         char *uname = mon->user;
         char *passwd = mon->password;
 
@@ -1199,6 +1343,15 @@ mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
             {
                 rval = MONITOR_CONN_REFUSED;
             }
+
+            if (mon_is_network_error(database->con, rval))
+            {
+                mon_set_unreachable(mon, database->server, database->con, rval);
+            }
+        }
+        else
+        {
+            mon_set_unreachable(mon, database->server, NULL, rval);
         }
 
         MXS_FREE(dpwd);
@@ -1220,11 +1373,28 @@ mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
 void
 mon_log_connect_error(MXS_MONITOR_SERVERS* database, mxs_connect_result_t rval)
 {
+    char error[MYSQL_ERRMSG_SIZE];
+    snprintf(error, sizeof(error), "%s", mysql_error(database->con));
+
+    if (mysql_errno(database->con) == 0)
+    {
+        /** The connection attempt was skipped, use the error of the monitor
+         * that made the attempt */
+        spinlock_acquire(&unreachable_lock);
+        MON_UNREACHABLE *entry = *mon_find_unreachable(database->server);
+
+        if (entry)
+        {
+            snprintf(error, sizeof(error), "%s", entry->error);
+        }
+
+        spinlock_release(&unreachable_lock);
+    }
+
     MXS_ERROR(rval == MONITOR_CONN_TIMEOUT ?
               "Monitor timed out when connecting to server [%s]:%d : \"%s\"" :
               "Monitor was unable to connect to server [%s]:%d : \"%s\"",
-              database->server->name, database->server->port,
-              mysql_error(database->con));
+              database->server->name, database->server->port, error);
 }
 
 static void mon_log_state_change(MXS_MONITOR_SERVERS *ptr)
@@ -1266,6 +1436,18 @@ MXS_MONITOR* monitor_server_in_use(const SERVER *server)
     return rval;
 }
 
+void monitor_request_check(const SERVER *server)
+{
+    MXS_MONITOR *mon = monitor_server_in_use(server);
+
+    /** Once the server is down, the errors of the remaining connections
+     * to it do not need to wake up the monitor again. */
+    if (mon && mon->state == MONITOR_STATE_RUNNING && !SERVER_IS_DOWN(server))
+    {
+        mon->server_pending_changes = true;
+    }
+}
+
 static bool create_monitor_config(const MXS_MONITOR *monitor, const char *filename)
 {
     int file = open(filename, O_EXCL | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
@@ -1402,14 +1584,94 @@ void release_monitor_servers(MXS_MONITOR *monitor)
         ptr = ptr->next;
     }
 }
+/**
+ * @brief Get a monotonic timestamp in milliseconds
+ *
+ * @return The current time in milliseconds
+ */
+static uint64_t mon_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+typedef struct mon_probe_task
+{
+    MXS_MONITOR         *monitor;
+    MXS_MONITOR_SERVERS *database;
+    mxs_monitor_probe_t  probe;
+    THREAD               thread;
+    bool                 started;
+} MON_PROBE_TASK;
+
+static void mon_probe_one(MON_PROBE_TASK *task)
+{
+    uint64_t start = mon_clock_ms();
+    task->probe(task->monitor, task->database);
+    task->database->probe_time = mon_clock_ms() - start;
+}
+
+static void mon_probe_thread(void *data)
+{
+    if (mysql_thread_init() == 0)
+    {
+        mon_probe_one((MON_PROBE_TASK*)data);
+        mysql_thread_end();
+    }
+    else
+    {
+        MXS_ERROR("mysql_thread_init failed when probing server '%s'.",
+                  ((MON_PROBE_TASK*)data)->database->server->unique_name);
+    }
+}
+
+void mon_probe_servers(MXS_MONITOR *monitor, mxs_monitor_probe_t probe)
+{
+    int n = 0;
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        n++;
+    }
+
+    MON_PROBE_TASK tasks[n > 0 ? n : 1];
+    int i = 0;
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next, i++)
+    {
+        tasks[i].monitor = monitor;
+        tasks[i].database = db;
+        tasks[i].probe = probe;
+        tasks[i].started = n > 1 &&
+            thread_start(&tasks[i].thread, mon_probe_thread, &tasks[i]) != NULL;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (tasks[i].started)
+        {
+            thread_wait(tasks[i].thread);
+        }
+        else
+        {
+            /** A single server, or a thread could not be started */
+            mon_probe_one(&tasks[i]);
+        }
+    }
+}
+
 /**
   * Sets the current status of all servers monitored by this monitor to
   * the pending status. This should only be called at the beginning of
-  * a monitor loop, after the servers are locked.
+  * a monitor loop, after the servers are locked. This also starts the
+  * measurement of the duration of the monitoring cycle.
   * @param monitor The target monitor
   */
 void servers_status_pending_to_current(MXS_MONITOR *monitor)
 {
+    monitor->tick_start = mon_clock_ms();
+
     MXS_MONITOR_SERVERS *ptr = monitor->databases;
     while (ptr)
     {
@@ -1421,17 +1683,34 @@ void servers_status_pending_to_current(MXS_MONITOR *monitor)
 /**
   *  Sets the pending status of all servers monitored by this monitor to
   *  the current status. This should only be called at the end of
-  *  a monitor loop, before the servers are released.
+  *  a monitor loop, before the servers are released. This publishes the
+  *  states of the servers to the routers and ends the measurement of the
+  *  duration of the monitoring cycle.
   *  @param monitor The target monitor
   */
 void servers_status_current_to_pending(MXS_MONITOR *monitor)
 {
     MXS_MONITOR_SERVERS *ptr = monitor->databases;
+    int n = 0;
+
     while (ptr)
     {
         ptr->server->status_pending = ptr->server->status;
         ptr = ptr->next;
+        n++;
+    }
+
+    /** Publish the final state of this cycle to the routers */
+    SERVER *servers[n > 0 ? n : 1];
+    n = 0;
+
+    for (ptr = monitor->databases; ptr; ptr = ptr->next)
+    {
+        servers[n++] = ptr->server;
     }
+
+    server_publish_states(servers, n);
+    monitor->tick_time = mon_clock_ms() - monitor->tick_start;
 }
 
 void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_t events)
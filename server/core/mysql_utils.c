@@ -163,7 +163,9 @@ MYSQL *mxs_mysql_real_connect(MYSQL *con, SERVER *server, const char *user, cons
     mysql_optionsv(con, MYSQL_OPT_RECONNECT, &yes);
     mysql_optionsv(con, MYSQL_INIT_COMMAND, "SET SQL_MODE=''");
 
-    MYSQL* mysql = mysql_real_connect(con, server->name, user, passwd, NULL, server->port, NULL, 0);
+    /** Without a host, the connector uses the Unix domain socket */
+    MYSQL* mysql = mysql_real_connect(con, server->socket ? NULL : server->name, user, passwd, NULL,
+                                      server->port, server->socket, 0);
 
     if (mysql)
     {
@@ -13,33 +13,49 @@
 
 #include <maxscale/poll.h>
 
+#include <dlfcn.h>
 #include <errno.h>
+#include <execinfo.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mysql.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/housekeeper.h>
+#include <maxscale/listener.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/paths.h>
 #include <maxscale/platform.h>
+#include <maxscale/probe.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/resultset.h>
 #include <maxscale/server.h>
+#include <maxscale/service.h>
 #include <maxscale/session.h>
 #include <maxscale/statistics.h>
 #include <maxscale/thread.h>
 #include <maxscale/utils.h>
 
+#include "maxscale/buffer.h"
+#include "maxscale/clock.h"
+#include "maxscale/metrics.h"
 #include "maxscale/poll.h"
+#include "maxscale/session.h"
+#include "maxscale/rcu.h"
+#include "maxscale/timer.h"
+#include "maxscale/trace.h"
 
 #define         PROFILE_POLL    0
 
@@ -50,6 +66,7 @@ extern unsigned long hkheartbeat;
 int number_poll_spins;
 int max_poll_sleep;
 static thread_local DCB* current_dcb;
+static thread_local uint64_t events_start; /*< When the events of the cycle were received */
 
 /**
  * @file poll.c  - Abstraction of the epoll functionality
@@ -95,18 +112,47 @@ typedef struct fake_event
     struct fake_event *next;  /*< The next event */
 } fake_event_t;
 
-thread_local int current_thread_id; /**< This thread's ID */
+/**
+ * A task posted to a polling thread
+ */
+typedef struct poll_task
+{
+    POLL_TASK_FN      func; /*< The function to execute */
+    void             *data; /*< Data passed to the function */
+    struct poll_task *next; /*< The previously posted task */
+} POLL_TASK;
+
+/**
+ * The task queue of a polling thread
+ *
+ * Any thread can push tasks to the queue with a compare-and-swap on the head
+ * of the list. Only the owning thread removes tasks from it by detaching the
+ * whole list at once.
+ */
+typedef struct poll_task_queue
+{
+    POLL_TASK *head; /*< The last posted task, the list is in reverse order */
+    int        fd;   /*< The eventfd used to wake up the thread */
+} POLL_TASK_QUEUE;
+
+/**
+ * Used to wait for the completion of a task executed in all threads
+ */
+typedef struct poll_broadcast
+{
+    POLL_TASK_FN func;    /*< The function to execute */
+    void        *data;    /*< Data passed to the function */
+    int          pending; /*< No. of threads that have not executed the task */
+} POLL_BROADCAST;
+
+thread_local int current_thread_id = -1; /**< This thread's ID */
 static int *epoll_fd;    /*< The epoll file descriptor */
 static int next_epoll_fd = 0; /*< Which thread handles the next DCB */
 static fake_event_t **fake_events; /*< Thread-specific fake event queue */
 static SPINLOCK      *fake_event_lock;
+static POLL_TASK_QUEUE *task_queues; /*< Thread-specific task queue */
 static int do_shutdown = 0;  /*< Flag the shutdown of the poll subsystem */
 
-/** Poll cross-thread messaging variables */
-static volatile int     *poll_msg;
-static void    *poll_msg_data = NULL;
-static SPINLOCK poll_msg_lock = SPINLOCK_INIT;
-
 #if MUTEX_EPOLL
 static simple_mutex_t epoll_wait_mutex; /*< serializes calls to epoll_wait */
 #endif
@@ -115,7 +161,9 @@ static int n_waiting = 0;    /*< No. of threads in epoll_wait */
 static int process_pollq(int thread_id, struct epoll_event *event);
 static void poll_add_event_to_dcb(DCB* dcb, GWBUF* buf, uint32_t ev);
 static bool poll_dcb_session_check(DCB *dcb, const char *);
-static void poll_check_message(void);
+static void poll_process_tasks(int thread_id);
+static void poll_process_read_pending(int thread_id);
+static void poll_flush_write_pending(int thread_id);
 
 DCB *eventq = NULL;
 SPINLOCK pollqlock = SPINLOCK_INIT;
@@ -135,6 +183,7 @@ static int n_avg_samples;
 
 /* Thread statistics data */
 static int n_threads;      /*< No. of threads */
+static int n_active_threads; /*< No. of threads new sessions are assigned to */
 
 /**
  * Internal MaxScale thread states
@@ -159,10 +208,107 @@ typedef struct
     DCB *cur_dcb;       /*< Current DCB being processed */
     uint32_t event;     /*< Current event being processed */
     uint64_t cycle_start; /*< The time when the poll loop was started */
+    int n_sessions;     /*< No. of client connections owned by the thread */
+    THREAD thread;      /*< The thread handle */
+    uint64_t busy_start; /*< When the thread returned from epoll_wait, in nanoseconds,
+                          *  0 while waiting. Only set if stall detection is enabled. */
+    int n_stalls;       /*< No. of stalls detected in the thread */
+    uint64_t n_queued;  /*< No. of events processed */
+    uint64_t queue_delay;     /*< Total time the events waited to be processed, in nanoseconds */
+    uint64_t max_queue_delay; /*< Longest time an event waited to be processed, in nanoseconds */
+    uint64_t n_continued;     /*< No. of reads that used up the read budget */
+    uint64_t n_flushed;       /*< No. of deferred writes flushed at the end of a cycle */
+    uint64_t busy_time;       /*< Total time spent processing events, in nanoseconds.
+                               *  Only measured if thread_rebalance is enabled. */
+    uint64_t last_busy_time;  /*< The busy time at the previous load calculation */
+    int load;                 /*< Percentage of the last load period spent processing events */
+    int n_migrated_in;        /*< No. of sessions moved to the thread */
+    int n_migrated_out;       /*< No. of sessions moved away from the thread */
 } THREAD_DATA;
 
 static THREAD_DATA *thread_data = NULL;    /*< Status of each thread */
 
+/** Maximum number of stack frames captured from a stalled thread */
+#define STALL_MAX_FRAMES 64
+
+/** Maximum number of modules whose stalls are counted */
+#define STALL_MAX_MODULES 32
+
+/** How long the watchdog waits for a stalled thread to capture its stack */
+#define STALL_TRACE_WAIT_MS 100
+
+/**
+ * The stack of a stalled thread, captured by the thread itself in the
+ * signal handler
+ */
+typedef struct
+{
+    void *frames[STALL_MAX_FRAMES];
+    int   n_frames;
+    int   done;     /*< Set by the thread when the frames have been captured */
+} STALL_TRACE;
+
+/**
+ * A list of DCBs of a thread that are processed later in the poll cycle.
+ * A closed DCB leaves a NULL in its place.
+ */
+typedef struct
+{
+    DCB **dcbs;
+    int   n_dcbs;
+    int   size;
+} POLL_DCB_LIST;
+
+static POLL_DCB_LIST *read_pending = NULL;  /*< DCBs that used up their read budget */
+static POLL_DCB_LIST *write_pending = NULL; /*< DCBs whose writes are deferred */
+
+static STALL_TRACE *stall_traces = NULL; /*< The captured stacks of each thread */
+static THREAD stall_watchdog;            /*< The thread that detects stalls */
+
+/**
+ * The number of stalls attributed to each module
+ */
+static struct
+{
+    SPINLOCK lock;
+    int      n_modules;
+    struct
+    {
+        char name[64];
+        int  count;
+    } modules[STALL_MAX_MODULES];
+} stallStats = {SPINLOCK_INIT};
+
+/**
+ * The number of buckets in the wakeup latency histogram. The first bucket
+ * counts idle periods shorter than 1us and each following bucket covers ten
+ * times the time of the previous one. The last bucket counts the rest.
+ */
+#define N_WAKEUP_TIMES 7
+
+/** Upper limit for the number of adaptive non-blocking polls */
+#define POLL_SPIN_MAX 10000
+
+/** Idle periods longer than this are not worth spinning for, in nanoseconds */
+#define POLL_SPIN_MAX_GAP 200000
+
+/** Initial estimate of the duration of a non-blocking poll, in nanoseconds */
+#define POLL_SPIN_INITIAL_COST 1000
+
+/**
+ * The state of the adaptive non-blocking polls of a thread
+ */
+typedef struct
+{
+    int      n_spins;    /*< Number of non-blocking polls before a blocking one */
+    uint64_t gap;        /*< Average idle time before events arrive, in nanoseconds */
+    uint64_t spin_cost;  /*< Average duration of a non-blocking poll, in nanoseconds */
+    uint32_t spin_wakeups[N_WAKEUP_TIMES];  /*< Idle periods ended by a non-blocking poll */
+    uint32_t block_wakeups[N_WAKEUP_TIMES]; /*< Idle periods ended by a blocking poll */
+} POLL_SPIN_DATA;
+
+static POLL_SPIN_DATA *spin_data = NULL; /*< Adaptive poll state of each thread */
+
 /**
  * The number of buckets used to gather statistics about how many
  * descriptors where processed on each epoll completion.
@@ -215,12 +361,23 @@ static struct
  * Periodic function to collect load data for average calculations
  */
 static void poll_loadav(void *);
+static void poll_rebalance();
+static void poll_drain_task(int thread_id, void *data);
+
+/** Maximum number of sessions moved away from a thread at a time */
+#define POLL_MIGRATE_MAX 8
 
 /**
  * Function to analyse error return from epoll_ctl
  */
 static int poll_resolve_error(DCB *, int, bool);
 
+/**
+ * Watchdog that detects polling threads that are stalled in processing
+ */
+static void poll_watchdog(void *);
+static void poll_stall_handler(int);
+
 /**
  * Initialise the polling system we are using for the gateway.
  *
@@ -230,6 +387,7 @@ void
 poll_init()
 {
     n_threads = config_threadcount();
+    n_active_threads = MXS_MAX(MXS_MIN(config_get_global_options()->n_active_threads, n_threads), 1);
 
     if (!(epoll_fd = MXS_MALLOC(sizeof(int) * n_threads)))
     {
@@ -251,16 +409,72 @@ poll_init()
         exit(-1);
     }
 
+    if (config_get_global_options()->n_thread_cpus)
+    {
+        /** Threads started later must not inherit the CPU of a polling thread */
+        thread_save_affinity();
+    }
+    else if (config_get_global_options()->incoming_cpu_steering)
+    {
+        MXS_WARNING("'incoming_cpu_steering' is ignored as 'thread_affinity' is not set.");
+    }
+
+    if (!gwbuf_pool_init(n_threads))
+    {
+        exit(-1);
+    }
+
+    if (!mxs_trace_init(n_threads, config_get_global_options()->trace_records))
+    {
+        exit(-1);
+    }
+
+    if (!mxs_timer_init(n_threads))
+    {
+        exit(-1);
+    }
+
+    if (!mxs_rcu_init(n_threads))
+    {
+        exit(-1);
+    }
+
     if ((fake_event_lock = MXS_CALLOC(n_threads, sizeof(SPINLOCK))) == NULL)
     {
         exit(-1);
     }
 
-    if ((poll_msg = MXS_CALLOC(n_threads, sizeof(int))) == NULL)
+    if ((task_queues = MXS_CALLOC(n_threads, sizeof(POLL_TASK_QUEUE))) == NULL)
+    {
+        exit(-1);
+    }
+
+    if ((spin_data = MXS_CALLOC(n_threads, sizeof(POLL_SPIN_DATA))) == NULL)
+    {
+        exit(-1);
+    }
+
+    if ((read_pending = MXS_CALLOC(n_threads, sizeof(POLL_DCB_LIST))) == NULL ||
+        (write_pending = MXS_CALLOC(n_threads, sizeof(POLL_DCB_LIST))) == NULL)
     {
         exit(-1);
     }
 
+    for (int i = 0; i < n_threads; i++)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &task_queues[i];
+
+        if ((task_queues[i].fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+            epoll_ctl(epoll_fd[i], EPOLL_CTL_ADD, task_queues[i].fd, &ev) == -1)
+        {
+            MXS_ERROR("FATAL: Could not create task queue for thread %d: %d, %s",
+                      i, errno, mxs_strerror(errno));
+            exit(-1);
+        }
+    }
+
     for (int i = 0; i < n_threads; i++)
     {
         spinlock_init(&fake_event_lock[i]);
@@ -268,12 +482,13 @@ poll_init()
 
     memset(&pollStats, 0, sizeof(pollStats));
     memset(&queueStats, 0, sizeof(queueStats));
-    thread_data = (THREAD_DATA *)MXS_MALLOC(n_threads * sizeof(THREAD_DATA));
+    thread_data = (THREAD_DATA *)MXS_CALLOC(n_threads, sizeof(THREAD_DATA));
     if (thread_data)
     {
         for (int i = 0; i < n_threads; i++)
         {
             thread_data[i].state = THREAD_STOPPED;
+            thread_data[i].n_sessions = 0;
         }
     }
 
@@ -300,6 +515,27 @@ poll_init()
     simple_mutex_init(&epoll_wait_mutex, "epoll_wait_mutex");
 #endif
 
+    if (config_get_global_options()->stall_threshold)
+    {
+        struct sigaction sigact = {};
+        sigact.sa_handler = poll_stall_handler;
+        sigact.sa_flags = SA_RESTART;
+        sigemptyset(&sigact.sa_mask);
+
+        /** The first call of backtrace can allocate memory, which is not
+         * safe in the signal handler */
+        void *frame;
+        backtrace(&frame, 1);
+
+        if ((stall_traces = MXS_CALLOC(n_threads, sizeof(STALL_TRACE))) == NULL ||
+            sigaction(SIGUSR2, &sigact, NULL) != 0 ||
+            thread_start(&stall_watchdog, poll_watchdog, NULL) == NULL)
+        {
+            MXS_ERROR("FATAL: Could not start the event loop stall detection.");
+            exit(-1);
+        }
+    }
+
     hktask_add("Load Average", poll_loadav, NULL, POLL_LOAD_FREQ);
     n_avg_samples = 15 * 60 / POLL_LOAD_FREQ;
     avg_samples = (double *)MXS_MALLOC(sizeof(double) * n_avg_samples);
@@ -317,8 +553,143 @@ poll_init()
 
     number_poll_spins = config_nbpolls();
     max_poll_sleep = config_pollsleep();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        spin_data[i].n_spins = number_poll_spins;
+        spin_data[i].spin_cost = POLL_SPIN_INITIAL_COST;
+    }
+}
+
+/**
+ * @return The current monotonic time in nanoseconds
+ */
+static inline uint64_t poll_clock()
+{
+    return mxs_clock_precise_ns();
+}
+
+int poll_thread_cpu(int thread_id)
+{
+    MXS_CONFIG *config = config_get_global_options();
+    return config->n_thread_cpus ? config->thread_cpus[thread_id % config->n_thread_cpus] : -1;
+}
+
+/**
+ * Bind the calling polling thread to its CPU
+ *
+ * The memory the thread allocates after this comes from the NUMA node of the
+ * CPU. This covers the buffers, DCBs and sessions in the caches of the thread.
+ *
+ * @param thread_id The thread
+ */
+static void poll_bind_thread(int thread_id)
+{
+    int cpu = poll_thread_cpu(thread_id);
+
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        if (rc != 0)
+        {
+            MXS_WARNING("Could not bind thread %d to CPU %d: %d, %s",
+                        thread_id, cpu, rc, mxs_strerror(rc));
+        }
+    }
+}
+
+/**
+ * Account the time of a read event to the session of a DCB
+ *
+ * The session is read after the event as a client DCB gets its session
+ * when the authentication completes. The session is not freed before the
+ * zombies are processed.
+ *
+ * @param dcb   DCB whose read event was processed
+ * @param start When the processing started
+ */
+static inline void poll_add_session_time(DCB *dcb, uint64_t start)
+{
+    MXS_SESSION *session = dcb->session;
+
+    if (session && session->state != SESSION_STATE_DUMMY &&
+        (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER || dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER))
+    {
+        session_add_event_time(session, dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER, start, poll_clock());
+    }
+}
+
+/**
+ * Record the end of an idle period and recalculate the number of
+ * non-blocking polls
+ *
+ * A thread spins with non-blocking polls only if events are expected to
+ * arrive soon enough for it to be cheaper than going to sleep. The number of
+ * spins covers twice the average idle time.
+ *
+ * @param spin    Adaptive poll state of the thread
+ * @param idle    Length of the idle period in nanoseconds
+ * @param blocked True if the events were returned by a blocking poll
+ */
+static void poll_record_wakeup(POLL_SPIN_DATA *spin, uint64_t idle, bool blocked)
+{
+    int i = 0;
+
+    for (uint64_t limit = 1000; i < N_WAKEUP_TIMES - 1 && idle >= limit; limit *= 10)
+    {
+        i++;
+    }
+
+    if (blocked)
+    {
+        spin->block_wakeups[i]++;
+    }
+    else
+    {
+        spin->spin_wakeups[i]++;
+    }
+
+    spin->gap = spin->gap ? (7 * spin->gap + idle) / 8 : idle;
+
+    if (spin->gap > POLL_SPIN_MAX_GAP)
+    {
+        spin->n_spins = 0;
+    }
+    else
+    {
+        uint64_t n = 2 * spin->gap / MXS_MAX(spin->spin_cost, 1);
+        spin->n_spins = MXS_MIN(n, POLL_SPIN_MAX);
+    }
+}
+
+/**
+ * Get the socket a listener uses in the epoll instance of a thread
+ *
+ * A listener with per-thread SO_REUSEPORT sockets registers each socket only
+ * in the epoll instance of the thread that owns it. All other listeners
+ * register the same socket in every epoll instance.
+ *
+ * @param dcb       Listener DCB
+ * @param thread_id Thread whose socket is returned
+ *
+ * @return The socket to use with the thread's epoll instance
+ */
+static inline int poll_listener_fd(DCB *dcb, int thread_id)
+{
+    return dcb->shard_fds ? dcb->shard_fds[thread_id] : dcb->fd;
 }
 
+/** The events a polled connection is registered for */
+#ifdef EPOLLRDHUP
+#define POLL_DCB_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET)
+#else
+#define POLL_DCB_EVENTS (EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET)
+#endif
+
 int poll_add_dcb(DCB *dcb)
 {
     int rc = -1;
@@ -328,11 +699,7 @@ int poll_add_dcb(DCB *dcb)
 
     CHK_DCB(dcb);
 
-#ifdef EPOLLRDHUP
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
-#else
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
-#endif
+    ev.events = POLL_DCB_EVENTS;
     ev.data.ptr = dcb;
 
     /*<
@@ -382,9 +749,19 @@ int poll_add_dcb(DCB *dcb)
     {
         owner = dcb->session->client_dcb->thread.id;
     }
+    else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb->listener &&
+             dcb->listener->listener && dcb->listener->listener->shard_fds &&
+             current_thread_id < atomic_load_int(&n_active_threads))
+    {
+        /** The kernel already balanced the connection to this thread's
+         * listener socket, keep the session in the accepting thread */
+        owner = current_thread_id;
+    }
     else
     {
-        owner = (unsigned int)atomic_add(&next_epoll_fd, 1) % n_threads;
+        /** The inactive threads still accept connections but the sessions
+         * are handled by the active ones */
+        owner = (unsigned int)atomic_add(&next_epoll_fd, 1) % atomic_load_int(&n_active_threads);
     }
 
     dcb->thread.id = owner;
@@ -400,13 +777,13 @@ int poll_add_dcb(DCB *dcb)
 
         for (int i = 0; i < nthr; i++)
         {
-            if ((rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_ADD, dcb->fd, &ev)))
+            if ((rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_ADD, poll_listener_fd(dcb, i), &ev)))
             {
                 error_num = errno;
                 /** Remove the listener from the previous epoll instances */
                 for (int j = 0; j < i; j++)
                 {
-                    epoll_ctl(epoll_fd[j], EPOLL_CTL_DEL, dcb->fd, &ev);
+                    epoll_ctl(epoll_fd[j], EPOLL_CTL_DEL, poll_listener_fd(dcb, j), &ev);
                 }
                 break;
             }
@@ -427,6 +804,10 @@ int poll_add_dcb(DCB *dcb)
     }
     if (0 == rc)
     {
+        if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && thread_data)
+        {
+            atomic_add(&thread_data[owner].n_sessions, 1);
+        }
         MXS_DEBUG("%lu [poll_add_dcb] Added dcb %p in state %s to poll set.",
                   pthread_self(),
                   dcb,
@@ -485,7 +866,7 @@ int poll_remove_dcb(DCB *dcb)
 
             for (int i = 0; i < nthr; i++)
             {
-                int tmp_rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, dcb->fd, &ev);
+                int tmp_rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, poll_listener_fd(dcb, i), &ev);
                 if (tmp_rc && rc == 0)
                 {
                     /** Even if one of the instances failed to remove it, try
@@ -502,6 +883,11 @@ int poll_remove_dcb(DCB *dcb)
             {
                 error_num = errno;
             }
+
+            if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && thread_data)
+            {
+                atomic_add(&thread_data[dcb->thread.id].n_sessions, -1);
+            }
         }
         /**
          * The poll_resolve_error function will always
@@ -658,14 +1044,46 @@ poll_waitevents(void *arg)
     int poll_spins = 0;
 
     int thread_id = current_thread_id;
+    bool adaptive = config_get_global_options()->adaptive_polls;
+    POLL_SPIN_DATA *spin = &spin_data[thread_id];
+    uint64_t idle_start = 0;
+
+    poll_bind_thread(thread_id);
+    gwbuf_pool_thread_init(thread_id);
+    mxs_trace_thread_init(thread_id);
+    dcb_idle_memory_thread_init();
+    bool detect_stalls = stall_traces && thread_data;
+    bool rebalance = config_get_global_options()->thread_rebalance && thread_data;
 
     if (thread_data)
     {
+        thread_data[thread_id].thread = pthread_self();
         thread_data[thread_id].state = THREAD_IDLE;
     }
 
+    if (detect_stalls)
+    {
+        /** The watchdog signals a stalled thread to capture its stack */
+        sigset_t sigset;
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGUSR2);
+        pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+    }
+
     while (1)
     {
+        int spin_limit = adaptive ? spin->n_spins : number_poll_spins;
+        bool blocked = false;
+        uint64_t poll_start = 0;
+
+        /** Nothing read without locks is referred to between the events */
+        mxs_rcu_quiescent(thread_id);
+
+        if (detect_stalls)
+        {
+            atomic_store_uint64(&thread_data[thread_id].busy_start, 0);
+        }
+
         atomic_add(&n_waiting, 1);
 #if BLOCKINGPOLL
         nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
@@ -679,8 +1097,25 @@ poll_waitevents(void *arg)
             thread_data[thread_id].state = THREAD_POLLING;
         }
 
+        if (adaptive)
+        {
+            poll_start = poll_clock();
+
+            if (idle_start == 0)
+            {
+                idle_start = poll_start;
+            }
+        }
+
         ts_stats_increment(pollStats.n_polls, thread_id);
-        if ((nfds = epoll_wait(epoll_fd[thread_id], events, MAX_EVENTS, 0)) == -1)
+        nfds = epoll_wait(epoll_fd[thread_id], events, MAX_EVENTS, 0);
+
+        if (adaptive && nfds == 0)
+        {
+            spin->spin_cost = (7 * spin->spin_cost + poll_clock() - poll_start) / 8;
+        }
+
+        if (nfds == -1)
         {
             atomic_add(&n_waiting, -1);
             int eno = errno;
@@ -700,17 +1135,20 @@ poll_waitevents(void *arg)
          * We calculate a timeout bias to alter the length of the blocking
          * call based on the time since we last received an event to process
          */
-        else if (nfds == 0 && poll_spins++ > number_poll_spins)
+        else if (nfds == 0 && read_pending[thread_id].n_dcbs == 0 && poll_spins++ > spin_limit)
         {
+            blocked = true;
             if (timeout_bias < 10)
             {
                 timeout_bias++;
             }
             ts_stats_increment(pollStats.blockingpolls, thread_id);
+            mxs_rcu_offline(thread_id);
             nfds = epoll_wait(epoll_fd[thread_id],
                               events,
                               MAX_EVENTS,
                               (max_poll_sleep * timeout_bias) / 10);
+            mxs_rcu_quiescent(thread_id);
             if (nfds == 0)
             {
                 poll_spins = 0;
@@ -735,7 +1173,7 @@ poll_waitevents(void *arg)
             ts_stats_set_max(pollStats.evq_max, nfds, thread_id);
 
             timeout_bias = 1;
-            if (poll_spins <= number_poll_spins + 1)
+            if (poll_spins <= spin_limit + 1)
             {
                 ts_stats_increment(pollStats.n_nbpollev, thread_id);
             }
@@ -744,6 +1182,13 @@ poll_waitevents(void *arg)
                       pthread_self(),
                       nfds);
             ts_stats_increment(pollStats.n_pollev, thread_id);
+
+            if (adaptive)
+            {
+                poll_record_wakeup(spin, poll_clock() - idle_start, blocked);
+                idle_start = 0;
+            }
+
             if (thread_data)
             {
                 thread_data[thread_id].n_fds = nfds;
@@ -771,11 +1216,31 @@ poll_waitevents(void *arg)
         }
 
         thread_data[thread_id].cycle_start = hkheartbeat;
+        mxs_clock_update();
+        events_start = mxs_clock_ns();
+        MXS_PROBE2(poll_cycle_start, thread_id, nfds);
+
+        if (detect_stalls)
+        {
+            atomic_store_uint64(&thread_data[thread_id].busy_start, events_start);
+        }
 
         /* Process of the queue of waiting requests */
         for (int i = 0; i < nfds; i++)
         {
-            process_pollq(thread_id, &events[i]);
+            if (events[i].data.ptr == &task_queues[thread_id])
+            {
+                /** Only wakes up the thread, the tasks are processed below */
+                uint64_t count;
+                while (read(task_queues[thread_id].fd, &count, sizeof(count)) > 0)
+                {
+                    ;
+                }
+            }
+            else
+            {
+                process_pollq(thread_id, &events[i]);
+            }
         }
 
         fake_event_t *event = NULL;
@@ -803,7 +1268,10 @@ poll_waitevents(void *arg)
             MXS_FREE(tmp);
         }
 
-        dcb_process_idle_sessions(thread_id);
+        /** Continue the reads that used up their budget */
+        poll_process_read_pending(thread_id);
+
+        mxs_timer_process(thread_id);
 
         if (thread_data)
         {
@@ -813,7 +1281,17 @@ poll_waitevents(void *arg)
         /** Process closed DCBs */
         dcb_process_zombies(thread_id);
 
-        poll_check_message();
+        poll_process_tasks(thread_id);
+
+        /** Write the data of the cycle with as few system calls as possible */
+        poll_flush_write_pending(thread_id);
+        MXS_PROBE1(poll_cycle_end, thread_id);
+
+        if (rebalance && nfds > 0)
+        {
+            atomic_store_uint64(&thread_data[thread_id].busy_time,
+                                thread_data[thread_id].busy_time + poll_clock() - events_start);
+        }
 
         if (thread_data)
         {
@@ -830,6 +1308,10 @@ poll_waitevents(void *arg)
             {
                 thread_data[thread_id].state = THREAD_STOPPED;
             }
+            mxs_rcu_offline(thread_id);
+            dcb_cache_thread_finish();
+            session_cache_thread_finish();
+            gwbuf_pool_thread_finish();
             return;
         }
         if (thread_data)
@@ -915,6 +1397,15 @@ process_pollq(int thread_id, struct epoll_event *event)
     CHK_DCB(dcb);
     if (thread_data)
     {
+        uint64_t delay = poll_clock() - events_start;
+        thread_data[thread_id].n_queued++;
+        thread_data[thread_id].queue_delay += delay;
+
+        if (delay > thread_data[thread_id].max_queue_delay)
+        {
+            thread_data[thread_id].max_queue_delay = delay;
+        }
+
         thread_data[thread_id].state = THREAD_PROCESSING;
         thread_data[thread_id].cur_dcb = dcb;
         thread_data[thread_id].event = ev;
@@ -924,9 +1415,15 @@ process_pollq(int thread_id, struct epoll_event *event)
     /* ss_dassert(dcb->state != DCB_STATE_DISCONNECTED); */
     if (DCB_STATE_DISCONNECTED == dcb->state)
     {
+        current_dcb = NULL;
         return 0;
     }
 
+    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        dcb_start_idle_timer(dcb);
+    }
+
     MXS_DEBUG("%lu [poll_waitevents] event %d dcb %p "
               "role %s",
               pthread_self(),
@@ -976,6 +1473,10 @@ process_pollq(int thread_id, struct epoll_event *event)
                 dcb->func.accept(dcb);
             }
         }
+        else if (dcb->flags & DCBF_READ_PAUSED)
+        {
+            /** The client is not keeping up, the data is read when it does */
+        }
         else
         {
             MXS_DEBUG("%lu [poll_waitevents] "
@@ -998,7 +1499,9 @@ process_pollq(int thread_id, struct epoll_event *event)
                 }
                 if (1 == return_code)
                 {
+                    uint64_t read_start = poll_clock();
                     dcb->func.read(dcb);
+                    poll_add_session_time(dcb, read_start);
                 }
             }
         }
@@ -1190,6 +1693,54 @@ dprintPollStats(DCB *dcb)
     dcb_printf(dcb, "\t>= %d\t\t\t%" PRId32 "\n", MAXNFDS,
                pollStats.n_fds[MAXNFDS - 1]);
 
+    dShowDCBReadStats(dcb);
+    dShowDCBMemory(dcb);
+
+}
+
+/**
+ * Print the metrics of the polling system
+ *
+ * @param dcb The DCB to print to
+ */
+void
+dprintPollMetrics(DCB *dcb)
+{
+    metrics_family(dcb, "maxscale_poll_cycles", "counter", NULL, "Number of epoll cycles");
+    metrics_sample(dcb, "maxscale_poll_cycles_total", NULL, NULL,
+                   ts_stats_get(pollStats.n_polls, TS_STATS_SUM));
+
+    metrics_family(dcb, "maxscale_poll_events", "counter", NULL, "Number of events by type");
+    metrics_sample(dcb, "maxscale_poll_events_total", "type", "read",
+                   ts_stats_get(pollStats.n_read, TS_STATS_SUM));
+    metrics_sample(dcb, "maxscale_poll_events_total", "type", "write",
+                   ts_stats_get(pollStats.n_write, TS_STATS_SUM));
+    metrics_sample(dcb, "maxscale_poll_events_total", "type", "error",
+                   ts_stats_get(pollStats.n_error, TS_STATS_SUM));
+    metrics_sample(dcb, "maxscale_poll_events_total", "type", "hangup",
+                   ts_stats_get(pollStats.n_hup, TS_STATS_SUM));
+    metrics_sample(dcb, "maxscale_poll_events_total", "type", "accept",
+                   ts_stats_get(pollStats.n_accept, TS_STATS_SUM));
+
+    metrics_family(dcb, "maxscale_poll_event_queue_length", "gauge", NULL,
+                   "Average length of the event queue");
+    metrics_sample(dcb, "maxscale_poll_event_queue_length", NULL, NULL,
+                   ts_stats_get(pollStats.evq_length, TS_STATS_AVG));
+
+    metrics_family(dcb, "maxscale_poll_event_queue_max_length", "gauge", NULL,
+                   "Maximum length of the event queue");
+    metrics_sample(dcb, "maxscale_poll_event_queue_max_length", NULL, NULL,
+                   ts_stats_get(pollStats.evq_max, TS_STATS_MAX));
+
+    metrics_family(dcb, "maxscale_poll_max_queue_time_ticks", "gauge", NULL,
+                   "Longest time an event has waited in the queue, in 100ms ticks");
+    metrics_sample(dcb, "maxscale_poll_max_queue_time_ticks", NULL, NULL,
+                   ts_stats_get(queueStats.maxqtime, TS_STATS_MAX));
+
+    metrics_family(dcb, "maxscale_poll_max_exec_time_ticks", "gauge", NULL,
+                   "Longest time an event has taken to process, in 100ms ticks");
+    metrics_sample(dcb, "maxscale_poll_max_exec_time_ticks", NULL, NULL,
+                   ts_stats_get(queueStats.maxexectime, TS_STATS_MAX));
 }
 
 /**
@@ -1265,6 +1816,7 @@ dShowThreads(DCB *dcb)
     double qavg1 = 0.0, qavg5 = 0.0, qavg15 = 0.0;
 
     dcb_printf(dcb, "Polling Threads.\n\n");
+    dcb_printf(dcb, "Active Threads: %d of %d.\n", atomic_load_int(&n_active_threads), n_threads);
     dcb_printf(dcb, "Historic Thread Load Average: %.2f.\n", load_average);
     dcb_printf(dcb, "Current Thread Load Average: %.2f.\n", current_avg);
 
@@ -1317,8 +1869,8 @@ dShowThreads(DCB *dcb)
     {
         return;
     }
-    dcb_printf(dcb, " ID | State      | # fds  | Descriptor       | Running  | Event\n");
-    dcb_printf(dcb, "----+------------+--------+------------------+----------+---------------\n");
+    dcb_printf(dcb, " ID | State      | Sessions | # fds  | Descriptor       | Running  | Event\n");
+    dcb_printf(dcb, "----+------------+----------+--------+------------------+----------+---------------\n");
     for (i = 0; i < n_threads; i++)
     {
         switch (thread_data[i].state)
@@ -1342,14 +1894,14 @@ dShowThreads(DCB *dcb)
         if (thread_data[i].state != THREAD_PROCESSING)
         {
             dcb_printf(dcb,
-                       " %2d | %-10s |        |                  |          |\n",
-                       i, state);
+                       " %2d | %-10s | %8d |        |                  |          |\n",
+                       i, state, thread_data[i].n_sessions);
         }
         else if (thread_data[i].cur_dcb == NULL)
         {
             dcb_printf(dcb,
-                       " %2d | %-10s | %6d |                  |          |\n",
-                       i, state, thread_data[i].n_fds);
+                       " %2d | %-10s | %8d | %6d |                  |          |\n",
+                       i, state, thread_data[i].n_sessions, thread_data[i].n_fds);
         }
         else
         {
@@ -1366,9 +1918,9 @@ dShowThreads(DCB *dcb)
                 from_heap = true;
             }
             dcb_printf(dcb,
-                       " %2d | %-10s | %6d | %-16p | <%3lu00ms | %s\n",
-                       i, state, thread_data[i].n_fds,
-                       thread_data[i].cur_dcb, 1 + hkheartbeat - dcb->evq.started,
+                       " %2d | %-10s | %8d | %6d | %-16p | <%3lu00ms | %s\n",
+                       i, state, thread_data[i].n_sessions, thread_data[i].n_fds,
+                       thread_data[i].cur_dcb, 1 + hkheartbeat - thread_data[i].cycle_start,
                        event_string);
 
             if (from_heap)
@@ -1377,31 +1929,282 @@ dShowThreads(DCB *dcb)
             }
         }
     }
-}
 
-/**
- * The function used to calculate time based load data. This is called by the
- * housekeeper every POLL_LOAD_FREQ seconds.
- *
- * @param data          Argument required by the housekeeper but not used here
- */
-static void
-poll_loadav(void *data)
-{
-    static  int last_samples = 0, last_nfds = 0;
-    int new_samples, new_nfds;
+    if (config_get_global_options()->n_thread_cpus)
+    {
+        dcb_printf(dcb, "\n ID | CPU\n");
+        dcb_printf(dcb, "----+-----\n");
 
-    new_samples = load_samples - last_samples;
-    new_nfds = load_nfds - last_nfds;
-    last_samples = load_samples;
-    last_nfds = load_nfds;
+        for (i = 0; i < n_threads; i++)
+        {
+            dcb_printf(dcb, " %2d | %3d\n", i, poll_thread_cpu(i));
+        }
+    }
 
-    /* POLL_LOAD_FREQ average is... */
-    if (new_samples)
+    if (config_get_global_options()->thread_rebalance)
     {
-        current_avg = new_nfds / new_samples;
-    }
-    else
+        dcb_printf(dcb, "\nSessions moved between threads:\n\n");
+        dcb_printf(dcb, " ID | Load | Moved in | Moved out\n");
+        dcb_printf(dcb, "----+------+----------+----------\n");
+
+        for (i = 0; i < n_threads; i++)
+        {
+            dcb_printf(dcb, " %2d | %3d%% | %8d | %8d\n", i, thread_data[i].load,
+                       thread_data[i].n_migrated_in, thread_data[i].n_migrated_out);
+        }
+    }
+
+    if (stall_traces)
+    {
+        dcb_printf(dcb, "\nEvent loop stalls longer than %dms:\n\n",
+                   config_get_global_options()->stall_threshold);
+        dcb_printf(dcb, " ID | Stalls\n");
+        dcb_printf(dcb, "----+----------\n");
+
+        for (i = 0; i < n_threads; i++)
+        {
+            dcb_printf(dcb, " %2d | %8d\n", i, thread_data[i].n_stalls);
+        }
+
+        dcb_printf(dcb, "\n Module                           | Stalls\n");
+        dcb_printf(dcb, "----------------------------------+----------\n");
+        spinlock_acquire(&stallStats.lock);
+
+        for (i = 0; i < stallStats.n_modules; i++)
+        {
+            dcb_printf(dcb, " %-32s | %8d\n", stallStats.modules[i].name, stallStats.modules[i].count);
+        }
+
+        spinlock_release(&stallStats.lock);
+    }
+}
+
+/**
+ * Capture the stack of the calling polling thread for the watchdog
+ *
+ * @param sig The signal, not used
+ */
+static void poll_stall_handler(int sig)
+{
+    int thread_id = current_thread_id;
+
+    if (thread_id >= 0)
+    {
+        STALL_TRACE *trace = &stall_traces[thread_id];
+        trace->n_frames = backtrace(trace->frames, STALL_MAX_FRAMES);
+        atomic_add(&trace->done, 1);
+    }
+}
+
+/**
+ * Find the innermost module on a captured stack
+ *
+ * The modules are the shared libraries in the module directory besides
+ * the core library.
+ *
+ * @param trace The captured stack
+ * @param dest  Where the name of the module is stored
+ * @param size  Size of @c dest
+ *
+ * @return True if a module was found
+ */
+static bool poll_stall_module(const STALL_TRACE *trace, char *dest, size_t size)
+{
+    const char *libdir = get_libdir();
+    size_t len = strlen(libdir);
+
+    for (int i = 0; i < trace->n_frames; i++)
+    {
+        Dl_info info;
+
+        if (dladdr(trace->frames[i], &info) && info.dli_fname &&
+            strncmp(info.dli_fname, libdir, len) == 0)
+        {
+            const char *name = strrchr(info.dli_fname, '/');
+            name = name ? name + 1 : info.dli_fname;
+
+            if (strncmp(name, "lib", 3) == 0)
+            {
+                name += 3;
+            }
+
+            if (strncmp(name, "maxscale-common", 15) != 0)
+            {
+                const char *end = strstr(name, ".so");
+                snprintf(dest, size, "%.*s", end ? (int)(end - name) : (int)strlen(name), name);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Count a stall of a module
+ *
+ * @param module The name of the module
+ */
+static void poll_count_stall(const char *module)
+{
+    spinlock_acquire(&stallStats.lock);
+    int i = 0;
+
+    while (i < stallStats.n_modules && strcmp(stallStats.modules[i].name, module) != 0)
+    {
+        i++;
+    }
+
+    if (i == stallStats.n_modules && i < STALL_MAX_MODULES)
+    {
+        strcpy(stallStats.modules[i].name, module);
+        stallStats.modules[i].count = 0;
+        stallStats.n_modules++;
+    }
+
+    if (i < stallStats.n_modules)
+    {
+        stallStats.modules[i].count++;
+    }
+
+    spinlock_release(&stallStats.lock);
+}
+
+/**
+ * Report a stalled polling thread
+ *
+ * The thread is signaled to capture its stack. The stall is attributed to the
+ * innermost module on the stack and logged with what the thread was processing
+ * and the stack.
+ *
+ * @param thread_id The stalled thread
+ * @param start     When the thread returned from epoll_wait
+ * @param now       The current time
+ */
+static void poll_report_stall(int thread_id, uint64_t start, uint64_t now)
+{
+    THREAD_DATA *data = &thread_data[thread_id];
+    STALL_TRACE *trace = &stall_traces[thread_id];
+    char activity[512] = "timers, closed connections or tasks";
+    DCB *dcb = data->cur_dcb;
+
+    /** The DCB is not freed before the thread processes the zombies */
+    if (data->state == THREAD_PROCESSING && dcb)
+    {
+        MXS_SESSION *session = dcb->session;
+
+        if (session && session->state != SESSION_STATE_DUMMY && session->service)
+        {
+            snprintf(activity, sizeof(activity), "%s %p of session %lu of service '%s'",
+                     STRDCBROLE(dcb->dcb_role), dcb, session->ses_id, session->service->name);
+        }
+        else
+        {
+            snprintf(activity, sizeof(activity), "%s %p", STRDCBROLE(dcb->dcb_role), dcb);
+        }
+    }
+
+    trace->n_frames = 0;
+    trace->done = 0;
+    pthread_kill(data->thread, SIGUSR2);
+
+    for (int i = 0; i < STALL_TRACE_WAIT_MS && !atomic_load_int(&trace->done); i++)
+    {
+        thread_millisleep(1);
+    }
+
+    /** The stack is of no use if the thread finished the stalled cycle */
+    bool captured = atomic_load_int(&trace->done) &&
+                    atomic_load_uint64(&data->busy_start) == start;
+    char module[64] = "core";
+
+    if (captured)
+    {
+        poll_stall_module(trace, module, sizeof(module));
+    }
+
+    data->n_stalls++;
+    poll_count_stall(module);
+
+    MXS_WARNING("Thread %d has been processing events for %lums, the event loop is stalled. "
+                "The thread is processing %s. The stall is attributed to module '%s'.%s",
+                thread_id, (now - start) / 1000000, activity, module,
+                captured ? " The stack of the thread:" : "");
+
+    char **symbols = captured ? backtrace_symbols(trace->frames, trace->n_frames) : NULL;
+
+    if (symbols)
+    {
+        for (int i = 0; i < trace->n_frames; i++)
+        {
+            MXS_WARNING("  %s", symbols[i]);
+        }
+
+        MXS_FREE(symbols);
+    }
+}
+
+/**
+ * Detect polling threads that have not returned to epoll_wait within the
+ * stall threshold. Each stalled cycle of a thread is reported once.
+ *
+ * @param arg Not used
+ */
+static void poll_watchdog(void *arg)
+{
+    int threshold = config_get_global_options()->stall_threshold;
+    uint64_t threshold_ns = (uint64_t)threshold * 1000000;
+    int interval = threshold / 4 > 10 ? threshold / 4 : 10;
+    uint64_t *reported = MXS_CALLOC(n_threads, sizeof(uint64_t));
+
+    if (reported == NULL)
+    {
+        return;
+    }
+
+    while (!do_shutdown)
+    {
+        thread_millisleep(interval);
+        uint64_t now = poll_clock();
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            uint64_t start = atomic_load_uint64(&thread_data[i].busy_start);
+
+            if (start && start != reported[i] && now > start && now - start > threshold_ns)
+            {
+                reported[i] = start;
+                poll_report_stall(i, start, now);
+            }
+        }
+    }
+
+    MXS_FREE(reported);
+}
+
+/**
+ * The function used to calculate time based load data. This is called by the
+ * housekeeper every POLL_LOAD_FREQ seconds.
+ *
+ * @param data          Argument required by the housekeeper but not used here
+ */
+static void
+poll_loadav(void *data)
+{
+    static  int last_samples = 0, last_nfds = 0;
+    int new_samples, new_nfds;
+
+    new_samples = load_samples - last_samples;
+    new_nfds = load_nfds - last_nfds;
+    last_samples = load_samples;
+    last_nfds = load_nfds;
+
+    /* POLL_LOAD_FREQ average is... */
+    if (new_samples)
+    {
+        current_avg = new_nfds / new_samples;
+    }
+    else
     {
         current_avg = 0.0;
     }
@@ -1411,6 +2214,275 @@ poll_loadav(void *data)
     {
         next_sample = 0;
     }
+
+    if (config_get_global_options()->thread_rebalance && thread_data)
+    {
+        poll_rebalance();
+    }
+
+    /** The sessions that were busy when a thread was deactivated are moved
+     * once they are idle */
+    for (int i = atomic_load_int(&n_active_threads); i < n_threads && thread_data; i++)
+    {
+        if (atomic_load_int(&thread_data[i].n_sessions) > 0)
+        {
+            poll_post_task(i, poll_drain_task, NULL);
+        }
+    }
+}
+
+/**
+ * Move the idle sessions of an inactive thread to the active threads
+ *
+ * The sessions of services with filters are never moved, as
+ * dcb_migrate_idle_sessions() skips them. They stay in the inactive thread
+ * until they close.
+ *
+ * @param thread_id The calling thread
+ * @param data      Not used
+ */
+static void poll_drain_task(int thread_id, void *data)
+{
+    int n_active = atomic_load_int(&n_active_threads);
+
+    /** The thread may have been activated again. Tasks are also executed
+     * while waiting for poll_execute_on_all(), in which case an event is
+     * being processed. */
+    if (thread_id >= n_active && current_dcb == NULL)
+    {
+        int total = 0;
+        int moved;
+
+        do
+        {
+            int target = 0;
+
+            for (int i = 1; i < n_active; i++)
+            {
+                if (atomic_load_int(&thread_data[i].n_sessions) <
+                    atomic_load_int(&thread_data[target].n_sessions))
+                {
+                    target = i;
+                }
+            }
+
+            moved = dcb_migrate_idle_sessions(target, POLL_MIGRATE_MAX);
+            total += moved;
+        }
+        while (moved == POLL_MIGRATE_MAX);
+
+        if (total > 0)
+        {
+            MXS_INFO("Moved %d sessions from inactive thread %d, %d sessions left.",
+                     total, thread_id, atomic_load_int(&thread_data[thread_id].n_sessions));
+        }
+    }
+}
+
+/**
+ * Move idle sessions away from a busy thread
+ *
+ * Executed by the busy thread, so the sessions are moved between events.
+ *
+ * @param thread_id The calling thread
+ * @param data      The thread the sessions are moved to
+ */
+static void poll_rebalance_task(int thread_id, void *data)
+{
+    int target = (int)(intptr_t)data;
+
+    /** Tasks are also executed while waiting for poll_execute_on_all(),
+     * in which case an event is being processed */
+    if (current_dcb == NULL && target < atomic_load_int(&n_active_threads))
+    {
+        int n = (atomic_load_int(&thread_data[thread_id].n_sessions) -
+                 atomic_load_int(&thread_data[target].n_sessions)) / 2;
+
+        if (n > 0)
+        {
+            n = dcb_migrate_idle_sessions(target, MXS_MIN(n, POLL_MIGRATE_MAX));
+
+            if (n > 0)
+            {
+                MXS_INFO("Moved %d sessions from thread %d (load %d%%) to thread %d (load %d%%).",
+                         n, thread_id, thread_data[thread_id].load, target, thread_data[target].load);
+            }
+        }
+    }
+}
+
+/**
+ * Calculate the load of each thread and move sessions from the busiest
+ * thread to the least busy one if their loads differ by more than
+ * thread_rebalance percent. Called by poll_loadav().
+ */
+static void poll_rebalance()
+{
+    static uint64_t last_check = 0;
+    uint64_t now = poll_clock();
+    uint64_t elapsed = now - last_check;
+    int n_active = atomic_load_int(&n_active_threads);
+    int busiest = 0;
+    int idlest = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        uint64_t busy = atomic_load_uint64(&thread_data[i].busy_time);
+
+        if (last_check && elapsed)
+        {
+            thread_data[i].load = MXS_MIN((busy - thread_data[i].last_busy_time) * 100 / elapsed, 100);
+        }
+
+        thread_data[i].last_busy_time = busy;
+
+        if (i >= n_active)
+        {
+            /** The inactive threads are drained, see poll_drain_task(). The
+             * sessions of services with filters are never moved, so they
+             * keep an inactive thread busy until they close. */
+            continue;
+        }
+        else if (thread_data[i].load > thread_data[busiest].load)
+        {
+            busiest = i;
+        }
+        else if (thread_data[i].load < thread_data[idlest].load)
+        {
+            idlest = i;
+        }
+    }
+
+    last_check = now;
+
+    if (busiest != idlest &&
+        thread_data[busiest].load - thread_data[idlest].load > config_get_global_options()->thread_rebalance &&
+        atomic_load_int(&thread_data[busiest].n_sessions) > atomic_load_int(&thread_data[idlest].n_sessions) + 1)
+    {
+        poll_post_task(busiest, poll_rebalance_task, (void*)(intptr_t)idlest);
+    }
+}
+
+bool poll_migrate_dcbs(DCB **dcbs, int n, int thread_id)
+{
+    int from = current_thread_id;
+    struct epoll_event ev;
+    ss_dassert(from != thread_id && dcbs[0]->dcb_role == DCB_ROLE_CLIENT_HANDLER);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (epoll_ctl(epoll_fd[from], EPOLL_CTL_DEL, dcbs[i]->fd, &ev) != 0)
+        {
+            MXS_ERROR("Failed to remove DCB %p from the poll set of thread %d: %d, %s",
+                      dcbs[i], from, errno, mxs_strerror(errno));
+
+            /** Keep the session in this thread */
+            for (int j = 0; j < i; j++)
+            {
+                ev.events = POLL_DCB_EVENTS;
+                ev.data.ptr = dcbs[j];
+                epoll_ctl(epoll_fd[from], EPOLL_CTL_ADD, dcbs[j]->fd, &ev);
+            }
+
+            return false;
+        }
+
+        if (dcbs[i]->cold)
+        {
+            /** Timers belong to the thread that set them. The idle timer is
+             * started again when the new thread processes an event. */
+            mxs_timer_cancel(&dcbs[i]->cold->idle_timer);
+        }
+    }
+
+    dcb_move_to_list(dcbs, n, thread_id);
+
+    /** The fake events generated for the DCBs are processed by the new owner */
+    fake_event_t *kept = NULL;
+    fake_event_t *kept_tail = NULL;
+    fake_event_t *moved = NULL;
+    fake_event_t *moved_tail = NULL;
+    spinlock_acquire(&fake_event_lock[from]);
+
+    for (fake_event_t *event = fake_events[from]; event; event = event->next)
+    {
+        bool found = false;
+
+        for (int i = 0; i < n && !found; i++)
+        {
+            found = event->dcb == dcbs[i];
+        }
+
+        fake_event_t **head = found ? &moved : &kept;
+        fake_event_t **tail = found ? &moved_tail : &kept_tail;
+
+        if (*head)
+        {
+            (*tail)->next = event;
+        }
+        else
+        {
+            *head = event;
+        }
+
+        *tail = event;
+    }
+
+    if (kept)
+    {
+        kept_tail->next = NULL;
+        kept->tail = kept_tail;
+    }
+
+    fake_events[from] = kept;
+
+    for (int i = 0; i < n; i++)
+    {
+        dcbs[i]->thread.id = thread_id;
+    }
+
+    spinlock_release(&fake_event_lock[from]);
+
+    if (moved)
+    {
+        moved_tail->next = NULL;
+        moved->tail = moved_tail;
+        spinlock_acquire(&fake_event_lock[thread_id]);
+
+        if (fake_events[thread_id])
+        {
+            fake_events[thread_id]->tail->next = moved;
+            fake_events[thread_id]->tail = moved_tail;
+        }
+        else
+        {
+            fake_events[thread_id] = moved;
+        }
+
+        spinlock_release(&fake_event_lock[thread_id]);
+    }
+
+    atomic_add(&thread_data[from].n_sessions, -1);
+    atomic_add(&thread_data[thread_id].n_sessions, 1);
+    atomic_add(&thread_data[from].n_migrated_out, 1);
+    atomic_add(&thread_data[thread_id].n_migrated_in, 1);
+
+    /** Adding a DCB reports the events it is already ready for, so nothing
+     * that arrived in the meantime is lost. The client DCB is added last. */
+    for (int i = n - 1; i >= 0; i--)
+    {
+        ev.events = POLL_DCB_EVENTS;
+        ev.data.ptr = dcbs[i];
+
+        if (epoll_ctl(epoll_fd[thread_id], EPOLL_CTL_ADD, dcbs[i]->fd, &ev) != 0)
+        {
+            MXS_ERROR("Failed to add DCB %p to the poll set of thread %d: %d, %s",
+                      dcbs[i], thread_id, errno, mxs_strerror(errno));
+            poll_fake_hangup_event(dcbs[i]);
+        }
+    }
+
+    return true;
 }
 
 void poll_add_epollin_event_to_dcb(DCB*   dcb,
@@ -1445,6 +2517,14 @@ static void poll_add_event_to_dcb(DCB*       dcb,
          * to be protected by a spinlock */
         spinlock_acquire(&fake_event_lock[thr]);
 
+        while (dcb->thread.id != thr)
+        {
+            /** The DCB was moved to another thread, see poll_migrate_dcbs() */
+            spinlock_release(&fake_event_lock[thr]);
+            thr = dcb->thread.id;
+            spinlock_acquire(&fake_event_lock[thr]);
+        }
+
         if (fake_events[thr])
         {
             fake_events[thr]->tail->next = event;
@@ -1459,6 +2539,244 @@ static void poll_add_event_to_dcb(DCB*       dcb,
     }
 }
 
+/**
+ * Add a DCB to a list
+ *
+ * @param list The list
+ * @param dcb  The DCB to add
+ * @return True if the DCB was added, false if memory allocation failed
+ */
+static bool poll_dcb_list_add(POLL_DCB_LIST *list, DCB *dcb)
+{
+    if (list->n_dcbs == list->size)
+    {
+        int size = list->size ? list->size * 2 : 16;
+        DCB **dcbs = MXS_REALLOC(list->dcbs, size * sizeof(DCB*));
+
+        if (dcbs == NULL)
+        {
+            return false;
+        }
+
+        list->dcbs = dcbs;
+        list->size = size;
+    }
+
+    list->dcbs[list->n_dcbs++] = dcb;
+    return true;
+}
+
+/**
+ * Remove a DCB from a list
+ *
+ * @param list The list
+ * @param dcb  The DCB to remove
+ */
+static void poll_dcb_list_remove(POLL_DCB_LIST *list, DCB *dcb)
+{
+    for (int i = 0; i < list->n_dcbs; i++)
+    {
+        if (list->dcbs[i] == dcb)
+        {
+            list->dcbs[i] = NULL;
+            break;
+        }
+    }
+}
+
+/**
+ * Remove the DCBs processed from the front of a list
+ *
+ * @param list The list
+ * @param n    The number of DCBs processed
+ */
+static void poll_dcb_list_consume(POLL_DCB_LIST *list, int n)
+{
+    list->n_dcbs -= n;
+    memmove(list->dcbs, list->dcbs + n, list->n_dcbs * sizeof(DCB*));
+}
+
+void poll_add_read_pending(DCB *dcb)
+{
+    ss_dassert(dcb->thread.id == current_thread_id);
+
+    if (dcb->flags & DCBF_READ_PENDING)
+    {
+        return;
+    }
+
+    if (!poll_dcb_list_add(&read_pending[dcb->thread.id], dcb))
+    {
+        /** A fake event still reads the rest of the data */
+        poll_fake_read_event(dcb);
+        return;
+    }
+
+    dcb->flags |= DCBF_READ_PENDING;
+
+    if (thread_data)
+    {
+        thread_data[dcb->thread.id].n_continued++;
+    }
+}
+
+void poll_cancel_read_pending(DCB *dcb)
+{
+    if (dcb->flags & DCBF_READ_PENDING)
+    {
+        poll_dcb_list_remove(&read_pending[dcb->thread.id], dcb);
+        dcb->flags &= ~DCBF_READ_PENDING;
+    }
+}
+
+/**
+ * Read the DCBs that used up their read budget
+ *
+ * The DCBs that use up their budget again are read in the next cycle.
+ *
+ * @param thread_id The current thread
+ */
+static void poll_process_read_pending(int thread_id)
+{
+    POLL_DCB_LIST *pending = &read_pending[thread_id];
+    int n = pending->n_dcbs;
+
+    for (int i = 0; i < n; i++)
+    {
+        DCB *dcb = pending->dcbs[i];
+
+        if (dcb)
+        {
+            struct epoll_event ev;
+            pending->dcbs[i] = NULL;
+            dcb->flags &= ~DCBF_READ_PENDING;
+            ev.data.ptr = dcb;
+            ev.events = EPOLLIN;
+            process_pollq(thread_id, &ev);
+        }
+    }
+
+    poll_dcb_list_consume(pending, n);
+}
+
+/**
+ * Change the events a polled DCB is registered for
+ *
+ * @param dcb    The DCB
+ * @param events The new events
+ * @return True if the events were changed
+ */
+static bool poll_modify_dcb(DCB *dcb, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = dcb;
+
+    if (epoll_ctl(epoll_fd[dcb->thread.id], EPOLL_CTL_MOD, dcb->fd, &ev) != 0)
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to change the polled events of DCB %p: %d, %s", dcb,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        return false;
+    }
+
+    return true;
+}
+
+void poll_pause_reading(DCB *dcb)
+{
+    ss_dassert(dcb->thread.id == current_thread_id);
+
+    if (!(dcb->flags & DCBF_READ_PAUSED) && dcb->state == DCB_STATE_POLLING &&
+        dcb->fd > 0 && poll_modify_dcb(dcb, POLL_DCB_EVENTS & ~EPOLLIN))
+    {
+        /** A pending read would only be ignored, it is repeated on resume */
+        poll_cancel_read_pending(dcb);
+        dcb->flags |= DCBF_READ_PAUSED;
+    }
+}
+
+void poll_resume_reading(DCB *dcb)
+{
+    ss_dassert(dcb->thread.id == current_thread_id);
+
+    if (dcb->flags & DCBF_READ_PAUSED)
+    {
+        dcb->flags &= ~DCBF_READ_PAUSED;
+
+        if (dcb->state == DCB_STATE_POLLING)
+        {
+            poll_modify_dcb(dcb, POLL_DCB_EVENTS);
+
+            /** The edge-triggered events that arrived while paused are lost */
+            poll_add_read_pending(dcb);
+        }
+    }
+}
+
+bool poll_add_write_pending(DCB *dcb)
+{
+    ss_dassert(dcb->thread.id == current_thread_id);
+
+    if (!(dcb->flags & DCBF_WRITE_PENDING))
+    {
+        if (!poll_dcb_list_add(&write_pending[dcb->thread.id], dcb))
+        {
+            return false;
+        }
+
+        dcb->flags |= DCBF_WRITE_PENDING;
+    }
+
+    return true;
+}
+
+void poll_cancel_write_pending(DCB *dcb)
+{
+    if (dcb->flags & DCBF_WRITE_PENDING)
+    {
+        poll_dcb_list_remove(&write_pending[dcb->thread.id], dcb);
+        dcb->flags &= ~DCBF_WRITE_PENDING;
+    }
+}
+
+/**
+ * Write the deferred data of the DCBs of a thread
+ *
+ * Writing can trigger callbacks that write to other DCBs so the list is
+ * processed until it is empty.
+ *
+ * @param thread_id The current thread
+ */
+static void poll_flush_write_pending(int thread_id)
+{
+    POLL_DCB_LIST *pending = &write_pending[thread_id];
+
+    while (pending->n_dcbs > 0)
+    {
+        int n = pending->n_dcbs;
+
+        for (int i = 0; i < n; i++)
+        {
+            DCB *dcb = pending->dcbs[i];
+
+            if (dcb)
+            {
+                pending->dcbs[i] = NULL;
+                dcb->flags &= ~DCBF_WRITE_PENDING;
+                dcb_drain_writeq(dcb);
+
+                if (thread_data)
+                {
+                    thread_data[thread_id].n_flushed++;
+                }
+            }
+        }
+
+        poll_dcb_list_consume(pending, n);
+    }
+}
+
 void poll_fake_write_event(DCB *dcb)
 {
     poll_add_event_to_dcb(dcb, NULL, EPOLLOUT);
@@ -1513,6 +2831,59 @@ dShowEventStats(DCB *pdcb)
     }
     dcb_printf(pdcb, " > %2d00ms      | %-10d | %-10d\n", N_QUEUE_TIMES,
                queueStats.qtimes[N_QUEUE_TIMES], queueStats.exectimes[N_QUEUE_TIMES]);
+
+    if (thread_data)
+    {
+        dcb_printf(pdcb, "\nQueueing delay of events.\n");
+        dcb_printf(pdcb, " ID | Events       | Average    | Maximum    | Continued reads | Coalesced writes\n");
+        dcb_printf(pdcb, "----+--------------+------------+------------+-----------------+-----------------\n");
+
+        for (i = 0; i < n_threads; i++)
+        {
+            THREAD_DATA *data = &thread_data[i];
+            dcb_printf(pdcb, " %2d | %12" PRIu64 " | %8" PRIu64 "us | %8" PRIu64 "us | %15" PRIu64
+                       " | %" PRIu64 "\n", i,
+                       data->n_queued, data->n_queued ? data->queue_delay / data->n_queued / 1000 : 0,
+                       data->max_queue_delay / 1000, data->n_continued, data->n_flushed);
+        }
+    }
+
+    if (config_get_global_options()->adaptive_polls)
+    {
+        static const char *wakeup_times[N_WAKEUP_TIMES] =
+        {
+            " < 1us", " 1 - 10us", " 10 - 100us", " 100us - 1ms", " 1 - 10ms", " 10 - 100ms", " > 100ms"
+        };
+        uint32_t spin_wakeups[N_WAKEUP_TIMES] = {};
+        uint32_t block_wakeups[N_WAKEUP_TIMES] = {};
+
+        dcb_printf(pdcb, "\nAdaptive non-blocking polls.\n");
+        dcb_printf(pdcb, " ID | Polls  | Idle time  | Poll time\n");
+        dcb_printf(pdcb, "----+--------+------------+-----------\n");
+
+        for (i = 0; i < n_threads; i++)
+        {
+            dcb_printf(pdcb, " %2d | %6d | %8" PRIu64 "us | %7" PRIu64 "ns\n", i,
+                       spin_data[i].n_spins, spin_data[i].gap / 1000, spin_data[i].spin_cost);
+
+            for (int j = 0; j < N_WAKEUP_TIMES; j++)
+            {
+                spin_wakeups[j] += spin_data[i].spin_wakeups[j];
+                block_wakeups[j] += spin_data[i].block_wakeups[j];
+            }
+        }
+
+        dcb_printf(pdcb, "\n");
+        dcb_printf(pdcb, "               |    Number of wakeups\n");
+        dcb_printf(pdcb, "Idle time      | Spinning   | Blocking\n");
+        dcb_printf(pdcb, "---------------+------------+-----------\n");
+
+        for (i = 0; i < N_WAKEUP_TIMES; i++)
+        {
+            dcb_printf(pdcb, "%-14s | %-10u | %-10u\n",
+                       wakeup_times[i], spin_wakeups[i], block_wakeups[i]);
+        }
+    }
 }
 
 /**
@@ -1624,46 +2995,142 @@ eventTimesGetList()
     return set;
 }
 
-void poll_send_message(enum poll_message msg, void *data)
+bool poll_post_task(int thread_id, POLL_TASK_FN func, void *data)
 {
-    spinlock_acquire(&poll_msg_lock);
-    int nthr = config_threadcount();
-    poll_msg_data = data;
+    ss_dassert(thread_id >= 0 && thread_id < n_threads);
+    POLL_TASK *task = (POLL_TASK*)MXS_MALLOC(sizeof(POLL_TASK));
 
-    for (int i = 0; i < nthr; i++)
+    if (task == NULL)
+    {
+        return false;
+    }
+
+    task->func = func;
+    task->data = data;
+
+    POLL_TASK_QUEUE *queue = &task_queues[thread_id];
+    POLL_TASK *head;
+
+    do
+    {
+        head = *(POLL_TASK * volatile *)&queue->head;
+        task->next = head;
+    }
+    while (!atomic_cas_ptr((void**)&queue->head, head, task));
+
+    if (head == NULL)
     {
-        poll_msg[i] |= msg;
+        /** The queue was empty and the thread might be waiting for events */
+        uint64_t one = 1;
+        if (write(queue->fd, &one, sizeof(one)) != sizeof(one))
+        {
+            /** The counter can only overflow if the thread has stopped
+             * polling, in which case it would not be woken up anyway */
+            MXS_WARNING("Failed to wake up thread %d: %d, %s",
+                        thread_id, errno, mxs_strerror(errno));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Execute the tasks posted to a thread
+ *
+ * @param thread_id The ID of the calling thread
+ */
+static void poll_process_tasks(int thread_id)
+{
+    POLL_TASK_QUEUE *queue = &task_queues[thread_id];
+
+    /** A dirty read avoids the atomic operation when the queue is empty */
+    if (*(POLL_TASK * volatile *)&queue->head == NULL)
+    {
+        return;
     }
 
-    /** Handle this thread's message */
-    poll_check_message();
+    POLL_TASK *task = (POLL_TASK*)atomic_exchange_ptr((void**)&queue->head, NULL);
+    POLL_TASK *ordered = NULL;
+
+    /** Reverse the list so that the tasks are executed in posting order */
+    while (task)
+    {
+        POLL_TASK *next = task->next;
+        task->next = ordered;
+        ordered = task;
+        task = next;
+    }
+
+    while (ordered)
+    {
+        POLL_TASK *next = ordered->next;
+        ordered->func(thread_id, ordered->data);
+        MXS_FREE(ordered);
+        ordered = next;
+    }
+}
+
+static void poll_broadcast_task(int thread_id, void *data)
+{
+    POLL_BROADCAST *broadcast = (POLL_BROADCAST*)data;
+    broadcast->func(thread_id, broadcast->data);
+    atomic_add(&broadcast->pending, -1);
+}
+
+void poll_execute_on_all(POLL_TASK_FN func, void *data)
+{
+    int nthr = config_threadcount();
+    POLL_BROADCAST broadcast = {func, data, nthr};
 
     for (int i = 0; i < nthr; i++)
     {
-        if (i != current_thread_id)
+        if (i == current_thread_id)
         {
-            while (poll_msg[i] & msg)
+            poll_broadcast_task(i, &broadcast);
+        }
+        else
+        {
+            while (!poll_post_task(i, poll_broadcast_task, &broadcast))
             {
                 thread_millisleep(1);
             }
         }
     }
 
-    poll_msg_data = NULL;
-    spinlock_release(&poll_msg_lock);
+    while (atomic_add(&broadcast.pending, 0) > 0)
+    {
+        if (current_thread_id != -1)
+        {
+            /** Another thread could be waiting for this one */
+            poll_process_tasks(current_thread_id);
+        }
+        thread_millisleep(1);
+    }
 }
 
-static void poll_check_message()
+int poll_get_active_threads()
 {
-    int thread_id = current_thread_id;
+    return atomic_load_int(&n_active_threads);
+}
 
-    if (poll_msg[thread_id] & POLL_MSG_CLEAN_PERSISTENT)
+bool poll_set_active_threads(int n)
+{
+    if (n < 1 || n > n_threads)
     {
-        SERVER *server = (SERVER*)poll_msg_data;
-        dcb_persistent_clean_count(server->persistent[thread_id], thread_id, false);
-        atomic_synchronize();
-        poll_msg[thread_id] &= ~POLL_MSG_CLEAN_PERSISTENT;
+        MXS_ERROR("The number of active threads must be between 1 and %d, "
+                  "the number of threads started with 'max_threads'.", n_threads);
+        return false;
     }
+
+    int old = atomic_add(&n_active_threads, n - atomic_load_int(&n_active_threads));
+
+    for (int i = n; i < old; i++)
+    {
+        poll_post_task(i, poll_drain_task, NULL);
+    }
+
+    MXS_NOTICE("Number of active threads changed from %d to %d.", old, n);
+    return true;
 }
 
 DCB* dcb_get_current()
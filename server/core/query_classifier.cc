@@ -12,11 +12,20 @@
  */
 
 #include "maxscale/query_classifier.h"
+#include <inttypes.h>
+#include <list>
+#include <new>
+#include <string>
+#include <tr1/unordered_map>
 #include <maxscale/log_manager.h>
 #include <maxscale/modutil.h>
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
 #include <maxscale/platform.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/spinlock.h>
 #include <maxscale/utils.h>
 #include "maxscale/trxboundaryparser.hh"
 
@@ -44,6 +53,274 @@ static QUERY_CLASSIFIER* classifier;
 
 static qc_trx_parse_using_t qc_trx_parse_using = QC_TRX_PARSE_USING_PARSER;
 
+namespace
+{
+
+/**
+ * A per-thread cache of classification results
+ *
+ * The results are keyed by the command and the canonical form of the
+ * statement, so statements that only differ by their literal values share
+ * an entry. The least recently used entries are evicted when the size of
+ * the cache would exceed the configured maximum.
+ */
+class QcCache
+{
+public:
+    struct Entry
+    {
+        Entry()
+            : type_mask(QUERY_TYPE_UNKNOWN)
+            , op(QUERY_OP_UNDEFINED)
+        {
+        }
+
+        uint32_t      type_mask;
+        qc_query_op_t op;
+    };
+
+    QcCache(int64_t max_size)
+        : m_max_size(max_size)
+        , m_size(0)
+        , m_hits(0)
+        , m_misses(0)
+        , m_evictions(0)
+    {
+    }
+
+    /**
+     * Find the result of a statement
+     *
+     * @param key   The cache key of the statement
+     * @param entry Set to the cached result if one was found
+     *
+     * @return True if the statement was found
+     */
+    bool get(const std::string& key, Entry* entry)
+    {
+        Entries::iterator it = m_entries.find(key);
+        bool found = false;
+
+        if (it != m_entries.end())
+        {
+            // Move the entry to the front of the LRU list.
+            m_lru.splice(m_lru.begin(), m_lru, it->second.pos);
+            *entry = it->second.entry;
+            ++m_hits;
+            found = true;
+        }
+        else
+        {
+            ++m_misses;
+        }
+
+        return found;
+    }
+
+    /**
+     * Store the result of a statement
+     *
+     * @param key   The cache key of the statement
+     * @param entry The classification result
+     */
+    void put(const std::string& key, const Entry& entry)
+    {
+        int64_t size = entry_size(key);
+
+        if (size > m_max_size || m_entries.find(key) != m_entries.end())
+        {
+            return;
+        }
+
+        while (m_size + size > m_max_size)
+        {
+            evict();
+        }
+
+        m_lru.push_front(key);
+
+        Node& node = m_entries[key];
+        node.entry = entry;
+        node.pos = m_lru.begin();
+        m_size += size;
+    }
+
+    void get_stats(int64_t* hits, int64_t* misses) const
+    {
+        *hits = m_hits;
+        *misses = m_misses;
+    }
+
+    void print_stats(DCB* dcb, int id) const
+    {
+        int64_t total = m_hits + m_misses;
+
+        dcb_printf(dcb, " %2d | %-12" PRId64 " | %-12" PRId64 " | %-8.1f | %-12" PRId64 " | %-10zu | %" PRId64 "\n",
+                   id, m_hits, m_misses, total ? 100.0 * m_hits / total : 0.0,
+                   m_evictions, m_entries.size(), m_size);
+    }
+
+private:
+    struct Node
+    {
+        Entry                            entry;
+        std::list<std::string>::iterator pos;
+    };
+
+    typedef std::tr1::unordered_map<std::string, Node> Entries;
+
+    /** Approximate memory used by an entry: the key is stored twice */
+    static int64_t entry_size(const std::string& key)
+    {
+        return 2 * key.size() + sizeof(Node) + 4 * sizeof(void*);
+    }
+
+    void evict()
+    {
+        ss_dassert(!m_lru.empty());
+
+        const std::string& key = m_lru.back();
+        m_size -= entry_size(key);
+        m_entries.erase(key);
+        m_lru.pop_back();
+        ++m_evictions;
+    }
+
+    Entries                m_entries;
+    std::list<std::string> m_lru;
+    int64_t                m_max_size;
+    int64_t                m_size;
+    int64_t                m_hits;
+    int64_t                m_misses;
+    int64_t                m_evictions;
+};
+
+typedef std::list<QcCache*> QcCaches;
+
+SPINLOCK qc_caches_lock = SPINLOCK_INIT;
+QcCaches qc_caches;
+
+thread_local QcCache* this_cache = NULL;
+
+/**
+ * Create the cache key of a statement
+ *
+ * @param query A COM_QUERY or COM_STMT_PREPARE packet
+ * @param key   Set to the key of the statement
+ *
+ * @return True if the statement can be cached
+ */
+bool qc_cache_get_key(GWBUF* query, std::string* key)
+{
+    bool rval = false;
+
+    if (GWBUF_LENGTH(query) > MYSQL_HEADER_LEN + 1 && GWBUF_IS_SQL(query))
+    {
+        const char* sql = (const char*)GWBUF_DATA(query) + MYSQL_HEADER_LEN + 1;
+        size_t len = GWBUF_LENGTH(query) - MYSQL_HEADER_LEN - 1;
+
+        // The command is a part of the key as a prepared statement
+        // gets a different type than the same query.
+        key->resize(len + 2);
+        (*key)[0] = (char)MYSQL_GET_COMMAND(GWBUF_DATA(query));
+        key->resize(modutil_canonicalize(sql, len, &(*key)[1], NULL) + 1);
+        rval = true;
+    }
+
+    return rval;
+}
+
+/**
+ * Check if a result can be shared by all statements with the same key
+ *
+ * The autocommit value of SET autocommit=? is one of the replaced literals.
+ */
+bool qc_cache_is_cacheable(uint32_t type_mask)
+{
+    return !(type_mask & (QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_DISABLE_AUTOCOMMIT));
+}
+
+/**
+ * Get the classification result of a statement
+ *
+ * If the statement is not in the cache, it is classified and stored in the
+ * cache. The cache must be enabled for the calling thread.
+ *
+ * @param query A COM_QUERY or COM_STMT_PREPARE packet
+ * @param entry Set to the result
+ *
+ * @return True if the result was stored in @c entry
+ */
+bool qc_cache_get_result(GWBUF* query, QcCache::Entry* entry)
+{
+    ss_dassert(this_cache);
+
+    std::string key;
+    bool rval = false;
+
+    if (qc_cache_get_key(query, &key))
+    {
+        if (this_cache->get(key, entry))
+        {
+            rval = true;
+        }
+        else
+        {
+            int32_t op = QUERY_OP_UNDEFINED;
+
+            classifier->qc_get_type_mask(query, &entry->type_mask);
+            classifier->qc_get_operation(query, &op);
+            entry->op = (qc_query_op_t)op;
+
+            if (qc_cache_is_cacheable(entry->type_mask))
+            {
+                this_cache->put(key, *entry);
+            }
+
+            rval = true;
+        }
+    }
+
+    return rval;
+}
+
+}
+
+void qc_print_cache_stats(DCB* dcb)
+{
+    dcb_printf(dcb, "Query Classification Cache.\n\n");
+
+    if (config_get_global_options()->qc_cache_size > 0)
+    {
+        dcb_printf(dcb, " ID | Hits         | Misses       | Hit %%    | Evictions    | Entries    | Size\n");
+        dcb_printf(dcb, "----+--------------+--------------+----------+--------------+------------+----------\n");
+
+        spinlock_acquire(&qc_caches_lock);
+
+        int id = 0;
+
+        for (QcCaches::const_iterator it = qc_caches.begin(); it != qc_caches.end(); ++it)
+        {
+            (*it)->print_stats(dcb, id++);
+        }
+
+        spinlock_release(&qc_caches_lock);
+    }
+    else
+    {
+        dcb_printf(dcb, "The query classification cache is not enabled.\n");
+    }
+}
+
+bool qc_get_cache_stats(int64_t* hits, int64_t* misses)
+{
+    if (this_cache)
+    {
+        this_cache->get_stats(hits, misses);
+    }
+
+    return this_cache != NULL;
+}
 
 bool qc_setup(const char* plugin_name, const char* plugin_args)
 {
@@ -159,7 +436,29 @@ bool qc_thread_init(uint32_t kind)
 
     bool rc = true;
 
-    if (kind & QC_INIT_PLUGIN)
+    if (kind & QC_INIT_SELF)
+    {
+        int64_t cache_size = config_get_global_options()->qc_cache_size;
+
+        if (cache_size > 0 && !this_cache)
+        {
+            this_cache = new (std::nothrow) QcCache(cache_size);
+
+            if (this_cache)
+            {
+                spinlock_acquire(&qc_caches_lock);
+                qc_caches.push_back(this_cache);
+                spinlock_release(&qc_caches_lock);
+            }
+            else
+            {
+                MXS_OOM();
+                rc = false;
+            }
+        }
+    }
+
+    if (rc && (kind & QC_INIT_PLUGIN))
     {
         rc = classifier->qc_thread_init() == 0;
     }
@@ -176,6 +475,16 @@ void qc_thread_end(uint32_t kind)
     {
         classifier->qc_thread_end();
     }
+
+    if ((kind & QC_INIT_SELF) && this_cache)
+    {
+        spinlock_acquire(&qc_caches_lock);
+        qc_caches.remove(this_cache);
+        spinlock_release(&qc_caches_lock);
+
+        delete this_cache;
+        this_cache = NULL;
+    }
 }
 
 qc_parse_result_t qc_parse(GWBUF* query, uint32_t collect)
@@ -196,8 +505,16 @@ uint32_t qc_get_type_mask(GWBUF* query)
     ss_dassert(classifier);
 
     uint32_t type_mask = QUERY_TYPE_UNKNOWN;
+    QcCache::Entry entry;
 
-    classifier->qc_get_type_mask(query, &type_mask);
+    if (this_cache && qc_cache_get_result(query, &entry))
+    {
+        type_mask = entry.type_mask;
+    }
+    else
+    {
+        classifier->qc_get_type_mask(query, &type_mask);
+    }
 
     return type_mask;
 }
@@ -208,8 +525,16 @@ qc_query_op_t qc_get_operation(GWBUF* query)
     ss_dassert(classifier);
 
     int32_t op = QUERY_OP_UNDEFINED;
+    QcCache::Entry entry;
 
-    classifier->qc_get_operation(query, &op);
+    if (this_cache && qc_cache_get_result(query, &entry))
+    {
+        op = entry.op;
+    }
+    else
+    {
+        classifier->qc_get_operation(query, &op);
+    }
 
     return (qc_query_op_t)op;
 }
@@ -251,6 +576,20 @@ char** qc_get_table_names(GWBUF* query, int* tblsize, bool fullnames)
     return names;
 }
 
+void qc_get_table_names_ref(GWBUF* query, bool fullnames, const char* const** names, size_t* n_names)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    *names = NULL;
+
+    uint32_t n = 0;
+
+    classifier->qc_get_table_names_ref(query, fullnames, names, &n);
+
+    *n_names = n;
+}
+
 char* qc_get_canonical(GWBUF* query)
 {
     QC_TRACE();
@@ -328,6 +667,20 @@ char** qc_get_database_names(GWBUF* query, int* sizep)
     return names;
 }
 
+void qc_get_database_names_ref(GWBUF* query, const char* const** names, size_t* n_names)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    *names = NULL;
+
+    uint32_t n = 0;
+
+    classifier->qc_get_database_names_ref(query, names, &n);
+
+    *n_names = n;
+}
+
 char* qc_get_prepare_name(GWBUF* query)
 {
     QC_TRACE();
@@ -904,3 +1257,183 @@ uint32_t qc_get_trx_type_mask(GWBUF* stmt)
 {
     return qc_get_trx_type_mask_using(stmt, qc_trx_parse_using);
 }
+
+uint32_t qc_get_session_type_mask(GWBUF* stmt)
+{
+    maxscale::TrxBoundaryParser parser;
+
+    return parser.session_type_mask_of(stmt);
+}
+
+/**
+ * Checks whether a part of a multi-statement query contains only
+ * whitespace, semicolons and comments.
+ *
+ * @param s    The start of the part.
+ * @param end  One past the end of the part.
+ *
+ * @return True, if there is no statement in the part.
+ */
+static bool qc_is_empty_statement(const char* s, const char* end)
+{
+    while (s < end)
+    {
+        if (isspace(*s) || *s == ';')
+        {
+            ++s;
+        }
+        else if (*s == '#' || (*s == '-' && s + 2 < end && s[1] == '-' && isspace(s[2])))
+        {
+            while (s < end && *s != '\n')
+            {
+                ++s;
+            }
+        }
+        else if (*s == '/' && s + 2 < end && s[1] == '*' && s[2] != '!')
+        {
+            const char* p = s + 2;
+
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+            {
+                ++p;
+            }
+
+            if (p + 1 >= end)
+            {
+                break;
+            }
+
+            s = p + 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return s == end;
+}
+
+/**
+ * Creates a COM_QUERY packet.
+ *
+ * @param sql  The statement.
+ * @param len  The length of the statement.
+ *
+ * @return The packet or NULL if the allocation failed.
+ */
+static GWBUF* qc_create_query(const char* sql, size_t len)
+{
+    GWBUF* query = gwbuf_alloc(MYSQL_HEADER_LEN + 1 + len);
+
+    if (query)
+    {
+        uint8_t* data = GWBUF_DATA(query);
+
+        gw_mysql_set_byte3(data, len + 1);
+        data[3] = 0;
+        data[4] = MYSQL_COM_QUERY;
+        memcpy(data + MYSQL_HEADER_LEN + 1, sql, len);
+        gwbuf_set_type(query, GWBUF_TYPE_MYSQL);
+    }
+
+    return query;
+}
+
+uint32_t* qc_get_type_masks(GWBUF* query, int* n_masks)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    uint32_t* type_masks = NULL;
+    int n_type_masks = 0;
+    int capacity = 0;
+    bool ok = false;
+
+    *n_masks = 0;
+
+    if (GWBUF_IS_CONTIGUOUS(query) && GWBUF_LENGTH(query) > MYSQL_HEADER_LEN &&
+        MYSQL_GET_COMMAND(GWBUF_DATA(query)) == MYSQL_COM_QUERY)
+    {
+        char* sql = (char*)GWBUF_DATA(query) + MYSQL_HEADER_LEN + 1;
+        char* end = (char*)GWBUF_DATA(query) + GWBUF_LENGTH(query);
+        char* start = sql;
+
+        ok = true;
+
+        while (ok && start < end)
+        {
+            char* stop = strnchr_esc_mysql(start, ';', end - start);
+
+            /** Skip the END of stored procedures etc. */
+            while (stop && is_mysql_sp_end(stop, end - stop))
+            {
+                stop = strnchr_esc_mysql(stop + 1, ';', end - stop - 1);
+            }
+
+            if (!stop)
+            {
+                stop = end;
+            }
+
+            if (!qc_is_empty_statement(start, stop))
+            {
+                if (n_type_masks == capacity)
+                {
+                    capacity = capacity ? 2 * capacity : 4;
+                    uint32_t* masks = (uint32_t*)MXS_REALLOC(type_masks, capacity * sizeof(uint32_t));
+
+                    if (masks)
+                    {
+                        type_masks = masks;
+                    }
+                    else
+                    {
+                        ok = false;
+                    }
+                }
+
+                if (ok)
+                {
+                    if (start == sql && stop == end)
+                    {
+                        // A single statement, the buffer can be classified as such.
+                        type_masks[n_type_masks++] = qc_get_type_mask(query);
+                    }
+                    else
+                    {
+                        GWBUF* stmt = qc_create_query(start, stop - start);
+
+                        if (stmt)
+                        {
+                            type_masks[n_type_masks++] = qc_get_type_mask(stmt);
+                            gwbuf_free(stmt);
+                        }
+                        else
+                        {
+                            ok = false;
+                        }
+                    }
+                }
+            }
+
+            start = stop + 1;
+        }
+    }
+    else
+    {
+        MXS_ERROR("The provided buffer is not a contiguous COM_QUERY packet.");
+    }
+
+    if (ok)
+    {
+        *n_masks = n_type_masks;
+    }
+    else
+    {
+        MXS_FREE(type_masks);
+        type_masks = NULL;
+    }
+
+    return type_masks;
+}
@@ -222,6 +222,27 @@ bool mxs_dequeue_if_expired(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result)
     return (found != NULL);
 }
 
+/**
+ * @brief Get the number of items in a queue
+ *
+ * If the queue config is NULL, the function will behave as for an empty queue.
+ *
+ * @param queue_config  The configuration and anchor structure for the queue
+ * @return int          The number of items in the queue
+ */
+int mxs_queue_length(QUEUE_CONFIG *queue_config)
+{
+    int count = 0;
+
+    if (queue_config && queue_config->has_entries)
+    {
+        spinlock_acquire(&queue_config->queue_lock);
+        count = mxs_queue_count(queue_config);
+        spinlock_release(&queue_config->queue_lock);
+    }
+    return count;
+}
+
 static inline int mxs_queue_count(QUEUE_CONFIG *queue_config)
 {
     int count = queue_config->end - queue_config->start;
@@ -22,88 +22,110 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
+#include <maxscale/atomic.h>
+#include <maxscale/platform.h>
 #include <maxscale/random_jkiss.h>
-#include <maxscale/debug.h>
 
 /* Public domain code for JKISS RNG - Comment header added */
 
+/**
+ * The state of the generator. Each thread has its own state so that the
+ * threads neither contend for it nor corrupt it by updating it concurrently.
+ */
+typedef struct jkiss_state
+{
+    unsigned int x;
+    unsigned int y;
+    unsigned int z;
+    unsigned int c;
+    bool         seeded;
+} JKISS_STATE;
+
 /* If possible, the seed variables will be set from /dev/urandom but
  * should that fail, these arbitrary numbers will be used as a last resort.
  */
-static unsigned int x = 123456789, y = 987654321, z = 43219876, c = 6543217; /* Seed variables */
-static bool init = false;
+static thread_local JKISS_STATE state = {123456789, 987654321, 43219876, 6543217, false};
 
-unsigned int random_jkiss(void)
-{
-    unsigned long long t;
-    unsigned int result;
-    ss_dassert(init);
-
-    x = 314527869 * x + 1234567;
-    y ^= y << 5;
-    y ^= y >> 7;
-    y ^= y << 22;
-    t = 4294584393ULL * z + c;
-    c = t >> 32;
-    z = t;
-    result = x + y + z;
-    return result;
-}
+/** Distinguishes the fallback seeds of different threads */
+static int seed_counter = 0;
 
 /* Own code adapted from http://www0.cs.ucl.ac.uk/staff/d.jones/GoodPracticeRNG.pdf */
 
-/***
- *
- * Obtain a seed random number from /dev/urandom if available.
- *
- * @return  uint    Random number
- *
+/**
+ * Seed the generator of the calling thread, from /dev/urandom if available.
  */
-static unsigned int random_jkiss_devrand(void)
+static void random_jkiss_seed(void)
 {
-    int fn;
-    unsigned int r;
+    unsigned int seed[4] = {};
+    int fn = open("/dev/urandom", O_RDONLY);
 
-    if ((fn = open("/dev/urandom", O_RDONLY)) == -1)
+    if (fn != -1)
     {
-        return 0;
+        if (read(fn, seed, sizeof(seed)) != sizeof(seed))
+        {
+            memset(seed, 0, sizeof(seed));
+        }
+        close(fn);
     }
 
-    if (read(fn, &r, sizeof(r)) != sizeof(r))
+    if (seed[0] == 0 && seed[1] == 0 && seed[2] == 0 && seed[3] == 0)
     {
-        r = 0;
+        /** No randomness available, at least make the sequences of the threads differ */
+        state.x += 2654435761U * (unsigned int)atomic_add(&seed_counter, 1);
     }
-    close(fn);
-    return r;
-}
-
-void random_jkiss_init(void)
-{
-    if (!init)
+    else
     {
-        int newrand, i;
-
-        if ((newrand = random_jkiss_devrand()) != 0)
+        if (seed[0] != 0)
         {
-            x = newrand;
+            state.x = seed[0];
         }
 
-        if ((newrand = random_jkiss_devrand()) != 0)
+        if (seed[1] != 0)
         {
-            y = newrand;
+            state.y = seed[1]; /* Must not be zero */
         }
 
-        if ((newrand = random_jkiss_devrand()) != 0)
+        if (seed[2] != 0)
         {
-            z = newrand;
+            state.z = seed[2];
         }
 
-        if ((newrand = random_jkiss_devrand()) != 0)
+        if (seed[3] != 0)
         {
-            c = newrand % 698769068 + 1; /* Should be less than 698769069 */
+            state.c = seed[3] % 698769068 + 1; /* Should be less than 698769069 */
         }
+    }
+
+    state.seeded = true;
+}
+
+unsigned int random_jkiss(void)
+{
+    unsigned long long t;
+    unsigned int result;
 
-        init = true;
+    if (!state.seeded)
+    {
+        random_jkiss_seed();
+    }
+
+    state.x = 314527869 * state.x + 1234567;
+    state.y ^= state.y << 5;
+    state.y ^= state.y >> 7;
+    state.y ^= state.y << 22;
+    t = 4294584393ULL * state.z + state.c;
+    state.c = t >> 32;
+    state.z = t;
+    result = state.x + state.y + state.z;
+    return result;
+}
+
+void random_jkiss_init(void)
+{
+    if (!state.seeded)
+    {
+        random_jkiss_seed();
     }
 }
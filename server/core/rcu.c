@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file rcu.c Epoch based freeing of data read without locks
+ *
+ * The global epoch is advanced every time data is retired and the retired
+ * data is tagged with the new epoch. At each quiescent point a polling thread
+ * copies the global epoch into its own epoch, an offline thread has the epoch
+ * zero. Data retired in an epoch can be freed once every online thread has an
+ * epoch at least as large, as each of them has then passed a quiescent point
+ * after the data was replaced.
+ */
+
+#include "maxscale/rcu.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/debug.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/spinlock.h>
+
+/** How often the retired data is freed, in seconds */
+#define RCU_RECLAIM_FREQ 1
+
+#define RCU_OFFLINE 0
+
+typedef struct rcu_thread
+{
+    uint64_t epoch; /*< The global epoch at the last quiescent point */
+} __attribute__((aligned(64))) RCU_THREAD;
+
+typedef struct rcu_retired
+{
+    struct rcu_retired *next;
+    uint64_t            epoch;            /*< The epoch in which the data was retired */
+    void               *data;
+    void              (*free_fn)(void *data);
+} RCU_RETIRED;
+
+static uint64_t     global_epoch = 1;
+static RCU_THREAD  *threads = NULL;
+static int          n_rcu_threads = 0;
+static SPINLOCK     retired_lock = SPINLOCK_INIT;
+static RCU_RETIRED *retired_head = NULL; /*< Oldest retired data first */
+static RCU_RETIRED *retired_tail = NULL;
+static int          n_retired = 0;
+
+static void rcu_reclaim_task(void *data)
+{
+    mxs_rcu_reclaim();
+}
+
+bool mxs_rcu_init(int n_threads)
+{
+    ss_dassert(threads == NULL);
+
+    /** The epochs are zeroed, i.e. the threads are offline until they start polling */
+    if ((threads = (RCU_THREAD*)MXS_CALLOC(n_threads, sizeof(RCU_THREAD))))
+    {
+        n_rcu_threads = n_threads;
+        spinlock_set_name(&retired_lock, "rcu");
+        hktask_add("RCU reclaim", rcu_reclaim_task, NULL, RCU_RECLAIM_FREQ);
+    }
+
+    return threads != NULL;
+}
+
+void mxs_rcu_quiescent(int thread_id)
+{
+    /** Sequentially consistent so that the loads of published pointers that
+     * follow are not done before the new epoch is visible to the reclaimer */
+    __atomic_store_n(&threads[thread_id].epoch,
+                     __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+}
+
+void mxs_rcu_offline(int thread_id)
+{
+    __atomic_store_n(&threads[thread_id].epoch, RCU_OFFLINE, __ATOMIC_RELEASE);
+}
+
+void mxs_rcu_retire(void *data, void (*free_fn)(void *data))
+{
+    RCU_RETIRED *retired = (RCU_RETIRED*)MXS_MALLOC(sizeof(RCU_RETIRED));
+
+    if (retired == NULL)
+    {
+        /** The data cannot safely be freed so it is leaked instead */
+        return;
+    }
+
+    retired->next = NULL;
+    retired->data = data;
+    retired->free_fn = free_fn;
+
+    spinlock_acquire(&retired_lock);
+
+    /** The epoch is advanced under the lock so that the list stays ordered */
+    retired->epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+    if (retired_tail)
+    {
+        retired_tail->next = retired;
+    }
+    else
+    {
+        retired_head = retired;
+    }
+
+    retired_tail = retired;
+    n_retired++;
+
+    spinlock_release(&retired_lock);
+}
+
+int mxs_rcu_reclaim()
+{
+    uint64_t min_epoch = UINT64_MAX;
+
+    for (int i = 0; i < n_rcu_threads; i++)
+    {
+        uint64_t epoch = __atomic_load_n(&threads[i].epoch, __ATOMIC_SEQ_CST);
+
+        if (epoch != RCU_OFFLINE && epoch < min_epoch)
+        {
+            min_epoch = epoch;
+        }
+    }
+
+    RCU_RETIRED *expired = NULL;
+    int n_freed = 0;
+
+    spinlock_acquire(&retired_lock);
+
+    if (retired_head && retired_head->epoch <= min_epoch)
+    {
+        RCU_RETIRED *last = retired_head;
+        n_freed = 1;
+
+        while (last->next && last->next->epoch <= min_epoch)
+        {
+            last = last->next;
+            n_freed++;
+        }
+
+        expired = retired_head;
+        retired_head = last->next;
+        last->next = NULL;
+
+        if (retired_head == NULL)
+        {
+            retired_tail = NULL;
+        }
+
+        n_retired -= n_freed;
+    }
+
+    spinlock_release(&retired_lock);
+
+    while (expired)
+    {
+        RCU_RETIRED *next = expired->next;
+        expired->free_fn(expired->data);
+        MXS_FREE(expired);
+        expired = next;
+    }
+
+    return n_freed;
+}
+
+int mxs_rcu_pending()
+{
+    spinlock_acquire(&retired_lock);
+    int rval = n_retired;
+    spinlock_release(&retired_lock);
+    return rval;
+}
@@ -25,16 +25,34 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <maxscale/alloc.h>
 #include <maxscale/resultset.h>
 #include <maxscale/buffer.h>
 #include <maxscale/dcb.h>
 
+/** The size of the buffers into which the rows are collected before writing */
+#define RESULTSET_BATCH_SIZE (64 * 1024)
 
-static int mysql_send_fieldcount(DCB *, int);
-static int mysql_send_columndef(DCB *, const char *, int, int, uint8_t);
-static int mysql_send_eof(DCB *, int);
-static int mysql_send_row(DCB *, RESULT_ROW *, int);
+/**
+ * Collects the packets of a result set into large buffers so that the rows
+ * are not written to the DCB one at a time
+ */
+typedef struct resultset_writer
+{
+    DCB    *dcb;  /*< The DCB the buffers are written to */
+    GWBUF  *buf;  /*< The buffer being filled, NULL if none */
+    size_t  used; /*< The number of bytes used in the buffer */
+} RESULTSET_WRITER;
+
+static uint8_t *writer_reserve(RESULTSET_WRITER *, size_t);
+static void writer_flush(RESULTSET_WRITER *);
+static void writer_printf(RESULTSET_WRITER *, const char *, ...) __attribute__((format (printf, 2, 3)));
+static int mysql_send_fieldcount(RESULTSET_WRITER *, int);
+static int mysql_send_columndef(RESULTSET_WRITER *, const char *, int, int, uint8_t);
+static int mysql_send_eof(RESULTSET_WRITER *, int);
+static int mysql_send_row(RESULTSET_WRITER *, RESULT_ROW *, int);
 
 
 /**
@@ -229,10 +247,94 @@ resultset_row_set(RESULT_ROW *row, int col, const char *value)
     return 1;
 }
 
+/**
+ * Reserve space for data in the buffer being filled. If the data does not
+ * fit, the buffer is written first and a new one is started.
+ *
+ * @param writer        The writer
+ * @param len           The number of bytes needed
+ * @return              Pointer to the reserved space or NULL on memory allocation failure
+ */
+static uint8_t *
+writer_reserve(RESULTSET_WRITER *writer, size_t len)
+{
+    if (writer->buf && writer->used + len > GWBUF_LENGTH(writer->buf))
+    {
+        writer_flush(writer);
+    }
+
+    if (writer->buf == NULL)
+    {
+        if ((writer->buf = gwbuf_alloc(MXS_MAX(len, RESULTSET_BATCH_SIZE))) == NULL)
+        {
+            return NULL;
+        }
+        writer->used = 0;
+    }
+
+    uint8_t *ptr = GWBUF_DATA(writer->buf) + writer->used;
+    writer->used += len;
+    return ptr;
+}
+
+/**
+ * Write the buffer being filled to the DCB
+ *
+ * @param writer        The writer
+ */
+static void
+writer_flush(RESULTSET_WRITER *writer)
+{
+    if (writer->buf)
+    {
+        GWBUF_RTRIM(writer->buf, GWBUF_LENGTH(writer->buf) - writer->used);
+
+        if (writer->used > 0)
+        {
+            writer->dcb->func.write(writer->dcb, writer->buf);
+        }
+        else
+        {
+            gwbuf_free(writer->buf);
+        }
+
+        writer->buf = NULL;
+        writer->used = 0;
+    }
+}
+
+/**
+ * Add formatted text to the buffer being filled
+ *
+ * @param writer        The writer
+ * @param fmt           The format string
+ */
+static void
+writer_printf(RESULTSET_WRITER *writer, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    // The terminating null byte is written but not counted as used.
+    char *ptr = (char*)writer_reserve(writer, len + 1);
+
+    if (ptr)
+    {
+        va_start(args, fmt);
+        vsnprintf(ptr, len + 1, fmt, args);
+        va_end(args);
+        writer->used--;
+    }
+}
+
 /**
  * Stream a result set using the MySQL protocol for encodign the result
  * set. Each row is retrieved by calling the function passed in the
- * argument list.
+ * argument list. The packets are collected into large buffers, so the
+ * rows are not written one at a time.
  *
  * @param set   The result set to stream
  * @param dcb   The connection to stream the result set to
@@ -243,55 +345,55 @@ resultset_stream_mysql(RESULTSET *set, DCB *dcb)
     RESULT_COLUMN *col;
     RESULT_ROW *row;
     uint8_t seqno = 2;
+    RESULTSET_WRITER writer = {dcb, NULL, 0};
 
-    mysql_send_fieldcount(dcb, set->n_cols);
+    mysql_send_fieldcount(&writer, set->n_cols);
 
     col = set->column;
     while (col)
     {
-        mysql_send_columndef(dcb, col->name, col->type, col->len, seqno++);
+        mysql_send_columndef(&writer, col->name, col->type, col->len, seqno++);
         col = col->next;
     }
-    mysql_send_eof(dcb, seqno++);
+    mysql_send_eof(&writer, seqno++);
     while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
     {
-        mysql_send_row(dcb, row, seqno++);
+        mysql_send_row(&writer, row, seqno++);
         resultset_free_row(row);
     }
-    mysql_send_eof(dcb, seqno);
+    mysql_send_eof(&writer, seqno);
+    writer_flush(&writer);
 }
 
 /**
  * Send the field count packet in a response packet sequence.
  *
- * @param dcb           DCB of connection to send result set to
+ * @param writer        The writer of the result set
  * @param count         Number of columns in the result set
  * @return              Non-zero on success
  */
 static int
-mysql_send_fieldcount(DCB *dcb, int count)
+mysql_send_fieldcount(RESULTSET_WRITER *writer, int count)
 {
-    GWBUF *pkt;
     uint8_t *ptr;
 
-    if ((pkt = gwbuf_alloc(5)) == NULL)
+    if ((ptr = writer_reserve(writer, 5)) == NULL)
     {
         return 0;
     }
-    ptr = GWBUF_DATA(pkt);
     *ptr++ = 0x01;                  // Payload length
     *ptr++ = 0x00;
     *ptr++ = 0x00;
     *ptr++ = 0x01;                  // Sequence number in response
     *ptr++ = count;                 // Length of result string
-    return dcb->func.write(dcb, pkt);
+    return 1;
 }
 
 
 /**
  * Send the column definition packet in a response packet sequence.
  *
- * @param dcb           The DCB of the connection
+ * @param writer        The writer of the result set
  * @param name          Name of the column
  * @param type          Column type
  * @param len           Column length
@@ -299,17 +401,15 @@ mysql_send_fieldcount(DCB *dcb, int count)
  * @return              Non-zero on success
  */
 static int
-mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqno)
+mysql_send_columndef(RESULTSET_WRITER *writer, const char *name, int type, int len, uint8_t seqno)
 {
-    GWBUF *pkt;
     uint8_t *ptr;
     int plen;
 
-    if ((pkt = gwbuf_alloc(26 + strlen(name))) == NULL)
+    if ((ptr = writer_reserve(writer, 26 + strlen(name))) == NULL)
     {
         return 0;
     }
-    ptr = GWBUF_DATA(pkt);
     plen = 22 + strlen(name);
     *ptr++ = plen & 0xff;
     *ptr++ = (plen >> 8) & 0xff;
@@ -348,28 +448,26 @@ mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqn
     *ptr++ = 0;
     *ptr++ = 0;
     *ptr++ = 0;
-    return dcb->func.write(dcb, pkt);
+    return 1;
 }
 
 
 /**
  * Send an EOF packet in a response packet sequence.
  *
- * @param dcb           The client connection
+ * @param writer        The writer of the result set
  * @param seqno         The sequence number of the EOF packet
  * @return              Non-zero on success
  */
 static int
-mysql_send_eof(DCB *dcb, int seqno)
+mysql_send_eof(RESULTSET_WRITER *writer, int seqno)
 {
-    GWBUF   *pkt;
     uint8_t *ptr;
 
-    if ((pkt = gwbuf_alloc(9)) == NULL)
+    if ((ptr = writer_reserve(writer, 9)) == NULL)
     {
         return 0;
     }
-    ptr = GWBUF_DATA(pkt);
     *ptr++ = 0x05;
     *ptr++ = 0x00;
     *ptr++ = 0x00;
@@ -379,7 +477,7 @@ mysql_send_eof(DCB *dcb, int seqno)
     *ptr++ = 0x00;
     *ptr++ = 0x02;                          // Autocommit enabled
     *ptr++ = 0x00;
-    return dcb->func.write(dcb, pkt);
+    return 1;
 }
 
 
@@ -387,15 +485,14 @@ mysql_send_eof(DCB *dcb, int seqno)
 /**
  * Send a row packet in a response packet sequence.
  *
- * @param dcb           The client connection
+ * @param writer        The writer of the result set
  * @param row           The row to send
  * @param seqno         The sequence number of the EOF packet
  * @return              Non-zero on success
  */
 static int
-mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
+mysql_send_row(RESULTSET_WRITER *writer, RESULT_ROW *row, int seqno)
 {
-    GWBUF *pkt;
     int i, len = 4;
     uint8_t *ptr;
 
@@ -408,11 +505,10 @@ mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
         len++;
     }
 
-    if ((pkt = gwbuf_alloc(len)) == NULL)
+    if ((ptr = writer_reserve(writer, len)) == NULL)
     {
         return 0;
     }
-    ptr = GWBUF_DATA(pkt);
     len -= 4;
     *ptr++ = len & 0xff;
     *ptr++ = (len >> 8) & 0xff;
@@ -433,7 +529,7 @@ mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
         }
     }
 
-    return dcb->func.write(dcb, pkt);
+    return 1;
 }
 
 /**
@@ -466,7 +562,8 @@ value_is_numeric(const char *value)
 /**
  * Stream a result set encoding it as a JSON object
  * Each row is retrieved by calling the function passed in the
- * argument list.
+ * argument list. The text is collected into large buffers, so the
+ * rows are not written one at a time.
  *
  * @param set   The result set to stream
  * @param dcb   The connection to stream the result set to
@@ -477,44 +574,46 @@ resultset_stream_json(RESULTSET *set, DCB *dcb)
     RESULT_COLUMN *col;
     RESULT_ROW *row;
     int rowno = 0;
+    RESULTSET_WRITER writer = {dcb, NULL, 0};
 
-    dcb_printf(dcb, "[ ");
+    writer_printf(&writer, "[ ");
     while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
     {
         int i = 0;
         if (rowno++ > 0)
         {
-            dcb_printf(dcb, ",\n");
+            writer_printf(&writer, ",\n");
         }
-        dcb_printf(dcb, "{ ");
+        writer_printf(&writer, "{ ");
         col = set->column;
         while (col)
         {
-            dcb_printf(dcb, "\"%s\" : ", col->name);
+            writer_printf(&writer, "\"%s\" : ", col->name);
             if (row->cols[i])
             {
                 if (value_is_numeric(row->cols[i]))
                 {
-                    dcb_printf(dcb, "%s", row->cols[i]);
+                    writer_printf(&writer, "%s", row->cols[i]);
                 }
                 else
                 {
-                    dcb_printf(dcb, "\"%s\"", row->cols[i]);
+                    writer_printf(&writer, "\"%s\"", row->cols[i]);
                 }
             }
             else
             {
-                dcb_printf(dcb, "null");
+                writer_printf(&writer, "null");
             }
             i++;
             col = col->next;
             if (col)
             {
-                dcb_printf(dcb, ", ");
+                writer_printf(&writer, ", ");
             }
         }
         resultset_free_row(row);
-        dcb_printf(dcb, "}");
+        writer_printf(&writer, "}");
     }
-    dcb_printf(dcb, "]\n");
+    writer_printf(&writer, "]\n");
+    writer_flush(&writer);
 }
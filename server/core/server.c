@@ -32,11 +32,13 @@
  *
  * @endverbatim
  */
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <maxscale/service.h>
 #include <maxscale/session.h>
@@ -47,8 +49,10 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/ssl.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/paths.h>
 
+#include "maxscale/metrics.h"
 #include "maxscale/monitor.h"
 #include "maxscale/poll.h"
 
@@ -58,6 +62,12 @@
 static SPINLOCK server_spin = SPINLOCK_INIT;
 static SERVER *allServers = NULL;
 
+/** Serializes the publishers of server states */
+static SPINLOCK publish_lock = SPINLOCK_INIT;
+/** Incremented before and after the publication of server states. An odd
+ * value means that the states are being published. */
+static uint64_t publish_seq = 0;
+
 static void spin_reporter(void *, char *, int);
 static void server_parameter_free(SERVER_PARAM *tofree);
 
@@ -125,11 +135,29 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     server->status_pending = SERVER_RUNNING;
     server->node_id = -1;
     server->rlag = MAX_RLAG_UNDEFINED;
+    server->rlag_ms = MAX_RLAG_UNDEFINED;
+    server->synced_ms = 0;
     server->master_id = -1;
     server->depth = -1;
+    server->load = 0;
     server->parameters = NULL;
     server->server_string = NULL;
+    server->published.status = server->status;
+    server->published.rlag = server->rlag;
+    server->published.rlag_ms = server->rlag_ms;
+    server->published.synced_ms = server->synced_ms;
+    server->published.node_ts = 0;
+    server->published.node_id = server->node_id;
+    server->published.master_id = server->master_id;
+    server->published.depth = server->depth;
+    server->published.load = server->load;
     spinlock_init(&server->lock);
+
+    char lockname[SPINLOCK_NAME_LEN];
+    snprintf(lockname, sizeof(lockname), "server:%s", server->unique_name);
+    spinlock_set_name(&server->lock, lockname);
+    spinlock_set_name(&server_spin, "servers");
+
     server->persistent = persistent;
     server->persistmax = 0;
     server->persistmaxtime = 0;
@@ -139,6 +167,7 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     server->is_active = true;
     server->created_online = false;
     server->charset = SERVER_DEFAULT_CHARSET;
+    server->sockopts = (MXS_SOCKET_OPTS)MXS_SOCKET_OPTS_INIT;
 
     spinlock_acquire(&server_spin);
     server->next = allServers;
@@ -184,8 +213,14 @@ server_free(SERVER *tofreeserver)
     MXS_FREE(tofreeserver->protocol);
     MXS_FREE(tofreeserver->unique_name);
     MXS_FREE(tofreeserver->server_string);
+    MXS_FREE(tofreeserver->socket);
     server_parameter_free(tofreeserver->parameters);
 
+    if (tofreeserver->stats.latency)
+    {
+        ts_hist_free(tofreeserver->stats.latency);
+    }
+
     if (tofreeserver->persistent)
     {
         int nthr = config_threadcount();
@@ -383,6 +418,71 @@ dprintAllServers(DCB *dcb)
     spinlock_release(&server_spin);
 }
 
+/**
+ * Print the metrics of all servers
+ *
+ * Each metric family is printed for all servers before the next one.
+ *
+ * @param dcb The DCB to print to
+ */
+void
+dprintAllServersMetrics(DCB *dcb)
+{
+    SERVER *server;
+
+    spinlock_acquire(&server_spin);
+
+    metrics_family(dcb, "maxscale_server_running", "gauge", NULL,
+                   "Whether the monitor sees the server running");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_sample(dcb, "maxscale_server_running", "server", server->unique_name,
+                       SERVER_IS_RUNNING(server) ? 1 : 0);
+    }
+
+    metrics_family(dcb, "maxscale_server_connections", "counter", NULL,
+                   "Number of connections created to the server");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_sample(dcb, "maxscale_server_connections_total", "server", server->unique_name,
+                       server->stats.n_connections);
+    }
+
+    metrics_family(dcb, "maxscale_server_current_connections", "gauge", NULL,
+                   "Current number of connections to the server");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_sample(dcb, "maxscale_server_current_connections", "server", server->unique_name,
+                       server->stats.n_current);
+    }
+
+    metrics_family(dcb, "maxscale_server_current_operations", "gauge", NULL,
+                   "Current number of queries waiting for a reply from the server");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_sample(dcb, "maxscale_server_current_operations", "server", server->unique_name,
+                       server->stats.n_current_ops);
+    }
+
+    metrics_family(dcb, "maxscale_server_pooled_connections", "gauge", NULL,
+                   "Current number of connections in the persistent pool");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_sample(dcb, "maxscale_server_pooled_connections", "server", server->unique_name,
+                       server->stats.n_persistent);
+    }
+
+    metrics_family(dcb, "maxscale_server_latency_seconds", "summary", "seconds",
+                   "Time from sending a query to the complete reply");
+    for (server = next_active_server(allServers); server; server = next_active_server(server->next))
+    {
+        metrics_latency(dcb, "maxscale_server_latency_seconds", "server", server->unique_name,
+                        server->stats.latency);
+    }
+
+    spinlock_release(&server_spin);
+}
+
 /**
  * Print all servers in Json format to a DCB
  *
@@ -447,12 +547,17 @@ dprintAllServersJson(DCB *dcb)
         }
         dcb_printf(dcb, "    \"replDepth\": \"%d\",\n",
                    server->depth);
+        dcb_printf(dcb, "    \"load\": \"%d\",\n", server->load);
         if (SERVER_IS_SLAVE(server) || SERVER_IS_RELAY_SERVER(server))
         {
             if (server->rlag >= 0)
             {
                 dcb_printf(dcb, "    \"slaveDelay\": \"%d\",\n", server->rlag);
             }
+            if (server->rlag_ms >= 0)
+            {
+                dcb_printf(dcb, "    \"slaveDelayMs\": \"%d\",\n", server->rlag_ms);
+            }
         }
         if (server->node_ts > 0)
         {
@@ -480,6 +585,17 @@ dprintAllServersJson(DCB *dcb)
     spinlock_release(&server_spin);
 }
 
+/**
+ * Clean the persistent connections of a server owned by the calling thread
+ *
+ * @param thread_id The ID of the calling thread
+ * @param data      The server
+ */
+static void server_clean_persistent_task(int thread_id, void *data)
+{
+    SERVER *server = (SERVER*)data;
+    dcb_persistent_clean_count(server->persistent[thread_id], thread_id, false);
+}
 
 /**
  * Print server details to a DCB
@@ -502,6 +618,10 @@ dprintServer(DCB *dcb, const SERVER *server)
     MXS_FREE(stat);
     dcb_printf(dcb, "\tProtocol:                            %s\n", server->protocol);
     dcb_printf(dcb, "\tPort:                                %d\n", server->port);
+    if (server->socket)
+    {
+        dcb_printf(dcb, "\tSocket:                              %s\n", server->socket);
+    }
     if (server->server_string)
     {
         dcb_printf(dcb, "\tServer Version:                      %s\n", server->server_string);
@@ -526,12 +646,21 @@ dprintServer(DCB *dcb, const SERVER *server)
         dcb_printf(dcb, "\n");
     }
     dcb_printf(dcb, "\tRepl Depth:                          %d\n", server->depth);
+    if (server->load > 0)
+    {
+        dcb_printf(dcb, "\tLoad:                                %.1f%%\n",
+                   (double)server->load * 100 / SERVER_LOAD_MAX);
+    }
     if (SERVER_IS_SLAVE(server) || SERVER_IS_RELAY_SERVER(server))
     {
         if (server->rlag >= 0)
         {
             dcb_printf(dcb, "\tSlave delay:                         %d\n", server->rlag);
         }
+        if (server->rlag_ms >= 0)
+        {
+            dcb_printf(dcb, "\tSlave delay in milliseconds:         %d\n", server->rlag_ms);
+        }
     }
     if (server->node_ts > 0)
     {
@@ -557,15 +686,27 @@ dprintServer(DCB *dcb, const SERVER *server)
     dcb_printf(dcb, "\tNumber of connections:               %d\n", server->stats.n_connections);
     dcb_printf(dcb, "\tCurrent no. of conns:                %d\n", server->stats.n_current);
     dcb_printf(dcb, "\tCurrent no. of operations:           %d\n", server->stats.n_current_ops);
+    if (server->stats.response_time)
+    {
+        dcb_printf(dcb, "\tAverage response time (usecs):       %" PRId64 "\n", server->stats.response_time);
+    }
+    if (server->stats.latency && ts_hist_count(server->stats.latency))
+    {
+        dcb_printf(dcb, "\tLatency p50/p99/p99.9 (usecs):       %" PRId64 "/%" PRId64 "/%" PRId64 "\n",
+                   ts_hist_percentile(server->stats.latency, 50),
+                   ts_hist_percentile(server->stats.latency, 99),
+                   ts_hist_percentile(server->stats.latency, 99.9));
+    }
     if (server->persistpoolmax)
     {
         dcb_printf(dcb, "\tPersistent pool size:                %d\n", server->stats.n_persistent);
-        poll_send_message(POLL_MSG_CLEAN_PERSISTENT, (void*)server);
+        poll_execute_on_all(server_clean_persistent_task, (void*)server);
         dcb_printf(dcb, "\tPersistent measured pool size:       %d\n", server->stats.n_persistent);
         dcb_printf(dcb, "\tPersistent actual size max:          %d\n", server->persistmax);
         dcb_printf(dcb, "\tPersistent pool size limit:          %ld\n", server->persistpoolmax);
         dcb_printf(dcb, "\tPersistent max time (secs):          %ld\n", server->persistmaxtime);
         dcb_printf(dcb, "\tConnections taken from pool:         %lu\n", server->stats.n_from_pool);
+        dcb_printf(dcb, "\tConnections not found in pool:       %lu\n", server->stats.n_new_conn);
         double d =  (double)server->stats.n_from_pool / (double)(server->stats.n_connections + server->stats.n_from_pool + 1);
         dcb_printf(dcb, "\tPool availability:                   %0.2lf%%\n", d * 100.0);
     }
@@ -584,6 +725,9 @@ dprintServer(DCB *dcb, const SERVER *server)
                    l->ssl_key ? l->ssl_key : "null");
         dcb_printf(dcb, "\tSSL CA certificate:                  %s\n",
                    l->ssl_ca_cert ? l->ssl_ca_cert : "null");
+        dcb_printf(dcb, "\tSSL handshakes (full/resumed):       %lu/%lu\n",
+                   atomic_load_uint64(&l->n_full_handshakes),
+                   atomic_load_uint64(&l->n_resumed_handshakes));
     }
 }
 
@@ -815,6 +959,43 @@ server_add_mon_user(SERVER *server, const char *user, const char *passwd)
     }
 }
 
+/**
+ * Connect to a server through a Unix domain socket
+ *
+ * The address and the port of the server are still used to identify it, for
+ * example in the replication topology, but the connections to it are made
+ * through the socket.
+ *
+ * @param server The server to update
+ * @param path   The path of the socket of the server
+ * @return True if the path was stored, false if it is too long or memory
+ *         allocation failed
+ */
+bool
+server_set_socket(SERVER *server, const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) > sizeof(addr.sun_path) - 1)
+    {
+        MXS_ERROR("The socket path '%s' of server '%s' is too long, the maximum "
+                  "length is %lu characters.", path, server->unique_name,
+                  sizeof(addr.sun_path) - 1);
+        return false;
+    }
+
+    char *my_path = MXS_STRDUP(path);
+
+    if (my_path == NULL)
+    {
+        return false;
+    }
+
+    MXS_FREE(server->socket);
+    server->socket = my_path;
+    return true;
+}
+
 /**
  * Check and update a server definition following a configuration
  * update. Changes will not affect any current connections to this
@@ -943,6 +1124,7 @@ server_get_parameter(const SERVER *server, char *name)
 static RESULT_ROW *
 serverRowCallback(RESULTSET *set, void *data)
 {
+    static const double latency_percentiles[] = {50, 99, 99.9};
     int *rowno = (int *)data;
     int i = 0;
     char *stat = NULL, buf[20];
@@ -975,6 +1157,13 @@ serverRowCallback(RESULTSET *set, void *data)
         stat = server_status(server);
         resultset_row_set(row, 4, stat);
         MXS_FREE(stat);
+
+        for (int j = 0; j < 3; j++)
+        {
+            ts_hist_t latency = server->stats.latency;
+            sprintf(buf, "%" PRId64, latency ? ts_hist_percentile(latency, latency_percentiles[j]) : 0);
+            resultset_row_set(row, 5 + j, buf);
+        }
     }
     spinlock_release(&server_spin);
     return row;
@@ -1006,6 +1195,9 @@ serverGetList()
     resultset_add_column(set, "Port", 5, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Connections", 8, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Status", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p50", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p99", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p99.9", 10, COL_TYPE_VARCHAR);
 
     return set;
 }
@@ -1135,6 +1327,14 @@ static bool create_server_config(const SERVER *server, const char *filename)
     dprintf(file, "protocol=%s\n", server->protocol);
     dprintf(file, "address=%s\n", server->name);
     dprintf(file, "port=%u\n", server->port);
+
+    if (server->socket)
+    {
+        dprintf(file, "socket=%s\n", server->socket);
+    }
+
+    write_socket_opts_config(file, &server->sockopts);
+
     dprintf(file, "authenticator=%s\n", server->authenticator);
 
     if (server->auth_options)
@@ -1266,6 +1466,7 @@ void server_set_status(SERVER *server, int bit)
     {
         /* Set the bit directly */
         server_set_status_nolock(server, bit);
+        server_publish_states(&server, 1);
     }
     spinlock_release(&server->lock);
 }
@@ -1293,10 +1494,57 @@ void server_clear_status(SERVER *server, int bit)
     {
         /* Clear bit directly */
         server_clear_status_nolock(server, bit);
+        server_publish_states(&server, 1);
     }
     spinlock_release(&server->lock);
 }
 
+void server_publish_states(SERVER **servers, int n_servers)
+{
+    spinlock_acquire(&publish_lock);
+    atomic_add_uint64(&publish_seq, 1);
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        SERVER *server = servers[i];
+        server->published.status = server->status;
+        server->published.rlag = server->rlag;
+        server->published.rlag_ms = server->rlag_ms;
+        server->published.synced_ms = server->synced_ms;
+        server->published.node_ts = server->node_ts;
+        server->published.node_id = server->node_id;
+        server->published.master_id = server->master_id;
+        server->published.depth = server->depth;
+        server->published.load = server->load;
+    }
+
+    atomic_add_uint64(&publish_seq, 1);
+    spinlock_release(&publish_lock);
+}
+
+void server_get_states(SERVER **servers, int n_servers, SERVER_STATE *states)
+{
+    uint64_t seq;
+
+    do
+    {
+        seq = atomic_load_uint64(&publish_seq);
+
+        for (int i = 0; i < n_servers; i++)
+        {
+            states[i] = servers[i]->published;
+        }
+
+        atomic_synchronize();
+    }
+    while ((seq & 1) || seq != atomic_load_uint64(&publish_seq));
+}
+
+uint64_t server_states_version(void)
+{
+    return atomic_load_uint64(&publish_seq);
+}
+
 bool server_is_mxs_service(const SERVER *server)
 {
     bool rval = false;
@@ -1315,3 +1563,19 @@ bool server_is_mxs_service(const SERVER *server)
 
     return rval;
 }
+
+void server_add_latency(SERVER *server, int64_t usecs)
+{
+    if (current_thread_id >= 0)
+    {
+        ts_hist_add_lazy(&server->stats.latency, usecs, current_thread_id);
+    }
+}
+
+void server_add_response_time(SERVER *server, int64_t usecs)
+{
+    int64_t average = server->stats.response_time;
+
+    /** The first sample is used as is so that new servers get measured quickly */
+    server->stats.response_time = average ? (7 * average + usecs) / 8 : MXS_MAX(usecs, 1);
+}
@@ -39,6 +39,7 @@
  * @endverbatim
  */
 #include <maxscale/service.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,8 +49,11 @@
 #include <sys/types.h>
 #include <math.h>
 #include <fcntl.h>
+#include <mysql.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/paths.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/listener.h>
@@ -62,14 +66,19 @@
 #include <maxscale/server.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/users.h>
 #include <maxscale/utils.h>
 #include <maxscale/version.h>
 
 #include "maxscale/config.h"
 #include "maxscale/filter.h"
+#include "maxscale/handoff.h"
+#include "maxscale/metrics.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/queuemanager.h"
+#include "maxscale/rcu.h"
 #include "maxscale/service.h"
 
 /** Base value for server weights */
@@ -99,13 +108,20 @@ typelib_t sqlvar_target_type =
 static SPINLOCK service_spin = SPINLOCK_INIT;
 static SERVICE  *allServices = NULL;
 
+/** The snapshot of a service that has no servers yet, it is never freed */
+static SERVICE_SERVERS no_servers = {0, 0, NULL};
+
 static int find_type(typelib_t* tl, const char* needle, int maxlen);
 
 static void service_add_qualified_param(SERVICE*          svc,
                                         MXS_CONFIG_PARAMETER* param);
 static void service_internal_restart(void *data);
 static void service_queue_check(void *data);
+static void service_queue_start(DCB *dcb);
+static void service_queue_drain(SERVICE *service);
+static void service_admission_check(void *data);
 static void service_calculate_weights(SERVICE *service);
+static void service_publish_servers(SERVICE *service);
 
 SERVICE* service_alloc(const char *name, const char *router)
 {
@@ -145,10 +161,12 @@ SERVICE* service_alloc(const char *name, const char *router)
     service->capabilities = 0;
     service->client_count = 0;
     service->n_dbref = 0;
+    service->servers = &no_servers;
     service->name = my_name;
     service->routerModule = my_router;
     service->users_from_all = false;
     service->queued_connections = NULL;
+    spinlock_init(&service->admission.lock);
     service->localhost_match_wildcard_host = SERVICE_PARAM_UNINIT;
     service->retry_start = true;
     service->conn_idle_timeout = SERVICE_NO_SESSION_TIMEOUT;
@@ -174,6 +192,11 @@ SERVICE* service_alloc(const char *name, const char *router)
     service->state = SERVICE_STATE_ALLOC;
     spinlock_init(&service->spin);
 
+    char lockname[SPINLOCK_NAME_LEN];
+    snprintf(lockname, sizeof(lockname), "service:%s", service->name);
+    spinlock_set_name(&service->spin, lockname);
+    spinlock_set_name(&service_spin, "services");
+
     spinlock_acquire(&service_spin);
     service->next = allServices;
     allServices = service;
@@ -224,6 +247,24 @@ static inline void close_port(SERV_LISTENER *port)
     }
 }
 
+/**
+ * Create the address and port string that is given to the listen entry point
+ *
+ * @param port The port
+ * @param dest Buffer large enough for the address, the port and two characters
+ */
+static void port_bind_config(const SERV_LISTENER *port, char *dest)
+{
+    if (port->address)
+    {
+        sprintf(dest, "%s|%d", port->address, port->port);
+    }
+    else
+    {
+        sprintf(dest, "::|%d", port->port);
+    }
+}
+
 /**
  * Start an individual port/protocol pair
  *
@@ -305,14 +346,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
      * listeners aren't normal DCBs, we can skip that.
      */
 
-    if (port->address)
-    {
-        sprintf(config_bind, "%s|%d", port->address, port->port);
-    }
-    else
-    {
-        sprintf(config_bind, "::|%d", port->port);
-    }
+    port_bind_config(port, config_bind);
 
     /** Load the authentication users before before starting the listener */
     if (port->listener->authfunc.loadusers)
@@ -612,28 +646,142 @@ bool serviceStartListener(SERVICE *service, const char *name)
     return rval;
 }
 
+/**
+ * @brief Get a monotonic timestamp in milliseconds
+ *
+ * @return The current time in milliseconds
+ */
+static uint64_t service_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** The services that are started in parallel at startup */
+typedef struct service_launch
+{
+    SERVICE **services;    /**< The services to start */
+    int       n_services;  /**< Number of services */
+    int       next;        /**< Index of the next service to start */
+    int       n_listeners; /**< Number of listeners that were started */
+    bool      error;       /**< Whether a service failed to start */
+    SERVICE  *slowest;     /**< The service that took the longest to start */
+    uint64_t  slowest_ms;  /**< How long the slowest service took to start */
+    SPINLOCK  lock;        /**< Protects the results */
+} SERVICE_LAUNCH;
+
+/**
+ * Start services until all have been started
+ *
+ * Each service opens its listeners as soon as its router instance has been
+ * created and its users have been loaded, regardless of the other services.
+ *
+ * @param data The SERVICE_LAUNCH
+ */
+static void service_launch_thread(void *data)
+{
+    SERVICE_LAUNCH *launch = (SERVICE_LAUNCH*)data;
+    bool mysql_thread = mysql_thread_init() == 0;
+    int i;
+
+    while ((i = atomic_add(&launch->next, 1)) < launch->n_services)
+    {
+        SERVICE *service = launch->services[i];
+
+        if (service->svc_do_shutdown)
+        {
+            continue;
+        }
+
+        uint64_t start = service_clock_ms();
+        int listeners = serviceInitialize(service);
+        uint64_t duration = service_clock_ms() - start;
+
+        if (listeners == 0)
+        {
+            MXS_ERROR("Failed to start service '%s'.", service->name);
+        }
+
+        MXS_INFO("Service '%s' started in %" PRIu64 " milliseconds.", service->name, duration);
+
+        spinlock_acquire(&launch->lock);
+        launch->n_listeners += listeners;
+        launch->error = launch->error || listeners == 0;
+
+        if (launch->slowest == NULL || duration > launch->slowest_ms)
+        {
+            launch->slowest = service;
+            launch->slowest_ms = duration;
+        }
+        spinlock_release(&launch->lock);
+    }
+
+    if (mysql_thread)
+    {
+        mysql_thread_end();
+    }
+}
+
 int service_launch_all()
 {
-    SERVICE *ptr;
-    int n = 0, i;
-    bool error = false;
+    SERVICE_LAUNCH launch = {.lock = SPINLOCK_INIT};
+    uint64_t start = service_clock_ms();
 
     config_enable_feedback_task();
 
-    ptr = allServices;
-    while (ptr && !ptr->svc_do_shutdown)
+    for (SERVICE *ptr = allServices; ptr; ptr = ptr->next)
     {
-        n += (i = serviceInitialize(ptr));
+        launch.n_services++;
+    }
+
+    if (launch.n_services == 0)
+    {
+        return 0;
+    }
+
+    if ((launch.services = MXS_MALLOC(launch.n_services * sizeof(SERVICE*))) == NULL)
+    {
+        return 0;
+    }
+
+    int n = 0;
+
+    for (SERVICE *ptr = allServices; ptr; ptr = ptr->next)
+    {
+        launch.services[n++] = ptr;
+    }
 
-        if (i == 0)
+    /** The services are started in the order they were created in, each
+     * thread taking the next one that is not yet being started. The modules
+     * of the services were loaded when the configuration was processed. */
+    int n_threads = MXS_MIN(config_threadcount(), launch.n_services);
+    THREAD threads[n_threads];
+    int n_started = 0;
+
+    for (int i = 1; i < n_threads; i++)
+    {
+        if (thread_start(&threads[n_started], service_launch_thread, &launch))
         {
-            MXS_ERROR("Failed to start service '%s'.", ptr->name);
-            error = true;
+            n_started++;
         }
+    }
 
-        ptr = ptr->next;
+    service_launch_thread(&launch);
+
+    for (int i = 0; i < n_started; i++)
+    {
+        thread_wait(threads[i]);
     }
-    return error ? 0 : n;
+
+    MXS_NOTICE("Started %d services in %" PRIu64 " milliseconds using %d threads. The slowest "
+               "service, '%s', took %" PRIu64 " milliseconds.", launch.n_services,
+               service_clock_ms() - start, n_started + 1,
+               launch.slowest ? launch.slowest->name : "", launch.slowest_ms);
+
+    MXS_FREE(launch.services);
+
+    return launch.error ? 0 : launch.n_listeners;
 }
 
 bool serviceStop(SERVICE *service)
@@ -725,6 +873,11 @@ void service_free(SERVICE *service)
         MXS_FREE(srv);
     }
 
+    if (service->servers != &no_servers)
+    {
+        MXS_FREE(service->servers);
+    }
+
     MXS_FREE(service->name);
     MXS_FREE(service->routerModule);
     MXS_FREE(service->weightby);
@@ -735,6 +888,21 @@ void service_free(SERVICE *service)
     config_parameter_free(service->svc_config_param);
     serviceClearRouterOptions(service);
 
+    if (service->stats.latency)
+    {
+        ts_hist_free(service->stats.latency);
+    }
+
+    ts_stats_t times[] = {service->stats.query_time, service->stats.reply_time, service->stats.wait_time};
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (times[i])
+        {
+            ts_stats_free(times[i]);
+        }
+    }
+
     MXS_FREE(service);
 }
 
@@ -874,6 +1042,8 @@ bool serviceAddBackend(SERVICE *service, SERVER *server)
                 atomic_synchronize();
                 service->dbref = new_ref;
             }
+
+            service_publish_servers(service);
             spinlock_release(&service->spin);
         }
     }
@@ -900,6 +1070,7 @@ void serviceRemoveBackend(SERVICE *service, const SERVER *server)
         {
             ref->active = false;
             service->n_dbref--;
+            service_publish_servers(service);
             break;
         }
     }
@@ -1162,11 +1333,102 @@ serviceSetConnectionLimits(SERVICE *service, int max, int queued, int timeout)
     return 1;
 }
 
+bool service_queue_connection(SERVICE *service, DCB *dcb)
+{
+    if (!mxs_enqueue(service->queued_connections, dcb))
+    {
+        return false;
+    }
+
+    /** A connection may have been closed after the caller found the service
+     * full but before the connection was queued, in which case no one else
+     * would start it */
+    service_queue_drain(service);
+    return true;
+}
+
+void service_release_connection(SERVICE *service)
+{
+    atomic_add(&service->client_count, -1);
+    service_queue_drain(service);
+}
+
+/**
+ * Start a queued connection that has been given a slot of the service
+ * @param thread_id The thread starting the connection
+ * @param data      The client DCB
+ */
+static void service_queue_start_task(int thread_id, void *data)
+{
+    DCB *dcb = (DCB *)data;
+    /** The protocol does not count a waiting DCB, see gw_process_one_new_client */
+    dcb->func.accept(dcb);
+}
+
+/**
+ * Start a queued connection, whose slot has already been counted in the
+ * client_count of the service
+ *
+ * The connection is started by a task of the calling thread, which executes
+ * it once it has processed its current events, or by the thread of the DCB if
+ * the caller is not a polling thread. Either way the thread is awake or is
+ * woken up by the task.
+ *
+ * @param dcb The dequeued client DCB
+ */
+static void service_queue_start(DCB *dcb)
+{
+    int thread_id = current_thread_id != -1 ? current_thread_id : dcb->thread.id;
+    dcb->state = DCB_STATE_WAITING;
+
+    if (!poll_post_task(thread_id, service_queue_start_task, dcb))
+    {
+        poll_fake_read_event(dcb);
+    }
+}
+
+/**
+ * Give the free slots of the service to the queued connections
+ *
+ * A slot is reserved before a connection is dequeued, so that the
+ * connections closed and queued concurrently neither exceed max_connections
+ * nor leave a connection in the queue while a slot is free.
+ *
+ * @param service The service
+ */
+static void service_queue_drain(SERVICE *service)
+{
+    QUEUE_ENTRY entry;
+
+    while (mxs_queue_length(service->queued_connections) > 0)
+    {
+        if (atomic_add(&service->client_count, 1) >= service->max_connections)
+        {
+            /** The thread holding the slots starts the queued connections
+             * when it releases one */
+            atomic_add(&service->client_count, -1);
+            break;
+        }
+
+        if (mxs_dequeue(service->queued_connections, &entry))
+        {
+            service_queue_start((DCB *)entry.queued_object);
+        }
+        else
+        {
+            /** Another thread emptied the queue, check again in case a
+             * connection was queued after that */
+            atomic_add(&service->client_count, -1);
+        }
+    }
+}
+
 /*
  * @brief The callback function triggered by housekeeping every second
  *
  * This function removes any expired connection requests from the queue, and
- * sends an error message "too many connections" for them.
+ * sends an error message "too many connections" for them. The connections are
+ * started by service_release_connection() when a slot becomes free, not here.
  *
  * @param   The parameter provided by the callback is the queue config
  */
@@ -1186,6 +1448,216 @@ service_queue_check(void *data)
     }
 }
 
+/**
+ * Sets the rate at which new client sessions of the service are created.
+ * @param service Service to configure
+ * @param rate    The number of new sessions per second, 0 for no limit
+ * @param burst   The number of sessions that can be created at once, 0 for @c rate
+ * @param queued  The maximum number of connections to queue up when the
+ *                rate is exceeded
+ * @param timeout The time a connection may wait in the queue
+ * @return 1 on success, 0 when the values are invalid
+ */
+int
+serviceSetConnectionRate(SERVICE *service, int rate, int burst, int queued, int timeout)
+{
+    SERVICE_ADMISSION *admission = &service->admission;
+
+    if (rate < 0 || burst < 0 || queued < 0)
+    {
+        return 0;
+    }
+
+    spinlock_acquire(&admission->lock);
+    admission->rate = rate;
+    admission->burst = burst ? burst : rate;
+    admission->tokens = admission->burst * 10;
+    admission->last = hkheartbeat;
+    spinlock_release(&admission->lock);
+
+    if (rate && queued && timeout && admission->queue == NULL)
+    {
+        char callback_name[100];
+        sprintf(callback_name, "Admit queued connections %p", service);
+        /* If memory allocation fails, result will be null so no queue */
+        admission->queue = mxs_queue_alloc(queued, timeout);
+        if (admission->queue)
+        {
+            hktask_add(callback_name, service_admission_check, (void *)service, 1);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Take a token from the token bucket of a service. The caller must hold
+ * the lock of the admission control.
+ *
+ * @param admission The admission control of the service
+ * @return True if a token was available
+ */
+static bool admission_take_token(SERVICE_ADMISSION *admission)
+{
+    long limit = admission->burst * 10L;
+    long elapsed = hkheartbeat - admission->last;
+
+    if (elapsed > 0)
+    {
+        long tokens = elapsed >= limit ? limit : admission->tokens + elapsed * admission->rate;
+        admission->tokens = tokens < limit ? tokens : limit;
+        admission->last = hkheartbeat;
+    }
+
+    bool rval = admission->tokens >= 10;
+
+    if (rval)
+    {
+        admission->tokens -= 10;
+    }
+
+    return rval;
+}
+
+/**
+ * Return a token that was taken but not used to the token bucket of a
+ * service. The caller must hold the lock of the admission control.
+ *
+ * @param admission The admission control of the service
+ */
+static void admission_return_token(SERVICE_ADMISSION *admission)
+{
+    long limit = admission->burst * 10L;
+    admission->tokens = admission->tokens + 10 < limit ? admission->tokens + 10 : limit;
+}
+
+/**
+ * Refuse a client connection that was not admitted in time.
+ *
+ * @param service The service of the connection
+ * @param dcb     The client DCB, closed by this function
+ */
+static void admission_reject(SERVICE *service, DCB *dcb)
+{
+    atomic_add_uint64(&service->admission.n_rejected, 1);
+
+    if (dcb->func.connlimit)
+    {
+        dcb->func.connlimit(dcb, service->admission.rate);
+    }
+    dcb_close(dcb);
+}
+
+/**
+ * Check whether a new client connection may create its session now. New
+ * connections are admitted at the configured rate and only when no earlier
+ * connection is waiting, so that a reconnecting crowd of clients does not
+ * starve the sessions that already exist.
+ *
+ * @param service The service the client connected to
+ * @param dcb     The new client DCB
+ * @return True if the session can be created, false if the DCB was queued
+ *         or closed
+ */
+bool serviceAdmitConnection(SERVICE *service, DCB *dcb)
+{
+    SERVICE_ADMISSION *admission = &service->admission;
+    bool admitted = true;
+
+    if (admission->rate)
+    {
+        spinlock_acquire(&admission->lock);
+        admitted = mxs_queue_length(admission->queue) == 0 && admission_take_token(admission);
+        spinlock_release(&admission->lock);
+
+        if (!admitted)
+        {
+            if (mxs_enqueue(admission->queue, dcb))
+            {
+                atomic_add_uint64(&admission->n_delayed, 1);
+            }
+            else
+            {
+                admission_reject(service, dcb);
+            }
+        }
+    }
+
+    return admitted;
+}
+
+/*
+ * @brief The callback function triggered by housekeeping every second
+ *
+ * This function refuses the connections that have waited for admission for
+ * too long and starts the sessions of as many of the rest as the token bucket
+ * allows. A connection that finds max_connections reached moves to the queue
+ * of the connection limit.
+ *
+ * @param   The parameter provided by the callback is the service
+ */
+static void
+service_admission_check(void *data)
+{
+    SERVICE *service = (SERVICE *)data;
+    SERVICE_ADMISSION *admission = &service->admission;
+    QUEUE_ENTRY entry;
+
+    while (mxs_dequeue_if_expired(admission->queue, &entry))
+    {
+        admission_reject(service, (DCB *)entry.queued_object);
+    }
+
+    while (mxs_queue_length(admission->queue) > 0)
+    {
+        spinlock_acquire(&admission->lock);
+        bool rate_limited = admission->rate != 0;
+        bool admitted = !rate_limited || admission_take_token(admission);
+        spinlock_release(&admission->lock);
+
+        if (!admitted)
+        {
+            break;
+        }
+
+        /* Only the housekeeper removes entries that are not expired */
+        if (!mxs_dequeue(admission->queue, &entry))
+        {
+            if (rate_limited)
+            {
+                spinlock_acquire(&admission->lock);
+                admission_return_token(admission);
+                spinlock_release(&admission->lock);
+            }
+            break;
+        }
+
+        DCB *dcb = (DCB *)entry.queued_object;
+
+        /** The slot is reserved before it is checked, so that concurrent
+         * closes and admissions cannot exceed max_connections */
+        int count = atomic_add(&service->client_count, 1);
+
+        if (service->max_connections && count >= service->max_connections)
+        {
+            atomic_add(&service->client_count, -1);
+
+            if (!service_queue_connection(service, dcb))
+            {
+                if (dcb->func.connlimit)
+                {
+                    dcb->func.connlimit(dcb, service->max_connections);
+                }
+                dcb_close(dcb);
+            }
+        }
+        else
+        {
+            service_queue_start(dcb);
+        }
+    }
+}
+
 /**
  * Enable or disable the restarting of the service on failure.
  * @param service Service to configure
@@ -1379,6 +1851,55 @@ dprintAllServices(DCB *dcb)
     spinlock_release(&service_spin);
 }
 
+/**
+ * Print the metrics of all services
+ *
+ * Each metric family is printed for all services before the next one.
+ *
+ * @param dcb The DCB to print to
+ */
+void
+dprintAllServicesMetrics(DCB *dcb)
+{
+    SERVICE *service;
+
+    spinlock_acquire(&service_spin);
+
+    metrics_family(dcb, "maxscale_service_sessions", "counter", NULL,
+                   "Number of sessions created since the service was started");
+    for (service = allServices; service; service = service->next)
+    {
+        metrics_sample(dcb, "maxscale_service_sessions_total", "service", service->name,
+                       service->stats.n_sessions);
+    }
+
+    metrics_family(dcb, "maxscale_service_current_sessions", "gauge", NULL,
+                   "Current number of sessions");
+    for (service = allServices; service; service = service->next)
+    {
+        metrics_sample(dcb, "maxscale_service_current_sessions", "service", service->name,
+                       service->stats.n_current);
+    }
+
+    metrics_family(dcb, "maxscale_service_latency_seconds", "summary", "seconds",
+                   "Time from receiving a query from the client to the complete reply");
+    for (service = allServices; service; service = service->next)
+    {
+        metrics_latency(dcb, "maxscale_service_latency_seconds", "service", service->name,
+                        service->stats.latency);
+    }
+
+    spinlock_release(&service_spin);
+}
+
+/**
+ * @return The total of per-thread nanoseconds in seconds
+ */
+static double service_time_secs(ts_stats_t stats)
+{
+    return stats ? ts_stats_get(stats, TS_STATS_SUM) / 1000000000.0 : 0.0;
+}
+
 /**
  * Print details of a single service.
  *
@@ -1448,6 +1969,49 @@ void dprintService(DCB *dcb, SERVICE *service)
                service->stats.n_sessions);
     dcb_printf(dcb, "\tCurrently connected:                 %d\n",
                service->stats.n_current);
+
+    if (service->stats.latency && ts_hist_count(service->stats.latency))
+    {
+        dcb_printf(dcb, "\tQuery latency p50/p99/p99.9 (usecs): %" PRId64 "/%" PRId64 "/%" PRId64 "\n",
+                   ts_hist_percentile(service->stats.latency, 50),
+                   ts_hist_percentile(service->stats.latency, 99),
+                   ts_hist_percentile(service->stats.latency, 99.9));
+    }
+
+    if (service->stats.query_time)
+    {
+        dcb_printf(dcb, "\tTime routing queries/replies (secs):  %.3f/%.3f\n",
+                   service_time_secs(service->stats.query_time),
+                   service_time_secs(service->stats.reply_time));
+        dcb_printf(dcb, "\tTime waiting for servers (secs):      %.3f\n",
+                   service_time_secs(service->stats.wait_time));
+    }
+
+    if (service->queued_connections)
+    {
+        dcb_printf(dcb, "\tQueued connections:                  %d\n",
+                   mxs_queue_length(service->queued_connections));
+    }
+    if (service->admission.rate)
+    {
+        dcb_printf(dcb, "\tConnection rate (per second/burst):  %d/%d\n",
+                   service->admission.rate, service->admission.burst);
+        dcb_printf(dcb, "\tConnections waiting for admission:   %d\n",
+                   mxs_queue_length(service->admission.queue));
+        dcb_printf(dcb, "\tConnections delayed/rejected:        %lu/%lu\n",
+                   atomic_load_uint64(&service->admission.n_delayed),
+                   atomic_load_uint64(&service->admission.n_rejected));
+    }
+
+    for (SERV_LISTENER *port = service->ports; port; port = port->next)
+    {
+        if (port->ssl)
+        {
+            dcb_printf(dcb, "\tSSL handshakes of %s (full/resumed): %lu/%lu\n", port->name,
+                       atomic_load_uint64(&port->ssl->n_full_handshakes),
+                       atomic_load_uint64(&port->ssl->n_resumed_handshakes));
+        }
+    }
 }
 
 /**
@@ -1843,6 +2407,96 @@ void service_shutdown()
     spinlock_release(&service_spin);
 }
 
+bool service_for_each_listener_socket(bool (*func)(const char *key, int fd, void *data), void *data)
+{
+    bool rval = true;
+
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service && rval; service = service->next)
+    {
+        spinlock_acquire(&service->spin);
+
+        for (SERV_LISTENER *port = service->ports; port && rval; port = port->next)
+        {
+            DCB *listener = port->listener;
+
+            if (listener && listener->session && listener->fd > 0 &&
+                listener->session->state == SESSION_STATE_LISTENER)
+            {
+                char config[(port->address ? strlen(port->address) : 2) + UINTLEN(port->port) + 2];
+                char key[HANDOFF_KEY_MAX];
+                int n_sockets = listener->shard_fds ? config_threadcount() : 1;
+
+                port_bind_config(port, config);
+
+                for (int i = 0; i < n_sockets && rval; i++)
+                {
+                    handoff_key(key, config, i);
+                    rval = func(key, listener->shard_fds ? listener->shard_fds[i] : listener->fd, data);
+                }
+            }
+        }
+
+        spinlock_release(&service->spin);
+    }
+
+    spinlock_release(&service_spin);
+
+    return rval;
+}
+
+void service_stop_all_listeners(void)
+{
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service; service = service->next)
+    {
+        serviceStop(service);
+    }
+
+    spinlock_release(&service_spin);
+}
+
+void service_close_all_listeners(void)
+{
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service; service = service->next)
+    {
+        spinlock_acquire(&service->spin);
+
+        for (SERV_LISTENER *port = service->ports; port; port = port->next)
+        {
+            if (port->listener && port->listener->session &&
+                port->listener->session->state == SESSION_STATE_LISTENER_STOPPED)
+            {
+                dcb_listen_close(port->listener);
+            }
+        }
+
+        spinlock_release(&service->spin);
+    }
+
+    spinlock_release(&service_spin);
+}
+
+int service_client_count(void)
+{
+    int n = 0;
+
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service; service = service->next)
+    {
+        n += service->client_count;
+    }
+
+    spinlock_release(&service_spin);
+
+    return n;
+}
+
 void service_destroy_instances(void)
 {
     spinlock_acquire(&service_spin);
@@ -1998,6 +2652,7 @@ serviceGetListenerList()
 static RESULT_ROW *
 serviceRowCallback(RESULTSET *set, void *data)
 {
+    static const double latency_percentiles[] = {50, 99, 99.9};
     int *rowno = (int *)data;
     int i = 0;
     char buf[20];
@@ -2025,6 +2680,13 @@ serviceRowCallback(RESULTSET *set, void *data)
     resultset_row_set(row, 2, buf);
     sprintf(buf, "%d", service->stats.n_sessions);
     resultset_row_set(row, 3, buf);
+
+    for (int j = 0; j < 3; j++)
+    {
+        ts_hist_t latency = service->stats.latency;
+        sprintf(buf, "%" PRId64, latency ? ts_hist_percentile(latency, latency_percentiles[j]) : 0);
+        resultset_row_set(row, 4 + j, buf);
+    }
     spinlock_release(&service_spin);
     return row;
 }
@@ -2054,6 +2716,9 @@ serviceGetList()
     resultset_add_column(set, "Router Module", 20, COL_TYPE_VARCHAR);
     resultset_add_column(set, "No. Sessions", 10, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Total Sessions", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p50", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p99", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Latency p99.9", 10, COL_TYPE_VARCHAR);
 
     return set;
 }
@@ -2093,8 +2758,127 @@ bool service_all_services_have_listeners()
     return rval;
 }
 
+static void service_servers_free(void *data)
+{
+    MXS_FREE(data);
+}
+
+/**
+ * Publish a new snapshot of the servers of a service
+ *
+ * The previous snapshot is freed once no polling thread can be using it.
+ *
+ * @note The service spinlock must be held when this function is called.
+ *
+ * @param service The service
+ */
+static void service_publish_servers(SERVICE *service)
+{
+    int n_servers = 0;
+
+    for (SERVER_REF *ref = service->dbref; ref; ref = ref->next)
+    {
+        if (ref->active)
+        {
+            n_servers++;
+        }
+    }
+
+    SERVICE_SERVERS *servers = MXS_MALLOC(sizeof(SERVICE_SERVERS) + n_servers * sizeof(SERVICE_SERVER));
+
+    if (servers == NULL)
+    {
+        /** The routers keep using the previous snapshot */
+        return;
+    }
+
+    SERVICE_SERVERS *old = service->servers;
+
+    servers->version = old->version + 1;
+    servers->n_servers = 0;
+    servers->servers = (SERVICE_SERVER*)(servers + 1);
+
+    for (SERVER_REF *ref = service->dbref; ref; ref = ref->next)
+    {
+        if (ref->active)
+        {
+            servers->servers[servers->n_servers].ref = ref;
+            servers->servers[servers->n_servers].weight = ref->weight;
+            servers->n_servers++;
+        }
+    }
+
+    atomic_store_ptr((void**)&service->servers, servers);
+
+    if (old != &no_servers)
+    {
+        mxs_rcu_retire(old, service_servers_free);
+    }
+}
+
+/**
+ * Calculate the relative weight of a server
+ *
+ * @param service  The service
+ * @param server   The server reference
+ * @param weightby The weighting parameter
+ * @param total    The sum of the weighting parameters of the servers
+ *
+ * @return The weight of the server
+ */
+static int service_server_weight(SERVICE *service, SERVER_REF *server, char *weightby, int total)
+{
+    int weight = SERVICE_BASE_SERVER_WEIGHT;
+    const char *param = server_get_parameter(server->server, weightby);
+
+    if (param)
+    {
+        int wght = atoi(param);
+        int perc = (wght * SERVICE_BASE_SERVER_WEIGHT) / total;
+
+        if (perc == 0)
+        {
+            MXS_WARNING("Weighting parameter '%s' with a value of %d for"
+                        " server '%s' rounds down to zero with total weight"
+                        " of %d for service '%s'. No queries will be "
+                        "routed to this server as long as a server with"
+                        " positive weight is available.",
+                        weightby, wght, server->server->unique_name,
+                        total, service->name);
+        }
+        else if (perc < 0)
+        {
+            MXS_ERROR("Weighting parameter '%s' for server '%s' is too large, "
+                      "maximum value is %d. No weighting will be used for this "
+                      "server.", weightby, server->server->unique_name,
+                      INT_MAX / SERVICE_BASE_SERVER_WEIGHT);
+            perc = SERVICE_BASE_SERVER_WEIGHT;
+        }
+        weight = perc;
+    }
+    else
+    {
+        MXS_WARNING("Server '%s' has no parameter '%s' used for weighting"
+                    " for service '%s'.", server->server->unique_name,
+                    weightby, service->name);
+    }
+
+    return weight;
+}
+
+/**
+ * Calculate the server weights of a service and publish them
+ *
+ * Each weight is stored only once so that the routers never see the base
+ * weight in place of the calculated one. The weights of one calculation are
+ * published together in a new snapshot of the servers.
+ *
+ * @param service The service
+ */
 static void service_calculate_weights(SERVICE *service)
 {
+    spinlock_acquire(&service->spin);
+
     char *weightby = serviceGetWeightingParameter(service);
     if (weightby && service->dbref)
     {
@@ -2104,7 +2888,6 @@ static void service_calculate_weights(SERVICE *service)
         /** Calculate total weight */
         for (SERVER_REF *server = service->dbref; server; server = server->next)
         {
-            server->weight = SERVICE_BASE_SERVER_WEIGHT;
             const char *param = server_get_parameter(server->server, weightby);
             if (param)
             {
@@ -2124,46 +2907,19 @@ static void service_calculate_weights(SERVICE *service)
                       "maximum value of %d. Weighting will be ignored.",
                       weightby, service->name, INT_MAX);
         }
-        else
-        {
-            /** Calculate the relative weight of the servers */
-            for (SERVER_REF *server = service->dbref; server; server = server->next)
-            {
-                const char *param = server_get_parameter(server->server, weightby);
-                if (param)
-                {
-                    int wght = atoi(param);
-                    int perc = (wght * SERVICE_BASE_SERVER_WEIGHT) / total;
 
-                    if (perc == 0)
-                    {
-                        MXS_WARNING("Weighting parameter '%s' with a value of %d for"
-                                    " server '%s' rounds down to zero with total weight"
-                                    " of %d for service '%s'. No queries will be "
-                                    "routed to this server as long as a server with"
-                                    " positive weight is available.",
-                                    weightby, wght, server->server->unique_name,
-                                    total, service->name);
-                    }
-                    else if (perc < 0)
-                    {
-                        MXS_ERROR("Weighting parameter '%s' for server '%s' is too large, "
-                                  "maximum value is %d. No weighting will be used for this "
-                                  "server.", weightby, server->server->unique_name,
-                                  INT_MAX / SERVICE_BASE_SERVER_WEIGHT);
-                        perc = SERVICE_BASE_SERVER_WEIGHT;
-                    }
-                    server->weight = perc;
-                }
-                else
-                {
-                    MXS_WARNING("Server '%s' has no parameter '%s' used for weighting"
-                                " for service '%s'.", server->server->unique_name,
-                                weightby, service->name);
-                }
-            }
+        /** Calculate the relative weight of the servers */
+        for (SERVER_REF *server = service->dbref; server; server = server->next)
+        {
+            int weight = total > 0 ?
+                         service_server_weight(service, server, weightby, total) :
+                         SERVICE_BASE_SERVER_WEIGHT;
+            server->weight = weight;
         }
     }
+
+    service_publish_servers(service);
+    spinlock_release(&service->spin);
 }
 
 void service_update_weights()
@@ -2322,3 +3078,11 @@ bool service_port_is_used(unsigned short port)
 
     return rval;
 }
+
+void service_add_latency(SERVICE *service, int64_t usecs)
+{
+    if (current_thread_id >= 0)
+    {
+        ts_hist_add_lazy(&service->stats.latency, usecs, current_thread_id);
+    }
+}
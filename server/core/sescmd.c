@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file sescmd.c - Interned session commands
+ *
+ * The commands are stored in a hashtable that is divided into independently
+ * locked shards, so that sessions of different threads seldom contend for the
+ * same lock. The reference counts are only modified while holding the lock
+ * of the shard, which guarantees that a command that is found in the table
+ * cannot be freed before its new reference has been counted.
+ */
+
+#include <maxscale/sescmd.h>
+
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/spinlock.h>
+
+/** The number of shards, a power of two */
+#define SESCMD_SHARDS 64
+
+/** The number of chains in a shard, a power of two */
+#define SESCMD_CHAINS 128
+
+struct mxs_sescmd
+{
+    struct mxs_sescmd *next;     /*< The next command in the chain */
+    uint32_t           hash;     /*< The hash of the contents */
+    int                refcount; /*< The number of references, protected by the shard lock */
+    GWBUF             *buffer;   /*< The command */
+};
+
+typedef struct sescmd_shard
+{
+    SPINLOCK    lock;                   /*< Protects the chains and the reference counts */
+    MXS_SESCMD *chains[SESCMD_CHAINS];  /*< The chains of the shard */
+    char        pad[64];                /*< Keeps the locks on separate cache lines */
+} SESCMD_SHARD;
+
+static SESCMD_SHARD shards[SESCMD_SHARDS];
+static int n_commands = 0;
+
+/**
+ * The FNV-1a hash of the contents of a buffer
+ */
+static uint32_t sescmd_hash(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+static inline SESCMD_SHARD* sescmd_shard(uint32_t hash)
+{
+    return &shards[hash % SESCMD_SHARDS];
+}
+
+static inline MXS_SESCMD** sescmd_chain(SESCMD_SHARD *shard, uint32_t hash)
+{
+    return &shard->chains[(hash / SESCMD_SHARDS) % SESCMD_CHAINS];
+}
+
+/**
+ * Find a command and add a reference to it. The shard must be locked.
+ */
+static MXS_SESCMD* sescmd_find(MXS_SESCMD *cmd, uint32_t hash, const GWBUF *buffer)
+{
+    size_t len = GWBUF_LENGTH(buffer);
+
+    for (; cmd; cmd = cmd->next)
+    {
+        if (cmd->hash == hash && GWBUF_LENGTH(cmd->buffer) == len &&
+            cmd->buffer->gwbuf_type == (buffer->gwbuf_type | GWBUF_TYPE_SESCMD) &&
+            memcmp(GWBUF_DATA(cmd->buffer), GWBUF_DATA(buffer), len) == 0)
+        {
+            cmd->refcount++;
+            return cmd;
+        }
+    }
+
+    return NULL;
+}
+
+MXS_SESCMD* mxs_sescmd_intern(GWBUF *buffer)
+{
+    GWBUF *contiguous = gwbuf_make_contiguous(buffer);
+
+    if (contiguous == NULL)
+    {
+        gwbuf_free(buffer);
+        return NULL;
+    }
+
+    buffer = contiguous;
+
+    size_t len = GWBUF_LENGTH(buffer);
+    uint32_t hash = sescmd_hash(GWBUF_DATA(buffer), len);
+    SESCMD_SHARD *shard = sescmd_shard(hash);
+    MXS_SESCMD **chain = sescmd_chain(shard, hash);
+
+    spinlock_acquire(&shard->lock);
+    MXS_SESCMD *rval = sescmd_find(*chain, hash, buffer);
+    spinlock_release(&shard->lock);
+
+    if (rval == NULL)
+    {
+        // A copy of the exact size, the original may be a part of a larger
+        // read buffer and carry hints and properties that are not needed
+        MXS_SESCMD *cmd = MXS_MALLOC(sizeof(MXS_SESCMD));
+        GWBUF *copy = gwbuf_alloc_and_load(len, GWBUF_DATA(buffer));
+
+        if (cmd && copy)
+        {
+            copy->gwbuf_type = buffer->gwbuf_type | GWBUF_TYPE_SESCMD;
+            cmd->hash = hash;
+            cmd->refcount = 1;
+            cmd->buffer = copy;
+
+            spinlock_acquire(&shard->lock);
+
+            // Another thread may have interned the same command in the meantime
+            if ((rval = sescmd_find(*chain, hash, buffer)) == NULL)
+            {
+                cmd->next = *chain;
+                *chain = cmd;
+                rval = cmd;
+                cmd = NULL;
+                copy = NULL;
+                atomic_add(&n_commands, 1);
+            }
+
+            spinlock_release(&shard->lock);
+        }
+
+        MXS_FREE(cmd);
+        gwbuf_free(copy);
+    }
+
+    gwbuf_free(buffer);
+    return rval;
+}
+
+void mxs_sescmd_release(MXS_SESCMD *cmd)
+{
+    if (cmd)
+    {
+        SESCMD_SHARD *shard = sescmd_shard(cmd->hash);
+        bool unused = false;
+
+        spinlock_acquire(&shard->lock);
+
+        if (--cmd->refcount == 0)
+        {
+            MXS_SESCMD **prev = sescmd_chain(shard, cmd->hash);
+
+            while (*prev != cmd)
+            {
+                prev = &(*prev)->next;
+            }
+
+            *prev = cmd->next;
+            unused = true;
+        }
+
+        spinlock_release(&shard->lock);
+
+        if (unused)
+        {
+            atomic_add(&n_commands, -1);
+            gwbuf_free(cmd->buffer);
+            MXS_FREE(cmd);
+        }
+    }
+}
+
+GWBUF* mxs_sescmd_buffer(const MXS_SESCMD *cmd)
+{
+    return cmd->buffer;
+}
+
+int mxs_sescmd_count()
+{
+    return atomic_load_int(&n_commands);
+}
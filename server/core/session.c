@@ -37,20 +37,72 @@
 
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
+#include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/poll.h>
+#include <maxscale/probe.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
 
 #include "maxscale/session.h"
 #include "maxscale/filter.h"
+#include "maxscale/poll.h"
 
 /* A session with null values, used for initialization */
 static MXS_SESSION session_initialized = SESSION_INIT;
 
+/** Maximum number of freed sessions a polling thread keeps for reuse */
+#define SESSION_CACHE_MAX 1024
+
+/**
+ * Freed sessions of a polling thread, only accessed by the owning thread
+ */
+typedef struct
+{
+    MXS_SESSION *sessions[SESSION_CACHE_MAX]; /*< The cached sessions */
+    int          count;                       /*< Number of cached sessions */
+} SESSION_CACHE;
+
+static thread_local SESSION_CACHE session_cache;
+
+#if defined(MXS_USDT)
+/**
+ * A component of the filter chain wrapped with the routeQuery probes
+ */
+typedef struct session_probe
+{
+    MXS_DOWNSTREAM down;   /*< The wrapped filter or router */
+    const char    *name;   /*< Name of the filter or the router module */
+    uint64_t       ses_id; /*< The session */
+} SESSION_PROBE;
+
+static int32_t session_probe_route_query(void *instance, void *session, GWBUF *buf);
+static void session_probe_wrap(MXS_SESSION *session, MXS_DOWNSTREAM *down, int index, const char *name);
+#endif
+
+/** Size of the chunks of the session arenas, including the header */
+#define SESSION_ARENA_CHUNK_SIZE 4096
+
+/** Alignment of the memory returned by session_alloc_mem() */
+#define SESSION_ARENA_ALIGN 16
+
+/** Usable size of the chunks that are not allocated for one large object */
+#define SESSION_ARENA_DATA_SIZE (SESSION_ARENA_CHUNK_SIZE - sizeof(SESSION_ARENA_CHUNK))
+
+/**
+ * A chunk of the memory of a session
+ */
+typedef struct session_arena_chunk
+{
+    struct session_arena_chunk *next; /*< The next, already filled, chunk */
+    size_t                      size; /*< Usable size of the chunk */
+    size_t                      used; /*< Bytes given out from the chunk */
+    char __attribute__((aligned(SESSION_ARENA_ALIGN))) data[]; /*< The memory */
+} SESSION_ARENA_CHUNK;
+
 /** Global session id; updated safely by use of atomic_add */
 static int session_id;
 
@@ -60,8 +112,9 @@ static void session_initialize(void *session);
 static int session_setup_filters(MXS_SESSION *session);
 static void session_simple_free(MXS_SESSION *session, DCB *dcb);
 static void session_add_to_all_list(MXS_SESSION *session);
-static MXS_SESSION *session_find_free();
 static void session_final_free(MXS_SESSION *session);
+static void session_arena_reset(MXS_SESSION_ARENA *arena);
+static void session_arena_free(MXS_SESSION_ARENA *arena);
 
 /**
  * @brief Initialize a session
@@ -96,13 +149,27 @@ session_initialize(void *session)
 MXS_SESSION *
 session_alloc(SERVICE *service, DCB *client_dcb)
 {
-    MXS_SESSION *session = (MXS_SESSION *)(MXS_MALLOC(sizeof(*session)));
+    MXS_SESSION *session;
+    SESSION_ARENA_CHUNK *spare = NULL;
+
+    if (session_cache.count > 0)
+    {
+        session = session_cache.sessions[--session_cache.count];
+        /** A cached session keeps its first chunk */
+        spare = session->arena.chunks;
+    }
+    else
+    {
+        session = (MXS_SESSION *)(MXS_MALLOC(sizeof(*session)));
+    }
 
     if (NULL == session)
     {
         return NULL;
     }
     session_initialize(session);
+    session->arena.chunks = spare;
+    session->arena.enabled = config_get_global_options()->session_arena;
 
     /** Assign a session id and increase */
     session->ses_id = (size_t)atomic_add(&session_id, 1) + 1;
@@ -113,6 +180,8 @@ session_alloc(SERVICE *service, DCB *client_dcb)
     session->stmt.buffer = NULL;
     session->stmt.target = NULL;
     session->qualifies_for_pooling = false;
+    session->reads_paused = false;
+    session->probes = NULL;
     /*<
      * Associate the session to the client DCB and set the reference count on
      * the session to indicate that there is a single reference to the
@@ -163,6 +232,11 @@ session_alloc(SERVICE *service, DCB *client_dcb)
 
         session->head.routeQuery = (void *)(service->router->routeQuery);
 
+#if defined(MXS_USDT)
+        session->probes = session_alloc_mem(session, (service->n_filters + 1) * sizeof(SESSION_PROBE));
+        session_probe_wrap(session, &session->head, service->n_filters, service->routerModule);
+#endif
+
         session->tail.instance = session;
         session->tail.session = session;
         session->tail.clientReply = session_reply;
@@ -181,6 +255,7 @@ session_alloc(SERVICE *service, DCB *client_dcb)
     if (SESSION_STATE_TO_BE_FREED != session->state)
     {
         session->state = SESSION_STATE_ROUTER_READY;
+        MXS_PROBE2(session_start, session->ses_id, service->name);
 
         if (session->client_dcb->user == NULL)
         {
@@ -211,6 +286,12 @@ session_alloc(SERVICE *service, DCB *client_dcb)
     CHK_SESSION(session);
 
     client_dcb->session = session;
+
+    if (SESSION_STATE_TO_BE_FREED != session->state)
+    {
+        dcb_enable_flow_control(client_dcb);
+    }
+
     return SESSION_STATE_TO_BE_FREED == session->state ? NULL : session;
 }
 
@@ -268,6 +349,35 @@ session_link_dcb(MXS_SESSION *session, DCB *dcb)
     return true;
 }
 
+void session_add_event_time(MXS_SESSION *session, bool client, uint64_t start, uint64_t end)
+{
+    SERVICE *service = session->service;
+    uint64_t elapsed = end > start ? end - start : 0;
+
+    if (client)
+    {
+        session->stats.query_time += elapsed;
+        ts_stats_add_lazy(&service->stats.query_time, elapsed, current_thread_id);
+
+        /** The servers now work on the query, an earlier query that got no
+         * reply is not waited for anymore */
+        session->stats.wait_start = end;
+    }
+    else
+    {
+        session->stats.reply_time += elapsed;
+        ts_stats_add_lazy(&service->stats.reply_time, elapsed, current_thread_id);
+
+        if (session->stats.wait_start)
+        {
+            uint64_t wait = start > session->stats.wait_start ? start - session->stats.wait_start : 0;
+            session->stats.wait_time += wait;
+            session->stats.wait_start = 0;
+            ts_stats_add_lazy(&service->stats.wait_time, wait, current_thread_id);
+        }
+    }
+}
+
 /**
  * Deallocate the specified session, minimal actions during session_alloc
  * Since changes to keep new session in existence until all related DCBs
@@ -352,6 +462,13 @@ static void session_free(MXS_SESSION *session)
         MXS_FREE(session->filters);
     }
 
+    if (session->probes)
+    {
+        session_free_mem(session, session->probes);
+        session->probes = NULL;
+    }
+
+    MXS_PROBE1(session_end, session->ses_id);
     MXS_INFO("Stopped %s client session [%lu]", session->service->name, session->ses_id);
 
     /** If session doesn't have parent referencing to it, it can be freed */
@@ -366,7 +483,124 @@ static void
 session_final_free(MXS_SESSION *session)
 {
     gwbuf_free(session->stmt.buffer);
-    MXS_FREE(session);
+
+    /** Polling threads keep the memory for sessions they allocate later */
+    if (current_thread_id != -1 && session_cache.count < SESSION_CACHE_MAX)
+    {
+        session_arena_reset(&session->arena);
+        session_cache.sessions[session_cache.count++] = session;
+    }
+    else
+    {
+        session_arena_free(&session->arena);
+        MXS_FREE(session);
+    }
+}
+
+void session_cache_thread_finish()
+{
+    while (session_cache.count > 0)
+    {
+        MXS_SESSION *session = session_cache.sessions[--session_cache.count];
+        session_arena_free(&session->arena);
+        MXS_FREE(session);
+    }
+}
+
+/**
+ * Free the chunks of an arena, keeping one chunk of the default size for reuse
+ *
+ * @param arena The arena of a freed session
+ */
+static void session_arena_reset(MXS_SESSION_ARENA *arena)
+{
+    SESSION_ARENA_CHUNK *spare = NULL;
+
+    while (arena->chunks)
+    {
+        SESSION_ARENA_CHUNK *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+
+        if (spare == NULL && chunk->size == SESSION_ARENA_DATA_SIZE)
+        {
+            spare = chunk;
+            spare->next = NULL;
+            spare->used = 0;
+        }
+        else
+        {
+            MXS_FREE(chunk);
+        }
+    }
+
+    arena->chunks = spare;
+}
+
+/**
+ * Free all chunks of an arena
+ *
+ * @param arena The arena of a freed session
+ */
+static void session_arena_free(MXS_SESSION_ARENA *arena)
+{
+    while (arena->chunks)
+    {
+        SESSION_ARENA_CHUNK *next = arena->chunks->next;
+        MXS_FREE(arena->chunks);
+        arena->chunks = next;
+    }
+}
+
+void *session_alloc_mem(MXS_SESSION *session, size_t size)
+{
+    MXS_SESSION_ARENA *arena = &session->arena;
+
+    if (!arena->enabled)
+    {
+        return MXS_CALLOC(1, size);
+    }
+
+    size = (size + SESSION_ARENA_ALIGN - 1) & ~((size_t)SESSION_ARENA_ALIGN - 1);
+    SESSION_ARENA_CHUNK *chunk = arena->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = size > SESSION_ARENA_DATA_SIZE ? size : SESSION_ARENA_DATA_SIZE;
+
+        if ((chunk = MXS_MALLOC(sizeof(SESSION_ARENA_CHUNK) + chunk_size)) == NULL)
+        {
+            return NULL;
+        }
+
+        chunk->size = chunk_size;
+        chunk->used = 0;
+
+        if (arena->chunks && chunk_size > SESSION_ARENA_DATA_SIZE)
+        {
+            /** Keep filling the current chunk, the large one is full already */
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        else
+        {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void session_free_mem(MXS_SESSION *session, void *ptr)
+{
+    /** Memory taken from the arena is freed with the session */
+    if (!session->arena.enabled)
+    {
+        MXS_FREE(ptr);
+    }
 }
 
 /**
@@ -486,6 +720,43 @@ dprintSession(DCB *dcb, MXS_SESSION *print_session)
 
     }
 
+    dcb_printf(dcb, "\tTime routing queries:    %.3f seconds\n",
+               print_session->stats.query_time / 1000000000.0);
+    dcb_printf(dcb, "\tTime routing replies:    %.3f seconds\n",
+               print_session->stats.reply_time / 1000000000.0);
+    dcb_printf(dcb, "\tTime waiting for servers: %.3f seconds\n",
+               print_session->stats.wait_time / 1000000000.0);
+
+    if (print_session->client_dcb)
+    {
+        DCB *client = print_session->client_dcb;
+        dcb_printf(dcb, "\tClient write queue:      %d bytes\n", client->writeqlen);
+
+        if (client->cold && client->cold->spill_end > client->cold->spill_start)
+        {
+            dcb_printf(dcb, "\tClient write queue on disk: %" PRId64 " bytes\n",
+                       (int64_t)(client->cold->spill_end - client->cold->spill_start));
+        }
+    }
+
+    dcb_printf(dcb, "\tServers paused:          %lu times%s\n",
+               print_session->stats.n_reads_paused,
+               print_session->reads_paused ? ", paused now" : "");
+
+    if (print_session->arena.enabled)
+    {
+        size_t used = 0;
+        size_t size = 0;
+
+        for (SESSION_ARENA_CHUNK *chunk = print_session->arena.chunks; chunk; chunk = chunk->next)
+        {
+            used += chunk->used;
+            size += chunk->size;
+        }
+
+        dcb_printf(dcb, "\tSession memory:          %lu of %lu bytes used\n", used, size);
+    }
+
     if (print_session->n_filters)
     {
         for (i = 0; i < print_session->n_filters; i++)
@@ -585,8 +856,6 @@ static int
 session_setup_filters(MXS_SESSION *session)
 {
     SERVICE *service = session->service;
-    MXS_DOWNSTREAM *head;
-    MXS_UPSTREAM *tail;
     int i;
 
     if ((session->filters = MXS_CALLOC(service->n_filters,
@@ -595,6 +864,9 @@ session_setup_filters(MXS_SESSION *session)
         return 0;
     }
     session->n_filters = service->n_filters;
+
+    /** The chain is built from the router towards the client, each filter
+     * becoming the new head of the session */
     for (i = service->n_filters - 1; i >= 0; i--)
     {
         if (service->filters[i] == NULL)
@@ -602,8 +874,7 @@ session_setup_filters(MXS_SESSION *session)
             MXS_ERROR("Service '%s' contians an unresolved filter.", service->name);
             return 0;
         }
-        if ((head = filter_apply(service->filters[i], session,
-                                 &session->head)) == NULL)
+        if (!filter_apply(service->filters[i], session, &session->head))
         {
             MXS_ERROR("Failed to create filter '%s' for "
                       "service '%s'.\n",
@@ -612,39 +883,70 @@ session_setup_filters(MXS_SESSION *session)
             return 0;
         }
         session->filters[i].filter = service->filters[i];
-        session->filters[i].session = head->session;
-        session->filters[i].instance = head->instance;
-        session->head = *head;
-        MXS_FREE(head);
+        session->filters[i].session = session->head.session;
+        session->filters[i].instance = session->head.instance;
+#if defined(MXS_USDT)
+        session_probe_wrap(session, &session->head, i, service->filters[i]->name);
+#endif
     }
 
     for (i = 0; i < service->n_filters; i++)
     {
-        if ((tail = filter_upstream(service->filters[i],
-                                    session->filters[i].session,
-                                    &session->tail)) == NULL)
+        /*
+         * filter_upstream leaves the tail as it is if the filter
+         * has no upstream entry point.
+         */
+        if (!filter_upstream(service->filters[i],
+                             session->filters[i].session,
+                             &session->tail))
         {
             MXS_ERROR("Failed to create filter '%s' for service '%s'.",
                       service->filters[i]->name,
                       service->name);
             return 0;
         }
-
-        /*
-         * filter_upstream may simply return the 3 parameter if
-         * the filter has no upstream entry point. So no need
-         * to copy the contents or free tail in this case.
-         */
-        if (tail != &session->tail)
-        {
-            session->tail = *tail;
-            MXS_FREE(tail);
-        }
     }
 
     return 1;
 }
 
+#if defined(MXS_USDT)
+/**
+ * Put a component of the filter chain behind the routeQuery probes
+ *
+ * The component before it in the chain, or the session itself if the
+ * component is the head of the chain, calls the wrapper instead.
+ *
+ * @param session The session
+ * @param down    The head of the chain, the component to wrap
+ * @param index   Index of the probe of the component
+ * @param name    Name of the component
+ */
+static void session_probe_wrap(MXS_SESSION *session, MXS_DOWNSTREAM *down, int index, const char *name)
+{
+    if (session->probes)
+    {
+        SESSION_PROBE *probe = &session->probes[index];
+        probe->down = *down;
+        probe->name = name;
+        probe->ses_id = session->ses_id;
+
+        down->instance = probe;
+        down->session = probe;
+        down->routeQuery = session_probe_route_query;
+    }
+}
+
+static int32_t session_probe_route_query(void *instance, void *session, GWBUF *buf)
+{
+    SESSION_PROBE *probe = (SESSION_PROBE*)instance;
+    MXS_PROBE3(route_query_entry, probe->ses_id, probe->name, buf ? GWBUF_LENGTH(buf) : 0);
+    int32_t rc = probe->down.routeQuery(probe->down.instance, probe->down.session, buf);
+    MXS_PROBE3(route_query_exit, probe->ses_id, probe->name, rc);
+    return rc;
+}
+#endif
+
 /**
  * Entry point for the final element in the upstream filter, i.e. the writing
  * of the data to the client.
@@ -716,45 +1018,66 @@ session_get_user(const MXS_SESSION *session)
 
 /**
  * Callback structure for the session list extraction
+ *
+ * The rows of all sessions are made in one pass over the DCBs when the first
+ * row is fetched. This way the DCB lists are iterated only once and are not
+ * locked while the rows are streamed to the client.
  */
 typedef struct
 {
-    int index;
-    int current;
     SESSIONLISTFILTER filter;
-    RESULT_ROW *row;
+    bool listed;       /*< Whether the rows have been made */
+    RESULT_ROW **rows; /*< The rows of the sessions */
+    int n_rows;        /*< The number of rows */
+    int size;          /*< The size of the rows array */
+    int next;          /*< The next row to return */
     RESULTSET *set;
 } SESSIONFILTER;
 
 bool dcb_iter_cb(DCB *dcb, void *data)
 {
     SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
+    MXS_SESSION *list_session = dcb->session;
 
-    if (cbdata->current < cbdata->index)
+    /** One row for each session, made from the client DCB of the session */
+    if (list_session == NULL || list_session->client_dcb != dcb ||
+        (cbdata->filter == SESSION_LIST_CONNECTION &&
+         list_session->state == SESSION_STATE_LISTENER))
     {
-        if (cbdata->filter == SESSION_LIST_ALL ||
-            (cbdata->filter == SESSION_LIST_CONNECTION &&
-             (dcb->session->state != SESSION_STATE_LISTENER)))
+        return true;
+    }
+
+    if (cbdata->n_rows == cbdata->size)
+    {
+        int size = cbdata->size ? cbdata->size * 2 : 1024;
+        RESULT_ROW **rows = MXS_REALLOC(cbdata->rows, size * sizeof(RESULT_ROW*));
+
+        if (rows == NULL)
         {
-            cbdata->current++;
+            return false;
         }
+
+        cbdata->rows = rows;
+        cbdata->size = size;
     }
-    else
+
+    RESULT_ROW *row = resultset_make_row(cbdata->set);
+
+    if (row == NULL)
     {
-        char buf[20];
-        MXS_SESSION *list_session = dcb->session;
-
-        cbdata->index++;
-        cbdata->row = resultset_make_row(cbdata->set);
-        snprintf(buf, sizeof(buf), "%p", list_session);
-        resultset_row_set(cbdata->row, 0, buf);
-        resultset_row_set(cbdata->row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
-                                           ? list_session->client_dcb->remote : ""));
-        resultset_row_set(cbdata->row, 2, (list_session->service && list_session->service->name
-                                           ? list_session->service->name : ""));
-        resultset_row_set(cbdata->row, 3, session_state(list_session->state));
         return false;
     }
+
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%p", list_session);
+    resultset_row_set(row, 0, buf);
+    resultset_row_set(row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
+                               ? list_session->client_dcb->remote : ""));
+    resultset_row_set(row, 2, (list_session->service && list_session->service->name
+                               ? list_session->service->name : ""));
+    resultset_row_set(row, 3, session_state(list_session->state));
+    cbdata->rows[cbdata->n_rows++] = row;
+
     return true;
 }
 
@@ -762,7 +1085,7 @@ bool dcb_iter_cb(DCB *dcb, void *data)
  * Provide a row to the result set that defines the set of sessions
  *
  * @param set   The result set
- * @param data  The index of the row to send
+ * @param data  The rows of the sessions
  * @return The next row or NULL
  */
 static RESULT_ROW *
@@ -771,13 +1094,24 @@ sessionRowCallback(RESULTSET *set, void *data)
     SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
     RESULT_ROW *row = NULL;
 
-    cbdata->current = 0;
-    dcb_foreach(dcb_iter_cb, cbdata);
+    if (!cbdata->listed)
+    {
+        dcb_foreach(dcb_iter_cb, cbdata);
+        cbdata->listed = true;
+    }
 
-    if (cbdata->row)
+    if (cbdata->next < cbdata->n_rows)
+    {
+        row = cbdata->rows[cbdata->next++];
+    }
+    else
     {
-        row = cbdata->row;
-        cbdata->row = NULL;
+        /** All rows have been returned, the caller frees them */
+        MXS_FREE(cbdata->rows);
+        cbdata->rows = NULL;
+        cbdata->n_rows = 0;
+        cbdata->size = 0;
+        cbdata->next = 0;
     }
 
     return row;
@@ -805,10 +1139,12 @@ sessionGetList(SESSIONLISTFILTER filter)
     {
         return NULL;
     }
-    data->index = 0;
     data->filter = filter;
-    data->current = 0;
-    data->row = NULL;
+    data->listed = false;
+    data->rows = NULL;
+    data->n_rows = 0;
+    data->size = 0;
+    data->next = 0;
 
     if ((set = resultset_create(sessionRowCallback, data)) == NULL)
     {
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file shardedhash.c A hashtable with independently locked shards
+ *
+ * The hash of a key selects both the shard and the chain within the shard.
+ * The low bits pick the shard so that keys are spread evenly between them
+ * and the remaining bits pick the chain.
+ */
+
+#include <maxscale/shardedhash.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+
+static void *identityfn(const void *data)
+{
+    return (void *)data;
+}
+
+static void nullfn(void *data)
+{
+}
+
+SHARDEDHASH *shardedhash_alloc(int nshards, int size, HASHHASHFN hashfn, HASHCMPFN cmpfn)
+{
+    ss_dassert(hashfn && cmpfn);
+
+    if (nshards <= 0)
+    {
+        nshards = SHARDEDHASH_DEFAULT_SHARDS;
+    }
+
+    int chains = size / nshards;
+
+    if (chains <= 0)
+    {
+        chains = 1;
+    }
+
+    SHARDEDHASH *table = (SHARDEDHASH *)MXS_CALLOC(1, sizeof(SHARDEDHASH));
+    SHARDEDHASH_SHARD *shards = (SHARDEDHASH_SHARD *)MXS_CALLOC(nshards, sizeof(SHARDEDHASH_SHARD));
+
+    if (table == NULL || shards == NULL)
+    {
+        MXS_FREE(table);
+        MXS_FREE(shards);
+        return NULL;
+    }
+
+    table->nshards = nshards;
+    table->size = chains;
+    table->shards = shards;
+    table->hashfn = hashfn;
+    table->cmpfn = cmpfn;
+    table->kcopyfn = identityfn;
+    table->vcopyfn = identityfn;
+    table->kfreefn = nullfn;
+    table->vfreefn = nullfn;
+
+    for (int i = 0; i < nshards; i++)
+    {
+        spinlock_init(&shards[i].lock);
+        shards[i].entries = (HASHENTRIES **)MXS_CALLOC(chains, sizeof(HASHENTRIES *));
+
+        if (shards[i].entries == NULL)
+        {
+            shardedhash_free(table);
+            return NULL;
+        }
+    }
+
+    return table;
+}
+
+SHARDEDHASH *shardedhash_alloc_str(int nshards, int size)
+{
+    SHARDEDHASH *table = shardedhash_alloc(nshards, size,
+                                           hashtable_item_strhash,
+                                           hashtable_item_strcmp);
+
+    if (table)
+    {
+        shardedhash_memory_fns(table, hashtable_item_strdup, NULL,
+                               hashtable_item_free, NULL);
+    }
+
+    return table;
+}
+
+void shardedhash_memory_fns(SHARDEDHASH *table,
+                            HASHCOPYFN kcopyfn,
+                            HASHCOPYFN vcopyfn,
+                            HASHFREEFN kfreefn,
+                            HASHFREEFN vfreefn)
+{
+    table->kcopyfn = kcopyfn ? kcopyfn : identityfn;
+    table->vcopyfn = vcopyfn ? vcopyfn : identityfn;
+    table->kfreefn = kfreefn ? kfreefn : nullfn;
+    table->vfreefn = vfreefn ? vfreefn : nullfn;
+}
+
+void shardedhash_free(SHARDEDHASH *table)
+{
+    if (table == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < table->nshards; i++)
+    {
+        SHARDEDHASH_SHARD *shard = &table->shards[i];
+
+        if (shard->entries)
+        {
+            for (int j = 0; j < table->size; j++)
+            {
+                HASHENTRIES *entry = shard->entries[j];
+
+                while (entry)
+                {
+                    HASHENTRIES *next = entry->next;
+                    table->kfreefn(entry->key);
+                    table->vfreefn(entry->value);
+                    MXS_FREE(entry);
+                    entry = next;
+                }
+            }
+
+            MXS_FREE(shard->entries);
+        }
+    }
+
+    MXS_FREE(table->shards);
+    MXS_FREE(table);
+}
+
+/**
+ * Find the shard and the chain of a key
+ *
+ * @param table  The table
+ * @param key    The key
+ * @param chain  On return, the chain of the key within the shard
+ *
+ * @return The shard of the key
+ */
+static SHARDEDHASH_SHARD *find_shard(SHARDEDHASH *table, const void *key, HASHENTRIES ***chain)
+{
+    unsigned int hash = (unsigned int)table->hashfn(key);
+    SHARDEDHASH_SHARD *shard = &table->shards[hash % table->nshards];
+
+    *chain = &shard->entries[(hash / table->nshards) % table->size];
+
+    return shard;
+}
+
+/**
+ * Find an entry from a chain. The lock of the shard must be held.
+ */
+static HASHENTRIES *find_entry(SHARDEDHASH *table, HASHENTRIES *entry, const void *key)
+{
+    while (entry && table->cmpfn(key, entry->key) != 0)
+    {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+/**
+ * Create a new entry at the head of a chain. The lock of the shard must be held.
+ *
+ * @return The new entry or NULL on memory allocation failure
+ */
+static HASHENTRIES *add_entry(SHARDEDHASH *table, SHARDEDHASH_SHARD *shard,
+                              HASHENTRIES **chain, void *key, void *value)
+{
+    HASHENTRIES *entry = (HASHENTRIES *)MXS_MALLOC(sizeof(HASHENTRIES));
+
+    if (entry)
+    {
+        entry->key = table->kcopyfn(key);
+        entry->value = entry->key ? table->vcopyfn(value) : NULL;
+
+        if (entry->value == NULL)
+        {
+            if (entry->key)
+            {
+                table->kfreefn(entry->key);
+            }
+
+            MXS_FREE(entry);
+            return NULL;
+        }
+
+        entry->next = *chain;
+        *chain = entry;
+        shard->n_elements++;
+    }
+
+    return entry;
+}
+
+int shardedhash_add(SHARDEDHASH *table, void *key, void *value)
+{
+    if (table == NULL || key == NULL || value == NULL)
+    {
+        return 0;
+    }
+
+    HASHENTRIES **chain;
+    SHARDEDHASH_SHARD *shard = find_shard(table, key, &chain);
+    int rval = 0;
+
+    spinlock_acquire(&shard->lock);
+
+    if (find_entry(table, *chain, key) == NULL &&
+        add_entry(table, shard, chain, key, value))
+    {
+        rval = 1;
+    }
+
+    spinlock_release(&shard->lock);
+
+    return rval;
+}
+
+void *shardedhash_fetch_or_add(SHARDEDHASH *table, void *key, void *value)
+{
+    if (table == NULL || key == NULL || value == NULL)
+    {
+        return NULL;
+    }
+
+    HASHENTRIES **chain;
+    SHARDEDHASH_SHARD *shard = find_shard(table, key, &chain);
+
+    spinlock_acquire(&shard->lock);
+
+    HASHENTRIES *entry = find_entry(table, *chain, key);
+
+    if (entry == NULL)
+    {
+        entry = add_entry(table, shard, chain, key, value);
+    }
+
+    void *rval = entry ? entry->value : NULL;
+
+    spinlock_release(&shard->lock);
+
+    return rval;
+}
+
+int shardedhash_delete(SHARDEDHASH *table, void *key)
+{
+    if (table == NULL || key == NULL)
+    {
+        return 0;
+    }
+
+    HASHENTRIES **chain;
+    SHARDEDHASH_SHARD *shard = find_shard(table, key, &chain);
+    HASHENTRIES *entry = NULL;
+
+    spinlock_acquire(&shard->lock);
+
+    for (HASHENTRIES **link = chain; *link; link = &(*link)->next)
+    {
+        if (table->cmpfn(key, (*link)->key) == 0)
+        {
+            entry = *link;
+            *link = entry->next;
+            shard->n_elements--;
+            break;
+        }
+    }
+
+    spinlock_release(&shard->lock);
+
+    if (entry)
+    {
+        table->kfreefn(entry->key);
+        table->vfreefn(entry->value);
+        MXS_FREE(entry);
+    }
+
+    return entry ? 1 : 0;
+}
+
+void *shardedhash_fetch(SHARDEDHASH *table, void *key)
+{
+    if (table == NULL || key == NULL)
+    {
+        return NULL;
+    }
+
+    HASHENTRIES **chain;
+    SHARDEDHASH_SHARD *shard = find_shard(table, key, &chain);
+
+    spinlock_acquire(&shard->lock);
+    HASHENTRIES *entry = find_entry(table, *chain, key);
+    void *rval = entry ? entry->value : NULL;
+    spinlock_release(&shard->lock);
+
+    return rval;
+}
+
+int shardedhash_size(SHARDEDHASH *table)
+{
+    int rval = 0;
+
+    for (int i = 0; i < table->nshards; i++)
+    {
+        spinlock_acquire(&table->shards[i].lock);
+        rval += table->shards[i].n_elements;
+        spinlock_release(&table->shards[i].lock);
+    }
+
+    return rval;
+}
@@ -29,6 +29,7 @@
 #include <sys/time.h>
 #include "maxscale/skygw_utils.h"
 #include <maxscale/atomic.h>
+#include <maxscale/clock.h>
 #include <maxscale/random_jkiss.h>
 #include <pcre2.h>
 
@@ -171,6 +172,31 @@ size_t get_timestamp_len_hp(void)
     return timestamp_len_hp;
 }
 
+/**
+ * Convert a time to local time
+ *
+ * localtime_r() takes a lock and may check the time zone, which is too
+ * expensive to do for every logged message. The conversion is therefore done
+ * only when the second changes and the previous result is kept per thread.
+ *
+ * @param t The time to convert
+ *
+ * @return The local time
+ */
+static const struct tm* timestamp_localtime(time_t t)
+{
+    static thread_local time_t cached_time = 0;
+    static thread_local struct tm cached_tm;
+
+    if (t != cached_time)
+    {
+        localtime_r(&t, &cached_tm);
+        cached_time = t;
+    }
+
+    return &cached_tm;
+}
+
 /**
  * @node Generate and write a timestamp to location passed as argument
  * by using at most tslen characters.
@@ -188,10 +214,8 @@ size_t get_timestamp_len_hp(void)
  */
 size_t snprint_timestamp(char* p_ts, size_t tslen)
 {
-    time_t t;
-    struct tm tm;
+    const struct tm* tm;
     size_t rval;
-    struct timeval tv;
     if (p_ts == NULL)
     {
         rval = 0;
@@ -200,11 +224,10 @@ size_t snprint_timestamp(char* p_ts, size_t tslen)
 
     /** Generate timestamp */
 
-    t = time(NULL);
-    localtime_r(&t, &tm);
+    tm = timestamp_localtime(mxs_clock_time());
     snprintf(p_ts, MXS_MIN(tslen, timestamp_len), timestamp_formatstr,
-             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
-             tm.tm_min, tm.tm_sec);
+             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
+             tm->tm_min, tm->tm_sec);
     rval = strlen(p_ts) * sizeof (char);
 retblock:
     return rval;
@@ -227,8 +250,7 @@ retblock:
  */
 size_t snprint_timestamp_hp(char* p_ts, size_t tslen)
 {
-    time_t t;
-    struct tm tm;
+    const struct tm* tm;
     size_t rval;
     struct timeval tv;
     int usec;
@@ -241,11 +263,11 @@ size_t snprint_timestamp_hp(char* p_ts, size_t tslen)
     /** Generate timestamp */
 
     gettimeofday(&tv, NULL);
-    localtime_r(&tv.tv_sec, &tm);
+    tm = timestamp_localtime(tv.tv_sec);
     usec = tv.tv_usec / 1000;
     snprintf(p_ts, MXS_MIN(tslen, timestamp_len_hp), timestamp_formatstr_hp,
-             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-             tm.tm_hour, tm.tm_min, tm.tm_sec, usec);
+             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+             tm->tm_hour, tm->tm_min, tm->tm_sec, usec);
     rval = strlen(p_ts) * sizeof (char);
 retblock:
     return rval;
@@ -11,71 +11,178 @@
  * Public License.
  */
 
-#include <maxscale/spinlock.h>
+#include "maxscale/spinlock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <maxscale/atomic.h>
-#include <time.h>
 #include <maxscale/debug.h>
 
+/** Number of times a waiting thread backs off before it goes to sleep */
+#define SPINLOCK_SPIN_ROUNDS 16
+
+/** The maximum number of pauses between two attempts to acquire a lock */
+#define SPINLOCK_MAX_BACKOFF 256
+
+/** The maximum number of named locks. The first entry is not used. */
+#define SPINLOCK_MAX_NAMED   512
+
+/** The lock values */
+#define SPINLOCK_FREE    0
+#define SPINLOCK_HELD    1
+#define SPINLOCK_SLEEPER 2
+
+/** The counters are padded to cache lines so that the counters of different
+ * locks can be updated at the same time without interfering */
+static struct
+{
+    SPINLOCK_COUNTERS counters;
+} __attribute__((aligned(64))) named_locks[SPINLOCK_MAX_NAMED];
+
+static int n_named_locks = 1;
+static SPINLOCK named_locks_lock = SPINLOCK_INIT;
 
 void spinlock_init(SPINLOCK *lock)
 {
-    lock->lock = 0;
-#if SPINLOCK_PROFILE
-    lock->spins = 0;
-    lock->maxspins = 0;
-    lock->acquired = 0;
-    lock->waiting = 0;
-    lock->max_waiting = 0;
-    lock->contended = 0;
-    lock->owner = 0;
+    lock->lock = SPINLOCK_FREE;
+    lock->stats = 0;
+}
+
+void spinlock_set_name(SPINLOCK *lock, const char *name)
+{
+    if (lock->stats == 0)
+    {
+        char truncated[SPINLOCK_NAME_LEN];
+        int index = 0;
+
+        snprintf(truncated, sizeof(truncated), "%s", name);
+        spinlock_acquire(&named_locks_lock);
+
+        for (int i = 1; i < n_named_locks && index == 0; i++)
+        {
+            if (strcmp(named_locks[i].counters.name, truncated) == 0)
+            {
+                index = i;
+            }
+        }
+
+        if (index == 0 && n_named_locks < SPINLOCK_MAX_NAMED)
+        {
+            index = n_named_locks++;
+            strcpy(named_locks[index].counters.name, truncated);
+        }
+
+        spinlock_release(&named_locks_lock);
+        lock->stats = index;
+    }
+}
+
+/**
+ * Let the other hardware thread of the core run while spinning
+ */
+static inline void spinlock_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
 #endif
 }
 
+/**
+ * Wait for a held lock, first spinning and then sleeping
+ *
+ * @param lock   The lock to acquire
+ * @param parked Set to the number of times the thread went to sleep
+ * @return The number of rounds spun
+ */
+static int spinlock_wait(SPINLOCK *lock, int *parked)
+{
+    int backoff = 1;
+    int spins = 0;
+    bool acquired = false;
+
+    while (!acquired && spins < SPINLOCK_SPIN_ROUNDS)
+    {
+        for (int i = 0; i < backoff; i++)
+        {
+            spinlock_pause();
+        }
+
+        spins++;
+
+        if (backoff < SPINLOCK_MAX_BACKOFF)
+        {
+            backoff *= 2;
+        }
+
+        /** A plain read does not take the cache line away from the holder */
+        acquired = *(volatile int*)&lock->lock == SPINLOCK_FREE &&
+                   __sync_bool_compare_and_swap(&lock->lock, SPINLOCK_FREE, SPINLOCK_HELD);
+    }
+
+    *parked = 0;
+
+    if (!acquired)
+    {
+        /** Mark the lock as having sleepers before sleeping. If the lock was
+         * released in the meantime, this acquires it. The mark stays even if
+         * there are no other sleepers, which only costs an extra wake-up. */
+        while (__sync_lock_test_and_set(&lock->lock, SPINLOCK_SLEEPER) != SPINLOCK_FREE)
+        {
+            syscall(SYS_futex, &lock->lock, FUTEX_WAIT_PRIVATE, SPINLOCK_SLEEPER, NULL, NULL, 0);
+            (*parked)++;
+        }
+    }
+
+    return spins;
+}
+
 void spinlock_acquire(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
-#if SPINLOCK_PROFILE
     int spins = 0;
+    int parked = 0;
 
-    atomic_add(&(lock->waiting), 1);
-#endif
-
-    while (__sync_lock_test_and_set(&(lock->lock), 1))
+    if (!__sync_bool_compare_and_swap(&lock->lock, SPINLOCK_FREE, SPINLOCK_HELD))
     {
-#if SPINLOCK_PROFILE
-        atomic_add(&(lock->spins), 1);
-        spins++;
-#endif
+        spins = spinlock_wait(lock, &parked);
     }
 
-#if SPINLOCK_PROFILE
-    if (spins)
+    if (lock->stats)
     {
-        lock->contended++;
-        if (lock->maxspins < spins)
+        /** The lock is held so the counters can be updated without atomics */
+        SPINLOCK_COUNTERS *counters = &named_locks[lock->stats].counters;
+        counters->acquired++;
+
+        if (spins)
         {
-            lock->maxspins = spins;
+            counters->contended++;
+            counters->spins += spins;
+            counters->parked += parked;
         }
     }
-    lock->acquired++;
-    lock->owner = thread_self();
-    atomic_add(&(lock->waiting), -1);
-#endif
 }
 
 bool
 spinlock_acquire_nowait(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
-    if (__sync_lock_test_and_set(&(lock->lock), 1))
+
+    if (!__sync_bool_compare_and_swap(&lock->lock, SPINLOCK_FREE, SPINLOCK_HELD))
     {
         return false;
     }
 
-#if SPINLOCK_PROFILE
-    lock->acquired++;
-    lock->owner = thread_self();
-#endif
+    if (lock->stats)
+    {
+        named_locks[lock->stats].counters.acquired++;
+    }
 
     return true;
 }
@@ -83,39 +190,45 @@ spinlock_acquire_nowait(const SPINLOCK *const_lock)
 void spinlock_release(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
-    ss_dassert(lock->lock != 0);
-#if SPINLOCK_PROFILE
-    if (lock->waiting > lock->max_waiting)
+    ss_dassert(lock->lock != SPINLOCK_FREE);
+
+    if (__atomic_exchange_n(&lock->lock, SPINLOCK_FREE, __ATOMIC_RELEASE) == SPINLOCK_SLEEPER)
     {
-        lock->max_waiting = lock->waiting;
+        syscall(SYS_futex, &lock->lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
     }
-#endif
-
-    __sync_lock_release(&lock->lock);
 }
 
 void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int), void *hdl)
 {
-#if SPINLOCK_PROFILE
-    reporter(hdl, "Spinlock acquired", lock->acquired);
-    if (lock->acquired)
+    if (lock->stats)
     {
-        reporter(hdl, "Total no. of spins", lock->spins);
-        if (lock->acquired)
-        {
-            reporter(hdl, "Average no. of spins (overall)", lock->spins / lock->acquired);
-        }
-        if (lock->contended)
+        const SPINLOCK_COUNTERS *counters = &named_locks[lock->stats].counters;
+
+        reporter(hdl, "Spinlock acquired", counters->acquired);
+        reporter(hdl, "Contended locks", counters->contended);
+
+        if (counters->acquired)
         {
-            reporter(hdl, "Average no. of spins (when contended)", lock->spins / lock->contended);
+            reporter(hdl, "Contention percentage", (counters->contended * 100) / counters->acquired);
         }
-        reporter(hdl, "Maximum no. of spins", lock->maxspins);
-        reporter(hdl, "Maximim no. of blocked threads", lock->max_waiting);
-        reporter(hdl, "Contended locks", lock->contended);
-        if (lock->acquired)
+
+        if (counters->contended)
         {
-            reporter(hdl, "Contention percentage", (lock->contended * 100) / lock->acquired);
+            reporter(hdl, "Average no. of spins (when contended)", counters->spins / counters->contended);
         }
+
+        reporter(hdl, "No. of times parked", counters->parked);
+    }
+}
+
+void spinlock_foreach_named(bool (*func)(const SPINLOCK_COUNTERS *counters, void *data), void *data)
+{
+    spinlock_acquire(&named_locks_lock);
+    int n = n_named_locks;
+    spinlock_release(&named_locks_lock);
+
+    for (int i = 1; i < n && func(&named_locks[i].counters, data); i++)
+    {
+        ;
     }
-#endif
 }
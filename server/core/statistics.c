@@ -26,6 +26,7 @@
 #include <maxscale/statistics.h>
 #include <string.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/debug.h>
 #include <maxscale/platform.h>
@@ -197,3 +198,215 @@ void ts_stats_set_min(ts_stats_t stats, int value, int thread_id)
         *item = value;
     }
 }
+
+void ts_stats_add(ts_stats_t stats, int64_t value, int thread_id)
+{
+    ss_dassert(thread_id < thread_count);
+    int64_t *item = (int64_t*)MXS_PTR(stats, thread_id * cache_linesize);
+    *item += value;
+}
+
+void ts_stats_add_lazy(ts_stats_t *stats, int64_t value, int thread_id)
+{
+    ts_stats_t current = *stats;
+
+    if (current == NULL)
+    {
+        ts_stats_t created = ts_stats_alloc();
+
+        if (created == NULL)
+        {
+            return;
+        }
+
+        if (atomic_cas_ptr(stats, NULL, created))
+        {
+            current = created;
+        }
+        else
+        {
+            /** Another thread added the first value at the same time */
+            ts_stats_free(created);
+            current = *stats;
+        }
+    }
+
+    ts_stats_add(current, value, thread_id);
+}
+
+/**
+ * The histograms have HIST_SUB linear buckets for each power of two, which
+ * keeps the relative error of a value below 1 / HIST_SUB. The values below
+ * 2 * HIST_SUB have buckets of their own. Values of 2^HIST_MAX_BITS or more
+ * are counted in the last bucket.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS) * HIST_SUB + HIST_SUB)
+
+/**
+ * The histogram of one thread. Only the thread itself writes to it.
+ */
+typedef struct ts_hist_slot
+{
+    int64_t max;                   /*< The largest value */
+    int64_t buckets[HIST_BUCKETS]; /*< Number of values in each bucket */
+} TS_HIST_SLOT;
+
+static size_t hist_slot_size()
+{
+    return (sizeof(TS_HIST_SLOT) + cache_linesize - 1) / cache_linesize * cache_linesize;
+}
+
+static inline TS_HIST_SLOT* hist_slot(ts_hist_t hist, int thread_id)
+{
+    return (TS_HIST_SLOT*)MXS_PTR(hist, thread_id * hist_slot_size());
+}
+
+static inline int hist_bucket(int64_t value)
+{
+    if (value < 2 * HIST_SUB)
+    {
+        return value < 0 ? 0 : value;
+    }
+    else if (value >= (int64_t)1 << HIST_MAX_BITS)
+    {
+        return HIST_BUCKETS - 1;
+    }
+
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return shift * HIST_SUB + (int)(value >> shift);
+}
+
+/**
+ * @brief The largest value that is counted in a bucket
+ */
+static int64_t hist_bucket_max(int bucket)
+{
+    if (bucket < 2 * HIST_SUB)
+    {
+        return bucket;
+    }
+
+    int shift = bucket / HIST_SUB - 1;
+    int64_t sub = bucket % HIST_SUB + HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+ts_hist_t ts_hist_alloc()
+{
+    ss_dassert(stats_initialized);
+    return MXS_CALLOC(thread_count, hist_slot_size());
+}
+
+void ts_hist_free(ts_hist_t hist)
+{
+    ss_dassert(stats_initialized);
+    MXS_FREE(hist);
+}
+
+void ts_hist_add(ts_hist_t hist, int64_t value, int thread_id)
+{
+    ss_dassert(thread_id < thread_count);
+    TS_HIST_SLOT *slot = hist_slot(hist, thread_id);
+
+    slot->buckets[hist_bucket(value)]++;
+
+    if (value > slot->max)
+    {
+        slot->max = value;
+    }
+}
+
+void ts_hist_add_lazy(ts_hist_t *hist, int64_t value, int thread_id)
+{
+    ts_hist_t current = *hist;
+
+    if (current == NULL)
+    {
+        ts_hist_t created = ts_hist_alloc();
+
+        if (created == NULL)
+        {
+            return;
+        }
+
+        if (atomic_cas_ptr(hist, NULL, created))
+        {
+            current = created;
+        }
+        else
+        {
+            /** Another thread added the first value at the same time */
+            ts_hist_free(created);
+            current = *hist;
+        }
+    }
+
+    ts_hist_add(current, value, thread_id);
+}
+
+int64_t ts_hist_count(ts_hist_t hist)
+{
+    ss_dassert(stats_initialized);
+    int64_t count = 0;
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        TS_HIST_SLOT *slot = hist_slot(hist, i);
+
+        for (int j = 0; j < HIST_BUCKETS; j++)
+        {
+            count += slot->buckets[j];
+        }
+    }
+
+    return count;
+}
+
+int64_t ts_hist_percentile(ts_hist_t hist, double percentile)
+{
+    ss_dassert(stats_initialized);
+    ss_dassert(percentile >= 0 && percentile <= 100);
+    int64_t counts[HIST_BUCKETS] = {0};
+    int64_t total = 0;
+    int64_t max = 0;
+
+    /** The threads keep on adding values while the counts are read, so they
+     * are read only once and the rank is searched from the copy */
+    for (int i = 0; i < thread_count; i++)
+    {
+        TS_HIST_SLOT *slot = hist_slot(hist, i);
+
+        for (int j = 0; j < HIST_BUCKETS; j++)
+        {
+            int64_t n = slot->buckets[j];
+            counts[j] += n;
+            total += n;
+        }
+
+        if (slot->max > max)
+        {
+            max = slot->max;
+        }
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    int64_t rank = (int64_t)(percentile / 100 * total + 0.5);
+    int64_t seen = 0;
+    int bucket = 0;
+
+    rank = MXS_MAX(rank, 1);
+
+    while (bucket < HIST_BUCKETS - 1 && (seen += counts[bucket]) < rank)
+    {
+        bucket++;
+    }
+
+    return MXS_MIN(hist_bucket_max(bucket), max);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file tablechange.c  The feed of modified tables
+ *
+ * The subscriptions are kept in a list that is protected by a spinlock. The
+ * lock is held while the subscribers are called, so that a subscriber that
+ * has unsubscribed is guaranteed not to be called anymore.
+ */
+
+#include <maxscale/tablechange.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/spinlock.h>
+
+typedef struct tablechange_subscriber
+{
+    TABLECHANGE_CB                 cb;   /*< The function to call */
+    void                          *data; /*< Data passed to the function */
+    struct tablechange_subscriber *next; /*< The next subscriber */
+} TABLECHANGE_SUBSCRIBER;
+
+static TABLECHANGE_SUBSCRIBER *subscribers = NULL;
+static SPINLOCK subscribers_lock = SPINLOCK_INIT;
+static int n_subscribers = 0;
+
+bool tablechange_subscribe(TABLECHANGE_CB cb, void* data)
+{
+    TABLECHANGE_SUBSCRIBER *subscriber = (TABLECHANGE_SUBSCRIBER*)MXS_MALLOC(sizeof(*subscriber));
+
+    if (subscriber)
+    {
+        subscriber->cb = cb;
+        subscriber->data = data;
+
+        spinlock_acquire(&subscribers_lock);
+        subscriber->next = subscribers;
+        subscribers = subscriber;
+        ++n_subscribers;
+        spinlock_release(&subscribers_lock);
+    }
+
+    return subscriber != NULL;
+}
+
+void tablechange_unsubscribe(TABLECHANGE_CB cb, void* data)
+{
+    spinlock_acquire(&subscribers_lock);
+
+    TABLECHANGE_SUBSCRIBER **link = &subscribers;
+
+    while (*link && ((*link)->cb != cb || (*link)->data != data))
+    {
+        link = &(*link)->next;
+    }
+
+    TABLECHANGE_SUBSCRIBER *subscriber = *link;
+
+    if (subscriber)
+    {
+        *link = subscriber->next;
+        --n_subscribers;
+    }
+
+    spinlock_release(&subscribers_lock);
+
+    MXS_FREE(subscriber);
+}
+
+bool tablechange_has_subscribers()
+{
+    return atomic_load_int(&n_subscribers) != 0;
+}
+
+void tablechange_publish(const char* const* tables, int n_tables)
+{
+    if (n_tables > 0 && tablechange_has_subscribers())
+    {
+        spinlock_acquire(&subscribers_lock);
+
+        for (TABLECHANGE_SUBSCRIBER *subscriber = subscribers; subscriber; subscriber = subscriber->next)
+        {
+            subscriber->cb(tables, n_tables, subscriber->data);
+        }
+
+        spinlock_release(&subscribers_lock);
+    }
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Micro-benchmarks of the core primitives
+ *
+ * Each benchmark runs an operation a number of times and reports the time
+ * of one operation in nanoseconds. The contended benchmarks run the operation
+ * in all threads at the same time on shared data and report the wall time of
+ * one operation of a thread, which grows with the contention. The fastest of
+ * the repetitions is reported.
+ *
+ * With -j the results are printed as JSON so that they can be compared
+ * across commits.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/buffer.h>
+#include <maxscale/config.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/paths.h>
+#include <maxscale/spinlock.h>
+#include "../maxscale/statistics.h"
+
+using namespace std;
+
+namespace
+{
+
+char USAGE[] =
+    "usage: core_benchmark [-n count] [-t threads] [-r repetitions] [-b benchmark] [-j]\n"
+    "\n"
+    "  -n  Number of operations of each thread, default 1000000\n"
+    "  -t  Number of threads of the contended benchmarks, default 4\n"
+    "  -r  Number of repetitions, default 3\n"
+    "  -b  Run only the named benchmark\n"
+    "  -j  Print the results as JSON\n";
+
+const char QUERY[] =
+    "SELECT id, name, email FROM test.users /* Find a user */ "
+    "WHERE id = 42 AND name = 'John Smith' AND email LIKE \"%@example.com\"";
+
+/** Number of entries in the hashtable besides the ones the threads add */
+const int HASHTABLE_ENTRIES = 1000;
+
+/** Number of rows in the result set of modutil_count_signal_packets */
+const int RESULTSET_ROWS = 10;
+
+/** Data shared by the threads of a benchmark */
+GWBUF* pBuffer;
+GWBUF* pQuery;
+GWBUF* pResultset;
+HASHTABLE* pHashtable;
+SPINLOCK lock = SPINLOCK_INIT;
+uint64_t nCounter;
+ts_stats_t stats;
+
+int int_hash(const void* key)
+{
+    return (int)(intptr_t)key;
+}
+
+int int_cmp(const void* key1, const void* key2)
+{
+    return (intptr_t)key1 != (intptr_t)key2;
+}
+
+GWBUF* create_resultset()
+{
+    // A result set of one column, its definition, the rows and the EOFs
+    const uint8_t column_count[] = {0x01, 0x00, 0x00, 0x01, 0x01};
+    const uint8_t column_def[] =
+    {
+        0x18, 0x00, 0x00, 0x02,
+        0x03, 'd', 'e', 'f', 0x00, 0x00, 0x00, 0x02, 'i', 'd', 0x00,
+        0x0c, 0x3f, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00
+    };
+    uint8_t eof[] = {0x05, 0x00, 0x00, 0x03, 0xfe, 0x00, 0x00, 0x02, 0x00};
+    uint8_t row[] = {0x02, 0x00, 0x00, 0x04, 0x01, '1'};
+
+    GWBUF* pRval = gwbuf_alloc_and_load(sizeof(column_count), column_count);
+    pRval = gwbuf_append(pRval, gwbuf_alloc_and_load(sizeof(column_def), column_def));
+    pRval = gwbuf_append(pRval, gwbuf_alloc_and_load(sizeof(eof), eof));
+
+    for (int i = 0; i < RESULTSET_ROWS; i++)
+    {
+        row[3] = 4 + i;
+        pRval = gwbuf_append(pRval, gwbuf_alloc_and_load(sizeof(row), row));
+    }
+
+    eof[3] = 4 + RESULTSET_ROWS;
+    pRval = gwbuf_append(pRval, gwbuf_alloc_and_load(sizeof(eof), eof));
+
+    // modutil_count_signal_packets expects a contiguous buffer
+    return gwbuf_make_contiguous(pRval);
+}
+
+void setup()
+{
+    pBuffer = gwbuf_alloc(1024);
+    pQuery = modutil_create_query(QUERY);
+    pResultset = create_resultset();
+    pHashtable = hashtable_alloc(HASHTABLE_ENTRIES, int_hash, int_cmp);
+    stats = ts_stats_alloc();
+
+    for (intptr_t i = 1; i <= HASHTABLE_ENTRIES; i++)
+    {
+        hashtable_add(pHashtable, (void*)i, (void*)i);
+    }
+}
+
+void teardown()
+{
+    gwbuf_free(pBuffer);
+    gwbuf_free(pQuery);
+    gwbuf_free(pResultset);
+    hashtable_free(pHashtable);
+    ts_stats_free(stats);
+}
+
+void bench_gwbuf_alloc_free(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        gwbuf_free(gwbuf_alloc(256));
+    }
+}
+
+void bench_gwbuf_clone(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        gwbuf_free(gwbuf_clone(pBuffer));
+    }
+}
+
+void bench_gwbuf_append(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        gwbuf_free(gwbuf_append(gwbuf_alloc(64), gwbuf_alloc(64)));
+    }
+}
+
+void bench_hashtable_add_fetch(int nThread, int nCount)
+{
+    // The keys of the thread are not among the prefilled ones
+    intptr_t key = HASHTABLE_ENTRIES + 1 + nThread;
+
+    for (int i = 0; i < nCount; i++)
+    {
+        hashtable_add(pHashtable, (void*)key, (void*)key);
+        hashtable_fetch(pHashtable, (void*)(intptr_t)(i % HASHTABLE_ENTRIES + 1));
+        hashtable_fetch(pHashtable, (void*)key);
+        hashtable_delete(pHashtable, (void*)key);
+    }
+}
+
+void bench_spinlock(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        spinlock_acquire(&lock);
+        nCounter++;
+        spinlock_release(&lock);
+    }
+}
+
+void bench_modutil_get_canonical(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        MXS_FREE(modutil_get_canonical(pQuery));
+    }
+}
+
+void bench_modutil_count_signal_packets(int nThread, int nCount)
+{
+    int more;
+
+    for (int i = 0; i < nCount; i++)
+    {
+        modutil_count_signal_packets(pResultset, 0, 0, &more);
+    }
+}
+
+void bench_ts_stats_increment(int nThread, int nCount)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        ts_stats_increment(stats, nThread);
+    }
+}
+
+struct Benchmark
+{
+    const char* zName;
+    bool        contended;  /**< Whether all threads run the benchmark */
+    void      (*run)(int nThread, int nCount);
+};
+
+const Benchmark BENCHMARKS[] =
+{
+    { "gwbuf_alloc_free",             false, bench_gwbuf_alloc_free },
+    { "gwbuf_clone",                  false, bench_gwbuf_clone },
+    { "gwbuf_append",                 false, bench_gwbuf_append },
+    { "hashtable_add_fetch",          true,  bench_hashtable_add_fetch },
+    { "spinlock",                     true,  bench_spinlock },
+    { "modutil_get_canonical",        false, bench_modutil_get_canonical },
+    { "modutil_count_signal_packets", false, bench_modutil_count_signal_packets },
+    { "ts_stats_increment",           true,  bench_ts_stats_increment },
+};
+
+const int N_BENCHMARKS = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+struct Thread
+{
+    const Benchmark* pBenchmark;
+    int              nThread;
+    int              nCount;
+    int*             pStart;
+    pthread_t        thread;
+};
+
+void* thread_main(void* pData)
+{
+    Thread* pThread = static_cast<Thread*>(pData);
+
+    while (!atomic_load_int(pThread->pStart))
+    {
+    }
+
+    pThread->pBenchmark->run(pThread->nThread, pThread->nCount);
+    return NULL;
+}
+
+uint64_t clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Run a benchmark once
+ *
+ * @return The time of one operation of a thread in nanoseconds
+ */
+double run_once(const Benchmark& benchmark, int nThreads, int nCount)
+{
+    vector<Thread> threads(nThreads);
+    int start = 0;
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threads[i].pBenchmark = &benchmark;
+        threads[i].nThread = i;
+        threads[i].nCount = nCount;
+        threads[i].pStart = &start;
+
+        if (pthread_create(&threads[i].thread, NULL, thread_main, &threads[i]) != 0)
+        {
+            cerr << "error: Could not start a thread." << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t begin = clock_ns();
+    atomic_add(&start, 1);
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    return (double)(clock_ns() - begin) / nCount;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    int nCount = 1000000;
+    int nThreads = 4;
+    int nRepetitions = 3;
+    const char* zBenchmark = NULL;
+    bool json = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:t:r:b:j")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            nCount = atoi(optarg);
+            break;
+
+        case 't':
+            nThreads = atoi(optarg);
+            break;
+
+        case 'r':
+            nRepetitions = atoi(optarg);
+            break;
+
+        case 'b':
+            zBenchmark = optarg;
+            break;
+
+        case 'j':
+            json = true;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    if ((rc == EXIT_SUCCESS) && (nCount > 0) && (nThreads > 0) && (nRepetitions > 0))
+    {
+        rc = EXIT_FAILURE;
+
+        set_datadir(strdup("/tmp"));
+        set_langdir(strdup("."));
+        set_process_datadir(strdup("/tmp"));
+
+        if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+        {
+            config_get_global_options()->n_threads = nThreads;
+            ts_stats_init();
+            setup();
+
+            if (json)
+            {
+                cout << "{\"count\": " << nCount << ", \"threads\": " << nThreads
+                     << ", \"benchmarks\": [";
+            }
+            else
+            {
+                cout << setw(32) << left << "Benchmark" << setw(10) << right << "Threads"
+                     << setw(12) << "ns/op" << endl;
+            }
+
+            bool first = true;
+
+            for (int i = 0; i < N_BENCHMARKS; i++)
+            {
+                const Benchmark& benchmark = BENCHMARKS[i];
+
+                if (zBenchmark && strcmp(zBenchmark, benchmark.zName) != 0)
+                {
+                    continue;
+                }
+
+                int n = benchmark.contended ? nThreads : 1;
+                double best = 0;
+
+                for (int j = 0; j < nRepetitions; j++)
+                {
+                    double ns = run_once(benchmark, n, nCount);
+
+                    if (j == 0 || ns < best)
+                    {
+                        best = ns;
+                    }
+                }
+
+                if (json)
+                {
+                    cout << (first ? "" : ",") << "\n  {\"name\": \"" << benchmark.zName
+                         << "\", \"threads\": " << n << ", \"ns_per_op\": "
+                         << fixed << setprecision(2) << best << "}";
+                }
+                else
+                {
+                    cout << setw(32) << left << benchmark.zName << setw(10) << right << n
+                         << setw(12) << fixed << setprecision(2) << best << endl;
+                }
+
+                first = false;
+            }
+
+            if (json)
+            {
+                cout << "\n]}" << endl;
+            }
+
+            teardown();
+            ts_stats_end();
+            mxs_log_finish();
+            rc = first ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        else
+        {
+            cerr << "error: Could not initialize log." << endl;
+        }
+    }
+    else
+    {
+        cout << USAGE << endl;
+    }
+
+    return rc;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <maxscale/filter.hh>
+#include <maxscale/session.h>
+#include "../maxscale/filter.h"
+
+using namespace std;
+
+namespace
+{
+
+char USAGE[] = "usage: filterchain_profile -n count -f filters\n";
+
+/**
+ * A filter session that passes everything on, like that of the nullfilter
+ */
+class PassSession : public maxscale::FilterSession
+{
+public:
+    PassSession(MXS_SESSION* pSession)
+        : maxscale::FilterSession(pSession)
+    {
+    }
+};
+
+class PassFilter : public maxscale::Filter<PassFilter, PassSession>
+{
+public:
+    static PassFilter* create(const char* zName, char** pzOptions, MXS_CONFIG_PARAMETER* pParams)
+    {
+        return new PassFilter;
+    }
+
+    PassSession* newSession(MXS_SESSION* pSession)
+    {
+        return new PassSession(pSession);
+    }
+
+    void diagnostics(DCB* pDcb)
+    {
+    }
+
+    uint64_t getCapabilities()
+    {
+        return 0;
+    }
+};
+
+int n_routed = 0;
+
+/** Stands for the router, not inlined so that the loops are not optimized away */
+__attribute__((noinline)) int32_t router_route_query(void* pInstance, void* pSession, GWBUF* pPacket)
+{
+    ++n_routed;
+    return 1;
+}
+
+uint64_t clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Route packets through a chain of pass-through filters
+ *
+ * @param nFilters Number of filters in the chain
+ * @param nCount   Number of packets to route
+ *
+ * @return How long routing the packets took in nanoseconds
+ */
+uint64_t profile(int nFilters, int nCount)
+{
+    MXS_FILTER_OBJECT* pObject = &PassFilter::s_object;
+    MXS_FILTER* pInstance = PassFilter::createInstance("pass", NULL, NULL);
+    vector<MXS_FILTER_DEF> defs(nFilters);
+    vector<MXS_FILTER_SESSION*> sessions;
+    MXS_SESSION session = {};
+
+    session.head.routeQuery = router_route_query;
+
+    for (int i = nFilters - 1; i >= 0; --i)
+    {
+        defs[i].name = const_cast<char*>("pass");
+        defs[i].filter = pInstance;
+        defs[i].obj = pObject;
+
+        filter_apply(&defs[i], &session, &session.head);
+        sessions.push_back(static_cast<MXS_FILTER_SESSION*>(session.head.session));
+    }
+
+    uint64_t start = clock_ns();
+
+    for (int i = 0; i < nCount; ++i)
+    {
+        MXS_SESSION_ROUTE_QUERY(&session, NULL);
+    }
+
+    uint64_t duration = clock_ns() - start;
+
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        pObject->closeSession(pInstance, sessions[i]);
+        pObject->freeSession(pInstance, sessions[i]);
+    }
+
+    pObject->destroyInstance(pInstance);
+
+    return duration;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    int nCount = 0;
+    int nFilters = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:f:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            nCount = atoi(optarg);
+            break;
+
+        case 'f':
+            nFilters = atoi(optarg);
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    if ((rc == EXIT_SUCCESS) && (nCount > 0) && (nFilters > 0))
+    {
+        uint64_t base = profile(0, nCount);
+        uint64_t chain = profile(nFilters, nCount);
+        double perHop = chain > base ? (double)(chain - base) / nCount / nFilters : 0;
+
+        cout << "Without filters: " << (double)base / nCount << "ns per packet" << endl;
+        cout << "With " << nFilters << " filters: " << (double)chain / nCount << "ns per packet" << endl;
+        cout << "Per filter: " << fixed << setprecision(2) << perHop << "ns" << endl;
+    }
+    else
+    {
+        cout << USAGE << endl;
+    }
+
+    return rc;
+}
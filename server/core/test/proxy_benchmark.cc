@@ -0,0 +1,1388 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * An end-to-end benchmark of the routing path of MaxScale
+ *
+ * The benchmark starts mock MariaDB servers inside its own process. The
+ * servers accept any credentials, present themselves as one master and its
+ * slaves to the monitor and reply to all other queries with a canned result
+ * set. MaxScale is then started from the given executable with a generated
+ * configuration for each scenario, and a number of client connections send
+ * queries through it as fast as they can. For each scenario the number of
+ * queries per second, the median and the 99th percentile latency and the CPU
+ * time MaxScale used per query are reported.
+ *
+ * The modules are loaded from the given directory, so MaxScale must be
+ * installed before it can be benchmarked.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <maxscale/atomic.h>
+
+using namespace std;
+
+namespace
+{
+
+const char USAGE[] =
+    "usage: proxy_benchmark -m maxscale -l libdir [-c clients] [-d seconds] [-w seconds]\n"
+    "                       [-t threads] [-r rows] [-n slaves] [-q query] [-s scenario] [-b] [-k]\n"
+    "\n"
+    "  -m  The MaxScale executable\n"
+    "  -l  The directory of the MaxScale modules\n"
+    "  -c  Number of client connections, default 16\n"
+    "  -d  Duration of the measurement of each scenario in seconds, default 10\n"
+    "  -w  Duration of the warmup before each measurement in seconds, default 2\n"
+    "  -t  Number of MaxScale worker threads, default 4\n"
+    "  -r  Number of rows in the result of each query, default 1\n"
+    "  -n  Number of slaves, default 2\n"
+    "  -q  The query the clients send\n"
+    "  -s  Run only the named scenario\n"
+    "  -b  Also measure the clients connecting directly to the master\n"
+    "  -k  Keep the configurations and logs of MaxScale\n";
+
+const char BENCH_USER[] = "bench";
+const char SERVICE_USER[] = "maxuser";
+const char SERVICE_PASSWORD[] = "maxpwd";
+const char SERVER_VERSION[] = "10.1.99-MariaDB-benchmark";
+const char DEFAULT_QUERY[] = "SELECT id, value FROM test.bench WHERE id = 1";
+
+/** Capabilities of the mock servers and the clients */
+const uint32_t CLIENT_LONG_PASSWORD = 1;
+const uint32_t CLIENT_LONG_FLAG = 4;
+const uint32_t CLIENT_CONNECT_WITH_DB = 8;
+const uint32_t CLIENT_PROTOCOL_41 = 512;
+const uint32_t CLIENT_TRANSACTIONS = 8192;
+const uint32_t CLIENT_SECURE_CONNECTION = 32768;
+const uint32_t CLIENT_MULTI_STATEMENTS = 65536;
+const uint32_t CLIENT_MULTI_RESULTS = 131072;
+const uint32_t CLIENT_PLUGIN_AUTH = 524288;
+const uint32_t CAPABILITIES = CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB |
+                              CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION |
+                              CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS | CLIENT_PLUGIN_AUTH;
+
+const uint8_t COM_QUIT = 0x01;
+const uint8_t COM_QUERY = 0x03;
+
+/** Number of columns in the result of SHOW ALL SLAVES STATUS */
+const int SLAVE_STATUS_COLUMNS = 42;
+
+/** How long MaxScale has to start accepting queries */
+const int STARTUP_TIMEOUT = 30;
+
+/**
+ * A routing configuration to benchmark
+ */
+struct Scenario
+{
+    const char* zName;    /**< Name of the scenario */
+    const char* zService; /**< Parameters of the service besides servers and credentials */
+    const char* zFilters; /**< Definitions of the filters the service uses */
+};
+
+const Scenario SCENARIOS[] =
+{
+    {
+        "readconnroute",
+        "router=readconnroute\n"
+        "router_options=slave\n",
+        ""
+    },
+    {
+        "readwritesplit",
+        "router=readwritesplit\n",
+        ""
+    },
+    {
+        "readwritesplit+filters",
+        "router=readwritesplit\n"
+        "filters=Hint|Regex|NamedServer\n",
+        "[Hint]\n"
+        "type=filter\n"
+        "module=hintfilter\n"
+        "\n"
+        "[Regex]\n"
+        "type=filter\n"
+        "module=regexfilter\n"
+        "match=no_such_table\n"
+        "replace=other_table\n"
+        "\n"
+        "[NamedServer]\n"
+        "type=filter\n"
+        "module=namedserverfilter\n"
+        "match=no_such_table\n"
+        "server=server1\n"
+        "\n"
+    }
+};
+
+const int N_SCENARIOS = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+uint64_t clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool write_fully(int fd, const void* pData, size_t nData)
+{
+    const uint8_t* pPtr = static_cast<const uint8_t*>(pData);
+
+    while (nData > 0)
+    {
+        ssize_t n = write(fd, pPtr, nData);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            return false;
+        }
+
+        pPtr += n;
+        nData -= n;
+    }
+
+    return true;
+}
+
+void set_nodelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * Reads MySQL protocol packets from a socket through a buffer
+ */
+class PacketReader
+{
+public:
+    PacketReader(int fd)
+        : m_fd(fd)
+        , m_start(0)
+        , m_end(0)
+    {
+    }
+
+    /**
+     * Read the next packet
+     *
+     * @param payload The payload of the packet
+     * @param pSeqno  The sequence number of the packet, if not NULL
+     *
+     * @return True if a packet was read
+     */
+    bool read(vector<uint8_t>& payload, uint8_t* pSeqno = NULL)
+    {
+        if (!fill(4))
+        {
+            return false;
+        }
+
+        const uint8_t* pHeader = m_buffer + m_start;
+        size_t len = pHeader[0] | (pHeader[1] << 8) | (pHeader[2] << 16);
+
+        if (pSeqno)
+        {
+            *pSeqno = pHeader[3];
+        }
+
+        m_start += 4;
+        payload.clear();
+
+        while (payload.size() < len)
+        {
+            if (!fill(1))
+            {
+                return false;
+            }
+
+            size_t n = min(len - payload.size(), m_end - m_start);
+            payload.insert(payload.end(), m_buffer + m_start, m_buffer + m_start + n);
+            m_start += n;
+        }
+
+        return true;
+    }
+
+private:
+    bool fill(size_t nNeeded)
+    {
+        if (m_end - m_start >= nNeeded)
+        {
+            return true;
+        }
+
+        memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+        m_end -= m_start;
+        m_start = 0;
+
+        while (m_end < nNeeded)
+        {
+            ssize_t n = ::read(m_fd, m_buffer + m_end, sizeof(m_buffer) - m_end);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n <= 0)
+            {
+                return false;
+            }
+
+            m_end += n;
+        }
+
+        return true;
+    }
+
+    int     m_fd;
+    size_t  m_start;
+    size_t  m_end;
+    uint8_t m_buffer[65536];
+};
+
+/**
+ * Builds MySQL protocol packets
+ */
+class PacketWriter
+{
+public:
+    PacketWriter()
+        : m_header(0)
+    {
+    }
+
+    /** Start a new packet */
+    void start(uint8_t seqno)
+    {
+        m_header = m_data.size();
+        uint8_t header[4] = {0, 0, 0, seqno};
+        m_data.insert(m_data.end(), header, header + 4);
+    }
+
+    /** Complete the current packet by storing its length */
+    void end()
+    {
+        size_t len = m_data.size() - m_header - 4;
+        m_data[m_header] = len;
+        m_data[m_header + 1] = len >> 8;
+        m_data[m_header + 2] = len >> 16;
+    }
+
+    void add_byte(uint8_t value)
+    {
+        m_data.push_back(value);
+    }
+
+    void add_int(uint64_t value, int nBytes)
+    {
+        for (int i = 0; i < nBytes; i++)
+        {
+            m_data.push_back(value >> (8 * i));
+        }
+    }
+
+    void add_lenenc_int(uint64_t value)
+    {
+        if (value < 251)
+        {
+            add_byte(value);
+        }
+        else if (value < 0x10000)
+        {
+            add_byte(0xfc);
+            add_int(value, 2);
+        }
+        else if (value < 0x1000000)
+        {
+            add_byte(0xfd);
+            add_int(value, 3);
+        }
+        else
+        {
+            add_byte(0xfe);
+            add_int(value, 8);
+        }
+    }
+
+    void add_bytes(const void* pData, size_t nData)
+    {
+        const uint8_t* pPtr = static_cast<const uint8_t*>(pData);
+        m_data.insert(m_data.end(), pPtr, pPtr + nData);
+    }
+
+    /** Add a string with its terminating null byte */
+    void add_nulstr(const char* zValue)
+    {
+        add_bytes(zValue, strlen(zValue) + 1);
+    }
+
+    void add_lenenc_str(const string& value)
+    {
+        add_lenenc_int(value.length());
+        add_bytes(value.data(), value.length());
+    }
+
+    const vector<uint8_t>& data() const
+    {
+        return m_data;
+    }
+
+private:
+    vector<uint8_t> m_data;
+    size_t          m_header;
+};
+
+/** A value of a row, NULL is represented by NULL_VALUE */
+const char NULL_VALUE[] = "\xfb";
+
+typedef vector<string> Row;
+
+/**
+ * Build an OK packet
+ */
+vector<uint8_t> ok_packet(uint8_t seqno)
+{
+    PacketWriter writer;
+    writer.start(seqno);
+    writer.add_byte(0x00);
+    writer.add_lenenc_int(0);   // Affected rows
+    writer.add_lenenc_int(0);   // Last insert id
+    writer.add_int(0x0002, 2);  // Autocommit
+    writer.add_int(0, 2);       // Warnings
+    writer.end();
+    return writer.data();
+}
+
+/**
+ * Build a complete result set
+ *
+ * @param columns The names of the columns
+ * @param rows    The rows
+ *
+ * @return The packets of the result set
+ */
+vector<uint8_t> result_set(const vector<string>& columns, const vector<Row>& rows)
+{
+    PacketWriter writer;
+    uint8_t seqno = 1;
+
+    writer.start(seqno++);
+    writer.add_lenenc_int(columns.size());
+    writer.end();
+
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        writer.start(seqno++);
+        writer.add_lenenc_str("def");
+        writer.add_lenenc_str("test");
+        writer.add_lenenc_str("bench");
+        writer.add_lenenc_str("bench");
+        writer.add_lenenc_str(columns[i]);
+        writer.add_lenenc_str(columns[i]);
+        writer.add_byte(0x0c);
+        writer.add_int(0x21, 2);    // utf8_general_ci
+        writer.add_int(255, 4);     // Column length
+        writer.add_byte(0xfd);      // VAR_STRING
+        writer.add_int(0, 2);       // Flags
+        writer.add_byte(0);         // Decimals
+        writer.add_int(0, 2);
+        writer.end();
+    }
+
+    uint8_t eof[] = {0xfe, 0x00, 0x00, 0x02, 0x00};
+    writer.start(seqno++);
+    writer.add_bytes(eof, sizeof(eof));
+    writer.end();
+
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        writer.start(seqno++);
+
+        for (size_t j = 0; j < rows[i].size(); j++)
+        {
+            if (rows[i][j] == NULL_VALUE)
+            {
+                writer.add_byte(0xfb);
+            }
+            else
+            {
+                writer.add_lenenc_str(rows[i][j]);
+            }
+        }
+
+        writer.end();
+    }
+
+    writer.start(seqno++);
+    writer.add_bytes(eof, sizeof(eof));
+    writer.end();
+
+    return writer.data();
+}
+
+/**
+ * A mock MariaDB server
+ *
+ * The server accepts any credentials. To the queries of the monitor it
+ * replies as a master or as a slave of the given master, to the queries of
+ * the authenticator with the benchmark user and to all other queries with a
+ * canned result set.
+ */
+class MockServer
+{
+public:
+    /**
+     * @param nServerId The server id
+     * @param nMasterId The server id of the master, 0 if this is the master
+     * @param nRows     The number of rows in the canned result set
+     */
+    MockServer(int nServerId, int nMasterId, int nRows)
+        : m_fd(-1)
+        , m_port(0)
+        , m_ok(ok_packet(1))
+    {
+        vector<string> columns;
+        vector<Row> rows;
+
+        columns.push_back("id");
+        columns.push_back("value");
+
+        for (int i = 0; i < nRows; i++)
+        {
+            Row row;
+            stringstream id;
+            id << i + 1;
+            row.push_back(id.str());
+            row.push_back("The quick brown fox jumps over the lazy dog");
+            rows.push_back(row);
+        }
+
+        m_result = result_set(columns, rows);
+
+        // The users, see the query of MySQLAuth
+        columns.clear();
+        rows.clear();
+        columns.push_back("user");
+        columns.push_back("host");
+        columns.push_back("db");
+        columns.push_back("select_priv");
+        columns.push_back("password");
+        Row user;
+        user.push_back(BENCH_USER);
+        user.push_back("%");
+        user.push_back(NULL_VALUE);
+        user.push_back("Y");
+        user.push_back("");
+        rows.push_back(user);
+        m_users = result_set(columns, rows);
+
+        columns.clear();
+        rows.clear();
+        columns.push_back("Database");
+        rows.push_back(Row(1, "test"));
+        m_databases = result_set(columns, rows);
+
+        columns.clear();
+        rows.clear();
+        stringstream id;
+        id << nServerId;
+        columns.push_back("@@server_id");
+        columns.push_back("@@read_only");
+        Row server_id;
+        server_id.push_back(id.str());
+        server_id.push_back(nMasterId ? "1" : "0");
+        rows.push_back(server_id);
+        m_server_id = result_set(columns, rows);
+
+        columns.clear();
+        rows.clear();
+
+        for (int i = 0; i < SLAVE_STATUS_COLUMNS; i++)
+        {
+            stringstream name;
+            name << "Column_" << i;
+            columns.push_back(name.str());
+        }
+
+        if (nMasterId)
+        {
+            stringstream master_id;
+            master_id << nMasterId;
+            Row status(SLAVE_STATUS_COLUMNS, "");
+            status[7] = "mysql-bin.000001";  // Master_Log_File
+            status[8] = "4";                 // Read_Master_Log_Pos
+            status[12] = "Yes";              // Slave_IO_Running
+            status[13] = "Yes";              // Slave_SQL_Running
+            status[41] = master_id.str();    // Master_Server_Id
+            rows.push_back(status);
+        }
+
+        m_slave_status = result_set(columns, rows);
+    }
+
+    /**
+     * Start listening on a free port of the loopback interface
+     *
+     * @return True if the server was started
+     */
+    bool start()
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        pthread_t thread;
+
+        if ((m_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+            bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(m_fd, 1024) != 0 ||
+            getsockname(m_fd, (struct sockaddr*)&addr, &len) != 0 ||
+            pthread_create(&thread, NULL, accept_main, this) != 0)
+        {
+            cerr << "Failed to start a mock server: " << strerror(errno) << endl;
+            return false;
+        }
+
+        pthread_detach(thread);
+        m_port = ntohs(addr.sin_port);
+        return true;
+    }
+
+    int port() const
+    {
+        return m_port;
+    }
+
+private:
+    struct Connection
+    {
+        MockServer* pServer;
+        int         fd;
+    };
+
+    static void* accept_main(void* pData)
+    {
+        MockServer* pServer = static_cast<MockServer*>(pData);
+
+        while (true)
+        {
+            int fd = accept(pServer->m_fd, NULL, NULL);
+
+            if (fd == -1)
+            {
+                continue;
+            }
+
+            Connection* pConnection = new Connection;
+            pConnection->pServer = pServer;
+            pConnection->fd = fd;
+            pthread_t thread;
+
+            if (pthread_create(&thread, NULL, connection_main, pConnection) == 0)
+            {
+                pthread_detach(thread);
+            }
+            else
+            {
+                close(fd);
+                delete pConnection;
+            }
+        }
+
+        return NULL;
+    }
+
+    static void* connection_main(void* pData)
+    {
+        Connection* pConnection = static_cast<Connection*>(pData);
+        set_nodelay(pConnection->fd);
+        pConnection->pServer->serve(pConnection->fd);
+        close(pConnection->fd);
+        delete pConnection;
+        return NULL;
+    }
+
+    void serve(int fd)
+    {
+        PacketWriter handshake;
+        handshake.start(0);
+        handshake.add_byte(10);                         // Protocol version
+        handshake.add_nulstr(SERVER_VERSION);
+        handshake.add_int(fd, 4);                       // Connection id
+        handshake.add_bytes("abcdefgh", 8);             // First part of the scramble
+        handshake.add_byte(0);
+        handshake.add_int(CAPABILITIES & 0xffff, 2);
+        handshake.add_byte(0x21);                       // utf8_general_ci
+        handshake.add_int(0x0002, 2);                   // Autocommit
+        handshake.add_int(CAPABILITIES >> 16, 2);
+        handshake.add_byte(21);                         // Length of the scramble
+        handshake.add_bytes("\0\0\0\0\0\0\0\0\0\0", 10);
+        handshake.add_bytes("ijklmnopqrst", 12);        // Rest of the scramble
+        handshake.add_byte(0);
+        handshake.add_nulstr("mysql_native_password");
+        handshake.end();
+
+        PacketReader reader(fd);
+        vector<uint8_t> packet;
+        const vector<uint8_t> ok = ok_packet(2);
+
+        // Any credentials are accepted
+        if (!write_fully(fd, &handshake.data()[0], handshake.data().size()) ||
+            !reader.read(packet) ||
+            !write_fully(fd, &ok[0], ok.size()))
+        {
+            return;
+        }
+
+        while (reader.read(packet) && !packet.empty() && packet[0] != COM_QUIT)
+        {
+            const vector<uint8_t>* pReply = &m_ok;
+
+            if (packet[0] == COM_QUERY)
+            {
+                string sql(packet.begin() + 1, packet.end());
+                pReply = reply_to(sql);
+            }
+
+            if (!write_fully(fd, &(*pReply)[0], pReply->size()))
+            {
+                break;
+            }
+        }
+    }
+
+    const vector<uint8_t>* reply_to(const string& sql) const
+    {
+        const char* zSql = sql.c_str();
+
+        if (strcasestr(zSql, "mysql.user"))
+        {
+            return &m_users;
+        }
+        else if (strcasestr(zSql, "SHOW DATABASES"))
+        {
+            return &m_databases;
+        }
+        else if (strcasestr(zSql, "@@server_id"))
+        {
+            return &m_server_id;
+        }
+        else if (strcasestr(zSql, "SLAVE STATUS"))
+        {
+            return &m_slave_status;
+        }
+        else if (strncasecmp(zSql, "SET ", 4) == 0 || strncasecmp(zSql, "USE ", 4) == 0)
+        {
+            return &m_ok;
+        }
+
+        return &m_result;
+    }
+
+    int             m_fd;
+    int             m_port;
+    vector<uint8_t> m_ok;
+    vector<uint8_t> m_result;
+    vector<uint8_t> m_users;
+    vector<uint8_t> m_databases;
+    vector<uint8_t> m_server_id;
+    vector<uint8_t> m_slave_status;
+};
+
+/**
+ * A client connection that sends queries and reads their results
+ */
+class Client
+{
+public:
+    Client()
+        : m_fd(-1)
+        , m_pReader(NULL)
+    {
+    }
+
+    ~Client()
+    {
+        if (m_fd != -1)
+        {
+            uint8_t quit[] = {1, 0, 0, 0, COM_QUIT};
+            write_fully(m_fd, quit, sizeof(quit));
+            close(m_fd);
+        }
+
+        delete m_pReader;
+    }
+
+    /**
+     * Connect and log in as the benchmark user
+     *
+     * @param port  The port on the loopback interface
+     * @param error The error message if the login failed
+     *
+     * @return True if the client is logged in
+     */
+    bool connect(int port, string& error)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+
+        if ((m_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+            ::connect(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+
+        set_nodelay(m_fd);
+        m_pReader = new PacketReader(m_fd);
+
+        vector<uint8_t> packet;
+        uint8_t seqno;
+
+        if (!m_pReader->read(packet, &seqno))
+        {
+            error = "No handshake";
+            return false;
+        }
+
+        PacketWriter response;
+        response.start(seqno + 1);
+        response.add_int(CAPABILITIES & ~CLIENT_CONNECT_WITH_DB, 4);
+        response.add_int(16 * 1024 * 1024, 4);  // Maximum packet size
+        response.add_byte(0x21);                // utf8_general_ci
+        response.add_bytes("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 23);
+        response.add_nulstr(BENCH_USER);
+        response.add_byte(0);                   // No password
+        response.add_nulstr("mysql_native_password");
+        response.end();
+
+        if (!write_fully(m_fd, &response.data()[0], response.data().size()) ||
+            !m_pReader->read(packet) || packet.empty())
+        {
+            error = "Connection closed during authentication";
+            return false;
+        }
+        else if (packet[0] != 0x00)
+        {
+            error = packet[0] == 0xff && packet.size() > 9 ?
+                    string(packet.begin() + 9, packet.end()) : "Authentication failed";
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Execute a query and read its result
+     *
+     * @param sql The query
+     *
+     * @return True if the query succeeded
+     */
+    bool query(const string& sql)
+    {
+        uint8_t header[5] =
+        {
+            (uint8_t)(sql.length() + 1),
+            (uint8_t)((sql.length() + 1) >> 8),
+            (uint8_t)((sql.length() + 1) >> 16),
+            0,
+            COM_QUERY
+        };
+
+        if (m_query.empty() || m_sql != sql)
+        {
+            m_sql = sql;
+            m_query.assign(header, header + sizeof(header));
+            m_query.insert(m_query.end(), sql.begin(), sql.end());
+        }
+
+        if (!write_fully(m_fd, &m_query[0], m_query.size()) || !m_pReader->read(m_packet) ||
+            m_packet.empty() || m_packet[0] == 0xff)
+        {
+            return false;
+        }
+        else if (m_packet[0] == 0x00)
+        {
+            return true;
+        }
+
+        // The column definitions and their EOF, the rows and their EOF
+        for (int eofs = 0; eofs < 2;)
+        {
+            if (!m_pReader->read(m_packet) || m_packet.empty() || m_packet[0] == 0xff)
+            {
+                return false;
+            }
+            else if (m_packet[0] == 0xfe && m_packet.size() < 9)
+            {
+                eofs++;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    int             m_fd;
+    PacketReader*   m_pReader;
+    string          m_sql;
+    vector<uint8_t> m_query;
+    vector<uint8_t> m_packet;
+};
+
+/**
+ * The state shared by the client threads of one measurement
+ */
+struct Run
+{
+    int              port;      /**< The port the clients connect to */
+    string           sql;       /**< The query */
+    int              measuring; /**< Whether the latencies are being recorded */
+    int              stop;      /**< Whether the clients should stop */
+    int              n_ready;   /**< Number of clients that have connected */
+    int              n_failed;  /**< Number of clients that have failed */
+};
+
+struct ClientThread
+{
+    Run*             pRun;
+    pthread_t        thread;
+    vector<uint32_t> latencies; /**< Latencies of the measured queries in microseconds */
+    string           error;
+};
+
+void* client_main(void* pData)
+{
+    ClientThread* pThread = static_cast<ClientThread*>(pData);
+    Run* pRun = pThread->pRun;
+    Client client;
+
+    if (!client.connect(pRun->port, pThread->error))
+    {
+        atomic_add(&pRun->n_failed, 1);
+        return NULL;
+    }
+
+    atomic_add(&pRun->n_ready, 1);
+
+    while (!atomic_load_int(&pRun->stop))
+    {
+        bool measured = atomic_load_int(&pRun->measuring);
+        uint64_t start = clock_us();
+
+        if (!client.query(pRun->sql))
+        {
+            pThread->error = "Query failed";
+            atomic_add(&pRun->n_failed, 1);
+            break;
+        }
+
+        if (measured && atomic_load_int(&pRun->measuring))
+        {
+            pThread->latencies.push_back(clock_us() - start);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * The CPU time a process has used
+ *
+ * @param pid The process
+ *
+ * @return The user and system time in microseconds or 0 if not known
+ */
+uint64_t process_cpu_us(pid_t pid)
+{
+    stringstream path;
+    path << "/proc/" << pid << "/stat";
+    ifstream stat(path.str().c_str());
+    string line;
+    uint64_t rval = 0;
+
+    if (getline(stat, line) && line.rfind(')') != string::npos)
+    {
+        // The fields after the name, utime and stime are the 12th and 13th of them
+        stringstream fields(line.substr(line.rfind(')') + 2));
+        string field;
+        uint64_t utime = 0;
+        uint64_t stime = 0;
+
+        for (int i = 0; i < 11 && fields >> field; i++)
+        {
+        }
+
+        if (fields >> utime >> stime)
+        {
+            rval = (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+        }
+    }
+
+    return rval;
+}
+
+struct Options
+{
+    string maxscale;
+    string libdir;
+    string sql;
+    string scenario;
+    int    n_clients;
+    int    duration;
+    int    warmup;
+    int    n_threads;
+    int    n_rows;
+    int    n_slaves;
+    bool   baseline;
+    bool   keep;
+};
+
+/**
+ * Measure the clients sending queries to a port
+ *
+ * @param options The options
+ * @param zName   The name of the measurement
+ * @param port    The port the clients connect to
+ * @param pid     The process whose CPU time is measured, 0 for none
+ *
+ * @return True if all clients succeeded
+ */
+bool measure(const Options& options, const char* zName, int port, pid_t pid)
+{
+    Run run = {};
+    run.port = port;
+    run.sql = options.sql;
+    vector<ClientThread> threads(options.n_clients);
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].pRun = &run;
+
+        if (pthread_create(&threads[i].thread, NULL, client_main, &threads[i]) != 0)
+        {
+            cerr << "Failed to start a client thread." << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (atomic_load_int(&run.n_ready) + atomic_load_int(&run.n_failed) < options.n_clients)
+    {
+        usleep(10000);
+    }
+
+    sleep(options.warmup);
+
+    uint64_t cpu_start = pid ? process_cpu_us(pid) : 0;
+    uint64_t start = clock_us();
+    atomic_add(&run.measuring, 1);
+
+    sleep(options.duration);
+
+    atomic_add(&run.measuring, -1);
+    uint64_t duration = clock_us() - start;
+    uint64_t cpu = pid ? process_cpu_us(pid) - cpu_start : 0;
+    atomic_add(&run.stop, 1);
+
+    vector<uint32_t> latencies;
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        latencies.insert(latencies.end(), threads[i].latencies.begin(), threads[i].latencies.end());
+
+        if (!threads[i].error.empty())
+        {
+            cerr << zName << ": " << threads[i].error << endl;
+        }
+    }
+
+    if (run.n_failed > 0 || latencies.empty())
+    {
+        cout << setw(24) << left << zName << "failed" << endl;
+        return false;
+    }
+
+    sort(latencies.begin(), latencies.end());
+
+    cout << setw(24) << left << zName
+         << setw(12) << right << fixed << setprecision(0)
+         << (double)latencies.size() * 1000000 / duration
+         << setw(12) << latencies[latencies.size() / 2]
+         << setw(12) << latencies[latencies.size() * 99 / 100];
+
+    if (pid)
+    {
+        cout << setw(16) << setprecision(2) << (double)cpu / latencies.size();
+    }
+    else
+    {
+        cout << setw(16) << "-";
+    }
+
+    cout << endl;
+    return true;
+}
+
+/**
+ * Find a free port on the loopback interface
+ */
+int free_port()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int port = 0;
+
+    if (fd != -1 &&
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr*)&addr, &len) == 0)
+    {
+        port = ntohs(addr.sin_port);
+    }
+
+    close(fd);
+    return port;
+}
+
+/**
+ * Write the configuration of MaxScale for a scenario
+ */
+bool write_config(const Options& options, const Scenario& scenario, const string& dir,
+                  const vector<MockServer*>& servers, int port)
+{
+    string path = dir + "/maxscale.cnf";
+    ofstream cnf(path.c_str());
+    stringstream names;
+
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+        names << (i ? "," : "") << "server" << i + 1;
+    }
+
+    cnf << "[maxscale]\n"
+        << "threads=" << options.n_threads << "\n"
+        << "\n"
+        << "[Monitor]\n"
+        << "type=monitor\n"
+        << "module=mysqlmon\n"
+        << "servers=" << names.str() << "\n"
+        << "user=" << SERVICE_USER << "\n"
+        << "passwd=" << SERVICE_PASSWORD << "\n"
+        << "monitor_interval=1000\n"
+        << "\n"
+        << "[Benchmark]\n"
+        << "type=service\n"
+        << scenario.zService
+        << "servers=" << names.str() << "\n"
+        << "user=" << SERVICE_USER << "\n"
+        << "passwd=" << SERVICE_PASSWORD << "\n"
+        << "\n"
+        << "[Benchmark Listener]\n"
+        << "type=listener\n"
+        << "service=Benchmark\n"
+        << "protocol=MySQLClient\n"
+        << "address=127.0.0.1\n"
+        << "port=" << port << "\n"
+        << "\n"
+        << scenario.zFilters;
+
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+        cnf << "[server" << i + 1 << "]\n"
+            << "type=server\n"
+            << "address=127.0.0.1\n"
+            << "port=" << servers[i]->port() << "\n"
+            << "protocol=MySQLBackend\n"
+            << "\n";
+    }
+
+    cnf.close();
+    return !cnf.fail();
+}
+
+/**
+ * Start MaxScale in the foreground with its files in a directory
+ *
+ * @return The process id or -1 on error
+ */
+pid_t start_maxscale(const Options& options, const string& dir)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        string log = dir + "/output.log";
+        int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        string config = dir + "/maxscale.cnf";
+        execl(options.maxscale.c_str(), options.maxscale.c_str(), "-d",
+              "-f", config.c_str(),
+              "-B", options.libdir.c_str(),
+              "-L", dir.c_str(),
+              "-D", dir.c_str(),
+              "-A", dir.c_str(),
+              "-P", dir.c_str(),
+              "-F", dir.c_str(),
+              "-M", dir.c_str(),
+              "-N", dir.c_str(),
+              (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+/**
+ * Wait until queries can be routed through MaxScale
+ *
+ * @return True if MaxScale is ready
+ */
+bool wait_for_maxscale(const Options& options, pid_t pid, int port)
+{
+    string error;
+
+    for (int i = 0; i < STARTUP_TIMEOUT * 10; i++)
+    {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            cerr << "MaxScale exited during startup." << endl;
+            return false;
+        }
+
+        Client client;
+
+        if (client.connect(port, error) && client.query(options.sql))
+        {
+            return true;
+        }
+
+        usleep(100000);
+    }
+
+    cerr << "MaxScale did not start routing queries: " << error << endl;
+    return false;
+}
+
+bool run_scenario(const Options& options, const Scenario& scenario, const vector<MockServer*>& servers)
+{
+    char dir[] = "/tmp/proxy_benchmark.XXXXXX";
+    int port = free_port();
+    bool ok = false;
+
+    if (mkdtemp(dir) == NULL || !write_config(options, scenario, dir, servers, port))
+    {
+        cerr << "Failed to write the configuration: " << strerror(errno) << endl;
+        return false;
+    }
+
+    pid_t pid = start_maxscale(options, dir);
+
+    if (pid > 0)
+    {
+        if (wait_for_maxscale(options, pid, port))
+        {
+            ok = measure(options, scenario.zName, port, pid);
+        }
+
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    if (ok && !options.keep)
+    {
+        string rm = string("rm -rf ") + dir;
+        if (system(rm.c_str()) != 0)
+        {
+            cerr << "Failed to remove " << dir << endl;
+        }
+    }
+    else
+    {
+        cerr << "The configuration and logs are in " << dir << endl;
+    }
+
+    return ok;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    options.sql = DEFAULT_QUERY;
+    options.n_clients = 16;
+    options.duration = 10;
+    options.warmup = 2;
+    options.n_threads = 4;
+    options.n_rows = 1;
+    options.n_slaves = 2;
+    options.baseline = false;
+    options.keep = false;
+
+    int rc = EXIT_SUCCESS;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:l:c:d:w:t:r:n:q:s:bk")) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            options.maxscale = optarg;
+            break;
+
+        case 'l':
+            options.libdir = optarg;
+            break;
+
+        case 'c':
+            options.n_clients = atoi(optarg);
+            break;
+
+        case 'd':
+            options.duration = atoi(optarg);
+            break;
+
+        case 'w':
+            options.warmup = atoi(optarg);
+            break;
+
+        case 't':
+            options.n_threads = atoi(optarg);
+            break;
+
+        case 'r':
+            options.n_rows = atoi(optarg);
+            break;
+
+        case 'n':
+            options.n_slaves = atoi(optarg);
+            break;
+
+        case 'q':
+            options.sql = optarg;
+            break;
+
+        case 's':
+            options.scenario = optarg;
+            break;
+
+        case 'b':
+            options.baseline = true;
+            break;
+
+        case 'k':
+            options.keep = true;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    bool run_maxscale = !options.maxscale.empty() && !options.libdir.empty();
+
+    if (rc != EXIT_SUCCESS || (!run_maxscale && !options.baseline) ||
+        options.n_clients <= 0 || options.duration <= 0 || options.warmup < 0 ||
+        options.n_threads <= 0 || options.n_rows < 0 || options.n_slaves < 0)
+    {
+        cout << USAGE << endl;
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // The master has the server id 1 and the slaves replicate from it
+    vector<MockServer*> servers;
+
+    for (int i = 0; i <= options.n_slaves; i++)
+    {
+        servers.push_back(new MockServer(i + 1, i ? 1 : 0, options.n_rows));
+
+        if (!servers.back()->start())
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    cout << options.n_clients << " clients, " << options.n_rows << " rows per query, "
+         << options.n_threads << " MaxScale threads, " << options.n_slaves << " slaves" << endl;
+    cout << setw(24) << left << "Scenario"
+         << setw(12) << right << "QPS"
+         << setw(12) << "p50 (us)"
+         << setw(12) << "p99 (us)"
+         << setw(16) << "CPU/query (us)" << endl;
+
+    if (options.baseline && !measure(options, "direct", servers[0]->port(), 0))
+    {
+        rc = EXIT_FAILURE;
+    }
+
+    for (int i = 0; run_maxscale && i < N_SCENARIOS; i++)
+    {
+        if ((options.scenario.empty() || options.scenario == SCENARIOS[i].zName) &&
+            !run_scenario(options, SCENARIOS[i], servers))
+        {
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    return rc;
+}
@@ -441,6 +441,132 @@ void test_clone()
     gwbuf_free(original);
 }
 
+/** Buffers outliving the buffer they were cloned from */
+void test_clone_outlives_original()
+{
+    size_t sizes[] = {1, 64, 200, 256, 257, 4000, 20000};
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t size = sizes[i];
+        uint8_t* data = generate_data(size);
+        GWBUF* original = gwbuf_alloc_and_load(size, data);
+        GWBUF* clone = gwbuf_clone(original);
+        ss_info_dassert(clone && clone->sbuf == original->sbuf, "Clone should share the data");
+
+        gwbuf_free(original);
+        ss_info_dassert(GWBUF_LENGTH(clone) == size, "Clone should have all the data");
+        ss_info_dassert(memcmp(GWBUF_DATA(clone), data, size) == 0, "Clone should have correct data");
+
+        clone = gwbuf_consume(clone, size / 2);
+        ss_info_dassert(gwbuf_length(clone) == size - size / 2, "Clone should be consumed");
+        ss_info_dassert(memcmp(GWBUF_DATA(clone), data + size / 2, size - size / 2) == 0,
+                        "Consumed clone should have correct data");
+
+        GWBUF* chain = gwbuf_append(clone, gwbuf_alloc_and_load(size, data));
+        chain = gwbuf_make_contiguous(chain);
+        ss_info_dassert(chain && chain->next == NULL, "Chain should be contiguous");
+        ss_info_dassert(gwbuf_length(chain) == 2 * size - size / 2, "Contiguous buffer should have all data");
+        ss_info_dassert(memcmp(GWBUF_DATA(chain) + size - size / 2, data, size) == 0,
+                        "Contiguous buffer should have correct data");
+
+        gwbuf_free(chain);
+        MXS_FREE(data);
+    }
+}
+
+/** The rest of a large read is copied into a buffer of its own size */
+void test_shrink()
+{
+    size_t size = 20000;
+    uint8_t* data = generate_data(size);
+    size_t released;
+
+    GWBUF* buffer = gwbuf_alloc_and_load(size, data);
+    buffer = gwbuf_consume(buffer, size - 10);
+    buffer = gwbuf_append(buffer, gwbuf_alloc_and_load(5, data));
+    buffer = gwbuf_shrink(buffer, &released);
+    ss_info_dassert(buffer && buffer->next == NULL, "Shrunk buffer should be contiguous");
+    ss_info_dassert(released >= size - 64, "The large data area should be released");
+    ss_info_dassert(gwbuf_length(buffer) == 15, "Shrunk buffer should have all data");
+    ss_info_dassert(memcmp(GWBUF_DATA(buffer), data + size - 10, 10) == 0 &&
+                    memcmp(GWBUF_DATA(buffer) + 10, data, 5) == 0,
+                    "Shrunk buffer should have correct data");
+
+    GWBUF* same = gwbuf_shrink(buffer, &released);
+    ss_info_dassert(same == buffer && released == 0, "Small buffer should not be copied");
+
+    GWBUF* original = gwbuf_alloc_and_load(size, data);
+    GWBUF* clone = gwbuf_consume(gwbuf_clone(original), size - 10);
+    same = gwbuf_shrink(clone, &released);
+    ss_info_dassert(same == clone && released == 0, "Shared data should not be copied");
+
+    gwbuf_free(clone);
+    gwbuf_free(original);
+    gwbuf_free(buffer);
+    MXS_FREE(data);
+}
+
+static int n_buffer_objects_freed = 0;
+
+static void free_buffer_object(void* data)
+{
+    n_buffer_objects_freed++;
+}
+
+/** Buffer objects are shared by clones of the data they describe */
+void test_buffer_object()
+{
+    int object;
+    GWBUF* original = gwbuf_alloc_and_load(8, "12345678");
+    gwbuf_add_buffer_object(original, GWBUF_PARSING_INFO, &object, free_buffer_object);
+    ss_info_dassert(GWBUF_IS_PARSED(original), "Buffer should be parsed");
+
+    GWBUF* clone = gwbuf_clone(original);
+    ss_info_dassert(gwbuf_get_buffer_object_data(clone, GWBUF_PARSING_INFO) == &object,
+                    "Clone should share the buffer object");
+
+    GWBUF* head = gwbuf_split(&original, 4);
+    ss_info_dassert(gwbuf_get_buffer_object_data(head, GWBUF_PARSING_INFO) == &object,
+                    "Split head should share the buffer object");
+    ss_info_dassert(!GWBUF_IS_PARSED(original), "Rest of the split should not be parsed");
+    ss_info_dassert(gwbuf_get_buffer_object_data(original, GWBUF_PARSING_INFO) == NULL,
+                    "Rest of the split should not have the buffer object");
+
+    gwbuf_free(head);
+    gwbuf_free(original);
+    ss_info_dassert(n_buffer_objects_freed == 0, "Buffer object should not be freed while in use");
+    gwbuf_free(clone);
+    ss_info_dassert(n_buffer_objects_freed == 1, "Buffer object should be freed with the data");
+
+    /** Each split packet adds its object to the same shared buffer */
+    const int n_parts = 2 * GWBUF_MAX_OBJECTS;
+    int objects[n_parts];
+    GWBUF* packets = gwbuf_alloc(n_parts);
+    GWBUF* parts[n_parts];
+
+    for (int i = 0; i < n_parts; i++)
+    {
+        parts[i] = i < n_parts - 1 ? gwbuf_split(&packets, 1) : packets;
+        bool added = gwbuf_add_buffer_object(parts[i], GWBUF_PARSING_INFO, &objects[i], free_buffer_object);
+        ss_info_dassert(added, "Buffer object should be added when the slots are in use");
+    }
+
+    for (int i = 0; i < n_parts; i++)
+    {
+        ss_info_dassert(gwbuf_get_buffer_object_data(parts[i], GWBUF_PARSING_INFO) == &objects[i],
+                        "Each part should find its own buffer object");
+    }
+
+    for (int i = 0; i < n_parts; i++)
+    {
+        gwbuf_free(parts[i]);
+    }
+
+    ss_info_dassert(n_buffer_objects_freed == 1 + n_parts,
+                    "All added buffer objects should be freed");
+}
+
 /**
  * test1    Allocate a buffer and do lots of things
  *
@@ -562,6 +688,9 @@ test1()
     test_consume();
     test_compare();
     test_clone();
+    test_clone_outlives_original();
+    test_shrink();
+    test_buffer_object();
 
     return 0;
 }
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <maxscale/debug.h>
+#include <maxscale/random_jkiss.h>
+
+#include "../maxscale/clock.h"
+
+/**
+ * Test that the clocks are read on every call until the thread updates them
+ */
+static int test1()
+{
+    uint64_t start = mxs_clock_ns();
+    usleep(2000);
+    ss_info_dassert(mxs_clock_ns() - start >= 2000000, "Clock should advance before the first update");
+
+    mxs_clock_update();
+    uint64_t coarse = mxs_clock_ns();
+    time_t coarse_time = mxs_clock_time();
+    usleep(2000);
+
+    ss_info_dassert(mxs_clock_ns() == coarse, "Coarse clock should not advance between updates");
+    ss_info_dassert(mxs_clock_ms() == coarse / 1000000, "Milliseconds should match nanoseconds");
+    ss_info_dassert(mxs_clock_time() == coarse_time, "Wall clock should not advance between updates");
+    ss_info_dassert(mxs_clock_precise_ns() - coarse >= 2000000, "Precise clock should always advance");
+
+    mxs_clock_update();
+    ss_info_dassert(mxs_clock_ns() - coarse >= 2000000, "Coarse clock should advance on update");
+
+    return 0;
+}
+
+static void* read_clock(void *data)
+{
+    uint64_t *rval = (uint64_t*)data;
+    rval[0] = mxs_clock_ns();
+    rval[1] = random_jkiss();
+    return NULL;
+}
+
+/**
+ * Test that the clocks and random number generators are per thread
+ */
+static int test2()
+{
+    uint64_t values[2];
+    pthread_t thr;
+
+    mxs_clock_update();
+    uint64_t coarse = mxs_clock_ns();
+    usleep(2000);
+
+    pthread_create(&thr, NULL, read_clock, values);
+    pthread_join(thr, NULL);
+
+    ss_info_dassert(values[0] - coarse >= 2000000, "Other threads should not see the coarse clock");
+    ss_info_dassert(mxs_clock_ns() == coarse, "Coarse clock should not advance between updates");
+
+    unsigned int a = random_jkiss();
+    unsigned int b = random_jkiss();
+    ss_info_dassert(a != b, "Consecutive random numbers should differ");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    random_jkiss_init();
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -105,12 +105,69 @@ static int test2()
     return 0;
 }
 
+/**
+ * Test the extraction of literal strings from patterns
+ */
+static int test3()
+{
+    struct
+    {
+        const char *pattern;
+        bool caseless;
+        const char *literal;
+    } tests[] =
+    {
+        {"SELECT",                  false, "SELECT"},
+        {"brown.*dog",              false, "brown"},
+        {"^select .* from t1$",     true,  " from t1"},
+        {"fro?m",                   false, "fr"},
+        {"ab{2}cd",                 false, "cd"},
+        {"a\\{2\\}cd",              false, "cd"},
+        {"(abc)?de",                false, "de"},
+        {"user\\.name",             false, "user.name"},
+        {"[abc]+xyz[0-9]",          false, "xyz"},
+        {"[]x]y",                   false, "y"},
+        {"id\\d+",                  false, "i"},
+        {"cat|dog",                 false, ""},
+        {"(?i)select",              false, ""},
+        {"\\(abc\\)*",              false, ""},
+        {"caf\xc3\xa9s",            true,  "caf"},
+    };
+
+    char literal[16];
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        size_t len = mxs_pcre2_get_literal(tests[i].pattern, tests[i].caseless,
+                                           literal, sizeof(literal));
+        test_assert(len == strlen(literal) && strcmp(literal, tests[i].literal) == 0,
+                    "Literal should be the longest required string");
+    }
+
+    test_assert(mxs_pcre2_get_literal("a very long literal string", false, literal,
+                                      sizeof(literal)) == sizeof(literal) - 1,
+                "Long literal should be truncated");
+
+    const char subject[] = "SELECT * FROM t1 WHERE id = 1";
+    size_t len = sizeof(subject) - 1;
+
+    test_assert(mxs_pcre2_has_literal(subject, len, "FROM", 4, false), "Literal should be found");
+    test_assert(!mxs_pcre2_has_literal(subject, len, "from", 4, false), "Case should matter");
+    test_assert(mxs_pcre2_has_literal(subject, len, "from", 4, true), "Case should not matter");
+    test_assert(mxs_pcre2_has_literal(subject, len, "= 1", 3, true), "Literal at the end should be found");
+    test_assert(!mxs_pcre2_has_literal(subject, len - 1, "= 1", 3, true),
+                "Literal past the end should not be found");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
     result += test1();
     result += test2();
+    result += test3();
 
     return result;
 }
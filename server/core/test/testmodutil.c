@@ -36,6 +36,7 @@
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/buffer.h>
+#include <maxscale/protocol/mysql.h>
 
 /**
  * test1    Allocate a service and do lots of other things
@@ -628,6 +629,128 @@ void test_bypass_whitespace()
     ss_info_dassert(*sql == 'S', "9");
 }
 
+void test_canonicalize()
+{
+    const char* tests[][2] =
+    {
+        {"SELECT 1", "SELECT ?"},
+        {"  select  a,b FROM t WHERE x='ab\\'c' AND y=\"x\"\"y\"  ", "select a,b FROM t WHERE x=? AND y=?"},
+        {"SELECT 1.5e-10, .5, 0xff, t1.c2", "SELECT ?, ?, ?, t1.c2"},
+        {"/* comment */ SELECT /*!50000 SQL_NO_CACHE */ 1 -- comment\n", "SELECT /*!50000 SQL_NO_CACHE */ ?"},
+        {"SELECT `a``1` FROM t # comment", "SELECT `a``1` FROM t"},
+        {"SELECT @@identity", "SELECT @@identity"},
+        {"SELECT 'unterminated", "SELECT ?"}
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        size_t len = strlen(tests[i][0]);
+        char dest[len + 1];
+        uint64_t hash;
+
+        size_t n = modutil_canonicalize(tests[i][0], len, dest, &hash);
+        ss_info_dassert(strcmp(dest, tests[i][1]) == 0, "Canonical form should be correct");
+        ss_info_dassert(n == strlen(tests[i][1]), "Length should be correct");
+    }
+
+    uint64_t h1, h2, h3;
+    char dest[64];
+    modutil_canonicalize("SELECT 1", 8, dest, &h1);
+    modutil_canonicalize("SELECT 2", 8, dest, &h2);
+    modutil_canonicalize("SELECT a", 8, dest, &h3);
+    ss_info_dassert(h1 == h2, "Statements differing by literals should have the same hash");
+    ss_info_dassert(h1 != h3, "Different statements should have different hashes");
+}
+
+/** Append a packet with the given payload to a buffer */
+GWBUF* add_packet(GWBUF* buffer, const uint8_t* payload, size_t len)
+{
+    GWBUF* packet = create_buffer(len);
+    memcpy(GWBUF_DATA(packet) + MYSQL_HEADER_LEN, payload, len);
+    return gwbuf_append(buffer, packet);
+}
+
+/** Append an EOF packet with the given status flags to a buffer */
+GWBUF* add_eof(GWBUF* buffer, uint16_t status)
+{
+    uint8_t eof[] = {MYSQL_REPLY_EOF, 0, 0, status & 0xff, status >> 8};
+    return add_packet(buffer, eof, sizeof(eof));
+}
+
+/** Append a result set without rows up to its column definition EOF */
+GWBUF* add_columns(GWBUF* buffer, uint16_t status)
+{
+    const uint8_t column_count[] = {1};
+    const uint8_t column_def[] = {3, 'd', 'e', 'f', 0};
+    buffer = add_packet(buffer, column_count, sizeof(column_count));
+    buffer = add_packet(buffer, column_def, sizeof(column_def));
+    return add_eof(buffer, status);
+}
+
+void test_parse_reply_cursor()
+{
+    MXS_REPLY_STATE state;
+    modutil_reset_reply_state(&state);
+
+    /** A COM_STMT_EXECUTE that opens a cursor ends in the first EOF */
+    GWBUF* buffer = add_columns(NULL, SERVER_STATUS_AUTOCOMMIT | SERVER_STATUS_CURSOR_EXISTS);
+    MXS_REPLY_INFO* info = modutil_parse_reply(&state, MYSQL_COM_STMT_EXECUTE, buffer);
+
+    ss_info_dassert(info && info->n_packets == 3, "The reply should have three packets");
+    ss_info_dassert(info->packets[0].flags == MXS_REPLY_RSET_START, "The result set should start");
+    ss_info_dassert(info->packets[2].flags & MXS_REPLY_END, "The cursor EOF should end the reply");
+    ss_info_dassert(info->n_replies == 1, "There should be one reply");
+    modutil_free_reply_info(info);
+    gwbuf_free(buffer);
+
+    /** A binary row starts with a zero byte like an OK packet */
+    const uint8_t row[] = {0, 0, 1};
+    buffer = add_columns(NULL, SERVER_STATUS_AUTOCOMMIT);
+    buffer = add_packet(buffer, row, sizeof(row));
+    buffer = add_packet(buffer, row, sizeof(row));
+    buffer = add_eof(buffer, SERVER_STATUS_AUTOCOMMIT);
+    info = modutil_parse_reply(&state, MYSQL_COM_STMT_EXECUTE, buffer);
+
+    ss_info_dassert(info && info->n_packets == 6, "The reply should have six packets");
+    ss_info_dassert(info->packets[0].flags == MXS_REPLY_RSET_START, "The next result set should start");
+    ss_info_dassert(info->packets[2].flags == MXS_REPLY_EOF, "The column EOF should not end the result");
+    ss_info_dassert(info->packets[3].flags == 0 && info->packets[4].flags == 0,
+                    "The rows should not be taken for OK packets");
+    ss_info_dassert(info->packets[5].flags & MXS_REPLY_END, "The second EOF should end the reply");
+    ss_info_dassert(info->n_replies == 1, "There should be one reply");
+    modutil_free_reply_info(info);
+    gwbuf_free(buffer);
+}
+
+void test_parse_reply_multiple_results()
+{
+    MXS_REPLY_STATE state;
+    modutil_reset_reply_state(&state);
+
+    const uint8_t row[] = {1, 'a'};
+    const uint8_t ok[] = {MYSQL_REPLY_OK, 0, 0, SERVER_STATUS_AUTOCOMMIT, 0, 0, 0};
+    GWBUF* buffer = add_columns(NULL, SERVER_STATUS_AUTOCOMMIT);
+    buffer = add_packet(buffer, row, sizeof(row));
+    buffer = add_eof(buffer, SERVER_STATUS_AUTOCOMMIT | SERVER_MORE_RESULTS_EXIST);
+    buffer = add_columns(buffer, SERVER_STATUS_AUTOCOMMIT);
+    buffer = add_eof(buffer, SERVER_STATUS_AUTOCOMMIT | SERVER_MORE_RESULTS_EXIST);
+    buffer = add_packet(buffer, ok, sizeof(ok));
+    MXS_REPLY_INFO* info = modutil_parse_reply(&state, MYSQL_COM_QUERY, buffer);
+
+    ss_info_dassert(info && info->n_packets == 10, "The reply should have ten packets");
+    ss_info_dassert(info->packets[4].flags == (MXS_REPLY_EOF | MXS_REPLY_RESULT_END),
+                    "The first result set should end without ending the reply");
+    ss_info_dassert(info->packets[4].status & SERVER_MORE_RESULTS_EXIST, "The status should be stored");
+    ss_info_dassert(info->packets[5].flags == MXS_REPLY_RSET_START, "The second result set should start");
+    ss_info_dassert(info->packets[8].flags == (MXS_REPLY_EOF | MXS_REPLY_RESULT_END),
+                    "The second result set should end without ending the reply");
+    ss_info_dassert(info->packets[9].flags == (MXS_REPLY_OK | MXS_REPLY_RESULT_END | MXS_REPLY_END),
+                    "The OK packet should end the reply");
+    ss_info_dassert(info->n_replies == 1, "There should be one reply");
+    modutil_free_reply_info(info);
+    gwbuf_free(buffer);
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -642,5 +765,8 @@ int main(int argc, char **argv)
     test_strnchr_esc_mysql();
     test_large_packets();
     test_bypass_whitespace();
+    test_canonicalize();
+    test_parse_reply_cursor();
+    test_parse_reply_multiple_results();
     exit(result);
 }
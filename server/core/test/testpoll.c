@@ -35,9 +35,52 @@
 #include <errno.h>
 #include <maxscale/dcb.h>
 #include <maxscale/listener.h>
+#include <maxscale/thread.h>
 
 #include "test_utils.h"
 
+#define N_TASKS 100
+
+static int task_order[N_TASKS + 1];
+static int n_tasks_done = 0;
+
+static void record_task(int thread_id, void *data)
+{
+    ss_info_dassert(thread_id == 0, "Task should be executed by the polling thread");
+    task_order[n_tasks_done++] = (intptr_t)data;
+}
+
+/**
+ * test_tasks   Post tasks to a polling thread and stop the thread
+ *
+ */
+static int
+test_tasks()
+{
+    THREAD poll_thread;
+    thread_start(&poll_thread, poll_waitevents, (void*)0);
+
+    for (intptr_t i = 0; i < N_TASKS; i++)
+    {
+        ss_info_dassert(poll_post_task(0, record_task, (void*)i), "Posting a task should succeed");
+    }
+
+    /** Executed after all previously posted tasks */
+    poll_execute_on_all(record_task, (void*)N_TASKS);
+
+    ss_info_dassert(n_tasks_done == N_TASKS + 1, "All tasks should be executed");
+
+    for (int i = 0; i <= N_TASKS; i++)
+    {
+        ss_info_dassert(task_order[i] == i, "Tasks should be executed in posting order");
+    }
+
+    poll_shutdown();
+    thread_wait(poll_thread);
+
+    return 0;
+}
+
 /**
  * test1    Allocate a service and do lots of other things
  *
@@ -55,6 +98,13 @@ test1()
     ss_dfprintf(stderr,
                 "testpoll : Initialise the polling system.");
     init_test_env(NULL);
+    ss_dfprintf(stderr, "\t..done\nExecute tasks in a polling thread.");
+
+    if (test_tasks() != 0)
+    {
+        return 1;
+    }
+
     ss_dfprintf(stderr, "\t..done\nAdd a DCB");
     dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
 
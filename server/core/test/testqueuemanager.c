@@ -91,6 +91,12 @@ test1()
         ss_dfprintf(stderr, "Input counter %d and output counter %d\n", input_counter, output_counter);
         ss_dfprintf(stderr, "Difference between counters %d\n", input_counter - output_counter);
         ss_dfprintf(stderr, "Filled %d, emptied %d, expired %d\n", filled, emptied, expired);
+        if (mxs_queue_length(queue) != input_counter - output_counter)
+        {
+            ss_dfprintf(stderr, "\nQueue length %d does not match the difference between counters.\n",
+                        mxs_queue_length(queue));
+            return 11;
+        }
         if (random_jkiss() % 2)
         {
             int *entrynumber = MXS_MALLOC(sizeof(int));
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <maxscale/debug.h>
+
+#include "../maxscale/rcu.h"
+
+static int n_freed = 0;
+
+static void count_free(void *data)
+{
+    n_freed++;
+}
+
+/**
+ * Test that data is freed right away when no thread is online
+ */
+static int test1()
+{
+    n_freed = 0;
+    mxs_rcu_retire(NULL, count_free);
+    mxs_rcu_retire(NULL, count_free);
+    ss_info_dassert(mxs_rcu_pending() == 2, "Retired data should be pending");
+    ss_info_dassert(mxs_rcu_reclaim() == 2, "Data should be freed");
+    ss_info_dassert(n_freed == 2, "Free function should be called");
+    ss_info_dassert(mxs_rcu_pending() == 0, "Nothing should be pending");
+
+    return 0;
+}
+
+/**
+ * Test that data is freed only after every online thread has passed a quiescent point
+ */
+static int test2()
+{
+    n_freed = 0;
+    mxs_rcu_quiescent(0);
+    mxs_rcu_quiescent(1);
+    mxs_rcu_retire(NULL, count_free);
+
+    ss_info_dassert(mxs_rcu_reclaim() == 0, "Data should not be freed while in use");
+    mxs_rcu_quiescent(0);
+    ss_info_dassert(mxs_rcu_reclaim() == 0, "Data should not be freed while in use by one thread");
+    mxs_rcu_offline(1);
+    ss_info_dassert(mxs_rcu_reclaim() == 1, "Data should be freed when the other thread goes offline");
+    ss_info_dassert(n_freed == 1, "Free function should be called");
+
+    return 0;
+}
+
+/**
+ * Test that only the data retired before the quiescent points is freed
+ */
+static int test3()
+{
+    n_freed = 0;
+    mxs_rcu_quiescent(0);
+    mxs_rcu_quiescent(1);
+    mxs_rcu_retire(NULL, count_free);
+    mxs_rcu_quiescent(0);
+    mxs_rcu_quiescent(1);
+    mxs_rcu_retire(NULL, count_free);
+
+    ss_info_dassert(mxs_rcu_reclaim() == 1, "Only the older data should be freed");
+    ss_info_dassert(mxs_rcu_pending() == 1, "The newer data should be pending");
+    mxs_rcu_quiescent(1);
+    mxs_rcu_offline(0);
+    ss_info_dassert(mxs_rcu_reclaim() == 1, "The newer data should be freed");
+    ss_info_dassert(n_freed == 2, "Free function should be called");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    mxs_rcu_init(2);
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -96,6 +96,21 @@ test1()
     {
         MXS_FREE(status);
     }
+    ss_dfprintf(stderr, "\t..done\nTesting Publication of Server State.");
+    SERVER_STATE state;
+    server_set_status_nolock(server, SERVER_SLAVE);
+    server->rlag = 5;
+    server_get_states(&server, 1, &state);
+    ss_info_dassert(state.status == SERVER_RUNNING && state.rlag != 5,
+                    "Unpublished changes should not be visible.");
+    uint64_t version = server_states_version();
+    server_publish_states(&server, 1);
+    ss_info_dassert(server_states_version() != version,
+                    "Publishing should change the version of the states.");
+    server_get_states(&server, 1, &state);
+    ss_info_dassert(state.status == (SERVER_RUNNING | SERVER_SLAVE) && state.rlag == 5,
+                    "Published changes should be visible.");
+    server_clear_status_nolock(server, SERVER_SLAVE);
     ss_dfprintf(stderr, "\t..done\nRun Prints for Server and all Servers.");
     printServer(server);
     printAllServers();
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/buffer.h>
+#include <maxscale/debug.h>
+#include <maxscale/sescmd.h>
+
+static GWBUF* create_command(const char *sql)
+{
+    size_t len = strlen(sql);
+    GWBUF *buffer = gwbuf_alloc(len + 5);
+    uint8_t *data = GWBUF_DATA(buffer);
+
+    data[0] = len + 1;
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+    gwbuf_set_type(buffer, GWBUF_TYPE_MYSQL);
+
+    return buffer;
+}
+
+/**
+ * Test that identical commands are shared and that different ones are not
+ */
+static int test1()
+{
+    MXS_SESCMD *a = mxs_sescmd_intern(create_command("SET NAMES utf8mb4"));
+    MXS_SESCMD *b = mxs_sescmd_intern(create_command("SET NAMES utf8mb4"));
+    MXS_SESCMD *c = mxs_sescmd_intern(create_command("SET autocommit=1"));
+
+    ss_info_dassert(a && b && c, "Interning should succeed");
+    ss_info_dassert(a == b, "Identical commands should be shared");
+    ss_info_dassert(a != c, "Different commands should not be shared");
+    ss_info_dassert(mxs_sescmd_count() == 2, "There should be two commands");
+
+    GWBUF *buffer = mxs_sescmd_buffer(a);
+    ss_info_dassert(GWBUF_LENGTH(buffer) == strlen("SET NAMES utf8mb4") + 5, "Buffer should be the command");
+    ss_info_dassert(GWBUF_IS_TYPE_SESCMD(buffer), "Buffer should be a session command");
+    ss_info_dassert(memcmp(GWBUF_DATA(buffer) + 5, "SET NAMES utf8mb4", 17) == 0, "Buffer should be the command");
+
+    mxs_sescmd_release(a);
+    ss_info_dassert(mxs_sescmd_count() == 2, "A referred command should not be freed");
+    mxs_sescmd_release(b);
+    ss_info_dassert(mxs_sescmd_count() == 1, "An unreferred command should be freed");
+    mxs_sescmd_release(c);
+    ss_info_dassert(mxs_sescmd_count() == 0, "All commands should be freed");
+
+    return 0;
+}
+
+/**
+ * Test that a command split over several buffers is interned as one
+ */
+static int test2()
+{
+    GWBUF *split = create_command("USE app");
+    GWBUF *head = gwbuf_split(&split, 6);
+    split = gwbuf_append(head, split);
+
+    MXS_SESCMD *a = mxs_sescmd_intern(create_command("USE app"));
+    MXS_SESCMD *b = mxs_sescmd_intern(split);
+
+    ss_info_dassert(a == b, "A split command should be shared with a contiguous one");
+
+    mxs_sescmd_release(a);
+    mxs_sescmd_release(b);
+    mxs_sescmd_release(NULL);
+    ss_info_dassert(mxs_sescmd_count() == 0, "All commands should be freed");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/shardedhash.h>
+
+#define N_THREADS 8
+#define N_KEYS    1000
+#define N_ROUNDS  50
+
+static int hfun(const void* key)
+{
+    return *(const int *)key * 23 + 41;
+}
+
+static int cmpfun(const void* v1, const void* v2)
+{
+    int i1 = *(const int *)v1;
+    int i2 = *(const int *)v2;
+
+    return (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+}
+
+static void* intdup(const void* v)
+{
+    int* rval = (int*)MXS_MALLOC(sizeof(int));
+    MXS_ABORT_IF_NULL(rval);
+    *rval = *(const int *)v;
+    return rval;
+}
+
+/**
+ * Test the basic operations from a single thread
+ */
+static int test1()
+{
+    SHARDEDHASH* h = shardedhash_alloc(4, 10, hfun, cmpfun);
+    ss_info_dassert(h, "Table should be allocated");
+    shardedhash_memory_fns(h, intdup, intdup, hashtable_item_free, hashtable_item_free);
+
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        ss_info_dassert(shardedhash_add(h, &i, &i) == 1, "New key should be added");
+    }
+
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        ss_info_dassert(shardedhash_add(h, &i, &i) == 0, "Duplicate key should not be added");
+        int* value = (int*)shardedhash_fetch(h, &i);
+        ss_info_dassert(value && *value == i, "Added value should be found");
+    }
+
+    ss_info_dassert(shardedhash_size(h) == N_KEYS, "All keys should be counted");
+
+    for (int i = 0; i < N_KEYS; i += 2)
+    {
+        ss_info_dassert(shardedhash_delete(h, &i) == 1, "Key should be deleted");
+        ss_info_dassert(shardedhash_delete(h, &i) == 0, "Key should be deleted only once");
+        ss_info_dassert(shardedhash_fetch(h, &i) == NULL, "Deleted key should not be found");
+    }
+
+    ss_info_dassert(shardedhash_size(h) == N_KEYS / 2, "Deleted keys should not be counted");
+
+    int key = 0;
+    int other = -1;
+    int* value = (int*)shardedhash_fetch_or_add(h, &key, &other);
+    ss_info_dassert(value && *value == -1, "Missing key should be added");
+    key = 1;
+    value = (int*)shardedhash_fetch_or_add(h, &key, &other);
+    ss_info_dassert(value && *value == 1, "Existing value should be returned");
+
+    shardedhash_free(h);
+
+    h = shardedhash_alloc_str(0, 0);
+    ss_info_dassert(h, "Table should be allocated");
+    char name[] = "test";
+    ss_info_dassert(shardedhash_add(h, name, "value") == 1, "String key should be added");
+    strcpy(name, "tset");
+    ss_info_dassert(shardedhash_fetch(h, "test"), "String key should be copied");
+    ss_info_dassert(shardedhash_fetch(h, name) == NULL, "Unknown key should not be found");
+    shardedhash_free(h);
+
+    return 0;
+}
+
+static SHARDEDHASH* shared;
+
+static void* counter_thread(void* data)
+{
+    for (int round = 0; round < N_ROUNDS; round++)
+    {
+        for (int i = 0; i < N_KEYS; i++)
+        {
+            int zero = 0;
+            int* value = (int*)shardedhash_fetch_or_add(shared, &i, &zero);
+            ss_info_dassert(value, "Value should be returned");
+            atomic_add(value, 1);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Test that concurrent threads adding the same keys all get the same entry
+ */
+static int test2()
+{
+    shared = shardedhash_alloc(0, 100, hfun, cmpfun);
+    ss_info_dassert(shared, "Table should be allocated");
+    shardedhash_memory_fns(shared, intdup, intdup, hashtable_item_free, hashtable_item_free);
+
+    pthread_t threads[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, counter_thread, NULL);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    ss_info_dassert(shardedhash_size(shared) == N_KEYS, "Every key should be added once");
+
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        int* value = (int*)shardedhash_fetch(shared, &i);
+        ss_info_dassert(value && *value == N_THREADS * N_ROUNDS,
+                        "Every thread should have updated the same value");
+    }
+
+    shardedhash_free(shared);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
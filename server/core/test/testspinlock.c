@@ -36,6 +36,8 @@
 #include <maxscale/spinlock.h>
 #include <maxscale/thread.h>
 
+#include "../maxscale/spinlock.h"
+
 
 /**
  * test1    spinlock_acquire_nowait tests
@@ -245,6 +247,59 @@ test3()
     return 0 == failures ? 0 : 1;
 }
 
+static bool find_counters(const SPINLOCK_COUNTERS *counters, void *data)
+{
+    const SPINLOCK_COUNTERS **found = (const SPINLOCK_COUNTERS **)data;
+
+    if (strcmp(counters->name, "test4") == 0)
+    {
+        *found = counters;
+    }
+
+    return *found == NULL;
+}
+
+/**
+ * test4    contention counters of named locks
+ *
+ * Hold a named lock long enough for a second thread to give up spinning
+ * and sleep, then check that the acquisitions and the wait were counted.
+ */
+static int
+test4()
+{
+    SPINLOCK    lck;
+    THREAD      handle;
+    struct timespec sleeptime;
+    const SPINLOCK_COUNTERS *counters = NULL;
+
+    sleeptime.tv_sec = 1;
+    sleeptime.tv_nsec = 0;
+
+    spinlock_init(&lck);
+    spinlock_set_name(&lck, "test4");
+    spinlock_foreach_named(find_counters, &counters);
+
+    if (counters == NULL || counters->acquired != 0)
+    {
+        fprintf(stderr, "spinlock: test 4.1 failed.\n");
+        return 1;
+    }
+
+    spinlock_acquire(&lck);
+    thread_start(&handle, test2_helper, (void *)&lck);
+    nanosleep(&sleeptime, NULL);
+    spinlock_release(&lck);
+    thread_wait(handle);
+
+    if (counters->acquired != 2 || counters->contended != 1 || counters->parked < 1)
+    {
+        fprintf(stderr, "spinlock: test 4.2 failed.\n");
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -252,6 +307,7 @@ int main(int argc, char **argv)
     result += test1();
     result += test2();
     result += test3();
+    result += test4();
 
     exit(result);
 }
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <maxscale/config.h>
+#include <maxscale/debug.h>
+
+#include "../maxscale/statistics.h"
+
+#define N_THREADS 4
+#define N_VALUES  100000
+
+/**
+ * Check that a value is within the error of the histogram from the expected value
+ */
+static bool is_close(int64_t value, int64_t expected)
+{
+    return value >= expected - expected / 32 - 1 && value <= expected + expected / 32 + 1;
+}
+
+/**
+ * Test the percentiles of the values of a single thread
+ */
+static int test1()
+{
+    ts_hist_t hist = ts_hist_alloc();
+    ss_info_dassert(hist, "Histogram should be allocated");
+    ss_info_dassert(ts_hist_count(hist) == 0, "New histogram should be empty");
+    ss_info_dassert(ts_hist_percentile(hist, 50) == 0, "Empty histogram should return zero");
+
+    for (int i = 1; i <= 10; i++)
+    {
+        ts_hist_add(hist, i, 0);
+    }
+
+    ss_info_dassert(ts_hist_count(hist) == 10, "All values should be counted");
+    ss_info_dassert(ts_hist_percentile(hist, 50) == 5, "Small values should be exact");
+    ss_info_dassert(ts_hist_percentile(hist, 100) == 10, "Largest value should be exact");
+    ss_info_dassert(ts_hist_percentile(hist, 0) == 1, "Smallest value should be exact");
+    ts_hist_free(hist);
+
+    hist = ts_hist_alloc();
+
+    for (int i = 1; i <= N_VALUES; i++)
+    {
+        ts_hist_add(hist, i, 0);
+    }
+
+    ss_info_dassert(is_close(ts_hist_percentile(hist, 50), N_VALUES / 2), "Median should be close");
+    ss_info_dassert(is_close(ts_hist_percentile(hist, 99), N_VALUES / 100 * 99), "p99 should be close");
+    ss_info_dassert(ts_hist_percentile(hist, 100) == N_VALUES, "Largest value should be exact");
+
+    ts_hist_add(hist, -5, 0);
+    ts_hist_add(hist, (int64_t)1 << 50, 0);
+    ss_info_dassert(ts_hist_count(hist) == N_VALUES + 2, "Values out of range should be counted");
+    ss_info_dassert(ts_hist_percentile(hist, 0) == 0, "Negative values should be counted as zero");
+    ts_hist_free(hist);
+
+    return 0;
+}
+
+static ts_hist_t shared;
+
+static void* adder_thread(void* data)
+{
+    int thread_id = (int)(intptr_t)data;
+
+    for (int i = 0; i < N_VALUES; i++)
+    {
+        ts_hist_add_lazy(&shared, 1000 * (thread_id + 1), thread_id);
+    }
+
+    return NULL;
+}
+
+/**
+ * Test that the histograms of the threads are combined
+ */
+static int test2()
+{
+    pthread_t threads[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, adder_thread, (void*)(intptr_t)i);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    ss_info_dassert(shared, "Histogram should be allocated by the first value");
+    ss_info_dassert(ts_hist_count(shared) == N_THREADS * N_VALUES, "Values of all threads should be counted");
+    ss_info_dassert(is_close(ts_hist_percentile(shared, 10), 1000), "Values of the first thread should be first");
+    ss_info_dassert(ts_hist_percentile(shared, 100) == 1000 * N_THREADS, "Largest value should be exact");
+
+    ts_hist_free(shared);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    config_get_global_options()->n_threads = N_THREADS;
+    ts_stats_init();
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
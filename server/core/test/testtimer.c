@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <maxscale/debug.h>
+#include <maxscale/hk_heartbeat.h>
+
+#include "../maxscale/poll.h"
+#include "../maxscale/timer.h"
+
+/** Timeouts around the boundaries of the levels and beyond the reach of the wheel */
+static const long timeouts[] =
+{
+    1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 262145,
+    (1L << 24) - 1, 1L << 24, (1L << 24) + 1000
+};
+
+#define N_TIMEOUTS (sizeof(timeouts) / sizeof(timeouts[0]))
+
+static MXS_TIMER timers[N_TIMEOUTS];
+static long expired_at[N_TIMEOUTS];
+
+static void record_expiry(MXS_TIMER *timer, void *data)
+{
+    expired_at[(intptr_t)data] = hkheartbeat;
+}
+
+static void advance(long ticks)
+{
+    for (long i = 0; i < ticks; i++)
+    {
+        hkheartbeat++;
+        mxs_timer_process(0);
+    }
+}
+
+/**
+ * Test that timers expire on the heartbeat they were set for
+ */
+static int test1()
+{
+    long start = hkheartbeat;
+
+    for (size_t i = 0; i < N_TIMEOUTS; i++)
+    {
+        mxs_timer_set(&timers[i], timeouts[i], record_expiry, (void*)(intptr_t)i);
+        ss_info_dassert(mxs_timer_is_set(&timers[i]), "Timer should be set");
+    }
+
+    ss_info_dassert(mxs_timer_count(0) == N_TIMEOUTS, "All timers should be counted");
+    advance(timeouts[N_TIMEOUTS - 1]);
+    ss_info_dassert(mxs_timer_count(0) == 0, "All timers should have expired");
+
+    for (size_t i = 0; i < N_TIMEOUTS; i++)
+    {
+        ss_info_dassert(!mxs_timer_is_set(&timers[i]), "Expired timer should not be set");
+        ss_info_dassert(expired_at[i] == start + timeouts[i], "Timer should expire on time");
+    }
+
+    return 0;
+}
+
+/**
+ * Test that cancelled timers do not expire
+ */
+static int test2()
+{
+    for (size_t i = 0; i < N_TIMEOUTS; i++)
+    {
+        expired_at[i] = 0;
+        mxs_timer_set(&timers[i], timeouts[i] % 5000 + 1, record_expiry, (void*)(intptr_t)i);
+    }
+
+    for (size_t i = 0; i < N_TIMEOUTS; i += 2)
+    {
+        mxs_timer_cancel(&timers[i]);
+    }
+
+    mxs_timer_cancel(&timers[0]);
+    advance(5001);
+    ss_info_dassert(mxs_timer_count(0) == 0, "All timers should have expired or been cancelled");
+
+    for (size_t i = 0; i < N_TIMEOUTS; i++)
+    {
+        ss_info_dassert((expired_at[i] == 0) == (i % 2 == 0), "Only the timers left set should expire");
+    }
+
+    return 0;
+}
+
+static int n_periodic = 0;
+
+static void periodic(MXS_TIMER *timer, void *data)
+{
+    n_periodic++;
+    /** A timer set for as far as the first level reaches must not expire again right away */
+    mxs_timer_set(timer, 64, periodic, data);
+    /** Cancelling a timer that expired on the same heartbeat prevents its expiration */
+    mxs_timer_cancel((MXS_TIMER*)data);
+}
+
+/**
+ * Test that expiring timers can set and cancel timers
+ */
+static int test3()
+{
+    MXS_TIMER timer = {0};
+    MXS_TIMER victim = {0};
+
+    expired_at[0] = 0;
+    mxs_timer_set(&victim, 10, record_expiry, (void*)0);
+    mxs_timer_set(&timer, 10, periodic, &victim);
+    advance(10 + 64 * 9);
+
+    ss_info_dassert(n_periodic == 10, "Periodic timer should expire every 64 heartbeats");
+    ss_info_dassert(expired_at[0] == 0, "Cancelled timer should not expire");
+    ss_info_dassert(mxs_timer_count(0) == 1, "Periodic timer should be set");
+
+    mxs_timer_cancel(&timer);
+    ss_info_dassert(mxs_timer_count(0) == 0, "No timers should be set");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    current_thread_id = 0;
+    hkheartbeat = 1000;
+    mxs_timer_init(1);
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -59,6 +59,11 @@ uint32_t get_parser_trx_type_mask(GWBUF* pBuf)
     return qc_get_trx_type_mask_using(pBuf, QC_TRX_PARSE_USING_PARSER);
 }
 
+uint32_t get_parser_session_type_mask(GWBUF* pBuf)
+{
+    return qc_get_session_type_mask(pBuf);
+}
+
 }
 
 namespace
@@ -105,6 +110,36 @@ struct test_case
 
 const size_t N_TEST_CASES = sizeof(test_cases)/sizeof(test_cases[0]);
 
+// The complete type masks of statements recognized by the parser.
+test_case session_test_cases[] =
+{
+    { "BEGIN", QUERY_TYPE_BEGIN_TRX },
+    { "COMMIT", QUERY_TYPE_COMMIT },
+    { "START TRANSACTION READ ONLY", QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_READ },
+    { "SET AUTOCOMMIT=1", QUERY_TYPE_GSYSVAR_WRITE|QUERY_TYPE_COMMIT|QUERY_TYPE_ENABLE_AUTOCOMMIT },
+    { "SET AUTOCOMMIT=0", QUERY_TYPE_GSYSVAR_WRITE|QUERY_TYPE_BEGIN_TRX|QUERY_TYPE_DISABLE_AUTOCOMMIT },
+
+    { "SET TRANSACTION ISOLATION LEVEL READ COMMITTED", QUERY_TYPE_WRITE },
+    { "SET SESSION TRANSACTION READ ONLY", QUERY_TYPE_GSYSVAR_WRITE },
+    { "SET GLOBAL TRANSACTION ISOLATION LEVEL SERIALIZABLE", QUERY_TYPE_GSYSVAR_WRITE },
+
+    { "USE test", QUERY_TYPE_SESSION_WRITE },
+    { "USE `test`", QUERY_TYPE_SESSION_WRITE },
+
+    { "XA START 'xid'", QUERY_TYPE_BEGIN_TRX },
+    { "XA BEGIN 'xid'", QUERY_TYPE_BEGIN_TRX },
+    { "XA END 'xid'", QUERY_TYPE_WRITE },
+    { "XA PREPARE 'xid'", QUERY_TYPE_WRITE },
+    { "XA COMMIT 'xid' ONE PHASE", QUERY_TYPE_COMMIT },
+    { "XA ROLLBACK 'xid'", QUERY_TYPE_ROLLBACK },
+    { "XA RECOVER", QUERY_TYPE_WRITE },
+
+    { "SELECT 1", 0 },
+    { "SET @a=1", 0 },
+};
+
+const size_t N_SESSION_TEST_CASES = sizeof(session_test_cases)/sizeof(session_test_cases[0]);
+
 
 bool test(uint32_t (*getter)(GWBUF*), const char* zStmt, uint32_t expected_type_mask)
 {
@@ -356,6 +391,37 @@ bool test(uint32_t (*getter)(GWBUF*), bool dont_bail_out)
     return rc;
 }
 
+bool test_session(bool dont_bail_out)
+{
+    bool rc = true;
+
+    test_case* pTest = session_test_cases;
+    test_case* pEnd  = pTest + N_SESSION_TEST_CASES;
+
+    while ((pTest < pEnd) && (dont_bail_out || rc))
+    {
+        string base(pTest->zStmt);
+        cout << base << endl;
+
+        if (!test(get_parser_session_type_mask, base.c_str(), pTest->type_mask))
+        {
+            rc = false;
+        }
+
+        string lc(base);
+        transform(lc.begin(), lc.end(), lc.begin(), ::tolower);
+
+        if (!test(get_parser_session_type_mask, lc.c_str(), pTest->type_mask))
+        {
+            rc = false;
+        }
+
+        ++pTest;
+    }
+
+    return rc;
+}
+
 }
 
 namespace
@@ -445,6 +511,14 @@ int main(int argc, char* argv[])
                         rc = EXIT_FAILURE;
                     }
                     cout << endl;
+
+                    cout << "Parser, session" << endl;
+                    cout << "===============" << endl;
+                    if (!test_session(dont_bail_out))
+                    {
+                        rc = EXIT_FAILURE;
+                    }
+                    cout << endl;
                 }
 
                 qc_process_end(QC_INIT_BOTH);
@@ -11,6 +11,8 @@
  * Public License.
  */
 #include <maxscale/thread.h>
+#include <sched.h>
+#include <stdbool.h>
 
 /**
  * @file thread.c  - Implementation of thread related operations
@@ -25,6 +27,23 @@
  */
 
 
+static cpu_set_t default_cpus;      /*< The CPUs new threads may run on */
+static bool      default_cpus_set;  /*< Whether default_cpus is used */
+
+/**
+ * Remember the CPU affinity of the calling thread
+ *
+ * The threads started after this run on the same CPUs instead of inheriting
+ * the affinity of the thread that starts them. This keeps e.g. the monitors
+ * started by a polling thread that is bound to one CPU from being bound to
+ * that CPU.
+ */
+void thread_save_affinity()
+{
+    CPU_ZERO(&default_cpus);
+    default_cpus_set = pthread_getaffinity_np(pthread_self(), sizeof(default_cpus), &default_cpus) == 0;
+}
+
 /**
  * Start a polling thread
  *
@@ -35,11 +54,23 @@
  */
 THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg)
 {
-    if (pthread_create(thd, NULL, (void *(*)(void *))entry, arg) != 0)
+    pthread_attr_t attr;
+    pthread_attr_t *attrp = NULL;
+
+    if (default_cpus_set && pthread_attr_init(&attr) == 0)
+    {
+        attrp = &attr;
+        pthread_attr_setaffinity_np(attrp, sizeof(default_cpus), &default_cpus);
+    }
+
+    int rc = pthread_create(thd, attrp, (void *(*)(void *))entry, arg);
+
+    if (attrp)
     {
-        return NULL;
+        pthread_attr_destroy(attrp);
     }
-    return thd;
+
+    return rc == 0 ? thd : NULL;
 }
 
 /**
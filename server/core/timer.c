@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file timer.c Hierarchical timer wheels of the polling threads
+ *
+ * Each wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots. A slot
+ * on the first level holds the timers that expire on one heartbeat, a slot on
+ * the second level the timers of TIMER_WHEEL_SIZE heartbeats and so on. When
+ * the first level has gone round, the next slot of the second level is
+ * cascaded, i.e. its timers are moved to the first level, and likewise for
+ * the higher levels. Timers that expire further away than the wheel reaches
+ * are kept on the last level and cascaded until they are due.
+ */
+
+#include "maxscale/timer.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/debug.h>
+#include <maxscale/hk_heartbeat.h>
+
+#include "maxscale/poll.h"
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SIZE   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+/** How far away the wheel reaches, about 19 days */
+#define TIMER_WHEEL_MAX    ((1L << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+typedef struct timer_wheel
+{
+    long       now;   /*< The next heartbeat to process */
+    int        count; /*< Number of timers set */
+    MXS_TIMER *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+} TIMER_WHEEL;
+
+static TIMER_WHEEL *wheels = NULL;
+
+bool mxs_timer_init(int n_threads)
+{
+    ss_dassert(wheels == NULL);
+
+    if ((wheels = (TIMER_WHEEL*)MXS_CALLOC(n_threads, sizeof(TIMER_WHEEL))))
+    {
+        for (int i = 0; i < n_threads; i++)
+        {
+            wheels[i].now = hkheartbeat;
+        }
+    }
+
+    return wheels != NULL;
+}
+
+/**
+ * Put a timer into the slot of the wheel that its expiration falls into
+ */
+static void timer_wheel_insert(TIMER_WHEEL *wheel, MXS_TIMER *timer)
+{
+    long delta = timer->expires - wheel->now;
+    MXS_TIMER **slot;
+
+    if (delta < 0)
+    {
+        /** Already due, it expires when the next heartbeat is processed */
+        slot = &wheel->slots[0][wheel->now & TIMER_WHEEL_MASK];
+    }
+    else
+    {
+        long expires = timer->expires;
+        int level = 0;
+
+        if (delta > TIMER_WHEEL_MAX)
+        {
+            expires = wheel->now + TIMER_WHEEL_MAX;
+            level = TIMER_WHEEL_LEVELS - 1;
+        }
+        else
+        {
+            while (delta >= (1L << ((level + 1) * TIMER_WHEEL_BITS)))
+            {
+                level++;
+            }
+        }
+
+        slot = &wheel->slots[level][(expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+    }
+
+    timer->next = *slot;
+
+    if (timer->next)
+    {
+        timer->next->pprev = &timer->next;
+    }
+
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+/**
+ * Move the timers of the current slot of a level to the lower levels
+ *
+ * @return The index of the slot
+ */
+static int timer_wheel_cascade(TIMER_WHEEL *wheel, int level)
+{
+    int index = (wheel->now >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    MXS_TIMER *timer = wheel->slots[level][index];
+
+    wheel->slots[level][index] = NULL;
+
+    while (timer)
+    {
+        MXS_TIMER *next = timer->next;
+        timer_wheel_insert(wheel, timer);
+        timer = next;
+    }
+
+    return index;
+}
+
+void mxs_timer_set(MXS_TIMER *timer, long ticks, MXS_TIMER_FN func, void *data)
+{
+    ss_dassert(wheels && current_thread_id >= 0);
+    ss_dassert(ticks > 0);
+
+    mxs_timer_cancel(timer);
+
+    TIMER_WHEEL *wheel = &wheels[current_thread_id];
+
+    timer->expires = hkheartbeat + (ticks > 0 ? ticks : 1);
+    timer->func = func;
+    timer->data = data;
+    timer->thread = current_thread_id;
+
+    timer_wheel_insert(wheel, timer);
+    wheel->count++;
+}
+
+void mxs_timer_cancel(MXS_TIMER *timer)
+{
+    if (timer->pprev)
+    {
+        ss_dassert(timer->thread == current_thread_id);
+
+        *timer->pprev = timer->next;
+
+        if (timer->next)
+        {
+            timer->next->pprev = timer->pprev;
+        }
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+        wheels[timer->thread].count--;
+    }
+}
+
+void mxs_timer_process(int thread_id)
+{
+    TIMER_WHEEL *wheel = &wheels[thread_id];
+    long heartbeat = hkheartbeat;
+
+    if (wheel->count == 0)
+    {
+        /** Nothing to cascade or expire, the wheel can skip ahead */
+        if (wheel->now <= heartbeat)
+        {
+            wheel->now = heartbeat + 1;
+        }
+        return;
+    }
+
+    while (wheel->now <= heartbeat)
+    {
+        int index = wheel->now & TIMER_WHEEL_MASK;
+
+        /** When a level has gone round, cascade the next slot of the level above */
+        for (int level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++)
+        {
+            index = timer_wheel_cascade(wheel, level);
+        }
+
+        index = wheel->now & TIMER_WHEEL_MASK;
+        wheel->now++;
+
+        /** The slot is emptied first so that the timers set by the functions
+         * do not expire now. The timers are removed from the expired list one
+         * at a time as a function can cancel any of the timers of the thread,
+         * including the ones that have expired but not yet been handled. */
+        MXS_TIMER *expired = wheel->slots[0][index];
+        MXS_TIMER *timer;
+
+        wheel->slots[0][index] = NULL;
+
+        if (expired)
+        {
+            expired->pprev = &expired;
+        }
+
+        while ((timer = expired))
+        {
+            mxs_timer_cancel(timer);
+            timer->func(timer, timer->data);
+        }
+    }
+}
+
+int mxs_timer_count(int thread_id)
+{
+    return wheels[thread_id].count;
+}
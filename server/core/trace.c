@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file trace.c Binary tracepoints
+ *
+ * Each polling thread writes its records to a ring buffer of its own, so
+ * recording needs no locks. A reader can read a buffer while the thread is
+ * writing to it: the sequence number of a record is cleared before the
+ * record is modified and set when it is complete, and a record is shown only
+ * if its sequence number is the expected one both before and after it was
+ * copied.
+ */
+
+#include "maxscale/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/dcb.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+#include <maxscale/session.h>
+
+/** The maximum length of a formatted record */
+#define TRACE_LINE_LEN 512
+
+typedef struct trace_record
+{
+    uint64_t              seq;     /*< Index of the record plus one, 0 while it is written */
+    const MXS_TRACEPOINT *tp;      /*< The tracepoint */
+    uint64_t              time;    /*< CLOCK_MONOTONIC time in nanoseconds */
+    uint64_t              session; /*< The current session */
+    intptr_t              args[MXS_TRACE_MAX_ARGS];
+} TRACE_RECORD;
+
+/**
+ * The trace buffer of one polling thread. Only the owning thread writes to it.
+ */
+typedef struct trace_buffer
+{
+    TRACE_RECORD *records;   /*< The ring of records */
+    uint64_t      mask;      /*< The number of records minus one */
+    uint64_t      next;      /*< The index of the next record */
+    int           thread_id; /*< The owning thread */
+    char          pad[36];   /*< Keeps the buffers on separate cache lines */
+} TRACE_BUFFER;
+
+bool mxs_trace_enabled = false;
+
+static TRACE_BUFFER *trace_buffers = NULL;
+static int trace_n_buffers = 0;
+static thread_local TRACE_BUFFER *this_buffer = NULL;
+
+bool mxs_trace_init(int n_threads, int n_records)
+{
+    ss_dassert(trace_buffers == NULL);
+
+    if (n_records <= 0)
+    {
+        return true;
+    }
+
+    uint64_t size = 1;
+
+    while (size < (uint64_t)n_records)
+    {
+        size <<= 1;
+    }
+
+    if ((trace_buffers = (TRACE_BUFFER *)MXS_CALLOC(n_threads, sizeof(TRACE_BUFFER))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        trace_buffers[i].records = (TRACE_RECORD *)MXS_CALLOC(size, sizeof(TRACE_RECORD));
+
+        if (trace_buffers[i].records == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                MXS_FREE(trace_buffers[j].records);
+            }
+
+            MXS_FREE(trace_buffers);
+            trace_buffers = NULL;
+            return false;
+        }
+
+        trace_buffers[i].mask = size - 1;
+        trace_buffers[i].thread_id = i;
+    }
+
+    trace_n_buffers = n_threads;
+    mxs_trace_enabled = true;
+
+    return true;
+}
+
+void mxs_trace_thread_init(int thread_id)
+{
+    if (trace_buffers && thread_id >= 0 && thread_id < trace_n_buffers)
+    {
+        this_buffer = &trace_buffers[thread_id];
+    }
+}
+
+void mxs_trace_record(const MXS_TRACEPOINT *tp, intptr_t arg1, intptr_t arg2,
+                      intptr_t arg3, intptr_t arg4)
+{
+    TRACE_BUFFER *buffer = this_buffer;
+
+    if (buffer)
+    {
+        uint64_t index = buffer->next;
+        TRACE_RECORD *record = &buffer->records[index & buffer->mask];
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        atomic_store_uint64(&record->seq, 0);
+        atomic_synchronize();
+
+        record->tp = tp;
+        record->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        record->session = session_get_current_id();
+        record->args[0] = arg1;
+        record->args[1] = arg2;
+        record->args[2] = arg3;
+        record->args[3] = arg4;
+
+        atomic_store_uint64(&record->seq, index + 1);
+        atomic_store_uint64(&buffer->next, index + 1);
+    }
+}
+
+/**
+ * Copy a record from a buffer
+ *
+ * @param buffer The buffer
+ * @param index  The index of the record
+ * @param dest   Where to copy the record
+ *
+ * @return True if the record was copied, false if it was being overwritten
+ */
+static bool trace_read(TRACE_BUFFER *buffer, uint64_t index, TRACE_RECORD *dest)
+{
+    TRACE_RECORD *record = &buffer->records[index & buffer->mask];
+    uint64_t seq = atomic_load_uint64(&record->seq);
+
+    memcpy(dest, record, sizeof(*dest));
+    atomic_synchronize();
+
+    return seq == index + 1 && atomic_load_uint64(&record->seq) == seq;
+}
+
+/**
+ * Format a record
+ *
+ * @param buffer The buffer the record was read from
+ * @param record The record
+ * @param dest   Where to write the text
+ * @param size   The size of @c dest
+ */
+static void trace_format(const TRACE_BUFFER *buffer, const TRACE_RECORD *record,
+                         char *dest, size_t size)
+{
+    int len = snprintf(dest, size, "%lu.%09lu thread %d session %lu %s: ",
+                       record->time / 1000000000, record->time % 1000000000,
+                       buffer->thread_id, record->session, record->tp->name);
+
+    if (len >= 0 && (size_t)len < size)
+    {
+        snprintf(dest + len, size - len, record->tp->format, record->args[0],
+                 record->args[1], record->args[2], record->args[3]);
+    }
+}
+
+/**
+ * Call a function for each record of a buffer, oldest first
+ *
+ * @param buffer The buffer
+ * @param func   The function to call with the formatted record
+ * @param data   Data passed to the function
+ */
+static void trace_for_each(TRACE_BUFFER *buffer, void (*func)(void *, const char *), void *data)
+{
+    uint64_t end = atomic_load_uint64(&buffer->next);
+    uint64_t size = buffer->mask + 1;
+
+    for (uint64_t i = end > size ? end - size : 0; i < end; i++)
+    {
+        TRACE_RECORD record;
+
+        if (trace_read(buffer, i, &record))
+        {
+            char line[TRACE_LINE_LEN];
+            trace_format(buffer, &record, line, sizeof(line));
+            func(data, line);
+        }
+    }
+}
+
+static void trace_print_line(void *data, const char *line)
+{
+    dcb_printf((DCB *)data, "%s\n", line);
+}
+
+void dprintTrace(DCB *dcb)
+{
+    dcb_printf(dcb, "Trace records.\n\n");
+
+    if (!mxs_trace_enabled)
+    {
+        dcb_printf(dcb, "Tracing is not enabled.\n");
+        return;
+    }
+
+    for (int i = 0; i < trace_n_buffers; i++)
+    {
+        trace_for_each(&trace_buffers[i], trace_print_line, dcb);
+    }
+}
+
+static void trace_log_line(void *data, const char *line)
+{
+    MXS_ALERT("  %s", line);
+}
+
+void mxs_trace_log_thread()
+{
+    if (this_buffer)
+    {
+        MXS_ALERT("Trace records of thread %d:", this_buffer->thread_id);
+        trace_for_each(this_buffer, trace_log_line, NULL);
+    }
+}
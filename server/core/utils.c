@@ -33,6 +33,7 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <regex.h>
+#include <sched.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -41,6 +42,7 @@
 #include <openssl/sha.h>
 
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/limits.h>
@@ -920,9 +922,24 @@ static bool configure_network_socket(int so)
         return false;
     }
 
+    set_busy_poll(so);
+
     return setnonblocking(so) == 0;
 }
 
+void set_busy_poll(int so)
+{
+    static bool warned = false;
+    int usecs = config_get_global_options()->busy_poll;
+
+    if (usecs > 0 && setsockopt(so, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0 && !warned)
+    {
+        MXS_WARNING("Failed to set SO_BUSY_POLL, busy polling is not used: %d, %s",
+                    errno, mxs_strerror(errno));
+        warned = true;
+    }
+}
+
 static bool configure_listener_socket(int so)
 {
     int one = 1;
@@ -1002,6 +1019,167 @@ int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr
     return so;
 }
 
+int open_unix_socket(struct sockaddr_un *addr, const char *path)
+{
+    int sndbufsize = MXS_BACKEND_SO_SNDBUF;
+    int rcvbufsize = MXS_BACKEND_SO_RCVBUF;
+    int so;
+
+    if (strlen(path) > sizeof(addr->sun_path) - 1)
+    {
+        MXS_ERROR("The path %s of the UNIX domain socket is too long. "
+                  "The maximum length is %lu.", path, sizeof(addr->sun_path) - 1);
+        return -1;
+    }
+
+    if ((so = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        MXS_ERROR("Can't create UNIX socket: %d, %s", errno, mxs_strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(so, SOL_SOCKET, SO_SNDBUF, &sndbufsize, sizeof(sndbufsize)) != 0 ||
+        setsockopt(so, SOL_SOCKET, SO_RCVBUF, &rcvbufsize, sizeof(rcvbufsize)) != 0)
+    {
+        MXS_ERROR("Failed to set socket option: %d, %s.", errno, mxs_strerror(errno));
+        close(so);
+        return -1;
+    }
+
+    if (setnonblocking(so) != 0)
+    {
+        close(so);
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return so;
+}
+
+/**
+ * Set an integer socket option and log a failure
+ */
+static void set_int_sockopt(int so, int level, int optname, const char *name, int value)
+{
+    if (setsockopt(so, level, optname, &value, sizeof(value)) != 0)
+    {
+        MXS_ERROR("Failed to set socket option %s to %d: %d, %s.",
+                  name, value, errno, mxs_strerror(errno));
+    }
+}
+
+void socket_opts_apply(int so, const MXS_SOCKET_OPTS *opts, enum mxs_socket_type type)
+{
+    int domain = AF_UNSPEC;
+    socklen_t len = sizeof(domain);
+    getsockopt(so, SOL_SOCKET, SO_DOMAIN, &domain, &len);
+    bool tcp = domain == AF_INET || domain == AF_INET6;
+
+    if (type == MXS_SOCKET_LISTENER)
+    {
+        if (tcp && opts->defer_accept > 0)
+        {
+            set_int_sockopt(so, IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT", opts->defer_accept);
+        }
+
+        if (tcp && opts->fastopen > 0)
+        {
+            set_int_sockopt(so, IPPROTO_TCP, TCP_FASTOPEN, "TCP_FASTOPEN", opts->fastopen);
+        }
+
+        return;
+    }
+
+    if (opts->sndbuf > 0)
+    {
+        set_int_sockopt(so, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", opts->sndbuf);
+    }
+
+    if (opts->rcvbuf > 0)
+    {
+        set_int_sockopt(so, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", opts->rcvbuf);
+    }
+
+    if (opts->priority >= 0)
+    {
+        set_int_sockopt(so, SOL_SOCKET, SO_PRIORITY, "SO_PRIORITY", opts->priority);
+    }
+
+    if (!tcp)
+    {
+        return;
+    }
+
+    if (opts->nodelay >= 0)
+    {
+        set_int_sockopt(so, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", opts->nodelay);
+    }
+
+    if (opts->quickack >= 0)
+    {
+        set_int_sockopt(so, IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", opts->quickack);
+    }
+
+    if (opts->keepalive > 0)
+    {
+        set_int_sockopt(so, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE", 1);
+        set_int_sockopt(so, IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE", opts->keepalive);
+    }
+
+#ifdef TCP_FASTOPEN_CONNECT
+    if (type == MXS_SOCKET_NETWORK && opts->fastopen > 0)
+    {
+        set_int_sockopt(so, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, "TCP_FASTOPEN_CONNECT", 1);
+    }
+#endif
+}
+
+void write_socket_opts_config(int fd, const MXS_SOCKET_OPTS *opts)
+{
+    if (opts->sndbuf > 0)
+    {
+        dprintf(fd, "send_buffer_size=%d\n", opts->sndbuf);
+    }
+
+    if (opts->rcvbuf > 0)
+    {
+        dprintf(fd, "receive_buffer_size=%d\n", opts->rcvbuf);
+    }
+
+    if (opts->nodelay >= 0)
+    {
+        dprintf(fd, "tcp_nodelay=%s\n", opts->nodelay ? "true" : "false");
+    }
+
+    if (opts->quickack >= 0)
+    {
+        dprintf(fd, "tcp_quickack=%s\n", opts->quickack ? "true" : "false");
+    }
+
+    if (opts->defer_accept > 0)
+    {
+        dprintf(fd, "tcp_defer_accept=%d\n", opts->defer_accept);
+    }
+
+    if (opts->fastopen > 0)
+    {
+        dprintf(fd, "tcp_fastopen=%d\n", opts->fastopen);
+    }
+
+    if (opts->keepalive > 0)
+    {
+        dprintf(fd, "tcp_keepalive=%d\n", opts->keepalive);
+    }
+
+    if (opts->priority >= 0)
+    {
+        dprintf(fd, "socket_priority=%d\n", opts->priority);
+    }
+}
+
 /**
  * Return the number of processors available.
  * @return Number of processors or 1 if the required definition of _SC_NPROCESSORS_CONF
@@ -1021,3 +1199,192 @@ long get_processor_count()
 #endif
     return processors;
 }
+
+/**
+ * Parse a list of CPUs
+ *
+ * The list is in the format used by Linux, e.g. "0-3,8,10-11".
+ *
+ * @param str      The list to parse
+ * @param cpus     Array where the CPUs are stored in the order they are listed
+ * @param max_cpus Size of @c cpus, the CPUs that do not fit are ignored
+ * @return Number of CPUs stored or -1 if the list is invalid
+ */
+int mxs_parse_cpu_list(const char *str, int *cpus, int max_cpus)
+{
+    int n = 0;
+    const char *ptr = str;
+
+    while (*ptr)
+    {
+        char *end;
+        long first = strtol(ptr, &end, 10);
+        long last = first;
+
+        if (end == ptr || first < 0)
+        {
+            return -1;
+        }
+
+        if (*end == '-')
+        {
+            ptr = end + 1;
+            last = strtol(ptr, &end, 10);
+
+            if (end == ptr || last < first)
+            {
+                return -1;
+            }
+        }
+
+        if (last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+
+        for (long cpu = first; cpu <= last && n < max_cpus; cpu++)
+        {
+            cpus[n++] = cpu;
+        }
+
+        ptr = end;
+
+        if (*ptr == ',')
+        {
+            ptr++;
+        }
+        else if (*ptr && !isspace(*ptr))
+        {
+            return -1;
+        }
+
+        while (isspace(*ptr))
+        {
+            ptr++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Read the CPUs of a NUMA node from sysfs
+ *
+ * @param node     The node
+ * @param cpus     Array where the CPUs are stored
+ * @param max_cpus Size of @c cpus
+ * @return Number of CPUs stored or -1 if the node does not exist
+ */
+static int numa_node_cpus(int node, int *cpus, int max_cpus)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    int n = -1;
+
+    if (file)
+    {
+        char line[4096];
+
+        if (fgets(line, sizeof(line), file))
+        {
+            n = mxs_parse_cpu_list(line, cpus, max_cpus);
+        }
+
+        fclose(file);
+    }
+
+    return n;
+}
+
+/**
+ * List the CPUs the process can run on, spread over the NUMA nodes
+ *
+ * The list takes the first CPU of each node, then the second CPU of each
+ * node and so on. Assigning the CPUs of the list to threads in order spreads
+ * the threads evenly over the nodes. If the nodes cannot be read, the CPUs
+ * are listed in numerical order.
+ *
+ * @param cpus     Array where the CPUs are stored
+ * @param max_cpus Size of @c cpus
+ * @return Number of CPUs stored
+ */
+int mxs_numa_cpu_list(int *cpus, int max_cpus)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return 0;
+    }
+
+    int *node_cpus = MXS_MALLOC(CPU_SETSIZE * sizeof(int));
+    int node_start[CPU_SETSIZE];
+    int node_len[CPU_SETSIZE];
+    int n_nodes = 0;
+    int total = 0;
+
+    if (node_cpus == NULL)
+    {
+        return 0;
+    }
+
+    for (int node = 0; node < CPU_SETSIZE && total < CPU_SETSIZE; node++)
+    {
+        int n = numa_node_cpus(node, node_cpus + total, CPU_SETSIZE - total);
+
+        if (n < 0)
+        {
+            break;
+        }
+
+        /** Only the CPUs the process is allowed to use are listed */
+        int len = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (CPU_ISSET(node_cpus[total + i], &allowed))
+            {
+                node_cpus[total + len++] = node_cpus[total + i];
+            }
+        }
+
+        if (len > 0)
+        {
+            node_start[n_nodes] = total;
+            node_len[n_nodes] = len;
+            n_nodes++;
+            total += len;
+        }
+    }
+
+    int n = 0;
+
+    if (n_nodes == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE && n < max_cpus; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus[n++] = cpu;
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; n < total && n < max_cpus; i++)
+        {
+            for (int node = 0; node < n_nodes && n < max_cpus; node++)
+            {
+                if (i < node_len[node])
+                {
+                    cpus[n++] = node_cpus[node_start[node] + i];
+                }
+            }
+        }
+    }
+
+    MXS_FREE(node_cpus);
+    return n;
+}
@@ -31,6 +31,8 @@
 #include <mysqld_error.h>
 #include <maxscale/mysql_utils.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/paths.h>
 
 /** Don't include the root user */
@@ -128,131 +130,441 @@ static bool check_password(const char *output, uint8_t *token, size_t token_len,
     return memcmp(final_step, stored_token, stored_token_len) == 0;
 }
 
-/** Callback for check_database() */
-static int database_cb(void *data, int columns, char** rows, char** row_names)
+static bool no_password_required(const char *result, size_t tok_len)
 {
-    bool *rval = (bool*)data;
-    *rval = true;
-    return 0;
+    return *result == '\0' && tok_len == 0;
 }
 
-static bool check_database(sqlite3 *handle, const char *database)
+/** How a grant matches the client host */
+typedef enum host_match
 {
-    bool rval = true;
+    HOST_MATCH_ANY,     /**< The host is '%' */
+    HOST_MATCH_EXACT,   /**< The host has no wildcards */
+    HOST_MATCH_PREFIX,  /**< The host has one '%' at the end, e.g. '192.168.%' */
+    HOST_MATCH_PATTERN  /**< The host needs to be matched with LIKE semantics */
+} host_match_t;
+
+/** A row of the users table */
+typedef struct mysql_auth_grant
+{
+    const char *user;
+    const char *host;
+    const char *db;                /**< NULL if the grant is not for a database */
+    const char *password;          /**< Empty if the user has no password */
+    bool anydb;
+    host_match_t host_match;
+    size_t prefix_len;             /**< Length of the host without the wildcard */
+    struct mysql_auth_grant *next; /**< The next grant in the same bucket */
+} MYSQL_AUTH_GRANT;
+
+/** A row of the databases table */
+typedef struct mysql_auth_db
+{
+    const char *db;
+    struct mysql_auth_db *next;
+} MYSQL_AUTH_DB;
+
+struct mysql_auth_users
+{
+    int refcount;
+    size_t n_grants;             /**< Number of buckets in @c grants, a power of two */
+    MYSQL_AUTH_GRANT **grants;   /**< Grants hashed by user name */
+    size_t n_databases;          /**< Number of buckets in @c databases, a power of two */
+    MYSQL_AUTH_DB **databases;   /**< Databases hashed by name */
+};
+
+/**
+ * Match a string against a pattern the same way as SQLite's LIKE does: '%'
+ * matches any sequence, '_' any single character and ASCII letters are
+ * compared case-insensitively.
+ */
+static bool like_match(const char *pattern, const char *str)
+{
+    const char *retry_pattern = NULL;
+    const char *retry_str = NULL;
 
-    if (*database)
+    while (*str)
     {
-        rval = false;
-        size_t len = sizeof(mysqlauth_validate_database_query) + strlen(database) + 1;
-        char sql[len];
+        if (*pattern == '%')
+        {
+            retry_pattern = ++pattern;
+            retry_str = str;
+        }
+        else if (*pattern && (*pattern == '_' ||
+                              tolower((unsigned char)*pattern) == tolower((unsigned char)*str)))
+        {
+            pattern++;
+            str++;
+        }
+        else if (retry_pattern)
+        {
+            /** Let the last '%' match one more character */
+            pattern = retry_pattern;
+            str = ++retry_str;
+        }
+        else
+        {
+            return false;
+        }
+    }
 
-        sprintf(sql, mysqlauth_validate_database_query, database);
+    while (*pattern == '%')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+static bool host_matches(const MYSQL_AUTH_GRANT *grant, const char *host)
+{
+    switch (grant->host_match)
+    {
+    case HOST_MATCH_ANY:
+        return true;
 
-        char *err;
+    case HOST_MATCH_EXACT:
+        return strcasecmp(grant->host, host) == 0;
 
-        if (sqlite3_exec(handle, sql, database_cb, &rval, &err) != SQLITE_OK)
+    case HOST_MATCH_PREFIX:
+        return strncasecmp(grant->host, host, grant->prefix_len) == 0;
+
+    default:
+        return like_match(grant->host, host);
+    }
+}
+
+static bool db_matches(const MYSQL_AUTH_GRANT *grant, const char *db)
+{
+    return grant->anydb || *db == '\0' || (grant->db && like_match(grant->db, db));
+}
+
+static size_t bucket_count(size_t n_items)
+{
+    size_t rval = 1;
+
+    while (rval < n_items)
+    {
+        rval <<= 1;
+    }
+
+    return rval;
+}
+
+static size_t bucket_of(const char *name, size_t n_buckets)
+{
+    return (size_t)hashtable_item_strhash(name) & (n_buckets - 1);
+}
+
+/**
+ * Find the first grant, in the order the users were loaded in, that matches
+ * the user, host and database. A NULL host matches all hosts.
+ */
+static const MYSQL_AUTH_GRANT* find_grant(const MYSQL_AUTH_USERS *users, const char *user,
+                                          const char *host, const char *db)
+{
+    for (const MYSQL_AUTH_GRANT *grant = users->grants[bucket_of(user, users->n_grants)];
+         grant; grant = grant->next)
+    {
+        if (strcmp(grant->user, user) == 0 &&
+            (host == NULL || host_matches(grant, host)) &&
+            db_matches(grant, db))
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
-            rval = false;
+            return grant;
         }
     }
 
-    return rval;
+    return NULL;
 }
 
-static bool no_password_required(const char *result, size_t tok_len)
+static bool check_database(const MYSQL_AUTH_USERS *users, const char *database)
 {
-    return *result == '\0' && tok_len == 0;
+    if (*database == '\0')
+    {
+        return true;
+    }
+
+    for (const MYSQL_AUTH_DB *db = users->databases[bucket_of(database, users->n_databases)];
+         db; db = db->next)
+    {
+        if (strcmp(db->db, database) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-/** Used to detect empty result sets */
-struct user_query_result
+/** Copy a string to the end of a structure allocated in one piece */
+static const char* copy_string(char **dest, const char *src)
 {
-    bool ok;
-    char output[SHA_DIGEST_LENGTH * 2 + 1];
-};
+    char *rval = *dest;
+    size_t len = strlen(src) + 1;
+    memcpy(rval, src, len);
+    *dest += len;
+    return rval;
+}
 
-/** @brief Callback for sqlite3_exec() */
-static int auth_cb(void *data, int columns, char** rows, char** row_names)
+/** Callback for sqlite3_exec() that collects the grants in reverse order */
+static int grant_cb(void *data, int columns, char** rows, char** row_names)
 {
-    struct user_query_result *res = (struct user_query_result*)data;
-    strcpy(res->output, rows[0] ? rows[0] : "");
-    res->ok = true;
+    MYSQL_AUTH_GRANT **list = (MYSQL_AUTH_GRANT**)data;
+    const char *user = rows[0] ? rows[0] : "";
+    const char *host = rows[1] ? rows[1] : "";
+    const char *password = rows[4] ? rows[4] : "";
+    size_t len = sizeof(MYSQL_AUTH_GRANT) + strlen(user) + strlen(host) +
+                 strlen(password) + (rows[2] ? strlen(rows[2]) + 1 : 0) + 3;
+    MYSQL_AUTH_GRANT *grant = MXS_MALLOC(len);
+
+    if (grant == NULL)
+    {
+        return 1;
+    }
+
+    char *ptr = (char*)(grant + 1);
+    grant->user = copy_string(&ptr, user);
+    grant->host = copy_string(&ptr, host);
+    grant->password = copy_string(&ptr, password);
+    grant->db = rows[2] ? copy_string(&ptr, rows[2]) : NULL;
+    grant->anydb = rows[3] && strcmp(rows[3], "1") == 0;
+
+    const char *wildcard = strpbrk(host, "%_");
+
+    if (wildcard == NULL)
+    {
+        grant->host_match = HOST_MATCH_EXACT;
+    }
+    else if (wildcard[0] == '%' && wildcard[1] == '\0')
+    {
+        grant->prefix_len = wildcard - host;
+        grant->host_match = grant->prefix_len ? HOST_MATCH_PREFIX : HOST_MATCH_ANY;
+    }
+    else
+    {
+        grant->host_match = HOST_MATCH_PATTERN;
+    }
+
+    grant->next = *list;
+    *list = grant;
     return 0;
 }
 
-int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
-                        uint8_t *scramble, size_t scramble_len)
+/** Callback for sqlite3_exec() that collects the databases */
+static int db_cb(void *data, int columns, char** rows, char** row_names)
 {
-    sqlite3 *handle = instance->handle;
-    size_t len = sizeof(mysqlauth_validate_user_query) + strlen(session->user) * 2 +
-                 strlen(session->db) * 2 + MYSQL_HOST_MAXLEN + session->auth_token_len * 4 + 1;
-    char sql[len + 1];
-    int rval = MXS_AUTH_FAILED;
-    char *err;
+    MYSQL_AUTH_DB **list = (MYSQL_AUTH_DB**)data;
+    const char *name = rows[0] ? rows[0] : "";
+    MYSQL_AUTH_DB *db = MXS_MALLOC(sizeof(MYSQL_AUTH_DB) + strlen(name) + 1);
 
-    if (instance->skip_auth)
+    if (db == NULL)
     {
-        sprintf(sql, mysqlauth_skip_auth_query, session->user, session->db, session->db);
+        return 1;
     }
-    else
+
+    char *ptr = (char*)(db + 1);
+    db->db = copy_string(&ptr, name);
+    db->next = *list;
+    *list = db;
+    return 0;
+}
+
+static void free_users(MYSQL_AUTH_USERS *users)
+{
+    for (size_t i = 0; i < users->n_grants; i++)
+    {
+        MYSQL_AUTH_GRANT *grant = users->grants[i];
+
+        while (grant)
+        {
+            MYSQL_AUTH_GRANT *next = grant->next;
+            MXS_FREE(grant);
+            grant = next;
+        }
+    }
+
+    for (size_t i = 0; i < users->n_databases; i++)
     {
-        sprintf(sql, mysqlauth_validate_user_query, session->user, dcb->remote,
-                dcb->remote, session->db, session->db);
+        MYSQL_AUTH_DB *db = users->databases[i];
+
+        while (db)
+        {
+            MYSQL_AUTH_DB *next = db->next;
+            MXS_FREE(db);
+            db = next;
+        }
     }
 
-    struct user_query_result res = {};
+    MXS_FREE(users->grants);
+    MXS_FREE(users->databases);
+    MXS_FREE(users);
+}
+
+static MYSQL_AUTH_USERS* acquire_users(MYSQL_AUTH *instance)
+{
+    spinlock_acquire(&instance->users_lock);
+    MYSQL_AUTH_USERS *users = instance->users;
 
-    if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+    if (users)
     {
-        MXS_ERROR("Failed to execute auth query: %s", err);
+        atomic_add(&users->refcount, 1);
+    }
+
+    spinlock_release(&instance->users_lock);
+    return users;
+}
+
+static void release_users(MYSQL_AUTH_USERS *users)
+{
+    if (users && atomic_add(&users->refcount, -1) == 1)
+    {
+        free_users(users);
+    }
+}
+
+bool update_mysql_users(MYSQL_AUTH *instance)
+{
+    MYSQL_AUTH_GRANT *grants = NULL;
+    MYSQL_AUTH_DB *databases = NULL;
+    MYSQL_AUTH_USERS *users = MXS_CALLOC(1, sizeof(MYSQL_AUTH_USERS));
+    bool ok = users != NULL;
+    char *err;
+
+    if (ok && (sqlite3_exec(instance->handle, dump_users_query, grant_cb, &grants, &err) != SQLITE_OK ||
+               sqlite3_exec(instance->handle, dump_databases_query, db_cb, &databases, &err) != SQLITE_OK))
+    {
+        MXS_ERROR("Failed to read the loaded users: %s", err);
         sqlite3_free(err);
+        ok = false;
     }
 
-    /** Check for IPv6 mapped IPv4 address */
-    if (!res.ok && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
+    if (ok)
     {
-        const char *ipv4 = strrchr(dcb->remote, ':') + 1;
-        sprintf(sql, mysqlauth_validate_user_query, session->user, ipv4, ipv4,
-                session->db, session->db);
+        size_t n_grants = 0;
+        size_t n_databases = 0;
+
+        for (MYSQL_AUTH_GRANT *grant = grants; grant; grant = grant->next)
+        {
+            n_grants++;
+        }
 
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+        for (MYSQL_AUTH_DB *db = databases; db; db = db->next)
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
+            n_databases++;
         }
+
+        users->refcount = 1;
+        users->n_grants = bucket_count(n_grants);
+        users->n_databases = bucket_count(n_databases);
+        users->grants = MXS_CALLOC(users->n_grants, sizeof(MYSQL_AUTH_GRANT*));
+        users->databases = MXS_CALLOC(users->n_databases, sizeof(MYSQL_AUTH_DB*));
+
+        if (users->grants && users->databases)
+        {
+            /** The lists are in reverse order so pushing the items to the
+             * front of the buckets restores the order the rows were read in */
+            while (grants)
+            {
+                MYSQL_AUTH_GRANT *grant = grants;
+                grants = grant->next;
+                size_t i = bucket_of(grant->user, users->n_grants);
+                grant->next = users->grants[i];
+                users->grants[i] = grant;
+            }
+
+            while (databases)
+            {
+                MYSQL_AUTH_DB *db = databases;
+                databases = db->next;
+                size_t i = bucket_of(db->db, users->n_databases);
+                db->next = users->databases[i];
+                users->databases[i] = db;
+            }
+
+            spinlock_acquire(&instance->users_lock);
+            MYSQL_AUTH_USERS *old_users = instance->users;
+            instance->users = users;
+            spinlock_release(&instance->users_lock);
+
+            release_users(old_users);
+            users = NULL;
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    while (grants)
+    {
+        MYSQL_AUTH_GRANT *next = grants->next;
+        MXS_FREE(grants);
+        grants = next;
     }
 
-    if (!res.ok)
+    while (databases)
+    {
+        MYSQL_AUTH_DB *next = databases->next;
+        MXS_FREE(databases);
+        databases = next;
+    }
+
+    if (users)
+    {
+        free_users(users);
+    }
+
+    return ok;
+}
+
+int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
+                        uint8_t *scramble, size_t scramble_len)
+{
+    MYSQL_AUTH_USERS *users = acquire_users(instance);
+    const MYSQL_AUTH_GRANT *grant = NULL;
+    int rval = MXS_AUTH_FAILED;
+
+    if (users == NULL)
+    {
+        /** No users have been loaded */
+    }
+    else if (instance->skip_auth)
+    {
+        grant = find_grant(users, session->user, NULL, session->db);
+    }
+    else
     {
-        /**
-         * Try authentication with the hostname instead of the IP. We do this only
-         * as a last resort so we avoid the high cost of the DNS lookup.
-         */
-        char client_hostname[MYSQL_HOST_MAXLEN] = "";
-        get_hostname(dcb, client_hostname, sizeof(client_hostname) - 1);
+        grant = find_grant(users, session->user, dcb->remote, session->db);
 
-        sprintf(sql, mysqlauth_validate_user_query, session->user, client_hostname,
-                client_hostname, session->db, session->db);
+        /** Check for IPv6 mapped IPv4 address */
+        if (!grant && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
+        {
+            const char *ipv4 = strrchr(dcb->remote, ':') + 1;
+            grant = find_grant(users, session->user, ipv4, session->db);
+        }
 
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+        if (!grant)
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
+            /**
+             * Try authentication with the hostname instead of the IP. We do this only
+             * as a last resort so we avoid the high cost of the DNS lookup.
+             */
+            char client_hostname[MYSQL_HOST_MAXLEN] = "";
+            get_hostname(dcb, client_hostname, sizeof(client_hostname) - 1);
+            grant = find_grant(users, session->user, client_hostname, session->db);
         }
     }
 
-    if (res.ok)
+    if (grant)
     {
         /** Found a matching row */
 
-        if (no_password_required(res.output, session->auth_token_len) ||
-            check_password(res.output, session->auth_token, session->auth_token_len,
+        if (no_password_required(grant->password, session->auth_token_len) ||
+            check_password(grant->password, session->auth_token, session->auth_token_len,
                            scramble, scramble_len, session->client_sha1))
         {
             /** Password is OK, check that the database exists */
-            if (check_database(handle, session->db))
+            if (check_database(users, session->db))
             {
                 rval = MXS_AUTH_SUCCEEDED;
             }
@@ -263,6 +575,8 @@ int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
         }
     }
 
+    release_users(users);
+
     return rval;
 }
 
@@ -729,7 +1043,49 @@ void commit_sqlite_transaction(sqlite3 *handle)
     }
 }
 
-int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV_LISTENER *listener)
+/** The users and databases fetched from one server */
+typedef struct loaded_users
+{
+    MYSQL *con;                    /**< Kept open until the results are freed */
+    MYSQL_RES *users;
+    MYSQL_RES *databases;
+    struct loaded_users *next;
+} LOADED_USERS;
+
+static void digest_result(SHA_CTX *digest, MYSQL_RES *result)
+{
+    unsigned int n_fields = mysql_num_fields(result);
+    MYSQL_ROW row;
+
+    while ((row = mysql_fetch_row(result)))
+    {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+
+        for (unsigned int i = 0; i < n_fields; i++)
+        {
+            /** The length and a NULL marker keep different rows from
+             * producing the same input */
+            uint64_t len = row[i] ? lengths[i] : UINT64_MAX;
+            SHA1_Update(digest, &len, sizeof(len));
+
+            if (row[i])
+            {
+                SHA1_Update(digest, row[i], lengths[i]);
+            }
+        }
+    }
+
+    mysql_data_seek(result, 0);
+}
+
+/**
+ * Fetch the users and databases from a server and add them to the digest
+ * of the current load. The rows are modified the way they are stored.
+ *
+ * @return The number of users or -1 if they could not be fetched
+ */
+static int fetch_users(MYSQL *con, SERVER_REF *server, SERVICE *service,
+                       LOADED_USERS *loaded, SHA_CTX *digest)
 {
     if (server->server->server_string == NULL)
     {
@@ -741,50 +1097,43 @@ int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV
     }
 
     char *query = get_new_users_query(server->server->server_string, service->enable_root);
-    MYSQL_AUTH *instance = (MYSQL_AUTH*)listener->auth_instance;
     bool anon_user = false;
-    int users = 0;
+    int users = -1;
 
     if (query)
     {
-        if (mxs_mysql_query(con, query) == 0)
+        if (mxs_mysql_query(con, query) == 0 && (loaded->users = mysql_store_result(con)))
         {
-            MYSQL_RES *result = mysql_store_result(con);
+            MYSQL_ROW row;
+            users = 0;
 
-            if (result)
+            while ((row = mysql_fetch_row(loaded->users)))
             {
-                start_sqlite_transaction(instance->handle);
-
-                MYSQL_ROW row;
+                if (service->strip_db_esc)
+                {
+                    strip_escape_chars(row[2]);
+                }
 
-                while ((row = mysql_fetch_row(result)))
+                if (strchr(row[1], '/'))
                 {
-                    if (service->strip_db_esc)
-                    {
-                        strip_escape_chars(row[2]);
-                    }
-
-                    if (strchr(row[1], '/'))
-                    {
-                        merge_netmask(row[1]);
-                    }
-
-                    add_mysql_user(instance->handle, row[0], row[1], row[2],
-                                   row[3] && strcmp(row[3], "Y") == 0, row[4]);
-                    users++;
-
-                    if (row[0] && *row[0] == '\0')
-                    {
-                        /** Empty username is used for the anonymous user. This means
-                         that localhost does not match wildcard host. */
-                        anon_user = true;
-                    }
+                    merge_netmask(row[1]);
                 }
 
-                commit_sqlite_transaction(instance->handle);
+                users++;
 
-                mysql_free_result(result);
+                if (row[0] && *row[0] == '\0')
+                {
+                    /** Empty username is used for the anonymous user. This means
+                     that localhost does not match wildcard host. */
+                    anon_user = true;
+                }
             }
+
+            mysql_data_seek(loaded->users, 0);
+
+            /** The rows were modified in place so the digest is computed
+             * from what is actually stored */
+            digest_result(digest, loaded->users);
         }
         else
         {
@@ -794,6 +1143,11 @@ int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV
         MXS_FREE(query);
     }
 
+    if (users == -1)
+    {
+        return -1;
+    }
+
     /** Set the parameter if it is not configured by the user */
     if (service->localhost_match_wildcard_host == SERVICE_PARAM_UNINIT)
     {
@@ -801,19 +1155,10 @@ int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV
     }
 
     /** Load the list of databases */
-    if (mxs_mysql_query(con, "SHOW DATABASES") == 0)
+    if (mxs_mysql_query(con, "SHOW DATABASES") == 0 &&
+        (loaded->databases = mysql_store_result(con)))
     {
-        MYSQL_RES *result = mysql_store_result(con);
-        if (result)
-        {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(result)))
-            {
-                add_database(instance->handle, row[0]);
-            }
-
-            mysql_free_result(result);
-        }
+        digest_result(digest, loaded->databases);
     }
     else
     {
@@ -823,10 +1168,50 @@ int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV
     return users;
 }
 
+static void insert_users(sqlite3 *handle, LOADED_USERS *loaded)
+{
+    start_sqlite_transaction(handle);
+
+    for (; loaded; loaded = loaded->next)
+    {
+        MYSQL_ROW row;
+
+        while ((row = mysql_fetch_row(loaded->users)))
+        {
+            add_mysql_user(handle, row[0], row[1], row[2],
+                           row[3] && strcmp(row[3], "Y") == 0, row[4]);
+        }
+
+        while (loaded->databases && (row = mysql_fetch_row(loaded->databases)))
+        {
+            add_database(handle, row[0]);
+        }
+    }
+
+    commit_sqlite_transaction(handle);
+}
+
+static void free_loaded_users(LOADED_USERS *loaded)
+{
+    while (loaded)
+    {
+        LOADED_USERS *next = loaded->next;
+        mysql_free_result(loaded->users);
+        mysql_free_result(loaded->databases);
+        mysql_close(loaded->con);
+        MXS_FREE(loaded);
+        loaded = next;
+    }
+}
+
 /**
  * Load the user/passwd form mysql.user table into the service users' hashtable
  * environment.
  *
+ * The users are fetched from the servers before anything is changed. If they
+ * are identical to the ones stored by the previous load, the stored users are
+ * kept as they are.
+ *
  * @param service   The current service
  * @param users     The users table into which to load the users
  * @return          -1 on any error or the number of users inserted
@@ -849,13 +1234,15 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
         return -1;
     }
 
-    /** Delete the old users */
     MYSQL_AUTH *instance = (MYSQL_AUTH*)listener->auth_instance;
-    delete_mysql_users(instance->handle);
-
     SERVER_REF *server = service->dbref;
     int total_users = -1;
     bool no_active_servers = true;
+    LOADED_USERS *loaded = NULL;
+    LOADED_USERS **tail = &loaded;
+    SHA_CTX digest;
+
+    SHA1_Init(&digest);
 
     for (server = service->dbref; !service->svc_do_shutdown && server; server = server->next)
     {
@@ -870,6 +1257,8 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
         MYSQL *con = gw_mysql_init();
         if (con)
         {
+            LOADED_USERS *server_users = NULL;
+
             if (mxs_mysql_real_connect(con, server->server, service_user, dpwd) == NULL)
             {
                 MXS_ERROR("Failure loading users data from backend "
@@ -878,18 +1267,24 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
                           service->name, mysql_errno(con), mysql_error(con));
                 mysql_close(con);
             }
+            else if ((server_users = MXS_CALLOC(1, sizeof(*server_users))) == NULL)
+            {
+                mysql_close(con);
+            }
             else
             {
                 /** Successfully connected to a server */
-                int users = get_users_from_server(con, server, service, listener);
+                server_users->con = con;
+                *tail = server_users;
+                tail = &server_users->next;
+
+                int users = fetch_users(con, server, service, server_users, &digest);
 
                 if (users > total_users)
                 {
                     total_users = users;
                 }
 
-                mysql_close(con);
-
                 if (!service->users_from_all)
                 {
                     break;
@@ -900,6 +1295,55 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
 
     MXS_FREE(dpwd);
 
+    uint8_t users_digest[SHA_DIGEST_LENGTH];
+    SHA1_Final(users_digest, &digest);
+
+    if (total_users > 0 && instance->users_digest_valid &&
+        memcmp(users_digest, instance->users_digest, sizeof(users_digest)) == 0)
+    {
+        /** The users have not changed since the previous load */
+        atomic_add_uint64(&instance->stats.unchanged, 1);
+    }
+    else
+    {
+        /** Delete the old users */
+        delete_mysql_users(instance->handle);
+
+        /** Skip the servers whose users could not be read */
+        LOADED_USERS **prev = &loaded;
+
+        while (*prev)
+        {
+            LOADED_USERS *server_users = *prev;
+
+            if (server_users->users == NULL)
+            {
+                *prev = server_users->next;
+                server_users->next = NULL;
+                free_loaded_users(server_users);
+            }
+            else
+            {
+                prev = &server_users->next;
+            }
+        }
+
+        insert_users(instance->handle, loaded);
+
+        /** If no users were loaded, the service user can be injected into
+         * the table so the next load must replace it */
+        memcpy(instance->users_digest, users_digest, sizeof(users_digest));
+        instance->users_digest_valid = total_users > 0;
+
+        if (!update_mysql_users(instance))
+        {
+            MXS_ERROR("[%s] Failed to take the loaded users into use for listener %s.",
+                      service->name, listener->name);
+        }
+    }
+
+    free_loaded_users(loaded);
+
     if (no_active_servers)
     {
         // This service has no servers or all servers are local MaxScale services
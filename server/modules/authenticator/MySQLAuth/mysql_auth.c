@@ -30,6 +30,7 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/poll.h>
 #include <maxscale/paths.h>
 #include <maxscale/secrets.h>
@@ -184,6 +185,10 @@ static void* mysql_auth_init(char **options)
         instance->inject_service_user = true;
         instance->skip_auth = false;
         instance->handle = NULL;
+        instance->users = NULL;
+        spinlock_init(&instance->users_lock);
+        instance->users_digest_valid = false;
+        memset(&instance->stats, 0, sizeof(instance->stats));
 
         for (int i = 0; options[i]; i++)
         {
@@ -255,13 +260,13 @@ static void mysql_auth_destroy(void *data)
     }
 }
 
-static bool is_localhost_address(struct sockaddr_storage *addr)
+static bool is_localhost_address(const struct sockaddr_storage *addr)
 {
     bool rval = false;
 
     if (addr->ss_family == AF_INET)
     {
-        struct sockaddr_in *ip = (struct sockaddr_in*)addr;
+        const struct sockaddr_in *ip = (const struct sockaddr_in*)addr;
         if (ip->sin_addr.s_addr == INADDR_LOOPBACK)
         {
             rval = true;
@@ -269,7 +274,7 @@ static bool is_localhost_address(struct sockaddr_storage *addr)
     }
     else if (addr->ss_family == AF_INET6)
     {
-        struct sockaddr_in6 *ip = (struct sockaddr_in6*)addr;
+        const struct sockaddr_in6 *ip = (const struct sockaddr_in6*)addr;
         if (memcmp(&ip->sin6_addr, &in6addr_loopback, sizeof(ip->sin6_addr)) == 0)
         {
             rval = true;
@@ -351,7 +356,7 @@ mysql_auth_authenticate(DCB *dcb)
             MXS_WARNING("%s: login attempt for user '%s'@[%s]:%d, authentication failed.",
                         dcb->service->name, client_data->user, dcb->remote, dcb_get_port(dcb));
 
-            if (is_localhost_address(&dcb->ip) &&
+            if (is_localhost_address(dcb_get_ip(dcb)) &&
                 !dcb->service->localhost_match_wildcard_host)
             {
                 MXS_NOTICE("If you have a wildcard grant that covers this address, "
@@ -620,9 +625,19 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
         }
     }
 
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     int loaded = replace_mysql_users(port, skip_local);
     bool injected = false;
 
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t duration = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    atomic_add_uint64(&instance->stats.loads, 1);
+    atomic_add_uint64(&instance->stats.total_ms, duration);
+    atomic_store_uint64(&instance->stats.last_ms, duration);
+
     if (loaded <= 0)
     {
         if (loaded < 0)
@@ -646,6 +661,12 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
         }
     }
 
+    if (injected && !update_mysql_users(instance))
+    {
+        MXS_ERROR("[%s] Failed to take the loaded users into use for listener %s.",
+                  service->name, port->name);
+    }
+
     if (injected)
     {
         MXS_NOTICE("[%s] No users were loaded but 'inject_service_user' is enabled. "
@@ -701,9 +722,21 @@ int diag_cb(void *data, int columns, char **row, char **field_names)
 
 void mysql_auth_diagnostic(DCB *dcb, SERV_LISTENER *port)
 {
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
+    uint64_t loads = atomic_load_uint64(&instance->stats.loads);
+
+    dcb_printf(dcb, "User loads: %lu (%lu unchanged)\n", loads,
+               atomic_load_uint64(&instance->stats.unchanged));
+
+    if (loads)
+    {
+        dcb_printf(dcb, "User load time: %lums last, %lums average\n",
+                   atomic_load_uint64(&instance->stats.last_ms),
+                   atomic_load_uint64(&instance->stats.total_ms) / loads);
+    }
+
     dcb_printf(dcb, "User names: ");
 
-    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
     char *err;
 
     if (sqlite3_exec(instance->handle, "SELECT user, host FROM " MYSQLAUTH_USERS_TABLE_NAME,
@@ -28,11 +28,13 @@
 
 #include <stdint.h>
 #include <arpa/inet.h>
+#include <openssl/sha.h>
 
 #include <maxscale/authenticator.h>
 #include <maxscale/dcb.h>
 #include <maxscale/buffer.h>
 #include <maxscale/service.h>
+#include <maxscale/spinlock.h>
 #include <maxscale/sqlite3.h>
 #include <maxscale/protocol/mysql.h>
 
@@ -60,22 +62,6 @@ static const char databases_create_sql[] =
 /** PRAGMA configuration options for SQLite */
 static const char pragma_sql[] = "PRAGMA JOURNAL_MODE=MEMORY";
 
-/** Query that checks if there's a grant for the user being authenticated */
-static const char mysqlauth_validate_user_query[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND ( '%s' = host OR '%s' LIKE host) AND (anydb = '1' OR '%s' = '' OR '%s' LIKE db)"
-    " LIMIT 1";
-
-/** Query that only checks if there's a matching user */
-static const char mysqlauth_skip_auth_query[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND (anydb = '1' OR '%s' = '' OR '%s' LIKE db)"
-    " LIMIT 1";
-
-/** Query that checks that the database exists */
-static const char mysqlauth_validate_database_query[] =
-    "SELECT * FROM " MYSQLAUTH_DATABASES_TABLE_NAME " WHERE db = '%s' LIMIT 1";
-
 /** Delete query used to clean up the database before loading new users */
 static const char delete_users_query[] = "DELETE FROM " MYSQLAUTH_USERS_TABLE_NAME;
 
@@ -104,12 +90,29 @@ static int db_flags = SQLITE_OPEN_READWRITE |
                       SQLITE_OPEN_CREATE |
                       SQLITE_OPEN_SHAREDCACHE;
 
+/** The loaded users in a form that can be searched without SQLite */
+typedef struct mysql_auth_users MYSQL_AUTH_USERS;
+
+/** Statistics of the loading of the users */
+typedef struct mysql_auth_stats
+{
+    uint64_t loads;       /**< Number of times the users were loaded */
+    uint64_t unchanged;   /**< Loads that found the users unchanged */
+    uint64_t last_ms;     /**< Duration of the latest load in milliseconds */
+    uint64_t total_ms;    /**< Total duration of the loads in milliseconds */
+} MYSQL_AUTH_STATS;
+
 typedef struct mysql_auth
 {
     sqlite3 *handle;          /**< SQLite3 database handle */
     char *cache_dir;          /**< Custom cache directory location */
     bool inject_service_user; /**< Inject the service user into the list of users */
     bool skip_auth;           /**< Authentication will always be successful */
+    MYSQL_AUTH_USERS *users;  /**< The users authentication is done against */
+    SPINLOCK users_lock;      /**< Protects the swapping of @c users */
+    uint8_t users_digest[SHA_DIGEST_LENGTH]; /**< SHA1 of the users loaded last time */
+    bool users_digest_valid;  /**< Whether @c users_digest can be compared to */
+    MYSQL_AUTH_STATS stats;   /**< Statistics of the loading of the users */
 } MYSQL_AUTH;
 
 /** Common structure for both backend and client authenticators */
@@ -177,6 +180,9 @@ bool dbusers_save(sqlite3 *src, const char *filename);
 /**
  * Reload and replace the currently loaded database users
  *
+ * The users are only replaced if they differ from the ones loaded the
+ * previous time.
+ *
  * @param service    The current service
  * @param skip_local Skip loading of users on local MaxScale services
  *
@@ -184,6 +190,20 @@ bool dbusers_save(sqlite3 *src, const char *filename);
  */
 int replace_mysql_users(SERV_LISTENER *listener, bool skip_local);
 
+/**
+ * @brief Replace the users that authentication is done against
+ *
+ * The contents of the users and databases tables are copied into hash tables
+ * that are never modified, so that authentication needs neither SQLite nor
+ * locking. Sessions that are authenticating keep using the old users until
+ * they are done. This must be called after the tables have been updated.
+ *
+ * @param instance MySQLAuth instance
+ *
+ * @return True on success, on error the old users remain in use
+ */
+bool update_mysql_users(MYSQL_AUTH *instance);
+
 /**
  * @brief Verify the user has access to the database
  *
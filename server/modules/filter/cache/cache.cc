@@ -16,17 +16,99 @@
 #include <new>
 #include <set>
 #include <string>
-#include <zlib.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/buffer.h>
 #include <maxscale/modutil.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/paths.h>
+#include <maxscale/platform.h>
+#include <maxscale/protocol/mysql.h>
+#include "keyhasher.hh"
 #include "storagefactory.hh"
 #include "storage.hh"
 
 using namespace std;
 
+namespace
+{
+
+int u_current_thread_id = 0;
+thread_local int u_thread_id = -1;
+
+enum statement_kind_t
+{
+    STATEMENT_QUERY,    // A COM_QUERY, the result is in the text protocol.
+    STATEMENT_PREPARED  // A COM_STMT_EXECUTE, the result is in the binary protocol.
+};
+
+/**
+ * Adds a statement and the default database to a key.
+ *
+ * @param hasher       The hasher of the key.
+ * @param kind         Whether the statement is a query or a prepared statement.
+ * @param zDefault_db  The default database, can be NULL.
+ * @param pQuery       The statement as a COM_QUERY packet.
+ *
+ * @return True, if the statement could be added.
+ */
+bool hash_statement(KeyHasher& hasher,
+                    statement_kind_t kind,
+                    const char* zDefault_db,
+                    const GWBUF* pQuery)
+{
+    bool rv = false;
+
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data(pQuery, 0, sizeof(header), header) == sizeof(header))
+    {
+        // The default database is prefixed with a marker and terminated, so
+        // that it cannot be confused with the beginning of the statement.
+        // The marker of a prepared statement differs from that of a query.
+        uint8_t marker = (zDefault_db ? 1 : 0) + (kind == STATEMENT_PREPARED ? 2 : 0);
+        hasher.update(&marker, sizeof(marker));
+
+        if (zDefault_db)
+        {
+            hasher.update(zDefault_db, strlen(zDefault_db) + 1);
+        }
+
+        // The statement is hashed where it is, even if the buffer is a chain.
+        size_t offset = sizeof(header);
+        size_t left = MYSQL_GET_PAYLOAD_LEN(header) - 1;
+
+        for (const GWBUF* pBuf = pQuery; pBuf && (left != 0); pBuf = pBuf->next)
+        {
+            size_t len = GWBUF_LENGTH(pBuf);
+
+            if (offset < len)
+            {
+                size_t n = len - offset;
+
+                if (n > left)
+                {
+                    n = left;
+                }
+
+                hasher.update(GWBUF_DATA(pBuf) + offset, n);
+                left -= n;
+                offset = 0;
+            }
+            else
+            {
+                offset -= len;
+            }
+        }
+
+        rv = true;
+    }
+
+    return rv;
+}
+
+}
+
 Cache::Cache(const std::string&  name,
              const CACHE_CONFIG* pConfig,
              SCacheRules         sRules,
@@ -42,6 +124,18 @@ Cache::~Cache()
 {
 }
 
+//static
+int Cache::thread_index()
+{
+    // A value of -1 indicates that the value has not been initialized,
+    if (u_thread_id == -1)
+    {
+        u_thread_id = atomic_add(&u_current_thread_id, 1);
+    }
+
+    return u_thread_id;
+}
+
 //static
 bool Cache::Create(const CACHE_CONFIG& config,
                    CacheRules**        ppRules,
@@ -123,31 +217,51 @@ cache_result_t Cache::get_default_key(const char* zDefault_db,
                                       const GWBUF* pQuery,
                                       CACHE_KEY* pKey)
 {
-    ss_dassert(GWBUF_IS_CONTIGUOUS(pQuery));
+    cache_result_t result = CACHE_RESULT_ERROR;
+    KeyHasher hasher;
 
-    char *pSql;
-    int length;
+    if (hash_statement(hasher, STATEMENT_QUERY, zDefault_db, pQuery))
+    {
+        hasher.finish(pKey);
+        result = CACHE_RESULT_OK;
+    }
 
-    modutil_extract_SQL(const_cast<GWBUF*>(pQuery), &pSql, &length);
+    return result;
+}
 
-    uint64_t crc1 = crc32(0, Z_NULL, 0);
+cache_result_t Cache::get_ps_key(const char* zDefault_db,
+                                 const GWBUF* pStmt,
+                                 const uint8_t* pParams,
+                                 size_t nParams,
+                                 CACHE_KEY* pKey) const
+{
+    // TODO: Take config into account.
+    return get_default_ps_key(zDefault_db, pStmt, pParams, nParams, pKey);
+}
 
-    const Bytef* pData;
+//static
+cache_result_t Cache::get_default_ps_key(const char* zDefault_db,
+                                         const GWBUF* pStmt,
+                                         const uint8_t* pParams,
+                                         size_t nParams,
+                                         CACHE_KEY* pKey)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+    KeyHasher hasher;
 
-    if (zDefault_db)
+    if (hash_statement(hasher, STATEMENT_PREPARED, zDefault_db, pStmt))
     {
-        pData = reinterpret_cast<const Bytef*>(zDefault_db);
-        crc1 = crc32(crc1, pData, strlen(zDefault_db));
-    }
+        // The statement is terminated by its length, so that the parameters
+        // cannot be confused with the end of the statement.
+        uint32_t len = gwbuf_length(pStmt);
+        hasher.update(&len, sizeof(len));
+        hasher.update(pParams, nParams);
 
-    pData = reinterpret_cast<const Bytef*>(pSql);
-
-    crc1 = crc32(crc1, pData, length);
-    uint64_t crc2 = crc32(crc1, pData, length);
-
-    pKey->data = (crc1 << 32 | crc2);
+        hasher.finish(pKey);
+        result = CACHE_RESULT_OK;
+    }
 
-    return CACHE_RESULT_OK;
+    return result;
 }
 
 bool Cache::should_store(const char* zDefaultDb, const GWBUF* pQuery)
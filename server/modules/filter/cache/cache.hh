@@ -16,6 +16,7 @@
 #include <tr1/functional>
 #include <tr1/memory>
 #include <string>
+#include <vector>
 #include <maxscale/buffer.h>
 #include <maxscale/session.h>
 #include "cachefilter.h"
@@ -37,6 +38,7 @@ public:
 
     typedef std::tr1::shared_ptr<CacheRules> SCacheRules;
     typedef std::tr1::shared_ptr<StorageFactory> SStorageFactory;
+    typedef std::vector<std::string> Tables;
 
     virtual ~Cache();
 
@@ -86,6 +88,26 @@ public:
      */
     virtual void refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession) = 0;
 
+    /**
+     * Specifies whether a session should wait for a value that another session
+     * is fetching, instead of fetching it itself. If it should, the session is
+     * woken up with @c CacheFilterSession::wake() when the other session calls
+     * @c refreshed() or when the session has waited for too long.
+     *
+     * @param key       The hashed key for a query.
+     * @param pSession  The session cache asking.
+     *
+     * @return True, if the session should wait, false if nobody is fetching the data.
+     */
+    virtual bool wait_for(const CACHE_KEY& key, CacheFilterSession* pSession) = 0;
+
+    /**
+     * Wakes up the sessions that have waited for a value for too long.
+     *
+     * @param timeout  The number of seconds a session may wait.
+     */
+    virtual void expire_waits(uint32_t timeout) = 0;
+
     /**
      * Returns a key for the statement. Takes the current config into account.
      *
@@ -113,6 +135,44 @@ public:
                                           const GWBUF* pQuery,
                                           CACHE_KEY* pKey);
 
+    /**
+     * Returns a key for an execution of a prepared statement. Takes the
+     * current config into account.
+     *
+     * @param zDefault_db  The default database, can be NULL.
+     * @param pStmt        The prepared statement as a COM_QUERY packet.
+     * @param pParams      The null bitmap, types and values of the parameters.
+     * @param nParams      The length of @c pParams.
+     * @param pKey         On output a key.
+     *
+     * @return CACHE_RESULT_OK if a key could be created.
+     */
+    cache_result_t get_ps_key(const char* zDefault_db,
+                              const GWBUF* pStmt,
+                              const uint8_t* pParams,
+                              size_t nParams,
+                              CACHE_KEY* pKey) const;
+
+    /**
+     * Returns a key for an execution of a prepared statement. The key differs
+     * from the key of the same statement sent as a query, as the result of a
+     * prepared statement is in the binary protocol. Does not take the current
+     * config into account.
+     *
+     * @param zDefault_db  The default database, can be NULL.
+     * @param pStmt        The prepared statement as a COM_QUERY packet.
+     * @param pParams      The null bitmap, types and values of the parameters.
+     * @param nParams      The length of @c pParams.
+     * @param pKey         On output a key.
+     *
+     * @return CACHE_RESULT_OK if a key could be created.
+     */
+    static cache_result_t get_default_ps_key(const char* zDefault_db,
+                                             const GWBUF* pStmt,
+                                             const uint8_t* pParams,
+                                             size_t nParams,
+                                             CACHE_KEY* pKey);
+
     /**
      * See @Storage::get_value
      */
@@ -130,6 +190,43 @@ public:
      */
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    /**
+     * Returns the invalidation generation, which is incremented whenever
+     * tables are invalidated.
+     *
+     * @return The current generation.
+     */
+    virtual uint64_t generation() const = 0;
+
+    /**
+     * Records the tables a stored value depends on, so that the value is
+     * deleted when any of the tables is invalidated. If the tables have been
+     * invalidated after @c generation was obtained, the value may already be
+     * outdated and is deleted immediately.
+     *
+     * @param key         The key of the value.
+     * @param tables      The qualified names of the tables.
+     * @param generation  The generation when the query was sent to the server.
+     */
+    virtual void set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation) = 0;
+
+    /**
+     * Deletes all values that depend on any of the tables.
+     *
+     * @param tables  The qualified names of the tables.
+     */
+    virtual void invalidate(const Tables& tables) = 0;
+
+    /**
+     * See @Storage::save_snapshot
+     */
+    virtual cache_result_t save_snapshot(const char* zPath) = 0;
+
+    /**
+     * See @Storage::load_snapshot
+     */
+    virtual cache_result_t load_snapshot(const char* zPath, uint64_t* pItems) = 0;
+
 protected:
     Cache(const std::string&  name,
           const CACHE_CONFIG* pConfig,
@@ -142,6 +239,13 @@ protected:
 
     json_t* do_get_info(uint32_t what) const;
 
+    /**
+     * Get the thread index of the current thread.
+     *
+     * @return The index of the current thread.
+     */
+    static int thread_index();
+
 private:
     Cache(const Cache&);
     Cache& operator = (const Cache&);
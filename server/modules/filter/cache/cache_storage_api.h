@@ -44,6 +44,7 @@ typedef enum cache_flags
 {
     CACHE_FLAGS_NONE          = 0x00,
     CACHE_FLAGS_INCLUDE_STALE = 0x01,
+    CACHE_FLAGS_PEEK          = 0x02, /*< Do not count the access as a use, e.g. for LRU. */
 } cache_flags_t;
 
 typedef enum cache_storage_info
@@ -62,7 +63,7 @@ typedef void* CACHE_STORAGE;
 
 typedef struct cache_key
 {
-    uint64_t data;
+    uint64_t data[2]; /*< A 128-bit hash of the default database and the statement. */
 } CACHE_KEY;
 
 /**
@@ -14,10 +14,13 @@
 #define MXS_MODULE_NAME "cache"
 #include "cachefilter.hh"
 #include <maxscale/alloc.h>
+#include <maxscale/housekeeper.h>
 #include <maxscale/paths.h>
 #include <maxscale/modulecmd.h>
+#include <maxscale/tablechange.h>
 #include "cachemt.hh"
 #include "cachept.hh"
+#include "cachetiered.hh"
 
 using std::auto_ptr;
 using std::string;
@@ -35,6 +38,7 @@ static char VERSION_STRING[] = "V1.0.0";
 void cache_config_finish(CACHE_CONFIG& config)
 {
     MXS_FREE(config.rules);
+    MXS_FREE(config.snapshot);
     MXS_FREE(config.storage);
     MXS_FREE(config.storage_options);
     MXS_FREE(config.storage_argv); // The items need not be freed, they point into storage_options.
@@ -51,6 +55,13 @@ void cache_config_finish(CACHE_CONFIG& config)
     config.debug = 0;
     config.thread_model = CACHE_THREAD_MODEL_MT;
     config.selects = CACHE_SELECTS_VERIFY_CACHEABLE;
+    config.storage_shards = 0;
+    config.eviction = CACHE_EVICTION_LRU;
+    config.thread_cache_max_size = 0;
+    config.invalidate = CACHE_INVALIDATE_NEVER;
+    config.fetch_wait_timeout = 0;
+    config.snapshot = NULL;
+    config.snapshot_interval = 0;
 }
 
 /**
@@ -102,6 +113,72 @@ bool cache_command_show(const MODULECMD_ARG* pArgs)
     return true;
 }
 
+/**
+ * The metrics reported by the cache. The values are summed over the threads
+ * and the shards of the storage.
+ */
+const struct
+{
+    const char* zName;
+    const char* zHelp;
+    bool        counter;
+} cache_metrics[] =
+{
+    { "items",     "Number of items in the cache",                       false },
+    { "size",      "Size of the items in the cache in bytes",            false },
+    { "hits",      "Number of lookups that found an item",               true  },
+    { "misses",    "Number of lookups that did not find an item",        true  },
+    { "evictions", "Number of items evicted to make room for new items", true  },
+    { "pending",   "Number of items being fetched from a server",        false },
+    { "waiting",   "Number of sessions waiting for a pending item",      false },
+};
+
+const int N_CACHE_METRICS = sizeof(cache_metrics) / sizeof(cache_metrics[0]);
+
+/**
+ * Add the values of the cache metrics found in a cache info object.
+ *
+ * If an object has LRU statistics, they are used instead of the statistics
+ * of the storage the LRU storage wraps, as the latter does not see the hits
+ * of the LRU storage.
+ *
+ * @param pInfo     A cache info object, as returned by @c Cache::get_info.
+ * @param pMetrics  The metrics the values are added to.
+ */
+void cache_add_metrics(json_t* pInfo, MXS_FILTER_METRIC* pMetrics)
+{
+    json_t* pLru = json_object_get(pInfo, "lru");
+
+    if (pLru)
+    {
+        pInfo = pLru;
+    }
+
+    for (int i = 0; i < N_CACHE_METRICS; ++i)
+    {
+        json_t* pValue = json_object_get(pInfo, cache_metrics[i].zName);
+
+        if (json_is_integer(pValue))
+        {
+            pMetrics[i].value += json_integer_value(pValue);
+        }
+    }
+
+    if (!pLru)
+    {
+        const char* zKey;
+        json_t* pChild;
+
+        json_object_foreach(pInfo, zKey, pChild)
+        {
+            if (json_is_object(pChild) && strcmp(zKey, "rules") != 0)
+            {
+                cache_add_metrics(pChild, pMetrics);
+            }
+        }
+    }
+}
+
 int cache_process_init()
 {
     uint32_t jit_available;
@@ -138,6 +215,24 @@ static const MXS_ENUM_VALUE parameter_selects_values[] =
     {NULL}
 };
 
+// Enumeration values for `invalidate`
+static const MXS_ENUM_VALUE parameter_invalidate_values[] =
+{
+    {"never",   CACHE_INVALIDATE_NEVER},
+    {"current", CACHE_INVALIDATE_CURRENT},
+    {"binlog",  CACHE_INVALIDATE_BINLOG},
+    {NULL}
+};
+
+// Enumeration values for `eviction`
+static const MXS_ENUM_VALUE parameter_eviction_values[] =
+{
+    {"lru",     CACHE_EVICTION_LRU},
+    {"clock",   CACHE_EVICTION_CLOCK},
+    {"tinylfu", CACHE_EVICTION_TINYLFU},
+    {NULL}
+};
+
 extern "C" MXS_MODULE* MXS_CREATE_MODULE()
 {
     static modulecmd_arg_type_t show_argv[] =
@@ -226,6 +321,44 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 parameter_selects_values
             },
+            {
+                "storage_shards",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_STORAGE_SHARDS
+            },
+            {
+                "eviction",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_EVICTION,
+                MXS_MODULE_OPT_NONE,
+                parameter_eviction_values
+            },
+            {
+                "thread_cache_max_size",
+                MXS_MODULE_PARAM_SIZE,
+                CACHE_DEFAULT_THREAD_CACHE_MAX_SIZE
+            },
+            {
+                "invalidate",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_INVALIDATE,
+                MXS_MODULE_OPT_NONE,
+                parameter_invalidate_values
+            },
+            {
+                "fetch_wait_timeout",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_FETCH_WAIT_TIMEOUT
+            },
+            {
+                "snapshot",
+                MXS_MODULE_PARAM_PATH
+            },
+            {
+                "snapshot_interval",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_SNAPSHOT_INTERVAL
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -238,12 +371,43 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
 //
 
 CacheFilter::CacheFilter()
+    : m_snapshot_loaded(false)
 {
     cache_config_reset(m_config);
 }
 
 CacheFilter::~CacheFilter()
 {
+    if (!m_expire_task.empty())
+    {
+        hktask_remove(m_expire_task.c_str());
+    }
+
+    if (!m_load_task.empty())
+    {
+        hktask_remove(m_load_task.c_str());
+    }
+
+    if (!m_snapshot_task.empty())
+    {
+        hktask_remove(m_snapshot_task.c_str());
+    }
+
+    if (!m_load_task.empty())
+    {
+        if (m_snapshot_loaded)
+        {
+            save_snapshot(this);
+        }
+        else
+        {
+            // Otherwise the items that were not yet loaded would be lost.
+            MXS_WARNING("The snapshot '%s' was not loaded, so it is not overwritten.",
+                        m_config.snapshot);
+        }
+    }
+
+    tablechange_unsubscribe(&CacheFilter::tables_modified, this);
     cache_config_finish(m_config);
 }
 
@@ -261,8 +425,16 @@ CacheFilter* CacheFilter::create(const char* zName, char** pzOptions, MXS_CONFIG
             switch (pFilter->m_config.thread_model)
             {
             case CACHE_THREAD_MODEL_MT:
-                MXS_NOTICE("Creating shared cache.");
-                MXS_EXCEPTION_GUARD(pCache = CacheMT::Create(zName, &pFilter->m_config));
+                if (pFilter->m_config.thread_cache_max_size != 0)
+                {
+                    MXS_NOTICE("Creating shared cache with thread caches.");
+                    MXS_EXCEPTION_GUARD(pCache = CacheTiered::Create(zName, &pFilter->m_config));
+                }
+                else
+                {
+                    MXS_NOTICE("Creating shared cache.");
+                    MXS_EXCEPTION_GUARD(pCache = CacheMT::Create(zName, &pFilter->m_config));
+                }
                 break;
 
             case CACHE_THREAD_MODEL_ST:
@@ -278,6 +450,33 @@ CacheFilter* CacheFilter::create(const char* zName, char** pzOptions, MXS_CONFIG
         if (pCache)
         {
             pFilter->m_sCache = auto_ptr<Cache>(pCache);
+
+            if ((pFilter->m_config.invalidate == CACHE_INVALIDATE_BINLOG) &&
+                !tablechange_subscribe(&CacheFilter::tables_modified, pFilter))
+            {
+                MXS_ERROR("Could not subscribe to the table modifications reported by the binlog.");
+                delete pFilter;
+                pFilter = NULL;
+            }
+            else if (pFilter->m_config.fetch_wait_timeout != 0)
+            {
+                pFilter->m_expire_task = "cache-wait-";
+                pFilter->m_expire_task += zName;
+
+                if (!hktask_add(pFilter->m_expire_task.c_str(), &CacheFilter::expire_waits, pFilter, 1))
+                {
+                    MXS_ERROR("Could not add the task for expiring the waits for fetched results.");
+                    pFilter->m_expire_task.clear();
+                    delete pFilter;
+                    pFilter = NULL;
+                }
+            }
+
+            if (pFilter && pFilter->m_config.snapshot && !pFilter->start_snapshots(zName))
+            {
+                delete pFilter;
+                pFilter = NULL;
+            }
         }
         else
         {
@@ -290,6 +489,123 @@ CacheFilter* CacheFilter::create(const char* zName, char** pzOptions, MXS_CONFIG
     return pFilter;
 }
 
+// static
+void CacheFilter::tables_modified(const char* const* pzTables, int nTables, void* pData)
+{
+    CacheFilter* pFilter = static_cast<CacheFilter*>(pData);
+
+    try
+    {
+        Cache::Tables tables(pzTables, pzTables + nTables);
+
+        pFilter->m_sCache->invalidate(tables);
+    }
+    catch (const std::exception& x)
+    {
+        MXS_ERROR("Could not invalidate the modified tables: %s", x.what());
+    }
+}
+
+// static
+void CacheFilter::expire_waits(void* pData)
+{
+    CacheFilter* pFilter = static_cast<CacheFilter*>(pData);
+
+    MXS_EXCEPTION_GUARD(pFilter->m_sCache->expire_waits(pFilter->m_config.fetch_wait_timeout));
+}
+
+/**
+ * Adds the tasks that load the snapshot in the background, and that save it
+ * periodically if so configured.
+ *
+ * @param zName  The name of the filter instance.
+ *
+ * @return True, if the tasks could be added.
+ */
+bool CacheFilter::start_snapshots(const char* zName)
+{
+    bool rv = true;
+
+    m_load_task = "cache-load-";
+    m_load_task += zName;
+
+    if (!hktask_oneshot(m_load_task.c_str(), &CacheFilter::load_snapshot, this, 0))
+    {
+        MXS_ERROR("Could not add the task for loading the snapshot '%s'.", m_config.snapshot);
+        m_load_task.clear();
+        rv = false;
+    }
+    else if (m_config.snapshot_interval != 0)
+    {
+        m_snapshot_task = "cache-snapshot-";
+        m_snapshot_task += zName;
+
+        if (!hktask_add(m_snapshot_task.c_str(), &CacheFilter::save_snapshot, this,
+                        m_config.snapshot_interval))
+        {
+            MXS_ERROR("Could not add the task for saving the snapshot '%s'.", m_config.snapshot);
+            m_snapshot_task.clear();
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+// static
+void CacheFilter::load_snapshot(void* pData)
+{
+    CacheFilter* pFilter = static_cast<CacheFilter*>(pData);
+    const char* zPath = pFilter->m_config.snapshot;
+
+    uint64_t items = 0;
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    MXS_EXCEPTION_GUARD(result = pFilter->m_sCache->load_snapshot(zPath, &items));
+
+    if (result == CACHE_RESULT_OK)
+    {
+        MXS_NOTICE("Loaded %lu items from the snapshot '%s'.", (unsigned long)items, zPath);
+    }
+    else if (result == CACHE_RESULT_NOT_FOUND)
+    {
+        MXS_NOTICE("The snapshot '%s' does not exist, the cache starts empty.", zPath);
+    }
+    else if (result == CACHE_RESULT_OUT_OF_RESOURCES)
+    {
+        MXS_WARNING("The storage '%s' does not support snapshots, '%s' is not used.",
+                    pFilter->m_config.storage, zPath);
+    }
+    else
+    {
+        MXS_ERROR("Could not load the snapshot '%s', the cache starts with the "
+                  "%lu items that could be loaded.", zPath, (unsigned long)items);
+    }
+
+    // The snapshot may be overwritten even if it could not be loaded, as it
+    // would not be loaded the next time either.
+    pFilter->m_snapshot_loaded = (result != CACHE_RESULT_OUT_OF_RESOURCES);
+}
+
+// static
+void CacheFilter::save_snapshot(void* pData)
+{
+    CacheFilter* pFilter = static_cast<CacheFilter*>(pData);
+    const char* zPath = pFilter->m_config.snapshot;
+
+    if (pFilter->m_snapshot_loaded)
+    {
+        cache_result_t result = CACHE_RESULT_ERROR;
+
+        MXS_EXCEPTION_GUARD(result = pFilter->m_sCache->save_snapshot(zPath));
+
+        if (result != CACHE_RESULT_OK)
+        {
+            MXS_ERROR("Could not save the snapshot '%s'.", zPath);
+        }
+    }
+}
+
 CacheFilterSession* CacheFilter::newSession(MXS_SESSION* pSession)
 {
     return CacheFilterSession::Create(m_sCache.get(), pSession);
@@ -301,6 +617,29 @@ void CacheFilter::diagnostics(DCB* pDcb)
     m_sCache->show(pDcb);
 }
 
+int CacheFilter::getMetrics(MXS_FILTER_METRIC* pMetrics)
+{
+    ss_dassert(N_CACHE_METRICS <= MXS_FILTER_MAX_METRICS);
+
+    for (int i = 0; i < N_CACHE_METRICS; ++i)
+    {
+        pMetrics[i].name = cache_metrics[i].zName;
+        pMetrics[i].help = cache_metrics[i].zHelp;
+        pMetrics[i].counter = cache_metrics[i].counter;
+        pMetrics[i].value = 0;
+    }
+
+    json_t* pInfo = m_sCache->get_info(Cache::INFO_PENDING | Cache::INFO_STORAGE);
+
+    if (pInfo)
+    {
+        cache_add_metrics(pInfo, pMetrics);
+        json_decref(pInfo);
+    }
+
+    return N_CACHE_METRICS;
+}
+
 uint64_t CacheFilter::getCapabilities()
 {
     return RCAP_TYPE_TRANSACTION_TRACKING;
@@ -325,12 +664,28 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
     config.selects = static_cast<cache_selects_t>(config_get_enum(ppParams,
                                                                   "selects",
                                                                   parameter_selects_values));
+    config.storage_shards = config_get_integer(ppParams, "storage_shards");
+    config.eviction = static_cast<cache_eviction_t>(config_get_enum(ppParams,
+                                                                    "eviction",
+                                                                    parameter_eviction_values));
+    config.thread_cache_max_size = config_get_size(ppParams, "thread_cache_max_size");
+    config.invalidate = static_cast<cache_invalidate_t>(config_get_enum(ppParams,
+                                                                        "invalidate",
+                                                                        parameter_invalidate_values));
+    config.fetch_wait_timeout = config_get_integer(ppParams, "fetch_wait_timeout");
+    config.snapshot_interval = config_get_integer(ppParams, "snapshot_interval");
 
     if (!config.storage)
     {
         error = true;
     }
 
+    if (config.storage_shards == 0)
+    {
+        MXS_ERROR("The value of the configuration entry 'storage_shards' must be at least 1.");
+        error = true;
+    }
+
     if ((config.debug < CACHE_DEBUG_MIN) || (config.debug > CACHE_DEBUG_MAX))
     {
         MXS_ERROR("The value of the configuration entry 'debug' must "
@@ -340,6 +695,7 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
     }
 
     config.rules = config_copy_string(ppParams, "rules");
+    config.snapshot = config_copy_string(ppParams, "snapshot");
 
     const MXS_CONFIG_PARAMETER *pParam = config_get_param(ppParams, "storage_options");
 
@@ -398,6 +754,38 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
             config.soft_ttl = config.hard_ttl;
         }
 
+        if ((config.thread_cache_max_size != 0) && (config.thread_model == CACHE_THREAD_MODEL_ST))
+        {
+            MXS_WARNING("The value of 'thread_cache_max_size' is ignored when 'cached_data' "
+                        "is 'thread_specific'.");
+            config.thread_cache_max_size = 0;
+        }
+
+        if ((config.invalidate != CACHE_INVALIDATE_NEVER) && (config.thread_model == CACHE_THREAD_MODEL_ST))
+        {
+            MXS_WARNING("Invalidation is not supported when 'cached_data' is 'thread_specific', "
+                        "as the caches of other threads cannot be accessed. Setting "
+                        "'invalidate' to 'never'.");
+            config.invalidate = CACHE_INVALIDATE_NEVER;
+        }
+
+        if (config.snapshot && (config.thread_model == CACHE_THREAD_MODEL_ST))
+        {
+            MXS_WARNING("Snapshots are not supported when 'cached_data' is 'thread_specific', "
+                        "as the caches of other threads cannot be accessed. Ignoring 'snapshot'.");
+            MXS_FREE(config.snapshot);
+            config.snapshot = NULL;
+        }
+
+        if (config.snapshot && (config.invalidate != CACHE_INVALIDATE_NEVER))
+        {
+            MXS_WARNING("Snapshots are not supported when 'invalidate' is not 'never', as "
+                        "modifications made while MaxScale is not running would not be "
+                        "noticed. Ignoring 'snapshot'.");
+            MXS_FREE(config.snapshot);
+            config.snapshot = NULL;
+        }
+
         if (config.max_resultset_size == 0)
         {
             if (config.max_size != 0)
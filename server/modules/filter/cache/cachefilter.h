@@ -58,6 +58,18 @@
 #define CACHE_DEFAULT_SELECTS            "verify_cacheable"
 // Storage
 #define CACHE_DEFAULT_STORAGE            "storage_inmemory"
+// Positive integer
+#define CACHE_DEFAULT_STORAGE_SHARDS     "1"
+// Eviction
+#define CACHE_DEFAULT_EVICTION           "lru"
+// Bytes
+#define CACHE_DEFAULT_THREAD_CACHE_MAX_SIZE "0"
+// Invalidation
+#define CACHE_DEFAULT_INVALIDATE         "never"
+// Seconds
+#define CACHE_DEFAULT_FETCH_WAIT_TIMEOUT "5"
+// Seconds
+#define CACHE_DEFAULT_SNAPSHOT_INTERVAL  "0"
 
 typedef enum cache_selects
 {
@@ -65,6 +77,20 @@ typedef enum cache_selects
     CACHE_SELECTS_VERIFY_CACHEABLE,
 } cache_selects_t;
 
+typedef enum cache_eviction
+{
+    CACHE_EVICTION_LRU,     /**< Move an item to the head of the LRU list when it is accessed. */
+    CACHE_EVICTION_CLOCK,   /**< Mark an item when it is accessed, give marked items a second chance. */
+    CACHE_EVICTION_TINYLFU, /**< Admit and evict items based on how frequently they are accessed. */
+} cache_eviction_t;
+
+typedef enum cache_invalidate
+{
+    CACHE_INVALIDATE_NEVER,   /**< Items are only removed because of the TTL or eviction. */
+    CACHE_INVALIDATE_CURRENT, /**< Writes through MaxScale invalidate the items of the tables. */
+    CACHE_INVALIDATE_BINLOG,  /**< As current, and the modifications reported by the binlog. */
+} cache_invalidate_t;
+
 typedef struct cache_config
 {
     uint64_t max_resultset_rows;       /**< The maximum number of rows of a resultset for it to be cached. */
@@ -81,4 +107,11 @@ typedef struct cache_config
     uint32_t debug;                    /**< Debug settings. */
     cache_thread_model_t thread_model; /**< Thread model. */
     cache_selects_t selects;           /**< Assume/verify that selects are cacheable. */
+    uint32_t storage_shards;           /**< The number of shards of a shared storage. */
+    cache_eviction_t eviction;         /**< How items are chosen for eviction. */
+    uint64_t thread_cache_max_size;    /**< Maximum size of the cache of each thread in front of a shared cache. */
+    cache_invalidate_t invalidate;     /**< How items are invalidated. */
+    uint32_t fetch_wait_timeout;       /**< How long to wait for an item another session is fetching. */
+    char* snapshot;                    /**< The file the items are saved to and loaded from. */
+    uint32_t snapshot_interval;        /**< How often the items are saved, 0 means only at shutdown. */
 } CACHE_CONFIG;
@@ -13,6 +13,7 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
 #include <maxscale/filter.hh>
 #include "cachefilter.h"
 #include "cachefiltersession.hh"
@@ -39,6 +40,8 @@ public:
 
     void diagnostics(DCB* pDcb);
 
+    int getMetrics(MXS_FILTER_METRIC* pMetrics);
+
     uint64_t getCapabilities();
 
 private:
@@ -49,7 +52,20 @@ private:
 
     static bool process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParams, CACHE_CONFIG& config);
 
+    static void tables_modified(const char* const* pzTables, int nTables, void* pData);
+
+    static void expire_waits(void* pData);
+
+    bool start_snapshots(const char* zName);
+
+    static void load_snapshot(void* pData);
+    static void save_snapshot(void* pData);
+
 private:
     CACHE_CONFIG         m_config;
     std::auto_ptr<Cache> m_sCache;
+    std::string          m_expire_task;
+    std::string          m_load_task;       // The task loading the snapshot.
+    std::string          m_snapshot_task;   // The task saving the snapshot periodically.
+    bool                 m_snapshot_loaded; // Whether the snapshot may be overwritten.
 };
@@ -13,10 +13,15 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachefiltersession.hh"
+#include <algorithm>
 #include <new>
+#include <string>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
+#include <maxscale/poll.h>
+#include <maxscale/probe.h>
+#include <maxscale/protocol/mysql.hh>
 #include <maxscale/query_classifier.h>
 #include "storage.hh"
 
@@ -175,6 +180,50 @@ bool is_select_statement(GWBUF* pStmt)
     return is_select;
 }
 
+/**
+ * Adds the tables a statement accesses to a collection of tables. A table
+ * without an explicit database is qualified with the default database, so
+ * that the same table is always referred to using the same name.
+ *
+ * @param pPacket     A COM_QUERY packet.
+ * @param zDefaultDb  The default database, may be NULL.
+ * @param tables      The collection the tables are added to.
+ */
+void add_tables(GWBUF* pPacket, const char* zDefaultDb, Cache::Tables& tables)
+{
+    const char* const* pzTables;
+    size_t n;
+    qc_get_table_names_ref(pPacket, true, &pzTables, &n);
+
+    if (pzTables)
+    {
+        try
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                std::string table;
+
+                if (!strchr(pzTables[i], '.') && zDefaultDb)
+                {
+                    table = zDefaultDb;
+                    table += ".";
+                }
+
+                table += pzTables[i];
+
+                if (std::find(tables.begin(), tables.end(), table) == tables.end())
+                {
+                    tables.push_back(table);
+                }
+            }
+        }
+        catch (const std::exception& x)
+        {
+            MXS_ERROR("Could not collect the tables of a statement: %s", x.what());
+        }
+    }
+}
+
 }
 
 CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, char* zDefaultDb)
@@ -185,14 +234,28 @@ CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, cha
     , m_zUseDb(NULL)
     , m_refreshing(false)
     , m_is_read_only(true)
+    , m_generation(0)
+    , m_pWaiting(NULL)
+    , m_pWaitingStmt(NULL)
+    , m_pPreparing(NULL)
 {
-    m_key.data = 0;
+    m_key.data[0] = 0;
+    m_key.data[1] = 0;
 
     reset_response_state();
 }
 
 CacheFilterSession::~CacheFilterSession()
 {
+    ss_dassert(!m_pWaiting);
+    ss_dassert(!m_pWaitingStmt);
+
+    for (PreparedStmts::iterator i = m_stmts.begin(); i != m_stmts.end(); ++i)
+    {
+        gwbuf_free(i->second.pStmt);
+    }
+
+    gwbuf_free(m_pPreparing);
     MXS_FREE(m_zUseDb);
     MXS_FREE(m_zDefaultDb);
 }
@@ -228,6 +291,9 @@ CacheFilterSession* CacheFilterSession::Create(Cache* pCache, MXS_SESSION* pSess
 
 void CacheFilterSession::close()
 {
+    // If the session is closed while fetching a value, the sessions waiting
+    // for it must not wait in vain.
+    refresh_done();
 }
 
 int CacheFilterSession::routeQuery(GWBUF* pPacket)
@@ -273,17 +339,29 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
         break;
 
     case MYSQL_COM_STMT_PREPARE:
-        if (log_decisions())
+        prepare_stmt(pPacket);
+        break;
+
+    case MYSQL_COM_STMT_CLOSE:
+        close_stmt(pPacket);
+        break;
+
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+    case MYSQL_COM_STMT_RESET:
         {
-            MXS_NOTICE("MYSQL_COM_STMT_PREPARE, ignoring.");
+            PreparedStmt* pStmt = find_stmt(pPacket);
+
+            if (pStmt)
+            {
+                // A parameter sent as long data is not part of the COM_STMT_EXECUTE
+                // and hence can not be part of the key. COM_STMT_RESET discards it.
+                pStmt->long_data = (MYSQL_GET_COMMAND(pData) == MYSQL_COM_STMT_SEND_LONG_DATA);
+            }
         }
         break;
 
     case MYSQL_COM_STMT_EXECUTE:
-        if (log_decisions())
-        {
-            MXS_NOTICE("MYSQL_COM_STMT_EXECUTE, ignoring.");
-        }
+        fetch_from_server = route_execute(pPacket, &rv);
         break;
 
     case MYSQL_COM_QUERY:
@@ -293,70 +371,15 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
             {
                 if (m_pCache->should_use(m_pSession))
                 {
-                    GWBUF* pResponse;
-                    cache_result_t result = get_cached_response(pPacket, &pResponse);
+                    CACHE_KEY key;
 
-                    if (CACHE_RESULT_IS_OK(result))
+                    if (CACHE_RESULT_IS_OK(m_pCache->get_key(m_zDefaultDb, pPacket, &key)))
                     {
-                        if (CACHE_RESULT_IS_STALE(result))
-                        {
-                            // The value was found, but it was stale. Now we need to
-                            // figure out whether somebody else is already fetching it.
-
-                            if (m_pCache->must_refresh(m_key, this))
-                            {
-                                // We were the first ones who hit the stale item. It's
-                                // our responsibility now to fetch it.
-                                if (log_decisions())
-                                {
-                                    MXS_NOTICE("Cache data is stale, fetching fresh from server.");
-                                }
-
-                                // As we don't use the response it must be freed.
-                                gwbuf_free(pResponse);
-
-                                m_refreshing = true;
-                                fetch_from_server = true;
-                            }
-                            else
-                            {
-                                // Somebody is already fetching the new value. So, let's
-                                // use the stale value. No point in hitting the server twice.
-                                if (log_decisions())
-                                {
-                                    MXS_NOTICE("Cache data is stale but returning it, fresh "
-                                               "data is being fetched already.");
-                                }
-                                fetch_from_server = false;
-                            }
-                        }
-                        else
-                        {
-                            if (log_decisions())
-                            {
-                                MXS_NOTICE("Using fresh data from cache.");
-                            }
-                            fetch_from_server = false;
-                        }
+                        fetch_from_server = route_via_cache(pPacket, NULL, key, &rv);
                     }
                     else
                     {
-                        fetch_from_server = true;
-                    }
-
-                    if (fetch_from_server)
-                    {
-                        m_state = CACHE_EXPECTING_RESPONSE;
-                    }
-                    else
-                    {
-                        m_state = CACHE_EXPECTING_NOTHING;
-                        gwbuf_free(pPacket);
-                        DCB *dcb = m_pSession->client_dcb;
-
-                        // TODO: This is not ok. Any filters before this filter, will not
-                        // TODO: see this data.
-                        rv = dcb->func.write(dcb, pResponse);
+                        MXS_ERROR("Could not create cache key.");
                     }
                 }
             }
@@ -365,6 +388,10 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
                 m_state = CACHE_IGNORING_RESPONSE;
             }
         }
+        else
+        {
+            add_invalidated_tables(pPacket);
+        }
         break;
 
     default:
@@ -379,69 +406,271 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
     return rv;
 }
 
-int CacheFilterSession::clientReply(GWBUF* pData)
+/**
+ * Route a COM_STMT_EXECUTE, via the cache if the result may be cached.
+ *
+ * @param pPacket  The COM_STMT_EXECUTE.
+ * @param pRv      Set to the return value of routeQuery(), if the
+ *                 packet is not to be sent to the server.
+ *
+ * @return True, if the packet should be sent to the server.
+ */
+bool CacheFilterSession::route_execute(GWBUF* pPacket, int* pRv)
 {
-    int rv;
+    bool fetch_from_server = true;
 
-    if (m_res.pData)
+    PreparedStmt* pStmt = find_stmt(pPacket);
+
+    if (pStmt)
     {
-        gwbuf_append(m_res.pData, pData);
-        m_res.length += gwbuf_length(pData); // pData may be a chain, so not GWBUF_LENGTH().
+        // The key must be created even if the cache is not consulted,
+        // as the types of the parameters are sent only when they change.
+        CACHE_KEY key;
+        bool has_key = get_ps_key(*pStmt, pPacket, &key);
+
+        if (should_consult_cache(pStmt->pStmt))
+        {
+            if (has_key &&
+                m_pCache->should_store(m_zDefaultDb, pStmt->pStmt) &&
+                m_pCache->should_use(m_pSession))
+            {
+                fetch_from_server = route_via_cache(pPacket, pStmt->pStmt, key, pRv);
+            }
+        }
+        else
+        {
+            add_invalidated_tables(pStmt->pStmt);
+        }
+    }
+
+    return fetch_from_server;
+}
+
+/**
+ * Route a statement via the cache, that is, return the result from the
+ * cache or prepare for storing the result fetched from the server.
+ *
+ * @param pPacket  The COM_QUERY or COM_STMT_EXECUTE.
+ * @param pStmt    The prepared statement as a COM_QUERY, or NULL if @c pPacket
+ *                 is a COM_QUERY.
+ * @param key      The key of the result.
+ * @param pRv      Set to the return value of routeQuery(), if the
+ *                 packet is not to be sent to the server.
+ *
+ * @return True, if the packet should be sent to the server.
+ */
+bool CacheFilterSession::route_via_cache(GWBUF* pPacket, GWBUF* pStmt, const CACHE_KEY& key, int* pRv)
+{
+    bool fetch_from_server = true;
+
+    m_key = key;
+
+    GWBUF* pResponse;
+    cache_result_t result = get_cached_response(&pResponse);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        MXS_PROBE2(cache_hit, m_pSession->ses_id, CACHE_RESULT_IS_STALE(result) ? 1 : 0);
     }
     else
     {
-        m_res.pData = pData;
-        m_res.length = gwbuf_length(pData);
+        MXS_PROBE1(cache_miss, m_pSession->ses_id);
     }
 
-    if (m_state != CACHE_IGNORING_RESPONSE)
+    if (CACHE_RESULT_IS_OK(result))
     {
-        if (cache_max_resultset_size_exceeded(m_pCache->config(), m_res.length))
+        if (CACHE_RESULT_IS_STALE(result))
+        {
+            // The value was found, but it was stale. Now we need to
+            // figure out whether somebody else is already fetching it.
+
+            if (m_pCache->must_refresh(m_key, this))
+            {
+                // We were the first ones who hit the stale item. It's
+                // our responsibility now to fetch it.
+                if (log_decisions())
+                {
+                    MXS_NOTICE("Cache data is stale, fetching fresh from server.");
+                }
+
+                // As we don't use the response it must be freed.
+                gwbuf_free(pResponse);
+
+                m_refreshing = true;
+                fetch_from_server = true;
+            }
+            else
+            {
+                // Somebody is already fetching the new value. So, let's
+                // use the stale value. No point in hitting the server twice.
+                if (log_decisions())
+                {
+                    MXS_NOTICE("Cache data is stale but returning it, fresh "
+                               "data is being fetched already.");
+                }
+                fetch_from_server = false;
+            }
+        }
+        else
         {
             if (log_decisions())
             {
-                MXS_NOTICE("Current size %luB of resultset, at least as much "
-                           "as maximum allowed size %luKiB. Not caching.",
-                           m_res.length,
-                           m_pCache->config().max_resultset_size / 1024);
+                MXS_NOTICE("Using fresh data from cache.");
             }
+            fetch_from_server = false;
+        }
+    }
+    else if ((m_pCache->config().fetch_wait_timeout == 0) ||
+             !CACHE_RESULT_IS_NOT_FOUND(result))
+    {
+        fetch_from_server = true;
+    }
+    else if (m_pCache->must_refresh(m_key, this))
+    {
+        // We were the first ones to miss the item. The sessions
+        // that miss it while we are fetching it wait for us.
+        m_refreshing = true;
+        fetch_from_server = true;
+    }
+    else if (wait(pPacket, pStmt))
+    {
+        // Somebody is already fetching the value. So, let's wait
+        // for it, instead of hitting the server again.
+        if (log_decisions())
+        {
+            MXS_NOTICE("Cache data is missing, waiting for it to be "
+                       "fetched by another session.");
+        }
 
+        m_state = CACHE_EXPECTING_NOTHING;
+        fetch_from_server = false;
+        pResponse = NULL;
+        *pRv = 1;
+    }
+    else
+    {
+        // The fetch was completed after we missed the item.
+        fetch_from_server = true;
+    }
+
+    if (fetch_from_server)
+    {
+        prepare_fetch(pStmt ? pStmt : pPacket);
+    }
+    else if (pResponse)
+    {
+        m_state = CACHE_EXPECTING_NOTHING;
+        gwbuf_free(pPacket);
+        DCB *dcb = m_pSession->client_dcb;
+
+        // TODO: This is not ok. Any filters before this filter, will not
+        // TODO: see this data.
+        *pRv = dcb->func.write(dcb, pResponse);
+    }
+
+    return fetch_from_server;
+}
+
+int CacheFilterSession::clientReply(GWBUF* pData)
+{
+    int rv = 1;
+
+    if (!m_invalidated.empty() && !session_trx_is_active(m_pSession))
+    {
+        m_pCache->invalidate(m_invalidated);
+        m_invalidated.clear();
+    }
+
+    if (is_collecting_response())
+    {
+        // A response that may be stored is forwarded to the client as it
+        // arrives, so that the caching does not delay the client. Only a
+        // clone, which shares the data, is collected for the cache.
+        GWBUF* pClone = gwbuf_clone(pData);
+
+        if (pClone)
+        {
+            rv = m_up.clientReply(pData);
+            pData = pClone;
+        }
+        else
+        {
+            // What has been collected so far has already been forwarded.
+            discard_response();
             m_state = CACHE_IGNORING_RESPONSE;
         }
     }
 
-    switch (m_state)
+    if (m_res.pData)
     {
-    case CACHE_EXPECTING_FIELDS:
-        rv = handle_expecting_fields();
-        break;
+        gwbuf_append(m_res.pData, pData);
+        m_res.length += gwbuf_length(pData); // pData may be a chain, so not GWBUF_LENGTH().
+    }
+    else
+    {
+        m_res.pData = pData;
+        m_res.length = gwbuf_length(pData);
+    }
 
-    case CACHE_EXPECTING_NOTHING:
-        rv = handle_expecting_nothing();
-        break;
+    if (is_collecting_response() &&
+        cache_max_resultset_size_exceeded(m_pCache->config(), m_res.length))
+    {
+        if (log_decisions())
+        {
+            MXS_NOTICE("Current size %luB of resultset, at least as much "
+                       "as maximum allowed size %luKiB. Not caching.",
+                       m_res.length,
+                       m_pCache->config().max_resultset_size / 1024);
+        }
 
-    case CACHE_EXPECTING_RESPONSE:
-        rv = handle_expecting_response();
-        break;
+        discard_response();
+        m_state = CACHE_IGNORING_RESPONSE;
+    }
+    else
+    {
+        switch (m_state)
+        {
+        case CACHE_EXPECTING_FIELDS:
+            handle_expecting_fields();
+            break;
 
-    case CACHE_EXPECTING_ROWS:
-        rv = handle_expecting_rows();
-        break;
+        case CACHE_EXPECTING_NOTHING:
+            rv = handle_expecting_nothing();
+            break;
 
-    case CACHE_EXPECTING_USE_RESPONSE:
-        rv = handle_expecting_use_response();
-        break;
+        case CACHE_EXPECTING_RESPONSE:
+            handle_expecting_response();
+            break;
 
-    case CACHE_IGNORING_RESPONSE:
-        rv = handle_ignoring_response();
-        break;
+        case CACHE_EXPECTING_ROWS:
+            handle_expecting_rows();
+            break;
 
-    default:
-        MXS_ERROR("Internal cache logic broken, unexpected state: %d", m_state);
-        ss_dassert(!true);
-        rv = send_upstream();
-        reset_response_state();
-        m_state = CACHE_IGNORING_RESPONSE;
+        case CACHE_EXPECTING_USE_RESPONSE:
+            rv = handle_expecting_use_response();
+            break;
+
+        case CACHE_EXPECTING_PREPARE_RESPONSE:
+            rv = handle_expecting_prepare_response();
+            break;
+
+        case CACHE_IGNORING_RESPONSE:
+            rv = handle_ignoring_response();
+            break;
+
+        default:
+            MXS_ERROR("Internal cache logic broken, unexpected state: %d", m_state);
+            ss_dassert(!true);
+            rv = send_upstream();
+            reset_response_state();
+            m_state = CACHE_IGNORING_RESPONSE;
+        }
+    }
+
+    if (m_refreshing && !is_collecting_response())
+    {
+        // The value has been stored, or it turned out that it should not be.
+        refresh_done();
     }
 
     return rv;
@@ -459,53 +688,36 @@ void CacheFilterSession::diagnostics(DCB* pDcb)
 /**
  * Called when resultset field information is handled.
  */
-int CacheFilterSession::handle_expecting_fields()
+void CacheFilterSession::handle_expecting_fields()
 {
     ss_dassert(m_state == CACHE_EXPECTING_FIELDS);
     ss_dassert(m_res.pData);
 
-    int rv = 1;
-
-    bool insufficient = false;
-
-    size_t buflen = m_res.length;
     ss_dassert(m_res.length == gwbuf_length(m_res.pData));
 
-    while (!insufficient && (buflen - m_res.offset >= MYSQL_HEADER_LEN))
-    {
-        uint8_t header[MYSQL_HEADER_LEN + 1];
-        gwbuf_copy_data(m_res.pData, m_res.offset, MYSQL_HEADER_LEN + 1, header);
-
-        size_t packetlen = MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(header);
+    ComChainReader packet(m_res.pData, m_res.offset);
 
-        if (m_res.offset + packetlen <= buflen)
+    // Walk the complete packets, the remaining data will be handled when more arrives.
+    while ((m_state == CACHE_EXPECTING_FIELDS) && packet.is_complete())
+    {
+        if (packet.is_eof()) // The EOF after the fields.
         {
-            // We have at least one complete packet.
-            int command = (int)MYSQL_GET_COMMAND(header);
-
-            switch (command)
-            {
-            case MYSQL_REPLY_EOF: // The EOF after the fields.
-                m_res.offset += packetlen;
-                m_state = CACHE_EXPECTING_ROWS;
-                rv = handle_expecting_rows();
-                break;
-
-            default: // Field information.
-                m_res.offset += packetlen;
-                ++m_res.nFields;
-                ss_dassert(m_res.nFields <= m_res.nTotalFields);
-                break;
-            }
+            m_state = CACHE_EXPECTING_ROWS;
         }
-        else
+        else // Field information.
         {
-            // We need more data
-            insufficient = true;
+            ++m_res.nFields;
+            ss_dassert(m_res.nFields <= m_res.nTotalFields);
         }
+
+        packet.next();
+        m_res.offset = packet.offset();
     }
 
-    return rv;
+    if (m_state == CACHE_EXPECTING_ROWS)
+    {
+        handle_expecting_rows();
+    }
 }
 
 /**
@@ -517,17 +729,16 @@ int CacheFilterSession::handle_expecting_nothing()
     ss_dassert(m_res.pData);
     unsigned long msg_size = gwbuf_length(m_res.pData);
 
-    if ((int)MYSQL_GET_COMMAND(GWBUF_DATA(m_res.pData)) == 0xff)
+    ComChainReader packet(m_res.pData);
+
+    if (packet.is_complete() && packet.is_err())
     {
-        /**
-         * Error text message is after:
-         * MYSQL_HEADER_LEN offset + status flag (1) + error code (2) +
-         * 6 bytes message status = MYSQL_HEADER_LEN + 9
-         */
+        m_res.pData = gwbuf_make_contiguous(m_res.pData);
+        ComERR err(m_res.pData);
+
         MXS_INFO("Error packet received from backend "
                  "(possibly a server shut down ?): [%.*s].",
-                 (int)msg_size - (MYSQL_HEADER_LEN + 9),
-                 GWBUF_DATA(m_res.pData) + MYSQL_HEADER_LEN + 9);
+                 (int)err.message_len(), err.message());
     }
     else
     {
@@ -544,34 +755,28 @@ int CacheFilterSession::handle_expecting_nothing()
 /**
  * Called when a response is received from the server.
  */
-int CacheFilterSession::handle_expecting_response()
+void CacheFilterSession::handle_expecting_response()
 {
     ss_dassert(m_state == CACHE_EXPECTING_RESPONSE);
     ss_dassert(m_res.pData);
 
-    int rv = 1;
-
-    size_t buflen = m_res.length;
     ss_dassert(m_res.length == gwbuf_length(m_res.pData));
 
-    if (buflen >= MYSQL_HEADER_LEN + 1) // We need the command byte.
-    {
-        // Reserve enough space to accomodate for the largest length encoded integer,
-        // which is type field + 8 bytes.
-        uint8_t header[MYSQL_HEADER_LEN + 1 + 8];
-        gwbuf_copy_data(m_res.pData, 0, MYSQL_HEADER_LEN + 1, header);
+    ComChainReader packet(m_res.pData);
 
-        switch ((int)MYSQL_GET_COMMAND(header))
+    if (packet.has_type()) // We need the command byte.
+    {
+        switch (packet.type())
         {
         case MYSQL_REPLY_OK:
             store_result();
         case MYSQL_REPLY_ERR:
-            rv = send_upstream();
+            discard_response();
             m_state = CACHE_IGNORING_RESPONSE;
             break;
 
         case MYSQL_REPLY_LOCAL_INFILE: // GET_MORE_CLIENT_DATA/SEND_MORE_CLIENT_DATA
-            rv = send_upstream();
+            discard_response();
             m_state = CACHE_IGNORING_RESPONSE;
             break;
 
@@ -580,100 +785,72 @@ int CacheFilterSession::handle_expecting_response()
             {
                 // We've seen the header and have figured out how many fields there are.
                 m_state = CACHE_EXPECTING_FIELDS;
-                rv = handle_expecting_fields();
+                handle_expecting_fields();
             }
-            else
+            else if (packet.has_leint())
             {
-                // mxs_leint_bytes() returns the length of the int type field + the size of the
-                // integer.
-                size_t n_bytes = mxs_leint_bytes(&header[4]);
-
-                if (MYSQL_HEADER_LEN + n_bytes <= buflen)
-                {
-                    // Now we can figure out how many fields there are, but first we
-                    // need to copy some more data.
-                    gwbuf_copy_data(m_res.pData,
-                                    MYSQL_HEADER_LEN + 1, n_bytes - 1, &header[MYSQL_HEADER_LEN + 1]);
+                // The field count packet contains only the length encoded number of fields.
+                m_res.nTotalFields = packet.leint();
+                m_res.offset = MYSQL_HEADER_LEN + packet.leint_bytes();
 
-                    m_res.nTotalFields = mxs_leint_value(&header[4]);
-                    m_res.offset = MYSQL_HEADER_LEN + n_bytes;
-
-                    m_state = CACHE_EXPECTING_FIELDS;
-                    rv = handle_expecting_fields();
-                }
-                else
-                {
-                    // We need more data. We will be called again, when data is available.
-                }
+                m_state = CACHE_EXPECTING_FIELDS;
+                handle_expecting_fields();
+            }
+            else
+            {
+                // We need more data. We will be called again, when data is available.
             }
             break;
         }
     }
-
-    return rv;
 }
 
 /**
  * Called when resultset rows are handled.
  */
-int CacheFilterSession::handle_expecting_rows()
+void CacheFilterSession::handle_expecting_rows()
 {
     ss_dassert(m_state == CACHE_EXPECTING_ROWS);
     ss_dassert(m_res.pData);
 
-    int rv = 1;
-
-    bool insufficient = false;
-
-    size_t buflen = m_res.length;
     ss_dassert(m_res.length == gwbuf_length(m_res.pData));
 
-    while (!insufficient && (buflen - m_res.offset >= MYSQL_HEADER_LEN))
+    ComChainReader packet(m_res.pData, m_res.offset);
+
+    // Walk the complete packets, the remaining data will be handled when more arrives.
+    while ((m_state == CACHE_EXPECTING_ROWS) && packet.is_complete())
     {
-        uint8_t header[MYSQL_HEADER_LEN + 1];
-        gwbuf_copy_data(m_res.pData, m_res.offset, MYSQL_HEADER_LEN + 1, header);
+        bool eof = packet.is_eof();
 
-        size_t packetlen = MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(header);
+        packet.next();
+        m_res.offset = packet.offset();
 
-        if (m_res.offset + packetlen <= buflen)
+        if (eof)
         {
-            if ((packetlen == MYSQL_EOF_PACKET_LEN) && (MYSQL_GET_COMMAND(header) == MYSQL_REPLY_EOF))
-            {
-                // The last EOF packet
-                m_res.offset += packetlen;
-                ss_dassert(m_res.offset == buflen);
+            // The last EOF packet
+            ss_dassert(m_res.offset == m_res.length);
 
-                store_result();
+            store_result();
 
-                rv = send_upstream();
-                m_state = CACHE_EXPECTING_NOTHING;
-            }
-            else
-            {
-                // Length encode strings, 0xfb denoting NULL.
-                m_res.offset += packetlen;
-                ++m_res.nRows;
+            discard_response();
+            m_state = CACHE_EXPECTING_NOTHING;
+        }
+        else
+        {
+            // Length encode strings, 0xfb denoting NULL.
+            ++m_res.nRows;
 
-                if (cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
+            if (cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
+            {
+                if (log_decisions())
                 {
-                    if (log_decisions())
-                    {
-                        MXS_NOTICE("Max rows %lu reached, not caching result.", m_res.nRows);
-                    }
-                    rv = send_upstream();
-                    m_res.offset = buflen; // To abort the loop.
-                    m_state = CACHE_IGNORING_RESPONSE;
+                    MXS_NOTICE("Max rows %lu reached, not caching result.", m_res.nRows);
                 }
+                discard_response();
+                m_state = CACHE_IGNORING_RESPONSE;
             }
         }
-        else
-        {
-            // We need more data
-            insufficient = true;
-        }
     }
-
-    return rv;
 }
 
 /**
@@ -686,14 +863,13 @@ int CacheFilterSession::handle_expecting_use_response()
 
     int rv = 1;
 
-    size_t buflen = m_res.length;
     ss_dassert(m_res.length == gwbuf_length(m_res.pData));
 
-    if (buflen >= MYSQL_HEADER_LEN + 1) // We need the command byte.
-    {
-        uint8_t command;
+    ComChainReader packet(m_res.pData);
 
-        gwbuf_copy_data(m_res.pData, MYSQL_HEADER_LEN, 1, &command);
+    if (packet.has_type()) // We need the command byte.
+    {
+        uint8_t command = packet.type();
 
         switch (command)
         {
@@ -727,6 +903,53 @@ int CacheFilterSession::handle_expecting_use_response()
     return rv;
 }
 
+/**
+ * Called when a response to a COM_STMT_PREPARE is received from the server.
+ */
+int CacheFilterSession::handle_expecting_prepare_response()
+{
+    ss_dassert(m_state == CACHE_EXPECTING_PREPARE_RESPONSE);
+    ss_dassert(m_res.pData);
+
+    // COM_STMT_PREPARE_OK: status (1), statement id (4), number of columns (2),
+    // number of parameters (2).
+    ComChainReader packet(m_res.pData);
+
+    if (packet.is_complete() && packet.payload_len() >= ComChainReader::PREFIX_LEN && packet.is_ok())
+    {
+        uint32_t id = packet.get_byte4(1);
+
+        PreparedStmt stmt;
+        stmt.pStmt = m_pPreparing;
+        stmt.nParams = packet.get_byte2(7);
+        stmt.long_data = false;
+
+        try
+        {
+            PreparedStmts::iterator i = m_stmts.find(id);
+
+            if (i != m_stmts.end())
+            {
+                gwbuf_free(i->second.pStmt);
+                m_stmts.erase(i);
+            }
+
+            m_stmts.insert(std::make_pair(id, stmt));
+            m_pPreparing = NULL;
+        }
+        catch (const std::exception& x)
+        {
+            MXS_ERROR("Could not record a prepared statement: %s", x.what());
+        }
+    }
+
+    gwbuf_free(m_pPreparing);
+    m_pPreparing = NULL;
+
+    m_state = CACHE_IGNORING_RESPONSE;
+    return send_upstream();
+}
+
 /**
  * Called when all data from the server is ignored.
  */
@@ -753,6 +976,15 @@ int CacheFilterSession::send_upstream()
     return rv;
 }
 
+/**
+ * Discard the collected response, which already has been forwarded.
+ */
+void CacheFilterSession::discard_response()
+{
+    gwbuf_free(m_res.pData);
+    m_res.pData = NULL;
+}
+
 /**
  * Reset cache response state
  */
@@ -767,28 +999,17 @@ void CacheFilterSession::reset_response_state()
 }
 
 /**
- * Route a query via the cache.
+ * Get the cached result of the current key.
+ *
+ * @param ppResponse  On successful return, the result.
  *
- * @param key A SELECT packet.
- * @param value The result.
- * @return True if the query was satisfied from the query.
+ * @return The result of the lookup.
  */
-cache_result_t CacheFilterSession::get_cached_response(const GWBUF *pQuery, GWBUF **ppResponse)
+cache_result_t CacheFilterSession::get_cached_response(GWBUF **ppResponse)
 {
-    cache_result_t result = m_pCache->get_key(m_zDefaultDb, pQuery, &m_key);
-
-    if (CACHE_RESULT_IS_OK(result))
-    {
-        uint32_t flags = CACHE_FLAGS_INCLUDE_STALE;
-
-        result = m_pCache->get_value(m_key, flags, ppResponse);
-    }
-    else
-    {
-        MXS_ERROR("Could not create cache key.");
-    }
+    uint32_t flags = CACHE_FLAGS_INCLUDE_STALE;
 
-    return result;
+    return m_pCache->get_value(m_key, flags, ppResponse);
 }
 
 /**
@@ -819,8 +1040,217 @@ void CacheFilterSession::store_result()
                 MXS_ERROR("Could not delete cache item.");
             }
         }
+        else if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+        {
+            m_pCache->set_tables(m_key, m_tables, m_generation);
+        }
+    }
+}
+
+/**
+ * Prepare for fetching the result of a SELECT from the server.
+ *
+ * @param pStmt  The SELECT, as a COM_QUERY.
+ */
+void CacheFilterSession::prepare_fetch(GWBUF* pStmt)
+{
+    m_state = CACHE_EXPECTING_RESPONSE;
+
+    if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+    {
+        // The generation must be obtained before the statement is
+        // sent, so that an invalidation that takes place while the
+        // result is being fetched prevents it from being stored.
+        m_tables.clear();
+        m_generation = m_pCache->generation();
+        add_tables(pStmt, m_zDefaultDb, m_tables);
+    }
+}
+
+/**
+ * Add the tables a statement modifies to the tables to be invalidated.
+ *
+ * @param pStmt  A statement that is not cached, as a COM_QUERY.
+ */
+void CacheFilterSession::add_invalidated_tables(GWBUF* pStmt)
+{
+    if ((m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER) &&
+        !is_select_statement(pStmt) &&
+        qc_query_is_type(qc_get_type_mask(pStmt), QUERY_TYPE_WRITE))
+    {
+        // The tables are invalidated when the response arrives, or if a
+        // transaction is active, when the transaction has ended.
+        add_tables(pStmt, m_zDefaultDb, m_invalidated);
     }
+}
 
+/**
+ * Start tracking a statement the client prepares. The statement is recorded
+ * when the server responds with its id.
+ *
+ * @param pPacket  A COM_STMT_PREPARE.
+ */
+void CacheFilterSession::prepare_stmt(GWBUF* pPacket)
+{
+    gwbuf_free(m_pPreparing);
+
+    // The statement is kept as a COM_QUERY, so that it can be classified
+    // and its tables obtained the same way as those of a COM_QUERY.
+    m_pPreparing = gwbuf_alloc_and_load(GWBUF_LENGTH(pPacket), GWBUF_DATA(pPacket));
+
+    if (m_pPreparing)
+    {
+        GWBUF_DATA(m_pPreparing)[MYSQL_HEADER_LEN] = MYSQL_COM_QUERY;
+        gwbuf_set_type(m_pPreparing, GWBUF_TYPE_MYSQL);
+        m_state = CACHE_EXPECTING_PREPARE_RESPONSE;
+    }
+}
+
+/**
+ * Stop tracking a prepared statement.
+ *
+ * @param pPacket  A COM_STMT_CLOSE.
+ */
+void CacheFilterSession::close_stmt(GWBUF* pPacket)
+{
+    uint32_t id = gw_mysql_get_byte4(GWBUF_DATA(pPacket) + MYSQL_HEADER_LEN + 1);
+
+    PreparedStmts::iterator i = m_stmts.find(id);
+
+    if (i != m_stmts.end())
+    {
+        gwbuf_free(i->second.pStmt);
+        m_stmts.erase(i);
+    }
+}
+
+/**
+ * Find the prepared statement a packet refers to.
+ *
+ * @param pPacket  A COM_STMT_EXECUTE, COM_STMT_SEND_LONG_DATA or COM_STMT_RESET.
+ *
+ * @return The statement, or NULL if it is not known.
+ */
+CacheFilterSession::PreparedStmt* CacheFilterSession::find_stmt(GWBUF* pPacket)
+{
+    PreparedStmt* pStmt = NULL;
+
+    if (GWBUF_LENGTH(pPacket) >= MYSQL_HEADER_LEN + 5)
+    {
+        uint32_t id = gw_mysql_get_byte4(GWBUF_DATA(pPacket) + MYSQL_HEADER_LEN + 1);
+
+        PreparedStmts::iterator i = m_stmts.find(id);
+
+        if (i != m_stmts.end())
+        {
+            pStmt = &i->second;
+        }
+    }
+
+    return pStmt;
+}
+
+/**
+ * Create the key of the result of a COM_STMT_EXECUTE. The types of the
+ * parameters are recorded, if they are bound, as subsequent executions
+ * only send them again if they change.
+ *
+ * @param stmt     The statement being executed.
+ * @param pPacket  The COM_STMT_EXECUTE.
+ * @param pKey     On successful return, the key.
+ *
+ * @return True, if the result may be cached and the key was created.
+ */
+bool CacheFilterSession::get_ps_key(PreparedStmt& stmt, GWBUF* pPacket, CACHE_KEY* pKey)
+{
+    const uint8_t* pData = GWBUF_DATA(pPacket);
+    const uint8_t* pEnd = pData + GWBUF_LENGTH(pPacket);
+
+    // Command (1), statement id (4), flags (1) and iteration count (4).
+    const uint8_t* pParams = pData + MYSQL_HEADER_LEN + 10;
+
+    if (pParams > pEnd)
+    {
+        return false;
+    }
+
+    // Only a result returned directly, without a cursor, can be cached.
+    bool cacheable = (pData[MYSQL_HEADER_LEN + 5] == 0) && !stmt.long_data;
+
+    std::vector<uint8_t> params;
+
+    if (stmt.nParams != 0)
+    {
+        size_t null_len = (stmt.nParams + 7) / 8;
+        size_t types_len = 2 * stmt.nParams;
+
+        const uint8_t* pBound = pParams + null_len;
+
+        if (pBound >= pEnd)
+        {
+            return false;
+        }
+
+        const uint8_t* pValues = pBound + 1;
+
+        try
+        {
+            if (*pBound)
+            {
+                if (pValues + types_len > pEnd)
+                {
+                    return false;
+                }
+
+                stmt.types.assign(pValues, pValues + types_len);
+                pValues += types_len;
+            }
+            else if (stmt.types.size() != types_len)
+            {
+                // The types have never been bound.
+                cacheable = false;
+            }
+
+            if (cacheable)
+            {
+                // The key covers the NULL bitmap, the types and the values.
+                params.reserve(null_len + types_len + (pEnd - pValues));
+                params.insert(params.end(), pParams, pBound);
+                params.insert(params.end(), stmt.types.begin(), stmt.types.end());
+                params.insert(params.end(), pValues, pEnd);
+            }
+        }
+        catch (const std::exception& x)
+        {
+            MXS_ERROR("Could not collect the parameters of a statement: %s", x.what());
+            cacheable = false;
+        }
+    }
+
+    if (cacheable)
+    {
+        cache_result_t result = m_pCache->get_ps_key(m_zDefaultDb,
+                                                     stmt.pStmt,
+                                                     params.empty() ? NULL : &params[0],
+                                                     params.size(),
+                                                     pKey);
+
+        if (!CACHE_RESULT_IS_OK(result))
+        {
+            MXS_ERROR("Could not create cache key.");
+            cacheable = false;
+        }
+    }
+
+    return cacheable;
+}
+
+/**
+ * Inform the cache that the session no longer fetches the value, so that
+ * the sessions waiting for it are woken up.
+ */
+void CacheFilterSession::refresh_done()
+{
     if (m_refreshing)
     {
         m_pCache->refreshed(m_key, this);
@@ -828,6 +1258,118 @@ void CacheFilterSession::store_result()
     }
 }
 
+/**
+ * Wait for the result of a SELECT that another session is fetching.
+ *
+ * @param pPacket  The SELECT, which is held until the session is woken up.
+ * @param pStmt    The prepared statement, if @c pPacket is a COM_STMT_EXECUTE.
+ *
+ * @return True, if the session waits, false if nobody is fetching the result.
+ */
+bool CacheFilterSession::wait(GWBUF* pPacket, GWBUF* pStmt)
+{
+    ss_dassert(!m_pWaiting);
+
+    // The statement may be closed while the session waits.
+    if (pStmt && !(pStmt = gwbuf_clone(pStmt)))
+    {
+        return false;
+    }
+
+    // The reference keeps the session alive until it has been woken up.
+    session_get_ref(m_pSession);
+    m_pWaiting = pPacket;
+    m_pWaitingStmt = pStmt;
+
+    bool waiting = m_pCache->wait_for(m_key, this);
+
+    if (!waiting)
+    {
+        m_pWaiting = NULL;
+        m_pWaitingStmt = NULL;
+        gwbuf_free(pStmt);
+        session_put_ref(m_pSession);
+    }
+
+    return waiting;
+}
+
+void CacheFilterSession::wake()
+{
+    ss_dassert(m_pWaiting);
+
+    if (!poll_post_task(m_pSession->client_dcb->thread.id, &CacheFilterSession::resume_task, this))
+    {
+        MXS_ERROR("Could not wake up a session waiting for the cache, the session will hang.");
+    }
+}
+
+//static
+void CacheFilterSession::resume_task(int thread_id, void* pData)
+{
+    CacheFilterSession* pThis = static_cast<CacheFilterSession*>(pData);
+
+    MXS_EXCEPTION_GUARD(pThis->resume());
+}
+
+/**
+ * Called in the thread of the session, when the value the session waited
+ * for has been fetched or the session has waited for too long.
+ */
+void CacheFilterSession::resume()
+{
+    GWBUF* pPacket = m_pWaiting;
+    GWBUF* pStmt = m_pWaitingStmt;
+    m_pWaiting = NULL;
+    m_pWaitingStmt = NULL;
+
+    MXS_SESSION* pSession = m_pSession;
+    DCB* pDcb = pSession->client_dcb;
+
+    if (pSession->state == SESSION_STATE_ROUTER_READY)
+    {
+        GWBUF* pResponse;
+        cache_result_t result = m_pCache->get_value(m_key, CACHE_FLAGS_INCLUDE_STALE, &pResponse);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            if (log_decisions())
+            {
+                MXS_NOTICE("Using data fetched by another session.");
+            }
+
+            gwbuf_free(pPacket);
+            pDcb->func.write(pDcb, pResponse);
+        }
+        else
+        {
+            // The result was not stored or we waited for too long. Fetch it
+            // ourselves, without waiting again.
+            if (log_decisions())
+            {
+                MXS_NOTICE("Cache data is still missing, fetching it from server.");
+            }
+
+            reset_response_state();
+            prepare_fetch(pStmt ? pStmt : pPacket);
+
+            if (m_down.routeQuery(pPacket) == 0)
+            {
+                poll_fake_hangup_event(pDcb);
+            }
+        }
+    }
+    else
+    {
+        gwbuf_free(pPacket);
+    }
+
+    gwbuf_free(pStmt);
+
+    // May free the session and this object.
+    session_put_ref(pSession);
+}
+
 /**
  * Whether the cache should be consulted.
  *
@@ -13,6 +13,8 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <map>
+#include <vector>
 #include <maxscale/buffer.h>
 #include <maxscale/filter.hh>
 #include "cache.hh"
@@ -30,6 +32,7 @@ public:
         CACHE_EXPECTING_NOTHING,      // We are not expecting anything from the server.
         CACHE_EXPECTING_USE_RESPONSE, // A "USE DB" was issued.
         CACHE_IGNORING_RESPONSE,      // We are not interested in the data received from the server.
+        CACHE_EXPECTING_PREPARE_RESPONSE, // A COM_STMT_PREPARE was issued.
     };
 
     struct CACHE_RESPONSE_STATE
@@ -85,19 +88,59 @@ public:
      */
     void diagnostics(DCB *dcb);
 
+    /**
+     * Wakes up a session that waits for a value being fetched by another
+     * session. Can be called from any thread; the session resumes in its
+     * own thread.
+     */
+    void wake();
+
 private:
-    int handle_expecting_fields();
+    /**
+     * A statement the client has prepared.
+     */
+    struct PreparedStmt
+    {
+        GWBUF*               pStmt;     /**< The statement as a COM_QUERY packet. */
+        uint16_t             nParams;   /**< The number of parameters. */
+        std::vector<uint8_t> types;     /**< The types of the parameters last bound. */
+        bool                 long_data; /**< Whether a parameter is sent with COM_STMT_SEND_LONG_DATA. */
+    };
+
+    typedef std::map<uint32_t, PreparedStmt> PreparedStmts;
+
+    bool route_execute(GWBUF* pPacket, int* pRv);
+    bool route_via_cache(GWBUF* pPacket, GWBUF* pStmt, const CACHE_KEY& key, int* pRv);
+
+    void prepare_stmt(GWBUF* pPacket);
+    void close_stmt(GWBUF* pPacket);
+    PreparedStmt* find_stmt(GWBUF* pPacket);
+    bool get_ps_key(PreparedStmt& stmt, GWBUF* pPacket, CACHE_KEY* pKey);
+
+    void add_invalidated_tables(GWBUF* pStmt);
+
+    void handle_expecting_fields();
     int handle_expecting_nothing();
-    int handle_expecting_response();
-    int handle_expecting_rows();
+    void handle_expecting_response();
+    void handle_expecting_rows();
     int handle_expecting_use_response();
     int handle_ignoring_response();
+    int handle_expecting_prepare_response();
 
     int send_upstream();
 
+    void discard_response();
+
+    bool is_collecting_response() const
+    {
+        return (m_state == CACHE_EXPECTING_RESPONSE) ||
+               (m_state == CACHE_EXPECTING_FIELDS) ||
+               (m_state == CACHE_EXPECTING_ROWS);
+    }
+
     void reset_response_state();
 
-    cache_result_t get_cached_response(const GWBUF *pQuery, GWBUF **ppResponse);
+    cache_result_t get_cached_response(GWBUF **ppResponse);
 
     bool log_decisions() const
     {
@@ -106,6 +149,16 @@ private:
 
     void store_result();
 
+    void prepare_fetch(GWBUF* pStmt);
+
+    void refresh_done();
+
+    bool wait(GWBUF* pPacket, GWBUF* pStmt);
+
+    void resume();
+
+    static void resume_task(int thread_id, void* pData);
+
     bool should_consult_cache(GWBUF* pPacket);
 
 private:
@@ -123,5 +176,12 @@ private:
     char*                 m_zUseDb;      /**< Pending default database. Needs server response. */
     bool                  m_refreshing;  /**< Whether the session is updating a stale cache entry. */
     bool                  m_is_read_only;/**< Whether the current trx has been read-only in pratice. */
+    Cache::Tables         m_tables;      /**< The tables of the SELECT whose result is being fetched. */
+    uint64_t              m_generation;  /**< The invalidation generation when the SELECT was sent. */
+    Cache::Tables         m_invalidated; /**< The tables modified, but not yet invalidated. */
+    GWBUF*                m_pWaiting;    /**< The SELECT waiting for another session to fetch the result. */
+    GWBUF*                m_pWaitingStmt;/**< The prepared statement of the waiting COM_STMT_EXECUTE. */
+    PreparedStmts         m_stmts;       /**< The statements prepared by the client. */
+    GWBUF*                m_pPreparing;  /**< The statement being prepared, as a COM_QUERY packet. */
 };
 
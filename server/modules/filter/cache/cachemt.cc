@@ -27,6 +27,7 @@ CacheMT::CacheMT(const std::string&  name,
     : CacheSimple(name, pConfig, sRules, sFactory, pStorage)
 {
     spinlock_init(&m_lock_pending);
+    spinlock_init(&m_lock_tables);
 
     MXS_NOTICE("Created multi threaded cache.");
 }
@@ -55,6 +56,19 @@ CacheMT* CacheMT::Create(const std::string& name, const CACHE_CONFIG* pConfig)
     return pCache;
 }
 
+// static
+CacheMT* CacheMT::Create(const std::string&  name,
+                         SCacheRules         sRules,
+                         SStorageFactory     sFactory,
+                         const CACHE_CONFIG* pConfig)
+{
+    ss_dassert(sRules.get());
+    ss_dassert(sFactory.get());
+    ss_dassert(pConfig);
+
+    return Create(name, pConfig, sRules, sFactory);
+}
+
 json_t* CacheMT::get_info(uint32_t flags) const
 {
     SpinLockGuard guard(m_lock_pending);
@@ -70,10 +84,58 @@ bool CacheMT::must_refresh(const CACHE_KEY& key, const CacheFilterSession* pSess
 }
 
 void CacheMT::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession)
+{
+    Waiters woken;
+
+    {
+        SpinLockGuard guard(m_lock_pending);
+
+        do_refreshed(key, pSession, woken);
+    }
+
+    // The sessions are woken up without holding the lock, as that involves
+    // posting a task to the thread of each session.
+    wake(woken);
+}
+
+bool CacheMT::wait_for(const CACHE_KEY& key, CacheFilterSession* pSession)
 {
     SpinLockGuard guard(m_lock_pending);
 
-    do_refreshed(key, pSession);
+    return do_wait_for(key, pSession);
+}
+
+void CacheMT::expire_waits(uint32_t timeout)
+{
+    Waiters woken;
+
+    {
+        SpinLockGuard guard(m_lock_pending);
+
+        do_expire_waits(timeout, woken);
+    }
+
+    wake(woken);
+}
+
+uint64_t CacheMT::generation() const
+{
+    // No locking, as e.g. CacheTiered obtains the generation on every hit.
+    return do_generation();
+}
+
+void CacheMT::set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation)
+{
+    SpinLockGuard guard(m_lock_tables);
+
+    do_set_tables(key, tables, generation);
+}
+
+void CacheMT::invalidate(const Tables& tables)
+{
+    SpinLockGuard guard(m_lock_tables);
+
+    do_invalidate(tables);
 }
 
 // static
@@ -93,7 +155,9 @@ CacheMT* CacheMT::Create(const std::string&  name,
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
 
-    Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config, argc, argv);
+    Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config,
+                                                pConfig->storage_shards, pConfig->eviction,
+                                                argc, argv);
 
     if (pStorage)
     {
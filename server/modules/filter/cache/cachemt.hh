@@ -22,6 +22,10 @@ public:
     ~CacheMT();
 
     static CacheMT* Create(const std::string& name, const CACHE_CONFIG* pConfig);
+    static CacheMT* Create(const std::string& name,
+                           SCacheRules sRules,
+                           SStorageFactory sFactory,
+                           const CACHE_CONFIG* pConfig);
 
     json_t* get_info(uint32_t what) const;
 
@@ -29,6 +33,16 @@ public:
 
     void refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession);
 
+    bool wait_for(const CACHE_KEY& key, CacheFilterSession* pSession);
+
+    void expire_waits(uint32_t timeout);
+
+    uint64_t generation() const;
+
+    void set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation);
+
+    void invalidate(const Tables& tables);
+
 private:
     CacheMT(const std::string&  name,
             const CACHE_CONFIG* pConfig,
@@ -47,4 +61,5 @@ private:
 
 private:
     mutable SPINLOCK m_lock_pending; // Lock used for protecting 'pending'.
+    mutable SPINLOCK m_lock_tables;  // Lock used for protecting the tables of the values.
 };
@@ -13,38 +13,13 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachept.hh"
-#include <maxscale/atomic.h>
-#include <maxscale/platform.h>
+#include <maxscale/poll.h>
 #include "cachest.hh"
 #include "storagefactory.hh"
 
 using std::tr1::shared_ptr;
 using std::string;
 
-namespace
-{
-
-int u_current_thread_id = 0;
-thread_local int u_thread_id = -1;
-
-/**
- * Get the thread index of the current thread.
- *
- * @return The index of the current thread.
- */
-inline int thread_index()
-{
-    // A value of -1 indicates that the value has not been initialized,
-    if (u_thread_id == -1)
-    {
-        u_thread_id = atomic_add(&u_current_thread_id, 1);
-    }
-
-    return u_thread_id;
-}
-
-}
-
 CachePT::CachePT(const std::string&  name,
                  const CACHE_CONFIG* pConfig,
                  SCacheRules         sRules,
@@ -91,6 +66,55 @@ void CachePT::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSessio
     thread_cache().refreshed(key, pSession);
 }
 
+bool CachePT::wait_for(const CACHE_KEY& key, CacheFilterSession* pSession)
+{
+    return thread_cache().wait_for(key, pSession);
+}
+
+namespace
+{
+
+struct ExpireWaits
+{
+    CachePT* pCache;
+    uint32_t timeout;
+};
+
+}
+
+void CachePT::expire_waits(uint32_t timeout)
+{
+    // The cache of a thread can only be accessed by the thread itself, so
+    // each thread is made to expire the waits of its own cache.
+    ExpireWaits expire_waits = { this, timeout };
+
+    poll_execute_on_all(&CachePT::expire_thread_waits, &expire_waits);
+}
+
+//static
+void CachePT::expire_thread_waits(int thread_id, void* pData)
+{
+    ExpireWaits* pExpire_waits = static_cast<ExpireWaits*>(pData);
+
+    pExpire_waits->pCache->thread_cache().expire_waits(pExpire_waits->timeout);
+}
+
+uint64_t CachePT::generation() const
+{
+    return thread_cache().generation();
+}
+
+void CachePT::set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation)
+{
+    thread_cache().set_tables(key, tables, generation);
+}
+
+void CachePT::invalidate(const Tables& tables)
+{
+    // Only the cache of the current thread can be accessed.
+    thread_cache().invalidate(tables);
+}
+
 json_t* CachePT::get_info(uint32_t what) const
 {
     json_t* pInfo = Cache::do_get_info(what);
@@ -142,6 +166,17 @@ cache_result_t CachePT::del_value(const CACHE_KEY& key)
     return thread_cache().del_value(key);
 }
 
+cache_result_t CachePT::save_snapshot(const char* zPath)
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t CachePT::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    *pItems = 0;
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
 // static
 CachePT* CachePT::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -28,6 +28,16 @@ public:
 
     void refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession);
 
+    bool wait_for(const CACHE_KEY& key, CacheFilterSession* pSession);
+
+    void expire_waits(uint32_t timeout);
+
+    uint64_t generation() const;
+
+    void set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation);
+
+    void invalidate(const Tables& tables);
+
     json_t* get_info(uint32_t what) const;
 
     cache_result_t get_key(const char* zDefault_db, const GWBUF* pQuery, CACHE_KEY* pKey) const;
@@ -38,6 +48,13 @@ public:
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    /**
+     * Not supported, as the caches of other threads cannot be accessed.
+     */
+    cache_result_t save_snapshot(const char* zPath);
+
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
 private:
     typedef std::tr1::shared_ptr<Cache> SCache;
     typedef std::vector<SCache>         Caches;
@@ -55,6 +72,8 @@ private:
 
     Cache& thread_cache();
 
+    static void expire_thread_waits(int thread_id, void* pData);
+
     const Cache& thread_cache() const
     {
         return const_cast<CachePT*>(this)->thread_cache();
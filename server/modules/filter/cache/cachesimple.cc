@@ -13,8 +13,20 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachesimple.hh"
+#include "cachefiltersession.hh"
 #include "storage.hh"
 #include "storagefactory.hh"
+#include <algorithm>
+#include <maxscale/clock.h>
+
+namespace
+{
+
+// The number of keys that are recorded before they are first checked for
+// having been evicted, which is done when the number has doubled since.
+const size_t MIN_SWEEP_LIMIT = 10000;
+
+}
 
 CacheSimple::CacheSimple(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -22,7 +34,10 @@ CacheSimple::CacheSimple(const std::string&  name,
                          SStorageFactory     sFactory,
                          Storage*            pStorage)
     : Cache(name, pConfig, sRules, sFactory)
+    , m_n_waiting(0)
     , m_pStorage(pStorage)
+    , m_generation(0)
+    , m_sweep_limit(MIN_SWEEP_LIMIT)
 {
 }
 
@@ -68,6 +83,16 @@ cache_result_t CacheSimple::del_value(const CACHE_KEY& key)
     return m_pStorage->del_value(key);
 }
 
+cache_result_t CacheSimple::save_snapshot(const char* zPath)
+{
+    return m_pStorage->save_snapshot(zPath);
+}
+
+cache_result_t CacheSimple::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    return m_pStorage->load_snapshot(zPath, pItems);
+}
+
 // protected:
 json_t* CacheSimple::do_get_info(uint32_t what) const
 {
@@ -75,7 +100,8 @@ json_t* CacheSimple::do_get_info(uint32_t what) const
 
     if (what & INFO_PENDING)
     {
-        // TODO: Include information about pending items.
+        json_object_set_new(pInfo, "pending", json_integer(m_pending.size()));
+        json_object_set_new(pInfo, "waiting", json_integer(m_n_waiting));
     }
 
     if (what & INFO_STORAGE)
@@ -104,7 +130,7 @@ bool CacheSimple::do_must_refresh(const CACHE_KEY& key, const CacheFilterSession
     {
         try
         {
-            m_pending.insert(std::make_pair(key, pSession));
+            m_pending.insert(std::make_pair(key, Fetch(pSession)));
             rv = true;
         }
         catch (const std::exception& x)
@@ -117,10 +143,218 @@ bool CacheSimple::do_must_refresh(const CACHE_KEY& key, const CacheFilterSession
 }
 
 // protected
-void CacheSimple::do_refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession)
+void CacheSimple::do_refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession, Waiters& woken)
 {
     Pending::iterator i = m_pending.find(key);
     ss_dassert(i != m_pending.end());
-    ss_dassert(i->second == pSession);
+    ss_dassert(i->second.pFetcher == pSession);
+
+    // Swapping does not allocate, so the waiters cannot be lost.
+    woken.swap(i->second.waiters);
+    m_n_waiting -= woken.size();
     m_pending.erase(i);
 }
+
+// protected
+bool CacheSimple::do_wait_for(const CACHE_KEY& key, CacheFilterSession* pSession)
+{
+    bool rv = false;
+    Pending::iterator i = m_pending.find(key);
+
+    if (i != m_pending.end())
+    {
+        try
+        {
+            i->second.waiters.push_back(Waiter(pSession, mxs_clock_time()));
+            ++m_n_waiting;
+            rv = true;
+        }
+        catch (const std::exception& x)
+        {
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+// protected
+void CacheSimple::do_expire_waits(uint32_t timeout, Waiters& woken)
+{
+    if (m_n_waiting != 0)
+    {
+        time_t now = mxs_clock_time();
+
+        try
+        {
+            // With room for all waiting sessions, copying a waiter cannot throw,
+            // so a waiter is never left in a list after it has been woken up.
+            woken.reserve(woken.size() + m_n_waiting);
+
+            for (Pending::iterator i = m_pending.begin(); i != m_pending.end(); ++i)
+            {
+                Waiters& waiters = i->second.waiters;
+                // The sessions are in the order they started waiting.
+                Waiters::iterator j = waiters.begin();
+
+                while ((j != waiters.end()) && (now - j->since >= (time_t)timeout))
+                {
+                    woken.push_back(*j);
+                    ++j;
+                }
+
+                m_n_waiting -= (j - waiters.begin());
+                waiters.erase(waiters.begin(), j);
+            }
+        }
+        catch (const std::exception& x)
+        {
+            // No session was woken up, they are expired the next time.
+            MXS_ERROR("Could not expire waiting sessions: %s", x.what());
+        }
+    }
+}
+
+//static
+void CacheSimple::wake(const Waiters& waiters)
+{
+    for (Waiters::const_iterator i = waiters.begin(); i != waiters.end(); ++i)
+    {
+        i->pSession->wake();
+    }
+}
+
+// protected
+void CacheSimple::do_set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation)
+{
+    TablesByKey::iterator i = m_tables_by_key.find(key);
+
+    if (i != m_tables_by_key.end())
+    {
+        remove_tables(key, i->second);
+        m_tables_by_key.erase(i);
+    }
+
+    if (generation != m_generation)
+    {
+        // Some tables were invalidated while the result was being fetched.
+        m_pStorage->del_value(key);
+    }
+    else if (!tables.empty())
+    {
+        try
+        {
+            if (m_tables_by_key.size() >= m_sweep_limit)
+            {
+                sweep_tables();
+            }
+
+            m_tables_by_key.insert(std::make_pair(key, tables));
+
+            for (Tables::const_iterator j = tables.begin(); j != tables.end(); ++j)
+            {
+                m_keys_by_table[*j].insert(key);
+            }
+        }
+        catch (const std::exception& x)
+        {
+            // Without the dependencies, the value could not be invalidated.
+            i = m_tables_by_key.find(key);
+
+            if (i != m_tables_by_key.end())
+            {
+                remove_tables(key, i->second);
+                m_tables_by_key.erase(i);
+            }
+
+            m_pStorage->del_value(key);
+        }
+    }
+}
+
+// protected
+void CacheSimple::do_invalidate(const Tables& tables)
+{
+    atomic_add_uint64(&m_generation, 1);
+
+    for (Tables::const_iterator i = tables.begin(); i != tables.end(); ++i)
+    {
+        KeysByTable::iterator j = m_keys_by_table.find(*i);
+
+        if (j != m_keys_by_table.end())
+        {
+            // Moved out, as remove_tables() below modifies the entry of this table.
+            Keys keys;
+            keys.swap(j->second);
+            m_keys_by_table.erase(j);
+
+            for (Keys::const_iterator k = keys.begin(); k != keys.end(); ++k)
+            {
+                const CACHE_KEY& key = *k;
+
+                m_pStorage->del_value(key);
+
+                TablesByKey::iterator l = m_tables_by_key.find(key);
+
+                if (l != m_tables_by_key.end())
+                {
+                    remove_tables(key, l->second);
+                    m_tables_by_key.erase(l);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Remove a key from the entries of the tables.
+ *
+ * @param key     The key.
+ * @param tables  The tables the key depends on.
+ */
+void CacheSimple::remove_tables(const CACHE_KEY& key, const Tables& tables)
+{
+    for (Tables::const_iterator i = tables.begin(); i != tables.end(); ++i)
+    {
+        KeysByTable::iterator j = m_keys_by_table.find(*i);
+
+        if (j != m_keys_by_table.end())
+        {
+            j->second.erase(key);
+
+            if (j->second.empty())
+            {
+                m_keys_by_table.erase(j);
+            }
+        }
+    }
+}
+
+/**
+ * Remove the keys of the values that are no longer in the storage, due to
+ * eviction or the TTL, as the storage does not report that.
+ */
+void CacheSimple::sweep_tables()
+{
+    TablesByKey::iterator i = m_tables_by_key.begin();
+
+    while (i != m_tables_by_key.end())
+    {
+        GWBUF* pValue;
+        uint32_t flags = CACHE_FLAGS_INCLUDE_STALE | CACHE_FLAGS_PEEK;
+        cache_result_t result = m_pStorage->get_value(i->first, flags, &pValue);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            gwbuf_free(pValue);
+            ++i;
+        }
+        else
+        {
+            remove_tables(i->first, i->second);
+            m_tables_by_key.erase(i++);
+        }
+    }
+
+    m_sweep_limit = std::max(MIN_SWEEP_LIMIT, 2 * m_tables_by_key.size());
+}
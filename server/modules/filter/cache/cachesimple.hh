@@ -13,7 +13,11 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <time.h>
 #include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#include <vector>
+#include <maxscale/atomic.h>
 #include <maxscale/hashtable.h>
 #include "cache.hh"
 #include "cache_storage_api.hh"
@@ -31,7 +35,38 @@ public:
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    cache_result_t save_snapshot(const char* zPath);
+
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
 protected:
+    struct Waiter
+    {
+        Waiter(CacheFilterSession* pSession, time_t since)
+            : pSession(pSession)
+            , since(since)
+        {
+        }
+
+        CacheFilterSession* pSession; // The session waiting.
+        time_t              since;    // When the session started waiting.
+    };
+
+    typedef std::vector<Waiter> Waiters;
+
+    struct Fetch
+    {
+        Fetch(const CacheFilterSession* pFetcher)
+            : pFetcher(pFetcher)
+        {
+        }
+
+        const CacheFilterSession* pFetcher; // The session fetching the value.
+        Waiters                   waiters;  // The sessions waiting for the value.
+    };
+
+    typedef std::tr1::unordered_map<CACHE_KEY, Fetch> Pending;
+
     CacheSimple(const std::string&  name,
                 const CACHE_CONFIG* pConfig,
                 SCacheRules         sRules,
@@ -47,15 +82,40 @@ protected:
 
     bool do_must_refresh(const CACHE_KEY& key, const CacheFilterSession* pSession);
 
-    void do_refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession);
+    void do_refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession, Waiters& woken);
+
+    bool do_wait_for(const CACHE_KEY& key, CacheFilterSession* pSession);
+
+    void do_expire_waits(uint32_t timeout, Waiters& woken);
+
+    static void wake(const Waiters& waiters);
+
+    uint64_t do_generation() const
+    {
+        return atomic_load_uint64(&m_generation);
+    }
+
+    void do_set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation);
+
+    void do_invalidate(const Tables& tables);
 
 private:
     CacheSimple(const Cache&);
     CacheSimple& operator = (const CacheSimple&);
 
+    void remove_tables(const CACHE_KEY& key, const Tables& tables);
+    void sweep_tables();
+
 protected:
-    typedef std::tr1::unordered_map<CACHE_KEY, const CacheFilterSession*> Pending;
+    typedef std::tr1::unordered_set<CACHE_KEY>             Keys;
+    typedef std::tr1::unordered_map<std::string, Keys>     KeysByTable;
+    typedef std::tr1::unordered_map<CACHE_KEY, Tables>     TablesByKey;
 
-    Pending  m_pending;  // Pending items; being fetched from the backend.
-    Storage* m_pStorage; // The storage instance to use.
+    Pending     m_pending;       // Pending items; being fetched from the backend.
+    size_t      m_n_waiting;     // The number of sessions waiting for pending items.
+    Storage*    m_pStorage;      // The storage instance to use.
+    KeysByTable m_keys_by_table; // The keys of the values that depend on a table.
+    TablesByKey m_tables_by_key; // The tables a value depends on.
+    uint64_t    m_generation;    // Incremented whenever tables are invalidated.
+    size_t      m_sweep_limit;   // When the keys are next checked for having been evicted.
 };
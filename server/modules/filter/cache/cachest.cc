@@ -77,7 +77,38 @@ bool CacheST::must_refresh(const CACHE_KEY& key, const CacheFilterSession* pSess
 
 void CacheST::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession)
 {
-    CacheSimple::do_refreshed(key, pSession);
+    Waiters woken;
+
+    CacheSimple::do_refreshed(key, pSession, woken);
+    CacheSimple::wake(woken);
+}
+
+bool CacheST::wait_for(const CACHE_KEY& key, CacheFilterSession* pSession)
+{
+    return CacheSimple::do_wait_for(key, pSession);
+}
+
+void CacheST::expire_waits(uint32_t timeout)
+{
+    Waiters woken;
+
+    CacheSimple::do_expire_waits(timeout, woken);
+    CacheSimple::wake(woken);
+}
+
+uint64_t CacheST::generation() const
+{
+    return CacheSimple::do_generation();
+}
+
+void CacheST::set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation)
+{
+    CacheSimple::do_set_tables(key, tables, generation);
+}
+
+void CacheST::invalidate(const Tables& tables)
+{
+    CacheSimple::do_invalidate(tables);
 }
 
 // static
@@ -97,7 +128,9 @@ CacheST* CacheST::Create(const std::string&  name,
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
 
-    Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config, argc, argv);
+    Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config,
+                                                1, pConfig->eviction,
+                                                argc, argv);
 
     if (pStorage)
     {
@@ -32,6 +32,16 @@ public:
 
     void refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession);
 
+    bool wait_for(const CACHE_KEY& key, CacheFilterSession* pSession);
+
+    void expire_waits(uint32_t timeout);
+
+    uint64_t generation() const;
+
+    void set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation);
+
+    void invalidate(const Tables& tables);
+
 private:
     CacheST(const std::string&  name,
             const CACHE_CONFIG* pConfig,
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "cachetiered.hh"
+#include <maxscale/atomic.h>
+#include "cachemt.hh"
+#include "storage.hh"
+#include "storagefactory.hh"
+
+using std::tr1::shared_ptr;
+
+namespace
+{
+
+// The storage of the thread caches; always in memory, whatever the shared cache uses.
+const char THREAD_CACHE_STORAGE[] = "storage_inmemory";
+
+// How many times a thread must find an item in the shared cache, before it is
+// copied to the cache of the thread.
+const uint32_t PROMOTION_HITS = 2;
+
+// The maximum number of items whose hits are counted by a thread. When reached,
+// the counting starts anew.
+const size_t MAX_COUNTED_HITS = 4096;
+
+}
+
+CacheTiered::ThreadCache::ThreadCache(Storage* pStorage)
+    : m_pStorage(pStorage)
+{
+}
+
+CacheTiered::ThreadCache::~ThreadCache()
+{
+    delete m_pStorage;
+}
+
+void CacheTiered::ThreadCache::copied(const CACHE_KEY& key, uint64_t generation)
+{
+    try
+    {
+        if (m_generations.size() >= MAX_COUNTED_HITS)
+        {
+            // A copy whose generation is not known is not used.
+            m_generations.clear();
+        }
+
+        m_generations[key] = generation;
+    }
+    catch (const std::exception&)
+    {
+    }
+}
+
+bool CacheTiered::ThreadCache::is_current(const CACHE_KEY& key, uint64_t generation) const
+{
+    Generations::const_iterator i = m_generations.find(key);
+
+    return (i != m_generations.end()) && (i->second == generation);
+}
+
+bool CacheTiered::ThreadCache::hit(const CACHE_KEY& key)
+{
+    bool promote = false;
+
+    try
+    {
+        if (m_hits.size() >= MAX_COUNTED_HITS)
+        {
+            m_hits.clear();
+        }
+
+        Hits::iterator i = m_hits.insert(std::make_pair(key, 0)).first;
+
+        if (++i->second >= PROMOTION_HITS)
+        {
+            m_hits.erase(i);
+            promote = true;
+        }
+    }
+    catch (const std::exception&)
+    {
+    }
+
+    return promote;
+}
+
+CacheTiered::CacheTiered(const std::string&  name,
+                         const CACHE_CONFIG* pConfig,
+                         SCacheRules         sRules,
+                         SStorageFactory     sFactory,
+                         SStorageFactory     sThreadFactory,
+                         SCacheMT            sShared,
+                         const ThreadCaches& thread_caches)
+    : Cache(name, pConfig, sRules, sFactory)
+    , m_sThreadFactory(sThreadFactory)
+    , m_sShared(sShared)
+    , m_thread_caches(thread_caches)
+    , m_generation(0)
+{
+    MXS_NOTICE("Created shared cache with thread caches.");
+}
+
+CacheTiered::~CacheTiered()
+{
+}
+
+// static
+CacheTiered* CacheTiered::Create(const std::string& name, const CACHE_CONFIG* pConfig)
+{
+    ss_dassert(pConfig);
+
+    CacheTiered* pCache = NULL;
+
+    CacheRules* pRules = NULL;
+    StorageFactory* pFactory = NULL;
+
+    if (Cache::Create(*pConfig, &pRules, &pFactory))
+    {
+        shared_ptr<CacheRules> sRules(pRules);
+        shared_ptr<StorageFactory> sFactory(pFactory);
+
+        pCache = Create(name, pConfig, sRules, sFactory);
+    }
+
+    return pCache;
+}
+
+bool CacheTiered::must_refresh(const CACHE_KEY& key, const CacheFilterSession* pSession)
+{
+    return m_sShared->must_refresh(key, pSession);
+}
+
+void CacheTiered::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession)
+{
+    m_sShared->refreshed(key, pSession);
+}
+
+bool CacheTiered::wait_for(const CACHE_KEY& key, CacheFilterSession* pSession)
+{
+    return m_sShared->wait_for(key, pSession);
+}
+
+void CacheTiered::expire_waits(uint32_t timeout)
+{
+    m_sShared->expire_waits(timeout);
+}
+
+uint64_t CacheTiered::generation() const
+{
+    return m_sShared->generation();
+}
+
+void CacheTiered::set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation)
+{
+    m_sShared->set_tables(key, tables, generation);
+}
+
+void CacheTiered::invalidate(const Tables& tables)
+{
+    // The copies in the thread caches are not deleted, but they will not be used
+    // as the generation changes.
+    m_sShared->invalidate(tables);
+}
+
+json_t* CacheTiered::get_info(uint32_t what) const
+{
+    json_t* pInfo = m_sShared->get_info(what);
+
+    if (pInfo && (what & INFO_STORAGE))
+    {
+        for (size_t i = 0; i < m_thread_caches.size(); ++i)
+        {
+            char key[20]; // Surely enough.
+            sprintf(key, "thread-%u", (unsigned int)i + 1);
+
+            json_t* pThreadInfo;
+
+            cache_result_t result = m_thread_caches[i]->storage().get_info(Storage::INFO_ALL,
+                                                                           &pThreadInfo);
+
+            if (CACHE_RESULT_IS_OK(result))
+            {
+                json_object_set(pInfo, key, pThreadInfo);
+                json_decref(pThreadInfo);
+            }
+        }
+    }
+
+    return pInfo;
+}
+
+cache_result_t CacheTiered::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const
+{
+    ThreadCache& thread_cache = this->thread_cache();
+
+    bool invalidating = (m_config.invalidate != CACHE_INVALIDATE_NEVER);
+    uint64_t shared_generation = invalidating ? m_sShared->generation() : 0;
+
+    cache_result_t result = thread_cache.storage().get_value(key, flags, ppValue);
+
+    if (CACHE_RESULT_IS_OK(result) && invalidating && !thread_cache.is_current(key, shared_generation))
+    {
+        gwbuf_free(*ppValue);
+        thread_cache.storage().del_value(key);
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+
+    if (!CACHE_RESULT_IS_OK(result))
+    {
+        int generation = atomic_add(&m_generation, 0);
+
+        result = m_sShared->get_value(key, flags, ppValue);
+
+        if (CACHE_RESULT_IS_OK(result) && !CACHE_RESULT_IS_STALE(result) && thread_cache.hit(key))
+        {
+            thread_cache.storage().put_value(key, *ppValue);
+            thread_cache.copied(key, shared_generation);
+
+            // If the item was stored or deleted meanwhile, the value that was
+            // copied may be outdated and the invalidation may have been missed.
+            if (atomic_add(&m_generation, 0) != generation)
+            {
+                thread_cache.storage().del_value(key);
+            }
+        }
+    }
+
+    return result;
+}
+
+cache_result_t CacheTiered::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+{
+    cache_result_t result = m_sShared->put_value(key, pValue);
+
+    invalidate_threads(key);
+
+    return result;
+}
+
+cache_result_t CacheTiered::del_value(const CACHE_KEY& key)
+{
+    cache_result_t result = m_sShared->del_value(key);
+
+    invalidate_threads(key);
+
+    return result;
+}
+
+cache_result_t CacheTiered::save_snapshot(const char* zPath)
+{
+    return m_sShared->save_snapshot(zPath);
+}
+
+cache_result_t CacheTiered::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    return m_sShared->load_snapshot(zPath, pItems);
+}
+
+// static
+CacheTiered* CacheTiered::Create(const std::string&  name,
+                                 const CACHE_CONFIG* pConfig,
+                                 SCacheRules         sRules,
+                                 SStorageFactory     sFactory)
+{
+    CacheTiered* pCache = NULL;
+
+    StorageFactory* pThreadFactory = StorageFactory::Open(THREAD_CACHE_STORAGE);
+
+    if (!pThreadFactory)
+    {
+        MXS_ERROR("Could not open storage factory '%s' for the thread caches.", THREAD_CACHE_STORAGE);
+        return NULL;
+    }
+
+    try
+    {
+        shared_ptr<StorageFactory> sThreadFactory(pThreadFactory);
+        pThreadFactory = NULL;
+
+        CacheMT* pShared = CacheMT::Create(name, sRules, sFactory, pConfig);
+
+        if (pShared)
+        {
+            shared_ptr<CacheMT> sShared(pShared);
+
+            // The storages are locked, since other threads invalidate items in them.
+            CacheStorageConfig storage_config(CACHE_THREAD_MODEL_MT,
+                                              pConfig->hard_ttl,
+                                              pConfig->soft_ttl,
+                                              0,
+                                              pConfig->thread_cache_max_size);
+
+            int n_threads = config_threadcount();
+
+            ThreadCaches thread_caches;
+
+            bool error = false;
+            int i = 0;
+
+            while (!error && (i < n_threads))
+            {
+                Storage* pStorage = sThreadFactory->createStorage(name.c_str(), storage_config,
+                                                                  1, pConfig->eviction);
+
+                ThreadCache* pThreadCache = NULL;
+
+                if (pStorage)
+                {
+                    MXS_EXCEPTION_GUARD(pThreadCache = new ThreadCache(pStorage));
+
+                    if (!pThreadCache)
+                    {
+                        delete pStorage;
+                    }
+                }
+
+                if (pThreadCache)
+                {
+                    shared_ptr<ThreadCache> sThreadCache(pThreadCache);
+
+                    thread_caches.push_back(sThreadCache);
+                }
+                else
+                {
+                    error = true;
+                }
+
+                ++i;
+            }
+
+            if (!error)
+            {
+                pCache = new CacheTiered(name, pConfig, sRules, sFactory,
+                                         sThreadFactory, sShared, thread_caches);
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        delete pThreadFactory;
+    }
+
+    return pCache;
+}
+
+CacheTiered::ThreadCache& CacheTiered::thread_cache() const
+{
+    int i = thread_index();
+    ss_dassert(i < (int)m_thread_caches.size());
+    return *m_thread_caches[i].get();
+}
+
+void CacheTiered::invalidate_threads(const CACHE_KEY& key)
+{
+    atomic_add(&m_generation, 1);
+
+    for (ThreadCaches::iterator i = m_thread_caches.begin(); i != m_thread_caches.end(); ++i)
+    {
+        (*i)->storage().del_value(key);
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <tr1/memory>
+#include <tr1/unordered_map>
+#include <vector>
+#include "cache.hh"
+#include "cache_storage_api.hh"
+
+class CacheMT;
+class Storage;
+
+/**
+ * CacheTiered is a shared cache in front of which each thread has a small
+ * cache of its own. An item found in the shared cache is copied to the
+ * thread cache after it has been repeatedly found by the same thread, after
+ * which that thread finds it without touching the shared cache.
+ *
+ * When an item is stored or deleted, it is deleted from the caches of all
+ * threads. When tables are invalidated, the copies in the caches of the
+ * threads that were made before that are no longer used.
+ */
+class CacheTiered : public Cache
+{
+public:
+    ~CacheTiered();
+
+    static CacheTiered* Create(const std::string& name, const CACHE_CONFIG* pConfig);
+
+    bool must_refresh(const CACHE_KEY& key, const CacheFilterSession* pSession);
+
+    void refreshed(const CACHE_KEY& key, const CacheFilterSession* pSession);
+
+    bool wait_for(const CACHE_KEY& key, CacheFilterSession* pSession);
+
+    void expire_waits(uint32_t timeout);
+
+    uint64_t generation() const;
+
+    void set_tables(const CACHE_KEY& key, const Tables& tables, uint64_t generation);
+
+    void invalidate(const Tables& tables);
+
+    json_t* get_info(uint32_t what) const;
+
+    cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const;
+
+    cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue);
+
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    /**
+     * Saves the items of the shared cache. The thread caches are filled
+     * again as the items are used.
+     */
+    cache_result_t save_snapshot(const char* zPath);
+
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
+private:
+    /**
+     * The cache of one thread. The storage is locked, as other threads
+     * delete from it, but the hit counts are used only by the thread itself.
+     */
+    class ThreadCache
+    {
+    public:
+        ThreadCache(Storage* pStorage);
+        ~ThreadCache();
+
+        Storage& storage()
+        {
+            return *m_pStorage;
+        }
+
+        /**
+         * Record that an item was found in the shared cache.
+         *
+         * @param key  The key of the item.
+         *
+         * @return True, if the item should be copied to the thread cache.
+         */
+        bool hit(const CACHE_KEY& key);
+
+        /**
+         * Record that an item was copied to the thread cache.
+         *
+         * @param key         The key of the item.
+         * @param generation  The invalidation generation of the shared cache.
+         */
+        void copied(const CACHE_KEY& key, uint64_t generation);
+
+        /**
+         * Whether the copy of an item may be used.
+         *
+         * @param key         The key of the item.
+         * @param generation  The invalidation generation of the shared cache.
+         *
+         * @return True, if no tables have been invalidated since the item was copied.
+         */
+        bool is_current(const CACHE_KEY& key, uint64_t generation) const;
+
+    private:
+        ThreadCache(const ThreadCache&);
+        ThreadCache& operator = (const ThreadCache&);
+
+        typedef std::tr1::unordered_map<CACHE_KEY, uint32_t> Hits;
+        typedef std::tr1::unordered_map<CACHE_KEY, uint64_t> Generations;
+
+        Storage*    m_pStorage;    // The storage of the thread cache.
+        Hits        m_hits;        // How many times items have been found in the shared cache.
+        Generations m_generations; // The invalidation generation when items were copied.
+    };
+
+    typedef std::tr1::shared_ptr<CacheMT>     SCacheMT;
+    typedef std::tr1::shared_ptr<ThreadCache> SThreadCache;
+    typedef std::vector<SThreadCache>         ThreadCaches;
+
+    CacheTiered(const std::string&  name,
+                const CACHE_CONFIG* pConfig,
+                SCacheRules         sRules,
+                SStorageFactory     sFactory,
+                SStorageFactory     sThreadFactory,
+                SCacheMT            sShared,
+                const ThreadCaches& thread_caches);
+
+    static CacheTiered* Create(const std::string&  name,
+                               const CACHE_CONFIG* pConfig,
+                               SCacheRules         sRules,
+                               SStorageFactory     sFactory);
+
+    ThreadCache& thread_cache() const;
+
+    void invalidate_threads(const CACHE_KEY& key);
+
+private:
+    CacheTiered(const Cache&);
+    CacheTiered& operator = (const CacheTiered&);
+
+private:
+    SStorageFactory m_sThreadFactory; // The factory of the thread cache storages.
+    SCacheMT        m_sShared;        // The shared cache.
+    ThreadCaches    m_thread_caches;  // The thread caches.
+    mutable int     m_generation;     // Incremented whenever an item is stored or deleted.
+};
@@ -0,0 +1,251 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string.h>
+#include <zlib.h>
+#include "cache_storage_api.h"
+
+/**
+ * The hash functions that can be used for generating the cache keys. The
+ * function is selected at compile time by defining CACHE_KEY_HASH, e.g. with
+ * -DCACHE_KEY_HASH=CACHE_KEY_HASH_CRC32. Note that the keys generated by
+ * different functions differ, so a persistent storage must be cleared if
+ * the function is changed.
+ */
+#define CACHE_KEY_HASH_MURMUR3 1 // MurmurHash3, the x64 128-bit variant.
+#define CACHE_KEY_HASH_CRC32   2 // CRC-32 and the length; fast but weak.
+
+#if !defined(CACHE_KEY_HASH)
+#define CACHE_KEY_HASH CACHE_KEY_HASH_MURMUR3
+#endif
+
+/**
+ * Murmur3Hasher calculates the 128-bit MurmurHash3 of data given in pieces
+ * of any size. The result is the same as if all the data had been given at
+ * once, so the pieces need not be copied into a contiguous buffer.
+ */
+class Murmur3Hasher
+{
+public:
+    Murmur3Hasher()
+        : m_h1(0)
+        , m_h2(0)
+        , m_length(0)
+        , m_nPending(0)
+    {
+    }
+
+    /**
+     * Add data.
+     *
+     * @param pData  The data.
+     * @param len    The length of the data.
+     */
+    void update(const void* pData, size_t len)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(pData);
+        const uint8_t* pEnd = p + len;
+
+        m_length += len;
+
+        if (m_nPending != 0)
+        {
+            // Complete the block started by an earlier piece.
+            size_t n = BLOCK_SIZE - m_nPending;
+
+            if (n > len)
+            {
+                n = len;
+            }
+
+            memcpy(m_pending + m_nPending, p, n);
+            m_nPending += n;
+            p += n;
+
+            if (m_nPending < BLOCK_SIZE)
+            {
+                return;
+            }
+
+            block(m_pending);
+            m_nPending = 0;
+        }
+
+        while (pEnd - p >= (ptrdiff_t)BLOCK_SIZE)
+        {
+            block(p);
+            p += BLOCK_SIZE;
+        }
+
+        m_nPending = pEnd - p;
+        memcpy(m_pending, p, m_nPending);
+    }
+
+    /**
+     * Calculate the hash of all data that has been added.
+     *
+     * @param pKey  On return, the hash.
+     */
+    void finish(CACHE_KEY* pKey)
+    {
+        uint64_t h1 = m_h1;
+        uint64_t h2 = m_h2;
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+        const uint8_t* pTail = m_pending;
+
+        switch (m_nPending)
+        {
+        case 15: k2 ^= ((uint64_t)pTail[14]) << 48;
+        case 14: k2 ^= ((uint64_t)pTail[13]) << 40;
+        case 13: k2 ^= ((uint64_t)pTail[12]) << 32;
+        case 12: k2 ^= ((uint64_t)pTail[11]) << 24;
+        case 11: k2 ^= ((uint64_t)pTail[10]) << 16;
+        case 10: k2 ^= ((uint64_t)pTail[9]) << 8;
+        case 9:  k2 ^= ((uint64_t)pTail[8]);
+            k2 *= C2;
+            k2 = rotl(k2, 33);
+            k2 *= C1;
+            h2 ^= k2;
+
+        case 8: k1 ^= ((uint64_t)pTail[7]) << 56;
+        case 7: k1 ^= ((uint64_t)pTail[6]) << 48;
+        case 6: k1 ^= ((uint64_t)pTail[5]) << 40;
+        case 5: k1 ^= ((uint64_t)pTail[4]) << 32;
+        case 4: k1 ^= ((uint64_t)pTail[3]) << 24;
+        case 3: k1 ^= ((uint64_t)pTail[2]) << 16;
+        case 2: k1 ^= ((uint64_t)pTail[1]) << 8;
+        case 1: k1 ^= ((uint64_t)pTail[0]);
+            k1 *= C1;
+            k1 = rotl(k1, 31);
+            k1 *= C2;
+            h1 ^= k1;
+        }
+
+        h1 ^= m_length;
+        h2 ^= m_length;
+
+        h1 += h2;
+        h2 += h1;
+
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+
+        h1 += h2;
+        h2 += h1;
+
+        pKey->data[0] = h1;
+        pKey->data[1] = h2;
+    }
+
+private:
+    enum
+    {
+        BLOCK_SIZE = 16
+    };
+
+    static const uint64_t C1 = 0x87c37b91114253d5ULL;
+    static const uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    static uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t fmix(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+
+        return k;
+    }
+
+    void block(const uint8_t* p)
+    {
+        uint64_t k1;
+        uint64_t k2;
+
+        // The block need not be aligned.
+        memcpy(&k1, p, sizeof(k1));
+        memcpy(&k2, p + sizeof(k1), sizeof(k2));
+
+        k1 *= C1;
+        k1 = rotl(k1, 31);
+        k1 *= C2;
+        m_h1 ^= k1;
+
+        m_h1 = rotl(m_h1, 27);
+        m_h1 += m_h2;
+        m_h1 = m_h1 * 5 + 0x52dce729;
+
+        k2 *= C2;
+        k2 = rotl(k2, 33);
+        k2 *= C1;
+        m_h2 ^= k2;
+
+        m_h2 = rotl(m_h2, 31);
+        m_h2 += m_h1;
+        m_h2 = m_h2 * 5 + 0x38495ab5;
+    }
+
+private:
+    uint64_t m_h1;                  // The first half of the state.
+    uint64_t m_h2;                  // The second half of the state.
+    uint64_t m_length;              // The length of all data.
+    uint8_t  m_pending[BLOCK_SIZE]; // The start of a block not yet complete.
+    size_t   m_nPending;            // The length of the incomplete block.
+};
+
+/**
+ * Crc32Hasher calculates the CRC-32 of data given in pieces of any size. The
+ * hash consists of the CRC-32 and the length of the data, so it is considerably
+ * weaker than the one of Murmur3Hasher.
+ */
+class Crc32Hasher
+{
+public:
+    Crc32Hasher()
+        : m_crc(crc32(0, Z_NULL, 0))
+        , m_length(0)
+    {
+    }
+
+    void update(const void* pData, size_t len)
+    {
+        m_crc = crc32(m_crc, static_cast<const Bytef*>(pData), len);
+        m_length += len;
+    }
+
+    void finish(CACHE_KEY* pKey)
+    {
+        pKey->data[0] = m_crc;
+        pKey->data[1] = m_length;
+    }
+
+private:
+    uLong    m_crc;    // The CRC-32 of the data so far.
+    uint64_t m_length; // The length of all data.
+};
+
+#if CACHE_KEY_HASH == CACHE_KEY_HASH_MURMUR3
+typedef Murmur3Hasher KeyHasher;
+#elif CACHE_KEY_HASH == CACHE_KEY_HASH_CRC32
+typedef Crc32Hasher KeyHasher;
+#else
+#error Unknown CACHE_KEY_HASH.
+#endif
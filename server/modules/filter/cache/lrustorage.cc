@@ -13,24 +13,69 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "lrustorage.hh"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <maxscale/clock.h>
+
+namespace
+{
+
+// The share of the cache, in percent, used by the TinyLFU window.
+const uint64_t TINYLFU_WINDOW_PERCENT = 1;
+
+// The share of the main part of the cache, in percent, used by the protected list.
+const uint64_t TINYLFU_PROTECTED_PERCENT = 80;
 
-LRUStorage::LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+// The average value size assumed when sizing the frequency sketch by max_size.
+const uint64_t TINYLFU_ASSUMED_VALUE_SIZE = 1024;
+
+// The beginning of a snapshot file, followed by the version of the format.
+const char     SNAPSHOT_MAGIC[] = "MXSCACHE";
+const uint32_t SNAPSHOT_VERSION = 1;
+
+inline uint64_t share(uint64_t max, uint64_t percent)
+{
+    return max == UINT64_MAX ? UINT64_MAX : std::max(max / 100 * percent, (uint64_t)1);
+}
+
+}
+
+LRUStorage::LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, cache_eviction_t eviction)
     : m_config(config)
     , m_pStorage(pStorage)
     , m_max_count(config.max_count != 0 ? config.max_count : UINT64_MAX)
     , m_max_size(config.max_size != 0 ? config.max_size : UINT64_MAX)
-    , m_pHead(NULL)
-    , m_pTail(NULL)
+    , m_eviction(eviction)
+    , m_window_max_count(share(m_max_count, TINYLFU_WINDOW_PERCENT))
+    , m_window_max_size(share(m_max_size, TINYLFU_WINDOW_PERCENT))
+    , m_protected_max_count(share(m_max_count, TINYLFU_PROTECTED_PERCENT))
+    , m_protected_max_size(share(m_max_size, TINYLFU_PROTECTED_PERCENT))
 {
+    if (m_eviction == CACHE_EVICTION_TINYLFU)
+    {
+        uint64_t capacity = m_max_count;
+
+        if (capacity == UINT64_MAX && m_max_size != UINT64_MAX)
+        {
+            capacity = m_max_size / TINYLFU_ASSUMED_VALUE_SIZE;
+        }
+
+        m_sketch.init(capacity);
+    }
 }
 
 LRUStorage::~LRUStorage()
 {
-    Node* pnode = m_pHead;
-
-    while (m_pHead)
+    for (int i = 0; i < N_SEGMENTS; ++i)
     {
-        free_node(m_pHead); // Adjusts m_pHead
+        while (m_segments[i].pHead)
+        {
+            free_node(m_segments[i].pHead); // Adjusts the head of the segment.
+        }
     }
 
     delete m_pStorage;
@@ -76,10 +121,26 @@ cache_result_t LRUStorage::do_get_value(const CACHE_KEY& key,
                                         uint32_t flags,
                                         GWBUF** ppValue) const
 {
-    return access_value(APPROACH_GET, key, flags, ppValue);
+    access_approach_t approach = (flags & CACHE_FLAGS_PEEK) ? APPROACH_PEEK : APPROACH_GET;
+
+    return access_value(approach, key, flags, ppValue);
 }
 
 cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalue)
+{
+    return store_value(key, pvalue, mxs_clock_time());
+}
+
+/**
+ * Store a value.
+ *
+ * @param key     The key.
+ * @param pvalue  The value.
+ * @param time    When the value was stored, used for the TTLs.
+ *
+ * @return The result of storing the value.
+ */
+cache_result_t LRUStorage::store_value(const CACHE_KEY& key, const GWBUF* pvalue, uint32_t time)
 {
     cache_result_t result = CACHE_RESULT_ERROR;
 
@@ -118,10 +179,21 @@ cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalu
                 ++m_stats.items;
             }
 
+            // The node is relinked, as the size of the list changes.
+            segment_t segment = pNode->segment();
+            remove_node(pNode);
+
             pNode->reset(&i->first, value_size);
+            pNode->set_time(time);
             m_stats.size += pNode->size();
 
-            move_to_head(pNode);
+            move_to_head(pNode, segment);
+
+            if (m_eviction == CACHE_EVICTION_TINYLFU)
+            {
+                // May evict the node itself, if it is not admitted.
+                evict_tinylfu();
+            }
         }
         else if (!existed)
         {
@@ -166,17 +238,19 @@ cache_result_t LRUStorage::do_get_head(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
 
+    Node* pHead;
+
     // Since it's the head it's unlikely to have happened, but we need to loop to
     // cater for the case that ttl has hit in.
-    while (m_pHead && (CACHE_RESULT_IS_NOT_FOUND(result)))
+    while ((pHead = head()) && (CACHE_RESULT_IS_NOT_FOUND(result)))
     {
-        ss_dassert(m_pHead->key());
-        result = do_get_value(*m_pHead->key(), CACHE_FLAGS_INCLUDE_STALE, ppValue);
+        ss_dassert(pHead->key());
+        result = do_get_value(*pHead->key(), CACHE_FLAGS_INCLUDE_STALE, ppValue);
     }
 
     if (CACHE_RESULT_IS_OK(result))
     {
-        *pKey = *m_pHead->key();
+        *pKey = *pHead->key();
     }
 
     return result;
@@ -186,16 +260,18 @@ cache_result_t LRUStorage::do_get_tail(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
 
+    Node* pTail;
+
     // We need to loop to cater for the case that ttl has hit in.
-    while (m_pTail && CACHE_RESULT_IS_NOT_FOUND(result))
+    while ((pTail = tail()) && CACHE_RESULT_IS_NOT_FOUND(result))
     {
-        ss_dassert(m_pTail->key());
-        result = peek_value(*m_pTail->key(), CACHE_FLAGS_INCLUDE_STALE, ppValue);
+        ss_dassert(pTail->key());
+        result = peek_value(*pTail->key(), CACHE_FLAGS_INCLUDE_STALE, ppValue);
     }
 
     if (CACHE_RESULT_IS_OK(result))
     {
-        *pKey = *m_pTail->key();
+        *pKey = *pTail->key();
     }
 
     return result;
@@ -220,6 +296,13 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
 
+    if ((approach == APPROACH_GET) && (m_eviction == CACHE_EVICTION_TINYLFU))
+    {
+        // Misses are counted as well, as they decide whether the value
+        // will be admitted when it is stored.
+        m_sketch.increment(key);
+    }
+
     NodesByKey::iterator i = m_nodes_by_key.find(key);
     bool existed = (i != m_nodes_by_key.end());
 
@@ -227,13 +310,30 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
     {
         result = m_pStorage->get_value(key, flags, ppValue);
 
+        if (CACHE_RESULT_IS_OK(result) && ((m_config.hard_ttl != 0) || (m_config.soft_ttl != 0)))
+        {
+            result = apply_ttl(i->second, flags, result, ppValue);
+        }
+
         if (CACHE_RESULT_IS_OK(result))
         {
             ++m_stats.hits;
 
             if (approach == APPROACH_GET)
             {
-                move_to_head(i->second);
+                if (m_eviction == CACHE_EVICTION_CLOCK)
+                {
+                    // No relinking on a hit, the mark is inspected at eviction time.
+                    i->second->set_referenced(true);
+                }
+                else if (m_eviction == CACHE_EVICTION_TINYLFU)
+                {
+                    promote(i->second);
+                }
+                else
+                {
+                    move_to_head(i->second);
+                }
             }
         }
         else if (CACHE_RESULT_IS_NOT_FOUND(result))
@@ -255,6 +355,118 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
     return result;
 }
 
+/**
+ * With CLOCK eviction, move the nodes at the tail that have been accessed
+ * since they were last inspected to the head, without their mark, so that
+ * the tail is a node that has not been accessed since.
+ */
+/**
+ * Apply the TTLs to a value found in the real storage. The real storage
+ * applies them as well, but it does not know when a value loaded from
+ * a snapshot was originally stored.
+ *
+ * @param pNode     The node of the value.
+ * @param flags     The flags of the lookup.
+ * @param result    The result of the lookup from the real storage.
+ * @param ppValue   The value, freed if it may not be returned.
+ *
+ * @return The result of the lookup.
+ */
+cache_result_t LRUStorage::apply_ttl(Node* pNode,
+                                     uint32_t flags,
+                                     cache_result_t result,
+                                     GWBUF** ppValue) const
+{
+    uint32_t age = mxs_clock_time() - pNode->time();
+
+    bool is_hard_stale = m_config.hard_ttl == 0 ? false : (age > m_config.hard_ttl);
+    bool is_soft_stale = m_config.soft_ttl == 0 ? false : (age > m_config.soft_ttl);
+    bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+    if (is_hard_stale)
+    {
+        gwbuf_free(*ppValue);
+        *ppValue = NULL;
+
+        m_pStorage->del_value(*pNode->key());
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+    else if (is_soft_stale)
+    {
+        if (include_stale)
+        {
+            result |= CACHE_RESULT_STALE;
+        }
+        else
+        {
+            gwbuf_free(*ppValue);
+            *ppValue = NULL;
+
+            result = (CACHE_RESULT_NOT_FOUND | CACHE_RESULT_STALE);
+        }
+    }
+
+    return result;
+}
+
+void LRUStorage::give_second_chances()
+{
+    if (m_eviction == CACHE_EVICTION_CLOCK)
+    {
+        Segment& main = m_segments[SEGMENT_MAIN];
+
+        // Terminates, as each moved node loses its mark.
+        while (main.pTail && main.pTail->referenced())
+        {
+            Node* pNode = main.pTail;
+
+            pNode->set_referenced(false);
+            move_to_head(pNode);
+        }
+    }
+}
+
+/**
+ * @return The most recently used node.
+ */
+LRUStorage::Node* LRUStorage::head() const
+{
+    // With TinyLFU, the most recently stored node is at the head of the window.
+    Node* pHead = m_segments[SEGMENT_WINDOW].pHead;
+
+    if (!pHead)
+    {
+        pHead = m_segments[SEGMENT_PROTECTED].pHead;
+    }
+
+    if (!pHead)
+    {
+        pHead = m_segments[SEGMENT_MAIN].pHead;
+    }
+
+    return pHead;
+}
+
+/**
+ * @return The node that would be evicted first.
+ */
+LRUStorage::Node* LRUStorage::tail() const
+{
+    Node* pTail = m_segments[SEGMENT_MAIN].pTail;
+
+    if (!pTail)
+    {
+        pTail = m_segments[SEGMENT_PROTECTED].pTail;
+    }
+
+    if (!pTail)
+    {
+        pTail = m_segments[SEGMENT_WINDOW].pTail;
+    }
+
+    return pTail;
+}
+
 /**
  * Free the data associated with the least recently used node,
  * but not the node itself.
@@ -263,13 +475,17 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
  */
 LRUStorage::Node* LRUStorage::vacate_lru()
 {
-    ss_dassert(m_pTail);
+    ss_dassert(tail());
 
     Node* pNode = NULL;
 
-    if (free_node_data(m_pTail))
+    give_second_chances();
+
+    Node* pTail = tail();
+
+    if (free_node_data(pTail))
     {
-        pNode = m_pTail;
+        pNode = pTail;
 
         remove_node(pNode);
     }
@@ -291,15 +507,18 @@ LRUStorage::Node* LRUStorage::vacate_lru(size_t needed_space)
     size_t freed_space = 0;
     bool error = false;
 
-    while (!error && m_pTail && (freed_space < needed_space))
+    while (!error && tail() && (freed_space < needed_space))
     {
-        size_t size = m_pTail->size();
+        give_second_chances();
 
-        if (free_node_data(m_pTail))
+        Node* pTail = tail();
+        size_t size = pTail->size();
+
+        if (free_node_data(pTail))
         {
             freed_space += size;
 
-            pNode = m_pTail;
+            pNode = pTail;
 
             remove_node(pNode);
 
@@ -385,9 +604,6 @@ void LRUStorage::free_node(Node* pNode) const
 {
     remove_node(pNode);
     delete pNode;
-
-    ss_dassert(!m_pHead || (m_pHead->prev() == NULL));
-    ss_dassert(!m_pTail || (m_pTail->next() == NULL));
 }
 
 /**
@@ -402,58 +618,186 @@ void LRUStorage::free_node(NodesByKey::iterator& i) const
 }
 
 /**
- * Remove a node and update head/tail accordingly.
+ * Remove a node from its list and update head/tail accordingly. Nothing is
+ * done if the node is not in a list.
  *
  * @param pNode  The node to be removed.
  */
 void LRUStorage::remove_node(Node* pNode) const
 {
-    ss_dassert(m_pHead->prev() == NULL);
-    ss_dassert(m_pTail->next() == NULL);
+    if (pNode->segment() == SEGMENT_NONE)
+    {
+        return;
+    }
+
+    Segment& segment = m_segments[pNode->segment()];
 
-    if (m_pHead == pNode)
+    ss_dassert(segment.pHead->prev() == NULL);
+    ss_dassert(segment.pTail->next() == NULL);
+
+    if (segment.pHead == pNode)
     {
-        m_pHead = m_pHead->next();
+        segment.pHead = segment.pHead->next();
     }
 
-    if (m_pTail == pNode)
+    if (segment.pTail == pNode)
     {
-        m_pTail = m_pTail->prev();
+        segment.pTail = segment.pTail->prev();
     }
 
     pNode->remove();
+    pNode->set_segment(SEGMENT_NONE);
+
+    ss_dassert(segment.count > 0);
+    ss_dassert(segment.size >= pNode->size());
 
-    ss_dassert(!m_pHead || (m_pHead->prev() == NULL));
-    ss_dassert(!m_pTail || (m_pTail->next() == NULL));
+    segment.count -= 1;
+    segment.size -= pNode->size();
+
+    ss_dassert(!segment.pHead || (segment.pHead->prev() == NULL));
+    ss_dassert(!segment.pTail || (segment.pTail->next() == NULL));
 }
 
 /**
- * Move a node to head.
+ * Move a node to the head of its list. A node that is not in a list is
+ * put in the window with TinyLFU, in the main list otherwise.
  *
  * @param pNode  The node to be moved to head.
  */
 void LRUStorage::move_to_head(Node* pNode) const
 {
-    ss_dassert(!m_pHead || (m_pHead->prev() == NULL));
-    ss_dassert(!m_pTail || (m_pTail->next() == NULL));
+    move_to_head(pNode, pNode->segment());
+}
 
-    if (m_pTail == pNode)
+/**
+ * Move a node to the head of a list.
+ *
+ * @param pNode    The node to be moved to head.
+ * @param segment  The list, if SEGMENT_NONE, the list of new nodes.
+ */
+void LRUStorage::move_to_head(Node* pNode, segment_t segment) const
+{
+    if (segment == SEGMENT_NONE)
     {
-        m_pTail = pNode->prev();
+        segment = (m_eviction == CACHE_EVICTION_TINYLFU) ? SEGMENT_WINDOW : SEGMENT_MAIN;
     }
 
-    m_pHead = pNode->prepend(m_pHead);
+    Segment& to = m_segments[segment];
 
-    if (!m_pTail)
+    if (to.pHead != pNode)
     {
-        m_pTail = m_pHead;
+        remove_node(pNode);
+
+        to.pHead = pNode->prepend(to.pHead);
+
+        if (!to.pTail)
+        {
+            to.pTail = to.pHead;
+        }
+
+        pNode->set_segment(segment);
+
+        to.count += 1;
+        to.size += pNode->size();
     }
 
-    ss_dassert(m_pHead);
-    ss_dassert(m_pTail);
-    ss_dassert((m_pHead != m_pTail) || (m_pHead == pNode));
-    ss_dassert(m_pHead->prev() == NULL);
-    ss_dassert(m_pTail->next() == NULL);
+    ss_dassert(to.pHead == pNode);
+    ss_dassert(to.pTail);
+    ss_dassert(to.pHead->prev() == NULL);
+    ss_dassert(to.pTail->next() == NULL);
+}
+
+/**
+ * Record a hit of a node with TinyLFU. A node in the probation list is moved
+ * to the protected list, from which the least recently used nodes are moved
+ * back to the probation list if the protected list becomes too large.
+ *
+ * @param pNode  The node that was accessed.
+ */
+void LRUStorage::promote(Node* pNode) const
+{
+    if (pNode->segment() == SEGMENT_MAIN)
+    {
+        Segment& prot = m_segments[SEGMENT_PROTECTED];
+
+        move_to_head(pNode, SEGMENT_PROTECTED);
+
+        while ((prot.pTail != pNode) && prot.exceeds(m_protected_max_count, m_protected_max_size))
+        {
+            move_to_head(prot.pTail, SEGMENT_MAIN);
+        }
+    }
+    else
+    {
+        move_to_head(pNode);
+    }
+}
+
+/**
+ * Restore the limits of the cache with TinyLFU. The nodes that do not fit in
+ * the window are moved to the probation list as candidates. If the cache is
+ * full, each candidate is compared with the least recently used node of the
+ * probation list, the victim, and the one that has been accessed less
+ * frequently is evicted.
+ */
+void LRUStorage::evict_tinylfu()
+{
+    Segment& window = m_segments[SEGMENT_WINDOW];
+    Segment& probation = m_segments[SEGMENT_MAIN];
+
+    size_t n_candidates = 0;
+
+    while (window.pTail && window.exceeds(m_window_max_count, m_window_max_size))
+    {
+        move_to_head(window.pTail, SEGMENT_MAIN);
+        ++n_candidates;
+    }
+
+    // The candidates are at the head of the probation list, the one that was
+    // in the window the longest time furthest from the head.
+    Node* pCandidate = NULL;
+
+    if (n_candidates != 0)
+    {
+        pCandidate = probation.pHead;
+
+        for (size_t i = 1; i < n_candidates; ++i)
+        {
+            pCandidate = pCandidate->next();
+        }
+    }
+
+    bool error = false;
+
+    while (!error && ((m_stats.items > m_max_count) || (m_stats.size > m_max_size)))
+    {
+        Node* pVictim = tail();
+        ss_dassert(pVictim);
+
+        Node* pEvicted = pVictim;
+
+        if (pCandidate == pVictim)
+        {
+            // Only candidates remain in the probation list.
+            pCandidate = NULL;
+        }
+        else if (pCandidate &&
+                 (m_sketch.frequency(*pCandidate->key()) <= m_sketch.frequency(*pVictim->key())))
+        {
+            pEvicted = pCandidate;
+            pCandidate = (--n_candidates != 0) ? pCandidate->prev() : NULL;
+            ++m_stats.rejections;
+        }
+
+        if (free_node_data(pEvicted))
+        {
+            free_node(pEvicted);
+        }
+        else
+        {
+            error = true;
+        }
+    }
 }
 
 cache_result_t LRUStorage::get_existing_node(NodesByKey::iterator& i, const GWBUF* pValue, Node** ppNode)
@@ -483,14 +827,21 @@ cache_result_t LRUStorage::get_existing_node(NodesByKey::iterator& i, const GWBU
 
         size_t new_size = m_stats.size - pNode->size() + value_size;
 
-        if (new_size > m_max_size)
+        if ((new_size > m_max_size) && (m_eviction != CACHE_EVICTION_TINYLFU))
         {
             ss_dassert(value_size > pNode->size());
 
             // We move it to the front, so that we do not have to deal with the case
-            // that 'pNode' is subject to removal.
+            // that 'pNode' is subject to removal. With CLOCK eviction it must also be
+            // marked, as otherwise it could end up at the tail when the marked nodes
+            // behind it are given a second chance.
             move_to_head(pNode);
 
+            if (m_eviction == CACHE_EVICTION_CLOCK)
+            {
+                pNode->set_referenced(true);
+            }
+
             size_t extra_size = value_size - pNode->size();
 
             Node* pVacant_node = vacate_lru(extra_size);
@@ -511,6 +862,7 @@ cache_result_t LRUStorage::get_existing_node(NodesByKey::iterator& i, const GWBU
         }
         else
         {
+            // With TinyLFU, the limits are restored after the value has been replaced.
             ss_dassert(m_stats.items <= m_max_count);
             *ppNode = pNode;
         }
@@ -531,7 +883,20 @@ cache_result_t LRUStorage::get_new_node(const CACHE_KEY& key,
 
     Node* pNode = NULL;
 
-    if ((new_size > m_max_size) || (m_stats.items == m_max_count))
+    if (m_eviction == CACHE_EVICTION_TINYLFU)
+    {
+        // The limits are restored after the node has been added.
+        if (value_size <= m_max_size)
+        {
+            pNode = new (std::nothrow) Node;
+        }
+
+        if (!pNode)
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+    }
+    else if ((new_size > m_max_size) || (m_stats.items == m_max_count))
     {
         if (new_size > m_max_size)
         {
@@ -599,4 +964,282 @@ void LRUStorage::Stats::fill(json_t* pObject) const
     set_integer(pObject, "updates", updates);
     set_integer(pObject, "deletes", deletes);
     set_integer(pObject, "evictions", evictions);
+    set_integer(pObject, "rejections", rejections);
+}
+
+void LRUStorage::FrequencySketch::init(uint64_t capacity)
+{
+    // One word of 16 counters per expected item, as each key uses 4 counters.
+    uint64_t n_words = 64;
+
+    while ((n_words < capacity) && (n_words < (1 << 24)))
+    {
+        n_words <<= 1;
+    }
+
+    m_table.assign(n_words, 0);
+    m_mask = n_words - 1;
+    m_sample_size = 10 * n_words;
+    m_additions = 0;
+}
+
+//static
+uint64_t LRUStorage::FrequencySketch::index(const CACHE_KEY& key, uint32_t i)
+{
+    // The key is a hash already, so the hash functions are derived from it.
+    uint64_t h = key.data[0] + (i + 1) * key.data[1];
+
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+
+    return h;
+}
+
+void LRUStorage::FrequencySketch::increment(const CACHE_KEY& key)
+{
+    bool added = false;
+
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        uint64_t h = index(key, i);
+        uint64_t& word = m_table[h & m_mask];
+        uint32_t shift = (h >> 60) << 2;
+
+        if (((word >> shift) & 0xf) != 0xf)
+        {
+            word += (UINT64_C(1) << shift);
+            added = true;
+        }
+    }
+
+    if (added && (++m_additions == m_sample_size))
+    {
+        // Halve all counters, so that old accesses count less.
+        for (std::vector<uint64_t>::iterator i = m_table.begin(); i != m_table.end(); ++i)
+        {
+            *i = (*i >> 1) & UINT64_C(0x7777777777777777);
+        }
+
+        m_additions /= 2;
+    }
+}
+
+uint32_t LRUStorage::FrequencySketch::frequency(const CACHE_KEY& key) const
+{
+    uint32_t frequency = 0xf;
+
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        uint64_t h = index(key, i);
+        uint32_t shift = (h >> 60) << 2;
+
+        frequency = std::min(frequency, (uint32_t)((m_table[h & m_mask] >> shift) & 0xf));
+    }
+
+    return frequency;
+}
+
+cache_result_t LRUStorage::do_get_snapshot(Snapshot* pSnapshot) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // With TinyLFU, the window holds the most recently stored items.
+    segment_t segments[] = { SEGMENT_MAIN, SEGMENT_PROTECTED, SEGMENT_WINDOW };
+
+    try
+    {
+        for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); ++i)
+        {
+            for (Node* pNode = m_segments[segments[i]].pTail; pNode; pNode = pNode->prev())
+            {
+                SnapshotItem item;
+                item.key = *pNode->key();
+                item.time = pNode->time();
+
+                // If the value has disappeared from the real storage, it is just skipped.
+                if (CACHE_RESULT_IS_OK(m_pStorage->get_value(item.key, CACHE_FLAGS_INCLUDE_STALE,
+                                                             &item.pValue)))
+                {
+                    pSnapshot->push_back(item);
+                }
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+bool LRUStorage::do_restore(const SnapshotItem& item)
+{
+    bool restored = false;
+
+    // A value stored after the start is more recent than the one in the snapshot.
+    if (m_nodes_by_key.find(item.key) == m_nodes_by_key.end())
+    {
+        uint32_t age = mxs_clock_time() - item.time;
+
+        if ((m_config.hard_ttl == 0) || (age <= m_config.hard_ttl))
+        {
+            restored = (store_value(item.key, item.pValue, item.time) == CACHE_RESULT_OK);
+        }
+    }
+
+    return restored;
+}
+
+//static
+cache_result_t LRUStorage::write_snapshot(const char* zPath, const Snapshot& snapshot)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // The snapshot is written to a temporary file that then replaces the
+    // previous one, so that a crash while writing does not lose it.
+    std::string tmp(zPath);
+    tmp += ".tmp";
+
+    FILE* pFile = fopen(tmp.c_str(), "w");
+
+    if (pFile)
+    {
+        bool ok = (fwrite(SNAPSHOT_MAGIC, 8, 1, pFile) == 1) &&
+                  (fwrite(&SNAPSHOT_VERSION, sizeof(SNAPSHOT_VERSION), 1, pFile) == 1);
+
+        for (Snapshot::const_iterator i = snapshot.begin(); ok && (i != snapshot.end()); ++i)
+        {
+            uint32_t length = GWBUF_LENGTH(i->pValue);
+
+            ok = (fwrite(&i->key, sizeof(i->key), 1, pFile) == 1) &&
+                 (fwrite(&i->time, sizeof(i->time), 1, pFile) == 1) &&
+                 (fwrite(&length, sizeof(length), 1, pFile) == 1) &&
+                 (fwrite(GWBUF_DATA(i->pValue), length, 1, pFile) == 1);
+        }
+
+        ok = (fflush(pFile) == 0) && (fsync(fileno(pFile)) == 0) && ok;
+
+        if (fclose(pFile) != 0)
+        {
+            ok = false;
+        }
+
+        if (ok && (rename(tmp.c_str(), zPath) != 0))
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Could not write the snapshot '%s': %s",
+                      zPath, strerror_r(errno, errbuf, sizeof(errbuf)));
+            unlink(tmp.c_str());
+            result = CACHE_RESULT_ERROR;
+        }
+    }
+    else
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Could not open '%s' for writing: %s",
+                  tmp.c_str(), strerror_r(errno, errbuf, sizeof(errbuf)));
+        result = CACHE_RESULT_ERROR;
+    }
+
+    return result;
+}
+
+//static
+void LRUStorage::free_snapshot(Snapshot& snapshot)
+{
+    for (Snapshot::iterator i = snapshot.begin(); i != snapshot.end(); ++i)
+    {
+        gwbuf_free(i->pValue);
+    }
+
+    snapshot.clear();
+}
+
+//static
+cache_result_t LRUStorage::open_snapshot(const char* zPath, FILE** ppFile)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    *ppFile = fopen(zPath, "r");
+
+    if (*ppFile)
+    {
+        char magic[8];
+        uint32_t version;
+
+        if ((fread(magic, sizeof(magic), 1, *ppFile) == 1) &&
+            (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0) &&
+            (fread(&version, sizeof(version), 1, *ppFile) == 1) &&
+            (version == SNAPSHOT_VERSION))
+        {
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            MXS_ERROR("'%s' is not a cache snapshot of version %u.", zPath, SNAPSHOT_VERSION);
+            fclose(*ppFile);
+            *ppFile = NULL;
+        }
+    }
+    else if (errno == ENOENT)
+    {
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+    else
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Could not open the snapshot '%s': %s",
+                  zPath, strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+
+    return result;
+}
+
+//static
+cache_result_t LRUStorage::read_snapshot_item(FILE* pFile, SnapshotItem* pItem)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    uint32_t length;
+
+    if (fread(&pItem->key, sizeof(pItem->key), 1, pFile) != 1)
+    {
+        if (feof(pFile))
+        {
+            result = CACHE_RESULT_NOT_FOUND;
+        }
+    }
+    else if ((fread(&pItem->time, sizeof(pItem->time), 1, pFile) == 1) &&
+             (fread(&length, sizeof(length), 1, pFile) == 1))
+    {
+        pItem->pValue = gwbuf_alloc(length);
+
+        if (!pItem->pValue)
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+        else if ((length == 0) || (fread(GWBUF_DATA(pItem->pValue), length, 1, pFile) == 1))
+        {
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            gwbuf_free(pItem->pValue);
+            pItem->pValue = NULL;
+        }
+    }
+
+    if (result == CACHE_RESULT_ERROR)
+    {
+        MXS_ERROR("The cache snapshot is truncated or could not be read.");
+    }
+
+    return result;
 }
@@ -13,6 +13,8 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <stdio.h>
+#include <vector>
 #include <tr1/unordered_map>
 #include "cachefilter.h"
 #include "cache_storage_api.hh"
@@ -29,7 +31,7 @@ public:
     void get_config(CACHE_STORAGE_CONFIG* pConfig);
 
 protected:
-    LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage);
+    LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, cache_eviction_t eviction);
 
     /**
      * @see Storage::get_info
@@ -76,6 +78,63 @@ protected:
      */
     cache_result_t do_get_items(uint64_t* pItems) const;
 
+    /**
+     * An item of a snapshot.
+     */
+    struct SnapshotItem
+    {
+        CACHE_KEY key;
+        uint32_t  time;   /*< When the value was stored. */
+        GWBUF*    pValue;
+    };
+
+    typedef std::vector<SnapshotItem> Snapshot;
+
+    /**
+     * Copies the items, the least recently used first, so that the most
+     * recently used are again at the head when the items are loaded.
+     *
+     * @param pSnapshot  The snapshot the items are appended to.
+     *
+     * @return CACHE_RESULT_OK or CACHE_RESULT_OUT_OF_RESOURCES.
+     */
+    cache_result_t do_get_snapshot(Snapshot* pSnapshot) const;
+
+    /**
+     * Stores an item loaded from a snapshot, unless the key has been
+     * stored since or the hard TTL of the item has passed.
+     *
+     * @param item  The item.
+     *
+     * @return True, if the item was stored.
+     */
+    bool do_restore(const SnapshotItem& item);
+
+    static cache_result_t write_snapshot(const char* zPath, const Snapshot& snapshot);
+    static void free_snapshot(Snapshot& snapshot);
+
+    /**
+     * Opens a snapshot for reading.
+     *
+     * @param zPath    The file.
+     * @param ppFile   On return, the opened file.
+     *
+     * @return CACHE_RESULT_OK, CACHE_RESULT_NOT_FOUND if the file does not
+     *         exist, or CACHE_RESULT_ERROR.
+     */
+    static cache_result_t open_snapshot(const char* zPath, FILE** ppFile);
+
+    /**
+     * Reads the next item of a snapshot.
+     *
+     * @param pFile  A file opened with @c open_snapshot.
+     * @param pItem  On return, the item, whose value the caller must free.
+     *
+     * @return CACHE_RESULT_OK, CACHE_RESULT_NOT_FOUND at the end of the
+     *         file, or CACHE_RESULT_ERROR.
+     */
+    static cache_result_t read_snapshot_item(FILE* pFile, SnapshotItem* pItem);
+
 private:
     LRUStorage(const LRUStorage&);
     LRUStorage& operator = (const LRUStorage&);
@@ -98,6 +157,22 @@ private:
         return access_value(APPROACH_PEEK, key, flags, ppValue);
     }
 
+    /**
+     * The lists the nodes are in. With TinyLFU eviction, a new node is put
+     * in the window, from which it moves to the probation list, if it is
+     * admitted to the cache, and from there to the protected list, if it is
+     * accessed again. With other eviction modes, all nodes are in the main list.
+     */
+    enum segment_t
+    {
+        SEGMENT_MAIN,      /*< The main list, or the probation list with TinyLFU. */
+        SEGMENT_WINDOW,    /*< The window, with TinyLFU. */
+        SEGMENT_PROTECTED, /*< The protected list, with TinyLFU. */
+        N_SEGMENTS,
+
+        SEGMENT_NONE = N_SEGMENTS /*< The node is not in any list. */
+    };
+
     /**
      * The Node class is used for maintaining LRU information.
      */
@@ -107,6 +182,9 @@ private:
         Node()
             : m_pKey(NULL)
             , m_size(0)
+            , m_time(0)
+            , m_referenced(false)
+            , m_segment(SEGMENT_NONE)
             , m_pNext(NULL)
             , m_pPrev(NULL)
         {}
@@ -123,6 +201,30 @@ private:
         {
             return m_size;
         }
+        bool referenced() const
+        {
+            return m_referenced;
+        }
+        void set_referenced(bool referenced)
+        {
+            m_referenced = referenced;
+        }
+        uint32_t time() const
+        {
+            return m_time;
+        }
+        void set_time(uint32_t time)
+        {
+            m_time = time;
+        }
+        segment_t segment() const
+        {
+            return m_segment;
+        }
+        void set_segment(segment_t segment)
+        {
+            m_segment = segment;
+        }
         Node* next() const
         {
             return m_pNext;
@@ -195,17 +297,85 @@ private:
         {
             m_pKey = pkey;
             m_size = size;
+            m_referenced = false;
         }
 
     private:
         const CACHE_KEY* m_pKey;  /*< Points at the key stored in nodes_by_key_ below. */
-        size_t           m_size;  /*< The size of the data referred to by m_pKey. */
-        Node*            m_pNext; /*< The next node in the LRU list. */
-        Node*            m_pPrev; /*< The previous node in the LRU list. */
+        size_t           m_size;       /*< The size of the data referred to by m_pKey. */
+        uint32_t         m_time;       /*< When the data was stored. */
+        bool             m_referenced; /*< Whether accessed since last inspected for eviction. */
+        segment_t        m_segment;    /*< The list the node is in. */
+        Node*            m_pNext;      /*< The next node in the LRU list. */
+        Node*            m_pPrev;      /*< The previous node in the LRU list. */
+    };
+
+    /**
+     * A list of nodes, the most recently used at the head.
+     */
+    struct Segment
+    {
+        Segment()
+            : pHead(NULL)
+            , pTail(NULL)
+            , count(0)
+            , size(0)
+        {}
+
+        bool exceeds(uint64_t max_count, uint64_t max_size) const
+        {
+            return (count > max_count) || (size > max_size);
+        }
+
+        Node*    pHead;
+        Node*    pTail;
+        uint64_t count; /*< The number of nodes in the list. */
+        uint64_t size;  /*< The total size of the values of the nodes. */
+    };
+
+    /**
+     * A count-min sketch with 4-bit counters that estimates how often keys
+     * have been accessed. The counters are halved periodically, so that the
+     * estimate reflects the recent accesses.
+     */
+    class FrequencySketch
+    {
+    public:
+        FrequencySketch()
+            : m_mask(0)
+            , m_additions(0)
+            , m_sample_size(0)
+        {}
+
+        void init(uint64_t capacity);
+
+        void increment(const CACHE_KEY& key);
+        uint32_t frequency(const CACHE_KEY& key) const;
+
+    private:
+        static uint64_t index(const CACHE_KEY& key, uint32_t i);
+
+        std::vector<uint64_t> m_table;       /*< 16 counters per word. */
+        uint64_t              m_mask;        /*< The number of words - 1. */
+        uint64_t              m_additions;   /*< Increments since the counters were halved. */
+        uint64_t              m_sample_size; /*< Increments after which the counters are halved. */
     };
 
     typedef std::tr1::unordered_map<CACHE_KEY, Node*> NodesByKey;
 
+    Node* head() const;
+    Node* tail() const;
+
+    cache_result_t store_value(const CACHE_KEY& key,
+                               const GWBUF* pValue,
+                               uint32_t time);
+
+    cache_result_t apply_ttl(Node* pNode,
+                             uint32_t flags,
+                             cache_result_t result,
+                             GWBUF** ppValue) const;
+
+    void give_second_chances();
     Node* vacate_lru();
     Node* vacate_lru(size_t space);
     bool free_node_data(Node* pNode);
@@ -213,6 +383,9 @@ private:
     void free_node(NodesByKey::iterator& i) const;
     void remove_node(Node* pNode) const;
     void move_to_head(Node* pNode) const;
+    void move_to_head(Node* pNode, segment_t segment) const;
+    void promote(Node* pNode) const;
+    void evict_tinylfu();
 
     cache_result_t get_existing_node(NodesByKey::iterator& i, const GWBUF* pvalue, Node** ppNode);
     cache_result_t get_new_node(const CACHE_KEY& key,
@@ -231,6 +404,7 @@ private:
             , updates(0)
             , deletes(0)
             , evictions(0)
+            , rejections(0)
         {}
 
         void fill(json_t* pObject) const;
@@ -242,14 +416,20 @@ private:
         uint64_t updates;    /*< How many times an existing key in the cache was updated. */
         uint64_t deletes;    /*< How many times an existing key in the cache was deleted. */
         uint64_t evictions;  /*< How many times an item has been evicted from the cache. */
+        uint64_t rejections; /*< How many of the evicted items were not admitted by TinyLFU. */
     };
 
     const CACHE_STORAGE_CONFIG m_config;       /*< The configuration. */
     Storage*                   m_pStorage;     /*< The actual storage. */
     const uint64_t             m_max_count;    /*< The maximum number of items in the LRU list, */
     const uint64_t             m_max_size;     /*< The maximum size of all cached items. */
+    const cache_eviction_t     m_eviction;     /*< How items are chosen for eviction. */
     mutable Stats              m_stats;        /*< Cache statistics. */
     mutable NodesByKey         m_nodes_by_key; /*< Mapping from cache keys to corresponding Node. */
-    mutable Node*              m_pHead;        /*< The node at the LRU list. */
-    mutable Node*              m_pTail;        /*< The node at bottom of the LRU list.*/
+    mutable Segment            m_segments[N_SEGMENTS]; /*< The lists of nodes. */
+    uint64_t                   m_window_max_count;     /*< TinyLFU: The maximum count of the window. */
+    uint64_t                   m_window_max_size;      /*< TinyLFU: The maximum size of the window. */
+    uint64_t                   m_protected_max_count;  /*< TinyLFU: The maximum count of protected. */
+    uint64_t                   m_protected_max_size;   /*< TinyLFU: The maximum size of protected. */
+    mutable FrequencySketch    m_sketch;               /*< TinyLFU: The access frequencies. */
 };
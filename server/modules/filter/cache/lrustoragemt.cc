@@ -16,8 +16,10 @@
 
 using maxscale::SpinLockGuard;
 
-LRUStorageMT::LRUStorageMT(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
-    : LRUStorage(config, pStorage)
+LRUStorageMT::LRUStorageMT(const CACHE_STORAGE_CONFIG& config,
+                           Storage* pStorage,
+                           cache_eviction_t eviction)
+    : LRUStorage(config, pStorage, eviction)
 {
     spinlock_init(&m_lock);
 
@@ -28,11 +30,13 @@ LRUStorageMT::~LRUStorageMT()
 {
 }
 
-LRUStorageMT* LRUStorageMT::create(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+LRUStorageMT* LRUStorageMT::create(const CACHE_STORAGE_CONFIG& config,
+                                   Storage* pStorage,
+                                   cache_eviction_t eviction)
 {
     LRUStorageMT* plru_storage = NULL;
 
-    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageMT(config, pStorage));
+    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageMT(config, pStorage, eviction));
 
     return plru_storage;
 }
@@ -95,3 +99,69 @@ cache_result_t LRUStorageMT::get_items(uint64_t* pItems) const
 
     return LRUStorage::do_get_items(pItems);
 }
+
+cache_result_t LRUStorageMT::save_snapshot(const char* zPath)
+{
+    Snapshot snapshot;
+    cache_result_t result;
+
+    {
+        SpinLockGuard guard(m_lock);
+
+        result = LRUStorage::do_get_snapshot(&snapshot);
+    }
+
+    // Written without holding the lock, so that the other threads are
+    // blocked only while the items are copied.
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        result = write_snapshot(zPath, snapshot);
+    }
+
+    free_snapshot(snapshot);
+
+    return result;
+}
+
+cache_result_t LRUStorageMT::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    FILE* pFile;
+    cache_result_t result = open_snapshot(zPath, &pFile);
+
+    *pItems = 0;
+
+    if (result == CACHE_RESULT_OK)
+    {
+        SnapshotItem item;
+
+        // The lock is held only while an item is stored, so that the
+        // storage can be used while the snapshot is being loaded.
+        while ((result = read_snapshot_item(pFile, &item)) == CACHE_RESULT_OK)
+        {
+            bool restored;
+
+            {
+                SpinLockGuard guard(m_lock);
+
+                restored = LRUStorage::do_restore(item);
+            }
+
+            if (restored)
+            {
+                ++*pItems;
+            }
+
+            gwbuf_free(item.pValue);
+        }
+
+        if (result == CACHE_RESULT_NOT_FOUND)
+        {
+            // The end of the snapshot.
+            result = CACHE_RESULT_OK;
+        }
+
+        fclose(pFile);
+    }
+
+    return result;
+}
@@ -21,7 +21,9 @@ class LRUStorageMT : public LRUStorage
 public:
     ~LRUStorageMT();
 
-    static LRUStorageMT* create(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    static LRUStorageMT* create(const CACHE_STORAGE_CONFIG& config,
+                                Storage* pstorage,
+                                cache_eviction_t eviction = CACHE_EVICTION_LRU);
 
     cache_result_t get_info(uint32_t what,
                             json_t** ppInfo) const;
@@ -45,8 +47,12 @@ public:
 
     cache_result_t get_items(uint64_t* pItems) const;
 
+    cache_result_t save_snapshot(const char* zPath);
+
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
 private:
-    LRUStorageMT(const CACHE_STORAGE_CONFIG& config, Storage* pStorage);
+    LRUStorageMT(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, cache_eviction_t eviction);
 
     LRUStorageMT(const LRUStorageMT&);
     LRUStorageMT& operator = (const LRUStorageMT&);
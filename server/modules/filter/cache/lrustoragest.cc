@@ -14,8 +14,10 @@
 #define MXS_MODULE_NAME "cache"
 #include "lrustoragest.hh"
 
-LRUStorageST::LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
-    : LRUStorage(config, pStorage)
+LRUStorageST::LRUStorageST(const CACHE_STORAGE_CONFIG& config,
+                           Storage* pStorage,
+                           cache_eviction_t eviction)
+    : LRUStorage(config, pStorage, eviction)
 {
     MXS_NOTICE("Created single threaded LRU storage.");
 }
@@ -24,11 +26,13 @@ LRUStorageST::~LRUStorageST()
 {
 }
 
-LRUStorageST* LRUStorageST::create(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+LRUStorageST* LRUStorageST::create(const CACHE_STORAGE_CONFIG& config,
+                                   Storage* pStorage,
+                                   cache_eviction_t eviction)
 {
     LRUStorageST* plru_storage = NULL;
 
-    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageST(config, pStorage));
+    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageST(config, pStorage, eviction));
 
     return plru_storage;
 }
@@ -75,3 +79,51 @@ cache_result_t LRUStorageST::get_items(uint64_t* pItems) const
 {
     return LRUStorage::do_get_items(pItems);
 }
+
+cache_result_t LRUStorageST::save_snapshot(const char* zPath)
+{
+    Snapshot snapshot;
+    cache_result_t result = LRUStorage::do_get_snapshot(&snapshot);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        result = write_snapshot(zPath, snapshot);
+    }
+
+    free_snapshot(snapshot);
+
+    return result;
+}
+
+cache_result_t LRUStorageST::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    FILE* pFile;
+    cache_result_t result = open_snapshot(zPath, &pFile);
+
+    *pItems = 0;
+
+    if (result == CACHE_RESULT_OK)
+    {
+        SnapshotItem item;
+
+        while ((result = read_snapshot_item(pFile, &item)) == CACHE_RESULT_OK)
+        {
+            if (LRUStorage::do_restore(item))
+            {
+                ++*pItems;
+            }
+
+            gwbuf_free(item.pValue);
+        }
+
+        if (result == CACHE_RESULT_NOT_FOUND)
+        {
+            // The end of the snapshot.
+            result = CACHE_RESULT_OK;
+        }
+
+        fclose(pFile);
+    }
+
+    return result;
+}
@@ -20,7 +20,9 @@ class LRUStorageST : public LRUStorage
 public:
     ~LRUStorageST();
 
-    static LRUStorageST* create(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    static LRUStorageST* create(const CACHE_STORAGE_CONFIG& config,
+                                Storage* pstorage,
+                                cache_eviction_t eviction = CACHE_EVICTION_LRU);
 
     cache_result_t get_info(uint32_t what,
                             json_t** ppInfo) const;
@@ -44,8 +46,12 @@ public:
 
     cache_result_t get_items(uint64_t* pItems) const;
 
+    cache_result_t save_snapshot(const char* zPath);
+
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
 private:
-    LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pstorage, cache_eviction_t eviction);
 
     LRUStorageST(const LRUStorageST&);
     LRUStorageST& operator = (const LRUStorageST&);
@@ -13,9 +13,13 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "rules.h"
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <new>
+#include <string>
+#include <vector>
+#include <tr1/unordered_set>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
@@ -76,6 +80,57 @@ static struct cache_attribute_mapping cache_use_attributes[] =
     { NULL,                 static_cast<cache_rule_attribute_t>(0) }
 };
 
+/**
+ * The query classifier information of a statement. Each piece of information
+ * is fetched when it is first needed and then shared by all rules, so that
+ * the query classifier is consulted at most once per statement.
+ */
+typedef struct cache_query_info
+{
+    const GWBUF         *query;             // The statement.
+    const char          *default_db;        // The current default database, may be NULL.
+    bool                 tables_fetched;
+    const char* const   *tables;            // Table names, qualified if qualified in the statement. Not owned.
+    size_t               n_tables;
+    bool                 databases_fetched;
+    const char* const   *databases;         // Database names mentioned in the statement. Not owned.
+    size_t               n_databases;
+    bool                 fields_fetched;
+    const QC_FIELD_INFO *fields;            // Not owned, valid as long as the statement.
+    size_t               n_fields;
+} CACHE_QUERY_INFO;
+
+typedef std::tr1::unordered_set<std::string> CACHE_RULE_NAMES;
+
+/**
+ * The rules using the operator "=" on a database, table, column, query or user
+ * are stored as names in hash sets, so that the cost of checking them does not
+ * depend on how many there are. The other rules are checked one by one.
+ *
+ * Table and column names are stored in lower case, as they are compared case
+ * insensitively. Databases, queries and users are compared case sensitively.
+ */
+struct cache_rules_index
+{
+    CACHE_RULE_NAMES         databases;         // "db"
+    CACHE_RULE_NAMES         tables;            // "tbl"
+    CACHE_RULE_NAMES         qualified_tables;  // "db.tbl"
+    CACHE_RULE_NAMES         columns;           // "col", or "*"
+    CACHE_RULE_NAMES         table_columns;     // "tbl.col"
+    CACHE_RULE_NAMES         qualified_columns; // "db.tbl.col"
+    CACHE_RULE_NAMES         queries;           // The entire statement.
+    CACHE_RULE_NAMES         accounts;          // "user@host"
+    std::vector<CACHE_RULE*> store_rules;       // The store rules not in the sets.
+    std::vector<CACHE_RULE*> use_rules;         // The use rules not in the sets.
+};
+
+static void cache_query_info_init(CACHE_QUERY_INFO *info, const char *default_db, const GWBUF *query);
+static const char* const *cache_query_info_get_tables(CACHE_QUERY_INFO *info, size_t *n_tables);
+static const char* const *cache_query_info_get_databases(CACHE_QUERY_INFO *info, size_t *n_databases);
+static const QC_FIELD_INFO *cache_query_info_get_fields(CACHE_QUERY_INFO *info, size_t *n_fields);
+static const char *cache_query_info_get_default_database(CACHE_QUERY_INFO *info);
+static const char *cache_query_info_get_default_table(CACHE_QUERY_INFO *info);
+
 static bool cache_rule_attribute_get(struct cache_attribute_mapping *mapping,
                                      const char *s,
                                      cache_rule_attribute_t *attribute);
@@ -110,42 +165,42 @@ static CACHE_RULE *cache_rule_create(cache_rule_attribute_t attribute,
                                      uint32_t               debug);
 static bool cache_rule_matches_column_regexp(CACHE_RULE *rule,
                                              int thread_id,
-                                             const char *default_db,
-                                             const GWBUF *query);
+                                             CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_column_simple(CACHE_RULE *rule,
-                                             const char *default_db,
-                                             const GWBUF *query);
+                                             CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_column(CACHE_RULE *rule,
                                       int thread_id,
-                                      const char *default_db,
-                                      const GWBUF *query);
+                                      CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_database(CACHE_RULE *rule,
                                         int thread_id,
-                                        const char *default_db,
-                                        const GWBUF *query);
+                                        CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_query(CACHE_RULE *rule,
                                      int thread_id,
-                                     const char *default_db,
-                                     const GWBUF *query);
+                                     CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_table(CACHE_RULE *rule,
                                      int thread_id,
-                                     const char *default_db,
-                                     const GWBUF *query);
+                                     CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_table_regexp(CACHE_RULE *rule,
                                             int thread_id,
-                                            const char *default_db,
-                                            const GWBUF *query);
+                                            CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_table_simple(CACHE_RULE *rule,
-                                            const char *default_db,
-                                            const GWBUF *query);
+                                            CACHE_QUERY_INFO *info);
 static bool cache_rule_matches_user(CACHE_RULE *rule, int thread_id, const char *user);
 static bool cache_rule_matches(CACHE_RULE *rule,
                                int thread_id,
-                               const char *default_db,
-                               const GWBUF *query);
+                               CACHE_QUERY_INFO *info);
 
 static void cache_rule_free(CACHE_RULE *rule);
 
+static void cache_rules_index_add_store_rule(struct cache_rules_index *index, CACHE_RULE *rule);
+static void cache_rules_index_add_use_rule(struct cache_rules_index *index, CACHE_RULE *rule);
+static bool cache_rules_index_should_store(struct cache_rules_index *index,
+                                           int thread_id,
+                                           CACHE_QUERY_INFO *info);
+static bool cache_rules_index_should_use(struct cache_rules_index *index,
+                                         int thread_id,
+                                         const char *account);
+
 static void cache_rules_add_store_rule(CACHE_RULES* self, CACHE_RULE* rule);
 static void cache_rules_add_use_rule(CACHE_RULES* self, CACHE_RULE* rule);
 static CACHE_RULES* cache_rules_create_from_json(json_t* root, uint32_t debug);
@@ -215,10 +270,18 @@ const char *cache_rule_op_to_string(cache_rule_op_t op)
 CACHE_RULES *cache_rules_create(uint32_t debug)
 {
     CACHE_RULES *rules = (CACHE_RULES*)MXS_CALLOC(1, sizeof(CACHE_RULES));
+    struct cache_rules_index *index = new (std::nothrow) cache_rules_index;
 
-    if (rules)
+    if (rules && index)
     {
         rules->debug = debug;
+        rules->index = index;
+    }
+    else
+    {
+        delete index;
+        MXS_FREE(rules);
+        rules = NULL;
     }
 
     return rules;
@@ -299,6 +362,7 @@ void cache_rules_free(CACHE_RULES *rules)
 
         cache_rule_free(rules->store_rules);
         cache_rule_free(rules->use_rules);
+        delete rules->index;
         MXS_FREE(rules);
     }
 }
@@ -330,10 +394,21 @@ bool cache_rules_should_store(CACHE_RULES *self, int thread_id, const char *defa
 
     if (rule)
     {
-        while (rule && !should_store)
+        CACHE_QUERY_INFO info;
+        cache_query_info_init(&info, default_db, query);
+
+        if (self->debug & CACHE_DEBUG_RULES)
         {
-            should_store = cache_rule_matches(rule, thread_id, default_db, query);
-            rule = rule->next;
+            // Each rule is checked separately, so that each can be reported.
+            while (rule && !should_store)
+            {
+                should_store = cache_rule_matches(rule, thread_id, &info);
+                rule = rule->next;
+            }
+        }
+        else
+        {
+            should_store = cache_rules_index_should_store(self->index, thread_id, &info);
         }
     }
     else
@@ -367,10 +442,18 @@ bool cache_rules_should_use(CACHE_RULES *self, int thread_id, const MXS_SESSION
         char account[strlen(user) + 1 + strlen(host) + 1];
         sprintf(account, "%s@%s", user, host);
 
-        while (rule && !should_use)
+        if (self->debug & CACHE_DEBUG_RULES)
         {
-            should_use = cache_rule_matches_user(rule, thread_id, account);
-            rule = rule->next;
+            // Each rule is checked separately, so that each can be reported.
+            while (rule && !should_use)
+            {
+                should_use = cache_rule_matches_user(rule, thread_id, account);
+                rule = rule->next;
+            }
+        }
+        else
+        {
+            should_use = cache_rules_index_should_use(self->index, thread_id, account);
         }
     }
     else
@@ -441,6 +524,140 @@ bool CacheRules::should_use(const MXS_SESSION* pSession) const
  * API end
  */
 
+/**
+ * Initializes a CACHE_QUERY_INFO object. Nothing is fetched yet.
+ *
+ * @param info       The object to be initialized.
+ * @param default_db The current default database, NULL if there is none.
+ * @param query      The query, expected to contain a COM_QUERY.
+ */
+static void cache_query_info_init(CACHE_QUERY_INFO *info, const char *default_db, const GWBUF *query)
+{
+    memset(info, 0, sizeof(*info));
+
+    info->query = query;
+    info->default_db = default_db;
+}
+
+/**
+ * Returns the tables of the query, qualified if qualified in the query.
+ *
+ * @param info     The query classifier information of the query.
+ * @param n_tables On return, the number of tables.
+ *
+ * @return The table names, owned by the query classifier.
+ */
+static const char* const *cache_query_info_get_tables(CACHE_QUERY_INFO *info, size_t *n_tables)
+{
+    if (!info->tables_fetched)
+    {
+        bool fullnames = true;
+        qc_get_table_names_ref((GWBUF*)info->query, fullnames, &info->tables, &info->n_tables);
+        info->tables_fetched = true;
+    }
+
+    *n_tables = info->n_tables;
+    return info->tables;
+}
+
+/**
+ * Returns the databases explicitly mentioned in the query.
+ *
+ * @param info        The query classifier information of the query.
+ * @param n_databases On return, the number of databases.
+ *
+ * @return The database names, owned by the query classifier.
+ */
+static const char* const *cache_query_info_get_databases(CACHE_QUERY_INFO *info, size_t *n_databases)
+{
+    if (!info->databases_fetched)
+    {
+        qc_get_database_names_ref((GWBUF*)info->query, &info->databases, &info->n_databases);
+        info->databases_fetched = true;
+    }
+
+    *n_databases = info->n_databases;
+    return info->databases;
+}
+
+/**
+ * Returns the fields of the query.
+ *
+ * @param info     The query classifier information of the query.
+ * @param n_fields On return, the number of fields.
+ *
+ * @return The fields, owned by the query classifier.
+ */
+static const QC_FIELD_INFO *cache_query_info_get_fields(CACHE_QUERY_INFO *info, size_t *n_fields)
+{
+    if (!info->fields_fetched)
+    {
+        qc_get_field_info((GWBUF*)info->query, &info->fields, &info->n_fields);
+        info->fields_fetched = true;
+    }
+
+    *n_fields = info->n_fields;
+    return info->fields;
+}
+
+/**
+ * Returns the database that unqualified tables and columns of the query refer to.
+ *
+ * @param info The query classifier information of the query.
+ *
+ * @return The database, or NULL if it cannot be deduced.
+ */
+static const char *cache_query_info_get_default_database(CACHE_QUERY_INFO *info)
+{
+    const char *default_database = NULL;
+
+    size_t n_databases;
+    const char* const *databases = cache_query_info_get_databases(info, &n_databases);
+
+    if (n_databases == 0)
+    {
+        // If no databases have been mentioned, then we can assume that all
+        // tables and columns that are not explcitly qualified refer to the
+        // default database.
+        default_database = info->default_db;
+    }
+    else if ((info->default_db == NULL) && (n_databases == 1))
+    {
+        // If there is no default database and exactly one database has been
+        // explicitly mentioned, then we can assume all tables and columns that
+        // are not explicitly qualified refer to that database.
+        default_database = databases[0];
+    }
+
+    return default_database;
+}
+
+/**
+ * Returns the table that unqualified columns of the query refer to.
+ *
+ * @param info The query classifier information of the query.
+ *
+ * @return The unqualified table name, or NULL if it cannot be deduced.
+ */
+static const char *cache_query_info_get_default_table(CACHE_QUERY_INFO *info)
+{
+    const char *default_table = NULL;
+
+    size_t n_tables;
+    const char* const *tables = cache_query_info_get_tables(info, &n_tables);
+
+    if (n_tables == 1)
+    {
+        // Only if we have exactly one table can we assume anything
+        // about a table that has not been mentioned explicitly.
+        const char *dot = strchr(tables[0], '.');
+
+        default_table = dot ? dot + 1 : tables[0];
+    }
+
+    return default_table;
+}
+
 /**
  * Converts a string to an attribute
  *
@@ -1057,7 +1274,7 @@ static bool cache_rule_compare_n(CACHE_RULE *self, int thread_id, const char *va
     {
     case CACHE_OP_EQ:
     case CACHE_OP_NEQ:
-        compares = (strncmp(self->value, value, length) == 0);
+        compares = (strncmp(self->value, value, length) == 0) && (self->value[length] == 0);
         break;
 
     case CACHE_OP_LIKE:
@@ -1085,76 +1302,42 @@ static bool cache_rule_compare_n(CACHE_RULE *self, int thread_id, const char *va
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of current thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
                                              int thread_id,
-                                             const char *default_db,
-                                             const GWBUF *query)
+                                             CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_COLUMN);
     ss_dassert((self->op == CACHE_OP_LIKE) || (self->op == CACHE_OP_UNLIKE));
 
-    const char* default_database = NULL;
-
-    int n_databases;
-    char **databases = qc_get_database_names((GWBUF*)query, &n_databases);
-
-    if (n_databases == 0)
-    {
-        // If no databases have been mentioned, then we can assume that all
-        // tables and columns that are not explcitly qualified refer to the
-        // default database.
-        default_database = default_db;
-    }
-    else if ((default_db == NULL) && (n_databases == 1))
-    {
-        // If there is no default database and exactly one database has been
-        // explicitly mentioned, then we can assume all tables and columns that
-        // are not explicitly qualified refer to that database.
-        default_database = databases[0];
-    }
-
+    const char* default_database = cache_query_info_get_default_database(info);
     size_t default_database_len = default_database ? strlen(default_database) : 0;
 
-    int n_tables;
-    char **tables = qc_get_table_names((GWBUF*)query, &n_tables, false);
-
-    const char* default_table = NULL;
-
-    if (n_tables == 1)
-    {
-        // Only if we have exactly one table can we assume anything
-        // about a table that has not been mentioned explicitly.
-        default_table = tables[0];
-    }
-
+    const char* default_table = cache_query_info_get_default_table(info);
     size_t default_table_len = default_table ? strlen(default_table) : 0;
 
-    const QC_FIELD_INFO *infos;
-    size_t n_infos;
-
-    qc_get_field_info((GWBUF*)query, &infos, &n_infos);
+    size_t n_fields;
+    const QC_FIELD_INFO *fields = cache_query_info_get_fields(info, &n_fields);
 
     bool matches = false;
 
     size_t i = 0;
-    while (!matches && (i < n_infos))
+    while (!matches && (i < n_fields))
     {
-        const QC_FIELD_INFO *info = (infos + i);
+        const QC_FIELD_INFO *field = (fields + i);
 
-        if (info->usage & QC_USED_IN_SELECT)
+        if (field->usage & QC_USED_IN_SELECT)
         {
             size_t database_len;
             const char *database;
 
-            if (info->database)
+            if (field->database)
             {
-                database = info->database;
-                database_len = strlen(info->database);
+                database = field->database;
+                database_len = strlen(field->database);
             }
             else
             {
@@ -1165,10 +1348,10 @@ static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
             size_t table_len;
             const char *table;
 
-            if (info->table)
+            if (field->table)
             {
-                table = info->table;
-                table_len = strlen(info->table);
+                table = field->table;
+                table_len = strlen(field->table);
             }
             else
             {
@@ -1176,7 +1359,7 @@ static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
                 table_len = default_table_len;
             }
 
-            char buffer[database_len + 1 + table_len + strlen(info->column) + 1];
+            char buffer[database_len + 1 + table_len + 1 + strlen(field->column) + 1];
             buffer[0] = 0;
 
             if (database)
@@ -1191,7 +1374,7 @@ static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
                 strcat(buffer, ".");
             }
 
-            strcat(buffer, info->column);
+            strcat(buffer, field->column);
 
             matches = cache_rule_compare(self, thread_id, buffer);
         }
@@ -1199,24 +1382,6 @@ static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
         ++i;
     }
 
-    if (tables)
-    {
-        for (i = 0; i < (size_t)n_tables; ++i)
-        {
-            MXS_FREE(tables[i]);
-        }
-        MXS_FREE(tables);
-    }
-
-    if (databases)
-    {
-        for (i = 0; i < (size_t)n_databases; ++i)
-        {
-            MXS_FREE(databases[i]);
-        }
-        MXS_FREE(databases);
-    }
-
     return matches;
 }
 
@@ -1224,12 +1389,11 @@ static bool cache_rule_matches_column_regexp(CACHE_RULE *self,
  * Returns boolean indicating whether the column rule matches the query or not.
  *
  * @param self       The CACHE_RULE object.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
-static bool cache_rule_matches_column_simple(CACHE_RULE *self, const char *default_db, const GWBUF *query)
+static bool cache_rule_matches_column_simple(CACHE_RULE *self, CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_COLUMN);
     ss_dassert((self->op == CACHE_OP_EQ) || (self->op == CACHE_OP_NEQ));
@@ -1238,57 +1402,26 @@ static bool cache_rule_matches_column_simple(CACHE_RULE *self, const char *defau
     const char* rule_table = self->simple.table;
     const char* rule_database = self->simple.database;
 
-    const char* default_database = NULL;
-
-    int n_databases;
-    char **databases = qc_get_database_names((GWBUF*)query, &n_databases);
-
-    if (n_databases == 0)
-    {
-        // If no databases have been mentioned, then we can assume that all
-        // tables and columns that are not explcitly qualified refer to the
-        // default database.
-        default_database = default_db;
-    }
-    else if ((default_db == NULL) && (n_databases == 1))
-    {
-        // If there is no default database and exactly one database has been
-        // explicitly mentioned, then we can assume all tables and columns that
-        // are not explicitly qualified refer to that database.
-        default_database = databases[0];
-    }
-
-    int n_tables;
-    char **tables = qc_get_table_names((GWBUF*)query, &n_tables, false);
-
-    const char* default_table = NULL;
-
-    if (n_tables == 1)
-    {
-        // Only if we have exactly one table can we assume anything
-        // about a table that has not been mentioned explicitly.
-        default_table = tables[0];
-    }
-
-    const QC_FIELD_INFO *infos;
-    size_t n_infos;
+    const char* default_database = cache_query_info_get_default_database(info);
+    const char* default_table = cache_query_info_get_default_table(info);
 
-    qc_get_field_info((GWBUF*)query, &infos, &n_infos);
+    size_t n_fields;
+    const QC_FIELD_INFO *fields = cache_query_info_get_fields(info, &n_fields);
 
     bool matches = false;
 
     size_t i = 0;
-    while (!matches && (i < n_infos))
+    while (!matches && (i < n_fields))
     {
-        const QC_FIELD_INFO *info = (infos + i);
+        const QC_FIELD_INFO *field = (fields + i);
 
-        if (info->usage & QC_USED_IN_SELECT)
+        if (field->usage & QC_USED_IN_SELECT)
         {
-            if ((strcasecmp(info->column, rule_column) == 0) || strcmp(rule_column, "*") == 0)
+            if ((strcasecmp(field->column, rule_column) == 0) || strcmp(rule_column, "*") == 0)
             {
                 if (rule_table)
                 {
-                    const char* check_table = info->table ? info->table : default_table;
+                    const char* check_table = field->table ? field->table : default_table;
 
                     if (check_table)
                     {
@@ -1297,7 +1430,7 @@ static bool cache_rule_matches_column_simple(CACHE_RULE *self, const char *defau
                             if (rule_database)
                             {
                                 const char *check_database =
-                                    info->database ? info->database : default_database;
+                                    field->database ? field->database : default_database;
 
                                 if (check_database)
                                 {
@@ -1360,24 +1493,6 @@ static bool cache_rule_matches_column_simple(CACHE_RULE *self, const char *defau
         ++i;
     }
 
-    if (tables)
-    {
-        for (i = 0; i < (size_t)n_tables; ++i)
-        {
-            MXS_FREE(tables[i]);
-        }
-        MXS_FREE(tables);
-    }
-
-    if (databases)
-    {
-        for (i = 0; i < (size_t)n_databases; ++i)
-        {
-            MXS_FREE(databases[i]);
-        }
-        MXS_FREE(databases);
-    }
-
     return matches;
 }
 
@@ -1386,15 +1501,13 @@ static bool cache_rule_matches_column_simple(CACHE_RULE *self, const char *defau
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of current thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_column(CACHE_RULE *self,
                                       int thread_id,
-                                      const char *default_db,
-                                      const GWBUF *query)
+                                      CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_COLUMN);
 
@@ -1404,12 +1517,12 @@ static bool cache_rule_matches_column(CACHE_RULE *self,
     {
     case CACHE_OP_EQ:
     case CACHE_OP_NEQ:
-        matches = cache_rule_matches_column_simple(self, default_db, query);
+        matches = cache_rule_matches_column_simple(self, info);
         break;
 
     case CACHE_OP_LIKE:
     case CACHE_OP_UNLIKE:
-        matches = cache_rule_matches_column_regexp(self, thread_id, default_db, query);
+        matches = cache_rule_matches_column_regexp(self, thread_id, info);
         break;
 
     default:
@@ -1424,56 +1537,41 @@ static bool cache_rule_matches_column(CACHE_RULE *self,
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of current thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_database(CACHE_RULE *self,
                                         int thread_id,
-                                        const char *default_db,
-                                        const GWBUF *query)
+                                        CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_DATABASE);
 
     bool matches = false;
 
-    bool fullnames = true;
-    int n;
-    char **names = qc_get_table_names((GWBUF*)query, &n, fullnames); // TODO: Make qc const-correct.
+    size_t n;
+    const char* const *names = cache_query_info_get_tables(info, &n);
 
-    if (names)
+    size_t i = 0;
+    while (!matches && (i < n))
     {
-        int i = 0;
+        const char *name = names[i];
+        const char *dot = strchr(name, '.');
 
-        while (!matches && (i < n))
+        if (dot)
         {
-            char *name = names[i];
-            char *dot = strchr(name, '.');
-            const char *database = NULL;
-
-            if (dot)
-            {
-                *dot = 0;
-                database = name;
-            }
-            else
-            {
-                database = default_db;
-            }
+            char database[dot - name + 1];
+            memcpy(database, name, dot - name);
+            database[dot - name] = 0;
 
             matches = cache_rule_compare(self, thread_id, database);
-
-            MXS_FREE(name);
-            ++i;
         }
-
-        while (i < n)
+        else
         {
-            MXS_FREE(names[i++]);
+            matches = cache_rule_compare(self, thread_id, info->default_db);
         }
 
-        MXS_FREE(names);
+        ++i;
     }
 
     return matches;
@@ -1484,15 +1582,13 @@ static bool cache_rule_matches_database(CACHE_RULE *self,
  *
  * @param self        The CACHE_RULE object.
  * @param thread_id   The thread id of the calling thread.
- * @param default_db  The current default db.
- * @param query       The query.
+ * @param info        The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_query(CACHE_RULE *self,
                                      int thread_id,
-                                     const char *default_db,
-                                     const GWBUF *query)
+                                     CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_QUERY);
 
@@ -1500,7 +1596,7 @@ static bool cache_rule_matches_query(CACHE_RULE *self,
     int len;
 
     // Will succeed, query contains a contiguous COM_QUERY.
-    modutil_extract_SQL((GWBUF*)query, &sql, &len);
+    modutil_extract_SQL((GWBUF*)info->query, &sql, &len);
 
     return cache_rule_compare_n(self, thread_id, sql, len);
 }
@@ -1510,75 +1606,52 @@ static bool cache_rule_matches_query(CACHE_RULE *self,
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of current thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_table_regexp(CACHE_RULE *self,
                                             int thread_id,
-                                            const char *default_db,
-                                            const GWBUF *query)
+                                            CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_TABLE);
     ss_dassert((self->op == CACHE_OP_LIKE) || (self->op == CACHE_OP_UNLIKE));
 
     bool matches = false;
 
-    int n;
-    char **names = NULL;
-    bool fullnames;
-
-    fullnames = true;
-    names = qc_get_table_names((GWBUF*)query, &n, fullnames);
+    size_t n;
+    const char* const *names = cache_query_info_get_tables(info, &n);
 
-    if (names)
+    if (n != 0)
     {
+        const char *default_db = info->default_db;
         size_t default_db_len = default_db ? strlen(default_db) : 0;
 
-        int i = 0;
+        size_t i = 0;
         while (!matches && (i < n))
         {
-            char *name = names[i];
-            char *dot = strchr(name, '.');
+            const char *name = names[i];
+            const char *dot = strchr(name, '.');
 
-            if (!dot)
+            if (!dot && default_db)
             {
-                // Only "tbl"
+                // Only "tbl", match "db.tbl" using the default database.
+                char buffer[default_db_len + 1 + strlen(name) + 1];
 
-                if (default_db)
-                {
-                    char buffer[default_db_len + 1 + strlen(name) + 1];
-
-                    strcpy(name, default_db);
-                    strcpy(name + default_db_len, ".");
-                    strcpy(name + default_db_len + 1, name);
+                strcpy(buffer, default_db);
+                strcpy(buffer + default_db_len, ".");
+                strcpy(buffer + default_db_len + 1, name);
 
-                    matches = cache_rule_compare(self, thread_id, name);
-                }
-                else
-                {
-                    matches = cache_rule_compare(self, thread_id, name);
-                }
-
-                MXS_FREE(names[i]);
+                matches = cache_rule_compare(self, thread_id, buffer);
             }
             else
             {
-                // A qualified name "db.tbl".
+                // A qualified name "db.tbl", or "tbl" without a default database.
                 matches = cache_rule_compare(self, thread_id, name);
             }
 
             ++i;
         }
-
-        if (i < n)
-        {
-            MXS_FREE(names[i]);
-            ++i;
-        }
-
-        MXS_FREE(names);
     }
     else if (self->op == CACHE_OP_UNLIKE)
     {
@@ -1592,86 +1665,54 @@ static bool cache_rule_matches_table_regexp(CACHE_RULE *self,
  * Returns boolean indicating whether the table simple rule matches the query or not.
  *
  * @param self       The CACHE_RULE object.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
-static bool cache_rule_matches_table_simple(CACHE_RULE *self, const char *default_db, const GWBUF *query)
+static bool cache_rule_matches_table_simple(CACHE_RULE *self, CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_TABLE);
     ss_dassert((self->op == CACHE_OP_EQ) || (self->op == CACHE_OP_NEQ));
 
     bool matches = false;
 
-    bool fullnames = false;
+    size_t n;
+    const char* const *names = cache_query_info_get_tables(info, &n);
 
-    if (self->simple.database)
+    size_t i = 0;
+    while (!matches && (i < n))
     {
-        fullnames = true;
-    }
-
-    int n;
-    char **names = NULL;
-
-    names = qc_get_table_names((GWBUF*)query, &n, fullnames);
+        const char *name = names[i];
+        const char *dot = strchr(name, '.');
+        const char *table = dot ? dot + 1 : name;
 
-    if (names)
-    {
-        int i = 0;
-        while (!matches && (i < n))
+        if (self->simple.database)
         {
-            char *name = names[i];
-            const char *database = NULL;
-            const char *table = NULL;
-
-            if (fullnames)
-            {
-                char *dot = strchr(name, '.');
-
-                if (dot)
-                {
-                    *dot = 0;
-
-                    database = name;
-                    table = dot + 1;
-                }
-                else
-                {
-                    database = default_db;
-                    table = name;
-                }
-
-                if (database)
-                {
-                    matches =
-                        (strcasecmp(self->simple.database, database) == 0) &&
-                        (strcasecmp(self->simple.table, table) == 0);
-                }
-            }
-            else
+            if (dot)
             {
-                table = name;
-
-                matches = (strcasecmp(self->simple.table, table) == 0);
+                matches =
+                    (strncasecmp(self->simple.database, name, dot - name) == 0) &&
+                    (self->simple.database[dot - name] == 0) &&
+                    (strcasecmp(self->simple.table, table) == 0);
             }
-
-            if (self->op == CACHE_OP_NEQ)
+            else if (info->default_db)
             {
-                matches = !matches;
+                matches =
+                    (strcasecmp(self->simple.database, info->default_db) == 0) &&
+                    (strcasecmp(self->simple.table, table) == 0);
             }
-
-            MXS_FREE(name);
-            ++i;
+        }
+        else
+        {
+            matches = (strcasecmp(self->simple.table, table) == 0);
         }
 
-        if (i < n)
+        if (self->op == CACHE_OP_NEQ)
         {
-            MXS_FREE(names[i]);
-            ++i;
+            matches = !matches;
         }
 
-        MXS_FREE(names);
+        ++i;
     }
 
     return matches;
@@ -1682,15 +1723,13 @@ static bool cache_rule_matches_table_simple(CACHE_RULE *self, const char *defaul
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of current thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
 static bool cache_rule_matches_table(CACHE_RULE *self,
                                      int thread_id,
-                                     const char *default_db,
-                                     const GWBUF *query)
+                                     CACHE_QUERY_INFO *info)
 {
     ss_dassert(self->attribute == CACHE_ATTRIBUTE_TABLE);
 
@@ -1700,12 +1739,12 @@ static bool cache_rule_matches_table(CACHE_RULE *self,
     {
     case CACHE_OP_EQ:
     case CACHE_OP_NEQ:
-        matches = cache_rule_matches_table_simple(self, default_db, query);
+        matches = cache_rule_matches_table_simple(self, info);
         break;
 
     case CACHE_OP_LIKE:
     case CACHE_OP_UNLIKE:
-        matches = cache_rule_matches_table_regexp(self, thread_id, default_db, query);
+        matches = cache_rule_matches_table_regexp(self, thread_id, info);
         break;
 
     default:
@@ -1759,31 +1798,30 @@ static bool cache_rule_matches_user(CACHE_RULE *self, int thread_id, const char
  *
  * @param self       The CACHE_RULE object.
  * @param thread_id  The thread id of the calling thread.
- * @param default_db The current default db.
- * @param query      The query.
+ * @param info       The query classifier information of the query.
  *
  * @return True, if the rule matches, false otherwise.
  */
-static bool cache_rule_matches(CACHE_RULE *self, int thread_id, const char *default_db, const GWBUF *query)
+static bool cache_rule_matches(CACHE_RULE *self, int thread_id, CACHE_QUERY_INFO *info)
 {
     bool matches = false;
 
     switch (self->attribute)
     {
     case CACHE_ATTRIBUTE_COLUMN:
-        matches = cache_rule_matches_column(self, thread_id, default_db, query);
+        matches = cache_rule_matches_column(self, thread_id, info);
         break;
 
     case CACHE_ATTRIBUTE_DATABASE:
-        matches = cache_rule_matches_database(self, thread_id, default_db, query);
+        matches = cache_rule_matches_database(self, thread_id, info);
         break;
 
     case CACHE_ATTRIBUTE_TABLE:
-        matches = cache_rule_matches_table(self, thread_id, default_db, query);
+        matches = cache_rule_matches_table(self, thread_id, info);
         break;
 
     case CACHE_ATTRIBUTE_QUERY:
-        matches = cache_rule_matches_query(self, thread_id, default_db, query);
+        matches = cache_rule_matches_query(self, thread_id, info);
         break;
 
     case CACHE_ATTRIBUTE_USER:
@@ -1799,7 +1837,7 @@ static bool cache_rule_matches(CACHE_RULE *self, int thread_id, const char *defa
     {
         char* sql;
         int sql_len;
-        modutil_extract_SQL((GWBUF*)query, &sql, &sql_len);
+        modutil_extract_SQL((GWBUF*)info->query, &sql, &sql_len);
         const char* text;
 
         if (matches)
@@ -1862,6 +1900,7 @@ static CACHE_RULE* cache_rule_append(CACHE_RULE* head, CACHE_RULE* tail)
 static void cache_rules_add_store_rule(CACHE_RULES* self, CACHE_RULE* rule)
 {
     self->store_rules = cache_rule_append(self->store_rules, rule);
+    cache_rules_index_add_store_rule(self->index, rule);
 }
 
 /**
@@ -1873,6 +1912,335 @@ static void cache_rules_add_store_rule(CACHE_RULES* self, CACHE_RULE* rule)
 static void cache_rules_add_use_rule(CACHE_RULES* self, CACHE_RULE* rule)
 {
     self->use_rules = cache_rule_append(self->use_rules, rule);
+    cache_rules_index_add_use_rule(self->index, rule);
+}
+
+/**
+ * Creates the name used in the index for a database, table and/or column.
+ * The name is in lower case and its parts are separated with dots.
+ *
+ * @param name     On return, the name.
+ * @param database The database, may be NULL.
+ * @param table    The table, may be NULL.
+ * @param column   The column, may be NULL.
+ */
+static void cache_rules_index_name(std::string *name,
+                                   const char *database,
+                                   const char *table,
+                                   const char *column)
+{
+    const char *parts[] = { database, table, column };
+
+    name->clear();
+
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+    {
+        const char *part = parts[i];
+
+        if (part)
+        {
+            if (!name->empty())
+            {
+                name->push_back('.');
+            }
+
+            while (*part)
+            {
+                name->push_back(tolower(*part));
+                ++part;
+            }
+        }
+    }
+}
+
+/**
+ * Adds a "store" rule to the index.
+ *
+ * @param index The index.
+ * @param rule  The rule to be added.
+ */
+static void cache_rules_index_add_store_rule(struct cache_rules_index *index, CACHE_RULE *rule)
+{
+    bool indexed = false;
+
+    if (rule->op == CACHE_OP_EQ)
+    {
+        std::string name;
+
+        indexed = true;
+
+        switch (rule->attribute)
+        {
+        case CACHE_ATTRIBUTE_COLUMN:
+            cache_rules_index_name(&name, rule->simple.database, rule->simple.table, rule->simple.column);
+
+            if (rule->simple.database)
+            {
+                index->qualified_columns.insert(name);
+            }
+            else if (rule->simple.table)
+            {
+                index->table_columns.insert(name);
+            }
+            else
+            {
+                index->columns.insert(name);
+            }
+            break;
+
+        case CACHE_ATTRIBUTE_DATABASE:
+            index->databases.insert(rule->simple.database);
+            break;
+
+        case CACHE_ATTRIBUTE_QUERY:
+            index->queries.insert(rule->value);
+            break;
+
+        case CACHE_ATTRIBUTE_TABLE:
+            cache_rules_index_name(&name, rule->simple.database, rule->simple.table, NULL);
+
+            if (rule->simple.database)
+            {
+                index->qualified_tables.insert(name);
+            }
+            else
+            {
+                index->tables.insert(name);
+            }
+            break;
+
+        default:
+            indexed = false;
+        }
+    }
+
+    if (!indexed)
+    {
+        index->store_rules.push_back(rule);
+    }
+}
+
+/**
+ * Adds a "use" rule to the index.
+ *
+ * @param index The index.
+ * @param rule  The rule to be added.
+ */
+static void cache_rules_index_add_use_rule(struct cache_rules_index *index, CACHE_RULE *rule)
+{
+    ss_dassert(rule->attribute == CACHE_ATTRIBUTE_USER);
+
+    if (rule->op == CACHE_OP_EQ)
+    {
+        index->accounts.insert(rule->value);
+    }
+    else
+    {
+        index->use_rules.push_back(rule);
+    }
+}
+
+/**
+ * Returns boolean indicating whether a table of the query is in the index.
+ *
+ * @param index The index.
+ * @param info  The query classifier information of the query.
+ *
+ * @return True, if a table or its database is in the index, false otherwise.
+ */
+static bool cache_rules_index_matches_tables(struct cache_rules_index *index, CACHE_QUERY_INFO *info)
+{
+    bool matches = false;
+
+    size_t n;
+    const char* const *names = cache_query_info_get_tables(info, &n);
+
+    std::string database;
+    std::string name;
+
+    size_t i = 0;
+    while (!matches && (i < n))
+    {
+        const char *table = names[i];
+        const char *dot = strchr(table, '.');
+        bool has_database = true;
+
+        if (dot)
+        {
+            database.assign(table, dot - table);
+            table = dot + 1;
+        }
+        else if (info->default_db)
+        {
+            database.assign(info->default_db);
+        }
+        else
+        {
+            has_database = false;
+        }
+
+        if (has_database)
+        {
+            matches = (index->databases.count(database) != 0);
+
+            if (!matches && !index->qualified_tables.empty())
+            {
+                cache_rules_index_name(&name, database.c_str(), table, NULL);
+                matches = (index->qualified_tables.count(name) != 0);
+            }
+        }
+
+        if (!matches && !index->tables.empty())
+        {
+            cache_rules_index_name(&name, NULL, table, NULL);
+            matches = (index->tables.count(name) != 0);
+        }
+
+        ++i;
+    }
+
+    return matches;
+}
+
+/**
+ * Returns boolean indicating whether a selected column of the query is in the index.
+ *
+ * @param index The index.
+ * @param info  The query classifier information of the query.
+ *
+ * @return True, if a column is in the index, false otherwise.
+ */
+static bool cache_rules_index_matches_columns(struct cache_rules_index *index, CACHE_QUERY_INFO *info)
+{
+    bool matches = false;
+
+    const char *default_database = NULL;
+    const char *default_table = NULL;
+
+    if (!index->table_columns.empty() || !index->qualified_columns.empty())
+    {
+        default_database = cache_query_info_get_default_database(info);
+        default_table = cache_query_info_get_default_table(info);
+    }
+
+    size_t n_fields;
+    const QC_FIELD_INFO *fields = cache_query_info_get_fields(info, &n_fields);
+
+    std::string name;
+
+    size_t i = 0;
+    while (!matches && (i < n_fields))
+    {
+        const QC_FIELD_INFO *field = (fields + i);
+
+        if (field->usage & QC_USED_IN_SELECT)
+        {
+            const char *table = field->table ? field->table : default_table;
+            const char *database = field->database ? field->database : default_database;
+
+            // A rule for the column "*" matches any column.
+            const char *columns[] = { field->column, "*" };
+
+            for (size_t j = 0; !matches && (j < sizeof(columns) / sizeof(columns[0])); ++j)
+            {
+                const char *column = columns[j];
+
+                cache_rules_index_name(&name, NULL, NULL, column);
+                matches = (index->columns.count(name) != 0);
+
+                if (!matches && table)
+                {
+                    cache_rules_index_name(&name, NULL, table, column);
+                    matches = (index->table_columns.count(name) != 0);
+
+                    if (!matches && database)
+                    {
+                        cache_rules_index_name(&name, database, table, column);
+                        matches = (index->qualified_columns.count(name) != 0);
+                    }
+                }
+            }
+        }
+
+        ++i;
+    }
+
+    return matches;
+}
+
+/**
+ * Returns boolean indicating whether the result of the query should be stored.
+ *
+ * @param index      The index.
+ * @param thread_id  The thread id of current thread.
+ * @param info       The query classifier information of the query.
+ *
+ * @return True, if the results should be stored.
+ */
+static bool cache_rules_index_should_store(struct cache_rules_index *index,
+                                           int thread_id,
+                                           CACHE_QUERY_INFO *info)
+{
+    bool should_store = false;
+
+    if (!index->queries.empty())
+    {
+        char* sql;
+        int len;
+
+        // Will succeed, query contains a contiguous COM_QUERY.
+        modutil_extract_SQL((GWBUF*)info->query, &sql, &len);
+
+        should_store = (index->queries.count(std::string(sql, len)) != 0);
+    }
+
+    if (!should_store &&
+        (!index->databases.empty() || !index->tables.empty() || !index->qualified_tables.empty()))
+    {
+        should_store = cache_rules_index_matches_tables(index, info);
+    }
+
+    if (!should_store &&
+        (!index->columns.empty() || !index->table_columns.empty() || !index->qualified_columns.empty()))
+    {
+        should_store = cache_rules_index_matches_columns(index, info);
+    }
+
+    std::vector<CACHE_RULE*>::const_iterator i = index->store_rules.begin();
+
+    while (!should_store && (i != index->store_rules.end()))
+    {
+        should_store = cache_rule_matches(*i, thread_id, info);
+        ++i;
+    }
+
+    return should_store;
+}
+
+/**
+ * Returns boolean indicating whether the cache should be used.
+ *
+ * @param index      The index.
+ * @param thread_id  The thread id of current thread.
+ * @param account    The account, "user@host".
+ *
+ * @return True, if the cache should be used.
+ */
+static bool cache_rules_index_should_use(struct cache_rules_index *index,
+                                         int thread_id,
+                                         const char *account)
+{
+    bool should_use = (index->accounts.count(account) != 0);
+
+    std::vector<CACHE_RULE*>::const_iterator i = index->use_rules.begin();
+
+    while (!should_use && (i != index->use_rules.end()))
+    {
+        should_use = cache_rule_matches_user(*i, thread_id, account);
+        ++i;
+    }
+
+    return should_use;
 }
 
 /**
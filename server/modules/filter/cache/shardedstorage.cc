@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "shardedstorage.hh"
+
+ShardedStorage::ShardedStorage(const CACHE_STORAGE_CONFIG& config, Shards& shards)
+    : m_config(config)
+{
+    ss_dassert(!shards.empty());
+
+    m_shards.swap(shards);
+
+    MXS_NOTICE("Created sharded storage with %lu shards.", m_shards.size());
+}
+
+ShardedStorage::~ShardedStorage()
+{
+    for (Shards::iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        delete *i;
+    }
+}
+
+ShardedStorage* ShardedStorage::create(const CACHE_STORAGE_CONFIG& config, Shards& shards)
+{
+    ShardedStorage* pStorage = NULL;
+
+    MXS_EXCEPTION_GUARD(pStorage = new ShardedStorage(config, shards));
+
+    return pStorage;
+}
+
+void ShardedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t ShardedStorage::get_info(uint32_t what,
+                                        json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        json_t* pShards = json_array();
+
+        if (pShards)
+        {
+            for (Shards::const_iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+            {
+                json_t* pShard_info;
+
+                cache_result_t result = (*i)->get_info(what, &pShard_info);
+
+                if (CACHE_RESULT_IS_OK(result))
+                {
+                    json_array_append_new(pShards, pShard_info);
+                }
+            }
+
+            json_object_set_new(*ppInfo, "shards", pShards);
+        }
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t ShardedStorage::get_value(const CACHE_KEY& key,
+                                         uint32_t flags,
+                                         GWBUF** ppValue) const
+{
+    return shard(key).get_value(key, flags, ppValue);
+}
+
+cache_result_t ShardedStorage::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+{
+    return shard(key).put_value(key, pValue);
+}
+
+cache_result_t ShardedStorage::del_value(const CACHE_KEY& key)
+{
+    return shard(key).del_value(key);
+}
+
+cache_result_t ShardedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         (i != m_shards.end()) && CACHE_RESULT_IS_NOT_FOUND(result);
+         ++i)
+    {
+        result = (*i)->get_head(pKey, ppHead);
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         (i != m_shards.end()) && CACHE_RESULT_IS_NOT_FOUND(result);
+         ++i)
+    {
+        result = (*i)->get_tail(pKey, ppTail);
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_size(uint64_t* pSize) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    *pSize = 0;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         (i != m_shards.end()) && CACHE_RESULT_IS_OK(result);
+         ++i)
+    {
+        uint64_t size;
+        result = (*i)->get_size(&size);
+        *pSize += size;
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_items(uint64_t* pItems) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    *pItems = 0;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         (i != m_shards.end()) && CACHE_RESULT_IS_OK(result);
+         ++i)
+    {
+        uint64_t items;
+        result = (*i)->get_items(&items);
+        *pItems += items;
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::save_snapshot(const char* zPath)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // All shards are saved even if some cannot be.
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        cache_result_t rv = m_shards[i]->save_snapshot(shard_path(zPath, i).c_str());
+
+        if (rv != CACHE_RESULT_OK)
+        {
+            result = rv;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    *pItems = 0;
+
+    for (size_t i = 0; (i < m_shards.size()) && (result == CACHE_RESULT_OK); ++i)
+    {
+        uint64_t items;
+        result = m_shards[i]->load_snapshot(shard_path(zPath, i).c_str(), &items);
+        *pItems += items;
+    }
+
+    return result;
+}
+
+std::string ShardedStorage::shard_path(const char* zPath, size_t i) const
+{
+    char suffix[64];
+    sprintf(suffix, ".%lu-of-%lu", (unsigned long)i + 1, (unsigned long)m_shards.size());
+
+    return std::string(zPath) + suffix;
+}
@@ -0,0 +1,113 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include "storage.hh"
+
+/**
+ * ShardedStorage partitions the keys by their hash into a number of
+ * independent storages, each of which does its own locking. Threads that
+ * access different shards do not contend with each other.
+ *
+ * The limits of the configuration apply to the whole; each shard has an
+ * equal part of them.
+ */
+class ShardedStorage : public Storage
+{
+public:
+    typedef std::vector<Storage*> Shards;
+
+    ~ShardedStorage();
+
+    /**
+     * Create a sharded storage.
+     *
+     * @param config  The configuration the storage was created with.
+     * @param shards  The shards. If the storage is created, it takes the
+     *                ownership of the shards and @c shards is emptied.
+     *
+     * @return A storage instance or NULL in case of errors.
+     */
+    static ShardedStorage* create(const CACHE_STORAGE_CONFIG& config, Shards& shards);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+
+    cache_result_t get_info(uint32_t what,
+                            json_t** ppInfo) const;
+
+    cache_result_t get_value(const CACHE_KEY& key,
+                             uint32_t flags,
+                             GWBUF** ppValue) const;
+
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const GWBUF* pValue);
+
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    /**
+     * @see Storage::get_head
+     *
+     * The head of the first non-empty shard.
+     */
+    cache_result_t get_head(CACHE_KEY* pKey,
+                            GWBUF** ppValue) const;
+
+    /**
+     * @see Storage::get_tail
+     *
+     * The tail of the first non-empty shard.
+     */
+    cache_result_t get_tail(CACHE_KEY* pKey,
+                            GWBUF** ppValue) const;
+
+    cache_result_t get_size(uint64_t* pSize) const;
+
+    cache_result_t get_items(uint64_t* pItems) const;
+
+    /**
+     * @see Storage::save_snapshot
+     *
+     * Each shard is saved to a file of its own, whose name is that of the
+     * snapshot followed by the index of the shard and the number of shards.
+     * If the number of shards is changed, the snapshot is not loaded.
+     */
+    cache_result_t save_snapshot(const char* zPath);
+
+    /**
+     * @see Storage::load_snapshot
+     */
+    cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
+private:
+    ShardedStorage(const CACHE_STORAGE_CONFIG& config, Shards& shards);
+
+    ShardedStorage(const ShardedStorage&);
+    ShardedStorage& operator = (const ShardedStorage&);
+
+    std::string shard_path(const char* zPath, size_t i) const;
+
+    Storage& shard(const CACHE_KEY& key) const
+    {
+        // The key is a hash already, but the low bits need not be well distributed.
+        uint64_t h = key.data[0] ^ (key.data[0] >> 32);
+
+        return *m_shards[h % m_shards.size()];
+    }
+
+private:
+    const CACHE_STORAGE_CONFIG m_config; /*< The configuration. */
+    Shards                     m_shards; /*< The shards. */
+};
@@ -22,3 +22,14 @@ Storage::Storage()
 Storage::~Storage()
 {
 }
+
+cache_result_t Storage::save_snapshot(const char* zPath)
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t Storage::load_snapshot(const char* zPath, uint64_t* pItems)
+{
+    *pItems = 0;
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
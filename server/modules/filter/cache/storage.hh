@@ -154,6 +154,37 @@ public:
      */
     virtual cache_result_t get_items(uint64_t* pItems) const = 0;
 
+    /**
+     * Save the items of the storage, with the time they were stored, to a file
+     * from which they can be loaded with @c load_snapshot. The file is replaced
+     * only once it has been completely written.
+     *
+     * @param zPath  The file.
+     *
+     * @return CACHE_RESULT_OK if the items were saved,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable
+     *         of saving its items, and
+     *         CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t save_snapshot(const char* zPath);
+
+    /**
+     * Load items saved with @c save_snapshot. Items that have been stored
+     * after the storage was created, and items whose hard TTL has passed,
+     * are not loaded. The TTLs of the loaded items are counted from when
+     * they were originally stored.
+     *
+     * @param zPath   The file.
+     * @param pItems  On return, the number of loaded items.
+     *
+     * @return CACHE_RESULT_OK if the items were loaded,
+     *         CACHE_RESULT_NOT_FOUND if the file does not exist,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable
+     *         of loading items, and
+     *         CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t load_snapshot(const char* zPath, uint64_t* pItems);
+
 protected:
     Storage();
 
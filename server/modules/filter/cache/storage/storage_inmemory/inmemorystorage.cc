@@ -13,7 +13,12 @@
 
 #define MXS_MODULE_NAME "storage_inmemory"
 #include "inmemorystorage.hh"
+#include <time.h>
+#include <zlib.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/clock.h>
+#include <maxscale/utils.h>
 #include <maxscale/modutil.h>
 #include <maxscale/query_classifier.h>
 #include "inmemorystoragest.hh"
@@ -32,11 +37,22 @@ const size_t INMEMORY_KEY_LENGTH = 2 * SHA512_DIGEST_LENGTH;
 #error storage_inmemory key is too long.
 #endif
 
+inline uint64_t time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 }
 
-InMemoryStorage::InMemoryStorage(const string& name, const CACHE_STORAGE_CONFIG& config)
+InMemoryStorage::InMemoryStorage(const string& name,
+                                 const CACHE_STORAGE_CONFIG& config,
+                                 const Options& options)
     : m_name(name)
     , m_config(config)
+    , m_options(options)
 {
 }
 
@@ -69,12 +85,66 @@ InMemoryStorage* InMemoryStorage::Create_instance(const char* zName,
                     "does not enforce such a limit.", (unsigned long)config.max_size);
     }
 
+    Options options;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        char arg[len + 1];
+        strcpy(arg, argv[i]);
+
+        const char* zValue = NULL;
+        char *zEq = strchr(arg, '=');
+
+        if (zEq)
+        {
+            *zEq = 0;
+            zValue = trim(zEq + 1);
+        }
+
+        const char* zKey = trim(arg);
+
+        if (strcmp(zKey, "compression_threshold") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : -1;
+
+            if ((value >= 0) && (*zEnd == 0))
+            {
+                options.compression_threshold = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', values will not be compressed.", zKey);
+            }
+        }
+        else if (strcmp(zKey, "compression_level") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : -1;
+
+            if ((value >= 1) && (value <= 9) && (*zEnd == 0))
+            {
+                options.compression_level = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %d instead.",
+                            zKey, options.compression_level);
+            }
+        }
+        else
+        {
+            MXS_WARNING("Unknown argument '%s'.", zKey);
+        }
+    }
+
     auto_ptr<InMemoryStorage> sStorage;
 
     switch (config.thread_model)
     {
     case CACHE_THREAD_MODEL_ST:
-        sStorage = InMemoryStorageST::Create(zName, config, argc, argv);
+        sStorage = InMemoryStorageST::Create(zName, config, options);
         break;
 
     default:
@@ -82,7 +152,7 @@ InMemoryStorage* InMemoryStorage::Create_instance(const char* zName,
         MXS_ERROR("Unknown thread model %d, creating multi-thread aware storage.",
                   (int)config.thread_model);
     case CACHE_THREAD_MODEL_MT:
-        sStorage = InMemoryStorageMT::Create(zName, config, argc, argv);
+        sStorage = InMemoryStorageMT::Create(zName, config, options);
         break;
     }
 
@@ -128,7 +198,92 @@ cache_result_t InMemoryStorage::do_get_info(uint32_t what, json_t** ppInfo) cons
     return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
 }
 
-cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
+cache_result_t InMemoryStorage::encode(const GWBUF& value, Value& encoded, uint32_t* pLength)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
+
+    cache_result_t result = CACHE_RESULT_OK;
+
+    size_t size = GWBUF_LENGTH(&value);
+    const uint8_t* pData = GWBUF_DATA(&value);
+
+    *pLength = 0;
+
+    try
+    {
+        if ((m_options.compression_threshold != 0) && (size >= m_options.compression_threshold))
+        {
+            uint64_t start = time_ns();
+
+            Value compressed(compressBound(size));
+            uLongf compressed_size = compressed.size();
+
+            if ((compress2(&compressed[0], &compressed_size, pData, size,
+                           m_options.compression_level) == Z_OK) &&
+                (compressed_size < size))
+            {
+                // Assigned and not swapped, so that the stored value does
+                // not retain the capacity needed in the worst case.
+                encoded.assign(compressed.begin(), compressed.begin() + compressed_size);
+                *pLength = size;
+            }
+
+            atomic_add_uint64(&m_stats.compression_ns, time_ns() - start);
+        }
+
+        if (*pLength == 0)
+        {
+            encoded.assign(pData, pData + size);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+cache_result_t InMemoryStorage::decode(uint32_t length, GWBUF** ppResult)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    if (length != 0)
+    {
+        uint64_t start = time_ns();
+
+        GWBUF* pCompressed = *ppResult;
+        *ppResult = gwbuf_alloc(length);
+
+        if (*ppResult)
+        {
+            uLongf size = length;
+
+            if ((uncompress(GWBUF_DATA(*ppResult), &size,
+                            GWBUF_DATA(pCompressed), GWBUF_LENGTH(pCompressed)) != Z_OK) ||
+                (size != length))
+            {
+                MXS_ERROR("Could not decompress a cached value.");
+                gwbuf_free(*ppResult);
+                *ppResult = NULL;
+                result = CACHE_RESULT_ERROR;
+            }
+        }
+        else
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+
+        gwbuf_free(pCompressed);
+
+        atomic_add_uint64(&m_stats.decompression_ns, time_ns() - start);
+    }
+
+    return result;
+}
+
+cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flags,
+                                             GWBUF** ppResult, uint32_t* pLength)
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
 
@@ -140,7 +295,7 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
 
         Entry& entry = i->second;
 
-        uint32_t now = time(NULL);
+        uint32_t now = mxs_clock_time();
 
         bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - entry.time > m_config.hard_ttl);
         bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - entry.time > m_config.soft_ttl);
@@ -148,7 +303,7 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
 
         if (is_hard_stale)
         {
-            m_entries.erase(i);
+            remove_entry(i);
         }
         else if (!is_soft_stale || include_stale)
         {
@@ -159,6 +314,7 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
             if (*ppResult)
             {
                 memcpy(GWBUF_DATA(*ppResult), entry.value.data(), length);
+                *pLength = entry.length;
 
                 result = CACHE_RESULT_OK;
 
@@ -186,12 +342,8 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
     return result;
 }
 
-cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF& value)
+cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, Value& encoded, uint32_t length)
 {
-    ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
-
-    size_t size = GWBUF_LENGTH(&value);
-
     Entries::iterator i = m_entries.find(key);
     Entry* pEntry;
 
@@ -200,7 +352,6 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
         m_stats.items += 1;
 
         pEntry = &m_entries[key];
-        pEntry->value.resize(size);
     }
     else
     {
@@ -208,27 +359,20 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
 
         pEntry = &i->second;
 
-        m_stats.size -= pEntry->value.size();
-
-        if (size < pEntry->value.capacity())
-        {
-            // If the needed value is less than what is currently stored,
-            // we shrink the buffer so as not to waste space.
-            Value entry_value(size);
-            pEntry->value.swap(entry_value);
-        }
-        else
-        {
-            pEntry->value.resize(size);
-        }
+        unaccount(*pEntry);
     }
 
-    m_stats.size += size;
+    pEntry->value.swap(encoded);
+    pEntry->length = length;
+    pEntry->time = mxs_clock_time();
 
-    const uint8_t* pData = GWBUF_DATA(&value);
+    m_stats.size += pEntry->value.size();
 
-    copy(pData, pData + size, pEntry->value.begin());
-    pEntry->time = time(NULL);
+    if (length != 0)
+    {
+        m_stats.compressed_items += 1;
+        m_stats.compressed_saved += length - pEntry->value.size();
+    }
 
     return CACHE_RESULT_OK;
 }
@@ -237,19 +381,43 @@ cache_result_t InMemoryStorage::do_del_value(const CACHE_KEY& key)
 {
     Entries::iterator i = m_entries.find(key);
 
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
     if (i != m_entries.end())
     {
-        ss_dassert(m_stats.size >= i->second.value.size());
-        ss_dassert(m_stats.items > 0);
-
-        m_stats.size -= i->second.value.size();
-        m_stats.items -= 1;
         m_stats.deletes += 1;
 
-        m_entries.erase(i);
+        remove_entry(i);
+
+        result = CACHE_RESULT_OK;
     }
 
-    return i != m_entries.end() ? CACHE_RESULT_OK : CACHE_RESULT_NOT_FOUND;
+    return result;
+}
+
+void InMemoryStorage::unaccount(const Entry& entry)
+{
+    ss_dassert(m_stats.size >= entry.value.size());
+
+    m_stats.size -= entry.value.size();
+
+    if (entry.length != 0)
+    {
+        ss_dassert(m_stats.compressed_items > 0);
+
+        m_stats.compressed_items -= 1;
+        m_stats.compressed_saved -= entry.length - entry.value.size();
+    }
+}
+
+void InMemoryStorage::remove_entry(Entries::iterator i)
+{
+    ss_dassert(m_stats.items > 0);
+
+    unaccount(i->second);
+    m_stats.items -= 1;
+
+    m_entries.erase(i);
 }
 
 static void set_integer(json_t* pObject, const char* zName, size_t value)
@@ -271,4 +439,8 @@ void InMemoryStorage::Stats::fill(json_t* pObject) const
     set_integer(pObject, "misses", misses);
     set_integer(pObject, "updates", updates);
     set_integer(pObject, "deletes", deletes);
+    set_integer(pObject, "compressed_items", compressed_items);
+    set_integer(pObject, "compressed_saved", compressed_saved);
+    set_integer(pObject, "compression_ms", compression_ns / 1000000);
+    set_integer(pObject, "decompression_ms", decompression_ns / 1000000);
 }
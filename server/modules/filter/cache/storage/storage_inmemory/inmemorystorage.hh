@@ -22,6 +22,17 @@
 class InMemoryStorage
 {
 public:
+    struct Options
+    {
+        Options()
+            : compression_threshold(0)
+            , compression_level(1)
+        {}
+
+        uint32_t compression_threshold; /*< Values at least this large are compressed, 0 means never. */
+        int      compression_level;     /*< The zlib compression level. */
+    };
+
     virtual ~InMemoryStorage();
 
     static bool Initialize(uint32_t* pCapabilities);
@@ -42,12 +53,41 @@ public:
     cache_result_t get_items(uint64_t* pItems) const;
 
 protected:
+    typedef std::vector<uint8_t> Value;
+
     InMemoryStorage(const std::string& name,
-                    const CACHE_STORAGE_CONFIG& config);
+                    const CACHE_STORAGE_CONFIG& config,
+                    const Options& options);
+
+    /**
+     * Encodes a value for storing. As the encoding may involve compression,
+     * it should be done without holding any lock.
+     *
+     * @param value     The value to be stored.
+     * @param encoded   On return, the bytes to be stored.
+     * @param pLength   On return, the length of the value if it was compressed,
+     *                  0 if it was not.
+     *
+     * @return CACHE_RESULT_OK or CACHE_RESULT_OUT_OF_RESOURCES.
+     */
+    cache_result_t encode(const GWBUF& value, Value& encoded, uint32_t* pLength);
+
+    /**
+     * Decodes a value returned by do_get_value(). As the decoding may involve
+     * decompression, it should be done without holding any lock.
+     *
+     * @param length     The length returned by do_get_value().
+     * @param ppResult   The buffer returned by do_get_value(), on return the
+     *                   decoded value.
+     *
+     * @return CACHE_RESULT_OK, or CACHE_RESULT_OUT_OF_RESOURCES or CACHE_RESULT_ERROR,
+     *         in which case the buffer has been freed.
+     */
+    cache_result_t decode(uint32_t length, GWBUF** ppResult);
 
     cache_result_t do_get_info(uint32_t what, json_t** ppInfo) const;
-    cache_result_t do_get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
-    cache_result_t do_put_value(const CACHE_KEY& key, const GWBUF& value);
+    cache_result_t do_get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult, uint32_t* pLength);
+    cache_result_t do_put_value(const CACHE_KEY& key, Value& encoded, uint32_t length);
     cache_result_t do_del_value(const CACHE_KEY& key);
 
 private:
@@ -55,15 +95,15 @@ private:
     InMemoryStorage& operator = (const InMemoryStorage&);
 
 private:
-    typedef std::vector<uint8_t> Value;
-
     struct Entry
     {
         Entry()
             : time(0)
+            , length(0)
         {}
 
         uint32_t time;
+        uint32_t length; /*< The length of the compressed value, 0 if not compressed. */
         Value    value;
     };
 
@@ -76,6 +116,10 @@ private:
             , misses(0)
             , updates(0)
             , deletes(0)
+            , compressed_items(0)
+            , compressed_saved(0)
+            , compression_ns(0)
+            , decompression_ns(0)
         {}
 
         void fill(json_t* pObject) const;
@@ -86,12 +130,20 @@ private:
         uint64_t misses;     /*< How many times a key was not found in the cache. */
         uint64_t updates;    /*< How many times an existing key in the cache was updated. */
         uint64_t deletes;    /*< How many times an existing key in the cache was deleted. */
+        uint64_t compressed_items; /*< The number of stored items that are compressed. */
+        uint64_t compressed_saved; /*< How many bytes the compression of the stored items saves. */
+        uint64_t compression_ns;   /*< The total time spent compressing values. */
+        uint64_t decompression_ns; /*< The total time spent decompressing values. */
     };
 
     typedef std::tr1::unordered_map<CACHE_KEY, Entry> Entries;
 
+    void unaccount(const Entry& entry);
+    void remove_entry(Entries::iterator i);
+
     std::string                m_name;
     const CACHE_STORAGE_CONFIG m_config;
+    const Options              m_options;
     Entries                    m_entries;
     Stats                      m_stats;
 };
@@ -18,8 +18,9 @@ using maxscale::SpinLockGuard;
 using std::auto_ptr;
 
 InMemoryStorageMT::InMemoryStorageMT(const std::string& name,
-                                     const CACHE_STORAGE_CONFIG& config)
-    : InMemoryStorage(name, config)
+                                     const CACHE_STORAGE_CONFIG& config,
+                                     const Options& options)
+    : InMemoryStorage(name, config, options)
 {
     spinlock_init(&m_lock);
 }
@@ -30,9 +31,9 @@ InMemoryStorageMT::~InMemoryStorageMT()
 
 auto_ptr<InMemoryStorageMT> InMemoryStorageMT::Create(const std::string& name,
                                                       const CACHE_STORAGE_CONFIG& config,
-                                                      int argc, char* argv[])
+                                                      const Options& options)
 {
-    return auto_ptr<InMemoryStorageMT>(new InMemoryStorageMT(name, config));
+    return auto_ptr<InMemoryStorageMT>(new InMemoryStorageMT(name, config, options));
 }
 
 cache_result_t InMemoryStorageMT::get_info(uint32_t what, json_t** ppInfo) const
@@ -44,16 +45,42 @@ cache_result_t InMemoryStorageMT::get_info(uint32_t what, json_t** ppInfo) const
 
 cache_result_t InMemoryStorageMT::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
 {
-    SpinLockGuard guard(m_lock);
+    uint32_t length = 0;
+    cache_result_t result;
+
+    {
+        SpinLockGuard guard(m_lock);
+
+        result = do_get_value(key, flags, ppResult, &length);
+    }
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        cache_result_t decoded = decode(length, ppResult);
 
-    return do_get_value(key, flags, ppResult);
+        if (!CACHE_RESULT_IS_OK(decoded))
+        {
+            result = decoded;
+        }
+    }
+
+    return result;
 }
 
 cache_result_t InMemoryStorageMT::put_value(const CACHE_KEY& key, const GWBUF& value)
 {
-    SpinLockGuard guard(m_lock);
+    Value encoded;
+    uint32_t length;
+    cache_result_t result = encode(value, encoded, &length);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        SpinLockGuard guard(m_lock);
+
+        result = do_put_value(key, encoded, length);
+    }
 
-    return do_put_value(key, value);
+    return result;
 }
 
 cache_result_t InMemoryStorageMT::del_value(const CACHE_KEY& key)
@@ -25,7 +25,7 @@ public:
 
     static SInMemoryStorageMT Create(const std::string& name,
                                      const CACHE_STORAGE_CONFIG& config,
-                                     int argc, char* argv[]);
+                                     const Options& options);
 
     cache_result_t get_info(uint32_t what, json_t** ppInfo) const;
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
@@ -33,7 +33,8 @@ public:
     cache_result_t del_value(const CACHE_KEY& key);
 
 private:
-    InMemoryStorageMT(const std::string& name, const CACHE_STORAGE_CONFIG& config);
+    InMemoryStorageMT(const std::string& name, const CACHE_STORAGE_CONFIG& config,
+                      const Options& options);
 
 private:
     InMemoryStorageMT(const InMemoryStorageMT&);
@@ -17,8 +17,9 @@
 using std::auto_ptr;
 
 InMemoryStorageST::InMemoryStorageST(const std::string& name,
-                                     const CACHE_STORAGE_CONFIG& config)
-    : InMemoryStorage(name, config)
+                                     const CACHE_STORAGE_CONFIG& config,
+                                     const Options& options)
+    : InMemoryStorage(name, config, options)
 {
 }
 
@@ -28,9 +29,9 @@ InMemoryStorageST::~InMemoryStorageST()
 
 auto_ptr<InMemoryStorageST> InMemoryStorageST::Create(const std::string& name,
                                                       const CACHE_STORAGE_CONFIG& config,
-                                                      int argc, char* argv[])
+                                                      const Options& options)
 {
-    return auto_ptr<InMemoryStorageST>(new InMemoryStorageST(name, config));
+    return auto_ptr<InMemoryStorageST>(new InMemoryStorageST(name, config, options));
 }
 
 cache_result_t InMemoryStorageST::get_info(uint32_t what, json_t** ppInfo) const
@@ -40,12 +41,34 @@ cache_result_t InMemoryStorageST::get_info(uint32_t what, json_t** ppInfo) const
 
 cache_result_t InMemoryStorageST::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
 {
-    return do_get_value(key, flags, ppResult);
+    uint32_t length = 0;
+    cache_result_t result = do_get_value(key, flags, ppResult, &length);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        cache_result_t decoded = decode(length, ppResult);
+
+        if (!CACHE_RESULT_IS_OK(decoded))
+        {
+            result = decoded;
+        }
+    }
+
+    return result;
 }
 
 cache_result_t InMemoryStorageST::put_value(const CACHE_KEY& key, const GWBUF& value)
 {
-    return do_put_value(key, value);
+    Value encoded;
+    uint32_t length;
+    cache_result_t result = encode(value, encoded, &length);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        result = do_put_value(key, encoded, length);
+    }
+
+    return result;
 }
 
 cache_result_t InMemoryStorageST::del_value(const CACHE_KEY& key)
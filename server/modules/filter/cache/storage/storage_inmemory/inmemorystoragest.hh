@@ -24,7 +24,7 @@ public:
 
     static SInMemoryStorageST Create(const std::string& name,
                                      const CACHE_STORAGE_CONFIG& config,
-                                     int argc, char* argv[]);
+                                     const Options& options);
 
     cache_result_t get_info(uint32_t what, json_t** ppInfo) const;
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
@@ -32,7 +32,8 @@ public:
     cache_result_t del_value(const CACHE_KEY& key);
 
 private:
-    InMemoryStorageST(const std::string& name, const CACHE_STORAGE_CONFIG& config);
+    InMemoryStorageST(const std::string& name, const CACHE_STORAGE_CONFIG& config,
+                      const Options& options);
 
 private:
     InMemoryStorageST(const InMemoryStorageST&);
@@ -0,0 +1,1118 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "storage_memcached"
+#include "memcachedstorage.hh"
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <maxscale/alloc.h>
+#include <maxscale/clock.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/utils.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+// The number of hexadecimal digits of a key.
+const size_t MEMCACHED_KEY_DIGITS = 2 * 2 * sizeof(uint64_t);
+
+// The maximum length of a memcached key.
+const size_t MEMCACHED_MAX_KEY_LENGTH = 250;
+
+// The maximum length of the key prefix.
+const size_t MEMCACHED_MAX_PREFIX_LENGTH = MEMCACHED_MAX_KEY_LENGTH - MEMCACHED_KEY_DIGITS;
+
+// The maximum number of keys fetched with one get command.
+const size_t MEMCACHED_MAX_KEYS_PER_GET = 100;
+
+// An expiration time longer than this is taken by memcached as a Unix time.
+const uint32_t MEMCACHED_MAX_EXPTIME = 60 * 60 * 24 * 30;
+
+// The number of seconds after which a failed connection attempt is retried.
+const time_t MEMCACHED_RETRY_INTERVAL = 1;
+
+inline uint32_t age(uint32_t now, uint32_t time)
+{
+    // The value may have been stored by another instance whose clock is ahead.
+    return now > time ? now - time : 0;
+}
+
+/**
+ * Creates the default key prefix from the name of the cache, so that the
+ * same filter on different MaxScale instances shares the values.
+ */
+string default_key_prefix(const char* zName)
+{
+    string prefix(zName);
+
+    if (prefix.length() > MEMCACHED_MAX_PREFIX_LENGTH - 1)
+    {
+        prefix.resize(MEMCACHED_MAX_PREFIX_LENGTH - 1);
+    }
+
+    for (string::iterator i = prefix.begin(); i != prefix.end(); ++i)
+    {
+        // Memcached keys must not contain whitespace or control characters.
+        if (*i <= ' ' || *i == 0x7f)
+        {
+            *i = '_';
+        }
+    }
+
+    return prefix + ":";
+}
+
+/**
+ * Parses a server specification of the form "host[:port]", where the host
+ * may be an IPv6 address enclosed in brackets.
+ *
+ * @param zValue  The specification.
+ * @param pHost   On successful return, the host.
+ * @param pPort   On successful return, the port, if one was specified.
+ *
+ * @return True, if the specification is valid.
+ */
+bool parse_server(const char* zValue, string* pHost, string* pPort)
+{
+    string server(zValue);
+    string host;
+    string rest;
+
+    if ((server.length() != 0) && (server[0] == '['))
+    {
+        size_t end = server.find(']');
+
+        if (end == string::npos)
+        {
+            return false;
+        }
+
+        host = server.substr(1, end - 1);
+        rest = server.substr(end + 1);
+    }
+    else
+    {
+        size_t colon = server.find(':');
+
+        host = server.substr(0, colon);
+        rest = (colon == string::npos) ? "" : server.substr(colon);
+    }
+
+    if (host.empty() || (!rest.empty() && ((rest[0] != ':') || (rest.length() == 1))))
+    {
+        return false;
+    }
+
+    *pHost = host;
+
+    if (!rest.empty())
+    {
+        *pPort = rest.substr(1);
+    }
+
+    return true;
+}
+
+}
+
+MemcachedStorage::MemcachedStorage(const string& name,
+                                   const CACHE_STORAGE_CONFIG& config,
+                                   const Options& options)
+    : m_name(name)
+    , m_config(config)
+    , m_options(options)
+    , m_size(0)
+    , m_seq(0)
+    , m_stop(false)
+    , m_stats()
+    , m_fd(-1)
+    , m_failing(false)
+    , m_retry_at(0)
+{
+    m_io = std::thread(&MemcachedStorage::run_io, this);
+}
+
+MemcachedStorage::~MemcachedStorage()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+
+    m_cond.notify_one();
+    m_io.join();
+}
+
+bool MemcachedStorage::Initialize(uint32_t* pCapabilities)
+{
+    // The near cache provides the eviction itself. Were the storage decorated
+    // with an LRUStorage, evicting a value would delete it from memcached.
+    *pCapabilities = (CACHE_STORAGE_CAP_MT |
+                      CACHE_STORAGE_CAP_LRU |
+                      CACHE_STORAGE_CAP_MAX_COUNT |
+                      CACHE_STORAGE_CAP_MAX_SIZE);
+
+    return true;
+}
+
+MemcachedStorage* MemcachedStorage::Create_instance(const char* zName,
+                                                    const CACHE_STORAGE_CONFIG& config,
+                                                    int argc, char* argv[])
+{
+    ss_dassert(zName);
+
+    Options options;
+    options.key_prefix = default_key_prefix(zName);
+
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        char arg[len + 1];
+        strcpy(arg, argv[i]);
+
+        const char* zValue = NULL;
+        char *zEq = strchr(arg, '=');
+
+        if (zEq)
+        {
+            *zEq = 0;
+            zValue = trim(zEq + 1);
+        }
+
+        const char* zKey = trim(arg);
+
+        if (strcmp(zKey, "server") == 0)
+        {
+            if (!zValue || !parse_server(zValue, &options.host, &options.port))
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %s:%s instead.",
+                            zKey, options.host.c_str(), options.port.c_str());
+            }
+        }
+        else if (strcmp(zKey, "key_prefix") == 0)
+        {
+            if (zValue && (strlen(zValue) <= MEMCACHED_MAX_PREFIX_LENGTH) &&
+                (strpbrk(zValue, " \t\r\n") == NULL))
+            {
+                options.key_prefix = zValue;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default '%s' instead.",
+                            zKey, options.key_prefix.c_str());
+            }
+        }
+        else if (strcmp(zKey, "timeout") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+            if ((value > 0) && (*zEnd == 0))
+            {
+                options.timeout = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %u instead.",
+                            zKey, options.timeout);
+            }
+        }
+        else if (strcmp(zKey, "near_cache_ttl") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : -1;
+
+            if ((value >= 0) && (*zEnd == 0))
+            {
+                options.near_cache_ttl = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %u instead.",
+                            zKey, options.near_cache_ttl);
+            }
+        }
+        else if (strcmp(zKey, "async_queue_size") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+            if ((value > 0) && (*zEnd == 0))
+            {
+                options.async_queue_size = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %lu instead.",
+                            zKey, options.async_queue_size);
+            }
+        }
+        else
+        {
+            MXS_WARNING("Unknown argument '%s'.", zKey);
+        }
+    }
+
+    MemcachedStorage* pStorage = new MemcachedStorage(zName, config, options);
+
+    MXS_NOTICE("Storage module created, using memcached at %s:%s.",
+               options.host.c_str(), options.port.c_str());
+
+    return pStorage;
+}
+
+void MemcachedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t MemcachedStorage::get_info(uint32_t flags, json_t** ppInfo) const
+{
+    json_t* pInfo = json_object();
+
+    if (pInfo)
+    {
+        string server = m_options.host + ":" + m_options.port;
+
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        json_object_set_new(pInfo, "server", json_string(server.c_str()));
+        json_object_set_new(pInfo, "items", json_integer(m_entries.size()));
+        json_object_set_new(pInfo, "size", json_integer(m_size));
+        json_object_set_new(pInfo, "hits", json_integer(m_stats.hits));
+        json_object_set_new(pInfo, "misses", json_integer(m_stats.misses));
+        json_object_set_new(pInfo, "evictions", json_integer(m_stats.evictions));
+        json_object_set_new(pInfo, "queued", json_integer(m_ops.size()));
+        json_object_set_new(pInfo, "fetched", json_integer(m_stats.fetched));
+        json_object_set_new(pInfo, "not_fetched", json_integer(m_stats.not_fetched));
+        json_object_set_new(pInfo, "written", json_integer(m_stats.written));
+        json_object_set_new(pInfo, "dropped", json_integer(m_stats.dropped));
+        json_object_set_new(pInfo, "failed", json_integer(m_stats.failed));
+
+        *ppInfo = pInfo;
+    }
+
+    return pInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    uint32_t now = mxs_clock_time();
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    Entries::iterator i = m_entries.find(key);
+
+    if (i == m_entries.end())
+    {
+        // The value is reported as missing, so that the result is obtained
+        // from the server, and fetched from memcached in the background.
+        ++m_stats.misses;
+        queue_fetch(key);
+    }
+    else
+    {
+        Entry& entry = i->second;
+
+        bool is_hard_stale = m_config.hard_ttl == 0 ? false : (age(now, entry.time) > m_config.hard_ttl);
+        bool is_soft_stale = m_config.soft_ttl == 0 ? false : (age(now, entry.time) > m_config.soft_ttl);
+        bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+        if (is_hard_stale)
+        {
+            // Memcached expires the value by itself.
+            ++m_stats.misses;
+            remove_entry(i);
+        }
+        else
+        {
+            ++m_stats.hits;
+
+            if (age(now, entry.fetched) >= m_options.near_cache_ttl)
+            {
+                // The value may have been replaced or deleted by another instance.
+                // It is used until the current value has been fetched.
+                queue_fetch(key);
+            }
+
+            if ((flags & CACHE_FLAGS_PEEK) == 0)
+            {
+                m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+            }
+
+            if (!is_soft_stale || include_stale)
+            {
+                *ppResult = gwbuf_alloc_and_load(entry.value.length(), entry.value.data());
+
+                if (*ppResult)
+                {
+                    result = CACHE_RESULT_OK;
+
+                    if (is_soft_stale)
+                    {
+                        result |= CACHE_RESULT_STALE;
+                    }
+                }
+                else
+                {
+                    result = CACHE_RESULT_OUT_OF_RESOURCES;
+                }
+            }
+            else
+            {
+                ss_dassert(is_soft_stale);
+                result = (CACHE_RESULT_NOT_FOUND | CACHE_RESULT_STALE);
+            }
+        }
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::put_value(const CACHE_KEY& key, const GWBUF& value)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
+
+    cache_result_t result = CACHE_RESULT_OK;
+
+    uint32_t now = mxs_clock_time();
+
+    try
+    {
+        Op op;
+        op.op = OP_SET;
+        op.key = key;
+        op.seq = 0;
+        op.time = now;
+        op.value.assign(reinterpret_cast<const char*>(GWBUF_DATA(&value)), GWBUF_LENGTH(&value));
+
+        string near_value(op.value);
+
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        // A fetch in progress would replace the value with an older one.
+        m_fetches.erase(key);
+        set_entry(key, now, now, near_value);
+
+        // Dropping a set only means that the value is not shared. Returning
+        // an error would only cause the value to be deleted.
+        queue(op, true);
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::del_value(const CACHE_KEY& key)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    try
+    {
+        Op op;
+        op.op = OP_DELETE;
+        op.key = key;
+        op.seq = 0;
+        op.time = 0;
+
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        m_fetches.erase(key);
+
+        Entries::iterator i = m_entries.find(key);
+
+        if (i != m_entries.end())
+        {
+            remove_entry(i);
+            result = CACHE_RESULT_OK;
+        }
+
+        // A delete is never dropped, as the value could otherwise be used
+        // although it e.g. has been invalidated.
+        queue(op, false);
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    if (!m_lru.empty())
+    {
+        const Entry& entry = m_entries.find(m_lru.front())->second;
+
+        *ppHead = gwbuf_alloc_and_load(entry.value.length(), entry.value.data());
+
+        if (*ppHead)
+        {
+            *pKey = m_lru.front();
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    if (!m_lru.empty())
+    {
+        const Entry& entry = m_entries.find(m_lru.back())->second;
+
+        *ppTail = gwbuf_alloc_and_load(entry.value.length(), entry.value.data());
+
+        if (*ppTail)
+        {
+            *pKey = m_lru.back();
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::get_size(uint64_t* pSize) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    *pSize = m_size;
+
+    return CACHE_RESULT_OK;
+}
+
+cache_result_t MemcachedStorage::get_items(uint64_t* pItems) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    *pItems = m_entries.size();
+
+    return CACHE_RESULT_OK;
+}
+
+/**
+ * Sets a value of the near cache and evicts the least recently used values,
+ * if the near cache is full. Called with m_lock locked.
+ *
+ * @param key    The key.
+ * @param time   When the value was stored.
+ * @param now    The current time.
+ * @param value  The value, which is swapped into the near cache.
+ */
+void MemcachedStorage::set_entry(const CACHE_KEY& key, uint32_t time, uint32_t now, string& value)
+{
+    Entries::iterator i = m_entries.find(key);
+
+    if (i == m_entries.end())
+    {
+        m_lru.push_front(key);
+
+        try
+        {
+            i = m_entries.insert(std::make_pair(key, Entry())).first;
+        }
+        catch (const std::bad_alloc&)
+        {
+            m_lru.pop_front();
+            throw;
+        }
+
+        i->second.lru = m_lru.begin();
+    }
+    else
+    {
+        m_size -= i->second.value.length();
+        m_lru.splice(m_lru.begin(), m_lru, i->second.lru);
+    }
+
+    Entry& entry = i->second;
+
+    entry.time = time;
+    entry.fetched = now;
+    entry.value.swap(value);
+
+    m_size += entry.value.length();
+
+    while (!m_lru.empty() &&
+           (((m_config.max_count != 0) && (m_entries.size() > m_config.max_count)) ||
+            ((m_config.max_size != 0) && (m_size > m_config.max_size))))
+    {
+        // Evicting only removes the value from the near cache, it remains in memcached.
+        remove_entry(m_entries.find(m_lru.back()));
+        ++m_stats.evictions;
+    }
+}
+
+/**
+ * Removes a value from the near cache. Called with m_lock locked.
+ *
+ * @param i  The entry of the value.
+ */
+void MemcachedStorage::remove_entry(Entries::iterator i)
+{
+    ss_dassert(i != m_entries.end());
+
+    m_size -= i->second.value.length();
+    m_lru.erase(i->second.lru);
+    m_entries.erase(i);
+}
+
+/**
+ * Queues the fetching of a value from memcached, unless the value is being
+ * fetched already. Called with m_lock locked.
+ *
+ * @param key  The key of the value.
+ */
+void MemcachedStorage::queue_fetch(const CACHE_KEY& key)
+{
+    try
+    {
+        if (m_fetches.find(key) == m_fetches.end())
+        {
+            if (m_ops.size() < m_options.async_queue_size)
+            {
+                Op op;
+                op.op = OP_GET;
+                op.key = key;
+                op.seq = ++m_seq;
+                op.time = 0;
+
+                m_fetches[key] = op.seq;
+                queue(op, false);
+            }
+            else
+            {
+                ++m_stats.dropped;
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Not fetching the value only means that it will not be found.
+    }
+}
+
+/**
+ * Queues an operation for the I/O thread. Called with m_lock locked.
+ *
+ * @param op         The operation, whose value is moved to the queue.
+ * @param droppable  Whether the operation may be dropped if the queue is full.
+ */
+void MemcachedStorage::queue(Op& op, bool droppable)
+{
+    if (droppable && (m_ops.size() >= m_options.async_queue_size))
+    {
+        ++m_stats.dropped;
+    }
+    else
+    {
+        m_ops.push_back(std::move(op));
+        m_cond.notify_one();
+    }
+}
+
+void MemcachedStorage::run_io()
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+
+    while (!m_stop)
+    {
+        if (m_ops.empty())
+        {
+            m_cond.wait(guard);
+        }
+        else
+        {
+            std::deque<Op> ops;
+            ops.swap(m_ops);
+
+            guard.unlock();
+
+            vector<Fetched> fetched;
+            bool ok = false;
+
+            try
+            {
+                ok = perform_ops(ops, fetched);
+            }
+            catch (const std::exception& x)
+            {
+                MXS_ERROR("Could not access memcached: %s", x.what());
+                disconnect();
+            }
+
+            guard.lock();
+
+            try
+            {
+                complete_ops(ops, fetched, ok);
+            }
+            catch (const std::exception& x)
+            {
+                MXS_ERROR("Could not update the near cache: %s", x.what());
+            }
+        }
+    }
+
+    guard.unlock();
+
+    disconnect();
+}
+
+/**
+ * Sends the queued operations to memcached as one request and reads the
+ * values that were fetched. Called without m_lock locked.
+ *
+ * @param ops      The operations.
+ * @param fetched  On return, the values that were found.
+ *
+ * @return True, if memcached could be accessed.
+ */
+bool MemcachedStorage::perform_ops(const std::deque<Op>& ops, vector<Fetched>& fetched)
+{
+    if ((m_fd == -1) && !connect())
+    {
+        return false;
+    }
+
+    uint32_t exptime = m_config.hard_ttl > MEMCACHED_MAX_EXPTIME ? MEMCACHED_MAX_EXPTIME : m_config.hard_ttl;
+
+    string request;
+    string get;
+    size_t n_keys = 0;
+    size_t n_gets = 0;
+
+    for (std::deque<Op>::const_iterator i = ops.begin(); i != ops.end(); ++i)
+    {
+        const Op& op = *i;
+        string key = memcached_key(op.key);
+
+        switch (op.op)
+        {
+        case OP_SET:
+            {
+                // The time the value was stored is kept in the flags, so that
+                // all instances can tell how old the value is.
+                char header[MEMCACHED_MAX_KEY_LENGTH + 64];
+                sprintf(header, "set %s %u %u %lu noreply\r\n",
+                        key.c_str(), op.time, exptime, (unsigned long)op.value.length());
+
+                request += header;
+                request += op.value;
+                request += "\r\n";
+            }
+            break;
+
+        case OP_DELETE:
+            request += "delete ";
+            request += key;
+            request += " noreply\r\n";
+            break;
+
+        case OP_GET:
+            get += (n_keys == 0) ? "get " : " ";
+            get += key;
+
+            if (++n_keys == MEMCACHED_MAX_KEYS_PER_GET)
+            {
+                request += get;
+                request += "\r\n";
+                get.clear();
+                n_keys = 0;
+                ++n_gets;
+            }
+            break;
+        }
+    }
+
+    if (n_keys != 0)
+    {
+        request += get;
+        request += "\r\n";
+        ++n_gets;
+    }
+
+    bool ok = send_request(request) && read_responses(n_gets, fetched);
+
+    if (!ok)
+    {
+        disconnect();
+    }
+
+    return ok;
+}
+
+/**
+ * Updates the near cache with the values fetched from memcached. Called
+ * with m_lock locked.
+ *
+ * @param ops      The operations that were performed.
+ * @param fetched  The values that were found.
+ * @param ok       Whether memcached could be accessed.
+ */
+void MemcachedStorage::complete_ops(const std::deque<Op>& ops, vector<Fetched>& fetched, bool ok)
+{
+    typedef std::unordered_set<CACHE_KEY, KeyHash, KeyEqual> Keys;
+    Keys current;
+    size_t n_writes = 0;
+
+    for (std::deque<Op>::const_iterator i = ops.begin(); i != ops.end(); ++i)
+    {
+        if (i->op == OP_GET)
+        {
+            Fetches::iterator j = m_fetches.find(i->key);
+
+            // If the value has been stored or deleted after the fetch was
+            // queued, the fetched value must not replace it.
+            if ((j != m_fetches.end()) && (j->second == i->seq))
+            {
+                m_fetches.erase(j);
+                current.insert(i->key);
+            }
+        }
+        else
+        {
+            ++n_writes;
+        }
+    }
+
+    if (ok)
+    {
+        uint32_t now = mxs_clock_time();
+
+        m_stats.written += n_writes;
+
+        for (vector<Fetched>::iterator i = fetched.begin(); i != fetched.end(); ++i)
+        {
+            Keys::iterator j = current.find(i->key);
+
+            if (j != current.end())
+            {
+                set_entry(i->key, i->time, now, i->value);
+                current.erase(j);
+                ++m_stats.fetched;
+            }
+        }
+
+        // The values that were not found have been deleted or have expired.
+        for (Keys::iterator i = current.begin(); i != current.end(); ++i)
+        {
+            Entries::iterator j = m_entries.find(*i);
+
+            if (j != m_entries.end())
+            {
+                remove_entry(j);
+            }
+
+            ++m_stats.not_fetched;
+        }
+    }
+    else
+    {
+        m_stats.failed += ops.size();
+    }
+}
+
+bool MemcachedStorage::connect()
+{
+    time_t now = mxs_clock_time();
+
+    if (now < m_retry_at)
+    {
+        return false;
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* pAddrs = NULL;
+    int rc = getaddrinfo(m_options.host.c_str(), m_options.port.c_str(), &hints, &pAddrs);
+    int error = 0;
+
+    if (rc == 0)
+    {
+        struct timeval tv;
+        tv.tv_sec = m_options.timeout / 1000;
+        tv.tv_usec = (m_options.timeout % 1000) * 1000;
+
+        for (struct addrinfo* pAddr = pAddrs; pAddr && (m_fd == -1); pAddr = pAddr->ai_next)
+        {
+            int fd = socket(pAddr->ai_family, pAddr->ai_socktype | SOCK_CLOEXEC, pAddr->ai_protocol);
+
+            if (fd != -1)
+            {
+                int one = 1;
+
+                // The timeouts apply to the connect as well.
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                if (::connect(fd, pAddr->ai_addr, pAddr->ai_addrlen) == 0)
+                {
+                    m_fd = fd;
+                }
+                else
+                {
+                    error = errno;
+                    close(fd);
+                }
+            }
+            else
+            {
+                error = errno;
+            }
+        }
+
+        freeaddrinfo(pAddrs);
+    }
+
+    if (m_fd == -1)
+    {
+        if (!m_failing)
+        {
+            MXS_ERROR("Could not connect to memcached at %s:%s: %s",
+                      m_options.host.c_str(), m_options.port.c_str(),
+                      rc != 0 ? gai_strerror(rc) : mxs_strerror(error));
+            m_failing = true;
+        }
+
+        m_retry_at = now + MEMCACHED_RETRY_INTERVAL;
+    }
+    else if (m_failing)
+    {
+        MXS_NOTICE("Connected to memcached at %s:%s.", m_options.host.c_str(), m_options.port.c_str());
+        m_failing = false;
+    }
+
+    return m_fd != -1;
+}
+
+void MemcachedStorage::disconnect()
+{
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool MemcachedStorage::send_request(const string& request)
+{
+    const char* pData = request.data();
+    size_t len = request.length();
+
+    while (len != 0)
+    {
+        ssize_t n = send(m_fd, pData, len, MSG_NOSIGNAL);
+
+        if (n > 0)
+        {
+            pData += n;
+            len -= n;
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            if (!m_failing)
+            {
+                MXS_ERROR("Could not send to memcached at %s:%s: %s",
+                          m_options.host.c_str(), m_options.port.c_str(), mxs_strerror(errno));
+                m_failing = true;
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MemcachedStorage::receive(string& in)
+{
+    char buffer[16 * 1024];
+
+    ssize_t n;
+
+    do
+    {
+        n = recv(m_fd, buffer, sizeof(buffer), 0);
+    }
+    while ((n == -1) && (errno == EINTR));
+
+    if (n > 0)
+    {
+        in.append(buffer, n);
+    }
+    else if (!m_failing)
+    {
+        MXS_ERROR("Could not receive from memcached at %s:%s: %s",
+                  m_options.host.c_str(), m_options.port.c_str(),
+                  n == 0 ? "Connection closed" : mxs_strerror(errno));
+        m_failing = true;
+    }
+
+    return n > 0;
+}
+
+/**
+ * Reads the responses to the get commands.
+ *
+ * @param n_gets   The number of get commands that were sent.
+ * @param fetched  On return, the values that were found.
+ *
+ * @return True, if the responses could be read.
+ */
+bool MemcachedStorage::read_responses(size_t n_gets, vector<Fetched>& fetched)
+{
+    string in;
+    size_t pos = 0;
+
+    while (n_gets != 0)
+    {
+        size_t eol = in.find("\r\n", pos);
+
+        if (eol == string::npos)
+        {
+            if (!receive(in))
+            {
+                return false;
+            }
+        }
+        else if (in.compare(pos, eol - pos, "END") == 0)
+        {
+            pos = eol + 2;
+            --n_gets;
+        }
+        else if (in.compare(pos, 6, "VALUE ") == 0)
+        {
+            // VALUE <key> <flags> <bytes>\r\n<data>\r\n
+            string line(in, pos, eol - pos);
+            char zKey[MEMCACHED_MAX_KEY_LENGTH + 1];
+            unsigned int flags;
+            unsigned long bytes;
+
+            if (sscanf(line.c_str(), "VALUE %250s %u %lu", zKey, &flags, &bytes) != 3)
+            {
+                MXS_ERROR("Invalid response from memcached: %s", line.c_str());
+                return false;
+            }
+
+            if (in.length() < eol + 2 + bytes + 2)
+            {
+                if (!receive(in))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                Fetched value;
+
+                if (parse_key(zKey, &value.key))
+                {
+                    value.time = flags;
+                    value.value.assign(in, eol + 2, bytes);
+                    fetched.push_back(std::move(value));
+                }
+
+                pos = eol + 2 + bytes + 2;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Unexpected response from memcached: %s", string(in, pos, eol - pos).c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+string MemcachedStorage::memcached_key(const CACHE_KEY& key) const
+{
+    char digits[MEMCACHED_KEY_DIGITS + 1];
+    sprintf(digits, "%016" PRIx64 "%016" PRIx64, key.data[0], key.data[1]);
+
+    return m_options.key_prefix + digits;
+}
+
+bool MemcachedStorage::parse_key(const char* zKey, CACHE_KEY* pKey) const
+{
+    size_t len = strlen(zKey);
+
+    if ((len != m_options.key_prefix.length() + MEMCACHED_KEY_DIGITS) ||
+        (m_options.key_prefix.compare(0, string::npos, zKey, m_options.key_prefix.length()) != 0))
+    {
+        return false;
+    }
+
+    const char* zDigits = zKey + m_options.key_prefix.length();
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        char digits[MEMCACHED_KEY_DIGITS / 2 + 1];
+        memcpy(digits, zDigits + i * (MEMCACHED_KEY_DIGITS / 2), MEMCACHED_KEY_DIGITS / 2);
+        digits[MEMCACHED_KEY_DIGITS / 2] = 0;
+
+        char* zEnd;
+        pKey->data[i] = strtoull(digits, &zEnd, 16);
+
+        if (*zEnd != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,184 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../../cache_storage_api.h"
+
+/**
+ * MemcachedStorage stores the cached values in a memcached server, so that
+ * they are shared by all MaxScale instances using the same server.
+ *
+ * The worker threads never wait for the network. The values are kept in a
+ * local near cache, from which they are returned. A value that is missing
+ * from the near cache, or that has been there for longer than the near cache
+ * TTL, is fetched from memcached by a background thread, which also writes
+ * the stored and deleted values to memcached.
+ */
+class MemcachedStorage
+{
+public:
+    struct Options
+    {
+        Options()
+            : host("127.0.0.1")
+            , port("11211")
+            , timeout(1000)
+            , near_cache_ttl(5)
+            , async_queue_size(10000)
+        {}
+
+        std::string host;             // The memcached host.
+        std::string port;             // The memcached port.
+        std::string key_prefix;       // The prefix of the memcached keys.
+        uint32_t    timeout;          // The network timeout in milliseconds.
+        uint32_t    near_cache_ttl;   // Seconds after which a value is fetched again.
+        size_t      async_queue_size; // The maximum number of queued operations.
+    };
+
+    static bool Initialize(uint32_t* pCapabilities);
+
+    static MemcachedStorage* Create_instance(const char* zName,
+                                             const CACHE_STORAGE_CONFIG& config,
+                                             int argc, char* argv[]);
+    ~MemcachedStorage();
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+    cache_result_t get_info(uint32_t flags, json_t** ppInfo) const;
+    cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
+    cache_result_t put_value(const CACHE_KEY& key, const GWBUF& value);
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    cache_result_t get_head(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_size(uint64_t* pSize) const;
+    cache_result_t get_items(uint64_t* pItems) const;
+
+private:
+    enum op_t
+    {
+        OP_GET,    // Fetch the value into the near cache.
+        OP_SET,    // Store the value in memcached.
+        OP_DELETE, // Delete the value from memcached.
+    };
+
+    struct Op
+    {
+        op_t        op;
+        CACHE_KEY   key;
+        uint64_t    seq;   // OP_GET: The sequence number of the fetch.
+        uint32_t    time;  // OP_SET: When the value was stored.
+        std::string value; // OP_SET: The value.
+    };
+
+    struct Fetched
+    {
+        CACHE_KEY   key;
+        uint32_t    time;  // When the value was stored.
+        std::string value;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const CACHE_KEY& key) const
+        {
+            // The key is a hash already.
+            return key.data[0];
+        }
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const CACHE_KEY& lhs, const CACHE_KEY& rhs) const
+        {
+            return (lhs.data[0] == rhs.data[0]) && (lhs.data[1] == rhs.data[1]);
+        }
+    };
+
+    typedef std::list<CACHE_KEY> Lru;
+
+    struct Entry
+    {
+        uint32_t      time;    // When the value was stored, by whichever instance.
+        uint32_t      fetched; // When the value was fetched from memcached or stored.
+        std::string   value;
+        Lru::iterator lru;
+    };
+
+    struct Stats
+    {
+        uint64_t hits;         // Values found in the near cache.
+        uint64_t misses;       // Values not found in the near cache.
+        uint64_t fetched;      // Values fetched from memcached.
+        uint64_t not_fetched;  // Values looked up from memcached but not found.
+        uint64_t written;      // Values stored in or deleted from memcached.
+        uint64_t dropped;      // Operations dropped because the queue was full.
+        uint64_t failed;       // Operations lost because memcached could not be accessed.
+        uint64_t evictions;    // Values evicted from the near cache.
+    };
+
+    typedef std::unordered_map<CACHE_KEY, Entry, KeyHash, KeyEqual> Entries;
+    typedef std::unordered_map<CACHE_KEY, uint64_t, KeyHash, KeyEqual> Fetches;
+
+    MemcachedStorage(const std::string& name,
+                     const CACHE_STORAGE_CONFIG& config,
+                     const Options& options);
+
+    MemcachedStorage(const MemcachedStorage&) = delete;
+    MemcachedStorage& operator = (const MemcachedStorage&) = delete;
+
+    void set_entry(const CACHE_KEY& key, uint32_t time, uint32_t now, std::string& value);
+    void remove_entry(Entries::iterator i);
+    void queue_fetch(const CACHE_KEY& key);
+    void queue(Op& op, bool droppable);
+
+    void run_io();
+    bool perform_ops(const std::deque<Op>& ops, std::vector<Fetched>& fetched);
+    void complete_ops(const std::deque<Op>& ops, std::vector<Fetched>& fetched, bool ok);
+
+    bool connect();
+    void disconnect();
+    bool send_request(const std::string& request);
+    bool receive(std::string& in);
+    bool read_responses(size_t n_gets, std::vector<Fetched>& fetched);
+
+    std::string memcached_key(const CACHE_KEY& key) const;
+    bool parse_key(const char* zKey, CACHE_KEY* pKey) const;
+
+private:
+    std::string                 m_name;
+    const CACHE_STORAGE_CONFIG  m_config;
+    const Options               m_options;
+    mutable std::mutex          m_lock;
+    std::condition_variable     m_cond;
+    Entries                     m_entries;
+    Lru                         m_lru;     // The keys, the most recently used first.
+    uint64_t                    m_size;    // The total size of the values in the near cache.
+    Fetches                     m_fetches; // The keys being fetched.
+    std::deque<Op>              m_ops;
+    uint64_t                    m_seq;
+    bool                        m_stop;
+    Stats                       m_stats;
+    int                         m_fd;       // Used only by the I/O thread.
+    bool                        m_failing;  // Used only by the I/O thread.
+    time_t                      m_retry_at; // Used only by the I/O thread.
+    std::thread                 m_io;
+};
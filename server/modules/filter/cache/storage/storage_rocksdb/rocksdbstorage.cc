@@ -17,8 +17,10 @@
 #include <sys/types.h>
 #include <fts.h>
 #include <algorithm>
+#include <vector>
 #include <rocksdb/env.h>
 #include <rocksdb/statistics.h>
+#include <rocksdb/write_batch.h>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
 #include <maxscale/modutil.h>
@@ -38,6 +40,9 @@ namespace
 const size_t ROCKSDB_N_LOW_THREADS = 2;
 const size_t ROCKSDB_N_HIGH_THREADS = 1;
 
+// The default maximum number of keys with a pending write, if writes are asynchronous.
+const size_t ROCKSDB_DEFAULT_ASYNC_QUEUE_SIZE = 10000;
+
 /**
  * Deletes a path, irrespective of whether it represents a file, a directory
  * or a directory hierarchy. If the path does not exist, then the path is
@@ -154,16 +159,36 @@ rocksdb::WriteOptions RocksDBStorage::s_write_options;
 RocksDBStorage::RocksDBStorage(const string& name,
                                const CACHE_STORAGE_CONFIG& config,
                                const string& path,
-                               unique_ptr<rocksdb::DBWithTTL>& sDb)
+                               unique_ptr<rocksdb::DBWithTTL>& sDb,
+                               size_t async_queue_size)
     : m_name(name)
     , m_config(config)
     , m_path(path)
     , m_sDb(std::move(sDb))
+    , m_async_queue_size(async_queue_size)
+    , m_seq(0)
+    , m_n_fetches(0)
+    , m_stop(false)
+    , m_async_stats()
 {
+    if (is_async())
+    {
+        m_writer = std::thread(&RocksDBStorage::run_writer, this);
+    }
 }
 
 RocksDBStorage::~RocksDBStorage()
 {
+    if (m_writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_async_lock);
+            m_stop = true;
+        }
+
+        m_async_cond.notify_one();
+        m_writer.join();
+    }
 }
 
 bool RocksDBStorage::Initialize(uint32_t* pCapabilities)
@@ -189,6 +214,8 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
 
     string storageDirectory = get_cachedir();
     bool collectStatistics = false;
+    bool async = false;
+    size_t asyncQueueSize = ROCKSDB_DEFAULT_ASYNC_QUEUE_SIZE;
 
     for (int i = 0; i < argc; ++i)
     {
@@ -226,6 +253,28 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
                 collectStatistics = config_truth_value(zValue);
             }
         }
+        else if (strcmp(zKey, "async") == 0)
+        {
+            if (zValue)
+            {
+                async = config_truth_value(zValue);
+            }
+        }
+        else if (strcmp(zKey, "async_queue_size") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+            if ((value > 0) && (*zEnd == 0))
+            {
+                asyncQueueSize = value;
+            }
+            else
+            {
+                MXS_WARNING("Invalid value specified for '%s', using default %lu instead.",
+                            zKey, asyncQueueSize);
+            }
+        }
         else
         {
             MXS_WARNING("Unknown argument '%s'.", zKey);
@@ -234,13 +283,14 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
 
     storageDirectory += "/storage_rocksdb";
 
-    return Create(zName, config, storageDirectory, collectStatistics);
+    return Create(zName, config, storageDirectory, collectStatistics, async ? asyncQueueSize : 0);
 }
 
 RocksDBStorage* RocksDBStorage::Create(const char* zName,
                                        const CACHE_STORAGE_CONFIG& config,
                                        const string& storageDirectory,
-                                       bool collectStatistics)
+                                       bool collectStatistics,
+                                       size_t asyncQueueSize)
 {
     unique_ptr<RocksDBStorage> sStorage;
 
@@ -287,7 +337,8 @@ RocksDBStorage* RocksDBStorage::Create(const char* zName,
             {
                 unique_ptr<rocksdb::DBWithTTL> sDb(pDb);
 
-                sStorage = unique_ptr<RocksDBStorage>(new RocksDBStorage(zName, config, path, sDb));
+                sStorage = unique_ptr<RocksDBStorage>(new RocksDBStorage(zName, config, path, sDb,
+                                                                      asyncQueueSize));
             }
             else
             {
@@ -334,6 +385,26 @@ cache_result_t RocksDBStorage::get_info(uint32_t what, json_t** ppInfo) const
             }
         });
 
+        if (is_async())
+        {
+            json_t* pAsync = json_object();
+
+            if (pAsync)
+            {
+                std::lock_guard<std::mutex> guard(m_async_lock);
+
+                json_object_set_new(pAsync, "pending", json_integer(m_pending.size()));
+                json_object_set_new(pAsync, "queued", json_integer(m_async_stats.queued));
+                json_object_set_new(pAsync, "written", json_integer(m_async_stats.written));
+                json_object_set_new(pAsync, "coalesced", json_integer(m_async_stats.coalesced));
+                json_object_set_new(pAsync, "dropped", json_integer(m_async_stats.dropped));
+                json_object_set_new(pAsync, "incomplete", json_integer(m_async_stats.incomplete));
+                json_object_set_new(pAsync, "fetched", json_integer(m_async_stats.fetched));
+
+                json_object_set_new(pInfo, "async", pAsync);
+            }
+        }
+
         *ppInfo = pInfo;
     }
 
@@ -344,10 +415,26 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
 {
     // Use the root DB so that we get the value *with* the timestamp at the end.
     rocksdb::DB* pDb = m_sDb->GetRootDB();
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(key.data), sizeof(key.data));
+    rocksdb::ReadOptions read_options;
     string value;
 
-    rocksdb::Status status = pDb->Get(rocksdb::ReadOptions(), rocksdb_key, &value);
+    if (is_async())
+    {
+        bool found;
+        cache_result_t result = get_pending(key, ppResult, &found);
+
+        if (found)
+        {
+            return result;
+        }
+
+        // Only the memtable and the block cache are consulted, so the read
+        // never waits for the disk.
+        read_options.read_tier = rocksdb::kBlockCacheTier;
+    }
+
+    rocksdb::Status status = pDb->Get(read_options, rocksdb_key, &value);
 
     cache_result_t result = CACHE_RESULT_ERROR;
 
@@ -373,11 +460,18 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
 
             if (is_hard_stale)
             {
-                status = m_sDb->Delete(Write_options(), rocksdb_key);
-
-                if (!status.ok())
+                if (is_async())
                 {
-                    MXS_WARNING("Failed when deleting stale item from RocksDB.");
+                    queue_del(key);
+                }
+                else
+                {
+                    status = m_sDb->Delete(Write_options(), rocksdb_key);
+
+                    if (!status.ok())
+                    {
+                        MXS_WARNING("Failed when deleting stale item from RocksDB.");
+                    }
                 }
                 result = CACHE_RESULT_NOT_FOUND;
             }
@@ -420,6 +514,14 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
         result = CACHE_RESULT_NOT_FOUND;
         break;
 
+    case rocksdb::Status::kIncomplete:
+        // The value is not in memory. Instead of waiting for the disk, the
+        // value is reported as missing and read in the background, so that
+        // it will be found in the block cache the next time.
+        queue_fetch(key);
+        result = CACHE_RESULT_NOT_FOUND;
+        break;
+
     default:
         MXS_ERROR("Failed to look up value: %s", status.ToString().c_str());
     }
@@ -431,7 +533,12 @@ cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& valu
 {
     ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
 
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    if (is_async())
+    {
+        return queue_put(key, value);
+    }
+
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(key.data), sizeof(key.data));
     rocksdb::Slice rocksdb_value((char*)GWBUF_DATA(&value), GWBUF_LENGTH(&value));
 
     rocksdb::Status status = m_sDb->Put(Write_options(), rocksdb_key, rocksdb_value);
@@ -441,7 +548,12 @@ cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& valu
 
 cache_result_t RocksDBStorage::del_value(const CACHE_KEY& key)
 {
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    if (is_async())
+    {
+        return queue_del(key);
+    }
+
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(key.data), sizeof(key.data));
 
     rocksdb::Status status = m_sDb->Delete(Write_options(), rocksdb_key);
 
@@ -467,3 +579,258 @@ cache_result_t RocksDBStorage::get_items(uint64_t* pItems) const
 {
     return CACHE_RESULT_OUT_OF_RESOURCES;
 }
+
+cache_result_t RocksDBStorage::get_pending(const CACHE_KEY& key, GWBUF** ppResult, bool* pFound)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    std::lock_guard<std::mutex> guard(m_async_lock);
+
+    auto i = m_pending.find(key);
+
+    *pFound = (i != m_pending.end());
+
+    if (*pFound && !i->second.del)
+    {
+        const string& value = i->second.value;
+
+        *ppResult = gwbuf_alloc(value.length());
+
+        if (*ppResult)
+        {
+            memcpy(GWBUF_DATA(*ppResult), value.data(), value.length());
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            result = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t RocksDBStorage::queue_put(const CACHE_KEY& key, const GWBUF& value)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    try
+    {
+        std::unique_lock<std::mutex> guard(m_async_lock);
+
+        auto i = m_pending.find(key);
+
+        if ((i == m_pending.end()) && (m_pending.size() >= m_async_queue_size))
+        {
+            // Dropping a put only means that a value is not cached. Returning
+            // an error would only cause the value to be deleted.
+            ++m_async_stats.dropped;
+        }
+        else
+        {
+            Pending& pending = (i == m_pending.end()) ? m_pending[key] : i->second;
+
+            pending.value.assign(reinterpret_cast<const char*>(GWBUF_DATA(&value)), GWBUF_LENGTH(&value));
+            pending.del = false;
+            pending.seq = ++m_seq;
+            ++m_async_stats.queued;
+
+            if (pending.queued)
+            {
+                ++m_async_stats.coalesced;
+            }
+            else
+            {
+                m_ops.push_back(Op { OP_WRITE, key });
+                pending.queued = true;
+
+                guard.unlock();
+                m_async_cond.notify_one();
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+cache_result_t RocksDBStorage::queue_del(const CACHE_KEY& key)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    try
+    {
+        std::unique_lock<std::mutex> guard(m_async_lock);
+
+        // A delete is never dropped, as the value could otherwise be used
+        // although it e.g. has been invalidated.
+        Pending& pending = m_pending[key];
+
+        pending.value.clear();
+        pending.del = true;
+        pending.seq = ++m_seq;
+        ++m_async_stats.queued;
+
+        if (pending.queued)
+        {
+            ++m_async_stats.coalesced;
+        }
+        else
+        {
+            m_ops.push_back(Op { OP_WRITE, key });
+            pending.queued = true;
+
+            guard.unlock();
+            m_async_cond.notify_one();
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+void RocksDBStorage::queue_fetch(const CACHE_KEY& key)
+{
+    try
+    {
+        std::unique_lock<std::mutex> guard(m_async_lock);
+
+        ++m_async_stats.incomplete;
+
+        if (m_n_fetches < m_async_queue_size)
+        {
+            m_ops.push_back(Op { OP_FETCH, key });
+            ++m_n_fetches;
+
+            guard.unlock();
+            m_async_cond.notify_one();
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Not fetching the value only means that it will not be found.
+    }
+}
+
+void RocksDBStorage::run_writer()
+{
+    std::unique_lock<std::mutex> guard(m_async_lock);
+
+    while (!m_stop)
+    {
+        if (m_ops.empty())
+        {
+            m_async_cond.wait(guard);
+        }
+        else
+        {
+            std::deque<Op> ops;
+            ops.swap(m_ops);
+
+            write_ops(ops);
+        }
+    }
+}
+
+/**
+ * Performs the queued operations. Called with m_async_lock locked, which is
+ * released while RocksDB is accessed.
+ *
+ * @param ops  The operations.
+ */
+void RocksDBStorage::write_ops(std::deque<Op>& ops)
+{
+    rocksdb::WriteBatch batch;
+    std::vector<std::pair<CACHE_KEY, uint64_t>> written; // The keys and sequence numbers.
+    std::vector<CACHE_KEY> fetches;
+
+    // All queued operations are in ops.
+    m_n_fetches = 0;
+
+    try
+    {
+        written.reserve(ops.size());
+
+        for (const Op& op : ops)
+        {
+            rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(op.key.data), sizeof(op.key.data));
+
+            if (op.op == OP_FETCH)
+            {
+                fetches.push_back(op.key);
+            }
+            else
+            {
+                auto i = m_pending.find(op.key);
+                ss_dassert(i != m_pending.end());
+
+                Pending& pending = i->second;
+                pending.queued = false;
+
+                if (pending.del)
+                {
+                    batch.Delete(rocksdb_key);
+                }
+                else
+                {
+                    batch.Put(rocksdb_key, pending.value);
+                }
+
+                written.push_back(std::make_pair(op.key, pending.seq));
+            }
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        // The operations not added to the batch remain pending, and are
+        // written when the key is put or deleted the next time.
+        MXS_ERROR("Out of memory when writing the queued operations.");
+    }
+
+    m_async_lock.unlock();
+
+    if (batch.Count() != 0)
+    {
+        // DBWithTTL adds the timestamps to the values of the batch.
+        rocksdb::Status status = m_sDb->Write(Write_options(), &batch);
+
+        if (!status.ok())
+        {
+            MXS_ERROR("Failed to write %d queued operations: %s",
+                      batch.Count(), status.ToString().c_str());
+        }
+    }
+
+    rocksdb::DB* pDb = m_sDb->GetRootDB();
+
+    for (const CACHE_KEY& key : fetches)
+    {
+        rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(key.data), sizeof(key.data));
+        string value;
+
+        pDb->Get(rocksdb::ReadOptions(), rocksdb_key, &value);
+    }
+
+    m_async_lock.lock();
+
+    for (const auto& w : written)
+    {
+        auto i = m_pending.find(w.first);
+
+        // If the key has been put or deleted again, the pending operation
+        // must remain, so that it is written and used in the meantime.
+        if ((i != m_pending.end()) && (i->second.seq == w.second))
+        {
+            m_pending.erase(i);
+        }
+    }
+
+    m_async_stats.written += written.size();
+    m_async_stats.fetched += fetches.size();
+}
@@ -13,8 +13,13 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <rocksdb/utilities/db_ttl.h>
 #include "../../cache_storage_api.h"
 
@@ -42,10 +47,66 @@ public:
     cache_result_t get_items(uint64_t* pItems) const;
 
 private:
+    enum op_t
+    {
+        OP_WRITE, // Write the pending put or delete of the key.
+        OP_FETCH, // Read the value so that it will be found in the block cache.
+    };
+
+    struct Op
+    {
+        op_t      op;
+        CACHE_KEY key;
+    };
+
+    struct Pending
+    {
+        Pending()
+            : seq(0)
+            , del(false)
+            , queued(false)
+        {}
+
+        uint64_t    seq;    // The sequence number of the latest put or delete of the key.
+        bool        del;    // Whether the latest operation is a delete.
+        bool        queued; // Whether an OP_WRITE of the key is in the queue.
+        std::string value;  // The value to be stored, if not a delete.
+    };
+
+    struct AsyncStats
+    {
+        uint64_t queued;     // Puts and deletes queued.
+        uint64_t written;    // Puts and deletes written.
+        uint64_t coalesced;  // Puts and deletes superseded before being written.
+        uint64_t dropped;    // Puts dropped because the queue was full.
+        uint64_t incomplete; // Reads that would have needed I/O.
+        uint64_t fetched;    // Reads made in the background.
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const CACHE_KEY& key) const
+        {
+            // The key is a hash already.
+            return key.data[0];
+        }
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const CACHE_KEY& lhs, const CACHE_KEY& rhs) const
+        {
+            return (lhs.data[0] == rhs.data[0]) && (lhs.data[1] == rhs.data[1]);
+        }
+    };
+
+    typedef std::unordered_map<CACHE_KEY, Pending, KeyHash, KeyEqual> PendingByKey;
+
     RocksDBStorage(const std::string& name,
                    const CACHE_STORAGE_CONFIG& config,
                    const std::string& path,
-                   std::unique_ptr<rocksdb::DBWithTTL>& sDb);
+                   std::unique_ptr<rocksdb::DBWithTTL>& sDb,
+                   size_t async_queue_size);
 
     RocksDBStorage(const RocksDBStorage&) = delete;
     RocksDBStorage& operator = (const RocksDBStorage&) = delete;
@@ -53,7 +114,21 @@ private:
     static RocksDBStorage* Create(const char* zName,
                                   const CACHE_STORAGE_CONFIG& config,
                                   const std::string& storage_directory,
-                                  bool collect_statistics);
+                                  bool collect_statistics,
+                                  size_t async_queue_size);
+
+    bool is_async() const
+    {
+        return m_async_queue_size != 0;
+    }
+
+    cache_result_t get_pending(const CACHE_KEY& key, GWBUF** ppResult, bool* pFound);
+    cache_result_t queue_put(const CACHE_KEY& key, const GWBUF& value);
+    cache_result_t queue_del(const CACHE_KEY& key);
+    void queue_fetch(const CACHE_KEY& key);
+
+    void run_writer();
+    void write_ops(std::deque<Op>& ops);
 
     static const rocksdb::WriteOptions& Write_options()
     {
@@ -65,6 +140,16 @@ private:
     const CACHE_STORAGE_CONFIG          m_config;
     std::string                         m_path;
     std::unique_ptr<rocksdb::DBWithTTL> m_sDb;
+    const size_t                        m_async_queue_size; // 0, if writes are synchronous.
+    mutable std::mutex                  m_async_lock;
+    std::condition_variable             m_async_cond;
+    std::deque<Op>                      m_ops;
+    PendingByKey                        m_pending;
+    uint64_t                            m_seq;       // The latest sequence number.
+    size_t                              m_n_fetches; // The number of OP_FETCHes in the queue.
+    bool                                m_stop;
+    AsyncStats                          m_async_stats;
+    std::thread                         m_writer;
 
     static rocksdb::WriteOptions        s_write_options;
 };
@@ -15,6 +15,7 @@
 #include "storagefactory.hh"
 #include <dlfcn.h>
 #include <sys/param.h>
+#include <algorithm>
 #include <new>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
@@ -22,6 +23,7 @@
 #include "cachefilter.h"
 #include "lrustoragest.hh"
 #include "lrustoragemt.hh"
+#include "shardedstorage.hh"
 #include "storagereal.hh"
 
 
@@ -149,14 +151,40 @@ StorageFactory* StorageFactory::Open(const char* zName)
 Storage* StorageFactory::createStorage(const char* zName,
                                        const CACHE_STORAGE_CONFIG& config,
                                        int argc, char* argv[])
+{
+    return createStorage(zName, config, 1, CACHE_EVICTION_LRU, argc, argv);
+}
+
+Storage* StorageFactory::createStorage(const char* zName,
+                                       const CACHE_STORAGE_CONFIG& config,
+                                       uint32_t shards,
+                                       cache_eviction_t eviction,
+                                       int argc, char* argv[])
 {
     ss_dassert(m_handle);
     ss_dassert(m_pApi);
 
-    CacheStorageConfig used_config(config);
-
     uint32_t mask = CACHE_STORAGE_CAP_MAX_COUNT | CACHE_STORAGE_CAP_MAX_SIZE;
 
+    if (shards > 1)
+    {
+        // Each shard has a storage of its own, which is sensible only if the
+        // storage is one that can be used by a single thread. A storage that
+        // provides the LRU handling itself, cannot be sharded.
+        if ((config.thread_model == CACHE_THREAD_MODEL_MT) &&
+            cache_storage_has_cap(m_storage_caps, CACHE_STORAGE_CAP_ST) &&
+            !cache_storage_has_cap(m_storage_caps, mask))
+        {
+            return createShardedStorage(zName, config, shards, eviction, argc, argv);
+        }
+        else
+        {
+            MXS_WARNING("The storage of '%s' cannot be sharded, using one shard.", zName);
+        }
+    }
+
+    CacheStorageConfig used_config(config);
+
     if (!cache_storage_has_cap(m_storage_caps, mask))
     {
         // Since we will wrap the native storage with a LRUStorage, according
@@ -180,13 +208,13 @@ Storage* StorageFactory::createStorage(const char* zName,
 
             if (config.thread_model == CACHE_THREAD_MODEL_ST)
             {
-                pLruStorage = LRUStorageST::create(config, pStorage);
+                pLruStorage = LRUStorageST::create(config, pStorage, eviction);
             }
             else
             {
                 ss_dassert(config.thread_model == CACHE_THREAD_MODEL_MT);
 
-                pLruStorage = LRUStorageMT::create(config, pStorage);
+                pLruStorage = LRUStorageMT::create(config, pStorage, eviction);
             }
 
             if (pLruStorage)
@@ -204,6 +232,67 @@ Storage* StorageFactory::createStorage(const char* zName,
     return pStorage;
 }
 
+Storage* StorageFactory::createShardedStorage(const char* zName,
+                                              const CACHE_STORAGE_CONFIG& config,
+                                              uint32_t shards,
+                                              cache_eviction_t eviction,
+                                              int argc, char* argv[])
+{
+    ss_dassert(shards > 1);
+
+    // Each shard gets an equal part of the limits, rounded down so that the
+    // total stays within them.
+    CacheStorageConfig shard_config(config);
+
+    if (config.max_count != 0)
+    {
+        shard_config.max_count = std::max(config.max_count / shards, (uint32_t)1);
+    }
+
+    if (config.max_size != 0)
+    {
+        shard_config.max_size = std::max(config.max_size / shards, (uint64_t)1);
+    }
+
+    Storage* pStorage = NULL;
+    ShardedStorage::Shards storages;
+    bool error = false;
+
+    for (uint32_t i = 0; !error && (i < shards); ++i)
+    {
+        Storage* pShard = createStorage(zName, shard_config, 1, eviction, argc, argv);
+
+        if (pShard)
+        {
+            try
+            {
+                storages.push_back(pShard);
+            }
+            catch (const std::exception& x)
+            {
+                delete pShard;
+                error = true;
+            }
+        }
+        else
+        {
+            error = true;
+        }
+    }
+
+    if (!error)
+    {
+        pStorage = ShardedStorage::create(config, storages);
+    }
+
+    // Empty, if the sharded storage was created.
+    for (ShardedStorage::Shards::iterator i = storages.begin(); i != storages.end(); ++i)
+    {
+        delete *i;
+    }
+
+    return pStorage;
+}
 
 Storage* StorageFactory::createRawStorage(const char* zName,
                                           const CACHE_STORAGE_CONFIG& config,
@@ -13,6 +13,7 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include "cachefilter.h"
 #include "cache_storage_api.h"
 
 class Storage;
@@ -66,6 +67,30 @@ public:
                            const CACHE_STORAGE_CONFIG& config,
                            int argc = 0, char* argv[] = NULL);
 
+    /**
+     * Create storage instance.
+     *
+     * As above, but if the LRU handling is provided on top of the underlying
+     * storage, it will use the specified eviction and, provided the storage is
+     * multi threaded and the underlying storage can have several independent
+     * instances, the keys are partitioned into @c shards separately locked
+     * storages.
+     *
+     * @param zName      The name of the storage.
+     * @param config     The storage configuration.
+     * @param shards     The number of shards.
+     * @param eviction   How items are chosen for eviction.
+     * @argc             Number of items in argv.
+     * @argv             Storage specific arguments.
+     *
+     * @return A storage instance or NULL in case of errors.
+     */
+    Storage* createStorage(const char* zName,
+                           const CACHE_STORAGE_CONFIG& config,
+                           uint32_t shards,
+                           cache_eviction_t eviction,
+                           int argc = 0, char* argv[] = NULL);
+
     /**
      * Create raw storage instance.
      *
@@ -86,6 +111,12 @@ public:
                               int argc = 0, char* argv[] = NULL);
 
 private:
+    Storage* createShardedStorage(const char* zName,
+                                  const CACHE_STORAGE_CONFIG& config,
+                                  uint32_t shards,
+                                  cache_eviction_t eviction,
+                                  int argc, char* argv[]);
+
     StorageFactory(void* handle, CACHE_STORAGE_API* pApi, uint32_t capabilities);
 
     StorageFactory(const StorageFactory&);
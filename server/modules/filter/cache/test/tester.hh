@@ -250,6 +250,16 @@ public:
         return combine_rvs(rv1, combine_rvs(rv2, rv3, rv4, rv5));
     }
 
+    static int combine_rvs(int rv1, int rv2, int rv3, int rv4, int rv5, int rv6)
+    {
+        return combine_rvs(rv1, combine_rvs(rv2, rv3, rv4, rv5, rv6));
+    }
+
+    static int combine_rvs(int rv1, int rv2, int rv3, int rv4, int rv5, int rv6, int rv7)
+    {
+        return combine_rvs(rv1, combine_rvs(rv2, rv3, rv4, rv5, rv6, rv7));
+    }
+
 protected:
     /**
      * Constructor
@@ -12,12 +12,78 @@
  */
 
 #include "testerlrustorage.hh"
+#include <stdlib.h>
+#include <unistd.h>
 #include "storage.hh"
 #include "storagefactory.hh"
 
 using namespace std;
 using namespace maxscale;
 
+namespace
+{
+
+/**
+ * Access a value and store it if it is not found.
+ *
+ * @return True, if the value was found.
+ */
+bool access(Storage& storage, const Tester::CacheItems::value_type& cache_item)
+{
+    GWBUF* pValue;
+    cache_result_t result = storage.get_value(cache_item.first, 0, &pValue);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        gwbuf_free(pValue);
+    }
+    else
+    {
+        storage.put_value(cache_item.first, cache_item.second);
+    }
+
+    return CACHE_RESULT_IS_OK(result);
+}
+
+/**
+ * Repeatedly access a hot set of items twice, followed by a scan of items
+ * that are accessed only once and that do not fit in the cache.
+ *
+ * @param storage      The storage to use.
+ * @param cache_items  The items, the first @c n_hot of which are hot.
+ * @param n_hot        The number of hot items.
+ * @param n_scanned    The number of items in each scan.
+ * @param pHits        On return, the number of hits.
+ *
+ * @return The number of accesses.
+ */
+size_t access_with_scans(Storage& storage, const Tester::CacheItems& cache_items,
+                         size_t n_hot, size_t n_scanned, size_t* pHits)
+{
+    size_t n_accesses = 0;
+    size_t n_hits = 0;
+
+    size_t j = n_hot;
+
+    while (j < cache_items.size())
+    {
+        for (size_t i = 0; i < 2 * n_hot; ++i, ++n_accesses)
+        {
+            n_hits += access(storage, cache_items[i % n_hot]);
+        }
+
+        for (size_t i = 0; (i < n_scanned) && (j < cache_items.size()); ++i, ++j, ++n_accesses)
+        {
+            n_hits += access(storage, cache_items[j]);
+        }
+    }
+
+    *pHits = n_hits;
+    return n_accesses;
+}
+
+}
+
 TesterLRUStorage::TesterLRUStorage(std::ostream* pOut, StorageFactory* pFactory)
     : TesterStorage(pOut, pFactory)
 {
@@ -41,8 +107,14 @@ int TesterLRUStorage::execute(size_t n_threads, size_t n_seconds, const CacheIte
     int rv4 = test_max_size(n_threads, n_seconds, cache_items, size);
     out() << endl;
     int rv5 = test_max_count_and_size(n_threads, n_seconds, cache_items, size);
+    out() << endl;
+    int rv6 = test_sharded(n_threads, n_seconds, cache_items, size);
+    out() << endl;
+    int rv7 = test_tinylfu(cache_items);
+    out() << endl;
+    int rv8 = test_snapshot(cache_items);
 
-    return combine_rvs(rv1, rv2, rv3, rv4, rv5);
+    return combine_rvs(rv1, rv2, rv3, rv4, rv5, rv6, combine_rvs(rv7, rv8));
 }
 
 Storage* TesterLRUStorage::get_storage(const CACHE_STORAGE_CONFIG& config) const
@@ -269,3 +341,203 @@ int TesterLRUStorage::test_max_count_and_size(size_t n_threads, size_t n_seconds
 
     return rv;
 }
+
+int TesterLRUStorage::test_sharded(size_t n_threads, size_t n_seconds,
+                                   const CacheItems& cache_items, uint64_t size)
+{
+    int rv = EXIT_FAILURE;
+
+    Storage* pStorage;
+
+    const uint32_t shards = 4;
+    size_t max_count = cache_items.size() / 4;
+    size_t max_size = size / 10;
+
+    out() << "LRU sharded: " << shards << ", clock eviction\n" << endl;
+    out() << "LRU max-count: " << max_count << "\n" << endl;
+    out() << "LRU max-size : " << max_size << "\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.max_count = max_count;
+    config.max_size = max_size;
+
+    pStorage = m_factory.createStorage("unspecified", config, shards, CACHE_EVICTION_CLOCK);
+
+    if (pStorage)
+    {
+        rv = execute_tasks(n_threads, n_seconds, cache_items, *pStorage);
+
+        ss_debug(cache_result_t result);
+        uint64_t items;
+        ss_debug(result = ) pStorage->get_items(&items);
+        ss_dassert(result == CACHE_RESULT_OK);
+
+        out() << "Max count: " << max_count << ", count: " << items << "." << endl;
+
+        if (items > max_count)
+        {
+            rv = EXIT_FAILURE;
+        }
+
+        uint64_t size;
+        ss_debug(result = ) pStorage->get_size(&size);
+        ss_dassert(result == CACHE_RESULT_OK);
+
+        out() << "Max size: " << max_size << ", size: " << size << "." << endl;
+
+        if (size > max_size)
+        {
+            rv = EXIT_FAILURE;
+        }
+
+        delete pStorage;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_tinylfu(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    size_t max_count = cache_items.size() / 10;
+    size_t n_hot = max_count / 2;
+
+    out() << "LRU vs TinyLFU, hot items: " << n_hot << "\n" << endl;
+    out() << "LRU max-count: " << max_count << "\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.max_count = max_count;
+
+    cache_eviction_t evictions[] = { CACHE_EVICTION_LRU, CACHE_EVICTION_TINYLFU };
+    const char* names[] = { "lru", "tinylfu" };
+    double ratios[2] = { 0, 0 };
+
+    if (n_hot != 0)
+    {
+        rv = EXIT_SUCCESS;
+
+        for (size_t k = 0; (rv == EXIT_SUCCESS) && (k < 2); ++k)
+        {
+            Storage* pStorage = m_factory.createStorage("unspecified", config, 1, evictions[k]);
+
+            if (pStorage)
+            {
+                size_t hits;
+                size_t accesses = access_with_scans(*pStorage, cache_items, n_hot, 2 * max_count, &hits);
+
+                ratios[k] = accesses != 0 ? (double)hits / accesses : 0;
+
+                out() << names[k] << " hit ratio: " << ratios[k] << "." << endl;
+
+                uint64_t items;
+                pStorage->get_items(&items);
+
+                if (items > max_count)
+                {
+                    out() << "error: " << names[k] << " holds " << items << " items." << endl;
+                    rv = EXIT_FAILURE;
+                }
+
+                delete pStorage;
+            }
+            else
+            {
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        if ((rv == EXIT_SUCCESS) && (ratios[1] < ratios[0]))
+        {
+            out() << "error: The hit ratio of tinylfu is lower than that of lru." << endl;
+            rv = EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        out() << "Too few items for comparing the hit ratios." << endl;
+        rv = EXIT_SUCCESS;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_snapshot(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    size_t items = cache_items.size() > 100 ? 100 : cache_items.size();
+
+    char path[] = "/tmp/testlrustorage-XXXXXX";
+    int fd = mkstemp(path);
+
+    out() << "Snapshot of " << items << " items\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+
+    Storage* pStorage = (fd != -1) ? get_storage(config) : NULL;
+
+    if (pStorage)
+    {
+        close(fd);
+
+        for (size_t i = 0; i < items; ++i)
+        {
+            pStorage->put_value(cache_items[i].first, cache_items[i].second);
+        }
+
+        cache_result_t result = pStorage->save_snapshot(path);
+        delete pStorage;
+
+        if (result != CACHE_RESULT_OK)
+        {
+            out() << "error: Could not save the snapshot." << endl;
+        }
+        else if ((pStorage = get_storage(config)) != NULL)
+        {
+            uint64_t loaded;
+            result = pStorage->load_snapshot(path, &loaded);
+
+            out() << "Loaded " << loaded << " items." << endl;
+
+            if ((result == CACHE_RESULT_OK) && (loaded == items))
+            {
+                rv = EXIT_SUCCESS;
+
+                for (size_t i = 0; i < items; ++i)
+                {
+                    const CacheItems::value_type& cache_item = cache_items[i];
+
+                    GWBUF* pValue;
+                    result = pStorage->get_value(cache_item.first, 0, &pValue);
+
+                    if (CACHE_RESULT_IS_OK(result))
+                    {
+                        if (gwbuf_length(pValue) != gwbuf_length(cache_item.second))
+                        {
+                            out() << "error: Loaded value has the wrong length." << endl;
+                            rv = EXIT_FAILURE;
+                        }
+
+                        gwbuf_free(pValue);
+                    }
+                    else
+                    {
+                        out() << "error: Saved item was not loaded." << endl;
+                        rv = EXIT_FAILURE;
+                    }
+                }
+            }
+            else
+            {
+                out() << "error: Could not load the snapshot." << endl;
+            }
+
+            delete pStorage;
+        }
+
+        unlink(path);
+    }
+
+    return rv;
+}
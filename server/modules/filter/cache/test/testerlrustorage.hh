@@ -46,6 +46,10 @@ private:
                       const CacheItems& cache_items, uint64_t size);
     int test_max_count_and_size(size_t n_threads, size_t n_seconds,
                                 const CacheItems& cache_items, uint64_t size);
+    int test_sharded(size_t n_threads, size_t n_seconds,
+                     const CacheItems& cache_items, uint64_t size);
+    int test_tinylfu(const CacheItems& cache_items);
+    int test_snapshot(const CacheItems& cache_items);
 
 private:
     TesterLRUStorage(const TesterLRUStorage&);
@@ -12,6 +12,7 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <time.h>
 #include <iostream>
 #include <fstream>
 #include <tr1/unordered_map>
@@ -30,14 +31,92 @@ namespace
 
 void print_usage(const char* zProgram)
 {
-    cout << "usage: " << zProgram << " storage-module text-file\n"
+    cout << "usage: " << zProgram << " storage-module [text-file [rounds]]\n"
          << "\n"
          << "where:\n"
          << "  storage-module  is the name of a storage module,\n"
-         << "  test-file       is the name of a text file." << endl;
+         << "  test-file       is the name of a text file,\n"
+         << "  rounds          how many times the keys are generated for measuring the\n"
+         << "                  throughput, default 100." << endl;
 }
 
-int test(StorageFactory& factory, istream& in)
+inline uint64_t time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Copies a buffer into a chain of small buffers.
+ *
+ * @param pBuf   The buffer to copy.
+ * @param piece  The length of each buffer of the chain.
+ *
+ * @return The chain or NULL if memory allocation failed.
+ */
+GWBUF* make_chain(GWBUF* pBuf, size_t piece)
+{
+    GWBUF* pChain = NULL;
+    size_t len = GWBUF_LENGTH(pBuf);
+
+    for (size_t offset = 0; offset < len; offset += piece)
+    {
+        size_t n = (len - offset < piece) ? len - offset : piece;
+        GWBUF* pPiece = gwbuf_alloc(n);
+
+        if (!pPiece)
+        {
+            gwbuf_free(pChain);
+            return NULL;
+        }
+
+        memcpy(GWBUF_DATA(pPiece), GWBUF_DATA(pBuf) + offset, n);
+        pChain = gwbuf_append(pChain, pPiece);
+    }
+
+    return pChain;
+}
+
+/**
+ * Measures the throughput of the key generation.
+ *
+ * @param queries  The statements.
+ * @param rounds   How many times the key of each statement is generated.
+ */
+void benchmark(const vector<GWBUF*>& queries, size_t rounds)
+{
+    size_t n_bytes = 0;
+
+    for (vector<GWBUF*>::const_iterator i = queries.begin(); i != queries.end(); ++i)
+    {
+        n_bytes += GWBUF_LENGTH(*i);
+    }
+
+    uint64_t start = time_ns();
+
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        for (vector<GWBUF*>::const_iterator i = queries.begin(); i != queries.end(); ++i)
+        {
+            CACHE_KEY key;
+            Cache::get_default_key("test", *i, &key);
+        }
+    }
+
+    uint64_t ns = time_ns() - start;
+    size_t n_keys = rounds * queries.size();
+
+    if ((ns != 0) && (n_keys != 0))
+    {
+        cout << n_keys << " keys in " << ns / 1e9 << " s, "
+             << ns / n_keys << " ns/key, "
+             << (rounds * n_bytes) / (ns / 1e9) / (1024 * 1024) << " MiB/s." << endl;
+    }
+}
+
+int test(StorageFactory& factory, istream& in, size_t rounds)
 {
     int rv = EXIT_SUCCESS;
 
@@ -51,6 +130,7 @@ int test(StorageFactory& factory, istream& in)
 
         size_t n_keys = 0;
         size_t n_collisions = 0;
+        vector<GWBUF*> queries;
 
         for (Statements::iterator i = statements.begin(); i < statements.end(); ++i)
         {
@@ -81,6 +161,39 @@ int test(StorageFactory& factory, istream& in)
                         ++n_keys;
                         keys.insert(make_pair(key, statement));
                     }
+
+                    // The key must not depend upon how the statement is split into buffers.
+                    GWBUF* pChain = make_chain(pQuery, 7);
+                    CACHE_KEY chain_key;
+
+                    if (!pChain ||
+                        (Cache::get_default_key(NULL, pChain, &chain_key) != CACHE_RESULT_OK) ||
+                        (chain_key != key))
+                    {
+                        cerr << "error: Different key generated for '" << statement
+                             << "' when it is in a chain of buffers." << endl;
+                        rv = EXIT_FAILURE;
+                    }
+
+                    gwbuf_free(pChain);
+
+                    // The key of a prepared statement must differ from that of the
+                    // same text statement and depend upon the parameters.
+                    const uint8_t params1[] = { 0x00, 0x01, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00 };
+                    const uint8_t params2[] = { 0x00, 0x01, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00 };
+                    CACHE_KEY ps_key1;
+                    CACHE_KEY ps_key2;
+
+                    if ((Cache::get_default_ps_key(NULL, pQuery, params1, sizeof(params1), &ps_key1)
+                         != CACHE_RESULT_OK) ||
+                        (Cache::get_default_ps_key(NULL, pQuery, params2, sizeof(params2), &ps_key2)
+                         != CACHE_RESULT_OK) ||
+                        (ps_key1 == key) || (ps_key1 == ps_key2))
+                    {
+                        cerr << "error: Key of prepared statement '" << statement
+                             << "' does not depend upon the statement kind and the parameters." << endl;
+                        rv = EXIT_FAILURE;
+                    }
                 }
                 else
                 {
@@ -88,7 +201,7 @@ int test(StorageFactory& factory, istream& in)
                     rv = EXIT_FAILURE;
                 }
 
-                gwbuf_free(pQuery);
+                queries.push_back(pQuery);
             }
             else
             {
@@ -101,6 +214,13 @@ int test(StorageFactory& factory, istream& in)
              << n_collisions << " collisions."
              << endl;
 
+        benchmark(queries, rounds);
+
+        for (vector<GWBUF*>::iterator i = queries.begin(); i != queries.end(); ++i)
+        {
+            gwbuf_free(*i);
+        }
+
 
         if (rv == EXIT_SUCCESS)
         {
@@ -124,7 +244,7 @@ int main(int argc, char* argv[])
 {
     int rv = EXIT_FAILURE;
 
-    if ((argc == 2) || (argc == 3))
+    if ((argc >= 2) && (argc <= 4))
     {
         if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
         {
@@ -136,9 +256,11 @@ int main(int argc, char* argv[])
 
                 if (pFactory)
                 {
+                    size_t rounds = (argc == 4) ? atoi(argv[3]) : 100;
+
                     if (argc == 2)
                     {
-                        rv = test(*pFactory, cin);
+                        rv = test(*pFactory, cin, rounds);
                     }
                     else
                     {
@@ -146,7 +268,7 @@ int main(int argc, char* argv[])
 
                         if (in)
                         {
-                            rv = test(*pFactory, in);
+                            rv = test(*pFactory, in, rounds);
                         }
                         else
                         {
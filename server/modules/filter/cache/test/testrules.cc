@@ -140,6 +140,10 @@ const struct store_test_case store_test_cases[] =
     STORE_TEST_CASE("column", "!=", "b",     true,  NULL, "SELECT a FROM tbl"),
     STORE_TEST_CASE("column", "=",  "tbl.a", true,  NULL, "SELECT a FROM tbl"),
     STORE_TEST_CASE("column", "=",  "tbl.a", true,  NULL, "SELECT tbl.a FROM tbl"),
+    STORE_TEST_CASE("column", "=",  "TBL.A", true,  NULL, "SELECT a FROM tbl"),
+    STORE_TEST_CASE("column", "=",  "tbl.*", true,  NULL, "SELECT a FROM tbl"),
+    STORE_TEST_CASE("column", "=",  "db.tbl.a", true,  "db", "SELECT a FROM tbl"),
+    STORE_TEST_CASE("column", "=",  "db.tbl.a", false, NULL, "SELECT a FROM tbl"),
 
     STORE_TEST_CASE("column", "like", ".*a",  true,  NULL, "SELECT a from tbl"),
     STORE_TEST_CASE("column", "like", ".*a",  true,  NULL, "SELECT tbl.a from tbl"),
@@ -159,6 +163,8 @@ const struct store_test_case store_test_cases[] =
     STORE_TEST_CASE("table", "=",   "db.tbl", true,  "db", "SELECT a from tbl"),
     STORE_TEST_CASE("table", "!=",  "db.tbl", false, NULL, "SELECT a from db.tbl"),
     STORE_TEST_CASE("table", "!=",  "db.tbl", false, "db", "SELECT a from tbl"),
+    STORE_TEST_CASE("table", "=",   "TBL",    true,  NULL, "SELECT a FROM tbl"),
+    STORE_TEST_CASE("table", "=",   "db.tbl", false, NULL, "SELECT a from tbl"),
 
     STORE_TEST_CASE("database", "=",  "db",    false, NULL,  "SELECT a FROM tbl"),
     STORE_TEST_CASE("database", "!=", "db",    true,  NULL,  "SELECT a FROM tbl"),
@@ -171,6 +177,7 @@ const struct store_test_case store_test_cases[] =
     STORE_TEST_CASE("query", "!=", "SELECT a FROM tbl", false, NULL, "SELECT a FROM tbl"),
     STORE_TEST_CASE("query", "=",  "SELECT b FROM tbl", false, NULL, "SELECT a FROM tbl"),
     STORE_TEST_CASE("query", "!=", "SELECT b FROM tbl", true,  NULL, "SELECT a FROM tbl"),
+    STORE_TEST_CASE("query", "=",  "SELECT a FROM tbl", false, NULL, "SELECT a FROM tb"),
 
     STORE_TEST_CASE("column", "=", "a", false, NULL, "SELECT b FROM tbl WHERE a = 5"),
     STORE_TEST_CASE("column", "=", "a", true,  NULL, "SELECT a, b FROM tbl WHERE a = 5"),
@@ -23,6 +23,9 @@
 #include <maxscale/query_classifier.h>
 #include <regex.h>
 #include <maxscale/alloc.h>
+#include <maxscale/server.h>
+#include <maxscale/service.h>
+#include <maxscale/session.h>
 
 /**
  * @file ccrfilter.c - a very simple filter designed to send queries to the
@@ -38,6 +41,7 @@
  *      time=<time period>          Seconds to wait before queries are routed to slaves.
  *      match=<regex>               Regex for matching
  *      ignore=<regex>              Regex for ignoring
+ *      mode=time|gtid              Whether the slaves are checked for the write
  *
  * The filter also has two options:
  *     @c case, which makes the regex case-sensitive, and
@@ -54,17 +58,27 @@ static  MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *sessio
 static  void   closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static  void   freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static  void   setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_DOWNSTREAM *downstream);
+static  void   setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_UPSTREAM *upstream);
 static  int    routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
+static  int    clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static  void   diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
 #define CCR_DEFAULT_TIME "60"
 
+/** How the end of the critical period is detected */
+typedef enum ccr_mode
+{
+    CCR_MODE_TIME, /*< Only the time and count limit the period */
+    CCR_MODE_GTID  /*< The period also ends when all slaves have the write */
+} CCR_MODE;
+
 typedef struct lagstats
 {
     int n_add_count;  /*< No. of statements diverted based on count */
     int n_add_time;   /*< No. of statements diverted based on time */
     int n_modified;   /*< No. of statements not diverted */
+    int n_synced;     /*< No. of times the slaves had the writes before the limits */
 } LAGSTATS;
 
 /**
@@ -79,6 +93,7 @@ typedef struct
                       * is done. */
     int count;       /*< Number of hints to add after each operation
                      * that modifies data. */
+    CCR_MODE mode;   /*< How the end of the critical period is detected */
     LAGSTATS stats;
     regex_t re;      /* Compiled regex text of match */
     regex_t nore;    /* Compiled regex text of ignore */
@@ -90,8 +105,12 @@ typedef struct
 typedef struct
 {
     MXS_DOWNSTREAM down;              /*< The downstream filter */
+    MXS_UPSTREAM   up;                /*< The upstream filter */
+    MXS_SESSION   *session;           /*< The client session */
     int            hints_left;        /*< Number of hints left to add to queries*/
     time_t         last_modification; /*< Time of the last data modifying operation */
+    bool           write_pending;     /*< Whether a write has not yet been committed */
+    uint64_t       write_ms;          /*< When the last write was known to be committed */
 } CCR_SESSION;
 
 static const MXS_ENUM_VALUE option_values[] =
@@ -102,6 +121,13 @@ static const MXS_ENUM_VALUE option_values[] =
     {NULL}
 };
 
+static const MXS_ENUM_VALUE mode_values[] =
+{
+    {"time", CCR_MODE_TIME},
+    {"gtid", CCR_MODE_GTID},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -119,9 +145,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
         closeSession,
         freeSession,
         setDownstream,
-        NULL,               // No Upstream requirement
+        setUpstream,
         routeQuery,
-        NULL, // No clientReply
+        clientReply,
         diagnostic,
         getCapabilities,
         NULL, // No destroyInstance
@@ -151,6 +177,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
              MXS_MODULE_OPT_NONE,
              option_values
             },
+            {
+             "mode",
+             MXS_MODULE_PARAM_ENUM,
+             "time",
+             MXS_MODULE_OPT_ENUM_UNIQUE,
+             mode_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -177,9 +210,11 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->count = config_get_integer(params, "count");
         my_instance->time = config_get_integer(params, "time");
+        my_instance->mode = config_get_enum(params, "mode", mode_values);
         my_instance->stats.n_add_count = 0;
         my_instance->stats.n_add_time = 0;
         my_instance->stats.n_modified = 0;
+        my_instance->stats.n_synced = 0;
 
         int cflags = config_get_enum(params, "options", option_values);
 
@@ -218,8 +253,11 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 
     if (my_session)
     {
+        my_session->session = session;
         my_session->hints_left = 0;
         my_session->last_modification = 0;
+        my_session->write_pending = false;
+        my_session->write_ms = 0;
     }
 
     return (MXS_FILTER_SESSION*)my_session;
@@ -264,6 +302,75 @@ setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_DOWNSTREAM
     my_session->down = *downstream;
 }
 
+/**
+ * Set the upstream component for this filter.
+ *
+ * @param instance    The filter instance data
+ * @param session     The filter session
+ * @param upstream    The upstream filter or session
+ */
+static void
+setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *upstream)
+{
+    CCR_SESSION *my_session = (CCR_SESSION *)session;
+
+    my_session->up = *upstream;
+}
+
+/**
+ * @return The monotonic time in milliseconds, comparable to SERVER::synced_ms
+ */
+static uint64_t time_in_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Check whether all slaves of the service have replicated the transactions
+ * that were committed on the master before a given time
+ *
+ * @param session  The client session
+ * @param write_ms When the write was known to be committed
+ *
+ * @return True if there is at least one slave and all slaves have the write
+ */
+static bool slaves_synced(MXS_SESSION *session, uint64_t write_ms)
+{
+    const SERVICE_SERVERS *snapshot = service_get_servers(session->service);
+    int n_servers = snapshot->n_servers;
+    bool synced = false;
+
+    if (n_servers > 0)
+    {
+        SERVER *servers[n_servers];
+        SERVER_STATE states[n_servers];
+
+        for (int i = 0; i < n_servers; i++)
+        {
+            servers[i] = snapshot->servers[i].ref->server;
+        }
+
+        server_get_states(servers, n_servers, states);
+
+        for (int i = 0; i < n_servers; i++)
+        {
+            if (snapshot->servers[i].ref->active && SERVER_IS_SLAVE(&states[i]))
+            {
+                if (states[i].synced_ms <= write_ms)
+                {
+                    return false;
+                }
+
+                synced = true;
+            }
+        }
+    }
+
+    return synced;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -315,11 +422,27 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                             MXS_INFO("Write operation detected, queries routed to master for %d seconds", my_instance->time);
                         }
 
+                        if (my_instance->mode == CCR_MODE_GTID)
+                        {
+                            my_session->write_pending = true;
+                        }
+
                         my_instance->stats.n_modified++;
                     }
                 }
             }
         }
+        else if (my_instance->mode == CCR_MODE_GTID && !my_session->write_pending &&
+                 (my_session->hints_left > 0 ||
+                  difftime(now, my_session->last_modification) < my_instance->time) &&
+                 slaves_synced(my_session->session, my_session->write_ms))
+        {
+            /** The slaves have the writes, the reads no longer need the master */
+            my_session->hints_left = 0;
+            my_session->last_modification = 0;
+            my_instance->stats.n_synced++;
+            MXS_INFO("Writes replicated to all slaves, queries routed normally");
+        }
         else if (my_session->hints_left > 0)
         {
             queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_MASTER, NULL);
@@ -345,6 +468,31 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                                        queue);
 }
 
+/**
+ * The clientReply entry point. In gtid mode, the time of the first reply after
+ * a write outside of a transaction is taken as the moment the write was
+ * committed on the master.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
+{
+    CCR_SESSION *my_session = (CCR_SESSION *)session;
+
+    if (my_session->write_pending && !session_trx_is_active(my_session->session))
+    {
+        my_session->write_ms = time_in_ms();
+        my_session->write_pending = false;
+    }
+
+    return my_session->up.clientReply(my_session->up.instance,
+                                      my_session->up.session,
+                                      reply);
+}
+
 /**
  * Diagnostics routine
  *
@@ -363,6 +511,7 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 
     dcb_printf(dcb, "Configuration:\n\tCount: %d\n", my_instance->count);
     dcb_printf(dcb, "\tTime: %d seconds\n", my_instance->time);
+    dcb_printf(dcb, "\tMode: %s\n", my_instance->mode == CCR_MODE_GTID ? "gtid" : "time");
 
     if (my_instance->match)
     {
@@ -378,6 +527,12 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     dcb_printf(dcb, "\tNo. of data modifications: %d\n", my_instance->stats.n_modified);
     dcb_printf(dcb, "\tNo. of hints added based on count: %d\n", my_instance->stats.n_add_count);
     dcb_printf(dcb, "\tNo. of hints added based on time: %d\n",  my_instance->stats.n_add_time);
+
+    if (my_instance->mode == CCR_MODE_GTID)
+    {
+        dcb_printf(dcb, "\tNo. of writes replicated before the limits: %d\n",
+                   my_instance->stats.n_synced);
+    }
 }
 
 /**
@@ -65,6 +65,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 #include <assert.h>
 #include <regex.h>
@@ -72,6 +73,8 @@
 
 #include <maxscale/filter.h>
 #include <maxscale/atomic.h>
+#include <maxscale/clock.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/modulecmd.h>
 #include <maxscale/modutil.h>
 #include <maxscale/log_manager.h>
@@ -176,16 +179,24 @@ typedef struct timerange_t
  */
 typedef struct queryspeed_t
 {
-    time_t               first_query; /*< Time when the first query occurred */
-    time_t               triggered; /*< Time when the limit was exceeded */
+    long                 refilled; /*< Heartbeat when the tokens were last refilled */
+    long                 triggered; /*< Heartbeat when the limit was exceeded */
     int                  period; /*< Measurement interval in seconds */
     int                  cooldown; /*< Time the user is denied access for */
-    int                  count; /*< Number of queries done */
+    int64_t              tokens; /*< Token bucket, a query takes QS_TOKEN_COST() tokens */
     int                  limit; /*< Maximum number of queries */
     long                 id;    /*< Unique id of the rule */
     bool                 active; /*< If the rule has been triggered */
 } QUERYSPEED;
 
+/**
+ * The tokens are scaled so that the bucket can be refilled with an integral
+ * number of tokens on each heartbeat: a query takes one token per heartbeat
+ * in the period and the bucket gains @c limit tokens on each heartbeat.
+ */
+#define QS_TOKEN_COST(qs) ((int64_t)((qs)->period > 0 ? (qs)->period : 1) * 10)
+#define QS_CAPACITY(qs) ((int64_t)(qs)->limit * QS_TOKEN_COST(qs))
+
 /**
  * A structure used to identify individual rules and to store their contents
  *
@@ -200,6 +211,8 @@ typedef struct rule_t
     qc_query_op_t  on_queries;  /*< Types of queries to inspect */
     int            times_matched; /*< Number of times this rule has been matched */
     TIMERANGE*     active;      /*< List of times when this rule is active */
+    char*          pattern;     /*< Regex that can be combined with others, or NULL */
+    uint64_t       matched_query; /*< The query whose content is known to match the rule */
     struct rule_t *next;
 } RULE;
 
@@ -212,9 +225,36 @@ typedef struct rulebook_t
     struct rulebook_t* next;    /*< The next rule in the book */
 } RULE_BOOK;
 
+/**
+ * The rules of a user compiled for matching the content of a query against all
+ * of them at once. The column and function names are looked up in hashtables
+ * that map a name to the rules that contain it, and all regex rules that can
+ * be combined are matched with one regex. If the combined regex does not match,
+ * none of the rules does.
+ *
+ * As the rules are thread specific, so are the matchers.
+ */
+typedef struct rule_matcher
+{
+    HASHTABLE        *columns;   /*< Column name to the column rules containing it */
+    HASHTABLE        *functions; /*< Function name to the function rules containing it */
+    pcre2_code       *regex;     /*< The combined regex rules, NULL if there are none */
+    pcre2_match_data *mdata;     /*< Match data for the combined regex */
+} RULE_MATCHER;
+
+/**
+ * The result of matching the content of a query with a RULE_MATCHER.
+ */
+typedef struct match_state
+{
+    bool enabled;       /*< If false, nothing is known and all rules must be checked */
+    bool regex_matched; /*< Whether the combined regex matched */
+} MATCH_STATE;
+
 thread_local int        thr_rule_version = 0;
 thread_local RULE      *thr_rules = NULL;
 thread_local HASHTABLE *thr_users = NULL;
+thread_local uint64_t   thr_query_id = 0;
 
 /**
  * A temporary template structure used in the creation of actual users.
@@ -241,8 +281,45 @@ typedef struct user_t
     RULE_BOOK*  rules_and;      /*< All of these rules must match for the action to trigger */
     RULE_BOOK*  rules_strict_and; /*< rules that skip the rest of the rules if one of them
                                    * fails. This is only for rules paired with 'match strict_all'. */
+    RULE_MATCHER* matcher;      /*< The compiled rules, NULL if they could not be compiled */
+    bool        cacheable;      /*< The rules depend only on the statement */
+    bool        exact_key;      /*< The decisions are cached by the statement, not its canonical form */
 } DBFW_USER;
 
+/** Maximum number of matched rules recorded in a decision */
+#define DECISION_MAX_RULES   8
+
+/** Statements longer than this are not cached */
+#define DECISION_MAX_SQL_LEN 4096
+
+/**
+ * A cached result of the rules of a user for a statement.
+ *
+ * The rules of a user that has no throttling rules and no rules that are
+ * active only at certain times give the same result for all statements with the
+ * same canonical form. If the user has regex rules, which can match the literal
+ * values, the statement itself is the key instead.
+ *
+ * As the rules are thread specific, so are the decisions.
+ */
+typedef struct decision
+{
+    const void* owner;    /*< The filter instance that made the decision */
+    DBFW_USER*  user;     /*< The user, NULL if the entry is empty */
+    uint64_t    hash;     /*< Hash of the key */
+    char*       key;      /*< The statement or its canonical form */
+    bool        match;    /*< Whether the rules matched */
+    char*       rulename; /*< Names of the matched rules, NULL if none matched */
+    char*       errmsg;   /*< The error message set by the rules, NULL if none */
+    RULE*       rules[DECISION_MAX_RULES]; /*< The rules that matched */
+    int         n_rules;  /*< Number of rules that matched */
+} DECISION;
+
+thread_local DECISION *thr_decisions = NULL;
+thread_local int       thr_n_decisions = 0;
+thread_local RULE     *thr_matched_rules[DECISION_MAX_RULES];
+thread_local int       thr_n_matched_rules = 0;
+
 /**
  * The Firewall filter instance.
  */
@@ -254,6 +331,7 @@ typedef struct
     int             idgen;      /*< UID generator */
     char           *rulefile;   /*< Path to the rule file */
     int             rule_version; /*< Latest rule file version, incremented on reload */
+    int             decision_cache_size; /*< Cached decisions per thread, 0 if disabled */
 } FW_INSTANCE;
 
 /**
@@ -264,6 +342,9 @@ typedef struct
     MXS_SESSION   *session;      /*< Client session structure */
     char          *errmsg;       /*< Rule specific error message */
     QUERYSPEED    *query_speed;  /*< How fast the user has executed queries */
+    DBFW_USER     *user;         /*< The rules of the user, valid if user_version is current */
+    char          *user_name;    /*< The name the rules were looked up with */
+    int            user_version; /*< The thread's rule version when the rules were looked up */
     MXS_DOWNSTREAM down;         /*< Next object in the downstream chain */
     MXS_UPSTREAM   up;           /*< Next object in the upstream chain */
 } FW_SESSION;
@@ -419,10 +500,13 @@ static void* rulebook_free(void* fval)
     return NULL;
 }
 
+static void rule_matcher_free(RULE_MATCHER* matcher);
+
 static void dbfw_user_free(void* fval)
 {
     DBFW_USER* value = (DBFW_USER*) fval;
 
+    rule_matcher_free(value->matcher);
     rulebook_free(value->rules_and);
     rulebook_free(value->rules_or);
     rulebook_free(value->rules_strict_and);
@@ -857,6 +941,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_ENUM_UNIQUE,
                 action_values
             },
+            {
+                "decision_cache_size",
+                MXS_MODULE_PARAM_COUNT,
+                "0"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -1013,6 +1102,8 @@ bool create_rule(void* scanner, const char* name)
             ruledef->active = NULL;
             ruledef->times_matched = 0;
             ruledef->data = NULL;
+            ruledef->pattern = NULL;
+            ruledef->matched_query = 0;
             rstack->rule = ruledef;
             rval = true;
         }
@@ -1062,6 +1153,7 @@ static void rule_free_all(RULE* rule)
             break;
         }
 
+        MXS_FREE(rule->pattern);
         MXS_FREE(rule->name);
         MXS_FREE(rule);
         rule = tmp;
@@ -1307,6 +1399,39 @@ bool define_limit_queries_rule(void* scanner, int max, int timeperiod, int holdo
     return qs != NULL;
 }
 
+/**
+ * Check whether a regex can be combined with others into an alternation of
+ * the form (?:re1)|(?:re2). That is not possible if the regex has capturing
+ * groups, as they would be renumbered, if it starts with a verb, which must be
+ * at the start of the pattern, or if it could consume the closing parenthesis,
+ * which a quoted sequence or a comment of an extended pattern could.
+ *
+ * @param re      The compiled regex
+ * @param pattern The source of the regex
+ * @return True if the regex can be combined
+ */
+static bool regex_is_combinable(pcre2_code* re, const char* pattern)
+{
+    uint32_t n_captures = 0;
+    pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &n_captures);
+
+    bool rval = n_captures == 0 && strncmp(pattern, "(*", 2) != 0 && strstr(pattern, "\\Q") == NULL;
+
+    for (const char* ptr = strstr(pattern, "(?"); rval && ptr; ptr = strstr(ptr + 2, "(?"))
+    {
+        /** Inline options, e.g. (?i) or (?x-i: */
+        for (const char* opt = ptr + 2; rval && (isalpha(*opt) || *opt == '-' || *opt == '^'); opt++)
+        {
+            if (*opt == 'x')
+            {
+                rval = false;
+            }
+        }
+    }
+
+    return rval;
+}
+
 /**
  * Define the topmost rule as a regex rule
  * @param scanner Current scanner
@@ -1327,6 +1452,12 @@ bool define_regex_rule(void* scanner, char* pattern)
         ss_dassert(rstack);
         rstack->rule->type = RT_REGEX;
         rstack->rule->data = (void*) re;
+
+        if (regex_is_combinable(re, (const char*)start))
+        {
+            /** If this fails, the regex is simply matched separately */
+            rstack->rule->pattern = MXS_STRDUP((const char*)start);
+        }
     }
     else
     {
@@ -1370,6 +1501,9 @@ static bool process_user_templates(HASHTABLE *users, user_template_t *templates,
                 user->rules_or = NULL;
                 user->rules_strict_and = NULL;
                 user->qs_limit = NULL;
+                user->matcher = NULL;
+                user->cacheable = false;
+                user->exact_key = false;
                 spinlock_init(&user->lock);
                 hashtable_add(users, user->name, user);
             }
@@ -1430,6 +1564,256 @@ static bool process_user_templates(HASHTABLE *users, user_template_t *templates,
     return rval;
 }
 
+/**
+ * Case-insensitive hash function for the names in a rule matcher.
+ * @param str The name
+ * @return The hash of the lowercased name
+ */
+static int rule_matcher_namehash(const void* str)
+{
+    const unsigned char* ptr = (const unsigned char*)str;
+    int hash = 0;
+
+    while (*ptr)
+    {
+        hash = 31 * hash + tolower(*ptr++);
+    }
+
+    return hash;
+}
+
+static void rule_matcher_bookfree(void* fval)
+{
+    rulebook_free(fval);
+}
+
+static HASHTABLE* rule_matcher_names_create()
+{
+    HASHTABLE *ht = hashtable_alloc(50, rule_matcher_namehash, hashtable_item_strcasecmp);
+
+    if (ht)
+    {
+        hashtable_memory_fns(ht, hashtable_item_strdup, NULL, hashtable_item_free, rule_matcher_bookfree);
+    }
+
+    return ht;
+}
+
+/**
+ * Add the names of a column or function rule to a rule matcher table.
+ * @param names The table
+ * @param rule The rule
+ * @return True on success, false on memory allocation failure
+ */
+static bool rule_matcher_add_names(HASHTABLE* names, RULE* rule)
+{
+    for (STRLINK* strln = (STRLINK*)rule->data; strln; strln = strln->next)
+    {
+        RULE_BOOK* book = hashtable_fetch(names, strln->value);
+
+        if (book)
+        {
+            /** The head of the list is owned by the table, so add after it */
+            RULE_BOOK* node = rulebook_push(book->next, rule);
+
+            if (node == NULL)
+            {
+                return false;
+            }
+
+            book->next = node;
+        }
+        else if ((book = rulebook_push(NULL, rule)) == NULL ||
+                 hashtable_add(names, strln->value, book) == 0)
+        {
+            MXS_FREE(book);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Append a combinable regex rule to the source of the combined regex.
+ * @param dest The source of the combined regex, NULL if nothing has been added
+ * @param rule The rule
+ * @return The new source or NULL on memory allocation failure
+ */
+static char* rule_matcher_add_pattern(char* dest, RULE* rule)
+{
+    size_t len = dest ? strlen(dest) : 0;
+    char* rval = MXS_REALLOC(dest, len + strlen(rule->pattern) + sizeof("|(?:)"));
+
+    if (rval)
+    {
+        sprintf(rval + len, "%s(?:%s)", len ? "|" : "", rule->pattern);
+    }
+    else
+    {
+        MXS_FREE(dest);
+    }
+
+    return rval;
+}
+
+static void rule_matcher_free(RULE_MATCHER* matcher)
+{
+    if (matcher)
+    {
+        hashtable_free(matcher->columns);
+        hashtable_free(matcher->functions);
+        pcre2_match_data_free(matcher->mdata);
+        pcre2_code_free(matcher->regex);
+        MXS_FREE(matcher);
+    }
+}
+
+/**
+ * Compile the rules of a user into a rule matcher.
+ * @param user The user
+ * @return The rule matcher or NULL on error
+ */
+static RULE_MATCHER* rule_matcher_create(DBFW_USER* user)
+{
+    RULE_MATCHER* matcher = MXS_CALLOC(1, sizeof(RULE_MATCHER));
+
+    if (matcher == NULL ||
+        (matcher->columns = rule_matcher_names_create()) == NULL ||
+        (matcher->functions = rule_matcher_names_create()) == NULL)
+    {
+        rule_matcher_free(matcher);
+        return NULL;
+    }
+
+    RULE_BOOK* books[] = {user->rules_or, user->rules_and, user->rules_strict_and};
+    char* pattern = NULL;
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < sizeof(books) / sizeof(books[0]); i++)
+    {
+        for (RULE_BOOK* book = books[i]; ok && book; book = book->next)
+        {
+            RULE* rule = book->rule;
+
+            switch (rule->type)
+            {
+            case RT_COLUMN:
+                ok = rule_matcher_add_names(matcher->columns, rule);
+                break;
+
+            case RT_FUNCTION:
+                ok = rule_matcher_add_names(matcher->functions, rule);
+                break;
+
+            case RT_REGEX:
+                if (rule->pattern)
+                {
+                    ok = (pattern = rule_matcher_add_pattern(pattern, rule)) != NULL;
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    if (ok && pattern)
+    {
+        int err;
+        size_t offset;
+
+        if ((matcher->regex = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+                                            0, &err, &offset, NULL)) == NULL ||
+            (matcher->mdata = pcre2_match_data_create_from_pattern(matcher->regex, NULL)) == NULL)
+        {
+            ok = false;
+        }
+    }
+
+    MXS_FREE(pattern);
+
+    if (!ok)
+    {
+        MXS_ERROR("Failed to compile the rules of user '%s', the rules are "
+                  "matched one at a time.", user->name);
+        rule_matcher_free(matcher);
+        matcher = NULL;
+    }
+
+    return matcher;
+}
+
+/**
+ * Check whether the decisions of the rules of a user can be cached.
+ * @param user The user
+ * @param exact_key Set to true if the statement itself must be the key
+ * @return True if the rules depend only on the statement
+ */
+static bool user_is_cacheable(DBFW_USER* user, bool* exact_key)
+{
+    RULE_BOOK* books[] = {user->rules_or, user->rules_and, user->rules_strict_and};
+    bool rval = true;
+    *exact_key = false;
+
+    for (size_t i = 0; rval && i < sizeof(books) / sizeof(books[0]); i++)
+    {
+        for (RULE_BOOK* book = books[i]; rval && book; book = book->next)
+        {
+            RULE* rule = book->rule;
+
+            switch (rule->type)
+            {
+            case RT_REGEX:
+                *exact_key = true;
+                break;
+
+            case RT_COLUMN:
+            case RT_FUNCTION:
+            case RT_WILDCARD:
+            case RT_CLAUSE:
+            case RT_PERMISSION:
+                break;
+
+            default:
+                rval = false;
+                break;
+            }
+
+            if (rule->active)
+            {
+                rval = false;
+            }
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Compile the rules of all users.
+ * @param users The users
+ */
+static void rule_matchers_create(HASHTABLE* users)
+{
+    HASHITERATOR* iter = hashtable_iterator(users);
+
+    if (iter)
+    {
+        void* key;
+
+        while ((key = hashtable_next(iter)))
+        {
+            DBFW_USER* user = hashtable_fetch(users, key);
+            user->matcher = rule_matcher_create(user);
+            user->cacheable = user_is_cacheable(user, &user->exact_key);
+        }
+
+        hashtable_iterator_free(iter);
+    }
+}
+
 /**
  * Read a rule file from disk and process it into rule and user definitions
  * @param filename Name of the file
@@ -1466,6 +1850,7 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
 
         if (rc == 0 && new_users && process_user_templates(new_users, pstack.templates, pstack.rule))
         {
+            rule_matchers_create(new_users);
             *rules = pstack.rule;
             *users = new_users;
         }
@@ -1492,6 +1877,30 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
     return rc == 0;
 }
 
+/**
+ * Free the contents of a decision, leaving the entry empty.
+ * @param decision The decision
+ */
+static void decision_free(DECISION* decision)
+{
+    MXS_FREE(decision->key);
+    MXS_FREE(decision->rulename);
+    MXS_FREE(decision->errmsg);
+    memset(decision, 0, sizeof(*decision));
+}
+
+/**
+ * Empty the decisions of this thread. Called when the rules are replaced, as
+ * the decisions refer to the users and rules of the thread.
+ */
+static void decisions_clear()
+{
+    for (int i = 0; i < thr_n_decisions; i++)
+    {
+        decision_free(&thr_decisions[i]);
+    }
+}
+
 /**
  * @brief Replace the rule file used by this thread
  *
@@ -1516,6 +1925,7 @@ bool replace_rules(FW_INSTANCE* instance)
 
     if (process_rule_file(filename, &rules, &users))
     {
+        decisions_clear();
         rule_free_all(thr_rules);
         hashtable_free(thr_users);
         thr_rules = rules;
@@ -1559,6 +1969,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     spinlock_init(&my_instance->lock);
     my_instance->action = config_get_enum(params, "action", action_values);
+    my_instance->decision_cache_size = config_get_integer(params, "decision_cache_size");
     my_instance->log_match = FW_LOG_NONE;
 
     if (config_get_bool(params, "log_match"))
@@ -1635,6 +2046,7 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     FW_SESSION *my_session = (FW_SESSION *) session;
     MXS_FREE(my_session->errmsg);
     MXS_FREE(my_session->query_speed);
+    MXS_FREE(my_session->user_name);
     MXS_FREE(my_session);
 }
 
@@ -1709,43 +2121,49 @@ GWBUF* gen_dummy_error(FW_SESSION* session, char* msg)
     return buf;
 }
 
+/** The local time of day of the calling thread, updated once a second */
+static thread_local struct
+{
+    time_t updated; /*< The wall clock time when the time of day was computed */
+    int    seconds; /*< Seconds since local midnight */
+} time_of_day = {0, 0};
+
 /**
- * Checks if the timerange object is active.
- * @return Whether the timerange is active
+ * Get the local time of day
+ *
+ * Converting the time to local time is expensive, so it is done only when
+ * the clock has advanced since the previous call.
+ *
+ * @return Seconds since local midnight
  */
-bool inside_timerange(TIMERANGE* comp)
+static int current_time_of_day()
 {
+    time_t now = mxs_clock_time();
 
-    struct tm tm_now;
-    struct tm tm_before, tm_after;
-    time_t before, after, now, time_now;
-    double to_before, to_after;
-
-    time(&time_now);
-    localtime_r(&time_now, &tm_now);
-    memcpy(&tm_before, &tm_now, sizeof(struct tm));
-    memcpy(&tm_after, &tm_now, sizeof(struct tm));
-
-
-    tm_before.tm_sec = comp->start.tm_sec;
-    tm_before.tm_min = comp->start.tm_min;
-    tm_before.tm_hour = comp->start.tm_hour;
-    tm_after.tm_sec = comp->end.tm_sec;
-    tm_after.tm_min = comp->end.tm_min;
-    tm_after.tm_hour = comp->end.tm_hour;
+    if (now != time_of_day.updated)
+    {
+        struct tm tm_now;
+        localtime_r(&now, &tm_now);
+        time_of_day.seconds = tm_now.tm_hour * 3600 + tm_now.tm_min * 60 + tm_now.tm_sec;
+        time_of_day.updated = now;
+    }
 
+    return time_of_day.seconds;
+}
 
-    before = mktime(&tm_before);
-    after = mktime(&tm_after);
-    now = mktime(&tm_now);
-    to_before = difftime(now, before);
-    to_after = difftime(now, after);
+static inline int tm_seconds_of_day(const struct tm *tm)
+{
+    return tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
 
-    if (to_before > 0.0 && to_after < 0.0)
-    {
-        return true;
-    }
-    return false;
+/**
+ * Checks if the timerange object is active.
+ * @return Whether the timerange is active
+ */
+bool inside_timerange(TIMERANGE* comp)
+{
+    int now = current_time_of_day();
+    return now > tm_seconds_of_day(&comp->start) && now < tm_seconds_of_day(&comp->end);
 }
 
 /**
@@ -1818,12 +2236,22 @@ static char* create_parse_error(FW_INSTANCE* my_instance,
     return msg;
 }
 
+/**
+ * Check whether the user has exceeded the query limit. The queries are counted
+ * with a token bucket that holds the allowed number of queries and is refilled
+ * over the period. The state is only accessed by the thread of the session and
+ * the time is taken from the heartbeat, so no locks or system calls are needed.
+ * @param my_session Fwfilter session
+ * @param rulebook The throttle rule
+ * @param msg On return, the error message if the limit has been exceeded
+ * @return True if the query exceeds the limit
+ */
 bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
 {
     bool matches = false;
     QUERYSPEED* rule_qs = (QUERYSPEED*)rulebook->rule->data;
     QUERYSPEED* queryspeed = my_session->query_speed;
-    time_t time_now = time(NULL);
+    long now = hkheartbeat;
     char emsg[512];
 
     if (queryspeed == NULL)
@@ -1834,14 +2262,18 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
         queryspeed->period = rule_qs->period;
         queryspeed->cooldown = rule_qs->cooldown;
         queryspeed->limit = rule_qs->limit;
+        queryspeed->tokens = QS_CAPACITY(queryspeed);
+        queryspeed->refilled = now;
         my_session->query_speed = queryspeed;
     }
 
     if (queryspeed->active)
     {
-        if (difftime(time_now, queryspeed->triggered) < queryspeed->cooldown)
+        long elapsed = now - queryspeed->triggered;
+
+        if (elapsed < queryspeed->cooldown * 10L)
         {
-            double blocked_for = queryspeed->cooldown - difftime(time_now, queryspeed->triggered);
+            double blocked_for = queryspeed->cooldown - elapsed / 10.0;
             sprintf(emsg, "Queries denied for %f seconds", blocked_for);
             *msg = MXS_STRDUP_A(emsg);
             matches = true;
@@ -1852,35 +2284,41 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
         else
         {
             queryspeed->active = false;
-            queryspeed->count = 0;
+            queryspeed->tokens = QS_CAPACITY(queryspeed);
+            queryspeed->refilled = now;
         }
     }
-    else
+
+    if (!queryspeed->active)
     {
-        if (queryspeed->count >= queryspeed->limit)
+        int64_t capacity = QS_CAPACITY(queryspeed);
+        int64_t cost = QS_TOKEN_COST(queryspeed);
+
+        if (now > queryspeed->refilled)
+        {
+            int64_t refill = (int64_t)(now - queryspeed->refilled) * queryspeed->limit;
+            queryspeed->tokens = capacity - queryspeed->tokens > refill ?
+                                 queryspeed->tokens + refill : capacity;
+            queryspeed->refilled = now;
+        }
+
+        if (queryspeed->tokens >= cost)
+        {
+            queryspeed->tokens -= cost;
+        }
+        else
         {
             MXS_INFO("rule '%s': query limit triggered (%d queries in %d seconds), "
                      "denying queries from user for %d seconds.", rulebook->rule->name,
                      queryspeed->limit, queryspeed->period, queryspeed->cooldown);
 
-            queryspeed->triggered = time_now;
+            queryspeed->triggered = now;
             queryspeed->active = true;
             matches = true;
 
-            double blocked_for = queryspeed->cooldown - difftime(time_now, queryspeed->triggered);
-            sprintf(emsg, "Queries denied for %f seconds", blocked_for);
+            sprintf(emsg, "Queries denied for %f seconds", (double)queryspeed->cooldown);
             *msg = MXS_STRDUP_A(emsg);
         }
-        else if (queryspeed->count > 0 &&
-                 difftime(time_now, queryspeed->first_query) <= queryspeed->period)
-        {
-            queryspeed->count++;
-        }
-        else
-        {
-            queryspeed->first_query = time_now;
-            queryspeed->count = 1;
-        }
     }
 
     return matches;
@@ -2121,21 +2559,125 @@ queryresolved:
     if (matches)
     {
         rulebook->rule->times_matched++;
+
+        if (thr_n_matched_rules < DECISION_MAX_RULES)
+        {
+            thr_matched_rules[thr_n_matched_rules] = rulebook->rule;
+        }
+        thr_n_matched_rules++;
     }
 
     return matches;
 }
 
+/**
+ * Mark the rules that contain one of the names as known to match the query.
+ * @param names A rule matcher table
+ * @param name The name of a column or function used by the query
+ */
+static void rule_matcher_mark(HASHTABLE* names, const char* name)
+{
+    for (RULE_BOOK* book = hashtable_fetch(names, (void*)name); book; book = book->next)
+    {
+        book->rule->matched_query = thr_query_id;
+    }
+}
+
+/**
+ * Match the content of a query against all the compiled rules of a user at
+ * once, so that the rules that cannot match need not be checked one at a time.
+ * @param user The user
+ * @param queue The GWBUF containing the query
+ * @param state The state that is filled
+ */
+static void rule_matcher_prepare(DBFW_USER* user, GWBUF* queue, MATCH_STATE* state)
+{
+    RULE_MATCHER* matcher = user->matcher;
+    state->enabled = false;
+    state->regex_matched = true;
+
+    if (matcher && (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)) &&
+        qc_parse(queue, QC_COLLECT_ALL) == QC_QUERY_PARSED)
+    {
+        state->enabled = true;
+        thr_query_id++;
+
+        const QC_FIELD_INFO* fields;
+        size_t n_fields;
+        qc_get_field_info(queue, &fields, &n_fields);
+
+        for (size_t i = 0; i < n_fields; ++i)
+        {
+            rule_matcher_mark(matcher->columns, fields[i].column);
+        }
+
+        const QC_FUNCTION_INFO* functions;
+        size_t n_functions;
+        qc_get_function_info(queue, &functions, &n_functions);
+
+        for (size_t i = 0; i < n_functions; ++i)
+        {
+            rule_matcher_mark(matcher->functions, functions[i].name);
+        }
+
+        if (matcher->regex)
+        {
+            char *fullquery = modutil_get_SQL(queue);
+
+            if (fullquery)
+            {
+                state->regex_matched = pcre2_match(matcher->regex, (PCRE2_SPTR)fullquery,
+                                                   PCRE2_ZERO_TERMINATED, 0, 0,
+                                                   matcher->mdata, NULL) > 0;
+                MXS_FREE(fullquery);
+            }
+        }
+    }
+}
+
+/**
+ * Check whether a rule can match the query according to its rule matcher.
+ * @param rule The rule
+ * @param state The state filled by rule_matcher_prepare()
+ * @return False if the rule is known not to match, true if it has to be checked
+ */
+static bool rule_may_match(RULE* rule, const MATCH_STATE* state)
+{
+    bool rval = true;
+
+    if (state->enabled)
+    {
+        switch (rule->type)
+        {
+        case RT_COLUMN:
+        case RT_FUNCTION:
+            rval = rule->matched_query == thr_query_id;
+            break;
+
+        case RT_REGEX:
+            rval = rule->pattern == NULL || state->regex_matched;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return rval;
+}
+
 /**
  * Check if the query matches any of the rules in the user's rulebook.
  * @param my_instance Fwfilter instance
  * @param my_session Fwfilter session
  * @param queue The GWBUF containing the query
  * @param user The user whose rulebook is checked
+ * @param state The state filled by rule_matcher_prepare()
  * @return True if the query matches at least one of the rules otherwise false
  */
 bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
-                     GWBUF *queue, DBFW_USER* user, char** rulename)
+                     GWBUF *queue, DBFW_USER* user, const MATCH_STATE* state,
+                     char** rulename)
 {
     RULE_BOOK* rulebook;
     bool rval = false;
@@ -2155,7 +2697,8 @@ bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
                     rulebook = rulebook->next;
                     continue;
                 }
-                if (rule_matches(my_instance, my_session, queue, user, rulebook, fullquery))
+                if (rule_may_match(rulebook->rule, state) &&
+                    rule_matches(my_instance, my_session, queue, user, rulebook, fullquery))
                 {
                     *rulename = MXS_STRDUP_A(rulebook->rule->name);
                     rval = true;
@@ -2211,10 +2754,12 @@ void append_string(char** dest, size_t* size, const char* src)
  * @param my_session Fwfilter session
  * @param queue The GWBUF containing the query
  * @param user The user whose rulebook is checked
+ * @param state The state filled by rule_matcher_prepare()
  * @return True if the query matches all of the rules otherwise false
  */
 bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
-                     GWBUF *queue, DBFW_USER* user, bool strict_all, char** rulename)
+                     GWBUF *queue, DBFW_USER* user, const MATCH_STATE* state,
+                     bool strict_all, char** rulename)
 {
     bool rval = false;
     bool have_active_rule = false;
@@ -2239,7 +2784,8 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
 
                 have_active_rule = true;
 
-                if (rule_matches(my_instance, my_session, queue, user, rulebook, fullquery))
+                if (rule_may_match(rulebook->rule, state) &&
+                    rule_matches(my_instance, my_session, queue, user, rulebook, fullquery))
                 {
                     append_string(&matched_rules, &size, rulebook->rule->name);
                 }
@@ -2304,6 +2850,182 @@ DBFW_USER* find_user_data(HASHTABLE *hash, const char *name, const char *remote)
     return user;
 }
 
+/**
+ * Retrieve the user specific data for this session from the thread local
+ * users. The result is stored in the session so that it needs to be looked up
+ * again only if the rules of the thread are replaced or the user changes.
+ *
+ * @param my_session Fwfilter session
+ * @param dcb The client DCB
+ * @return The user data or NULL if it was not found
+ */
+static DBFW_USER* find_session_user(FW_SESSION *my_session, DCB *dcb)
+{
+    if (my_session->user_version != thr_rule_version ||
+        my_session->user_name == NULL ||
+        strcmp(my_session->user_name, dcb->user) != 0)
+    {
+        char *user_name = MXS_STRDUP(dcb->user);
+        DBFW_USER *user = find_user_data(thr_users, dcb->user, dcb->remote);
+
+        if (user_name == NULL)
+        {
+            /** Not stored, so the user is looked up again for the next query */
+            return user;
+        }
+
+        MXS_FREE(my_session->user_name);
+        my_session->user_name = user_name;
+        my_session->user = user;
+        my_session->user_version = thr_rule_version;
+    }
+
+    return my_session->user;
+}
+
+/**
+ * Check if the query matches the rules of a user.
+ * @param my_instance Fwfilter instance
+ * @param my_session Fwfilter session
+ * @param queue The GWBUF containing the query
+ * @param user The user whose rules are checked
+ * @param rulename Set to the names of the matched rules
+ * @return True if the query matches the rules
+ */
+static bool check_rules(FW_INSTANCE* my_instance, FW_SESSION* my_session,
+                        GWBUF *queue, DBFW_USER* user, char** rulename)
+{
+    MATCH_STATE state;
+    thr_n_matched_rules = 0;
+
+    rule_matcher_prepare(user, queue, &state);
+
+    return check_match_any(my_instance, my_session, queue, user, &state, rulename) ||
+           check_match_all(my_instance, my_session, queue, user, &state, false, rulename) ||
+           check_match_all(my_instance, my_session, queue, user, &state, true, rulename);
+}
+
+/**
+ * Find the entry of a key in the decisions of this thread.
+ * @param my_instance Fwfilter instance
+ * @param hash Hash of the key
+ * @return The entry for the key, which may hold another decision, or NULL if
+ *         the decisions could not be allocated
+ */
+static DECISION* decision_entry(FW_INSTANCE* my_instance, uint64_t hash)
+{
+    if (thr_n_decisions < my_instance->decision_cache_size)
+    {
+        DECISION* decisions = MXS_CALLOC(my_instance->decision_cache_size, sizeof(DECISION));
+
+        if (decisions == NULL)
+        {
+            return NULL;
+        }
+
+        decisions_clear();
+        MXS_FREE(thr_decisions);
+        thr_decisions = decisions;
+        thr_n_decisions = my_instance->decision_cache_size;
+    }
+
+    return &thr_decisions[hash % thr_n_decisions];
+}
+
+/**
+ * Check if the query matches the rules of a user, using the result of an
+ * earlier query with the same key if there is one.
+ *
+ * @see check_rules
+ */
+static bool check_rules_cached(FW_INSTANCE* my_instance, FW_SESSION* my_session,
+                               GWBUF *queue, DBFW_USER* user, char** rulename)
+{
+    char* sql;
+    int len;
+
+    if (my_instance->decision_cache_size == 0 || !user->cacheable ||
+        !modutil_extract_SQL(queue, &sql, &len) || len > DECISION_MAX_SQL_LEN)
+    {
+        return check_rules(my_instance, my_session, queue, user, rulename);
+    }
+
+    char key[len + 1];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    if (user->exact_key)
+    {
+        for (int i = 0; i < len; i++)
+        {
+            hash = (hash ^ (uint8_t)sql[i]) * 0x100000001b3ULL;
+        }
+
+        memcpy(key, sql, len);
+        key[len] = '\0';
+    }
+    else
+    {
+        modutil_canonicalize(sql, len, key, &hash);
+    }
+
+    DECISION* decision = decision_entry(my_instance, hash);
+
+    if (decision == NULL)
+    {
+        return check_rules(my_instance, my_session, queue, user, rulename);
+    }
+
+    if (decision->user == user && decision->owner == my_instance &&
+        decision->hash == hash && strcmp(decision->key, key) == 0)
+    {
+        for (int i = 0; i < decision->n_rules; i++)
+        {
+            decision->rules[i]->times_matched++;
+        }
+
+        char* errmsg;
+
+        if (decision->errmsg && (errmsg = MXS_STRDUP(decision->errmsg)))
+        {
+            MXS_FREE(my_session->errmsg);
+            my_session->errmsg = errmsg;
+        }
+
+        *rulename = decision->rulename ? MXS_STRDUP(decision->rulename) : NULL;
+        return decision->match;
+    }
+
+    /** The rules replace the error message if they set one */
+    char* old_errmsg = my_session->errmsg;
+    bool match = check_rules(my_instance, my_session, queue, user, rulename);
+
+    if (thr_n_matched_rules <= DECISION_MAX_RULES)
+    {
+        decision_free(decision);
+        decision->key = MXS_STRDUP(key);
+        decision->rulename = *rulename ? MXS_STRDUP(*rulename) : NULL;
+        decision->errmsg = my_session->errmsg && my_session->errmsg != old_errmsg ?
+                           MXS_STRDUP(my_session->errmsg) : NULL;
+
+        if (decision->key && (decision->rulename || *rulename == NULL) &&
+            (decision->errmsg || my_session->errmsg == NULL || my_session->errmsg == old_errmsg))
+        {
+            decision->owner = my_instance;
+            decision->user = user;
+            decision->hash = hash;
+            decision->match = match;
+            decision->n_rules = thr_n_matched_rules;
+            memcpy(decision->rules, thr_matched_rules, thr_n_matched_rules * sizeof(RULE*));
+        }
+        else
+        {
+            decision_free(decision);
+        }
+    }
+
+    return match;
+}
+
 static bool command_is_mandatory(const GWBUF *buffer)
 {
     switch (MYSQL_GET_COMMAND((uint8_t*)GWBUF_DATA(buffer)))
@@ -2341,7 +3063,7 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     DCB *dcb = my_session->session->client_dcb;
     int rval = 0;
     ss_dassert(dcb && dcb->session);
-    int rule_version = my_instance->rule_version;
+    int rule_version = atomic_load_int(&my_instance->rule_version);
 
     if (thr_rule_version < rule_version)
     {
@@ -2384,20 +3106,13 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
             ss_dassert(analyzed_queue);
         }
 
-        DBFW_USER *user = find_user_data(thr_users, dcb->user, dcb->remote);
+        DBFW_USER *user = find_session_user(my_session, dcb);
         bool query_ok = command_is_mandatory(queue);
 
         if (user)
         {
-            bool match = false;
             char* rname = NULL;
-
-            if (check_match_any(my_instance, my_session, analyzed_queue, user, &rname) ||
-                check_match_all(my_instance, my_session, analyzed_queue, user, false, &rname) ||
-                check_match_all(my_instance, my_session, analyzed_queue, user, true, &rname))
-            {
-                match = true;
-            }
+            bool match = check_rules_cached(my_instance, my_session, analyzed_queue, user, &rname);
 
             switch (my_instance->action)
             {
@@ -2491,6 +3206,12 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     FW_INSTANCE *my_instance = (FW_INSTANCE *) instance;
 
     dcb_printf(dcb, "Firewall Filter\n");
+
+    if (my_instance->decision_cache_size > 0)
+    {
+        dcb_printf(dcb, "Cached decisions per thread: %d\n", my_instance->decision_cache_size);
+    }
+
     dcb_printf(dcb, "Rule, Type, Times Matched\n");
 
     for (RULE *rule = thr_rules; rule; rule = rule->next)
@@ -69,28 +69,19 @@ HINT_TOKEN kwords[] = {
 };
  */
 
-static HINT_TOKEN *hint_next_token(GWBUF **buf, char **ptr);
+static HINT_TOKEN *hint_next_token(GWBUF **buf, char **ptr, HINT_TOKEN *tok);
+static bool hint_marker_found(GWBUF *request);
 static void hint_pop(HINT_SESSION *);
 static HINT *lookup_named_hint(HINT_SESSION *, char *);
 static void create_named_hint(HINT_SESSION *, char *, HINT *);
 static void hint_push(HINT_SESSION *, HINT *);
 static const char* token_get_keyword(HINT_TOKEN* token);
-static void token_free(HINT_TOKEN* token);
 
 typedef enum
 {
     HM_EXECUTE, HM_START, HM_PREPARE
 } HINT_MODE;
 
-void token_free(HINT_TOKEN* token)
-{
-    if (token->value != NULL)
-    {
-        MXS_FREE(token->value);
-    }
-    MXS_FREE(token);
-}
-
 static const char* token_get_keyword(
     HINT_TOKEN* token)
 {
@@ -149,9 +140,16 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
     HINT *rval = NULL;
     char *pname, *lvalue, *hintname = NULL;
     GWBUF *buf;
-    HINT_TOKEN *tok;
+    HINT_TOKEN token, *tok;
     HINT_MODE mode = HM_EXECUTE;
     bool multiline_comment = false;
+
+    /* Most statements have no hints, skip them without parsing */
+    if (!hint_marker_found(request))
+    {
+        goto retblock;
+    }
+
     /* First look for any comment in the SQL */
     modutil_MySQL_Query(request, &ptr, &len, &residual);
     buf = request;
@@ -261,32 +259,23 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
         }
     }
 
-    tok = hint_next_token(&buf, &ptr);
-
-    if (tok == NULL)
-    {
-        goto retblock;
-    }
+    tok = hint_next_token(&buf, &ptr, &token);
 
     /** This is not MaxScale hint because it doesn't start with 'maxscale' */
     if (tok->token != TOK_MAXSCALE)
     {
-        token_free(tok);
         goto retblock;
     }
-    token_free(tok);
 
     state = HS_INIT;
 
-    while (((tok = hint_next_token(&buf, &ptr)) != NULL) &&
-           (tok->token != TOK_END))
+    while ((tok = hint_next_token(&buf, &ptr, &token))->token != TOK_END)
     {
         if (tok->token == TOK_LINEBRK)
         {
             if (multiline_comment)
             {
                 // Skip token
-                token_free(tok);
                 continue;
             }
             else
@@ -324,7 +313,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'route', 'stop' or hint name instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -335,7 +323,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                 MXS_ERROR("Syntax error in hint. Expected "
                           "'to' instead of '%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             state = HS_ROUTE1;
@@ -360,8 +347,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'master', 'slave', or 'server' instead "
                           "of '%s'. Hint ignored.",
                           token_get_keyword(tok));
-
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -378,7 +363,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "server name instead of '%s'. Hint "
                           "ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -406,7 +390,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'=', 'prepare', or 'start' instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -427,7 +410,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                 break;
             case TOK_STRING:
                 state = HS_NAME;
-                lvalue = tok->value;
+                lvalue = MXS_STRDUP_A(tok->value);
                 break;
             default:
                 /* Error, token tok->value not expected */
@@ -435,19 +418,12 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'route' or hint name instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
         }
-        token_free(tok);
     } /*< while */
 
-    if (tok && tok->token == TOK_END)
-    {
-        token_free(tok);
-    }
-
     switch (mode)
     {
     case HM_START:
@@ -534,23 +510,18 @@ retblock:
  * @param buf   A pointer to the buffer point, will be updated if a
  *      new buffer is used.
  * @param ptr   The pointer within the buffer we are processing
- * @return A HINT token
+ * @param tok   The token to fill
+ * @return The token @c tok
  */
 static HINT_TOKEN *
-hint_next_token(GWBUF **buf, char **ptr)
+hint_next_token(GWBUF **buf, char **ptr, HINT_TOKEN *tok)
 {
-    char word[100], *dest;
+    char *word = tok->value, *dest;
     int inword = 0;
     int endtag = 0;
     char inquote = '\0';
     int i, found;
-    HINT_TOKEN *tok;
 
-    if ((tok = (HINT_TOKEN *)MXS_MALLOC(sizeof(HINT_TOKEN))) == NULL)
-    {
-        return NULL;
-    }
-    tok->value = NULL;
     dest = word;
     while (*ptr < (char *)((*buf)->end) || (*buf)->next)
     {
@@ -603,7 +574,7 @@ hint_next_token(GWBUF **buf, char **ptr)
             *ptr = (*buf)->start;
         }
 
-        if (dest - word > 98)
+        if (dest - word > HINT_TOKEN_MAX - 2)
         {
             break;
         }
@@ -636,12 +607,61 @@ hint_next_token(GWBUF **buf, char **ptr)
     if (found == 0)
     {
         tok->token = TOK_STRING;
-        tok->value = MXS_STRDUP_A(word);
     }
 
     return tok;
 }
 
+/**
+ * Check whether a statement can contain a hint
+ *
+ * A hint is a comment that starts with the word 'maxscale'. The comment
+ * markers are searched with the optimized memory search functions of the C
+ * library and only a statement with a comment is searched for the word. Most
+ * statements are rejected without looking at each character.
+ *
+ * @param request The statement
+ * @return False if the statement has no hint
+ */
+static bool
+hint_marker_found(GWBUF *request)
+{
+    static const char keyword[] = "maxscale";
+    const int keylen = sizeof(keyword) - 1;
+    char *sql;
+    int len;
+
+    /** Buffer chains are left for the parser */
+    if (request->next || !modutil_extract_SQL(request, &sql, &len))
+    {
+        return request->next != NULL;
+    }
+
+    char *end = sql + len;
+    char *comment = memchr(sql, '#', len);
+    char *ptr;
+
+    if ((ptr = memmem(sql, comment ? comment - sql : len, "--", 2)))
+    {
+        comment = ptr;
+    }
+
+    if ((ptr = memmem(sql, comment ? comment - sql : len, "/*", 2)))
+    {
+        comment = ptr;
+    }
+
+    for (ptr = comment; ptr && end - ptr >= keylen; ptr++)
+    {
+        if ((*ptr | 0x20) == 'm' && strncasecmp(ptr, keyword, keylen) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
  * hint_pop - pop the hint off the top of the stack if it is not empty
  *
@@ -44,11 +44,14 @@ typedef enum
     TOK_END
 } TOKEN_VALUE;
 
+/* The maximum length of a token */
+#define HINT_TOKEN_MAX 100
+
 /* The tokenising return type */
 typedef struct
 {
-    TOKEN_VALUE token;      // The token itself
-    char        *value;     // The string version of the token
+    TOKEN_VALUE token;                  // The token itself
+    char        value[HINT_TOKEN_MAX];  // The string version of the token
 } HINT_TOKEN;
 
 /**
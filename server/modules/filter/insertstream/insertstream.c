@@ -16,7 +16,9 @@
 #include <maxscale/cdefs.h>
 
 #include <strings.h>
+#include <time.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/buffer.h>
 #include <maxscale/filter.h>
 #include <maxscale/log_manager.h>
@@ -42,15 +44,41 @@ static uint64_t getCapabilities(MXS_FILTER *instance);
 static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF *reply);
 static bool extract_insert_target(GWBUF *buffer, char* target, int len);
 static GWBUF* create_load_data_command(const char *target);
-static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num);
+static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num, int *n_rows);
+static char* get_value(char* data, uint32_t datalen, char** dest, uint32_t* destlen);
+
+/** How the inserts are combined */
+enum ds_mode
+{
+    DS_MODE_LOAD_DATA, /**< Stream the rows with LOAD DATA LOCAL INFILE */
+    DS_MODE_INSERT     /**< Collect the rows of each table into multi-row inserts */
+};
+
+static const MXS_ENUM_VALUE mode_values[] =
+{
+    {"load_data", DS_MODE_LOAD_DATA},
+    {"insert",    DS_MODE_INSERT},
+    {NULL}
+};
+
+/** Default size of the values of a multi-row insert */
+#define DS_DEFAULT_BATCH_SIZE "1048576"
+
+/** The part of a multi-row insert that precedes the values */
+static const char insert_template[] = "INSERT INTO %s VALUES ";
 
 /**
  * Instance structure
  */
 typedef struct
 {
-    char *source; /**< Source address to restrict matches */
-    char *user;   /**< User name to restrict matches */
+    char *source;        /**< Source address to restrict matches */
+    char *user;          /**< User name to restrict matches */
+    enum ds_mode mode;   /**< How the inserts are combined */
+    uint64_t batch_size; /**< Size of the values at which a multi-row insert is sent */
+    time_t started;      /**< When the instance was created */
+    uint64_t n_rows;     /**< Number of rows streamed or batched */
+    uint64_t n_batches;  /**< Number of streams opened or multi-row inserts sent */
 } DS_INSTANCE;
 
 enum ds_state
@@ -59,9 +87,21 @@ enum ds_state
     DS_REQUEST_SENT,     /**< Request for stream sent */
     DS_REQUEST_ACCEPTED, /**< Stream request accepted */
     DS_STREAM_OPEN,      /**< Stream is open */
-    DS_CLOSING_STREAM    /**< Stream is about to be closed */
+    DS_CLOSING_STREAM,   /**< Stream is about to be closed */
+    DS_FLUSHING_BATCH    /**< A multi-row insert has been sent */
 };
 
+/**
+ * The rows waiting to be inserted into one table
+ */
+typedef struct ds_batch
+{
+    char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1]; /**< The table */
+    GWBUF *values;         /**< Comma separated value lists */
+    int n_rows;            /**< Number of rows */
+    struct ds_batch *next; /**< The batch of the next table */
+} DS_BATCH;
+
 /**
  * The session structure for this regex filter
  */
@@ -75,8 +115,13 @@ typedef struct
     DCB* client_dcb;     /**< Client DCB */
     enum ds_state state; /**< The current state of the stream */
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1]; /**< Current target table */
+    DS_BATCH *batches;   /**< The rows waiting to be inserted, one batch per table */
+    GWBUF *error;        /**< Error returned for a multi-row insert */
+    int n_affected;      /**< Affected rows returned once the multi-row insert is done */
 } DS_SESSION;
 
+static void free_batches(DS_SESSION *my_session);
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -118,6 +163,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"mode", MXS_MODULE_PARAM_ENUM, "load_data", MXS_MODULE_OPT_NONE, mode_values},
+            {"batch_size", MXS_MODULE_PARAM_SIZE, DS_DEFAULT_BATCH_SIZE},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -163,6 +210,20 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
+        my_instance->mode = config_get_enum(params, "mode", mode_values);
+        my_instance->batch_size = config_get_size(params, "batch_size");
+        my_instance->started = time(NULL);
+
+        /** A multi-row insert must fit into one packet */
+        uint64_t max_size = MYSQL_PACKET_LENGTH_MAX - 1 - sizeof(insert_template) -
+                            (MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1);
+
+        if (my_instance->batch_size > max_size)
+        {
+            MXS_WARNING("The batch_size of '%s' is larger than the maximum of %lu bytes, "
+                        "using the maximum.", name, max_size);
+            my_instance->batch_size = max_size;
+        }
     }
 
     return (MXS_FILTER *) my_instance;
@@ -225,6 +286,11 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 static void
 freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    DS_SESSION *my_session = (DS_SESSION*) session;
+
+    free_batches(my_session);
+    gwbuf_free(my_session->error);
+    gwbuf_free(my_session->queue);
     MXS_FREE(session);
 }
 
@@ -254,6 +320,277 @@ static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_U
     my_session->up = *upstream;
 }
 
+/**
+ * Free the rows that are waiting to be inserted
+ *
+ * @param my_session The filter session
+ */
+static void free_batches(DS_SESSION *my_session)
+{
+    while (my_session->batches)
+    {
+        DS_BATCH *batch = my_session->batches;
+        my_session->batches = batch->next;
+        gwbuf_free(batch->values);
+        MXS_FREE(batch);
+    }
+}
+
+/**
+ * Find the batch of a table, creating it if it doesn't exist
+ *
+ * @param my_session The filter session
+ * @param target     The table
+ *
+ * @return The batch or NULL if memory allocation failed
+ */
+static DS_BATCH* get_batch(DS_SESSION *my_session, const char *target)
+{
+    DS_BATCH **batch = &my_session->batches;
+
+    while (*batch && strcmp((*batch)->target, target) != 0)
+    {
+        batch = &(*batch)->next;
+    }
+
+    if (*batch == NULL && (*batch = MXS_CALLOC(1, sizeof(DS_BATCH))))
+    {
+        strcpy((*batch)->target, target);
+    }
+
+    return *batch;
+}
+
+/**
+ * @brief Extract the value lists of an INSERT
+ *
+ * @param buffer Buffer containing the query
+ * @param n_rows Number of value lists
+ *
+ * @return The value lists, each preceded by a comma, or NULL on error
+ */
+static GWBUF* extract_values(GWBUF *buffer, int *n_rows)
+{
+    char *data = (char*)GWBUF_DATA(buffer);
+    char *end = (char*)buffer->end;
+    char *ptr = data + MYSQL_HEADER_LEN + 1;
+    char *value;
+    uint32_t valuesize;
+    GWBUF *rval = NULL;
+
+    *n_rows = 0;
+
+    while ((ptr = get_value(ptr, end - ptr, &value, &valuesize)))
+    {
+        GWBUF *row = gwbuf_alloc(valuesize + 3);
+
+        if (row == NULL)
+        {
+            gwbuf_free(rval);
+            return NULL;
+        }
+
+        char *dest = (char*)GWBUF_DATA(row);
+        *dest++ = ',';
+        *dest++ = '(';
+        memcpy(dest, value, valuesize);
+        dest[valuesize] = ')';
+        rval = gwbuf_append(rval, row);
+        ++*n_rows;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Send the rows of one table as a multi-row insert
+ *
+ * The batch is removed from the session. The reply is handled by batch_flushed().
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param batch       The batch to send
+ *
+ * @return 1 on success, 0 on error
+ */
+static int32_t flush_batch(DS_INSTANCE *my_instance, DS_SESSION *my_session, DS_BATCH *batch)
+{
+    DS_BATCH **prev = &my_session->batches;
+
+    while (*prev != batch)
+    {
+        prev = &(*prev)->next;
+    }
+
+    *prev = batch->next;
+
+    /** The values start with a comma that is left out */
+    size_t values_len = gwbuf_length(batch->values) - 1;
+    char prefix[sizeof(insert_template) + strlen(batch->target)];
+    int prefix_len = snprintf(prefix, sizeof(prefix), insert_template, batch->target);
+    uint32_t payload = 1 + prefix_len + values_len;
+    GWBUF *query = gwbuf_alloc(MYSQL_HEADER_LEN + payload);
+
+    if (query)
+    {
+        uint8_t *ptr = GWBUF_DATA(query);
+        *ptr++ = payload;
+        *ptr++ = payload >> 8;
+        *ptr++ = payload >> 16;
+        *ptr++ = 0;
+        *ptr++ = 0x03;
+        memcpy(ptr, prefix, prefix_len);
+        gwbuf_copy_data(batch->values, 1, values_len, ptr + prefix_len);
+    }
+
+    gwbuf_free(batch->values);
+    MXS_FREE(batch);
+
+    if (query == NULL)
+    {
+        return 0;
+    }
+
+    my_session->state = DS_FLUSHING_BATCH;
+    atomic_add_uint64(&my_instance->n_batches, 1);
+
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session, query);
+}
+
+/**
+ * @brief Handle the reply to a multi-row insert
+ *
+ * If the flush was started by a statement, the statement is routed again so
+ * that the next batch is sent or, when all of them are sent, the statement
+ * itself. Otherwise the insert that filled the batch is answered.
+ *
+ * @param my_session The filter session
+ * @param reply      The reply from the backend
+ *
+ * @return 1 on success, 0 on error
+ */
+static int32_t batch_flushed(DS_SESSION *my_session, GWBUF *reply)
+{
+    int rc = 1;
+    my_session->state = DS_STREAM_CLOSED;
+
+    if (MYSQL_IS_ERROR_PACKET((uint8_t*)GWBUF_DATA(reply)))
+    {
+        /** The inserts were already acknowledged, the error is returned for the next statement */
+        gwbuf_free(my_session->error);
+        my_session->error = reply;
+        free_batches(my_session);
+    }
+    else
+    {
+        gwbuf_free(reply);
+    }
+
+    if (my_session->queue)
+    {
+        GWBUF* queue = my_session->queue;
+        my_session->queue = NULL;
+        poll_add_epollin_event_to_dcb(my_session->client_dcb, queue);
+    }
+    else if (my_session->error)
+    {
+        rc = my_session->up.clientReply(my_session->up.instance,
+                                        my_session->up.session, my_session->error);
+        my_session->error = NULL;
+    }
+    else
+    {
+        rc = mxs_mysql_send_ok(my_session->client_dcb, 1, my_session->n_affected, NULL);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Route a statement when inserts are collected into multi-row inserts
+ *
+ * Inserts done inside a transaction are acknowledged at once and their rows
+ * are added to the batch of the target table. A batch is sent as one insert
+ * when it reaches the batch size. All batches are sent before any other
+ * statement is routed.
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param queue       The statement
+ *
+ * @return 1 on success, 0 on error
+ */
+static int32_t route_batched(DS_INSTANCE *my_instance, DS_SESSION *my_session, GWBUF *queue)
+{
+    char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1];
+    GWBUF *values = NULL;
+    int n_rows = 0;
+
+    if (my_session->error)
+    {
+        /** A multi-row insert failed, the statement fails with its error */
+        GWBUF *error = my_session->error;
+        my_session->error = NULL;
+        gwbuf_free(queue);
+        return my_session->client_dcb->func.write(my_session->client_dcb, error);
+    }
+
+    if (my_session->active && session_trx_is_active(my_session->client_dcb->session) &&
+        extract_insert_target(queue, target, sizeof(target)) &&
+        (values = extract_values(queue, &n_rows)))
+    {
+        DS_BATCH *batch = get_batch(my_session, target);
+
+        if (batch == NULL)
+        {
+            gwbuf_free(values);
+            gwbuf_free(queue);
+            return 0;
+        }
+
+        if (batch->values &&
+            gwbuf_length(batch->values) + gwbuf_length(values) > my_instance->batch_size)
+        {
+            /** The rows would not fit, send the batch and route the insert again */
+            gwbuf_free(values);
+            my_session->queue = queue;
+            return flush_batch(my_instance, my_session, batch);
+        }
+
+        if (gwbuf_length(values) > my_instance->batch_size)
+        {
+            /** Too large to be batched */
+            gwbuf_free(values);
+        }
+        else
+        {
+            gwbuf_free(queue);
+            batch->values = gwbuf_append(batch->values, values);
+            batch->n_rows += n_rows;
+            atomic_add_uint64(&my_instance->n_rows, n_rows);
+
+            if (gwbuf_length(batch->values) >= my_instance->batch_size)
+            {
+                /** The insert is acknowledged when the batch has been sent */
+                my_session->n_affected = n_rows;
+                return flush_batch(my_instance, my_session, batch);
+            }
+
+            return mxs_mysql_send_ok(my_session->client_dcb, 1, n_rows, NULL);
+        }
+    }
+    else if (my_session->batches)
+    {
+        /** The statement is routed again after the batch has been sent */
+        my_session->queue = queue;
+        return flush_batch(my_instance, my_session, my_session->batches);
+    }
+
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session, queue);
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -268,13 +605,18 @@ static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_U
  */
 static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
+    DS_INSTANCE *my_instance = (DS_INSTANCE *) instance;
     DS_SESSION *my_session = (DS_SESSION *) session;
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1];
     bool send_ok = false;
-    bool send_error = false;
     int rc = 0;
     ss_dassert(GWBUF_IS_CONTIGUOUS(queue));
 
+    if (my_instance->mode == DS_MODE_INSERT)
+    {
+        return route_batched(my_instance, my_session, queue);
+    }
+
     if (session_trx_is_active(my_session->client_dcb->session) &&
         extract_insert_target(queue, target, sizeof(target)))
     {
@@ -287,6 +629,7 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
             my_session->state = DS_REQUEST_SENT;
             my_session->packet_num = 0;
             queue = create_load_data_command(target);
+            atomic_add_uint64(&my_instance->n_batches, 1);
             break;
 
         case DS_REQUEST_ACCEPTED:
@@ -301,18 +644,22 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
                  * a data stream
                  */
                 uint8_t packet_num = ++my_session->packet_num;
+                int n_rows = 0;
                 send_ok = true;
-                queue = convert_to_stream(queue, packet_num);
+                queue = convert_to_stream(queue, packet_num, &n_rows);
+                atomic_add_uint64(&my_instance->n_rows, n_rows);
             }
             else
             {
                 /**
-                 * Target mismatch
-                 *
-                 * TODO: Instead of sending an error, we could just open a new stream
+                 * Target mismatch, close the stream. The insert is routed
+                 * again once the stream is closed and it opens a new stream
+                 * for its own target.
                  */
-                gwbuf_free(queue);
-                send_error = true;
+                char empty_packet[] = {0, 0, 0, ++my_session->packet_num};
+                my_session->state = DS_CLOSING_STREAM;
+                my_session->queue = queue;
+                queue = gwbuf_alloc_and_load(sizeof(empty_packet), &empty_packet[0]);
             }
             break;
 
@@ -361,15 +708,8 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
         rc = mxs_mysql_send_ok(my_session->client_dcb, 1, 0, NULL);
     }
 
-    if (send_error)
-    {
-        rc = mysql_send_custom_error(my_session->client_dcb, 1, 0, "Invalid insert target");
-    }
-    else
-    {
-        rc = my_session->down.routeQuery(my_session->down.instance,
-                                         my_session->down.session, queue);
-    }
+    rc = my_session->down.routeQuery(my_session->down.instance,
+                                     my_session->down.session, queue);
 
     return rc;
 }
@@ -402,10 +742,11 @@ static char* get_value(char* data, uint32_t datalen, char** dest, uint32_t* dest
  *
  * @param buffer     Buffer containing the query
  * @param packet_num The current packet sequence number
+ * @param n_rows     Number of rows in the stream
  *
  * @return The modified buffer
  */
-static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num)
+static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num, int *n_rows)
 {
     /** Remove the INSERT INTO ... from the buffer */
     char *dataptr = (char*)GWBUF_DATA(buffer);
@@ -428,6 +769,7 @@ static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num)
         memmove(store_end, value, valuesize);
         store_end += valuesize;
         *store_end++ = '\n';
+        ++*n_rows;
     }
 
     gwbuf_rtrim(buffer, (char*)buffer->end - store_end);
@@ -456,6 +798,11 @@ static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GW
     DS_SESSION *my_session = (DS_SESSION*) session;
     int rc = 1;
 
+    if (my_session->state == DS_FLUSHING_BATCH)
+    {
+        return batch_flushed(my_session, reply);
+    }
+
     if (my_session->state == DS_CLOSING_STREAM ||
         (my_session->state == DS_REQUEST_SENT &&
          !MYSQL_IS_ERROR_PACKET((uint8_t*)GWBUF_DATA(reply))))
@@ -510,6 +857,21 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
     {
         dcb_printf(dcb, "\t\tReplacement limit to user           %s\n", my_instance->user);
     }
+
+    uint64_t n_rows = atomic_load_uint64(&my_instance->n_rows);
+    uint64_t n_batches = atomic_load_uint64(&my_instance->n_batches);
+    time_t uptime = time(NULL) - my_instance->started;
+
+    dcb_printf(dcb, "\t\tMode                                %s\n",
+               my_instance->mode == DS_MODE_INSERT ? "insert" : "load_data");
+    dcb_printf(dcb, "\t\tRows                                %lu\n", n_rows);
+    dcb_printf(dcb, "\t\tRows per second                     %.1f\n",
+               (double)n_rows / (uptime > 0 ? uptime : 1));
+    dcb_printf(dcb, "\t\t%s                %lu\n",
+               my_instance->mode == DS_MODE_INSERT ? "Multi-row inserts  " : "Streams            ",
+               n_batches);
+    dcb_printf(dcb, "\t\tAverage rows per batch              %.1f\n",
+               n_batches ? (double)n_rows / n_batches : 0.0);
 }
 
 /**
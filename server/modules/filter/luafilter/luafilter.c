@@ -34,6 +34,10 @@
  * is defined and valid, the matching entry point function in Lua will be called.
  * The same holds true for session script apart from no calls to createInstance
  * or diagnostic being made for the session script.
+ *
+ * By default all sessions share one state of the global script and the calls
+ * into it are serialized. With thread states, the script is precompiled once
+ * and each thread loads the bytecode into a state of its own.
  */
 
 #define MXS_MODULE_NAME "luafilter"
@@ -44,14 +48,24 @@
 #include <lualib.h>
 #include <string.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
 #include <maxscale/debug.h>
 #include <maxscale/filter.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/modulecmd.h>
 #include <maxscale/modutil.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/rcu.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
 
+#if LUA_VERSION_NUM >= 503
+#define dump_function(state, writer, data) lua_dump(state, writer, data, 0)
+#else
+#define dump_function(state, writer, data) lua_dump(state, writer, data)
+#endif
+
 /*
  * The filter entry points
  */
@@ -65,6 +79,7 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GW
 static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER *instance);
+static bool reload_global_script(const MODULECMD_ARG *argv);
 
 /**
  * The module entry point routine. It is this routine that
@@ -76,6 +91,13 @@ static uint64_t getCapabilities(MXS_FILTER *instance);
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    modulecmd_arg_type_t args_reload[] =
+    {
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to reload"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "reload", reload_global_script, 1, args_reload);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -106,6 +128,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"global_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
             {"session_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
+            {"thread_states", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -166,6 +189,39 @@ static int lua_qc_get_operation(lua_State* state)
     return 1;
 }
 
+/**
+ * A value that the global script shares with all states
+ */
+typedef struct
+{
+    char *key;
+    char *value;
+} LUA_SHARED_VALUE;
+
+/**
+ * A loaded version of the global script. Once loaded, the script is not
+ * modified and the thread states read it without locks.
+ */
+typedef struct
+{
+    int version;              /**< Incremented each time the script is reloaded */
+    char *bytecode;           /**< The precompiled script, only with thread states */
+    size_t size;              /**< Size of the bytecode */
+    bool loaded;              /**< Whether the shared values can no longer be set */
+    int n_shared;             /**< Number of shared values */
+    LUA_SHARED_VALUE *shared; /**< The shared values, sorted by key once loaded */
+} LUA_SCRIPT;
+
+/**
+ * The state of the global script in one thread
+ */
+typedef struct
+{
+    lua_State *state;     /**< The state, NULL if the script failed to load */
+    int version;          /**< Version of the script the state was loaded from */
+    GWBUF *current_query; /**< The query being routed */
+} LUA_THREAD;
+
 /**
  * The Lua filter instance.
  */
@@ -175,6 +231,10 @@ typedef struct
     char* global_script;
     char* session_script;
     SPINLOCK lock;
+    bool thread_states;  /**< Whether each thread has its own global script state */
+    LUA_SCRIPT *script;  /**< The current version of the global script */
+    LUA_THREAD *threads; /**< The global script states of the threads */
+    int n_threads;       /**< Number of threads */
 } LUA_INSTANCE;
 
 /**
@@ -190,6 +250,366 @@ typedef struct
     MXS_UPSTREAM up;
 } LUA_SESSION;
 
+/**
+ * Expose a part of the query classifier API
+ *
+ * @param state Lua state
+ * @param query Where the query being routed is stored
+ */
+static void expose_query_classifier(lua_State *state, GWBUF **query)
+{
+    lua_pushlightuserdata(state, query);
+    lua_pushcclosure(state, lua_qc_get_type_mask, 1);
+    lua_setglobal(state, "lua_qc_get_type_mask");
+
+    lua_pushlightuserdata(state, query);
+    lua_pushcclosure(state, lua_qc_get_operation, 1);
+    lua_setglobal(state, "lua_qc_get_operation");
+}
+
+static int compare_shared_values(const void *a, const void *b)
+{
+    return strcmp(((const LUA_SHARED_VALUE*)a)->key, ((const LUA_SHARED_VALUE*)b)->key);
+}
+
+static LUA_SHARED_VALUE* find_shared_value(LUA_SCRIPT *script, const char *key)
+{
+    if (script->loaded)
+    {
+        LUA_SHARED_VALUE search = {(char*)key, NULL};
+        return bsearch(&search, script->shared, script->n_shared,
+                       sizeof(LUA_SHARED_VALUE), compare_shared_values);
+    }
+
+    for (int i = 0; i < script->n_shared; i++)
+    {
+        if (strcmp(script->shared[i].key, key) == 0)
+        {
+            return &script->shared[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Store a value that all states of the global script can read. Only the
+ * global script can set values and only while it is being loaded.
+ *
+ * @param state Lua state
+ * @return Always 0
+ */
+static int lua_shared_set(lua_State* state)
+{
+    LUA_SCRIPT *script = (LUA_SCRIPT*)lua_touserdata(state, lua_upvalueindex(1));
+    const char *key = luaL_checkstring(state, 1);
+    const char *value = luaL_checkstring(state, 2);
+
+    if (script->loaded)
+    {
+        return luaL_error(state, "Shared values can only be set when the global script is loaded");
+    }
+
+    LUA_SHARED_VALUE *shared = find_shared_value(script, key);
+
+    if (shared == NULL)
+    {
+        shared = MXS_REALLOC(script->shared, (script->n_shared + 1) * sizeof(LUA_SHARED_VALUE));
+
+        if (shared == NULL || (shared[script->n_shared].key = MXS_STRDUP(key)) == NULL)
+        {
+            script->shared = shared ? shared : script->shared;
+            return luaL_error(state, "Memory allocation failed");
+        }
+
+        script->shared = shared;
+        shared = &script->shared[script->n_shared++];
+        shared->value = NULL;
+    }
+
+    MXS_FREE(shared->value);
+
+    if ((shared->value = MXS_STRDUP(value)) == NULL)
+    {
+        return luaL_error(state, "Memory allocation failed");
+    }
+
+    return 0;
+}
+
+/**
+ * Accept a shared value in a thread state
+ *
+ * A thread state executes the global script again, including any top level
+ * calls to shared_set. The values were already stored when the script was
+ * loaded, so the arguments are only checked.
+ *
+ * @param state Lua state
+ * @return Always 0
+ */
+static int lua_shared_set_ignored(lua_State* state)
+{
+    luaL_checkstring(state, 1);
+    luaL_checkstring(state, 2);
+    return 0;
+}
+
+/**
+ * Push a value shared by the global script to the Lua state's stack
+ *
+ * @param state Lua state
+ * @return Always 1
+ */
+static int lua_shared_get(lua_State* state)
+{
+    LUA_SCRIPT *script = (LUA_SCRIPT*)lua_touserdata(state, lua_upvalueindex(1));
+    LUA_SHARED_VALUE *shared = find_shared_value(script, luaL_checkstring(state, 1));
+
+    if (shared && shared->value)
+    {
+        lua_pushstring(state, shared->value);
+    }
+    else
+    {
+        lua_pushnil(state);
+    }
+
+    return 1;
+}
+
+/**
+ * Expose the shared values of the global script
+ *
+ * @param state    Lua state
+ * @param script   The script
+ * @param writable Whether the state can set values, otherwise setting a
+ *                 value has no effect
+ */
+static void expose_shared_values(lua_State *state, LUA_SCRIPT *script, bool writable)
+{
+    lua_pushlightuserdata(state, script);
+    lua_pushcclosure(state, lua_shared_get, 1);
+    lua_setglobal(state, "shared_get");
+
+    if (writable)
+    {
+        lua_pushlightuserdata(state, script);
+        lua_pushcclosure(state, lua_shared_set, 1);
+    }
+    else
+    {
+        lua_pushcfunction(state, lua_shared_set_ignored);
+    }
+
+    lua_setglobal(state, "shared_set");
+}
+
+static void free_script(void *data)
+{
+    LUA_SCRIPT *script = (LUA_SCRIPT*)data;
+
+    if (script)
+    {
+        for (int i = 0; i < script->n_shared; i++)
+        {
+            MXS_FREE(script->shared[i].key);
+            MXS_FREE(script->shared[i].value);
+        }
+
+        MXS_FREE(script->shared);
+        MXS_FREE(script->bytecode);
+        MXS_FREE(script);
+    }
+}
+
+/**
+ * Append a part of the precompiled script to the bytecode
+ */
+static int bytecode_writer(lua_State *state, const void *data, size_t size, void *ud)
+{
+    LUA_SCRIPT *script = (LUA_SCRIPT*)ud;
+    char *bytecode = MXS_REALLOC(script->bytecode, script->size + size);
+
+    if (bytecode == NULL)
+    {
+        return 1;
+    }
+
+    memcpy(bytecode + script->size, data, size);
+    script->bytecode = bytecode;
+    script->size += size;
+    return 0;
+}
+
+/**
+ * Load the global script into a new state
+ *
+ * The script is executed once on a global level before its createInstance
+ * function is called. The values it shares are fixed after this. With thread
+ * states, the script is also precompiled for the threads.
+ *
+ * @param my_instance The filter instance
+ * @param script_out  The loaded script
+ *
+ * @return The new state or NULL on error
+ */
+static lua_State* load_global_script(LUA_INSTANCE *my_instance, LUA_SCRIPT **script_out)
+{
+    LUA_SCRIPT *script = (LUA_SCRIPT*)MXS_CALLOC(1, sizeof(LUA_SCRIPT));
+    lua_State *state = script ? luaL_newstate() : NULL;
+
+    if (state == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        MXS_FREE(script);
+        return NULL;
+    }
+
+    luaL_openlibs(state);
+    expose_shared_values(state, script, true);
+
+    const char *error = NULL;
+
+    if (luaL_loadfile(state, my_instance->global_script))
+    {
+        error = lua_tostring(state, -1);
+    }
+    else if (my_instance->thread_states && dump_function(state, bytecode_writer, script))
+    {
+        error = "Precompiling the script failed";
+    }
+    else if (lua_pcall(state, 0, 0, 0))
+    {
+        error = lua_tostring(state, -1);
+    }
+
+    if (error)
+    {
+        MXS_ERROR("Failed to execute global script at '%s':%s.",
+                  my_instance->global_script, error);
+        lua_close(state);
+        free_script(script);
+        return NULL;
+    }
+
+    lua_getglobal(state, "createInstance");
+
+    if (lua_pcall(state, 0, 0, 0))
+    {
+        MXS_WARNING("Failed to get global variable 'createInstance':  %s."
+                    " The createInstance entry point will not be called for the global script.",
+                    lua_tostring(state, -1));
+        lua_pop(state, -1); // Pop the error off the stack
+    }
+
+    expose_query_classifier(state, &current_global_query);
+
+    script->loaded = true;
+    qsort(script->shared, script->n_shared, sizeof(LUA_SHARED_VALUE), compare_shared_values);
+
+    *script_out = script;
+    return state;
+}
+
+/**
+ * Load the precompiled global script into a state for a thread
+ *
+ * @param my_instance The filter instance
+ * @param script      The script to load
+ * @param thread      The thread
+ *
+ * @return The new state or NULL on error
+ */
+static lua_State* create_thread_state(LUA_INSTANCE *my_instance, LUA_SCRIPT *script, LUA_THREAD *thread)
+{
+    lua_State *state = luaL_newstate();
+
+    if (state == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return NULL;
+    }
+
+    luaL_openlibs(state);
+    expose_shared_values(state, script, false);
+    expose_query_classifier(state, &thread->current_query);
+
+    if (luaL_loadbuffer(state, script->bytecode, script->size, my_instance->global_script) ||
+        lua_pcall(state, 0, 0, 0))
+    {
+        MXS_ERROR("Failed to execute global script at '%s' for a thread: %s.",
+                  my_instance->global_script, lua_tostring(state, -1));
+        lua_close(state);
+        state = NULL;
+    }
+
+    return state;
+}
+
+/**
+ * Get the state of the global script for a session
+ *
+ * Without thread states, all sessions share one state and the instance is
+ * locked until release_global_state() is called. With thread states, the
+ * state of the calling thread is used. It is replaced with a new one if the
+ * script has been reloaded, which is why the state never uses a retired
+ * version of the script.
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param query       Where the query being routed is stored for the state
+ *
+ * @return The state or NULL if there is none
+ */
+static lua_State* acquire_global_state(LUA_INSTANCE *my_instance, LUA_SESSION *my_session,
+                                       GWBUF ***query)
+{
+    if (my_instance->global_script == NULL)
+    {
+        return NULL;
+    }
+
+    if (!my_instance->thread_states)
+    {
+        spinlock_acquire(&my_instance->lock);
+        *query = &current_global_query;
+        return my_instance->global_lua_state;
+    }
+
+    int id = my_session->session->client_dcb->thread.id;
+    ss_dassert(id >= 0 && id < my_instance->n_threads);
+
+    LUA_THREAD *thread = &my_instance->threads[id];
+    LUA_SCRIPT *script = (LUA_SCRIPT*)atomic_load_ptr((void**)&my_instance->script);
+
+    if (thread->version != script->version)
+    {
+        if (thread->state)
+        {
+            lua_close(thread->state);
+        }
+
+        thread->state = create_thread_state(my_instance, script, thread);
+        thread->version = script->version;
+    }
+
+    *query = &thread->current_query;
+    return thread->state;
+}
+
+/**
+ * Release a state acquired with acquire_global_state()
+ *
+ * @param my_instance The filter instance
+ */
+static void release_global_state(LUA_INSTANCE *my_instance)
+{
+    if (!my_instance->thread_states)
+    {
+        spinlock_release(&my_instance->lock);
+    }
+}
+
 /**
  * Create a new instance of the Lua filter.
  *
@@ -213,48 +633,32 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     my_instance->global_script = config_copy_string(params, "global_script");
     my_instance->session_script = config_copy_string(params, "session_script");
+    my_instance->thread_states = config_get_bool(params, "thread_states");
 
     if (my_instance->global_script)
     {
-        if ((my_instance->global_lua_state = luaL_newstate()))
+        if ((my_instance->global_lua_state = load_global_script(my_instance, &my_instance->script)))
         {
-            luaL_openlibs(my_instance->global_lua_state);
+            my_instance->script->version = 1;
+        }
 
-            if (luaL_dofile(my_instance->global_lua_state, my_instance->global_script))
+        if (my_instance->global_lua_state && my_instance->thread_states)
+        {
+            my_instance->n_threads = config_threadcount();
+            my_instance->threads = (LUA_THREAD*)MXS_CALLOC(my_instance->n_threads, sizeof(LUA_THREAD));
+        }
+
+        if (my_instance->global_lua_state == NULL ||
+            (my_instance->thread_states && my_instance->threads == NULL))
+        {
+            if (my_instance->global_lua_state)
             {
-                MXS_ERROR("Failed to execute global script at '%s':%s.",
-                          my_instance->global_script, lua_tostring(my_instance->global_lua_state, -1));
-                MXS_FREE(my_instance->global_script);
-                MXS_FREE(my_instance->session_script);
-                MXS_FREE(my_instance);
-                my_instance = NULL;
+                lua_close(my_instance->global_lua_state);
             }
-            else if (my_instance->global_lua_state)
-            {
-                lua_getglobal(my_instance->global_lua_state, "createInstance");
 
-                if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
-                {
-                    MXS_WARNING("Failed to get global variable 'createInstance':  %s."
-                                " The createInstance entry point will not be called for the global script.",
-                                lua_tostring(my_instance->global_lua_state, -1));
-                    lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
-                }
-
-                /** Expose a part of the query classifier API */
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_type_mask, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_type_mask");
-
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_operation, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_operation");
-
-            }
-        }
-        else
-        {
-            MXS_ERROR("Unable to initialize new Lua state.");
+            free_script(my_instance->script);
+            MXS_FREE(my_instance->global_script);
+            MXS_FREE(my_instance->session_script);
             MXS_FREE(my_instance);
             my_instance = NULL;
         }
@@ -313,13 +717,7 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
             lua_setglobal(my_session->lua_state, "id_gen");
 
             /** Expose a part of the query classifier API */
-            lua_pushlightuserdata(my_session->lua_state, &my_session->current_query);
-            lua_pushcclosure(my_session->lua_state, lua_qc_get_type_mask, 1);
-            lua_setglobal(my_session->lua_state, "lua_qc_get_type_mask");
-
-            lua_pushlightuserdata(my_session->lua_state, &my_session->current_query);
-            lua_pushcclosure(my_session->lua_state, lua_qc_get_operation, 1);
-            lua_setglobal(my_session->lua_state, "lua_qc_get_operation");
+            expose_query_classifier(my_session->lua_state, &my_session->current_query);
 
             /** Call the newSession entry point */
             lua_getglobal(my_session->lua_state, "newSession");
@@ -336,23 +734,24 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
         }
     }
 
-    if (my_session && my_instance->global_lua_state)
-    {
-        spinlock_acquire(&my_instance->lock);
+    GWBUF **query;
+    lua_State *state;
 
-        lua_getglobal(my_instance->global_lua_state, "newSession");
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->user);
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->remote);
+    if (my_session && (state = acquire_global_state(my_instance, my_session, &query)))
+    {
+        lua_getglobal(state, "newSession");
+        lua_pushstring(state, session->client_dcb->user);
+        lua_pushstring(state, session->client_dcb->remote);
 
-        if (lua_pcall(my_instance->global_lua_state, 2, 0, 0))
+        if (lua_pcall(state, 2, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'newSession': '%s'."
                         " The newSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
+                        lua_tostring(state, -1));
+            lua_pop(state, -1); // Pop the error off the stack
         }
 
-        spinlock_release(&my_instance->lock);
+        release_global_state(my_instance);
     }
 
     return (MXS_FILTER_SESSION*)my_session;
@@ -388,20 +787,21 @@ static void closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
         spinlock_release(&my_session->lock);
     }
 
-    if (my_instance->global_lua_state)
-    {
-        spinlock_acquire(&my_instance->lock);
+    GWBUF **query;
+    lua_State *state = acquire_global_state(my_instance, my_session, &query);
 
-        lua_getglobal(my_instance->global_lua_state, "closeSession");
+    if (state)
+    {
+        lua_getglobal(state, "closeSession");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(state, 0, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+                        lua_tostring(state, -1));
+            lua_pop(state, -1);
         }
-        spinlock_release(&my_instance->lock);
+        release_global_state(my_instance);
     }
 }
 
@@ -478,20 +878,21 @@ static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GW
 
         spinlock_release(&my_session->lock);
     }
-    if (my_instance->global_lua_state)
-    {
-        spinlock_acquire(&my_instance->lock);
+    GWBUF **query;
+    lua_State *state = acquire_global_state(my_instance, my_session, &query);
 
-        lua_getglobal(my_instance->global_lua_state, "clientReply");
+    if (state)
+    {
+        lua_getglobal(state, "clientReply");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(state, 0, 0, 0))
         {
             MXS_ERROR("Global scope call to 'clientReply' failed: '%s'.",
-                      lua_tostring(my_session->lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+                      lua_tostring(state, -1));
+            lua_pop(state, -1);
         }
 
-        spinlock_release(&my_instance->lock);
+        release_global_state(my_instance);
     }
 
     return my_session->up.clientReply(my_session->up.instance,
@@ -564,36 +965,38 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
             spinlock_release(&my_session->lock);
         }
 
-        if (my_instance->global_lua_state)
+        GWBUF **query;
+        lua_State *state;
+
+        if (fullquery && (state = acquire_global_state(my_instance, my_session, &query)))
         {
-            spinlock_acquire(&my_instance->lock);
-            current_global_query = queue;
+            *query = queue;
 
-            lua_getglobal(my_instance->global_lua_state, "routeQuery");
+            lua_getglobal(state, "routeQuery");
 
-            lua_pushlstring(my_instance->global_lua_state, fullquery, strlen(fullquery));
+            lua_pushlstring(state, fullquery, strlen(fullquery));
 
-            if (lua_pcall(my_instance->global_lua_state, 1, 0, 0))
+            if (lua_pcall(state, 1, 0, 0))
             {
                 MXS_ERROR("Global scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_instance->global_lua_state, -1));
-                lua_pop(my_instance->global_lua_state, -1);
+                          lua_tostring(state, -1));
+                lua_pop(state, -1);
             }
-            else if (lua_gettop(my_instance->global_lua_state))
+            else if (lua_gettop(state))
             {
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                if (lua_isstring(state, -1))
                 {
                     gwbuf_free(forward);
-                    forward = modutil_create_query(lua_tostring(my_instance->global_lua_state, -1));
+                    forward = modutil_create_query(lua_tostring(state, -1));
                 }
-                else if (lua_isboolean(my_instance->global_lua_state, -1))
+                else if (lua_isboolean(state, -1))
                 {
-                    route = lua_toboolean(my_instance->global_lua_state, -1);
+                    route = lua_toboolean(state, -1);
                 }
             }
 
-            current_global_query = NULL;
-            spinlock_release(&my_instance->lock);
+            *query = NULL;
+            release_global_state(my_instance);
         }
 
         MXS_FREE(fullquery);
@@ -656,6 +1059,13 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
         {
             dcb_printf(dcb, "Global script: %s\n", my_instance->global_script);
         }
+        if (my_instance->thread_states)
+        {
+            spinlock_acquire(&my_instance->lock);
+            dcb_printf(dcb, "Global script version: %d\n", my_instance->script->version);
+            dcb_printf(dcb, "Shared values: %d\n", my_instance->script->n_shared);
+            spinlock_release(&my_instance->lock);
+        }
         if (my_instance->session_script)
         {
             dcb_printf(dcb, "Session script: %s\n", my_instance->session_script);
@@ -672,3 +1082,59 @@ static uint64_t getCapabilities(MXS_FILTER *instance)
 {
     return RCAP_TYPE_CONTIGUOUS_INPUT;
 }
+
+/**
+ * Reload the global script
+ *
+ * The script is loaded into a new state that replaces the current one. With
+ * thread states, each thread replaces its state when it next calls the script
+ * and the previous version is freed once no thread can be using it.
+ *
+ * @param argv The filter to reload
+ * @return True if the script was reloaded
+ */
+static bool reload_global_script(const MODULECMD_ARG *argv)
+{
+    MXS_FILTER_DEF *filter = argv->argv[0].value.filter;
+    LUA_INSTANCE *my_instance = (LUA_INSTANCE*)filter_def_get_instance(filter);
+
+    if (my_instance->global_script == NULL)
+    {
+        modulecmd_set_error("The filter has no global script");
+        return false;
+    }
+
+    LUA_SCRIPT *script;
+    lua_State *state = load_global_script(my_instance, &script);
+
+    if (state == NULL)
+    {
+        modulecmd_set_error("Failed to load global script at '%s'. See log "
+                            "file for more details.", my_instance->global_script);
+        return false;
+    }
+
+    spinlock_acquire(&my_instance->lock);
+
+    lua_State *old_state = my_instance->global_lua_state;
+    LUA_SCRIPT *old_script = my_instance->script;
+    script->version = old_script->version + 1;
+    my_instance->global_lua_state = state;
+    atomic_store_ptr((void**)&my_instance->script, script);
+
+    spinlock_release(&my_instance->lock);
+
+    lua_close(old_state);
+
+    if (my_instance->thread_states)
+    {
+        mxs_rcu_retire(old_script, free_script);
+    }
+    else
+    {
+        free_script(old_script);
+    }
+
+    MXS_NOTICE("Reloaded global script at '%s'.", my_instance->global_script);
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testluafilter.c - Tests for the global script of the Lua filter
+ */
+
+// The tested functions are static
+#include "../luafilter.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <maxscale/debug.h>
+#include <maxscale/log_manager.h>
+
+static const char shared_script[] =
+    "shared_set(\"greeting\", \"hello\")\n"
+    "\n"
+    "function createInstance()\n"
+    "    shared_set(\"answer\", \"42\")\n"
+    "end\n";
+
+/**
+ * Write a script into a temporary file
+ *
+ * @param contents The script
+ * @return The name of the file, to be freed by the caller
+ */
+static char* write_script(const char *contents)
+{
+    char *name = MXS_STRDUP_A("/tmp/testluafilter_XXXXXX");
+    int fd = mkstemp(name);
+    ss_dassert(fd != -1);
+
+    ssize_t len = strlen(contents);
+    ssize_t written = write(fd, contents, len);
+    ss_info_dassert(written == len, "Writing the script should succeed");
+    close(fd);
+
+    return name;
+}
+
+/** A thread state executes top level calls of shared_set without failing */
+static int test_thread_state_shared_set()
+{
+    char *name = write_script(shared_script);
+    LUA_INSTANCE instance = {0};
+    instance.global_script = name;
+    instance.thread_states = true;
+
+    LUA_SCRIPT *script = NULL;
+    lua_State *global = load_global_script(&instance, &script);
+    ss_info_dassert(global && script, "Global script should load");
+
+    LUA_THREAD thread = {0};
+    lua_State *state = create_thread_state(&instance, script, &thread);
+    ss_info_dassert(state, "Thread state should execute the global script");
+
+    lua_getglobal(state, "shared_get");
+    lua_pushstring(state, "greeting");
+    lua_call(state, 1, 1);
+    ss_info_dassert(lua_isstring(state, -1) && strcmp(lua_tostring(state, -1), "hello") == 0,
+                    "Thread state should see the value set on a global level");
+    lua_pop(state, 1);
+
+    lua_getglobal(state, "shared_get");
+    lua_pushstring(state, "answer");
+    lua_call(state, 1, 1);
+    ss_info_dassert(lua_isstring(state, -1) && strcmp(lua_tostring(state, -1), "42") == 0,
+                    "Thread state should see the value set in createInstance");
+    lua_pop(state, 1);
+
+    lua_close(state);
+    lua_close(global);
+    free_script(script);
+    unlink(name);
+    MXS_FREE(name);
+
+    return 0;
+}
+
+int main()
+{
+    int rc = EXIT_FAILURE;
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        rc = test_thread_state_shared_set();
+        mxs_log_finish();
+    }
+
+    return rc;
+}
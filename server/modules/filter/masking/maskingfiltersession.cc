@@ -18,8 +18,8 @@
 #include <maxscale/filter.hh>
 #include <maxscale/mysql_utils.h>
 #include <maxscale/protocol/mysql.h>
+#include <maxscale/protocol/mysql.hh>
 #include "maskingfilter.hh"
-#include "mysql.hh"
 
 using maxscale::Buffer;
 using std::ostream;
@@ -152,20 +152,7 @@ void MaskingFilterSession::handle_field(GWBUF* pPacket)
     }
     else
     {
-        const char *zUser = session_get_user(m_pSession);
-        const char *zHost = session_get_remote(m_pSession);
-
-        if (!zUser)
-        {
-            zUser = "";
-        }
-
-        if (!zHost)
-        {
-            zHost = "";
-        }
-
-        const MaskingRules::Rule* pRule = m_res.rules()->get_rule_for(column_def, zUser, zHost);
+        const MaskingRules::Rule* pRule = get_rule_for(column_def);
 
         if (m_res.append_type_and_rule(column_def.type(), pRule))
         {
@@ -175,6 +162,70 @@ void MaskingFilterSession::handle_field(GWBUF* pPacket)
     }
 }
 
+namespace
+{
+
+void append_key_part(string& key, const LEncString& part)
+{
+    // NULL and the empty string match the same rules.
+    if (part.length() != 0)
+    {
+        key += part.to_string();
+    }
+
+    key += '\0';
+}
+
+}
+
+const MaskingRules::Rule* MaskingFilterSession::get_rule_for(const ComQueryResponse::ColumnDef& column_def)
+{
+    const char *zUser = session_get_user(m_pSession);
+    const char *zHost = session_get_remote(m_pSession);
+
+    if (!zUser)
+    {
+        zUser = "";
+    }
+
+    if (!zHost)
+    {
+        zHost = "";
+    }
+
+    if ((m_sColumn_rules_source != m_res.rules()) ||
+        (m_column_rules_user != zUser) ||
+        (m_column_rules_host != zHost) ||
+        (m_column_rules.size() >= MAX_COLUMN_RULES))
+    {
+        // The rules have been reloaded or the user has changed.
+        m_column_rules.clear();
+        m_sColumn_rules_source = m_res.rules();
+        m_column_rules_user = zUser;
+        m_column_rules_host = zHost;
+    }
+
+    string key;
+    append_key_part(key, column_def.schema());
+    append_key_part(key, column_def.org_table());
+    append_key_part(key, column_def.org_name());
+
+    const MaskingRules::Rule* pRule;
+    ColumnRules::const_iterator i = m_column_rules.find(key);
+
+    if (i != m_column_rules.end())
+    {
+        pRule = i->second;
+    }
+    else
+    {
+        pRule = m_res.rules()->get_rule_for(column_def, zUser, zHost);
+        m_column_rules.insert(std::make_pair(key, pRule));
+    }
+
+    return pRule;
+}
+
 void MaskingFilterSession::handle_eof(GWBUF* pPacket)
 {
     ComResponse response(pPacket);
@@ -273,10 +324,12 @@ void MaskingFilterSession::mask_values(ComPacket& response)
         {
             ComQueryResponse::TextResultsetRow row(response, m_res.types());
 
+            // The values after the last masked one are not even looked at.
+            uint32_t nMasked = m_res.masked_fields();
             ComQueryResponse::TextResultsetRow::iterator i = row.begin();
-            while (i != row.end())
+            for (uint32_t index = 0; index < nMasked && i != row.end(); ++index)
             {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
+                const MaskingRules::Rule* pRule = m_res.get_rule(index);
 
                 if (pRule)
                 {
@@ -301,10 +354,12 @@ void MaskingFilterSession::mask_values(ComPacket& response)
         {
             ComQueryResponse::BinaryResultsetRow row(response, m_res.types());
 
+            // The values after the last masked one are not even looked at.
+            uint32_t nMasked = m_res.masked_fields();
             ComQueryResponse::BinaryResultsetRow::iterator i = row.begin();
-            while (i != row.end())
+            for (uint32_t index = 0; index < nMasked && i != row.end(); ++index)
             {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
+                const MaskingRules::Rule* pRule = m_res.get_rule(index);
 
                 if (pRule)
                 {
@@ -14,7 +14,9 @@
 
 #include <maxscale/cppdefs.hh>
 #include <memory>
+#include <string>
 #include <tr1/memory>
+#include <tr1/unordered_map>
 #include <maxscale/buffer.hh>
 #include <maxscale/filter.hh>
 #include "maskingrules.hh"
@@ -61,16 +63,31 @@ private:
 
     void mask_values(ComPacket& response);
 
+    const MaskingRules::Rule* get_rule_for(const ComQueryResponse::ColumnDef& column_def);
+
 private:
     typedef std::tr1::shared_ptr<MaskingRules> SMaskingRules;
 
+    /**
+     * The rules that apply to the columns seen by the session, keyed by the
+     * schema, table and name of the column. The rules depend only on these
+     * and on the user, so the rules need not be checked again for each
+     * result set of a query.
+     */
+    typedef std::tr1::unordered_map<std::string, const MaskingRules::Rule*> ColumnRules;
+
+    enum
+    {
+        MAX_COLUMN_RULES = 1000 // The number of columns after which the cache is cleared.
+    };
+
     class ResponseState
     {
     public:
         ResponseState()
             : m_command(0)
             , m_nTotal_fields(0)
-            , m_index(0)
+            , m_nMasked_fields(0)
             , m_multi_result(false)
             , m_some_rule_matches(false)
         {}
@@ -90,7 +107,7 @@ private:
             m_nTotal_fields = 0;
             m_types.clear();
             m_rules.clear();
-            m_index = 0;
+            m_nMasked_fields = 0;
             m_multi_result = true;
         }
 
@@ -132,6 +149,7 @@ private:
             if (pRule)
             {
                 m_some_rule_matches = true;
+                m_nMasked_fields = m_rules.size();
             }
 
             return m_rules.size() == m_nTotal_fields;
@@ -142,15 +160,20 @@ private:
             return m_types;
         }
 
-        const MaskingRules::Rule* get_rule()
+        /**
+         * @return The number of fields up to and including the last one
+         *         that is masked. Values after them need not be looked at.
+         */
+        uint32_t masked_fields() const
+        {
+            return m_nMasked_fields;
+        }
+
+        const MaskingRules::Rule* get_rule(size_t index) const
         {
             ss_dassert(m_nTotal_fields == m_rules.size());
-            ss_dassert(m_index < m_rules.size());
-            const MaskingRules::Rule* pRule = m_rules[m_index++];
-            // The rules will be used repeatedly for each row. Hence, once we hit
-            // the end, we need to continue from the start.
-            m_index = m_index % m_rules.size();
-            return pRule;
+            ss_dassert(index < m_rules.size());
+            return m_rules[index];
         }
 
     private:
@@ -159,7 +182,7 @@ private:
         uint32_t                               m_nTotal_fields;     /*<! The total number of fields. */
         std::vector<enum_field_types>          m_types;             /*<! The column types. */
         std::vector<const MaskingRules::Rule*> m_rules;             /*<! The rules applied for columns. */
-        size_t                                 m_index;             /*<! Index to the current rule.*/
+        uint32_t                               m_nMasked_fields;    /*<! Fields up to the last masked one. */
         bool                                   m_multi_result;      /*<! Are we processing multi-results. */
         bool                                   m_some_rule_matches; /*<! At least one rule matches. */
     };
@@ -167,4 +190,8 @@ private:
     const MaskingFilter& m_filter;
     state_t              m_state;
     ResponseState        m_res;
+    SMaskingRules        m_sColumn_rules_source; /*<! The rules m_column_rules refers to. */
+    std::string          m_column_rules_user;    /*<! The user m_column_rules applies to. */
+    std::string          m_column_rules_host;    /*<! The host m_column_rules applies to. */
+    ColumnRules          m_column_rules;         /*<! The rules of the columns seen so far. */
 };
@@ -18,7 +18,7 @@
 #include <string>
 #include <vector>
 #include <jansson.h>
-#include "mysql.hh"
+#include <maxscale/protocol/mysql.hh>
 
 /**
  * @class MaskingRules
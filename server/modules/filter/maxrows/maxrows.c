@@ -146,6 +146,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_ENUM_UNIQUE,
                 return_option_values
             },
+            {
+                "streaming",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -161,6 +166,7 @@ typedef struct maxrows_config
     uint32_t        max_resultset_size;
     uint32_t                     debug;
     enum maxrows_return_mode  m_return;
+    bool                      streaming; /**< Forward results as they arrive */
 } MAXROWS_CONFIG;
 
 typedef struct maxrows_instance
@@ -202,6 +208,9 @@ typedef struct maxrows_session_data
     bool                    large_packet;      /**< Large packet (> 16MB)) indicator */
     bool                    discard_resultset; /**< Discard resultset indicator */
     GWBUF                   *input_sql;        /**< Input query */
+    size_t                  n_bytes;           /**< Bytes of the response forwarded when streaming */
+    uint8_t                 last_seq;          /**< Sequence number of the last forwarded packet */
+    uint16_t                status;            /**< Server status of the last EOF packet */
 } MAXROWS_SESSION_DATA;
 
 static MAXROWS_SESSION_DATA *maxrows_session_data_create(MAXROWS_INSTANCE *instance,
@@ -213,6 +222,7 @@ static int handle_expecting_nothing(MAXROWS_SESSION_DATA *csdata);
 static int handle_expecting_response(MAXROWS_SESSION_DATA *csdata);
 static int handle_rows(MAXROWS_SESSION_DATA *csdata, GWBUF* buffer, size_t extra_offset);
 static int handle_ignoring_response(MAXROWS_SESSION_DATA *csdata);
+static int handle_streaming(MAXROWS_SESSION_DATA *csdata, GWBUF *data);
 static bool process_params(char **options,
                            MXS_CONFIG_PARAMETER *params,
                            MAXROWS_CONFIG* config);
@@ -251,6 +261,7 @@ static MXS_FILTER *createInstance(const char *name,
                                                      "max_resultset_return",
                                                      return_option_values);
         cinstance->config.debug = config_get_integer(params, "debug");
+        cinstance->config.streaming = config_get_bool(params, "streaming");
     }
 
     return (MXS_FILTER*)cinstance;
@@ -354,6 +365,7 @@ static int routeQuery(MXS_FILTER *instance,
     csdata->state = MAXROWS_IGNORING_RESPONSE;
     csdata->large_packet = false;
     csdata->discard_resultset = false;
+    csdata->n_bytes = 0;
     // Set buffer size to 0
     csdata->res.length = 0;
 
@@ -413,6 +425,13 @@ static int clientReply(MXS_FILTER *instance,
 
     int rv;
 
+    if (csdata->instance->config.streaming &&
+        csdata->state != MAXROWS_IGNORING_RESPONSE &&
+        csdata->state != MAXROWS_EXPECTING_NOTHING)
+    {
+        return handle_streaming(csdata, data);
+    }
+
     if (csdata->res.data)
     {
         if (csdata->discard_resultset &&
@@ -569,6 +588,8 @@ static void maxrows_session_data_free(MAXROWS_SESSION_DATA* data)
 {
     if (data)
     {
+        gwbuf_free(data->res.data);
+        gwbuf_free(data->input_sql);
         MXS_FREE(data);
     }
 }
@@ -1173,15 +1194,15 @@ static int send_ok_upstream(MAXROWS_SESSION_DATA *csdata)
 }
 
 /**
- * Send ERR packet data upstream.
+ * Create the ERR packet that is sent when the limit is hit. The message
+ * contains a prefix and the original SQL input.
  *
- * An error packet is sent to client including
- * a message prefix plus the original SQL input
+ * @param csdata Session data
+ * @param seq    Sequence number of the packet
  *
- * @param   csdata    Session data
- * @return            Non-Zero if successful, 0 on errors
+ * @return The packet or NULL on errors
  */
-static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
+static GWBUF* create_error_packet(MAXROWS_SESSION_DATA *csdata, uint8_t seq)
 {
     GWBUF *err_pkt;
     uint8_t hdr_err[MYSQL_ERR_PACKET_MIN_LEN];
@@ -1199,8 +1220,6 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
               MAXROWS_INPUT_SQL_MAX_LEN : sql_len;
     uint8_t sql[sql_len];
 
-    ss_dassert(csdata->res.data != NULL);
-
     pkt_len += sql_len;
 
     bytes_copied = gwbuf_copy_data(csdata->input_sql,
@@ -1211,14 +1230,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
     if (!bytes_copied ||
         (err_pkt = gwbuf_alloc(MYSQL_HEADER_LEN + pkt_len)) == NULL)
     {
-        /* Abort client connection */
-        poll_fake_hangup_event(csdata->session->client_dcb);
-        gwbuf_free(csdata->res.data);
-        gwbuf_free(csdata->input_sql);
-        csdata->res.data = NULL;
-        csdata->input_sql = NULL;
-
-        return 0;
+        return NULL;
     }
 
     uint8_t *ptr = GWBUF_DATA(err_pkt);
@@ -1228,8 +1240,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
 
     /* Set the payload length of the whole error message */
     gw_mysql_set_byte3(&ptr[0], pkt_len);
-    /* Note: sequence id is always 01 (4th byte) */
-    ptr[3] = 1;
+    ptr[3] = seq;
     /* Error indicator */
     ptr[4] = 0xff;
     /* MySQL error code: 2 bytes */
@@ -1241,6 +1252,37 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
     /* Copy SQL input */
     memcpy(&ptr[13 +  err_prefix_len], sql, sql_len);
 
+    return err_pkt;
+}
+
+/**
+ * Send ERR packet data upstream.
+ *
+ * An error packet is sent to client including
+ * a message prefix plus the original SQL input
+ *
+ * @param   csdata    Session data
+ * @return            Non-Zero if successful, 0 on errors
+ */
+static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
+{
+    ss_dassert(csdata->res.data != NULL);
+
+    /* Note: sequence id is always 01 (4th byte) */
+    GWBUF *err_pkt = create_error_packet(csdata, 1);
+
+    if (err_pkt == NULL)
+    {
+        /* Abort client connection */
+        poll_fake_hangup_event(csdata->session->client_dcb);
+        gwbuf_free(csdata->res.data);
+        gwbuf_free(csdata->input_sql);
+        csdata->res.data = NULL;
+        csdata->input_sql = NULL;
+
+        return 0;
+    }
+
     int rv = csdata->up.clientReply(csdata->up.instance,
                                     csdata->up.session,
                                     err_pkt);
@@ -1283,3 +1325,188 @@ static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
             break;
     }
 }
+
+/**
+ * Create the packet that ends a streamed response when the limit is hit:
+ * an ERR packet if errors are returned, otherwise an EOF packet that ends
+ * the result set after the rows sent so far.
+ *
+ * @param csdata Session data
+ *
+ * @return The packet or NULL on errors
+ */
+static GWBUF* create_stream_terminator(MAXROWS_SESSION_DATA *csdata)
+{
+    uint8_t seq = csdata->last_seq + 1;
+
+    if (csdata->instance->config.m_return == MAXROWS_RETURN_ERR)
+    {
+        return create_error_packet(csdata, seq);
+    }
+
+    uint8_t eof[MYSQL_EOF_PACKET_LEN] = {05, 00, 00, seq, 0xfe, 00, 00, 00, 00};
+    gw_mysql_set_byte2(eof + MAXROWS_MYSQL_EOF_PACKET_FLAGS_OFFSET,
+                       csdata->status & ~SERVER_MORE_RESULTS_EXIST);
+
+    return gwbuf_alloc_and_load(MYSQL_EOF_PACKET_LEN, eof);
+}
+
+/**
+ * Get the server status of an OK packet
+ *
+ * @param packet The OK packet
+ *
+ * @return The server status or 0 if the packet is too short
+ */
+static uint16_t ok_status(GWBUF *packet)
+{
+    // Command byte, two length encoded integers and the status
+    uint8_t ok[MYSQL_HEADER_LEN + 1 + 9 + 9 + 2] = {};
+    size_t len = gwbuf_copy_data(packet, 0, sizeof(ok), ok);
+    size_t offset = MYSQL_HEADER_LEN + 1;
+
+    offset += mxs_leint_bytes(ok + offset);
+    offset += mxs_leint_bytes(ok + offset);
+
+    return offset + 2 <= len ? gw_mysql_get_byte2(ok + offset) : 0;
+}
+
+/**
+ * Handle a part of the response in streaming mode. Complete packets are
+ * forwarded as they arrive and only an incomplete packet is kept. When the
+ * limit is hit, the result set is ended and the rest of the response is
+ * discarded.
+ *
+ * @param csdata Session data
+ * @param data   The next part of the response
+ *
+ * @return Whatever the upstream returns, 1 if nothing was sent
+ */
+static int handle_streaming(MAXROWS_SESSION_DATA *csdata, GWBUF *data)
+{
+    MAXROWS_CONFIG *config = &csdata->instance->config;
+    GWBUF *out = NULL;
+    GWBUF *packet;
+    bool end = false;
+
+    csdata->res.data = gwbuf_append(csdata->res.data, data);
+
+    while (!end && (packet = modutil_get_next_MySQL_packet(&csdata->res.data)))
+    {
+        uint8_t header[MYSQL_EOF_PACKET_LEN] = {};
+        gwbuf_copy_data(packet, 0, MYSQL_EOF_PACKET_LEN, header);
+
+        size_t packetlen = gwbuf_length(packet);
+        bool continuation = csdata->large_packet;
+        uint8_t command = continuation ? 0 : MYSQL_GET_COMMAND(header);
+        bool more = false;
+
+        csdata->large_packet = packetlen == MYSQL_PACKET_LENGTH_MAX + MYSQL_HEADER_LEN;
+
+        if (continuation)
+        {
+            // The rest of a large packet goes where its beginning went
+        }
+        else if (command == 0xff || (command == 0x00 && csdata->state == MAXROWS_EXPECTING_RESPONSE))
+        {
+            // ERR or OK ends the response unless more results follow the OK
+            more = command == 0x00 && (ok_status(packet) & SERVER_MORE_RESULTS_EXIST);
+            end = !more;
+        }
+        else if (command == 0xfb && csdata->state == MAXROWS_EXPECTING_RESPONSE)
+        {
+            // GET_MORE_CLIENT_DATA, the rest is not a result set
+            end = true;
+        }
+        else if (command == 0xfe && packetlen == MYSQL_EOF_PACKET_LEN &&
+                 csdata->state != MAXROWS_EXPECTING_RESPONSE)
+        {
+            csdata->status = gw_mysql_get_byte2(header + MAXROWS_MYSQL_EOF_PACKET_FLAGS_OFFSET);
+
+            if (csdata->state == MAXROWS_EXPECTING_FIELDS)
+            {
+                csdata->state = MAXROWS_EXPECTING_ROWS;
+            }
+            else
+            {
+                more = csdata->status & SERVER_MORE_RESULTS_EXIST;
+                end = !more;
+
+                if (config->debug & MAXROWS_DEBUG_DECISIONS)
+                {
+                    MXS_NOTICE("EOF packet seen: the resultset has %lu rows.%s",
+                               csdata->res.n_rows,
+                               csdata->discard_resultset ? " [Discarded]" : "");
+                }
+            }
+        }
+        else if (csdata->state == MAXROWS_EXPECTING_RESPONSE)
+        {
+            // The column count of a new result set
+            csdata->state = MAXROWS_EXPECTING_FIELDS;
+            csdata->res.n_rows = 0;
+        }
+        else if (csdata->state == MAXROWS_EXPECTING_ROWS && !csdata->discard_resultset &&
+                 (++csdata->res.n_rows > config->max_resultset_rows ||
+                  csdata->n_bytes + packetlen > config->max_resultset_size))
+        {
+            if (config->debug & MAXROWS_DEBUG_DISCARDING)
+            {
+                MXS_INFO("Limit reached after %lu rows and %luB, ending the resultset.",
+                         csdata->res.n_rows - 1, csdata->n_bytes);
+            }
+
+            GWBUF *terminator = create_stream_terminator(csdata);
+
+            if (terminator == NULL)
+            {
+                gwbuf_free(packet);
+                gwbuf_free(out);
+                poll_fake_hangup_event(csdata->session->client_dcb);
+                return 0;
+            }
+
+            out = gwbuf_append(out, terminator);
+            csdata->discard_resultset = true;
+        }
+
+        if (more)
+        {
+            csdata->state = MAXROWS_EXPECTING_RESPONSE;
+        }
+
+        if (csdata->discard_resultset)
+        {
+            gwbuf_free(packet);
+        }
+        else
+        {
+            csdata->last_seq = MYSQL_GET_PACKET_NO(header);
+            csdata->n_bytes += packetlen;
+            out = gwbuf_append(out, packet);
+        }
+    }
+
+    if (end)
+    {
+        // Anything after the end of the response is passed on as it is
+        csdata->state = MAXROWS_IGNORING_RESPONSE;
+        gwbuf_free(csdata->input_sql);
+        csdata->input_sql = NULL;
+
+        if (csdata->res.data)
+        {
+            out = gwbuf_append(out, csdata->res.data);
+            csdata->res.data = NULL;
+        }
+    }
+
+    int rv = 1;
+
+    if (out)
+    {
+        rv = csdata->up.clientReply(csdata->up.instance, csdata->up.session, out);
+    }
+
+    return rv;
+}
@@ -46,6 +46,8 @@
  *      ssl_CA_cert     Path to the CA certificate in PEM format
  *      ssl_client_cert Path to the client cerificate in PEM format
  *      ssl_client_key  Path to the client public key in PEM format
+ *      buffer_size     Size of the queue of messages of each worker thread
+ *      batch_size      Number of messages published before waiting for their confirmations
  *
  * The logging trigger levels are:
  *      all     Log everything
@@ -55,6 +57,14 @@
  *      object  Trigger on a particular database object (table or view)
  *@endverbatim
  * See the individual struct documentations for logging trigger parameters
+ *
+ * The messages are not published by the worker threads. Each worker thread
+ * adds its messages to a queue of its own from where a sender thread of the
+ * filter instance publishes them with publisher confirms enabled. A message
+ * is removed from the queue only once the broker has confirmed it, so the
+ * messages that are unconfirmed when the connection is lost are published
+ * again after reconnecting. If the queue of a worker thread is full, the
+ * message is dropped.
  */
 
 #define MXS_MODULE_NAME "mqfilter"
@@ -75,13 +85,20 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/query_classifier.h>
-#include <maxscale/spinlock.h>
 #include <maxscale/session.h>
-#include <maxscale/housekeeper.h>
 #include <maxscale/alloc.h>
+#include <maxscale/thread.h>
+
+/** Length of the identifier that pairs the queries and replies of a session */
+#define MQ_UID_LEN 32
+
+/** How long the sender sleeps when there is nothing to publish */
+#define MQ_SENDER_IDLE_MS 10
+
+/** How long the sender waits for the broker to confirm the published messages */
+#define MQ_CONFIRM_TIMEOUT 10
 
 static int uid_gen;
-static int hktask_id = 0;
 /*
  * The filter entry points
  */
@@ -97,14 +114,29 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
 static uint64_t getCapabilities(MXS_FILTER *instance);
 
 /**
- *Structure used to store messages and their properties.
+ * The messages of a worker thread waiting to be published. The worker is the
+ * only one advancing the head and the sender the only one advancing the tail,
+ * so no locks are needed.
+ */
+typedef struct mq_ring
+{
+    char     *data;    /*< The messages */
+    uint64_t  size;    /*< The size of the data */
+    uint64_t  head;    /*< The total number of bytes added */
+    uint64_t  tail;    /*< The total number of bytes published and confirmed */
+    uint64_t  added;   /*< The number of messages added */
+    uint64_t  dropped; /*< The number of messages dropped because the ring was full */
+} MQ_RING;
+
+/**
+ * The header of a message in a ring, followed by @c len bytes of text.
  */
-typedef struct mqmessage_t
+typedef struct mq_record
 {
-    amqp_basic_properties_t *prop;
-    char *msg;
-    struct mqmessage_t *next;
-} mqmessage;
+    uint32_t len;                 /*< The length of the text */
+    bool     reply;               /*< Whether the message is a reply instead of a query */
+    char     uid[MQ_UID_LEN + 1]; /*< The identifier of the query and reply */
+} MQ_RECORD;
 
 /**
  *Logging trigger levels
@@ -170,9 +202,8 @@ typedef struct object_trigger_t
  */
 typedef struct mqstats_t
 {
-    int n_msg; /*< Total number of messages */
-    int n_sent; /*< Number of sent messages */
-    int n_queued; /*< Number of unsent messages */
+    uint64_t n_sent; /*< Number of messages confirmed by the broker */
+    uint64_t n_nacked; /*< Number of messages the broker failed to handle */
 } MQSTATS;
 
 /**
@@ -208,9 +239,13 @@ typedef struct
     int conn_stat; /**state of the connection to the server*/
     int rconn_intv; /**delay for reconnects, in seconds*/
     time_t last_rconn; /**last reconnect attempt*/
-    SPINLOCK rconn_lock;
-    SPINLOCK msg_lock;
-    mqmessage* messages;
+    uint64_t delivery_tag; /**tag of the last published message on the channel*/
+    uint64_t confirmed; /**highest tag the broker has confirmed on the channel*/
+    MQ_RING* rings; /**the queues of messages of the worker threads*/
+    int n_rings; /**number of rings*/
+    int batch_size; /**messages published before waiting for confirmations*/
+    char* msgbuf; /**buffer for the text of a message that wraps around a ring*/
+    THREAD sender; /**the thread publishing the messages*/
     enum log_trigger_t trgtype;
     SRC_TRIG* src_trg;
     SHM_TRIG* shm_trg;
@@ -235,9 +270,10 @@ typedef struct
     MXS_UPSTREAM up;
     MXS_SESSION* session;
     bool was_query; /**True if the previous routeQuery call had valid content*/
+    int thread_id; /**The thread of the session, selects the ring*/
 } MQ_SESSION;
 
-void sendMessage(void* data);
+static void mq_sender(void* data);
 
 static const MXS_ENUM_VALUE trigger_values[] =
 {
@@ -305,6 +341,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"logging_object", MXS_MODULE_PARAM_STRING},
             {"logging_log_all", MXS_MODULE_PARAM_BOOL, "false"},
             {"logging_strict", MXS_MODULE_PARAM_BOOL, "true"},
+            {"buffer_size", MXS_MODULE_PARAM_SIZE, "1Mi"},
+            {"batch_size", MXS_MODULE_PARAM_COUNT, "100"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -462,6 +500,18 @@ init_conn(MQ_INSTANCE *my_instance)
             goto cleanup;
         }
     }
+
+    /** The broker confirms each published message on the channel */
+    amqp_confirm_select(my_instance->conn, my_instance->channel);
+    reply = amqp_get_rpc_reply(my_instance->conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+    {
+        MXS_ERROR("Failed to enable publisher confirms.");
+        goto cleanup;
+    }
+
+    my_instance->delivery_tag = 0;
+    my_instance->confirmed = 0;
     rval = 1;
 
 cleanup:
@@ -507,6 +557,263 @@ char** parse_optstr(const char* str, const char* tok, int* szstore)
     return arr;
 }
 
+/**
+ * Create the rings of messages, one for each worker thread.
+ * @param instance MQfilter instance
+ * @param size     The size of each ring
+ * @return True on success, false on memory allocation failure
+ */
+static bool mq_rings_create(MQ_INSTANCE *instance, uint64_t size)
+{
+    int n_rings = config_threadcount();
+    MQ_RING *rings = MXS_CALLOC(n_rings, sizeof(MQ_RING));
+
+    if (rings == NULL || (instance->msgbuf = MXS_MALLOC(size)) == NULL)
+    {
+        MXS_FREE(rings);
+        return false;
+    }
+
+    instance->rings = rings;
+    instance->n_rings = n_rings;
+
+    for (int i = 0; i < n_rings; i++)
+    {
+        if ((rings[i].data = MXS_MALLOC(size)) == NULL)
+        {
+            return false;
+        }
+        rings[i].size = size;
+    }
+
+    return true;
+}
+
+/**
+ * Copy data into a ring at a position that may wrap around its end.
+ */
+static void mq_ring_copy_in(MQ_RING *ring, uint64_t pos, const void *src, uint64_t len)
+{
+    uint64_t offset = pos % ring->size;
+    uint64_t n = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->data + offset, src, n);
+    memcpy(ring->data, (const char*)src + n, len - n);
+}
+
+/**
+ * Copy data out of a ring from a position that may wrap around its end.
+ */
+static void mq_ring_copy_out(MQ_RING *ring, uint64_t pos, void *dest, uint64_t len)
+{
+    uint64_t offset = pos % ring->size;
+    uint64_t n = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(dest, ring->data + offset, n);
+    memcpy((char*)dest + n, ring->data, len - n);
+}
+
+/**
+ * Wait until the broker has confirmed the messages published on the channel.
+ * The broker confirms the messages of a channel in the order they were
+ * published, so the highest confirmed tag is enough to track them.
+ * @param instance MQfilter instance
+ * @return The number of messages the broker failed to handle or -1 if the
+ * confirmations were not received
+ */
+static int mq_wait_confirms(MQ_INSTANCE *instance)
+{
+    int nacked = 0;
+
+    while (instance->confirmed < instance->delivery_tag)
+    {
+        amqp_frame_t frame;
+        struct timeval timeout = {MQ_CONFIRM_TIMEOUT, 0};
+        int rc = amqp_simple_wait_frame_noblock(instance->conn, &frame, &timeout);
+
+        if (rc != AMQP_STATUS_OK)
+        {
+            instance->conn_stat = rc;
+            return -1;
+        }
+
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+        {
+            continue;
+        }
+
+        uint64_t tag;
+        bool multiple;
+
+        switch (frame.payload.method.id)
+        {
+        case AMQP_BASIC_ACK_METHOD:
+            tag = ((amqp_basic_ack_t*)frame.payload.method.decoded)->delivery_tag;
+            multiple = ((amqp_basic_ack_t*)frame.payload.method.decoded)->multiple;
+            break;
+
+        case AMQP_BASIC_NACK_METHOD:
+            tag = ((amqp_basic_nack_t*)frame.payload.method.decoded)->delivery_tag;
+            multiple = ((amqp_basic_nack_t*)frame.payload.method.decoded)->multiple;
+
+            if (tag > instance->confirmed)
+            {
+                nacked += multiple ? tag - instance->confirmed : 1;
+            }
+            break;
+
+        case AMQP_CHANNEL_CLOSE_METHOD:
+        case AMQP_CONNECTION_CLOSE_METHOD:
+            instance->conn_stat = AMQP_STATUS_CONNECTION_CLOSED;
+            return -1;
+
+        default:
+            continue;
+        }
+
+        if (tag > instance->confirmed)
+        {
+            instance->confirmed = tag;
+        }
+    }
+
+    return nacked;
+}
+
+/**
+ * Publish a batch of messages from a ring and wait for their confirmations.
+ * The messages are removed from the ring only once they are confirmed.
+ * @param instance MQfilter instance
+ * @param ring     The ring
+ * @return True if there was something to publish
+ */
+static bool mq_ring_publish(MQ_INSTANCE *instance, MQ_RING *ring)
+{
+    uint64_t head = atomic_load_uint64(&ring->head);
+    uint64_t tail = ring->tail;
+    int n_msg = 0;
+
+    if (tail == head)
+    {
+        return false;
+    }
+
+    amqp_basic_properties_t prop;
+    prop._flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
+                  AMQP_BASIC_DELIVERY_MODE_FLAG |
+                  AMQP_BASIC_MESSAGE_ID_FLAG |
+                  AMQP_BASIC_CORRELATION_ID_FLAG;
+    prop.content_type = amqp_cstring_bytes("text/plain");
+    prop.delivery_mode = AMQP_DELIVERY_PERSISTENT;
+
+    while (tail < head && n_msg < instance->batch_size)
+    {
+        MQ_RECORD record;
+        mq_ring_copy_out(ring, tail, &record, sizeof(record));
+        mq_ring_copy_out(ring, tail + sizeof(record), instance->msgbuf, record.len);
+
+        amqp_bytes_t body = {record.len, instance->msgbuf};
+        prop.correlation_id = amqp_cstring_bytes(record.uid);
+        prop.message_id = amqp_cstring_bytes(record.reply ? "reply" : "query");
+
+        int rc = amqp_basic_publish(instance->conn, instance->channel,
+                                    amqp_cstring_bytes(instance->exchange),
+                                    amqp_cstring_bytes(instance->key),
+                                    0, 0, &prop, body);
+
+        if (rc != AMQP_STATUS_OK)
+        {
+            instance->conn_stat = rc;
+            break;
+        }
+
+        instance->delivery_tag++;
+        tail += sizeof(record) + record.len;
+        n_msg++;
+    }
+
+    int nacked = instance->conn_stat == AMQP_STATUS_OK ? mq_wait_confirms(instance) : -1;
+    amqp_maybe_release_buffers(instance->conn);
+
+    if (nacked < 0)
+    {
+        MXS_ERROR("Failed to publish messages to the RabbitMQ server: %s",
+                  amqp_error_string2(instance->conn_stat));
+    }
+    else
+    {
+        atomic_add_uint64(&instance->stats.n_sent, n_msg - nacked);
+        atomic_add_uint64(&instance->stats.n_nacked, nacked);
+
+        // The full barrier makes the space free only after the messages have been copied.
+        atomic_add_uint64(&ring->tail, tail - ring->tail);
+    }
+
+    return true;
+}
+
+/**
+ * Open a new connection to the RabbitMQ server, if enough time has passed
+ * since the previous attempt.
+ * @param instance MQfilter instance
+ * @return True if the connection was opened
+ */
+static bool mq_reconnect(MQ_INSTANCE *instance)
+{
+    if (difftime(time(NULL), instance->last_rconn) <= instance->rconn_intv)
+    {
+        return false;
+    }
+
+    instance->last_rconn = time(NULL);
+    amqp_destroy_connection(instance->conn);
+    instance->channel = 1;
+
+    if ((instance->conn = amqp_new_connection()) && init_conn(instance))
+    {
+        instance->rconn_intv = 1;
+        instance->conn_stat = AMQP_STATUS_OK;
+    }
+    else
+    {
+        instance->rconn_intv += 5;
+        MXS_ERROR("Failed to reconnect to the MQRabbit server ");
+    }
+
+    return instance->conn_stat == AMQP_STATUS_OK;
+}
+
+/**
+ * The sender thread that publishes the messages of all worker threads. As
+ * filter instances are never destroyed, the thread runs until MaxScale exits.
+ * @param data MQfilter instance
+ */
+static void mq_sender(void* data)
+{
+    MQ_INSTANCE *instance = (MQ_INSTANCE*)data;
+
+    while (true)
+    {
+        bool idle = true;
+
+        if (instance->conn_stat == AMQP_STATUS_OK || mq_reconnect(instance))
+        {
+            for (int i = 0; i < instance->n_rings && instance->conn_stat == AMQP_STATUS_OK; i++)
+            {
+                if (mq_ring_publish(instance, &instance->rings[i]))
+                {
+                    idle = false;
+                }
+            }
+        }
+
+        if (idle)
+        {
+            thread_millisleep(MQ_SENDER_IDLE_MS);
+        }
+    }
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -524,20 +831,13 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     if (my_instance)
     {
-        spinlock_init(&my_instance->rconn_lock);
-        spinlock_init(&my_instance->msg_lock);
         uid_gen = 0;
 
-        if ((my_instance->conn = amqp_new_connection()) == NULL)
-        {
-            MXS_FREE(my_instance);
-            return NULL;
-        }
-
         my_instance->channel = 1;
-        my_instance->last_rconn = time(NULL);
-        my_instance->conn_stat = AMQP_STATUS_OK;
+        my_instance->last_rconn = 0;
+        my_instance->conn_stat = AMQP_STATUS_SOCKET_CLOSED;
         my_instance->rconn_intv = 1;
+        my_instance->batch_size = config_get_integer(params, "batch_size");
 
         my_instance->port = config_get_integer(params, "port");
         my_instance->trgtype = config_get_enum(params, "logging_trigger", trigger_values);
@@ -611,185 +911,83 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             amqp_set_initialize_ssl_library(0);
         }
 
-        /**Connect to the server*/
-        init_conn(my_instance);
-
-        char taskname[512];
-        snprintf(taskname, 511, "mqtask%d", atomic_add(&hktask_id, 1));
-        hktask_add(taskname, sendMessage, (void*)my_instance, 5);
-    }
-
-    return (MXS_FILTER *)my_instance;
-}
-
-/**
- * Declares a persistent, non-exclusive and non-passive queue that
- * auto-deletes after all the messages have been consumed.
- * @param my_session MQ_SESSION instance used to declare the queue
- * @param qname Name of the queue to be declared
- * @return Returns 0 if an error occurred, 1 if successful
- */
-int declareQueue(MQ_INSTANCE *my_instance, MQ_SESSION* my_session, char* qname)
-{
-    int success = 1;
-    amqp_rpc_reply_t reply;
-
-    spinlock_acquire(&my_instance->rconn_lock);
-
-    amqp_queue_declare(my_instance->conn, my_instance->channel,
-                       amqp_cstring_bytes(qname),
-                       0, 1, 0, 1,
-                       amqp_empty_table);
-    reply = amqp_get_rpc_reply(my_instance->conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL)
-    {
-        success = 0;
-        MXS_ERROR("Queue declaration failed.");
-
-    }
-
-    amqp_queue_bind(my_instance->conn, my_instance->channel,
-                    amqp_cstring_bytes(qname),
-                    amqp_cstring_bytes(my_instance->exchange),
-                    amqp_cstring_bytes(my_session->uid),
-                    amqp_empty_table);
-    reply = amqp_get_rpc_reply(my_instance->conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL)
-    {
-        success = 0;
-        MXS_ERROR("Failed to bind queue to exchange.");
-
-    }
-    spinlock_release(&my_instance->rconn_lock);
-    return success;
-}
-
-/**
- * Broadcasts a message on the message stack to the RabbitMQ server
- * and frees the allocated memory if successful. This function is only called by
- * the housekeeper thread.
- * @param data MQfilter instance
- */
-void sendMessage(void* data)
-{
-    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
-    mqmessage *tmp;
-    int err_num = AMQP_STATUS_OK;
+        uint64_t size = config_get_size(params, "buffer_size");
+        bool error = false;
 
-    spinlock_acquire(&instance->rconn_lock);
-    if (instance->conn_stat != AMQP_STATUS_OK)
-    {
-        if (difftime(time(NULL), instance->last_rconn) > instance->rconn_intv)
+        if (my_instance->batch_size < 1)
         {
-            instance->last_rconn = time(NULL);
-
-            if (init_conn(instance))
-            {
-                instance->rconn_intv = 1.0;
-                instance->conn_stat = AMQP_STATUS_OK;
-            }
-            else
-            {
-                instance->rconn_intv += 5.0;
-                MXS_ERROR("Failed to reconnect to the MQRabbit server ");
-            }
+            my_instance->batch_size = 1;
         }
-        err_num = instance->conn_stat;
-    }
-    spinlock_release(&instance->rconn_lock);
 
-    if (err_num != AMQP_STATUS_OK)
-    {
-        /** No connection to the broker */
-        return;
-    }
-
-    spinlock_acquire(&instance->msg_lock);
-    tmp = instance->messages;
-
-    if (tmp == NULL)
-    {
-        spinlock_release(&instance->msg_lock);
-        return;
-    }
-
-    instance->messages = instance->messages->next;
-    spinlock_release(&instance->msg_lock);
-
-    while (tmp)
-    {
-        err_num = amqp_basic_publish(instance->conn, instance->channel,
-                                     amqp_cstring_bytes(instance->exchange),
-                                     amqp_cstring_bytes(instance->key),
-                                     0, 0, tmp->prop, amqp_cstring_bytes(tmp->msg));
-
-        spinlock_acquire(&instance->rconn_lock);
-        instance->conn_stat = err_num;
-        spinlock_release(&instance->rconn_lock);
-
-        if (err_num == AMQP_STATUS_OK)
+        /** The sender connects to the server */
+        if (size <= sizeof(MQ_RECORD))
         {
-            /**Message was sent successfully*/
-            MXS_FREE(tmp->prop);
-            MXS_FREE(tmp->msg);
-            MXS_FREE(tmp);
-
-            atomic_add(&instance->stats.n_sent, 1);
-            atomic_add(&instance->stats.n_queued, -1);
-            spinlock_acquire(&instance->msg_lock);
-            tmp = instance->messages;
+            MXS_ERROR("The value of 'buffer_size' is too small.");
+            error = true;
+        }
+        else if (!mq_rings_create(my_instance, size) ||
+                 thread_start(&my_instance->sender, mq_sender, my_instance) == NULL)
+        {
+            MXS_ERROR("Failed to start the sender of '%s'.", name);
+            error = true;
+        }
 
-            if (tmp == NULL)
+        if (error)
+        {
+            for (int i = 0; i < my_instance->n_rings; i++)
             {
-                spinlock_release(&instance->msg_lock);
-                return;
+                MXS_FREE(my_instance->rings[i].data);
             }
 
-            instance->messages = instance->messages->next;
-            spinlock_release(&instance->msg_lock);
-        }
-        else
-        {
-            spinlock_acquire(&instance->msg_lock);
-            tmp->next = instance->messages;
-            instance->messages = tmp;
-            spinlock_release(&instance->msg_lock);
-            return;
+            MXS_FREE(my_instance->rings);
+            MXS_FREE(my_instance->msgbuf);
+            MXS_FREE(my_instance);
+            my_instance = NULL;
         }
     }
+
+    return (MXS_FILTER *)my_instance;
 }
 
 /**
- * Push a new message on the stack to be broadcasted later.
- * The message assumes ownership of the memory allocated to the message content and properties.
- * @param prop Message properties
- * @param msg Message content
+ * Add a message to the ring of the calling worker thread. If the ring is
+ * full, the message is dropped.
+ *
+ * @param instance MQfilter instance
+ * @param session  The session of the message
+ * @param reply    Whether the message is a reply instead of a query
+ * @param msg      The message
  */
-void pushMessage(MQ_INSTANCE *instance, amqp_basic_properties_t* prop, char* msg)
+static void mq_push(MQ_INSTANCE *instance, MQ_SESSION *session, bool reply, const char *msg)
 {
+    MQ_RING *ring = &instance->rings[session->thread_id];
+    MQ_RECORD record;
+    memset(&record, 0, sizeof(record));
+    record.len = strlen(msg);
+    record.reply = reply;
 
-    mqmessage* newmsg = MXS_CALLOC(1, sizeof(mqmessage));
-    if (newmsg)
+    if (session->uid)
     {
-        newmsg->msg = msg;
-        newmsg->prop = prop;
+        strcpy(record.uid, session->uid);
     }
-    else
+
+    uint64_t need = sizeof(record) + record.len;
+    uint64_t used = ring->head - atomic_load_uint64(&ring->tail);
+
+    if (need > ring->size - used)
     {
-        MXS_FREE(prop);
-        MXS_FREE(msg);
+        atomic_add_uint64(&ring->dropped, 1);
         return;
     }
 
-    spinlock_acquire(&instance->msg_lock);
-
-    newmsg->next = instance->messages;
-    instance->messages = newmsg;
+    mq_ring_copy_in(ring, ring->head, &record, sizeof(record));
+    mq_ring_copy_in(ring, ring->head + sizeof(record), msg, record.len);
 
-    spinlock_release(&instance->msg_lock);
+    // Counted first so that a message is never confirmed before it is counted
+    atomic_add_uint64(&ring->added, 1);
 
-    atomic_add(&instance->stats.n_msg, 1);
-    atomic_add(&instance->stats.n_queued, 1);
+    // The full barrier makes the message visible before the new head.
+    atomic_add_uint64(&ring->head, need);
 }
 
 /**
@@ -830,6 +1028,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->uid = NULL;
         my_session->session = session;
         my_session->db = db;
+        my_session->thread_id = session->client_dcb->thread.id;
     }
     else
     {
@@ -943,7 +1142,6 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     int length, i, j, dbcount = 0;
     char** sesstbls;
     unsigned int plen = 0;
-    amqp_basic_properties_t *prop;
 
     /**The user is changing databases*/
     if (*((char*) (queue->start + 4)) == 0x02)
@@ -1181,18 +1379,6 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 
                 my_session->was_query = true;
 
-                if ((prop = MXS_MALLOC(sizeof(amqp_basic_properties_t))))
-                {
-                    prop->_flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
-                                   AMQP_BASIC_DELIVERY_MODE_FLAG |
-                                   AMQP_BASIC_MESSAGE_ID_FLAG |
-                                   AMQP_BASIC_CORRELATION_ID_FLAG;
-                    prop->content_type = amqp_cstring_bytes("text/plain");
-                    prop->delivery_mode = AMQP_DELIVERY_PERSISTENT;
-                    prop->correlation_id = amqp_cstring_bytes(my_session->uid);
-                    prop->message_id = amqp_cstring_bytes("query");
-                }
-
                 if (success)
                 {
 
@@ -1213,7 +1399,8 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 strcpy(combined, t_buf);
                 strncat(combined, canon_q, length);
 
-                pushMessage(my_instance, prop, combined);
+                mq_push(my_instance, my_session, false, combined);
+                MXS_FREE(combined);
                 MXS_FREE(canon_q);
             }
 
@@ -1344,7 +1531,6 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
     MQ_INSTANCE *my_instance = (MQ_INSTANCE *) instance;
     char t_buf[128], *combined;
     unsigned int pkt_len = pktlen(reply->sbuf->data), offset = 0;
-    amqp_basic_properties_t *prop;
 
     if (my_session->was_query)
     {
@@ -1355,18 +1541,6 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
 
         if (pkt_len > 0)
         {
-            if ((prop = MXS_MALLOC(sizeof(amqp_basic_properties_t))))
-            {
-                prop->_flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
-                               AMQP_BASIC_DELIVERY_MODE_FLAG |
-                               AMQP_BASIC_MESSAGE_ID_FLAG |
-                               AMQP_BASIC_CORRELATION_ID_FLAG;
-                prop->content_type = amqp_cstring_bytes("text/plain");
-                prop->delivery_mode = AMQP_DELIVERY_PERSISTENT;
-                prop->correlation_id = amqp_cstring_bytes(my_session->uid);
-                prop->message_id = amqp_cstring_bytes("reply");
-            }
-
             combined = MXS_CALLOC(GWBUF_LENGTH(reply) + 256, sizeof(char));
             MXS_ABORT_IF_NULL(combined);
 
@@ -1452,7 +1626,7 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
             if (packet_ok)
             {
 
-                pushMessage(my_instance, prop, combined);
+                mq_push(my_instance, my_session, true, combined);
 
                 if (was_last)
                 {
@@ -1464,6 +1638,8 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
 
                 }
             }
+
+            MXS_FREE(combined);
         }
 
     }
@@ -1495,12 +1671,21 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
                    my_instance->vhost, my_instance->exchange,
                    my_instance->key, my_instance->queue
                   );
-        dcb_printf(dcb, "%-16s%-16s%-16s\n",
-                   "Messages", "Queued", "Sent");
-        dcb_printf(dcb, "%-16d%-16d%-16d\n",
-                   my_instance->stats.n_msg,
-                   my_instance->stats.n_queued,
-                   my_instance->stats.n_sent);
+        uint64_t added = 0;
+        uint64_t dropped = 0;
+        uint64_t sent = atomic_load_uint64(&my_instance->stats.n_sent);
+        uint64_t nacked = atomic_load_uint64(&my_instance->stats.n_nacked);
+
+        for (int i = 0; i < my_instance->n_rings; i++)
+        {
+            added += atomic_load_uint64(&my_instance->rings[i].added);
+            dropped += atomic_load_uint64(&my_instance->rings[i].dropped);
+        }
+
+        dcb_printf(dcb, "%-16s%-16s%-16s%-16s%-16s\n",
+                   "Messages", "Queued", "Sent", "Dropped", "Failed");
+        dcb_printf(dcb, "%-16lu%-16lu%-16lu%-16lu%-16lu\n",
+                   added + dropped, added - sent - nacked, sent, dropped, nacked);
     }
 }
 
@@ -23,6 +23,7 @@
 #include <regex.h>
 #include <maxscale/hint.h>
 #include <maxscale/alloc.h>
+#include <maxscale/pcre2.h>
 #include <maxscale/utils.h>
 #include <netdb.h>
 
@@ -70,6 +71,9 @@ typedef struct
     char *match; /* Regular expression to match */
     char *server; /* Server to route to */
     regex_t re; /* Compiled regex text */
+    char literal[64]; /* String every matching query contains */
+    size_t literal_len; /* Length of the literal, 0 if there is none */
+    bool caseless; /* Whether the regex ignores case */
 } REGEXHINT_INSTANCE;
 
 static bool validate_ip_address(const char *);
@@ -199,6 +203,14 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             my_instance->match = NULL;
             error = true;
         }
+        else
+        {
+            my_instance->caseless = cflags & REG_ICASE;
+            my_instance->literal_len = mxs_pcre2_get_literal(my_instance->match,
+                                                             my_instance->caseless,
+                                                             my_instance->literal,
+                                                             sizeof(my_instance->literal));
+        }
 
         if (error)
         {
@@ -237,7 +249,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         {
             my_session->active = check_source_host(my_instance,
                                                    remote,
-                                                   &session->client_dcb->ip);
+                                                   dcb_get_ip(session->client_dcb));
         }
 
         /* Check client user against 'user' option */
@@ -316,7 +328,11 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     {
         if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
         {
-            if (regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0)
+            /** Only queries that contain the literal string of the regex can match it */
+            if ((my_instance->literal_len == 0 ||
+                 mxs_pcre2_has_literal(sql, limits[0].rm_eo, my_instance->literal,
+                                       my_instance->literal_len, my_instance->caseless)) &&
+                regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0)
             {
                 queue->hint = hint_create_route(queue->hint,
                                                 HINT_ROUTE_TO_NAMED_SERVER,
@@ -37,10 +37,12 @@ const MXS_ENUM_VALUE capability_values[] =
     { "RCAP_TYPE_STMT_OUTPUT",          RCAP_TYPE_STMT_OUTPUT },
     { "RCAP_TYPE_CONTIGUOUS_OUTPUT",    RCAP_TYPE_CONTIGUOUS_OUTPUT },
     { "RCAP_TYPE_RESULTSET_OUTPUT",     RCAP_TYPE_RESULTSET_OUTPUT },
+    { "RCAP_TYPE_SESSION_STATE_TRACKING", RCAP_TYPE_SESSION_STATE_TRACKING },
+    { "RCAP_TYPE_REPLY_INFO",             RCAP_TYPE_REPLY_INFO },
     { NULL, 0 }
 };
 
-size_t RCAP_TYPE_NAME_MAXLEN = 30; // strlen(RCAP_TYPE_TRANSACTION_TRACKING)
+size_t RCAP_TYPE_NAME_MAXLEN = 32; // strlen(RCAP_TYPE_SESSION_STATE_TRACKING)
 size_t RCAP_TYPE_COUNT = sizeof(capability_values)/sizeof(capability_values[0]);
 
 }
@@ -0,0 +1,72 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qlacapture.h - The format of the workload capture files
+ *
+ * With @c log_type=capture, the qlafilter writes every packet the clients
+ * send into the file @c <filebase>.capture, together with the size and
+ * latency of the replies, so that the workload can be replayed with
+ * qlareplay. The file starts with a QLA_CAPTURE_HEADER, followed by records
+ * that each consist of a QLA_CAPTURE_RECORD and @c len bytes of data:
+ *
+ * - QLA_CAPTURE_OPEN:  A session started, the data is "user@host".
+ * - QLA_CAPTURE_QUERY: The client sent a statement, the data is the MySQL
+ *                      packets of the statement, headers included.
+ * - QLA_CAPTURE_REPLY: The reply to the latest statement of the session
+ *                      ended, the data is a QLA_CAPTURE_REPLY_DATA.
+ * - QLA_CAPTURE_CLOSE: The session ended, there is no data.
+ *
+ * The records of a session are in the order they were made, but the records
+ * of different sessions may be interleaved in any order. The numbers are in
+ * the byte order of the host that made the capture.
+ */
+
+#include <stdint.h>
+
+/** The magic bytes at the start of a capture file, without a terminating null */
+#define QLA_CAPTURE_MAGIC   "MXSQLCAP"
+
+/** The version of the format described here */
+#define QLA_CAPTURE_VERSION 1
+
+typedef struct qla_capture_header
+{
+    char     magic[8]; /*< QLA_CAPTURE_MAGIC */
+    uint32_t version;  /*< QLA_CAPTURE_VERSION */
+    uint32_t reserved;
+} QLA_CAPTURE_HEADER;
+
+/** The types of the records */
+enum qla_capture_type
+{
+    QLA_CAPTURE_OPEN  = 1,
+    QLA_CAPTURE_QUERY = 2,
+    QLA_CAPTURE_REPLY = 3,
+    QLA_CAPTURE_CLOSE = 4,
+};
+
+typedef struct qla_capture_record
+{
+    uint32_t type;    /*< The enum qla_capture_type of the record */
+    uint32_t len;     /*< The length of the data that follows */
+    uint64_t session; /*< The id of the session */
+    int64_t  time;    /*< When the record was made, microseconds since the epoch */
+} QLA_CAPTURE_RECORD;
+
+typedef struct qla_capture_reply_data
+{
+    uint64_t size;    /*< The size of the reply in bytes */
+    uint64_t latency; /*< Microseconds from the statement to the end of the reply */
+} QLA_CAPTURE_REPLY_DATA;
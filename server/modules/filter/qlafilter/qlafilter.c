@@ -26,6 +26,10 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * With log_type=capture, the packets of the clients and the sizes and
+ * latencies of the replies are written into a binary capture file that
+ * qlareplay can replay. The format is described in qlacapture.h.
+ *
  * Date         Who             Description
  * 03/06/2014   Mark Riddoch    Initial implementation
  * 11/06/2014   Mark Riddoch    Addition of source and match parameters
@@ -50,14 +54,23 @@
 #include <string.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/clock.h>
+#include <maxscale/protocol/mysql.h>
 #include <maxscale/service.h>
+#include <maxscale/thread.h>
+
+#include "qlacapture.h"
 
 /** Date string buffer size */
 #define QLA_DATE_BUFFER_SIZE 20
 
+/** How long the writer of asynchronous logging sleeps when there is nothing to write */
+#define QLA_WRITER_IDLE_MS 10
+
 /** Log file save mode flags */
 #define CONFIG_FILE_SESSION (1 << 0) // Default value, session specific files
 #define CONFIG_FILE_UNIFIED (1 << 1) // One file shared by all sessions
+#define CONFIG_FILE_CAPTURE (1 << 2) // Binary capture of the workload
 
 /* Flags for controlling extra log entry contents */
 enum log_options
@@ -80,7 +93,9 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
 static void closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static void freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static void setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_DOWNSTREAM *downstream);
+static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_UPSTREAM *upstream);
 static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
+static int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *reply);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
@@ -107,11 +122,42 @@ typedef struct
     uint32_t log_file_data_flags; /* What data is saved to the files */
     FILE *unified_fp; /* Unified log file. The pointer needs to be shared here
                        * to avoid garbled printing. */
+    FILE *capture_fp; /* Capture file, shared by all sessions */
     bool flush_writes; /* Flush log file after every write? */
     bool append;    /* Open files in append-mode? */
     bool write_warning_given; /* To make sure some warning are only given once */
+    bool async;     /* Are the entries written by a separate thread? */
+    struct qla_ring *rings; /* Per thread queues of entries, if async */
+    int n_rings;    /* The number of rings */
+    THREAD writer;  /* The thread writing the entries, if async */
 } QLA_INSTANCE;
 
+/**
+ * With asynchronous logging, each worker thread formats its log entries into
+ * a ring of its own, from where the writer thread of the filter instance
+ * writes them into the files. The worker is the only one advancing the head
+ * and the writer the only one advancing the tail, so no locks are needed.
+ * If the writer falls behind and the ring is full, entries are dropped.
+ */
+typedef struct qla_ring
+{
+    char     *data;    /* The entries */
+    uint64_t  size;    /* The size of the data */
+    uint64_t  head;    /* The total number of bytes added */
+    uint64_t  tail;    /* The total number of bytes written */
+    uint64_t  dropped; /* The number of entries dropped because the ring was full */
+} QLA_RING;
+
+/**
+ * The header of an entry in a ring, followed by @c len bytes of text.
+ */
+typedef struct qla_record
+{
+    FILE     *fp;    /* The file to write to */
+    uint32_t  len;   /* The length of the text */
+    bool      close; /* Close the file instead of writing to it */
+} QLA_RECORD;
+
 /**
  * The session structure for this QLA filter.
  * This stores the downstream filter information, such that the
@@ -124,17 +170,28 @@ typedef struct
 {
     int active;
     MXS_DOWNSTREAM down;
+    MXS_UPSTREAM up;
     char *filename;   /* The session-specific log file name */
     FILE *fp;         /* The session-specific log file */
     const char *remote;
     char *service;    /* The service name this filter is attached to. Not owned. */
     size_t ses_id;    /* The session this filter serves */
     const char *user; /* The client */
+    int thread_id;    /* The thread of the session, selects the ring if async */
+    uint64_t query_start; /* When the statement waiting for a reply was routed, in
+                           * microseconds, 0 if there is none. Only with capture. */
+    uint64_t reply_size;  /* The size of the reply received so far */
 } QLA_SESSION;
 
 static FILE* open_log_file(uint32_t, QLA_INSTANCE *, const char *);
 static int write_log_entry(uint32_t, FILE*, QLA_INSTANCE*, QLA_SESSION*, const char*,
                            const char*, size_t);
+static FILE* open_capture_file(QLA_INSTANCE *, const char *);
+static void write_capture_record(QLA_INSTANCE *, QLA_SESSION *, uint32_t, const GWBUF *,
+                                 const void *, uint32_t);
+static bool qla_rings_create(QLA_INSTANCE *, uint64_t);
+static bool qla_ring_push(QLA_RING *, FILE *, bool, const char *, uint32_t);
+static void qla_writer(void *);
 
 static const MXS_ENUM_VALUE option_values[] =
 {
@@ -148,6 +205,7 @@ static const MXS_ENUM_VALUE log_type_values[] =
 {
     {"session", CONFIG_FILE_SESSION},
     {"unified", CONFIG_FILE_UNIFIED},
+    {"capture", CONFIG_FILE_CAPTURE},
     {NULL}
 };
 
@@ -178,9 +236,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
         closeSession,
         freeSession,
         setDownstream,
-        NULL, // No Upstream requirement
+        setUpstream,
         routeQuery,
-        NULL, // No client reply
+        clientReply,
         diagnostic,
         getCapabilities,
         NULL, // No destroyInstance
@@ -252,6 +310,16 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_PARAM_BOOL,
                 "false"
             },
+            {
+                "async",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
+            {
+                "async_buffer_size",
+                MXS_MODULE_PARAM_SIZE,
+                "1Mi"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -278,11 +346,15 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->sessions = 0;
         my_instance->unified_fp = NULL;
+        my_instance->capture_fp = NULL;
         my_instance->write_warning_given = false;
         my_instance->name = MXS_STRDUP_A(name);
         my_instance->filebase = MXS_STRDUP_A(config_get_string(params, "filebase"));
         my_instance->flush_writes = config_get_bool(params, "flush");
         my_instance->append = config_get_bool(params, "append");
+        my_instance->async = config_get_bool(params, "async");
+        my_instance->rings = NULL;
+        my_instance->n_rings = 0;
         my_instance->match = config_copy_string(params, "match");
         my_instance->nomatch = config_copy_string(params, "exclude");
         my_instance->source = config_copy_string(params, "source");
@@ -342,8 +414,49 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             }
         }
 
+        if (!error && (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE))
+        {
+            const char CAPTURE[] = ".capture";
+            char filename[strlen(my_instance->filebase) + sizeof(CAPTURE)];
+            sprintf(filename, "%s%s", my_instance->filebase, CAPTURE);
+
+            // Like the unified file, the capture file is only closed at program exit
+            if ((my_instance->capture_fp = open_capture_file(my_instance, filename)) == NULL)
+            {
+                char errbuf[MXS_STRERROR_BUFLEN];
+                MXS_ERROR("Opening capture file '%s' for qla filter failed due to %d, %s",
+                          filename, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+                error = true;
+            }
+        }
+
+        if (!error && my_instance->async)
+        {
+            uint64_t size = config_get_size(params, "async_buffer_size");
+
+            if (size < 2 * sizeof(QLA_RECORD))
+            {
+                MXS_ERROR("The value of 'async_buffer_size' is too small.");
+                error = true;
+            }
+            else if (!qla_rings_create(my_instance, size) ||
+                     thread_start(&my_instance->writer, qla_writer, my_instance) == NULL)
+            {
+                MXS_ERROR("Failed to start the asynchronous writer of '%s'.", name);
+                error = true;
+            }
+        }
+
         if (error)
         {
+            if (my_instance->rings)
+            {
+                for (int i = 0; i < my_instance->n_rings; i++)
+                {
+                    MXS_FREE(my_instance->rings[i].data);
+                }
+                MXS_FREE(my_instance->rings);
+            }
             if (my_instance->match)
             {
                 MXS_FREE(my_instance->match);
@@ -359,6 +472,10 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             {
                 fclose(my_instance->unified_fp);
             }
+            if (my_instance->capture_fp != NULL)
+            {
+                fclose(my_instance->capture_fp);
+            }
             MXS_FREE(my_instance->filebase);
             MXS_FREE(my_instance->source);
             MXS_FREE(my_instance->user_name);
@@ -410,6 +527,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->remote = remote;
         my_session->ses_id = session->ses_id;
         my_session->service = session->service->name;
+        my_session->thread_id = session->client_dcb->thread.id;
 
         sprintf(my_session->filename, "%s.%lu",
                 my_instance->filebase,
@@ -437,6 +555,14 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
                 my_session = NULL;
             }
         }
+
+        if (my_session && my_session->active && (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE))
+        {
+            char client[strlen(userName) + strlen(remote) + 2];
+            sprintf(client, "%s@%s", userName, remote);
+            write_capture_record(my_instance, my_session, QLA_CAPTURE_OPEN, NULL,
+                                 client, strlen(client));
+        }
     }
     return (MXS_FILTER_SESSION*)my_session;
 }
@@ -452,11 +578,31 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 static void
 closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
+    if (my_session->active && (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE))
+    {
+        write_capture_record(my_instance, my_session, QLA_CAPTURE_CLOSE, NULL, NULL, 0);
+    }
+
     if (my_session->active && my_session->fp)
     {
-        fclose(my_session->fp);
+        if (my_instance->async)
+        {
+            // The writer closes the file once the entries before this have been
+            // written. The close must not be dropped, so wait for space if needed.
+            QLA_RING *ring = &my_instance->rings[my_session->thread_id];
+
+            while (!qla_ring_push(ring, my_session->fp, true, NULL, 0))
+            {
+                thread_millisleep(1);
+            }
+        }
+        else
+        {
+            fclose(my_session->fp);
+        }
     }
 }
 
@@ -492,6 +638,43 @@ setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_DOWNSTREAM
     my_session->down = *downstream;
 }
 
+/**
+ * Set the upstream filter or session to which results will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param upstream  The upstream filter or session.
+ */
+static void
+setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *upstream)
+{
+    QLA_SESSION *my_session = (QLA_SESSION *) session;
+
+    my_session->up = *upstream;
+}
+
+/**
+ * Check whether the server replies to a command
+ *
+ * @param command The command byte of the packet
+ *
+ * @return True if the command is answered
+ */
+static bool command_has_reply(uint8_t command)
+{
+    switch (command)
+    {
+    case MYSQL_COM_QUIT:
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+    case MYSQL_COM_STMT_CLOSE:
+        return false;
+
+    default:
+        return true;
+    }
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -512,7 +695,19 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     struct timeval tv;
     regmatch_t limits[] = {{0, 0}};
 
-    if (my_session->active)
+    if (my_session->active && (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE))
+    {
+        write_capture_record(my_instance, my_session, QLA_CAPTURE_QUERY, queue, NULL, 0);
+
+        if (GWBUF_LENGTH(queue) > MYSQL_HEADER_LEN &&
+            command_has_reply(MYSQL_GET_COMMAND(GWBUF_DATA(queue))))
+        {
+            my_session->query_start = mxs_clock_precise_ns() / 1000;
+            my_session->reply_size = 0;
+        }
+    }
+
+    if (my_session->active && (my_instance->log_mode_flags & (CONFIG_FILE_SESSION | CONFIG_FILE_UNIFIED)))
     {
         if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
         {
@@ -569,6 +764,43 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                                        my_session->down.session, queue);
 }
 
+/**
+ * The clientReply entry point. With capture, the end of the reply to the
+ * latest statement is recorded with the size and latency of the reply.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
+{
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
+    QLA_SESSION *my_session = (QLA_SESSION *) session;
+
+    if (my_session->query_start)
+    {
+        const MXS_REPLY_INFO *info = modutil_get_reply_info(reply);
+        my_session->reply_size += gwbuf_length(reply);
+
+        // Without the packet information, the reply is not made of results and
+        // its end cannot be found, so the first part of it ends the reply.
+        if (info == NULL || info->n_replies > 0)
+        {
+            QLA_CAPTURE_REPLY_DATA data;
+            data.size = my_session->reply_size;
+            data.latency = mxs_clock_precise_ns() / 1000 - my_session->query_start;
+            my_session->query_start = 0;
+
+            write_capture_record(my_instance, my_session, QLA_CAPTURE_REPLY, NULL,
+                                 &data, sizeof(data));
+        }
+    }
+
+    return my_session->up.clientReply(my_session->up.instance,
+                                      my_session->up.session, reply);
+}
+
 /**
  * Diagnostics routine
  *
@@ -586,11 +818,16 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) fsession;
 
-    if (my_session)
+    if (my_session && (my_instance->log_mode_flags & CONFIG_FILE_SESSION))
     {
         dcb_printf(dcb, "\t\tLogging to file            %s.\n",
                    my_session->filename);
     }
+    if (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE)
+    {
+        dcb_printf(dcb, "\t\tCapturing to file          %s.capture\n",
+                   my_instance->filebase);
+    }
     if (my_instance->source)
     {
         dcb_printf(dcb, "\t\tLimit logging to connections from  %s\n",
@@ -611,6 +848,21 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        uint64_t pending = 0;
+        uint64_t dropped = 0;
+
+        for (int i = 0; i < my_instance->n_rings; i++)
+        {
+            QLA_RING *ring = &my_instance->rings[i];
+            pending += atomic_load_uint64(&ring->head) - atomic_load_uint64(&ring->tail);
+            dropped += atomic_load_uint64(&ring->dropped);
+        }
+
+        dcb_printf(dcb, "\t\tBytes waiting to be written   %lu\n", pending);
+        dcb_printf(dcb, "\t\tEntries dropped               %lu\n", dropped);
+    }
 }
 
 /**
@@ -620,7 +872,16 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
  */
 static uint64_t getCapabilities(MXS_FILTER* instance)
 {
-    return RCAP_TYPE_CONTIGUOUS_INPUT;
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
+    uint64_t rval = RCAP_TYPE_CONTIGUOUS_INPUT;
+
+    if (my_instance->log_mode_flags & CONFIG_FILE_CAPTURE)
+    {
+        // The packet information tells where the replies end
+        rval |= RCAP_TYPE_REPLY_INFO;
+    }
+
+    return rval;
 }
 /**
  * Open the log file and print a header if appropriate.
@@ -721,6 +982,109 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
     return fp;
 }
 
+/**
+ * Open the capture file and write the header if the file is empty.
+ * @param   instance    The filter instance
+ * @param   filename    Target file path
+ * @return  A valid file on success, null otherwise.
+ */
+static FILE* open_capture_file(QLA_INSTANCE *instance, const char *filename)
+{
+    FILE *fp = fopen(filename, instance->append ? "a" : "w");
+
+    if (fp && fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == 0)
+    {
+        QLA_CAPTURE_HEADER header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, QLA_CAPTURE_MAGIC, sizeof(header.magic));
+        header.version = QLA_CAPTURE_VERSION;
+
+        if (fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0)
+        {
+            fclose(fp);
+            MXS_ERROR("Failed to write header to file %s.", filename);
+            return NULL;
+        }
+    }
+
+    return fp;
+}
+
+/**
+ * Write a record to the capture file.
+ * @param   instance    Filter instance
+ * @param   session     Filter session
+ * @param   type        The enum qla_capture_type of the record
+ * @param   packets     If not NULL, the packets to write as the data
+ * @param   data        The data, if @c packets is NULL
+ * @param   len         Length of the data, if @c packets is NULL
+ */
+static void write_capture_record(QLA_INSTANCE *instance, QLA_SESSION *session, uint32_t type,
+                                 const GWBUF *packets, const void *data, uint32_t len)
+{
+    if (packets)
+    {
+        len = gwbuf_length(packets);
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    QLA_CAPTURE_RECORD record;
+    record.type = type;
+    record.len = len;
+    record.session = session->ses_id;
+    record.time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    // The record is written with one call so that the records of the sessions
+    // of other threads cannot end up in the middle of it.
+    uint32_t total = sizeof(record) + len;
+    uint8_t *buf = MXS_MALLOC(total);
+
+    if (buf == NULL)
+    {
+        return;
+    }
+
+    memcpy(buf, &record, sizeof(record));
+
+    if (packets)
+    {
+        gwbuf_copy_data(packets, 0, len, buf + sizeof(record));
+    }
+    else if (len)
+    {
+        memcpy(buf + sizeof(record), data, len);
+    }
+
+    bool error = false;
+
+    if (instance->async)
+    {
+        QLA_RING *ring = &instance->rings[session->thread_id];
+
+        if (!qla_ring_push(ring, instance->capture_fp, false, (const char*)buf, total))
+        {
+            atomic_add_uint64(&ring->dropped, 1);
+        }
+    }
+    else if (fwrite(buf, 1, total, instance->capture_fp) != total ||
+             (instance->flush_writes && fflush(instance->capture_fp) != 0))
+    {
+        error = true;
+    }
+
+    MXS_FREE(buf);
+
+    if (error && !instance->write_warning_given)
+    {
+        MXS_ERROR("qla-filter '%s': Capture file write failed. "
+                  "Suppressing further similar warnings.",
+                  instance->name);
+        instance->write_warning_given = true;
+    }
+}
+
 /**
  * Write an entry to the log file.
  * @param   data_flags    Controls what to write
@@ -844,6 +1208,22 @@ static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *ins
         *(current_pos - 1) = '\n';
     }
 
+    if (instance->async)
+    {
+        // The writer writes the entry, and counts it if the ring is full.
+        uint32_t len = current_pos - print_str;
+        QLA_RING *ring = &instance->rings[session->thread_id];
+
+        if (!qla_ring_push(ring, logfile, false, print_str, len))
+        {
+            atomic_add_uint64(&ring->dropped, 1);
+            len = 0;
+        }
+
+        MXS_FREE(print_str);
+        return len;
+    }
+
     // Finally, write the log event.
     int written = fprintf(logfile, "%s", print_str);
     MXS_FREE(print_str);
@@ -863,3 +1243,180 @@ static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *ins
         return rval;
     }
 }
+
+/**
+ * Create the rings for asynchronous logging, one for each worker thread.
+ * @param   instance    Filter instance
+ * @param   size        The size of each ring
+ * @return  True on success, false on memory allocation failure
+ */
+static bool qla_rings_create(QLA_INSTANCE *instance, uint64_t size)
+{
+    int n_rings = config_threadcount();
+    QLA_RING *rings = MXS_CALLOC(n_rings, sizeof(QLA_RING));
+
+    if (rings == NULL)
+    {
+        return false;
+    }
+
+    instance->rings = rings;
+    instance->n_rings = n_rings;
+
+    for (int i = 0; i < n_rings; i++)
+    {
+        if ((rings[i].data = MXS_MALLOC(size)) == NULL)
+        {
+            return false;
+        }
+        rings[i].size = size;
+    }
+
+    return true;
+}
+
+/**
+ * Copy data into a ring at a position that may wrap around its end.
+ */
+static void qla_ring_copy_in(QLA_RING *ring, uint64_t pos, const void *src, uint64_t len)
+{
+    uint64_t offset = pos % ring->size;
+    uint64_t n = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->data + offset, src, n);
+    memcpy(ring->data, (const char*)src + n, len - n);
+}
+
+/**
+ * Add an entry to the ring of the calling worker thread.
+ * @param   ring    The ring of the thread
+ * @param   fp      Target file
+ * @param   close   Whether the file is closed instead of written to
+ * @param   text    The text to write
+ * @param   len     Length of the text
+ * @return  True if the entry was added, false if the ring was full
+ */
+static bool qla_ring_push(QLA_RING *ring, FILE *fp, bool close, const char *text, uint32_t len)
+{
+    uint64_t need = sizeof(QLA_RECORD) + len;
+    uint64_t used = ring->head - atomic_load_uint64(&ring->tail);
+
+    if (need > ring->size - used)
+    {
+        return false;
+    }
+
+    QLA_RECORD record;
+    memset(&record, 0, sizeof(record));
+    record.fp = fp;
+    record.len = len;
+    record.close = close;
+
+    qla_ring_copy_in(ring, ring->head, &record, sizeof(record));
+    qla_ring_copy_in(ring, ring->head + sizeof(record), text, len);
+
+    // The full barrier makes the entry visible before the new head.
+    atomic_add_uint64(&ring->head, need);
+
+    return true;
+}
+
+/**
+ * Write the entries of a ring. The entries are written with stdio, so the
+ * writes of consecutive entries are combined. If flushing is enabled, a file
+ * is flushed when the entries written to it in a row have been written.
+ * @param   instance    Filter instance
+ * @param   ring        The ring
+ * @return  True if there was something to write
+ */
+static bool qla_ring_drain(QLA_INSTANCE *instance, QLA_RING *ring)
+{
+    uint64_t head = atomic_load_uint64(&ring->head);
+    uint64_t tail = ring->tail;
+    FILE *last = NULL;
+    bool error = false;
+
+    while (tail < head)
+    {
+        QLA_RECORD record;
+        uint64_t offset = tail % ring->size;
+        uint64_t n = ring->size - offset < sizeof(record) ? ring->size - offset : sizeof(record);
+
+        memcpy(&record, ring->data + offset, n);
+        memcpy((char*)&record + n, ring->data, sizeof(record) - n);
+        tail += sizeof(record);
+
+        if (last && last != record.fp && instance->flush_writes && fflush(last) != 0)
+        {
+            error = true;
+        }
+
+        if (record.close)
+        {
+            fclose(record.fp);
+            last = NULL;
+        }
+        else
+        {
+            offset = tail % ring->size;
+            n = ring->size - offset < record.len ? ring->size - offset : record.len;
+
+            if (fwrite(ring->data + offset, 1, n, record.fp) != n ||
+                fwrite(ring->data, 1, record.len - n, record.fp) != record.len - n)
+            {
+                error = true;
+            }
+
+            tail += record.len;
+            last = record.fp;
+        }
+    }
+
+    if (last && instance->flush_writes && fflush(last) != 0)
+    {
+        error = true;
+    }
+
+    if (error && !instance->write_warning_given)
+    {
+        MXS_ERROR("qla-filter '%s': Log file write failed. "
+                  "Suppressing further similar warnings.",
+                  instance->name);
+        instance->write_warning_given = true;
+    }
+
+    bool rval = tail != ring->tail;
+
+    // The full barrier makes the space free only after the entries have been copied.
+    atomic_add_uint64(&ring->tail, tail - ring->tail);
+
+    return rval;
+}
+
+/**
+ * The writer thread of asynchronous logging. As filter instances are never
+ * destroyed, the thread runs until MaxScale exits.
+ * @param   data    Filter instance
+ */
+static void qla_writer(void *data)
+{
+    QLA_INSTANCE *instance = (QLA_INSTANCE*)data;
+
+    while (true)
+    {
+        bool idle = true;
+
+        for (int i = 0; i < instance->n_rings; i++)
+        {
+            if (qla_ring_drain(instance, &instance->rings[i]))
+            {
+                idle = false;
+            }
+        }
+
+        if (idle)
+        {
+            thread_millisleep(QLA_WRITER_IDLE_MS);
+        }
+    }
+}
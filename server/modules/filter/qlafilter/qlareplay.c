@@ -0,0 +1,877 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qlareplay.c - Replay a workload captured by the qlafilter
+ *
+ * The sessions of a capture file are replayed against a server or a MaxScale,
+ * each session in its own connection and its statements in the order they
+ * were captured. The statements are sent at the same pace as they were
+ * captured, optionally faster or slower, or as fast as possible. A fixed
+ * number of threads replay the sessions, so a session starts late if all the
+ * threads are busy with earlier sessions.
+ *
+ * The latencies of the replayed statements are compared with the captured
+ * ones, and optionally written into a CSV file statement by statement.
+ *
+ * Only the text protocol is replayed: COM_QUERY, COM_INIT_DB and COM_PING.
+ * The other commands, mostly those of prepared statements, are counted as
+ * skipped.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mysql.h>
+#include <errmsg.h>
+
+#include "qlacapture.h"
+
+static const char *replay_version = "1.0.0";
+
+/** The default number of threads replaying the sessions */
+#define REPLAY_DEFAULT_THREADS 16
+
+typedef struct replay_query
+{
+    int64_t        time;     /*< When the statement was captured */
+    const uint8_t *packets;  /*< The packets of the statement, in the loaded file */
+    uint32_t       len;      /*< The length of the packets */
+    int64_t        captured; /*< The captured latency in microseconds, -1 if unknown */
+} REPLAY_QUERY;
+
+typedef struct replay_result
+{
+    uint8_t command;  /*< The command of the statement */
+    bool    error;    /*< Whether the statement failed */
+    int64_t replayed; /*< The replayed latency in microseconds, -1 if not replayed */
+} REPLAY_RESULT;
+
+typedef struct replay_session
+{
+    uint64_t       id;        /*< The id of the captured session */
+    int64_t        start;     /*< When the session started */
+    REPLAY_QUERY  *queries;   /*< The statements of the session */
+    int            n_queries; /*< The number of statements */
+    int            size;      /*< The allocated size of the statements */
+    REPLAY_RESULT *results;   /*< The results of the statements */
+    bool           failed;    /*< Whether connecting failed */
+} REPLAY_SESSION;
+
+/** A record of the capture file, in the order the records are sorted into */
+typedef struct replay_record
+{
+    QLA_CAPTURE_RECORD hdr;
+    const uint8_t     *data;
+    size_t             seq;
+} REPLAY_RECORD;
+
+typedef struct replay_options
+{
+    const char *host;
+    const char *socket;
+    const char *user;
+    const char *password;
+    const char *database;
+    int         port;
+    int         threads;
+    double      speed;
+} REPLAY_OPTIONS;
+
+static REPLAY_OPTIONS options =
+{
+    "127.0.0.1", NULL, NULL, NULL, NULL, 3306, REPLAY_DEFAULT_THREADS, 1.0
+};
+
+static REPLAY_SESSION *sessions = NULL;
+static int n_sessions = 0;
+static int next_session = 0;
+
+static int64_t capture_start = 0;
+static int64_t capture_end = 0;
+static int64_t replay_start = 0;
+
+static struct option long_options[] =
+{
+    {"host",     required_argument, 0, 'h'},
+    {"port",     required_argument, 0, 'P'},
+    {"socket",   required_argument, 0, 'S'},
+    {"user",     required_argument, 0, 'u'},
+    {"password", required_argument, 0, 'p'},
+    {"database", required_argument, 0, 'D'},
+    {"threads",  required_argument, 0, 't'},
+    {"speed",    required_argument, 0, 's'},
+    {"output",   required_argument, 0, 'o'},
+    {"version",  no_argument, 0, 'V'},
+    {"help",     no_argument, 0, '?'},
+    {0, 0, 0, 0}
+};
+
+/**
+ * @return The current monotonic time in microseconds
+ */
+static int64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Wait until it is time to replay something that was captured at @c time.
+ */
+static void wait_for(int64_t time)
+{
+    if (options.speed > 0)
+    {
+        int64_t target = replay_start + (int64_t)((time - capture_start) / options.speed);
+        int64_t now = monotonic_us();
+
+        if (target > now)
+        {
+            usleep(target - now);
+        }
+    }
+}
+
+static int compare_records(const void *a, const void *b)
+{
+    const REPLAY_RECORD *l = (const REPLAY_RECORD*)a;
+    const REPLAY_RECORD *r = (const REPLAY_RECORD*)b;
+
+    if (l->hdr.session != r->hdr.session)
+    {
+        return l->hdr.session < r->hdr.session ? -1 : 1;
+    }
+
+    return l->seq < r->seq ? -1 : l->seq > r->seq;
+}
+
+static int compare_sessions(const void *a, const void *b)
+{
+    const REPLAY_SESSION *l = (const REPLAY_SESSION*)a;
+    const REPLAY_SESSION *r = (const REPLAY_SESSION*)b;
+
+    return l->start < r->start ? -1 : l->start > r->start;
+}
+
+static int compare_latencies(const void *a, const void *b)
+{
+    int64_t l = *(const int64_t*)a;
+    int64_t r = *(const int64_t*)b;
+
+    return l < r ? -1 : l > r;
+}
+
+/**
+ * Read a capture file into memory
+ *
+ * @param filename The capture file
+ * @param size     The size of the file is stored here
+ *
+ * @return The contents of the file or NULL on error
+ */
+static uint8_t* read_capture(const char *filename, size_t *size)
+{
+    FILE *fp = fopen(filename, "rb");
+    uint8_t *data = NULL;
+
+    if (fp == NULL)
+    {
+        printf("ERROR: Failed to open capture file %s: %s.\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    long len;
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        printf("ERROR: Failed to read capture file %s: %s.\n", filename, strerror(errno));
+    }
+    else if ((data = malloc(len ? len : 1)) == NULL)
+    {
+        printf("ERROR: Out of memory.\n");
+    }
+    else if (fread(data, 1, len, fp) != (size_t)len)
+    {
+        printf("ERROR: Failed to read capture file %s.\n", filename);
+        free(data);
+        data = NULL;
+    }
+    else
+    {
+        *size = len;
+    }
+
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Add a statement to a session
+ */
+static bool add_query(REPLAY_SESSION *session, const REPLAY_RECORD *record)
+{
+    if (session->n_queries == session->size)
+    {
+        int size = session->size ? session->size * 2 : 16;
+        REPLAY_QUERY *queries = realloc(session->queries, size * sizeof(REPLAY_QUERY));
+
+        if (queries == NULL)
+        {
+            return false;
+        }
+
+        session->queries = queries;
+        session->size = size;
+    }
+
+    REPLAY_QUERY *query = &session->queries[session->n_queries++];
+    query->time = record->hdr.time;
+    query->packets = record->data;
+    query->len = record->hdr.len;
+    query->captured = -1;
+
+    return true;
+}
+
+/**
+ * Parse the records of a capture file into sessions
+ *
+ * @param data The contents of the capture file
+ * @param size The size of the file
+ *
+ * @return True if the file was valid
+ */
+static bool parse_capture(const uint8_t *data, size_t size)
+{
+    QLA_CAPTURE_HEADER header;
+
+    if (size < sizeof(header))
+    {
+        printf("ERROR: The file is not a capture file.\n");
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, QLA_CAPTURE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        printf("ERROR: The file is not a capture file.\n");
+        return false;
+    }
+    else if (header.version != QLA_CAPTURE_VERSION)
+    {
+        printf("ERROR: Unsupported capture file version %u.\n", header.version);
+        return false;
+    }
+
+    size_t n_records = 0;
+    size_t alloc_records = 0;
+    REPLAY_RECORD *records = NULL;
+    size_t offset = sizeof(header);
+
+    while (offset + sizeof(QLA_CAPTURE_RECORD) <= size)
+    {
+        if (n_records == alloc_records)
+        {
+            alloc_records = alloc_records ? alloc_records * 2 : 1024;
+            REPLAY_RECORD *tmp = realloc(records, alloc_records * sizeof(REPLAY_RECORD));
+
+            if (tmp == NULL)
+            {
+                printf("ERROR: Out of memory.\n");
+                free(records);
+                return false;
+            }
+
+            records = tmp;
+        }
+
+        REPLAY_RECORD *record = &records[n_records];
+        memcpy(&record->hdr, data + offset, sizeof(record->hdr));
+        offset += sizeof(record->hdr);
+
+        if (record->hdr.len > size - offset)
+        {
+            // The last record was cut short, most likely because MaxScale
+            // was still writing the file.
+            break;
+        }
+
+        record->data = data + offset;
+        record->seq = n_records++;
+        offset += record->hdr.len;
+    }
+
+    qsort(records, n_records, sizeof(REPLAY_RECORD), compare_records);
+
+    bool ok = true;
+    size_t i = 0;
+
+    while (ok && i < n_records)
+    {
+        REPLAY_SESSION session = {records[i].hdr.session, records[i].hdr.time};
+
+        for (; ok && i < n_records && records[i].hdr.session == session.id; i++)
+        {
+            const REPLAY_RECORD *record = &records[i];
+
+            switch (record->hdr.type)
+            {
+            case QLA_CAPTURE_QUERY:
+                ok = add_query(&session, record);
+                break;
+
+            case QLA_CAPTURE_REPLY:
+                // The reply belongs to the latest statement of the session
+                if (session.n_queries > 0 && record->hdr.len >= sizeof(QLA_CAPTURE_REPLY_DATA))
+                {
+                    QLA_CAPTURE_REPLY_DATA reply;
+                    memcpy(&reply, record->data, sizeof(reply));
+                    session.queries[session.n_queries - 1].captured = reply.latency;
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            if (record->hdr.time > capture_end)
+            {
+                capture_end = record->hdr.time;
+            }
+        }
+
+        if (ok && session.n_queries > 0)
+        {
+            REPLAY_SESSION *tmp = realloc(sessions, (n_sessions + 1) * sizeof(REPLAY_SESSION));
+
+            if (tmp)
+            {
+                sessions = tmp;
+                sessions[n_sessions++] = session;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            free(session.queries);
+        }
+    }
+
+    free(records);
+
+    if (!ok)
+    {
+        printf("ERROR: Out of memory.\n");
+        return false;
+    }
+
+    qsort(sessions, n_sessions, sizeof(REPLAY_SESSION), compare_sessions);
+
+    if (n_sessions > 0)
+    {
+        capture_start = sessions[0].start;
+    }
+
+    return true;
+}
+
+/**
+ * Execute one captured statement
+ *
+ * @param mysql   The connection
+ * @param query   The statement
+ * @param result  The result of the statement
+ *
+ * @return False if the connection was lost or the client quit
+ */
+static bool execute_query(MYSQL *mysql, const REPLAY_QUERY *query, REPLAY_RESULT *result)
+{
+    // Join the payloads of the packets of the statement
+    char *payload = malloc(query->len);
+    size_t len = 0;
+
+    if (payload == NULL)
+    {
+        result->error = true;
+        return true;
+    }
+
+    for (size_t pos = 0; pos + 4 <= query->len;)
+    {
+        const uint8_t *p = query->packets + pos;
+        size_t pktlen = p[0] | (p[1] << 8) | (p[2] << 16);
+
+        if (pktlen > query->len - pos - 4)
+        {
+            pktlen = query->len - pos - 4;
+        }
+
+        memcpy(payload + len, p + 4, pktlen);
+        len += pktlen;
+        pos += pktlen + 4;
+    }
+
+    if (len == 0)
+    {
+        free(payload);
+        return true;
+    }
+
+    bool rval = true;
+    bool replayed = true;
+    int64_t start = monotonic_us();
+
+    result->command = payload[0];
+
+    switch (result->command)
+    {
+    case MYSQL_COM_QUERY:
+        if (mysql_real_query(mysql, payload + 1, len - 1) == 0)
+        {
+            do
+            {
+                MYSQL_RES *res = mysql_store_result(mysql);
+
+                if (res)
+                {
+                    mysql_free_result(res);
+                }
+            }
+            while (mysql_next_result(mysql) == 0);
+        }
+        break;
+
+    case MYSQL_COM_INIT_DB:
+        {
+            char *db = strndup(payload + 1, len - 1);
+
+            if (db)
+            {
+                mysql_select_db(mysql, db);
+                free(db);
+            }
+        }
+        break;
+
+    case MYSQL_COM_PING:
+        mysql_ping(mysql);
+        break;
+
+    case MYSQL_COM_QUIT:
+        replayed = false;
+        rval = false;
+        break;
+
+    default:
+        replayed = false;
+        break;
+    }
+
+    if (replayed)
+    {
+        unsigned int err = mysql_errno(mysql);
+        result->replayed = monotonic_us() - start;
+        result->error = err != 0;
+
+        if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        {
+            rval = false;
+        }
+    }
+
+    free(payload);
+    return rval;
+}
+
+/**
+ * Replay one session
+ */
+static void replay_session(REPLAY_SESSION *session)
+{
+    MYSQL *mysql = mysql_init(NULL);
+
+    wait_for(session->start);
+
+    if (mysql == NULL ||
+        mysql_real_connect(mysql, options.host, options.user, options.password, options.database,
+                           options.port, options.socket,
+                           CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS) == NULL)
+    {
+        if (mysql)
+        {
+            printf("ERROR: Failed to connect to %s: %s\n", options.host, mysql_error(mysql));
+        }
+
+        session->failed = true;
+    }
+    else
+    {
+        for (int i = 0; i < session->n_queries; i++)
+        {
+            wait_for(session->queries[i].time);
+
+            if (!execute_query(mysql, &session->queries[i], &session->results[i]))
+            {
+                break;
+            }
+        }
+    }
+
+    mysql_close(mysql);
+}
+
+/**
+ * The replaying threads, which take the sessions in the order they started
+ */
+static void* replay_thread(void *data)
+{
+    mysql_thread_init();
+
+    int i;
+
+    while ((i = __sync_fetch_and_add(&next_session, 1)) < n_sessions)
+    {
+        replay_session(&sessions[i]);
+    }
+
+    mysql_thread_end();
+    return NULL;
+}
+
+/**
+ * Write the results of the statements into a CSV file
+ */
+static bool write_results(const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+
+    if (fp == NULL)
+    {
+        printf("ERROR: Failed to open %s: %s.\n", filename, strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "session,offset_us,command,captured_us,replayed_us,error\n");
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        REPLAY_SESSION *session = &sessions[i];
+
+        for (int j = 0; j < session->n_queries; j++)
+        {
+            REPLAY_QUERY *query = &session->queries[j];
+            REPLAY_RESULT *result = &session->results[j];
+
+            fprintf(fp, "%" PRIu64 ",%" PRId64 ",%u,%" PRId64 ",%" PRId64 ",%d\n",
+                    session->id, query->time - capture_start, result->command,
+                    query->captured, result->replayed, result->error);
+        }
+    }
+
+    return fclose(fp) == 0;
+}
+
+/**
+ * @return The nearest-rank percentile of sorted values
+ */
+static int64_t percentile(const int64_t *values, size_t n, double q)
+{
+    size_t rank = (size_t)ceil(q * n);
+    return n ? values[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+static double average(const int64_t *values, size_t n)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += values[i];
+    }
+
+    return n ? sum / n : 0;
+}
+
+/**
+ * Print the summary of the replay
+ *
+ * The latencies are compared only for the statements whose captured latency
+ * is known and which were replayed without an error.
+ */
+static void print_summary(int64_t duration)
+{
+    size_t n_queries = 0;
+    size_t n_replayed = 0;
+    size_t n_skipped = 0;
+    size_t n_errors = 0;
+    int n_failed = 0;
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        n_queries += sessions[i].n_queries;
+        n_failed += sessions[i].failed;
+    }
+
+    int64_t *captured = malloc((n_queries + 1) * sizeof(int64_t));
+    int64_t *replayed = malloc((n_queries + 1) * sizeof(int64_t));
+    size_t n = 0;
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        for (int j = 0; j < sessions[i].n_queries; j++)
+        {
+            REPLAY_QUERY *query = &sessions[i].queries[j];
+            REPLAY_RESULT *result = &sessions[i].results[j];
+
+            if (result->replayed < 0)
+            {
+                // The end of the session is not a skipped statement
+                if (result->command != MYSQL_COM_QUIT)
+                {
+                    n_skipped++;
+                }
+            }
+            else
+            {
+                n_replayed++;
+
+                if (result->error)
+                {
+                    n_errors++;
+                }
+                else if (query->captured >= 0 && captured && replayed)
+                {
+                    captured[n] = query->captured;
+                    replayed[n] = result->replayed;
+                    n++;
+                }
+            }
+        }
+    }
+
+    printf("Sessions:            %d (%d failed to connect)\n", n_sessions, n_failed);
+    printf("Statements:          %zu\n", n_queries);
+    printf("Replayed:            %zu\n", n_replayed);
+    printf("Skipped:             %zu\n", n_skipped);
+    printf("Errors:              %zu\n", n_errors);
+    printf("Duration (s):        captured %.3f, replayed %.3f\n",
+           (capture_end - capture_start) / 1000000.0, duration / 1000000.0);
+
+    if (n > 0)
+    {
+        qsort(captured, n, sizeof(int64_t), compare_latencies);
+        qsort(replayed, n, sizeof(int64_t), compare_latencies);
+
+        printf("\nLatency (ms) of %zu statements\n", n);
+        printf("               Captured    Replayed\n");
+        printf("  average    %10.3f  %10.3f\n", average(captured, n) / 1000, average(replayed, n) / 1000);
+
+        const struct
+        {
+            const char *name;
+            double      q;
+        } quantiles[] =
+        {
+            {"50%", 0.5}, {"90%", 0.9}, {"99%", 0.99}, {"max", 1.0}
+        };
+
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+        {
+            printf("  %-8s   %10.3f  %10.3f\n", quantiles[i].name,
+                   percentile(captured, n, quantiles[i].q) / 1000.0,
+                   percentile(replayed, n, quantiles[i].q) / 1000.0);
+        }
+    }
+
+    free(captured);
+    free(replayed);
+}
+
+/**
+ * Print version information
+ */
+static void
+printVersion(const char *progname)
+{
+    printf("%s Version %s\n", progname, replay_version);
+}
+
+/**
+ * Display the --help text.
+ */
+static void
+printUsage(const char *progname)
+{
+    printVersion(progname);
+
+    printf("Replays a workload captured by the qlafilter with log_type=capture.\n\n");
+    printf("Usage: %s [OPTIONS] <capture file>\n\n", progname);
+    printf("  -h|--host         Host to connect to (default 127.0.0.1)\n");
+    printf("  -P|--port         Port to connect to (default 3306)\n");
+    printf("  -S|--socket       Unix domain socket to connect to\n");
+    printf("  -u|--user         User name\n");
+    printf("  -p|--password     Password\n");
+    printf("  -D|--database     Default database of the sessions\n");
+    printf("  -t|--threads      Number of sessions replayed at the same time (default %d)\n",
+           REPLAY_DEFAULT_THREADS);
+    printf("  -s|--speed        Speed relative to the capture, 0 for as fast as possible (default 1)\n");
+    printf("  -o|--output       Write the latencies of the statements into this CSV file\n");
+    printf("  -V|--version      Print version information and exit\n");
+    printf("  -?|--help         Print this help text\n");
+}
+
+int main(int argc, char **argv)
+{
+    int option_index = 0;
+    const char *output = NULL;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "h:P:S:u:p:D:t:s:o:V?", long_options, &option_index)) >= 0)
+    {
+        switch (c)
+        {
+        case 'h':
+            options.host = optarg;
+            break;
+        case 'P':
+            options.port = atoi(optarg);
+            break;
+        case 'S':
+            options.socket = optarg;
+            break;
+        case 'u':
+            options.user = optarg;
+            break;
+        case 'p':
+            options.password = optarg;
+            break;
+        case 'D':
+            options.database = optarg;
+            break;
+        case 't':
+            options.threads = atoi(optarg);
+            break;
+        case 's':
+            options.speed = atof(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'V':
+            printVersion(*argv);
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            printUsage(*argv);
+            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+    if (argv[optind] == NULL)
+    {
+        printf("ERROR: No capture file was specified.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.threads < 1 || options.speed < 0)
+    {
+        printf("ERROR: The number of threads must be positive and the speed non-negative.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = 0;
+    uint8_t *data = read_capture(argv[optind], &size);
+
+    if (data == NULL || !parse_capture(data, size))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        if ((sessions[i].results = calloc(sessions[i].n_queries, sizeof(REPLAY_RESULT))) == NULL)
+        {
+            printf("ERROR: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int j = 0; j < sessions[i].n_queries; j++)
+        {
+            sessions[i].results[j].replayed = -1;
+        }
+    }
+
+    if (mysql_library_init(0, NULL, NULL))
+    {
+        printf("ERROR: Failed to initialize the client library.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int n_threads = options.threads < n_sessions ? options.threads : n_sessions;
+    pthread_t threads[n_threads > 0 ? n_threads : 1];
+
+    replay_start = monotonic_us();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, replay_thread, NULL) != 0)
+        {
+            printf("ERROR: Failed to start thread %d.\n", i);
+            n_threads = i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    int64_t duration = monotonic_us() - replay_start;
+    int rval = EXIT_SUCCESS;
+
+    print_summary(duration);
+
+    if (output && !write_results(output))
+    {
+        rval = EXIT_FAILURE;
+    }
+
+    mysql_library_end();
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        free(sessions[i].queries);
+        free(sessions[i].results);
+    }
+
+    free(sessions);
+    free(data);
+
+    return rval;
+}
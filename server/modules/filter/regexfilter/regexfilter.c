@@ -24,6 +24,7 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/platform.h>
 
 /**
  * @file regexfilter.c - a very simple regular expression rewrite filter.
@@ -51,9 +52,13 @@ static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
-static char *regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *study,
+static void thread_finish();
+static char *regex_replace(const char *sql, pcre2_code *re, uint32_t match_pairs,
                            const char *replace);
 
+/** Maximum length of the literal string used to skip non-matching queries */
+#define REGEX_LITERAL_MAX 64
+
 /**
  * Instance structure
  */
@@ -64,7 +69,10 @@ typedef struct
     char *match; /*< Regular expression to match */
     char *replace; /*< Replacement text */
     pcre2_code *re; /*< Compiled regex text */
-    pcre2_match_data *match_data; /*< Matching data used by the compiled regex */
+    uint32_t match_pairs; /*< Number of offset pairs the compiled regex needs */
+    char literal[REGEX_LITERAL_MAX]; /*< String every matching query contains */
+    size_t literal_len; /*< Length of the literal, 0 if there is none */
+    bool caseless; /*< Whether the regex ignores case */
     FILE* logfile; /*< Log file */
     bool log_trace; /*< Whether messages should be printed to tracelog */
 } REGEX_INSTANCE;
@@ -81,6 +89,10 @@ typedef struct
     int active; /* Is filter active */
 } REGEX_SESSION;
 
+/** Matching data of the current thread, shared by all instances */
+static thread_local pcre2_match_data *thr_match_data = NULL;
+static thread_local uint32_t thr_match_pairs = 0;
+
 void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new);
 void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old);
 
@@ -127,7 +139,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Process init. */
         NULL, /* Process finish. */
         NULL, /* Thread init. */
-        NULL, /* Thread finish. */
+        thread_finish, /* Thread finish. */
         {
             {"match", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
             {"replace", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
@@ -156,11 +168,6 @@ void free_instance(REGEX_INSTANCE *instance)
             pcre2_code_free(instance->re);
         }
 
-        if (instance->match_data)
-        {
-            pcre2_match_data_free(instance->match_data);
-        }
-
         MXS_FREE(instance->match);
         MXS_FREE(instance->replace);
         MXS_FREE(instance->source);
@@ -226,14 +233,18 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             return NULL;
         }
 
-        if ((my_instance->match_data =
-                 pcre2_match_data_create_from_pattern(my_instance->re, NULL)) == NULL)
-        {
-            MXS_ERROR("Failure to create PCRE2 matching data. "
-                      "This is most likely caused by a lack of available memory.");
-            free_instance(my_instance);
-            return NULL;
-        }
+        // We do not care about the result. If JIT is not present, the
+        // interpreter is used.
+        pcre2_jit_compile(my_instance->re, PCRE2_JIT_COMPLETE);
+
+        uint32_t captures = 0;
+        pcre2_pattern_info(my_instance->re, PCRE2_INFO_CAPTURECOUNT, &captures);
+        my_instance->match_pairs = captures + 1;
+
+        my_instance->caseless = cflags & PCRE2_CASELESS;
+        my_instance->literal_len = mxs_pcre2_get_literal(my_instance->match, my_instance->caseless,
+                                                         my_instance->literal,
+                                                         sizeof(my_instance->literal));
     }
 
     return (MXS_FILTER *) my_instance;
@@ -335,12 +346,25 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 
     if (my_session->active && modutil_is_SQL(queue))
     {
-        if ((sql = modutil_get_SQL(queue)) != NULL)
+        char *ptr;
+        int len;
+
+        /** Only queries that contain the literal string of the regex can match it */
+        bool candidate = my_instance->literal_len == 0 ||
+                         !modutil_extract_SQL(queue, &ptr, &len) ||
+                         mxs_pcre2_has_literal(ptr, len, my_instance->literal,
+                                               my_instance->literal_len, my_instance->caseless);
+
+        if (!candidate && !my_instance->logfile && !my_instance->log_trace)
+        {
+            my_session->no_change++;
+        }
+        else if ((sql = modutil_get_SQL(queue)) != NULL)
         {
-            newsql = regex_replace(sql,
-                                   my_instance->re,
-                                   my_instance->match_data,
-                                   my_instance->replace);
+            newsql = candidate ? regex_replace(sql,
+                                               my_instance->re,
+                                               my_instance->match_pairs,
+                                               my_instance->replace) : NULL;
             if (newsql)
             {
                 queue = modutil_replace_SQL(queue, newsql);
@@ -406,23 +430,54 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     }
 }
 
+/**
+ * Get the matching data of the calling thread. The data is allocated once
+ * per thread and grown when a regex needs more offset pairs.
+ *
+ * @param   pairs Number of offset pairs needed
+ * @return  The matching data or NULL if memory allocation failed
+ */
+static pcre2_match_data* get_match_data(uint32_t pairs)
+{
+    if (thr_match_pairs < pairs)
+    {
+        pcre2_match_data_free(thr_match_data);
+        thr_match_data = pcre2_match_data_create(pairs, NULL);
+        thr_match_pairs = thr_match_data ? pairs : 0;
+    }
+
+    return thr_match_data;
+}
+
+/**
+ * Free the matching data of a thread that terminates.
+ */
+static void thread_finish()
+{
+    pcre2_match_data_free(thr_match_data);
+    thr_match_data = NULL;
+    thr_match_pairs = 0;
+}
+
 /**
  * Perform a regular expression match and substitution on the SQL
  *
  * @param   sql The original SQL text
  * @param   re  The compiled regular expression
- * @param   match_data The PCRE2 matching data buffer
+ * @param   match_pairs Number of offset pairs the regular expression needs
  * @param   replace The replacement text
  * @return  The replaced text or NULL if no replacement was done.
  */
 static char *
-regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, const char *replace)
+regex_replace(const char *sql, pcre2_code *re, uint32_t match_pairs, const char *replace)
 {
     char *result = NULL;
     size_t result_size;
+    pcre2_match_data *match_data = get_match_data(match_pairs);
 
-    /** This should never fail with rc == 0 because we used pcre2_match_data_create_from_pattern() */
-    if (pcre2_match(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) > 0)
+    /** This should never fail with rc == 0 because the match data has room for all pairs */
+    if (match_data &&
+        pcre2_match(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) > 0)
     {
         result_size = strlen(sql) + strlen(replace);
         result = MXS_MALLOC(result_size);
@@ -29,6 +29,10 @@
  *          of the request (optional)
  * user     A user name to match against. If present only requests that
  *          originate from this user will be duplciated (optional)
+ * sample_every        Duplicate only every Nth statement (optional)
+ * sample_percentage   Duplicate only this percentage of the statements (optional)
+ * skip_repeated_reads Seconds during which a read with the same canonical
+ *                     form is not duplicated again (optional)
  *
  * Revision History
  * ================
@@ -60,6 +64,11 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/clock.h>
+#include <maxscale/platform.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/random_jkiss.h>
 
 #define MYSQL_COM_QUIT                  0x01
 #define MYSQL_COM_INITDB                0x02
@@ -77,6 +86,22 @@
 #define PARENT                          0
 #define CHILD                           1
 
+/** The maximum number of queued clones routed to the branch at a time */
+#define TEE_QUEUE_BATCH                 16
+
+/** Number of recently duplicated reads remembered by a thread */
+#define TEE_SEEN_SIZE                   4096
+
+/** Reads longer than this are always duplicated */
+#define TEE_SEEN_MAX_SQL_LEN            4096
+
+/** What is dropped when the queue of a session is full */
+enum tee_drop_policy
+{
+    TEE_DROP_NEWEST, /* The clone that does not fit */
+    TEE_DROP_OLDEST  /* The oldest queued clone */
+};
+
 #ifdef SS_DEBUG
 static int debug_seq = 0;
 #endif
@@ -122,8 +147,42 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
     regex_t nore; /* Compiled regex nomatch text */
+    int queue_size; /* Clones queued per session, 0 for routing them directly */
+    int drop_policy; /* What to drop when the queue is full */
+    uint64_t n_queued; /* Total number of clones queued */
+    uint64_t n_dropped; /* Total number of clones dropped */
+    int sample_every; /* Duplicate every Nth statement */
+    int sample_percentage; /* Percentage of statements duplicated */
+    int skip_repeated_reads; /* Seconds a duplicated read is remembered, 0 for never */
+    uint64_t n_unsampled; /* Total number of clones left out by the sampling */
+    uint64_t n_repeated; /* Total number of repeated reads not duplicated */
 } TEE_INSTANCE;
 
+/**
+ * A read recently duplicated to a branch. The reads are remembered by the
+ * canonical form of the statement, and the default database, in a table
+ * of each thread, so that identical reads of any session are executed on
+ * the branch only once in a while.
+ */
+typedef struct tee_seen
+{
+    const TEE_INSTANCE *owner; /* The filter that duplicated the read, NULL if unused */
+    uint64_t hash; /* Hash of the canonical form and the default database */
+    uint64_t when; /* When the read was duplicated, in milliseconds */
+} TEE_SEEN;
+
+static thread_local TEE_SEEN *thr_seen = NULL;
+
+/**
+ * A clone waiting to be routed to the branch session.
+ */
+typedef struct tee_queued
+{
+    GWBUF *buffer; /* The clone */
+    bool required; /* The clone keeps the branch consistent and may not be dropped */
+    struct tee_queued *next;
+} TEE_QUEUED;
+
 /**
  * The session structure for this TEE filter.
  * This stores the downstream filter information, such that the
@@ -156,6 +215,16 @@ typedef struct
     GWBUF* queue;
     SPINLOCK tee_lock;
     DCB* client_dcb;
+    MXS_SESSION *session; /* The parent session */
+    TEE_QUEUED *queue_head; /* The clones waiting to be routed to the branch */
+    TEE_QUEUED *queue_tail;
+    int n_queue; /* Number of clones in the queue */
+    bool task_posted; /* Whether a task routing the queue has been posted */
+    int n_dropped; /* Number of clones dropped because the queue was full */
+    unsigned int n_sample; /* Number of statements considered for sampling */
+    bool continued; /* The previous clone was followed by the rest of a large statement */
+    bool skip_continued; /* Whether the previous clone was left out */
+    int n_skipped; /* Number of clones left out by the sampling or as repeated reads */
 
 #ifdef SS_DEBUG
     long d_id;
@@ -187,6 +256,9 @@ int route_single_query(TEE_INSTANCE* my_instance,
                        GWBUF* clone);
 int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer);
 void create_orphan(MXS_SESSION* ses);
+static void tee_queue_clear(TEE_SESSION* my_session);
+static void tee_enqueue(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone);
+static bool tee_skip_clone(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone);
 
 static void
 orphan_free(void* data)
@@ -289,6 +361,13 @@ static const MXS_ENUM_VALUE option_values[] =
     {NULL}
 };
 
+static const MXS_ENUM_VALUE drop_policy_values[] =
+{
+    {"newest", TEE_DROP_NEWEST},
+    {"oldest", TEE_DROP_OLDEST},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -344,6 +423,17 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 option_values
             },
+            {"queue_size", MXS_MODULE_PARAM_COUNT, "0"},
+            {
+                "drop_policy",
+                MXS_MODULE_PARAM_ENUM,
+                "newest",
+                MXS_MODULE_OPT_NONE,
+                drop_policy_values
+            },
+            {"sample_every", MXS_MODULE_PARAM_COUNT, "1"},
+            {"sample_percentage", MXS_MODULE_PARAM_COUNT, "100"},
+            {"skip_repeated_reads", MXS_MODULE_PARAM_COUNT, "0"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -373,9 +463,26 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->userName = config_copy_string(params, "user");
         my_instance->match = config_copy_string(params, "match");
         my_instance->nomatch = config_copy_string(params, "exclude");
+        my_instance->queue_size = config_get_integer(params, "queue_size");
+        my_instance->drop_policy = config_get_enum(params, "drop_policy", drop_policy_values);
+        my_instance->sample_every = config_get_integer(params, "sample_every");
+        my_instance->sample_percentage = config_get_integer(params, "sample_percentage");
+        my_instance->skip_repeated_reads = config_get_integer(params, "skip_repeated_reads");
 
         int cflags = config_get_enum(params, "options", option_values);
 
+        if (my_instance->sample_every < 1 || my_instance->sample_percentage > 100)
+        {
+            MXS_ERROR("The value of sample_every must be at least 1 and the value of "
+                      "sample_percentage at most 100.");
+            MXS_FREE(my_instance->match);
+            MXS_FREE(my_instance->nomatch);
+            MXS_FREE(my_instance->source);
+            MXS_FREE(my_instance->userName);
+            MXS_FREE(my_instance);
+            return NULL;
+        }
+
         if (my_instance->match && regcomp(&my_instance->re, my_instance->match, cflags))
         {
             MXS_ERROR("Invalid regular expression '%s' for the match parameter.",
@@ -450,6 +557,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->residual = 0;
         my_session->tee_replybuf = NULL;
         my_session->client_dcb = session->client_dcb;
+        my_session->session = session;
         my_session->instance = my_instance;
         my_session->client_multistatement = false;
         my_session->queue = NULL;
@@ -614,6 +722,7 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     {
         gwbuf_free(my_session->tee_replybuf);
     }
+    tee_queue_clear(my_session);
     MXS_FREE(session);
 
     orphan_free(NULL);
@@ -739,12 +848,48 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match		%s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->queue_size > 0)
+    {
+        dcb_printf(dcb, "\t\tQueued statements per session	%d\n",
+                   my_instance->queue_size);
+        dcb_printf(dcb, "\t\tTotal statements queued:	%lu\n",
+                   atomic_load_uint64(&my_instance->n_queued));
+        dcb_printf(dcb, "\t\tTotal statements dropped:	%lu\n",
+                   atomic_load_uint64(&my_instance->n_dropped));
+    }
+    if (my_instance->sample_every > 1 || my_instance->sample_percentage < 100)
+    {
+        dcb_printf(dcb, "\t\tDuplicate every Nth statement:	%d\n",
+                   my_instance->sample_every);
+        dcb_printf(dcb, "\t\tPercentage duplicated:		%d\n",
+                   my_instance->sample_percentage);
+        dcb_printf(dcb, "\t\tTotal statements not sampled:	%lu\n",
+                   atomic_load_uint64(&my_instance->n_unsampled));
+    }
+    if (my_instance->skip_repeated_reads > 0)
+    {
+        dcb_printf(dcb, "\t\tSkip reads repeated within	%d seconds\n",
+                   my_instance->skip_repeated_reads);
+        dcb_printf(dcb, "\t\tTotal repeated reads skipped:	%lu\n",
+                   atomic_load_uint64(&my_instance->n_repeated));
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of statements duplicated:	%d.\n",
                    my_session->n_duped);
         dcb_printf(dcb, "\t\tNo. of statements rejected:	%d.\n",
                    my_session->n_rejected);
+        if (my_instance->queue_size > 0)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                       my_session->n_dropped);
+        }
+        if (my_instance->sample_every > 1 || my_instance->sample_percentage < 100 ||
+            my_instance->skip_repeated_reads > 0)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements skipped:	%d.\n",
+                       my_session->n_skipped);
+        }
     }
 }
 
@@ -884,11 +1029,23 @@ int route_single_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF
         rval = my_session->down.routeQuery(my_session->down.instance,
                                            my_session->down.session,
                                            buffer);
+
+        if (clone && tee_skip_clone(my_instance, my_session, clone))
+        {
+            my_session->n_skipped++;
+            gwbuf_free(clone);
+            clone = NULL;
+        }
+
         if (clone)
         {
             my_session->n_duped++;
 
-            if (my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
+            if (my_instance->queue_size > 0)
+            {
+                tee_enqueue(my_instance, my_session, clone);
+            }
+            else if (my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
             {
                 MXS_SESSION_ROUTE_QUERY(my_session->branch_session, clone);
             }
@@ -960,3 +1117,296 @@ void create_orphan(MXS_SESSION* ses)
         spinlock_release(&orphanLock);
     }
 }
+
+/**
+ * Free the clones that have not been routed to the branch.
+ * @param my_session Tee session
+ */
+static void tee_queue_clear(TEE_SESSION* my_session)
+{
+    while (my_session->queue_head)
+    {
+        TEE_QUEUED *queued = my_session->queue_head;
+        my_session->queue_head = queued->next;
+        gwbuf_free(queued->buffer);
+        MXS_FREE(queued);
+    }
+
+    my_session->queue_tail = NULL;
+    my_session->n_queue = 0;
+}
+
+/**
+ * Route the queued clones of a session to the branch. The task is executed by
+ * the thread of the session, after the events that were being processed when
+ * it was posted, so routing to the branch does not delay the main branch. At
+ * most TEE_QUEUE_BATCH clones are routed at a time, after which the task is
+ * posted again.
+ * @param thread_id The thread of the session
+ * @param data The tee session
+ */
+static void tee_route_queued(int thread_id, void* data)
+{
+    TEE_SESSION *my_session = (TEE_SESSION*)data;
+    MXS_SESSION *session = my_session->session;
+
+    for (int i = 0; i < TEE_QUEUE_BATCH && my_session->queue_head; i++)
+    {
+        if (!my_session->active || my_session->branch_session == NULL ||
+            my_session->branch_session->state != SESSION_STATE_ROUTER_READY)
+        {
+            tee_queue_clear(my_session);
+            break;
+        }
+
+        TEE_QUEUED *queued = my_session->queue_head;
+
+        if ((my_session->queue_head = queued->next) == NULL)
+        {
+            my_session->queue_tail = NULL;
+        }
+        my_session->n_queue--;
+
+        MXS_SESSION_ROUTE_QUERY(my_session->branch_session, queued->buffer);
+        MXS_FREE(queued);
+    }
+
+    if (my_session->queue_head && poll_post_task(thread_id, tee_route_queued, my_session))
+    {
+        // The reference of the session is passed on to the next task.
+        return;
+    }
+
+    tee_queue_clear(my_session);
+    my_session->task_posted = false;
+    session_put_ref(session);
+}
+
+/**
+ * Remove the oldest clone that may be dropped from the queue.
+ * @param my_session Tee session
+ * @return True if a clone was removed
+ */
+static bool tee_drop_oldest(TEE_SESSION* my_session)
+{
+    TEE_QUEUED **link = &my_session->queue_head;
+    TEE_QUEUED *prev = NULL;
+
+    while (*link && (*link)->required)
+    {
+        prev = *link;
+        link = &(*link)->next;
+    }
+
+    TEE_QUEUED *queued = *link;
+
+    if (queued)
+    {
+        *link = queued->next;
+
+        if (my_session->queue_tail == queued)
+        {
+            my_session->queue_tail = prev;
+        }
+
+        my_session->n_queue--;
+        gwbuf_free(queued->buffer);
+        MXS_FREE(queued);
+    }
+
+    return queued != NULL;
+}
+
+/**
+ * Queue a clone for the branch. If the queue is full, a clone is dropped
+ * according to the drop policy, except the ones that are required for keeping
+ * the state of the branch session consistent.
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param clone The clone
+ */
+static void tee_enqueue(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone)
+{
+    bool required = packet_is_required(clone);
+    TEE_QUEUED *queued = NULL;
+
+    if (my_session->n_queue >= my_instance->queue_size && !required)
+    {
+        my_session->n_dropped++;
+        atomic_add_uint64(&my_instance->n_dropped, 1);
+
+        if (my_instance->drop_policy == TEE_DROP_NEWEST || !tee_drop_oldest(my_session))
+        {
+            gwbuf_free(clone);
+            return;
+        }
+    }
+
+    if ((queued = MXS_MALLOC(sizeof(TEE_QUEUED))) == NULL)
+    {
+        my_session->n_dropped++;
+        atomic_add_uint64(&my_instance->n_dropped, 1);
+        gwbuf_free(clone);
+        return;
+    }
+
+    queued->buffer = clone;
+    queued->required = required;
+    queued->next = NULL;
+
+    if (my_session->queue_tail)
+    {
+        my_session->queue_tail->next = queued;
+    }
+    else
+    {
+        my_session->queue_head = queued;
+    }
+
+    my_session->queue_tail = queued;
+    my_session->n_queue++;
+    atomic_add_uint64(&my_instance->n_queued, 1);
+
+    if (!my_session->task_posted)
+    {
+        // The reference keeps the session alive until the task has been executed.
+        session_get_ref(my_session->session);
+
+        if (poll_post_task(my_session->client_dcb->thread.id, tee_route_queued, my_session))
+        {
+            my_session->task_posted = true;
+        }
+        else
+        {
+            session_put_ref(my_session->session);
+            tee_queue_clear(my_session);
+        }
+    }
+}
+
+/**
+ * Check whether a read was duplicated to the branch recently and if not,
+ * remember it if it is a read.
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param clone The clone
+ * @return True if the same read was duplicated within skip_repeated_reads seconds
+ */
+static bool tee_read_is_repeated(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone)
+{
+    char* sql;
+    int len;
+
+    if (!modutil_extract_SQL(clone, &sql, &len) || len > TEE_SEEN_MAX_SQL_LEN)
+    {
+        return false;
+    }
+
+    if (thr_seen == NULL && (thr_seen = MXS_CALLOC(TEE_SEEN_SIZE, sizeof(TEE_SEEN))) == NULL)
+    {
+        return false;
+    }
+
+    char canonical[len + 1];
+    uint64_t hash;
+    modutil_canonicalize(sql, len, canonical, &hash);
+
+    /** The same statement reads different tables in different databases */
+    MYSQL_session* data = (MYSQL_session*)my_session->client_dcb->data;
+
+    for (const char* db = data ? data->db : ""; *db; db++)
+    {
+        hash = (hash ^ (uint8_t)*db) * 0x100000001b3ULL;
+    }
+
+    TEE_SEEN* seen = &thr_seen[hash % TEE_SEEN_SIZE];
+    uint64_t now = mxs_clock_ms();
+
+    if (seen->owner == my_instance && seen->hash == hash &&
+        now - seen->when < (uint64_t)my_instance->skip_repeated_reads * 1000)
+    {
+        return true;
+    }
+
+    /** A read with the same canonical form is a read as well, so only the
+     * reads that are not found need to be classified */
+    uint32_t type = qc_get_type_mask(clone);
+
+    if (qc_get_operation(clone) == QUERY_OP_SELECT && (type & QUERY_TYPE_READ) &&
+        (type & ~(QUERY_TYPE_READ | QUERY_TYPE_LOCAL_READ)) == 0)
+    {
+        seen->owner = my_instance;
+        seen->hash = hash;
+        seen->when = now;
+    }
+
+    return false;
+}
+
+/** The types of the statements that change the state of the session */
+#define TEE_SESSION_STATE_TYPES (QUERY_TYPE_SESSION_WRITE | QUERY_TYPE_USERVAR_WRITE | \
+                                 QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_BEGIN_TRX | \
+                                 QUERY_TYPE_COMMIT | QUERY_TYPE_ROLLBACK | \
+                                 QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_DISABLE_AUTOCOMMIT | \
+                                 QUERY_TYPE_PREPARE_NAMED_STMT | QUERY_TYPE_CREATE_TMP_TABLE)
+
+/**
+ * Check whether a statement changes the state of the session, for example the
+ * default database, a variable, the transaction or autocommit. Leaving one of
+ * these out would leave the branch session in a different state, e.g. inside
+ * a transaction that is never committed.
+ * @param clone The clone
+ * @return True if the statement changes the state of the session
+ */
+static bool tee_changes_session_state(GWBUF* clone)
+{
+    return modutil_is_SQL(clone) && (qc_get_type_mask(clone) & TEE_SESSION_STATE_TYPES);
+}
+
+/**
+ * Check whether a clone is left out instead of being routed to the branch.
+ * Statements that keep the branch session consistent are always routed. Of
+ * the others, only the sampled ones are routed unless they change the state
+ * of the session, and of those, the reads that were duplicated recently are
+ * not. Only the statements that the sampling would leave out are classified. The parts of a large statement are routed
+ * or left out together.
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param clone The clone
+ * @return True if the clone should not be routed to the branch
+ */
+static bool tee_skip_clone(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone)
+{
+    bool skip = false;
+
+    if (my_session->continued)
+    {
+        skip = my_session->skip_continued;
+    }
+    else if (!packet_is_required(clone))
+    {
+        if ((my_instance->sample_every > 1 &&
+             my_session->n_sample++ % my_instance->sample_every != 0) ||
+            (my_instance->sample_percentage < 100 &&
+             random_jkiss() % 100 >= (unsigned int)my_instance->sample_percentage))
+        {
+            skip = !tee_changes_session_state(clone);
+        }
+
+        if (skip)
+        {
+            atomic_add_uint64(&my_instance->n_unsampled, 1);
+        }
+        else if (my_instance->skip_repeated_reads > 0 && modutil_is_SQL(clone) &&
+                 tee_read_is_repeated(my_instance, my_session, clone))
+        {
+            atomic_add_uint64(&my_instance->n_repeated, 1);
+            skip = true;
+        }
+    }
+
+    my_session->continued = MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(clone)) == GW_MYSQL_MAX_PACKET_LEN;
+    my_session->skip_continued = skip;
+
+    return skip;
+}
@@ -46,6 +46,18 @@
 #include <regex.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/modulecmd.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/spinlock.h>
+
+/** The number of queries each thread tracks per reported query */
+#define TOPN_GLOBAL_CAPACITY_FACTOR 10
+
+/** The longest canonical statement that is stored, longer ones are truncated */
+#define TOPN_GLOBAL_MAX_SQL 1024
+
+/** The number of buckets in the latency histograms; bucket i holds durations below 2^i us */
+#define TOPN_HISTOGRAM_SIZE 32
 
 /*
  * The filter entry points
@@ -60,6 +72,7 @@ static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
+static bool topn_show_global(const MODULECMD_ARG *argv);
 
 /**
  * A instance structure, the assumption is that the option passed
@@ -80,8 +93,42 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
     regex_t exre; /* Compiled regex nomatch text */
+    int global_topN; /* Number of queries to report over all sessions, 0 if disabled */
+    struct topn_summary *summaries; /* Per thread summaries of all sessions */
+    int n_summaries; /* Number of summaries */
 } TOPN_INSTANCE;
 
+/**
+ * A statement tracked over all sessions. The statements are identified by the
+ * hash of their canonical form.
+ */
+typedef struct topn_global_entry
+{
+    uint64_t hash;     /* Hash of the canonical statement */
+    char *sql;         /* The canonical statement, possibly truncated */
+    uint64_t count;    /* Number of executions, an upper bound */
+    uint64_t error;    /* How much count may exceed the true number of executions */
+    uint64_t total_us; /* Total execution time of the counted executions */
+    uint32_t histogram[TOPN_HISTOGRAM_SIZE]; /* Distribution of the execution times */
+} TOPN_GLOBAL_ENTRY;
+
+/**
+ * The statements of the sessions of one thread, maintained with the
+ * Space-Saving algorithm: when a new statement does not fit, it replaces the
+ * least executed one and inherits its count as the error. With a capacity of
+ * k, any statement executed more than 1/k of the time is guaranteed to be
+ * tracked, and the memory used does not depend on the number of different
+ * statements. The lock is only contended while the summaries are merged for
+ * a report.
+ */
+typedef struct topn_summary
+{
+    SPINLOCK lock;              /* Protects the entries */
+    int n_entries;              /* Number of entries in use */
+    int capacity;               /* Number of entries allocated */
+    TOPN_GLOBAL_ENTRY *entries; /* The tracked statements */
+} TOPN_SUMMARY;
+
 /**
  * Structure to hold the Top N queries
  */
@@ -110,6 +157,8 @@ typedef struct
     int fd;
     struct timeval start;
     char *current;
+    char *canonical; /* Canonical form of current, if tracked over all sessions */
+    int thread_id; /* The thread of the session, selects the summary */
     TOPNQ **top;
     int n_statements;
     struct timeval total;
@@ -135,6 +184,14 @@ static const MXS_ENUM_VALUE option_values[] =
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    modulecmd_arg_type_t args_top[] =
+    {
+        {MODULECMD_ARG_OUTPUT, "DCB where result is written"},
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to inspect"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "top", topn_show_global, 2, args_top);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -164,6 +221,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Thread finish. */
         {
             {"count", MXS_MODULE_PARAM_COUNT, "10"},
+            {"global_count", MXS_MODULE_PARAM_COUNT, "0"},
             {"filebase", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
             {"match", MXS_MODULE_PARAM_STRING},
             {"exclude", MXS_MODULE_PARAM_STRING},
@@ -206,6 +264,27 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
         my_instance->filebase = MXS_STRDUP_A(config_get_string(params, "filebase"));
+        my_instance->global_topN = config_get_integer(params, "global_count");
+        my_instance->summaries = NULL;
+        my_instance->n_summaries = 0;
+
+        if (my_instance->global_topN > 0)
+        {
+            int n_threads = config_threadcount();
+            int capacity = my_instance->global_topN * TOPN_GLOBAL_CAPACITY_FACTOR;
+
+            my_instance->summaries = MXS_CALLOC(n_threads, sizeof(TOPN_SUMMARY));
+            MXS_ABORT_IF_NULL(my_instance->summaries);
+            my_instance->n_summaries = n_threads;
+
+            for (int i = 0; i < n_threads; i++)
+            {
+                spinlock_init(&my_instance->summaries[i].lock);
+                my_instance->summaries[i].capacity = capacity;
+                my_instance->summaries[i].entries = MXS_CALLOC(capacity, sizeof(TOPN_GLOBAL_ENTRY));
+                MXS_ABORT_IF_NULL(my_instance->summaries[i].entries);
+            }
+        }
 
         int cflags = config_get_enum(params, "options", option_values);
         bool error = false;
@@ -327,6 +406,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 
         sprintf(my_session->filename, "%s.%d", my_instance->filebase,
                 my_instance->sessions);
+        my_session->thread_id = session->client_dcb->thread.id;
         gettimeofday(&my_session->connect, NULL);
     }
 
@@ -414,6 +494,7 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
 
+    MXS_FREE(my_session->canonical);
     MXS_FREE(my_session->filename);
     MXS_FREE(session);
     return;
@@ -482,6 +563,14 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 {
                     MXS_FREE(my_session->current);
                 }
+                MXS_FREE(my_session->canonical);
+                my_session->canonical = NULL;
+
+                if (my_instance->global_topN > 0)
+                {
+                    my_session->canonical = qc_get_canonical(queue);
+                }
+
                 gettimeofday(&my_session->start, NULL);
                 my_session->current = ptr;
             }
@@ -496,6 +585,307 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                                        my_session->down.session, queue);
 }
 
+/**
+ * Calculate the hash of a canonical statement (64-bit FNV-1a).
+ *
+ * @param sql   The canonical statement
+ * @return The hash
+ */
+static uint64_t
+topn_hash(const char *sql)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const unsigned char *ptr = (const unsigned char*)sql; *ptr; ptr++)
+    {
+        hash ^= *ptr;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Record an execution of a statement in the summary of a thread.
+ *
+ * @param summary   The summary of the calling thread
+ * @param sql       The canonical statement
+ * @param us        The execution time in microseconds
+ */
+static void
+topn_global_add(TOPN_SUMMARY *summary, const char *sql, uint64_t us)
+{
+    uint64_t hash = topn_hash(sql);
+    TOPN_GLOBAL_ENTRY *entry = NULL;
+    TOPN_GLOBAL_ENTRY *least = NULL;
+
+    spinlock_acquire(&summary->lock);
+
+    for (int i = 0; i < summary->n_entries; i++)
+    {
+        if (summary->entries[i].hash == hash)
+        {
+            entry = &summary->entries[i];
+            break;
+        }
+
+        if (least == NULL || summary->entries[i].count < least->count)
+        {
+            least = &summary->entries[i];
+        }
+    }
+
+    if (entry == NULL)
+    {
+        size_t len = strnlen(sql, TOPN_GLOBAL_MAX_SQL);
+        char *copy = MXS_MALLOC(len + 1);
+
+        if (copy)
+        {
+            memcpy(copy, sql, len);
+            copy[len] = '\0';
+
+            if (summary->n_entries < summary->capacity)
+            {
+                entry = &summary->entries[summary->n_entries++];
+                memset(entry, 0, sizeof(*entry));
+            }
+            else
+            {
+                // Replace the least executed statement.
+                entry = least;
+                MXS_FREE(entry->sql);
+                uint64_t count = entry->count;
+                memset(entry, 0, sizeof(*entry));
+                entry->count = count;
+                entry->error = count;
+            }
+
+            entry->hash = hash;
+            entry->sql = copy;
+        }
+    }
+
+    if (entry)
+    {
+        int bucket = 0;
+
+        while (bucket < TOPN_HISTOGRAM_SIZE - 1 && us >= (1ULL << bucket))
+        {
+            bucket++;
+        }
+
+        entry->count++;
+        entry->total_us += us;
+        entry->histogram[bucket]++;
+    }
+
+    spinlock_release(&summary->lock);
+}
+
+/**
+ * Return an upper bound for the 99th percentile of the execution times.
+ *
+ * @param entry The statement
+ * @return The 99th percentile in microseconds
+ */
+static uint64_t
+topn_global_p99(const TOPN_GLOBAL_ENTRY *entry)
+{
+    uint64_t n = 0;
+
+    for (int i = 0; i < TOPN_HISTOGRAM_SIZE; i++)
+    {
+        n += entry->histogram[i];
+    }
+
+    uint64_t below = 0;
+    int i = 0;
+
+    while (i < TOPN_HISTOGRAM_SIZE - 1 && (below + entry->histogram[i]) * 100 < n * 99)
+    {
+        below += entry->histogram[i++];
+    }
+
+    return 1ULL << i;
+}
+
+static int
+cmp_global_hash(const void *va, const void *vb)
+{
+    const TOPN_GLOBAL_ENTRY *a = (const TOPN_GLOBAL_ENTRY*)va;
+    const TOPN_GLOBAL_ENTRY *b = (const TOPN_GLOBAL_ENTRY*)vb;
+
+    return a->hash < b->hash ? -1 : (a->hash > b->hash ? 1 : 0);
+}
+
+static int
+cmp_global_count(const void *va, const void *vb)
+{
+    const TOPN_GLOBAL_ENTRY *a = (const TOPN_GLOBAL_ENTRY*)va;
+    const TOPN_GLOBAL_ENTRY *b = (const TOPN_GLOBAL_ENTRY*)vb;
+
+    return a->count < b->count ? 1 : (a->count > b->count ? -1 : 0);
+}
+
+static int
+cmp_global_time(const void *va, const void *vb)
+{
+    const TOPN_GLOBAL_ENTRY *a = (const TOPN_GLOBAL_ENTRY*)va;
+    const TOPN_GLOBAL_ENTRY *b = (const TOPN_GLOBAL_ENTRY*)vb;
+
+    return a->total_us < b->total_us ? 1 : (a->total_us > b->total_us ? -1 : 0);
+}
+
+/**
+ * Merge the summaries of all threads. The statements tracked by several
+ * threads are combined into one entry.
+ *
+ * @param instance  The filter instance
+ * @param n_entries On return, the number of merged statements
+ * @return The merged statements, to be freed with topn_global_free(), or NULL
+ *         if no statements have been tracked or memory allocation failed
+ */
+static TOPN_GLOBAL_ENTRY *
+topn_global_merge(TOPN_INSTANCE *instance, int *n_entries)
+{
+    int capacity = instance->n_summaries * instance->global_topN * TOPN_GLOBAL_CAPACITY_FACTOR;
+    TOPN_GLOBAL_ENTRY *entries = MXS_CALLOC(capacity > 0 ? capacity : 1, sizeof(TOPN_GLOBAL_ENTRY));
+    int n = 0;
+
+    if (entries == NULL)
+    {
+        *n_entries = 0;
+        return NULL;
+    }
+
+    for (int i = 0; i < instance->n_summaries; i++)
+    {
+        TOPN_SUMMARY *summary = &instance->summaries[i];
+
+        spinlock_acquire(&summary->lock);
+
+        for (int j = 0; j < summary->n_entries; j++)
+        {
+            entries[n] = summary->entries[j];
+
+            if ((entries[n].sql = MXS_STRDUP(summary->entries[j].sql)))
+            {
+                n++;
+            }
+        }
+
+        spinlock_release(&summary->lock);
+    }
+
+    qsort(entries, n, sizeof(TOPN_GLOBAL_ENTRY), cmp_global_hash);
+
+    int merged = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (merged > 0 && entries[merged - 1].hash == entries[i].hash)
+        {
+            TOPN_GLOBAL_ENTRY *target = &entries[merged - 1];
+
+            target->count += entries[i].count;
+            target->error += entries[i].error;
+            target->total_us += entries[i].total_us;
+
+            for (int j = 0; j < TOPN_HISTOGRAM_SIZE; j++)
+            {
+                target->histogram[j] += entries[i].histogram[j];
+            }
+
+            MXS_FREE(entries[i].sql);
+        }
+        else
+        {
+            entries[merged++] = entries[i];
+        }
+    }
+
+    *n_entries = merged;
+    return entries;
+}
+
+static void
+topn_global_free(TOPN_GLOBAL_ENTRY *entries, int n_entries)
+{
+    for (int i = 0; i < n_entries; i++)
+    {
+        MXS_FREE(entries[i].sql);
+    }
+
+    MXS_FREE(entries);
+}
+
+/**
+ * Print the top statements of all sessions by count and by total time.
+ *
+ * @param instance  The filter instance
+ * @param dcb       The DCB for the output
+ */
+static void
+topn_global_print(TOPN_INSTANCE *instance, DCB *dcb)
+{
+    int n_entries;
+    TOPN_GLOBAL_ENTRY *entries = topn_global_merge(instance, &n_entries);
+    int n = n_entries < instance->global_topN ? n_entries : instance->global_topN;
+
+    struct
+    {
+        const char *title;
+        int (*cmp)(const void*, const void*);
+    } orders[] =
+    {
+        {"executions", cmp_global_count},
+        {"total execution time", cmp_global_time}
+    };
+
+    for (size_t i = 0; i < sizeof(orders) / sizeof(orders[0]); i++)
+    {
+        qsort(entries, n_entries, sizeof(TOPN_GLOBAL_ENTRY), orders[i].cmp);
+
+        dcb_printf(dcb, "\t\tTop %d queries of all sessions by %s:\n",
+                   instance->global_topN, orders[i].title);
+
+        for (int j = 0; j < n; j++)
+        {
+            TOPN_GLOBAL_ENTRY *entry = &entries[j];
+
+            dcb_printf(dcb, "\t\t%d place:\n", j + 1);
+            dcb_printf(dcb, "\t\t\tExecutions: %lu (at most %lu too many)\n",
+                       entry->count, entry->error);
+            dcb_printf(dcb, "\t\t\tTotal execution time: %.3f seconds\n",
+                       (double)entry->total_us / 1000000);
+            dcb_printf(dcb, "\t\t\t99th percentile: below %.3f seconds\n",
+                       (double)topn_global_p99(entry) / 1000000);
+            dcb_printf(dcb, "\t\t\tSQL: %s\n", entry->sql);
+        }
+    }
+
+    topn_global_free(entries, n_entries);
+}
+
+static bool
+topn_show_global(const MODULECMD_ARG *argv)
+{
+    DCB *dcb = argv->argv[0].value.dcb;
+    MXS_FILTER_DEF *filter = argv->argv[1].value.filter;
+    TOPN_INSTANCE *instance = (TOPN_INSTANCE*)filter_def_get_instance(filter);
+
+    if (instance->global_topN == 0)
+    {
+        modulecmd_set_error("The queries of all sessions are not tracked, "
+                            "'global_count' is not set.");
+        return false;
+    }
+
+    topn_global_print(instance, dcb);
+    return true;
+}
+
 static int
 cmp_topn(const void *va, const void *vb)
 {
@@ -524,6 +914,15 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
 
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
+        if (my_session->canonical)
+        {
+            topn_global_add(&my_instance->summaries[my_session->thread_id],
+                            my_session->canonical,
+                            (uint64_t)diff.tv_sec * 1000000 + diff.tv_usec);
+            MXS_FREE(my_session->canonical);
+            my_session->canonical = NULL;
+        }
+
         inserted = 0;
         for (i = 0; i < my_instance->topN; i++)
         {
@@ -603,6 +1002,10 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
+    if (my_session == NULL && my_instance->global_topN > 0)
+    {
+        topn_global_print(my_instance, dcb);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tLogging to file %s.\n",
@@ -23,32 +23,124 @@
 #include <mysqld_error.h>
 #include <maxscale/alloc.h>
 #include <maxscale/debug.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/mysql_utils.h>
 
+/** The topology of the whole cluster, read from one of the nodes */
+#define AURORA_TOPOLOGY_QUERY "SELECT server_id, session_id, replica_lag_in_milliseconds " \
+    "FROM information_schema.replica_host_status ORDER BY last_update_timestamp DESC"
+
+/** The session_id of the master in replica_host_status */
+#define AURORA_MASTER_SESSION_ID "MASTER_SESSION_ID"
+
+/** Maximum length of an @@aurora_server_id, including the terminating null */
+#define AURORA_ID_LEN 128
+
+/** Size of the hashtable of the servers */
+#define AURORA_SERVERS_SIZE 16
+
 typedef struct aurora_monitor
 {
     bool   shutdown;            /**< True if the monitor is stopped */
     THREAD thread;              /**< Monitor thread */
     char*  script;              /**< Launchable script */
     uint64_t   events;          /**< Enabled monitor events */
+    HASHTABLE* servers;         /**< AURORA_SERVER of each server, by unique name */
+    SERVER* source;             /**< The server the topology was last read from */
 } AURORA_MONITOR;
 
+/** The monitor's view of one server */
+typedef struct aurora_server
+{
+    char          id[AURORA_ID_LEN]; /**< @@aurora_server_id of the server, empty if unknown */
+    unsigned long thread_id;         /**< The connection the id was read with */
+    unsigned int  status;            /**< SERVER_RUNNING or SERVER_AUTH_ERROR from the last probe */
+} AURORA_SERVER;
+
+static void* aurora_server_copy(const void *data)
+{
+    AURORA_SERVER *rval = MXS_MALLOC(sizeof(AURORA_SERVER));
+
+    if (rval)
+    {
+        memcpy(rval, data, sizeof(AURORA_SERVER));
+    }
+
+    return rval;
+}
+
 /**
- * @brief Update the status of a server
+ * @brief Add the servers that were added to the monitor after the last check
+ *
+ * Called before the probing so that the probes only modify existing entries.
  *
- * This function connects to the database and queries it for its status. The
- * status of the server is adjusted accordingly based on the results of the
- * query.
+ * @param monitor Monitor object
+ */
+static void add_new_servers(MXS_MONITOR *monitor)
+{
+    AURORA_MONITOR *handle = monitor->handle;
+
+    for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
+    {
+        if (hashtable_fetch(handle->servers, ptr->server->unique_name) == NULL)
+        {
+            AURORA_SERVER info = {};
+            hashtable_add(handle->servers, ptr->server->unique_name, &info);
+        }
+    }
+}
+
+/**
+ * @brief Read the @@aurora_server_id of a server
+ *
+ * @param database Server with an open connection
+ * @param info     Where the id is stored
+ * @return True if the id was read
+ */
+static bool read_aurora_server_id(MXS_MONITOR_SERVERS *database, AURORA_SERVER *info)
+{
+    bool rval = false;
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(database->con, "SELECT @@aurora_server_id") == 0 &&
+        (result = mysql_store_result(database->con)))
+    {
+        MYSQL_ROW row = mysql_fetch_row(result);
+
+        if (row && row[0])
+        {
+            snprintf(info->id, sizeof(info->id), "%s", row[0]);
+            info->thread_id = mysql_thread_id(database->con);
+            rval = true;
+        }
+
+        mysql_free_result(result);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check whether a server can be reached
+ *
+ * This function connects to or pings the database. The role of the server is
+ * not queried here, it is found from the topology of the cluster once all
+ * servers have been probed. The @@aurora_server_id that identifies the server
+ * in the topology is read only when a new connection is created.
  *
  * @param monitor  Monitor object
- * @param database Server whose status should be updated
+ * @param database Server to probe
  */
-void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
+static void probe_server(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
 {
+    AURORA_MONITOR *handle = monitor->handle;
+    AURORA_SERVER *info = hashtable_fetch(handle->servers, database->server->unique_name);
+    ss_dassert(info);
+
+    info->status = 0;
+
     if (!SERVER_IN_MAINT(database->server))
     {
-        SERVER temp_server = {.status = database->server->status};
-        server_clear_status_nolock(&temp_server, SERVER_RUNNING | SERVER_MASTER | SERVER_SLAVE | SERVER_AUTH_ERROR);
         database->mon_prev_status = database->server->status;
 
         /** Try to connect to or ping the database */
@@ -56,30 +148,12 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
 
         if (rval == MONITOR_CONN_OK)
         {
-            server_set_status_nolock(&temp_server, SERVER_RUNNING);
-            MYSQL_RES *result;
-
-            /** Connection is OK, query for replica status */
-            if (mxs_mysql_query(database->con, "SELECT @@aurora_server_id, server_id FROM "
-                                "information_schema.replica_host_status "
-                                "WHERE session_id = 'MASTER_SESSION_ID'") == 0 &&
-                (result = mysql_store_result(database->con)))
-            {
-                ss_dassert(mysql_field_count(database->con) == 2);
-                MYSQL_ROW row = mysql_fetch_row(result);
-                int status = SERVER_SLAVE;
-
-                /** The master will return a row with two identical non-NULL fields */
-                if (row[0] && row[1] && strcmp(row[0], row[1]) == 0)
-                {
-                    status = SERVER_MASTER;
-                }
+            info->status = SERVER_RUNNING;
 
-                server_set_status_nolock(&temp_server, status);
-                mysql_free_result(result);
-            }
-            else
+            if ((info->id[0] == '\0' || info->thread_id != mysql_thread_id(database->con)) &&
+                !read_aurora_server_id(database, info))
             {
+                info->id[0] = '\0';
                 mon_report_query_error(database);
             }
         }
@@ -88,7 +162,7 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
             /** Failed to connect to the database */
             if (mysql_errno(database->con) == ER_ACCESS_DENIED_ERROR)
             {
-                server_set_status_nolock(&temp_server, SERVER_AUTH_ERROR);
+                info->status = SERVER_AUTH_ERROR;
             }
 
             if (mon_status_changed(database) && mon_print_fail_status(database))
@@ -96,9 +170,100 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
                 mon_log_connect_error(database, rval);
             }
         }
+    }
+}
+
+/**
+ * @brief Read the topology of the cluster
+ *
+ * The replica_host_status table of any node lists all the nodes of the
+ * cluster, so the topology is read from only one node. The previous master is
+ * tried first as it has the most recent view of the replicas.
+ *
+ * @param monitor Monitor object
+ * @return The topology or NULL if no node returned it
+ */
+static MYSQL_RES* read_topology(MXS_MONITOR *monitor)
+{
+    AURORA_MONITOR *handle = monitor->handle;
+    MYSQL_RES *result = NULL;
+
+    handle->source = NULL;
+
+    for (int pass = 0; pass < 2 && result == NULL; pass++)
+    {
+        for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr && result == NULL; ptr = ptr->next)
+        {
+            AURORA_SERVER *info = hashtable_fetch(handle->servers, ptr->server->unique_name);
+            bool was_master = SERVER_IS_MASTER(ptr->server);
+
+            if ((info->status & SERVER_RUNNING) && !SERVER_IN_MAINT(ptr->server) &&
+                was_master == (pass == 0))
+            {
+                if (mxs_mysql_query(ptr->con, AURORA_TOPOLOGY_QUERY) == 0 &&
+                    (result = mysql_store_result(ptr->con)))
+                {
+                    ss_dassert(mysql_field_count(ptr->con) == 3);
+                    handle->source = ptr->server;
+                }
+                else
+                {
+                    mon_report_query_error(ptr);
+                }
+            }
+        }
+    }
+
+    return result;
+}
 
-        server_transfer_status(database->server, &temp_server);
+/**
+ * @brief Update the status of a server
+ *
+ * The status is based on the result of the probe and the row of the server
+ * in the topology of the cluster. A node that is not in the topology is
+ * running but has no role.
+ *
+ * @param database Server whose status should be updated
+ * @param info     The result of the probe
+ * @param topology The topology of the cluster or NULL if it is not known
+ */
+static void update_server_status(MXS_MONITOR_SERVERS *database, const AURORA_SERVER *info,
+                                 MYSQL_RES *topology)
+{
+    SERVER temp_server = {.status = database->server->status};
+    server_clear_status_nolock(&temp_server, SERVER_RUNNING | SERVER_MASTER | SERVER_SLAVE | SERVER_AUTH_ERROR);
+    server_set_status_nolock(&temp_server, info->status);
+    int rlag_ms = MAX_RLAG_NOT_AVAILABLE;
+
+    if ((info->status & SERVER_RUNNING) && info->id[0] && topology)
+    {
+        MYSQL_ROW row;
+        mysql_data_seek(topology, 0);
+
+        /** The rows are newest first, a replaced instance may have older rows */
+        while ((row = mysql_fetch_row(topology)))
+        {
+            if (row[0] && strcmp(row[0], info->id) == 0)
+            {
+                if (row[1] && strcmp(row[1], AURORA_MASTER_SESSION_ID) == 0)
+                {
+                    server_set_status_nolock(&temp_server, SERVER_MASTER);
+                    rlag_ms = 0;
+                }
+                else
+                {
+                    server_set_status_nolock(&temp_server, SERVER_SLAVE);
+                    rlag_ms = row[2] ? (int)strtod(row[2], NULL) : MAX_RLAG_NOT_AVAILABLE;
+                }
+                break;
+            }
+        }
     }
+
+    database->server->rlag_ms = rlag_ms;
+    database->server->rlag = rlag_ms >= 0 ? rlag_ms / 1000 : rlag_ms;
+    server_transfer_status(database->server, &temp_server);
 }
 
 /**
@@ -122,11 +287,30 @@ monitorMain(void *arg)
     {
         lock_monitor_servers(monitor);
         servers_status_pending_to_current(monitor);
+        add_new_servers(monitor);
+
+        /** Probe all servers in parallel */
+        mon_probe_servers(monitor, probe_server);
+
+        /** Read the roles of all servers with one query */
+        MYSQL_RES *topology = read_topology(monitor);
 
         for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
         {
-            update_server_status(monitor, ptr);
+            if (!SERVER_IN_MAINT(ptr->server))
+            {
+                update_server_status(ptr, hashtable_fetch(handle->servers, ptr->server->unique_name),
+                                     topology);
+            }
+        }
 
+        if (topology)
+        {
+            mysql_free_result(topology);
+        }
+
+        for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
+        {
             if (SERVER_IS_DOWN(ptr->server))
             {
                 /** Hang up all DCBs connected to the failed server */
@@ -168,6 +352,7 @@ static void auroramon_free(AURORA_MONITOR *handle)
     if (handle)
     {
         MXS_FREE(handle->script);
+        hashtable_free(handle->servers);
         MXS_FREE(handle);
     }
 }
@@ -199,10 +384,20 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
         }
 
         handle->shutdown = false;
+        handle->script = NULL;
+        handle->source = NULL;
 
-        if (!check_monitor_permissions(mon, "SELECT @@aurora_server_id, server_id FROM "
-                                       "information_schema.replica_host_status "
-                                       "WHERE session_id = 'MASTER_SESSION_ID'"))
+        if ((handle->servers = hashtable_alloc(AURORA_SERVERS_SIZE, hashtable_item_strhash,
+                                               hashtable_item_strcmp)) == NULL)
+        {
+            auroramon_free(handle);
+            return NULL;
+        }
+
+        hashtable_memory_fns(handle->servers, hashtable_item_strdup, aurora_server_copy,
+                             hashtable_item_free, hashtable_item_free);
+
+        if (!check_monitor_permissions(mon, AURORA_TOPOLOGY_QUERY))
         {
             MXS_ERROR("Failed to start monitor. See earlier errors for more information.");
             auroramon_free(handle);
@@ -246,6 +441,21 @@ stopMonitor(MXS_MONITOR *mon)
 static void
 diagnostics(DCB *dcb, const MXS_MONITOR *mon)
 {
+    AURORA_MONITOR *handle = (AURORA_MONITOR *) mon->handle;
+    SERVER *source = handle->source;
+
+    dcb_printf(dcb, "Topology read from:\t%s\n", source ? source->unique_name : "<none>");
+
+    for (MXS_MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+    {
+        AURORA_SERVER *info = hashtable_fetch(handle->servers, db->server->unique_name);
+
+        if (info)
+        {
+            dcb_printf(dcb, "Server %s:\t%s\n", db->server->unique_name,
+                       info->id[0] ? info->id : "<unknown id>");
+        }
+    }
 }
 
 /**
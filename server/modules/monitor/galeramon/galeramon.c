@@ -110,6 +110,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 mxs_monitor_event_enum_values
             },
             {"set_donor_nodes", MXS_MODULE_PARAM_BOOL, "false"},
+            {"flow_control_limit", MXS_MODULE_PARAM_COUNT, "16"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -153,6 +154,7 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
     handle->set_donor_nodes = config_get_bool(params, "set_donor_nodes");
+    handle->flow_control_limit = MXS_MAX(config_get_integer(params, "flow_control_limit"), 1);
 
     /** SHOW STATUS doesn't require any special permissions */
     if (!check_monitor_permissions(mon, "SHOW STATUS LIKE 'wsrep_local_state'"))
@@ -201,6 +203,57 @@ diagnostics(DCB *dcb, const MXS_MONITOR *mon)
     dcb_printf(dcb, "Master Role Setting Disabled:\t%s\n",
                handle->disableMasterRoleSetting ? "on" : "off");
     dcb_printf(dcb, "Set wsrep_sst_donor node list:\t%s\n", (handle->set_donor_nodes == 1) ? "on" : "off");
+    dcb_printf(dcb, "Flow control limit:\t%d\n", handle->flow_control_limit);
+}
+
+/**
+ * Update the load of a joined node from its flow control status
+ *
+ * The load is the largest of the fraction of time that replication has been
+ * paused by flow control and the lengths of the receive and send queues
+ * relative to the flow control limit of the monitor. A node whose queue grows
+ * to the limit pauses the whole cluster, so the routers should send less work
+ * to it well before that.
+ *
+ * @param handle   The Galera monitor
+ * @param database The database to query
+ */
+static void update_node_load(const GALERA_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    MYSQL_RES *result;
+    int load = 0;
+
+    if (mxs_mysql_query(database->con, "SHOW STATUS WHERE Variable_name IN "
+                        "('wsrep_flow_control_paused', 'wsrep_local_recv_queue', "
+                        "'wsrep_local_send_queue')") == 0
+        && (result = mysql_store_result(database->con)) != NULL)
+    {
+        MYSQL_ROW row;
+
+        while (mysql_field_count(database->con) >= 2 && (row = mysql_fetch_row(result)))
+        {
+            double value = row[1] ? strtod(row[1], NULL) : 0;
+
+            if (strcasecmp(row[0], "wsrep_flow_control_paused") == 0)
+            {
+                value *= SERVER_LOAD_MAX;
+            }
+            else
+            {
+                value = value * SERVER_LOAD_MAX / handle->flow_control_limit;
+            }
+
+            load = MXS_MAX(load, (int)MXS_MIN(value, SERVER_LOAD_MAX));
+        }
+
+        mysql_free_result(result);
+    }
+    else
+    {
+        mon_report_query_error(database);
+    }
+
+    database->server->load = load;
 }
 
 /**
@@ -248,6 +301,7 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         }
 
         database->server->node_id = -1;
+        database->server->load = 0;
 
         server_transfer_status(database->server, &temp_server);
 
@@ -363,10 +417,13 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         {
             mon_report_query_error(database);
         }
+
+        update_node_load(handle, database);
         server_set_status_nolock(&temp_server, SERVER_JOINED);
     }
     else
     {
+        database->server->load = 0;
         server_clear_status_nolock(&temp_server, SERVER_JOINED);
     }
 
@@ -450,13 +507,17 @@ monitorMain(void *arg)
         lock_monitor_servers(mon);
         servers_status_pending_to_current(mon);
 
-        ptr = mon->databases;
-        while (ptr)
+        for (ptr = mon->databases; ptr; ptr = ptr->next)
         {
             ptr->mon_prev_status = ptr->server->status;
+        }
 
-            monitorDatabase(mon, ptr);
+        /* monitor all nodes in parallel */
+        mon_probe_servers(mon, monitorDatabase);
 
+        ptr = mon->databases;
+        while (ptr)
+        {
             /* Log server status change */
             if (mon_status_changed(ptr))
             {
@@ -63,6 +63,7 @@ typedef struct
     uint64_t events; /*< enabled events */
     bool set_donor_nodes; /**< set the wrep_sst_donor variable with an
                            * ordered list of nodes */
+    int flow_control_limit; /**< Queue length at which a node is fully loaded */
 } GALERA_MONITOR;
 
 MXS_END_DECLS
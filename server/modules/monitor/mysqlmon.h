@@ -52,6 +52,28 @@
 
 MXS_BEGIN_DECLS
 
+#define MYSQL_GTID_MAX_DOMAINS  8   /**< Replication domains tracked per GTID position */
+#define MYSQL_GTID_HISTORY_SIZE 256 /**< Master GTID positions kept for lag measurement */
+
+/**
+ * A GTID position with the latest sequence number of each replication domain
+ */
+typedef struct
+{
+    int      n_domains;                       /**< Number of domains */
+    uint32_t domain[MYSQL_GTID_MAX_DOMAINS];  /**< Replication domains */
+    uint64_t seq[MYSQL_GTID_MAX_DOMAINS];     /**< Sequence number of each domain */
+} MYSQL_GTID_POS;
+
+/**
+ * A GTID position of the master and the time when it was first seen
+ */
+typedef struct
+{
+    uint64_t       time; /**< Monotonic time in milliseconds */
+    MYSQL_GTID_POS pos;  /**< GTID position of the master */
+} MYSQL_GTID_SAMPLE;
+
 /**
  * The handle for an instance of a MySQL Monitor module
  */
@@ -79,6 +101,11 @@ typedef struct
                                    down before failover is initiated */
     bool allow_cluster_recovery; /**< Allow failed servers to rejoin the cluster */
     bool warn_failover; /**< Log a warning when failover happens */
+    bool gtid_replication_lag; /**< Measure replication lag from GTID positions */
+    SERVER *gtid_master; /**< The master whose GTID positions are in gtid_history */
+    MYSQL_GTID_SAMPLE gtid_history[MYSQL_GTID_HISTORY_SIZE]; /**< Ring buffer of master positions */
+    int gtid_history_start; /**< Index of the oldest sample */
+    int gtid_history_len; /**< Number of samples */
 } MYSQL_MONITOR;
 
 MXS_END_DECLS
@@ -53,6 +53,8 @@
 #include <maxscale/alloc.h>
 #include <maxscale/debug.h>
 #include <maxscale/mysql_utils.h>
+#include <ctype.h>
+#include <time.h>
 
 /** Column positions for SHOW SLAVE STATUS */
 #define MYSQL55_STATUS_BINLOG_POS 5
@@ -129,6 +131,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"detect_standalone_master", MXS_MODULE_PARAM_BOOL, "false"},
             {"failcount", MXS_MODULE_PARAM_COUNT, "5"},
             {"allow_cluster_recovery", MXS_MODULE_PARAM_BOOL, "true"},
+            {"gtid_replication_lag", MXS_MODULE_PARAM_BOOL, "false"},
             {
                 "script",
                 MXS_MODULE_PARAM_PATH,
@@ -164,6 +167,11 @@ typedef struct mysql_server_info
     bool             slave_sql; /**< If Slave SQL thread is running */
     uint64_t         binlog_pos; /**< Binlog position from SHOW SLAVE STATUS */
     char            *binlog_name; /**< Binlog name from SHOW SLAVE STATUS */
+    bool             heartbeat_table; /**< Whether the heartbeat table is known to exist */
+    time_t           heartbeat_purged; /**< When old heartbeats were last purged */
+    MYSQL_GTID_POS   gtid_pos;  /**< Value of @@gtid_current_pos */
+    uint64_t         gtid_time; /**< When gtid_pos was read, in milliseconds */
+    bool             gtid_pos_ok; /**< Whether gtid_pos was read in the last cycle */
 } MYSQL_SERVER_INFO;
 
 /** Other values are implicitly zero initialized */
@@ -284,6 +292,10 @@ startMonitor(MXS_MONITOR *monitor, const MXS_CONFIG_PARAMETER* params)
     handle->failcount = config_get_integer(params, "failcount");
     handle->allow_cluster_recovery = config_get_bool(params, "allow_cluster_recovery");
     handle->mysql51_replication = config_get_bool(params, "mysql51_replication");
+    handle->gtid_replication_lag = config_get_bool(params, "gtid_replication_lag");
+    handle->gtid_master = NULL;
+    handle->gtid_history_start = 0;
+    handle->gtid_history_len = 0;
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
 
@@ -342,6 +354,7 @@ static void diagnostics(DCB *dcb, const MXS_MONITOR *mon)
     dcb_printf(dcb, "MaxScale MonitorId:\t%lu\n", handle->id);
     dcb_printf(dcb, "Replication lag:\t%s\n", (handle->replicationHeartbeat == 1) ? "enabled" : "disabled");
     dcb_printf(dcb, "Detect Stale Master:\t%s\n", (handle->detectStaleMaster == 1) ? "enabled" : "disabled");
+    dcb_printf(dcb, "GTID replication lag:\t%s\n", handle->gtid_replication_lag ? "enabled" : "disabled");
     dcb_printf(dcb, "Server information\n\n");
 
     for (MXS_MONITOR_SERVERS *db = mon->databases; db; db = db->next)
@@ -357,6 +370,11 @@ static void diagnostics(DCB *dcb, const MXS_MONITOR *mon)
         dcb_printf(dcb, "Master binlog file: %s\n", serv_info->binlog_name);
         dcb_printf(dcb, "Master binlog position: %lu\n", serv_info->binlog_pos);
 
+        if (handle->gtid_replication_lag)
+        {
+            dcb_printf(dcb, "Replication lag: %d ms\n", db->server->rlag_ms);
+        }
+
         if (handle->multimaster)
         {
             dcb_printf(dcb, "Master group: %d\n", serv_info->group);
@@ -608,6 +626,261 @@ static MXS_MONITOR_SERVERS *build_mysql51_replication_tree(MXS_MONITOR *mon)
     return rval;
 }
 
+/**
+ * @brief Get a monotonic timestamp in milliseconds
+ */
+static uint64_t time_in_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Parse a GTID list of the form DOMAIN-SERVER_ID-SEQUENCE[,...]
+ *
+ * Domains beyond MYSQL_GTID_MAX_DOMAINS are ignored.
+ *
+ * @param str GTID list
+ * @param pos Parsed position
+ * @return True if the list was valid
+ */
+static bool parse_gtid_pos(const char *str, MYSQL_GTID_POS *pos)
+{
+    pos->n_domains = 0;
+
+    while (*str)
+    {
+        char *end;
+
+        while (isspace(*str) || *str == ',')
+        {
+            str++;
+        }
+
+        if (*str == '\0')
+        {
+            break;
+        }
+
+        uint32_t domain = strtoul(str, &end, 10);
+
+        if (*end != '-')
+        {
+            return false;
+        }
+
+        strtoul(end + 1, &end, 10);
+
+        if (*end != '-')
+        {
+            return false;
+        }
+
+        uint64_t seq = strtoull(end + 1, &end, 10);
+
+        if (*end && *end != ',' && !isspace(*end))
+        {
+            return false;
+        }
+
+        if (pos->n_domains < MYSQL_GTID_MAX_DOMAINS)
+        {
+            pos->domain[pos->n_domains] = domain;
+            pos->seq[pos->n_domains] = seq;
+            pos->n_domains++;
+        }
+
+        str = end;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check whether a GTID position contains all transactions of another one
+ *
+ * @param pos   Position to check
+ * @param other The other position
+ * @return True if every domain of @c other is at the same or a lower
+ *         sequence number than in @c pos
+ */
+static bool gtid_pos_covers(const MYSQL_GTID_POS *pos, const MYSQL_GTID_POS *other)
+{
+    for (int i = 0; i < other->n_domains; i++)
+    {
+        uint64_t seq = 0;
+
+        for (int j = 0; j < pos->n_domains; j++)
+        {
+            if (pos->domain[j] == other->domain[i])
+            {
+                seq = pos->seq[j];
+                break;
+            }
+        }
+
+        if (seq < other->seq[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read the GTID position of a server
+ *
+ * @param database  Server to query
+ * @param serv_info Where the position is stored
+ */
+static void update_gtid_pos(MXS_MONITOR_SERVERS *database, MYSQL_SERVER_INFO *serv_info)
+{
+    MYSQL_RES *result;
+    serv_info->gtid_pos_ok = false;
+
+    /** The position contains at least what was committed before the query was sent */
+    uint64_t started = time_in_ms();
+
+    if (mxs_mysql_query(database->con, "SELECT @@gtid_current_pos") == 0
+        && (result = mysql_store_result(database->con)) != NULL)
+    {
+        MYSQL_ROW row = mysql_fetch_row(result);
+        serv_info->gtid_time = started;
+
+        if (row && row[0] && parse_gtid_pos(row[0], &serv_info->gtid_pos))
+        {
+            serv_info->gtid_pos_ok = true;
+        }
+
+        mysql_free_result(result);
+    }
+    else
+    {
+        mon_report_query_error(database);
+    }
+}
+
+/**
+ * @brief Measure the replication lag of the slaves from GTID positions
+ *
+ * Each new GTID position of the master is stored with the time it was first
+ * seen. The lag of a slave is the time between reading its position and the
+ * first moment the master had a transaction the slave has not yet replicated.
+ * The precision is thus the monitoring interval. If the slave is behind all of
+ * the stored positions, the age of the oldest one is used as the lag.
+ *
+ * The time of the newest master position a server has is stored as the time
+ * before which the server is known to have all transactions of the master.
+ *
+ * @param mon         Monitor
+ * @param root_master The master server or NULL if there is no master
+ */
+static void update_gtid_lag(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *root_master)
+{
+    MYSQL_MONITOR *handle = (MYSQL_MONITOR*)mon->handle;
+    MYSQL_SERVER_INFO *master_info = NULL;
+
+    if (root_master && (SERVER_IS_MASTER(root_master->server) ||
+                        SERVER_IS_RELAY_SERVER(root_master->server)))
+    {
+        master_info = hashtable_fetch(handle->server_info, root_master->server->unique_name);
+    }
+
+    if (master_info == NULL || root_master->server != handle->gtid_master)
+    {
+        /** The old positions are of no use with a new master */
+        handle->gtid_master = master_info ? root_master->server : NULL;
+        handle->gtid_history_start = 0;
+        handle->gtid_history_len = 0;
+    }
+
+    if (master_info && master_info->gtid_pos_ok)
+    {
+        MYSQL_GTID_SAMPLE *latest = handle->gtid_history_len == 0 ? NULL :
+                                    &handle->gtid_history[(handle->gtid_history_start +
+                                                           handle->gtid_history_len - 1) %
+                                                          MYSQL_GTID_HISTORY_SIZE];
+
+        if (latest == NULL || !gtid_pos_covers(&latest->pos, &master_info->gtid_pos))
+        {
+            if (handle->gtid_history_len == MYSQL_GTID_HISTORY_SIZE)
+            {
+                /** Replace the oldest sample */
+                handle->gtid_history_start = (handle->gtid_history_start + 1) % MYSQL_GTID_HISTORY_SIZE;
+                handle->gtid_history_len--;
+            }
+
+            MYSQL_GTID_SAMPLE *sample = &handle->gtid_history[(handle->gtid_history_start +
+                                                               handle->gtid_history_len) %
+                                                              MYSQL_GTID_HISTORY_SIZE];
+            sample->time = master_info->gtid_time;
+            sample->pos = master_info->gtid_pos;
+            handle->gtid_history_len++;
+        }
+    }
+
+    for (MXS_MONITOR_SERVERS *ptr = mon->databases; ptr; ptr = ptr->next)
+    {
+        MYSQL_SERVER_INFO *info = hashtable_fetch(handle->server_info, ptr->server->unique_name);
+        int rlag_ms = MAX_RLAG_NOT_AVAILABLE;
+        uint64_t synced_ms = 0;
+
+        if (master_info && ptr == root_master)
+        {
+            rlag_ms = 0;
+            synced_ms = master_info->gtid_pos_ok ? master_info->gtid_time : 0;
+        }
+        else if (info && info->gtid_pos_ok && handle->gtid_history_len > 0 &&
+                 (SERVER_IS_SLAVE(ptr->server) || SERVER_IS_RELAY_SERVER(ptr->server)))
+        {
+            int i;
+            MYSQL_GTID_SAMPLE *sample = NULL;
+
+            /** Find the oldest master position the slave has not reached */
+            for (i = 0; i < handle->gtid_history_len; i++)
+            {
+                sample = &handle->gtid_history[(handle->gtid_history_start + i) %
+                                               MYSQL_GTID_HISTORY_SIZE];
+
+                if (!gtid_pos_covers(&info->gtid_pos, &sample->pos))
+                {
+                    break;
+                }
+            }
+
+            if (i == handle->gtid_history_len || info->gtid_time <= sample->time)
+            {
+                rlag_ms = 0;
+            }
+            else
+            {
+                rlag_ms = info->gtid_time - sample->time;
+            }
+
+            if (i == handle->gtid_history_len && master_info->gtid_pos_ok)
+            {
+                /** The slave has the position the master had when it was last read */
+                synced_ms = master_info->gtid_time;
+            }
+            else if (i > 0)
+            {
+                synced_ms = handle->gtid_history[(handle->gtid_history_start + i - 1) %
+                                                 MYSQL_GTID_HISTORY_SIZE].time;
+            }
+        }
+
+        ptr->server->rlag_ms = rlag_ms;
+        ptr->server->synced_ms = synced_ms;
+
+        if (!handle->replicationHeartbeat)
+        {
+            ptr->server->rlag = rlag_ms >= 0 ? rlag_ms / 1000 : rlag_ms;
+        }
+    }
+}
+
 /**
  * Monitor an individual server
  *
@@ -632,13 +905,19 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     /** Store previous status */
     database->mon_prev_status = database->server->status;
 
-    if (database->con == NULL || mysql_ping(database->con) != 0)
+    /** The first query also checks that the connection is alive, which saves
+     * the round trip of a separate ping */
+    const char *id_query = "SELECT @@server_id, @@read_only";
+    bool queried = database->con && mxs_mysql_query(database->con, id_query) == 0;
+
+    if (!queried)
     {
         mxs_connect_result_t rval;
         if ((rval = mon_connect_to_db(mon, database)) == MONITOR_CONN_OK)
         {
             server_clear_status_nolock(database->server, SERVER_AUTH_ERROR);
             monitor_clear_pending_status(database, SERVER_AUTH_ERROR);
+            queried = mxs_mysql_query(database->con, id_query) == 0;
         }
         else
         {
@@ -698,8 +977,7 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     ss_dassert(serv_info);
 
     /* Get server_id and read_only from current node */
-    if (mxs_mysql_query(database->con, "SELECT @@server_id, @@read_only") == 0
-        && (result = mysql_store_result(database->con)) != NULL)
+    if (queried && (result = mysql_store_result(database->con)) != NULL)
     {
         long server_id = -1;
 
@@ -735,6 +1013,11 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     if (server_version >= 100000)
     {
         monitor_mysql_db(database, serv_info, MYSQL_SERVER_VERSION_100);
+
+        if (handle->gtid_replication_lag)
+        {
+            update_gtid_pos(database, serv_info);
+        }
     }
     else if (server_version >= 5 * 10000 + 5 * 100)
     {
@@ -1134,10 +1417,16 @@ monitorMain(void *arg)
 
             /* copy server status into monitor pending_status */
             ptr->pending_status = ptr->server->status;
+            ptr = ptr->next;
+        }
 
-            /* monitor current node */
-            monitorDatabase(mon, ptr);
+        /* monitor all nodes in parallel */
+        mon_probe_servers(mon, monitorDatabase);
 
+        ptr = mon->databases;
+
+        while (ptr)
+        {
             /* reset the slave list of current node */
             memset(&ptr->server->slaves, 0, sizeof(ptr->server->slaves));
 
@@ -1400,6 +1689,11 @@ monitorMain(void *arg)
             }
         }
 
+        if (handle->gtid_replication_lag)
+        {
+            update_gtid_lag(mon, root_master);
+        }
+
         mon_hangup_failed_servers(mon);
         servers_status_current_to_pending(mon);
         release_monitor_servers(mon);
@@ -1476,18 +1770,25 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
         return;
     }
 
+    MYSQL_SERVER_INFO *serv_info = hashtable_fetch(handle->server_info, database->server->unique_name);
+    ss_dassert(serv_info);
+
+    /** The table is only checked until it is known to exist. If it is dropped,
+     * the failing heartbeat update causes it to be checked again. */
+    if (serv_info->heartbeat_table)
+    {
+        returned_rows = 1;
+    }
     /* check if the maxscale_schema database and replication_heartbeat table exist */
-    if (mxs_mysql_query(database->con, "SELECT table_name FROM information_schema.tables "
-                        "WHERE table_schema = 'maxscale_schema' AND table_name = 'replication_heartbeat'"))
+    else if (mxs_mysql_query(database->con, "SELECT table_name FROM information_schema.tables "
+                             "WHERE table_schema = 'maxscale_schema' AND table_name = 'replication_heartbeat'"))
     {
         MXS_ERROR( "Error checking for replication_heartbeat in Master server"
                    ": %s", mysql_error(database->con));
         database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        returned_rows = 0;
     }
-
-    result = mysql_store_result(database->con);
-
-    if (result == NULL)
+    else if ((result = mysql_store_result(database->con)) == NULL)
     {
         returned_rows = 0;
     }
@@ -1495,6 +1796,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
     {
         returned_rows = mysql_num_rows(result);
         mysql_free_result(result);
+        serv_info->heartbeat_table = returned_rows > 0;
     }
 
     if (0 == returned_rows)
@@ -1513,77 +1815,62 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
 
             database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
         }
+        else
+        {
+            serv_info->heartbeat_table = true;
+        }
     }
 
-    /* auto purge old values after 48 hours*/
-    purge_time = time(0) - (3600 * 48);
-
-    sprintf(heartbeat_purge_query,
-            "DELETE FROM maxscale_schema.replication_heartbeat WHERE master_timestamp < %lu", purge_time);
+    heartbeat = time(0);
 
-    if (mxs_mysql_query(database->con, heartbeat_purge_query))
+    /* auto purge old values after 48 hours, checked once an hour */
+    if (heartbeat - serv_info->heartbeat_purged >= 3600)
     {
-        MXS_ERROR("Error deleting from maxscale_schema.replication_heartbeat "
-                  "table: [%s], %s",
-                  heartbeat_purge_query,
-                  mysql_error(database->con));
-    }
+        purge_time = heartbeat - (3600 * 48);
 
-    heartbeat = time(0);
+        sprintf(heartbeat_purge_query,
+                "DELETE FROM maxscale_schema.replication_heartbeat WHERE master_timestamp < %lu", purge_time);
+
+        if (mxs_mysql_query(database->con, heartbeat_purge_query))
+        {
+            MXS_ERROR("Error deleting from maxscale_schema.replication_heartbeat "
+                      "table: [%s], %s",
+                      heartbeat_purge_query,
+                      mysql_error(database->con));
+        }
+        else
+        {
+            serv_info->heartbeat_purged = heartbeat;
+        }
+    }
 
     /* set node_ts for master as time(0) */
     database->server->node_ts = heartbeat;
 
+    /* The row is identified by the primary key so a single REPLACE both
+     * inserts a new row and updates an existing one */
     sprintf(heartbeat_insert_query,
-            "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
-            heartbeat, handle->master->server->node_id, id);
+            "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
+            handle->master->server->node_id, id, heartbeat);
 
     /* Try to insert MaxScale timestamp into master */
     if (mxs_mysql_query(database->con, heartbeat_insert_query))
     {
-
         database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        serv_info->heartbeat_table = false;
 
-        MXS_ERROR("Error updating maxscale_schema.replication_heartbeat table: [%s], %s",
+        MXS_ERROR("Error inserting into "
+                  "maxscale_schema.replication_heartbeat table: [%s], %s",
                   heartbeat_insert_query,
                   mysql_error(database->con));
     }
     else
     {
-        if (mysql_affected_rows(database->con) == 0)
-        {
-            heartbeat = time(0);
-            sprintf(heartbeat_insert_query,
-                    "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
-                    handle->master->server->node_id, id, heartbeat);
-
-            if (mxs_mysql_query(database->con, heartbeat_insert_query))
-            {
+        /* Set replication lag to 0 for the master */
+        database->server->rlag = 0;
 
-                database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
-
-                MXS_ERROR("Error inserting into "
-                          "maxscale_schema.replication_heartbeat table: [%s], %s",
-                          heartbeat_insert_query,
-                          mysql_error(database->con));
-            }
-            else
-            {
-                /* Set replication lag to 0 for the master */
-                database->server->rlag = 0;
-
-                MXS_DEBUG("heartbeat table inserted data for %s:%i",
-                          database->server->name, database->server->port);
-            }
-        }
-        else
-        {
-            /* Set replication lag as 0 for the master */
-            database->server->rlag = 0;
-
-            MXS_DEBUG("heartbeat table updated for Master %s:%i",
-                      database->server->name, database->server->port);
-        }
+        MXS_DEBUG("heartbeat table updated for Master %s:%i",
+                  database->server->name, database->server->port);
     }
 }
 
@@ -41,6 +41,7 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/resultset.h>
+#include "../../../core/maxscale/metrics.h"
 
 #define ISspace(x) isspace((int)(x))
 #define HTTP_SERVER_STRING "MaxScale(c) v.1.0.0"
@@ -54,7 +55,7 @@ static int httpd_accept(DCB *dcb);
 static int httpd_close(DCB *dcb);
 static int httpd_listen(DCB *dcb, char *config);
 static int httpd_get_line(int sock, char *buf, int size);
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok);
+static void httpd_send_headers(DCB *dcb, int final, bool auth_ok, const char *url);
 static char *httpd_default_auth();
 
 /**
@@ -257,7 +258,7 @@ static int httpd_read_event(DCB* dcb)
      */
 
     /* send all the basic headers and close with \r\n */
-    httpd_send_headers(dcb, 1, auth_ok);
+    httpd_send_headers(dcb, 1, auth_ok, url);
 
 #if 0
     /**
@@ -455,8 +456,10 @@ static int httpd_get_line(int sock, char *buf, int size)
 
 /**
  * HTTPD send basic headers with 200 OK
+ *
+ * The metrics are sent in the OpenMetrics text format, everything else is JSON.
  */
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok)
+static void httpd_send_headers(DCB *dcb, int final, bool auth_ok, const char *url)
 {
     char date[64] = "";
     const char *fmt = "%a, %d %b %Y %H:%M:%S GMT";
@@ -472,8 +475,9 @@ static void httpd_send_headers(DCB *dcb, int final, bool auth_ok)
                "Server: %s\r\n"
                "Connection: close\r\n"
                "WWW-Authenticate: Basic realm=\"MaxInfo\"\r\n"
-               "Content-Type: application/json\r\n",
-               response, date, HTTP_SERVER_STRING);
+               "Content-Type: %s\r\n",
+               response, date, HTTP_SERVER_STRING,
+               strcmp(url, "/metrics") == 0 ? METRICS_CONTENT_TYPE : "application/json");
 
     /* close the headers */
     if (final)
@@ -17,10 +17,13 @@
 #include <maxscale/limits.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/modutil.h>
+#include <maxscale/probe.h>
+#include <maxscale/mysql_utils.h>
 #include <maxscale/utils.h>
 #include <mysqld_error.h>
 #include <maxscale/alloc.h>
 #include <maxscale/modinfo.h>
+#include <maxscale/monitor.h>
 #include <maxscale/protocol.h>
 
 /*
@@ -69,7 +72,7 @@ static bool sescmd_response_complete(DCB* dcb);
 static void gw_reply_on_error(DCB *dcb, mxs_auth_state_t state);
 static int gw_read_and_write(DCB *dcb);
 static int gw_decode_mysql_server_handshake(MySQLProtocol *conn, uint8_t *payload);
-static int gw_do_connect_to_backend(char *host, int port, int *fd);
+static int gw_do_connect_to_backend(SERVER *server, int *fd);
 static void inline close_socket(int socket);
 static GWBUF *gw_create_change_user_packet(MYSQL_session*  mses,
                                            MySQLProtocol*  protocol);
@@ -78,6 +81,9 @@ static int gw_send_change_user_to_backend(char          *dbname,
                                           uint8_t       *passwd,
                                           MySQLProtocol *conn);
 static bool gw_connection_established(DCB* dcb);
+static int gw_send_reset_connection(DCB *dcb, MYSQL_session *mses, GWBUF *queue);
+static bool discard_reset_replies(DCB *dcb, GWBUF **read_buffer);
+static bool server_supports_reset_connection(const SERVER *server);
 
 /*
  * The module entry point routine. It is this routine that
@@ -203,7 +209,7 @@ static int gw_create_backend_connection(DCB *backend_dcb,
 
     /*< if succeed, fd > 0, -1 otherwise */
     /* TODO: Better if function returned a protocol auth state */
-    rv = gw_do_connect_to_backend(server->name, server->port, &fd);
+    rv = gw_do_connect_to_backend(server, &fd);
     /*< Assign protocol with backend_dcb */
     backend_dcb->protocol = protocol;
 
@@ -251,6 +257,7 @@ static int gw_create_backend_connection(DCB *backend_dcb,
                   server->port,
                   protocol->fd,
                   session->client_dcb->fd);
+        monitor_request_check(server);
         break;
     } /*< switch */
 
@@ -263,22 +270,38 @@ return_fd:
  *
  * This routine creates socket and connects to a backend server.
  * Connect it non-blocking operation. If connect fails, socket is closed.
+ * A server with a socket path is connected through the Unix domain socket,
+ * which avoids the TCP stack for servers on the same host.
  *
- * @param host The host to connect to
- * @param port The host TCP/IP port
+ * @param server The server to connect to
  * @param *fd where connected fd is copied
  * @return 0/1 on success and -1 on failure
  * If successful, fd has file descriptor to socket which is connected to
  * backend server. In failure, fd == -1 and socket is closed.
  *
  */
-static int gw_do_connect_to_backend(char *host, int port, int *fd)
+static int gw_do_connect_to_backend(SERVER *server, int *fd)
 {
+    char *host = server->name;
+    int port = server->port;
     struct sockaddr_storage serv_addr = {};
+    struct sockaddr_un unix_addr;
+    struct sockaddr *addr = (struct sockaddr *)&serv_addr;
+    socklen_t addrlen = sizeof(serv_addr);
     int rv = -1;
+    int so;
 
     /* prepare for connect */
-    int so = open_network_socket(MXS_SOCKET_NETWORK, &serv_addr, host, port);
+    if (server->socket)
+    {
+        so = open_unix_socket(&unix_addr, server->socket);
+        addr = (struct sockaddr *)&unix_addr;
+        addrlen = sizeof(unix_addr);
+    }
+    else
+    {
+        so = open_network_socket(MXS_SOCKET_NETWORK, &serv_addr, host, port);
+    }
 
     if (so == -1)
     {
@@ -286,7 +309,9 @@ static int gw_do_connect_to_backend(char *host, int port, int *fd)
         return rv;
     }
 
-    rv = connect(so, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+    socket_opts_apply(so, &server->sockopts, MXS_SOCKET_NETWORK);
+
+    rv = connect(so, addr, addrlen);
 
     if (rv != 0)
     {
@@ -296,8 +321,9 @@ static int gw_do_connect_to_backend(char *host, int port, int *fd)
         }
         else
         {
-            MXS_ERROR("Failed to connect backend server [%s]:%d due to: %d, %s.",
-                      host, port, errno, mxs_strerror(errno));
+            MXS_ERROR("Failed to connect backend server [%s]:%d%s%s due to: %d, %s.",
+                      host, port, server->socket ? " through " : "",
+                      server->socket ? server->socket : "", errno, mxs_strerror(errno));
             close(so);
             return rv;
         }
@@ -616,6 +642,279 @@ static inline bool expecting_resultset(MySQLProtocol *proto)
            proto->current_command == MYSQL_COM_STMT_FETCH;
 }
 
+/**
+ * @brief Check whether a result set has been completely read
+ *
+ * Only the packets that have arrived after the previous call are inspected.
+ * The number of bytes already inspected and the number of EOF packets found
+ * in them are kept in the protocol, so a result set that arrives in many
+ * reads is neither rescanned nor copied while it is being collected.
+ *
+ * @param proto  Backend protocol
+ * @param buffer All data of the result set read so far, need not be contiguous
+ * @return True if the buffer contains the whole result set
+ */
+static bool resultset_complete(MySQLProtocol *proto, GWBUF *buffer)
+{
+    size_t total = gwbuf_length(buffer);
+    size_t pos = proto->rset_scanned;
+    size_t offset = pos;
+    bool complete = false;
+
+    /** Skip the buffers that were inspected by earlier calls */
+    while (buffer && offset >= GWBUF_LENGTH(buffer))
+    {
+        offset -= GWBUF_LENGTH(buffer);
+        buffer = buffer->next;
+    }
+
+    while (!complete && pos + MYSQL_HEADER_LEN < total)
+    {
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+        gwbuf_copy_data(buffer, offset, sizeof(header), header);
+        size_t pktlen = MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN;
+
+        if (pos + pktlen > total)
+        {
+            /** The rest of the packet has not arrived yet */
+            break;
+        }
+
+        if (header[MYSQL_HEADER_LEN] == MYSQL_REPLY_ERR ||
+            (pktlen == MYSQL_EOF_PACKET_LEN && header[MYSQL_HEADER_LEN] == MYSQL_REPLY_EOF &&
+             ++proto->rset_eofs == 2))
+        {
+            complete = true;
+        }
+
+        pos += pktlen;
+        offset += pktlen;
+
+        while (buffer && offset >= GWBUF_LENGTH(buffer))
+        {
+            offset -= GWBUF_LENGTH(buffer);
+            buffer = buffer->next;
+        }
+    }
+
+    if (complete)
+    {
+        proto->rset_scanned = 0;
+        proto->rset_eofs = 0;
+    }
+    else
+    {
+        proto->rset_scanned = pos;
+    }
+
+    return complete;
+}
+
+/** The longest possible start of an OK packet up to and including the warnings */
+#define MYSQL_OK_PACKET_HEADER_MAX (MYSQL_HEADER_LEN + 1 + 9 + 9 + 2 + 2)
+
+/**
+ * @brief Check whether an OK packet must be converted for the client
+ *
+ * @param data The start of the OK packet
+ * @param len  Length of @c data, at most the length of the packet
+ * @return True if the packet has an info string or session state information
+ *         that must be converted to the format the client expects
+ */
+static bool ok_packet_has_info(const uint8_t *data, size_t len)
+{
+    size_t pos = MYSQL_HEADER_LEN + 1;
+
+    if (pos < len)
+    {
+        pos += mxs_leint_bytes(data + pos); // Affected rows
+    }
+
+    if (pos < len)
+    {
+        pos += mxs_leint_bytes(data + pos); // Last insert ID
+    }
+
+    return pos + 4 <= len && pos + 4 < MYSQL_GET_PAYLOAD_LEN(data) + MYSQL_HEADER_LEN;
+}
+
+/**
+ * @brief Decode the session state information of an OK packet
+ *
+ * The default database reported by the server is stored in the protocol. As
+ * the client has not asked for session state tracking, the packet is rebuilt
+ * without the session state information and with the info string as a plain
+ * string instead of a length-encoded one.
+ *
+ * @param proto  Backend protocol
+ * @param packet Contiguous OK packet, freed by this call
+ * @return The rebuilt packet or NULL on memory allocation failure
+ */
+static GWBUF* track_ok_packet(MySQLProtocol *proto, GWBUF *packet)
+{
+    uint8_t *data = GWBUF_DATA(packet);
+    uint8_t *end = data + GWBUF_LENGTH(packet);
+    uint8_t *ptr = data + MYSQL_HEADER_LEN + 1;
+
+    ptr += mxs_leint_bytes(ptr);
+    ptr += mxs_leint_bytes(ptr);
+
+    uint8_t *status_ptr = ptr;
+    uint16_t status = gw_mysql_get_byte2(status_ptr);
+    ptr += 4;
+
+    if (ptr + mxs_leint_bytes(ptr) > end)
+    {
+        return packet;
+    }
+
+    size_t info_len = mxs_leint_value(ptr);
+    uint8_t *info = ptr + mxs_leint_bytes(ptr);
+    ptr = info + info_len;
+
+    if (ptr > end)
+    {
+        /** Not in the session tracking format, pass it on as it is */
+        return packet;
+    }
+
+    if ((status & MXS_SERVER_SESSION_STATE_CHANGED) && ptr < end)
+    {
+        uint64_t state_len = mxs_leint_value(ptr);
+        ptr += mxs_leint_bytes(ptr);
+        uint8_t *state_end = ptr + state_len <= end ? ptr + state_len : end;
+
+        while (ptr + 1 < state_end)
+        {
+            uint8_t type = *ptr++;
+            uint64_t len = mxs_leint_value(ptr);
+            ptr += mxs_leint_bytes(ptr);
+            uint8_t *next = ptr + len;
+
+            if (next > state_end)
+            {
+                break;
+            }
+
+            if (type == MXS_SESSION_TRACK_SCHEMA && ptr < next)
+            {
+                uint64_t db_len = mxs_leint_value(ptr);
+                uint8_t *db = ptr + mxs_leint_bytes(ptr);
+
+                if (db + db_len <= next && db_len <= MYSQL_DATABASE_MAXLEN)
+                {
+                    memcpy(proto->tracked_db, db, db_len);
+                    proto->tracked_db[db_len] = '\0';
+                }
+            }
+
+            ptr = next;
+        }
+    }
+
+    size_t head_len = status_ptr + 4 - data;
+    GWBUF *rval = gwbuf_alloc(head_len + info_len);
+
+    if (rval)
+    {
+        uint8_t *out = GWBUF_DATA(rval);
+        memcpy(out, data, head_len);
+        gw_mysql_set_byte3(out, head_len + info_len - MYSQL_HEADER_LEN);
+        gw_mysql_set_byte2(out + (status_ptr - data), status & ~MXS_SERVER_SESSION_STATE_CHANGED);
+        memcpy(out + head_len, info, info_len);
+    }
+
+    gwbuf_free(packet);
+    return rval;
+}
+
+/**
+ * @brief Start following the replies to a command written to the server
+ *
+ * @param proto Backend protocol
+ */
+static void start_command_replies(MySQLProtocol *proto)
+{
+    modutil_reset_reply_state(&proto->reply_state);
+    proto->result_start = true;
+}
+
+/**
+ * @brief Follow the session state that the server reports in a reply
+ *
+ * The status flags of the OK packets and of the EOF packets that end the
+ * result sets are stored in the protocol, so the router knows exactly whether
+ * a transaction is open and whether autocommit is on. If the server tracks
+ * the session state, the OK packets are also decoded and converted to the
+ * format the client expects, and the packet boundaries in @c info are updated
+ * to match. Only OK packets that start a result are converted, the packets of
+ * a result set are always passed on as they are.
+ *
+ * @param proto  Backend protocol
+ * @param buffer Complete packets of the reply
+ * @param info   The packets of @c buffer
+ * @return The packets to pass on or NULL on memory allocation failure
+ */
+static GWBUF* track_session_state(MySQLProtocol *proto, GWBUF *buffer, MXS_REPLY_INFO *info)
+{
+    GWBUF *rval = NULL;
+    size_t consumed = 0;
+    int64_t shift = 0;
+
+    for (int i = 0; i < info->n_packets; i++)
+    {
+        MXS_REPLY_PACKET *packet = &info->packets[i];
+        size_t offset = packet->offset - consumed;
+        packet->offset += shift;
+
+        bool starts_result = proto->result_start;
+        proto->result_start = packet->flags & (MXS_REPLY_RESULT_END | MXS_REPLY_LOCAL_INFILE);
+
+        if ((packet->flags & MXS_REPLY_RESULT_END) && !(packet->flags & MXS_REPLY_ERR))
+        {
+            proto->server_status = packet->status;
+            proto->have_status = true;
+        }
+
+        if ((packet->flags & MXS_REPLY_OK) && starts_result && proto->session_track)
+        {
+            uint8_t header[MYSQL_OK_PACKET_HEADER_MAX];
+            size_t n = gwbuf_copy_data(buffer, offset, sizeof(header), header);
+
+            if (ok_packet_has_info(header, MXS_MIN(n, packet->length)))
+            {
+                GWBUF *head = gwbuf_split(&buffer, offset);
+                GWBUF *ok = gwbuf_split(&buffer, packet->length);
+                GWBUF *tmp = gwbuf_make_contiguous(ok);
+
+                if (tmp)
+                {
+                    tmp = track_ok_packet(proto, tmp);
+                }
+                else
+                {
+                    gwbuf_free(ok);
+                }
+
+                if (tmp == NULL)
+                {
+                    gwbuf_free(rval);
+                    gwbuf_free(head);
+                    gwbuf_free(buffer);
+                    return NULL;
+                }
+
+                consumed += offset + packet->length;
+                shift += (int64_t)GWBUF_LENGTH(tmp) - packet->length;
+                packet->length = GWBUF_LENGTH(tmp);
+                rval = gwbuf_append(gwbuf_append(rval, head), tmp);
+            }
+        }
+    }
+
+    return gwbuf_append(rval, buffer);
+}
+
 /**
  * Helpers for checking OK and ERR packets specific to COM_CHANGE_USER
  */
@@ -699,7 +998,28 @@ gw_read_and_write(DCB *dcb)
     uint64_t capabilities = service_get_capabilities(session->service);
     MySQLProtocol *proto = (MySQLProtocol *)dcb->protocol;
 
-    if (rcap_type_required(capabilities, RCAP_TYPE_STMT_OUTPUT) || proto->ignore_reply)
+    if (proto->reset_replies && !discard_reset_replies(dcb, &read_buffer))
+    {
+        return 0;
+    }
+
+    if (rcap_type_required(capabilities, RCAP_TYPE_RESULTSET_OUTPUT) &&
+        expecting_resultset(proto) && mxs_mysql_is_result_set(read_buffer) &&
+        !resultset_complete(proto, read_buffer))
+    {
+        /** Keep collecting the result set as it is, it is split and made
+         * contiguous only once it is complete */
+        dcb->dcb_readqueue = read_buffer;
+        return 0;
+    }
+
+    bool track_state = proto->session_track ||
+                       rcap_type_required(capabilities, RCAP_TYPE_SESSION_STATE_TRACKING);
+    bool reply_info = rcap_type_required(capabilities, RCAP_TYPE_REPLY_INFO);
+    MXS_REPLY_INFO *info = NULL;
+
+    if (rcap_type_required(capabilities, RCAP_TYPE_STMT_OUTPUT) || proto->ignore_reply ||
+        track_state || reply_info)
     {
         GWBUF *tmp = modutil_get_complete_packets(&read_buffer);
         /* Put any residue into the read queue */
@@ -714,6 +1034,16 @@ gw_read_and_write(DCB *dcb)
 
         read_buffer = tmp;
 
+        if ((track_state || reply_info) && !proto->ignore_reply &&
+            (info = modutil_parse_reply(&proto->reply_state, proto->current_command, read_buffer)) &&
+            track_state && (read_buffer = track_session_state(proto, read_buffer, info)) == NULL)
+        {
+            /** Failed to convert an OK packet */
+            modutil_free_reply_info(info);
+            poll_fake_hangup_event(dcb);
+            return 0;
+        }
+
         if (rcap_type_required(capabilities, RCAP_TYPE_CONTIGUOUS_OUTPUT) || proto->ignore_reply)
         {
             if ((tmp = gwbuf_make_contiguous(read_buffer)))
@@ -724,20 +1054,10 @@ gw_read_and_write(DCB *dcb)
             {
                 /** Failed to make the buffer contiguous */
                 gwbuf_free(read_buffer);
+                modutil_free_reply_info(info);
                 poll_fake_hangup_event(dcb);
                 return 0;
             }
-
-            if (rcap_type_required(capabilities, RCAP_TYPE_RESULTSET_OUTPUT) &&
-                expecting_resultset(proto) && mxs_mysql_is_result_set(read_buffer))
-            {
-                int more = 0;
-                if (modutil_count_signal_packets(read_buffer, 0, 0, &more) != 2)
-                {
-                    dcb->dcb_readqueue = read_buffer;
-                    return 0;
-                }
-            }
         }
     }
 
@@ -844,6 +1164,7 @@ gw_read_and_write(DCB *dcb)
             {
                 stmt = gwbuf_append(stmt, read_buffer);
                 dcb->dcb_readqueue = gwbuf_append(stmt, dcb->dcb_readqueue);
+                modutil_free_reply_info(info);
                 return 0;
             }
 
@@ -853,6 +1174,7 @@ gw_read_and_write(DCB *dcb)
                           "Read buffer unexpectedly null, even though response "
                           "not marked as complete. User: %s",
                           pthread_self(), dcb->session->client_dcb->user);
+                modutil_free_reply_info(info);
                 return 0;
             }
         }
@@ -865,11 +1187,19 @@ gw_read_and_write(DCB *dcb)
         {
             stmt = read_buffer;
             read_buffer = NULL;
+
+            if (info)
+            {
+                /** The packet boundaries describe the whole buffer */
+                modutil_add_reply_info(stmt, info);
+                info = NULL;
+            }
         }
 
         if (session_ok_to_route(dcb))
         {
             gwbuf_set_type(stmt, GWBUF_TYPE_MYSQL);
+            MXS_PROBE3(backend_reply, session->ses_id, dcb->server->unique_name, GWBUF_LENGTH(stmt));
             session->service->router->clientReply(session->service->router_instance,
                                                   session->router_session,
                                                   stmt, dcb);
@@ -882,6 +1212,8 @@ gw_read_and_write(DCB *dcb)
     }
     while (read_buffer);
 
+    modutil_free_reply_info(info);
+
     return return_code;
 }
 
@@ -960,6 +1292,8 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
     int rc = 0;
 
     CHK_DCB(dcb);
+    MXS_PROBE3(backend_send, dcb->session ? dcb->session->ses_id : 0,
+               dcb->server->unique_name, GWBUF_LENGTH(queue));
 
     if (dcb->was_persistent)
     {
@@ -1005,7 +1339,19 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             return 1;
         }
 
-        GWBUF *buf = gw_create_change_user_packet(dcb->session->client_dcb->data, dcb->protocol);
+        MYSQL_session *mses = dcb->session->client_dcb->data;
+
+        if (strlen(mses->db) > 0 && server_supports_reset_connection(dcb->server))
+        {
+            /**
+             * The pool only hands out connections of the same user, so the
+             * session state can be reset without authenticating again. The
+             * reset is sent in front of the query, not waited for.
+             */
+            return gw_send_reset_connection(dcb, mses, queue);
+        }
+
+        GWBUF *buf = gw_create_change_user_packet(mses, dcb->protocol);
         int rc = 0;
 
         if (dcb_write(dcb, buf))
@@ -1084,6 +1430,9 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
                 backend_protocol->current_command = client_proto->current_command;
             }
 
+            /** Follow the replies to this command from their start */
+            start_command_replies(backend_protocol);
+
             MXS_DEBUG("%lu [gw_MySQLWrite_backend] write to dcb %p "
                       "fd %d protocol state %s.",
                       pthread_self(),
@@ -1213,6 +1562,9 @@ static int gw_error_backend_event(DCB *dcb)
         }
         return 1;
     }
+    /** Let the monitor check the server instead of waiting for its next cycle */
+    monitor_request_check(dcb->server);
+
     errbuf = mysql_create_custom_error(1,
                                        0,
                                        "Lost connection to backend server.");
@@ -1300,6 +1652,9 @@ static int gw_backend_hangup(DCB *dcb)
     router = session->service->router;
     router_instance = session->service->router_instance;
 
+    /** Let the monitor check the server instead of waiting for its next cycle */
+    monitor_request_check(dcb->server);
+
     errbuf = mysql_create_custom_error(1,
                                        0,
                                        "Lost connection to backend server.");
@@ -2082,5 +2437,145 @@ static bool gw_connection_established(DCB* dcb)
 {
     MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
     return proto->protocol_auth_state == MXS_AUTH_STATE_COMPLETE &&
-           !proto->ignore_reply && !proto->stored_query;
+           !proto->ignore_reply && !proto->stored_query && proto->reset_replies == 0;
+}
+
+/**
+ * Create a MySQL command packet
+ *
+ * @param command The command byte
+ * @param arg     The string argument of the command, or NULL
+ * @return The command packet or NULL if memory allocation failed
+ */
+static GWBUF* gw_create_command_packet(uint8_t command, const char *arg)
+{
+    size_t len = arg ? strlen(arg) : 0;
+    GWBUF *buffer = gwbuf_alloc(MYSQL_HEADER_LEN + 1 + len);
+
+    if (buffer)
+    {
+        uint8_t *data = GWBUF_DATA(buffer);
+        gw_mysql_set_byte3(data, 1 + len);
+        data[MYSQL_SEQ_OFFSET] = 0;
+        data[MYSQL_COM_OFFSET] = command;
+        memcpy(data + MYSQL_HEADER_LEN + 1, arg, len);
+    }
+
+    return buffer;
+}
+
+/**
+ * Check whether a server supports COM_RESET_CONNECTION. It was added in
+ * MySQL 5.7.3 and MariaDB 10.2.4.
+ *
+ * @param server The server to check
+ * @return True if the version of the server is known to support it
+ */
+static bool server_supports_reset_connection(const SERVER *server)
+{
+    const char *version = server->server_string;
+    int major = 0;
+    int minor = 0;
+    int patch = 0;
+
+    if (version == NULL || sscanf(version, "%d.%d.%d", &major, &minor, &patch) != 3)
+    {
+        return false;
+    }
+
+    int number = major * 10000 + minor * 100 + patch;
+    return major >= 10 ? number >= 100204 : number >= 50703;
+}
+
+/**
+ * Reset the session state of a connection taken from the persistent pool
+ *
+ * A COM_RESET_CONNECTION is sent followed by a COM_INIT_DB and a statement
+ * that restores the character set of the connection, as the reset returns
+ * the session variables to the global values. The query is written right
+ * after them and the three OK packets are discarded when they arrive, so
+ * the reuse of the connection takes no extra round-trips.
+ *
+ * @param dcb   The backend DCB taken from the pool
+ * @param mses  The session data of the client
+ * @param queue The first query of the client
+ * @return 1 on success, 0 on failure
+ */
+static int gw_send_reset_connection(DCB *dcb, MYSQL_session *mses, GWBUF *queue)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    char set_charset[128];
+
+    snprintf(set_charset, sizeof(set_charset), "SET character_set_client=%u, "
+             "character_set_results=%u, collation_connection=%u",
+             proto->charset, proto->charset, proto->charset);
+
+    GWBUF *reset = gw_create_command_packet(GW_MYSQL_COM_RESET_CONNECTION, NULL);
+    GWBUF *init_db = gw_create_command_packet(MYSQL_COM_INIT_DB, mses->db);
+    GWBUF *charset = modutil_create_query(set_charset);
+
+    if (reset == NULL || init_db == NULL || charset == NULL)
+    {
+        gwbuf_free(reset);
+        gwbuf_free(init_db);
+        gwbuf_free(charset);
+        gwbuf_free(queue);
+        return 0;
+    }
+
+    reset = gwbuf_append(gwbuf_append(reset, init_db), charset);
+
+    if (!dcb_write(dcb, reset))
+    {
+        gwbuf_free(queue);
+        return 0;
+    }
+
+    MXS_INFO("Sent COM_RESET_CONNECTION");
+    proto->reset_replies = 3;
+    return gw_MySQLWrite_backend(dcb, queue);
+}
+
+/**
+ * Discard the replies to the statements that reset a pooled connection
+ *
+ * If any of them failed, the session state is unknown and the connection
+ * is closed.
+ *
+ * @param dcb         The backend DCB
+ * @param read_buffer The data read from the backend, on return the data
+ *                    that follows the replies
+ * @return True if there is data left to process
+ */
+static bool discard_reset_replies(DCB *dcb, GWBUF **read_buffer)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    GWBUF *reply;
+
+    while (proto->reset_replies && (reply = modutil_get_next_MySQL_packet(read_buffer)))
+    {
+        uint8_t result = MYSQL_REPLY_ERR;
+        gwbuf_copy_data(reply, MYSQL_HEADER_LEN, 1, &result);
+        gwbuf_free(reply);
+        proto->reset_replies--;
+
+        if (result != MYSQL_REPLY_OK)
+        {
+            MXS_ERROR("Failed to reset the state of a pooled connection to '%s'.",
+                      dcb->server->unique_name);
+            gwbuf_free(*read_buffer);
+            *read_buffer = NULL;
+            poll_fake_hangup_event(dcb);
+            return false;
+        }
+    }
+
+    if (proto->reset_replies)
+    {
+        /** The rest of the replies have not been read yet */
+        dcb->dcb_readqueue = *read_buffer;
+        return false;
+    }
+
+    return *read_buffer != NULL;
 }
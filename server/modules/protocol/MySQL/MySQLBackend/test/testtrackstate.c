@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testtrackstate.c - Tests for the session state tracking of the backend protocol
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+
+// The tested functions are static
+#include "../mysql_backend.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/debug.h>
+
+/** Append a packet with the given payload to a buffer */
+static GWBUF* add_packet(GWBUF* buffer, const uint8_t* payload, size_t len)
+{
+    GWBUF* packet = gwbuf_alloc(MYSQL_HEADER_LEN + len);
+    uint8_t* data = GWBUF_DATA(packet);
+    gw_mysql_set_byte3(data, len);
+    data[3] = 0;
+    memcpy(data + MYSQL_HEADER_LEN, payload, len);
+    return gwbuf_append(buffer, packet);
+}
+
+/** Append an EOF packet with the given status flags to a buffer */
+static GWBUF* add_eof(GWBUF* buffer, uint16_t status)
+{
+    uint8_t eof[] = {MYSQL_REPLY_EOF, 0, 0, status & 0xff, status >> 8};
+    return add_packet(buffer, eof, sizeof(eof));
+}
+
+/** Append the start of a result set up to its column definition EOF */
+static GWBUF* add_columns(GWBUF* buffer, uint16_t status)
+{
+    const uint8_t column_count[] = {1};
+    const uint8_t column_def[] = {3, 'd', 'e', 'f', 0};
+    buffer = add_packet(buffer, column_count, sizeof(column_count));
+    buffer = add_packet(buffer, column_def, sizeof(column_def));
+    return add_eof(buffer, status);
+}
+
+/**
+ * Pass a reply to a command through the session state tracking
+ *
+ * @param proto   Backend protocol
+ * @param command The command
+ * @param reply   The reply, freed by this call
+ * @return True if the tracking passed the reply on as it was
+ */
+static bool reply_unchanged(MySQLProtocol *proto, uint8_t command, GWBUF *reply)
+{
+    start_command_replies(proto);
+    proto->current_command = command;
+
+    size_t len = gwbuf_length(reply);
+    uint8_t before[len];
+    gwbuf_copy_data(reply, 0, len, before);
+
+    MXS_REPLY_INFO *info = modutil_parse_reply(&proto->reply_state, command, reply);
+    ss_info_dassert(info, "The reply should be parsed");
+    GWBUF *result = track_session_state(proto, reply, info);
+    ss_info_dassert(result, "The reply should be tracked");
+
+    uint8_t after[len];
+    bool rval = gwbuf_length(result) == len &&
+                gwbuf_copy_data(result, 0, len, after) == len &&
+                memcmp(before, after, len) == 0;
+
+    modutil_free_reply_info(info);
+    gwbuf_free(result);
+    return rval;
+}
+
+/** A cursor-opening execute followed by a plain execute keeps the binary rows intact */
+static void test_cursor_then_execute(MySQLProtocol *proto)
+{
+    GWBUF *reply = add_columns(NULL, SERVER_STATUS_AUTOCOMMIT | SERVER_STATUS_CURSOR_EXISTS);
+    ss_info_dassert(reply_unchanged(proto, MYSQL_COM_STMT_EXECUTE, reply),
+                    "The reply that opens a cursor should be passed on as it is");
+    ss_info_dassert(proto->server_status & SERVER_STATUS_CURSOR_EXISTS,
+                    "The status of the cursor EOF should be stored");
+
+    /** Binary rows start with a zero byte and would look like OK packets with an info string */
+    const uint8_t row[] = {0, 0, 1, 2, 3, 4, 5, 6};
+    reply = add_columns(NULL, SERVER_STATUS_AUTOCOMMIT);
+    reply = add_packet(reply, row, sizeof(row));
+    reply = add_packet(reply, row, sizeof(row));
+    reply = add_eof(reply, SERVER_STATUS_AUTOCOMMIT);
+    ss_info_dassert(reply_unchanged(proto, MYSQL_COM_STMT_EXECUTE, reply),
+                    "The rows of the next execute should be passed on as they are");
+    ss_info_dassert(proto->server_status == SERVER_STATUS_AUTOCOMMIT,
+                    "The status of the last EOF should be stored");
+}
+
+/** An OK packet that starts a reply is converted and its default database stored */
+static void test_ok_packet(MySQLProtocol *proto)
+{
+    const uint8_t ok[] =
+    {
+        MYSQL_REPLY_OK, 0, 0,
+        SERVER_STATUS_AUTOCOMMIT, MXS_SERVER_SESSION_STATE_CHANGED >> 8,
+        0, 0,                                   // Warnings
+        0,                                      // Info
+        7, MXS_SESSION_TRACK_SCHEMA, 5, 4, 't', 'e', 's', 't'
+    };
+
+    GWBUF *reply = add_packet(NULL, ok, sizeof(ok));
+    ss_info_dassert(!reply_unchanged(proto, MYSQL_COM_QUERY, reply),
+                    "The OK packet should be converted");
+    ss_info_dassert(strcmp(proto->tracked_db, "test") == 0, "The default database should be stored");
+}
+
+int main()
+{
+    MySQLProtocol proto;
+    memset(&proto, 0, sizeof(proto));
+    proto.session_track = true;
+
+    test_cursor_then_execute(&proto);
+    test_ok_packet(&proto);
+
+    return 0;
+}
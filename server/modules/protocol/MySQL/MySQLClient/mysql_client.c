@@ -188,6 +188,7 @@ static int thread_init(void)
  */
 static void thread_finish(void)
 {
+    mxs_mysql_compress_thread_finish();
     mysql_thread_end();
 }
 
@@ -358,6 +359,9 @@ int MySQLSendHandshake(DCB* dcb)
         mysql_server_capabilities_one[1] |= (int)GW_MYSQL_CAPABILITIES_SSL >> 8;
     }
 
+    /** Clients may compress the traffic after the authentication */
+    mysql_server_capabilities_one[0] |= (uint8_t)GW_MYSQL_CAPABILITIES_COMPRESS;
+
     memcpy(mysql_handshake_payload, mysql_server_capabilities_one, sizeof(mysql_server_capabilities_one));
     mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_capabilities_one);
 
@@ -420,9 +424,52 @@ int MySQLSendHandshake(DCB* dcb)
  */
 int gw_MySQLWrite_client(DCB *dcb, GWBUF *queue)
 {
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (proto->compress && (queue = mxs_mysql_compress(proto, queue)) == NULL)
+    {
+        return 0;
+    }
+
     return dcb_write(dcb, queue);
 }
 
+/**
+ * @brief Read data from a client that uses the compressed protocol
+ *
+ * The read queue of the DCB holds uncompressed data, so the received data of
+ * a partial compressed packet is kept in the protocol instead.
+ *
+ * @param dcb         Client DCB
+ * @param read_buffer On return, the uncompressed data
+ * @return -1 on error, otherwise the number of bytes read
+ */
+static int read_compressed(DCB *dcb, GWBUF **read_buffer)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    GWBUF *data = gwbuf_append(dcb->dcb_readqueue, dcb->dcb_fakequeue);
+    GWBUF *received = proto->compressed_queue;
+    dcb->dcb_readqueue = NULL;
+    dcb->dcb_fakequeue = NULL;
+    proto->compressed_queue = NULL;
+
+    int rc = dcb_read(dcb, &received, 0);
+    bool error = false;
+
+    data = gwbuf_append(data, mxs_mysql_decompress(proto, &received, &error));
+    proto->compressed_queue = received;
+
+    if (error)
+    {
+        gwbuf_free(data);
+        data = NULL;
+        rc = -1;
+    }
+
+    *read_buffer = data;
+    return rc;
+}
+
 /**
  * @brief Client read event triggered by EPOLLIN
  *
@@ -475,7 +522,15 @@ int gw_read_client_event(DCB* dcb)
     {
         max_bytes = 36;
     }
-    return_code = dcb_read(dcb, &read_buffer, max_bytes);
+    if (protocol->compress)
+    {
+        return_code = read_compressed(dcb, &read_buffer);
+    }
+    else
+    {
+        return_code = dcb_read(dcb, &read_buffer, max_bytes);
+    }
+
     if (return_code < 0)
     {
         dcb_close(dcb);
@@ -721,6 +776,9 @@ gw_read_do_authentication(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
                        session->state != SESSION_STATE_DUMMY);
             protocol->protocol_auth_state = MXS_AUTH_STATE_COMPLETE;
             mxs_mysql_send_ok(dcb, next_sequence, 0, NULL);
+
+            /** The packets that follow the OK are compressed if the client asked for it */
+            protocol->compress = protocol->client_capabilities & GW_MYSQL_CAPABILITIES_COMPRESS;
         }
         else
         {
@@ -1512,6 +1570,15 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
              */
             gwbuf_set_type(packetbuf, GWBUF_TYPE_SINGLE_STMT);
 
+            /**
+             * A packet of the maximum size is followed by the rest of the same
+             * query. The parts are routed as they arrive but they contain no
+             * command of their own.
+             */
+            MySQLProtocol *proto = (MySQLProtocol*)session->client_dcb->protocol;
+            bool continued = proto->large_query;
+            proto->large_query = gwbuf_length(packetbuf) == MYSQL_HEADER_LEN + GW_MYSQL_MAX_PACKET_LEN;
+
             if (rcap_type_required(capabilities, RCAP_TYPE_CONTIGUOUS_INPUT))
             {
                 if (!GWBUF_IS_CONTIGUOUS(packetbuf))
@@ -1533,7 +1600,7 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
                     }
                 }
 
-                if (rcap_type_required(capabilities, RCAP_TYPE_TRANSACTION_TRACKING))
+                if (rcap_type_required(capabilities, RCAP_TYPE_TRANSACTION_TRACKING) && !continued)
                 {
                     uint8_t *data = GWBUF_DATA(packetbuf);
 
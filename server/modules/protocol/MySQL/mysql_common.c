@@ -47,7 +47,9 @@
 #include <maxscale/alloc.h>
 #include <maxscale/log_manager.h>
 #include <netinet/tcp.h>
+#include <zlib.h>
 #include <maxscale/modutil.h>
+#include <maxscale/platform.h>
 
 uint8_t null_client_sha1[MYSQL_SCRAMBLE_LEN] = "";
 
@@ -105,6 +107,19 @@ MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd)
     p->stored_query = NULL;
     p->extra_capabilities = 0;
     p->ignore_reply = false;
+    p->reset_replies = 0;
+    p->large_query = false;
+    p->rset_scanned = 0;
+    p->rset_eofs = 0;
+    p->compress = false;
+    p->compressed_seq = 0;
+    p->compressed_queue = NULL;
+    p->session_track = false;
+    modutil_reset_reply_state(&p->reply_state);
+    p->result_start = true;
+    p->have_status = false;
+    p->server_status = 0;
+    p->tracked_db[0] = '\0';
 #if defined(SS_DEBUG)
     p->protocol_chk_top = CHK_NUM_PROTOCOL;
     p->protocol_chk_tail = CHK_NUM_PROTOCOL;
@@ -146,6 +161,7 @@ void mysql_protocol_done(DCB* dcb)
         }
 
         gwbuf_free(p->stored_query);
+        gwbuf_free(p->compressed_queue);
 
         p->protocol_state = MYSQL_PROTOCOL_DONE;
     }
@@ -1257,7 +1273,8 @@ load_hashed_password(uint8_t *scramble, uint8_t *payload, uint8_t *passwd)
  * the connection requires SSL (set from the MaxScale configuration). The
  * compression flag may be set, although compression is NOT SUPPORTED. If a
  * database name has been specified in the function call, the relevant flag
- * is set.
+ * is set. Session state tracking is requested if the server supports it and
+ * the service has declared RCAP_TYPE_SESSION_STATE_TRACKING.
  *
  * @param conn  The MySQLProtocol structure for the connection
  * @param db_specified Whether the connection request specified a database
@@ -1303,6 +1320,13 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
 
     final_capabilities |= (int)GW_MYSQL_CAPABILITIES_PLUGIN_AUTH;
 
+    if ((conn->server_capabilities & GW_MYSQL_CAPABILITIES_SESSION_TRACK) &&
+        rcap_type_required(service_get_capabilities(conn->owner_dcb->session->service),
+                           RCAP_TYPE_SESSION_STATE_TRACKING))
+    {
+        final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_SESSION_TRACK;
+    }
+
     return final_capabilities;
 }
 
@@ -1336,6 +1360,7 @@ mxs_auth_state_t gw_send_backend_auth(DCB *dcb)
     MySQLProtocol *conn = (MySQLProtocol*)dcb->protocol;
     uint32_t capabilities = create_capabilities(conn, (local_session.db && strlen(local_session.db)), false);
     gw_mysql_set_byte4(client_capabilities, capabilities);
+    conn->session_track = capabilities & GW_MYSQL_CAPABILITIES_SESSION_TRACK;
 
     /**
      * Use the default authentication plugin name. If the server is using a
@@ -1496,6 +1521,7 @@ gw_decode_mysql_server_handshake(MySQLProtocol *conn, uint8_t *payload)
 
     // get capabilities part 2 (2 bytes)
     memcpy(&capab_ptr[2], &mysql_server_capabilities_two, 2);
+    conn->server_capabilities = mysql_server_capabilities_one | (mysql_server_capabilities_two << 16);
 
     // 2 bytes shift
     payload += 2;
@@ -1597,3 +1623,228 @@ bool mxs_mysql_is_result_set(GWBUF *buffer)
 
     return rval;
 }
+
+/** The zlib streams are kept for the lifetime of the thread and only reset
+ * between packets, so that nothing is allocated for each packet */
+static thread_local z_stream deflate_stream;
+static thread_local bool deflate_ready = false;
+static thread_local z_stream inflate_stream;
+static thread_local bool inflate_ready = false;
+
+static z_stream* get_deflate_stream()
+{
+    if (!deflate_ready)
+    {
+        memset(&deflate_stream, 0, sizeof(deflate_stream));
+        deflate_ready = deflateInit(&deflate_stream, Z_DEFAULT_COMPRESSION) == Z_OK;
+    }
+
+    return deflate_ready ? &deflate_stream : NULL;
+}
+
+static z_stream* get_inflate_stream()
+{
+    if (!inflate_ready)
+    {
+        memset(&inflate_stream, 0, sizeof(inflate_stream));
+        inflate_ready = inflateInit(&inflate_stream) == Z_OK;
+    }
+
+    return inflate_ready ? &inflate_stream : NULL;
+}
+
+void mxs_mysql_compress_thread_finish(void)
+{
+    if (deflate_ready)
+    {
+        deflateEnd(&deflate_stream);
+        deflate_ready = false;
+    }
+
+    if (inflate_ready)
+    {
+        inflateEnd(&inflate_stream);
+        inflate_ready = false;
+    }
+}
+
+static void set_compressed_header(uint8_t *header, size_t len, uint8_t seq, size_t uncompressed_len)
+{
+    gw_mysql_set_byte3(header, len);
+    header[3] = seq;
+    gw_mysql_set_byte3(header + MYSQL_HEADER_LEN, uncompressed_len);
+}
+
+/**
+ * Compress data into one compressed packet
+ *
+ * @param buffer The data, at most 0xffffff bytes
+ * @param len    Length of the data
+ * @return The compressed payload or NULL if the data was not compressed
+ */
+static GWBUF* deflate_packet(GWBUF *buffer, size_t len)
+{
+    z_stream *zs = get_deflate_stream();
+
+    if (zs == NULL || len < MYSQL_COMPRESS_MIN_LEN)
+    {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(zs, len);
+    GWBUF *rval = gwbuf_alloc(MYSQL_COMPRESSED_HEADER_LEN + bound);
+
+    if (rval)
+    {
+        int rc = Z_OK;
+        zs->next_out = GWBUF_DATA(rval) + MYSQL_COMPRESSED_HEADER_LEN;
+        zs->avail_out = bound;
+
+        for (GWBUF *b = buffer; b && rc == Z_OK; b = b->next)
+        {
+            zs->next_in = GWBUF_DATA(b);
+            zs->avail_in = GWBUF_LENGTH(b);
+            rc = deflate(zs, b->next ? Z_NO_FLUSH : Z_FINISH);
+        }
+
+        size_t compressed_len = zs->total_out;
+        deflateReset(zs);
+
+        if (rc == Z_STREAM_END && compressed_len < len)
+        {
+            rval = gwbuf_rtrim(rval, bound - compressed_len);
+        }
+        else
+        {
+            gwbuf_free(rval);
+            rval = NULL;
+        }
+    }
+
+    return rval;
+}
+
+GWBUF* mxs_mysql_compress(MySQLProtocol *proto, GWBUF *buffer)
+{
+    GWBUF *rval = NULL;
+
+    while (buffer)
+    {
+        size_t len = gwbuf_length(buffer);
+        GWBUF *data = buffer;
+        buffer = NULL;
+
+        if (len > GW_MYSQL_MAX_PACKET_LEN)
+        {
+            /** The length of a compressed packet has only three bytes */
+            len = GW_MYSQL_MAX_PACKET_LEN;
+            buffer = data;
+            data = gwbuf_split(&buffer, len);
+        }
+
+        GWBUF *packet = deflate_packet(data, len);
+
+        if (packet)
+        {
+            set_compressed_header(GWBUF_DATA(packet), GWBUF_LENGTH(packet) - MYSQL_COMPRESSED_HEADER_LEN,
+                                  proto->compressed_seq++, len);
+            gwbuf_free(data);
+        }
+        else if ((packet = gwbuf_alloc(MYSQL_COMPRESSED_HEADER_LEN)))
+        {
+            /** An uncompressed length of zero means that the payload is not compressed */
+            set_compressed_header(GWBUF_DATA(packet), len, proto->compressed_seq++, 0);
+            packet = gwbuf_append(packet, data);
+        }
+        else
+        {
+            gwbuf_free(data);
+            gwbuf_free(buffer);
+            gwbuf_free(rval);
+            return NULL;
+        }
+
+        rval = gwbuf_append(rval, packet);
+    }
+
+    return rval;
+}
+
+/**
+ * Decompress the payload of a compressed packet
+ *
+ * @param payload The compressed payload
+ * @param len     The uncompressed length of the payload
+ * @return The uncompressed data or NULL on error
+ */
+static GWBUF* inflate_packet(GWBUF *payload, size_t len)
+{
+    z_stream *zs = get_inflate_stream();
+    GWBUF *rval = zs ? gwbuf_alloc(len) : NULL;
+
+    if (rval)
+    {
+        int rc = Z_OK;
+        zs->next_out = GWBUF_DATA(rval);
+        zs->avail_out = len;
+
+        for (GWBUF *b = payload; b && rc == Z_OK; b = b->next)
+        {
+            zs->next_in = GWBUF_DATA(b);
+            zs->avail_in = GWBUF_LENGTH(b);
+            rc = inflate(zs, Z_NO_FLUSH);
+        }
+
+        size_t inflated_len = zs->total_out;
+        inflateReset(zs);
+
+        if (rc != Z_STREAM_END || inflated_len != len)
+        {
+            gwbuf_free(rval);
+            rval = NULL;
+        }
+    }
+
+    return rval;
+}
+
+GWBUF* mxs_mysql_decompress(MySQLProtocol *proto, GWBUF **buffer, bool *error)
+{
+    GWBUF *rval = NULL;
+    uint8_t header[MYSQL_COMPRESSED_HEADER_LEN];
+
+    while (gwbuf_copy_data(*buffer, 0, sizeof(header), header) == sizeof(header))
+    {
+        size_t len = gw_mysql_get_byte3(header);
+        size_t uncompressed_len = gw_mysql_get_byte3(header + MYSQL_HEADER_LEN);
+
+        if (gwbuf_length(*buffer) < MYSQL_COMPRESSED_HEADER_LEN + len)
+        {
+            /** The rest of the packet has not been received */
+            break;
+        }
+
+        GWBUF *payload = gwbuf_split(buffer, MYSQL_COMPRESSED_HEADER_LEN + len);
+        payload = gwbuf_consume(payload, MYSQL_COMPRESSED_HEADER_LEN);
+        proto->compressed_seq = header[3] + 1;
+
+        if (payload && uncompressed_len)
+        {
+            GWBUF *data = inflate_packet(payload, uncompressed_len);
+            gwbuf_free(payload);
+
+            if (data == NULL)
+            {
+                MXS_ERROR("Failed to decompress a packet of %lu bytes.", len);
+                *error = true;
+                break;
+            }
+
+            payload = data;
+        }
+
+        rval = gwbuf_append(rval, payload);
+    }
+
+    return rval;
+}
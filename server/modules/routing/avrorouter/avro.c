@@ -88,6 +88,7 @@ void converter_func(void* data);
 bool binlog_next_file_exists(const char* binlogdir, const char* binlog);
 int blr_file_get_next_binlogname(const char *router);
 bool avro_load_conversion_state(AVRO_INSTANCE *router);
+bool avro_load_table_cache(AVRO_INSTANCE *router);
 void avro_load_metadata_from_schemas(AVRO_INSTANCE *router);
 int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata);
 static bool ensure_dir_ok(const char* path, int mode);
@@ -185,6 +186,10 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"group_trx", MXS_MODULE_PARAM_COUNT, "1"},
             {"start_index", MXS_MODULE_PARAM_COUNT, "1"},
             {"block_size", MXS_MODULE_PARAM_COUNT, "0"},
+            {"mmap_binlog", MXS_MODULE_PARAM_BOOL, "false"},
+            {"conversion_threads", MXS_MODULE_PARAM_COUNT, "0"},
+            {"max_file_size", MXS_MODULE_PARAM_SIZE, "0"},
+            {"max_file_time", MXS_MODULE_PARAM_COUNT, "0"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -386,8 +391,11 @@ createInstance(SERVICE *service, char **options)
     memset(&inst->stats, 0, sizeof(AVRO_ROUTER_STATS));
     spinlock_init(&inst->lock);
     spinlock_init(&inst->fileslock);
+    spinlock_init(&inst->block_cache_lock);
     inst->service = service;
     inst->binlog_fd = -1;
+    inst->binlog_map = NULL;
+    inst->binlog_map_len = 0;
     inst->current_pos = 4;
     inst->binlog_position = 4;
     inst->clients = NULL;
@@ -407,6 +415,12 @@ createInstance(SERVICE *service, char **options)
     inst->trx_target = config_get_integer(params, "group_trx");
     int first_file = config_get_integer(params, "start_index");
     inst->block_size = config_get_integer(params, "block_size");
+    inst->mmap_binlog = config_get_bool(params, "mmap_binlog");
+    inst->n_workers = config_get_integer(params, "conversion_threads");
+    inst->max_file_size = config_get_size(params, "max_file_size");
+    inst->max_file_time = config_get_integer(params, "max_file_time");
+    inst->workers = NULL;
+    inst->next_worker = 0;
 
     MXS_CONFIG_PARAMETER *param = config_get_param(params, "source");
     inst->gtid.domain = 0;
@@ -491,6 +505,22 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->block_size = atoi(value);
                 }
+                else if (strcmp(options[i], "mmap_binlog") == 0)
+                {
+                    inst->mmap_binlog = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "conversion_threads") == 0)
+                {
+                    inst->n_workers = MXS_MAX(0, atoi(value));
+                }
+                else if (strcmp(options[i], "max_file_size") == 0)
+                {
+                    inst->max_file_size = strtoull(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "max_file_time") == 0)
+                {
+                    inst->max_file_time = strtoull(value, NULL, 10);
+                }
                 else
                 {
                     MXS_WARNING("Unknown router option: '%s'", options[i]);
@@ -577,6 +607,11 @@ createInstance(SERVICE *service, char **options)
         err = true;
     }
 
+    if (!err && inst->n_workers > 0 && !avro_workers_start(inst, inst->n_workers))
+    {
+        err = true;
+    }
+
     if (err)
     {
         sqlite3_close_v2(inst->sqlite_handle);
@@ -601,7 +636,11 @@ createInstance(SERVICE *service, char **options)
 
     /* AVRO converter init */
     avro_load_conversion_state(inst);
-    avro_load_metadata_from_schemas(inst);
+
+    if (!avro_load_table_cache(inst))
+    {
+        avro_load_metadata_from_schemas(inst);
+    }
 
     /*
      * Add tasks for statistic computation
@@ -653,6 +692,7 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
     memset(&client->stats, 0, sizeof(AVRO_CLIENT_STATS));
     atomic_add(&inst->stats.n_clients, 1);
     client->uuid = NULL;
+    client->filter = NULL;
     spinlock_init(&client->catch_lock);
     client->dcb = session->client_dcb;
     client->router = inst;
@@ -713,6 +753,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
     ss_dassert(prev_val > 0);
 
     free(client->uuid);
+    avro_filter_free(client->filter);
     maxavro_file_close(client->file_handle);
     sqlite3_close_v2(client->sqlite_handle);
 
@@ -816,19 +857,6 @@ static char *event_names_mariadb10[] =
 };
 */
 
-/**
- * Display an entry from the spinlock statistics data
- *
- * @param   dcb The DCB to print to
- * @param   desc    Description of the statistic
- * @param   value   The statistic value
- */
-static void
-spin_reporter(void *dcb, char *desc, int value)
-{
-    dcb_printf((DCB *) dcb, "\t\t%-35s  %d\n", desc, value);
-}
-
 /**
  * Display router diagnostics
  *
@@ -879,6 +907,19 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
     avro_get_used_tables(router_inst, dcb);
     dcb_printf(dcb, "\n");
 
+    for (int i = 0; i < router_inst->n_workers; i++)
+    {
+        AVRO_WORKER *worker = &router_inst->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        dcb_printf(dcb, "\tConversion thread %d row events:      %lu (%d queued)\n",
+                   i, worker->n_jobs, worker->n_queued);
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    dcb_printf(dcb, "\tData blocks sent from block cache:   %lu\n",
+               router_inst->stats.block_cache_hits);
+    dcb_printf(dcb, "\tData blocks read from Avro files:    %lu\n",
+               router_inst->stats.block_cache_misses);
     dcb_printf(dcb, "\tNumber of AVRO clients:              %u\n",
                router_inst->stats.n_clients);
 
@@ -930,12 +971,6 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
             // TODO: Add real value for this
             //dcb_printf(dcb, "\t\tAvro N.MaxTransactions:          %u\n", 0);
 
-#if SPINLOCK_PROFILE
-            dcb_printf(dcb, "\tSpinlock statistics (catch_lock):\n");
-            spinlock_stats(&session->catch_lock, spin_reporter, dcb);
-            dcb_printf(dcb, "\tSpinlock statistics (rses_lock):\n");
-            spinlock_stats(&session->file_lock, spin_reporter, dcb);
-#endif
             dcb_printf(dcb, "\t\t--------------------\n\n");
             session = session->next;
         }
@@ -1066,7 +1101,12 @@ void converter_func(void* data)
 
         if (avro_open_binlog(router->binlogdir, router->binlog_name, &router->binlog_fd))
         {
+            avro_map_binlog(router);
             binlog_end = avro_read_all_events(router);
+            avro_unmap_binlog(router);
+
+            /** The Avro files are indexed only after the queued rows are written */
+            avro_workers_wait(router);
 
             if (router->current_pos != start_pos || strcmp(binlog_name, router->binlog_name) != 0)
             {
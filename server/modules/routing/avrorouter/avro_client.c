@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <maxscale/service.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -50,6 +52,7 @@ static int avro_client_do_registration(AVRO_INSTANCE *, AVRO_CLIENT *, GWBUF *);
 int avro_client_callback(DCB *dcb, DCB_REASON reason, void *data);
 static void avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *queue);
 static bool avro_client_stream_data(AVRO_CLIENT *client);
+static void seek_to_gtid_file(AVRO_INSTANCE *router, AVRO_CLIENT *client);
 void avro_notify_client(AVRO_CLIENT *client);
 void poll_fake_write_event(DCB *dcb);
 GWBUF* read_avro_json_schema(const char *avrofile, const char* dir);
@@ -432,6 +435,138 @@ bool file_in_dir(const char *dir, const char *file)
     return access(path, F_OK) == 0;
 }
 
+void avro_filter_free(AVRO_FILTER *filter)
+{
+    if (filter)
+    {
+        for (int i = 0; i < filter->n_fields; i++)
+        {
+            MXS_FREE(filter->fields[i]);
+        }
+
+        for (int i = 0; i < filter->n_conditions; i++)
+        {
+            MXS_FREE(filter->columns[i]);
+            MXS_FREE(filter->values[i]);
+        }
+
+        MXS_FREE(filter);
+    }
+}
+
+/**
+ * @brief Get the filter of a client, creating it if needed
+ *
+ * @param client Client to get the filter for
+ * @return The filter or NULL on memory allocation error
+ */
+static AVRO_FILTER* get_filter(AVRO_CLIENT *client)
+{
+    if (client->filter == NULL)
+    {
+        client->filter = MXS_CALLOC(1, sizeof(AVRO_FILTER));
+    }
+
+    return client->filter;
+}
+
+/**
+ * @brief Parse the options of a REQUEST-DATA command
+ *
+ * The options are an optional GTID followed by any of the following:
+ *
+ *   FIELDS COLUMN[,COLUMN...]
+ *   WHERE COLUMN=VALUE [AND COLUMN=VALUE...]
+ *   UNTIL GTID
+ *
+ * @param client Client that sent the command
+ * @param options The options, modified by the parsing
+ * @return NULL on success or a description of the error
+ */
+static const char* parse_request_options(AVRO_CLIENT *client, char *options)
+{
+    const char delim[] = " \t\r\n";
+    char *saveptr;
+    char *tok = strtok_r(options, delim, &saveptr);
+
+    if (tok && isdigit(*tok))
+    {
+        client->requested_gtid = true;
+        extract_gtid_request(&client->gtid, tok, strlen(tok));
+        memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+        tok = strtok_r(NULL, delim, &saveptr);
+    }
+
+    while (tok)
+    {
+        AVRO_FILTER *filter = get_filter(client);
+
+        if (filter == NULL)
+        {
+            return "out of memory";
+        }
+
+        if (strcasecmp(tok, "FIELDS") == 0)
+        {
+            char *fields = strtok_r(NULL, delim, &saveptr);
+            char *fieldptr;
+
+            for (char *field = fields ? strtok_r(fields, ",", &fieldptr) : NULL;
+                 field; field = strtok_r(NULL, ",", &fieldptr))
+            {
+                if (filter->n_fields == AVRO_FILTER_MAX)
+                {
+                    return "has too many FIELDS";
+                }
+                filter->fields[filter->n_fields++] = MXS_STRDUP_A(field);
+            }
+
+            if (filter->n_fields == 0)
+            {
+                return "FIELDS with no columns";
+            }
+        }
+        else if (strcasecmp(tok, "WHERE") == 0 || strcasecmp(tok, "AND") == 0)
+        {
+            char *cond = strtok_r(NULL, delim, &saveptr);
+            char *value = cond ? strchr(cond, '=') : NULL;
+
+            if (value == NULL || value == cond)
+            {
+                return "WHERE with no COLUMN=VALUE condition";
+            }
+            else if (filter->n_conditions == AVRO_FILTER_MAX)
+            {
+                return "has too many WHERE conditions";
+            }
+
+            *value++ = '\0';
+            filter->columns[filter->n_conditions] = MXS_STRDUP_A(cond);
+            filter->values[filter->n_conditions++] = MXS_STRDUP_A(value);
+        }
+        else if (strcasecmp(tok, "UNTIL") == 0)
+        {
+            char *gtid = strtok_r(NULL, delim, &saveptr);
+
+            if (gtid == NULL || !isdigit(*gtid))
+            {
+                return "UNTIL with no GTID";
+            }
+
+            extract_gtid_request(&filter->until, gtid, strlen(gtid));
+            filter->until_set = true;
+        }
+        else
+        {
+            return "with an unknown option";
+        }
+
+        tok = strtok_r(NULL, delim, &saveptr);
+    }
+
+    return NULL;
+}
+
 /**
  * Process command from client
  *
@@ -461,18 +596,46 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
         if (data_len > 1)
         {
             const char *gtid_ptr = get_avrofile_name(file_ptr, data_len, client->avro_binfile);
+            const char *err = NULL;
+
+            avro_filter_free(client->filter);
+            client->filter = NULL;
 
             if (gtid_ptr)
             {
-                client->requested_gtid = true;
-                extract_gtid_request(&client->gtid, gtid_ptr, data_len - (gtid_ptr - file_ptr));
-                memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+                int len = data_len - (gtid_ptr - file_ptr);
+                char options[len + 1];
+                memcpy(options, gtid_ptr, len);
+                options[len] = '\0';
+                err = parse_request_options(client, options);
             }
 
-            if (file_in_dir(router->avrodir, client->avro_binfile))
+            if (err)
             {
+                dcb_printf(client->dcb, "ERR REQUEST-DATA %s", err);
+            }
+            else if (client->filter && client->format != AVRO_FORMAT_JSON)
+            {
+                dcb_printf(client->dcb, "ERR REQUEST-DATA FIELDS, WHERE and UNTIL "
+                           "are only supported with the JSON format");
+            }
+            else if (file_in_dir(router->avrodir, client->avro_binfile))
+            {
+                if (client->requested_gtid)
+                {
+                    seek_to_gtid_file(router, client);
+                }
+
+                /** The configured flow control marks are used if set */
+                if (client->dcb->high_water == 0)
+                {
+                    DCB_SET_HIGH_WATER(client->dcb, AVRO_CLIENT_HIGH_WATER);
+                    DCB_SET_LOW_WATER(client->dcb, AVRO_CLIENT_LOW_WATER);
+                }
+
                 /* set callback routine for data sending */
                 dcb_add_callback(client->dcb, DCB_REASON_DRAINED, avro_client_callback, client);
+                dcb_add_callback(client->dcb, DCB_REASON_LOW_WATER, avro_client_callback, client);
 
                 /* Add fake event that will call the avro_client_callback() routine */
                 poll_fake_write_event(client->dcb);
@@ -554,47 +717,382 @@ const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest)
     return rval;
 }
 
-static int send_row(DCB *dcb, json_t* row)
+/**
+ * @brief Convert a row into the text sent to a JSON client
+ *
+ * @param row Row to convert
+ * @return Buffer with the row and a newline or NULL on error
+ */
+static GWBUF* row_to_buffer(json_t* row)
 {
     char *json = json_dumps(row, JSON_PRESERVE_ORDER);
-    size_t len = strlen(json);
-    GWBUF *buf = gwbuf_alloc(len + 1);
-    int rc = 0;
+    GWBUF *buf = NULL;
 
-    if (json && buf)
+    if (json && (buf = gwbuf_alloc(strlen(json) + 1)))
     {
+        size_t len = strlen(json);
         uint8_t *data = GWBUF_DATA(buf);
         memcpy(data, json, len);
         data[len] = '\n';
-        rc = dcb->func.write(dcb, buf);
     }
     else
     {
         MXS_ERROR("Failed to dump JSON value.");
-        rc = 0;
     }
+
     MXS_FREE(json);
-    return rc;
+    return buf;
 }
 
-static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
+static int send_row(DCB *dcb, json_t* row)
+{
+    GWBUF *buf = row_to_buffer(row);
+    return buf ? dcb->func.write(dcb, buf) : 0;
+}
+
+/**
+ * @brief Check if a value of a row matches the value of a condition
+ *
+ * @param value Value in the row
+ * @param expected Value in the condition
+ * @return True if the values are equal
+ */
+static bool value_matches(json_t *value, const char *expected)
+{
+    char *end;
+
+    if (json_is_string(value))
+    {
+        return strcmp(json_string_value(value), expected) == 0;
+    }
+    else if (json_is_integer(value))
+    {
+        long long ival = strtoll(expected, &end, 10);
+        return *expected && *end == '\0' && ival == json_integer_value(value);
+    }
+    else if (json_is_real(value))
+    {
+        double dval = strtod(expected, &end);
+        return *expected && *end == '\0' && dval == json_real_value(value);
+    }
+    else if (json_is_true(value))
+    {
+        return strcasecmp(expected, "true") == 0 || strcmp(expected, "1") == 0;
+    }
+    else if (json_is_false(value))
+    {
+        return strcasecmp(expected, "false") == 0 || strcmp(expected, "0") == 0;
+    }
+    else if (json_is_null(value))
+    {
+        return strcasecmp(expected, "NULL") == 0;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Apply the filter of a data request to a row
+ *
+ * The GTID and event fields are always sent so that the client can resume
+ * streaming from the rows it has received.
+ *
+ * @param filter Filter of the request
+ * @param row Row to filter
+ * @return The row to send, NULL if the row is filtered out. The caller must
+ * call json_decref() on the returned value.
+ */
+static json_t* filter_row(AVRO_FILTER *filter, json_t *row)
+{
+    if (filter->until_set)
+    {
+        json_t *domain = json_object_get(row, avro_domain);
+        json_t *seq = json_object_get(row, avro_sequence);
+
+        if (domain && seq && (uint64_t)json_integer_value(domain) == filter->until.domain &&
+            (uint64_t)json_integer_value(seq) > filter->until.seq)
+        {
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < filter->n_conditions; i++)
+    {
+        json_t *value = json_object_get(row, filter->columns[i]);
+
+        if (value == NULL || !value_matches(value, filter->values[i]))
+        {
+            return NULL;
+        }
+    }
+
+    if (filter->n_fields == 0)
+    {
+        return json_incref(row);
+    }
+
+    const char *reserved[] = {avro_domain, avro_server_id, avro_sequence, avro_event_number,
+                              avro_event_type, avro_timestamp
+                             };
+    json_t *rval = json_object();
+
+    for (size_t i = 0; rval && i < sizeof(reserved) / sizeof(reserved[0]); i++)
+    {
+        json_t *value = json_object_get(row, reserved[i]);
+
+        if (value)
+        {
+            json_object_set(rval, reserved[i], value);
+        }
+    }
+
+    for (int i = 0; rval && i < filter->n_fields; i++)
+    {
+        json_t *value = json_object_get(row, filter->fields[i]);
+
+        if (value)
+        {
+            json_object_set(rval, filter->fields[i], value);
+        }
+    }
+
+    return rval;
+}
+
+static void set_current_gtid(gtid_pos_t *gtid, json_t *row)
 {
     json_t *obj = json_object_get(row, avro_sequence);
     ss_dassert(json_is_integer(obj));
-    client->gtid.seq = json_integer_value(obj);
+    gtid->seq = json_integer_value(obj);
 
     obj = json_object_get(row, avro_server_id);
     ss_dassert(json_is_integer(obj));
-    client->gtid.server_id = json_integer_value(obj);
+    gtid->server_id = json_integer_value(obj);
 
     obj = json_object_get(row, avro_domain);
     ss_dassert(json_is_integer(obj));
-    client->gtid.domain = json_integer_value(obj);
+    gtid->domain = json_integer_value(obj);
+}
+
+/**
+ * @brief Find the slot of a data block in the block cache
+ *
+ * @param router Router instance
+ * @param sync Sync marker of the file
+ * @param pos Offset of the block in the file
+ * @param format Format of the data
+ * @return The slot where the block is stored
+ */
+static AVRO_BLOCK* block_cache_slot(AVRO_INSTANCE *router, const uint8_t *sync,
+                                    long pos, enum avro_data_format format)
+{
+    uint64_t hash = pos * 31 + format;
+
+    for (int i = 0; i < SYNC_MARKER_SIZE; i++)
+    {
+        hash = hash * 31 + sync[i];
+    }
+
+    return &router->block_cache[hash % AVRO_BLOCK_CACHE_SIZE];
+}
+
+/**
+ * @brief Get the current data block of a file from the block cache
+ *
+ * @param router Router instance
+ * @param file File positioned at the start of a data block
+ * @param format Format of the data
+ * @param gtid If not NULL, the GTID of the last record of the block is stored here
+ * @return A clone of the cached block or NULL if the block is not cached
+ */
+static GWBUF* block_cache_get(AVRO_INSTANCE *router, MAXAVRO_FILE *file,
+                              enum avro_data_format format, gtid_pos_t *gtid)
+{
+    AVRO_BLOCK *block = block_cache_slot(router, file->sync, file->block_start_pos, format);
+    GWBUF *rval = NULL;
+
+    spinlock_acquire(&router->block_cache_lock);
+
+    if (block->data && block->pos == file->block_start_pos && block->format == format &&
+        memcmp(block->sync, file->sync, SYNC_MARKER_SIZE) == 0)
+    {
+        rval = gwbuf_clone(block->data);
+
+        if (rval && gtid)
+        {
+            gtid->seq = block->gtid.seq;
+            gtid->server_id = block->gtid.server_id;
+            gtid->domain = block->gtid.domain;
+        }
+    }
+
+    spinlock_release(&router->block_cache_lock);
+
+    atomic_add_uint64(rval ? &router->stats.block_cache_hits :
+                      &router->stats.block_cache_misses, 1);
+    return rval;
+}
+
+/**
+ * @brief Store a data block in the block cache
+ *
+ * The block replaces any block that was stored in the same slot.
+ *
+ * @param router Router instance
+ * @param sync Sync marker of the file
+ * @param pos Offset of the block in the file
+ * @param format Format of the data
+ * @param data The complete block, shared with the cache
+ * @param gtid The GTID of the last record of the block or NULL
+ */
+static void block_cache_put(AVRO_INSTANCE *router, const uint8_t *sync, long pos,
+                            enum avro_data_format format, GWBUF *data, gtid_pos_t *gtid)
+{
+    GWBUF *clone = gwbuf_clone(data);
+
+    if (clone)
+    {
+        AVRO_BLOCK *block = block_cache_slot(router, sync, pos, format);
+
+        spinlock_acquire(&router->block_cache_lock);
+        GWBUF *old = block->data;
+        memcpy(block->sync, sync, SYNC_MARKER_SIZE);
+        block->pos = pos;
+        block->format = format;
+        block->data = clone;
+
+        if (gtid)
+        {
+            block->gtid = *gtid;
+        }
+
+        spinlock_release(&router->block_cache_lock);
+
+        gwbuf_free(old);
+    }
+}
+
+/**
+ * @brief Read the rest of the current data block in JSON format
+ *
+ * A block that is read from its start is shared with the other clients via
+ * the block cache, so that each block is decoded only once.
+ *
+ * @param router Router instance
+ * @param file File to read from
+ * @param gtid The GTID of the last record that was read is stored here
+ * @return The records of the block or NULL if no records were read
+ */
+static GWBUF* read_json_block(AVRO_INSTANCE *router, MAXAVRO_FILE *file, gtid_pos_t *gtid)
+{
+    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    {
+        return NULL;
+    }
+
+    long pos = file->block_start_pos;
+    bool from_start = file->records_read_from_block == 0;
+    GWBUF *rval = NULL;
+
+    if (from_start && (rval = block_cache_get(router, file, AVRO_FORMAT_JSON, gtid)))
+    {
+        /** The records are skipped when the file moves to the next block */
+        return rval;
+    }
+
+    json_t *row;
+
+    while ((row = maxavro_record_read_json(file)))
+    {
+        rval = gwbuf_append(rval, row_to_buffer(row));
+        set_current_gtid(gtid, row);
+        json_decref(row);
+    }
+
+    if (rval && (rval = gwbuf_make_contiguous(rval)) && from_start &&
+        file->records_read_from_block == file->records_in_block &&
+        maxavro_get_error(file) == MAXAVRO_ERR_NONE)
+    {
+        block_cache_put(router, file->sync, pos, AVRO_FORMAT_JSON, rval, gtid);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Read the rest of the current data block for a filtered request
+ *
+ * The rows differ between clients, so the block cache is not used.
+ *
+ * @param client Client with the filter
+ * @param file File to read from
+ * @return The rows that pass the filter or NULL if no rows were sent
+ */
+static GWBUF* read_filtered_json_block(AVRO_CLIENT *client, MAXAVRO_FILE *file)
+{
+    GWBUF *rval = NULL;
+    json_t *row;
+
+    while ((row = maxavro_record_read_json(file)))
+    {
+        json_t *filtered = filter_row(client->filter, row);
+
+        if (filtered)
+        {
+            rval = gwbuf_append(rval, row_to_buffer(filtered));
+            json_decref(filtered);
+        }
+
+        set_current_gtid(&client->gtid, row);
+        json_decref(row);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Read the current data block in native Avro format
+ *
+ * The blocks are shared with the other clients via the block cache.
+ *
+ * @param router Router instance
+ * @param file File to read from
+ * @return The complete data block or NULL if no block was read
+ */
+static GWBUF* read_binary_block(AVRO_INSTANCE *router, MAXAVRO_FILE *file)
+{
+    if (file->last_error != MAXAVRO_ERR_NONE)
+    {
+        /** Reports the error */
+        return maxavro_record_read_binary(file);
+    }
+
+    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    {
+        return NULL;
+    }
+
+    long pos = file->block_start_pos;
+    GWBUF *rval = block_cache_get(router, file, AVRO_FORMAT_AVRO, NULL);
+
+    if (rval)
+    {
+        /** Skip the block like maxavro_record_read_binary does after reading it */
+        maxavro_next_block(file);
+    }
+    else if ((rval = maxavro_record_read_binary(file)))
+    {
+        block_cache_put(router, file->sync, pos, AVRO_FORMAT_AVRO, rval, NULL);
+    }
+
+    return rval;
 }
 
 /**
  * @brief Stream Avro data in JSON format
  *
+ * The streaming stops when the client write queue goes above the high water mark.
+ *
  * @param file File to stream from
  * @param dcb DCB to stream to
  * @return True if more data is readable, false if all data was sent
@@ -602,32 +1100,36 @@ static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
 static bool stream_json(AVRO_CLIENT *client)
 {
     int bytes = 0;
+    int rc = 1;
+    bool more = false;
     MAXAVRO_FILE *file = client->file_handle;
     DCB *dcb = client->dcb;
 
     do
     {
-        json_t *row;
-        int rc = 1;
-        while (rc > 0 && (row = maxavro_record_read_json(file)))
+        GWBUF *buffer = client->filter ? read_filtered_json_block(client, file) :
+                        read_json_block(client->router, file, &client->gtid);
+
+        if (buffer)
         {
-            rc = send_row(dcb, row);
-            set_current_gtid(client, row);
-            json_decref(row);
+            rc = dcb->func.write(dcb, buffer);
         }
         bytes += file->block_size;
     }
-    while (maxavro_next_block(file) && bytes < AVRO_DATA_BURST_SIZE);
+    while (rc > 0 && (more = maxavro_next_block(file)) &&
+           bytes < AVRO_DATA_BURST_SIZE && !DCB_ABOVE_HIGH_WATER(dcb));
 
-    return bytes >= AVRO_DATA_BURST_SIZE;
+    return rc > 0 && more;
 }
 
 /**
  * @brief Stream Avro data in native Avro format
  *
+ * The streaming stops when the client write queue goes above the high water mark.
+ *
  * @param file File to stream from
  * @param dcb DCB to stream to
- * @return True if streaming was successful, false if an error occurred
+ * @return True if more data is readable, false if all data was sent
  */
 static bool stream_binary(AVRO_CLIENT *client)
 {
@@ -637,10 +1139,10 @@ static bool stream_binary(AVRO_CLIENT *client)
     MAXAVRO_FILE *file = client->file_handle;
     DCB *dcb = client->dcb;
 
-    while (rc > 0 && bytes < AVRO_DATA_BURST_SIZE)
+    while (rc > 0 && bytes < AVRO_DATA_BURST_SIZE && !DCB_ABOVE_HIGH_WATER(dcb))
     {
         bytes += file->block_size;
-        if ((buffer = maxavro_record_read_binary(file)))
+        if ((buffer = read_binary_block(client->router, file)))
         {
             rc = dcb->func.write(dcb, buffer);
         }
@@ -650,7 +1152,7 @@ static bool stream_binary(AVRO_CLIENT *client)
         }
     }
 
-    return bytes >= AVRO_DATA_BURST_SIZE;
+    return rc > 0;
 }
 
 static int sqlite_cb(void* data, int rows, char** values, char** names)
@@ -700,6 +1202,69 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
     return rval;
 }
 
+static const char file_select_template[] = "SELECT avrofile FROM "GTID_TABLE_NAME
+                                           " WHERE domain=? AND server_id=? AND sequence < ?"
+                                           " AND avrofile > ? AND substr(avrofile, 1, ?) = ?"
+                                           " ORDER BY sequence DESC, avrofile DESC LIMIT 1;";
+
+/**
+ * @brief Skip the files that precede the requested GTID
+ *
+ * The file with the last indexed GTID before the requested one is looked up
+ * from the GTID index. The streaming starts from that file instead of reading
+ * through all the older files of the table.
+ *
+ * @param router Avro router instance
+ * @param client Client that requested a GTID
+ */
+static void seek_to_gtid_file(AVRO_INSTANCE *router, AVRO_CLIENT *client)
+{
+    /** The files of a table only differ by the version, db.table.000001.avro */
+    char *version = strrchr(client->avro_binfile, '.');
+
+    while (version && version > client->avro_binfile && *(version - 1) != '.')
+    {
+        version--;
+    }
+
+    if (version == NULL || version == client->avro_binfile)
+    {
+        return;
+    }
+
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(client->sqlite_handle, file_select_template, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to prepare GTID file query: %s",
+                  sqlite3_errmsg(client->sqlite_handle));
+        return;
+    }
+
+    int prefix_len = version - client->avro_binfile;
+    sqlite3_bind_int64(stmt, 1, client->gtid.domain);
+    sqlite3_bind_int64(stmt, 2, client->gtid.server_id);
+    sqlite3_bind_int64(stmt, 3, client->gtid.seq);
+    sqlite3_bind_text(stmt, 4, client->avro_binfile, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 5, prefix_len);
+    sqlite3_bind_text(stmt, 6, client->avro_binfile, prefix_len, SQLITE_TRANSIENT);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *file = (const char*)sqlite3_column_text(stmt, 0);
+
+        if (file && strlen(file) <= AVRO_MAX_FILENAME_LEN && file_in_dir(router->avrodir, file))
+        {
+            MXS_INFO("Starting GTID %lu-%lu-%lu for %s@%s from file %s",
+                     client->gtid.domain, client->gtid.server_id, client->gtid.seq,
+                     client->dcb->user, client->dcb->remote, file);
+            strcpy(client->avro_binfile, file);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+}
+
 /**
  *
  * @param client
@@ -745,7 +1310,13 @@ static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
              * read the row into memory */
             if (!seeking)
             {
-                send_row(client->dcb, row);
+                json_t *filtered = client->filter ? filter_row(client->filter, row) : json_incref(row);
+
+                if (filtered)
+                {
+                    send_row(client->dcb, filtered);
+                    json_decref(filtered);
+                }
             }
 
             json_decref(row);
@@ -973,7 +1544,7 @@ static void print_next_filename(const char *file, const char *dir, char *dest, s
  */
 int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
 {
-    if (reason == DCB_REASON_DRAINED)
+    if (reason == DCB_REASON_DRAINED || reason == DCB_REASON_LOW_WATER)
     {
         AVRO_CLIENT *client = (AVRO_CLIENT*)userdata;
 
@@ -1015,22 +1586,32 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
         /** Stream the data to the client */
         bool read_more = avro_client_stream_data(client);
 
-        char filename[PATH_MAX + 1];
-        print_next_filename(client->avro_binfile, client->router->avrodir,
-                            filename, sizeof(filename));
+        bool next_file = false;
 
-        bool next_file;
-        /** If the next file is available, send it to the client */
-        if ((next_file = (access(filename, R_OK) == 0)))
+        if (!read_more)
         {
-            rotate_avro_file(client, filename);
+            char filename[PATH_MAX + 1];
+            print_next_filename(client->avro_binfile, client->router->avrodir,
+                                filename, sizeof(filename));
+
+            /** If the next file is available, send it to the client */
+            if ((next_file = (access(filename, R_OK) == 0)))
+            {
+                rotate_avro_file(client, filename);
+            }
         }
 
         spinlock_acquire(&client->catch_lock);
         client->cstate &= ~AVRO_CS_BUSY;
         client->cstate |= AVRO_WAIT_DATA;
 
-        if (next_file || read_more)
+        if (DCB_ABOVE_HIGH_WATER(client->dcb))
+        {
+            /** The low water callback continues the streaming once the
+             * client has read enough of the queued data */
+            client->cstate &= ~AVRO_WAIT_DATA;
+        }
+        else if (next_file || read_more)
         {
 #ifdef SS_DEBUG
             if (read_more)
@@ -35,14 +35,19 @@
 #include <binlog_common.h>
 #include <blr_constants.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/pcre2.h>
 #include <ini.h>
 #include <stdlib.h>
 #include <glob.h>
+#include <zlib.h>
 #include <maxscale/alloc.h>
+#include <maxscale/tablechange.h>
 
 static const char *statefile_section = "avro-conversion";
+static const uint8_t table_cache_magic[] = {'M', 'X', 'S', 'T', 'C', 'A', 'C', 'H'};
+static const uint32_t table_cache_format = 1;
 static const char *ddl_list_name = "table-ddl.list";
 void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr,
                         int *pending_transaction, uint8_t *ptr);
@@ -99,6 +104,92 @@ void avro_close_binlog(int fd)
     close(fd);
 }
 
+/**
+ * Map the open binlog file into memory
+ *
+ * Only a binlog file that is followed by the next file is mapped, as such a
+ * file is complete and no longer grows. The events of a mapped file are
+ * processed directly from the mapping instead of being read into buffers.
+ * The mapping is private, so the file is unaffected if the events are
+ * modified while they are processed.
+ *
+ * @param router The router instance
+ */
+void avro_map_binlog(AVRO_INSTANCE *router)
+{
+    struct stat st;
+
+    router->binlog_map = NULL;
+    router->binlog_map_len = 0;
+
+    if (router->mmap_binlog &&
+        binlog_next_file_exists(router->binlogdir, router->binlog_name) &&
+        fstat(router->binlog_fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         router->binlog_fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            router->binlog_map = (uint8_t*)map;
+            router->binlog_map_len = st.st_size;
+        }
+        else
+        {
+            char err[MXS_STRERROR_BUFLEN];
+            MXS_WARNING("Failed to map binlog file %s into memory, reading it "
+                        "instead: %d, %s", router->binlog_name, errno,
+                        strerror_r(errno, err, sizeof(err)));
+        }
+    }
+}
+
+/**
+ * Unmap the binlog file mapped with avro_map_binlog
+ *
+ * @param router The router instance
+ */
+void avro_unmap_binlog(AVRO_INSTANCE *router)
+{
+    if (router->binlog_map)
+    {
+        munmap(router->binlog_map, router->binlog_map_len);
+        router->binlog_map = NULL;
+        router->binlog_map_len = 0;
+    }
+}
+
+/**
+ * Read from the binlog file, from its mapping if it is mapped
+ *
+ * @param router The router instance
+ * @param dest   Where to read the data
+ * @param len    The number of bytes to read
+ * @param pos    The position in the file
+ * @return The number of bytes read or -1 on error, like pread
+ */
+static ssize_t avro_binlog_pread(AVRO_INSTANCE *router, void *dest, size_t len, uint64_t pos)
+{
+    if (router->binlog_map)
+    {
+        if (pos >= router->binlog_map_len)
+        {
+            return 0;
+        }
+
+        if (len > router->binlog_map_len - pos)
+        {
+            len = router->binlog_map_len - pos;
+        }
+
+        memcpy(dest, router->binlog_map + pos, len);
+        return len;
+    }
+
+    return pread(router->binlog_fd, dest, len, pos);
+}
+
 /**
  * @brief Allocate an Avro table
  *
@@ -150,10 +241,363 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size
 
         table->json_schema = MXS_STRDUP_A(json_schema);
         table->filename = MXS_STRDUP_A(filepath);
+        table->opened = time(NULL);
     }
     return table;
 }
 
+static bool cache_write(FILE *file, uLong *crc, const void *data, size_t size)
+{
+    *crc = crc32(*crc, (const Bytef*)data, size);
+    return fwrite(data, 1, size, file) == size;
+}
+
+static bool cache_write_str(FILE *file, uLong *crc, const char *str)
+{
+    uint32_t len = strlen(str);
+    return cache_write(file, crc, &len, sizeof(len)) && cache_write(file, crc, str, len);
+}
+
+static bool cache_write_table(FILE *file, uLong *crc, TABLE_CREATE *create)
+{
+    int32_t version = create->version;
+    uint8_t was_used = create->was_used;
+    uint32_t columns = create->columns;
+    bool rval = cache_write_str(file, crc, create->database) &&
+                cache_write_str(file, crc, create->table) &&
+                cache_write(file, crc, &version, sizeof(version)) &&
+                cache_write(file, crc, &was_used, sizeof(was_used)) &&
+                cache_write(file, crc, &columns, sizeof(columns));
+
+    for (uint32_t i = 0; rval && i < columns; i++)
+    {
+        int32_t length = create->column_lengths[i];
+        rval = cache_write_str(file, crc, create->column_names[i]) &&
+               cache_write_str(file, crc, create->column_types[i]) &&
+               cache_write(file, crc, &length, sizeof(length));
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Write the table definitions into the table cache
+ *
+ * The cache holds the current definition of every known table and the
+ * conversion position it belongs to. Loading it at startup replaces the
+ * reading of the stored Avro schemas. The values are stored in the native
+ * byte order, followed by a CRC32 of the whole file.
+ *
+ * @param router Avro router instance
+ * @return True if the cache was written successfully to disk
+ */
+static bool avro_save_table_cache(AVRO_INSTANCE *router)
+{
+    char filename[PATH_MAX + 1];
+    char err_msg[MXS_STRERROR_BUFLEN];
+
+    snprintf(filename, sizeof(filename), "%s/"AVRO_TABLE_CACHE_FILE".tmp", router->avrodir);
+
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL)
+    {
+        MXS_ERROR("Failed to open file '%s': %d, %s", filename,
+                  errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    uLong crc = crc32(0, NULL, 0);
+    uint64_t pos = router->current_pos;
+    uint32_t n_tables = hashtable_size(router->created_tables);
+    bool rval = cache_write(file, &crc, table_cache_magic, sizeof(table_cache_magic)) &&
+                cache_write(file, &crc, &table_cache_format, sizeof(table_cache_format)) &&
+                cache_write_str(file, &crc, router->binlog_name) &&
+                cache_write(file, &crc, &pos, sizeof(pos)) &&
+                cache_write(file, &crc, &n_tables, sizeof(n_tables));
+
+    HASHITERATOR *iter = hashtable_iterator(router->created_tables);
+    uint32_t n_written = 0;
+
+    if (iter)
+    {
+        char *key;
+
+        while (rval && (key = hashtable_next(iter)))
+        {
+            TABLE_CREATE *create = hashtable_fetch(router->created_tables, key);
+
+            if (create)
+            {
+                rval = cache_write_table(file, &crc, create);
+                n_written++;
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+    else
+    {
+        rval = false;
+    }
+
+    uint32_t checksum = crc;
+
+    if (rval && (n_written != n_tables || fwrite(&checksum, 1, sizeof(checksum), file) != sizeof(checksum)))
+    {
+        rval = false;
+    }
+
+    if (fclose(file) != 0)
+    {
+        rval = false;
+    }
+
+    char newname[PATH_MAX + 1];
+    snprintf(newname, sizeof(newname), "%s/"AVRO_TABLE_CACHE_FILE, router->avrodir);
+
+    if (!rval)
+    {
+        MXS_ERROR("Failed to write the table cache '%s'.", filename);
+        unlink(filename);
+    }
+    else if (rename(filename, newname) == -1)
+    {
+        MXS_ERROR("Failed to rename file '%s' to '%s': %d, %s", filename, newname,
+                  errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        unlink(filename);
+        rval = false;
+    }
+
+    return rval;
+}
+
+static bool cache_read(const uint8_t **ptr, const uint8_t *end, void *dest, size_t size)
+{
+    if ((size_t)(end - *ptr) < size)
+    {
+        return false;
+    }
+
+    memcpy(dest, *ptr, size);
+    *ptr += size;
+    return true;
+}
+
+static char* cache_read_str(const uint8_t **ptr, const uint8_t *end)
+{
+    uint32_t len;
+    char *rval = NULL;
+
+    if (cache_read(ptr, end, &len, sizeof(len)) && (size_t)(end - *ptr) >= len &&
+        (rval = MXS_MALLOC(len + 1)))
+    {
+        memcpy(rval, *ptr, len);
+        rval[len] = '\0';
+        *ptr += len;
+    }
+
+    return rval;
+}
+
+static TABLE_CREATE* cache_read_table(const uint8_t **ptr, const uint8_t *end)
+{
+    TABLE_CREATE *create = MXS_CALLOC(1, sizeof(TABLE_CREATE));
+    int32_t version;
+    uint8_t was_used;
+    uint32_t columns;
+
+    if (create == NULL ||
+        (create->database = cache_read_str(ptr, end)) == NULL ||
+        (create->table = cache_read_str(ptr, end)) == NULL ||
+        !cache_read(ptr, end, &version, sizeof(version)) ||
+        !cache_read(ptr, end, &was_used, sizeof(was_used)) ||
+        !cache_read(ptr, end, &columns, sizeof(columns)) ||
+        columns == 0 || columns > (size_t)(end - *ptr))
+    {
+        table_create_free(create);
+        return NULL;
+    }
+
+    create->version = version;
+    create->was_used = was_used;
+
+    if ((create->column_names = MXS_CALLOC(columns, sizeof(char*))) == NULL ||
+        (create->column_types = MXS_CALLOC(columns, sizeof(char*))) == NULL ||
+        (create->column_lengths = MXS_CALLOC(columns, sizeof(int))) == NULL)
+    {
+        table_create_free(create);
+        return NULL;
+    }
+
+    create->columns = columns;
+
+    for (uint32_t i = 0; i < columns; i++)
+    {
+        int32_t length;
+
+        if ((create->column_names[i] = cache_read_str(ptr, end)) == NULL ||
+            (create->column_types[i] = cache_read_str(ptr, end)) == NULL ||
+            !cache_read(ptr, end, &length, sizeof(length)))
+        {
+            table_create_free(create);
+            return NULL;
+        }
+
+        create->column_lengths[i] = length;
+    }
+
+    return create;
+}
+
+/**
+ * @brief Parse the contents of the table cache
+ *
+ * @param router Avro router instance
+ * @param data The cache without the checksum
+ * @param size Size of @p data
+ * @param tables Array where the tables are stored, must be freed by the caller
+ * @param n_tables Number of tables in @p tables
+ * @return True if the cache matches the stored conversion position
+ */
+static bool cache_parse(AVRO_INSTANCE *router, const uint8_t *data, size_t size,
+                        TABLE_CREATE ***tables, uint32_t *n_tables)
+{
+    const uint8_t *ptr = data;
+    const uint8_t *end = data + size;
+    uint8_t magic[sizeof(table_cache_magic)];
+    uint32_t format;
+    uint64_t pos;
+
+    if (!cache_read(&ptr, end, magic, sizeof(magic)) ||
+        memcmp(magic, table_cache_magic, sizeof(magic)) != 0 ||
+        !cache_read(&ptr, end, &format, sizeof(format)) || format != table_cache_format)
+    {
+        MXS_WARNING("Table cache was created by a different version of MaxScale.");
+        return false;
+    }
+
+    char *binlog = cache_read_str(&ptr, end);
+    bool rval = binlog && cache_read(&ptr, end, &pos, sizeof(pos)) &&
+                cache_read(&ptr, end, n_tables, sizeof(*n_tables));
+
+    if (rval && (strcmp(binlog, router->binlog_name) != 0 || pos != router->current_pos))
+    {
+        MXS_NOTICE("Table cache is for position %s:%lu but the conversion continues "
+                   "from %s:%lu, ignoring it.", binlog, pos,
+                   router->binlog_name, router->current_pos);
+        rval = false;
+    }
+
+    MXS_FREE(binlog);
+
+    if (rval && *n_tables > 0)
+    {
+        rval = *n_tables <= (size_t)(end - ptr) &&
+               (*tables = MXS_CALLOC(*n_tables, sizeof(TABLE_CREATE*)));
+
+        for (uint32_t i = 0; rval && i < *n_tables; i++)
+        {
+            rval = ((*tables)[i] = cache_read_table(&ptr, end)) != NULL;
+        }
+    }
+
+    return rval && ptr == end;
+}
+
+/**
+ * @brief Load the table definitions from the table cache
+ *
+ * The cache is used only if it was written at the same position the
+ * conversion continues from.
+ *
+ * @param router Avro router instance
+ * @return True if the table definitions were loaded from the cache
+ */
+bool avro_load_table_cache(AVRO_INSTANCE *router)
+{
+    char filename[PATH_MAX + 1];
+    char err_msg[MXS_STRERROR_BUFLEN];
+    snprintf(filename, sizeof(filename), "%s/"AVRO_TABLE_CACHE_FILE, router->avrodir);
+
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+        {
+            MXS_ERROR("Failed to open file '%s': %d, %s", filename,
+                      errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+        return false;
+    }
+
+    struct stat st;
+    uint8_t *data = NULL;
+    bool rval = false;
+
+    if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(uint32_t) &&
+        (data = MXS_MALLOC(st.st_size)))
+    {
+        if (read(fd, data, st.st_size) == st.st_size)
+        {
+            size_t size = st.st_size - sizeof(uint32_t);
+            uint32_t checksum;
+            memcpy(&checksum, data + size, sizeof(checksum));
+
+            if (crc32(crc32(0, NULL, 0), data, size) == checksum)
+            {
+                TABLE_CREATE **tables = NULL;
+                uint32_t n_tables = 0;
+                rval = cache_parse(router, data, size, &tables, &n_tables);
+
+                for (uint32_t i = 0; tables && i < n_tables; i++)
+                {
+                    if (rval)
+                    {
+                        char table_ident[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 2];
+                        snprintf(table_ident, sizeof(table_ident), "%s.%s",
+                                 tables[i]->database, tables[i]->table);
+                        hashtable_add(router->created_tables, table_ident, tables[i]);
+                    }
+                    else
+                    {
+                        table_create_free(tables[i]);
+                    }
+                }
+
+                MXS_FREE(tables);
+
+                if (rval)
+                {
+                    MXS_NOTICE("[%s] Loaded %u table definitions from the table cache.",
+                               router->service->name, n_tables);
+                }
+            }
+            else
+            {
+                MXS_WARNING("Checksum mismatch in table cache '%s', ignoring it.", filename);
+            }
+        }
+        else
+        {
+            MXS_ERROR("Failed to read file '%s': %d, %s", filename,
+                      errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+    }
+
+    MXS_FREE(data);
+    close(fd);
+
+    if (!rval)
+    {
+        MXS_NOTICE("[%s] Reading the table definitions from the Avro schemas.",
+                   router->service->name);
+    }
+
+    return rval;
+}
+
 /**
  * @brief Write a new ini file with current conversion status
  *
@@ -168,6 +612,10 @@ bool avro_save_conversion_state(AVRO_INSTANCE *router)
     char filename[PATH_MAX + 1];
     char err_msg[MXS_STRERROR_BUFLEN];
 
+    /** The cache stores the same position as the state file so a cache
+     * that was not followed by a state file is ignored when loading */
+    avro_save_table_cache(router);
+
     snprintf(filename, sizeof(filename), "%s/"AVRO_PROGRESS_FILE".tmp", router->avrodir);
 
     /* open file for writing */
@@ -416,8 +864,8 @@ static GWBUF* read_event_data(AVRO_INSTANCE *router, REP_HEADER* hdr, uint64_t p
     if ((result = gwbuf_alloc(hdr->event_size - BINLOG_EVENT_HDR_LEN + 1)))
     {
         uint8_t *data = GWBUF_DATA(result);
-        int n = pread(router->binlog_fd, data, hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                      pos + BINLOG_EVENT_HDR_LEN);
+        int n = avro_binlog_pread(router, data, hdr->event_size - BINLOG_EVENT_HDR_LEN,
+                                  pos + BINLOG_EVENT_HDR_LEN);
         /** NULL-terminate for QUERY_EVENT processing */
         data[hdr->event_size - BINLOG_EVENT_HDR_LEN] = '\0';
 
@@ -522,7 +970,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
     {
         int n;
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((n = avro_binlog_pread(router, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -615,9 +1063,19 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             return AVRO_BINLOG_ERROR;
         }
 
-        GWBUF *result = read_event_data(router, &hdr, pos);
+        GWBUF *result = NULL;
 
-        if (result == NULL)
+        if (router->binlog_map && hdr.event_type != QUERY_EVENT &&
+            pos + hdr.event_size <= router->binlog_map_len)
+        {
+            /** Only a QUERY_EVENT needs to be copied for the NULL-termination */
+            ptr = router->binlog_map + pos + BINLOG_EVENT_HDR_LEN;
+        }
+        else if ((result = read_event_data(router, &hdr, pos)))
+        {
+            ptr = GWBUF_DATA(result);
+        }
+        else
         {
             router->binlog_position = last_known_commit;
             router->current_pos = pos;
@@ -633,9 +1091,6 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             last_known_commit = pos;
         }
 
-        /* get event content */
-        ptr = GWBUF_DATA(result);
-
         MXS_DEBUG("%s(%x) - %llu", binlog_event_name(hdr.event_type), hdr.event_type, pos);
 
         uint32_t original_size = hdr.event_size;
@@ -732,12 +1187,14 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             {
                 /** A non-transactional engine finished a transaction */
                 router->trx_count++;
+                avro_publish_modified_tables(router);
             }
         }
         else if (hdr.event_type == XID_EVENT)
         {
             router->trx_count++;
             pending_transaction = 0;
+            avro_publish_modified_tables(router);
 
             if (router->row_count >= router->row_target ||
                 router->trx_count >= router->trx_target)
@@ -780,6 +1237,71 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
     return AVRO_BINLOG_ERROR;
 }
 
+/**
+ * Record a table as modified by the current transaction
+ *
+ * The tables are collected only if someone has subscribed to the table
+ * modifications. Committed transactions are usually small, so a linear
+ * search is enough to keep the tables unique.
+ *
+ * @param router Router instance
+ * @param ident  Fully qualified table name
+ */
+void avro_add_modified_table(AVRO_INSTANCE *router, const char *ident)
+{
+    if (tablechange_has_subscribers())
+    {
+        for (int i = 0; i < router->n_modified_tables; i++)
+        {
+            if (strcmp(router->modified_tables[i], ident) == 0)
+            {
+                return;
+            }
+        }
+
+        if (router->n_modified_tables == router->modified_tables_size)
+        {
+            int size = router->modified_tables_size ? 2 * router->modified_tables_size : 8;
+            char **tables = MXS_REALLOC(router->modified_tables, size * sizeof(char*));
+
+            if (tables == NULL)
+            {
+                return;
+            }
+
+            router->modified_tables = tables;
+            router->modified_tables_size = size;
+        }
+
+        char *table = MXS_STRDUP(ident);
+
+        if (table)
+        {
+            router->modified_tables[router->n_modified_tables++] = table;
+        }
+    }
+}
+
+/**
+ * Publish the tables modified by a committed transaction
+ *
+ * @param router Router instance
+ */
+void avro_publish_modified_tables(AVRO_INSTANCE *router)
+{
+    if (router->n_modified_tables)
+    {
+        tablechange_publish((const char* const*)router->modified_tables, router->n_modified_tables);
+
+        for (int i = 0; i < router->n_modified_tables; i++)
+        {
+            MXS_FREE(router->modified_tables[i]);
+        }
+
+        router->n_modified_tables = 0;
+    }
+}
+
 /**
  * Read the field names from the stored Avro schemas
  *
@@ -853,6 +1375,9 @@ void avro_load_metadata_from_schemas(AVRO_INSTANCE *router)
  */
 void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op flush)
 {
+    /** All queued rows are flushed */
+    avro_workers_wait(router);
+
     HASHITERATOR *iter = hashtable_iterator(router->open_tables);
 
     if (iter)
@@ -1020,6 +1545,9 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
     {
         TABLE_CREATE *created = NULL;
 
+        /** The replaced table definitions and maps may still be in use */
+        avro_workers_wait(router);
+
         if (is_create_like_statement(sql, len))
         {
             created = table_create_copy(router, sql, len, db);
@@ -1063,12 +1591,18 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
 
         if (created)
         {
+            /** The table definition may still be in use */
+            avro_workers_wait(router);
             table_create_alter(created, sql, sql + len);
         }
         else
         {
             MXS_ERROR("Alter statement to a table with no create statement.");
         }
+
+        /** DDL statements are committed implicitly */
+        avro_add_modified_table(router, full_ident);
+        avro_publish_modified_tables(router);
     }
     /* A transaction starts with this event */
     else if (strncmp(sql, "BEGIN", 5) == 0)
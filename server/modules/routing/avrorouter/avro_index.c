@@ -40,21 +40,13 @@
 void* safe_key_free(void *data);
 
 static const char insert_template[] = "INSERT INTO gtid(domain, server_id, "
-                                      "sequence, avrofile, position) values (%lu, %lu, %lu, \"%s\", %ld);";
+                                      "sequence, avrofile, position) values (?, ?, ?, ?, ?);";
 
-static void set_gtid(gtid_pos_t *gtid, json_t *row)
+static void set_gtid(gtid_pos_t *gtid, MAXAVRO_VALUE *values)
 {
-    json_t *obj = json_object_get(row, avro_sequence);
-    ss_dassert(json_is_integer(obj));
-    gtid->seq = json_integer_value(obj);
-
-    obj = json_object_get(row, avro_server_id);
-    ss_dassert(json_is_integer(obj));
-    gtid->server_id = json_integer_value(obj);
-
-    obj = json_object_get(row, avro_domain);
-    ss_dassert(json_is_integer(obj));
-    gtid->domain = json_integer_value(obj);
+    gtid->domain = values[0].value.integer;
+    gtid->server_id = values[1].value.integer;
+    gtid->seq = values[2].value.integer;
 }
 
 int index_query_cb(void *data, int rows, char** values, char** names)
@@ -72,9 +64,13 @@ int index_query_cb(void *data, int rows, char** values, char** names)
 
 void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 {
+    /** Only the GTID is decoded from the records */
+    const char *gtid_fields[] = {avro_domain, avro_server_id, avro_sequence};
     MAXAVRO_FILE *file = maxavro_file_open(filename);
+    MAXAVRO_READER *reader = NULL;
 
-    if (file)
+    if (file && (reader = maxavro_reader_alloc(file->schema, gtid_fields,
+                                               sizeof(gtid_fields) / sizeof(gtid_fields[0]))))
     {
         char *name = strrchr(filename, '/');
         ss_dassert(name);
@@ -94,6 +90,7 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
                 MXS_ERROR("Failed to read last indexed position of file '%s': %s",
                           name, errmsg);
                 sqlite3_free(errmsg);
+                maxavro_reader_free(reader);
                 maxavro_file_close(file);
                 return;
             }
@@ -101,11 +98,23 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             /** Continue from last position */
             if (pos > 0 && !maxavro_record_set_pos(file, pos))
             {
+                maxavro_reader_free(reader);
                 maxavro_file_close(file);
                 return;
             }
 
             gtid_pos_t prev_gtid = {0, 0, 0, 0, 0};
+            sqlite3_stmt *stmt;
+
+            /** The statement is only parsed once and the values are bound for each GTID */
+            if (sqlite3_prepare_v2(router->sqlite_handle, insert_template, -1, &stmt, NULL) != SQLITE_OK)
+            {
+                MXS_ERROR("Failed to prepare GTID index statement: %s",
+                          sqlite3_errmsg(router->sqlite_handle));
+                maxavro_reader_free(reader);
+                maxavro_file_close(file);
+                return;
+            }
 
             if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
             {
@@ -115,32 +124,34 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 
             do
             {
-                json_t *row = maxavro_record_read_json(file);
+                MAXAVRO_VALUE *values = maxavro_record_read_values(file, reader);
 
-                if (row)
+                if (values)
                 {
                     gtid_pos_t gtid;
-                    set_gtid(&gtid, row);
+                    set_gtid(&gtid, values);
 
                     if (prev_gtid.domain != gtid.domain ||
                         prev_gtid.server_id != gtid.server_id ||
                         prev_gtid.seq != gtid.seq)
                     {
-                        snprintf(sql, sizeof(sql), insert_template, gtid.domain,
-                                 gtid.server_id, gtid.seq, name, file->block_start_pos);
-                        if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                                         &errmsg) != SQLITE_OK)
+                        sqlite3_bind_int64(stmt, 1, gtid.domain);
+                        sqlite3_bind_int64(stmt, 2, gtid.server_id);
+                        sqlite3_bind_int64(stmt, 3, gtid.seq);
+                        sqlite3_bind_text(stmt, 4, name, -1, SQLITE_STATIC);
+                        sqlite3_bind_int64(stmt, 5, file->block_start_pos);
+
+                        if (sqlite3_step(stmt) != SQLITE_DONE)
                         {
                             MXS_ERROR("Failed to insert GTID %lu-%lu-%lu for %s "
                                       "into index database: %s", gtid.domain,
-                                      gtid.server_id, gtid.seq, name, errmsg);
-
+                                      gtid.server_id, gtid.seq, name,
+                                      sqlite3_errmsg(router->sqlite_handle));
                         }
-                        sqlite3_free(errmsg);
-                        errmsg = NULL;
+
+                        sqlite3_reset(stmt);
                         prev_gtid = gtid;
                     }
-                    json_decref(row);
                 }
                 else
                 {
@@ -149,14 +160,13 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             }
             while (maxavro_next_block(file));
 
-            if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to commit transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
+            sqlite3_finalize(stmt);
 
-            snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO "INDEX_TABLE_NAME
-                     " values (%lu, \"%s\");", file->block_start_pos, name);
+            /** The progress is stored in the same transaction as the GTIDs so
+             * that a file is never indexed twice from the same position */
+            snprintf(sql, sizeof(sql), "DELETE FROM "INDEX_TABLE_NAME" WHERE filename=\"%s\";"
+                     "INSERT INTO "INDEX_TABLE_NAME" values (%lu, \"%s\");",
+                     name, file->block_start_pos, name);
             if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
                              &errmsg) != SQLITE_OK)
             {
@@ -164,17 +174,25 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             }
             sqlite3_free(errmsg);
             errmsg = NULL;
+
+            if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
+            {
+                MXS_ERROR("Failed to commit transaction: %s", errmsg);
+            }
+            sqlite3_free(errmsg);
         }
         else
         {
             MXS_ERROR("Malformed filename: %s", filename);
         }
 
+        maxavro_reader_free(reader);
         maxavro_file_close(file);
     }
     else
     {
         MXS_ERROR("Failed to open file '%s' when generating file index.", filename);
+        maxavro_file_close(file);
     }
 }
 
@@ -17,6 +17,7 @@
 #include <jansson.h>
 #include <maxscale/alloc.h>
 #include <strings.h>
+#include <sys/stat.h>
 
 #define WRITE_EVENT         0
 #define UPDATE_EVENT        1
@@ -65,6 +66,38 @@ static int get_event_type(uint8_t event)
     }
 }
 
+/**
+ * @brief Check whether the Avro file of a table should be rotated
+ *
+ * @param router Avro router instance
+ * @param table_ident The table
+ * @return True if the file is larger than max_file_size or older than max_file_time
+ */
+static bool avro_table_rotation_due(AVRO_INSTANCE *router, char *table_ident)
+{
+    bool rval = false;
+    AVRO_TABLE *table;
+
+    if ((router->max_file_size || router->max_file_time) &&
+        (table = hashtable_fetch(router->open_tables, table_ident)))
+    {
+        struct stat st;
+
+        if (router->max_file_time &&
+            time(NULL) - table->opened >= (time_t)router->max_file_time)
+        {
+            rval = true;
+        }
+        else if (router->max_file_size && stat(table->filename, &st) == 0 &&
+                 (uint64_t)st.st_size >= router->max_file_size)
+        {
+            rval = true;
+        }
+    }
+
+    return rval;
+}
+
 /**
  * @brief Handle a table map event
  *
@@ -87,6 +120,16 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
     if (create)
     {
         ss_dassert(create->columns > 0);
+
+        if (create->was_used && create->version < TABLE_MAP_VERSION_MAX &&
+            avro_table_rotation_due(router, table_ident))
+        {
+            /** A new version with the same columns starts a new file */
+            MXS_INFO("Starting a new Avro file for table '%s'", table_ident);
+            create->version++;
+            create->was_used = false;
+        }
+
         TABLE_MAP *old = hashtable_fetch(router->table_maps, table_ident);
 
         if (old == NULL || old->version != create->version)
@@ -103,6 +146,10 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                     snprintf(filepath, sizeof(filepath), "%s/%s.%06d.avro",
                              router->avrodir, table_ident, map->version);
 
+                    /** The old table and map must no longer be in use when
+                     * they are freed */
+                    avro_workers_wait(router);
+
                     /** Close the file and open a new one */
                     hashtable_delete(router->open_tables, table_ident);
                     AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema, router->block_size);
@@ -111,6 +158,12 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                     {
                         bool notify = old != NULL;
 
+                        if (router->n_workers > 0)
+                        {
+                            avro_table->worker = router->next_worker;
+                            router->next_worker = (router->next_worker + 1) % router->n_workers;
+                        }
+
                         if (old)
                         {
                             router->active_maps[old->id % MAX_MAPPED_TABLES] = NULL;
@@ -180,22 +233,22 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
  * @param event_type Event type
  * @param record Record to prepare
  */
-static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
+static void prepare_record(gtid_pos_t *gtid, REP_HEADER *hdr,
                            int event_type, avro_value_t *record)
 {
     avro_value_t field;
     avro_value_get_by_name(record, avro_domain, &field, NULL);
-    avro_value_set_int(&field, router->gtid.domain);
+    avro_value_set_int(&field, gtid->domain);
 
     avro_value_get_by_name(record, avro_server_id, &field, NULL);
-    avro_value_set_int(&field, router->gtid.server_id);
+    avro_value_set_int(&field, gtid->server_id);
 
     avro_value_get_by_name(record, avro_sequence, &field, NULL);
-    avro_value_set_int(&field, router->gtid.seq);
+    avro_value_set_int(&field, gtid->seq);
 
-    router->gtid.event_num++;
+    gtid->event_num++;
     avro_value_get_by_name(record, avro_event_number, &field, NULL);
-    avro_value_set_int(&field, router->gtid.event_num);
+    avro_value_set_int(&field, gtid->event_num);
 
     avro_value_get_by_name(record, avro_timestamp, &field, NULL);
     avro_value_set_int(&field, hdr->timestamp);
@@ -204,6 +257,108 @@ static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
     avro_value_set_enum(&field, event_type);
 }
 
+/**
+ * @brief Count the Avro records of a row event
+ *
+ * The rows are only parsed, not converted. An UPDATE row has two records, the
+ * before and the after image.
+ *
+ * @param map Table map of the rows
+ * @param create Table definition
+ * @param hdr Replication header
+ * @param start Start of the event payload
+ * @param ptr Start of the first row
+ * @param col_present The bitfield of the columns present in the event
+ * @return The number of records
+ */
+static uint64_t count_records(TABLE_MAP *map, TABLE_CREATE *create, REP_HEADER *hdr,
+                              uint8_t *start, uint8_t *ptr, uint8_t *col_present)
+{
+    uint64_t records = 0;
+    uint8_t *end = ptr + hdr->event_size - BINLOG_EVENT_HDR_LEN;
+    int event_type = get_event_type(hdr->event_type);
+
+    while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+    {
+        ptr = process_row_event_data(map, create, NULL, ptr, col_present, end);
+        records++;
+
+        if (event_type == UPDATE_EVENT)
+        {
+            ptr = process_row_event_data(map, create, NULL, ptr, col_present, end);
+            records++;
+        }
+    }
+
+    return records;
+}
+
+/**
+ * @brief Convert the rows of a row event into Avro records
+ *
+ * The subsequence number in the GTID of the job is incremented for each record.
+ *
+ * @param job The row event
+ * @param start Start of the event payload
+ * @param col_present The bitfield of the columns present in the event
+ * @param ptr Start of the first row
+ */
+static void write_rows(AVRO_ROW_JOB *job, uint8_t *start, uint8_t *col_present, uint8_t *ptr)
+{
+    AVRO_TABLE *table = job->table;
+    REP_HEADER *hdr = &job->hdr;
+    avro_value_t record;
+    avro_generic_value_new(table->avro_writer_iface, &record);
+
+    /** Each event has one or more rows in it. The number of rows is not known
+     * beforehand so we must continue processing them until we reach the end
+     * of the event. */
+    while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+    {
+        static uint64_t total_row_count = 1;
+        MXS_INFO("Row %lu", total_row_count++);
+
+        /** Add the current GTID and timestamp */
+        uint8_t *end = ptr + hdr->event_size - BINLOG_EVENT_HDR_LEN;
+        int event_type = get_event_type(hdr->event_type);
+        prepare_record(&job->gtid, hdr, event_type, &record);
+        ptr = process_row_event_data(job->map, job->create, &record, ptr, col_present, end);
+        if (avro_file_writer_append_value(table->avro_file, &record))
+        {
+            MXS_ERROR("Failed to write value at position %ld: %s",
+                      job->pos, avro_strerror());
+        }
+
+        /** Update rows events have the before and after images of the
+         * affected rows so we'll process them as another record with
+         * a different type */
+        if (event_type == UPDATE_EVENT)
+        {
+            prepare_record(&job->gtid, hdr, UPDATE_EVENT_AFTER, &record);
+            ptr = process_row_event_data(job->map, job->create, &record, ptr, col_present, end);
+            if (avro_file_writer_append_value(table->avro_file, &record))
+            {
+                MXS_ERROR("Failed to write value at position %ld: %s",
+                          job->pos, avro_strerror());
+            }
+        }
+    }
+
+    avro_value_decref(&record);
+}
+
+/**
+ * @brief Convert the rows of a queued row event
+ *
+ * Called by the conversion worker of the table.
+ *
+ * @param job The row event
+ */
+void avro_write_rows(AVRO_ROW_JOB *job)
+{
+    write_rows(job, job->data, job->data + job->present, job->data + job->rows);
+}
+
 /**
  * @brief Handle a single RBR row event
  *
@@ -258,6 +413,7 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
      * the future partial row images could be used if the bitfield containing
      * the columns that are present in this event is used. */
     const int coldata_size = (ncolumns + 7) / 8;
+    uint8_t *col_present_ptr = ptr;
     uint8_t col_present[coldata_size];
     memcpy(&col_present, ptr, coldata_size);
     ptr += coldata_size;
@@ -281,55 +437,51 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
     {
         char table_ident[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 2];
         snprintf(table_ident, sizeof(table_ident), "%s.%s", map->database, map->table);
+        avro_add_modified_table(router, table_ident);
         AVRO_TABLE* table = hashtable_fetch(router->open_tables, table_ident);
         TABLE_CREATE* create = map->table_create;
 
         if (table && create && ncolumns == map->columns)
         {
-            avro_value_t record;
-            avro_generic_value_new(table->avro_writer_iface, &record);
-
-            /** Each event has one or more rows in it. The number of rows is not known
-             * beforehand so we must continue processing them until we reach the end
-             * of the event. */
-            int rows = 0;
             MXS_INFO("Row Event for '%s' at %lu", table_ident, router->current_pos);
 
-            while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+            if (router->n_workers > 0)
             {
-                static uint64_t total_row_count = 1;
-                MXS_INFO("Row %lu", total_row_count++);
-
-                /** Add the current GTID and timestamp */
-                uint8_t *end = ptr + hdr->event_size - BINLOG_EVENT_HDR_LEN;
-                int event_type = get_event_type(hdr->event_type);
-                prepare_record(router, hdr, event_type, &record);
-                ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                if (avro_file_writer_append_value(table->avro_file, &record))
-                {
-                    MXS_ERROR("Failed to write value at position %ld: %s",
-                              router->current_pos, avro_strerror());
-                }
-
-                /** Update rows events have the before and after images of the
-                 * affected rows so we'll process them as another record with
-                 * a different type */
-                if (event_type == UPDATE_EVENT)
-                {
-                    prepare_record(router, hdr, UPDATE_EVENT_AFTER, &record);
-                    ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                    if (avro_file_writer_append_value(table->avro_file, &record))
-                    {
-                        MXS_ERROR("Failed to write value at position %ld: %s",
-                                  router->current_pos, avro_strerror());
-                    }
-                }
-
-                rows++;
+                /** The records of the event get the subsequence numbers after
+                 * the current one, so the numbers are reserved before the
+                 * rows are converted by the worker of the table */
+                size_t len = hdr->event_size - BINLOG_EVENT_HDR_LEN;
+                AVRO_ROW_JOB *job = MXS_MALLOC(sizeof(*job) + len);
+                MXS_ABORT_IF_NULL(job);
+
+                memcpy(job->data, start, len);
+                job->table = table;
+                job->map = map;
+                job->create = create;
+                job->hdr = *hdr;
+                job->gtid = router->gtid;
+                job->pos = router->current_pos;
+                job->present = col_present_ptr - start;
+                job->rows = ptr - start;
+                job->next = NULL;
+
+                router->gtid.event_num += count_records(map, create, hdr, start, ptr, col_present);
+                avro_worker_add_job(router, job);
+            }
+            else
+            {
+                AVRO_ROW_JOB job;
+                job.table = table;
+                job.map = map;
+                job.create = create;
+                job.hdr = *hdr;
+                job.gtid = router->gtid;
+                job.pos = router->current_pos;
+                write_rows(&job, start, col_present, ptr);
+                router->gtid.event_num = job.gtid.event_num;
             }
 
             add_used_table(router, table_ident);
-            avro_value_decref(&record);
             rval = true;
         }
         else if (table == NULL)
@@ -486,12 +638,96 @@ int get_metadata_len(uint8_t type)
     }
 }
 
+/**
+ * @brief Create the decoding plan of a table map
+ *
+ * The type of each column and the length of its value prefix only depend on
+ * the table map, so they are resolved once instead of for every row.
+ *
+ * @param map Table map with the column types and metadata
+ * @return The plan with one entry per column or NULL on memory allocation error
+ */
+AVRO_COLUMN_PLAN* column_plan_alloc(TABLE_MAP *map)
+{
+    /** Allocate at least one entry for the plan */
+    AVRO_COLUMN_PLAN *plan = MXS_CALLOC(map->columns + 1, sizeof(AVRO_COLUMN_PLAN));
+    size_t metadata_offset = 0;
+
+    for (uint64_t i = 0; plan && i < map->columns; i++)
+    {
+        AVRO_COLUMN_PLAN *col = &plan[i];
+        uint8_t *metadata = map->column_metadata + metadata_offset;
+        col->type = map->column_types[i];
+        col->metadata = metadata;
+        col->field = -1;
+
+        if (column_is_fixed_string(col->type))
+        {
+            if (fixed_string_is_enum(metadata[0]))
+            {
+                col->kind = AVRO_COLUMN_ENUM;
+            }
+            else
+            {
+                /**
+                 * The first byte in the metadata stores the real type of
+                 * the string (ENUM and SET types are also stored as fixed
+                 * length strings).
+                 *
+                 * The first two bits of the second byte contain the XOR'ed
+                 * field length but as that information is not relevant for
+                 * us, we just use this information to know whether to read
+                 * one or two bytes for string length.
+                 */
+                uint16_t meta = metadata[1] + (metadata[0] << 8);
+                uint16_t extra_length = (((meta >> 4) & 0x300) ^ 0x300);
+                uint16_t field_length = (meta & 0xff) + extra_length;
+                col->kind = AVRO_COLUMN_CHAR;
+                col->length_bytes = field_length > 255 ? 2 : 1;
+            }
+        }
+        else if (column_is_bit(col->type))
+        {
+            col->kind = AVRO_COLUMN_BIT;
+            col->bit_width = metadata[0] + metadata[1] * 8;
+        }
+        else if (column_is_decimal(col->type))
+        {
+            col->kind = AVRO_COLUMN_DECIMAL;
+        }
+        else if (column_is_variable_string(col->type))
+        {
+            int bytes = metadata[0] | metadata[1] << 8;
+            col->kind = AVRO_COLUMN_VARCHAR;
+            col->length_bytes = bytes > 255 ? 2 : 1;
+        }
+        else if (column_is_blob(col->type))
+        {
+            col->kind = AVRO_COLUMN_BLOB;
+            col->length_bytes = metadata[0];
+        }
+        else if (column_is_temporal(col->type))
+        {
+            col->kind = AVRO_COLUMN_TEMPORAL;
+        }
+        else
+        {
+            col->kind = AVRO_COLUMN_NUMERIC;
+        }
+
+        metadata_offset += get_metadata_len(col->type);
+        ss_dassert(metadata_offset <= map->column_metadata_size);
+    }
+
+    return plan;
+}
+
 /**
  * @brief Extract the values from a single row  in a row event
  *
  * @param map Table map event associated with this row
  * @param create Table creation associated with this row
- * @param record Avro record used for storing this row
+ * @param record Avro record used for storing this row, NULL to only skip the row
  * @param ptr Pointer to the start of the row data, should be after the row event header
  * @param columns_present The bitfield holding the columns that are present for
  * this row event. Currently this should be a bitfield which has all bits set.
@@ -503,8 +739,6 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
     int npresent = 0;
     avro_value_t field;
     long ncolumns = map->columns;
-    uint8_t *metadata = map->column_metadata;
-    size_t metadata_offset = 0;
 
     /** BIT type values use the extra bits in the row event header */
     int extra_bits = (((ncolumns + 7) / 8) * 8) - ncolumns;
@@ -517,90 +751,107 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
 
     for (long i = 0; i < map->columns && i < create->columns && npresent < ncolumns; i++)
     {
-        ss_debug(int rc = )avro_value_get_by_name(record, create->column_names[i], &field, NULL);
-        ss_dassert(rc == 0);
+        if (!bit_is_set(columns_present, ncolumns, i))
+        {
+            continue;
+        }
+
+        AVRO_COLUMN_PLAN *col = &map->plan[i];
+        npresent++;
 
-        if (bit_is_set(columns_present, ncolumns, i))
+        if (record)
         {
-            npresent++;
-            if (bit_is_set(null_bitmap, ncolumns, i))
+            /** The position of the field is looked up by name only once */
+            if (col->field < 0)
             {
-                MXS_INFO("[%ld] NULL", i);
-                if (column_is_blob(map->column_types[i]))
+                size_t index = 0;
+                ss_debug(int rc = )avro_value_get_by_name(record, create->column_names[i], &field, &index);
+                ss_dassert(rc == 0);
+                col->field = index;
+            }
+            else
+            {
+                avro_value_get_by_index(record, col->field, &field, NULL);
+            }
+        }
+
+        if (bit_is_set(null_bitmap, ncolumns, i))
+        {
+            MXS_INFO("[%ld] NULL", i);
+            if (record == NULL)
+            {
+                /** Only the length of the row is needed */
+            }
+            else if (col->kind == AVRO_COLUMN_BLOB)
+            {
+                uint8_t nullvalue = 0;
+                avro_value_set_bytes(&field, &nullvalue, 1);
+            }
+            else
+            {
+                avro_value_set_null(&field);
+            }
+            continue;
+        }
+
+        switch (col->kind)
+        {
+        case AVRO_COLUMN_ENUM:
+            {
+                /** ENUM and SET are stored as STRING types with the type stored
+                 * in the metadata. */
+                uint8_t val[col->metadata[1]];
+                uint64_t bytes = unpack_enum(ptr, col->metadata, val);
+                char strval[32];
+
+                /** Right now only ENUMs/SETs with less than 256 values
+                 * are printed correctly */
+                snprintf(strval, sizeof(strval), "%hhu", val[0]);
+                if (bytes > 1 && warn_large_enumset)
                 {
-                    uint8_t nullvalue = 0;
-                    avro_value_set_bytes(&field, &nullvalue, 1);
+                    warn_large_enumset = true;
+                    MXS_WARNING("ENUM/SET values larger than 255 values aren't supported.");
                 }
-                else
+                if (record)
                 {
-                    avro_value_set_null(&field);
+                    avro_value_set_string(&field, strval);
                 }
+                MXS_INFO("[%ld] ENUM: %lu bytes", i, bytes);
+                ptr += bytes;
             }
-            else if (column_is_fixed_string(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_CHAR:
             {
-                /** ENUM and SET are stored as STRING types with the type stored
-                 * in the metadata. */
-                if (fixed_string_is_enum(metadata[metadata_offset]))
+                int bytes = 0;
+
+                if (col->length_bytes == 2)
                 {
-                    uint8_t val[metadata[metadata_offset + 1]];
-                    uint64_t bytes = unpack_enum(ptr, &metadata[metadata_offset], val);
-                    char strval[32];
-
-                    /** Right now only ENUMs/SETs with less than 256 values
-                     * are printed correctly */
-                    snprintf(strval, sizeof(strval), "%hhu", val[0]);
-                    if (bytes > 1 && warn_large_enumset)
-                    {
-                        warn_large_enumset = true;
-                        MXS_WARNING("ENUM/SET values larger than 255 values aren't supported.");
-                    }
-                    avro_value_set_string(&field, strval);
-                    MXS_INFO("[%ld] ENUM: %lu bytes", i, bytes);
-                    ptr += bytes;
-                    ss_dassert(ptr < end);
+                    bytes = ptr[0] + (ptr[1] << 8);
+                    ptr += 2;
                 }
                 else
                 {
-                    /**
-                     * The first byte in the metadata stores the real type of
-                     * the string (ENUM and SET types are also stored as fixed
-                     * length strings).
-                     *
-                     * The first two bits of the second byte contain the XOR'ed
-                     * field length but as that information is not relevant for
-                     * us, we just use this information to know whether to read
-                     * one or two bytes for string length.
-                     */
-
-                    uint16_t meta = metadata[metadata_offset + 1] + (metadata[metadata_offset] << 8);
-                    int bytes = 0;
-                    uint16_t extra_length = (((meta >> 4) & 0x300) ^ 0x300);
-                    uint16_t field_length = (meta & 0xff) + extra_length;
-
-                    if (field_length > 255)
-                    {
-                        bytes = ptr[0] + (ptr[1] << 8);
-                        ptr += 2;
-                    }
-                    else
-                    {
-                        bytes = *ptr++;
-                    }
+                    bytes = *ptr++;
+                }
 
-                    MXS_INFO("[%ld] CHAR: field: %d bytes, data: %d bytes", i, field_length, bytes);
-                    ss_dassert(bytes || *ptr == '\0');
+                MXS_INFO("[%ld] CHAR: data: %d bytes", i, bytes);
+                ss_dassert(bytes || *ptr == '\0');
+                if (record)
+                {
                     char str[bytes + 1];
                     memcpy(str, ptr, bytes);
                     str[bytes] = '\0';
                     avro_value_set_string(&field, str);
-                    ptr += bytes;
-                    ss_dassert(ptr < end);
                 }
+                ptr += bytes;
             }
-            else if (column_is_bit(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_BIT:
             {
                 uint64_t value = 0;
-                int width = metadata[metadata_offset] + metadata[metadata_offset + 1] * 8;
+                int width = col->bit_width;
                 int bits_in_nullmap = MXS_MIN(width, extra_bits);
                 extra_bits -= bits_in_nullmap;
                 width -= bits_in_nullmap;
@@ -612,24 +863,31 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                     warn_bit = true;
                     MXS_WARNING("BIT is not currently supported, values are stored as 0.");
                 }
-                avro_value_set_int(&field, value);
+                if (record)
+                {
+                    avro_value_set_int(&field, value);
+                }
                 MXS_INFO("[%ld] BIT", i);
                 ptr += bytes;
-                ss_dassert(ptr < end);
             }
-            else if (column_is_decimal(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_DECIMAL:
             {
                 double f_value = 0.0;
-                ptr += unpack_decimal_field(ptr, metadata + metadata_offset, &f_value);
-                avro_value_set_double(&field, f_value);
+                ptr += unpack_decimal_field(ptr, col->metadata, &f_value);
+                if (record)
+                {
+                    avro_value_set_double(&field, f_value);
+                }
                 MXS_INFO("[%ld] DOUBLE", i);
-                ss_dassert(ptr < end);
             }
-            else if (column_is_variable_string(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_VARCHAR:
             {
                 size_t sz;
-                int bytes = metadata[metadata_offset] | metadata[metadata_offset + 1] << 8;
-                if (bytes > 255)
+                if (col->length_bytes == 2)
                 {
                     sz = gw_mysql_get_byte2(ptr);
                     ptr += 2;
@@ -640,58 +898,70 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                     ptr++;
                 }
 
-                MXS_INFO("[%ld] VARCHAR: field: %d bytes, data: %lu bytes", i, bytes, sz);
-                char buf[sz + 1];
-                memcpy(buf, ptr, sz);
-                buf[sz] = '\0';
+                MXS_INFO("[%ld] VARCHAR: data: %lu bytes", i, sz);
+                if (record)
+                {
+                    char buf[sz + 1];
+                    memcpy(buf, ptr, sz);
+                    buf[sz] = '\0';
+                    avro_value_set_string(&field, buf);
+                }
                 ptr += sz;
-                avro_value_set_string(&field, buf);
-                ss_dassert(ptr < end);
             }
-            else if (column_is_blob(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_BLOB:
             {
-                uint8_t bytes = metadata[metadata_offset];
                 uint64_t len = 0;
-                memcpy(&len, ptr, bytes);
-                ptr += bytes;
-                MXS_INFO("[%ld] BLOB: field: %d bytes, data: %lu bytes", i, bytes, len);
+                memcpy(&len, ptr, col->length_bytes);
+                ptr += col->length_bytes;
+                MXS_INFO("[%ld] BLOB: field: %d bytes, data: %lu bytes", i, col->length_bytes, len);
                 if (len)
                 {
-                    avro_value_set_bytes(&field, ptr, len);
+                    if (record)
+                    {
+                        avro_value_set_bytes(&field, ptr, len);
+                    }
                     ptr += len;
                 }
-                else
+                else if (record)
                 {
                     uint8_t nullvalue = 0;
                     avro_value_set_bytes(&field, &nullvalue, 1);
                 }
-                ss_dassert(ptr < end);
             }
-            else if (column_is_temporal(map->column_types[i]))
+            break;
+
+        case AVRO_COLUMN_TEMPORAL:
             {
                 char buf[80];
                 struct tm tm;
-                ptr += unpack_temporal_value(map->column_types[i], ptr,
-                                             &metadata[metadata_offset],
+                ptr += unpack_temporal_value(col->type, ptr, col->metadata,
                                              create->column_lengths[i], &tm);
-                format_temporal_value(buf, sizeof(buf), map->column_types[i], &tm);
-                avro_value_set_string(&field, buf);
-                MXS_INFO("[%ld] TEMPORAL: %s", i, buf);
-                ss_dassert(ptr < end);
+                if (record)
+                {
+                    format_temporal_value(buf, sizeof(buf), col->type, &tm);
+                    avro_value_set_string(&field, buf);
+                    MXS_INFO("[%ld] TEMPORAL: %s", i, buf);
+                }
             }
-            /** All numeric types (INT, LONG, FLOAT etc.) */
-            else
+            break;
+
+        /** All numeric types (INT, LONG, FLOAT etc.) */
+        default:
             {
                 uint8_t lval[16];
                 memset(lval, 0, sizeof(lval));
-                ptr += unpack_numeric_field(ptr, map->column_types[i],
-                                            &metadata[metadata_offset], lval);
-                set_numeric_field_value(&field, map->column_types[i], &metadata[metadata_offset], lval);
-                ss_dassert(ptr < end);
+                ptr += unpack_numeric_field(ptr, col->type, col->metadata, lval);
+                if (record)
+                {
+                    set_numeric_field_value(&field, col->type, col->metadata, lval);
+                }
             }
-            ss_dassert(metadata_offset <= map->column_metadata_size);
-            metadata_offset += get_metadata_len(map->column_types[i]);
+            break;
         }
+
+        ss_dassert(ptr < end);
     }
 
     return ptr;
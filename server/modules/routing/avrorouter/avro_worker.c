@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_worker.c - Conversion threads of the Avro router
+ *
+ * The rows of a row event are written into the Avro file of the table by the
+ * conversion thread that the table is assigned to. The events of a table are
+ * converted in the order they are in the binlog but the events of different
+ * tables are converted in parallel. The GTID event numbers of the rows are
+ * reserved when the event is queued, so the records are identical to the ones
+ * created without the conversion threads.
+ */
+
+#include "avrorouter.h"
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+
+/**
+ * @brief The main loop of a conversion thread
+ *
+ * @param data The AVRO_WORKER of the thread
+ */
+static void avro_worker_main(void *data)
+{
+    AVRO_WORKER *worker = (AVRO_WORKER*)data;
+
+    pthread_mutex_lock(&worker->lock);
+
+    while (true)
+    {
+        while (worker->head == NULL && !worker->shutdown)
+        {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+
+        if (worker->head == NULL)
+        {
+            break;
+        }
+
+        AVRO_ROW_JOB *job = worker->head;
+        worker->head = job->next;
+
+        if (worker->head == NULL)
+        {
+            worker->tail = NULL;
+        }
+
+        worker->n_queued--;
+        worker->busy = true;
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+
+        avro_write_rows(job);
+        MXS_FREE(job);
+
+        pthread_mutex_lock(&worker->lock);
+        worker->busy = false;
+        worker->n_jobs++;
+        pthread_cond_broadcast(&worker->cond);
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/**
+ * @brief Start the conversion threads
+ *
+ * @param router Avro router instance
+ * @param n_workers Number of threads to start
+ * @return True if all threads were started
+ */
+bool avro_workers_start(AVRO_INSTANCE *router, int n_workers)
+{
+    router->workers = MXS_CALLOC(n_workers, sizeof(AVRO_WORKER));
+
+    if (router->workers == NULL)
+    {
+        router->n_workers = 0;
+        return false;
+    }
+
+    for (int i = 0; i < n_workers; i++)
+    {
+        AVRO_WORKER *worker = &router->workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+
+        if (thread_start(&worker->thread, avro_worker_main, worker) == NULL)
+        {
+            MXS_ERROR("Failed to start Avro conversion thread %d.", i);
+            router->n_workers = i;
+            avro_workers_stop(router);
+            return false;
+        }
+    }
+
+    router->n_workers = n_workers;
+    return true;
+}
+
+/**
+ * @brief Stop the conversion threads
+ *
+ * The queued rows are written before the threads exit.
+ *
+ * @param router Avro router instance
+ */
+void avro_workers_stop(AVRO_INSTANCE *router)
+{
+    for (int i = 0; i < router->n_workers; i++)
+    {
+        AVRO_WORKER *worker = &router->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->shutdown = true;
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+        thread_wait(worker->thread);
+    }
+
+    MXS_FREE(router->workers);
+    router->workers = NULL;
+    router->n_workers = 0;
+}
+
+/**
+ * @brief Wait until all queued rows are written
+ *
+ * This must be called before the tables, maps or table definitions that the
+ * queued rows refer to are modified or freed and before the Avro files are
+ * flushed.
+ *
+ * @param router Avro router instance
+ */
+void avro_workers_wait(AVRO_INSTANCE *router)
+{
+    for (int i = 0; i < router->n_workers; i++)
+    {
+        AVRO_WORKER *worker = &router->workers[i];
+        pthread_mutex_lock(&worker->lock);
+
+        while (worker->head || worker->busy)
+        {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+/**
+ * @brief Queue the rows of a row event
+ *
+ * The rows are written by the conversion thread of the table. If the queue
+ * of the thread is full, the call blocks until there is room in it.
+ *
+ * @param router Avro router instance
+ * @param job The rows to write, freed by the conversion thread
+ */
+void avro_worker_add_job(AVRO_INSTANCE *router, AVRO_ROW_JOB *job)
+{
+    AVRO_WORKER *worker = &router->workers[job->table->worker];
+    job->next = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+
+    while (worker->n_queued >= AVRO_WORKER_QUEUE_MAX)
+    {
+        pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+
+    if (worker->tail)
+    {
+        worker->tail->next = job;
+    }
+    else
+    {
+        worker->head = job;
+    }
+
+    worker->tail = job;
+    worker->n_queued++;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+}
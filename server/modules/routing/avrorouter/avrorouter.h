@@ -28,6 +28,7 @@
 #include <maxscale/dcb.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/mysql_binlog.h>
 #include <maxscale/users.h>
 #include <avro.h>
@@ -63,6 +64,9 @@ MXS_BEGIN_DECLS
 /** Name of the file where the binlog to Avro conversion progress is stored */
 #define AVRO_PROGRESS_FILE "avro-conversion.ini"
 
+/** Name of the file where the table definitions are cached */
+#define AVRO_TABLE_CACHE_FILE "avro-tables.cache"
+
 /** Buffer limits */
 #define AVRO_SQL_BUFFER_SIZE 2048
 
@@ -121,7 +125,15 @@ typedef enum avro_binlog_end
 #define TABLE_MAP_MAX_NAME_LEN 64
 
 /** How many bytes each thread tries to send */
-#define AVRO_DATA_BURST_SIZE (32 * 1024)
+#define AVRO_DATA_BURST_SIZE (256 * 1024)
+
+/**
+ * The client write queue marks used for streaming. The streaming stops when
+ * the write queue is above the high water mark and continues when it drops
+ * below the low water mark.
+ */
+#define AVRO_CLIENT_HIGH_WATER (256 * 1024)
+#define AVRO_CLIENT_LOW_WATER  (64 * 1024)
 
 /** A CREATE TABLE abstraction */
 typedef struct table_create
@@ -136,6 +148,30 @@ typedef struct table_create
     bool was_used; /**< Has this schema been persisted to disk */
 } TABLE_CREATE;
 
+/** How the value of a column is read from a row event */
+enum avro_column_kind
+{
+    AVRO_COLUMN_NUMERIC,
+    AVRO_COLUMN_ENUM,
+    AVRO_COLUMN_CHAR,
+    AVRO_COLUMN_BIT,
+    AVRO_COLUMN_DECIMAL,
+    AVRO_COLUMN_VARCHAR,
+    AVRO_COLUMN_BLOB,
+    AVRO_COLUMN_TEMPORAL
+};
+
+/** The decoding of one column, resolved once when the table map is read */
+typedef struct avro_column_plan
+{
+    enum avro_column_kind kind;
+    uint8_t  type;         /*< The column type */
+    uint8_t  *metadata;    /*< The metadata of the column in the table map */
+    int      length_bytes; /*< Bytes in the length of a CHAR, VARCHAR or BLOB value */
+    int      bit_width;    /*< The width of a BIT column in bits */
+    int      field;        /*< Index of the Avro field, -1 until the first row */
+} AVRO_COLUMN_PLAN;
+
 /** A representation of a table map event read from a binary log. A table map
  * maps a table to a unique ID which can be used to match row events to table map
  * events. The table map event tells us how the table is laid out and gives us
@@ -150,6 +186,7 @@ typedef struct table_map
     uint8_t *column_metadata;
     size_t column_metadata_size;
     TABLE_CREATE *table_create; /*< The definition of the table */
+    AVRO_COLUMN_PLAN *plan; /*< How each column is decoded */
     int version;
     char version_string[TABLE_MAP_VERSION_DIGITS + 1];
     char *table;
@@ -168,6 +205,8 @@ typedef struct
     int             n_masterstarts; /*< Number of times connection restarted */
     time_t          lastReply;
     uint64_t        events[MAX_EVENT_TYPE_END + 1]; /*< Per event counters */
+    uint64_t        block_cache_hits;   /*< Data blocks sent from the block cache */
+    uint64_t        block_cache_misses; /*< Data blocks read from the Avro files */
     uint64_t        lastsample;
     int             minno;
     int             minavgs[AVRO_NSTATS_MINUTES];
@@ -195,6 +234,8 @@ typedef struct avro_table_t
     avro_file_writer_t avro_file; /*< Current Avro data file */
     avro_value_iface_t *avro_writer_iface; /*< Avro C API writer interface */
     avro_schema_t avro_schema; /*< Native Avro schema of the table */
+    int worker; /*< The conversion worker that writes the table */
+    time_t opened; /*< When the file was opened for writing */
 } AVRO_TABLE;
 
 /** Data format used when streaming data to the clients */
@@ -217,6 +258,76 @@ typedef struct gtid_pos
                          * rebuild GTID events in the correct order. */
 } gtid_pos_t;
 
+/** How many data blocks the block cache holds */
+#define AVRO_BLOCK_CACHE_SIZE 64
+
+/**
+ * A data block of an Avro file in the form it is sent to the clients. The
+ * sync marker of the file and the offset of the block identify the block.
+ */
+typedef struct avro_block
+{
+    uint8_t               sync[SYNC_MARKER_SIZE]; /*< Sync marker of the file */
+    long                  pos;    /*< Offset of the block in the file */
+    enum avro_data_format format; /*< The format of the data */
+    GWBUF                 *data;  /*< The data, NULL if the slot is unused */
+    gtid_pos_t            gtid;   /*< GTID of the last record in a JSON block */
+} AVRO_BLOCK;
+
+/** The maximum number of columns or conditions in a data request */
+#define AVRO_FILTER_MAX 32
+
+/** The row filter and the column projection of a data request */
+typedef struct avro_filter
+{
+    char       *fields[AVRO_FILTER_MAX];  /*< Columns sent to the client */
+    int        n_fields;                  /*< Number of columns, 0 sends all columns */
+    char       *columns[AVRO_FILTER_MAX]; /*< Columns the conditions compare */
+    char       *values[AVRO_FILTER_MAX];  /*< Values the columns must be equal to */
+    int        n_conditions;              /*< Number of conditions */
+    bool       until_set;                 /*< Whether the rows after @c until are filtered */
+    gtid_pos_t until;                     /*< The last GTID sent to the client */
+} AVRO_FILTER;
+
+/** The maximum number of row events queued for one conversion worker */
+#define AVRO_WORKER_QUEUE_MAX 1024
+
+/**
+ * A row event queued for conversion. The job has a copy of the event payload
+ * and the GTID of the event with the subsequence number of the record that
+ * precedes the first record of the event.
+ */
+typedef struct avro_row_job
+{
+    AVRO_TABLE          *table;     /*< The table the rows are written to */
+    TABLE_MAP           *map;       /*< The table map of the rows */
+    TABLE_CREATE        *create;    /*< The table definition */
+    REP_HEADER          hdr;        /*< The header of the row event */
+    gtid_pos_t          gtid;       /*< The GTID of the row event */
+    uint64_t            pos;        /*< The position of the row event */
+    size_t              present;    /*< Offset of the present columns bitmap */
+    size_t              rows;       /*< Offset of the first row */
+    struct avro_row_job *next;      /*< The next job in the queue */
+    uint8_t             data[];     /*< The payload of the row event */
+} AVRO_ROW_JOB;
+
+/**
+ * A conversion worker. Each table is written by one worker, which writes the
+ * rows of the table in the order they were queued.
+ */
+typedef struct avro_worker
+{
+    THREAD          thread;     /*< The worker thread */
+    pthread_mutex_t lock;       /*< Protects the fields below */
+    pthread_cond_t  cond;       /*< Signalled when the queue or the state changes */
+    AVRO_ROW_JOB    *head;      /*< The first queued job */
+    AVRO_ROW_JOB    *tail;      /*< The last queued job */
+    int             n_queued;   /*< The number of queued jobs */
+    bool            busy;       /*< Whether a job is being converted */
+    bool            shutdown;   /*< Whether the worker should stop */
+    uint64_t        n_jobs;     /*< The number of converted jobs */
+} AVRO_WORKER;
+
 /**
  * The client structure used within this router.
  * This represents the clients that are requesting AVRO files from MaxScale.
@@ -243,6 +354,7 @@ typedef struct avro_client
     bool            requested_gtid; /*< If the client requested */
     gtid_pos_t      gtid; /*< Current/requested GTID */
     gtid_pos_t      gtid_start; /*< First sent GTID */
+    AVRO_FILTER     *filter;    /*< Filter of the requested rows, NULL if none */
     unsigned int    cstate;         /*< Catch up state */
     sqlite3       *sqlite_handle;
 #if defined(SS_DEBUG)
@@ -272,6 +384,9 @@ typedef struct avro_instance
     uint64_t                current_pos;
     /*< Current binlog position */
     int                     binlog_fd;      /*< File descriptor of the binlog file being read */
+    bool                    mmap_binlog;    /*< Map completed binlog files into memory */
+    uint8_t                 *binlog_map;    /*< The mapping of the binlog file being read */
+    uint64_t                binlog_map_len; /*< The length of the mapping */
     pcre2_code              *create_table_re;
     pcre2_code              *alter_table_re;
     uint8_t event_types;
@@ -287,6 +402,8 @@ typedef struct avro_instance
     int               rotating;     /*< Rotation in progress flag */
     SPINLOCK          fileslock;    /*< Lock for the files queue above */
     AVRO_ROUTER_STATS      stats;        /*< Statistics for this router */
+    SPINLOCK          block_cache_lock; /*< Protects the block cache */
+    AVRO_BLOCK        block_cache[AVRO_BLOCK_CACHE_SIZE]; /*< Data blocks shared by the clients */
     int task_delay; /*< Delay in seconds until the next conversion takes place */
     uint64_t        trx_count; /*< Transactions processed */
     uint64_t        trx_target; /*< Minimum about of transactions that will trigger
@@ -295,6 +412,15 @@ typedef struct avro_instance
     uint64_t        row_target; /*< Minimum about of row events that will trigger
                                  * a flush of all tables */
     uint64_t        block_size; /**< Avro datablock size */
+    uint64_t        max_file_size; /*< Size at which a new Avro file is started, 0 for no limit */
+    uint64_t        max_file_time; /*< Seconds after which a new Avro file is started,
+                                    * 0 for no limit */
+    char          **modified_tables; /*< Tables modified by the current transaction */
+    int             n_modified_tables; /*< Number of modified tables */
+    int             modified_tables_size; /*< Allocated size of modified_tables */
+    int             n_workers; /*< Number of conversion workers, 0 if rows are converted inline */
+    AVRO_WORKER    *workers; /*< The conversion workers */
+    int             next_worker; /*< The worker the next opened table is given to */
     struct avro_instance  *next;
 } AVRO_INSTANCE;
 
@@ -302,6 +428,7 @@ extern void read_table_info(uint8_t *ptr, uint8_t post_header_len, uint64_t *tab
                             char* dest, size_t len);
 extern TABLE_MAP *table_map_alloc(uint8_t *ptr, uint8_t hdr_len, TABLE_CREATE* create);
 extern void table_map_free(TABLE_MAP *map);
+extern AVRO_COLUMN_PLAN* column_plan_alloc(TABLE_MAP *map);
 extern TABLE_CREATE* table_create_alloc(const char* sql, int len, const char* db);
 extern TABLE_CREATE* table_create_copy(AVRO_INSTANCE *router, const char* sql, size_t len, const char* db);
 extern void table_create_free(TABLE_CREATE* value);
@@ -310,8 +437,11 @@ extern bool table_create_alter(TABLE_CREATE *create, const char *sql, const char
 extern void read_alter_identifier(const char *sql, const char *end, char *dest, int size);
 extern int avro_client_handle_request(AVRO_INSTANCE *, AVRO_CLIENT *, GWBUF *);
 extern void avro_client_rotate(AVRO_INSTANCE *router, AVRO_CLIENT *client, uint8_t *ptr);
+extern void avro_filter_free(AVRO_FILTER *filter);
 extern bool avro_open_binlog(const char *binlogdir, const char *file, int *fd);
 extern void avro_close_binlog(int fd);
+extern void avro_map_binlog(AVRO_INSTANCE *router);
+extern void avro_unmap_binlog(AVRO_INSTANCE *router);
 extern avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router);
 extern AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size_t block_size);
 extern void avro_table_free(AVRO_TABLE *table);
@@ -320,6 +450,13 @@ extern void save_avro_schema(const char *path, const char* schema, TABLE_MAP *ma
 extern bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern void table_map_remap(uint8_t *ptr, uint8_t hdr_len, TABLE_MAP *map);
+extern void avro_add_modified_table(AVRO_INSTANCE *router, const char *ident);
+extern void avro_publish_modified_tables(AVRO_INSTANCE *router);
+extern bool avro_workers_start(AVRO_INSTANCE *router, int n_workers);
+extern void avro_workers_stop(AVRO_INSTANCE *router);
+extern void avro_workers_wait(AVRO_INSTANCE *router);
+extern void avro_worker_add_job(AVRO_INSTANCE *router, AVRO_ROW_JOB *job);
+extern void avro_write_rows(AVRO_ROW_JOB *job);
 
 enum avrorouter_file_op
 {
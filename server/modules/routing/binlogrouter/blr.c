@@ -129,6 +129,16 @@ GWBUF *blr_cache_read_response(ROUTER_INSTANCE *router, char *response);
 static SPINLOCK instlock;
 static ROUTER_INSTANCE *instances;
 
+static const MXS_ENUM_VALUE binlog_sync_values[] =
+{
+    {"batch", BLR_SYNC_BATCH},
+    {"commit", BLR_SYNC_COMMIT},
+    {"events", BLR_SYNC_EVENTS},
+    {"interval", BLR_SYNC_INTERVAL},
+    {"none", BLR_SYNC_NONE},
+    {NULL}
+};
+
 static const MXS_ENUM_VALUE enc_algo_values[] =
 {
     {"aes_cbc", BLR_AES_CBC},
@@ -191,6 +201,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"file", MXS_MODULE_PARAM_COUNT, "1"},
             {"transaction_safety", MXS_MODULE_PARAM_BOOL, "false"},
             {"semisync", MXS_MODULE_PARAM_BOOL, "false"},
+            {"relay_compression", MXS_MODULE_PARAM_BOOL, "false"},
             {"encrypt_binlog", MXS_MODULE_PARAM_BOOL, "false"},
             {"encryption_algorithm", MXS_MODULE_PARAM_ENUM, "aes_cbc", MXS_MODULE_OPT_NONE, enc_algo_values},
             {"encryption_key_file", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
@@ -199,6 +210,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"shortburst", MXS_MODULE_PARAM_COUNT, DEF_SHORT_BURST},
             {"longburst", MXS_MODULE_PARAM_COUNT, DEF_LONG_BURST},
             {"burstsize", MXS_MODULE_PARAM_SIZE, DEF_BURST_SIZE},
+            {"event_cache_size", MXS_MODULE_PARAM_SIZE, DEF_EVENT_CACHE_SIZE},
+            {"write_buffer_size", MXS_MODULE_PARAM_SIZE, DEF_WRITE_BUFFER_SIZE},
+            {"binlog_sync", MXS_MODULE_PARAM_ENUM, "batch", MXS_MODULE_OPT_NONE, binlog_sync_values},
+            {"binlog_sync_events", MXS_MODULE_PARAM_COUNT, "1000"},
+            {"binlog_sync_interval", MXS_MODULE_PARAM_COUNT, "1000"},
+            {"mmap_binlog", MXS_MODULE_PARAM_BOOL, "false"},
+            {"compress_binlog", MXS_MODULE_PARAM_BOOL, "false"},
+            {"binlog_checkpoint", MXS_MODULE_PARAM_BOOL, "false"},
             {"heartbeat", MXS_MODULE_PARAM_COUNT, BLR_HEARTBEAT_DEFAULT_INTERVAL},
             {"send_slave_heartbeat", MXS_MODULE_PARAM_BOOL, "false"},
             {"binlogdir", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_W_OK},
@@ -210,6 +229,40 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Parse the value of a size router option
+ *
+ * @param value The value, a number with an optional K, M or G suffix
+ *
+ * @return The size in bytes
+ */
+static unsigned long
+blr_size_option(const char *value)
+{
+    unsigned long size = atoi(value);
+    const char *ptr = value;
+    while (*ptr && isdigit(*ptr))
+    {
+        ptr++;
+    }
+    switch (*ptr)
+    {
+    case 'G':
+    case 'g':
+        size = size * 1024 * 1000 * 1000;
+        break;
+    case 'M':
+    case 'm':
+        size = size * 1024 * 1000;
+        break;
+    case 'K':
+    case 'k':
+        size = size * 1024;
+        break;
+    }
+    return size;
+}
+
 /**
  * Create an instance of the router for a particular service
  * within MaxScale.
@@ -280,6 +333,15 @@ createInstance(SERVICE *service, char **options)
     spinlock_init(&inst->fileslock);
     spinlock_init(&inst->binlog_lock);
 
+    char lockname[SPINLOCK_NAME_LEN];
+    snprintf(lockname, sizeof(lockname), "binlogrouter:%s", service->name);
+    spinlock_set_name(&inst->lock, lockname);
+    snprintf(lockname, sizeof(lockname), "binlogrouter:%s:binlog", service->name);
+    spinlock_set_name(&inst->binlog_lock, lockname);
+    spinlock_init(&inst->event_cache.lock);
+    spinlock_init(&inst->slave_status_response.lock);
+    spinlock_init(&inst->master_status_response.lock);
+
     inst->binlog_fd = -1;
     inst->master_chksum = true;
 
@@ -313,6 +375,7 @@ createInstance(SERVICE *service, char **options)
     inst->next = NULL;
     inst->lastEventTimestamp = 0;
     inst->binlog_position = 0;
+    inst->binlog_generation = 1;
     inst->current_pos = 0;
     inst->current_safe_event = 0;
     inst->master_event_state = BLR_EVENT_DONE;
@@ -329,6 +392,14 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = config_get_integer(params, "shortburst");
     inst->long_burst = config_get_integer(params, "longburst");
     inst->burst_size = config_get_size(params, "burstsize");
+    inst->event_cache.size = config_get_size(params, "event_cache_size");
+    inst->write_buffer.size = config_get_size(params, "write_buffer_size");
+    inst->binlog_sync = config_get_enum(params, "binlog_sync", binlog_sync_values);
+    inst->sync_events = config_get_integer(params, "binlog_sync_events");
+    inst->sync_interval = config_get_integer(params, "binlog_sync_interval");
+    inst->mmap_binlog = config_get_bool(params, "mmap_binlog");
+    inst->compress_binlog = config_get_bool(params, "compress_binlog");
+    inst->binlog_checkpoint = config_get_bool(params, "binlog_checkpoint");
     inst->binlogdir = config_copy_string(params, "binlogdir");
     inst->heartbeat = config_get_integer(params, "heartbeat");
     inst->ssl_cert_verification_depth = config_get_integer(params, "ssl_cert_verification_depth");
@@ -352,6 +423,7 @@ createInstance(SERVICE *service, char **options)
     /* Semi-Sync support */
     inst->request_semi_sync = config_get_bool(params, "semisync");
     inst->master_semi_sync = 0;
+    inst->relay_compression = config_get_bool(params, "relay_compression");
 
     /* Binlog encryption */
     inst->encryption.enabled = config_get_bool(params, "encrypt_binlog");
@@ -509,6 +581,10 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->request_semi_sync = config_truth_value(value);
                 }
+                else if (strcmp(options[i], "relay_compression") == 0)
+                {
+                    inst->relay_compression = config_truth_value(value);
+                }
                 else if (strcmp(options[i], "encrypt_binlog") == 0)
                 {
                     inst->encryption.enabled = config_truth_value(value);
@@ -553,29 +629,56 @@ createInstance(SERVICE *service, char **options)
                 }
                 else if (strcmp(options[i], "burstsize") == 0)
                 {
-                    unsigned long size = atoi(value);
-                    char    *ptr = value;
-                    while (*ptr && isdigit(*ptr))
+                    inst->burst_size = blr_size_option(value);
+                }
+                else if (strcmp(options[i], "event_cache_size") == 0)
+                {
+                    inst->event_cache.size = blr_size_option(value);
+                }
+                else if (strcmp(options[i], "write_buffer_size") == 0)
+                {
+                    inst->write_buffer.size = blr_size_option(value);
+                }
+                else if (strcmp(options[i], "binlog_sync") == 0)
+                {
+                    int j = 0;
+
+                    while (binlog_sync_values[j].name &&
+                           strcasecmp(binlog_sync_values[j].name, value) != 0)
                     {
-                        ptr++;
+                        j++;
                     }
-                    switch (*ptr)
+
+                    if (binlog_sync_values[j].name)
                     {
-                    case 'G':
-                    case 'g':
-                        size = size * 1024 * 1000 * 1000;
-                        break;
-                    case 'M':
-                    case 'm':
-                        size = size * 1024 * 1000;
-                        break;
-                    case 'K':
-                    case 'k':
-                        size = size * 1024;
-                        break;
+                        inst->binlog_sync = binlog_sync_values[j].enum_value;
                     }
-                    inst->burst_size = size;
-
+                    else
+                    {
+                        MXS_WARNING("Invalid binlog_sync value %s, "
+                                    "using the default value 'batch'.", value);
+                        inst->binlog_sync = BLR_SYNC_BATCH;
+                    }
+                }
+                else if (strcmp(options[i], "binlog_sync_events") == 0)
+                {
+                    inst->sync_events = atoi(value);
+                }
+                else if (strcmp(options[i], "binlog_sync_interval") == 0)
+                {
+                    inst->sync_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "mmap_binlog") == 0)
+                {
+                    inst->mmap_binlog = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "compress_binlog") == 0)
+                {
+                    inst->compress_binlog = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "binlog_checkpoint") == 0)
+                {
+                    inst->binlog_checkpoint = config_truth_value(value);
                 }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
@@ -824,6 +927,9 @@ createInstance(SERVICE *service, char **options)
         }
     }
 
+    /* Allocate the buffer of the binlog writes */
+    blr_init_write_buffer(inst);
+
     if (inst->master_state == BLRM_UNCONNECTED)
     {
 
@@ -885,6 +991,12 @@ createInstance(SERVICE *service, char **options)
     snprintf(task_name, BLRM_TASK_NAME_LEN, "%s stats", service->name);
     hktask_add(task_name, stats_func, inst, BLR_STATS_FREQ);
 
+    if (inst->compress_binlog)
+    {
+        snprintf(task_name, BLRM_TASK_NAME_LEN, "%s compress", service->name);
+        hktask_add(task_name, blr_compress_binlogs, inst, BLR_COMPRESS_FREQ);
+    }
+
     /* Log whether the transaction safety option value is on */
     if (inst->trx_safe)
     {
@@ -966,6 +1078,8 @@ free_instance(ROUTER_INSTANCE *instance)
     MXS_FREE(instance->set_slave_hostname);
     MXS_FREE(instance->fileroot);
     MXS_FREE(instance->binlogdir);
+    MXS_FREE(instance->write_buffer.data);
+    blr_free_cache(instance);
     /* SSL options */
     MXS_FREE(instance->ssl_ca);
     MXS_FREE(instance->ssl_cert);
@@ -1112,6 +1226,7 @@ static void freeSession(MXS_ROUTER* router_instance,
     {
         MXS_FREE(slave->encryption_ctx);
     }
+    MXS_FREE(slave->read_buffer.data);
     MXS_FREE(slave);
 }
 
@@ -1251,13 +1366,11 @@ static char *event_names_mariadb10[] =
  * @param   desc    Description of the statistic
  * @param   value   The statistic value
  */
-#if SPINLOCK_PROFILE
 static void
 spin_reporter(void *dcb, char *desc, int value)
 {
     dcb_printf((DCB *)dcb, "\t\t%-35s	%d\n", desc, value);
 }
-#endif
 
 /**
  * Display router diagnostics
@@ -1415,6 +1528,69 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
     dcb_printf(dcb, "\tAverage events per packet:                   %.1f\n",
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
+    if (router_inst->event_cache.data)
+    {
+        spinlock_acquire(&router_inst->event_cache.lock);
+        uint64_t cached = router_inst->event_cache.end - router_inst->event_cache.start;
+        spinlock_release(&router_inst->event_cache.lock);
+
+        dcb_printf(dcb, "\tBinlog event cache size:                     %lu\n",
+                   router_inst->event_cache.size);
+        dcb_printf(dcb, "\tBytes of binlog events in the cache:         %lu\n",
+                   cached);
+        dcb_printf(dcb, "\tNo. of binlog events read from the cache:    %lu\n",
+                   atomic_load_uint64(&router_inst->event_cache.n_hits));
+        dcb_printf(dcb, "\tNo. of binlog events read from the files:    %lu\n",
+                   atomic_load_uint64(&router_inst->event_cache.n_misses));
+    }
+    dcb_printf(dcb, "\tStatus responses sent from the cache:        %lu\n",
+               atomic_load_uint64(&router_inst->slave_status_response.n_hits) +
+               atomic_load_uint64(&router_inst->master_status_response.n_hits));
+    dcb_printf(dcb, "\tStatus responses built:                      %lu\n",
+               atomic_load_uint64(&router_inst->slave_status_response.n_builds) +
+               atomic_load_uint64(&router_inst->master_status_response.n_builds));
+    dcb_printf(dcb, "\tBinlog file sync policy:                     %s\n",
+               binlog_sync_values[router_inst->binlog_sync].name);
+    dcb_printf(dcb, "\tNumber of binlog file writes:                %lu\n",
+               router_inst->stats.n_writes);
+    dcb_printf(dcb, "\tAverage bytes per binlog file write:         %.1f\n",
+               router_inst->stats.n_writes != 0 ?
+               ((double)router_inst->stats.n_write_bytes / router_inst->stats.n_writes) : 0);
+    dcb_printf(dcb, "\tNumber of binlog file syncs:                 %lu\n",
+               router_inst->stats.n_syncs);
+    dcb_printf(dcb, "\tAverage binlog file sync time (ms):          %.3f\n",
+               router_inst->stats.n_syncs != 0 ?
+               ((double)router_inst->stats.sync_time / router_inst->stats.n_syncs / 1000) : 0);
+    dcb_printf(dcb, "\tMaximum binlog file sync time (ms):          %.3f\n",
+               (double)router_inst->stats.max_sync_time / 1000);
+
+    if (router_inst->relay_compression)
+    {
+        dcb_printf(dcb, "\tNumber of compressed frames from master:     %lu\n",
+                   router_inst->stats.n_relay_frames);
+        dcb_printf(dcb, "\tCompression ratio of the frames:              %.2f\n",
+                   router_inst->stats.relay_in != 0 ?
+                   (double)router_inst->stats.relay_out / router_inst->stats.relay_in : 0);
+    }
+
+    if (router_inst->request_semi_sync)
+    {
+        dcb_printf(dcb, "\tNumber of Semi-Sync ACK requests:            %lu\n",
+                   router_inst->stats.n_semisync_reqs);
+        dcb_printf(dcb, "\tNumber of Semi-Sync ACKs sent:               %lu\n",
+                   router_inst->stats.n_semisync_acks);
+    }
+
+    if (router_inst->compress_binlog)
+    {
+        uint64_t in = atomic_load_uint64(&router_inst->stats.compress_in);
+        uint64_t out = atomic_load_uint64(&router_inst->stats.compress_out);
+
+        dcb_printf(dcb, "\tNumber of binlog files compressed:           %lu\n",
+                   atomic_load_uint64(&router_inst->stats.n_compressed));
+        dcb_printf(dcb, "\tBinlog compression ratio:                    %.2f\n",
+                   out != 0 ? (double)in / out : 0);
+    }
 
     spinlock_acquire(&router_inst->lock);
     if (router_inst->stats.lastReply)
@@ -1498,14 +1674,10 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
         }
     }
 
-#if SPINLOCK_PROFILE
-    dcb_printf(dcb, "\tSpinlock statistics (instlock):\n");
-    spinlock_stats(&instlock, spin_reporter, dcb);
     dcb_printf(dcb, "\tSpinlock statistics (instance lock):\n");
     spinlock_stats(&router_inst->lock, spin_reporter, dcb);
     dcb_printf(dcb, "\tSpinlock statistics (binlog position lock):\n");
     spinlock_stats(&router_inst->binlog_lock, spin_reporter, dcb);
-#endif
 
     if (router_inst->slaves)
     {
@@ -1605,6 +1777,13 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
             dcb_printf(dcb,
                        "\t\tNo. transitions to follow mode:          %u\n",
                        session->stats.n_bursts);
+            dcb_printf(dcb,
+                       "\t\tTime spent in catchup (seconds):          %.3f\n",
+                       session->stats.catchup_time / 1000000.0);
+            dcb_printf(dcb,
+                       "\t\tCatchup throughput (bytes/second):        %lu\n",
+                       session->stats.catchup_time ? (unsigned long)
+                       (session->stats.catchup_bytes * 1000000 / session->stats.catchup_time) : 0UL);
             if (router_inst->send_slave_heartbeat)
             {
                 dcb_printf(dcb,
@@ -1683,12 +1862,6 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                                 " Busy in slave catchup."));
                 }
             }
-#if SPINLOCK_PROFILE
-            dcb_printf(dcb, "\tSpinlock statistics (catch_lock):\n");
-            spinlock_stats(&session->catch_lock, spin_reporter, dcb);
-            dcb_printf(dcb, "\tSpinlock statistics (rses_lock):\n");
-            spinlock_stats(&session->rses_lock, spin_reporter, dcb);
-#endif
             dcb_printf(dcb, "\t\t--------------------\n\n");
             session = session->next;
         }
@@ -2316,7 +2489,14 @@ static int blr_check_binlog(ROUTER_INSTANCE *router)
      * If an open transaction is detected at pos XYZ
      * inst->binlog_position will be set to XYZ while
      * router->current_pos is the last event found.
+     *
+     * With a valid checkpoint only the events after it are read.
      */
+    if (router->binlog_checkpoint && blr_file_read_checkpoint(router))
+    {
+        MXS_NOTICE("%s: Checking binlog file '%s' from checkpoint at %lu",
+                   router->service->name, router->binlog_name, router->checkpoint_pos);
+    }
 
     n = blr_read_events_all_events(router, 0, 0);
 
@@ -198,6 +198,28 @@ enum blr_aes_mode
 #define DEF_LONG_BURST          "500"
 #define DEF_BURST_SIZE          "1024000" /* 1 Mb */
 
+/**
+ * Default size of the cache of recent binlog events
+ */
+#define DEF_EVENT_CACHE_SIZE    "8388608" /* 8 MiB */
+
+/**
+ * Default size of the buffer that collects the events into larger writes
+ */
+#define DEF_WRITE_BUFFER_SIZE   "65536" /* 64 KiB */
+
+/**
+ * When the binlog file being written is synchronised to disk
+ */
+enum blr_binlog_sync
+{
+    BLR_SYNC_BATCH,     /*< After each batch of events read from the master */
+    BLR_SYNC_COMMIT,    /*< Before events are made available to the slaves */
+    BLR_SYNC_EVENTS,    /*< After a number of events */
+    BLR_SYNC_INTERVAL,  /*< After a number of milliseconds */
+    BLR_SYNC_NONE       /*< Only when the file is closed */
+};
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -345,16 +367,131 @@ typedef struct
     SPINLOCK        lock;           /*< The spinlock for the cache */
 } BLCACHE;
 
+/**
+ * The cache of the most recent binlog events written by the router. The events
+ * are stored in a ring buffer at the offset given by their position modulo the
+ * size of the buffer, so the cache holds a contiguous range of one binlog file.
+ * Slaves that read events from the range get them from the cache instead of
+ * the binlog file.
+ *
+ * The master thread adds the events and the lock protects only the range, so
+ * that the events can be copied without holding the lock.
+ */
+typedef struct
+{
+    uint8_t         *data;          /*< The ring buffer, NULL if disabled */
+    uint64_t        size;           /*< The size of the ring buffer */
+    char            binlogname[BINLOG_FNAMELEN + 1]; /*< The file of the cached events */
+    uint64_t        start;          /*< The position of the first cached event */
+    uint64_t        end;            /*< The position after the last cached event */
+    uint64_t        generation;     /*< Incremented when the cached range is reset */
+    uint64_t        n_hits;         /*< Events read from the cache */
+    uint64_t        n_misses;       /*< Events read from the binlog files */
+    SPINLOCK        lock;           /*< Protects the range */
+} BLR_EVENT_CACHE;
+
+/**
+ * A prebuilt response to a status query of the slaves, e.g. SHOW SLAVE STATUS.
+ * The column definitions of the response never change, so a query renders
+ * only the row and, if it is the same as the row of the cached response,
+ * sends a clone of the cached response with a single write. Otherwise the
+ * response is built again from the new row.
+ */
+typedef struct
+{
+    GWBUF           *response;      /*< The complete response, NULL until the first query */
+    size_t          row_offset;     /*< Offset of the row in the response */
+    size_t          row_len;        /*< Length of the row */
+    uint64_t        n_hits;         /*< Responses sent from the cache */
+    uint64_t        n_builds;       /*< Responses built because the row changed */
+    SPINLOCK        lock;           /*< Protects the response */
+} BLR_STATUS_RESPONSE;
+
+/**
+ * The buffer that collects the events written by the master thread into
+ * larger writes. The buffer is written to the binlog file before the events
+ * are made available to the slaves and after each batch of events.
+ */
+typedef struct
+{
+    uint8_t         *data;          /*< The buffered bytes, NULL if disabled */
+    uint64_t        size;           /*< The size of the buffer */
+    uint32_t        len;            /*< The number of buffered bytes */
+    uint64_t        pos;            /*< The file offset of the first buffered byte */
+} BLR_WRITE_BUFFER;
+
 typedef struct blfile
 {
     char            binlogname[BINLOG_FNAMELEN + 1]; /*< Name of the binlog file */
     int             fd;                             /*< Actual file descriptor */
     int             refcnt;                         /*< Reference count for file */
     BLCACHE         *cache;                         /*< Record cache for this file */
+    uint8_t         *map;                           /*< The mapping of a closed file */
+    uint64_t        map_len;                        /*< The length of the mapping */
+    bool            map_failed;                     /*< Mapping the file has failed */
+    uint64_t        *zindex;                        /*< The block offsets of a compressed
+                                                     *  file, NULL if not compressed */
+    uint64_t        zlen;                           /*< The uncompressed length of a
+                                                     *  compressed file */
+    uint64_t        state;                          /*< The binlog generation the file was
+                                                     *  checked in, shifted left by one,
+                                                     *  and 1 if it was being written */
     SPINLOCK        lock;                           /*< The file lock */
     struct blfile   *next;                          /*< Next file in list */
 } BLFILE;
 
+/**
+ * The sizes of the buffers a slave in catchup mode reads the binlog file and
+ * collects the packets in
+ */
+#define BLR_READ_AHEAD_SIZE     (64 * 1024)
+#define BLR_SEND_BATCH_SIZE     (64 * 1024)
+
+/**
+ * A MaxScale binlog server that replicates from another one can request the
+ * collected packets as compressed frames. The payload of a frame is the frame
+ * marker, the length of the packets in it, four bytes little-endian, and the
+ * packets compressed with zlib. The marker is never the first byte of an
+ * event, error or EOF packet. Small batches are not compressed.
+ */
+#define BLR_RELAY_FRAME         0xfc
+#define BLR_RELAY_FRAME_HDR_LEN 5
+#define BLR_RELAY_MIN_COMPRESS  512
+
+/**
+ * A compressed binlog file starts with a header that holds the magic, the block
+ * size, the uncompressed length of the file and the offset of the block index,
+ * all little-endian. The blocks are compressed with zlib one by one. The index
+ * at the end of the file has the offsets of the blocks and of the index itself.
+ */
+#define BLR_ZFILE_MAGIC         { 0xfe, 0x6d, 0x78, 0x7a }
+#define BLR_ZFILE_HDR_SIZE      (BINLOG_MAGIC_SIZE + 4 + 8 + 8)
+#define BLR_ZFILE_BLOCK_SIZE    BLR_READ_AHEAD_SIZE
+
+/** How often, in seconds, the closed binlog files are checked for compression */
+#define BLR_COMPRESS_FREQ       10
+
+/**
+ * The checkpoint file holds the name of the current binlog file, a safe
+ * position in it and the CRC32 of the data before that position. It is
+ * written at most once per interval, in microseconds.
+ */
+#define BLR_CHECKPOINT_FILE     "binlog.checkpoint"
+#define BLR_CHECKPOINT_INTERVAL 1000000
+#define BLR_CHECKPOINT_CRC_LEN  4096
+
+/**
+ * The binlog data read ahead by a slave in catchup mode. The data is valid
+ * only during one catchup burst.
+ */
+typedef struct
+{
+    uint8_t         *data;          /*< The data, NULL if not allocated */
+    uint32_t        len;            /*< The number of bytes read */
+    BLFILE          *file;          /*< The file the data was read from */
+    unsigned long   pos;            /*< The position of the first byte */
+} BLR_READ_BUFFER;
+
 /**
  * Slave statistics
  */
@@ -374,6 +511,8 @@ typedef struct
     int             n_failed_read;
     int             n_overrun;
     int             n_caughtup;
+    uint64_t        catchup_bytes;  /*< Bytes sent in catchup bursts */
+    uint64_t        catchup_time;   /*< Microseconds spent in catchup bursts */
     int             n_actions[3];
     uint64_t        lastsample;
     int             minno;
@@ -440,6 +579,12 @@ typedef struct router_slave
     char              lsi_binlog_name[BINLOG_FNAMELEN + 1]; /*< Which binlog file */
     uint32_t          lsi_binlog_pos; /*< What position */
     void              *encryption_ctx;      /*< Encryption context */
+    BLR_READ_BUFFER   read_buffer;  /*< Binlog data read ahead in catchup */
+    GWBUF             *batch;       /*< Packets collected for a single write */
+    uint32_t          batch_len;    /*< The length of the collected packets */
+    bool              batching;     /*< Whether packets are collected */
+    bool              relay_compression; /*< Send the collected packets compressed,
+                                          *  requested by a MaxScale binlog server */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -467,6 +612,19 @@ typedef struct
     time_t          lastReply;
     uint64_t        n_fakeevents;   /*< Fake events not written to disk */
     uint64_t        n_artificial;   /*< Artificial events not written to disk */
+    uint64_t        n_writes;       /*< Number of writes to the binlog files */
+    uint64_t        n_write_bytes;  /*< Number of bytes written to the binlog files */
+    uint64_t        n_syncs;        /*< Number of binlog file synchronisations */
+    uint64_t        sync_time;      /*< Total time of the synchronisations in microseconds */
+    uint64_t        max_sync_time;  /*< Longest synchronisation in microseconds */
+    uint64_t        n_relay_frames; /*< Compressed frames received from the master */
+    uint64_t        relay_in;       /*< Bytes in the compressed frames */
+    uint64_t        relay_out;      /*< Bytes in the packets of the compressed frames */
+    uint64_t        n_semisync_reqs; /*< Events that requested a Semi-Sync ACK */
+    uint64_t        n_semisync_acks; /*< Semi-Sync ACKs sent to the master */
+    uint64_t        n_compressed;   /*< Number of binlog files compressed */
+    uint64_t        compress_in;    /*< Bytes in the binlog files before compression */
+    uint64_t        compress_out;   /*< Bytes in the binlog files after compression */
     int             n_badcrc;       /*< No. of bad CRC's from master */
     uint64_t        events[MAX_EVENT_TYPE_END + 1]; /*< Per event counters */
     uint64_t        lastsample;
@@ -548,6 +706,8 @@ typedef struct router_instance
     /*< Name of the current binlog file */
     uint64_t                binlog_position;
     /*< last committed transaction position */
+    uint64_t                binlog_generation;
+    /*< Incremented whenever binlog_name changes */
     uint64_t                current_pos;
     /*< Current binlog position */
     int                     binlog_fd;      /*< File descriptor of the binlog
@@ -566,6 +726,20 @@ typedef struct router_instance
     unsigned int      short_burst;  /*< Short burst for slave catchup */
     unsigned int      long_burst;   /*< Long burst for slave catchup */
     unsigned long     burst_size;   /*< Maximum size of burst to send */
+    BLR_EVENT_CACHE   event_cache;  /*< The cache of recent binlog events */
+    BLR_STATUS_RESPONSE slave_status_response;  /*< The response to SHOW SLAVE STATUS */
+    BLR_STATUS_RESPONSE master_status_response; /*< The response to SHOW MASTER STATUS */
+    BLR_WRITE_BUFFER  write_buffer; /*< The buffer of events not yet written */
+    int               binlog_sync;  /*< When the binlog file is synchronised */
+    unsigned long     sync_events;  /*< Events between synchronisations */
+    unsigned long     sync_interval; /*< Milliseconds between synchronisations */
+    unsigned long     unsynced_events; /*< Events written since the last sync */
+    uint64_t          last_sync;    /*< When the binlog file was last synchronised */
+    bool              mmap_binlog;  /*< Read closed binlog files from a mapping */
+    bool              compress_binlog; /*< Compress the old binlog files */
+    bool              binlog_checkpoint; /*< Checkpoint the safe position */
+    uint64_t          checkpoint_pos; /*< The position of the latest checkpoint */
+    uint64_t          last_checkpoint; /*< When the latest checkpoint was written */
     unsigned long     heartbeat;    /*< Configured heartbeat value */
     ROUTER_STATS      stats;        /*< Statistics for this router */
     int               active_logs;
@@ -590,6 +764,10 @@ typedef struct router_instance
     char              *ssl_version;         /*< config TLS Version for Master SSL connection */
     bool              request_semi_sync;    /*< Request Semi-Sync replication to master */
     int               master_semi_sync;     /*< Semi-Sync replication status of master server */
+    uint64_t          semisync_ack_pos;     /*< Position of the pending Semi-Sync ACK, 0 if none */
+    bool              relay_compression;    /*< Request compressed frames from a MaxScale master */
+    bool              relay_continued;      /*< The next packet from the master continues an event */
+    char              semisync_ack_file[BINLOG_FNAMELEN + 1]; /*< Binlog file of the pending ACK */
     BINLOG_ENCRYPTION_SETUP encryption;     /*< Binlog encryption setup */
     void              *encryption_ctx;      /*< Encryption context */
     char              *set_slave_hostname;  /*< Send custom Hostname to Master */
@@ -753,16 +931,27 @@ extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 extern void blr_init_cache(ROUTER_INSTANCE *);
+extern void blr_free_cache(ROUTER_INSTANCE *);
+extern void blr_cache_reset(ROUTER_INSTANCE *);
+extern void blr_cache_add(ROUTER_INSTANCE *, uint64_t, const uint8_t *, uint32_t);
+extern GWBUF *blr_cache_read(ROUTER_INSTANCE *, const char *, uint64_t, REP_HEADER *);
 
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
-extern void blr_file_flush(ROUTER_INSTANCE *);
+extern int  blr_file_flush(ROUTER_INSTANCE *);
+extern int  blr_file_commit(ROUTER_INSTANCE *);
+extern int  blr_file_write_flush(ROUTER_INSTANCE *);
+extern void blr_init_write_buffer(ROUTER_INSTANCE *);
+extern uint64_t blr_clock_us();
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *,
-                              const SLAVE_ENCRYPTION_CTX *);
+                              const SLAVE_ENCRYPTION_CTX *, BLR_READ_BUFFER *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
 extern unsigned long blr_file_size(BLFILE *);
+extern bool blr_file_is_compressed(int fd);
+extern bool blr_file_read_checkpoint(ROUTER_INSTANCE *);
+extern void blr_compress_binlogs(void *);
 extern int blr_statistics(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_ping(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_send_custom_error(DCB *, int, int, char *, char *, unsigned int);
@@ -783,6 +972,8 @@ extern bool blr_send_event(blr_thread_role_t role,
                            ROUTER_SLAVE *slave,
                            REP_HEADER *hdr,
                            uint8_t *buf);
+extern void blr_slave_batch_start(ROUTER_SLAVE *);
+extern void blr_slave_batch_end(ROUTER_SLAVE *);
 
 extern const char *blr_get_encryption_algorithm(int);
 extern int blr_check_encryption_algorithm(char *);
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <maxscale/alloc.h>
 #include <maxscale/service.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -47,15 +48,245 @@
 
 #include <maxscale/log_manager.h>
 
+/**
+ * Copy bytes out of the ring buffer of the event cache.
+ *
+ * @param cache The event cache
+ * @param pos   The binlog position of the first byte
+ * @param dest  Where to copy the bytes
+ * @param len   The number of bytes, at most the size of the cache
+ */
+static void
+blr_cache_copy_out(const BLR_EVENT_CACHE *cache, uint64_t pos, uint8_t *dest, uint32_t len)
+{
+    uint64_t offset = pos % cache->size;
+    uint64_t n = cache->size - offset;
+
+    if (n > len)
+    {
+        n = len;
+    }
+
+    memcpy(dest, cache->data + offset, n);
+    memcpy(dest + n, cache->data, len - n);
+}
 
 /**
- * Initialise the cache for this instanceof the binlog router. As a side
- * effect also determine the binlog file to read and the position to read
- * from.
+ * Copy bytes into the ring buffer of the event cache.
+ *
+ * @param cache The event cache
+ * @param pos   The binlog position of the first byte
+ * @param src   The bytes to copy
+ * @param len   The number of bytes, at most the size of the cache
+ */
+static void
+blr_cache_copy_in(BLR_EVENT_CACHE *cache, uint64_t pos, const uint8_t *src, uint32_t len)
+{
+    uint64_t offset = pos % cache->size;
+    uint64_t n = cache->size - offset;
+
+    if (n > len)
+    {
+        n = len;
+    }
+
+    memcpy(cache->data + offset, src, n);
+    memcpy(cache->data, src + n, len - n);
+}
+
+/**
+ * Initialise the cache for this instance of the binlog router. The size of
+ * the cache has been set from the configuration and a size of zero disables
+ * the cache.
  *
  * @param   router      The router instance
  */
 void
 blr_init_cache(ROUTER_INSTANCE *router)
 {
+    BLR_EVENT_CACHE *cache = &router->event_cache;
+
+    if (cache->size > 0)
+    {
+        if ((cache->data = (uint8_t *)MXS_MALLOC(cache->size)) == NULL)
+        {
+            MXS_ERROR("%s: Failed to allocate the binlog event cache of %lu bytes, "
+                      "the slaves will read all events from the binlog files.",
+                      router->service->name, cache->size);
+        }
+    }
+}
+
+/**
+ * Free the cache of the binlog router instance.
+ *
+ * @param   router      The router instance
+ */
+void
+blr_free_cache(ROUTER_INSTANCE *router)
+{
+    MXS_FREE(router->event_cache.data);
+    router->event_cache.data = NULL;
+}
+
+/**
+ * Empty the cache. Called when the router starts writing another binlog file
+ * or writes at a position that does not follow the cached events.
+ *
+ * @param   router      The router instance
+ */
+void
+blr_cache_reset(ROUTER_INSTANCE *router)
+{
+    BLR_EVENT_CACHE *cache = &router->event_cache;
+
+    spinlock_acquire(&cache->lock);
+    strcpy(cache->binlogname, router->binlog_name);
+    cache->start = 0;
+    cache->end = 0;
+    cache->generation++;
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Add an event that has been written to the current binlog file into the
+ * cache. The oldest events are removed to make room for the event. Only
+ * the master thread adds events.
+ *
+ * @param   router      The router instance
+ * @param   pos         The position of the event in the binlog file
+ * @param   event       The event as it is, unencrypted
+ * @param   size        The size of the event
+ */
+void
+blr_cache_add(ROUTER_INSTANCE *router, uint64_t pos, const uint8_t *event, uint32_t size)
+{
+    BLR_EVENT_CACHE *cache = &router->event_cache;
+
+    if (cache->data == NULL)
+    {
+        return;
+    }
+
+    if (pos != cache->end || size > cache->size ||
+        strcmp(cache->binlogname, router->binlog_name) != 0)
+    {
+        spinlock_acquire(&cache->lock);
+        strcpy(cache->binlogname, router->binlog_name);
+        cache->start = pos;
+        cache->end = pos;
+        cache->generation++;
+        spinlock_release(&cache->lock);
+
+        if (size > cache->size)
+        {
+            return;
+        }
+    }
+
+    if (cache->end + size - cache->start > cache->size)
+    {
+        /** Remove the oldest events before their bytes are overwritten */
+        spinlock_acquire(&cache->lock);
+
+        while (cache->end + size - cache->start > cache->size)
+        {
+            uint8_t field[4];
+            blr_cache_copy_out(cache, cache->start + 9, field, sizeof(field));
+            uint32_t event_size = extract_field(field, 32);
+
+            if (event_size == 0 || cache->start + event_size > cache->end)
+            {
+                cache->start = pos;
+                cache->end = pos;
+                cache->generation++;
+                break;
+            }
+
+            cache->start += event_size;
+        }
+
+        spinlock_release(&cache->lock);
+    }
+
+    /** The readers do not access the bytes after the end of the range */
+    blr_cache_copy_in(cache, pos, event, size);
+
+    spinlock_acquire(&cache->lock);
+    cache->end = pos + size;
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Read an event from the cache. The event is copied without holding the lock
+ * and discarded if it was removed from the cache while it was being copied.
+ *
+ * @param   router      The router instance
+ * @param   binlog      The name of the binlog file
+ * @param   pos         The position of the event
+ * @param   hdr         The replication header to populate
+ * @return  The event, or NULL if it is not in the cache
+ */
+GWBUF *
+blr_cache_read(ROUTER_INSTANCE *router, const char *binlog, uint64_t pos, REP_HEADER *hdr)
+{
+    BLR_EVENT_CACHE *cache = &router->event_cache;
+    uint8_t hdbuf[BINLOG_EVENT_HDR_LEN];
+    uint32_t event_size = 0;
+    uint64_t generation = 0;
+    GWBUF *result = NULL;
+
+    if (cache->data == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&cache->lock);
+    if (strcmp(cache->binlogname, binlog) == 0 &&
+        pos >= cache->start &&
+        pos + BINLOG_EVENT_HDR_LEN <= cache->end)
+    {
+        blr_cache_copy_out(cache, pos, hdbuf, BINLOG_EVENT_HDR_LEN);
+        event_size = extract_field(&hdbuf[9], 32);
+        generation = cache->generation;
+
+        if (event_size < BINLOG_EVENT_HDR_LEN || pos + event_size > cache->end)
+        {
+            event_size = 0;
+        }
+    }
+    spinlock_release(&cache->lock);
+
+    if (event_size && (result = gwbuf_alloc(event_size)) != NULL)
+    {
+        blr_cache_copy_out(cache, pos, GWBUF_DATA(result), event_size);
+
+        spinlock_acquire(&cache->lock);
+        bool valid = cache->generation == generation && cache->start <= pos;
+        spinlock_release(&cache->lock);
+
+        if (!valid)
+        {
+            gwbuf_free(result);
+            result = NULL;
+        }
+    }
+
+    if (result)
+    {
+        hdr->timestamp = EXTRACT32(hdbuf);
+        hdr->event_type = hdbuf[4];
+        hdr->serverid = EXTRACT32(&hdbuf[5]);
+        hdr->event_size = event_size;
+        hdr->next_pos = EXTRACT32(&hdbuf[13]);
+        hdr->flags = EXTRACT16(&hdbuf[17]);
+
+        atomic_add_uint64(&cache->n_hits, 1);
+    }
+    else
+    {
+        atomic_add_uint64(&cache->n_misses, 1);
+    }
+
+    return result;
 }
@@ -57,9 +57,11 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 #include <maxscale/service.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -73,6 +75,7 @@
 #include <inttypes.h>
 #include <maxscale/secrets.h>
 #include <maxscale/encryption.h>
+#include <maxscale/platform.h>
 
 /**
  * AES_CTR handling
@@ -154,6 +157,26 @@ const EVP_CIPHER *(*ciphers[])(unsigned int) =
     aes_ecb
 };
 
+/**
+ * A cipher context of a thread. The context is initialised with a cipher and
+ * a key once and only the IV is set for each event, so that the context is not
+ * allocated and the key schedule not computed for every event.
+ */
+typedef struct
+{
+    EVP_CIPHER_CTX  *ctx;                           /*< The context, NULL if not allocated */
+    bool            ready;                          /*< Whether the context has a key */
+    int             algo;                           /*< The algorithm of the context */
+    int             action;                         /*< Encrypt or decrypt */
+    unsigned int    key_len;                        /*< The length of the key */
+    uint8_t         key[BINLOG_AES_MAX_KEY_LEN];    /*< The key of the context */
+} BLR_CIPHER_CTX;
+
+/** The contexts for decryption and encryption, indexed by the action */
+static thread_local BLR_CIPHER_CTX blr_crypt_ctx[2];
+/** The context for the last block of AES_CBC */
+static thread_local BLR_CIPHER_CTX blr_cbc_tail_ctx;
+
 #if OPENSSL_VERSION_NUMBER > 0x10000000L
 static const char *blr_encryption_algorithm_names[BINLOG_MAX_CRYPTO_SCHEME] = {"aes_cbc", "aes_ctr"};
 static const char blr_encryption_algorithm_list_names[] = "aes_cbc, aes_ctr";
@@ -163,7 +186,9 @@ static const char blr_encryption_algorithm_list_names[] = "aes_cbc";
 #endif
 
 static int  blr_file_create(ROUTER_INSTANCE *router, char *file);
+static int  blr_file_finish(ROUTER_INSTANCE *router);
 static void blr_log_header(int priority, char *msg, uint8_t *ptr);
+static bool blr_zfile_open(BLFILE *file);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
 int blr_file_get_next_binlogname(ROUTER_INSTANCE *router);
 int blr_file_new_binlog(ROUTER_INSTANCE *router, char *file);
@@ -404,6 +429,12 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
         return 0;
     }
 
+    /* The events of the current file must be written before it is closed */
+    if (!blr_file_finish(router))
+    {
+        return 0;
+    }
+
     int created = 0;
     char err_msg[MXS_STRERROR_BUFLEN];
 
@@ -421,6 +452,7 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
         {
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
+            atomic_add_uint64(&router->binlog_generation, 1);
             strcpy(router->binlog_name, file);
             router->binlog_fd = fd;
             router->current_pos = BINLOG_MAGIC_SIZE;     /* Initial position after the magic number */
@@ -429,6 +461,7 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->last_written = BINLOG_MAGIC_SIZE;
             spinlock_release(&router->binlog_lock);
 
+            blr_cache_reset(router);
             created = 1;
         }
         else
@@ -465,6 +498,11 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
     char path[PATH_MAX + 1] = "";
     int fd;
 
+    if (!blr_file_finish(router))
+    {
+        return;
+    }
+
     strcpy(path, router->binlogdir);
     strcat(path, "/");
     strcat(path, file);
@@ -478,6 +516,7 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
     fsync(fd);
     close(router->binlog_fd);
     spinlock_acquire(&router->binlog_lock);
+    atomic_add_uint64(&router->binlog_generation, 1);
     memmove(router->binlog_name, file, BINLOG_FNAMELEN);
     router->current_pos = lseek(fd, 0L, SEEK_END);
     if (router->current_pos < 4)
@@ -509,6 +548,329 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
     }
     router->binlog_fd = fd;
     spinlock_release(&router->binlog_lock);
+
+    blr_cache_reset(router);
+}
+
+/**
+ * Return the value of the monotonic clock in microseconds.
+ */
+uint64_t
+blr_clock_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Allocate the buffer that collects the events into larger writes. The size
+ * of the buffer has been set from the configuration and a size of zero
+ * disables the buffering.
+ *
+ * @param router The router instance
+ */
+void
+blr_init_write_buffer(ROUTER_INSTANCE *router)
+{
+    BLR_WRITE_BUFFER *buffer = &router->write_buffer;
+
+    buffer->len = 0;
+    buffer->pos = 0;
+
+    if (buffer->size > 0 &&
+        (buffer->data = (uint8_t *)MXS_MALLOC(buffer->size)) == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate the binlog write buffer of %lu bytes, "
+                  "the events will be written one at a time.",
+                  router->service->name, buffer->size);
+        buffer->size = 0;
+    }
+}
+
+/**
+ * Write the buffered events to the binlog file. If the write fails, the file
+ * is truncated to the last safe position and the router continues from it,
+ * as the buffered events have not been made available to the slaves.
+ *
+ * @param router The router instance
+ * @return       1 on success, 0 if the events could not be written
+ */
+int
+blr_file_write_flush(ROUTER_INSTANCE *router)
+{
+    BLR_WRITE_BUFFER *buffer = &router->write_buffer;
+
+    if (buffer->len == 0)
+    {
+        return 1;
+    }
+
+    ssize_t n = pwrite(router->binlog_fd, buffer->data, buffer->len, buffer->pos);
+
+    if (n != buffer->len)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to write %u bytes of binlog records at %lu of %s, %s. "
+                  "Truncating to previous safe position %lu.",
+                  router->service->name, buffer->len, buffer->pos,
+                  router->binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)),
+                  router->binlog_position);
+
+        buffer->len = 0;
+
+        if (ftruncate(router->binlog_fd, router->binlog_position))
+        {
+            MXS_ERROR("%s: Failed to truncate binlog file %s at %lu, %s. ",
+                      router->service->name, router->binlog_name,
+                      router->binlog_position,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+
+        /* Request the lost events again from the master */
+        spinlock_acquire(&router->binlog_lock);
+        router->current_pos = router->binlog_position;
+        router->last_written = router->binlog_position;
+        router->pending_transaction = 0;
+        spinlock_release(&router->binlog_lock);
+
+        return 0;
+    }
+
+    router->stats.n_writes++;
+    router->stats.n_write_bytes += n;
+    buffer->len = 0;
+
+    return 1;
+}
+
+/**
+ * Write data at the end of the binlog file being written. The data is
+ * buffered if it fits in the write buffer.
+ *
+ * @param router The router instance
+ * @param data   The data to write
+ * @param size   The size of the data
+ * @return       The number of bytes written, or -1 on error
+ */
+static int
+blr_file_write(ROUTER_INSTANCE *router, const uint8_t *data, uint32_t size)
+{
+    BLR_WRITE_BUFFER *buffer = &router->write_buffer;
+
+    if (buffer->len > 0 &&
+        (buffer->pos + buffer->len != router->last_written ||
+         buffer->len + size > buffer->size))
+    {
+        if (!blr_file_write_flush(router))
+        {
+            return -1;
+        }
+    }
+
+    router->unsynced_events++;
+
+    if (buffer->data && size <= buffer->size)
+    {
+        if (buffer->len == 0)
+        {
+            buffer->pos = router->last_written;
+        }
+
+        memcpy(buffer->data + buffer->len, data, size);
+        buffer->len += size;
+        return size;
+    }
+
+    int n = pwrite(router->binlog_fd, data, size, router->last_written);
+
+    if (n > 0)
+    {
+        router->stats.n_writes++;
+        router->stats.n_write_bytes += n;
+    }
+
+    return n;
+}
+
+/**
+ * Synchronise the binlog file being written to disk.
+ *
+ * @param router The router instance
+ */
+static void
+blr_file_sync(ROUTER_INSTANCE *router)
+{
+    uint64_t start = blr_clock_us();
+
+    fsync(router->binlog_fd);
+
+    uint64_t now = blr_clock_us();
+    uint64_t duration = now - start;
+
+    router->stats.n_syncs++;
+    router->stats.sync_time += duration;
+
+    if (duration > router->stats.max_sync_time)
+    {
+        router->stats.max_sync_time = duration;
+    }
+
+    router->last_sync = now;
+    router->unsynced_events = 0;
+}
+
+/**
+ * Calculate the CRC32 of the data before a position of the binlog file being
+ * written. It identifies the data up to the position in a checkpoint.
+ *
+ * @param router    The router instance
+ * @param pos       The position
+ * @param crc       The calculated CRC32
+ * @return          True if the data could be read
+ */
+static bool
+blr_file_checkpoint_crc(ROUTER_INSTANCE *router, uint64_t pos, unsigned long *crc)
+{
+    uint8_t buf[BLR_CHECKPOINT_CRC_LEN];
+    uint64_t start = pos > BLR_CHECKPOINT_CRC_LEN ? pos - BLR_CHECKPOINT_CRC_LEN : 0;
+    size_t len = pos - start;
+
+    if (pread(router->binlog_fd, buf, len, start) != (ssize_t)len)
+    {
+        return false;
+    }
+
+    *crc = crc32(crc32(0L, NULL, 0), buf, len);
+    return true;
+}
+
+/**
+ * Write a checkpoint of the safe position in the binlog file being written.
+ *
+ * With transaction safety the safe position is always at the end of a
+ * transaction, so the binlog check at startup can continue from the checkpoint
+ * without losing track of a partial transaction. The file is written at most
+ * once per interval.
+ *
+ * @param router    The router instance
+ */
+static void
+blr_file_write_checkpoint(ROUTER_INSTANCE *router)
+{
+    uint64_t now = blr_clock_us();
+    uint64_t pos = router->binlog_position;
+    unsigned long crc;
+
+    if (pos == router->checkpoint_pos || pos <= BINLOG_MAGIC_SIZE ||
+        now - router->last_checkpoint < BLR_CHECKPOINT_INTERVAL ||
+        !blr_file_checkpoint_crc(router, pos, &crc))
+    {
+        return;
+    }
+
+    char path[PATH_MAX + 1];
+    char tmp[PATH_MAX + 1];
+    snprintf(path, sizeof(path), "%s/%s", router->binlogdir, BLR_CHECKPOINT_FILE);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *file = fopen(tmp, "w");
+    bool ok = file != NULL;
+
+    if (ok)
+    {
+        ok = fprintf(file, "%s %lu %lx\n", router->binlog_name, pos, crc) > 0;
+        ok = fclose(file) == 0 && ok && rename(tmp, path) == 0;
+    }
+
+    if (ok)
+    {
+        router->checkpoint_pos = pos;
+    }
+    else
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to write binlog checkpoint %s: %d, %s",
+                  router->service->name, path, errno,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+    }
+
+    router->last_checkpoint = now;
+}
+
+/**
+ * Read the checkpoint of the binlog file being written. The checkpoint is used
+ * only if it is in the current binlog file and the data before it has not
+ * changed since it was written.
+ *
+ * @param router    The router instance
+ * @return          True if router->checkpoint_pos was set to a valid checkpoint
+ */
+bool
+blr_file_read_checkpoint(ROUTER_INSTANCE *router)
+{
+    char path[PATH_MAX + 1];
+    char name[BINLOG_FNAMELEN + 1] = "";
+    unsigned long pos = 0;
+    unsigned long crc = 0;
+    unsigned long file_crc;
+    struct stat statb;
+    bool ok = false;
+
+    router->checkpoint_pos = 0;
+    snprintf(path, sizeof(path), "%s/%s", router->binlogdir, BLR_CHECKPOINT_FILE);
+
+    FILE *file = fopen(path, "r");
+
+    if (file)
+    {
+        char fmt[32];
+        snprintf(fmt, sizeof(fmt), "%%%ds %%lu %%lx", BINLOG_FNAMELEN);
+        ok = fscanf(file, fmt, name, &pos, &crc) == 3;
+        fclose(file);
+    }
+
+    if (ok)
+    {
+        ok = strcmp(name, router->binlog_name) == 0 &&
+             fstat(router->binlog_fd, &statb) == 0 &&
+             pos > BINLOG_MAGIC_SIZE && pos <= (unsigned long)statb.st_size &&
+             blr_file_checkpoint_crc(router, pos, &file_crc) && file_crc == crc;
+
+        if (ok)
+        {
+            router->checkpoint_pos = pos;
+        }
+        else
+        {
+            MXS_WARNING("%s: Binlog checkpoint at %lu in '%s' does not match binlog file "
+                        "'%s', checking all of the file.", router->service->name,
+                        pos, name, router->binlog_name);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Write the buffered events and synchronise the binlog file being written
+ * before it is closed.
+ *
+ * @param router The router instance
+ * @return       1 on success, 0 if the events could not be written
+ */
+static int
+blr_file_finish(ROUTER_INSTANCE *router)
+{
+    int rval = blr_file_write_flush(router);
+
+    if (router->binlog_sync != BLR_SYNC_NONE && router->unsynced_events > 0)
+    {
+        blr_file_sync(router);
+    }
+
+    return rval;
 }
 
 /**
@@ -548,6 +910,8 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
         n = hole_size;
     }
 
+    uint64_t write_pos = router->last_written;
+
     if (router->encryption.enabled && router->encryption_ctx != NULL)
     {
         GWBUF *encrypted;
@@ -564,7 +928,7 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
 
         encr_ptr = GWBUF_DATA(encrypted);
 
-        n = pwrite(router->binlog_fd, encr_ptr, size, router->last_written);
+        n = blr_file_write(router, encr_ptr, size);
 
         gwbuf_free(encrypted);
         encrypted = NULL;
@@ -572,7 +936,7 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     else
     {
         /* Write current received event form master */
-        n = pwrite(router->binlog_fd, buf, size, router->last_written);
+        n = blr_file_write(router, buf, size);
     }
 
     /* Check write operation result*/
@@ -602,6 +966,9 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     router->last_event_pos = hdr->next_pos - hdr->event_size;
     spinlock_release(&router->binlog_lock);
 
+    /* Keep the unencrypted event for the slaves */
+    blr_cache_add(router, write_pos, buf, size);
+
     /* Check whether adding the Start Encryption event into current binlog */
     if (router->encryption.enabled && write_start_encryption_event)
     {
@@ -623,90 +990,425 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
         n = event_size;
     }
 
-    return n;
+    return n;
+}
+
+/**
+ * Write the buffered events after a batch of events has been received from
+ * the master and synchronise the binlog file according to the sync policy.
+ *
+ * @param   router  The binlog router
+ * @return  1 on success, 0 if the events could not be written
+ */
+int
+blr_file_flush(ROUTER_INSTANCE *router)
+{
+    int rval = blr_file_write_flush(router);
+    bool sync = false;
+
+    if (router->unsynced_events > 0)
+    {
+        switch (router->binlog_sync)
+        {
+        case BLR_SYNC_BATCH:
+            sync = true;
+            break;
+
+        case BLR_SYNC_EVENTS:
+            sync = router->unsynced_events >= router->sync_events;
+            break;
+
+        case BLR_SYNC_INTERVAL:
+            sync = blr_clock_us() - router->last_sync >= router->sync_interval * 1000;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (sync)
+    {
+        blr_file_sync(router);
+    }
+
+    if (rval && router->binlog_checkpoint)
+    {
+        blr_file_write_checkpoint(router);
+    }
+
+    return rval;
+}
+
+/**
+ * Write the buffered events before they are made available to the slaves
+ * and synchronise the binlog file if the sync policy requires it.
+ *
+ * @param   router  The binlog router
+ * @return  1 on success, 0 if the events could not be written
+ */
+int
+blr_file_commit(ROUTER_INSTANCE *router)
+{
+    int rval = blr_file_write_flush(router);
+
+    if (rval && router->binlog_sync == BLR_SYNC_COMMIT && router->unsynced_events > 0)
+    {
+        blr_file_sync(router);
+    }
+
+    return rval;
+}
+
+/**
+ * Open a binlog file for reading binlog records
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog filename
+ * @return a binlog file record
+ */
+BLFILE *
+blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
+{
+    size_t len = strlen(binlog);
+    if (len > BINLOG_FNAMELEN)
+    {
+        MXS_ERROR("The binlog filename %s is longer than the maximum allowed length %d.",
+                  binlog, BINLOG_FNAMELEN);
+        return NULL;
+    }
+
+    len += (strlen(router->binlogdir) + 1); // +1 for the /.
+    if (len > PATH_MAX)
+    {
+        MXS_ERROR("The length of %s/%s is longer than the maximum allowed length %d.",
+                  router->binlogdir, binlog, PATH_MAX);
+        return NULL;
+    }
+
+    char path[PATH_MAX + 1] = "";
+    BLFILE *file;
+
+    spinlock_acquire(&router->fileslock);
+    file = router->files;
+    while (file && strcmp(file->binlogname, binlog) != 0)
+    {
+        file = file->next;
+    }
+
+    if (file)
+    {
+        file->refcnt++;
+        spinlock_release(&router->fileslock);
+        return file;
+    }
+
+    if ((file = (BLFILE *)MXS_CALLOC(1, sizeof(BLFILE))) == NULL)
+    {
+        spinlock_release(&router->fileslock);
+        return NULL;
+    }
+    strcpy(file->binlogname, binlog);
+    file->refcnt = 1;
+    file->cache = 0;
+    spinlock_init(&file->lock);
+
+    strcpy(path, router->binlogdir);
+    strcat(path, "/");
+    strcat(path, binlog);
+
+    if ((file->fd = open(path, O_RDONLY, 0666)) == -1)
+    {
+        MXS_ERROR("Failed to open binlog file %s", path);
+        MXS_FREE(file);
+        spinlock_release(&router->fileslock);
+        return NULL;
+    }
+
+    if (blr_file_is_compressed(file->fd) && !blr_zfile_open(file))
+    {
+        MXS_ERROR("Failed to read the block index of compressed binlog file %s", path);
+        close(file->fd);
+        MXS_FREE(file);
+        spinlock_release(&router->fileslock);
+        return NULL;
+    }
+
+    file->next = router->files;
+    router->files = file;
+    spinlock_release(&router->fileslock);
+
+    return file;
+}
+
+/**
+ * Map a closed binlog file into memory. The file lock must be held.
+ *
+ * A closed file no longer grows, so the mapping covers all of it. If the
+ * mapping fails, the file is read normally and mapping is not tried again.
+ *
+ * @param file      File record
+ * @param filelen   The length of the file
+ */
+static void
+blr_file_map(BLFILE *file, unsigned long filelen)
+{
+    void *map = filelen > 0 ? mmap(NULL, filelen, PROT_READ, MAP_SHARED, file->fd, 0) : MAP_FAILED;
+
+    if (map != MAP_FAILED)
+    {
+        madvise(map, filelen, MADV_SEQUENTIAL);
+        file->map = (uint8_t *)map;
+        file->map_len = filelen;
+    }
+    else
+    {
+        if (filelen > 0)
+        {
+            char err_msg[MXS_STRERROR_BUFLEN];
+            MXS_WARNING("Failed to map binlog file %s into memory, reading it instead: %d, %s",
+                        file->binlogname, errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+        file->map_failed = true;
+    }
+}
+
+/**
+ * Check whether a binlog file is compressed
+ *
+ * @param fd    The binlog file
+ * @return      True if the file starts with the magic of a compressed file
+ */
+bool
+blr_file_is_compressed(int fd)
+{
+    uint8_t magic[] = BLR_ZFILE_MAGIC;
+    uint8_t buf[BINLOG_MAGIC_SIZE];
+
+    return pread(fd, buf, BINLOG_MAGIC_SIZE, 0) == BINLOG_MAGIC_SIZE &&
+           memcmp(buf, magic, BINLOG_MAGIC_SIZE) == 0;
+}
+
+/**
+ * Read the block index of a compressed binlog file
+ *
+ * @param file  File record of a compressed file
+ * @return      True if the index was read
+ */
+static bool
+blr_zfile_open(BLFILE *file)
+{
+    uint8_t hdr[BLR_ZFILE_HDR_SIZE];
+
+    if (pread(file->fd, hdr, BLR_ZFILE_HDR_SIZE, 0) != BLR_ZFILE_HDR_SIZE ||
+        gw_mysql_get_byte4(hdr + BINLOG_MAGIC_SIZE) != BLR_ZFILE_BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    uint64_t len = gw_mysql_get_byte8(hdr + BINLOG_MAGIC_SIZE + 4);
+    uint64_t index_pos = gw_mysql_get_byte8(hdr + BINLOG_MAGIC_SIZE + 12);
+    uint64_t n_blocks = (len + BLR_ZFILE_BLOCK_SIZE - 1) / BLR_ZFILE_BLOCK_SIZE;
+    size_t size = (n_blocks + 1) * 8;
+    uint8_t *buf = (uint8_t *)MXS_MALLOC(size);
+    uint64_t *index = (uint64_t *)MXS_MALLOC((n_blocks + 1) * sizeof(uint64_t));
+    bool ok = false;
+
+    if (buf && index && pread(file->fd, buf, size, index_pos) == (ssize_t)size)
+    {
+        ok = true;
+
+        for (uint64_t i = 0; i <= n_blocks; i++)
+        {
+            index[i] = gw_mysql_get_byte8(buf + i * 8);
+
+            if (i > 0 && index[i] < index[i - 1])
+            {
+                ok = false;
+            }
+        }
+    }
+
+    MXS_FREE(buf);
+
+    if (ok && index[n_blocks] == index_pos)
+    {
+        file->zindex = index;
+        file->zlen = len;
+    }
+    else
+    {
+        MXS_FREE(index);
+        ok = false;
+    }
+
+    return ok;
 }
 
 /**
- * Flush the content of the binlog file to disk.
+ * Decompress one block of a compressed binlog file into a read buffer
  *
- * @param   router  The binlog router
+ * @param file  File record of a compressed file
+ * @param block The number of the block
+ * @param rbuf  The read buffer
+ * @return      True if the block was decompressed
  */
-void
-blr_file_flush(ROUTER_INSTANCE *router)
+static bool
+blr_zfile_read_block(BLFILE *file, uint64_t block, BLR_READ_BUFFER *rbuf)
 {
-    fsync(router->binlog_fd);
+    uint64_t start = file->zindex[block];
+    size_t clen = file->zindex[block + 1] - start;
+    uLongf len = MXS_MIN(BLR_ZFILE_BLOCK_SIZE, file->zlen - block * BLR_ZFILE_BLOCK_SIZE);
+    uint8_t *cbuf = (uint8_t *)MXS_MALLOC(clen);
+    bool ok = false;
+
+    rbuf->file = NULL;
+    rbuf->len = 0;
+
+    if (rbuf->data == NULL)
+    {
+        rbuf->data = (uint8_t *)MXS_MALLOC(BLR_ZFILE_BLOCK_SIZE);
+    }
+
+    if (cbuf && rbuf->data && pread(file->fd, cbuf, clen, start) == (ssize_t)clen)
+    {
+        uLongf dlen = BLR_ZFILE_BLOCK_SIZE;
+
+        if (uncompress(rbuf->data, &dlen, cbuf, clen) == Z_OK && dlen == len)
+        {
+            rbuf->file = file;
+            rbuf->pos = block * BLR_ZFILE_BLOCK_SIZE;
+            rbuf->len = len;
+            ok = true;
+        }
+        else
+        {
+            MXS_ERROR("Failed to decompress block %lu of binlog file %s.",
+                      block, file->binlogname);
+        }
+    }
+
+    MXS_FREE(cbuf);
+    return ok;
 }
 
 /**
- * Open a binlog file for reading binlog records
+ * Read data from a compressed binlog file. The blocks that hold the data are
+ * decompressed into the read buffer, where the following reads find them.
  *
- * @param router    The router instance
- * @param binlog    The binlog filename
- * @return a binlog file record
+ * @param file      File record of a compressed file
+ * @param dest      Where to read the data
+ * @param len       The number of bytes to read
+ * @param pos       The position of the data in the uncompressed file
+ * @param rbuf      The read buffer, or NULL
+ * @return          The number of bytes read or -1 on error, as with pread()
  */
-BLFILE *
-blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
+static int
+blr_zfile_pread(BLFILE *file, uint8_t *dest, uint32_t len, unsigned long pos,
+                BLR_READ_BUFFER *rbuf)
 {
-    size_t len = strlen(binlog);
-    if (len > BINLOG_FNAMELEN)
+    BLR_READ_BUFFER tmp = {NULL, 0, NULL, 0};
+    int n = 0;
+
+    if (rbuf == NULL)
     {
-        MXS_ERROR("The binlog filename %s is longer than the maximum allowed length %d.",
-                  binlog, BINLOG_FNAMELEN);
-        return NULL;
+        rbuf = &tmp;
     }
 
-    len += (strlen(router->binlogdir) + 1); // +1 for the /.
-    if (len > PATH_MAX)
+    while ((uint32_t)n < len && pos < file->zlen)
     {
-        MXS_ERROR("The length of %s/%s is longer than the maximum allowed length %d.",
-                  router->binlogdir, binlog, PATH_MAX);
-        return NULL;
+        if (rbuf->file != file || pos < rbuf->pos || pos >= rbuf->pos + rbuf->len)
+        {
+            if (!blr_zfile_read_block(file, pos / BLR_ZFILE_BLOCK_SIZE, rbuf))
+            {
+                errno = EIO;
+                n = -1;
+                break;
+            }
+        }
+
+        uint32_t avail = rbuf->pos + rbuf->len - pos;
+        uint32_t chunk = MXS_MIN(len - n, avail);
+
+        memcpy(dest + n, rbuf->data + (pos - rbuf->pos), chunk);
+        n += chunk;
+        pos += chunk;
     }
 
-    char path[PATH_MAX + 1] = "";
-    BLFILE *file;
+    MXS_FREE(tmp.data);
 
-    spinlock_acquire(&router->fileslock);
-    file = router->files;
-    while (file && strcmp(file->binlogname, binlog) != 0)
+    return n;
+}
+
+/**
+ * Read data from a binlog file. The data of a mapped file is copied from the
+ * mapping. With a read buffer, a larger block of data is read at once and the
+ * following reads are served from it.
+ *
+ * @param file      File record
+ * @param dest      Where to read the data
+ * @param len       The number of bytes to read
+ * @param pos       The position of the data
+ * @param safe_end  The end of the data that can be read ahead
+ * @param rbuf      The read buffer, or NULL
+ * @param mapped    Whether the mapping of the file can be used
+ * @return          The number of bytes read or -1 on error, as with pread()
+ */
+static int
+blr_file_pread(BLFILE *file, uint8_t *dest, uint32_t len, unsigned long pos,
+               unsigned long safe_end, BLR_READ_BUFFER *rbuf, bool mapped)
+{
+    if (file->zindex)
     {
-        file = file->next;
+        return blr_zfile_pread(file, dest, len, pos, rbuf);
     }
 
-    if (file)
+    if (mapped && pos + len <= file->map_len)
     {
-        file->refcnt++;
-        spinlock_release(&router->fileslock);
-        return file;
+        memcpy(dest, file->map + pos, len);
+        return len;
     }
 
-    if ((file = (BLFILE *)MXS_CALLOC(1, sizeof(BLFILE))) == NULL)
+    if (rbuf == NULL || len > BLR_READ_AHEAD_SIZE)
     {
-        spinlock_release(&router->fileslock);
-        return NULL;
+        return pread(file->fd, dest, len, pos);
     }
-    strcpy(file->binlogname, binlog);
-    file->refcnt = 1;
-    file->cache = 0;
-    spinlock_init(&file->lock);
 
-    strcpy(path, router->binlogdir);
-    strcat(path, "/");
-    strcat(path, binlog);
-
-    if ((file->fd = open(path, O_RDONLY, 0666)) == -1)
+    if (rbuf->file != file || pos < rbuf->pos || pos + len > rbuf->pos + rbuf->len)
     {
-        MXS_ERROR("Failed to open binlog file %s", path);
-        MXS_FREE(file);
-        spinlock_release(&router->fileslock);
-        return NULL;
+        uint32_t n = BLR_READ_AHEAD_SIZE;
+
+        if (pos + n > safe_end)
+        {
+            n = safe_end > pos ? safe_end - pos : 0;
+        }
+
+        rbuf->file = NULL;
+        rbuf->len = 0;
+
+        if (n < len ||
+            (rbuf->data == NULL &&
+             (rbuf->data = (uint8_t *)MXS_MALLOC(BLR_READ_AHEAD_SIZE)) == NULL))
+        {
+            return pread(file->fd, dest, len, pos);
+        }
+
+        ssize_t rc = pread(file->fd, rbuf->data, n, pos);
+
+        if (rc < (ssize_t)len)
+        {
+            /** Let the caller handle the short read or the error */
+            return pread(file->fd, dest, len, pos);
+        }
+
+        rbuf->file = file;
+        rbuf->pos = pos;
+        rbuf->len = rc;
     }
 
-    file->next = router->files;
-    router->files = file;
-    spinlock_release(&router->fileslock);
+    memcpy(dest, rbuf->data + (pos - rbuf->pos), len);
 
-    return file;
+    return len;
 }
 
 /**
@@ -718,6 +1420,7 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
  * @param hdr       Binlog header to populate
  * @param errmsg    Allocated BINLOG_ERROR_MSG_LEN bytes message error buffer
  * @param enc_ctx   Encryption context for binlog file being read
+ * @param rbuf      Buffer for reading ahead, or NULL
  * @return          The binlog record wrapped in a GWBUF structure
  */
 GWBUF *
@@ -726,7 +1429,8 @@ blr_read_binlog(ROUTER_INSTANCE *router,
                 unsigned long pos,
                 REP_HEADER *hdr,
                 char *errmsg,
-                const SLAVE_ENCRYPTION_CTX *enc_ctx)
+                const SLAVE_ENCRYPTION_CTX *enc_ctx,
+                BLR_READ_BUFFER *rbuf)
 {
     uint8_t hdbuf[BINLOG_EVENT_HDR_LEN];
     GWBUF *result;
@@ -748,7 +1452,11 @@ blr_read_binlog(ROUTER_INSTANCE *router,
     }
 
     spinlock_acquire(&file->lock);
-    if (fstat(file->fd, &statb) == 0)
+    if (file->zindex)
+    {
+        filelen = file->zlen;
+    }
+    else if (fstat(file->fd, &statb) == 0)
     {
         filelen = statb.st_size;
     }
@@ -793,17 +1501,37 @@ blr_read_binlog(ROUTER_INSTANCE *router,
         return NULL;
     }
 
-    spinlock_acquire(&router->binlog_lock);
-    spinlock_acquire(&file->lock);
+    /*
+     * Whether the file is the one being written changes only when the router
+     * moves to another binlog file, so it is checked under the locks once per
+     * binlog file. Otherwise only the tail position is loaded, without locks.
+     */
+    uint64_t generation = atomic_load_uint64(&router->binlog_generation);
+    uint64_t state = atomic_load_uint64(&file->state);
+
+    if ((state >> 1) != generation)
+    {
+        spinlock_acquire(&router->binlog_lock);
+        spinlock_acquire(&file->lock);
+
+        generation = router->binlog_generation;
+        state = (generation << 1) | (strcmp(router->binlog_name, file->binlogname) == 0);
+        atomic_store_uint64(&file->state, state);
+
+        spinlock_release(&file->lock);
+        spinlock_release(&router->binlog_lock);
+    }
 
-    if (strcmp(router->binlog_name, file->binlogname) == 0 &&
-        pos >= router->binlog_position)
+    bool closed = (state & 1) == 0;
+    unsigned long tail = atomic_load_uint64(&router->binlog_position);
+
+    if (!closed && pos >= tail)
     {
-        if (pos > router->binlog_position)
+        if (pos > tail)
         {
             snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Requested binlog position %lu is unsafe. "
                      "Latest safe position %lu, end of binlog file %lu",
-                     pos, router->binlog_position, router->current_pos);
+                     pos, tail, (unsigned long)atomic_load_uint64(&router->current_pos));
 
             hdr->ok = SLAVE_POS_READ_UNSAFE;
         }
@@ -813,17 +1541,49 @@ blr_read_binlog(ROUTER_INSTANCE *router,
             hdr->ok = SLAVE_POS_READ_OK;
         }
 
-        spinlock_release(&file->lock);
-        spinlock_release(&router->binlog_lock);
-
         return NULL;
     }
 
-    spinlock_release(&file->lock);
-    spinlock_release(&router->binlog_lock);
+    /* Only complete events are read ahead */
+    unsigned long safe_end = filelen;
+
+    if (!closed && tail < safe_end)
+    {
+        safe_end = tail;
+    }
+
+    /* Closed files are read from a mapping, the current one never */
+    bool mapped = false;
+
+    if (closed && router->mmap_binlog && file->zindex == NULL)
+    {
+        spinlock_acquire(&file->lock);
+
+        if (file->map == NULL && !file->map_failed)
+        {
+            blr_file_map(file, filelen);
+        }
+
+        mapped = file->map != NULL;
+        spinlock_release(&file->lock);
+    }
+
+    /* Recent events are read from the cache, unencrypted */
+    if ((result = blr_cache_read(router, file->binlogname, pos, hdr)) != NULL)
+    {
+        if (!blr_binlog_event_check(router, pos, hdr, file->binlogname, errmsg))
+        {
+            gwbuf_free(result);
+            return NULL;
+        }
+
+        hdr->ok = SLAVE_POS_READ_OK;
+        return result;
+    }
 
     /* Read the header information from the file */
-    if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+    if ((n = blr_file_pread(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos, safe_end, rbuf, mapped)) !=
+        BINLOG_EVENT_HDR_LEN)
     {
         switch (n)
         {
@@ -887,7 +1647,8 @@ blr_read_binlog(ROUTER_INSTANCE *router,
                       pos, file->binlogname, filelen, router->binlog_position,
                       router->binlog_name);
 
-            if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+            if ((n = blr_file_pread(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos, safe_end, NULL, mapped)) !=
+                BINLOG_EVENT_HDR_LEN)
             {
                 switch (n)
                 {
@@ -967,8 +1728,8 @@ blr_read_binlog(ROUTER_INSTANCE *router,
 
     memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);  // Copy the header in the buffer
 
-    if ((n = pread(file->fd, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                   pos + BINLOG_EVENT_HDR_LEN))
+    if ((n = blr_file_pread(file, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
+                            pos + BINLOG_EVENT_HDR_LEN, safe_end, rbuf, mapped))
         != hdr->event_size - BINLOG_EVENT_HDR_LEN)  // Read the balance
     {
         if (n ==  0)
@@ -1109,8 +1870,13 @@ blr_close_binlog(ROUTER_INSTANCE *router, BLFILE *file)
 
     if (file)
     {
+        if (file->map)
+        {
+            munmap(file->map, file->map_len);
+        }
         close(file->fd);
         file->fd = -1;
+        MXS_FREE(file->zindex);
         MXS_FREE(file);
     }
 }
@@ -1148,6 +1914,11 @@ blr_file_size(BLFILE *file)
 {
     struct stat statb;
 
+    if (file->zindex)
+    {
+        return file->zlen;
+    }
+
     if (fstat(file->fd, &statb) == 0)
     {
         return statb.st_size;
@@ -1155,6 +1926,173 @@ blr_file_size(BLFILE *file)
     return 0;
 }
 
+/**
+ * Compress a closed binlog file
+ *
+ * The compressed file is written next to the binlog file and renamed over it
+ * when complete. The slaves that have the binlog file open keep reading the
+ * uncompressed file until they close it.
+ *
+ * @param router    The router instance
+ * @param path      The path of the binlog file
+ * @param fd        The binlog file, open for reading
+ * @return          True if the file was compressed
+ */
+static bool
+blr_file_compress(ROUTER_INSTANCE *router, const char *path, int fd)
+{
+    char tmp[PATH_MAX + 1];
+    struct stat statb;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    if (fstat(fd, &statb) != 0)
+    {
+        return false;
+    }
+
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (out == -1)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to create %s: %d, %s",
+                  tmp, errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    uint64_t len = statb.st_size;
+    uint64_t n_blocks = (len + BLR_ZFILE_BLOCK_SIZE - 1) / BLR_ZFILE_BLOCK_SIZE;
+    uLong bound = compressBound(BLR_ZFILE_BLOCK_SIZE);
+    uint8_t *data = (uint8_t *)MXS_MALLOC(BLR_ZFILE_BLOCK_SIZE);
+    uint8_t *cdata = (uint8_t *)MXS_MALLOC(bound);
+    uint8_t *index = (uint8_t *)MXS_MALLOC((n_blocks + 1) * 8);
+    uint64_t pos = BLR_ZFILE_HDR_SIZE;
+    bool ok = data && cdata && index;
+
+    for (uint64_t i = 0; ok && i < n_blocks; i++)
+    {
+        size_t n = MXS_MIN(BLR_ZFILE_BLOCK_SIZE, len - i * BLR_ZFILE_BLOCK_SIZE);
+        uLongf clen = bound;
+
+        ok = pread(fd, data, n, i * BLR_ZFILE_BLOCK_SIZE) == (ssize_t)n &&
+             compress2(cdata, &clen, data, n, Z_DEFAULT_COMPRESSION) == Z_OK &&
+             pwrite(out, cdata, clen, pos) == (ssize_t)clen;
+
+        gw_mysql_set_byte4(index + i * 8, pos);
+        gw_mysql_set_byte4(index + i * 8 + 4, pos >> 32);
+        pos += clen;
+    }
+
+    if (ok)
+    {
+        uint8_t hdr[BLR_ZFILE_HDR_SIZE] = BLR_ZFILE_MAGIC;
+        uint8_t *ptr = hdr + BINLOG_MAGIC_SIZE;
+
+        gw_mysql_set_byte4(index + n_blocks * 8, pos);
+        gw_mysql_set_byte4(index + n_blocks * 8 + 4, pos >> 32);
+
+        gw_mysql_set_byte4(ptr, BLR_ZFILE_BLOCK_SIZE);
+        gw_mysql_set_byte4(ptr + 4, len);
+        gw_mysql_set_byte4(ptr + 8, len >> 32);
+        gw_mysql_set_byte4(ptr + 12, pos);
+        gw_mysql_set_byte4(ptr + 16, pos >> 32);
+
+        size_t index_len = (n_blocks + 1) * 8;
+
+        ok = pwrite(out, index, index_len, pos) == (ssize_t)index_len &&
+             pwrite(out, hdr, BLR_ZFILE_HDR_SIZE, 0) == BLR_ZFILE_HDR_SIZE &&
+             fsync(out) == 0;
+
+        pos += index_len;
+    }
+
+    MXS_FREE(data);
+    MXS_FREE(cdata);
+    MXS_FREE(index);
+
+    if (close(out) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to compress binlog file %s: %d, %s",
+                  path, errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        unlink(tmp);
+        return false;
+    }
+
+    atomic_add_uint64(&router->stats.n_compressed, 1);
+    atomic_add_uint64(&router->stats.compress_in, len);
+    atomic_add_uint64(&router->stats.compress_out, pos);
+
+    MXS_INFO("%s: Compressed binlog file %s from %lu to %lu bytes.",
+             router->service->name, path, len, pos);
+
+    return true;
+}
+
+/**
+ * Compress the oldest uncompressed binlog file. Called by the housekeeper.
+ *
+ * The file being written and the one before it are never compressed, as a
+ * partial transaction may still be truncated from the previous file. The
+ * other files are checked from the newest to the oldest and one file is
+ * compressed at a time, so that the housekeeper is not blocked for long.
+ *
+ * @param inst  The router instance
+ */
+void
+blr_compress_binlogs(void *inst)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)inst;
+    char current[BINLOG_FNAMELEN + 1];
+
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(current, router->binlog_name);
+    spinlock_release(&router->binlog_lock);
+
+    char *sptr = strrchr(current, '.');
+
+    if (sptr == NULL)
+    {
+        return;
+    }
+
+    *sptr = '\0';
+    int seq = atoi(sptr + 1);
+    uint8_t magic[] = BINLOG_MAGIC;
+
+    for (int i = seq - 2; i > 0; i--)
+    {
+        char path[PATH_MAX + 1];
+        uint8_t buf[BINLOG_MAGIC_SIZE];
+
+        snprintf(path, sizeof(path), "%s/" BINLOG_NAMEFMT, router->binlogdir, current, i);
+
+        int fd = open(path, O_RDONLY);
+
+        if (fd == -1)
+        {
+            /** The older files have been purged */
+            break;
+        }
+
+        bool plain = pread(fd, buf, BINLOG_MAGIC_SIZE, 0) == BINLOG_MAGIC_SIZE &&
+                     memcmp(buf, magic, BINLOG_MAGIC_SIZE) == 0;
+
+        if (plain)
+        {
+            blr_file_compress(router, path, fd);
+        }
+
+        close(fd);
+
+        if (plain)
+        {
+            break;
+        }
+    }
+}
+
 
 /**
  * Write the response packet to a cache file so that MaxScale can respond
@@ -1361,6 +2299,12 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
 
     while (1)
     {
+        /* The events before a checkpoint were checked before it was written */
+        if (router->checkpoint_pos > pos && first_event.event_type != 0 &&
+            pending_transaction == 0)
+        {
+            pos = router->checkpoint_pos;
+        }
 
         /* Read the header information from the file */
         if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
@@ -2648,7 +3592,7 @@ blr_write_special_event(ROUTER_INSTANCE *router, uint32_t file_offset, uint32_t
     }
 
     /* Write the event */
-    if ((n = pwrite(router->binlog_fd, new_event, event_size, router->last_written)) != event_size)
+    if ((n = blr_file_write(router, new_event, event_size)) != event_size)
     {
         char err_msg[MXS_STRERROR_BUFLEN];
         MXS_ERROR("%s: Failed to write %s special binlog record at %lu of %s, %s. "
@@ -2681,7 +3625,11 @@ blr_write_special_event(ROUTER_INSTANCE *router, uint32_t file_offset, uint32_t
     spinlock_release(&router->binlog_lock);
 
     // Force write
-    fsync(router->binlog_fd);
+    if (!blr_file_write_flush(router))
+    {
+        return 0;
+    }
+    blr_file_sync(router);
 
     return 1;
 }
@@ -2777,6 +3725,57 @@ blr_create_start_encryption_event(ROUTER_INSTANCE *router, uint32_t event_pos, b
     return new_event;
 }
 
+/**
+ * Prepare a cipher context of the thread for a new event
+ *
+ * @param cache     The context
+ * @param algo      The encryption algorithm
+ * @param key       The encryption key
+ * @param key_len   The length of the key
+ * @param iv        The IV of the event, or NULL
+ * @param action    Crypt action: 1 encrypt, 0 decrypt
+ * @return          The context or NULL on error
+ */
+static EVP_CIPHER_CTX *blr_cipher_ctx(BLR_CIPHER_CTX *cache,
+                                      int algo,
+                                      const uint8_t *key,
+                                      unsigned int key_len,
+                                      const uint8_t *iv,
+                                      int action)
+{
+    if (cache->ctx == NULL && (cache->ctx = mxs_evp_cipher_ctx_alloc()) == NULL)
+    {
+        return NULL;
+    }
+
+    if (cache->ready && cache->algo == algo && cache->action == action &&
+        cache->key_len == key_len && memcmp(cache->key, key, key_len) == 0)
+    {
+        /* Keep the cipher and the key, only reset the state and the IV */
+        if (EVP_CipherInit_ex(cache->ctx, NULL, NULL, NULL, iv, action))
+        {
+            return cache->ctx;
+        }
+    }
+    else if (EVP_CipherInit_ex(cache->ctx, ciphers[algo](key_len), NULL, key, iv, action))
+    {
+        /* Set no padding */
+        EVP_CIPHER_CTX_set_padding(cache->ctx, 0);
+
+        cache->ready = true;
+        cache->algo = algo;
+        cache->action = action;
+        cache->key_len = key_len;
+        memcpy(cache->key, key, key_len);
+
+        return cache->ctx;
+    }
+
+    cache->ready = false;
+
+    return NULL;
+}
+
 /**
  * Encrypt/Decrypt an array of bytes
  *
@@ -2819,25 +3818,21 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
 
     out_ptr = GWBUF_DATA(outbuf);
 
-    EVP_CIPHER_CTX *ctx = mxs_evp_cipher_ctx_alloc();
-
     /* Set the encryption algorithm accordingly to key_len and encryption mode */
-    if (!EVP_CipherInit_ex(ctx,
-                           ciphers[router->encryption.encryption_algorithm](router->encryption.key_len),
-                           NULL,
-                           key,
-                           iv,
-                           action))
+    EVP_CIPHER_CTX *ctx = blr_cipher_ctx(&blr_crypt_ctx[action ? 1 : 0],
+                                         router->encryption.encryption_algorithm,
+                                         key,
+                                         key_len,
+                                         iv,
+                                         action);
+
+    if (ctx == NULL)
     {
         MXS_ERROR("Error in EVP_CipherInit_ex for algo %d", router->encryption.encryption_algorithm);
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         return NULL;
     }
 
-    /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-
     /* Encryt/Decrypt the input data */
     if (!EVP_CipherUpdate(ctx,
                           out_ptr + 4,
@@ -2846,8 +3841,7 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
                           size))
     {
         MXS_ERROR("Error in EVP_CipherUpdate");
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         return NULL;
     }
 
@@ -2888,12 +3882,10 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
 
     if (!finale_ret)
     {
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         outbuf = NULL;
     }
 
-    mxs_evp_cipher_ctx_free(ctx);
-
     return outbuf;
 }
 
@@ -3073,24 +4065,20 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
     uint8_t mask[AES_BLOCK_SIZE];
     int mlen = 0;
 
-    EVP_CIPHER_CTX* t_ctx = mxs_evp_cipher_ctx_alloc();
-
     /* Initialise with AES_ECB and NULL iv */
-    if (!EVP_CipherInit_ex(t_ctx,
-                           ciphers[BLR_AES_ECB](key_len),
-                           NULL,
-                           key,
-                           NULL, /* NULL iv */
-                           BINLOG_FLAG_ENCRYPT))
+    EVP_CIPHER_CTX* t_ctx = blr_cipher_ctx(&blr_cbc_tail_ctx,
+                                           BLR_AES_ECB,
+                                           key,
+                                           key_len,
+                                           NULL, /* NULL iv */
+                                           BINLOG_FLAG_ENCRYPT);
+
+    if (t_ctx == NULL)
     {
         MXS_ERROR("Error in EVP_CipherInit_ex CBC for last block (ECB)");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
-    /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(t_ctx, 0);
-
     /* Do the enc/dec of the IV (the one from previous stage) */
     if (!EVP_CipherUpdate(t_ctx,
                           mask,
@@ -3099,7 +4087,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
                           sizeof(mask)))
     {
         MXS_ERROR("Error in EVP_CipherUpdate ECB");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
@@ -3114,8 +4101,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
         output[i] = input[i] ^ mask[i];
     }
 
-    mxs_evp_cipher_ctx_free(t_ctx);
-
     return 1;
 }
 
@@ -102,7 +102,9 @@ static void blr_check_last_master_event(void *inst);
 extern int blr_check_heartbeat(ROUTER_INSTANCE *router);
 static void blr_log_identity(ROUTER_INSTANCE *router);
 static void blr_extract_header_semisync(uint8_t *pkt, REP_HEADER *hdr);
-static int blr_send_semisync_ack (ROUTER_INSTANCE *router, uint64_t pos);
+static int blr_send_semisync_ack(ROUTER_INSTANCE *router, const char *file, uint64_t pos);
+static void blr_send_pending_semisync_ack(ROUTER_INSTANCE *router);
+static GWBUF *blr_relay_uncompress(ROUTER_INSTANCE *router, GWBUF *buf);
 static int blr_get_master_semisync(GWBUF *buf);
 
 static void blr_terminate_master_replication(ROUTER_INSTANCE *router, uint8_t* ptr, int len);
@@ -322,6 +324,8 @@ blr_master_close(ROUTER_INSTANCE *router)
     router->master_event_state = BLR_EVENT_DONE;
     gwbuf_free(router->stored_event);
     router->stored_event = NULL;
+    router->semisync_ack_pos = 0;
+    router->relay_continued = false;
 }
 
 /**
@@ -590,7 +594,9 @@ blr_master_response(ROUTER_INSTANCE *router, GWBUF *buf)
             }
             router->saved_master.uuid = buf;
             blr_cache_response(router, "uuid", buf);
-            sprintf(query, "SET @slave_uuid='%s'", router->uuid);
+            /* A MaxScale master sends the events compressed when requested */
+            sprintf(query, "SET @slave_uuid='%s'%s", router->uuid,
+                    router->relay_compression ? ", @maxscale_relay_compression=1" : "");
             buf = blr_make_query(router->master, query);
             router->master_state = BLRM_SUUID;
             router->master->func.write(router->master, buf);
@@ -808,6 +814,13 @@ blr_master_response(ROUTER_INSTANCE *router, GWBUF *buf)
         break;
 
     case BLRM_BINLOGDUMP:
+        if (router->relay_compression && (buf = blr_relay_uncompress(router, buf)) == NULL)
+        {
+            blr_master_close(router);
+            blr_master_delayed_connect(router);
+            break;
+        }
+
         /**
          * Main body, we have received a binlog record from the master
          */
@@ -1538,8 +1551,20 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                       router->service->dbref->server->name,
                                       router->service->dbref->server->port);
 
-                            /* Send Semi-Sync ACK packet to master server */
-                            blr_send_semisync_ack(router, hdr.next_pos);
+                            /**
+                             * The ACK is sent after the batch of events has been
+                             * written. An ACK of a later position also acknowledges
+                             * the earlier ones, but only in the same binlog file.
+                             */
+                            if (router->semisync_ack_pos &&
+                                strcmp(router->semisync_ack_file, router->binlog_name) != 0)
+                            {
+                                blr_send_pending_semisync_ack(router);
+                            }
+
+                            strcpy(router->semisync_ack_file, router->binlog_name);
+                            router->semisync_ack_pos = hdr.next_pos;
+                            router->stats.n_semisync_reqs++;
 
                             /* Reset ACK sending */
                             semi_sync_send_ack = 0;
@@ -1550,6 +1575,18 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                          * may depend on pending transaction
                          */
 
+                        /* The buffered events must be written before slaves are notified */
+                        if ((router->trx_safe == 0 ||
+                             router->pending_transaction == BLRM_NO_TRANSACTION ||
+                             router->pending_transaction > BLRM_TRANSACTION_START) &&
+                            !blr_file_commit(router))
+                        {
+                            gwbuf_free(pkt);
+                            blr_master_close(router);
+                            blr_master_delayed_connect(router);
+                            return;
+                        }
+
                         spinlock_acquire(&router->binlog_lock);
 
                         if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == BLRM_NO_TRANSACTION))
@@ -1639,7 +1676,16 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
         }
     }
 
-    blr_file_flush(router);
+    if (!blr_file_flush(router))
+    {
+        blr_master_close(router);
+        blr_master_delayed_connect(router);
+    }
+    else if (router->semisync_ack_pos)
+    {
+        /* One ACK for the latest event that requested it covers the batch */
+        blr_send_pending_semisync_ack(router);
+    }
 }
 
 /**
@@ -2293,6 +2339,89 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
     return n;
 }
 
+/**
+ * Compress the packets collected for a slave into a frame, if the slave
+ * requested it and the frame is smaller than the packets.
+ *
+ * @param slave The slave
+ */
+static void blr_slave_compress_batch(ROUTER_SLAVE *slave)
+{
+    uLong bound = compressBound(slave->batch_len);
+    GWBUF *frame = gwbuf_alloc(MYSQL_HEADER_LEN + BLR_RELAY_FRAME_HDR_LEN + bound);
+
+    if (frame)
+    {
+        uint8_t *data = GWBUF_DATA(frame);
+        uLongf len = bound;
+
+        /** Fast compression keeps the latency of the events low */
+        if (compress2(data + MYSQL_HEADER_LEN + BLR_RELAY_FRAME_HDR_LEN, &len,
+                      GWBUF_DATA(slave->batch), slave->batch_len, Z_BEST_SPEED) == Z_OK &&
+            len + BLR_RELAY_FRAME_HDR_LEN + MYSQL_HEADER_LEN < slave->batch_len)
+        {
+            encode_value(data, len + BLR_RELAY_FRAME_HDR_LEN, 24);
+            data[3] = slave->seqno++;
+            data[4] = BLR_RELAY_FRAME;
+            encode_value(data + 5, slave->batch_len, 32);
+            GWBUF_RTRIM(frame, bound - len);
+
+            gwbuf_free(slave->batch);
+            slave->batch = frame;
+            slave->batch_len = GWBUF_LENGTH(frame);
+        }
+        else
+        {
+            gwbuf_free(frame);
+        }
+    }
+}
+
+/**
+ * Write the packets collected for a slave.
+ *
+ * @param slave The slave
+ */
+static void blr_slave_write_batch(ROUTER_SLAVE *slave)
+{
+    if (slave->batch)
+    {
+        GWBUF_RTRIM(slave->batch, BLR_SEND_BATCH_SIZE - slave->batch_len);
+
+        if (slave->relay_compression && slave->batch_len >= BLR_RELAY_MIN_COMPRESS)
+        {
+            blr_slave_compress_batch(slave);
+        }
+
+        slave->dcb->func.write(slave->dcb, slave->batch);
+        slave->batch = NULL;
+        slave->batch_len = 0;
+    }
+}
+
+/**
+ * Start collecting the packets sent to a slave, so that many small events
+ * are written to the slave at once.
+ *
+ * @param slave The slave
+ */
+void blr_slave_batch_start(ROUTER_SLAVE *slave)
+{
+    slave->batching = true;
+}
+
+/**
+ * Write the collected packets and stop collecting the packets sent to a slave.
+ * Must be called before anything else is written to the slave.
+ *
+ * @param slave The slave
+ */
+void blr_slave_batch_end(ROUTER_SLAVE *slave)
+{
+    blr_slave_write_batch(slave);
+    slave->batching = false;
+}
+
 /**
  * Send a replication event packet to a slave
  *
@@ -2312,10 +2441,35 @@ bool blr_send_packet(ROUTER_SLAVE *slave, uint8_t *buf, uint32_t len, bool first
 {
     bool rval = true;
     unsigned int datalen = len + (first ? 1 : 0);
-    GWBUF *buffer = gwbuf_alloc(datalen + MYSQL_HEADER_LEN);
-    if (buffer)
+    GWBUF *buffer = NULL;
+    uint8_t *data = NULL;
+
+    if (slave->batching && datalen + MYSQL_HEADER_LEN <= BLR_SEND_BATCH_SIZE)
+    {
+        if (slave->batch && slave->batch_len + datalen + MYSQL_HEADER_LEN > BLR_SEND_BATCH_SIZE)
+        {
+            blr_slave_write_batch(slave);
+        }
+
+        if (slave->batch || (slave->batch = gwbuf_alloc(BLR_SEND_BATCH_SIZE)))
+        {
+            data = GWBUF_DATA(slave->batch) + slave->batch_len;
+            slave->batch_len += datalen + MYSQL_HEADER_LEN;
+        }
+    }
+    else
+    {
+        /** The collected packets are written first to keep the order */
+        blr_slave_write_batch(slave);
+
+        if ((buffer = gwbuf_alloc(datalen + MYSQL_HEADER_LEN)))
+        {
+            data = GWBUF_DATA(buffer);
+        }
+    }
+
+    if (data)
     {
-        uint8_t *data = GWBUF_DATA(buffer);
         encode_value(data, datalen, 24);
         data += 3;
         *data++ = slave->seqno++;
@@ -2330,8 +2484,12 @@ bool blr_send_packet(ROUTER_SLAVE *slave, uint8_t *buf, uint32_t len, bool first
             memcpy(data, buf, len);
         }
 
-        slave->stats.n_bytes += GWBUF_LENGTH(buffer);
-        slave->dcb->func.write(slave->dcb, buffer);
+        slave->stats.n_bytes += datalen + MYSQL_HEADER_LEN;
+
+        if (buffer)
+        {
+            slave->dcb->func.write(slave->dcb, buffer);
+        }
     }
     else
     {
@@ -2500,19 +2658,20 @@ blr_extract_header_semisync(register uint8_t *ptr, register REP_HEADER *hdr)
  * Send a MySQL Replication Semi-Sync ACK to the master server.
  *
  * @param router The router instance.
+ * @param file The binlog file for the ACK reply.
  * @param pos The binlog position for the ACK reply.
  * @return 1 if the packect is sent, 0 on errors
  */
 
 static int
-blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
+blr_send_semisync_ack(ROUTER_INSTANCE *router, const char *file, uint64_t pos)
 {
     int seqno = 0;
     int semi_sync_flag = BLR_MASTER_SEMI_SYNC_INDICATOR;
     GWBUF   *buf;
     int     len;
     uint8_t *data;
-    int     binlog_file_len = strlen(router->binlog_name);
+    int     binlog_file_len = strlen(file);
 
     /* payload is: 1 byte semi-sync indicator + 8 bytes position + binlog name len */
     len = 1 + 8 + binlog_file_len;
@@ -2537,13 +2696,116 @@ blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
     encode_value(&data[5], pos, 64);
 
     /* Binlog filename */
-    memcpy((char *)&data[13], router->binlog_name, binlog_file_len);
+    memcpy((char *)&data[13], file, binlog_file_len);
 
     router->master->func.write(router->master, buf);
 
     return 1;
 }
 
+/**
+ * Send the Semi-Sync ACK for the latest event that requested one.
+ *
+ * @param router The router instance.
+ */
+static void
+blr_send_pending_semisync_ack(ROUTER_INSTANCE *router)
+{
+    MXS_DEBUG("%s: Sending Semi-Sync ACK for binlog file %s, pos %lu to the "
+              "master server [%s]:%d", router->service->name,
+              router->semisync_ack_file, router->semisync_ack_pos,
+              router->service->dbref->server->name,
+              router->service->dbref->server->port);
+
+    if (blr_send_semisync_ack(router, router->semisync_ack_file, router->semisync_ack_pos))
+    {
+        router->stats.n_semisync_acks++;
+    }
+
+    router->semisync_ack_pos = 0;
+}
+
+/**
+ * Uncompress a frame sent by a MaxScale binlog server
+ *
+ * @param router The router instance
+ * @param frame  The frame packet
+ * @return The packets in the frame or NULL on error
+ */
+static GWBUF *blr_relay_uncompress_frame(ROUTER_INSTANCE *router, GWBUF *frame)
+{
+    GWBUF *rval = NULL;
+
+    if ((frame = gwbuf_make_contiguous(frame)))
+    {
+        uint8_t *ptr = GWBUF_DATA(frame) + MYSQL_HEADER_LEN;
+        size_t len = GWBUF_LENGTH(frame) - MYSQL_HEADER_LEN;
+        uLongf out_len = gw_mysql_get_byte4(ptr + 1);
+
+        if (len > BLR_RELAY_FRAME_HDR_LEN && out_len <= BLR_SEND_BATCH_SIZE &&
+            (rval = gwbuf_alloc(out_len)))
+        {
+            uLongf n = out_len;
+
+            if (uncompress(GWBUF_DATA(rval), &n, ptr + BLR_RELAY_FRAME_HDR_LEN,
+                           len - BLR_RELAY_FRAME_HDR_LEN) != Z_OK || n != out_len)
+            {
+                gwbuf_free(rval);
+                rval = NULL;
+            }
+            else
+            {
+                router->stats.n_relay_frames++;
+                router->stats.relay_in += len + MYSQL_HEADER_LEN;
+                router->stats.relay_out += out_len;
+            }
+        }
+
+        gwbuf_free(frame);
+    }
+
+    return rval;
+}
+
+/**
+ * Replace the compressed frames sent by a MaxScale binlog server with the
+ * packets in them. A packet that continues a large event is never a frame,
+ * whatever its first byte is.
+ *
+ * @param router The router instance
+ * @param buf    Complete packets from the master
+ * @return The packets with the frames uncompressed or NULL on error
+ */
+static GWBUF *blr_relay_uncompress(ROUTER_INSTANCE *router, GWBUF *buf)
+{
+    GWBUF *rval = NULL;
+    uint8_t hdr[MYSQL_HEADER_LEN + 1];
+
+    while (buf && gwbuf_copy_data(buf, 0, sizeof(hdr), hdr) == sizeof(hdr))
+    {
+        uint32_t len = gw_mysql_get_byte3(hdr);
+        bool frame = !router->relay_continued && hdr[MYSQL_HEADER_LEN] == BLR_RELAY_FRAME;
+        GWBUF *packet = gwbuf_split(&buf, len + MYSQL_HEADER_LEN);
+
+        router->relay_continued = len == MYSQL_PACKET_LENGTH_MAX;
+
+        if (frame && (packet = blr_relay_uncompress_frame(router, packet)) == NULL)
+        {
+            MXS_ERROR("%s: Failed to uncompress a frame of binlog events from "
+                      "master server [%s]:%d.", router->service->name,
+                      router->service->dbref->server->name,
+                      router->service->dbref->server->port);
+            gwbuf_free(buf);
+            gwbuf_free(rval);
+            return NULL;
+        }
+
+        rval = gwbuf_append(rval, packet);
+    }
+
+    return gwbuf_append(rval, buf);
+}
+
 /**
  * Check the master semisync capability.
  *
@@ -119,6 +119,12 @@ static int blr_slave_send_fieldcount(ROUTER_INSTANCE *router, ROUTER_SLAVE *slav
 static int blr_slave_send_columndef(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *name, int type,
                                     int len, uint8_t seqno);
 static int blr_slave_send_eof(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int seqno);
+static GWBUF *blr_slave_create_fieldcount(int count);
+static GWBUF *blr_slave_create_columndef(char *name, int type, int len, uint8_t seqno);
+static GWBUF *blr_slave_create_eof(int seqno);
+static int blr_slave_send_status_response(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave,
+                                          BLR_STATUS_RESPONSE *cache, char **columns,
+                                          const uint8_t *row, size_t row_len, int eof_seqno);
 static int blr_slave_send_disconnected_server(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int server_id,
                                               int found);
 static int blr_slave_disconnect_all(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
@@ -804,6 +810,15 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
                 }
                 slave->uuid = MXS_STRDUP_A(word_ptr);
             }
+
+            /* A MaxScale binlog server requests the events compressed */
+            if ((word = strtok_r(NULL, sep, &brkb)) != NULL &&
+                strcasecmp(word, "@maxscale_relay_compression") == 0 &&
+                (word = strtok_r(NULL, sep, &brkb)) != NULL)
+            {
+                slave->relay_compression = atoi(word) != 0;
+            }
+
             MXS_FREE(query_text);
             return blr_slave_replay(router, slave, router->saved_master.setslaveuuid);
         }
@@ -1396,6 +1411,14 @@ blr_slave_send_maxscale_variables(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
 }
 
 
+/*
+ * Columns to send for a "SHOW MASTER STATUS" command
+ */
+static char *master_status_columns[] =
+{
+    "File", "Position", "Binlog_Do_DB", "Binlog_Ignore_DB", "Execute_Gtid_Set", NULL
+};
+
 /**
  * Send the response to the SQL command "SHOW MASTER STATUS"
  *
@@ -1406,31 +1429,19 @@ blr_slave_send_maxscale_variables(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
 static int
 blr_slave_send_master_status(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
 {
-    GWBUF *pkt;
     char file[40];
     char position[40];
     uint8_t *ptr;
     int len, file_len;
 
-    blr_slave_send_fieldcount(router, slave, 5);
-    blr_slave_send_columndef(router, slave, "File", BLR_TYPE_STRING, 40, 2);
-    blr_slave_send_columndef(router, slave, "Position", BLR_TYPE_STRING, 40, 3);
-    blr_slave_send_columndef(router, slave, "Binlog_Do_DB", BLR_TYPE_STRING, 40, 4);
-    blr_slave_send_columndef(router, slave, "Binlog_Ignore_DB", BLR_TYPE_STRING, 40, 5);
-    blr_slave_send_columndef(router, slave, "Execute_Gtid_Set", BLR_TYPE_STRING, 40, 6);
-    blr_slave_send_eof(router, slave, 7);
-
     sprintf(file, "%s", router->binlog_name);
     file_len = strlen(file);
 
     sprintf(position, "%lu", router->binlog_position);
 
     len = 5 + file_len + strlen(position) + 1 + 3;
-    if ((pkt = gwbuf_alloc(len)) == NULL)
-    {
-        return 0;
-    }
-    ptr = GWBUF_DATA(pkt);
+    uint8_t row[len];
+    ptr = row;
     encode_value(ptr, len - 4, 24);                    // Add length of data packet
     ptr += 3;
     *ptr++ = 0x08;                                     // Sequence number in response
@@ -1443,8 +1454,9 @@ blr_slave_send_master_status(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     *ptr++ = 0; // Send 3 empty values
     *ptr++ = 0;
     *ptr++ = 0;
-    slave->dcb->func.write(slave->dcb, pkt);
-    return blr_slave_send_eof(router, slave, 9);
+
+    return blr_slave_send_status_response(router, slave, &router->master_status_response,
+                                          master_status_columns, row, len, 9);
 }
 
 /*
@@ -1479,7 +1491,6 @@ static char *slave_status_columns[] =
 static int
 blr_slave_send_slave_status(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
 {
-    GWBUF *pkt;
     char column[251] = "";
     uint8_t *ptr;
     int len, actual_len, col_len, seqno, ncols, i;
@@ -1489,21 +1500,13 @@ blr_slave_send_slave_status(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     /* Count the columns */
     for (ncols = 0; slave_status_columns[ncols]; ncols++);
 
-    blr_slave_send_fieldcount(router, slave, ncols);
-    seqno = 2;
-    for (i = 0; slave_status_columns[i]; i++)
-    {
-        blr_slave_send_columndef(router, slave, slave_status_columns[i], BLR_TYPE_STRING, 40, seqno++);
-    }
-    blr_slave_send_eof(router, slave, seqno++);
+    /* The field count, the column definitions and their EOF precede the row */
+    seqno = ncols + 3;
 
     len = 5 + ncols * max_column_size + 250;   // Max length + 250 bytes error message
 
-    if ((pkt = gwbuf_alloc(len)) == NULL)
-    {
-        return 0;
-    }
-    ptr = GWBUF_DATA(pkt);
+    uint8_t row[len];
+    ptr = row;
     encode_value(ptr, len - 4, 24);     // Add length of data packet
     ptr += 3;
     *ptr++ = seqno++;                   // Sequence number in response
@@ -1840,14 +1843,11 @@ blr_slave_send_slave_status(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     *ptr++ = 0;
     *ptr++ = 0;
 
-    actual_len = ptr - (uint8_t *)GWBUF_DATA(pkt);
-    ptr = GWBUF_DATA(pkt);
-    encode_value(ptr, actual_len - 4, 24);          // Add length of data packet
-
-    pkt = gwbuf_rtrim(pkt, len - actual_len);       // Trim the buffer to the actual size
+    actual_len = ptr - row;
+    encode_value(row, actual_len - 4, 24);          // Add length of data packet
 
-    slave->dcb->func.write(slave->dcb, pkt);
-    return blr_slave_send_eof(router, slave, seqno++);
+    return blr_slave_send_status_response(router, slave, &router->slave_status_response,
+                                          slave_status_columns, row, actual_len, seqno);
 }
 
 /**
@@ -2370,9 +2370,17 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
     slave->file = file;
 #endif
     int events_before = slave->stats.n_events;
+    unsigned long bytes_before = slave->stats.n_bytes;
+    uint64_t burst_start = blr_clock_us();
+
+    /* Read the binlog file in larger blocks and send the events in larger writes */
+    slave->read_buffer.file = NULL;
+    slave->read_buffer.len = 0;
+    blr_slave_batch_start(slave);
 
     while (burst-- && burst_size > 0 &&
-           (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg, slave->encryption_ctx)) != NULL)
+           (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg,
+                                     slave->encryption_ctx, &slave->read_buffer)) != NULL)
     {
         char binlog_name[BINLOG_FNAMELEN + 1];
         uint32_t binlog_pos;
@@ -2440,6 +2448,8 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         {
             unsigned long beat1 = hkheartbeat;
             blr_close_binlog(router, file);
+            slave->read_buffer.file = NULL;
+            slave->read_buffer.len = 0;
             if (hkheartbeat - beat1 > 1)
             {
                 MXS_ERROR("blr_close_binlog took %lu maxscale beats", hkheartbeat - beat1);
@@ -2459,6 +2469,7 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             {
                 char err_msg[BINLOG_ERROR_MSG_LEN + 1];
                 err_msg[BINLOG_ERROR_MSG_LEN] = '\0';
+                blr_slave_batch_end(slave);
                 if (rotating)
                 {
                     spinlock_acquire(&slave->catch_lock);
@@ -2514,6 +2525,7 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
                         slave->serverid,
                         binlog_name,
                         binlog_pos);
+            blr_slave_batch_end(slave);
 #ifndef BLFILE_IN_SLAVE
             blr_close_binlog(router, file);
 #endif
@@ -2532,6 +2544,11 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         }
     }
 
+    blr_slave_batch_end(slave);
+
+    slave->stats.catchup_bytes += slave->stats.n_bytes - bytes_before;
+    slave->stats.catchup_time += blr_clock_us() - burst_start;
+
     /**
      * End of while reading
      * Checking last buffer first
@@ -2922,7 +2939,7 @@ blr_slave_read_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
         return NULL;
     }
     /* FDE is not encrypted, so we can pass NULL to last parameter */
-    if ((record = blr_read_binlog(router, file, 4, &hdr, err_msg, NULL)) == NULL)
+    if ((record = blr_read_binlog(router, file, 4, &hdr, err_msg, NULL, NULL)) == NULL)
     {
         if (hdr.ok != SLAVE_POS_READ_OK)
         {
@@ -3009,20 +3026,33 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *fde)
  */
 static int
 blr_slave_send_fieldcount(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int count)
+{
+    GWBUF *pkt = blr_slave_create_fieldcount(count);
+    return pkt ? slave->dcb->func.write(slave->dcb, pkt) : 0;
+}
+
+/**
+ * Create the field count packet of a response packet sequence.
+ *
+ * @param count     Number of columns in the result set
+ * @return      The packet or NULL on memory allocation failure
+ */
+static GWBUF *
+blr_slave_create_fieldcount(int count)
 {
     GWBUF *pkt;
     uint8_t *ptr;
 
     if ((pkt = gwbuf_alloc(5)) == NULL)
     {
-        return 0;
+        return NULL;
     }
     ptr = GWBUF_DATA(pkt);
     encode_value(ptr, 1, 24);           // Add length of data packet
     ptr += 3;
     *ptr++ = 0x01;                  // Sequence number in response
     *ptr++ = count;                 // Length of result string
-    return slave->dcb->func.write(slave->dcb, pkt);
+    return pkt;
 }
 
 
@@ -3040,13 +3070,29 @@ blr_slave_send_fieldcount(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int coun
 static int
 blr_slave_send_columndef(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *name, int type, int len,
                          uint8_t seqno)
+{
+    GWBUF *pkt = blr_slave_create_columndef(name, type, len, seqno);
+    return pkt ? slave->dcb->func.write(slave->dcb, pkt) : 0;
+}
+
+/**
+ * Create the column definition packet of a response packet sequence.
+ *
+ * @param name      Name of the column
+ * @param type      Column type
+ * @param len       Column length
+ * @param seqno     Packet sequence number
+ * @return      The packet or NULL on memory allocation failure
+ */
+static GWBUF *
+blr_slave_create_columndef(char *name, int type, int len, uint8_t seqno)
 {
     GWBUF *pkt;
     uint8_t *ptr;
 
     if ((pkt = gwbuf_alloc(26 + strlen(name))) == NULL)
     {
-        return 0;
+        return NULL;
     }
     ptr = GWBUF_DATA(pkt);
     encode_value(ptr, 22 + strlen(name), 24);   // Add length of data packet
@@ -3083,7 +3129,7 @@ blr_slave_send_columndef(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *nam
     *ptr++ = 0;
     *ptr++ = 0;
     *ptr++ = 0;
-    return slave->dcb->func.write(slave->dcb, pkt);
+    return pkt;
 }
 
 
@@ -3097,13 +3143,26 @@ blr_slave_send_columndef(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *nam
  */
 static int
 blr_slave_send_eof(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int seqno)
+{
+    GWBUF *pkt = blr_slave_create_eof(seqno);
+    return pkt ? slave->dcb->func.write(slave->dcb, pkt) : 0;
+}
+
+/**
+ * Create an EOF packet of a response packet sequence.
+ *
+ * @param seqno     The sequence number of the EOF packet
+ * @return      The packet or NULL on memory allocation failure
+ */
+static GWBUF *
+blr_slave_create_eof(int seqno)
 {
     GWBUF *pkt;
     uint8_t *ptr;
 
     if ((pkt = gwbuf_alloc(9)) == NULL)
     {
-        return 0;
+        return NULL;
     }
     ptr = GWBUF_DATA(pkt);
     encode_value(ptr, 5, 24);           // Add length of data packet
@@ -3113,7 +3172,98 @@ blr_slave_send_eof(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int seqno)
     encode_value(ptr, 0, 16);           // No errors
     ptr += 2;
     encode_value(ptr, 2, 16);           // Autocommit enabled
-    return slave->dcb->func.write(slave->dcb, pkt);
+    return pkt;
+}
+
+/**
+ * Send a single row status response, using the cached response if its row is
+ * the same. The columns are all strings.
+ *
+ * @param router    The router
+ * @param slave     The slave connection
+ * @param cache     The cached response
+ * @param columns   The names of the columns, terminated by NULL
+ * @param row       The row packet, with the sequence number that follows the
+ *                  EOF of the column definitions
+ * @param row_len   The length of the row packet
+ * @param eof_seqno The sequence number of the EOF packet that follows the row
+ * @return      Non-zero on success
+ */
+static int
+blr_slave_send_status_response(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave,
+                               BLR_STATUS_RESPONSE *cache, char **columns,
+                               const uint8_t *row, size_t row_len, int eof_seqno)
+{
+    GWBUF *clone = NULL;
+
+    spinlock_acquire(&cache->lock);
+    if (cache->response && cache->row_len == row_len &&
+        memcmp(GWBUF_DATA(cache->response) + cache->row_offset, row, row_len) == 0)
+    {
+        clone = gwbuf_clone(cache->response);
+    }
+    spinlock_release(&cache->lock);
+
+    if (clone)
+    {
+        atomic_add_uint64(&cache->n_hits, 1);
+        return slave->dcb->func.write(slave->dcb, clone);
+    }
+
+    int ncols;
+    for (ncols = 0; columns[ncols]; ncols++);
+
+    GWBUF *response = blr_slave_create_fieldcount(ncols);
+
+    for (int i = 0; response && columns[i]; i++)
+    {
+        GWBUF *pkt = blr_slave_create_columndef(columns[i], BLR_TYPE_STRING, 40, i + 2);
+
+        if (pkt)
+        {
+            response = gwbuf_append(response, pkt);
+        }
+        else
+        {
+            gwbuf_free(response);
+            response = NULL;
+        }
+    }
+
+    GWBUF *eof = blr_slave_create_eof(ncols + 2);
+    GWBUF *pkt = gwbuf_alloc_and_load(row_len, row);
+    GWBUF *last = blr_slave_create_eof(eof_seqno);
+
+    if (response == NULL || eof == NULL || pkt == NULL || last == NULL)
+    {
+        gwbuf_free(response);
+        gwbuf_free(eof);
+        gwbuf_free(pkt);
+        gwbuf_free(last);
+        return 0;
+    }
+
+    size_t row_offset = gwbuf_length(response) + GWBUF_LENGTH(eof);
+    response = gwbuf_append(gwbuf_append(gwbuf_append(response, eof), pkt), last);
+
+    if ((response = gwbuf_make_contiguous(response)) == NULL ||
+        (clone = gwbuf_clone(response)) == NULL)
+    {
+        gwbuf_free(response);
+        return 0;
+    }
+
+    spinlock_acquire(&cache->lock);
+    GWBUF *old = cache->response;
+    cache->response = response;
+    cache->row_offset = row_offset;
+    cache->row_len = row_len;
+    spinlock_release(&cache->lock);
+
+    gwbuf_free(old);
+    atomic_add_uint64(&cache->n_builds, 1);
+
+    return slave->dcb->func.write(slave->dcb, clone);
 }
 
 /**
@@ -5884,7 +6034,7 @@ blr_slave_read_ste(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, uint32_t fde_en
         return 0;
     }
     /* Start Encryption Event is not encrypted, we can pass NULL to last parameter */
-    if ((record = blr_read_binlog(router, file, fde_end_pos, &hdr, err_msg, NULL)) == NULL)
+    if ((record = blr_read_binlog(router, file, fde_end_pos, &hdr, err_msg, NULL, NULL)) == NULL)
     {
         if (hdr.ok != SLAVE_POS_READ_OK)
         {
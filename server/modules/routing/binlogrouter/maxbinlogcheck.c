@@ -173,6 +173,17 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if (blr_file_is_compressed(fd))
+    {
+        printf("ERROR: Binlog file %s has been compressed by the binlog router "
+               "and cannot be checked.\n", path);
+        close(fd);
+        MXS_FREE(inst);
+        mxs_log_flush_sync();
+        mxs_log_finish();
+        exit(EXIT_FAILURE);
+    }
+
     inst->binlog_fd = fd;
     inst->mariadb10_compat = mariadb10_compat;
     strcpy(inst->binlog_name, name);
@@ -55,12 +55,16 @@
 #include <maxscale/version.h>
 #include <debugcli.h>
 
+#include "../../../core/maxscale/buffer.h"
 #include "../../../core/maxscale/config_runtime.h"
 #include "../../../core/maxscale/maxscale.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/poll.h"
+#include "../../../core/maxscale/query_classifier.h"
 #include "../../../core/maxscale/session.h"
+#include "../../../core/maxscale/spinlock.h"
+#include "../../../core/maxscale/trace.h"
 
 #define MAXARGS 12
 
@@ -96,6 +100,7 @@ struct subcommand
 
 static void telnetdShowUsers(DCB *);
 static void show_log_throttling(DCB *);
+static void show_spinlocks(DCB *);
 
 static void showVersion(DCB *dcb)
 {
@@ -107,14 +112,12 @@ static void showVersion(DCB *dcb)
  */
 struct subcommand showoptions[] =
 {
-#if defined(BUFFER_TRACE)
     {
-        "buffers",    0, dprintAllBuffers,
-        "Show all buffers with backtrace",
-        "Show all buffers with backtrace",
+        "buffers", 0, 0, dprintBufferStats,
+        "Show the buffer pool statistics",
+        "Usage: show buffers",
         {0}
     },
-#endif
     {
         "dcbs", 0, 0, dprintAllDCBs,
         "Show all DCBs",
@@ -213,6 +216,12 @@ struct subcommand showoptions[] =
         "Example: show persistent db-server-1",
         {ARG_TYPE_SERVER}
     },
+    {
+        "qc_cache", 0, 0, qc_print_cache_stats,
+        "Show the query classification cache statistics",
+        "Usage: show qc_cache",
+        {0}
+    },
     {
         "server", 1, 1, dprintServer,
         "Show server details",
@@ -270,6 +279,12 @@ struct subcommand showoptions[] =
         "Usage: show sessions",
         {0}
     },
+    {
+        "spinlocks", 0, 0, show_spinlocks,
+        "Show the contention of the named spinlocks",
+        "Usage: show spinlocks",
+        {0}
+    },
     {
         "tasks", 0, 0, hkshow_tasks,
         "Show all active housekeeper tasks in MaxScale",
@@ -282,6 +297,12 @@ struct subcommand showoptions[] =
         "Usage: show threads",
         {0}
     },
+    {
+        "trace", 0, 0, dprintTrace,
+        "Show the trace records of the worker threads",
+        "Usage: show trace",
+        {0}
+    },
     {
         "users", 0, 0, telnetdShowUsers,
         "Show enabled Linux accounts",
@@ -1461,6 +1482,34 @@ static void alterMonitor(DCB *dcb, MXS_MONITOR *monitor, char *v1, char *v2, cha
 
 }
 
+static void alterMaxScale(DCB *dcb, char *v1, char *v2, char *v3,
+                          char *v4, char *v5, char *v6, char *v7, char *v8, char *v9,
+                          char *v10, char *v11, char *v12)
+{
+    char *values[12] = {v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12};
+    const int items = sizeof(values) / sizeof(values[0]);
+
+    for (int i = 0; i < items && values[i]; i++)
+    {
+        char *key = values[i];
+        char *value = strchr(key, '=');
+
+        if (value)
+        {
+            *value++ = '\0';
+
+            if (!runtime_alter_maxscale(key, value))
+            {
+                dcb_printf(dcb, "Error: Bad key-value parameter: %s=%s\n", key, value);
+            }
+        }
+        else
+        {
+            dcb_printf(dcb, "Error: not a key-value parameter: %s\n", values[i]);
+        }
+    }
+}
+
 struct subcommand alteroptions[] =
 {
     {
@@ -1497,6 +1546,28 @@ struct subcommand alteroptions[] =
             ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING
         }
     },
+    {
+        "maxscale", 1, 12, alterMaxScale,
+        "Alter global parameters",
+        "Usage: alter maxscale KEY=VALUE ...\n"
+        "\n"
+        "Parameters:\n"
+        "KEY=VALUE List of `key=value` pairs separated by spaces\n"
+        "\n"
+        "This will alter a global parameter of MaxScale. The accepted values for KEY are:\n"
+        "\n"
+        "threads               Number of polling threads that handle sessions, at most\n"
+        "                      the number of threads started with 'max_threads'\n"
+        "\n"
+        "The change is not persisted and needs to be set again after a restart.\n"
+        "\n"
+        "Example: alter maxscale threads=16",
+        {
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING,
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING,
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING
+        }
+    },
     {
         "monitor", 2, 12, alterMonitor,
         "Alter monitor parameters",
@@ -2198,6 +2269,31 @@ show_log_throttling(DCB *dcb)
     dcb_printf(dcb, "%lu %lu %lu\n", t.count, t.window_ms, t.suppress_ms);
 }
 
+static bool print_spinlock(const SPINLOCK_COUNTERS *counters, void *data)
+{
+    DCB *dcb = (DCB*)data;
+
+    dcb_printf(dcb, "%-40s | %12lu | %10lu | %5.1f%% | %9.1f | %8lu\n",
+               counters->name, counters->acquired, counters->contended,
+               counters->acquired ? 100.0 * counters->contended / counters->acquired : 0.0,
+               counters->contended ? (double)counters->spins / counters->contended : 0.0,
+               counters->parked);
+    return true;
+}
+
+/**
+ * Print the contention counters of the named spinlocks
+ *
+ * @param dcb The DCB to print the counters to
+ */
+static void
+show_spinlocks(DCB *dcb)
+{
+    dcb_printf(dcb, "%-40s | Acquired     | Contended  | %%      | Avg spins | Parked\n", "Lock");
+    dcb_printf(dcb, "-----------------------------------------+--------------+------------+--------+-----------+---------\n");
+    spinlock_foreach_named(print_spinlock, dcb);
+}
+
 /**
  * Command to shutdown a running monitor
  *
@@ -50,6 +50,7 @@
 #include <maxscale/secrets.h>
 #include <maxscale/users.h>
 
+#include "../../../core/maxscale/metrics.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/session.h"
@@ -708,6 +709,12 @@ handle_url(INFO_INSTANCE *instance, INFO_SESSION *session, GWBUF *queue)
     RESULTSET *set;
 
     uri = (char *)GWBUF_DATA(queue);
+
+    if (strcmp(uri, "/metrics") == 0)
+    {
+        metrics_write(session->dcb);
+    }
+
     for (i = 0; supported_uri[i].uri; i++)
     {
         if (strcmp(uri, supported_uri[i].uri) == 0)
@@ -64,6 +64,48 @@ typedef struct
     int n_queries; /*< Number of queries forwarded */
 } ROUTER_STATS;
 
+/** How the server of a new session is chosen */
+typedef enum rcr_affinity
+{
+    RCR_AFFINITY_NONE,    /*< The server with the least connections relative to its weight */
+    RCR_AFFINITY_USER,    /*< Consistent hashing of the client user */
+    RCR_AFFINITY_ADDRESS, /*< Consistent hashing of the client address */
+    RCR_AFFINITY_DATABASE /*< Consistent hashing of the default database */
+} rcr_affinity_t;
+
+/** Number of entries in the consistent hashing lookup table, must be a prime */
+#define RCR_LOOKUP_SIZE 4099
+
+/**
+ * A server of the service as seen by new sessions
+ */
+typedef struct rcr_server
+{
+    SERVER_REF *ref;           /*< The server */
+    bool        running;       /*< Whether the server was running when the table was built */
+    time_t      running_since; /*< When the server started running, 0 if it needs no slow start */
+    bool        eligible;      /*< Whether new sessions can be routed to the server */
+    int         weight;        /*< Weight adjusted by the load and the slow start */
+} RCR_SERVER;
+
+/**
+ * The servers of the service with their eligibility and weights computed
+ * in advance. A table is not modified once it is published, a new one is
+ * built when the servers of the service or their states change.
+ */
+typedef struct rcr_server_table
+{
+    uint64_t    servers_version; /*< Version of the server snapshot of the service */
+    uint64_t    states_version;  /*< Version of the published server states */
+    time_t      built;           /*< When the table was built */
+    bool        ramping;         /*< Whether the weight of a server is still growing */
+    SERVER_REF *master;          /*< The root master */
+    SERVER_REF *preferred;       /*< Always chosen if set, the root master with the master option */
+    int16_t    *lookup;          /*< Consistent hashing lookup table of server indexes or NULL */
+    int         n_servers;       /*< Number of servers */
+    RCR_SERVER  servers[];       /*< The servers in the order of the snapshot */
+} RCR_SERVER_TABLE;
+
 /**
  * The per instance data for the router.
  */
@@ -74,6 +116,9 @@ typedef struct router_instance
     unsigned int bitmask; /*< Bitmask to apply to server->status       */
     unsigned int bitvalue; /*< Required value of server->status         */
     ROUTER_STATS stats; /*< Statistics for this router               */
+    int slow_start; /*< Seconds it takes a returning server to get its full weight */
+    rcr_affinity_t affinity; /*< How the server of a new session is chosen */
+    RCR_SERVER_TABLE *servers; /*< The current server table, replaced under the lock */
     struct router_instance
         *next;
 } ROUTER_INSTANCE;
@@ -76,7 +76,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/rcu.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
 #include <maxscale/atomic.h>
@@ -104,6 +107,15 @@ static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses);
 static SERVER_REF *get_root_master(SERVER_REF *servers);
 static int handle_state_switch(DCB* dcb, DCB_REASON reason, void * routersession);
 
+static const MXS_ENUM_VALUE affinity_values[] =
+{
+    {"none",     RCR_AFFINITY_NONE},
+    {"user",     RCR_AFFINITY_USER},
+    {"address",  RCR_AFFINITY_ADDRESS},
+    {"database", RCR_AFFINITY_DATABASE},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -143,6 +155,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
+            {"slow_start", MXS_MODULE_PARAM_COUNT, "0"},
+            {
+                "affinity",
+                MXS_MODULE_PARAM_ENUM,
+                "none",
+                MXS_MODULE_OPT_NONE,
+                affinity_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -181,6 +201,12 @@ createInstance(SERVICE *service, char **options)
 
     inst->service = service;
     spinlock_init(&inst->lock);
+    inst->slow_start = config_get_integer(service->svc_config_param, "slow_start");
+    inst->affinity = config_get_enum(service->svc_config_param, "affinity", affinity_values);
+
+    char lockname[SPINLOCK_NAME_LEN];
+    snprintf(lockname, sizeof(lockname), "readconnroute:%s", service->name);
+    spinlock_set_name(&inst->lock, lockname);
 
     /*
      * Process the options
@@ -250,6 +276,330 @@ createInstance(SERVICE *service, char **options)
     return (MXS_ROUTER *) inst;
 }
 
+static void free_server_table(void *data)
+{
+    MXS_FREE(data);
+}
+
+/**
+ * Find a server from a server table
+ *
+ * @param table The table
+ * @param ref   The server to find
+ *
+ * @return The server or NULL if it is not in the table
+ */
+static const RCR_SERVER* find_table_server(const RCR_SERVER_TABLE *table, const SERVER_REF *ref)
+{
+    for (int i = 0; i < table->n_servers; i++)
+    {
+        if (table->servers[i].ref == ref)
+        {
+            return &table->servers[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Hash a string for consistent hashing
+ *
+ * @param str  The string
+ * @param seed Seed that selects one of several independent hashes
+ *
+ * @return The hash of the string
+ */
+static uint64_t affinity_hash(const char *str, uint64_t seed)
+{
+    /** 64-bit FNV-1a followed by the finalizer of MurmurHash3 */
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+
+    for (const unsigned char *p = (const unsigned char*)str; *p; p++)
+    {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb3fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * Fill the consistent hashing lookup table of a server table with Maglev
+ * hashing. Each eligible server claims entries in the order of its own
+ * permutation of the table, as many per round as its weight relative to the
+ * highest weight allows. As the permutations depend only on the names of the
+ * servers, adding or removing a server moves few of the other entries.
+ *
+ * @param table Table whose lookup table is filled
+ *
+ * @return True if there are eligible servers, false if the lookup table is empty
+ */
+static bool fill_lookup_table(RCR_SERVER_TABLE *table)
+{
+    int n = table->n_servers;
+    uint64_t offset[n];
+    uint64_t skip[n];
+    uint64_t next[n];
+    int credit[n];
+    int weight[n];
+    int max_weight = 0;
+    bool weighted = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        weighted = weighted || (table->servers[i].eligible && table->servers[i].weight > 0);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const RCR_SERVER *srv = &table->servers[i];
+        const char *name = srv->ref->server->unique_name;
+
+        /** Zero weights are used only if all eligible servers have one */
+        weight[i] = !srv->eligible ? 0 : weighted ? srv->weight : 1;
+        max_weight = MXS_MAX(max_weight, weight[i]);
+        offset[i] = affinity_hash(name, 0) % RCR_LOOKUP_SIZE;
+        skip[i] = affinity_hash(name, 1) % (RCR_LOOKUP_SIZE - 1) + 1;
+        next[i] = 0;
+        credit[i] = 0;
+    }
+
+    if (max_weight == 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < RCR_LOOKUP_SIZE; i++)
+    {
+        table->lookup[i] = -1;
+    }
+
+    int filled = 0;
+
+    while (filled < RCR_LOOKUP_SIZE)
+    {
+        for (int i = 0; i < n && filled < RCR_LOOKUP_SIZE; i++)
+        {
+            credit[i] += weight[i];
+
+            while (credit[i] >= max_weight && filled < RCR_LOOKUP_SIZE)
+            {
+                uint64_t entry;
+                credit[i] -= max_weight;
+
+                do
+                {
+                    entry = (offset[i] + next[i]++ * skip[i]) % RCR_LOOKUP_SIZE;
+                }
+                while (table->lookup[entry] != -1);
+
+                table->lookup[entry] = i;
+                filled++;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Build a new server table. A server that starts running, or is added to the
+ * service while running, gets a weight that grows from one to its full weight
+ * over the slow start period. The servers running when the first table is built
+ * get their full weight at once.
+ *
+ * @param inst    The router instance
+ * @param old     The previous table or NULL if this is the first one
+ * @param servers The server snapshot of the service
+ * @param version Version of the published server states
+ *
+ * @return The new table or NULL if memory allocation failed
+ */
+static RCR_SERVER_TABLE* build_server_table(ROUTER_INSTANCE *inst, const RCR_SERVER_TABLE *old,
+                                            const SERVICE_SERVERS *servers, uint64_t version)
+{
+    size_t size = sizeof(RCR_SERVER_TABLE) + servers->n_servers * sizeof(RCR_SERVER);
+
+    if (inst->affinity != RCR_AFFINITY_NONE)
+    {
+        size += RCR_LOOKUP_SIZE * sizeof(int16_t);
+    }
+
+    RCR_SERVER_TABLE *table = MXS_MALLOC(size);
+
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    time_t now = time(NULL);
+
+    table->servers_version = servers->version;
+    table->states_version = version;
+    table->built = now;
+    table->ramping = false;
+    table->master = get_root_master(inst->service->dbref);
+    table->preferred = NULL;
+    table->lookup = NULL;
+    table->n_servers = servers->n_servers;
+
+    for (int i = 0; i < servers->n_servers; i++)
+    {
+        RCR_SERVER *srv = &table->servers[i];
+        SERVER_REF *ref = servers->servers[i].ref;
+        const RCR_SERVER *prev = old ? find_table_server(old, ref) : NULL;
+
+        srv->ref = ref;
+        srv->running = SERVER_IS_RUNNING(ref->server);
+
+        if (!srv->running)
+        {
+            srv->running_since = 0;
+        }
+        else if (prev && prev->running)
+        {
+            srv->running_since = prev->running_since;
+        }
+        else
+        {
+            srv->running_since = old ? now : 0;
+        }
+
+        /* The weights are lowered for servers that the monitor reports as loaded */
+        srv->weight = server_weight_by_load(servers->servers[i].weight, ref->server->load);
+
+        if (srv->running_since && now - srv->running_since < inst->slow_start)
+        {
+            int weight = srv->weight * (now - srv->running_since) / inst->slow_start;
+            srv->weight = srv->weight && weight == 0 ? 1 : weight;
+            table->ramping = true;
+        }
+
+        /* Check server status bits against bitvalue from router_options */
+        srv->eligible = SERVER_REF_IS_ACTIVE(ref) && !SERVER_IN_MAINT(ref->server) && srv->running &&
+                        (ref->server->status & inst->bitmask & inst->bitvalue);
+
+        if (srv->eligible && ref == table->master)
+        {
+            if (inst->bitvalue & SERVER_SLAVE)
+            {
+                /* Skip root master here, as it could also be slave of an external server that
+                 * is not in the configuration.  Intermediate masters (Relay Servers) are also
+                 * slave and will be selected as Slave(s)
+                 */
+                srv->eligible = false;
+            }
+            else if (inst->bitvalue & SERVER_MASTER)
+            {
+                /* If option is "master" return only the root Master as there could be
+                 * intermediate masters (Relay Servers) and they must not be selected.
+                 */
+                table->preferred = ref;
+            }
+        }
+    }
+
+    if (inst->affinity != RCR_AFFINITY_NONE)
+    {
+        table->lookup = (int16_t*)&table->servers[table->n_servers];
+
+        if (!fill_lookup_table(table))
+        {
+            table->lookup = NULL;
+        }
+    }
+
+    return table;
+}
+
+/**
+ * Get the value that decides the server of a session with consistent hashing
+ *
+ * @param inst    The router instance
+ * @param session The session
+ *
+ * @return The value or NULL if the session has none
+ */
+static const char* get_affinity_key(ROUTER_INSTANCE *inst, MXS_SESSION *session)
+{
+    DCB *dcb = session->client_dcb;
+    const char *key = NULL;
+
+    switch (inst->affinity)
+    {
+    case RCR_AFFINITY_USER:
+        key = dcb->user;
+        break;
+
+    case RCR_AFFINITY_ADDRESS:
+        key = dcb->remote;
+        break;
+
+    case RCR_AFFINITY_DATABASE:
+        /** The default database is only known for MySQL clients */
+        if (dcb->data && dcb->listener && strcasecmp(dcb->listener->protocol, "MySQLClient") == 0)
+        {
+            key = ((MYSQL_session*)dcb->data)->db;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return key && *key ? key : NULL;
+}
+
+/**
+ * Get the current server table, building a new one if the servers of the
+ * service or their states have changed or if the weight of a server is still
+ * growing. The table must not be used after the current event is handled.
+ *
+ * @param inst The router instance
+ *
+ * @return The server table or NULL if none could be built
+ */
+static const RCR_SERVER_TABLE* get_server_table(ROUTER_INSTANCE *inst)
+{
+    const SERVICE_SERVERS *servers = service_get_servers(inst->service);
+    uint64_t version = server_states_version();
+    const RCR_SERVER_TABLE *table = atomic_load_ptr((void * const *)&inst->servers);
+
+    if (table == NULL || table->servers_version != servers->version ||
+        table->states_version != version || (table->ramping && table->built != time(NULL)))
+    {
+        spinlock_acquire(&inst->lock);
+        RCR_SERVER_TABLE *old = inst->servers;
+
+        /** Another thread may have replaced the table while we waited for the lock */
+        if (old == table)
+        {
+            RCR_SERVER_TABLE *new_table = build_server_table(inst, old, servers, version);
+
+            if (new_table)
+            {
+                atomic_store_ptr((void**)&inst->servers, new_table);
+
+                if (old)
+                {
+                    mxs_rcu_retire(old, free_server_table);
+                }
+            }
+        }
+
+        table = inst->servers;
+        spinlock_release(&inst->lock);
+    }
+
+    return table;
+}
+
 /**
  * Associate a new session with this instance of the router.
  *
@@ -285,10 +635,15 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
 #endif
     client_rses->client_dcb = session->client_dcb;
 
-    /**
-     * Find the Master host from available servers
-     */
-    master_host = get_root_master(inst->service->dbref);
+    const RCR_SERVER_TABLE *table = get_server_table(inst);
+
+    if (table == NULL)
+    {
+        MXS_FREE(client_rses);
+        return NULL;
+    }
+
+    master_host = table->master;
 
     /**
      * Find a backend server to connect to. This is the extent of the
@@ -307,79 +662,67 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
      * and has had less connections over time than the candidate it will also
      * become the new candidate. This has the effect of spreading the
      * connections over different servers during periods of very low load.
+     *
+     * The eligibility and the weights of the servers come from the server table.
      */
-    for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+    const char *key;
+
+    if (table->preferred)
     {
-        if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(ref->server))
-        {
-            continue;
-        }
-        else
+        candidate = table->preferred;
+    }
+    else if (!master_host && (inst->bitvalue & SERVER_MASTER))
+    {
+        /* Master_host is NULL, no master server.  If requested router_option is 'master'
+         * candidate wll be NULL.
+         */
+    }
+    else if (table->lookup && (key = get_affinity_key(inst, session)))
+    {
+        /* The same key always maps to the same server while the servers stay the same */
+        candidate = table->servers[table->lookup[affinity_hash(key, 0) % RCR_LOOKUP_SIZE]].ref;
+    }
+    else
+    {
+        int candidate_weight = 0;
+
+        for (int i = 0; i < table->n_servers; i++)
         {
+            const RCR_SERVER *srv = &table->servers[i];
+            SERVER_REF *ref = srv->ref;
+
+            if (!srv->eligible)
+            {
+                continue;
+            }
+
             MXS_DEBUG("%lu [newSession] Examine server in port %d with "
-                      "%d connections. Status is %s, "
+                      "%d connections and weight %d. Status is %s, "
                       "inst->bitvalue is %d",
                       pthread_self(),
                       ref->server->port,
                       ref->connections,
+                      srv->weight,
                       STRSRVSTATUS(ref->server),
                       inst->bitmask);
-        }
-
-        /* Check server status bits against bitvalue from router_options */
-        if (ref && SERVER_IS_RUNNING(ref->server) &&
-            (ref->server->status & inst->bitmask & inst->bitvalue))
-        {
-            if (master_host)
-            {
-                if (ref == master_host && (inst->bitvalue & SERVER_SLAVE))
-                {
-                    /* Skip root master here, as it could also be slave of an external server that
-                     * is not in the configuration.  Intermediate masters (Relay Servers) are also
-                     * slave and will be selected as Slave(s)
-                     */
-
-                    continue;
-                }
-                if (ref == master_host && (inst->bitvalue & SERVER_MASTER))
-                {
-                    /* If option is "master" return only the root Master as there could be
-                     * intermediate masters (Relay Servers) and they must not be selected.
-                     */
-
-                    candidate = master_host;
-                    break;
-                }
-            }
-            else
-            {
-                /* Master_host is NULL, no master server.  If requested router_option is 'master'
-                 * candidate wll be NULL.
-                 */
-                if (inst->bitvalue & SERVER_MASTER)
-                {
-                    candidate = NULL;
-                    break;
-                }
-            }
 
             /* If no candidate set, set first running server as our initial candidate server */
             if (candidate == NULL)
             {
                 candidate = ref;
             }
-            else if (ref->weight == 0 || candidate->weight == 0)
+            else if (srv->weight == 0 || candidate_weight == 0)
             {
-                candidate = ref->weight ? ref : candidate;
+                candidate = srv->weight ? ref : candidate;
             }
-            else if (((ref->connections + 1) * 1000) / ref->weight <
-                     ((candidate->connections + 1) * 1000) / candidate->weight)
+            else if (((ref->connections + 1) * 1000) / srv->weight <
+                     ((candidate->connections + 1) * 1000) / candidate_weight)
             {
                 /* This running server has fewer connections, set it as a new candidate */
                 candidate = ref;
             }
-            else if (((ref->connections + 1) * 1000) / ref->weight ==
-                     ((candidate->connections + 1) * 1000) / candidate->weight &&
+            else if (((ref->connections + 1) * 1000) / srv->weight ==
+                     ((candidate->connections + 1) * 1000) / candidate_weight &&
                      ref->server->stats.n_connections < candidate->server->stats.n_connections)
             {
                 /* This running server has the same number of connections currently as the candidate
@@ -387,6 +730,11 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
                 candidate*/
                 candidate = ref;
             }
+
+            if (candidate == ref)
+            {
+                candidate_weight = srv->weight;
+            }
         }
     }
 
@@ -647,6 +995,31 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                        ref->connections);
         }
     }
+
+    if (router_inst->slow_start > 0)
+    {
+        dcb_printf(dcb, "\tSlow start period:             %d seconds\n",
+                   router_inst->slow_start);
+
+        /** Not a polling thread, the lock keeps the table from being freed */
+        spinlock_acquire(&router_inst->lock);
+        const RCR_SERVER_TABLE *table = router_inst->servers;
+        time_t now = time(NULL);
+
+        for (int i = 0; table && i < table->n_servers; i++)
+        {
+            const RCR_SERVER *srv = &table->servers[i];
+
+            if (srv->running_since && now - srv->running_since < router_inst->slow_start)
+            {
+                dcb_printf(dcb, "\t\t%-20s in slow start for %ld more seconds\n",
+                           srv->ref->server->unique_name,
+                           (long)(router_inst->slow_start - (now - srv->running_since)));
+            }
+        }
+
+        spinlock_release(&router_inst->lock);
+    }
 }
 
 /**
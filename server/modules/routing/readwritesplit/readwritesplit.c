@@ -19,6 +19,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
@@ -30,6 +31,7 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/alloc.h>
+#include <maxscale/trace.h>
 
 /**
  * @file readwritesplit.c   The entry points for the read/write query splitting
@@ -104,7 +106,10 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
                                         DCB *backend_dcb, GWBUF *errmsg);
 static bool have_enough_servers(ROUTER_CLIENT_SES *rses, const int min_nsrv,
                                 int router_nsrv, ROUTER_INSTANCE *router);
-static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int* n_backend);
+static bool create_backends(ROUTER_CLIENT_SES *rses, const SERVICE_SERVERS *servers,
+                            backend_ref_t** dest, int* n_backend);
+
+static MXS_TRACEPOINT tp_backend_error = {"rwsplit_backend_error", "server=%s hedged=%ld"};
 
 /**
  * Enum values for router parameters
@@ -122,6 +127,21 @@ static const MXS_ENUM_VALUE slave_selection_criteria_values[] =
     {"LEAST_ROUTER_CONNECTIONS", LEAST_ROUTER_CONNECTIONS},
     {"LEAST_BEHIND_MASTER",      LEAST_BEHIND_MASTER},
     {"LEAST_CURRENT_OPERATIONS", LEAST_CURRENT_OPERATIONS},
+    {"ADAPTIVE_ROUTING",         ADAPTIVE_ROUTING},
+    {NULL}
+};
+
+static const MXS_ENUM_VALUE master_accept_reads_values[] =
+{
+    {"false",    RW_MASTER_READS_OFF},
+    {"off",      RW_MASTER_READS_OFF},
+    {"no",       RW_MASTER_READS_OFF},
+    {"0",        RW_MASTER_READS_OFF},
+    {"true",     RW_MASTER_READS_ON},
+    {"on",       RW_MASTER_READS_ON},
+    {"yes",      RW_MASTER_READS_ON},
+    {"1",        RW_MASTER_READS_ON},
+    {"adaptive", RW_MASTER_READS_ADAPTIVE},
     {NULL}
 };
 
@@ -189,14 +209,27 @@ MXS_MODULE *MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 master_failure_mode_values
             },
+            {
+                "master_accept_reads",
+                MXS_MODULE_PARAM_ENUM,
+                "false",
+                MXS_MODULE_OPT_NONE,
+                master_accept_reads_values
+            },
             {"max_slave_replication_lag", MXS_MODULE_PARAM_INT, "-1"},
+            {"max_slave_replication_lag_ms", MXS_MODULE_PARAM_INT, "-1"},
             {"max_slave_connections", MXS_MODULE_PARAM_STRING, MAX_SLAVE_COUNT},
             {"retry_failed_reads", MXS_MODULE_PARAM_BOOL, "true"},
             {"disable_sescmd_history", MXS_MODULE_PARAM_BOOL, "true"},
             {"max_sescmd_history", MXS_MODULE_PARAM_COUNT, "0"},
             {"strict_multi_stmt",  MXS_MODULE_PARAM_BOOL, "true"},
             {"strict_sp_calls",  MXS_MODULE_PARAM_BOOL, "false"},
-            {"master_accept_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"per_statement_routing", MXS_MODULE_PARAM_BOOL, "false"},
+            {"lazy_connect", MXS_MODULE_PARAM_BOOL, "false"},
+            {"causal_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"galera_table_writes", MXS_MODULE_PARAM_BOOL, "false"},
+            {"max_reused_ps", MXS_MODULE_PARAM_COUNT, "0"},
+            {"switchover_timeout", MXS_MODULE_PARAM_COUNT, "0"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -274,12 +307,21 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
                                                                  master_failure_mode_values);
 
     router->rwsplit_config.max_slave_replication_lag = config_get_integer(params, "max_slave_replication_lag");
+    router->rwsplit_config.max_slave_replication_lag_ms = config_get_integer(params,
+                                                                             "max_slave_replication_lag_ms");
     router->rwsplit_config.retry_failed_reads = config_get_bool(params, "retry_failed_reads");
     router->rwsplit_config.strict_multi_stmt = config_get_bool(params, "strict_multi_stmt");
     router->rwsplit_config.strict_sp_calls = config_get_bool(params, "strict_sp_calls");
     router->rwsplit_config.disable_sescmd_history = config_get_bool(params, "disable_sescmd_history");
     router->rwsplit_config.max_sescmd_history = config_get_integer(params, "max_sescmd_history");
-    router->rwsplit_config.master_accept_reads = config_get_bool(params, "master_accept_reads");
+    router->rwsplit_config.master_accept_reads = config_get_enum(params, "master_accept_reads",
+                                                                 master_accept_reads_values);
+    router->rwsplit_config.per_statement_routing = config_get_bool(params, "per_statement_routing");
+    router->rwsplit_config.lazy_connect = config_get_bool(params, "lazy_connect");
+    router->rwsplit_config.causal_reads = config_get_bool(params, "causal_reads");
+    router->rwsplit_config.galera_table_writes = config_get_bool(params, "galera_table_writes");
+    router->rwsplit_config.max_reused_ps = config_get_integer(params, "max_reused_ps");
+    router->rwsplit_config.switchover_timeout = config_get_integer(params, "switchover_timeout");
 
     if (!handle_max_slaves(router, config_get_string(params, "max_slave_connections")) ||
         (options && !rwsplit_process_router_options(router, options)))
@@ -318,7 +360,8 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
 static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *session)
 {
     ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)router_inst;
-    ROUTER_CLIENT_SES *client_rses = (ROUTER_CLIENT_SES *)MXS_CALLOC(1, sizeof(ROUTER_CLIENT_SES));
+    ROUTER_CLIENT_SES *client_rses = (ROUTER_CLIENT_SES *)session_alloc_mem(session,
+                                                                             sizeof(ROUTER_CLIENT_SES));
 
     if (client_rses == NULL)
     {
@@ -331,16 +374,21 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
 
     client_rses->router = router;
     client_rses->client_dcb = session->client_dcb;
+    client_rses->rses_session = session;
     client_rses->have_tmp_tables = false;
+    client_rses->rses_tmp_table_filter = 0;
     client_rses->forced_node = NULL;
+    client_rses->rses_ro_trx_forced = false;
     memcpy(&client_rses->rses_config, &router->rwsplit_config, sizeof(client_rses->rses_config));
 
-    int router_nservers = router->service->n_dbref;
+    /** The sessions are created from one consistent set of servers */
+    const SERVICE_SERVERS *servers = service_get_servers(router->service);
+    int router_nservers = servers->n_servers;
     const int min_nservers = 1; /*< hard-coded for now */
 
     if (!have_enough_servers(client_rses, min_nservers, router_nservers, router))
     {
-        MXS_FREE(client_rses);
+        session_free_mem(session, client_rses);
         return NULL;
     }
 
@@ -349,9 +397,9 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
      */
     backend_ref_t *backend_ref;
 
-    if (!create_backends(client_rses, &backend_ref, &router_nservers))
+    if (!create_backends(client_rses, servers, &backend_ref, &router_nservers))
     {
-        MXS_FREE(client_rses);
+        session_free_mem(session, client_rses);
         return NULL;
     }
 
@@ -362,23 +410,32 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
     client_rses->rses_nbackends = router_nservers; /*< # of backend servers */
 
     backend_ref_t *master_ref = NULL; /*< pointer to selected master */
+    bool lazy = client_rses->rses_config.lazy_connect;
+
     if (!select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
-                                        max_nslaves, max_slave_rlag,
+                                        lazy ? 0 : max_nslaves, max_slave_rlag,
                                         client_rses->rses_config.slave_selection_criteria,
-                                        session, router, false))
+                                        session, router, false) ||
+        /** Without a master, the slaves are needed right away */
+        (lazy && master_ref == NULL &&
+         !select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
+                                         max_nslaves, max_slave_rlag,
+                                         client_rses->rses_config.slave_selection_criteria,
+                                         session, router, true)))
     {
         /**
          * Master and at least <min_nslaves> slaves must be found if the router is
          * in the strict mode. If sessions without master are allowed, only
          * <min_nslaves> slaves must be found.
          */
-        MXS_FREE(client_rses->rses_backend_ref);
-        MXS_FREE(client_rses);
+        session_free_mem(session, client_rses->rses_backend_ref);
+        session_free_mem(session, client_rses);
         return NULL;
     }
 
     /** Copy backend pointers to router session. */
     client_rses->rses_master_ref = master_ref;
+    client_rses->rses_slaves_pending = lazy && master_ref != NULL;
 
     if (client_rses->rses_config.rw_max_slave_conn_percent)
     {
@@ -417,6 +474,7 @@ static void closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_sessio
          * of every API function to quickly stop the processing of closed sessions.
          */
         router_cli_ses->rses_closed = true;
+        mxs_timer_cancel(&router_cli_ses->rses_master_timer);
 
         for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
         {
@@ -500,8 +558,21 @@ static void freeSession(MXS_ROUTER *router_instance, MXS_ROUTER_SESSION *router_
         }
     }
 
-    MXS_FREE(router_cli_ses->rses_backend_ref);
-    MXS_FREE(router_cli_ses);
+    for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
+    {
+        ps_free_backend(&router_cli_ses->rses_backend_ref[i]);
+    }
+
+    if (router_cli_ses->rses_ps)
+    {
+        hashtable_free(router_cli_ses->rses_ps);
+    }
+
+    ps_free_closed(router_cli_ses);
+
+    rwsplit_free_queue(router_cli_ses);
+    session_free_mem(router_cli_ses->rses_session, router_cli_ses->rses_backend_ref);
+    session_free_mem(router_cli_ses->rses_session, router_cli_ses);
     return;
 }
 
@@ -564,8 +635,28 @@ static int routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session,
     {
         closed_session_reply(querybuf);
     }
+    else if (rses->rses_large_query)
+    {
+        /** The packet continues a large query and goes where the query went */
+        rses->rses_large_query = rwsplit_is_large_packet(querybuf);
+
+        if (route_large_query_part(inst, rses, querybuf))
+        {
+            rval = 1;
+        }
+    }
     else
     {
+        /** The data packets of LOAD DATA LOCAL INFILE are routed separately */
+        rses->rses_large_query = !rses->rses_load_active && rwsplit_is_large_packet(querybuf);
+        rses->rses_large_target = NULL;
+
+        if (!rwsplit_pipeline_busy(rses))
+        {
+            /** The latency of the service is measured from here */
+            rses->rses_query_in = rwsplit_now_usecs();
+        }
+
         live_session_reply(&querybuf, rses);
         if (route_single_stmt(inst, rses, querybuf))
         {
@@ -604,6 +695,8 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
                failure_mode_to_str(router->rwsplit_config.master_failure_mode));
     dcb_printf(dcb, "\tmax_slave_replication_lag: %d\n",
                router->rwsplit_config.max_slave_replication_lag);
+    dcb_printf(dcb, "\tmax_slave_replication_lag_ms: %d\n",
+               router->rwsplit_config.max_slave_replication_lag_ms);
     dcb_printf(dcb, "\tretry_failed_reads:        %s\n",
                router->rwsplit_config.retry_failed_reads ? "true" : "false");
     dcb_printf(dcb, "\tstrict_multi_stmt:         %s\n",
@@ -615,7 +708,19 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
     dcb_printf(dcb, "\tmax_sescmd_history:        %d\n",
                router->rwsplit_config.max_sescmd_history);
     dcb_printf(dcb, "\tmaster_accept_reads:       %s\n",
-               router->rwsplit_config.master_accept_reads ? "true" : "false");
+               master_reads_to_str(router->rwsplit_config.master_accept_reads));
+    dcb_printf(dcb, "\tper_statement_routing:     %s\n",
+               router->rwsplit_config.per_statement_routing ? "true" : "false");
+    dcb_printf(dcb, "\tlazy_connect:              %s\n",
+               router->rwsplit_config.lazy_connect ? "true" : "false");
+    dcb_printf(dcb, "\tcausal_reads:              %s\n",
+               router->rwsplit_config.causal_reads ? "true" : "false");
+    dcb_printf(dcb, "\tgalera_table_writes:       %s\n",
+               router->rwsplit_config.galera_table_writes ? "true" : "false");
+    dcb_printf(dcb, "\tmax_reused_ps:             %d\n",
+               router->rwsplit_config.max_reused_ps);
+    dcb_printf(dcb, "\tswitchover_timeout:        %d\n",
+               router->rwsplit_config.switchover_timeout);
     dcb_printf(dcb, "\n");
 
     if (router->stats.n_queries > 0)
@@ -637,6 +742,8 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
                router->stats.n_slave, slave_pct);
     dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%" PRIu64 " (%.2f%%)\n",
                router->stats.n_all, all_pct);
+    dcb_printf(dcb, "\tNumber of sessions moved to a new master:	%" PRIu64 "\n",
+               router->stats.n_master_switches);
 
     if ((weightby = serviceGetWeightingParameter(router->service)) != NULL)
     {
@@ -700,6 +807,47 @@ static void clientReply(MXS_ROUTER *instance,
     backend_ref_t *bref = get_bref_from_dcb(router_cli_ses, backend_dcb);
     CHK_BACKEND_REF(bref);
     sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+    bool reply_complete = false;
+
+    if (bref->bref_draining)
+    {
+        /** The other slave of a hedged read replied first, discard this reply */
+        if (!drain_reply(bref, &writebuf))
+        {
+            return;
+        }
+
+        bref->bref_draining = false;
+        bref_clear_state(bref, BREF_QUERY_ACTIVE);
+
+        if (!sescmd_cursor_is_active(scur))
+        {
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
+
+        if (writebuf == NULL)
+        {
+            return;
+        }
+    }
+    else if (bref == router_cli_ses->rses_hedged[0] || bref == router_cli_ses->rses_hedged[1])
+    {
+        backend_ref_t *other = bref == router_cli_ses->rses_hedged[0] ?
+                               router_cli_ses->rses_hedged[1] : router_cli_ses->rses_hedged[0];
+        router_cli_ses->rses_hedged[0] = NULL;
+        router_cli_ses->rses_hedged[1] = NULL;
+
+        if (BREF_IS_IN_USE(other) && BREF_IS_QUERY_ACTIVE(other))
+        {
+            memset(&other->bref_drain, 0, sizeof(other->bref_drain));
+            other->bref_draining = true;
+        }
+
+        /** Statements that arrived during the hedged read wait for this reply */
+        memset(&router_cli_ses->rses_reply, 0, sizeof(router_cli_ses->rses_reply));
+        router_cli_ses->rses_pipeline = bref;
+        router_cli_ses->rses_n_replies = 1;
+    }
 
     /** Statement was successfully executed, free the stored statement */
     session_clear_stmt(backend_dcb->session);
@@ -743,6 +891,7 @@ static void clientReply(MXS_ROUTER *instance,
 
         /** Set response status as replied */
         bref_clear_state(bref, BREF_WAITING_RESULT);
+        reply_complete = writebuf != NULL;
     }
     /**
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
@@ -750,9 +899,43 @@ static void clientReply(MXS_ROUTER *instance,
      */
     else if (BREF_IS_QUERY_ACTIVE(bref))
     {
-        bref_clear_state(bref, BREF_QUERY_ACTIVE);
-        /** Set response status as replied */
-        bref_clear_state(bref, BREF_WAITING_RESULT);
+        bool complete = true;
+
+        if (bref == router_cli_ses->rses_pipeline && router_cli_ses->rses_n_replies > 0)
+        {
+            /** The backend is executing queries that were sent without
+             * waiting for the earlier replies */
+            router_cli_ses->rses_n_replies -= count_replies(&router_cli_ses->rses_reply, writebuf);
+
+            if (router_cli_ses->rses_n_replies < 0)
+            {
+                router_cli_ses->rses_n_replies = 0;
+            }
+
+            complete = router_cli_ses->rses_n_replies == 0;
+        }
+
+        if (bref->query_sent)
+        {
+            server_add_response_time(bref->ref->server, rwsplit_now_usecs() - bref->query_sent);
+            bref->query_sent = 0;
+        }
+
+        if (complete)
+        {
+            server_add_latency(bref->ref->server, rwsplit_now_usecs() - bref->query_started);
+            reply_complete = true;
+
+            if (router_cli_ses->rses_causal_pending && bref == router_cli_ses->rses_master_ref)
+            {
+                /** The write is now visible on the master */
+                router_cli_ses->rses_causal_write = time(NULL);
+                router_cli_ses->rses_causal_pending = false;
+            }
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            /** Set response status as replied */
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
     }
 
     if (writebuf != NULL && client_dcb != NULL)
@@ -761,6 +944,18 @@ static void clientReply(MXS_ROUTER *instance,
         MXS_SESSION_ROUTE_REPLY(backend_dcb->session, writebuf);
     }
 
+    if (reply_complete && router_cli_ses->rses_query_in && !rwsplit_pipeline_busy(router_cli_ses))
+    {
+        service_add_latency(router_inst->service, rwsplit_now_usecs() - router_cli_ses->rses_query_in);
+        router_cli_ses->rses_query_in = 0;
+    }
+
+    if (bref == router_cli_ses->rses_master_ref && !BREF_IS_WAITING_RESULT(bref) &&
+        !sescmd_cursor_is_active(scur))
+    {
+        check_reported_session_state(router_cli_ses, backend_dcb);
+    }
+
     /** There is one pending session command to be executed. */
     if (sescmd_cursor_is_active(scur))
     {
@@ -811,6 +1006,11 @@ static void clientReply(MXS_ROUTER *instance,
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    if (router_cli_ses->rses_queue)
+    {
+        rwsplit_route_queued(router_inst, router_cli_ses);
+    }
 }
 
 
@@ -818,14 +1018,17 @@ static void clientReply(MXS_ROUTER *instance,
  * @brief Get router capabilities (API)
  *
  * Return a bit map indicating the characteristics of this particular router.
- * In this case, the only bit set indicates that the router wants to receive
- * data for routing as whole SQL statements.
+ * The router wants to receive data for routing as whole SQL statements, with
+ * the transaction state tracked from the statements and corrected with the
+ * session state that the master reports.
  *
- * @return RCAP_TYPE_STMT_INPUT.
+ * @return RCAP_TYPE_STMT_INPUT, RCAP_TYPE_TRANSACTION_TRACKING,
+ *         RCAP_TYPE_SESSION_STATE_TRACKING and RCAP_TYPE_REPLY_INFO.
  */
 static uint64_t getCapabilities(MXS_ROUTER* instance)
 {
-    return RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING;
+    return RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING |
+           RCAP_TYPE_SESSION_STATE_TRACKING | RCAP_TYPE_REPLY_INFO;
 }
 
 /*
@@ -928,9 +1131,29 @@ void bref_set_state(backend_ref_t *bref, bref_state_t state)
         }
     }
 
+    if ((state & BREF_QUERY_ACTIVE) && (bref->bref_state & BREF_QUERY_ACTIVE) == 0)
+    {
+        bref->query_sent = rwsplit_now_usecs();
+        bref->query_started = bref->query_sent;
+    }
+
     bref->bref_state |= state;
 }
 
+/**
+ * @brief Get the current monotonic time
+ *
+ * Used to measure the response times of the backend servers.
+ *
+ * @return Current time in microseconds
+ */
+int64_t rwsplit_now_usecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * @brief Free resources belonging to a property
  *
@@ -1159,14 +1382,15 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                 c = GET_SELECT_CRITERIA(value);
                 ss_dassert(c == LEAST_GLOBAL_CONNECTIONS ||
                            c == LEAST_ROUTER_CONNECTIONS || c == LEAST_BEHIND_MASTER ||
-                           c == LEAST_CURRENT_OPERATIONS || c == UNDEFINED_CRITERIA);
+                           c == LEAST_CURRENT_OPERATIONS || c == ADAPTIVE_ROUTING ||
+                           c == UNDEFINED_CRITERIA);
 
                 if (c == UNDEFINED_CRITERIA)
                 {
                     MXS_ERROR("Unknown slave selection criteria \"%s\". "
                               "Allowed values are LEAST_GLOBAL_CONNECTIONS, "
-                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER,"
-                              "and LEAST_CURRENT_OPERATIONS.",
+                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER, "
+                              "LEAST_CURRENT_OPERATIONS and ADAPTIVE_ROUTING.",
                               STRCRITERIA(router->rwsplit_config.slave_selection_criteria));
                     success = false;
                 }
@@ -1185,7 +1409,15 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             }
             else if (strcmp(options[i], "master_accept_reads") == 0)
             {
-                router->rwsplit_config.master_accept_reads = config_truth_value(value);
+                if (strcmp(value, "adaptive") == 0)
+                {
+                    router->rwsplit_config.master_accept_reads = RW_MASTER_READS_ADAPTIVE;
+                }
+                else
+                {
+                    router->rwsplit_config.master_accept_reads = config_truth_value(value) ?
+                                                                 RW_MASTER_READS_ON : RW_MASTER_READS_OFF;
+                }
             }
             else if (strcmp(options[i], "strict_multi_stmt") == 0)
             {
@@ -1199,6 +1431,30 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.retry_failed_reads = config_truth_value(value);
             }
+            else if (strcmp(options[i], "per_statement_routing") == 0)
+            {
+                router->rwsplit_config.per_statement_routing = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "lazy_connect") == 0)
+            {
+                router->rwsplit_config.lazy_connect = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads") == 0)
+            {
+                router->rwsplit_config.causal_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "galera_table_writes") == 0)
+            {
+                router->rwsplit_config.galera_table_writes = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "max_reused_ps") == 0)
+            {
+                router->rwsplit_config.max_reused_ps = atoi(value);
+            }
+            else if (strcmp(options[i], "switchover_timeout") == 0)
+            {
+                router->rwsplit_config.switchover_timeout = atoi(value);
+            }
             else if (strcmp(options[i], "master_failure_mode") == 0)
             {
                 if (strcasecmp(value, "fail_instantly") == 0)
@@ -1310,8 +1566,15 @@ static void handleError(MXS_ROUTER *instance,
                     SERVER *srv = rses->rses_master_ref->ref->server;
                     bool can_continue = false;
 
-                    if (rses->rses_config.master_failure_mode != RW_FAIL_INSTANTLY &&
-                        (bref == NULL || !BREF_IS_WAITING_RESULT(bref)))
+                    if (rses->rses_config.switchover_timeout > 0 &&
+                        rwsplit_can_switch_master(rses))
+                    {
+                        /** The next write waits for a new master and the
+                         * session continues on it */
+                        can_continue = true;
+                    }
+                    else if (rses->rses_config.master_failure_mode != RW_FAIL_INSTANTLY &&
+                             (bref == NULL || !BREF_IS_WAITING_RESULT(bref)))
                     {
                         /** The failure of a master is not considered a critical
                          * failure as partial functionality still remains. Reads
@@ -1363,6 +1626,7 @@ static void handleError(MXS_ROUTER *instance,
                                   problem_dcb->server->unique_name);
 
                         rses->forced_node = NULL;
+                        rses->rses_ro_trx_forced = false;
                         *succp = false;
                         break;
                     }
@@ -1453,9 +1717,18 @@ static void handle_error_reply_client(MXS_SESSION *ses, ROUTER_CLIENT_SES *rses,
     }
 }
 
-static bool reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old, GWBUF *stored)
+/**
+ * @brief Retry a failed read on another server
+ *
+ * @param rses   Router session
+ * @param old    The backend where the read failed
+ * @param stored The read
+ *
+ * @return The backend where the read was retried or NULL if it couldn't be retried
+ */
+static backend_ref_t *reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old, GWBUF *stored)
 {
-    bool success = false;
+    backend_ref_t *success = NULL;
 
     if (!session_trx_is_active(rses->client_dcb->session))
     {
@@ -1475,7 +1748,7 @@ static bool reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old
                 if (bref->bref_dcb->func.write(bref->bref_dcb, stored))
                 {
                     MXS_INFO("Retrying failed read at '%s'.", bref->ref->server->unique_name);
-                    success = true;
+                    success = bref;
                     break;
                 }
             }
@@ -1492,7 +1765,7 @@ static bool reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old
             if (bref->bref_dcb->func.write(bref->bref_dcb, stored))
             {
                 MXS_INFO("Retrying failed read at '%s'.", bref->ref->server->unique_name);
-                success = true;
+                success = bref;
             }
         }
     }
@@ -1542,19 +1815,46 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
     }
     CHK_BACKEND_REF(bref);
 
+    /**
+     * A slave of a hedged read doesn't owe the client a reply if the other
+     * slave has already replied or is still executing the same query.
+     */
+    bool hedged = bref->bref_draining;
+    bref->bref_draining = false;
+    MXS_TRACE(tp_backend_error, bref->ref->server->unique_name, hedged, 0, 0);
+
+    if (bref == myrses->rses_hedged[0] || bref == myrses->rses_hedged[1])
+    {
+        backend_ref_t *other = bref == myrses->rses_hedged[0] ?
+                               myrses->rses_hedged[1] : myrses->rses_hedged[0];
+        myrses->rses_hedged[0] = NULL;
+        myrses->rses_hedged[1] = NULL;
+        hedged = BREF_IS_IN_USE(other) && BREF_IS_QUERY_ACTIVE(other);
+    }
+
     /**
      * If query was sent through the bref and it is waiting for reply from
      * the backend server it is necessary to send an error to the client
      * because it is waiting for reply.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    /** The replies to all the queries that the backend was executing are lost */
+    int n_lost = 0;
+
+    if (bref == myrses->rses_pipeline && myrses->rses_n_replies > 0)
+    {
+        n_lost = myrses->rses_n_replies;
+        myrses->rses_n_replies = 0;
+    }
+
+    if (BREF_IS_WAITING_RESULT(bref) && !hedged)
     {
         GWBUF *stored = NULL;
         const SERVER *target = NULL;
+        backend_ref_t *retry = NULL;
 
         if (!session_take_stmt(backend_dcb->session, &stored, &target) ||
-            target != bref->ref->server ||
-            !reroute_stored_statement(*rses, bref, stored))
+            target != bref->ref->server || n_lost > 1 ||
+            (retry = reroute_stored_statement(*rses, bref, stored)) == NULL)
         {
             /**
              * We failed to route the stored statement or no statement was
@@ -1568,9 +1868,22 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
                  * We need to route an error to the client to let it know
                  * that the query failed. */
                 DCB *client_dcb = ses->client_dcb;
-                client_dcb->func.write(client_dcb, gwbuf_clone(errmsg));
+
+                for (int i = 0; i < MXS_MAX(n_lost, 1); i++)
+                {
+                    client_dcb->func.write(client_dcb, gwbuf_clone(errmsg));
+                }
             }
         }
+        else if (n_lost == 1)
+        {
+            /** The statements that wait for the reply now wait for the retried read */
+            memset(&myrses->rses_reply, 0, sizeof(myrses->rses_reply));
+            myrses->rses_pipeline = retry;
+            myrses->rses_n_replies = 1;
+            bref_set_state(retry, BREF_QUERY_ACTIVE);
+            bref_set_state(retry, BREF_WAITING_RESULT);
+        }
     }
 
     RW_CHK_DCB(bref, backend_dcb);
@@ -1597,6 +1910,11 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
                                                ses, inst, true);
     }
 
+    if (succp && myrses->rses_queue)
+    {
+        rwsplit_route_queued(inst, myrses);
+    }
+
     return succp;
 }
 
@@ -1685,47 +2003,39 @@ static void free_rwsplit_instance(ROUTER_INSTANCE *router)
  * set of used servers.
  *
  * @param rses Client router session
+ * @param servers The snapshot of the servers of the service
  * @param dest Destination where the array of backens is stored
  * @param n_backend Number of items in the array
  * @return True on success, false on error
  */
-static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int* n_backend)
+static bool create_backends(ROUTER_CLIENT_SES *rses, const SERVICE_SERVERS *servers,
+                            backend_ref_t** dest, int* n_backend)
 {
-    backend_ref_t *backend_ref = (backend_ref_t *)MXS_CALLOC(1, *n_backend * sizeof(backend_ref_t));
+    backend_ref_t *backend_ref = (backend_ref_t *)session_alloc_mem(rses->rses_session,
+                                                                    *n_backend * sizeof(backend_ref_t));
 
     if (backend_ref == NULL)
     {
         return false;
     }
 
-    int i = 0;
-
-    for (SERVER_REF *sref = rses->router->service->dbref; sref && i < *n_backend; sref = sref->next)
+    for (int i = 0; i < *n_backend; i++)
     {
-        if (sref->active)
-        {
 #if defined(SS_DEBUG)
-            backend_ref[i].bref_chk_top = CHK_NUM_BACKEND_REF;
-            backend_ref[i].bref_chk_tail = CHK_NUM_BACKEND_REF;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_chk_top = CHK_NUM_SESCMD_CUR;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_chk_tail = CHK_NUM_SESCMD_CUR;
+        backend_ref[i].bref_chk_top = CHK_NUM_BACKEND_REF;
+        backend_ref[i].bref_chk_tail = CHK_NUM_BACKEND_REF;
+        backend_ref[i].bref_sescmd_cur.scmd_cur_chk_top = CHK_NUM_SESCMD_CUR;
+        backend_ref[i].bref_sescmd_cur.scmd_cur_chk_tail = CHK_NUM_SESCMD_CUR;
 #endif
-            backend_ref[i].bref_state = 0;
-            backend_ref[i].ref = sref;
-            /** store pointers to sescmd list to both cursors */
-            backend_ref[i].bref_sescmd_cur.scmd_cur_rses = rses;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_active = false;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
-                &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
-            backend_ref[i].bref_sescmd_cur.scmd_cur_cmd = NULL;
-            i++;
-        }
-    }
-
-    if (i < *n_backend)
-    {
-        MXS_INFO("The service reported %d servers but only took %d into use.", *n_backend, i);
-        *n_backend = i;
+        backend_ref[i].bref_state = 0;
+        backend_ref[i].ref = servers->servers[i].ref;
+        backend_ref[i].bref_weight = servers->servers[i].weight;
+        /** store pointers to sescmd list to both cursors */
+        backend_ref[i].bref_sescmd_cur.scmd_cur_rses = rses;
+        backend_ref[i].bref_sescmd_cur.scmd_cur_active = false;
+        backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
+            &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+        backend_ref[i].bref_sescmd_cur.scmd_cur_cmd = NULL;
     }
 
     *dest = backend_ref;
@@ -33,8 +33,11 @@
 
 #include <maxscale/dcb.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
+#include <maxscale/sescmd.h>
 
 MXS_BEGIN_DECLS
 
@@ -72,7 +75,8 @@ typedef enum
     TARGET_SLAVE        = 0x02,
     TARGET_NAMED_SERVER = 0x04,
     TARGET_ALL          = 0x08,
-    TARGET_RLAG_MAX     = 0x10
+    TARGET_RLAG_MAX     = 0x10,
+    TARGET_HEDGED       = 0x20
 } route_target_t;
 
 #define TARGET_IS_MASTER(t)       (t & TARGET_MASTER)
@@ -80,6 +84,7 @@ typedef enum
 #define TARGET_IS_NAMED_SERVER(t) (t & TARGET_NAMED_SERVER)
 #define TARGET_IS_ALL(t)          (t & TARGET_ALL)
 #define TARGET_IS_RLAG_MAX(t)     (t & TARGET_RLAG_MAX)
+#define TARGET_IS_HEDGED(t)       (t & TARGET_HEDGED)
 
 typedef struct rses_property_st rses_property_t;
 typedef struct router_client_session ROUTER_CLIENT_SES;
@@ -106,8 +111,9 @@ typedef enum select_criteria
     LEAST_ROUTER_CONNECTIONS,   /*< connections established by this router */
     LEAST_BEHIND_MASTER,
     LEAST_CURRENT_OPERATIONS,
-    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS,
-    LAST_CRITERIA               /*< not used except for an index */
+    ADAPTIVE_ROUTING,           /*< lowest average response time */
+    LAST_CRITERIA,              /*< not used except for an index */
+    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS
 } select_criteria_t;
 
 static inline const char* select_criteria_to_str(select_criteria_t type)
@@ -126,6 +132,9 @@ static inline const char* select_criteria_to_str(select_criteria_t type)
     case LEAST_CURRENT_OPERATIONS:
         return "LEAST_CURRENT_OPERATIONS";
 
+    case ADAPTIVE_ROUTING:
+        return "ADAPTIVE_ROUTING";
+
     default:
         return "UNDEFINED_CRITERIA";
     }
@@ -160,6 +169,35 @@ static inline const char* failure_mode_to_str(enum failure_mode type)
     }
 }
 
+/**
+ * Controls whether reads are sent to the master
+ */
+enum master_reads
+{
+    RW_MASTER_READS_OFF, /**< Only if no slave can be used */
+    RW_MASTER_READS_ON, /**< Like any slave */
+    RW_MASTER_READS_ADAPTIVE /**< When the master is less loaded than the best slave */
+};
+
+static inline const char* master_reads_to_str(enum master_reads type)
+{
+    switch (type)
+    {
+    case RW_MASTER_READS_OFF:
+        return "false";
+
+    case RW_MASTER_READS_ON:
+        return "true";
+
+    case RW_MASTER_READS_ADAPTIVE:
+        return "adaptive";
+
+    default:
+        ss_dassert(false);
+        return "UNDEFINED_MODE";
+    }
+}
+
 /** default values for rwsplit configuration parameters */
 #define CONFIG_MAX_SLAVE_CONN 1
 #define CONFIG_MAX_SLAVE_RLAG -1 /*< not used */
@@ -173,7 +211,9 @@ static inline const char* failure_mode_to_str(enum failure_mode type)
         strncmp(s,"LEAST_ROUTER_CONNECTIONS", strlen("LEAST_ROUTER_CONNECTIONS")) == 0 ?        \
         LEAST_ROUTER_CONNECTIONS : (                                                            \
         strncmp(s,"LEAST_CURRENT_OPERATIONS", strlen("LEAST_CURRENT_OPERATIONS")) == 0 ?        \
-        LEAST_CURRENT_OPERATIONS : UNDEFINED_CRITERIA))))
+        LEAST_CURRENT_OPERATIONS : (                                                            \
+        strncmp(s,"ADAPTIVE_ROUTING", strlen("ADAPTIVE_ROUTING")) == 0 ?                        \
+        ADAPTIVE_ROUTING : UNDEFINED_CRITERIA)))))
 
 /**
  * Session variable command
@@ -184,13 +224,16 @@ typedef struct mysql_sescmd_st
     skygw_chk_t        my_sescmd_chk_top;
 #endif
     rses_property_t*   my_sescmd_prop;       /*< parent property */
-    GWBUF*             my_sescmd_buf;        /*< query buffer */
+    MXS_SESCMD*        my_sescmd_cmd;        /*< the interned command, shared by sessions */
     unsigned char      my_sescmd_packet_type; /*< packet type */
     bool               my_sescmd_is_replied; /*< is cmd replied to client */
     unsigned char      reply_cmd; /*< The reply command. One of OK, ERR, RESULTSET or
                                    *  LOCAL_INFILE. Slave servers are compared to this
                                    *  when they return session command replies.*/
     int      position; /*< Position of this command */
+    char*              my_sescmd_key; /*< What the command sets, NULL if it can't be
+                                       *  compacted away from the history */
+    qc_query_type_t    my_sescmd_qtype; /*< Type of the command */
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_tail;
 #endif
@@ -234,6 +277,45 @@ typedef struct sescmd_cursor_st
 #endif
 } sescmd_cursor_t;
 
+/**
+ * Binary protocol prepared statement
+ */
+typedef struct rwsplit_ps_st
+{
+    int             position;  /**< Position of the COM_STMT_PREPARE in the session command history */
+    qc_query_type_t type;      /**< Type of the prepared statement */
+    bool            long_data; /**< Parameter data has been sent to the master */
+    bool            cursor;    /**< The statement has been executed with a cursor */
+    uint32_t        id;        /**< The ID the client uses */
+    char*           sql;       /**< The statement, kept only if it can be reused */
+    size_t          sql_len;   /**< Length of the statement */
+    GWBUF*          response;  /**< The response to the COM_STMT_PREPARE, kept with the statement */
+    struct rwsplit_ps_st* next; /**< The next closed statement */
+} rwsplit_ps_t;
+
+/**
+ * How much of the payload of a packet is read to find where a reply ends. An
+ * OK packet has its status flags after two length-encoded integers.
+ */
+#define REPLY_PEEK_LEN 21
+
+/**
+ * Progress of a reply that is read packet by packet, either to discard it or
+ * to find where it ends when several queries are executing on a backend
+ */
+typedef struct reply_drain_st
+{
+    uint8_t  header[MYSQL_HEADER_LEN + REPLY_PEEK_LEN]; /**< Packet header and the start of the payload */
+    uint32_t header_len;   /**< How many bytes of the header have been read */
+    uint32_t peek_len;     /**< How many bytes of the payload are read into the header */
+    uint32_t payload_left; /**< How much of the current packet is still unread */
+    int      n_packets;    /**< Number of packets read in the current result */
+    int      n_eof;        /**< Number of EOF packets read in the current result */
+    bool     examined;     /**< The type of the current packet has been checked */
+    bool     continued;    /**< The next packet continues a large packet */
+    bool     last;         /**< The current packet ends the reply */
+} reply_drain_t;
+
 /**
  * Reference to BACKEND.
  *
@@ -252,12 +334,32 @@ typedef struct backend_ref_st
     GWBUF*          bref_pending_cmd; /**< For stmt which can't be routed due active sescmd execution */
     unsigned char   reply_cmd;  /**< The reply the backend server sent to a session command.
                                  * Used to detect slaves that fail to execute session command. */
+    int64_t         query_sent; /**< When the active query was sent, in microseconds */
+    int64_t         query_started; /**< Like query_sent but kept until the reply is complete */
+    bool            bref_draining; /**< The other slave answered the hedged read first */
+    reply_drain_t   bref_drain; /**< Progress of the discarded reply */
+    HASHTABLE*      bref_ps_ids; /**< Backend's prepared statement IDs by session command position */
+    SERVER_STATE    bref_server_state; /**< State of the server when the backends were last selected */
+    int             bref_weight; /**< Weight of the server when the backends were last selected */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
     int closed_at; /** DEBUG: Line number where this backend reference was closed */
 } backend_ref_t;
 
+/**
+ * A statement that waits for the replies to the earlier statements
+ */
+typedef struct rwsplit_queued_st
+{
+    GWBUF*                    buffer; /**< The statement */
+    backend_ref_t*            bref;   /**< The chosen target or NULL if the statement is
+                                       * routed when it is taken from the queue */
+    bool                      continued; /**< The buffer continues the large query
+                                          * queued before it */
+    struct rwsplit_queued_st* next;   /**< The next statement */
+} rwsplit_queued_t;
+
 typedef struct rwsplit_config_st
 {
     int               rw_max_slave_conn_percent; /**< Maximum percentage of slaves
@@ -265,17 +367,25 @@ typedef struct rwsplit_config_st
     int               max_slave_connections; /**< Maximum number of slaves for each connection*/
     select_criteria_t slave_selection_criteria; /**< The slave selection criteria */
     int               max_slave_replication_lag; /**< Maximum replication lag */
+    int               max_slave_replication_lag_ms; /**< Maximum replication lag in milliseconds */
     mxs_target_t      use_sql_variables_in; /**< Whether to send user variables
                                                 * to master or all nodes */
     int               max_sescmd_history; /**< Maximum amount of session commands to store */
     bool              disable_sescmd_history; /**< Disable session command history */
-    bool              master_accept_reads; /**< Use master for reads */
+    enum master_reads master_accept_reads; /**< Use master for reads
+                                               * @see enum master_reads */
     bool              strict_multi_stmt; /**< Force non-multistatement queries to be routed
                                              * to the master after a multistatement query. */
     bool              strict_sp_calls; /**< Lock session to master after an SP call */
     enum failure_mode master_failure_mode; /**< Master server failure handling mode.
                                                * @see enum failure_mode */
     bool              retry_failed_reads; /**< Retry failed reads on other servers */
+    bool              per_statement_routing; /**< Balance each read by the current load */
+    bool              lazy_connect; /**< Connect to slaves when the first read is routed */
+    bool              causal_reads; /**< Only read from slaves that have the session's writes */
+    bool              galera_table_writes; /**< Spread writes over Galera nodes by their tables */
+    int               max_reused_ps; /**< Closed prepared statements kept open for reuse */
+    int               switchover_timeout; /**< Milliseconds writes wait for a new master */
 } rwsplit_config_t;
 
 #if defined(PREP_STMT_CACHING)
@@ -317,10 +427,35 @@ struct router_client_session
     int              rses_nsescmd;  /*< Number of executed session commands */
     bool             rses_load_active; /*< If LOAD DATA LOCAL INFILE is being currently executed */
     bool             have_tmp_tables;
+    uint64_t         rses_tmp_table_filter; /*< Bloom filter of the temporary table names */
     uint64_t         rses_load_data_sent; /*< How much data has been sent */
     DCB*             client_dcb;
+    MXS_SESSION*     rses_session; /*< The session, this and rses_backend_ref are its memory */
     int              pos_generator;
     backend_ref_t    *forced_node; /*< Current server where all queries should be sent */
+    bool             rses_ro_trx_forced; /*< forced_node was chosen for a READ ONLY transaction */
+    unsigned int     rses_read_offset; /*< Where the next slave search starts */
+    bool             rses_slaves_pending; /*< Slaves are connected on the first read */
+    bool             rses_causal_pending; /*< A write is waiting for its reply */
+    time_t           rses_causal_write; /*< When the last write was acknowledged */
+    backend_ref_t*   rses_galera_ref; /*< Galera node of the latest write, used by transactions */
+    backend_ref_t*   rses_hedged[2]; /*< Slaves executing the same read, the first reply is used */
+    backend_ref_t*   rses_pipeline; /*< Backend executing the queries whose replies are pending */
+    int              rses_n_replies; /*< Number of pending replies from rses_pipeline */
+    reply_drain_t    rses_reply; /*< Progress of the current reply from rses_pipeline */
+    rwsplit_queued_t* rses_queue; /*< Statements waiting for the pending replies */
+    rwsplit_queued_t* rses_queue_tail; /*< The last statement in rses_queue */
+    bool             rses_dequeuing; /*< A statement taken from rses_queue is being routed */
+    bool             rses_large_query; /*< The next packet continues a large query */
+    backend_ref_t*   rses_large_target; /*< The backend the last query was written to */
+    int64_t          rses_query_in; /*< When the client sent the first query whose reply is
+                                     * pending, in microseconds, or 0 */
+    HASHTABLE*       rses_ps; /*< Prepared statements by the ID the client uses */
+    rwsplit_ps_t*    rses_ps_closed; /*< Closed statements kept for reuse, the latest first */
+    int              rses_n_ps_closed; /*< Number of statements in rses_ps_closed */
+    MXS_TIMER        rses_master_timer; /*< Checks for a new master while writes wait */
+    long             rses_master_deadline; /*< Heartbeat until which writes wait for a
+                                            * new master, 0 if the master is in use */
 #if defined(PREP_STMT_CACHING)
     HASHTABLE*       rses_prep_stmt[2];
 #endif
@@ -341,6 +476,7 @@ typedef struct
     uint64_t n_master;   /*< Number of stmts sent to master */
     uint64_t n_slave;    /*< Number of stmts sent to slave */
     uint64_t n_all;      /*< Number of stmts sent to all */
+    uint64_t n_master_switches; /*< Number of sessions moved to a new master */
 } ROUTER_STATS;
 
 /**
@@ -50,6 +50,9 @@ void closed_session_reply(GWBUF *querybuf);
 void live_session_reply(GWBUF **querybuf, ROUTER_CLIENT_SES *rses);
 void print_error_packet(ROUTER_CLIENT_SES *rses, GWBUF *buf, DCB *dcb);
 void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend_ref_t *bref);
+bool drain_reply(backend_ref_t *bref, GWBUF **buffer);
+int count_replies(reply_drain_t *drain, GWBUF *buffer);
+void check_reported_session_state(ROUTER_CLIENT_SES *rses, DCB *backend_dcb);
 bool execute_sescmd_in_backend(backend_ref_t *backend_ref);
 bool handle_target_is_all(route_target_t route_target,
                           ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
@@ -71,6 +74,27 @@ backend_ref_t *get_bref_from_dcb(ROUTER_CLIENT_SES *rses, DCB *dcb);
 void rses_property_done(rses_property_t *prop);
 int rses_get_max_slavecount(ROUTER_CLIENT_SES *rses, int router_nservers);
 int rses_get_max_replication_lag(ROUTER_CLIENT_SES *rses);
+int64_t rwsplit_now_usecs();
+
+/**
+ * Check whether a packet is the first or a middle part of a query that is
+ * larger than the maximum packet size
+ */
+static inline bool rwsplit_is_large_packet(GWBUF *buffer)
+{
+    return gwbuf_length(buffer) == MYSQL_HEADER_LEN + GW_MYSQL_MAX_PACKET_LEN;
+}
+
+/**
+ * Check whether a type mask is that of a statement that changes the transaction
+ * or session state. Such a statement is neither a stored procedure call nor
+ * a LOAD DATA LOCAL INFILE, so its operation need not be resolved.
+ */
+static inline bool is_trx_or_session_stmt(uint32_t qtype)
+{
+    return (qtype & (QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_COMMIT | QUERY_TYPE_ROLLBACK |
+                     QUERY_TYPE_SESSION_WRITE | QUERY_TYPE_GSYSVAR_WRITE)) != 0;
+}
 
 /*
  * The following are implemented in rwsplit_route_stmt.c
@@ -94,6 +118,7 @@ bool handle_hinted_target(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
                           route_target_t route_target, DCB **target_dcb);
 bool handle_slave_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                             DCB **target_dcb);
+bool handle_hedged_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
 bool handle_master_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                              DCB **target_dcb);
 bool handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
@@ -102,6 +127,11 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                          GWBUF *querybuf, ROUTER_INSTANCE *inst,
                          int packet_type,
                          qc_query_type_t qtype);
+bool route_large_query_part(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+bool rwsplit_pipeline_busy(ROUTER_CLIENT_SES *rses);
+bool rwsplit_can_switch_master(ROUTER_CLIENT_SES *rses);
+void rwsplit_route_queued(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses);
+void rwsplit_free_queue(ROUTER_CLIENT_SES *rses);
 
 /*
  * The following are implemented in rwsplit_session_cmd.c
@@ -121,6 +151,7 @@ GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur);
 GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                                      backend_ref_t *bref,
                                      bool *reconnect);
+void compact_sescmd_history(ROUTER_CLIENT_SES *rses, const char *key);
 
 /*
  * The following are implemented in rwsplit_select_backends.c
@@ -133,10 +164,20 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
                                     MXS_SESSION *session,
                                     ROUTER_INSTANCE *router,
                                     bool active_session);
+bool select_connect_new_master(ROUTER_CLIENT_SES *rses);
 
 /*
  * The following are implemented in rwsplit_tmp_table_multi.c
  */
+
+/** How a multi-statement query is routed */
+typedef enum multi_stmt_class
+{
+    MULTI_STMT_READ,    /*< Only reads, routed like a single read */
+    MULTI_STMT_WRITE,   /*< Leaves the session state alone, routed to the master */
+    MULTI_STMT_SESSION  /*< Modifies the session state, all later queries go to the master */
+} multi_stmt_class_t;
+
 void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
                           GWBUF *querybuf,
                           mysql_server_cmd_t packet_type);
@@ -146,10 +187,26 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
 void check_create_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
                             GWBUF *querybuf, qc_query_type_t type);
 bool check_for_multi_stmt(GWBUF *buf, void *protocol, mysql_server_cmd_t packet_type);
-bool check_for_sp_call(GWBUF *buf, mysql_server_cmd_t packet_type);
+multi_stmt_class_t classify_multi_stmt(GWBUF *buf, qc_query_type_t *qtype);
+bool check_for_sp_call(GWBUF *buf, mysql_server_cmd_t packet_type, uint32_t qtype);
 qc_query_type_t determine_query_type(GWBUF *querybuf, int packet_type, bool non_empty_packet);
 void close_failed_bref(backend_ref_t *bref, bool fatal);
 
+/*
+ * The following are implemented in rwsplit_ps.c
+ */
+bool ps_command_has_id(int packet_type);
+void ps_store_backend_id(backend_ref_t *bref, mysql_sescmd_t *scmd, GWBUF *reply);
+void ps_store_client_id(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                        mysql_sescmd_t *scmd, GWBUF *reply);
+rwsplit_ps_t* ps_get(ROUTER_CLIENT_SES *rses, GWBUF *buffer);
+qc_query_type_t ps_get_exec_type(rwsplit_ps_t *ps, GWBUF *buffer);
+GWBUF* ps_rewrite_id(backend_ref_t *bref, rwsplit_ps_t *ps, GWBUF *buffer);
+bool ps_route_close(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps, GWBUF *buffer);
+bool ps_route_prepare(ROUTER_CLIENT_SES *rses, GWBUF *buffer);
+void ps_free_backend(backend_ref_t *bref);
+void ps_free_closed(ROUTER_CLIENT_SES *rses);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,7 @@
 #include <maxscale/protocol/mysql.h>
 #include <mysqld_error.h>
 #include <maxscale/alloc.h>
+#include <maxscale/mysql_utils.h>
 
 #if defined(SS_DEBUG)
 #include <maxscale/protocol/mysql.h>
@@ -361,14 +362,15 @@ void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend
     if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_ERR) &&
         MYSQL_IS_ERROR_PACKET(((uint8_t *)GWBUF_DATA(writebuf))))
     {
-        uint8_t *buf = (uint8_t *)GWBUF_DATA((scur->scmd_cur_cmd->my_sescmd_buf));
+        GWBUF *cmdbuf = mxs_sescmd_buffer(scur->scmd_cur_cmd->my_sescmd_cmd);
+        uint8_t *buf = (uint8_t *)GWBUF_DATA(cmdbuf);
         uint8_t *replybuf = (uint8_t *)GWBUF_DATA(writebuf);
         size_t len = MYSQL_GET_PAYLOAD_LEN(buf);
         size_t replylen = MYSQL_GET_PAYLOAD_LEN(replybuf);
         char *err = strndup(&((char *)replybuf)[8], 5);
         char *replystr = strndup(&((char *)replybuf)[13], replylen - 4 - 5);
 
-        ss_dassert(len + 4 == GWBUF_LENGTH(scur->scmd_cur_cmd->my_sescmd_buf));
+        ss_dassert(len + 4 == GWBUF_LENGTH(cmdbuf));
 
         MXS_ERROR("Failed to execute session command in [%s]:%d. Error was: %s %s",
                   bref->ref->server->name,
@@ -378,6 +380,265 @@ void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend
     }
 }
 
+/**
+ * @brief Check whether a packet ends a result or the whole reply
+ *
+ * A result is either a single OK packet or a result set which ends in its
+ * second EOF packet. If the status flags of the last packet have
+ * SERVER_MORE_RESULTS_EXIST set, another result follows. An ERR packet always
+ * ends the reply. An answer to LOAD DATA LOCAL INFILE is not counted as a
+ * packet so that the OK packet, which the server sends after the data, ends it.
+ *
+ * @param drain The progress of the reply
+ */
+static void examine_reply_packet(reply_drain_t *drain)
+{
+    uint32_t payload_len = gw_mysql_get_byte3(drain->header);
+    uint8_t *payload = drain->header + MYSQL_HEADER_LEN;
+    uint8_t cmd = drain->peek_len > 0 ? payload[0] : 0;
+    bool end_of_result = false;
+    uint16_t status = 0;
+
+    if (cmd == MYSQL_REPLY_ERR)
+    {
+        drain->last = true;
+    }
+    else if (drain->n_packets == 0 && cmd == MYSQL_REPLY_OK)
+    {
+        size_t pos = 1;
+        pos += mxs_leint_bytes(payload + pos);
+        pos += mxs_leint_bytes(payload + pos);
+
+        if (pos + 2 <= drain->peek_len)
+        {
+            status = gw_mysql_get_byte2(payload + pos);
+        }
+        end_of_result = true;
+    }
+    else if (drain->n_packets == 0 && cmd == MYSQL_REPLY_LOCAL_INFILE)
+    {
+        /** The client sends the file next */
+    }
+    else
+    {
+        if (cmd == MYSQL_REPLY_EOF && payload_len < MYSQL_EOF_PACKET_LEN && ++drain->n_eof == 2)
+        {
+            if (drain->peek_len >= 5)
+            {
+                status = gw_mysql_get_byte2(payload + 3);
+            }
+            end_of_result = true;
+        }
+        drain->n_packets++;
+    }
+
+    if (end_of_result)
+    {
+        if (status & SERVER_MORE_RESULTS_EXIST)
+        {
+            drain->n_packets = 0;
+            drain->n_eof = 0;
+        }
+        else
+        {
+            drain->last = true;
+        }
+    }
+}
+
+/**
+ * @brief Read a reply up to its end
+ *
+ * The reply can be split into any number of buffers so the progress is stored
+ * in @c drain. Only the headers and the start of the packets are copied.
+ *
+ * @param drain  The progress of the reply, reset when the reply ends
+ * @param buffer Buffer containing the next part of the reply
+ * @param len    Length of the buffer
+ * @param offset Offset where to start, on return the offset after the reply
+ *               or the length of the buffer
+ *
+ * @return True if the whole reply has been read
+ */
+static bool read_reply(reply_drain_t *drain, GWBUF *buffer, size_t len, size_t *offset)
+{
+    bool done = false;
+
+    while (*offset < len && !done)
+    {
+        if (drain->header_len < MYSQL_HEADER_LEN)
+        {
+            size_t n = gwbuf_copy_data(buffer, *offset, MYSQL_HEADER_LEN - drain->header_len,
+                                       drain->header + drain->header_len);
+            *offset += n;
+            drain->header_len += n;
+
+            if (drain->header_len == MYSQL_HEADER_LEN)
+            {
+                drain->payload_left = gw_mysql_get_byte3(drain->header);
+                drain->peek_len = drain->continued ? 0 : MXS_MIN(drain->payload_left, REPLY_PEEK_LEN);
+            }
+        }
+        else if (drain->header_len < MYSQL_HEADER_LEN + drain->peek_len)
+        {
+            size_t n = gwbuf_copy_data(buffer, *offset,
+                                       MYSQL_HEADER_LEN + drain->peek_len - drain->header_len,
+                                       drain->header + drain->header_len);
+            *offset += n;
+            drain->header_len += n;
+            drain->payload_left -= n;
+        }
+
+        if (drain->header_len == MYSQL_HEADER_LEN + drain->peek_len)
+        {
+            if (!drain->examined && !drain->continued)
+            {
+                examine_reply_packet(drain);
+            }
+            drain->examined = true;
+
+            /** Skip the rest of the payload */
+            size_t n = MXS_MIN(drain->payload_left, len - *offset);
+            *offset += n;
+            drain->payload_left -= n;
+
+            if (drain->payload_left == 0)
+            {
+                drain->continued = gw_mysql_get_byte3(drain->header) == GW_MYSQL_MAX_PACKET_LEN;
+                done = drain->last && !drain->continued;
+                drain->header_len = 0;
+                drain->peek_len = 0;
+                drain->examined = false;
+            }
+        }
+    }
+
+    if (done)
+    {
+        memset(drain, 0, sizeof(*drain));
+    }
+
+    return done;
+}
+
+/**
+ * @brief Discard a part of a reply that is not sent to the client
+ *
+ * @param bref   Backend reference whose reply is discarded
+ * @param buffer Buffer containing the next part of the reply, freed or the
+ *               part that follows the reply is left in it
+ *
+ * @return True if the whole reply has been read
+ */
+bool drain_reply(backend_ref_t *bref, GWBUF **buffer)
+{
+    const MXS_REPLY_INFO *info = modutil_get_reply_info(*buffer);
+    size_t offset = 0;
+    bool done = false;
+
+    if (info)
+    {
+        /** The backend protocol has already found where the reply ends */
+        offset = gwbuf_length(*buffer);
+
+        for (int i = 0; i < info->n_packets; i++)
+        {
+            if (info->packets[i].flags & MXS_REPLY_END)
+            {
+                offset = info->packets[i].offset + info->packets[i].length;
+                done = true;
+                break;
+            }
+        }
+    }
+    else
+    {
+        done = read_reply(&bref->bref_drain, *buffer, gwbuf_length(*buffer), &offset);
+    }
+
+    *buffer = gwbuf_consume(*buffer, offset);
+
+    return done;
+}
+
+/**
+ * @brief Count the replies that end in a buffer
+ *
+ * @param drain  The progress of the reply that the buffer continues
+ * @param buffer Buffer containing the next part of the replies
+ *
+ * @return Number of replies that end in the buffer
+ */
+int count_replies(reply_drain_t *drain, GWBUF *buffer)
+{
+    const MXS_REPLY_INFO *info = modutil_get_reply_info(buffer);
+
+    if (info)
+    {
+        return info->n_replies;
+    }
+
+    size_t len = gwbuf_length(buffer);
+    size_t offset = 0;
+    int n = 0;
+
+    while (offset < len)
+    {
+        if (read_reply(drain, buffer, len, &offset))
+        {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Correct the transaction state with the state that the master reports
+ *
+ * The transaction state and the autocommit mode are deduced from the
+ * statements before they are routed. Statements that implicitly commit a
+ * transaction, or that start or end one inside a stored procedure, change
+ * them without the classifier noticing. Once the master has replied and no
+ * other statements are on their way, the status flags of its latest reply
+ * tell the actual state.
+ *
+ * @param rses        Router client session
+ * @param backend_dcb The DCB of the master
+ */
+void check_reported_session_state(ROUTER_CLIENT_SES *rses, DCB *backend_dcb)
+{
+    MySQLProtocol *proto = (MySQLProtocol *)backend_dcb->protocol;
+    MXS_SESSION *session = backend_dcb->session;
+
+    if (!proto->have_status || rwsplit_pipeline_busy(rses) || rses->rses_queue)
+    {
+        return;
+    }
+
+    bool autocommit = proto->server_status & SERVER_STATUS_AUTOCOMMIT;
+    bool in_trx = proto->server_status & SERVER_STATUS_IN_TRANS;
+    mxs_session_trx_state_t trx_state = session_get_trx_state(session);
+
+    if (session_is_autocommit(session) != autocommit)
+    {
+        MXS_INFO("Master reports that autocommit is %s.", autocommit ? "enabled" : "disabled");
+        session_set_autocommit(session, autocommit);
+    }
+
+    if (in_trx && !(trx_state & SESSION_TRX_ACTIVE_BIT))
+    {
+        MXS_INFO("Master reports an open transaction, routing the following statements to it.");
+        session_set_trx_state(session, SESSION_TRX_ACTIVE);
+    }
+    else if (!in_trx && autocommit && (trx_state & SESSION_TRX_ACTIVE_BIT) &&
+             !(trx_state & SESSION_TRX_ENDING_BIT))
+    {
+        MXS_INFO("Master reports that the transaction has ended.");
+        session_set_trx_state(session, trx_state | SESSION_TRX_ENDING_BIT);
+    }
+}
+
 /**
  * @brief If session command cursor is passive, sends the command to backend for
  * execution.
@@ -440,8 +701,8 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
     switch (scur->scmd_cur_cmd->my_sescmd_packet_type)
     {
     case MYSQL_COM_CHANGE_USER:
-        /** This makes it possible to handle replies correctly */
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+        /** The clone is of type GWBUF_TYPE_SESCMD, which makes it possible
+         * to handle replies correctly */
         buf = sescmd_cursor_clone_querybuf(scur);
         rc = dcb->func.auth(dcb, NULL, dcb->session, buf);
         break;
@@ -457,7 +718,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
             data = dcb->session->client_dcb->data;
             *data->db = 0;
-            tmpbuf = scur->scmd_cur_cmd->my_sescmd_buf;
+            tmpbuf = mxs_sescmd_buffer(scur->scmd_cur_cmd->my_sescmd_cmd);
             qlen = MYSQL_GET_PAYLOAD_LEN((unsigned char *) GWBUF_DATA(tmpbuf));
             if (qlen)
             {
@@ -477,11 +738,9 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
     case MYSQL_COM_QUERY:
     default:
         /**
-         * Mark session command buffer, it triggers writing
-         * MySQL command to protocol
+         * The clone is of type GWBUF_TYPE_SESCMD, which triggers
+         * writing MySQL command to protocol
          */
-
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         buf = sescmd_cursor_clone_querybuf(scur);
         rc = dcb->func.write(dcb, buf);
         break;
@@ -0,0 +1,622 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/service.h>
+#include <maxscale/session.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_ps.c   The functions that track binary protocol prepared
+ * statements.
+ *
+ * A COM_STMT_PREPARE is executed on all backends as a session command and it
+ * is classified only once. Each backend assigns its own ID to the statement
+ * and the client is given the ID of the backend whose response it receives.
+ * The commands that refer to the statement are routed with the stored type
+ * and the client's ID is replaced with the ID of the target backend.
+ *
+ * With max_reused_ps, a statement the client closes is left open on the
+ * backends and kept with the response the client got when it prepared it. If
+ * the client prepares the same statement again, it gets the same response
+ * and the statement is used again without contacting the backends. The
+ * client's ID stays valid, as the backend that assigned it still has the
+ * statement.
+ */
+
+/** Offset of the statement ID in both the commands and the COM_STMT_PREPARE response */
+#define PS_ID_OFFSET (MYSQL_HEADER_LEN + 1)
+
+/** Offset of the flags of a COM_STMT_EXECUTE */
+#define PS_EXEC_FLAGS_OFFSET (MYSQL_HEADER_LEN + 5)
+
+static int ps_hashfun(const void *key)
+{
+    return *(const uint32_t*)key;
+}
+
+static int ps_cmpfun(const void *v1, const void *v2)
+{
+    uint32_t i1 = *(const uint32_t*)v1;
+    uint32_t i2 = *(const uint32_t*)v2;
+
+    return i1 == i2 ? 0 : (i1 < i2 ? -1 : 1);
+}
+
+static void* ps_iddup(const void *id)
+{
+    uint32_t *rval = (uint32_t*)MXS_MALLOC(sizeof(*rval));
+
+    if (rval)
+    {
+        *rval = *(const uint32_t*)id;
+    }
+
+    return rval;
+}
+
+static void ps_free(void *data)
+{
+    rwsplit_ps_t *ps = (rwsplit_ps_t*)data;
+
+    if (ps)
+    {
+        MXS_FREE(ps->sql);
+        gwbuf_free(ps->response);
+        MXS_FREE(ps);
+    }
+}
+
+static HASHTABLE* ps_table_alloc(HASHCOPYFN vcopyfn, HASHFREEFN vfreefn)
+{
+    HASHTABLE *h = hashtable_alloc(7, ps_hashfun, ps_cmpfun);
+
+    if (h)
+    {
+        hashtable_memory_fns(h, ps_iddup, vcopyfn, rwsplit_hfree, vfreefn);
+    }
+    else
+    {
+        MXS_ERROR("Failed to allocate a new hashtable.");
+    }
+
+    return h;
+}
+
+static bool ps_read_id(GWBUF *buffer, uint32_t *id)
+{
+    uint8_t data[sizeof(*id)];
+    bool rval = false;
+
+    if (gwbuf_copy_data(buffer, PS_ID_OFFSET, sizeof(data), data) == sizeof(data))
+    {
+        *id = gw_mysql_get_byte4(data);
+        rval = true;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check if a command refers to a prepared statement by its ID
+ *
+ * @param packet_type Command type
+ * @return True if the command starts with a statement ID
+ */
+bool ps_command_has_id(int packet_type)
+{
+    return packet_type == MYSQL_COM_STMT_EXECUTE ||
+           packet_type == MYSQL_COM_STMT_SEND_LONG_DATA ||
+           packet_type == MYSQL_COM_STMT_RESET ||
+           packet_type == MYSQL_COM_STMT_FETCH ||
+           packet_type == MYSQL_COM_STMT_CLOSE;
+}
+
+static bool ps_read_response_id(backend_ref_t *bref, mysql_sescmd_t *scmd,
+                                GWBUF *reply, uint32_t *id)
+{
+    return scmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+           bref->reply_cmd == MYSQL_REPLY_OK && ps_read_id(reply, id);
+}
+
+/**
+ * @brief Store the statement ID a backend assigned to a prepared statement
+ *
+ * @param bref  Backend that sent the response
+ * @param scmd  The session command the response is for
+ * @param reply The response
+ */
+void ps_store_backend_id(backend_ref_t *bref, mysql_sescmd_t *scmd, GWBUF *reply)
+{
+    uint32_t id;
+
+    if (ps_read_response_id(bref, scmd, reply, &id))
+    {
+        uint32_t position = scmd->position;
+
+        if (bref->bref_ps_ids == NULL)
+        {
+            bref->bref_ps_ids = ps_table_alloc(ps_iddup, rwsplit_hfree);
+        }
+
+        if (bref->bref_ps_ids)
+        {
+            hashtable_delete(bref->bref_ps_ids, &position);
+            hashtable_add(bref->bref_ps_ids, &position, &id);
+        }
+    }
+}
+
+/**
+ * @brief Keep what is needed to reuse a prepared statement
+ *
+ * @param ps       The prepared statement
+ * @param prepare  The COM_STMT_PREPARE
+ * @param response The complete response to it
+ */
+static void ps_store_reusable(rwsplit_ps_t *ps, GWBUF *prepare, GWBUF *response)
+{
+    size_t prepare_len = gwbuf_length(prepare);
+    size_t response_len = gwbuf_length(response);
+
+    if (prepare_len > MYSQL_HEADER_LEN + 1)
+    {
+        ps->sql_len = prepare_len - MYSQL_HEADER_LEN - 1;
+        ps->sql = (char*)MXS_MALLOC(ps->sql_len);
+        ps->response = gwbuf_alloc(response_len);
+
+        if (ps->sql && ps->response)
+        {
+            gwbuf_copy_data(prepare, MYSQL_HEADER_LEN + 1, ps->sql_len, (uint8_t*)ps->sql);
+            gwbuf_copy_data(response, 0, response_len, GWBUF_DATA(ps->response));
+            gwbuf_set_type(ps->response, GWBUF_TYPE_MYSQL);
+        }
+        else
+        {
+            MXS_FREE(ps->sql);
+            gwbuf_free(ps->response);
+            ps->sql = NULL;
+            ps->response = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Store a prepared statement by the ID that is sent to the client
+ *
+ * @param rses  Router session
+ * @param bref  Backend whose response is sent to the client
+ * @param scmd  The session command the response is for
+ * @param reply The response
+ */
+void ps_store_client_id(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                        mysql_sescmd_t *scmd, GWBUF *reply)
+{
+    uint32_t id;
+
+    if (ps_read_response_id(bref, scmd, reply, &id))
+    {
+        if (rses->rses_ps == NULL)
+        {
+            rses->rses_ps = ps_table_alloc(NULL, ps_free);
+        }
+
+        rwsplit_ps_t *ps = (rwsplit_ps_t*)MXS_CALLOC(1, sizeof(*ps));
+
+        if (ps && rses->rses_ps)
+        {
+            ps->position = scmd->position;
+            ps->type = scmd->my_sescmd_qtype;
+            ps->id = id;
+
+            if (rses->rses_config.max_reused_ps > 0)
+            {
+                ps_store_reusable(ps, mxs_sescmd_buffer(scmd->my_sescmd_cmd), reply);
+            }
+
+            hashtable_delete(rses->rses_ps, &id);
+
+            if (!hashtable_add(rses->rses_ps, &id, ps))
+            {
+                ps_free(ps);
+            }
+        }
+        else
+        {
+            MXS_FREE(ps);
+        }
+    }
+}
+
+/**
+ * @brief Find the prepared statement a command refers to
+ *
+ * @param rses   Router session
+ * @param buffer Command with a statement ID
+ * @return The prepared statement or NULL if the client's ID is not known
+ */
+rwsplit_ps_t* ps_get(ROUTER_CLIENT_SES *rses, GWBUF *buffer)
+{
+    uint32_t id;
+    rwsplit_ps_t *rval = NULL;
+
+    if (rses->rses_ps && ps_read_id(buffer, &id))
+    {
+        rval = (rwsplit_ps_t*)hashtable_fetch(rses->rses_ps, &id);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Get the type of a COM_STMT_EXECUTE
+ *
+ * Executions that open a cursor or use parameter data sent with
+ * COM_STMT_SEND_LONG_DATA depend on state that only the master has. An open
+ * cursor is also remembered so that the statement is not reused.
+ *
+ * @param ps     The prepared statement
+ * @param buffer The COM_STMT_EXECUTE
+ * @return The type of the prepared statement
+ */
+qc_query_type_t ps_get_exec_type(rwsplit_ps_t *ps, GWBUF *buffer)
+{
+    uint8_t flags = 0;
+    qc_query_type_t rval = QUERY_TYPE_EXEC_STMT;
+
+    gwbuf_copy_data(buffer, PS_EXEC_FLAGS_OFFSET, 1, &flags);
+
+    if (flags != 0)
+    {
+        ps->cursor = true;
+    }
+
+    if (!ps->long_data && flags == 0)
+    {
+        rval = (qc_query_type_t)(ps->type & ~QUERY_TYPE_PREPARE_STMT);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Replace the client's statement ID with the backend's own ID
+ *
+ * @param bref   The target backend
+ * @param ps     The prepared statement
+ * @param buffer Command with the client's statement ID
+ * @return New buffer with the backend's statement ID or NULL if the
+ * statement is not prepared on the backend
+ */
+GWBUF* ps_rewrite_id(backend_ref_t *bref, rwsplit_ps_t *ps, GWBUF *buffer)
+{
+    uint32_t position = ps->position;
+    uint32_t *id = NULL;
+    GWBUF *rval = NULL;
+
+    if (bref->bref_ps_ids)
+    {
+        id = (uint32_t*)hashtable_fetch(bref->bref_ps_ids, &position);
+    }
+
+    ss_dassert(buffer->next == NULL);
+
+    if (id && (rval = gwbuf_alloc_and_load(GWBUF_LENGTH(buffer), GWBUF_DATA(buffer))))
+    {
+        gwbuf_set_type(rval, buffer->gwbuf_type);
+        gw_mysql_set_byte4(GWBUF_DATA(rval) + PS_ID_OFFSET, *id);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Close a prepared statement on all backends
+ *
+ * COM_STMT_CLOSE has no response so it is written directly to each backend
+ * with the backend's own statement ID.
+ *
+ * @param rses   Router session
+ * @param ps     The prepared statement
+ * @param buffer A COM_STMT_CLOSE
+ * @return False if writing to a backend failed
+ */
+static bool ps_close_backends(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps, GWBUF *buffer)
+{
+    uint32_t position = ps->position;
+    bool rval = true;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref))
+        {
+            GWBUF *close = ps_rewrite_id(bref, ps, buffer);
+
+            if (close && bref->bref_dcb->func.write(bref->bref_dcb, close) != 1)
+            {
+                MXS_ERROR("Failed to close prepared statement on '%s'.",
+                          bref->ref->server->unique_name);
+                rval = false;
+            }
+        }
+
+        if (bref->bref_ps_ids)
+        {
+            hashtable_delete(bref->bref_ps_ids, &position);
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Close a statement that was kept for reuse
+ *
+ * @param rses Router session
+ * @param ps   The statement, freed by this function
+ */
+static void ps_close_kept(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps)
+{
+    GWBUF *close = gwbuf_alloc(MYSQL_HEADER_LEN + 5);
+
+    if (close)
+    {
+        uint8_t *data = GWBUF_DATA(close);
+        gw_mysql_set_byte3(data, 5);
+        data[3] = 0;
+        data[4] = MYSQL_COM_STMT_CLOSE;
+        gw_mysql_set_byte4(data + PS_ID_OFFSET, ps->id);
+        gwbuf_set_type(close, GWBUF_TYPE_MYSQL);
+
+        ps_close_backends(rses, ps, close);
+        gwbuf_free(close);
+    }
+
+    ps_free(ps);
+}
+
+/**
+ * @brief Keep a statement the client closes open for reuse
+ *
+ * The statement is kept if it has no state besides its text. When there are
+ * more than max_reused_ps kept statements, the oldest one is closed.
+ *
+ * @param rses Router session
+ * @param ps   The prepared statement
+ * @return True if the statement was kept
+ */
+static bool ps_keep(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps)
+{
+    if (ps->sql == NULL || ps->long_data || ps->cursor)
+    {
+        return false;
+    }
+
+    rwsplit_ps_t *kept = (rwsplit_ps_t*)MXS_MALLOC(sizeof(*kept));
+
+    if (kept == NULL)
+    {
+        return false;
+    }
+
+    /** The table frees the original */
+    *kept = *ps;
+    ps->sql = NULL;
+    ps->response = NULL;
+
+    kept->next = rses->rses_ps_closed;
+    rses->rses_ps_closed = kept;
+
+    if (++rses->rses_n_ps_closed > rses->rses_config.max_reused_ps)
+    {
+        rwsplit_ps_t **last = &rses->rses_ps_closed;
+
+        while ((*last)->next)
+        {
+            last = &(*last)->next;
+        }
+
+        ps_close_kept(rses, *last);
+        *last = NULL;
+        rses->rses_n_ps_closed--;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Close a prepared statement
+ *
+ * The statement is either kept for reuse or closed on all backends.
+ *
+ * @param rses   Router session
+ * @param ps     The prepared statement
+ * @param buffer The COM_STMT_CLOSE
+ * @return False if writing to a backend failed
+ */
+bool ps_route_close(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps, GWBUF *buffer)
+{
+    uint32_t id;
+    bool rval = true;
+
+    if (!ps_keep(rses, ps))
+    {
+        rval = ps_close_backends(rses, ps, buffer);
+    }
+
+    if (ps_read_id(buffer, &id))
+    {
+        /** Frees the prepared statement */
+        hashtable_delete(rses->rses_ps, &id);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check if a kept statement can still be used
+ *
+ * Every backend in use must still have the statement and the client's ID
+ * must not have been given to another statement after a backend reconnected.
+ */
+static bool ps_is_usable(ROUTER_CLIENT_SES *rses, rwsplit_ps_t *ps)
+{
+    uint32_t position = ps->position;
+    uint32_t id = ps->id;
+
+    if (rses->rses_ps && hashtable_fetch(rses->rses_ps, &id))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            (bref->bref_ps_ids == NULL || hashtable_fetch(bref->bref_ps_ids, &position) == NULL))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reply to a COM_STMT_PREPARE with a statement kept for reuse
+ *
+ * The response is sent only if no earlier command is waiting for its reply,
+ * as it would otherwise overtake that reply.
+ *
+ * @param rses   Router session
+ * @param buffer The COM_STMT_PREPARE
+ * @return True if the client was sent the response of a kept statement
+ */
+bool ps_route_prepare(ROUTER_CLIENT_SES *rses, GWBUF *buffer)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            (BREF_IS_WAITING_RESULT(bref) || sescmd_cursor_is_active(&bref->bref_sescmd_cur)))
+        {
+            return false;
+        }
+    }
+
+    size_t len = gwbuf_length(buffer);
+
+    if (len <= MYSQL_HEADER_LEN + 1 || buffer->next)
+    {
+        return false;
+    }
+
+    const char *sql = (const char*)GWBUF_DATA(buffer) + MYSQL_HEADER_LEN + 1;
+    size_t sql_len = len - MYSQL_HEADER_LEN - 1;
+    rwsplit_ps_t **prev = &rses->rses_ps_closed;
+
+    while (*prev && ((*prev)->sql_len != sql_len || memcmp((*prev)->sql, sql, sql_len) != 0))
+    {
+        prev = &(*prev)->next;
+    }
+
+    rwsplit_ps_t *ps = *prev;
+
+    if (ps == NULL)
+    {
+        return false;
+    }
+
+    *prev = ps->next;
+    ps->next = NULL;
+    rses->rses_n_ps_closed--;
+
+    if (!ps_is_usable(rses, ps))
+    {
+        ps_close_kept(rses, ps);
+        return false;
+    }
+
+    if (rses->rses_ps == NULL)
+    {
+        rses->rses_ps = ps_table_alloc(NULL, ps_free);
+    }
+
+    GWBUF *response = gwbuf_alloc_and_load(GWBUF_LENGTH(ps->response), GWBUF_DATA(ps->response));
+    uint32_t id = ps->id;
+
+    if (rses->rses_ps == NULL || response == NULL || !hashtable_add(rses->rses_ps, &id, ps))
+    {
+        gwbuf_free(response);
+        ps_close_kept(rses, ps);
+        return false;
+    }
+
+    MXS_INFO("Reusing prepared statement %u.", id);
+    gwbuf_set_type(response, GWBUF_TYPE_MYSQL);
+    MXS_SESSION_ROUTE_REPLY(rses->rses_session, response);
+
+    if (rses->rses_query_in)
+    {
+        service_add_latency(rses->router->service, rwsplit_now_usecs() - rses->rses_query_in);
+        rses->rses_query_in = 0;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Forget the statement IDs of a backend
+ *
+ * The IDs are not valid after the connection to the backend is closed.
+ *
+ * @param bref Backend reference
+ */
+void ps_free_backend(backend_ref_t *bref)
+{
+    if (bref->bref_ps_ids)
+    {
+        hashtable_free(bref->bref_ps_ids);
+        bref->bref_ps_ids = NULL;
+    }
+}
+
+/**
+ * @brief Free the statements kept for reuse
+ *
+ * The statements are not closed on the backends as this is called only
+ * when the session is freed.
+ *
+ * @param rses Router session
+ */
+void ps_free_closed(ROUTER_CLIENT_SES *rses)
+{
+    while (rses->rses_ps_closed)
+    {
+        rwsplit_ps_t *ps = rses->rses_ps_closed;
+        rses->rses_ps_closed = ps->next;
+        ps_free(ps);
+    }
+
+    rses->rses_n_ps_closed = 0;
+}
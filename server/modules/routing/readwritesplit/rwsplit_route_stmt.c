@@ -19,8 +19,11 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/poll.h>
 
 #include <maxscale/router.h>
+#include <maxscale/trace.h>
 #include "rwsplit_internal.h"
 /**
  * @file rwsplit_route_stmt.c   The functions that support the routing of
@@ -43,6 +46,19 @@ static backend_ref_t *check_candidate_bref(backend_ref_t *cand,
                                            backend_ref_t *new,
                                            select_criteria_t sc);
 static backend_ref_t *get_root_master_bref(ROUTER_CLIENT_SES *rses);
+static bool handle_ps_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                             rwsplit_ps_t *ps, GWBUF *querybuf, DCB *target_dcb);
+static bool reply_must_wait(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+static bool queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, backend_ref_t *bref);
+static void add_pending_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+static bool handle_galera_write_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                       GWBUF *querybuf, DCB **target_dcb);
+static bool wait_for_new_master(ROUTER_CLIENT_SES *rses);
+static bool hold_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+
+static MXS_TRACEPOINT tp_route = {"rwsplit_route", "command=%ld type=0x%lx target=0x%lx"};
+static MXS_TRACEPOINT tp_target = {"rwsplit_target", "server=%s pending=%ld"};
+static MXS_TRACEPOINT tp_queue = {"rwsplit_queue", "server=%s"};
 
 /**
  * Routing function. Find out query type, backend type, and target DCB(s).
@@ -63,14 +79,47 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     route_target_t route_target;
     bool succp = false;
     bool non_empty_packet;
+    rwsplit_ps_t *ps = NULL;
 
     ss_dassert(querybuf->next == NULL); // The buffer must be contiguous.
     ss_dassert(!GWBUF_IS_TYPE_UNDEFINED(querybuf));
 
+    /** The data of LOAD DATA LOCAL INFILE is sent while its query is executing */
+    bool load_data = rses->rses_load_active;
+
     /* packet_type is a problem as it is MySQL specific */
     packet_type = determine_packet_type(querybuf, &non_empty_packet);
+
+    if (!load_data && !is_packet_a_query(packet_type) && rwsplit_pipeline_busy(rses))
+    {
+        /** Only the replies to queries are followed, the other commands are
+         * routed when the replies to the earlier statements are complete */
+        return queue_stmt(rses, querybuf, NULL);
+    }
+
+    if (packet_type == MYSQL_COM_STMT_PREPARE && !load_data && rses->rses_ps_closed &&
+        ps_route_prepare(rses, querybuf))
+    {
+        /** The client prepared a statement it had closed, the statement
+         * still exists on the backends and is neither classified nor sent */
+        return true;
+    }
+
     qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
 
+    if (ps_command_has_id(packet_type) && (ps = ps_get(rses, querybuf)))
+    {
+        if (packet_type == MYSQL_COM_STMT_EXECUTE)
+        {
+            /** Use the type the statement got when it was prepared */
+            qtype = ps_get_exec_type(ps, querybuf);
+        }
+        else if (packet_type == MYSQL_COM_STMT_SEND_LONG_DATA)
+        {
+            ps->long_data = true;
+        }
+    }
+
     if (non_empty_packet)
     {
         handle_multi_temp_and_load(rses, querybuf, packet_type, (int *)&qtype);
@@ -106,7 +155,19 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         MXS_INFO("> LOAD DATA LOCAL INFILE finished: %lu bytes sent.",
                  rses->rses_load_data_sent + gwbuf_length(querybuf));
     }
-    if (TARGET_IS_ALL(route_target))
+
+    MXS_TRACE(tp_route, packet_type, qtype, route_target, 0);
+
+    if (ps && packet_type == MYSQL_COM_STMT_CLOSE)
+    {
+        succp = ps_route_close(rses, ps, querybuf);
+    }
+    else if (TARGET_IS_ALL(route_target) && rwsplit_pipeline_busy(rses))
+    {
+        /** The reply to a session command comes from any of the backends */
+        succp = queue_stmt(rses, querybuf, NULL);
+    }
+    else if (TARGET_IS_ALL(route_target))
     {
         succp = handle_target_is_all(route_target, inst, rses, querybuf, packet_type, qtype);
     }
@@ -124,14 +185,46 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         {
             succp = handle_hinted_target(rses, querybuf, route_target, &target_dcb);
         }
+        else if (TARGET_IS_SLAVE(route_target) && TARGET_IS_HEDGED(route_target) &&
+                 !rwsplit_pipeline_busy(rses) && !rwsplit_is_large_packet(querybuf) &&
+                 handle_hedged_target(inst, rses, querybuf))
+        {
+            /** The query was sent to two slaves, the first reply is used */
+            succp = true;
+        }
         else if (TARGET_IS_SLAVE(route_target))
         {
             succp = handle_slave_is_target(inst, rses, &target_dcb);
-            store_stmt = rses->rses_config.retry_failed_reads;
+            /** A read can't be retried if later queries are executing or if
+             * only its first part would be stored */
+            store_stmt = rses->rses_config.retry_failed_reads && !rwsplit_pipeline_busy(rses) &&
+                         !rwsplit_is_large_packet(querybuf);
+        }
+        else if (TARGET_IS_MASTER(route_target) && wait_for_new_master(rses))
+        {
+            /** The write is routed when the session has a new master */
+            succp = hold_stmt(rses, querybuf);
         }
         else if (TARGET_IS_MASTER(route_target))
         {
-            succp = handle_master_is_target(inst, rses, &target_dcb);
+            /** Temporary tables exist only on the master and the prepared
+             * statements and multi-statement queries are executed there */
+            if (rses->rses_config.galera_table_writes && packet_type == MYSQL_COM_QUERY &&
+                !load_data && !rses->have_tmp_tables && rses->forced_node == NULL)
+            {
+                succp = handle_galera_write_target(inst, rses, querybuf, &target_dcb);
+            }
+            else
+            {
+                succp = handle_master_is_target(inst, rses, &target_dcb);
+            }
+
+            if (succp && rses->rses_config.causal_reads &&
+                (qc_query_is_type(qtype, QUERY_TYPE_WRITE) ||
+                 qc_query_is_type(qtype, QUERY_TYPE_COMMIT)))
+            {
+                rses->rses_causal_pending = true;
+            }
 
             if (!rses->rses_config.strict_multi_stmt &&
                 !rses->rses_config.strict_sp_calls &&
@@ -140,13 +233,32 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                 /** Reset the forced node as we're in relaxed multi-statement
                  * and SP call mode */
                 rses->forced_node = NULL;
+                rses->rses_ro_trx_forced = false;
             }
         }
 
-        if (target_dcb && succp) /*< Have DCB of the target backend */
+        if (target_dcb && succp && ps)
+        {
+            succp = handle_ps_target(inst, rses, ps, querybuf, target_dcb);
+        }
+        else if (target_dcb && succp) /*< Have DCB of the target backend */
         {
             ss_dassert(!store_stmt || TARGET_IS_SLAVE(route_target));
-            handle_got_target(inst, rses, querybuf, target_dcb, store_stmt);
+            backend_ref_t *bref = get_bref_from_dcb(rses, target_dcb);
+
+            if (load_data || !is_packet_a_query(packet_type))
+            {
+                handle_got_target(inst, rses, querybuf, target_dcb, store_stmt);
+            }
+            else if (reply_must_wait(rses, bref))
+            {
+                /** The reply must not overtake the pending replies */
+                succp = queue_stmt(rses, querybuf, bref);
+            }
+            else if (handle_got_target(inst, rses, querybuf, target_dcb, store_stmt))
+            {
+                add_pending_reply(rses, bref);
+            }
         }
     }
 
@@ -299,7 +411,20 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         return false;
     }
 
-    mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    mysql_sescmd_t *sescmd = mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    sescmd->my_sescmd_qtype = qtype;
+
+    if (sescmd->my_sescmd_cmd == NULL)
+    {
+        MXS_ERROR("Failed to store session command.");
+        rses_property_done(prop);
+        return false;
+    }
+
+    if (sescmd->my_sescmd_key)
+    {
+        compact_sescmd_history(router_cli_ses, sescmd->my_sescmd_key);
+    }
 
     /** Add sescmd property to router client session */
     if (rses_property_add(router_cli_ses, prop) != 0)
@@ -440,6 +565,106 @@ void rwsplit_hfree(void *fval)
     MXS_FREE(fval);
 }
 
+/**
+ * @brief Connect the slaves of a session that uses lazy connections
+ *
+ * The session command history is executed on the slaves as they are connected.
+ * If the history is disabled and session commands have already been executed,
+ * the slaves can't be brought to the same state and they are not connected.
+ *
+ * @param rses Router session
+ */
+static void connect_pending_slaves(ROUTER_CLIENT_SES *rses)
+{
+    rses->rses_slaves_pending = false;
+
+    if (rses->rses_config.disable_sescmd_history && rses->rses_nsescmd > 0)
+    {
+        MXS_INFO("Session command history is disabled, not connecting to slaves.");
+    }
+    else
+    {
+        select_connect_backend_servers(&rses->rses_master_ref, rses->rses_backend_ref,
+                                       rses->rses_nbackends,
+                                       rses_get_max_slavecount(rses, rses->rses_nbackends),
+                                       rses_get_max_replication_lag(rses),
+                                       rses->rses_config.slave_selection_criteria,
+                                       rses->client_dcb->session, rses->router, true);
+    }
+}
+
+/**
+ * @brief Check if a slave has replicated the latest write of the session
+ *
+ * The monitor stores the timestamp of the latest replication heartbeat that
+ * the slave has applied. The heartbeats are written to the master by the same
+ * clock as the write timestamps so a heartbeat newer than the latest write
+ * means that the slave has the write.
+ *
+ * @param rses   Router session
+ * @param server Slave server
+ * @return True if reads of the session can be routed to the slave
+ */
+static bool slave_has_latest_write(ROUTER_CLIENT_SES *rses, SERVER *server)
+{
+    return !rses->rses_config.causal_reads || rses->rses_causal_write == 0 ||
+           server->node_ts > (unsigned long)rses->rses_causal_write;
+}
+
+/**
+ * @brief Check whether the replication lag of a server is acceptable
+ *
+ * @param rses     Router client session
+ * @param server   The server
+ * @param max_rlag Maximum replication lag in seconds
+ * @return True if the lag is within the limit in seconds and within the one
+ *         in milliseconds, if it is configured
+ */
+static bool rlag_is_acceptable(ROUTER_CLIENT_SES *rses, const SERVER *server, int max_rlag)
+{
+    int max_rlag_ms = rses->rses_config.max_slave_replication_lag_ms;
+
+    return (max_rlag == MAX_RLAG_UNDEFINED ||
+            (server->rlag != MAX_RLAG_NOT_AVAILABLE && server->rlag <= max_rlag)) &&
+           (max_rlag_ms <= 0 || (server->rlag_ms >= 0 && server->rlag_ms <= max_rlag_ms));
+}
+
+/**
+ * @brief Check whether a read is better routed to the master than to a slave
+ *
+ * The servers are compared by their active operations in relation to their
+ * weights, which are lowered by the load that the monitor currently reports.
+ * The master wins only if it is strictly less loaded so that an idle cluster
+ * keeps its reads on the slaves.
+ *
+ * @param master The master
+ * @param slave  The best slave for the read
+ * @return True if the read should be routed to the master
+ */
+static bool master_is_less_loaded(const backend_ref_t *master, const backend_ref_t *slave)
+{
+    const SERVER *m = master->ref->server;
+    const SERVER *s = slave->ref->server;
+    int wm = server_weight_by_load(master->bref_weight, m->load);
+    int ws = server_weight_by_load(slave->bref_weight, s->load);
+
+    if (wm == 0 && ws == 0)
+    {
+        return m->stats.n_current_ops < s->stats.n_current_ops;
+    }
+    else if (wm == 0)
+    {
+        return false;
+    }
+    else if (ws == 0)
+    {
+        return true;
+    }
+
+    return (1000 + 1000 * (int64_t)m->stats.n_current_ops) / wm <
+           (1000 + 1000 * (int64_t)s->stats.n_current_ops) / ws;
+}
+
 /**
  * Provide the router with a pointer to a suitable backend dcb.
  *
@@ -485,6 +710,11 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
         goto return_succp;
     }
 
+    if (rses->rses_slaves_pending && btype != BE_MASTER)
+    {
+        connect_pending_slaves(rses);
+    }
+
     /** get root master from available servers */
     master_bref = get_root_master_bref(rses);
 
@@ -527,9 +757,25 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
     if (btype == BE_SLAVE)
     {
         backend_ref_t *candidate_bref = NULL;
+        select_criteria_t criteria = rses->rses_config.slave_selection_criteria;
+        int offset = 0;
 
-        for (i = 0; i < rses->rses_nbackends; i++)
+        if (rses->rses_config.per_statement_routing)
+        {
+            /**
+             * Compare the slaves by their live load and rotate the starting
+             * point of the search so that equally loaded slaves take turns.
+             */
+            if (criteria != ADAPTIVE_ROUTING)
+            {
+                criteria = LEAST_CURRENT_OPERATIONS;
+            }
+            offset = rses->rses_read_offset++ % rses->rses_nbackends;
+        }
+
+        for (int n = 0; n < rses->rses_nbackends; n++)
         {
+            i = (n + offset) % rses->rses_nbackends;
             SERVER_REF *b = backend_ref[i].ref;
             SERVER server;
             SERVER candidate;
@@ -538,11 +784,20 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
              * Unused backend or backend which is not master nor
              * slave can't be used
              */
-            if (!BREF_IS_IN_USE(&backend_ref[i]) ||
+            if (!BREF_IS_IN_USE(&backend_ref[i]) || backend_ref[i].bref_draining ||
                 (!SERVER_IS_MASTER(&server) && !SERVER_IS_SLAVE(&server)))
             {
                 continue;
             }
+            /**
+             * Slaves that don't yet have the latest write of this session
+             * can't be used with causal reads
+             */
+            else if (&backend_ref[i] != master_bref &&
+                     !slave_has_latest_write(rses, b->server))
+            {
+                continue;
+            }
             /**
              * If there are no candidates yet accept both master or
              * slave.
@@ -565,9 +820,7 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
                  * or that candidate's lag doesn't exceed the
                  * maximum allowed replication lag.
                  */
-                else if (max_rlag == MAX_RLAG_UNDEFINED ||
-                         (b->server->rlag != MAX_RLAG_NOT_AVAILABLE &&
-                          b->server->rlag <= max_rlag))
+                else if (rlag_is_acceptable(rses, b->server, max_rlag))
                 {
                     /** found slave */
                     candidate_bref = &backend_ref[i];
@@ -580,10 +833,8 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
              * replication lag limits replaces it.
              */
             else if (SERVER_IS_MASTER(&candidate) && SERVER_IS_SLAVE(&server) &&
-                     (max_rlag == MAX_RLAG_UNDEFINED ||
-                      (b->server->rlag != MAX_RLAG_NOT_AVAILABLE &&
-                       b->server->rlag <= max_rlag)) &&
-                     !rses->rses_config.master_accept_reads)
+                     rlag_is_acceptable(rses, b->server, max_rlag) &&
+                     rses->rses_config.master_accept_reads != RW_MASTER_READS_ON)
             {
                 /** found slave */
                 candidate_bref = &backend_ref[i];
@@ -596,14 +847,13 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
              * necessary.
              */
             else if (SERVER_IS_SLAVE(&server) ||
-                     (rses->rses_config.master_accept_reads && SERVER_IS_MASTER(&server)))
+                     (rses->rses_config.master_accept_reads == RW_MASTER_READS_ON &&
+                      SERVER_IS_MASTER(&server)))
             {
-                if (max_rlag == MAX_RLAG_UNDEFINED ||
-                    (b->server->rlag != MAX_RLAG_NOT_AVAILABLE &&
-                     b->server->rlag <= max_rlag))
+                if (rlag_is_acceptable(rses, b->server, max_rlag))
                 {
                     candidate_bref = check_candidate_bref(candidate_bref, &backend_ref[i],
-                                                          rses->rses_config.slave_selection_criteria);
+                                                          criteria);
                     candidate.status = candidate_bref->ref->server->status;
                 }
                 else
@@ -614,6 +864,22 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
             }
         } /*<  for */
 
+        /**
+         * In the adaptive mode, the master takes the read when it is less
+         * loaded than the best slave.
+         */
+        if (rses->rses_config.master_accept_reads == RW_MASTER_READS_ADAPTIVE &&
+            candidate_bref && master_bref && candidate_bref != master_bref &&
+            BREF_IS_IN_USE(master_bref) && !master_bref->bref_draining &&
+            SERVER_IS_MASTER(master_bref->ref->server) &&
+            master_is_less_loaded(master_bref, candidate_bref))
+        {
+            MXS_INFO("Master '%s' is less loaded than slave '%s', routing read to master.",
+                     master_bref->ref->server->unique_name,
+                     candidate_bref->ref->server->unique_name);
+            candidate_bref = master_bref;
+        }
+
         /** Assign selected DCB's pointer value */
         if (candidate_bref != NULL)
         {
@@ -707,6 +973,8 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
               (use_sql_variables_in == TYPE_ALL &&
                qc_query_is_type(qtype, QUERY_TYPE_USERVAR_WRITE)) ||
               qc_query_is_type(qtype, QUERY_TYPE_GSYSVAR_WRITE) ||
+              /** Binary protocol prepared statements are prepared on all servers */
+              qc_query_is_type(qtype, QUERY_TYPE_PREPARE_STMT) ||
               /** enable or disable autocommit are always routed to all */
               qc_query_is_type(qtype, QUERY_TYPE_ENABLE_AUTOCOMMIT) ||
               qc_query_is_type(qtype, QUERY_TYPE_DISABLE_AUTOCOMMIT)))
@@ -722,9 +990,8 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
          * They can be safely routed to all backends since the execution
          * is done later.
          *
-         * With prepared statement caching the task of routing
-         * the execution of the prepared statements to the right server would be
-         * an easy one. Currently this is not supported.
+         * The type of a binary protocol prepared statement is stored when
+         * it is prepared and its executions are routed based on it.
          */
         if (qc_query_is_type(qtype, QUERY_TYPE_READ) &&
             !(qc_query_is_type(qtype, QUERY_TYPE_PREPARE_STMT) ||
@@ -850,11 +1117,18 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
             {
                 target |= TARGET_RLAG_MAX;
             }
+            else if (strcasecmp((char *)hint->data, "hedged_read") == 0)
+            {
+                if (config_truth_value((char *)hint->value))
+                {
+                    target |= TARGET_HEDGED;
+                }
+            }
             else
             {
                 MXS_ERROR("Unknown hint parameter "
                           "'%s' when 'max_slave_replication_lag' "
-                          "was expected.",
+                          "or 'hedged_read' was expected.",
                           (char *)hint->data);
             }
         }
@@ -892,20 +1166,48 @@ handle_multi_temp_and_load(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
      * If we do not have a master node, assigning the forced node is not
      * effective since we don't have a node to force queries to. In this
      * situation, assigning QUERY_TYPE_WRITE for the query will trigger
-     * the error processing. */
-    if ((rses->forced_node == NULL || rses->forced_node != rses->rses_master_ref) &&
-        (check_for_multi_stmt(querybuf, rses->client_dcb->protocol, packet_type) ||
-         check_for_sp_call(querybuf, packet_type)))
+     * the error processing.
+     *
+     * A multi-statement query that only reads data cannot change the
+     * session state so it is routed as a read with the combined type of
+     * all of its statements. A multi-statement query that modifies data
+     * but not the session state is routed to the master without affecting
+     * the routing of later queries. */
+    if (rses->forced_node == NULL || rses->forced_node != rses->rses_master_ref)
     {
-        if (rses->rses_master_ref)
+        bool multi_stmt = check_for_multi_stmt(querybuf, rses->client_dcb->protocol, packet_type);
+        multi_stmt_class_t multi_stmt_class = MULTI_STMT_SESSION;
+        qc_query_type_t multi_stmt_type;
+
+        if (multi_stmt)
         {
-            rses->forced_node = rses->rses_master_ref;
-            MXS_INFO("Multi-statement query or stored procedure call, routing "
-                     "all future queries to master.");
+            multi_stmt_class = classify_multi_stmt(querybuf, &multi_stmt_type);
         }
-        else
+
+        if (multi_stmt && multi_stmt_class == MULTI_STMT_READ)
+        {
+            *qtype = multi_stmt_type;
+            MXS_INFO("Multi-statement query contains only reads, routing it as a read.");
+        }
+        else if (multi_stmt && multi_stmt_class == MULTI_STMT_WRITE)
         {
-            *qtype |= QUERY_TYPE_WRITE;
+            *qtype = multi_stmt_type;
+            MXS_INFO("Multi-statement query does not modify the session state, "
+                     "routing it to master.");
+        }
+        else if (multi_stmt || check_for_sp_call(querybuf, packet_type, *qtype))
+        {
+            if (rses->rses_master_ref)
+            {
+                rses->forced_node = rses->rses_master_ref;
+                rses->rses_ro_trx_forced = false;
+                MXS_INFO("Multi-statement query or stored procedure call, routing "
+                         "all future queries to master.");
+            }
+            else
+            {
+                *qtype |= QUERY_TYPE_WRITE;
+            }
         }
     }
 
@@ -958,7 +1260,7 @@ handle_multi_temp_and_load(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
     {
         rses->rses_load_data_sent += gwbuf_length(querybuf);
     }
-    else if (is_packet_a_query(packet_type))
+    else if (is_packet_a_query(packet_type) && !is_trx_or_session_stmt(*qtype))
     {
         qc_query_op_t queryop = qc_get_operation(querybuf);
         if (queryop == QUERY_OP_LOAD)
@@ -1082,6 +1384,122 @@ bool handle_slave_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     }
 }
 
+/**
+ * @brief Check if a backend can take part in a hedged read
+ *
+ * @param rses     Router session
+ * @param bref     Backend reference
+ * @param max_rlag Maximum replication lag
+ *
+ * @return True if the query can be sent to the backend right away
+ */
+static bool bref_is_hedge_candidate(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, int max_rlag)
+{
+    SERVER *server = bref->ref->server;
+
+    return BREF_IS_IN_USE(bref) && SERVER_IS_SLAVE(server) && bref != rses->rses_master_ref &&
+           !bref->bref_draining && !BREF_IS_WAITING_RESULT(bref) &&
+           !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+           (max_rlag == MAX_RLAG_UNDEFINED ||
+            (server->rlag != MAX_RLAG_NOT_AVAILABLE && server->rlag <= max_rlag)) &&
+           slave_has_latest_write(rses, server);
+}
+
+/**
+ * @brief Send a read to the two best slaves
+ *
+ * The reply that arrives first is returned to the client and the other one
+ * is discarded. This hides the latency of a slave that is momentarily slow.
+ * Only idle slaves are used so that the discarded reply never delays
+ * another query.
+ *
+ * @param inst     Router instance
+ * @param rses     Router session
+ * @param querybuf The query
+ *
+ * @return True if the query was sent to two slaves, false if it should be
+ * routed normally
+ */
+bool handle_hedged_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    if (session_trx_is_active(rses->client_dcb->session))
+    {
+        /** Both slaves would see the transaction, only one can be used */
+        return false;
+    }
+
+    if (rses->rses_slaves_pending)
+    {
+        connect_pending_slaves(rses);
+    }
+
+    select_criteria_t criteria = rses->rses_config.slave_selection_criteria;
+    int max_rlag = rses_get_max_replication_lag(rses);
+    backend_ref_t *first = NULL;
+    backend_ref_t *second = NULL;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (bref_is_hedge_candidate(rses, bref, max_rlag))
+        {
+            if (check_candidate_bref(first, bref, criteria) == bref)
+            {
+                second = first;
+                first = bref;
+            }
+            else if (check_candidate_bref(second, bref, criteria) == bref)
+            {
+                second = bref;
+            }
+        }
+    }
+
+    if (first == NULL || second == NULL)
+    {
+        MXS_INFO("Less than two idle slaves available, routing hedged read normally.");
+        return false;
+    }
+
+    backend_ref_t *hedge[2] = {first, second};
+    int n_sent = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        DCB *dcb = hedge[i]->bref_dcb;
+
+        if (dcb->func.write(dcb, gwbuf_clone(querybuf)) == 1)
+        {
+            MXS_INFO("Route hedged read to slave \t[%s]:%d <",
+                     hedge[i]->ref->server->name, hedge[i]->ref->server->port);
+            bref_set_state(hedge[i], BREF_QUERY_ACTIVE);
+            bref_set_state(hedge[i], BREF_WAITING_RESULT);
+            n_sent++;
+        }
+        else
+        {
+            MXS_ERROR("Routing hedged read to [%s]:%d failed.",
+                      hedge[i]->ref->server->name, hedge[i]->ref->server->port);
+            hedge[i] = NULL;
+        }
+    }
+
+    if (n_sent == 2)
+    {
+        rses->rses_hedged[0] = hedge[0];
+        rses->rses_hedged[1] = hedge[1];
+    }
+
+    if (n_sent > 0)
+    {
+        atomic_add_uint64(&inst->stats.n_queries, 1);
+        atomic_add_uint64(&inst->stats.n_slave, 1);
+    }
+
+    return n_sent > 0;
+}
+
 /**
  * @brief Log master write failure
  *
@@ -1196,6 +1614,148 @@ bool handle_master_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     return succp;
 }
 
+/**
+ * @brief Check whether a Galera node can execute the writes of a session
+ *
+ * @param bref Backend reference
+ * @return True if the node is synced and the session is connected to it
+ */
+static bool bref_is_galera_writer(backend_ref_t *bref)
+{
+    return BREF_IS_IN_USE(bref) && !BREF_IS_CLOSED(bref) && !bref->bref_draining &&
+           bref->bref_dcb && SERVER_IS_JOINED(bref->ref->server) &&
+           (SERVER_IS_MASTER(bref->ref->server) || SERVER_IS_SLAVE(bref->ref->server));
+}
+
+/**
+ * @brief The rendezvous hash score of a table on a server
+ *
+ * The table is written to the server with the highest score. When a server
+ * is removed, only the tables it had move to other servers.
+ *
+ * @param table  Table name
+ * @param server Server name
+ * @return The score
+ */
+static uint64_t galera_score(const char *table, const char *server)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *p = table; *p; p++)
+    {
+        hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+    }
+
+    hash = (hash ^ '.') * 1099511628211ULL;
+
+    for (const char *p = server; *p; p++)
+    {
+        hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+    }
+
+    /** Mix the bits, similar names would otherwise get similar scores */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @brief Route a write to the Galera node of its table
+ *
+ * A write outside of a transaction goes to the node whose rendezvous hash
+ * score for the first table of the statement is the highest. All sessions
+ * thus write a table through the same node and the writes do not fail the
+ * certification because of conflicts on the other nodes. Statements without
+ * tables, e.g. SELECT LAST_INSERT_ID(), and all statements of transactions
+ * go to the node of the latest write.
+ *
+ * @param inst       Router instance
+ * @param rses       Router session
+ * @param querybuf   A COM_QUERY
+ * @param target_dcb The DCB of the chosen node
+ *
+ * @return True if a node was found
+ */
+static bool handle_galera_write_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                       GWBUF *querybuf, DCB **target_dcb)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    bool in_trx = session_trx_is_active(session) || !session_is_autocommit(session);
+    backend_ref_t *target = NULL;
+
+    if (rses->rses_slaves_pending)
+    {
+        connect_pending_slaves(rses);
+    }
+
+    if (rses->rses_galera_ref && !bref_is_galera_writer(rses->rses_galera_ref))
+    {
+        if (in_trx && rses->rses_galera_ref != rses->rses_master_ref)
+        {
+            MXS_ERROR("[%s] Galera node '%s' executing the transaction of %s@%s is no "
+                      "longer available. Closing client connection.", inst->service->name,
+                      rses->rses_galera_ref->ref->server->unique_name,
+                      rses->client_dcb->user, rses->client_dcb->remote);
+            return false;
+        }
+
+        rses->rses_galera_ref = NULL;
+    }
+
+    size_t n_tables = 0;
+    const char* const* tables = NULL;
+
+    if (!in_trx)
+    {
+        qc_get_table_names_ref(querybuf, true, &tables, &n_tables);
+    }
+
+    if (n_tables > 0)
+    {
+        uint64_t best = 0;
+
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+            if (bref_is_galera_writer(bref))
+            {
+                uint64_t score = galera_score(tables[0], bref->ref->server->unique_name);
+
+                if (target == NULL || score > best)
+                {
+                    target = bref;
+                    best = score;
+                }
+            }
+        }
+    }
+    else
+    {
+        target = rses->rses_galera_ref;
+    }
+
+    if (target == NULL)
+    {
+        /** No tables or no synced nodes, the master is used */
+        if (!handle_master_is_target(inst, rses, target_dcb))
+        {
+            return false;
+        }
+
+        target = get_bref_from_dcb(rses, *target_dcb);
+    }
+    else
+    {
+        atomic_add_uint64(&inst->stats.n_master, 1);
+        *target_dcb = target->bref_dcb;
+    }
+
+    rses->rses_galera_ref = target;
+    return true;
+}
+
 /**
  * @brief Handle got a target
  *
@@ -1225,6 +1785,7 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         session_trx_is_read_only(rses->client_dcb->session))
     {
         rses->forced_node = bref;
+        rses->rses_ro_trx_forced = true;
         MXS_DEBUG("Setting forced_node SLAVE to %s within an opened READ ONLY transaction\n",
                   target_dcb->server->unique_name);
     }
@@ -1243,12 +1804,18 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
      */
     if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref)
     {
+        MXS_TRACE(tp_target, target_dcb->server->unique_name, 1, 0, 0);
         bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        rses->rses_large_target = bref;
         return true;
     }
 
+    MXS_TRACE(tp_target, target_dcb->server->unique_name, 0, 0, 0);
+
     if (target_dcb->func.write(target_dcb, gwbuf_clone(querybuf)) == 1)
     {
+        rses->rses_large_target = bref;
+
         if (store && !session_store_stmt(rses->client_dcb->session, querybuf, target_dcb->server))
         {
             MXS_ERROR("Failed to store current statement, it won't be retried if it fails.");
@@ -1265,14 +1832,17 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         bref_set_state(bref, BREF_WAITING_RESULT);
 
         /**
-         * If a READ ONLYtransaction is ending set forced_node to NULL
+         * If a READ ONLY transaction is ending set forced_node to NULL,
+         * unless the node was forced for some other reason, e.g. an earlier
+         * multi-statement query that forced all queries to the master.
          */
-        if (rses->forced_node &&
+        if (rses->forced_node && rses->rses_ro_trx_forced &&
             session_trx_is_read_only(rses->client_dcb->session) &&
             session_trx_is_ending(rses->client_dcb->session))
         {
             MXS_DEBUG("An opened READ ONLY transaction ends: forced_node is set to NULL");
             rses->forced_node = NULL;
+            rses->rses_ro_trx_forced = false;
         }
         return true;
     }
@@ -1283,6 +1853,48 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     }
 }
 
+/**
+ * @brief Route a command that refers to a prepared statement
+ *
+ * The client's statement ID is replaced with the one the target uses. If the
+ * target is a slave that hasn't yet prepared the statement, the command is
+ * routed to the master.
+ *
+ * @param inst       Router instance
+ * @param rses       Router session
+ * @param ps         The prepared statement
+ * @param querybuf   The command
+ * @param target_dcb DCB of the chosen target
+ *
+ * @return True if the command was routed
+ */
+static bool handle_ps_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                             rwsplit_ps_t *ps, GWBUF *querybuf, DCB *target_dcb)
+{
+    backend_ref_t *bref = get_bref_from_dcb(rses, target_dcb);
+    GWBUF *buffer = ps_rewrite_id(bref, ps, querybuf);
+
+    if (buffer == NULL && bref != rses->rses_master_ref)
+    {
+        MXS_INFO("Statement is not prepared on '%s', routing it to the master.",
+                 bref->ref->server->unique_name);
+        target_dcb = NULL;
+
+        if (!handle_master_is_target(inst, rses, &target_dcb))
+        {
+            return false;
+        }
+
+        buffer = ps_rewrite_id(get_bref_from_dcb(rses, target_dcb), ps, querybuf);
+    }
+
+    /** The stored statement can't be retried as the ID only works on this server */
+    bool rval = handle_got_target(inst, rses, buffer ? buffer : querybuf, target_dcb, false);
+    gwbuf_free(buffer);
+
+    return rval;
+}
+
 /**
  * @brief Create a generic router session property structure.
  *
@@ -1442,3 +2054,356 @@ static backend_ref_t *get_root_master_bref(ROUTER_CLIENT_SES *rses)
 
     return candidate_bref;
 }
+
+/**
+ * @brief Check whether replies are pending
+ *
+ * A client may send statements without waiting for the replies to the earlier
+ * ones. The queries that go to the backend that is executing the earlier
+ * queries are sent to it immediately as it replies to them in order. Other
+ * statements wait in a queue until the pending replies are complete.
+ *
+ * @param rses Router session
+ *
+ * @return True if a new statement may have to wait
+ */
+bool rwsplit_pipeline_busy(ROUTER_CLIENT_SES *rses)
+{
+    return rses->rses_n_replies > 0 || rses->rses_hedged[0] != NULL ||
+           (rses->rses_queue != NULL && !rses->rses_dequeuing);
+}
+
+/**
+ * Check whether a query to a backend must wait for the pending replies
+ */
+static bool reply_must_wait(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    return rses->rses_hedged[0] != NULL ||
+           (rses->rses_queue != NULL && !rses->rses_dequeuing) ||
+           (rses->rses_n_replies > 0 && bref != rses->rses_pipeline);
+}
+
+/**
+ * @brief Add a statement to the end of the queue
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ * @param bref     The target of the statement or NULL if the statement is
+ *                 routed when it is taken from the queue
+ *
+ * @return True if the statement was queued
+ */
+static bool queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, backend_ref_t *bref)
+{
+    rwsplit_queued_t *queued = (rwsplit_queued_t*)MXS_MALLOC(sizeof(*queued));
+    GWBUF *buffer = gwbuf_clone(querybuf);
+
+    if (queued == NULL || buffer == NULL)
+    {
+        MXS_FREE(queued);
+        gwbuf_free(buffer);
+        return false;
+    }
+
+    queued->buffer = buffer;
+    queued->bref = bref;
+    queued->continued = false;
+    queued->next = NULL;
+
+    if (rses->rses_queue_tail)
+    {
+        rses->rses_queue_tail->next = queued;
+    }
+    else
+    {
+        rses->rses_queue = queued;
+    }
+
+    rses->rses_queue_tail = queued;
+    MXS_INFO("Statement queued until the pending replies are complete.");
+    MXS_TRACE(tp_queue, bref ? bref->ref->server->unique_name : "any", 0, 0, 0);
+
+    return true;
+}
+
+/**
+ * @brief Check whether the master of a session can be replaced
+ *
+ * An open transaction, the temporary tables and the result of a statement
+ * that the master is executing would be lost with the old master.
+ *
+ * @param rses Router session
+ *
+ * @return True if the session can continue on a new master
+ */
+bool rwsplit_can_switch_master(ROUTER_CLIENT_SES *rses)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+
+    return !session_trx_is_active(rses->rses_session) && !rses->have_tmp_tables &&
+           !rses->rses_load_active &&
+           (master == NULL || !BREF_IS_IN_USE(master) || !BREF_IS_WAITING_RESULT(master));
+}
+
+static bool master_is_usable(ROUTER_CLIENT_SES *rses)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+
+    return master && BREF_IS_IN_USE(master) && SERVER_IS_MASTER(master->ref->server);
+}
+
+/**
+ * Called every heartbeat while the writes of a session wait for a new master
+ */
+static void retry_new_master(MXS_TIMER *timer, void *data)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *)data;
+
+    if (rses->rses_closed)
+    {
+        return;
+    }
+
+    if (!select_connect_new_master(rses) && hkheartbeat < rses->rses_master_deadline)
+    {
+        mxs_timer_set(timer, 1, retry_new_master, rses);
+    }
+    else
+    {
+        if (!master_is_usable(rses))
+        {
+            MXS_WARNING("No master became available in %d milliseconds, "
+                        "routing the waiting writes of session %lu fails.",
+                        rses->rses_config.switchover_timeout, rses->rses_session->ses_id);
+        }
+
+        /** If the wait expired, the writes are handled as if the master
+         * had been lost just now. Later writes may wait again. */
+        rwsplit_route_queued(rses->router, rses);
+        rses->rses_master_deadline = 0;
+    }
+}
+
+/**
+ * @brief Check whether a write must wait for a new master
+ *
+ * With switchover_timeout, a session whose master has lost its status is
+ * moved to the new master. If there is no master yet, for example in the
+ * middle of a switchover, the write waits in the queue of the session until
+ * a master appears or switchover_timeout milliseconds have passed. The
+ * statements that follow it wait in the queue behind it.
+ *
+ * @param rses Router session
+ *
+ * @return True if the write must wait
+ */
+static bool wait_for_new_master(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->rses_config.switchover_timeout == 0 || master_is_usable(rses) ||
+        !rwsplit_can_switch_master(rses) || select_connect_new_master(rses))
+    {
+        rses->rses_master_deadline = 0;
+        return false;
+    }
+    else if (mxs_timer_is_set(&rses->rses_master_timer))
+    {
+        return true;
+    }
+    else if (rses->rses_master_deadline != 0)
+    {
+        /** The wait expired, the waiting writes are being routed */
+        return false;
+    }
+
+    rses->rses_master_deadline = hkheartbeat + (rses->rses_config.switchover_timeout + 99) / 100;
+    mxs_timer_set(&rses->rses_master_timer, 1, retry_new_master, rses);
+    MXS_INFO("No master available, writes wait at most %d milliseconds for a new master.",
+             rses->rses_config.switchover_timeout);
+
+    return true;
+}
+
+/**
+ * @brief Make a write wait for a new master
+ *
+ * A write that was taken from the queue goes back to the front of it so that
+ * the order of the statements is kept.
+ *
+ * @param rses     Router session
+ * @param querybuf The write
+ *
+ * @return True if the write was queued
+ */
+static bool hold_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    if (!rses->rses_dequeuing)
+    {
+        return queue_stmt(rses, querybuf, NULL);
+    }
+
+    rwsplit_queued_t *queued = (rwsplit_queued_t*)MXS_MALLOC(sizeof(*queued));
+    GWBUF *buffer = gwbuf_clone(querybuf);
+
+    if (queued == NULL || buffer == NULL)
+    {
+        MXS_FREE(queued);
+        gwbuf_free(buffer);
+        return false;
+    }
+
+    queued->buffer = buffer;
+    queued->bref = NULL;
+    queued->continued = false;
+    queued->next = rses->rses_queue;
+    rses->rses_queue = queued;
+
+    if (rses->rses_queue_tail == NULL)
+    {
+        rses->rses_queue_tail = queued;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Route a packet that continues a large query
+ *
+ * The packets that follow a packet of the maximum size are a part of the
+ * same query. They are written to the backend the first packet was written
+ * to as soon as they arrive, without being classified. If the first packet
+ * is still waiting in the queue, the packet is queued after it.
+ *
+ * @param inst     Router instance
+ * @param rses     Router session
+ * @param querybuf The next part of the query
+ *
+ * @return True if the packet was routed or queued
+ */
+bool route_large_query_part(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    backend_ref_t *bref = rses->rses_large_target;
+    bool succp = false;
+
+    if (rses->rses_queue && !rses->rses_dequeuing)
+    {
+        if ((succp = queue_stmt(rses, querybuf, NULL)))
+        {
+            rses->rses_queue_tail->continued = true;
+        }
+    }
+    else if (bref == NULL || !BREF_IS_IN_USE(bref))
+    {
+        MXS_ERROR("The first part of a large query was not routed to a single "
+                  "server, unable to route the rest of it.");
+    }
+    else if (bref->bref_pending_cmd)
+    {
+        /** The first part is waiting for a session command to complete */
+        bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        succp = true;
+    }
+    else
+    {
+        succp = bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(querybuf)) == 1;
+    }
+
+    return succp;
+}
+
+/**
+ * Expect one more reply from a backend
+ */
+static void add_pending_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    if (rses->rses_n_replies == 0)
+    {
+        memset(&rses->rses_reply, 0, sizeof(rses->rses_reply));
+        rses->rses_pipeline = bref;
+    }
+
+    ss_dassert(rses->rses_pipeline == bref);
+    rses->rses_n_replies++;
+}
+
+/**
+ * @brief Route the queued statements that no longer need to wait
+ *
+ * Called when replies are complete. If a statement can't be routed, the
+ * session is closed as the client would otherwise wait for its reply forever.
+ *
+ * @param inst Router instance
+ * @param rses Router session
+ */
+void rwsplit_route_queued(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses)
+{
+    while (rses->rses_queue && !rses->rses_closed && rses->rses_hedged[0] == NULL &&
+           !mxs_timer_is_set(&rses->rses_master_timer))
+    {
+        rwsplit_queued_t *queued = rses->rses_queue;
+
+        if (rses->rses_n_replies > 0 && !queued->continued &&
+            (queued->bref == NULL || queued->bref != rses->rses_pipeline))
+        {
+            break;
+        }
+
+        rses->rses_queue = queued->next;
+
+        if (rses->rses_queue == NULL)
+        {
+            rses->rses_queue_tail = NULL;
+        }
+
+        bool succp;
+        rses->rses_dequeuing = true;
+
+        if (queued->continued)
+        {
+            succp = route_large_query_part(inst, rses, queued->buffer);
+        }
+        else if (queued->bref && BREF_IS_IN_USE(queued->bref))
+        {
+            succp = handle_got_target(inst, rses, queued->buffer, queued->bref->bref_dcb, false);
+
+            if (succp)
+            {
+                add_pending_reply(rses, queued->bref);
+            }
+        }
+        else
+        {
+            /** The statement is routed as if it had just arrived */
+            rses->rses_large_target = NULL;
+            succp = route_single_stmt(inst, rses, queued->buffer);
+        }
+
+        rses->rses_dequeuing = false;
+        gwbuf_free(queued->buffer);
+        MXS_FREE(queued);
+
+        if (!succp)
+        {
+            MXS_ERROR("Failed to route a queued statement, closing the session.");
+            poll_fake_hangup_event(rses->client_dcb);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Free the queued statements
+ *
+ * @param rses Router session
+ */
+void rwsplit_free_queue(ROUTER_CLIENT_SES *rses)
+{
+    while (rses->rses_queue)
+    {
+        rwsplit_queued_t *queued = rses->rses_queue;
+        rses->rses_queue = queued->next;
+        gwbuf_free(queued->buffer);
+        MXS_FREE(queued);
+    }
+
+    rses->rses_queue_tail = NULL;
+}
@@ -13,6 +13,7 @@
 
 #include "readwritesplit.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
@@ -20,6 +21,8 @@
 #include <stdint.h>
 
 #include <maxscale/router.h>
+#include <maxscale/random_jkiss.h>
+#include <maxscale/trace.h>
 #include "rwsplit_internal.h"
 /**
  * @file rwsplit_select_backends.c   The functions that implement back end
@@ -40,7 +43,9 @@ static bool connect_server(backend_ref_t *bref, MXS_SESSION *session, bool execu
 static void log_server_connections(select_criteria_t select_criteria,
                                    backend_ref_t *backend_ref, int router_nservers);
 
-static SERVER_REF *get_root_master(backend_ref_t *servers, int router_nservers);
+static backend_ref_t *get_root_master(backend_ref_t *servers, int router_nservers);
+
+static MXS_TRACEPOINT tp_connect = {"rwsplit_connect", "server=%s history=%ld connected=%ld"};
 
 static int bref_cmp_global_conn(const void *bref1, const void *bref2);
 
@@ -50,6 +55,8 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2);
 
 static int bref_cmp_current_load(const void *bref1, const void *bref2);
 
+static int bref_cmp_response_time(const void *bref1, const void *bref2);
+
 /**
  * The order of functions _must_ match with the order the select criteria are
  * listed in select_criteria_t definition in readwritesplit.h
@@ -60,7 +67,8 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
     bref_cmp_global_conn,
     bref_cmp_router_conn,
     bref_cmp_behind_master,
-    bref_cmp_current_load
+    bref_cmp_current_load,
+    bref_cmp_response_time
 };
 
 /**
@@ -71,7 +79,7 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
  */
 static bool bref_valid_for_connect(const backend_ref_t *bref)
 {
-    return !BREF_HAS_FAILED(bref) && SERVER_IS_RUNNING(bref->ref->server);
+    return !BREF_HAS_FAILED(bref) && SERVER_IS_RUNNING(&bref->bref_server_state);
 }
 
 /**
@@ -83,10 +91,66 @@ static bool bref_valid_for_connect(const backend_ref_t *bref)
  */
 static bool bref_valid_for_slave(const backend_ref_t *bref, const SERVER *master_host)
 {
-    SERVER *server = bref->ref->server;
+    const SERVER_STATE *state = &bref->bref_server_state;
+
+    return (SERVER_IS_SLAVE(state) || SERVER_IS_RELAY_SERVER(state)) &&
+           (master_host == NULL || (bref->ref->server != master_host));
+}
+
+/**
+ * @brief Check whether a backend reference can be connected to as a new slave
+ *
+ * @param bref Backend reference
+ * @param master The master server
+ * @return True if this backend is an unused slave candidate
+ */
+static bool bref_is_slave_candidate(const backend_ref_t *bref, const SERVER *master)
+{
+    return !BREF_IS_IN_USE(bref) && bref_valid_for_connect(bref) &&
+           bref_valid_for_slave(bref, master);
+}
+
+/**
+ * @brief Pick a slave candidate with power-of-two-choices sampling
+ *
+ * Two distinct candidates are picked at random and the better one of them is
+ * returned. This prevents all new sessions from piling on the server that
+ * currently looks the best.
+ *
+ * @param bref Backend reference
+ * @param n Size of @c bref
+ * @param n_candidates Number of candidates in @c bref, must be at least two
+ * @param master The master server
+ * @param cmpfun qsort() compatible comparison function
+ * @return The better one of the two sampled candidates
+ */
+static backend_ref_t* sample_slave_candidate(backend_ref_t *bref, int n, int n_candidates,
+                                             const SERVER *master,
+                                             int (*cmpfun)(const void *, const void *))
+{
+    int first = random_jkiss() % n_candidates;
+    int second = (first + 1 + random_jkiss() % (n_candidates - 1)) % n_candidates;
+    backend_ref_t *cand1 = NULL;
+    backend_ref_t *cand2 = NULL;
+
+    for (int i = 0, c = 0; i < n; i++)
+    {
+        if (bref_is_slave_candidate(&bref[i], master))
+        {
+            if (c == first)
+            {
+                cand1 = &bref[i];
+            }
+            else if (c == second)
+            {
+                cand2 = &bref[i];
+            }
+            c++;
+        }
+    }
 
-    return (SERVER_IS_SLAVE(server) || SERVER_IS_RELAY_SERVER(server)) &&
-           (master_host == NULL || (server != master_host));
+    ss_dassert(cand1 && cand2);
+    return cmpfun(cand1, cand2) > 0 ? cand2 : cand1;
 }
 
 /**
@@ -99,19 +163,21 @@ static bool bref_valid_for_slave(const backend_ref_t *bref, const SERVER *master
  * @param n Size of @c bref
  * @param master The master server
  * @param cmpfun qsort() compatible comparison function
+ * @param sample Use power-of-two-choices sampling instead of picking the best one
  * @return The best slave backend reference or NULL if no candidates could be found
  */
 backend_ref_t* get_slave_candidate(backend_ref_t *bref, int n, const SERVER *master,
-                                   int (*cmpfun)(const void *, const void *))
+                                   int (*cmpfun)(const void *, const void *), bool sample)
 {
     backend_ref_t *candidate = NULL;
+    int n_candidates = 0;
 
     for (int i = 0; i < n; i++)
     {
-        if (!BREF_IS_IN_USE(&bref[i]) &&
-            bref_valid_for_connect(&bref[i]) &&
-            bref_valid_for_slave(&bref[i], master))
+        if (bref_is_slave_candidate(&bref[i], master))
         {
+            n_candidates++;
+
             if (candidate)
             {
                 if (cmpfun(candidate, &bref[i]) > 0)
@@ -126,9 +192,61 @@ backend_ref_t* get_slave_candidate(backend_ref_t *bref, int n, const SERVER *mas
         }
     }
 
+    if (sample && n_candidates > 2)
+    {
+        candidate = sample_slave_candidate(bref, n, n_candidates, master, cmpfun);
+    }
+
     return candidate;
 }
 
+/**
+ * @brief Take a snapshot of the state of the backend servers
+ *
+ * The backends are selected based on the snapshot so that all decisions use
+ * one consistent view of the servers even if a monitor updates them meanwhile.
+ * The weights are taken from the current snapshot of the servers of the service.
+ * A server that has since been removed from the service keeps its old weight.
+ *
+ * @param service The service
+ * @param backend_ref Backend references
+ * @param router_nservers Number of backend references
+ */
+static void update_server_states(SERVICE *service, backend_ref_t *backend_ref, int router_nservers)
+{
+    SERVER *servers[router_nservers];
+    SERVER_STATE states[router_nservers];
+
+    for (int i = 0; i < router_nservers; i++)
+    {
+        servers[i] = backend_ref[i].ref->server;
+    }
+
+    server_get_states(servers, router_nservers, states);
+
+    for (int i = 0; i < router_nservers; i++)
+    {
+        backend_ref[i].bref_server_state = states[i];
+    }
+
+    const SERVICE_SERVERS *snapshot = service_get_servers(service);
+
+    for (int i = 0, j = 0; i < router_nservers && snapshot->n_servers > 0; i++)
+    {
+        /** The backends are in the same order as the servers of the snapshot
+         * unless the servers have changed, so the search seldom goes round */
+        for (int n = 0; n < snapshot->n_servers; n++, j = (j + 1) % snapshot->n_servers)
+        {
+            if (snapshot->servers[j].ref == backend_ref[i].ref)
+            {
+                backend_ref[i].bref_weight = snapshot->servers[j].weight;
+                j = (j + 1) % snapshot->n_servers;
+                break;
+            }
+        }
+    }
+}
+
 /**
  * @brief Search suitable backend servers from those of router instance
  *
@@ -164,12 +282,14 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
         return false;
     }
 
+    update_server_states(router->service, backend_ref, router_nservers);
+
     /* get the root Master */
-    SERVER_REF *master_backend = get_root_master(backend_ref, router_nservers);
-    SERVER  *master_host = master_backend ? master_backend->server : NULL;
+    backend_ref_t *master_backend = get_root_master(backend_ref, router_nservers);
+    SERVER  *master_host = master_backend ? master_backend->ref->server : NULL;
 
     if (router->rwsplit_config.master_failure_mode == RW_FAIL_INSTANTLY &&
-        (master_host == NULL || SERVER_IS_DOWN(master_host)))
+        (master_host == NULL || SERVER_IS_DOWN(&master_backend->bref_server_state)))
     {
         MXS_ERROR("Couldn't find suitable Master from %d candidates.", router_nservers);
         return false;
@@ -190,6 +310,7 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
     /** Check slave selection criteria and set compare function */
     int (*p)(const void *, const void *) = criteria_cmpfun[select_criteria];
     ss_dassert(p);
+    bool sample = select_criteria == ADAPTIVE_ROUTING;
 
     SERVER *old_master = *p_master_ref ? (*p_master_ref)->ref->server : NULL;
 
@@ -239,7 +360,7 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
 
     ss_dassert(slaves_connected < max_nslaves || max_nslaves == 0);
 
-    backend_ref_t *bref = get_slave_candidate(backend_ref, router_nservers, master_host, p);
+    backend_ref_t *bref = get_slave_candidate(backend_ref, router_nservers, master_host, p, sample);
 
     /** Connect to all possible slaves */
     while (bref && slaves_connected < max_nslaves)
@@ -254,7 +375,7 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
             bref_set_state(bref, BREF_FATAL_FAILURE);
         }
 
-        bref = get_slave_candidate(backend_ref, router_nservers, master_host, p);
+        bref = get_slave_candidate(backend_ref, router_nservers, master_host, p, sample);
     }
 
     /**
@@ -313,27 +434,106 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
     return succp;
 }
 
+/**
+ * @brief Move a session to a new master
+ *
+ * Called when the master of the session has lost its status, for example in
+ * a switchover. If the session already has a slave connection to the new
+ * master, it becomes the master connection. Otherwise a new connection is
+ * created and the session command history is executed on it before the
+ * queries routed to it. The connection to the old master is kept if the
+ * server is now a slave.
+ *
+ * @param rses Router session
+ *
+ * @return True if the session has a usable master connection
+ */
+bool select_connect_new_master(ROUTER_CLIENT_SES *rses)
+{
+    backend_ref_t *old = rses->rses_master_ref;
+
+    update_server_states(rses->router->service, rses->rses_backend_ref, rses->rses_nbackends);
+    backend_ref_t *master = get_root_master(rses->rses_backend_ref, rses->rses_nbackends);
+
+    if (master == NULL || !bref_valid_for_connect(master))
+    {
+        return false;
+    }
+    else if (master == old && BREF_IS_IN_USE(master))
+    {
+        /** The master got its status back */
+        return true;
+    }
+
+    if (!BREF_IS_IN_USE(master))
+    {
+        if (rses->rses_config.disable_sescmd_history && rses->rses_nsescmd > 0)
+        {
+            MXS_ERROR("Session command history is disabled, the session can't be "
+                      "moved to the new master '%s'.", master->ref->server->unique_name);
+            return false;
+        }
+
+        if (!connect_server(master, rses->rses_session, true))
+        {
+            return false;
+        }
+    }
+
+    if (old && BREF_IS_IN_USE(old) && !SERVER_IS_SLAVE(&old->bref_server_state))
+    {
+        close_failed_bref(old, false);
+        RW_CHK_DCB(old, old->bref_dcb);
+        dcb_close(old->bref_dcb);
+        RW_CLOSE_BREF(old);
+        atomic_add(&old->ref->connections, -1);
+    }
+
+    if (rses->forced_node == old)
+    {
+        rses->forced_node = NULL;
+        rses->rses_ro_trx_forced = false;
+    }
+
+    rses->rses_master_ref = master;
+    atomic_add_uint64(&rses->router->stats.n_master_switches, 1);
+
+    MXS_NOTICE("Session %lu moved from master '%s' to '%s'.", rses->rses_session->ses_id,
+               old ? old->ref->server->unique_name : "<none>",
+               master->ref->server->unique_name);
+
+    return true;
+}
+
+/** Get the weight of a backend, lowered if the monitor reports its server as loaded */
+static int bref_weight(const backend_ref_t *bref)
+{
+    return server_weight_by_load(bref->bref_weight, bref->bref_server_state.load);
+}
+
 /** Compare number of connections from this router in backend servers */
 static int bref_cmp_router_conn(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = bref_weight((backend_ref_t *)bref1);
+    int w2 = bref_weight((backend_ref_t *)bref2);
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
         return b1->connections - b2->connections;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->connections) / b1->weight) -
-           ((1000 + 1000 * b2->connections) / b2->weight);
+    return ((1000 + 1000 * b1->connections) / w1) -
+           ((1000 + 1000 * b2->connections) / w2);
 }
 
 /** Compare number of global connections in backend servers */
@@ -341,23 +541,25 @@ static int bref_cmp_global_conn(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = bref_weight((backend_ref_t *)bref1);
+    int w2 = bref_weight((backend_ref_t *)bref2);
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
         return b1->server->stats.n_current -
                b2->server->stats.n_current;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->server->stats.n_current) / b1->weight) -
-           ((1000 + 1000 * b2->server->stats.n_current) / b2->weight);
+    return ((1000 + 1000 * b1->server->stats.n_current) / w1) -
+           ((1000 + 1000 * b2->server->stats.n_current) / w2);
 }
 
 /** Compare replication lag between backend servers */
@@ -365,23 +567,26 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = bref_weight((backend_ref_t *)bref1);
+    int w2 = bref_weight((backend_ref_t *)bref2);
+    int rlag1 = ((backend_ref_t *)bref1)->bref_server_state.rlag;
+    int rlag2 = ((backend_ref_t *)bref2)->bref_server_state.rlag;
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
-        return b1->server->rlag -
-               b2->server->rlag;
+        return rlag1 - rlag2;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->server->rlag) / b1->weight) -
-           ((1000 + 1000 * b2->server->rlag) / b2->weight);
+    return ((1000 + 1000 * rlag1) / w1) -
+           ((1000 + 1000 * rlag2) / w2);
 }
 
 /** Compare number of current operations in backend servers */
@@ -389,22 +594,58 @@ static int bref_cmp_current_load(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = bref_weight((backend_ref_t *)bref1);
+    int w2 = bref_weight((backend_ref_t *)bref2);
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
         return b1->server->stats.n_current_ops - b2->server->stats.n_current_ops;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
+    {
+        return 1;
+    }
+    else if (w2 == 0)
+    {
+        return -1;
+    }
+
+    return ((1000 + 1000 * b1->server->stats.n_current_ops) / w1) -
+           ((1000 + 1000 * b2->server->stats.n_current_ops) / w2);
+}
+
+/**
+ * Compare the average response times of backend servers
+ *
+ * Servers that have not yet been measured are preferred so that their response
+ * time gets sampled.
+ */
+static int bref_cmp_response_time(const void *bref1, const void *bref2)
+{
+    SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
+    SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = bref_weight((backend_ref_t *)bref1);
+    int w2 = bref_weight((backend_ref_t *)bref2);
+    int64_t t1 = b1->server->stats.response_time;
+    int64_t t2 = b2->server->stats.response_time;
+
+    if (w1 == 0 && w2 == 0)
+    {
+        return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
+    }
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->server->stats.n_current_ops) / b1->weight) -
-           ((1000 + 1000 * b2->server->stats.n_current_ops) / b2->weight);
+    t1 = (1000 + 1000 * t1) / w1;
+    t2 = (1000 + 1000 * t2) / w2;
+
+    return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
 }
 
 /**
@@ -425,11 +666,14 @@ static bool connect_server(backend_ref_t *bref, MXS_SESSION *session, bool execu
     bool rval = false;
 
     bref->bref_dcb = dcb_connect(serv, session, serv->protocol);
+    MXS_TRACE(tp_connect, serv->unique_name, execute_history, bref->bref_dcb != NULL, 0);
 
     if (bref->bref_dcb != NULL)
     {
         bref_clear_state(bref, BREF_CLOSED);
         bref->closed_at = 0;
+        bref->bref_draining = false;
+        ps_free_backend(bref);
 
         if (!execute_history || execute_sescmd_history(bref))
         {
@@ -476,7 +720,8 @@ static void log_server_connections(select_criteria_t select_criteria,
     if (select_criteria == LEAST_GLOBAL_CONNECTIONS ||
         select_criteria == LEAST_ROUTER_CONNECTIONS ||
         select_criteria == LEAST_BEHIND_MASTER ||
-        select_criteria == LEAST_CURRENT_OPERATIONS)
+        select_criteria == LEAST_CURRENT_OPERATIONS ||
+        select_criteria == ADAPTIVE_ROUTING)
     {
         MXS_INFO("Servers and %s connection counts:",
                  select_criteria == LEAST_GLOBAL_CONNECTIONS ? "all MaxScale"
@@ -511,6 +756,14 @@ static void log_server_connections(select_criteria_t select_criteria,
                 MXS_INFO("replication lag : %d in \t[%s]:%d %s",
                          b->server->rlag, b->server->name,
                          b->server->port, STRSRVSTATUS(b->server));
+                break;
+
+            case ADAPTIVE_ROUTING:
+                MXS_INFO("response time : %" PRId64 " usecs in \t[%s]:%d %s",
+                         b->server->stats.response_time, b->server->name,
+                         b->server->port, STRSRVSTATUS(b->server));
+                break;
+
             default:
                 break;
             }
@@ -531,10 +784,10 @@ static void log_server_connections(select_criteria_t select_criteria,
  * @return          The Master found
  *
  */
-static SERVER_REF *get_root_master(backend_ref_t *servers, int router_nservers)
+static backend_ref_t *get_root_master(backend_ref_t *servers, int router_nservers)
 {
     int i = 0;
-    SERVER_REF *master_host = NULL;
+    backend_ref_t *master_host = NULL;
 
     for (i = 0; i < router_nservers; i++)
     {
@@ -545,12 +798,12 @@ static SERVER_REF *get_root_master(backend_ref_t *servers, int router_nservers)
             continue;
         }
 
-        SERVER_REF *b = servers[i].ref;
+        backend_ref_t *b = &servers[i];
 
-        if (SERVER_IS_MASTER(b->server))
+        if (SERVER_IS_MASTER(&b->bref_server_state))
         {
             if (master_host == NULL ||
-                (b->server->depth < master_host->server->depth))
+                (b->bref_server_state.depth < master_host->bref_server_state.depth))
             {
                 master_host = b;
             }
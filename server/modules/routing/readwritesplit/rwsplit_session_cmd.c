@@ -13,12 +13,15 @@
 
 #include "readwritesplit.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
 
@@ -39,6 +42,7 @@ static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur);
 static void sescmd_cursor_reset(sescmd_cursor_t *scur);
 static bool sescmd_cursor_next(sescmd_cursor_t *scur);
 static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd);
+static char *sescmd_get_key(GWBUF *buf, unsigned char packet_type);
 
 /*
  * The following functions, all to do with the handling of session commands,
@@ -72,6 +76,9 @@ mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop)
 
 /**
  * Create session command property.
+ *
+ * The command is interned, so the session holds only a reference to it.
+ * If interning fails, my_sescmd_cmd is NULL.
  */
 mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
                                   GWBUF *sescmd_buf,
@@ -88,10 +95,11 @@ mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
     sescmd->my_sescmd_chk_top = CHK_NUM_MY_SESCMD;
     sescmd->my_sescmd_chk_tail = CHK_NUM_MY_SESCMD;
 #endif
-    /** Set session command buffer */
-    sescmd->my_sescmd_buf = sescmd_buf;
     sescmd->my_sescmd_packet_type = packet_type;
     sescmd->position = atomic_add(&rses->pos_generator, 1);
+    /** The key is taken before interning, the shared buffer must not be classified */
+    sescmd->my_sescmd_key = sescmd_get_key(sescmd_buf, packet_type);
+    sescmd->my_sescmd_cmd = mxs_sescmd_intern(sescmd_buf);
 
     return sescmd;
 }
@@ -104,7 +112,8 @@ void mysql_sescmd_done(mysql_sescmd_t *sescmd)
         return;
     }
     CHK_RSES_PROP(sescmd->my_sescmd_prop);
-    gwbuf_free(sescmd->my_sescmd_buf);
+    mxs_sescmd_release(sescmd->my_sescmd_cmd);
+    MXS_FREE(sescmd->my_sescmd_key);
     memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
 
@@ -145,6 +154,7 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
     {
         bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
         scur->position = scmd->position;
+        ps_store_backend_id(bref, scmd, replybuf);
         /** Faster backend has already responded to client : discard */
         if (scmd->my_sescmd_is_replied)
         {
@@ -194,6 +204,7 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             /** Mark the rest session commands as replied */
             scmd->my_sescmd_is_replied = true;
             scmd->reply_cmd = *((unsigned char *)replybuf->start + 4);
+            ps_store_client_id(ses, bref, scmd, replybuf);
 
             MXS_INFO("Server '%s' responded to a session command, sending the response "
                      "to the client.", bref->ref->server->unique_name);
@@ -313,7 +324,7 @@ GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur)
     }
     ss_dassert(scur->scmd_cur_cmd != NULL);
 
-    buf = gwbuf_clone(scur->scmd_cur_cmd->my_sescmd_buf);
+    buf = gwbuf_clone(mxs_sescmd_buffer(scur->scmd_cur_cmd->my_sescmd_cmd));
 
     CHK_GWBUF(buf);
     return buf;
@@ -365,6 +376,72 @@ static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur)
     return succp;
 }
 
+/**
+ * @brief Remove superseded session commands from the history
+ *
+ * Removes the commands that set the same thing as a new command. Only the
+ * commands after the last command that can't be compacted are removed as the
+ * commands before it may depend on them. Commands that are still being executed
+ * or waiting to be executed on a backend are not removed.
+ *
+ * @param rses Router session
+ * @param key  The key of the new session command
+ */
+void compact_sescmd_history(ROUTER_CLIENT_SES *rses, const char *key)
+{
+    rses_property_t **link = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+
+    for (rses_property_t *prop = *link; prop; prop = prop->rses_prop_next)
+    {
+        if (prop->rses_prop_data.sescmd.my_sescmd_key == NULL)
+        {
+            link = &prop->rses_prop_next;
+        }
+    }
+
+    while (*link)
+    {
+        rses_property_t *prop = *link;
+        mysql_sescmd_t *scmd = &prop->rses_prop_data.sescmd;
+        bool pending = !scmd->my_sescmd_is_replied;
+
+        for (int i = 0; i < rses->rses_nbackends && !pending; i++)
+        {
+            if (*rses->rses_backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property == prop)
+            {
+                pending = true;
+            }
+        }
+
+        if (pending || strcmp(scmd->my_sescmd_key, key) != 0)
+        {
+            link = &prop->rses_prop_next;
+            continue;
+        }
+
+        /** Cursors that have already executed this command move back to the previous one */
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            sescmd_cursor_t *scur = &rses->rses_backend_ref[i].bref_sescmd_cur;
+
+            if (scur->scmd_cur_ptr_property == &prop->rses_prop_next)
+            {
+                scur->scmd_cur_ptr_property = link;
+            }
+
+            if (scur->scmd_cur_cmd == scmd)
+            {
+                scur->scmd_cur_cmd = NULL;
+            }
+        }
+
+        MXS_INFO("Removing superseded session command from the history: %s", key);
+        *link = prop->rses_prop_next;
+        rses_property_done(prop);
+        atomic_add(&rses->rses_nsescmd, -1);
+    }
+}
+
 /*
  * End of functions called from other modules of the read write split router;
  * start of functions that are internal to this module.
@@ -465,3 +542,195 @@ static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd)
     CHK_MYSQL_SESCMD(scmd);
     return scmd->my_sescmd_prop;
 }
+
+static bool sescmd_is_ident_char(char c)
+{
+    return isalnum(c) || c == '_' || c == '$';
+}
+
+static const char *sescmd_skip_space(const char *ptr)
+{
+    while (isspace(*ptr))
+    {
+        ptr++;
+    }
+    return ptr;
+}
+
+/**
+ * Skip a keyword if it is the next word in the statement
+ */
+static bool sescmd_skip_word(const char **ptr, const char *word)
+{
+    size_t len = strlen(word);
+
+    if (strncasecmp(*ptr, word, len) == 0 && !sescmd_is_ident_char((*ptr)[len]))
+    {
+        *ptr = sescmd_skip_space(*ptr + len);
+        return true;
+    }
+
+    return false;
+}
+
+static bool sescmd_name_is(const char *name, int len, const char *word)
+{
+    return (size_t)len == strlen(word) && strncasecmp(name, word, len) == 0;
+}
+
+/**
+ * Check that the rest of the statement is a constant value
+ *
+ * Values that refer to variables or call functions could depend on earlier
+ * session commands.
+ */
+static bool sescmd_is_constant(const char *ptr)
+{
+    char quote = 0;
+
+    if (*ptr == '\0')
+    {
+        return false;
+    }
+
+    for (; *ptr; ptr++)
+    {
+        if (quote)
+        {
+            if (*ptr == '\\' && ptr[1])
+            {
+                ptr++;
+            }
+            else if (*ptr == quote)
+            {
+                quote = 0;
+            }
+        }
+        else if (*ptr == '\'' || *ptr == '"' || *ptr == '`')
+        {
+            quote = *ptr;
+        }
+        else if (strchr("@(),;#", *ptr) || (*ptr == '-' && ptr[1] == '-') ||
+                 (*ptr == '/' && ptr[1] == '*'))
+        {
+            return false;
+        }
+    }
+
+    return quote == 0;
+}
+
+/**
+ * @brief Get the history compaction key of a session command
+ *
+ * A command can be compacted if executing a later command with the same key
+ * makes it redundant. These are COM_INIT_DB, USE statements and SET statements
+ * that assign a constant to one session or user variable.
+ *
+ * @param buf         Session command buffer
+ * @param packet_type Command byte of the packet
+ * @return The key of the command or NULL if the command can't be compacted
+ */
+static char *sescmd_get_key(GWBUF *buf, unsigned char packet_type)
+{
+    if (packet_type == MYSQL_COM_INIT_DB)
+    {
+        return MXS_STRDUP("USE");
+    }
+    else if (packet_type != MYSQL_COM_QUERY)
+    {
+        return NULL;
+    }
+
+    char *sql = modutil_get_SQL(buf);
+    char *rval = NULL;
+
+    if (sql == NULL)
+    {
+        return NULL;
+    }
+
+    const char *ptr = sescmd_skip_space(sql);
+
+    if (sescmd_skip_word(&ptr, "USE"))
+    {
+        if (sescmd_is_constant(ptr))
+        {
+            rval = MXS_STRDUP("USE");
+        }
+    }
+    else if (sescmd_skip_word(&ptr, "SET"))
+    {
+        if (!sescmd_skip_word(&ptr, "SESSION") && !sescmd_skip_word(&ptr, "LOCAL"))
+        {
+            if (strncasecmp(ptr, "@@session.", 10) == 0)
+            {
+                ptr += 10;
+            }
+            else if (strncasecmp(ptr, "@@local.", 8) == 0)
+            {
+                ptr += 8;
+            }
+            else if (strncmp(ptr, "@@", 2) == 0)
+            {
+                ptr += 2;
+            }
+        }
+
+        const char *name = ptr;
+
+        if (*ptr == '@')
+        {
+            /** A user variable */
+            ptr++;
+        }
+
+        while (sescmd_is_ident_char(*ptr))
+        {
+            ptr++;
+        }
+
+        int len = ptr - name;
+        ptr = sescmd_skip_space(ptr);
+
+        if (len == 0 || (*name == '@' && len == 1) ||
+            sescmd_name_is(name, len, "GLOBAL") ||
+            sescmd_name_is(name, len, "TRANSACTION"))
+        {
+            /** Global changes and one-shot transaction settings are left alone */
+        }
+        else if (sescmd_name_is(name, len, "NAMES"))
+        {
+            if (sescmd_is_constant(ptr))
+            {
+                rval = MXS_STRDUP("SET NAMES");
+            }
+        }
+        else if (sescmd_name_is(name, len, "CHARSET") ||
+                 (sescmd_name_is(name, len, "CHARACTER") && sescmd_skip_word(&ptr, "SET")))
+        {
+            if (sescmd_is_constant(ptr))
+            {
+                rval = MXS_STRDUP("SET CHARACTER SET");
+            }
+        }
+        else if (*ptr == '=' || (*ptr == ':' && ptr[1] == '='))
+        {
+            ptr = sescmd_skip_space(ptr + (*ptr == '=' ? 1 : 2));
+
+            if (sescmd_is_constant(ptr) && (rval = MXS_MALLOC(len + 5)))
+            {
+                strcpy(rval, "SET ");
+
+                for (int i = 0; i < len; i++)
+                {
+                    rval[i + 4] = tolower(name[i]);
+                }
+                rval[len + 4] = '\0';
+            }
+        }
+    }
+
+    MXS_FREE(sql);
+    return rval;
+}
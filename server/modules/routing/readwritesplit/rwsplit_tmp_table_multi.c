@@ -45,6 +45,38 @@
  * somewhere else, outside this router. Perhaps in the query classifier?
  */
 
+/**
+ * @brief Get the bits of a table name in the temporary table filter
+ *
+ * Each session has a small bloom filter of the names of its temporary
+ * tables. A table whose bits are not all set in the filter is not a
+ * temporary table, so it can be ruled out without building its qualified
+ * name and looking it up from the hashtable.
+ *
+ * @param table Unqualified table name
+ * @return The bits of the name
+ */
+static uint64_t tmp_table_filter_bits(const char *table)
+{
+    unsigned int hash = rwsplit_hashkeyfun(table);
+
+    return ((uint64_t)1 << (hash & 63)) | ((uint64_t)1 << ((hash >> 6) & 63));
+}
+
+/**
+ * @brief Check whether a table may be a temporary table of the session
+ *
+ * @param router_cli_ses Router client session
+ * @param table Unqualified table name
+ * @return False if the table is certainly not a temporary table
+ */
+static bool tmp_table_filter_match(ROUTER_CLIENT_SES *router_cli_ses, const char *table)
+{
+    uint64_t bits = tmp_table_filter_bits(table);
+
+    return (router_cli_ses->rses_tmp_table_filter & bits) == bits;
+}
+
 /**
  * @brief Check for dropping of temporary tables
  *
@@ -62,8 +94,9 @@ void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses, GWBUF *querybuf,
         return;
     }
 
-    int tsize = 0, klen = 0, i;
-    char **tbl = NULL;
+    size_t tsize = 0, i;
+    int klen = 0;
+    const char* const* tbl = NULL;
     char *hkey, *dbname;
     MYSQL_session *my_data;
     rses_property_t *rses_prop_tmp;
@@ -74,32 +107,38 @@ void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses, GWBUF *querybuf,
 
     if (qc_is_drop_table_query(querybuf))
     {
-        tbl = qc_get_table_names(querybuf, &tsize, false);
+        qc_get_table_names_ref(querybuf, false, &tbl, &tsize);
         if (tbl != NULL)
         {
             for (i = 0; i < tsize; i++)
             {
-                /* Not clear why the next six lines are outside the if block */
-                klen = strlen(dbname) + strlen(tbl[i]) + 2;
-                hkey = MXS_CALLOC(klen, sizeof(char));
-                MXS_ABORT_IF_NULL(hkey);
-                strcpy(hkey, dbname);
-                strcat(hkey, ".");
-                strcat(hkey, tbl[i]);
-
-                if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables)
+                if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables &&
+                    tmp_table_filter_match(router_cli_ses, tbl[i]))
                 {
+                    klen = strlen(dbname) + strlen(tbl[i]) + 2;
+                    hkey = MXS_CALLOC(klen, sizeof(char));
+                    MXS_ABORT_IF_NULL(hkey);
+                    strcpy(hkey, dbname);
+                    strcat(hkey, ".");
+                    strcat(hkey, tbl[i]);
+
                     if (hashtable_delete(rses_prop_tmp->rses_prop_data.temp_tables,
                                          (void *)hkey))
                     {
                         MXS_INFO("Temporary table dropped: %s", hkey);
                     }
+                    MXS_FREE(hkey);
                 }
-                MXS_FREE(tbl[i]);
-                MXS_FREE(hkey);
             }
 
-            MXS_FREE(tbl);
+            if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables &&
+                hashtable_size(rses_prop_tmp->rses_prop_data.temp_tables) == 0)
+            {
+                /** No temporary tables are left, the statements of the session
+                 * no longer need to be checked */
+                router_cli_ses->have_tmp_tables = false;
+                router_cli_ses->rses_tmp_table_filter = 0;
+            }
         }
     }
 }
@@ -117,8 +156,8 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
 {
 
     bool target_tmp_table = false;
-    int tsize = 0, klen = 0, i;
-    char **tbl = NULL;
+    size_t tsize = 0, i;
+    const char* const* tbl = NULL;
     char *dbname;
     char hkey[MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2];
     MYSQL_session *data;
@@ -155,13 +194,18 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         qc_query_is_type(qtype, QUERY_TYPE_SYSVAR_READ) ||
         qc_query_is_type(qtype, QUERY_TYPE_GSYSVAR_READ))
     {
-        tbl = qc_get_table_names(querybuf, &tsize, false);
+        qc_get_table_names_ref(querybuf, false, &tbl, &tsize);
 
         if (tbl != NULL && tsize > 0)
         {
             /** Query targets at least one table */
             for (i = 0; i < tsize && !target_tmp_table && tbl[i]; i++)
             {
+                if (!tmp_table_filter_match(router_cli_ses, tbl[i]))
+                {
+                    continue;
+                }
+
                 sprintf(hkey, "%s.%s", dbname, tbl[i]);
                 if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables)
                 {
@@ -177,15 +221,6 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         }
     }
 
-    if (tbl != NULL)
-    {
-        for (i = 0; i < tsize; i++)
-        {
-            MXS_FREE(tbl[i]);
-        }
-        MXS_FREE(tbl);
-    }
-
     return rval;
 }
 
@@ -288,11 +323,15 @@ void check_create_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
             }
         }
 
-        if (hkey && rses_prop_tmp->rses_prop_data.temp_tables &&
-            hashtable_add(rses_prop_tmp->rses_prop_data.temp_tables, (void *)hkey,
-                          (void *)is_temp) == 0) /*< Conflict in hash table */
+        if (hkey && rses_prop_tmp->rses_prop_data.temp_tables)
         {
-            MXS_INFO("Temporary table conflict in hashtable: %s", hkey);
+            router_cli_ses->rses_tmp_table_filter |= tmp_table_filter_bits(tblname);
+
+            if (hashtable_add(rses_prop_tmp->rses_prop_data.temp_tables, (void *)hkey,
+                              (void *)is_temp) == 0) /*< Conflict in hash table */
+            {
+                MXS_INFO("Temporary table conflict in hashtable: %s", hkey);
+            }
         }
 #if defined(SS_DEBUG)
         {
@@ -355,9 +394,125 @@ bool check_for_multi_stmt(GWBUF *buf, void *protocol, mysql_server_cmd_t packet_
     return rval;
 }
 
-bool check_for_sp_call(GWBUF *buf, mysql_server_cmd_t packet_type)
+/**
+ * @brief Check if a query contains a word that hints at session level locks
+ *
+ * Table locks, named locks and handlers are session state but the statements
+ * that use them are classified as plain writes or reads. The check is done on
+ * the text of the query and errs on the side of finding the words, e.g. also
+ * inside string literals.
+ *
+ * @param buf Buffer containing the full query
+ * @return True if the query contains "LOCK" or "HANDLER" in any case
+ */
+static bool query_mentions_session_lock(GWBUF *buf)
+{
+    static const char *words[] = {"LOCK", "HANDLER"};
+    const char *data = (const char*)GWBUF_DATA(buf) + MYSQL_HEADER_LEN + 1;
+    int len = GWBUF_LENGTH(buf) - MYSQL_HEADER_LEN - 1;
+
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    {
+        int wlen = strlen(words[i]);
+
+        for (int j = 0; j + wlen <= len; j++)
+        {
+            if (strncasecmp(data + j, words[i], wlen) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Classify the statements of a multi-statement query
+ *
+ * A multi-statement query that only reads data cannot modify the session
+ * state and can be routed like a single read. A query whose statements
+ * modify data but not the session state, e.g. `INSERT ...; UPDATE ...`, must
+ * be routed to the master but later queries can be routed normally. Only
+ * the queries that modify the session state, leave a transaction open or
+ * contain statements that could not be classified, and the writes that may
+ * use locks or handlers, require all later queries to be routed to the master.
+ *
+ * @param buf   Buffer containing the full query
+ * @param qtype On return, the combined type of all statements if
+ *              MULTI_STMT_READ or MULTI_STMT_WRITE is returned
+ * @return How the query should be routed
+ */
+multi_stmt_class_t classify_multi_stmt(GWBUF *buf, qc_query_type_t *qtype)
+{
+    const uint32_t read_types = QUERY_TYPE_READ | QUERY_TYPE_USERVAR_READ |
+                                QUERY_TYPE_SYSVAR_READ | QUERY_TYPE_GSYSVAR_READ;
+    const uint32_t session_types = QUERY_TYPE_SESSION_WRITE | QUERY_TYPE_USERVAR_WRITE |
+                                   QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_ENABLE_AUTOCOMMIT |
+                                   QUERY_TYPE_DISABLE_AUTOCOMMIT | QUERY_TYPE_PREPARE_NAMED_STMT |
+                                   QUERY_TYPE_PREPARE_STMT | QUERY_TYPE_CREATE_TMP_TABLE;
+    int n_masks = 0;
+    uint32_t *type_masks = qc_get_type_masks(buf, &n_masks);
+    uint32_t combined = 0;
+    bool read_only = n_masks > 0;
+    bool session_state = n_masks == 0;
+    bool trx_open = false;
+
+    for (int i = 0; i < n_masks && !session_state; i++)
+    {
+        uint32_t type = type_masks[i];
+
+        if ((type & QUERY_TYPE_READ) == 0 || (type & ~read_types) != 0)
+        {
+            read_only = false;
+        }
+
+        if (type == QUERY_TYPE_UNKNOWN || (type & session_types) != 0)
+        {
+            session_state = true;
+        }
+        else if (type & QUERY_TYPE_BEGIN_TRX)
+        {
+            trx_open = true;
+        }
+        else if (type & (QUERY_TYPE_COMMIT | QUERY_TYPE_ROLLBACK))
+        {
+            trx_open = false;
+        }
+
+        combined |= type;
+    }
+
+    MXS_FREE(type_masks);
+
+    multi_stmt_class_t rval;
+
+    if (session_state || trx_open)
+    {
+        rval = MULTI_STMT_SESSION;
+    }
+    else if (read_only)
+    {
+        *qtype = (qc_query_type_t)combined;
+        rval = MULTI_STMT_READ;
+    }
+    else if (query_mentions_session_lock(buf))
+    {
+        rval = MULTI_STMT_SESSION;
+    }
+    else
+    {
+        *qtype = (qc_query_type_t)(combined | QUERY_TYPE_WRITE);
+        rval = MULTI_STMT_WRITE;
+    }
+
+    return rval;
+}
+
+bool check_for_sp_call(GWBUF *buf, mysql_server_cmd_t packet_type, uint32_t qtype)
 {
-    return packet_type == MYSQL_COM_QUERY && qc_get_operation(buf) == QUERY_OP_CALL;
+    return packet_type == MYSQL_COM_QUERY && !is_trx_or_session_stmt(qtype) &&
+           qc_get_operation(buf) == QUERY_OP_CALL;
 }
 
 /**
@@ -398,7 +553,14 @@ determine_query_type(GWBUF *querybuf, int packet_type, bool non_empty_packet)
             break;
 
         case MYSQL_COM_QUERY:
-            qtype = qc_get_type_mask(querybuf);
+            /** Statements only changing the transaction or session state are
+             * recognized without the query classifier */
+            qtype = qc_get_session_type_mask(querybuf);
+
+            if (qtype == QUERY_TYPE_UNKNOWN)
+            {
+                qtype = qc_get_type_mask(querybuf);
+            }
             break;
 
         case MYSQL_COM_STMT_PREPARE:
@@ -0,0 +1,748 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "scatter.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/mysql_utils.h>
+
+static bool is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/**
+ * Check if a keyword starts at a position of the query
+ *
+ * @return Pointer past the keyword or NULL if the keyword is not there
+ */
+static const char* match_keyword(const char *ptr, const char *start, const char *end,
+                                 const char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    if ((ptr > start && is_ident_char(ptr[-1])) || (size_t)(end - ptr) < len ||
+        strncasecmp(ptr, keyword, len) != 0 || (ptr + len < end && is_ident_char(ptr[len])))
+    {
+        return NULL;
+    }
+
+    return ptr + len;
+}
+
+static const char* skip_space(const char *ptr, const char *end)
+{
+    while (ptr < end && isspace((unsigned char)*ptr))
+    {
+        ptr++;
+    }
+
+    return ptr;
+}
+
+/**
+ * Skip a quoted string or a comment
+ *
+ * @return Pointer past the string or the comment, or @c ptr if there is none
+ */
+static const char* skip_quoted(const char *ptr, const char *end)
+{
+    char c = *ptr;
+
+    if (c == '\'' || c == '"' || c == '`')
+    {
+        for (ptr++; ptr < end && *ptr != c; ptr++)
+        {
+            if (*ptr == '\\' && c != '`' && ptr + 1 < end)
+            {
+                ptr++;
+            }
+        }
+
+        return ptr < end ? ptr + 1 : end;
+    }
+    else if (c == '#' || (c == '-' && ptr + 2 < end && ptr[1] == '-' && isspace((unsigned char)ptr[2])))
+    {
+        const char *eol = memchr(ptr, '\n', end - ptr);
+        return eol ? eol + 1 : end;
+    }
+    else if (c == '/' && ptr + 1 < end && ptr[1] == '*')
+    {
+        for (ptr += 2; ptr + 1 < end && !(ptr[0] == '*' && ptr[1] == '/'); ptr++)
+        {
+            ;
+        }
+
+        return ptr + 1 < end ? ptr + 2 : end;
+    }
+
+    return ptr;
+}
+
+/**
+ * Parse the column of an ORDER BY of a single column, optionally followed
+ * by ASC or DESC
+ *
+ * @return Pointer past the clause or NULL if it is not supported
+ */
+static const char* parse_order_by(const char *ptr, const char *end, SCATTER_ORDER *order)
+{
+    const char *start = ptr;
+
+    while (ptr < end && (is_ident_char(*ptr) || *ptr == '.' || *ptr == '`'))
+    {
+        if (*ptr == '`')
+        {
+            const char *next = skip_quoted(ptr, end);
+            const char *name = ptr + 1;
+            int len = next - name - 1;
+
+            if (len <= 0 || len > SCATTER_MAX_COLUMN)
+            {
+                return NULL;
+            }
+
+            sprintf(order->name, "%.*s", len, name);
+            ptr = next;
+        }
+        else
+        {
+            const char *name = ptr;
+
+            while (ptr < end && is_ident_char(*ptr))
+            {
+                ptr++;
+            }
+
+            if (ptr - name > SCATTER_MAX_COLUMN)
+            {
+                return NULL;
+            }
+
+            sprintf(order->name, "%.*s", (int)(ptr - name), name);
+
+            if (ptr < end && *ptr == '.')
+            {
+                ptr++;
+            }
+        }
+    }
+
+    if (ptr == start || ptr - start > SCATTER_MAX_COLUMN || order->name[0] == '\0')
+    {
+        return NULL;
+    }
+
+    sprintf(order->column, "%.*s", (int)(ptr - start), start);
+
+    char *num_end;
+    long position = strtol(order->column, &num_end, 10);
+
+    if (*num_end == '\0')
+    {
+        if (position <= 0)
+        {
+            return NULL;
+        }
+
+        order->position = position;
+    }
+
+    ptr = skip_space(ptr, end);
+
+    const char *next;
+
+    if ((next = match_keyword(ptr, start, end, "DESC")))
+    {
+        order->descending = true;
+        ptr = next;
+    }
+    else if ((next = match_keyword(ptr, start, end, "ASC")))
+    {
+        ptr = next;
+    }
+
+    return skip_space(ptr, end);
+}
+
+static const char* parse_number(const char *ptr, const char *end, uint64_t *value)
+{
+    if (ptr == end || !isdigit((unsigned char)*ptr))
+    {
+        return NULL;
+    }
+
+    *value = 0;
+
+    while (ptr < end && isdigit((unsigned char)*ptr))
+    {
+        *value = *value * 10 + (*ptr - '0');
+        ptr++;
+    }
+
+    return skip_space(ptr, end);
+}
+
+/**
+ * Parse the arguments of a LIMIT: `count`, `offset, count` or `count OFFSET offset`
+ *
+ * @return Pointer past the clause or NULL if it is not supported
+ */
+static const char* parse_limit(const char *ptr, const char *end, SCATTER_ORDER *order)
+{
+    uint64_t first;
+    uint64_t second;
+    const char *next;
+
+    if ((ptr = parse_number(ptr, end, &first)) == NULL)
+    {
+        return NULL;
+    }
+
+    if (ptr < end && *ptr == ',')
+    {
+        if ((ptr = parse_number(skip_space(ptr + 1, end), end, &second)) == NULL)
+        {
+            return NULL;
+        }
+
+        order->offset = first;
+        order->limit = second;
+    }
+    else if ((next = match_keyword(ptr, ptr, end, "OFFSET")))
+    {
+        if ((ptr = parse_number(skip_space(next, end), end, &second)) == NULL)
+        {
+            return NULL;
+        }
+
+        order->offset = second;
+        order->limit = first;
+    }
+    else
+    {
+        order->limit = first;
+    }
+
+    return ptr;
+}
+
+/**
+ * Parse the ORDER BY and LIMIT clauses at the end of a union
+ *
+ * @return True if the clauses are supported
+ */
+static bool parse_union_order(const char *order_by, const char *limit, const char *end,
+                              SCATTER_ORDER *order)
+{
+    const char *ptr;
+
+    if (order_by)
+    {
+        ptr = skip_space(match_keyword(order_by, order_by, end, "ORDER"), end);
+
+        if ((ptr = match_keyword(ptr, order_by, end, "BY")) == NULL ||
+            (ptr = parse_order_by(skip_space(ptr, end), end, order)) == NULL ||
+            (ptr != end && ptr != limit))
+        {
+            return false;
+        }
+    }
+
+    if (limit)
+    {
+        ptr = skip_space(match_keyword(limit, limit, end, "LIMIT"), end);
+
+        if ((ptr = parse_limit(ptr, end, order)) == NULL || ptr != end)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool scatter_parse_union(const char *sql, int len, SCATTER_QUERY *query)
+{
+    const char *end = sql + len;
+    const char *ptr = sql;
+    const char *branch = sql;
+    const char *order_by = NULL;
+    const char *limit = NULL;
+    int depth = 0;
+
+    memset(query, 0, sizeof(*query));
+    query->order.limit = -1;
+
+    /** Ignore the trailing semicolons and whitespace */
+    while (end > sql && (isspace((unsigned char)end[-1]) || end[-1] == ';'))
+    {
+        end--;
+    }
+
+    while (ptr < end)
+    {
+        const char *next = skip_quoted(ptr, end);
+
+        if (next != ptr)
+        {
+            ptr = next;
+            continue;
+        }
+
+        if (*ptr == '(')
+        {
+            depth++;
+        }
+        else if (*ptr == ')')
+        {
+            depth--;
+        }
+        else if (depth == 0 && (next = match_keyword(ptr, sql, end, "UNION")))
+        {
+            next = skip_space(next, end);
+
+            if ((next = match_keyword(next, sql, end, "ALL")) == NULL ||
+                query->n_branches == SCATTER_MAX_BRANCHES - 1 || order_by || limit)
+            {
+                /** Only UNION ALL can be merged by concatenating the rows */
+                return false;
+            }
+
+            query->branch[query->n_branches] = branch;
+            query->branch_len[query->n_branches] = ptr - branch;
+            query->n_branches++;
+            branch = ptr = next;
+            continue;
+        }
+        else if (depth == 0 && !order_by && !limit && match_keyword(ptr, sql, end, "ORDER"))
+        {
+            order_by = ptr;
+        }
+        else if (depth == 0 && !limit && match_keyword(ptr, sql, end, "LIMIT"))
+        {
+            limit = ptr;
+        }
+
+        ptr++;
+    }
+
+    if (query->n_branches == 0 || depth != 0 ||
+        !parse_union_order(order_by, limit, end, &query->order))
+    {
+        return false;
+    }
+
+    const char *branch_end = order_by ? order_by : limit ? limit : end;
+    query->branch[query->n_branches] = branch;
+    query->branch_len[query->n_branches] = branch_end - branch;
+    query->n_branches++;
+
+    return true;
+}
+
+int scatter_order_to_sql(const SCATTER_ORDER *order, char *dest, int size)
+{
+    int len = 0;
+
+    *dest = '\0';
+
+    if (order->column[0])
+    {
+        len += snprintf(dest + len, size - len, " ORDER BY %s%s",
+                        order->column, order->descending ? " DESC" : "");
+    }
+
+    if (order->limit >= 0 && len < size)
+    {
+        len += snprintf(dest + len, size - len, " LIMIT %" PRIu64,
+                        order->offset + (uint64_t)order->limit);
+    }
+
+    return len < size ? len : size - 1;
+}
+
+bool scatter_reply_add(SCATTER_REPLY *reply, GWBUF *buffer)
+{
+    reply->buffer = gwbuf_append(reply->buffer, buffer);
+    size_t total = gwbuf_length(reply->buffer);
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    while (!reply->complete && reply->offset + sizeof(header) <= total)
+    {
+        gwbuf_copy_data(reply->buffer, reply->offset, sizeof(header), header);
+        size_t payload = gw_mysql_get_byte3(header);
+        uint8_t command = header[MYSQL_HEADER_LEN];
+
+        if (reply->offset + MYSQL_HEADER_LEN + payload > total)
+        {
+            break;
+        }
+
+        if (command == MYSQL_REPLY_ERR ||
+            (reply->offset == 0 && command == MYSQL_REPLY_OK))
+        {
+            reply->complete = true;
+        }
+        else if (command == MYSQL_REPLY_EOF && payload < 9 && ++reply->n_eof == 2)
+        {
+            reply->complete = true;
+        }
+
+        reply->offset += MYSQL_HEADER_LEN + payload;
+    }
+
+    return reply->complete;
+}
+
+void scatter_reply_reset(SCATTER_REPLY *reply)
+{
+    gwbuf_free(reply->buffer);
+    reply->buffer = NULL;
+    reply->offset = 0;
+    reply->n_eof = 0;
+    reply->complete = false;
+}
+
+static uint8_t* next_packet(uint8_t *ptr)
+{
+    return ptr + MYSQL_HEADER_LEN + gw_mysql_get_byte3(ptr);
+}
+
+static bool is_eof(uint8_t *ptr)
+{
+    return ptr[MYSQL_HEADER_LEN] == MYSQL_REPLY_EOF && gw_mysql_get_byte3(ptr) < 9;
+}
+
+/**
+ * The parts of a complete result set
+ */
+typedef struct result_set
+{
+    uint8_t  *header_end; /*< End of the column definitions and their EOF */
+    uint8_t **rows;       /*< The row packets */
+    size_t    n_rows;
+    size_t    next;       /*< Next row to merge */
+    uint8_t  *eof;        /*< The last EOF packet */
+} RESULT_SET;
+
+static bool parse_result_set(GWBUF *buffer, RESULT_SET *rset, uint64_t *n_columns)
+{
+    uint8_t *ptr = GWBUF_DATA(buffer);
+    uint8_t *end = ptr + GWBUF_LENGTH(buffer);
+    uint8_t *data = ptr + MYSQL_HEADER_LEN;
+
+    *n_columns = mxs_leint_value(data);
+    ptr = next_packet(ptr);
+
+    /** Skip the column definitions and the EOF after them */
+    for (uint64_t i = 0; i <= *n_columns && ptr < end; i++)
+    {
+        ptr = next_packet(ptr);
+    }
+
+    rset->header_end = ptr;
+    rset->n_rows = 0;
+    rset->next = 0;
+
+    for (uint8_t *row = ptr; row < end && !is_eof(row); row = next_packet(row))
+    {
+        rset->n_rows++;
+    }
+
+    if ((rset->rows = (uint8_t**)MXS_MALLOC((rset->n_rows + 1) * sizeof(uint8_t*))) == NULL)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < rset->n_rows; i++)
+    {
+        rset->rows[i] = ptr;
+        ptr = next_packet(ptr);
+    }
+
+    rset->eof = ptr;
+    return ptr < end;
+}
+
+/**
+ * Find the index of the ORDER BY column from the column definitions
+ *
+ * @return The index or -1 if the column was not found
+ */
+static int find_order_column(GWBUF *buffer, uint64_t n_columns, const SCATTER_ORDER *order)
+{
+    if (order->position > 0)
+    {
+        return (uint64_t)order->position <= n_columns ? order->position - 1 : -1;
+    }
+
+    uint8_t *ptr = next_packet(GWBUF_DATA(buffer));
+
+    for (uint64_t i = 0; i < n_columns; i++)
+    {
+        uint8_t *field = ptr + MYSQL_HEADER_LEN;
+        size_t len = 0;
+        char *value = NULL;
+
+        /** Skip catalog, schema, table and original table to get the name */
+        for (int j = 0; j < 5; j++)
+        {
+            value = mxs_lestr_consume(&field, &len);
+        }
+
+        if (len == strlen(order->name) && strncasecmp(value, order->name, len) == 0)
+        {
+            return i;
+        }
+
+        ptr = next_packet(ptr);
+    }
+
+    return -1;
+}
+
+/**
+ * Get a value of a row in the text protocol
+ *
+ * @return Pointer to the value or NULL if it is NULL
+ */
+static uint8_t* row_value(uint8_t *row, int column, size_t *len)
+{
+    uint8_t *ptr = row + MYSQL_HEADER_LEN;
+
+    for (int i = 0; i < column; i++)
+    {
+        if (*ptr == 0xfb)
+        {
+            ptr++;
+        }
+        else
+        {
+            uint64_t size = mxs_leint_consume(&ptr);
+            ptr += size;
+        }
+    }
+
+    if (*ptr == 0xfb)
+    {
+        return NULL;
+    }
+
+    *len = mxs_leint_consume(&ptr);
+    return ptr;
+}
+
+static bool to_number(const uint8_t *value, size_t len, double *number)
+{
+    char buf[len + 1];
+    char *end;
+
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+    *number = strtod(buf, &end);
+
+    return len > 0 && *end == '\0';
+}
+
+/**
+ * Compare the ORDER BY column of two rows. NULLs are the smallest values,
+ * numbers are compared by value and other values byte by byte.
+ */
+static int compare_rows(uint8_t *a, uint8_t *b, int column)
+{
+    size_t alen = 0;
+    size_t blen = 0;
+    uint8_t *aval = row_value(a, column, &alen);
+    uint8_t *bval = row_value(b, column, &blen);
+    double anum;
+    double bnum;
+
+    if (aval == NULL || bval == NULL)
+    {
+        return (aval != NULL) - (bval != NULL);
+    }
+    else if (to_number(aval, alen, &anum) && to_number(bval, blen, &bnum))
+    {
+        return (anum > bnum) - (anum < bnum);
+    }
+
+    int rval = memcmp(aval, bval, alen < blen ? alen : blen);
+    return rval ? rval : (alen > blen) - (alen < blen);
+}
+
+/**
+ * Pick the result set whose next row comes first
+ *
+ * @return Index of the result set or -1 if all rows are merged
+ */
+static int next_row(RESULT_SET *rsets, int n, int column, bool descending)
+{
+    int rval = -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (rsets[i].next < rsets[i].n_rows)
+        {
+            if (rval == -1)
+            {
+                rval = i;
+            }
+            else if (column >= 0)
+            {
+                int cmp = compare_rows(rsets[i].rows[rsets[i].next],
+                                       rsets[rval].rows[rsets[rval].next], column);
+
+                if (descending ? cmp > 0 : cmp < 0)
+                {
+                    rval = i;
+                }
+            }
+        }
+    }
+
+    return rval;
+}
+
+GWBUF* scatter_merge(SCATTER_REPLY *replies, int n, const SCATTER_ORDER *order)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if ((replies[i].buffer = gwbuf_make_contiguous(replies[i].buffer)) == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        uint8_t command = GWBUF_DATA(replies[i].buffer)[MYSQL_HEADER_LEN];
+
+        if (command == MYSQL_REPLY_ERR || command == MYSQL_REPLY_OK)
+        {
+            /** Not a result set, let the client see why */
+            GWBUF *rval = replies[i].buffer;
+            replies[i].buffer = NULL;
+            return rval;
+        }
+    }
+
+    RESULT_SET rsets[n];
+    uint64_t n_columns = 0;
+    bool ok = true;
+
+    memset(rsets, 0, sizeof(rsets));
+
+    for (int i = 0; i < n && ok; i++)
+    {
+        uint64_t columns;
+
+        if (!parse_result_set(replies[i].buffer, &rsets[i], &columns))
+        {
+            ok = false;
+        }
+        else if (i > 0 && columns != n_columns)
+        {
+            MXS_ERROR("Scattered query returned %" PRIu64 " columns from one server "
+                      "and %" PRIu64 " from another.", n_columns, columns);
+            ok = false;
+        }
+
+        n_columns = columns;
+    }
+
+    GWBUF *rval = NULL;
+
+    if (ok)
+    {
+        uint8_t *first = GWBUF_DATA(replies[0].buffer);
+        size_t header_len = rsets[0].header_end - first;
+        size_t eof_len = next_packet(rsets[0].eof) - rsets[0].eof;
+        size_t n_rows = 0;
+        size_t rows_len = 0;
+        int column = order->column[0] ? find_order_column(replies[0].buffer, n_columns, order) : -1;
+        uint64_t skipped = 0;
+        int pick;
+
+        /** Select the rows first to know the size of the merged reply */
+        uint8_t **selected = NULL;
+        size_t total_rows = 0;
+
+        for (int j = 0; j < n; j++)
+        {
+            total_rows += rsets[j].n_rows;
+        }
+
+        if ((selected = (uint8_t**)MXS_MALLOC((total_rows + 1) * sizeof(uint8_t*))))
+        {
+            while ((order->limit < 0 || n_rows < (uint64_t)order->limit) &&
+                   (pick = next_row(rsets, n, column, order->descending)) != -1)
+            {
+                uint8_t *row = rsets[pick].rows[rsets[pick].next++];
+
+                if (skipped < order->offset)
+                {
+                    skipped++;
+                }
+                else
+                {
+                    selected[n_rows++] = row;
+                    rows_len += next_packet(row) - row;
+                }
+            }
+
+            if ((rval = gwbuf_alloc(header_len + rows_len + eof_len)))
+            {
+                uint8_t *ptr = GWBUF_DATA(rval);
+                memcpy(ptr, first, header_len);
+                ptr += header_len;
+
+                for (size_t j = 0; j < n_rows; j++)
+                {
+                    size_t len = next_packet(selected[j]) - selected[j];
+                    memcpy(ptr, selected[j], len);
+                    ptr += len;
+                }
+
+                memcpy(ptr, rsets[0].eof, eof_len);
+
+                /** Number the packets as if they came from one server */
+                uint8_t seq = 1;
+                uint8_t *end = GWBUF_DATA(rval) + GWBUF_LENGTH(rval);
+
+                for (ptr = GWBUF_DATA(rval); ptr < end; ptr = next_packet(ptr))
+                {
+                    ptr[3] = seq++;
+                }
+
+                gwbuf_set_type(rval, GWBUF_TYPE_MYSQL);
+            }
+
+            MXS_FREE(selected);
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        MXS_FREE(rsets[i].rows);
+    }
+
+    return rval;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#ifndef _SCATTER_HG
+#define _SCATTER_HG
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file scatter.h Splitting of cross-shard UNION ALL queries and merging of
+ * their result sets
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+#include <maxscale/protocol/mysql.h>
+
+MXS_BEGIN_DECLS
+
+/** Maximum number of UNION ALL branches in a scattered query */
+#define SCATTER_MAX_BRANCHES 64
+
+/** Maximum length of the ORDER BY column of a scattered query */
+#define SCATTER_MAX_COLUMN (MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 8)
+
+/**
+ * How the merged result set of a scattered query is ordered and limited
+ */
+typedef struct scatter_order
+{
+    char     column[SCATTER_MAX_COLUMN + 1]; /*< ORDER BY column as written, empty if not ordered */
+    char     name[SCATTER_MAX_COLUMN + 1];   /*< Unquoted column name without a qualifier */
+    int      position;   /*< Position of the ORDER BY column if given as a number */
+    bool     descending; /*< Whether the order is descending */
+    uint64_t offset;     /*< Number of rows to skip */
+    int64_t  limit;      /*< Maximum number of rows, -1 for no limit */
+} SCATTER_ORDER;
+
+/**
+ * A UNION ALL query split into its branches
+ */
+typedef struct scatter_query
+{
+    int           n_branches;
+    const char   *branch[SCATTER_MAX_BRANCHES];     /*< Start of each branch in the query */
+    int           branch_len[SCATTER_MAX_BRANCHES]; /*< Length of each branch */
+    SCATTER_ORDER order; /*< Trailing ORDER BY and LIMIT of the whole union */
+} SCATTER_QUERY;
+
+/**
+ * The reply of one server to a scattered query
+ */
+typedef struct scatter_reply
+{
+    GWBUF  *buffer;   /*< The reply collected so far */
+    size_t  offset;   /*< Offset of the first packet not yet inspected */
+    int     n_eof;    /*< Number of EOF packets seen */
+    bool    complete; /*< Whether the whole reply has been received */
+} SCATTER_REPLY;
+
+/**
+ * Split a query that combines two or more queries with UNION ALL. The
+ * ORDER BY of a single column and the LIMIT at the end of the last query,
+ * which apply to the whole union, are removed from the last branch.
+ *
+ * @param sql   The query
+ * @param len   Length of the query
+ * @param query The split query
+ *
+ * @return True if the query is a UNION ALL that can be scattered
+ */
+bool scatter_parse_union(const char *sql, int len, SCATTER_QUERY *query);
+
+/**
+ * Append the ORDER BY and LIMIT of a scattered query to a query sent to one
+ * server. The offset is added to the limit as the rows are skipped only when
+ * the results are merged.
+ *
+ * @param order The ORDER BY and LIMIT of the scattered query
+ * @param dest  Where the clauses are written
+ * @param size  Size of @c dest
+ *
+ * @return Number of characters written
+ */
+int scatter_order_to_sql(const SCATTER_ORDER *order, char *dest, int size);
+
+/**
+ * Add a part of a reply to a scattered query
+ *
+ * @param reply  The reply of the server
+ * @param buffer The next part of the reply
+ *
+ * @return True if the reply is complete
+ */
+bool scatter_reply_add(SCATTER_REPLY *reply, GWBUF *buffer);
+
+/**
+ * Discard a reply to a scattered query
+ *
+ * @param reply Reply to discard
+ */
+void scatter_reply_reset(SCATTER_REPLY *reply);
+
+/**
+ * Merge the complete replies to a scattered query. The rows are concatenated
+ * or, if the query is ordered, merged in order and the limit is applied. If a
+ * server returned an error or no result set, that reply is returned as is.
+ *
+ * @param replies The replies of the servers, the buffers are consumed
+ * @param n       Number of replies
+ * @param order   The ORDER BY and LIMIT of the query
+ *
+ * @return The merged reply or NULL if the result sets have a different number
+ * of columns or memory allocation failed
+ */
+GWBUF* scatter_merge(SCATTER_REPLY *replies, int n, const SCATTER_ORDER *order);
+
+MXS_END_DECLS
+
+#endif
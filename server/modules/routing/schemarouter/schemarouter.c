@@ -30,11 +30,25 @@
 #include <maxscale/modutil.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/mysql_utils.h>
 #include <maxscale/poll.h>
 #include <pcre.h>
 
 #define DEFAULT_REFRESH_INTERVAL "300"
 
+/** How often the need to refresh the shared shard map is checked, in seconds */
+#define SHARED_MAP_CHECK_FREQ 1
+
+/** The query used to read the databases of a shard for the shared shard map */
+#define SHARED_MAP_QUERY "SELECT SCHEMA_NAME FROM information_schema.SCHEMATA"
+
+/** The query used to read the tables of a shard when tables are sharded */
+#define SHARED_MAP_TABLE_QUERY "SELECT TABLE_SCHEMA, TABLE_NAME FROM information_schema.TABLES " \
+    "WHERE TABLE_SCHEMA NOT IN ('mysql', 'information_schema', 'performance_schema')"
+
 /** Size of the hashtable used to store ignored databases */
 #define SCHEMAROUTER_HASHSIZE 100
 
@@ -199,6 +213,8 @@ shard_map_t* shard_map_alloc()
             spinlock_init(&rval->lock);
             rval->last_updated = 0;
             rval->state = SHMAP_UNINIT;
+            rval->refcount = 1;
+            rval->tables = NULL;
         }
         else
         {
@@ -209,6 +225,508 @@ shard_map_t* shard_map_alloc()
     return rval;
 }
 
+/**
+ * Release a reference to a shared shard map, the last reference frees the map.
+ * @param map Shard map to release, can be NULL
+ */
+static void shared_map_release(shard_map_t *map)
+{
+    if (map && atomic_add(&map->refcount, -1) == 1)
+    {
+        hashtable_free(map->hash);
+        hashtable_free(map->tables);
+        MXS_FREE(map);
+    }
+}
+
+/**
+ * Take a reference to the shared shard map of the router.
+ * @param router Router instance
+ * @return The shared shard map or NULL if it has not been built
+ */
+static shard_map_t* shared_map_acquire(ROUTER_INSTANCE* router)
+{
+    spinlock_acquire(&router->lock);
+    shard_map_t *map = router->shared_map;
+
+    if (map)
+    {
+        atomic_add(&map->refcount, 1);
+    }
+    spinlock_release(&router->lock);
+    return map;
+}
+
+/**
+ * Replace the shared shard map of the router. The sessions using the old map
+ * keep it until they release it.
+ * @param router Router instance
+ * @param map The new shared shard map, NULL makes the sessions map the databases
+ * themselves
+ */
+static void shared_map_publish(ROUTER_INSTANCE* router, shard_map_t *map)
+{
+    spinlock_acquire(&router->lock);
+    shard_map_t *old = router->shared_map;
+    router->shared_map = map;
+    spinlock_release(&router->lock);
+
+    shared_map_release(old);
+}
+
+/**
+ * Release the shard map of a session if it is the shared shard map. The other
+ * shard maps are owned by the router's per user cache.
+ * @param rses Router client session
+ */
+static void release_shard_map(ROUTER_CLIENT_SES* rses)
+{
+    if (rses->shardmap_shared)
+    {
+        shared_map_release(rses->shardmap);
+        rses->shardmap = NULL;
+        rses->shardmap_shared = false;
+    }
+}
+
+/**
+ * Check if a database is ignored when looking for databases found on more
+ * than one server.
+ * @param router Router instance
+ * @param db Database name
+ * @param match_data Match data for the ignore regex
+ * @return True if the database is ignored
+ */
+static bool is_ignored_db(ROUTER_INSTANCE* router, char* db, pcre2_match_data* match_data)
+{
+    return hashtable_fetch(router->ignored_dbs, db) ||
+           (router->ignore_regex &&
+            pcre2_match(router->ignore_regex, (PCRE2_SPTR)db, PCRE2_ZERO_TERMINATED,
+                        0, 0, match_data, NULL) >= 0);
+}
+
+/**
+ * Add a database to a shard map. If the database is already in the map and it
+ * is ignored, the preferred server wins the conflict.
+ * @param router Router instance
+ * @param hash Database hashtable of the shard map
+ * @param db Database name
+ * @param target Unique name of the server that has the database
+ * @param match_data Match data for the ignore regex
+ * @return False if the database was found on more than one server
+ */
+static bool shard_map_add_db(ROUTER_INSTANCE* router, HASHTABLE* hash, char* db,
+                             char* target, pcre2_match_data* match_data)
+{
+    bool rval = true;
+
+    if (hashtable_add(hash, db, target))
+    {
+        MXS_INFO("<%s, %s>", target, db);
+    }
+    else if (!is_ignored_db(router, db, match_data))
+    {
+        rval = false;
+    }
+    else if (router->preferred_server &&
+             strcmp(target, router->preferred_server->unique_name) == 0)
+    {
+        /** In conflict situations, use the preferred server */
+        MXS_INFO("Forcing location of '%s' from '%s' to ''%s",
+                 db, (char*)hashtable_fetch(hash, db), target);
+
+        hashtable_delete(hash, db);
+        hashtable_add(hash, db, target);
+    }
+
+    return rval;
+}
+
+/**
+ * Read the databases of a shard into the shared shard map.
+ * @param router Router instance
+ * @param con Connection to the server
+ * @param server Server to read
+ * @param map Shard map to fill
+ * @param match_data Match data for the ignore regex
+ * @param duplicate Set to true if a database was found on more than one server
+ * @return True if the databases were read
+ */
+static bool shared_map_read_databases(ROUTER_INSTANCE* router, MYSQL* con, SERVER* server,
+                                      shard_map_t* map, pcre2_match_data* match_data,
+                                      bool* duplicate)
+{
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(con, SHARED_MAP_QUERY) != 0 ||
+        (result = mysql_store_result(con)) == NULL)
+    {
+        return false;
+    }
+
+    MYSQL_ROW row;
+
+    while ((row = mysql_fetch_row(result)))
+    {
+        /** With table sharding a database can be on more than one server, the
+         * first server is used for the queries that do not target a table */
+        if (row[0] && !shard_map_add_db(router, map->hash, row[0], server->unique_name, match_data) &&
+            !router->schemarouter_config.table_sharding)
+        {
+            *duplicate = true;
+            MXS_ERROR("Database '%s' found on servers '%s' and '%s' for service '%s'.",
+                      row[0], server->unique_name, (char*)hashtable_fetch(map->hash, row[0]),
+                      router->service->name);
+        }
+    }
+
+    mysql_free_result(result);
+    return true;
+}
+
+/**
+ * Read the databases and, if table sharding is enabled, the tables of a shard.
+ * The tables are returned as a result set as the size of the table hashtable
+ * is only known once all shards have been read.
+ * @param router Router instance
+ * @param server Server to read
+ * @param user Service user
+ * @param password Decrypted password of the service user
+ * @param map Shard map to fill
+ * @param match_data Match data for the ignore regex
+ * @param duplicate Set to true if a database was found on more than one server
+ * @param tables Set to the tables of the shard, freed by the caller
+ * @return True if the shard was read
+ */
+static bool shared_map_read_shard(ROUTER_INSTANCE* router, SERVER* server,
+                                  const char* user, const char* password,
+                                  shard_map_t* map, pcre2_match_data* match_data,
+                                  bool* duplicate, MYSQL_RES** tables)
+{
+    MYSQL *con = mysql_init(NULL);
+
+    if (con == NULL)
+    {
+        MXS_ERROR("mysql_init: %s", mysql_error(NULL));
+        return false;
+    }
+
+    MXS_CONFIG* cnf = config_get_global_options();
+    mysql_optionsv(con, MYSQL_OPT_CONNECT_TIMEOUT, &cnf->auth_conn_timeout);
+    mysql_optionsv(con, MYSQL_OPT_READ_TIMEOUT, &cnf->auth_read_timeout);
+    mysql_optionsv(con, MYSQL_OPT_WRITE_TIMEOUT, &cnf->auth_write_timeout);
+
+    bool rval = mxs_mysql_real_connect(con, server, user, password) &&
+                shared_map_read_databases(router, con, server, map, match_data, duplicate);
+
+    if (rval && router->schemarouter_config.table_sharding &&
+        (mxs_mysql_query(con, SHARED_MAP_TABLE_QUERY) != 0 ||
+         (*tables = mysql_store_result(con)) == NULL))
+    {
+        rval = false;
+    }
+
+    if (!rval)
+    {
+        MXS_ERROR("Failed to read the databases of server '%s' for service '%s': %d, %s",
+                  server->unique_name, router->service->name, mysql_errno(con), mysql_error(con));
+    }
+
+    mysql_close(con);
+    return rval;
+}
+
+/**
+ * Add the tables of a shard to the shared shard map. The tables of the ignored
+ * databases are routed by their database.
+ * @param router Router instance
+ * @param map Shard map to fill
+ * @param server Unique name of the server
+ * @param tables The tables of the server
+ * @param match_data Match data for the ignore regex
+ * @return False if a table was found on more than one server
+ */
+static bool shared_map_add_tables(ROUTER_INSTANCE* router, shard_map_t* map, char* server,
+                                  MYSQL_RES* tables, pcre2_match_data* match_data)
+{
+    bool rval = true;
+    MYSQL_ROW row;
+
+    while ((row = mysql_fetch_row(tables)))
+    {
+        if (row[0] && row[1] && !is_ignored_db(router, row[0], match_data))
+        {
+            char key[strlen(row[0]) + strlen(row[1]) + 2];
+            sprintf(key, "%s.%s", row[0], row[1]);
+
+            if (!hashtable_add(map->tables, key, server))
+            {
+                rval = false;
+                MXS_ERROR("Table '%s' found on servers '%s' and '%s' for service '%s'.",
+                          key, server, (char*)hashtable_fetch(map->tables, key),
+                          router->service->name);
+            }
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Copy the entries of a server from one hashtable of a shard map to another.
+ * @param router Router instance
+ * @param from Hashtable to copy from
+ * @param to Hashtable to copy to
+ * @param server Unique name of the server
+ * @param match_data Match data for the ignore regex
+ */
+static void shared_map_copy_shard(ROUTER_INSTANCE* router, HASHTABLE* from, HASHTABLE* to,
+                                  char* server, pcre2_match_data* match_data)
+{
+    HASHITERATOR *iter = from ? hashtable_iterator(from) : NULL;
+
+    if (iter)
+    {
+        char *key;
+
+        while ((key = hashtable_next(iter)))
+        {
+            char *value = hashtable_fetch(from, key);
+
+            if (value && strcmp(value, server) == 0)
+            {
+                shard_map_add_db(router, to, key, value, match_data);
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+}
+
+/**
+ * Count the entries that were added to, moved in or removed from a hashtable
+ * of a shard map.
+ * @param old The old hashtable, can be NULL
+ * @param hash The new hashtable, can be NULL
+ * @return Number of changed entries
+ */
+static int shard_map_changes(HASHTABLE* old, HASHTABLE* hash)
+{
+    if (old == NULL || hash == NULL)
+    {
+        return (old ? hashtable_size(old) : 0) + (hash ? hashtable_size(hash) : 0);
+    }
+
+    HASHITERATOR *iter = hashtable_iterator(hash);
+    int changes = 0;
+    char *key;
+
+    if (iter == NULL)
+    {
+        return 1;
+    }
+
+    while ((key = hashtable_next(iter)))
+    {
+        char *value = hashtable_fetch(old, key);
+
+        if (value == NULL || strcmp(value, (char*)hashtable_fetch(hash, key)) != 0)
+        {
+            changes++;
+        }
+    }
+
+    hashtable_iterator_free(iter);
+
+    if ((iter = hashtable_iterator(old)) == NULL)
+    {
+        return changes + 1;
+    }
+
+    while ((key = hashtable_next(iter)))
+    {
+        if (hashtable_fetch(hash, key) == NULL)
+        {
+            changes++;
+        }
+    }
+
+    hashtable_iterator_free(iter);
+    return changes;
+}
+
+/**
+ * The result of reading one shard
+ */
+typedef struct shared_map_shard
+{
+    SERVER    *server;
+    bool       read;   /*< Whether the shard was read */
+    MYSQL_RES *tables; /*< The tables of the shard if table sharding is enabled */
+} SHARED_MAP_SHARD;
+
+/**
+ * Rebuild the shared shard map from the databases of the running shards.
+ *
+ * The databases of a shard that could not be read are carried over from the
+ * current map and the new map is published only if it differs from the current
+ * one. If a database or a table is found on more than one server, the shared map
+ * is discarded and the sessions map the databases themselves which reports the
+ * conflict to the clients.
+ * @param router Router instance
+ */
+static void shared_map_refresh(ROUTER_INSTANCE* router)
+{
+    char *user;
+    char *password;
+
+    if (serviceGetUser(router->service, &user, &password) == 0)
+    {
+        return;
+    }
+
+    char *dpwd = decrypt_password(password);
+    shard_map_t *map = shard_map_alloc();
+    pcre2_match_data *match_data = NULL;
+
+    if (dpwd == NULL || map == NULL ||
+        (router->ignore_regex &&
+         (match_data = pcre2_match_data_create_from_pattern(router->ignore_regex, NULL)) == NULL))
+    {
+        MXS_FREE(dpwd);
+        shared_map_release(map);
+        return;
+    }
+
+    int n_refs = 0;
+
+    for (SERVER_REF *ref = router->service->dbref; ref; ref = ref->next)
+    {
+        n_refs++;
+    }
+
+    SHARED_MAP_SHARD shards[n_refs > 0 ? n_refs : 1];
+    shard_map_t *old = shared_map_acquire(router);
+    bool duplicate = false;
+    int n_tried = 0;
+    int n_read = 0;
+    int n_tables = 0;
+
+    for (SERVER_REF *ref = router->service->dbref; ref && n_tried < n_refs; ref = ref->next)
+    {
+        if (SERVER_REF_IS_ACTIVE(ref) && SERVER_IS_RUNNING(ref->server))
+        {
+            SHARED_MAP_SHARD *shard = &shards[n_tried++];
+            shard->server = ref->server;
+            shard->tables = NULL;
+            shard->read = shared_map_read_shard(router, ref->server, user, dpwd, map,
+                                                match_data, &duplicate, &shard->tables);
+
+            if (shard->read)
+            {
+                n_read++;
+                n_tables += shard->tables ? mysql_num_rows(shard->tables) : 0;
+            }
+            else if (old)
+            {
+                shared_map_copy_shard(router, old->hash, map->hash,
+                                      ref->server->unique_name, match_data);
+                n_tables += old->tables ? hashtable_size(old->tables) : 0;
+            }
+        }
+    }
+
+    if (router->schemarouter_config.table_sharding && n_read > 0 && !duplicate)
+    {
+        /** Sized by the number of tables so that a lookup takes constant time */
+        int size = n_tables > SCHEMAROUTER_HASHSIZE ? n_tables : SCHEMAROUTER_HASHSIZE;
+
+        if ((map->tables = hashtable_alloc(size, hashkeyfun, hashcmpfun)))
+        {
+            HASHCOPYFN kcopy = (HASHCOPYFN)strdup;
+            hashtable_memory_fns(map->tables, kcopy, kcopy, keyfreefun, keyfreefun);
+
+            for (int i = 0; i < n_tried; i++)
+            {
+                if (shards[i].tables)
+                {
+                    duplicate |= !shared_map_add_tables(router, map, shards[i].server->unique_name,
+                                                        shards[i].tables, match_data);
+                }
+                else if (!shards[i].read && old)
+                {
+                    shared_map_copy_shard(router, old->tables, map->tables,
+                                          shards[i].server->unique_name, match_data);
+                }
+            }
+        }
+        else
+        {
+            n_read = 0;
+        }
+    }
+
+    for (int i = 0; i < n_tried; i++)
+    {
+        if (shards[i].tables)
+        {
+            mysql_free_result(shards[i].tables);
+        }
+    }
+
+    if (n_tried > 0)
+    {
+        router->shared_map_refreshed = time(NULL);
+    }
+
+    if (duplicate)
+    {
+        MXS_ERROR("Sessions of service '%s' map the databases themselves until "
+                  "the databases are found on only one server.", router->service->name);
+        shared_map_publish(router, NULL);
+        shared_map_release(map);
+    }
+    else if (n_read == 0 ||
+             (old && shard_map_changes(old->hash, map->hash) == 0 &&
+              shard_map_changes(old->tables, map->tables) == 0))
+    {
+        shared_map_release(map);
+    }
+    else
+    {
+        map->state = SHMAP_READY;
+        map->last_updated = time(NULL);
+        MXS_INFO("Shared shard map of service '%s' rebuilt with %d databases and %d tables.",
+                 router->service->name, hashtable_size(map->hash),
+                 map->tables ? hashtable_size(map->tables) : 0);
+        shared_map_publish(router, map);
+        atomic_add(&router->stats.shmap_refreshes, 1);
+    }
+
+    shared_map_release(old);
+    pcre2_match_data_free(match_data);
+    MXS_FREE(dpwd);
+}
+
+/**
+ * Housekeeper task that refreshes the shared shard map when it has not been
+ * built, when a session could not find a database from it or when it is older
+ * than the refresh interval.
+ * @param data Router instance
+ */
+static void shared_map_check(void* data)
+{
+    ROUTER_INSTANCE* router = (ROUTER_INSTANCE*)data;
+
+    if (router->shared_map_refreshed == 0 || router->shared_map_refresh ||
+        difftime(time(NULL), router->shared_map_refreshed) >=
+        router->schemarouter_config.refresh_min_interval)
+    {
+        router->shared_map_refresh = false;
+        shared_map_refresh(router);
+    }
+}
+
 /**
  * Convert a length encoded string into a C string.
  * @param data Pointer to the first byte of the string
@@ -338,36 +856,15 @@ showdb_response_t parse_showdb_response(ROUTER_CLIENT_SES* rses, backend_ref_t*
 
         if (data)
         {
-            if (hashtable_add(rses->shardmap->hash, data, target))
+            if (!shard_map_add_db(rses->router, rses->shardmap->hash, data, target,
+                                  rses->router->ignore_match_data))
             {
-                MXS_INFO("<%s, %s>", target, data);
-            }
-            else
-            {
-                if (!(hashtable_fetch(rses->router->ignored_dbs, data) ||
-                      (rses->router->ignore_regex &&
-                       pcre2_match(rses->router->ignore_regex, (PCRE2_SPTR)data,
-                                   PCRE2_ZERO_TERMINATED, 0, 0,
-                                   rses->router->ignore_match_data, NULL) >= 0)))
-                {
-                    duplicate_found = true;
-                    MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s@%s.",
-                              data, target,
-                              (char*)hashtable_fetch(rses->shardmap->hash, data),
-                              rses->rses_client_dcb->user,
-                              rses->rses_client_dcb->remote);
-                }
-                else if (rses->router->preferred_server &&
-                         strcmp(target, rses->router->preferred_server->unique_name) == 0)
-                {
-                    /** In conflict situations, use the preferred server */
-                    MXS_INFO("Forcing location of '%s' from '%s' to ''%s",
-                             data, (char*)hashtable_fetch(rses->shardmap->hash,
-                                                          data), target);
-
-                    hashtable_delete(rses->shardmap->hash, data);
-                    hashtable_add(rses->shardmap->hash, data, target);
-                }
+                duplicate_found = true;
+                MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s@%s.",
+                          data, target,
+                          (char*)hashtable_fetch(rses->shardmap->hash, data),
+                          rses->rses_client_dcb->user,
+                          rses->rses_client_dcb->remote);
             }
             MXS_FREE(data);
         }
@@ -454,6 +951,25 @@ int gen_databaselist(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* session)
     return !rval;
 }
 
+/**
+ * Find the server of a table from the sharded tables.
+ * @param tables Sharded tables of the shard map
+ * @param table Table name, qualified with the database if it is not in the current one
+ * @param current_db Current database of the session
+ * @return Unique name of the server or NULL if the table is not sharded
+ */
+static char* get_table_shard_name(HASHTABLE* tables, const char* table, const char* current_db)
+{
+    if (strchr(table, '.'))
+    {
+        return (char*)hashtable_fetch(tables, (void*)table);
+    }
+
+    char key[strlen(current_db) + strlen(table) + 2];
+    sprintf(key, "%s.%s", current_db, table);
+    return (char*)hashtable_fetch(tables, key);
+}
+
 /**
  * Check the hashtable for the right backend for this query.
  * @param router Router instance
@@ -471,6 +987,9 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
     char* rval = NULL, *query, *tmp = NULL;
     bool has_dbs = false; /**If the query targets any database other than the current one*/
     bool uses_implicit_databases = false;
+    HASHTABLE* tables = client->shardmap->tables;
+    char* table_target = NULL;
+    bool table_conflict = false;
 
     dbnms = qc_get_table_names(buffer, &sz, true);
 
@@ -480,9 +999,31 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
         {
             uses_implicit_databases = true;
         }
+
+        if (tables && (tmp = get_table_shard_name(tables, dbnms[i], client->current_db)))
+        {
+            if (table_target && strcmp(table_target, tmp) != 0)
+            {
+                table_conflict = true;
+            }
+            table_target = tmp;
+        }
         MXS_FREE(dbnms[i]);
     }
     MXS_FREE(dbnms);
+    tmp = NULL;
+
+    if (table_target)
+    {
+        if (!table_conflict)
+        {
+            MXS_INFO("Query targets tables on server '%s'", table_target);
+            return table_target;
+        }
+
+        MXS_WARNING("Query targets tables on more than one server. Cross server "
+                    "queries are not supported. Routing query by the databases it uses.");
+    }
 
     HASHTABLE* ht = client->shardmap->hash;
 
@@ -670,6 +1211,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"disable_sescmd_history", MXS_MODULE_PARAM_BOOL, "false"},
             {"refresh_databases", MXS_MODULE_PARAM_BOOL, "true"},
             {"refresh_interval", MXS_MODULE_PARAM_COUNT, DEFAULT_REFRESH_INTERVAL},
+            {"shared_shard_map", MXS_MODULE_PARAM_BOOL, "true"},
+            {"table_sharding", MXS_MODULE_PARAM_BOOL, "false"},
+            {"scatter_union", MXS_MODULE_PARAM_BOOL, "true"},
             {"debug", MXS_MODULE_PARAM_BOOL, "false"},
             {"preferred_server", MXS_MODULE_PARAM_SERVER},
             {MXS_END_MODULE_PARAMS}
@@ -737,6 +1281,9 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
 
     router->schemarouter_config.refresh_databases = config_get_bool(conf, "refresh_databases");
     router->schemarouter_config.refresh_min_interval = config_get_integer(conf, "refresh_interval");
+    router->schemarouter_config.shared_shard_map = config_get_bool(conf, "shared_shard_map");
+    router->schemarouter_config.table_sharding = config_get_bool(conf, "table_sharding");
+    router->schemarouter_config.scatter_union = config_get_bool(conf, "scatter_union");
     router->schemarouter_config.max_sescmd_hist = config_get_integer(conf, "max_sescmd_history");
     router->schemarouter_config.disable_sescmd_hist = config_get_bool(conf, "disable_sescmd_history");
     router->schemarouter_config.debug = config_get_bool(conf, "debug");
@@ -854,6 +1401,12 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
         MXS_FREE(router);
         router = NULL;
     }
+    else if (router->schemarouter_config.shared_shard_map)
+    {
+        char name[strlen(service->name) + sizeof("Shard map of ")];
+        sprintf(name, "Shard map of %s", service->name);
+        hktask_add(name, shared_map_check, router, SHARED_MAP_CHECK_FREQ);
+    }
 
     return (MXS_ROUTER *)router;
 }
@@ -933,17 +1486,29 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
     client_rses->rses_mysql_session = (MYSQL_session*)session->client_dcb->data;
     client_rses->rses_client_dcb = (DCB*)session->client_dcb;
 
-    spinlock_acquire(&router->lock);
-
-    shard_map_t *map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
-    enum shard_map_state state;
+    shard_map_t *map = NULL;
+    enum shard_map_state state = SHMAP_UNINIT;
 
-    if (map)
+    if (router->schemarouter_config.shared_shard_map &&
+        (map = shared_map_acquire(router)))
     {
-        state = shard_map_update_state(map, router);
+        /** The shared map is always ready, it is refreshed in the background */
+        state = SHMAP_READY;
+        client_rses->shardmap_shared = true;
     }
+    else
+    {
+        spinlock_acquire(&router->lock);
 
-    spinlock_release(&router->lock);
+        map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
+
+        if (map)
+        {
+            state = shard_map_update_state(map, router);
+        }
+
+        spinlock_release(&router->lock);
+    }
 
     if (map == NULL || state != SHMAP_READY)
     {
@@ -991,6 +1556,7 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
 
     if (backend_ref == NULL)
     {
+        release_shard_map(client_rses);
         MXS_FREE(client_rses);
         return NULL;
     }
@@ -1040,6 +1606,7 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
      */
     if (!(succp = rses_begin_locked_router_action(client_rses)))
     {
+        release_shard_map(client_rses);
         MXS_FREE(client_rses->rses_backend_ref);
         MXS_FREE(client_rses);
         return NULL;
@@ -1053,6 +1620,7 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
 
     if (!succp || !(succp = rses_begin_locked_router_action(client_rses)))
     {
+        release_shard_map(client_rses);
         MXS_FREE(client_rses->rses_backend_ref);
         MXS_FREE(client_rses);
         return NULL;
@@ -1182,6 +1750,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
     for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
     {
         gwbuf_free(router_cli_ses->rses_backend_ref[i].bref_pending_cmd);
+        scatter_reply_reset(&router_cli_ses->rses_backend_ref[i].bref_scatter_reply);
     }
 
     /**
@@ -1205,6 +1774,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
      * all the memory and other resources associated
      * to the client session.
      */
+    release_shard_map(router_cli_ses);
     MXS_FREE(router_cli_ses->rses_backend_ref);
     MXS_FREE(router_cli_ses);
     return;
@@ -1630,6 +2200,213 @@ bool send_database_list(ROUTER_INSTANCE* router, ROUTER_CLIENT_SES* client)
     return rval;
 }
 
+/**
+ * Route a read-only UNION ALL whose branches use databases on different
+ * servers. Each server is sent the branches that use its databases and the
+ * replies are merged in clientReply once all of the servers have replied.
+ *
+ * @param inst     Router instance
+ * @param rses     Router client session
+ * @param querybuf The query
+ * @param qtype    Type of the query
+ *
+ * @return 1 if the query was routed, 0 if routing failed and -1 if the query
+ * is not scattered and should be routed normally
+ */
+static int route_scattered_query(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* rses,
+                                 GWBUF* querybuf, qc_query_type_t qtype)
+{
+    char* sql;
+    int len;
+    SCATTER_QUERY query;
+
+    if (!modutil_extract_SQL(querybuf, &sql, &len) || !scatter_parse_union(sql, len, &query))
+    {
+        return -1;
+    }
+
+    if (!rses_begin_locked_router_action(rses))
+    {
+        return 0;
+    }
+
+    backend_ref_t* targets[SCATTER_MAX_BRANCHES];
+    int branch_target[SCATTER_MAX_BRANCHES];
+    int n_targets = 0;
+    bool scatter = true;
+
+    spinlock_acquire(&rses->shardmap->lock);
+
+    for (int i = 0; i < query.n_branches && scatter; i++)
+    {
+        char branch[query.branch_len[i] + 1];
+        sprintf(branch, "%.*s", query.branch_len[i], query.branch[i]);
+        GWBUF* buf = modutil_create_query(branch);
+        char* tname = NULL;
+        DCB* dcb;
+
+        if (buf)
+        {
+            tname = get_shard_target_name(inst, rses, buf, qtype);
+            gwbuf_free(buf);
+        }
+
+        if (tname == NULL && rses->current_db[0] != '\0')
+        {
+            tname = hashtable_fetch(rses->shardmap->hash, rses->current_db);
+        }
+
+        if (tname && check_shard_status(inst, tname) && get_shard_dcb(&dcb, rses, tname))
+        {
+            backend_ref_t* bref = get_bref_from_dcb(rses, dcb);
+            int j = 0;
+
+            while (j < n_targets && targets[j] != bref)
+            {
+                j++;
+            }
+
+            if (j == n_targets)
+            {
+                targets[n_targets++] = bref;
+            }
+
+            branch_target[i] = j;
+        }
+        else
+        {
+            scatter = false;
+        }
+    }
+
+    spinlock_release(&rses->shardmap->lock);
+
+    for (int i = 0; i < n_targets && scatter; i++)
+    {
+        if (sescmd_cursor_is_active(&targets[i]->bref_sescmd_cur) ||
+            targets[i]->bref_pending_cmd || targets[i]->bref_scattered)
+        {
+            scatter = false;
+        }
+    }
+
+    if (!scatter || n_targets < 2)
+    {
+        rses_end_locked_router_action(rses);
+        return -1;
+    }
+
+    char stmt[len + query.n_branches * sizeof(" UNION ALL ") + SCATTER_MAX_COLUMN + 64];
+    int rval = 1;
+
+    for (int i = 0; i < n_targets && rval == 1; i++)
+    {
+        backend_ref_t* bref = targets[i];
+        int pos = 0;
+
+        for (int j = 0; j < query.n_branches; j++)
+        {
+            if (branch_target[j] == i)
+            {
+                pos += sprintf(stmt + pos, "%s%.*s", pos ? " UNION ALL " : "",
+                               query.branch_len[j], query.branch[j]);
+            }
+        }
+
+        scatter_order_to_sql(&query.order, stmt + pos, sizeof(stmt) - pos);
+        GWBUF* buf = modutil_create_query(stmt);
+
+        MXS_INFO("Scatter query to \t[%s]:%d <",
+                 bref->bref_backend->server->name,
+                 bref->bref_backend->server->port);
+
+        if (buf && bref->bref_dcb->func.write(bref->bref_dcb, buf) == 1)
+        {
+            scatter_reply_reset(&bref->bref_scatter_reply);
+            bref->bref_scattered = true;
+            bref_set_state(bref, BREF_QUERY_ACTIVE);
+            bref_set_state(bref, BREF_WAITING_RESULT);
+        }
+        else
+        {
+            MXS_ERROR("Routing scattered query to '%s' failed.",
+                      bref->bref_backend->server->unique_name);
+            rval = 0;
+        }
+    }
+
+    if (rval == 1)
+    {
+        rses->scatter_pending = n_targets;
+        rses->scatter_order = query.order;
+        rses->scatter_first = targets[0];
+        atomic_add(&inst->stats.n_scattered, 1);
+        atomic_add(&inst->stats.n_queries, 1);
+    }
+
+    rses_end_locked_router_action(rses);
+
+    return rval;
+}
+
+/**
+ * Collect a reply to a scattered query. Called with the router session locked.
+ *
+ * @param rses   Router client session
+ * @param bref   Backend that replied
+ * @param buffer The reply
+ *
+ * @return The merged reply once all the servers have replied, otherwise NULL
+ */
+static GWBUF* process_scattered_reply(ROUTER_CLIENT_SES* rses, backend_ref_t* bref, GWBUF* buffer)
+{
+    if (!scatter_reply_add(&bref->bref_scatter_reply, buffer))
+    {
+        return NULL;
+    }
+
+    bref->bref_scattered = false;
+    bref_clear_state(bref, BREF_QUERY_ACTIVE);
+    bref_clear_state(bref, BREF_WAITING_RESULT);
+
+    if (rses->scatter_failed)
+    {
+        scatter_reply_reset(&bref->bref_scatter_reply);
+        rses->scatter_failed = --rses->scatter_pending > 0;
+        return NULL;
+    }
+
+    if (--rses->scatter_pending > 0)
+    {
+        return NULL;
+    }
+
+    /** The first branch decides the column names of a union */
+    SCATTER_REPLY replies[rses->rses_nbackends];
+    int n = 1;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t* b = &rses->rses_backend_ref[i];
+
+        if (b->bref_scatter_reply.complete)
+        {
+            replies[b == rses->scatter_first ? 0 : n++] = b->bref_scatter_reply;
+            memset(&b->bref_scatter_reply, 0, sizeof(b->bref_scatter_reply));
+        }
+    }
+
+    GWBUF* rval = scatter_merge(replies, n, &rses->scatter_order);
+
+    if (rval == NULL)
+    {
+        rval = modutil_create_mysql_err_msg(1, 0, SCHEMA_ERR_SCATTER, SCHEMA_ERRSTR_SCATTER,
+                                            "Failed to merge the results of a scattered query.");
+    }
+
+    return rval;
+}
+
 /**
  * The main routing entry, this is called with every packet that is
  * received and has to be forwarded to the backend database.
@@ -1868,9 +2645,18 @@ static int routeQuery(MXS_ROUTER* instance,
                 difftime(now, router_cli_ses->rses_config.last_refresh) >
                 router_cli_ses->rses_config.refresh_min_interval)
             {
-                spinlock_acquire(&router_cli_ses->shardmap->lock);
-                router_cli_ses->shardmap->state = SHMAP_STALE;
-                spinlock_release(&router_cli_ses->shardmap->lock);
+                if (router_cli_ses->shardmap_shared)
+                {
+                    /** The shared map is never modified, have it rebuilt in the background */
+                    inst->shared_map_refresh = true;
+                    release_shard_map(router_cli_ses);
+                }
+                else
+                {
+                    spinlock_acquire(&router_cli_ses->shardmap->lock);
+                    router_cli_ses->shardmap->state = SHMAP_STALE;
+                    spinlock_release(&router_cli_ses->shardmap->lock);
+                }
 
                 rses_begin_locked_router_action(router_cli_ses);
 
@@ -1919,6 +2705,21 @@ static int routeQuery(MXS_ROUTER* instance,
         goto retblock;
     }
 
+    if (inst->schemarouter_config.scatter_union &&
+        packet_type == MYSQL_COM_QUERY &&
+        !router_cli_ses->rses_transaction_active &&
+        qc_query_is_type(qtype, QUERY_TYPE_READ) &&
+        !qc_query_is_type(qtype, QUERY_TYPE_WRITE))
+    {
+        int rc = route_scattered_query(inst, router_cli_ses, querybuf, qtype);
+
+        if (rc != -1)
+        {
+            ret = rc;
+            goto retblock;
+        }
+    }
+
     route_target = get_shard_route_target(qtype,
                                           router_cli_ses->rses_transaction_active,
                                           querybuf->hint);
@@ -2235,6 +3036,8 @@ static void diagnostic(MXS_ROUTER *instance, DCB *dcb)
                router->stats.longest_sescmd);
     dcb_printf(dcb, "Session command history limit exceeded: %d times\n",
                router->stats.n_hist_exceeded);
+    dcb_printf(dcb, "Scattered UNION ALL queries: %d\n",
+               router->stats.n_scattered);
     if (!router->schemarouter_config.disable_sescmd_hist)
     {
         dcb_printf(dcb, "Session command history: enabled\n");
@@ -2264,6 +3067,30 @@ static void diagnostic(MXS_ROUTER *instance, DCB *dcb)
     }
     dcb_printf(dcb, "Shard map cache hits: %d\n", router->stats.shmap_cache_hit);
     dcb_printf(dcb, "Shard map cache misses: %d\n", router->stats.shmap_cache_miss);
+
+    if (router->schemarouter_config.shared_shard_map)
+    {
+        shard_map_t *map = shared_map_acquire(router);
+
+        if (map)
+        {
+            dcb_printf(dcb, "Shared shard map databases: %d\n", hashtable_size(map->hash));
+
+            if (map->tables)
+            {
+                dcb_printf(dcb, "Shared shard map tables: %d\n", hashtable_size(map->tables));
+            }
+            dcb_printf(dcb, "Shared shard map age: %.0lf seconds\n",
+                       difftime(time(NULL), map->last_updated));
+            shared_map_release(map);
+        }
+        else
+        {
+            dcb_printf(dcb, "Shared shard map: not built\n");
+        }
+
+        dcb_printf(dcb, "Shared shard map rebuilds: %d\n", router->stats.shmap_refreshes);
+    }
     dcb_printf(dcb, "\n");
 }
 
@@ -2433,6 +3260,16 @@ static void clientReply(MXS_ROUTER* instance,
 
     CHK_BACKEND_REF(bref);
     scur = &bref->bref_sescmd_cur;
+
+    if (bref->bref_scattered && !sescmd_cursor_is_active(scur))
+    {
+        if ((writebuf = process_scattered_reply(router_cli_ses, bref, writebuf)) == NULL)
+        {
+            rses_end_locked_router_action(router_cli_ses);
+            return;
+        }
+    }
+
     /**
      * Active cursor means that reply is from session command
      * execution.
@@ -2442,7 +3279,8 @@ static void clientReply(MXS_ROUTER* instance,
         if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_ERR) &&
             MYSQL_IS_ERROR_PACKET(((uint8_t *) GWBUF_DATA(writebuf))))
         {
-            uint8_t* buf = (uint8_t *) GWBUF_DATA((scur->scmd_cur_cmd->my_sescmd_buf));
+            GWBUF* cmdbuf = mxs_sescmd_buffer(scur->scmd_cur_cmd->my_sescmd_cmd);
+            uint8_t* buf = (uint8_t *) GWBUF_DATA(cmdbuf);
             uint8_t* replybuf = (uint8_t *) GWBUF_DATA(writebuf);
             size_t len = MYSQL_GET_PAYLOAD_LEN(buf);
             size_t replylen = MYSQL_GET_PAYLOAD_LEN(replybuf);
@@ -2451,7 +3289,7 @@ static void clientReply(MXS_ROUTER* instance,
             char* replystr = strndup(&((char *) replybuf)[13],
                                      replylen - 4 - 5);
 
-            ss_dassert(len + 4 == GWBUF_LENGTH(scur->scmd_cur_cmd->my_sescmd_buf));
+            ss_dassert(len + 4 == GWBUF_LENGTH(cmdbuf));
 
             MXS_ERROR("Failed to execute %s in [%s]:%d. %s %s",
                       cmdstr,
@@ -2982,6 +3820,9 @@ static mysql_sescmd_t* rses_property_get_sescmd(rses_property_t* prop)
 
 /**
  * Create session command property.
+ *
+ * The command is interned, so the session holds only a reference to it.
+ * If interning fails, my_sescmd_cmd is NULL.
  */
 static mysql_sescmd_t* mysql_sescmd_init(rses_property_t*   rses_prop,
                                          GWBUF*             sescmd_buf,
@@ -2999,7 +3840,7 @@ static mysql_sescmd_t* mysql_sescmd_init(rses_property_t*   rses_prop,
     sescmd->my_sescmd_chk_tail = CHK_NUM_MY_SESCMD;
 #endif
     /** Set session command buffer */
-    sescmd->my_sescmd_buf  = sescmd_buf;
+    sescmd->my_sescmd_cmd  = mxs_sescmd_intern(sescmd_buf);
     sescmd->my_sescmd_packet_type = packet_type;
     sescmd->position = atomic_add(&rses->pos_generator, 1);
     return sescmd;
@@ -3008,7 +3849,7 @@ static mysql_sescmd_t* mysql_sescmd_init(rses_property_t*   rses_prop,
 static void mysql_sescmd_done(mysql_sescmd_t* sescmd)
 {
     CHK_RSES_PROP(sescmd->my_sescmd_prop);
-    gwbuf_free(sescmd->my_sescmd_buf);
+    mxs_sescmd_release(sescmd->my_sescmd_cmd);
     memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
 
@@ -3142,7 +3983,7 @@ static GWBUF* sescmd_cursor_clone_querybuf(sescmd_cursor_t* scur)
     GWBUF* buf;
     ss_dassert(scur->scmd_cur_cmd != NULL);
 
-    buf = gwbuf_clone(scur->scmd_cur_cmd->my_sescmd_buf);
+    buf = gwbuf_clone(mxs_sescmd_buffer(scur->scmd_cur_cmd->my_sescmd_cmd));
 
     CHK_GWBUF(buf);
     return buf;
@@ -3252,8 +4093,6 @@ static bool execute_sescmd_in_backend(backend_ref_t* backend_ref)
     switch (scur->scmd_cur_cmd->my_sescmd_packet_type)
     {
     case MYSQL_COM_CHANGE_USER:
-        /** This makes it possible to handle replies correctly */
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         rc = dcb->func.auth(dcb,
                             NULL,
                             dcb->session,
@@ -3262,11 +4101,6 @@ static bool execute_sescmd_in_backend(backend_ref_t* backend_ref)
 
     case MYSQL_COM_QUERY:
     default:
-        /**
-         * Mark session command buffer, it triggers writing
-         * MySQL command to protocol
-         */
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         rc = dcb->func.write(dcb, sescmd_cursor_clone_querybuf(scur));
         break;
     }
@@ -3387,6 +4221,7 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_cli_ses,
 {
     bool succp = false;
     rses_property_t* prop;
+    mysql_sescmd_t* sescmd;
     backend_ref_t* backend_ref;
     int i;
 
@@ -3513,7 +4348,15 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_cli_ses,
      * are cleaned up as a part of router session clean-up.
      */
     prop = rses_property_init(RSES_PROP_TYPE_SESCMD);
-    mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    sescmd = mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+
+    if (sescmd->my_sescmd_cmd == NULL)
+    {
+        MXS_ERROR("Failed to store session command.");
+        rses_property_done(prop);
+        succp = false;
+        goto return_unlock;
+    }
 
     /** Add sescmd property to router client session */
     rses_property_add(router_cli_ses, prop);
@@ -3575,6 +4418,7 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_cli_ses,
             succp = false;
         }
     }
+return_unlock:
     /** Unlock router session */
     rses_end_locked_router_action(router_cli_ses);
 
@@ -3779,6 +4623,31 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
         client_dcb->func.write(client_dcb, gwbuf_clone(errmsg));
         bref_clear_state(bref, BREF_WAITING_RESULT);
     }
+
+    /**
+     * The client got the error instead of the reply to a scattered query,
+     * the replies of the other servers are discarded.
+     */
+    if (bref->bref_scattered)
+    {
+        bref->bref_scattered = false;
+        scatter_reply_reset(&bref->bref_scatter_reply);
+        rses->scatter_pending--;
+        rses->scatter_failed = true;
+
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            if (rses->rses_backend_ref[i].bref_scatter_reply.complete)
+            {
+                scatter_reply_reset(&rses->rses_backend_ref[i].bref_scatter_reply);
+            }
+        }
+
+        if (rses->scatter_pending == 0)
+        {
+            rses->scatter_failed = false;
+        }
+    }
     bref_clear_state(bref, BREF_IN_USE);
     bref_set_state(bref, BREF_CLOSED);
 
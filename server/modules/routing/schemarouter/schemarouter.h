@@ -32,6 +32,8 @@
 #include <maxscale/hashtable.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/sescmd.h>
+#include "scatter.h"
 
 MXS_BEGIN_DECLS
 
@@ -64,7 +66,9 @@ enum shard_map_state
 };
 
 /**
- * A map of the shards tied to a single user.
+ * A map of the shards tied to a single user or, if shared, to the whole router
+ * instance. A shared map is never modified once it is published, the sessions
+ * hold a reference to it and the last one to release it frees it.
  */
 typedef struct shard_map
 {
@@ -73,6 +77,9 @@ typedef struct shard_map
     SPINLOCK lock;
     time_t last_updated;
     enum shard_map_state state; /*< State of the shard map */
+    int refcount; /*< References to a shared map, including the router's own */
+    HASHTABLE *tables; /*< Tables of the sharded databases hashed by the fully
+                         * qualified name, NULL if tables are not sharded */
 } shard_map_t;
 
 /**
@@ -98,6 +105,8 @@ typedef enum bref_state
 #define SCHEMA_ERRSTR_DUPLICATEDB "DUPDB"
 #define SCHEMA_ERR_DBNOTFOUND 1049
 #define SCHEMA_ERRSTR_DBNOTFOUND "42000"
+#define SCHEMA_ERR_SCATTER 1815
+#define SCHEMA_ERRSTR_SCATTER "HY000"
 /**
  * The type of the backend server
  */
@@ -171,7 +180,7 @@ typedef struct mysql_sescmd_st
     skygw_chk_t        my_sescmd_chk_top;
 #endif
     rses_property_t*   my_sescmd_prop;       /*< Parent property */
-    GWBUF*             my_sescmd_buf;        /*< Query buffer */
+    MXS_SESCMD*        my_sescmd_cmd;        /*< Interned query buffer */
     unsigned char      my_sescmd_packet_type;/*< Packet type */
     bool               my_sescmd_is_replied; /*< Is cmd replied to client */
     int      position; /*< Position of this command */
@@ -271,6 +280,8 @@ typedef struct backend_ref_st
     int             bref_num_result_wait; /*< Number of not yet received results */
     sescmd_cursor_t bref_sescmd_cur; /*< Session command cursor */
     GWBUF*          bref_pending_cmd; /*< For stmt which can't be routed due active sescmd execution */
+    bool            bref_scattered; /*< Waiting for the reply to a scattered query */
+    SCATTER_REPLY   bref_scatter_reply; /*< The reply to the scattered query */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -289,6 +300,9 @@ typedef struct schemarouter_config_st
     time_t last_refresh; /*< Last time the database list was refreshed */
     double refresh_min_interval; /*< Minimum required interval between refreshes of databases */
     bool refresh_databases; /*< Are databases refreshed when they are not found in the hashtable */
+    bool shared_shard_map; /*< Are the databases mapped once for all sessions in the background */
+    bool table_sharding; /*< Are tables of one database spread across servers */
+    bool scatter_union; /*< Are UNION ALL queries over several servers scattered */
     bool debug; /*< Enable verbose debug messages to clients */
 } schemarouter_config_t;
 
@@ -308,6 +322,8 @@ typedef struct
     double          ses_average; /*< Average session length */
     int             shmap_cache_hit; /*< Shard map was found from the cache */
     int             shmap_cache_miss;/*< No shard map found from the cache */
+    int             shmap_refreshes; /*< Number of times the shared shard map was rebuilt */
+    int             n_scattered; /*< Number of queries scattered to several servers */
 } ROUTER_STATS;
 
 /**
@@ -335,10 +351,15 @@ struct router_client_session
     struct router_client_session* next; /*< List of router sessions */
     shard_map_t*
     shardmap; /*< Database hash containing names of the databases mapped to the servers that contain them */
+    bool            shardmap_shared; /*< Is shardmap a reference to the shared shard map */
     char            connect_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Database the user was trying to connect to */
     char            current_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Current active database */
     init_mask_t    init; /*< Initialization state bitmask */
     GWBUF*          queue; /*< Query that was received before the session was ready */
+    int             scatter_pending; /*< Servers yet to reply to a scattered query */
+    bool            scatter_failed; /*< A server failed, the replies are discarded */
+    SCATTER_ORDER   scatter_order; /*< Order and limit of the scattered query */
+    backend_ref_t*  scatter_first; /*< Server of the first branch, its column names are used */
     DCB*            dcb_route; /*< Internal DCB used to trigger re-routing of buffers */
     DCB*            dcb_reply; /*< Internal DCB used to send replies to the client */
     ROUTER_STATS    stats;     /*< Statistics for this router         */
@@ -356,6 +377,9 @@ struct router_client_session
 typedef struct router_instance
 {
     HASHTABLE*              shard_maps;  /*< Shard maps hashed by user name */
+    shard_map_t*            shared_map;  /*< Shard map of all sessions, NULL if not yet built */
+    time_t                  shared_map_refreshed; /*< When the shared map was last refreshed */
+    bool                    shared_map_refresh; /*< Refresh the shared map at the next check */
     SERVICE*                service;     /*< Pointer to service                 */
     ROUTER_CLIENT_SES*      connections; /*< List of client connections         */
     SPINLOCK                lock;        /*< Lock for the instance data         */